@@ -0,0 +1,702 @@
+#include "../uwsgi.h"
+#include <ucontext.h>
+
+/*
+
+	microbenchmarks for the core primitives
+
+	./bench_core [filter] [--json]
+
+	every benchmark runs for ~BENCH_TIME nanoseconds and reports the ns/op,
+	use the filter (a substring of the benchmark name) to run only a subset
+
+*/
+
+extern struct uwsgi_server uwsgi;
+
+#define BENCH_TIME 300000000ULL
+#define BENCH_BATCH 1024
+
+static char *bench_filter;
+static int bench_json;
+
+static uint64_t bench_nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static time_t bench_clock_seconds(void) {
+	return time(NULL);
+}
+
+static uint64_t bench_clock_microseconds(void) {
+	return bench_nanos() / 1000;
+}
+
+static struct uwsgi_clock bench_clock = {
+	.name = "bench",
+	.seconds = bench_clock_seconds,
+	.microseconds = bench_clock_microseconds,
+};
+
+static int bench_enabled(char *name) {
+	if (!bench_filter) return 1;
+	return strstr(name, bench_filter) != NULL;
+}
+
+static void bench_report(char *name, uint64_t ops, uint64_t elapsed) {
+	double ns = ops ? (double) elapsed / ops : 0;
+	if (bench_json) {
+		printf("{\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}\n", name, (unsigned long long) ops, ns, ns > 0 ? 1000000000.0 / ns : 0);
+	}
+	else {
+		printf("%-48s %12llu ops %10.2f ns/op\n", name, (unsigned long long) ops, ns);
+	}
+	fflush(stdout);
+}
+
+// run func in batches until BENCH_TIME is elapsed
+static void bench_run(char *name, void (*func)(void *, uint64_t), void *data) {
+	if (!bench_enabled(name)) return;
+	uint64_t ops = 0;
+	uint64_t start = bench_nanos();
+	uint64_t now = start;
+	while (now - start < BENCH_TIME) {
+		func(data, BENCH_BATCH);
+		ops += BENCH_BATCH;
+		now = bench_nanos();
+	}
+	bench_report(name, ops, now - start);
+}
+
+struct bench_threads {
+	void (*func)(void *, uint64_t);
+	void *data;
+	volatile int go;
+	volatile int stop;
+	uint64_t ops[64];
+	int id;
+	pthread_mutex_t mutex;
+};
+
+static void *bench_thread(void *arg) {
+	struct bench_threads *bt = (struct bench_threads *) arg;
+	pthread_mutex_lock(&bt->mutex);
+	int id = bt->id++;
+	pthread_mutex_unlock(&bt->mutex);
+	while (!bt->go);
+	while (!bt->stop) {
+		bt->func(bt->data, BENCH_BATCH);
+		bt->ops[id] += BENCH_BATCH;
+	}
+	return NULL;
+}
+
+// same as bench_run but with n concurrent threads (the reported ns/op is the aggregated throughput)
+static void bench_run_threads(char *name, int n, void (*func)(void *, uint64_t), void *data) {
+	char *num = uwsgi_num2str(n);
+	char *full_name = uwsgi_concat3(name, " threads=", num);
+	free(num);
+	if (!bench_enabled(full_name)) goto end;
+	struct bench_threads bt;
+	pthread_t threads[64];
+	int i;
+	memset(&bt, 0, sizeof(struct bench_threads));
+	pthread_mutex_init(&bt.mutex, NULL);
+	bt.func = func;
+	bt.data = data;
+	if (n > 64) n = 64;
+	for (i = 0; i < n; i++) {
+		pthread_create(&threads[i], NULL, bench_thread, &bt);
+	}
+	uint64_t start = bench_nanos();
+	bt.go = 1;
+	usleep(BENCH_TIME / 1000);
+	bt.stop = 1;
+	uint64_t elapsed = bench_nanos() - start;
+	uint64_t ops = 0;
+	for (i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		ops += bt.ops[i];
+	}
+	bench_report(full_name, ops, elapsed);
+end:
+	free(full_name);
+}
+
+/* uwsgi_buffer */
+
+static void bench_buffer_append(void *data, uint64_t n) {
+	struct uwsgi_buffer *ub = (struct uwsgi_buffer *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		if (ub->pos > 60000) ub->pos = 0;
+		uwsgi_buffer_append(ub, "0123456789abcdef", 16);
+	}
+}
+
+static void bench_buffer_keyval(void *data, uint64_t n) {
+	struct uwsgi_buffer *ub = (struct uwsgi_buffer *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		if (ub->pos > 60000) ub->pos = 0;
+		uwsgi_buffer_append_keyval(ub, "HTTP_USER_AGENT", 15, "Mozilla/5.0 (X11; Linux x86_64)", 31);
+	}
+}
+
+static void bench_buffer_grow(void *data, uint64_t n) {
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		struct uwsgi_buffer *ub = uwsgi_buffer_new(64);
+		int j;
+		for (j = 0; j < 64; j++)
+			uwsgi_buffer_append(ub, "0123456789abcdef", 16);
+		uwsgi_buffer_destroy(ub);
+	}
+}
+
+static void bench_buffer_short_lived(void *data, uint64_t n) {
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+		uwsgi_buffer_append_keyval(ub, "HTTP_USER_AGENT", 15, "Mozilla/5.0 (X11; Linux x86_64)", 31);
+		uwsgi_buffer_destroy(ub);
+	}
+}
+
+static void bench_buffer_json(void *data, uint64_t n) {
+	struct uwsgi_buffer *ub = (struct uwsgi_buffer *) data;
+	char *msg = "[pid: 1234|app: 0|req: 1/1] 127.0.0.1 () {34 vars in 612 bytes} [Thu Jan  1 00:00:00 1970] GET /foo/bar?a=1 => generated 11 bytes in 0 msecs (HTTP/1.1 200) 2 headers in 79 bytes (1 switches on core 0) \"Mozilla/5.0\"\n";
+	size_t len = strlen(msg);
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		ub->pos = 0;
+		uwsgi_buffer_append_json(ub, msg, len);
+	}
+}
+
+static void bench_stats(void *data, uint64_t n) {
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		struct uwsgi_stats *us = uwsgi_stats_new(8192);
+		int j;
+		uwsgi_stats_key(us, "workers");
+		uwsgi_stats_list_open(us);
+		for (j = 0; j < 16; j++) {
+			if (j) uwsgi_stats_comma(us);
+			uwsgi_stats_object_open(us);
+			uwsgi_stats_keylong_comma(us, "id", j + 1);
+			uwsgi_stats_keylong_comma(us, "pid", 10000 + j);
+			uwsgi_stats_keylong_comma(us, "requests", 123456789);
+			uwsgi_stats_keylong_comma(us, "exceptions", 0);
+			uwsgi_stats_keyval_comma(us, "status", "idle");
+			uwsgi_stats_keyslong_comma(us, "rss", -1);
+			uwsgi_stats_keylong(us, "avg_rt", 4321);
+			uwsgi_stats_object_close(us);
+		}
+		uwsgi_stats_list_close(us);
+		uwsgi_stats_object_close(us);
+		free(us->base);
+		free(us);
+	}
+}
+
+/* uwsgi_parse_vars */
+
+struct bench_request {
+	struct wsgi_request *wsgi_req;
+	char *buffer;
+	struct iovec *hvec;
+	uint16_t len;
+};
+
+static void bench_request_build(struct bench_request *br) {
+	char *vars[] = {
+		"REQUEST_METHOD", "GET",
+		"REQUEST_URI", "/articles/42?page=1&sort=asc",
+		"PATH_INFO", "/articles/42",
+		"QUERY_STRING", "page=1&sort=asc",
+		"SERVER_PROTOCOL", "HTTP/1.1",
+		"REQUEST_SCHEME", "http",
+		"REMOTE_ADDR", "10.0.0.1",
+		"REMOTE_PORT", "51234",
+		"SERVER_PORT", "80",
+		"SERVER_NAME", "example.com",
+		"HTTP_HOST", "example.com",
+		"HTTP_USER_AGENT", "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0",
+		"HTTP_ACCEPT", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+		"HTTP_ACCEPT_LANGUAGE", "en-US,en;q=0.5",
+		"HTTP_ACCEPT_ENCODING", "gzip, deflate, br",
+		"HTTP_COOKIE", "sessionid=0123456789abcdef; csrftoken=fedcba9876543210",
+		"HTTP_CONNECTION", "keep-alive",
+		NULL,
+	};
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(4096);
+	int i;
+	for (i = 0; vars[i]; i += 2) {
+		uwsgi_buffer_append_keyval(ub, vars[i], strlen(vars[i]), vars[i + 1], strlen(vars[i + 1]));
+	}
+	br->wsgi_req = uwsgi_calloc(sizeof(struct wsgi_request));
+	// the first 4 bytes are for the uwsgi header (as in the cores buffers)
+	br->buffer = uwsgi_malloc(uwsgi.buffer_size + 4) + 4;
+	memcpy(br->buffer, ub->buf, ub->pos);
+	br->len = ub->pos;
+	br->hvec = uwsgi_malloc(sizeof(struct iovec) * uwsgi.vec_size);
+	uwsgi_buffer_destroy(ub);
+}
+
+static void bench_request_reset(struct bench_request *br) {
+	struct wsgi_request *wsgi_req = br->wsgi_req;
+	// the same reset done at the end of every request
+	memset(wsgi_req, 0, sizeof(struct wsgi_request));
+	wsgi_req->buffer = br->buffer;
+	wsgi_req->hvec = br->hvec;
+	wsgi_req->len = br->len;
+	wsgi_req->uh = (struct uwsgi_header *) (br->buffer - 4);
+}
+
+static void bench_parse_vars(void *data, uint64_t n) {
+	struct bench_request *br = (struct bench_request *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		bench_request_reset(br);
+		if (uwsgi_parse_vars(br->wsgi_req)) {
+			uwsgi_log("unable to parse the benchmark request\n");
+			exit(1);
+		}
+	}
+}
+
+/* hash algorithms */
+
+struct bench_hash {
+	struct uwsgi_hash_algo *uha;
+	char *key;
+	uint64_t keylen;
+};
+
+static void bench_hash(void *data, uint64_t n) {
+	struct bench_hash *bh = (struct bench_hash *) data;
+	uint64_t i;
+	uint32_t sum = 0;
+	for (i = 0; i < n; i++) {
+		bh->key[0] = i;
+		sum += bh->uha->func(bh->key, bh->keylen);
+	}
+	// avoid the loop to be optimized away
+	bh->key[1] = sum;
+}
+
+/* cache */
+
+struct bench_cache {
+	struct uwsgi_cache *uc;
+	uint64_t keys;
+	uint64_t seed;
+};
+
+static uint64_t bench_cache_key(struct bench_cache *bc, char *key) {
+	// xorshift, every thread has its own sequence
+	bc->seed ^= bc->seed << 13;
+	bc->seed ^= bc->seed >> 7;
+	bc->seed ^= bc->seed << 17;
+	return snprintf(key, 32, "key%llu", (unsigned long long) (bc->seed % bc->keys));
+}
+
+static void bench_cache_get(void *data, uint64_t n) {
+	struct bench_cache bc = *((struct bench_cache *) data);
+	bc.seed += (uint64_t) pthread_self();
+	char key[32];
+	uint64_t i, vallen;
+	for (i = 0; i < n; i++) {
+		uint64_t keylen = bench_cache_key(&bc, key);
+		uwsgi_rlock(bc.uc->lock);
+		uwsgi_cache_get2(bc.uc, key, keylen, &vallen);
+		uwsgi_rwunlock(bc.uc->lock);
+	}
+}
+
+static void bench_cache_set(void *data, uint64_t n) {
+	struct bench_cache bc = *((struct bench_cache *) data);
+	bc.seed += (uint64_t) pthread_self();
+	char key[32];
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		uint64_t keylen = bench_cache_key(&bc, key);
+		uwsgi_wlock(bc.uc->lock);
+		uwsgi_cache_set2(bc.uc, key, keylen, "0123456789abcdef0123456789abcdef", 32, 0, UWSGI_CACHE_FLAG_UPDATE);
+		uwsgi_rwunlock(bc.uc->lock);
+	}
+}
+
+static void bench_cache_mixed(void *data, uint64_t n) {
+	// 90% reads, 10% writes
+	uint64_t i;
+	for (i = 0; i < n; i += 10) {
+		bench_cache_get(data, 9);
+		bench_cache_set(data, 1);
+	}
+}
+
+static void bench_caches(void) {
+	char *layouts[] = { "", ",open_addressing=1", NULL };
+	int load_factors[] = { 25, 50, 90 };
+	int i, j, t;
+	uint64_t items = 10000;
+	for (i = 0; layouts[i]; i++) {
+		for (j = 0; j < 3; j++) {
+			char arg[256];
+			snprintf(arg, 256, "name=bench%d_%d,items=%llu,blocksize=64,keysize=32%s", i, j, (unsigned long long) items, layouts[i]);
+			struct uwsgi_cache *uc = uwsgi_cache_create(arg);
+			// fill the cache up to the load factor
+			uint64_t k, fill = (items * load_factors[j]) / 100;
+			for (k = 0; k < fill; k++) {
+				char key[32];
+				int keylen = snprintf(key, 32, "key%llu", (unsigned long long) k);
+				uwsgi_wlock(uc->lock);
+				uwsgi_cache_set2(uc, key, keylen, "0123456789abcdef0123456789abcdef", 32, 0, 0);
+				uwsgi_rwunlock(uc->lock);
+			}
+			struct bench_cache bc;
+			bc.uc = uc;
+			bc.keys = fill;
+			bc.seed = 88172645463325252ULL;
+			char *layout = i ? "open-addressing" : "chained";
+			char *lf = uwsgi_num2str(load_factors[j]);
+			char *prefix = uwsgi_concat4("cache ", layout, " load=", lf);
+			char *get_name = uwsgi_concat2(prefix, "% get");
+			char *set_name = uwsgi_concat2(prefix, "% set");
+			char *mixed_name = uwsgi_concat2(prefix, "% 90/10");
+			bench_run(get_name, bench_cache_get, &bc);
+			bench_run(set_name, bench_cache_set, &bc);
+			for (t = 1; t <= 8; t *= 2) {
+				bench_run_threads(mixed_name, t, bench_cache_mixed, &bc);
+			}
+			free(lf);
+			free(prefix);
+			free(get_name);
+			free(set_name);
+			free(mixed_name);
+		}
+	}
+}
+
+/* lock engines */
+
+static void bench_lock(void *data, uint64_t n) {
+	struct uwsgi_lock_item *uli = (struct uwsgi_lock_item *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		uwsgi_lock(uli);
+		uwsgi_unlock(uli);
+	}
+}
+
+static void bench_rlock(void *data, uint64_t n) {
+	struct uwsgi_lock_item *uli = (struct uwsgi_lock_item *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		uwsgi_rlock(uli);
+		uwsgi_rwunlock(uli);
+	}
+}
+
+static void bench_locks(void) {
+	// ipcsem is the last one as the lock list is cleared at exit
+	char *engines[] = { NULL,
+#ifdef __linux__
+		"futex", "futex-rb",
+#endif
+		"ipcsem", NULL
+	};
+	int i, t;
+	for (i = 0; i == 0 || engines[i]; i++) {
+		char *engine = engines[i] ? engines[i] : "default";
+		char *lock_name = uwsgi_concat3("lock ", engine, " lock/unlock");
+		char *rlock_name = uwsgi_concat3("lock ", engine, " rlock/unlock");
+		uwsgi.locking_setup = 0;
+		uwsgi.registered_locks = NULL;
+		uwsgi.lock_engine = engines[i];
+		uwsgi_setup_locking();
+		struct uwsgi_lock_item *uli = uwsgi_lock_init("bench");
+		struct uwsgi_lock_item *rwli = uwsgi_rwlock_init("bench_rw");
+		bench_run(lock_name, bench_lock, uli);
+		bench_run(rlock_name, bench_rlock, rwli);
+		for (t = 2; t <= 8; t *= 2) {
+			bench_run_threads(lock_name, t, bench_lock, uli);
+			bench_run_threads(rlock_name, t, bench_rlock, rwli);
+		}
+		free(lock_name);
+		free(rlock_name);
+	}
+}
+
+/* rb_timers */
+
+struct bench_rbtimers {
+	struct uwsgi_rbtree *tree;
+	struct uwsgi_rb_timer **timers;
+	uint64_t count;
+	uint64_t pos;
+};
+
+static void bench_rbtimers_churn(void *data, uint64_t n) {
+	struct bench_rbtimers *br = (struct bench_rbtimers *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		// re-arm a timer (the most common operation on the event loops)
+		uint64_t pos = br->pos++ % br->count;
+		uint64_t value = br->timers[pos]->value + br->count;
+		uwsgi_del_rb_timer(br->tree, br->timers[pos]);
+		free(br->timers[pos]);
+		br->timers[pos] = uwsgi_add_rb_timer(br->tree, value, NULL);
+	}
+}
+
+static void bench_rbtimers_min(void *data, uint64_t n) {
+	struct bench_rbtimers *br = (struct bench_rbtimers *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		if (!uwsgi_min_rb_timer(br->tree, NULL)) {
+			uwsgi_log("empty rb_timer tree\n");
+			exit(1);
+		}
+	}
+}
+
+static void bench_rbtimers(void) {
+	uint64_t sizes[] = { 16, 1024, 65536, 0 };
+	int i;
+	for (i = 0; sizes[i]; i++) {
+		struct bench_rbtimers br;
+		uint64_t j;
+		br.tree = uwsgi_init_rb_timer();
+		br.count = sizes[i];
+		br.pos = 0;
+		br.timers = uwsgi_malloc(sizeof(struct uwsgi_rb_timer *) * br.count);
+		for (j = 0; j < br.count; j++) {
+			br.timers[j] = uwsgi_add_rb_timer(br.tree, j, NULL);
+		}
+		char *num = uwsgi_64bit2str(br.count);
+		char *churn_name = uwsgi_concat3("rb_timers re-arm timers=", num, "");
+		char *min_name = uwsgi_concat3("rb_timers min timers=", num, "");
+		bench_run(churn_name, bench_rbtimers_churn, &br);
+		bench_run(min_name, bench_rbtimers_min, &br);
+		free(num);
+		free(churn_name);
+		free(min_name);
+		for (j = 0; j < br.count; j++) {
+			uwsgi_del_rb_timer(br.tree, br.timers[j]);
+			free(br.timers[j]);
+		}
+		free(br.timers);
+		free(br.tree);
+	}
+}
+
+/* metrics indexes */
+
+#define BENCH_METRICS 4096
+
+static void bench_metrics_name(void *data, uint64_t n) {
+	char **names = (char **) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		if (!uwsgi_metric_find_by_name(names[i % BENCH_METRICS])) exit(1);
+	}
+}
+
+static void bench_metrics_walk(void *data, uint64_t n) {
+	struct uwsgi_metric *um = NULL;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		um = um ? uwsgi_metric_find_next_by_asn(um->asn, um->asn_len) : uwsgi_metric_find_next_by_asn(NULL, 0);
+	}
+}
+
+static void bench_metrics(void) {
+	char **names = uwsgi_malloc(sizeof(char *) * BENCH_METRICS);
+	char oid[64];
+	int i;
+	uwsgi.has_metrics = 1;
+	for (i = 0; i < BENCH_METRICS; i++) {
+		names[i] = uwsgi_malloc(64);
+		snprintf(names[i], 64, "bench.custom.%d", i);
+		snprintf(oid, 64, "100.%d.%d", i % 64, i);
+		uwsgi_register_metric(names[i], oid, UWSGI_METRIC_COUNTER, NULL, NULL, 0, NULL);
+	}
+	bench_run("metrics find_by_name 4096 metrics", bench_metrics_name, names);
+	bench_run("metrics snmp walk 4096 metrics", bench_metrics_walk, NULL);
+	uwsgi.has_metrics = 0;
+}
+
+/* log formatter */
+
+static void bench_logformat(void *data, uint64_t n) {
+	struct bench_request *br = (struct bench_request *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		uwsgi.logit(br->wsgi_req);
+	}
+}
+
+static void bench_logformats(struct bench_request *br) {
+	char *formats[] = {
+		"%(addr) - %(user) [%(ltime)] \"%(method) %(uri) %(proto)\" %(status) %(size) \"%(referer)\" \"%(uagent)\"",
+		"%(method) %(uri) %(status) %(micros) %(var.HTTP_HOST)",
+		NULL,
+	};
+	int i, j;
+	if (!bench_enabled("logformat")) return;
+	uwsgi.req_log_fd = open("/dev/null", O_WRONLY);
+	if (uwsgi.req_log_fd < 0) {
+		uwsgi_error_open("/dev/null");
+		exit(1);
+	}
+	bench_request_reset(br);
+	uwsgi_parse_vars(br->wsgi_req);
+	br->wsgi_req->status = 200;
+	br->wsgi_req->response_size = 1234;
+	br->wsgi_req->end_of_request = br->wsgi_req->start_of_request + 1500;
+	for (i = 0; formats[i]; i++) {
+		uwsgi.logchunks = NULL;
+		uwsgi.logformat_vectors = 0;
+		uwsgi.logformat_buffer_size = 0;
+		uwsgi.logbuffers = NULL;
+		uwsgi_build_log_format(formats[i]);
+		uwsgi.logit = uwsgi_logit_lf;
+		uwsgi.logvectors = uwsgi_malloc(sizeof(struct iovec *) * uwsgi.cores);
+		for (j = 0; j < uwsgi.cores; j++) {
+			uwsgi.logvectors[j] = uwsgi_malloc(sizeof(struct iovec) * uwsgi.logformat_vectors);
+			uwsgi.logvectors[j][uwsgi.logformat_vectors - 1].iov_base = "\n";
+			uwsgi.logvectors[j][uwsgi.logformat_vectors - 1].iov_len = 1;
+		}
+		if (uwsgi.logformat_buffer_size) {
+			uwsgi.logbuffers = uwsgi_malloc(sizeof(char *) * uwsgi.cores);
+			for (j = 0; j < uwsgi.cores; j++) {
+				uwsgi.logbuffers[j] = uwsgi_malloc(uwsgi.logformat_buffer_size);
+			}
+		}
+		char *name = uwsgi_concat2("logformat ", formats[i]);
+		bench_run(name, bench_logformat, br);
+		free(name);
+	}
+	close(uwsgi.req_log_fd);
+	uwsgi.req_log_fd = 2;
+}
+
+/* coroutine stacks (compare with tests/bench/switch.py for greenlet/gevent) */
+
+static ucontext_t bench_main_ctx, bench_coro_ctx;
+
+static void bench_coro(void) {
+	for (;;) {
+		swapcontext(&bench_coro_ctx, &bench_main_ctx);
+	}
+}
+
+// a switch to the coroutine and back (the same round trip of a ugreen suspend)
+static void bench_switch(void *data, uint64_t n) {
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		swapcontext(&bench_main_ctx, &bench_coro_ctx);
+	}
+}
+
+static void bench_stack_recycle(void *data, uint64_t n) {
+	struct uwsgi_stack_pool *usp = (struct uwsgi_stack_pool *) data;
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		struct uwsgi_stack *us = uwsgi_stack_get(usp);
+		if (!us) exit(1);
+		// the request touches the top of the stack
+		us->sp[us->size - 1] = 1;
+		uwsgi_stack_put(usp, us);
+	}
+}
+
+static void bench_stacks(void) {
+	struct uwsgi_stack_pool *usp = uwsgi_stack_pool_new(256 * 1024, 64, 0);
+	struct uwsgi_stack *us = uwsgi_stack_get(usp);
+	getcontext(&bench_coro_ctx);
+	bench_coro_ctx.uc_stack.ss_sp = us->sp;
+	bench_coro_ctx.uc_stack.ss_size = us->size;
+	bench_coro_ctx.uc_link = &bench_main_ctx;
+	makecontext(&bench_coro_ctx, bench_coro, 0);
+	bench_run("ucontext switch round trip", bench_switch, NULL);
+	bench_run("stack pool get/put", bench_stack_recycle, usp);
+	struct uwsgi_stack_pool *trim_usp = uwsgi_stack_pool_new(256 * 1024, 64, 1);
+	bench_run("stack pool get/put trim", bench_stack_recycle, trim_usp);
+	// zero idle stacks, every request maps a new one (as without pooling)
+	struct uwsgi_stack_pool *nopool_usp = uwsgi_stack_pool_new(256 * 1024, 0, 0);
+	bench_run("stack mmap/munmap", bench_stack_recycle, nopool_usp);
+}
+
+int main(int argc, char *argv[]) {
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--json")) {
+			bench_json = 1;
+		}
+		else {
+			bench_filter = argv[i];
+		}
+	}
+
+	// the minimal setup done by uwsgi_setup()
+	uwsgi.shared = (struct uwsgi_shared *) uwsgi_calloc_shared(sizeof(struct uwsgi_shared));
+	uwsgi_init_default();
+	uwsgi.cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uwsgi.page_size = getpagesize();
+	uwsgi.no_initial_output = 1;
+	uwsgi_register_clock(&bench_clock);
+	uwsgi_set_clock("bench");
+	uwsgi_hash_algo_register_all();
+	uwsgi_register_logchunks();
+	uwsgi_setup_locking();
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(65536);
+	bench_run("buffer append 16 bytes", bench_buffer_append, ub);
+	bench_run("buffer append keyval", bench_buffer_keyval, ub);
+	bench_run("buffer new/grow/destroy 1k", bench_buffer_grow, NULL);
+	bench_run("buffer new/destroy page_size", bench_buffer_short_lived, NULL);
+	bench_run("buffer append_json log line", bench_buffer_json, ub);
+	uwsgi_buffer_destroy(ub);
+
+	bench_run("stats 16 workers", bench_stats, NULL);
+
+	struct bench_request br;
+	bench_request_build(&br);
+	bench_run("parse_vars 17 vars", bench_parse_vars, &br);
+
+	char *algos[] = { "djb33x", "murmur2", "xxh3", "siphash", NULL };
+	uint64_t keylens[] = { 8, 32, 256, 0 };
+	char hkey[256];
+	memset(hkey, 'k', 256);
+	for (i = 0; algos[i]; i++) {
+		int j;
+		for (j = 0; keylens[j]; j++) {
+			struct bench_hash bh;
+			bh.uha = uwsgi_hash_algo_get(algos[i]);
+			if (!bh.uha) continue;
+			bh.key = hkey;
+			bh.keylen = keylens[j];
+			char *num = uwsgi_64bit2str(keylens[j]);
+			char *name = uwsgi_concat4("hash ", algos[i], " keylen=", num);
+			bench_run(name, bench_hash, &bh);
+			free(num);
+			free(name);
+		}
+	}
+
+	bench_caches();
+	bench_rbtimers();
+	bench_metrics();
+	bench_logformats(&br);
+	bench_stacks();
+	// last, as switching engines invalidates the locks of the caches
+	bench_locks();
+
+	return 0;
+}
@@ -84,6 +84,48 @@ START_TEST(test_uwsgi_cron_task_needs_execution_handles_weekday_7_as_sunday)
 }
 END_TEST
 
+static time_t cron_local_time(int year, int mon, int mday, int hour, int min)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(struct tm));
+	tm.tm_year = year - 1900;
+	tm.tm_mon = mon - 1;
+	tm.tm_mday = mday;
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+START_TEST(test_uwsgi_cron_next)
+{
+	struct uwsgi_cron uc;
+	memset(&uc, 0, sizeof(struct uwsgi_cron));
+
+	// */5 * * * *, the current minute is included
+	uc.minute = -5; uc.hour = -1; uc.day = -1; uc.month = -1; uc.week = -1;
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 3, 10, 12, 3) + 30) == cron_local_time(2024, 3, 10, 12, 5));
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 3, 10, 12, 5) + 59) == cron_local_time(2024, 3, 10, 12, 5));
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 3, 10, 23, 56)) == cron_local_time(2024, 3, 11, 0, 0));
+
+	// 30 4 1 * * (the first of the month)
+	uc.minute = 30; uc.hour = 4; uc.day = 1;
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 1, 31, 5, 0)) == cron_local_time(2024, 2, 1, 4, 30));
+
+	// 0 0 * * 7 (sunday), 2024-03-10 is a sunday
+	uc.minute = 0; uc.hour = 0; uc.day = -1; uc.week = 7;
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 3, 5, 10, 0)) == cron_local_time(2024, 3, 10, 0, 0));
+
+	// 0 0 29 2 * (leap days only)
+	uc.day = 29; uc.month = 2; uc.week = -1;
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 3, 1, 0, 0)) == cron_local_time(2028, 2, 29, 0, 0));
+
+	// can never match
+	uc.day = 30;
+	ck_assert(uwsgi_cron_next(&uc, cron_local_time(2024, 3, 1, 0, 0)) == 0);
+}
+END_TEST
+
 Suite *check_core_cron(void)
 {
 	Suite *s = suite_create("uwsgi cron");
@@ -91,6 +133,135 @@ Suite *check_core_cron(void)
 
 	suite_add_tcase(s, tc);
 	tcase_add_test(tc, test_uwsgi_cron_task_needs_execution_handles_weekday_7_as_sunday);
+	tcase_add_test(tc, test_uwsgi_cron_next);
+	return s;
+}
+
+START_TEST(test_uwsgi_hash_vectors)
+{
+	int i;
+	char key[16], msg[15];
+	for (i = 0; i < 16; i++) key[i] = i;
+	for (i = 0; i < 15; i++) msg[i] = i;
+
+	ck_assert(uwsgi_xxh3_64("", 0) == 0x2D06800538D394C2ULL);
+	ck_assert(uwsgi_xxh3_64("abc", 3) == 0x78AF5F94892F3950ULL);
+
+	uint64_t k0, k1;
+	memcpy(&k0, key, 8);
+	memcpy(&k1, key + 8, 8);
+	ck_assert(uwsgi_siphash(msg, 15, k0, k1) == 0xA129CA6149BE45E5ULL);
+}
+END_TEST
+
+Suite *check_core_hash(void)
+{
+	Suite *s = suite_create("uwsgi hash");
+	TCase *tc = tcase_create("hash");
+
+	suite_add_tcase(s, tc);
+	tcase_add_test(tc, test_uwsgi_hash_vectors);
+	return s;
+}
+
+START_TEST(test_uwsgi_json_escape)
+{
+	char dst[128];
+	// the quote is past the first word
+	char *src = "0123456789\"abc\\\t\n\rdef\x01";
+	size_t len = uwsgi_json_escape(dst, src, strlen(src));
+	ck_assert(len == 27);
+	ck_assert(!memcmp(dst, "0123456789\\\"abc\\\\\\t\\n\\rdef\x01", len));
+
+	ck_assert(uwsgi_json_plain_len("0123456789abcdef", 16) == 16);
+	ck_assert(uwsgi_json_plain_len("01234567\x1f", 9) == 8);
+	ck_assert(uwsgi_json_plain_len("\xc3\xa8\xc3\xa8\xc3\xa8\xc3\xa8\"", 9) == 8);
+}
+END_TEST
+
+Suite *check_core_json(void)
+{
+	Suite *s = suite_create("uwsgi json");
+	TCase *tc = tcase_create("json");
+
+	suite_add_tcase(s, tc);
+	tcase_add_test(tc, test_uwsgi_json_escape);
+	return s;
+}
+
+START_TEST(test_uwsgi_metric_asn_cmp)
+{
+	// 3.127 < 3.128 < 3.16384 (base128 lengths differ)
+	ck_assert(uwsgi_metric_asn_cmp("\x03\x7f", 2, "\x03\x81\x00", 3) < 0);
+	ck_assert(uwsgi_metric_asn_cmp("\x03\xff\x7f", 3, "\x03\x81\x80\x00", 4) < 0);
+	// a prefix comes first
+	ck_assert(uwsgi_metric_asn_cmp("\x03\x01", 2, "\x03\x01\x01", 3) < 0);
+	ck_assert(uwsgi_metric_asn_cmp("\x05\x64", 2, "\x03\x01\x01", 3) > 0);
+	ck_assert(uwsgi_metric_asn_cmp("\x03\x01", 2, "\x03\x01", 2) == 0);
+}
+END_TEST
+
+Suite *check_core_metrics(void)
+{
+	Suite *s = suite_create("uwsgi metrics");
+	TCase *tc = tcase_create("metrics");
+
+	suite_add_tcase(s, tc);
+	tcase_add_test(tc, test_uwsgi_metric_asn_cmp);
+	return s;
+}
+
+START_TEST(test_uwsgi_cache_immutable)
+{
+	char src[] = "/tmp/uwsgi_check_immutable_XXXXXX";
+	int fd = mkstemp(src);
+	ck_assert(fd >= 0);
+	char *data = "foo\tbar\nempty_line_follows\t1\n\nnumber\t12345678\n";
+	ck_assert(write(fd, data, strlen(data)) == (ssize_t) strlen(data));
+	close(fd);
+
+	char *dst = uwsgi_concat2(src, ".mph");
+	ck_assert(uwsgi_cache_immutable_build(src, dst) == 0);
+
+	struct stat st;
+	fd = open(dst, O_RDONLY);
+	ck_assert(fd >= 0);
+	ck_assert(!fstat(fd, &st));
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	ck_assert(map != MAP_FAILED);
+
+	uint64_t vallen = 0;
+	char *value = uwsgi_cache_immutable_lookup(map, "foo", 3, &vallen);
+	ck_assert(value && vallen == 3 && !memcmp(value, "bar", 3));
+	value = uwsgi_cache_immutable_lookup(map, "number", 6, &vallen);
+	ck_assert(value && vallen == 8 && !memcmp(value, "12345678", 8));
+	ck_assert(uwsgi_cache_immutable_lookup(map, "fo", 2, &vallen) == NULL);
+	ck_assert(uwsgi_cache_immutable_lookup(map, "missing", 7, &vallen) == NULL);
+
+	munmap(map, st.st_size);
+	unlink(dst);
+
+	// duplicated keys are refused
+	fd = open(src, O_WRONLY | O_TRUNC);
+	ck_assert(fd >= 0);
+	ck_assert(write(fd, "a\t1\na\t2\n", 8) == 8);
+	close(fd);
+	ck_assert(uwsgi_cache_immutable_build(src, dst) == -1);
+	ck_assert(access(dst, F_OK) == -1);
+
+	unlink(src);
+	free(dst);
+}
+END_TEST
+
+Suite *check_core_cache(void)
+{
+	Suite *s = suite_create("uwsgi cache");
+	TCase *tc = tcase_create("cache");
+
+	suite_add_tcase(s, tc);
+	tcase_add_test(tc, test_uwsgi_cache_immutable);
 	return s;
 }
 
@@ -100,6 +271,10 @@ int main(void)
 	SRunner *r = srunner_create(check_core_strings());
 	srunner_add_suite(r, check_core_opt_parsing());
 	srunner_add_suite(r, check_core_cron());
+	srunner_add_suite(r, check_core_hash());
+	srunner_add_suite(r, check_core_json());
+	srunner_add_suite(r, check_core_metrics());
+	srunner_add_suite(r, check_core_cache());
 	srunner_run_all(r, CK_NORMAL);
 	nf = srunner_ntests_failed(r);
 	srunner_free(r);
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+Replay a recorded load trace against uWSGI cheaper algorithms.
+
+The trace is a text file with one line per second: the number of requests
+to send in that second and (optionally) the service time in milliseconds
+of those requests (default 50). Lines starting with # are ignored.
+
+For every algorithm an instance is spawned (with the python plugin and a
+tiny app sleeping for the service time), the trace is replayed over http
+and the number of running workers is sampled from the stats server.
+
+    ./contrib/cheaper_replay.py --trace morning.txt --algos spare,busyness,predictive \\
+        -- --plugin python --processes 16 --cheaper 2
+
+Results are printed as a table: latency percentiles, average and maximum
+workers and the number of failed requests.
+"""
+
+import argparse
+import json
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import http.client
+from concurrent.futures import ThreadPoolExecutor
+
+APP = """
+import time
+def application(env, start_response):
+    ms = int(env.get('QUERY_STRING') or 0)
+    time.sleep(ms / 1000.0)
+    start_response('200 OK', [('Content-Type', 'text/plain')])
+    return [b'ok']
+"""
+
+
+def load_trace(path):
+    trace = []
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            items = line.split()
+            rps = int(float(items[0]))
+            ms = int(float(items[1])) if len(items) > 1 else 50
+            trace.append((rps, ms))
+    return trace
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def running_workers(stats_port):
+    try:
+        s = socket.create_connection(('127.0.0.1', stats_port), timeout=1)
+        data = b''
+        while True:
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+        s.close()
+        stats = json.loads(data.decode())
+        return len([w for w in stats['workers'] if w['status'] != 'cheap' and w['pid'] > 0])
+    except (OSError, ValueError, KeyError):
+        return None
+
+
+def wait_for(port, timeout=10):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=1).close()
+            return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def request(port, ms, latencies, errors):
+    start = time.time()
+    try:
+        conn = http.client.HTTPConnection('127.0.0.1', port, timeout=30)
+        conn.request('GET', '/?%d' % ms)
+        conn.getresponse().read()
+        conn.close()
+        latencies.append(time.time() - start)
+    except (OSError, http.client.HTTPException):
+        errors.append(1)
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def replay(args, algo, trace, app):
+    http_port = free_port()
+    stats_port = free_port()
+    cmd = [args.uwsgi, '--master', '--http-socket', '127.0.0.1:%d' % http_port,
+           '--stats', '127.0.0.1:%d' % stats_port, '--wsgi-file', app,
+           '--cheaper-algo', algo, '--disable-logging'] + args.uwsgi_args
+    log = open(os.path.join(args.logdir, 'cheaper_%s.log' % algo), 'w') if args.logdir else subprocess.DEVNULL
+    proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+    try:
+        if not wait_for(http_port) or not wait_for(stats_port):
+            print('unable to start uWSGI with algorithm %s' % algo, file=sys.stderr)
+            return None
+        latencies = []
+        errors = []
+        workers = []
+        pool = ThreadPoolExecutor(max_workers=args.concurrency)
+        for rps, ms in trace:
+            second = time.time()
+            for i in range(rps):
+                pool.submit(request, http_port, ms, latencies, errors)
+                # spread the requests in the second
+                delay = second + ((i + 1) / float(rps)) / args.speed - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+            delay = second + 1.0 / args.speed - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            n = running_workers(stats_port)
+            if n is not None:
+                workers.append(n)
+        pool.shutdown(wait=True)
+        return {
+            'p50': percentile(latencies, 50) * 1000,
+            'p99': percentile(latencies, 99) * 1000,
+            'avg_workers': sum(workers) / float(len(workers)) if workers else 0,
+            'max_workers': max(workers) if workers else 0,
+            'errors': len(errors),
+        }
+    finally:
+        proc.terminate()
+        proc.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='replay a load trace against uWSGI cheaper algorithms')
+    parser.add_argument('--trace', required=True, help='trace file (one "<requests> [<msecs>]" line per second)')
+    parser.add_argument('--algos', default='spare,spare2,backlog,busyness,predictive,latency', help='comma separated list of algorithms')
+    parser.add_argument('--uwsgi', default='uwsgi', help='uWSGI binary')
+    parser.add_argument('--speed', type=float, default=1.0, help='replay speed multiplier')
+    parser.add_argument('--concurrency', type=int, default=256, help='max concurrent client requests')
+    parser.add_argument('--logdir', help='store the uWSGI logs in the specified directory')
+    parser.add_argument('uwsgi_args', nargs=argparse.REMAINDER, help='additional uWSGI options (after --)')
+    args = parser.parse_args()
+    if args.uwsgi_args and args.uwsgi_args[0] == '--':
+        args.uwsgi_args = args.uwsgi_args[1:]
+
+    trace = load_trace(args.trace)
+    fd, app = tempfile.mkstemp(suffix='.py')
+    with os.fdopen(fd, 'w') as f:
+        f.write(APP)
+
+    try:
+        print('%-12s %10s %10s %12s %12s %8s' % ('algorithm', 'p50 (ms)', 'p99 (ms)', 'avg workers', 'max workers', 'errors'))
+        for algo in args.algos.split(','):
+            result = replay(args, algo, trace, app)
+            if not result:
+                continue
+            print('%-12s %10.1f %10.1f %12.2f %12d %8d' % (algo, result['p50'], result['p99'],
+                                                          result['avg_workers'], result['max_workers'], result['errors']))
+    finally:
+        os.unlink(app)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,133 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	admission control (load shedding at accept time)
+
+	the time a connection spent in the listen queue is measured just after accept() via TCP_INFO
+	(tcpi_last_data_recv is the time since the connection has been established or since its last
+	data packet), so requests whose clients have probably already given up can be refused before
+	reaching the app:
+
+	--admission-max-wait <ms> (or --admission-socket-max-wait <socket>=<ms>) refuses every request
+	that waited more than the specified time
+
+	--admission-codel <ms> enables a CoDel-like controller: if for a whole interval (--admission-codel-interval,
+	default 100ms) the minimum queue wait stayed above the target, the queue is standing and
+	every request waiting more than twice the target is refused until the queue drains
+
+	refused requests are closed or, with --admission-503, answered with a minimal 503 response.
+
+	only TCP sockets on Linux can be measured, connections kept alive by the http11 protocol are never refused.
+	the controller state is per-process (cores of a multithreaded worker share it)
+
+*/
+
+static struct {
+	uint64_t interval_end;
+	uint64_t min_wait;
+	int overloaded;
+} codel;
+
+void uwsgi_admission_setup() {
+	if (!uwsgi.admission_max_wait && !uwsgi.admission_codel && !uwsgi.admission_socket_max_wait) return;
+#ifndef __linux__
+	uwsgi_log("*** admission control is not supported on this platform ***\n");
+#else
+	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
+	while(uwsgi_sock) {
+		uwsgi_sock->admission_max_wait = uwsgi.admission_max_wait;
+		struct uwsgi_string_list *usl;
+		uwsgi_foreach(usl, uwsgi.admission_socket_max_wait) {
+			char *equal = strrchr(usl->value, '=');
+			if (!equal) {
+				uwsgi_log("invalid admission-socket-max-wait syntax, must be <socket>=<ms>\n");
+				exit(1);
+			}
+			if (!uwsgi_strncmp(usl->value, equal - usl->value, uwsgi_sock->name, uwsgi_sock->name_len)) {
+				uwsgi_sock->admission_max_wait = atoi(equal + 1);
+			}
+		}
+		uwsgi_sock = uwsgi_sock->next;
+	}
+	if (!uwsgi.admission_codel_interval) {
+		uwsgi.admission_codel_interval = 100;
+	}
+	uwsgi.admission_enabled = 1;
+#endif
+}
+
+#ifdef __linux__
+// time (in msecs) spent by the connection in the listen queue, -1 if unknown
+static int64_t admission_queue_wait(struct wsgi_request *wsgi_req) {
+	struct tcp_info ti;
+	socklen_t tis = sizeof(struct tcp_info);
+	if (wsgi_req->socket->family != AF_INET && wsgi_req->socket->family != AF_INET6) return -1;
+	if (getsockopt(wsgi_req->fd, IPPROTO_TCP, TCP_INFO, &ti, &tis)) return -1;
+	return ti.tcpi_last_data_recv;
+}
+
+static int admission_codel(uint64_t now, uint64_t wait) {
+	uint64_t target = uwsgi.admission_codel;
+
+	if (now >= codel.interval_end) {
+		// the whole interval passed without the queue draining below the target
+		codel.overloaded = codel.interval_end > 0 && codel.min_wait > target;
+		codel.min_wait = wait;
+		codel.interval_end = now + (uwsgi.admission_codel_interval * 1000);
+	}
+	else if (wait < codel.min_wait) {
+		codel.min_wait = wait;
+	}
+
+	return codel.overloaded && wait > target * 2;
+}
+
+static void admission_refuse(struct wsgi_request *wsgi_req) {
+	if (uwsgi.admission_503) {
+		char buf[4096];
+		// consume what is already there, so close() does not send a RST before the response
+		if (recv(wsgi_req->fd, buf, sizeof(buf), MSG_DONTWAIT) < 0) {
+			// nothing to read, that's fine
+		}
+		char *response = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+		if (write(wsgi_req->fd, response, strlen(response)) < 0) {
+			// the client is already gone
+		}
+	}
+	close(wsgi_req->fd);
+	uwsgi.workers[uwsgi.mywid].admission_refused++;
+}
+#endif
+
+/*
+	returns 0 if the request can be managed, -1 if it has been refused (and its connection closed)
+*/
+int uwsgi_admission_check(struct wsgi_request *wsgi_req) {
+#ifdef __linux__
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+
+	// kept-alive connection
+	if (uwsgi_sock->retry && uwsgi_sock->retry[wsgi_req->async_id]) return 0;
+
+	int64_t wait = admission_queue_wait(wsgi_req);
+	if (wait < 0) return 0;
+
+	if (uwsgi_sock->admission_max_wait > 0 && wait > uwsgi_sock->admission_max_wait) {
+		goto refuse;
+	}
+
+	if (uwsgi.admission_codel > 0 && admission_codel(wsgi_req->accepted_at, wait)) {
+		goto refuse;
+	}
+
+	return 0;
+refuse:
+	admission_refuse(wsgi_req);
+	return -1;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,154 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	key-affinity dispatch (--affinity-header <name> or --affinity-cookie <name>)
+
+	requests with the same affinity key are steered to the same worker, so per-worker
+	in-process caches are effective. After accept() every worker peeks the head of the request
+	(HTTP or uwsgi protocol), hashes the key and chooses the worker with rendezvous (highest random weight)
+	hashing over the running workers: when the cheaper spawns or stops a worker only the keys mapped
+	to it move. If the chosen worker is not the current one, the connection is handed over to it
+	via its own datagram socketpair (see priority.c).
+
+	requests without a key (or not inspectable) are managed by the worker that accepted them,
+	as the ones whose destination worker has a full handover queue.
+
+*/
+
+// splitmix64 finalizer, mixes the key hash with the worker id
+static uint64_t affinity_mix(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static int affinity_reserved(int wid) {
+	struct uwsgi_priority_class *upc = uwsgi.priority_classes;
+	while(upc) {
+		if (upc->workers[wid]) return 1;
+		upc = upc->next;
+	}
+	return 0;
+}
+
+// called by the master before spawning the workers
+void uwsgi_affinity_setup() {
+	if (!uwsgi.affinity_header && !uwsgi.affinity_cookie) return;
+
+	if (uwsgi.affinity_header) {
+		// translate the header name to its CGI form
+		size_t i, len = strlen(uwsgi.affinity_header);
+		uwsgi.affinity_var = uwsgi_concat2("HTTP_", uwsgi.affinity_header);
+		for(i = 0; i < len; i++) {
+			char c = toupper((int) uwsgi.affinity_var[5 + i]);
+			uwsgi.affinity_var[5 + i] = c == '-' ? '_' : c;
+		}
+	}
+	else {
+		uwsgi.affinity_var = "HTTP_COOKIE";
+	}
+	uwsgi.affinity_var_len = strlen(uwsgi.affinity_var);
+
+	// (re)registering is a no-op if the caches subsystem already did it
+	uwsgi_hash_algo_register_all();
+	uwsgi.affinity_hash = uwsgi_hash_algo_get(uwsgi.affinity_hash_name ? uwsgi.affinity_hash_name : "murmur2");
+	if (!uwsgi.affinity_hash) {
+		uwsgi_log("unable to find hash algo \"%s\" for affinity dispatch\n", uwsgi.affinity_hash_name);
+		exit(1);
+	}
+
+	uwsgi.affinity_fds = uwsgi_malloc(sizeof(int) * 2 * (uwsgi.numproc + 1));
+	int i;
+	for(i = 1; i <= uwsgi.numproc; i++) {
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, &uwsgi.affinity_fds[i * 2])) {
+			uwsgi_error("uwsgi_affinity_setup()/socketpair()");
+			exit(1);
+		}
+		uwsgi_socket_nb(uwsgi.affinity_fds[i * 2]);
+		uwsgi_socket_nb(uwsgi.affinity_fds[(i * 2) + 1]);
+	}
+}
+
+// called by each worker after the sockets mapping
+void uwsgi_affinity_worker_setup() {
+	if (!uwsgi.affinity_fds) return;
+	int i;
+	for(i = 1; i <= uwsgi.numproc; i++) {
+		if (i == uwsgi.mywid) {
+			close(uwsgi.affinity_fds[(i * 2) + 1]);
+		}
+		else {
+			close(uwsgi.affinity_fds[i * 2]);
+		}
+	}
+	char *name = uwsgi_malloc(32);
+	snprintf(name, 32, "affinity:%d", uwsgi.mywid);
+	uwsgi_handover_socket(name, uwsgi.affinity_fds[uwsgi.mywid * 2]);
+}
+
+static char *affinity_cookie(char *cookies, size_t len, size_t *vlen) {
+	char *name = uwsgi.affinity_cookie;
+	size_t name_len = strlen(name);
+	char *ptr = cookies, *end = cookies + len;
+	while(ptr < end) {
+		while(ptr < end && (*ptr == ' ' || *ptr == ';')) ptr++;
+		char *semicolon = memchr(ptr, ';', end - ptr);
+		char *cookie_end = semicolon ? semicolon : end;
+		if ((size_t) (cookie_end - ptr) > name_len && ptr[name_len] == '=' && !memcmp(ptr, name, name_len)) {
+			*vlen = cookie_end - (ptr + name_len + 1);
+			return ptr + name_len + 1;
+		}
+		ptr = cookie_end;
+	}
+	return NULL;
+}
+
+// the running worker with the highest weight for the key
+int uwsgi_affinity_worker(char *key, size_t key_len) {
+	uint64_t h = uwsgi.affinity_hash->func(key, key_len);
+	uint64_t best_score = 0;
+	int best = 0;
+	int i;
+	for(i = 1; i <= uwsgi.numproc; i++) {
+		if (uwsgi.workers[i].pid <= 0 || uwsgi.workers[i].cheaped || affinity_reserved(i)) continue;
+		uint64_t score = affinity_mix(h ^ affinity_mix(i));
+		if (!best || score > best_score) {
+			best = i;
+			best_score = score;
+		}
+	}
+	return best;
+}
+
+/*
+	returns 0 if the request must be managed by the current worker,
+	-1 if it has been handed over to the worker owning its key
+*/
+int uwsgi_affinity_dispatch(struct wsgi_request *wsgi_req) {
+	if (wsgi_req->handed_over || uwsgi.priority_my_class) return 0;
+
+	size_t len = 0;
+	char *buf = uwsgi_handover_peek(wsgi_req, &len);
+	if (!buf) return 0;
+
+	size_t key_len = 0;
+	char *key = uwsgi_handover_head_var(wsgi_req->socket, buf, len, uwsgi.affinity_var, uwsgi.affinity_var_len, &key_len);
+	if (key && uwsgi.affinity_cookie) {
+		key = affinity_cookie(key, key_len, &key_len);
+	}
+	if (!key || key_len == 0) return 0;
+
+	int wid = uwsgi_affinity_worker(key, key_len);
+	if (!wid || wid == uwsgi.mywid) return 0;
+
+	// the owner is too busy, better a cache miss than a lost request
+	if (uwsgi_handover_send(wsgi_req, uwsgi.affinity_fds[(wid * 2) + 1])) return 0;
+
+	uwsgi.workers[uwsgi.mywid].affinity_handovers++;
+	uwsgi_handover_release(wsgi_req);
+	return -1;
+}
@@ -161,6 +161,34 @@ static struct uwsgi_alarm_instance *uwsgi_alarm_get_instance(char *name) {
 
 
 #ifdef UWSGI_PCRE
+/*
+	a regexp can be part of the combined one only if it does not refer to its groups by number
+	(backreferences, recursion and conditionals would point to the wrong group)
+*/
+static int uwsgi_alarm_log_combinable(char *re) {
+	char *refs[] = { "\\g", "\\k", "(?P=", "(?P>", "(?(", "(?R", "(?&", "(?+", "(?-", NULL };
+	int i;
+	for (i = 0; refs[i]; i++) {
+		if (strstr(re, refs[i]))
+			return 0;
+	}
+	char *ptr = re;
+	while ((ptr = strchr(ptr, '\\'))) {
+		if (isdigit((int) ptr[1]) && ptr[1] != '0')
+			return 0;
+		if (!ptr[1])
+			break;
+		ptr += 2;
+	}
+	ptr = re;
+	while ((ptr = strstr(ptr, "(?"))) {
+		if (isdigit((int) ptr[2]))
+			return 0;
+		ptr += 2;
+	}
+	return 1;
+}
+
 static int uwsgi_alarm_log_add(char *alarms, char *regexp, int negate) {
 
 	struct uwsgi_alarm_log *old_ual = NULL, *ual = uwsgi.alarm_logs;
@@ -333,6 +361,8 @@ void uwsgi_alarms_init() {
 
 #ifdef UWSGI_PCRE
 	// then map log-alarm
+	struct uwsgi_buffer *any = uwsgi_buffer_new(uwsgi.page_size);
+	int any_count = 0;
 	usl = uwsgi.alarm_logs_list;
 	while (usl) {
 		char *line = uwsgi_str(usl->value);
@@ -349,8 +379,29 @@ void uwsgi_alarms_init() {
 			exit(1);
 		}
 
+		// negated regexps only stop the matching, a line can raise alarms only if one of the others matches
+		if (!usl->custom && any) {
+			if (!uwsgi_alarm_log_combinable(regexp) || (any_count && uwsgi_buffer_append(any, "|", 1))
+				|| uwsgi_buffer_append(any, "(?:", 3) || uwsgi_buffer_append(any, regexp, strlen(regexp))
+				|| uwsgi_buffer_append(any, ")", 1)) {
+				uwsgi_buffer_destroy(any);
+				any = NULL;
+			}
+			any_count++;
+		}
+
 		usl = usl->next;
 	}
+
+	// with a single regexp the prefilter would only double the work
+	if (any && any_count > 1) {
+		if (uwsgi_buffer_append(any, "\0", 1) || uwsgi_regexp_build(any->buf, &uwsgi.alarm_logs_any, &uwsgi.alarm_logs_any_extra)) {
+			uwsgi_log("[uwsgi-alarm] unable to combine the log-alarm regexps, they will be checked one by one\n");
+			uwsgi.alarm_logs_any = NULL;
+		}
+	}
+	if (any)
+		uwsgi_buffer_destroy(any);
 #endif
 }
 
@@ -365,6 +416,9 @@ void uwsgi_alarm_thread_start() {
 }
 
 void uwsgi_alarm_trigger_uai(struct uwsgi_alarm_instance *uai, char *msg, size_t len) {
+	// the alarm thread would truncate it anyway
+	if (len > uwsgi.alarm_msg_size)
+		len = uwsgi.alarm_msg_size;
 	struct iovec iov[2];
 	iov[0].iov_base = &uai;
 	iov[0].iov_len = sizeof(long);
@@ -378,20 +432,43 @@ void uwsgi_alarm_trigger_uai(struct uwsgi_alarm_instance *uai, char *msg, size_t
 }
 
 #ifdef UWSGI_PCRE
+/*
+	hand an alarm raised by the master (log lines) to the alarm thread, so slow alarms (commands, http calls...)
+	never stop the log draining. Every message already queued for the instance in the last --alarm-freq seconds
+	(not only the last one) is dropped here, before reaching the thread.
+*/
+static void uwsgi_alarm_queue(struct uwsgi_alarm_instance *uai, char *msg, size_t len) {
+	if (!uwsgi.alarm_thread) {
+		uwsgi_alarm_run(uai, msg, len);
+		return;
+	}
+	time_t now = uwsgi_now();
+	uint64_t hash = uwsgi_xxh3_64(msg, len);
+	int i;
+	for (i = 0; i < UWSGI_ALARM_DEDUPE; i++) {
+		if (uai->queued_at[i] && uai->queued_hash[i] == hash && now - uai->queued_at[i] < uwsgi.alarm_freq)
+			return;
+	}
+	uai->queued_hash[uai->queued_pos] = hash;
+	uai->queued_at[uai->queued_pos] = now;
+	uai->queued_pos = (uai->queued_pos + 1) % UWSGI_ALARM_DEDUPE;
+	uwsgi_alarm_trigger_uai(uai, msg, len);
+}
+
 // check if a log should raise an alarm
 void uwsgi_alarm_log_check(char *msg, size_t len) {
 	if (!uwsgi_strncmp(msg, len, "[uwsgi-alarm", 12))
 		return;
+	// most of the lines do not raise alarms
+	if (uwsgi.alarm_logs_any && uwsgi_regexp_match(uwsgi.alarm_logs_any, uwsgi.alarm_logs_any_extra, msg, len) < 0)
+		return;
 	struct uwsgi_alarm_log *ual = uwsgi.alarm_logs;
 	while (ual) {
 		if (uwsgi_regexp_match(ual->pattern, ual->pattern_extra, msg, len) >= 0) {
 			if (!ual->negate) {
 				struct uwsgi_alarm_ll *uall = ual->alarms;
 				while (uall) {
-					if (uwsgi.alarm_cheap)
-						uwsgi_alarm_trigger_uai(uall->alarm, msg, len);
-					else
-						uwsgi_alarm_run(uall->alarm, msg, len);
+					uwsgi_alarm_queue(uall->alarm, msg, len);
 					uall = uall->next;
 				}
 			}
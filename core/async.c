@@ -8,11 +8,13 @@ extern struct uwsgi_server uwsgi;
 
 	You can see it as an hub holding the following structures:
 
-	1) the runqueue, cores ready to be run are appended to this list
+	1) the runqueue, cores ready to be run are appended to this list (every core has a preallocated slot,
+	so pushing and removing are O(1) and do not allocate memory)
 
 	2) the fd list, this is a list of monitored file descriptors, a core can wait for all the file descriptors it needs
 
-	3) the timeout value, if set, the current core will timeout after the specified number of seconds (unless an event cancels it)
+	3) the timeout value, if set, the current core will timeout after the specified number of seconds (unless an event cancels it),
+	timeouts are kept in a rbtree of preallocated (one per core) nodes
 
 
 	IMPORTANT: this is not a callback-based engine !!!
@@ -43,6 +45,9 @@ void uwsgi_async_init() {
         uwsgi.async_waiting_fd_table = uwsgi_calloc(sizeof(struct wsgi_request *) * uwsgi.max_fd);
         uwsgi.async_proto_fd_table = uwsgi_calloc(sizeof(struct wsgi_request *) * uwsgi.max_fd);
 
+	uwsgi.async_runqueue_slots = uwsgi_calloc(sizeof(struct uwsgi_async_request) * uwsgi.async);
+	uwsgi.async_timeout_slots = uwsgi_calloc(sizeof(struct uwsgi_rb_timer) * uwsgi.async);
+
 }
 
 struct wsgi_request *find_wsgi_req_proto_by_fd(int fd) {
@@ -73,19 +78,18 @@ static void runqueue_remove(struct uwsgi_async_request *u_request) {
 		uwsgi.async_runqueue_last = parent;
 	}
 
-	free(u_request);
+	// release the slot
+	u_request->wsgi_req = NULL;
+	u_request->prev = NULL;
+	u_request->next = NULL;
 }
 
 static void runqueue_push(struct wsgi_request *wsgi_req) {
 
+	struct uwsgi_async_request *uar = &uwsgi.async_runqueue_slots[wsgi_req->async_id];
 	// do not push the same request in the runqueue
-	struct uwsgi_async_request *uar = uwsgi.async_runqueue;
-	while(uar) {
-		if (uar->wsgi_req == wsgi_req) return;
-		uar = uar->next;
-	}
+	if (uar->wsgi_req) return;
 
-	uar = uwsgi_malloc(sizeof(struct uwsgi_async_request));
 	uar->prev = NULL;
 	uar->next = NULL;
 	uar->wsgi_req = wsgi_req;
@@ -119,7 +123,6 @@ struct wsgi_request *find_first_available_wsgi_req() {
 void async_reset_request(struct wsgi_request *wsgi_req) {
 	if (wsgi_req->async_timeout) {
 		uwsgi_del_rb_timer(uwsgi.rb_async_timeouts, wsgi_req->async_timeout);
-		free(wsgi_req->async_timeout);
 		wsgi_req->async_timeout = NULL;
 	}
 	
@@ -265,7 +268,7 @@ void async_add_timeout(struct wsgi_request *wsgi_req, int timeout) {
 	wsgi_req->async_ready_fd = 0;
 
 	if (timeout > 0 && wsgi_req->async_timeout == NULL) {
-		wsgi_req->async_timeout = uwsgi_add_rb_timer(uwsgi.rb_async_timeouts, uwsgi_now() + timeout, wsgi_req);
+		wsgi_req->async_timeout = uwsgi_insert_rb_timer(uwsgi.rb_async_timeouts, &uwsgi.async_timeout_slots[wsgi_req->async_id], uwsgi_now() + timeout, wsgi_req);
 	}
 
 }
@@ -336,7 +339,9 @@ void async_schedule_to_req(void) {
 	// a trick to avoid calling routes again
 	uwsgi.wsgi_req->is_routing = 1;
 #endif
+	int mem_old = uwsgi_memory_enter(UWSGI_MEM_PLUGINS);
 	uwsgi.wsgi_req->async_status = uwsgi.p[uwsgi.wsgi_req->uh->modifier1]->request(uwsgi.wsgi_req);
+	uwsgi_memory_leave(mem_old);
         if (uwsgi.wsgi_req->async_status <= UWSGI_OK) goto end;
 
 	if (uwsgi.schedule_to_main) {
@@ -360,7 +365,9 @@ void async_schedule_to_req_green(void) {
         }
 #endif
         for(;;) {
+		int mem_old = uwsgi_memory_enter(UWSGI_MEM_PLUGINS);
 		wsgi_req->async_status = uwsgi.p[wsgi_req->uh->modifier1]->request(wsgi_req);
+		uwsgi_memory_leave(mem_old);
                 if (wsgi_req->async_status <= UWSGI_OK) {
                         break;
                 }
@@ -2,18 +2,82 @@
 
 extern struct uwsgi_server uwsgi;
 
+/*
+
+	uwsgi_buffer pooling
+
+	buffers are created and destroyed a lot of times per request (headers, logging, routing...),
+	so every thread keeps a small free list of structures and one of memory areas for each
+	power-of-two size (from 64 bytes up to the page size, as the common uwsgi_buffer_new(uwsgi.page_size)).
+
+	sizes are never rounded up, as some users expect ub->len to be the requested one.
+	The memory areas are plain malloc()'ed chunks, so the (common) pattern of stealing ub->buf (setting it to NULL before uwsgi_buffer_destroy)
+	and free()'ing it later continues to work. Pooling is disabled when debugging buffers.
+
+*/
+
+#define UWSGI_BUFFER_POOL_MIN_SHIFT 6
+#define UWSGI_BUFFER_POOL_CLASSES 11
+#define UWSGI_BUFFER_POOL_MAX 32
+
+struct uwsgi_buffer_pool {
+	struct uwsgi_buffer *structs;
+	int structs_count;
+	char *bufs[UWSGI_BUFFER_POOL_CLASSES];
+	int bufs_count[UWSGI_BUFFER_POOL_CLASSES];
+};
+
+static __thread struct uwsgi_buffer_pool ub_pool;
+
+// the size class of a buffer (only exact powers of two are pooled), -1 if it must not be pooled
+static int uwsgi_buffer_class(size_t len) {
+	if (len > (size_t) uwsgi.page_size || (len & (len - 1))) return -1;
+	int class = 0;
+	size_t class_len = 1 << UWSGI_BUFFER_POOL_MIN_SHIFT;
+	while (class_len < len) {
+		class_len <<= 1;
+		class++;
+	}
+	if (class_len != len || class >= UWSGI_BUFFER_POOL_CLASSES) return -1;
+	return class;
+}
+
 struct uwsgi_buffer *uwsgi_buffer_new(size_t len) {
 #ifdef UWSGI_DEBUG_BUFFER
 	uwsgi_log("[uwsgi-buffer] allocating a new buffer of %llu\n", (unsigned long long) len);
-#endif
 	struct uwsgi_buffer *ub = uwsgi_calloc(sizeof(struct uwsgi_buffer));
-
 	if (len) {
 		ub->buf = uwsgi_malloc(len);
 		ub->len = len;
 	}
 	return ub;
+#else
+	int mem_old = uwsgi_memory_enter(UWSGI_MEM_BUFFERS);
+	struct uwsgi_buffer *ub = ub_pool.structs;
+	if (ub) {
+		ub_pool.structs = (struct uwsgi_buffer *) ub->buf;
+		ub_pool.structs_count--;
+		memset(ub, 0, sizeof(struct uwsgi_buffer));
+	}
+	else {
+		ub = uwsgi_calloc(sizeof(struct uwsgi_buffer));
+	}
 
+	if (len) {
+		int class = uwsgi_buffer_class(len);
+		if (class >= 0 && ub_pool.bufs[class]) {
+			ub->buf = ub_pool.bufs[class];
+			memcpy(&ub_pool.bufs[class], ub->buf, sizeof(char *));
+			ub_pool.bufs_count[class]--;
+		}
+		if (!ub->buf) {
+			ub->buf = uwsgi_malloc(len);
+		}
+		ub->len = len;
+	}
+	uwsgi_memory_leave(mem_old);
+	return ub;
+#endif
 }
 
 int uwsgi_buffer_fix(struct uwsgi_buffer *ub, size_t len) {
@@ -25,26 +89,38 @@ int uwsgi_buffer_fix(struct uwsgi_buffer *ub, size_t len) {
 			uwsgi_error("uwsgi_buffer_fix()");
 			return -1;
 		}
+		if (uwsgi.memory_stats)
+			uwsgi_memory_account_to(UWSGI_MEM_BUFFERS, len - ub->len);
 		ub->buf = new_buf;
 		ub->len = len;
 	}
 	return 0;
 }
 
+// grow geometrically (at least of a page), so appending in a loop does not realloc() every time
+static size_t uwsgi_buffer_grow_len(struct uwsgi_buffer *ub, size_t needed) {
+	size_t new_len = UMAX(ub->len * 2, ub->len + (size_t) uwsgi.page_size);
+	if (new_len < needed) new_len = needed;
+	if (ub->limit > 0 && new_len > ub->limit) {
+		new_len = ub->limit;
+	}
+	return new_len;
+}
+
 int uwsgi_buffer_ensure(struct uwsgi_buffer *ub, size_t len) {
 	size_t remains = ub->len - ub->pos;
 	if (remains < len) {
-		size_t new_len = ub->len + (len - remains);
-		if (ub->limit > 0 && new_len > ub->limit) {
-			new_len = ub->limit;
-			if (new_len == ub->len)
-				return -1;
-		}
+		size_t needed = ub->len + (len - remains);
+		size_t new_len = uwsgi_buffer_grow_len(ub, needed);
+		if (new_len < needed)
+			return -1;
 		char *new_buf = realloc(ub->buf, new_len);
 		if (!new_buf) {
 			uwsgi_error("uwsgi_buffer_ensure()");
 			return -1;
 		}
+		if (uwsgi.memory_stats)
+			uwsgi_memory_account_to(UWSGI_MEM_BUFFERS, new_len - ub->len);
 		ub->buf = new_buf;
 		ub->len = new_len;
 	}
@@ -101,22 +177,19 @@ int uwsgi_buffer_append(struct uwsgi_buffer *ub, char *buf, size_t len) {
 	size_t remains = ub->len - ub->pos;
 
 	if (len > remains) {
-		size_t chunk_size = UMAX(len, (size_t) uwsgi.page_size);
-		if (ub->limit > 0 && ub->len + chunk_size > ub->limit) {
-			// retry with another minimal size
-			if (len < (size_t) uwsgi.page_size) {
-				chunk_size = len;
-			}
-			if (ub->len + chunk_size > ub->limit)
-				return -1;
-		}
-		char *new_buf = realloc(ub->buf, ub->len + chunk_size);
+		size_t needed = ub->pos + len;
+		size_t new_len = uwsgi_buffer_grow_len(ub, needed);
+		if (new_len < needed)
+			return -1;
+		char *new_buf = realloc(ub->buf, new_len);
 		if (!new_buf) {
 			uwsgi_error("uwsgi_buffer_append()");
 			return -1;
 		}
+		if (uwsgi.memory_stats)
+			uwsgi_memory_account_to(UWSGI_MEM_BUFFERS, new_len - ub->len);
 		ub->buf = new_buf;
-		ub->len += chunk_size;
+		ub->len = new_len;
 	}
 
 	memcpy(ub->buf + ub->pos, buf, len);
@@ -125,27 +198,13 @@ int uwsgi_buffer_append(struct uwsgi_buffer *ub, char *buf, size_t len) {
 }
 
 int uwsgi_buffer_append_json(struct uwsgi_buffer *ub, char *buf, size_t len) {
-	// need to escape \ and "
-	size_t i;
-	for(i=0;i<len;i++) {
-		if (buf[i] == '\t') {
-			if (uwsgi_buffer_append(ub, "\\t", 2)) return -1;
-		}
-		else if (buf[i] == '\n') {
-			if (uwsgi_buffer_append(ub, "\\n", 2)) return -1;
-		}
-		else if (buf[i] == '\r') {
-			if (uwsgi_buffer_append(ub, "\\r", 2)) return -1;
-		}
-		else if (buf[i] == '"') {
-			if (uwsgi_buffer_append(ub, "\\\"", 2)) return -1;
-		}
-		else if (buf[i] == '\\') {
-			if (uwsgi_buffer_append(ub, "\\\\", 2)) return -1;
-		}
-		else {
-			if (uwsgi_buffer_append(ub, buf+i, 1)) return -1;
-		}
+	// need to escape \ and " (see uwsgi_json_escape()), in chunks to not overallocate big values
+	while (len > 0) {
+		size_t chunk = UMIN(len, 4096);
+		if (uwsgi_buffer_ensure(ub, chunk * 2)) return -1;
+		ub->pos += uwsgi_json_escape(ub->buf + ub->pos, buf, chunk);
+		buf += chunk;
+		len -= chunk;
 	}
 	return 0;
 }
@@ -351,10 +410,31 @@ void uwsgi_buffer_destroy(struct uwsgi_buffer *ub) {
 		uwsgi_log("[uwsgi-buffer][BUG] buffer at %p already destroyed !!!\n", ub);
 	}
 	ub->freed = 1;
-#endif
 	if (ub->buf)
 		free(ub->buf);
 	free(ub);
+#else
+	if (ub->buf) {
+		int class = uwsgi_buffer_class(ub->len);
+		// ub->len is always a lower bound of the allocated memory
+		if (class >= 0 && ub_pool.bufs_count[class] < UWSGI_BUFFER_POOL_MAX) {
+			memcpy(ub->buf, &ub_pool.bufs[class], sizeof(char *));
+			ub_pool.bufs[class] = ub->buf;
+			ub_pool.bufs_count[class]++;
+		}
+		else {
+			free(ub->buf);
+		}
+	}
+	if (ub_pool.structs_count < UWSGI_BUFFER_POOL_MAX) {
+		ub->buf = (char *) ub_pool.structs;
+		ub_pool.structs = ub;
+		ub_pool.structs_count++;
+	}
+	else {
+		free(ub);
+	}
+#endif
 }
 
 ssize_t uwsgi_buffer_write_simple(struct wsgi_request *wsgi_req, struct uwsgi_buffer *ub) {
@@ -451,3 +531,116 @@ int uwsgi_buffer_httpdate(struct uwsgi_buffer *ub, time_t t) {
 	if (size <= 0) return -1;
 	return uwsgi_buffer_append(ub, http_last_modified, size);
 }
+
+// msgpack
+
+int uwsgi_buffer_msgpack_map(struct uwsgi_buffer *ub, uint32_t len) {
+	if (len <= 15) {
+		return uwsgi_buffer_byte(ub, 0x80 + len);
+	}
+	else if (len <= 0xffff) {
+		if (uwsgi_buffer_byte(ub, 0xDE)) return -1;
+		return uwsgi_buffer_u16be(ub, (uint16_t) len);
+	}
+	
+	if (uwsgi_buffer_byte(ub, 0xDF)) return -1;
+	return uwsgi_buffer_u32be(ub, len);
+}
+
+int uwsgi_buffer_msgpack_array(struct uwsgi_buffer *ub, uint32_t len) {
+        if (len <= 15) {
+                return uwsgi_buffer_byte(ub, 0x90 + len);
+        }
+        else if (len <= 0xffff) {
+                if (uwsgi_buffer_byte(ub, 0xDC)) return -1;
+                return uwsgi_buffer_u16be(ub, (uint16_t) len);
+        }
+
+        if (uwsgi_buffer_byte(ub, 0xDD)) return -1;
+        return uwsgi_buffer_u32be(ub, len);
+}
+
+int uwsgi_buffer_msgpack_str(struct uwsgi_buffer *ub, char *str, uint32_t len) {
+        if (len <= 31) {
+                if (uwsgi_buffer_byte(ub, 0xA0 + len)) return -1;
+        }
+	// this is annoying, D9 does not work for older SPEC :(
+/*
+        else if (len <= 0xff) {
+                if (uwsgi_buffer_byte(ub, 0xD9)) return -1;
+                if (uwsgi_buffer_byte(ub, (uint8_t) len)) return -1;
+        }
+*/
+	else if (len <= 0xffff) {
+                if (uwsgi_buffer_byte(ub, 0xDA)) return -1;
+                if (uwsgi_buffer_u16be(ub, (uint16_t) len)) return -1;
+	}
+	else {
+                if (uwsgi_buffer_byte(ub, 0xDB)) return -1;
+                if (uwsgi_buffer_u32be(ub, len)) return -1;
+	}
+
+        return uwsgi_buffer_append(ub, str, len);
+}
+
+int uwsgi_buffer_msgpack_bin(struct uwsgi_buffer *ub, char *str, uint32_t len) {
+        if (len <= 0xff) {
+                if (uwsgi_buffer_byte(ub, 0xC4)) return -1;
+                if (uwsgi_buffer_byte(ub, (uint8_t) len)) return -1;
+        }
+        else if (len <= 0xffff) {
+                if (uwsgi_buffer_byte(ub, 0xC5)) return -1;
+		if (uwsgi_buffer_u16be(ub, (uint16_t) len)) return -1;
+        }
+        else {
+                if (uwsgi_buffer_byte(ub, 0xC6)) return -1;
+		if (uwsgi_buffer_u32be(ub, len)) return -1;
+        }
+
+        return uwsgi_buffer_append(ub, str, len);
+}
+
+
+int uwsgi_buffer_msgpack_int(struct uwsgi_buffer *ub, int64_t num) {
+	if (num >= 0 && num <= 127) {
+		return uwsgi_buffer_byte(ub, (uint8_t) num);
+	}
+	else if (num < 0 && num >= -31) {
+		return uwsgi_buffer_byte(ub, 224 | (int8_t) num);
+	}
+	else if (num <= 127 && num >= -127) {
+		if (uwsgi_buffer_byte(ub, 0xD0)) return -1;
+		return uwsgi_buffer_byte(ub, (int8_t) num);
+	}
+	else if (num <= 32767 && num >= -32767) {
+		if (uwsgi_buffer_byte(ub, 0xD1)) return -1;
+		return uwsgi_buffer_u16be(ub, (uint16_t) num);
+	}
+	else if (num <= 2147483647LL && num >= -2147483648LL) {
+		if (uwsgi_buffer_byte(ub, 0xD2)) return -1;
+		return uwsgi_buffer_u32be(ub, (uint32_t) num);
+	}
+	if (uwsgi_buffer_byte(ub, 0xD3)) return -1;
+	return uwsgi_buffer_u64be(ub, (uint64_t)num);
+}
+
+int uwsgi_buffer_msgpack_float(struct uwsgi_buffer *ub, double num) {
+	if (num >= -126.0 && num <= 127.0) {
+        	if (uwsgi_buffer_byte(ub, 0xCA)) return -1;
+        	return uwsgi_buffer_f32be(ub, (float) num);
+	}
+	if (uwsgi_buffer_byte(ub, 0xCB)) return -1;
+        return uwsgi_buffer_f64be(ub, num);
+}
+
+int uwsgi_buffer_msgpack_nil(struct uwsgi_buffer *ub) {
+	return uwsgi_buffer_byte(ub, 0xC0);
+}
+
+int uwsgi_buffer_msgpack_true(struct uwsgi_buffer *ub) {
+	return uwsgi_buffer_byte(ub, 0xC3);
+}
+
+int uwsgi_buffer_msgpack_false(struct uwsgi_buffer *ub) {
+	return uwsgi_buffer_byte(ub, 0xC2);
+}
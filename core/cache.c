@@ -1,7 +1,108 @@
 #include "uwsgi.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 extern struct uwsgi_server uwsgi;
-#define cache_item(x) (struct uwsgi_cache_item *) (((char *)uc->items) + ((sizeof(struct uwsgi_cache_item)+uc->keysize) * x))
+#define cache_item(x) ((struct uwsgi_cache_item *) (((char *)uc->items) + ((sizeof(struct uwsgi_cache_item)+uc->keysize) * (x))))
+
+/*
+	open addressing hashtable layout (--cache2 layout=open)
+
+	instead of chaining items via prev/next, the hashtable is probed linearly.
+	A compact array of 1 byte tags (0 for empty slots, 0x80 | 7 bits of the hash for used ones)
+	is scanned 16 slots at a time (with SSE2) so the items array is touched only on tag matches.
+
+	The first UWSGI_CACHE_OA_GROUP tags are mirrored after the end of the array, so a group
+	load never needs to wrap. Deletion uses backward shifting, so no tombstones are needed and
+	the probe sequence always stops at the first empty slot.
+*/
+
+#define UWSGI_CACHE_OA_GROUP 16
+#define cache_oa_tag(h) (0x80 | (((h) >> 25) & 0x7f))
+
+static void cache_oa_set_tag(struct uwsgi_cache *uc, uint64_t pos, uint8_t tag) {
+	uc->tags[pos] = tag;
+	if (pos < UWSGI_CACHE_OA_GROUP) {
+		uc->tags[uc->hashsize + pos] = tag;
+	}
+}
+
+static uint64_t cache_oa_find(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint32_t hash) {
+	uint64_t pos = hash % uc->hashsize;
+	uint8_t tag = cache_oa_tag(hash);
+	uint64_t probed = 0;
+#ifdef __SSE2__
+	__m128i needle = _mm_set1_epi8((char) tag);
+	__m128i zero = _mm_setzero_si128();
+	while (probed < uc->hashsize) {
+		__m128i group = _mm_loadu_si128((__m128i *) (uc->tags + pos));
+		uint32_t match = _mm_movemask_epi8(_mm_cmpeq_epi8(group, needle));
+		uint32_t empty = _mm_movemask_epi8(_mm_cmpeq_epi8(group, zero));
+		// only the slots before the first empty one are part of the probe sequence
+		if (empty) match &= (empty & -empty) - 1;
+		while (match) {
+			uint64_t slot = uc->hashtable[(pos + __builtin_ctz(match)) % uc->hashsize];
+			struct uwsgi_cache_item *uci = cache_item(slot);
+			if (uci->hash == hash && uci->keysize == keylen && !memcmp(uci->key, key, keylen)) return slot;
+			match &= match - 1;
+		}
+		if (empty) return 0;
+		pos = (pos + UWSGI_CACHE_OA_GROUP) % uc->hashsize;
+		probed += UWSGI_CACHE_OA_GROUP;
+	}
+#else
+	while (probed < uc->hashsize) {
+		uint8_t t = uc->tags[pos];
+		if (!t) return 0;
+		if (t == tag) {
+			uint64_t slot = uc->hashtable[pos];
+			struct uwsgi_cache_item *uci = cache_item(slot);
+			if (uci->hash == hash && uci->keysize == keylen && !memcmp(uci->key, key, keylen)) return slot;
+		}
+		pos = (pos + 1) % uc->hashsize;
+		probed++;
+	}
+#endif
+	return 0;
+}
+
+static void cache_oa_insert(struct uwsgi_cache *uc, uint64_t index, uint32_t hash) {
+	// hashsize is always bigger than max_items, so an empty slot is always there
+	uint64_t pos = hash % uc->hashsize;
+	while (uc->tags[pos]) {
+		pos = (pos + 1) % uc->hashsize;
+	}
+	uc->hashtable[pos] = index;
+	cache_oa_set_tag(uc, pos, cache_oa_tag(hash));
+}
+
+static void cache_oa_remove(struct uwsgi_cache *uc, uint64_t index, uint32_t hash) {
+	uint64_t pos = hash % uc->hashsize;
+	uint64_t probed = 0;
+	while (uc->hashtable[pos] != index || !uc->tags[pos]) {
+		if (!uc->tags[pos] || ++probed >= uc->hashsize) return;
+		pos = (pos + 1) % uc->hashsize;
+	}
+
+	// backward shift: move back the following items that would be unreachable otherwise
+	uint64_t hole = pos;
+	uint64_t next = (pos + 1) % uc->hashsize;
+	while (uc->tags[next]) {
+		struct uwsgi_cache_item *uci = cache_item(uc->hashtable[next]);
+		uint64_t home = uci->hash % uc->hashsize;
+		// is home cyclically outside (hole, next] ?
+		if ((next > hole && (home <= hole || home > next)) || (next < hole && (home <= hole && home > next))) {
+			uc->hashtable[hole] = uc->hashtable[next];
+			cache_oa_set_tag(uc, hole, uc->tags[next]);
+			hole = next;
+		}
+		next = (next + 1) % uc->hashsize;
+	}
+	uc->hashtable[hole] = 0;
+	cache_oa_set_tag(uc, hole, 0);
+}
 
 // block bitmap manager
 
@@ -24,6 +125,8 @@ extern struct uwsgi_server uwsgi;
 
 */
 
+static uint64_t cache_policy_victim(struct uwsgi_cache *);
+
 static void cache_full(struct uwsgi_cache *uc) {
 	uint64_t i;
 	int clear_cache = uc->clear_on_full;
@@ -37,8 +140,13 @@ static void cache_full(struct uwsgi_cache *uc) {
 
         uc->full++;
 
-        if (uc->purge_lru && uc->lru_head)
-        	uwsgi_cache_del2(uc, NULL, 0, uc->lru_head, UWSGI_CACHE_FLAG_LOCAL);
+        if (uc->purge_lru) {
+		uint64_t victim = cache_policy_victim(uc);
+		if (victim) {
+        		uwsgi_cache_del2(uc, NULL, 0, victim, UWSGI_CACHE_FLAG_LOCAL);
+			uc->evictions++;
+		}
+	}
 
 	// we do not need locking here !
 	if (uc->sweep_on_full) {
@@ -217,7 +325,20 @@ static void cache_unmark_blocks(struct uwsgi_cache *uc, uint64_t index, uint64_t
         }
 }
 
-static void cache_send_udp_command(struct uwsgi_cache *, char *, uint16_t, char *, uint16_t, uint64_t, uint8_t);
+// free the blocks of a value, unless a reader pinned them
+static void cache_release_blocks(struct uwsgi_cache *uc, uint64_t first_block, uint64_t size) {
+	uint64_t i;
+	for (i = 0; i < UWSGI_CACHE_PINS; i++) {
+		struct uwsgi_cache_pin *ucp = &uc->pins[i];
+		if (ucp->refs && !ucp->released && ucp->first_block == first_block) {
+			ucp->released = 1;
+			return;
+		}
+	}
+	cache_unmark_blocks(uc, first_block, size);
+}
+
+static void cache_send_udp_command(struct uwsgi_cache *, char *, uint16_t, char *, uint64_t, uint64_t, uint8_t);
 
 static void cache_sync_hook(char *k, uint16_t kl, char *v, uint16_t vl, void *data) {
 	struct uwsgi_cache *uc = (struct uwsgi_cache *) data;
@@ -258,14 +379,15 @@ static void uwsgi_cache_add_items(struct uwsgi_cache *uc) {
 		key_len = value - key;
 		value++;
 		uint64_t len = (usl->value + usl->len) - value;
-		uwsgi_wlock(uc->lock);
-		if (!uwsgi_cache_set2(uc, key, key_len, value, len, 0, 0)) {
+		struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, key_len);
+		uwsgi_wlock(ucs->lock);
+		if (!uwsgi_cache_set2(ucs, key, key_len, value, len, 0, 0)) {
 			uwsgi_log("[cache] stored \"%.*s\" in \"%s\"\n", key_len, key, uc->name);
 		}
 		else {
 			uwsgi_log("[cache-error] unable to store \"%.*s\" in \"%s\"\n", key_len, key, uc->name);
 		}
-		uwsgi_rwunlock(uc->lock);
+		uwsgi_rwunlock(ucs->lock);
 next:
 		usl = usl->next;
 	}
@@ -290,14 +412,15 @@ static void uwsgi_cache_load_files(struct uwsgi_cache *uc) {
 		}
 		value = uwsgi_open_and_read(key, &len, 0, NULL);
 		if (value) {
-			uwsgi_wlock(uc->lock);
-			if (!uwsgi_cache_set2(uc, key, key_len, value, len, 0, 0)) {
+			struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, key_len);
+			uwsgi_wlock(ucs->lock);
+			if (!uwsgi_cache_set2(ucs, key, key_len, value, len, 0, 0)) {
 				uwsgi_log("[cache] stored \"%.*s\" in \"%s\"\n", key_len, key, uc->name);
 			}		
 			else {
 				uwsgi_log("[cache-error] unable to store \"%.*s\" in \"%s\"\n", key_len, key, uc->name);
 			}
-			uwsgi_rwunlock(uc->lock);
+			uwsgi_rwunlock(ucs->lock);
 			free(value);
 		}
 		else {
@@ -327,11 +450,12 @@ next:
                 if (value) {
 			struct uwsgi_buffer *gzipped = uwsgi_gzip(value, len);
 			if (gzipped) {
-                        	uwsgi_wlock(uc->lock);
-                        	if (!uwsgi_cache_set2(uc, key, key_len, gzipped->buf, gzipped->len, 0, 0)) {
+				struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, key_len);
+                        	uwsgi_wlock(ucs->lock);
+                        	if (!uwsgi_cache_set2(ucs, key, key_len, gzipped->buf, gzipped->len, 0, 0)) {
                                 	uwsgi_log("[cache-gzip] stored \"%.*s\" in \"%s\"\n", key_len, key, uc->name);
                         	}
-                        	uwsgi_rwunlock(uc->lock);
+                        	uwsgi_rwunlock(ucs->lock);
 				uwsgi_buffer_destroy(gzipped);
 			}
                         free(value);
@@ -344,18 +468,478 @@ next2:
 
 
 
+/*
+	snapshots
+
+	the snapshot file contains two slots, written alternately, so a crash during a snapshot
+	can only corrupt the slot being written. Every slot is:
+
+	header (4096 bytes) | hashes of the regions (page aligned) | segments (region aligned)
+
+	the segments are the items area, the hashtable, the open addressing tags, the unused blocks stack,
+	the blocks bitmap and the expiration wheel: the whole cache state is restored without scanning the items.
+	Segments are split in 64k regions, only the regions changed since the last write of the slot are rewritten.
+*/
+
+#define UWSGI_CACHE_SNAPSHOT_VERSION 1
+#define UWSGI_CACHE_SNAPSHOT_REGION (64 * 1024)
+#define UWSGI_CACHE_SNAPSHOT_MAX_SEGMENTS 6
+
+struct uwsgi_cache_snapshot_header {
+	char magic[8];
+	uint64_t version;
+	uint64_t generation;
+	uint64_t created;
+	// geometry
+	uint64_t item_size;
+	uint64_t filesize;
+	uint64_t hashsize;
+	uint64_t max_items;
+	uint64_t blocks;
+	uint64_t blocksize;
+	uint64_t keysize;
+	uint64_t layout;
+	uint64_t regions;
+	uint64_t regions_hash;
+	// state
+	uint64_t n_items;
+	uint64_t unused_blocks_stack_ptr;
+	uint64_t lru_head;
+	uint64_t lru_tail;
+	uint64_t lru_protected_head;
+	uint64_t lru_protected_tail;
+	uint64_t lru_protected_items;
+	uint64_t next_scan;
+	uint64_t wheel_pos;
+	// must be the last field
+	uint64_t checksum;
+};
+
+struct uwsgi_cache_snapshot_segment {
+	char *ptr;
+	uint64_t len;
+};
+
+static int cache_snapshot_segments(struct uwsgi_cache *uc, struct uwsgi_cache_snapshot_segment *segs) {
+	int n = 0;
+	segs[n].ptr = (char *) uc->items; segs[n++].len = uc->filesize;
+	segs[n].ptr = (char *) uc->hashtable; segs[n++].len = sizeof(uint64_t) * uc->hashsize;
+	if (uc->tags) {
+		segs[n].ptr = (char *) uc->tags; segs[n++].len = uc->hashsize + UWSGI_CACHE_OA_GROUP;
+	}
+	segs[n].ptr = (char *) uc->unused_blocks_stack; segs[n++].len = sizeof(uint64_t) * uc->max_items;
+	if (uc->blocks_bitmap) {
+		segs[n].ptr = (char *) uc->blocks_bitmap; segs[n++].len = uc->blocks_bitmap_size;
+	}
+	if (uc->expire_wheel) {
+		segs[n].ptr = (char *) uc->expire_wheel; segs[n++].len = sizeof(uint64_t) * UWSGI_CACHE_WHEEL_SLOTS;
+	}
+	return n;
+}
+
+static uint64_t cache_snapshot_regions(struct uwsgi_cache_snapshot_segment *segs, int n) {
+	uint64_t regions = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		regions += (segs[i].len + UWSGI_CACHE_SNAPSHOT_REGION - 1) / UWSGI_CACHE_SNAPSHOT_REGION;
+	}
+	return regions;
+}
+
+static uint64_t cache_snapshot_align(uint64_t len, uint64_t align) {
+	return ((len + align - 1) / align) * align;
+}
+
+// the size of the header + the hashes area
+static uint64_t cache_snapshot_head_size(uint64_t regions) {
+	return 4096 + cache_snapshot_align(regions * sizeof(uint64_t), 4096);
+}
+
+static uint64_t cache_snapshot_slot_size(struct uwsgi_cache_snapshot_segment *segs, int n) {
+	uint64_t size = cache_snapshot_head_size(cache_snapshot_regions(segs, n));
+	int i;
+	for (i = 0; i < n; i++) {
+		size += cache_snapshot_align(segs[i].len, UWSGI_CACHE_SNAPSHOT_REGION);
+	}
+	return size;
+}
+
+static uint64_t cache_snapshot_layout(struct uwsgi_cache *uc) {
+	return (uint64_t) uc->open_addressing | ((uint64_t) uc->use_blocks_bitmap << 1) | ((uint64_t) uc->purge_lru << 2) |
+		((uint64_t) (uc->expire_wheel != NULL) << 3) | ((uint64_t) uc->policy << 8);
+}
+
+static void cache_snapshot_geometry(struct uwsgi_cache *uc, struct uwsgi_cache_snapshot_header *ucsh, uint64_t regions) {
+	memcpy(ucsh->magic, "uWSGIcs", 8);
+	ucsh->version = UWSGI_CACHE_SNAPSHOT_VERSION;
+	ucsh->item_size = sizeof(struct uwsgi_cache_item);
+	ucsh->filesize = uc->filesize;
+	ucsh->hashsize = uc->hashsize;
+	ucsh->max_items = uc->max_items;
+	ucsh->blocks = uc->blocks;
+	ucsh->blocksize = uc->blocksize;
+	ucsh->keysize = uc->keysize;
+	ucsh->layout = cache_snapshot_layout(uc);
+	ucsh->regions = regions;
+}
+
+static uint64_t cache_snapshot_checksum(struct uwsgi_cache_snapshot_header *ucsh) {
+	return uwsgi_xxh3_64((char *) ucsh, offsetof(struct uwsgi_cache_snapshot_header, checksum));
+}
+
+static int cache_snapshot_pread(int fd, char *buf, size_t len, off_t offset) {
+	while (len > 0) {
+		ssize_t rlen = pread(fd, buf, len, offset);
+		if (rlen <= 0) return -1;
+		buf += rlen;
+		len -= rlen;
+		offset += rlen;
+	}
+	return 0;
+}
+
+static int cache_snapshot_pwrite(int fd, char *buf, size_t len, off_t offset) {
+	while (len > 0) {
+		ssize_t wlen = pwrite(fd, buf, len, offset);
+		if (wlen <= 0) {
+			uwsgi_error("cache_snapshot_pwrite()/pwrite()");
+			return -1;
+		}
+		buf += wlen;
+		len -= wlen;
+		offset += wlen;
+	}
+	return 0;
+}
+
+// reads and validates the header (and the hashes) of a slot
+static int cache_snapshot_read_head(struct uwsgi_cache *uc, int slot, uint64_t slot_size, uint64_t regions, struct uwsgi_cache_snapshot_header *ucsh, uint64_t *hashes) {
+	struct uwsgi_cache_snapshot_header expected;
+	off_t base = (off_t) slot * slot_size;
+
+	if (cache_snapshot_pread(uc->snapshot_fd, (char *) ucsh, sizeof(struct uwsgi_cache_snapshot_header), base)) return -1;
+	if (ucsh->checksum != cache_snapshot_checksum(ucsh)) return -1;
+
+	memset(&expected, 0, sizeof(struct uwsgi_cache_snapshot_header));
+	cache_snapshot_geometry(uc, &expected, regions);
+	// compare everything from the magic to the number of regions (generation and creation time excluded)
+	if (memcmp(ucsh->magic, expected.magic, 8) || ucsh->version != expected.version) return -1;
+	if (memcmp(&ucsh->item_size, &expected.item_size, offsetof(struct uwsgi_cache_snapshot_header, regions_hash) - offsetof(struct uwsgi_cache_snapshot_header, item_size))) return -1;
+
+	if (cache_snapshot_pread(uc->snapshot_fd, (char *) hashes, regions * sizeof(uint64_t), base + 4096)) return -1;
+	if (uwsgi_xxh3_64((char *) hashes, regions * sizeof(uint64_t)) != ucsh->regions_hash) return -1;
+	return 0;
+}
+
+static int cache_snapshot_load_slot(struct uwsgi_cache *uc, int slot, uint64_t slot_size, struct uwsgi_cache_snapshot_segment *segs, int n, uint64_t regions, uint64_t *hashes) {
+	off_t offset = (off_t) slot * slot_size + cache_snapshot_head_size(regions);
+	uint64_t r = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (cache_snapshot_pread(uc->snapshot_fd, segs[i].ptr, segs[i].len, offset)) return -1;
+		uint64_t pos;
+		for (pos = 0; pos < segs[i].len; pos += UWSGI_CACHE_SNAPSHOT_REGION) {
+			uint64_t len = segs[i].len - pos;
+			if (len > UWSGI_CACHE_SNAPSHOT_REGION) len = UWSGI_CACHE_SNAPSHOT_REGION;
+			if (uwsgi_xxh3_64(segs[i].ptr + pos, len) != hashes[r++]) return -1;
+		}
+		offset += cache_snapshot_align(segs[i].len, UWSGI_CACHE_SNAPSHOT_REGION);
+	}
+	return 0;
+}
+
+// back to an empty cache after a failed load
+static void cache_snapshot_reset(struct uwsgi_cache *uc, struct uwsgi_cache_snapshot_segment *segs, int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		memset(segs[i].ptr, 0, segs[i].len);
+	}
+	uc->unused_blocks_stack_ptr = 0;
+	uint64_t j;
+	for (j = 1; j < uc->max_items; j++) {
+		uc->unused_blocks_stack_ptr++;
+		uc->unused_blocks_stack[uc->unused_blocks_stack_ptr] = j;
+	}
+	if (uc->blocks_bitmap && (uc->blocks % 8)) {
+		uc->blocks_bitmap[uc->blocks_bitmap_size-1] = 0xff >> (uc->blocks % 8);
+	}
+}
+
+static void cache_snapshot_restore(struct uwsgi_cache *uc) {
+	struct uwsgi_cache_snapshot_segment segs[UWSGI_CACHE_SNAPSHOT_MAX_SEGMENTS];
+	struct uwsgi_cache_snapshot_header headers[2];
+	int n = cache_snapshot_segments(uc, segs);
+	uint64_t regions = cache_snapshot_regions(segs, n);
+	uint64_t slot_size = cache_snapshot_slot_size(segs, n);
+	int i;
+
+	uc->snapshot_fd = open(uc->snapshot, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+	if (uc->snapshot_fd < 0) {
+		uwsgi_error_open(uc->snapshot);
+		exit(1);
+	}
+
+	for (i = 0; i < 2; i++) {
+		uc->snapshot_hashes[i] = uwsgi_calloc(sizeof(uint64_t) * regions);
+		uc->snapshot_valid[i] = !cache_snapshot_read_head(uc, i, slot_size, regions, &headers[i], uc->snapshot_hashes[i]);
+	}
+
+	struct stat st;
+	if (fstat(uc->snapshot_fd, &st)) {
+		uwsgi_error("cache_snapshot_restore()/fstat()");
+		exit(1);
+	}
+	if ((uint64_t) st.st_size != slot_size * 2) {
+		if (st.st_size > 0) uwsgi_log("[cache-snapshot] snapshot file %s does not match cache \"%s\", it will be overwritten\n", uc->snapshot, uc->name);
+		if (ftruncate(uc->snapshot_fd, slot_size * 2)) {
+			uwsgi_error("cache_snapshot_restore()/ftruncate()");
+			exit(1);
+		}
+		return;
+	}
+
+	// try the most recent slot first
+	int first = 0;
+	if (uc->snapshot_valid[0] && uc->snapshot_valid[1]) {
+		first = headers[1].generation > headers[0].generation ? 1 : 0;
+	}
+	else if (uc->snapshot_valid[1]) {
+		first = 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		int slot = (first + i) % 2;
+		if (!uc->snapshot_valid[slot]) continue;
+		uint64_t start = uwsgi_micros();
+		if (cache_snapshot_load_slot(uc, slot, slot_size, segs, n, regions, uc->snapshot_hashes[slot])) {
+			uwsgi_log("[cache-snapshot] corrupted snapshot slot %d (generation %llu) for cache \"%s\"\n", slot, (unsigned long long) headers[slot].generation, uc->name);
+			uc->snapshot_valid[slot] = 0;
+			continue;
+		}
+		struct uwsgi_cache_snapshot_header *ucsh = &headers[slot];
+		uc->n_items = ucsh->n_items;
+		uc->unused_blocks_stack_ptr = ucsh->unused_blocks_stack_ptr;
+		uc->lru_head = ucsh->lru_head;
+		uc->lru_tail = ucsh->lru_tail;
+		uc->lru_protected_head = ucsh->lru_protected_head;
+		uc->lru_protected_tail = ucsh->lru_protected_tail;
+		uc->lru_protected_items = ucsh->lru_protected_items;
+		uc->next_scan = ucsh->next_scan;
+		if (uc->expire_wheel) uc->wheel_pos = ucsh->wheel_pos;
+		uc->snapshot_generation = ucsh->generation;
+		uwsgi_log("[cache-snapshot] restored %llu items for cache \"%s\" from %s (generation %llu) in %llu ms\n", (unsigned long long) uc->n_items, uc->name, uc->snapshot,
+			(unsigned long long) ucsh->generation, (unsigned long long) ((uwsgi_micros() - start) / 1000));
+		return;
+	}
+
+	cache_snapshot_reset(uc, segs, n);
+}
+
+/*
+	the cache lock is held only for copying the state in a private buffer (a single memcpy for
+	every segment), regions hashing and writes run on the copy, so writers are not stalled
+	by the checksums (the price is a second copy of the cache in the snapshotter memory)
+*/
+// returns the number of written regions, -1 on error
+static int64_t cache_snapshot(struct uwsgi_cache *uc) {
+	struct uwsgi_cache_snapshot_segment segs[UWSGI_CACHE_SNAPSHOT_MAX_SEGMENTS];
+	struct uwsgi_cache_snapshot_header ucsh;
+	int n = cache_snapshot_segments(uc, segs);
+	uint64_t regions = cache_snapshot_regions(segs, n);
+	uint64_t slot_size = cache_snapshot_slot_size(segs, n);
+	uint64_t generation = uc->snapshot_generation + 1;
+	int slot = generation % 2;
+	int last = (slot + 1) % 2;
+	uint64_t *hashes = uwsgi_malloc(sizeof(uint64_t) * regions);
+	// position in the copy and file offset of the changed regions
+	uint64_t *dirty = uwsgi_malloc(sizeof(uint64_t) * regions * 3);
+	uint64_t dirty_count = 0, changed = 0;
+	int64_t ret = -1;
+	int i;
+
+	uint64_t copy_size = 0;
+	for (i = 0; i < n; i++) {
+		copy_size += segs[i].len;
+	}
+	if (!uc->snapshot_copy) uc->snapshot_copy = uwsgi_malloc(copy_size);
+
+	memset(&ucsh, 0, sizeof(struct uwsgi_cache_snapshot_header));
+
+	uwsgi_rlock(uc->lock);
+	char *ptr = uc->snapshot_copy;
+	for (i = 0; i < n; i++) {
+		memcpy(ptr, segs[i].ptr, segs[i].len);
+		ptr += segs[i].len;
+	}
+	cache_snapshot_geometry(uc, &ucsh, regions);
+	ucsh.n_items = uc->n_items;
+	ucsh.unused_blocks_stack_ptr = uc->unused_blocks_stack_ptr;
+	ucsh.lru_head = uc->lru_head;
+	ucsh.lru_tail = uc->lru_tail;
+	ucsh.lru_protected_head = uc->lru_protected_head;
+	ucsh.lru_protected_tail = uc->lru_protected_tail;
+	ucsh.lru_protected_items = uc->lru_protected_items;
+	ucsh.next_scan = uc->next_scan;
+	ucsh.wheel_pos = uc->wheel_pos;
+	uwsgi_rwunlock(uc->lock);
+
+	uint64_t r = 0;
+	off_t offset = (off_t) slot * slot_size + cache_snapshot_head_size(regions);
+	ptr = uc->snapshot_copy;
+	for (i = 0; i < n; i++) {
+		uint64_t pos;
+		for (pos = 0; pos < segs[i].len; pos += UWSGI_CACHE_SNAPSHOT_REGION) {
+			uint64_t len = segs[i].len - pos;
+			if (len > UWSGI_CACHE_SNAPSHOT_REGION) len = UWSGI_CACHE_SNAPSHOT_REGION;
+			hashes[r] = uwsgi_xxh3_64(ptr + pos, len);
+			if (!uc->snapshot_valid[last] || hashes[r] != uc->snapshot_hashes[last][r]) changed++;
+			if (!uc->snapshot_valid[slot] || hashes[r] != uc->snapshot_hashes[slot][r]) {
+				dirty[dirty_count * 3] = (ptr - uc->snapshot_copy) + pos;
+				dirty[(dirty_count * 3) + 1] = len;
+				dirty[(dirty_count * 3) + 2] = offset + pos;
+				dirty_count++;
+			}
+			r++;
+		}
+		ptr += segs[i].len;
+		offset += cache_snapshot_align(segs[i].len, UWSGI_CACHE_SNAPSHOT_REGION);
+	}
+
+	// nothing changed since the last snapshot
+	if (!changed) {
+		ret = 0;
+		goto end;
+	}
+
+	ucsh.generation = generation;
+	ucsh.created = uwsgi_now();
+	ucsh.regions_hash = uwsgi_xxh3_64((char *) hashes, regions * sizeof(uint64_t));
+	ucsh.checksum = cache_snapshot_checksum(&ucsh);
+
+	// invalidate the slot before touching it
+	struct uwsgi_cache_snapshot_header empty;
+	memset(&empty, 0, sizeof(struct uwsgi_cache_snapshot_header));
+	uc->snapshot_valid[slot] = 0;
+	if (cache_snapshot_pwrite(uc->snapshot_fd, (char *) &empty, sizeof(struct uwsgi_cache_snapshot_header), (off_t) slot * slot_size)) goto end;
+	if (fdatasync(uc->snapshot_fd)) goto end;
+
+	uint64_t d;
+	for (d = 0; d < dirty_count; d++) {
+		if (cache_snapshot_pwrite(uc->snapshot_fd, uc->snapshot_copy + dirty[d * 3], dirty[(d * 3) + 1], dirty[(d * 3) + 2])) goto end;
+	}
+	if (cache_snapshot_pwrite(uc->snapshot_fd, (char *) hashes, regions * sizeof(uint64_t), ((off_t) slot * slot_size) + 4096)) goto end;
+	if (fdatasync(uc->snapshot_fd)) goto end;
+
+	if (cache_snapshot_pwrite(uc->snapshot_fd, (char *) &ucsh, sizeof(struct uwsgi_cache_snapshot_header), (off_t) slot * slot_size)) goto end;
+	if (fdatasync(uc->snapshot_fd)) goto end;
+
+	memcpy(uc->snapshot_hashes[slot], hashes, sizeof(uint64_t) * regions);
+	uc->snapshot_valid[slot] = 1;
+	uc->snapshot_generation = generation;
+	ret = dirty_count;
+end:
+	free(dirty);
+	free(hashes);
+	return ret;
+}
+
+static void *cache_snapshot_loop(void *arg) {
+	// block all signals
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	for (;;) {
+		sleep(1);
+		time_t now = uwsgi_now();
+		struct uwsgi_cache *uc;
+		for (uc = uwsgi.caches; uc; uc = uc->next) {
+			if (!uc->snapshot || uc->shards) continue;
+			if (now - uc->snapshot_last < (time_t) uc->snapshot_freq) continue;
+			uc->snapshot_last = now;
+			int64_t written = cache_snapshot(uc);
+			if (written < 0) {
+				uwsgi_log("[cache-snapshot] unable to write snapshot for cache \"%s\"\n", uc->name);
+			}
+			else if (written > 0 && uwsgi.cache_report_freed_items) {
+				uwsgi_log("[cache-snapshot] cache \"%s\" generation %llu: %lld regions written\n", uc->name, (unsigned long long) uc->snapshot_generation, (long long) written);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+void uwsgi_cache_start_snapshotters() {
+	struct uwsgi_cache *uc;
+	for (uc = uwsgi.caches; uc; uc = uc->next) {
+		if (uc->snapshot && !uc->shards) break;
+	}
+
+	if (!uc) return;
+
+	pthread_t cache_snapshotter;
+	if (pthread_create(&cache_snapshotter, NULL, cache_snapshot_loop, NULL)) {
+		uwsgi_error("uwsgi_cache_start_snapshotters()/pthread_create()");
+		uwsgi_log("unable to run the cache snapshot thread !!!\n");
+		return;
+	}
+	uwsgi_log("cache snapshot thread enabled\n");
+}
+
+static void cache_init_unused_blocks(uint64_t from, uint64_t to, void *data) {
+	struct uwsgi_cache *uc = (struct uwsgi_cache *) data;
+	uint64_t i;
+	// item 0 is never used
+	if (from == 0) from = 1;
+	for (i = from; i < to; i++) {
+		uc->unused_blocks_stack[i] = i;
+	}
+}
+
+static void cache_init_items(uint64_t from, uint64_t to, void *data) {
+	struct uwsgi_cache *uc = (struct uwsgi_cache *) data;
+	uint64_t i;
+	for (i = from; i < to; i++) {
+		// here we only need to clear the item header
+		memset(cache_item(i), 0, sizeof(struct uwsgi_cache_item));
+	}
+}
+
 void uwsgi_cache_init(struct uwsgi_cache *uc) {
 
+	if (uc->open_addressing) {
+		// keep the load factor below 100% (slot 0 is never used) and at least a full group
+		if (uc->hashsize < uc->max_items) uc->hashsize = uc->max_items;
+		if (uc->hashsize < UWSGI_CACHE_OA_GROUP) uc->hashsize = UWSGI_CACHE_OA_GROUP;
+		uc->tags = uwsgi_calloc_shared(uc->hashsize + UWSGI_CACHE_OA_GROUP);
+	}
 	uc->hashtable = uwsgi_calloc_shared(sizeof(uint64_t) * uc->hashsize);
+	if (uc->policy == UWSGI_CACHE_POLICY_SLRU) {
+		uc->lru_protected_max = (uc->max_items * 8) / 10;
+		if (!uc->lru_protected_max) uc->lru_protected_max = 1;
+	}
+	if (uc->tinylfu) {
+		uint64_t width = 16;
+		while (width < uc->max_items) width <<= 1;
+		uc->sketch_mask = width - 1;
+		uc->sketch = uwsgi_calloc_shared(width * 4);
+		uc->sketch_ops = uwsgi_calloc_shared(sizeof(uint64_t));
+	}
+	if (uc->use_expire_wheel) {
+		uc->expire_wheel = uwsgi_calloc_shared(sizeof(uint64_t) * UWSGI_CACHE_WHEEL_SLOTS);
+		uc->wheel_pos = uwsgi_now();
+	}
+	if (uc->replication_window) {
+		uc->replication_buffers[0] = uwsgi_calloc_shared(uc->replication_buffer_size);
+		uc->replication_buffers[1] = uwsgi_calloc_shared(uc->replication_buffer_size);
+	}
 	uc->unused_blocks_stack = uwsgi_calloc_shared(sizeof(uint64_t) * uc->max_items);
-	uc->unused_blocks_stack_ptr = 0;
 	uc->filesize = ( (sizeof(struct uwsgi_cache_item)+uc->keysize) * uc->max_items) + (uc->blocksize * uc->blocks);
 
-	uint64_t i;
-	for (i = 1; i < uc->max_items; i++) {
-        	uc->unused_blocks_stack_ptr++;
-                uc->unused_blocks_stack[uc->unused_blocks_stack_ptr] = i;
-        }
+	// slot n of the stack holds item n (the stack pointer is at the top)
+	uwsgi_parallel_for(uc->max_items, 1024 * 1024, cache_init_unused_blocks, uc);
+	uc->unused_blocks_stack_ptr = uc->max_items ? uc->max_items - 1 : 0;
 
 	if (uc->use_blocks_bitmap) {
 		uc->blocks_bitmap_size = uc->blocks/8;
@@ -365,6 +949,7 @@ void uwsgi_cache_init(struct uwsgi_cache *uc) {
 		if (m > 0) {
 			uc->blocks_bitmap[uc->blocks_bitmap_size-1] = 0xff >> m;
 		}
+		uc->pins = uwsgi_calloc_shared(sizeof(struct uwsgi_cache_pin) * UWSGI_CACHE_PINS);
 	}
 
 	//uwsgi.cache_items = (struct uwsgi_cache_item *) mmap(NULL, sizeof(struct uwsgi_cache_item) * uwsgi.cache_max_items, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
@@ -410,19 +995,15 @@ void uwsgi_cache_init(struct uwsgi_cache *uc) {
 			exit(1);
 		}
 
+		uc->items_page_size = uwsgi.page_size;
 		uwsgi_cache_fix(uc);
 		close(cache_fd);
 	}
 	else {
-		uc->items = (struct uwsgi_cache_item *) mmap(NULL, uc->filesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
-		if (uc->items == MAP_FAILED) {
-			uwsgi_error("uwsgi_cache_init()/mmap()");
-			exit(1);
-		}
-		uint64_t i;
-		for (i = 0; i < uc->max_items; i++) {
-			// here we only need to clear the item header
-			memset(cache_item(i), 0, sizeof(struct uwsgi_cache_item));
+		uc->items = (struct uwsgi_cache_item *) uwsgi_mmap_shared(uc->filesize, &uc->items_page_size);
+		uwsgi_parallel_for(uc->max_items, 256 * 1024, cache_init_items, uc);
+		if (uc->snapshot) {
+			cache_snapshot_restore(uc);
 		}
 	}
 
@@ -444,7 +1025,9 @@ void uwsgi_cache_init(struct uwsgi_cache *uc) {
 			(unsigned long long) ((sizeof(struct uwsgi_cache_item)+uc->keysize) * uc->max_items), (unsigned long long) (uc->blocksize * uc->blocks),
 			(unsigned long long) uc->blocks_bitmap_size);
 
-	uwsgi_cache_setup_nodes(uc);
+	// shards share the nodes list of the parent (already configured)
+	if (!uc->shard_of)
+		uwsgi_cache_setup_nodes(uc);
 
 	uc->udp_node_socket = socket(AF_INET, SOCK_DGRAM, 0);
 	if (uc->udp_node_socket < 0) {
@@ -455,12 +1038,90 @@ void uwsgi_cache_init(struct uwsgi_cache *uc) {
 
 	uwsgi_cache_sync_from_nodes(uc);
 
+	// files and items are loaded by the parent (they are dispatched to the right shard)
+	if (uc->shard_of) return;
+
 	uwsgi_cache_load_files(uc);
 
 	uwsgi_cache_add_items(uc);
 
 }
 
+/*
+	lock-striped caches
+
+	when shards=N is specified, the cache is split in N independent caches (each one
+	with its own lock, hashtable, items and blocks). The parent cache holds no data, it
+	only maps keys to shards using the high bits of the (fibonacci-scrambled) key hash, the low
+	bits are used by the shard hashtable, so the two distributions do not interfere.
+
+	Shards are named <name>:<n> and are appended to the caches list, so sweepers, store syncing,
+	stats and remote sync work on them without special casing.
+*/
+
+struct uwsgi_cache *uwsgi_cache_shard(struct uwsgi_cache *uc, char *key, uint16_t keylen) {
+	if (!uc->shards) return uc;
+	uint32_t hash = uc->hash->func(key, keylen) * 2654435761U;
+	return uc->shards[((uint64_t) hash * uc->shards_count) >> 32];
+}
+
+static void uwsgi_cache_init_shards(struct uwsgi_cache *uc) {
+	uint64_t i;
+
+	if (uc->shards_count > uc->max_items) {
+		uwsgi_log("invalid number of shards for cache \"%s\", must be lower than max_items (%llu)\n", uc->name, (unsigned long long) uc->max_items);
+		exit(1);
+	}
+
+	uwsgi_cache_setup_nodes(uc);
+
+	uc->shards = uwsgi_calloc_shared(sizeof(struct uwsgi_cache *) * uc->shards_count);
+
+	struct uwsgi_cache *last = uc;
+	for (i = 0; i < uc->shards_count; i++) {
+		char *num = uwsgi_64bit2str(i);
+		struct uwsgi_cache *ucs = uwsgi_calloc_shared(sizeof(struct uwsgi_cache));
+		memcpy(ucs, uc, sizeof(struct uwsgi_cache));
+		ucs->shards = NULL;
+		ucs->shards_count = 0;
+		ucs->shard_of = uc;
+		ucs->name = uwsgi_concat3(uc->name, ":", num);
+		ucs->name_len = strlen(ucs->name);
+		// slot 0 is never used
+		ucs->max_items = (uc->max_items / uc->shards_count) + 1;
+		ucs->blocks = (uc->blocks / uc->shards_count) + 1;
+		ucs->hashsize = uc->hashsize / uc->shards_count;
+		if (!ucs->hashsize) ucs->hashsize = 1;
+		if (ucs->use_blocks_bitmap) {
+			ucs->max_item_size = ucs->blocksize * ucs->blocks;
+		}
+		if (uc->store) {
+			ucs->store = uwsgi_concat3(uc->store, ".", num);
+		}
+		if (uc->snapshot) {
+			ucs->snapshot = uwsgi_concat3(uc->snapshot, ".", num);
+		}
+		// the parent udp server dispatches updates to the shards
+		ucs->udp_servers = NULL;
+		free(num);
+
+		ucs->next = last->next;
+		last->next = ucs;
+		last = ucs;
+
+		uc->shards[i] = ucs;
+		uwsgi_cache_init(ucs);
+	}
+
+	uc->max_item_size = uc->shards[0]->max_item_size;
+
+	uwsgi_log("*** Cache \"%s\" split in %llu shards ***\n", uc->name, (unsigned long long) uc->shards_count);
+
+	uwsgi_cache_load_files(uc);
+
+	uwsgi_cache_add_items(uc);
+}
+
 static uint64_t check_lazy(struct uwsgi_cache *uc, struct uwsgi_cache_item *uci, uint64_t slot) {
 	if (!uci->expires || !uc->lazy_expire) return slot;
 	uint64_t now = (uint64_t) uwsgi_now();
@@ -472,9 +1133,20 @@ static uint64_t check_lazy(struct uwsgi_cache *uc, struct uwsgi_cache_item *uci,
 	return slot;
 }
 
+static void cache_sketch_record(struct uwsgi_cache *, uint32_t);
+
 static uint64_t uwsgi_cache_get_index(struct uwsgi_cache *uc, char *key, uint16_t keylen) {
 
 	uint32_t hash = uc->hash->func(key, keylen);
+
+	if (uc->tinylfu) cache_sketch_record(uc, hash);
+
+	if (uc->open_addressing) {
+		uint64_t found = cache_oa_find(uc, key, keylen, hash);
+		if (!found) return 0;
+		return check_lazy(uc, cache_item(found), found);
+	}
+
 	uint32_t hash_key = hash % uc->hashsize;
 
 	uint64_t slot = uc->hashtable[hash_key];
@@ -528,12 +1200,108 @@ cycle:
 	return 0;
 }
 
+/*
+	seqlock reads
+
+	when a cache is created with seqlock=1, writers (that always hold the write lock) make
+	uc->seq odd while modifying the hashtable/items and even again when done.
+	Readers get the value without locking: they copy it optimistically and retry if uc->seq
+	changed in the meantime. Readers never write to shared memory (so hits/miss counters
+	are not updated by lockless reads).
+
+	Nested modifications (like set -> full -> del) only bump the counter in the outer call.
+*/
+
+static int cache_seq_write_begin(struct uwsgi_cache *uc) {
+	if (!uc->seqlock || (uc->seq & 1)) return 0;
+	__atomic_store_n(&uc->seq, uc->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 1;
+}
+
+static void cache_seq_write_end(struct uwsgi_cache *uc, int owned) {
+	if (!owned) return;
+	__atomic_store_n(&uc->seq, uc->seq + 1, __ATOMIC_RELEASE);
+}
+
+// returns 0 on consistent read (*value is NULL on miss), -1 if the read must be retried
+static int cache_seq_read(struct uwsgi_cache *uc, char *key, uint16_t keylen, char **value, uint64_t *valsize, uint64_t *expires) {
+	*value = NULL;
+	uint64_t seq = __atomic_load_n(&uc->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1) return -1;
+
+	if (keylen > uc->keysize) return 0;
+
+	uint32_t hash = uc->hash->func(key, keylen);
+	uint64_t pos = hash % uc->hashsize;
+	uint64_t slot = uc->hashtable[pos];
+	uint64_t rounds = 0;
+	struct uwsgi_cache_item *uci = NULL;
+
+	if (uc->open_addressing) {
+		uint8_t tag = cache_oa_tag(hash);
+		for (;;) {
+			uint8_t t = uc->tags[pos];
+			if (!t) {
+				slot = 0;
+				break;
+			}
+			if (rounds++ > uc->hashsize) return -1;
+			if (t == tag) {
+				slot = uc->hashtable[pos];
+				if (slot >= uc->max_items) return -1;
+				uci = cache_item(slot);
+				if (uci->hash == hash && uci->keysize == keylen && !memcmp(uci->key, key, keylen)) break;
+			}
+			pos = (pos + 1) % uc->hashsize;
+		}
+	}
+	else {
+		while (slot) {
+			// a concurrent writer can generate garbage, never trust what we read
+			if (slot >= uc->max_items || rounds++ > uc->max_items) return -1;
+			uci = cache_item(slot);
+			if (uci->hash == hash && uci->keysize == keylen && !memcmp(uci->key, key, keylen)) break;
+			slot = uci->next;
+		}
+	}
+
+	if (slot && !(uci->flags & UWSGI_CACHE_FLAG_UNGETTABLE)) {
+		uint64_t first_block = uci->first_block;
+		uint64_t vlen = uci->valsize;
+		uint64_t item_expires = uci->expires;
+		if (!vlen || vlen > uc->max_item_size || first_block >= uc->blocks) return -1;
+		if ((first_block * uc->blocksize) + vlen > uc->blocks * uc->blocksize) return -1;
+		if (item_expires && uc->lazy_expire && item_expires <= (uint64_t) uwsgi_now()) goto check;
+		*value = uwsgi_malloc(vlen);
+		memcpy(*value, ((char *) uc->data) + (first_block * uc->blocksize), vlen);
+		*valsize = vlen;
+		if (expires) *expires = item_expires;
+	}
+
+check:
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&uc->seq, __ATOMIC_RELAXED) != seq) {
+		if (*value) {
+			free(*value);
+			*value = NULL;
+		}
+		return -1;
+	}
+	return 0;
+}
+
 uint32_t uwsgi_cache_exists2(struct uwsgi_cache *uc, char *key, uint16_t keylen) {
 
+	if (uc->immutable) {
+		uint64_t valsize;
+		return uwsgi_cache_immutable_get(uc, key, keylen, &valsize) ? 1 : 0;
+	}
+
 	return uwsgi_cache_get_index(uc, key, keylen);
 }
 
-static void lru_remove_item(struct uwsgi_cache *uc, uint64_t index)
+static void lru_list_remove(struct uwsgi_cache *uc, uint64_t *head, uint64_t *tail, uint64_t index)
 {
 	struct uwsgi_cache_item *prev, *next, *curr = cache_item(index);
 
@@ -541,43 +1309,231 @@ static void lru_remove_item(struct uwsgi_cache *uc, uint64_t index)
 		next = cache_item(curr->lru_next);
 		next->lru_prev = curr->lru_prev;
 	} else
-		uc->lru_tail = curr->lru_prev;
+		*tail = curr->lru_prev;
 
 	if (curr->lru_prev) {
 		prev = cache_item(curr->lru_prev);
 		prev->lru_next = curr->lru_next;
 	} else
-		uc->lru_head = curr->lru_next;
+		*head = curr->lru_next;
 }
 
-static void lru_add_item(struct uwsgi_cache *uc, uint64_t index)
+static void lru_list_add(struct uwsgi_cache *uc, uint64_t *head, uint64_t *tail, uint64_t index)
 {
 	struct uwsgi_cache_item *prev, *curr = cache_item(index);
 
-	if (uc->lru_tail) {
-		prev = cache_item(uc->lru_tail);
+	if (*tail) {
+		prev = cache_item(*tail);
 		prev->lru_next = index;
 	} else
-		uc->lru_head = index;
+		*head = index;
 
 	curr->lru_next = 0;
-	curr->lru_prev = uc->lru_tail;
-	uc->lru_tail = index;
+	curr->lru_prev = *tail;
+	*tail = index;
 }
 
-char *uwsgi_cache_get2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_t * valsize) {
+static void lru_remove_item(struct uwsgi_cache *uc, uint64_t index)
+{
+	lru_list_remove(uc, &uc->lru_head, &uc->lru_tail, index);
+}
 
-	uint64_t index = uwsgi_cache_get_index(uc, key, keylen);
+static void lru_add_item(struct uwsgi_cache *uc, uint64_t index)
+{
+	lru_list_add(uc, &uc->lru_head, &uc->lru_tail, index);
+}
 
-	if (index) {
-		struct uwsgi_cache_item *uci = cache_item(index);
-		if (uci->flags & UWSGI_CACHE_FLAG_UNGETTABLE)
-			return NULL;
-		*valsize = uci->valsize;
-		if (uc->purge_lru) {
+/*
+	eviction policies
+
+	lru: every hit moves the item to the tail of the list, the head is evicted.
+	slru: new items enter the probation segment (the lru list), a hit promotes them to the
+		protected segment (80% of the cache). When the protected segment is full its
+		least recently used item is demoted back to probation.
+	clock: hits only set a reference bit (no list manipulation). On eviction the hand (the head
+		of the list) skips (and clears) referenced items by moving them to the tail.
+
+	tinylfu can be combined with all of them: when the cache is full a new key is admitted only
+	if it has been requested more frequently than the victim chosen by the policy.
+*/
+
+static void cache_policy_add(struct uwsgi_cache *uc, uint64_t index) {
+	struct uwsgi_cache_item *uci = cache_item(index);
+	uci->flags &= ~(UWSGI_CACHE_ITEM_PROTECTED|UWSGI_CACHE_ITEM_REFERENCED);
+	lru_add_item(uc, index);
+}
+
+static void cache_policy_remove(struct uwsgi_cache *uc, uint64_t index) {
+	struct uwsgi_cache_item *uci = cache_item(index);
+	if (uci->flags & UWSGI_CACHE_ITEM_PROTECTED) {
+		lru_list_remove(uc, &uc->lru_protected_head, &uc->lru_protected_tail, index);
+		uc->lru_protected_items--;
+	}
+	else {
+		lru_remove_item(uc, index);
+	}
+	uci->flags &= ~(UWSGI_CACHE_ITEM_PROTECTED|UWSGI_CACHE_ITEM_REFERENCED);
+}
+
+static void cache_policy_hit(struct uwsgi_cache *uc, uint64_t index) {
+	struct uwsgi_cache_item *uci = cache_item(index);
+
+	switch(uc->policy) {
+		case UWSGI_CACHE_POLICY_CLOCK:
+			if (!(uci->flags & UWSGI_CACHE_ITEM_REFERENCED))
+				uci->flags |= UWSGI_CACHE_ITEM_REFERENCED;
+			return;
+		case UWSGI_CACHE_POLICY_SLRU:
+			if (uci->flags & UWSGI_CACHE_ITEM_PROTECTED) {
+				lru_list_remove(uc, &uc->lru_protected_head, &uc->lru_protected_tail, index);
+				lru_list_add(uc, &uc->lru_protected_head, &uc->lru_protected_tail, index);
+				return;
+			}
+			lru_remove_item(uc, index);
+			uci->flags |= UWSGI_CACHE_ITEM_PROTECTED;
+			lru_list_add(uc, &uc->lru_protected_head, &uc->lru_protected_tail, index);
+			uc->lru_protected_items++;
+			if (uc->lru_protected_items > uc->lru_protected_max) {
+				uint64_t demoted = uc->lru_protected_head;
+				lru_list_remove(uc, &uc->lru_protected_head, &uc->lru_protected_tail, demoted);
+				uc->lru_protected_items--;
+				cache_item(demoted)->flags &= ~UWSGI_CACHE_ITEM_PROTECTED;
+				lru_add_item(uc, demoted);
+			}
+			return;
+		default:
+			lru_remove_item(uc, index);
+			lru_add_item(uc, index);
+	}
+}
+
+static uint64_t cache_policy_victim(struct uwsgi_cache *uc) {
+	if (uc->policy == UWSGI_CACHE_POLICY_CLOCK) {
+		// every referenced item loses its bit, so this ends in at most one full round
+		while (uc->lru_head) {
+			struct uwsgi_cache_item *uci = cache_item(uc->lru_head);
+			if (!(uci->flags & UWSGI_CACHE_ITEM_REFERENCED)) break;
+			uci->flags &= ~UWSGI_CACHE_ITEM_REFERENCED;
+			uint64_t index = uc->lru_head;
 			lru_remove_item(uc, index);
 			lru_add_item(uc, index);
 		}
+	}
+	if (uc->lru_head) return uc->lru_head;
+	return uc->lru_protected_head;
+}
+
+static uint64_t cache_sketch_slot(struct uwsgi_cache *uc, uint32_t hash, int row) {
+	static const uint64_t seeds[4] = { 0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL };
+	uint64_t h = ((uint64_t) hash + 1) * seeds[row];
+	return (row * (uc->sketch_mask + 1)) + ((h >> 32) & uc->sketch_mask);
+}
+
+static uint8_t cache_sketch_freq(struct uwsgi_cache *uc, uint32_t hash) {
+	int i;
+	uint8_t freq = 15;
+	for (i = 0; i < 4; i++) {
+		uint8_t value = __atomic_load_n(&uc->sketch[cache_sketch_slot(uc, hash, i)], __ATOMIC_RELAXED);
+		if (value < freq) freq = value;
+	}
+	return freq;
+}
+
+/*
+	the sketch is recorded by the lookups too (under the read lock, concurrently with the other
+	workers), so the counters are updated with CAS (saturating at 15), and only the worker
+	resetting the operations counter runs the aging pass
+*/
+static void cache_sketch_record(struct uwsgi_cache *uc, uint32_t hash) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		uint8_t *counter = &uc->sketch[cache_sketch_slot(uc, hash, i)];
+		uint8_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		while (value < 15 && !__atomic_compare_exchange_n(counter, &value, value + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+	// aging: halve all of the counters every 10 * max_items accesses
+	uint64_t ops = __atomic_add_fetch(uc->sketch_ops, 1, __ATOMIC_RELAXED);
+	if (ops < uc->max_items * 10) return;
+	if (!__atomic_compare_exchange_n(uc->sketch_ops, &ops, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+	// 8 counters at a time (the sketch is page aligned and its size is a multiple of 64)
+	uint64_t *words = (uint64_t *) uc->sketch;
+	uint64_t j;
+	for (j = 0; j < ((uc->sketch_mask + 1) * 4) / 8; j++) {
+		uint64_t word = __atomic_load_n(&words[j], __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&words[j], &word, (word >> 1) & 0x7f7f7f7f7f7f7f7fULL, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+}
+
+// returns 0 if the new key (with the specified hash) should not replace the next victim
+static int cache_policy_admit(struct uwsgi_cache *uc, uint32_t hash) {
+	if (!uc->tinylfu) return 1;
+	uint64_t victim = cache_policy_victim(uc);
+	if (!victim) return 1;
+	if (cache_sketch_freq(uc, hash) > cache_sketch_freq(uc, cache_item(victim)->hash)) return 1;
+	uc->rejected++;
+	return 0;
+}
+
+/*
+	timer wheel
+
+	caches with expire_wheel=1 link every item with an expiration in one of the
+	UWSGI_CACHE_WHEEL_SLOTS (1 second granularity) buckets of the wheel, using the lru_prev/lru_next
+	fields (lru caches do not expire items). The sweeper only walks the buckets of the seconds
+	elapsed since its last run, so its work is proportional to the expiring items instead of max_items.
+	Items already expired when added are put in the next bucket to scan.
+*/
+
+static void cache_wheel_add(struct uwsgi_cache *uc, uint64_t index) {
+	struct uwsgi_cache_item *uci = cache_item(index);
+	if (!uc->expire_wheel || !uci->expires) return;
+	uint64_t bucket = (uci->expires < uc->wheel_pos ? uc->wheel_pos : uci->expires) % UWSGI_CACHE_WHEEL_SLOTS;
+	uci->lru_prev = 0;
+	uci->lru_next = uc->expire_wheel[bucket];
+	if (uci->lru_next) {
+		cache_item(uci->lru_next)->lru_prev = index;
+	}
+	uc->expire_wheel[bucket] = index;
+}
+
+static void cache_wheel_remove(struct uwsgi_cache *uc, uint64_t index) {
+	struct uwsgi_cache_item *uci = cache_item(index);
+	if (!uc->expire_wheel || !uci->expires) return;
+	if (uci->lru_prev) {
+		cache_item(uci->lru_prev)->lru_next = uci->lru_next;
+	}
+	else {
+		uint64_t bucket = uci->expires % UWSGI_CACHE_WHEEL_SLOTS;
+		// the item could have been added to a later bucket (it was already expired)
+		if (uc->expire_wheel[bucket] != index) {
+			for (bucket = 0; bucket < UWSGI_CACHE_WHEEL_SLOTS; bucket++) {
+				if (uc->expire_wheel[bucket] == index) break;
+			}
+		}
+		if (bucket < UWSGI_CACHE_WHEEL_SLOTS) {
+			uc->expire_wheel[bucket] = uci->lru_next;
+		}
+	}
+	if (uci->lru_next) {
+		cache_item(uci->lru_next)->lru_prev = uci->lru_prev;
+	}
+	uci->lru_prev = 0;
+	uci->lru_next = 0;
+}
+
+char *uwsgi_cache_get2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_t * valsize) {
+
+	if (uc->immutable) return uwsgi_cache_immutable_get(uc, key, keylen, valsize);
+
+	uint64_t index = uwsgi_cache_get_index(uc, key, keylen);
+
+	if (index) {
+		struct uwsgi_cache_item *uci = cache_item(index);
+		if (uci->flags & UWSGI_CACHE_FLAG_UNGETTABLE)
+			return NULL;
+		*valsize = uci->valsize;
+		if (uc->purge_lru)
+			cache_policy_hit(uc, index);
 		uci->hits++;
 		uc->hits++;
 		return uc->data + (uci->first_block * uc->blocksize);
@@ -590,6 +1546,14 @@ char *uwsgi_cache_get2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint6
 
 int64_t uwsgi_cache_num2(struct uwsgi_cache *uc, char *key, uint16_t keylen) {
 
+	if (uc->immutable) {
+		uint64_t valsize = 0;
+		char *value = uwsgi_cache_immutable_get(uc, key, keylen, &valsize);
+		int64_t num = 0;
+		if (value && valsize == 8) memcpy(&num, value, 8);
+		return num;
+	}
+
         uint64_t index = uwsgi_cache_get_index(uc, key, keylen);
 
         if (index) {
@@ -608,6 +1572,11 @@ int64_t uwsgi_cache_num2(struct uwsgi_cache *uc, char *key, uint16_t keylen) {
 
 char *uwsgi_cache_get3(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_t * valsize, uint64_t *expires) {
 
+	if (uc->immutable) {
+		if (expires) *expires = 0;
+		return uwsgi_cache_immutable_get(uc, key, keylen, valsize);
+	}
+
         uint64_t index = uwsgi_cache_get_index(uc, key, keylen);
 
         if (index) {
@@ -617,10 +1586,8 @@ char *uwsgi_cache_get3(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint6
                 *valsize = uci->valsize;
 		if (expires)
 			*expires = uci->expires;
-		if (uc->purge_lru) {
-			lru_remove_item(uc, index);
-			lru_add_item(uc, index);
-		}
+		if (uc->purge_lru)
+			cache_policy_hit(uc, index);
                 uci->hits++;
                 uc->hits++;
                 return uc->data + (uci->first_block * uc->blocksize);
@@ -631,8 +1598,100 @@ char *uwsgi_cache_get3(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint6
         return NULL;
 }
 
+/*
+	pinning allows a reader to use a value directly from the shared memory, without holding
+	the lock (e.g. for offloading it): the blocks of a pinned value are not reused until it is
+	unpinned, even if the item is updated or removed in the meantime.
+
+	only bitmap caches support it (in the other modes the blocks are bound to the item slot)
+*/
+
+// get the (local) cache of the key when its values can be pinned
+struct uwsgi_cache *uwsgi_cache_pinnable(char *cache, char *key, uint16_t keylen) {
+	struct uwsgi_cache *uc = uwsgi.caches;
+	if (cache) {
+		if (strchr(cache, '@')) return NULL;
+		uc = uwsgi_cache_by_name(cache);
+	}
+	if (!uc) return NULL;
+	uc = uwsgi_cache_shard(uc, key, keylen);
+	if (!uc->pins) return NULL;
+	return uc;
+}
+
+/*
+	returns 0 on hit (the value is pinned), -1 on miss and -2 when all of the pins are in use
+	(use a standard get in such a case)
+*/
+int uwsgi_cache_pin(struct uwsgi_cache *uc, char *key, uint16_t keylen, char **value, uint64_t *valsize, uint64_t *expires, uint64_t *pin) {
+	int ret = -1;
+	uwsgi_wlock(uc->lock);
+	uint64_t index = uwsgi_cache_get_index(uc, key, keylen);
+	if (!index) {
+		uc->miss++;
+		goto end;
+	}
+	struct uwsgi_cache_item *uci = cache_item(index);
+	if (uci->flags & UWSGI_CACHE_FLAG_UNGETTABLE) goto end;
+
+	uint64_t i, slot = UWSGI_CACHE_PINS;
+	for (i = 0; i < UWSGI_CACHE_PINS; i++) {
+		struct uwsgi_cache_pin *ucp = &uc->pins[i];
+		if (!ucp->refs) {
+			if (slot == UWSGI_CACHE_PINS) slot = i;
+			continue;
+		}
+		// the value has already been pinned by another reader
+		if (!ucp->released && ucp->first_block == uci->first_block) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot == UWSGI_CACHE_PINS) {
+		ret = -2;
+		goto end;
+	}
+
+	struct uwsgi_cache_pin *ucp = &uc->pins[slot];
+	if (!ucp->refs) {
+		ucp->first_block = uci->first_block;
+		ucp->size = uci->valsize;
+		ucp->released = 0;
+	}
+	ucp->refs++;
+
+	*pin = slot;
+	*value = uc->data + (uci->first_block * uc->blocksize);
+	*valsize = uci->valsize;
+	if (expires) *expires = uci->expires;
+	if (uc->purge_lru)
+		cache_policy_hit(uc, index);
+	uci->hits++;
+	uc->hits++;
+	ret = 0;
+end:
+	uwsgi_rwunlock(uc->lock);
+	return ret;
+}
+
+void uwsgi_cache_unpin(struct uwsgi_cache *uc, uint64_t pin) {
+	uwsgi_wlock(uc->lock);
+	struct uwsgi_cache_pin *ucp = &uc->pins[pin];
+	ucp->refs--;
+	if (!ucp->refs && ucp->released) {
+		cache_unmark_blocks(uc, ucp->first_block, ucp->size);
+		ucp->released = 0;
+	}
+	uwsgi_rwunlock(uc->lock);
+}
+
 char *uwsgi_cache_get4(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_t * valsize, uint64_t *hits) {
 
+	if (uc->immutable) {
+		if (hits) *hits = 0;
+		return uwsgi_cache_immutable_get(uc, key, keylen, valsize);
+	}
+
         uint64_t index = uwsgi_cache_get_index(uc, key, keylen);
 
         if (index) {
@@ -652,12 +1711,51 @@ char *uwsgi_cache_get4(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint6
         return NULL;
 }
 
+/*
+	legion replication (legion=<name>)
+
+	the Lord of the legion is the only node whose updates are applied by the others: every
+	node still sends its updates as sequenced batches (see batched replication below), but the
+	records of the other nodes are marked as forwarded (cmd 14 set, 15 del) and only the Lord
+	applies them, as its own writes, so they are sequenced again in its batches. Reads are
+	always served by the local copy and every node applies the updates in the Lord order.
+
+	Without a Lord (the legion has no quorum) writes are refused.
+*/
+
+static int cache_legion_refuse(struct uwsgi_cache *uc) {
+#ifdef UWSGI_SSL
+	if (uc->legion && !uc->legion->has_quorum) {
+		uc->legion_refused++;
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+static int cache_legion_lord(struct uwsgi_cache *uc) {
+#ifdef UWSGI_SSL
+	if (uc->legion && uc->legion->i_am_the_lord) return 1;
+#endif
+	return 0;
+}
+
+static int cache_legion_follower(struct uwsgi_cache *uc) {
+#ifdef UWSGI_SSL
+	if (uc->legion && !uc->legion->i_am_the_lord) return 1;
+#endif
+	return 0;
+}
 
 int uwsgi_cache_del2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_t index, uint16_t flags) {
 
+	if (uc->immutable) return -1;
+
+	if (!(flags & UWSGI_CACHE_FLAG_LOCAL) && cache_legion_refuse(uc)) return -1;
 
 	struct uwsgi_cache_item *uci;
 	int ret = -1;
+	int seq_owned = cache_seq_write_begin(uc);
 
 	if (!index) index = uwsgi_cache_get_index(uc, key, keylen);
 
@@ -665,13 +1763,16 @@ int uwsgi_cache_del2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_
 		uci = cache_item(index);
 		if (uci->keysize > 0) {
 			// unmark blocks
-			if (uc->blocks_bitmap) cache_unmark_blocks(uc, uci->first_block, uci->valsize);
+			if (uc->blocks_bitmap) cache_release_blocks(uc, uci->first_block, uci->valsize);
 			// put back the block in unused stack
 			uc->unused_blocks_stack_ptr++;
 			uc->unused_blocks_stack[uc->unused_blocks_stack_ptr] = index;
 
+			if (uc->open_addressing) {
+				cache_oa_remove(uc, index, uci->hash);
+			}
 			// unlink prev and next (if any)
-			if (uci->prev) {
+			else if (uci->prev) {
                         	struct uwsgi_cache_item *ucii = cache_item(uci->prev);
                         	ucii->next = uci->next;
                 	}
@@ -680,23 +1781,26 @@ int uwsgi_cache_del2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_
                         	uc->hashtable[uci->hash % uc->hashsize] = uci->next;
                 	}
 
-                	if (uci->next) {
+                	if (!uc->open_addressing && uci->next) {
                         	struct uwsgi_cache_item *ucii = cache_item(uci->next);
                         	ucii->prev = uci->prev;
                 	}
 
-                	if (!uci->prev && !uci->next) {
+                	if (!uc->open_addressing && !uci->prev && !uci->next) {
                         	// reset hashtable entry
                         	uc->hashtable[uci->hash % uc->hashsize] = 0;
                 	}
 
 			if (uc->purge_lru)
-				lru_remove_item(uc, index);
+				cache_policy_remove(uc, index);
+			else
+				cache_wheel_remove(uc, index);
 
 			uc->n_items--;
 		}
 
 		ret = 0;
+		__atomic_add_fetch(&uc->generation, 1, __ATOMIC_RELEASE);
 
 		uci->keysize = 0;
 		uci->valsize = 0;
@@ -710,6 +1814,8 @@ int uwsgi_cache_del2(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_
 		}
 	}
 
+	cache_seq_write_end(uc, seq_owned);
+
 	if (uc->nodes && ret == 0 && !(flags & UWSGI_CACHE_FLAG_LOCAL)) {
                 cache_send_udp_command(uc, key, keylen, NULL, 0, 0, 11);
         }
@@ -726,11 +1832,32 @@ void uwsgi_cache_fix(struct uwsgi_cache *uc) {
 	// reset unused blocks
 	uc->unused_blocks_stack_ptr = 0;
 
+	// eviction lists and the timer wheel are rebuilt from scratch
+	uc->lru_head = 0;
+	uc->lru_tail = 0;
+	uc->lru_protected_head = 0;
+	uc->lru_protected_tail = 0;
+	uc->lru_protected_items = 0;
+	if (uc->expire_wheel) {
+		memset(uc->expire_wheel, 0, sizeof(uint64_t) * UWSGI_CACHE_WHEEL_SLOTS);
+	}
+
 	for (i = 1; i < uc->max_items; i++) {
 		// valid record ?
 		struct uwsgi_cache_item *uci = cache_item(i);
 		if (uci->keysize) {
-			if (!uci->prev) {
+			if (uc->purge_lru) {
+				cache_policy_add(uc, i);
+			}
+			else {
+				cache_wheel_add(uc, i);
+			}
+			if (uc->open_addressing) {
+				uci->prev = 0;
+				uci->next = 0;
+				cache_oa_insert(uc, i, uci->hash);
+			}
+			else if (!uci->prev) {
 				// put value in hash_table
 				uc->hashtable[uci->hash % uc->hashsize] = i;
 			}
@@ -762,6 +1889,8 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
 	int ret = -1;
 	time_t now = 0;
 
+	if (uc->immutable) return -1;
+
 	if (!keylen || !vallen)
 		return -1;
 
@@ -772,10 +1901,16 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
 
 	if ((flags & UWSGI_CACHE_FLAG_MATH) && vallen != 8) return -1;
 
+	if (!(flags & UWSGI_CACHE_FLAG_LOCAL) && cache_legion_refuse(uc)) return -1;
+
+	int seq_owned = cache_seq_write_begin(uc);
+
 	//uwsgi_log("putting cache data in key %.*s %d\n", keylen, key, vallen);
 	index = uwsgi_cache_get_index(uc, key, keylen);
 	if (!index) {
 		if (!uc->unused_blocks_stack_ptr) {
+			if (uc->purge_lru && !cache_policy_admit(uc, uc->hash->func(key, keylen)))
+				goto end;
 			cache_full(uc);
 			if (!uc->unused_blocks_stack_ptr)
 				goto end;
@@ -806,7 +1941,7 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
                         }
 		}
 		if (uc->purge_lru)
-			lru_add_item(uc, index);
+			cache_policy_add(uc, index);
 		else if (expires && !(flags & UWSGI_CACHE_FLAG_ABSEXPIRE)) {
 			now = uwsgi_now();
 			expires += now;
@@ -814,6 +1949,7 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
 				uc->next_scan = expires;
 		}
 		uci->expires = expires;
+		cache_wheel_add(uc, index);
 		uci->hash = uc->hash->func(key, keylen);
 		uci->hits = 0;
 		uci->flags = flags;
@@ -857,8 +1993,10 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
 		uci->prev = 0;
 		uci->next = 0;
 
-		last_index = uc->hashtable[slot];
-		if (last_index == 0) {
+		if (uc->open_addressing) {
+			cache_oa_insert(uc, index, uci->hash);
+		}
+		else if ((last_index = uc->hashtable[slot]) == 0) {
 			uc->hashtable[slot] = index;
 		}
 		else {
@@ -878,15 +2016,18 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
 		uci = cache_item(index);
 		if (!(flags & UWSGI_CACHE_FLAG_FIXEXPIRE)) {
 			if (uc->purge_lru) {
-				lru_remove_item(uc, index);
-				lru_add_item(uc, index);
-			} else if (expires && !(flags & UWSGI_CACHE_FLAG_ABSEXPIRE)) {
-				now = uwsgi_now();
-				expires += now;
-				if (!uc->next_scan || uc->next_scan > expires)
-					uc->next_scan = expires;
+				cache_policy_hit(uc, index);
+			} else {
+				cache_wheel_remove(uc, index);
+				if (expires && !(flags & UWSGI_CACHE_FLAG_ABSEXPIRE)) {
+					now = uwsgi_now();
+					expires += now;
+					if (!uc->next_scan || uc->next_scan > expires)
+						uc->next_scan = expires;
+				}
 			}
 			uci->expires = expires;
+			cache_wheel_add(uc, index);
 		}
 		if (uc->blocks_bitmap) {
 			// we have a special case here, as we need to find a new series of free blocks
@@ -906,8 +2047,12 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
                         else {
                                 uc->blocks_bitmap_pos = uci->first_block + needed_blocks;
                         }
+			// the math operations work on the current number
+			if ((flags & UWSGI_CACHE_FLAG_MATH) && uci->valsize == 8) {
+				memcpy(((char *) uc->data) + (uci->first_block * uc->blocksize), ((char *) uc->data) + (old_first_block * uc->blocksize), 8);
+			}
 			// unmark the old blocks
-			cache_unmark_blocks(uc, old_first_block, uci->valsize);
+			cache_release_blocks(uc, old_first_block, uci->valsize);
 		}
 		if ( !(flags & UWSGI_CACHE_FLAG_MATH)) {
 			memcpy(((char *) uc->data) + (uci->first_block * uc->blocksize), val, vallen);
@@ -937,22 +2082,39 @@ int uwsgi_cache_set2(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *v
 		ret = 0;
 	}
 
+	if (ret == 0) __atomic_add_fetch(&uc->generation, 1, __ATOMIC_RELEASE);
+
 	if (uc->use_last_modified) {
 		uc->last_modified_at = (now ? now : uwsgi_now());
 	}
 
+	cache_seq_write_end(uc, seq_owned);
+
 	if (uc->nodes && ret == 0 && !(flags & UWSGI_CACHE_FLAG_LOCAL)) {
 		cache_send_udp_command(uc, key, keylen, val, vallen, expires, 10);
 	}
 
+	return ret;
 
 end:
+	cache_seq_write_end(uc, seq_owned);
 	return ret;
 
 }
 
 
-static void cache_send_udp_command(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *val, uint16_t vallen, uint64_t expires, uint8_t cmd) {
+static void cache_replication_queue(struct uwsgi_cache *, char *, uint16_t, char *, uint64_t, uint64_t, uint8_t);
+
+static void cache_send_udp_command(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *val, uint64_t vallen, uint64_t expires, uint8_t cmd) {
+
+		if (uc->replication_window) {
+			if (cache_legion_follower(uc)) {
+				cmd += 4;
+				uc->legion_forwarded++;
+			}
+			cache_replication_queue(uc, key, keylen, val, vallen, expires, cmd);
+			return;
+		}
 
 		struct uwsgi_header uh;
 		uint8_t u_k[2];
@@ -1024,47 +2186,531 @@ static void cache_send_udp_command(struct uwsgi_cache *uc, char *key, uint16_t k
 
 }
 
-void *cache_udp_server_loop(void *ucache) {
+/*
+	batched replication
+
+	with replication=<ms> updates for the udp nodes are not sent immediately: set2/del2 (that
+	always run with the cache write lock held) append a record to the active (shared) buffer.
+	Every <ms> milliseconds the master thread swaps the buffers and packs the records in
+	datagrams (modifier2 12) prefixed by a 64bit sequence number, sent to all of the nodes with
+	a single sendmmsg(). The last UWSGI_CACHE_REPL_HISTORY datagrams are kept for retransmission.
+
+	Receivers apply batches in order (taking the cache lock once per batch) and track the
+	next expected sequence of every sender. When a gap is detected the following batches are
+	held back and a nack (modifier2 13, with the [from, to) range) is sent back to the sender.
+	If the gap is not filled within 3 seconds the missing batches are accounted as lost.
+
+	The upper 32 bits of the sequence are the (unix time) epoch of the sender, so a restarted
+	sender (starting again from a low sequence) is recognized and its peer state reset instead of
+	having its batches dropped as duplicates. Peers not heard for UWSGI_CACHE_REPL_PEER_TTL
+	seconds are forgotten.
+
+	record: cmd(1) keylen(2) vallen(2) expires(8) key val (little endian)
+*/
+
+#define UWSGI_CACHE_REPL_RECORD_HEADER 13
+#define UWSGI_CACHE_REPL_PEER_TTL 300
+
+static void cache_repl_put16(char *buf, uint16_t n) {
+	buf[0] = (char) (n & 0xff);
+	buf[1] = (char) ((n >> 8) & 0xff);
+}
+
+static void cache_repl_put64(char *buf, uint64_t n) {
+	int i;
+	for (i = 0; i < 8; i++) {
+		buf[i] = (char) ((n >> (i * 8)) & 0xff);
+	}
+}
+
+static uint16_t cache_repl_get16(char *buf) {
+	uint8_t *b = (uint8_t *) buf;
+	return b[0] | (b[1] << 8);
+}
+
+static uint64_t cache_repl_get64(char *buf) {
+	uint8_t *b = (uint8_t *) buf;
+	uint64_t n = 0;
+	int i;
+	for (i = 7; i >= 0; i--) {
+		n = (n << 8) | b[i];
+	}
+	return n;
+}
+
+static void cache_replication_queue(struct uwsgi_cache *uc, char *key, uint16_t keylen, char *val, uint64_t vallen, uint64_t expires, uint8_t cmd) {
+	uint64_t record_len = UWSGI_CACHE_REPL_RECORD_HEADER + keylen + vallen;
+	int active = uc->replication_active;
+
+	if (record_len + 12 > UWSGI_CACHE_REPL_MAXPKT || uc->replication_pos[active] + record_len > uc->replication_buffer_size) {
+		uc->replication_dropped++;
+		return;
+	}
+
+	char *ptr = uc->replication_buffers[active] + uc->replication_pos[active];
+	ptr[0] = (char) cmd;
+	cache_repl_put16(ptr + 1, keylen);
+	cache_repl_put16(ptr + 3, (uint16_t) vallen);
+	cache_repl_put64(ptr + 5, expires);
+	memcpy(ptr + UWSGI_CACHE_REPL_RECORD_HEADER, key, keylen);
+	if (vallen) memcpy(ptr + UWSGI_CACHE_REPL_RECORD_HEADER + keylen, val, vallen);
+	uc->replication_pos[active] += record_len;
+}
+
+struct uwsgi_cache_repl_packet {
+	uint64_t seq;
+	char *buf;
+	size_t len;
+};
+
+struct uwsgi_cache_repl_sender {
+	struct uwsgi_cache *uc;
+	uint64_t seq;
+	uint64_t reported_dropped;
+	struct uwsgi_cache_repl_packet history[UWSGI_CACHE_REPL_HISTORY];
+	struct uwsgi_cache_repl_sender *next;
+};
+
+static void cache_replication_send(struct uwsgi_cache *uc, struct uwsgi_cache_repl_packet *packets, int n, struct sockaddr_in *dest) {
+	int i, count = 0;
+	struct uwsgi_string_list *usl;
+
+	for (usl = uc->nodes; usl; usl = usl->next) count++;
+	if (dest) count = 1;
+	if (!count || !n) return;
+
+	struct iovec *iov = uwsgi_malloc(sizeof(struct iovec) * n * count);
+#ifdef __linux__
+	struct mmsghdr *msgs = uwsgi_calloc(sizeof(struct mmsghdr) * n * count);
+#endif
+	int m = 0;
+	for (i = 0; i < n; i++) {
+		if (dest) {
+			iov[m].iov_base = packets[i].buf;
+			iov[m].iov_len = packets[i].len;
+#ifdef __linux__
+			msgs[m].msg_hdr.msg_name = dest;
+			msgs[m].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[m].msg_hdr.msg_iov = &iov[m];
+			msgs[m].msg_hdr.msg_iovlen = 1;
+#endif
+			m++;
+			continue;
+		}
+		for (usl = uc->nodes; usl; usl = usl->next) {
+			iov[m].iov_base = packets[i].buf;
+			iov[m].iov_len = packets[i].len;
+#ifdef __linux__
+			msgs[m].msg_hdr.msg_name = usl->custom_ptr;
+			msgs[m].msg_hdr.msg_namelen = usl->custom;
+			msgs[m].msg_hdr.msg_iov = &iov[m];
+			msgs[m].msg_hdr.msg_iovlen = 1;
+#endif
+			m++;
+		}
+	}
+
+#ifdef __linux__
+	int sent = 0;
+	while (sent < m) {
+		int ret = sendmmsg(uc->udp_node_socket, msgs + sent, m - sent, 0);
+		if (ret <= 0) {
+			uwsgi_error("[cache-replication] sendmmsg()");
+			break;
+		}
+		sent += ret;
+	}
+	free(msgs);
+#else
+	struct msghdr mh;
+	int j = 0;
+	for (i = 0; i < n; i++) {
+		struct uwsgi_string_list *node = uc->nodes;
+		do {
+			memset(&mh, 0, sizeof(struct msghdr));
+			mh.msg_name = dest ? (void *) dest : node->custom_ptr;
+			mh.msg_namelen = dest ? sizeof(struct sockaddr_in) : (socklen_t) node->custom;
+			mh.msg_iov = &iov[j++];
+			mh.msg_iovlen = 1;
+			if (sendmsg(uc->udp_node_socket, &mh, 0) <= 0) {
+				uwsgi_error("[cache-replication] sendmsg()");
+			}
+			if (!dest) node = node->next;
+		} while (!dest && node);
+	}
+#endif
+	free(iov);
+}
+
+static void cache_replication_run(struct uwsgi_cache_repl_sender *urs) {
+	struct uwsgi_cache *uc = urs->uc;
+
+	// swap the buffers (writers will start filling the other one)
+	uwsgi_wlock(uc->lock);
+	int ready = uc->replication_active;
+	uc->replication_active = !ready;
+	uc->replication_pos[uc->replication_active] = 0;
+	uint64_t dropped = uc->replication_dropped;
+	uwsgi_rwunlock(uc->lock);
+
+	if (dropped != urs->reported_dropped) {
+		uwsgi_log("[cache-replication] %llu updates for cache \"%s\" have not been replicated (buffer full or too big)\n", (unsigned long long) (dropped - urs->reported_dropped), uc->name);
+		urs->reported_dropped = dropped;
+	}
+
+	char *buf = uc->replication_buffers[ready];
+	uint64_t len = uc->replication_pos[ready];
+	uint64_t pos = 0;
+	struct uwsgi_cache_repl_packet packets[64];
+	int n = 0;
+
+	while (pos < len) {
+		// find how many records fit in the packet (at least one)
+		uint64_t end = pos;
+		while (end < len) {
+			uint64_t record_len = UWSGI_CACHE_REPL_RECORD_HEADER + cache_repl_get16(buf + end + 1) + cache_repl_get16(buf + end + 3);
+			if (end > pos && (end - pos) + record_len + 12 > UWSGI_CACHE_REPL_PKTSIZE) break;
+			end += record_len;
+		}
+
+		struct uwsgi_cache_repl_packet *hp = &urs->history[urs->seq % UWSGI_CACHE_REPL_HISTORY];
+		free(hp->buf);
+		hp->seq = urs->seq++;
+		hp->len = 12 + (end - pos);
+		hp->buf = uwsgi_malloc(hp->len);
+		hp->buf[0] = 111;
+		cache_repl_put16(hp->buf + 1, (uint16_t) (hp->len - 4));
+		hp->buf[3] = 12;
+		cache_repl_put64(hp->buf + 4, hp->seq);
+		memcpy(hp->buf + 12, buf + pos, end - pos);
+		pos = end;
+
+		packets[n++] = *hp;
+		if (n == 64) {
+			cache_replication_send(uc, packets, n, NULL);
+			n = 0;
+		}
+	}
+	cache_replication_send(uc, packets, n, NULL);
+}
+
+// manage nacks from the nodes
+static void cache_replication_nacks(struct uwsgi_cache_repl_sender *urs) {
+	struct uwsgi_cache *uc = urs->uc;
+	char buf[20];
+	for (;;) {
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(struct sockaddr_in);
+		ssize_t len = recvfrom(uc->udp_node_socket, buf, 20, 0, (struct sockaddr *) &addr, &addr_len);
+		if (len <= 0) break;
+		if (len != 20 || buf[0] != 111 || buf[3] != 13) continue;
+		uint64_t from = cache_repl_get64(buf + 4);
+		uint64_t to = cache_repl_get64(buf + 12);
+		for (; from < to && from < urs->seq; from++) {
+			struct uwsgi_cache_repl_packet *hp = &urs->history[from % UWSGI_CACHE_REPL_HISTORY];
+			if (!hp->buf || hp->seq != from) continue;
+			cache_replication_send(uc, hp, 1, &addr);
+		}
+	}
+}
+
+static void *cache_replication_loop(void *arg) {
+	// block all signals
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	struct uwsgi_cache_repl_sender *senders = NULL, *urs;
+	uint64_t window = 0;
+	struct uwsgi_cache *uc;
+	for (uc = uwsgi.caches; uc; uc = uc->next) {
+		if (!uc->replication_window || !uc->nodes || uc->shards) continue;
+		urs = uwsgi_calloc(sizeof(struct uwsgi_cache_repl_sender));
+		urs->uc = uc;
+		// the epoch of this sender
+		urs->seq = ((uint64_t) uwsgi_now()) << 32;
+		urs->next = senders;
+		senders = urs;
+		if (!window || uc->replication_window < window) window = uc->replication_window;
+	}
+
+	for (;;) {
+		usleep(window * 1000);
+		for (urs = senders; urs; urs = urs->next) {
+			cache_replication_nacks(urs);
+			cache_replication_run(urs);
+		}
+	}
+
+	return NULL;
+}
+
+void uwsgi_cache_start_replicators() {
+	struct uwsgi_cache *uc;
+	for (uc = uwsgi.caches; uc; uc = uc->next) {
+		if (uc->replication_window && uc->nodes && !uc->shards) break;
+	}
+
+	if (!uc) return;
+
+	pthread_t cache_replicator;
+	if (pthread_create(&cache_replicator, NULL, cache_replication_loop, NULL)) {
+		uwsgi_error("uwsgi_cache_start_replicators()/pthread_create()");
+		uwsgi_log("unable to run the cache replication thread !!!\n");
+		return;
+	}
+	uwsgi_log("cache replication thread enabled\n");
+}
+
+struct uwsgi_cache_repl_peer {
+	struct sockaddr_in addr;
+	uint64_t expected;
+	time_t gap_since;
+	time_t last_seen;
+	// batches received after a gap
+	char *pending[UWSGI_CACHE_REPL_HISTORY];
+	uint16_t pending_len[UWSGI_CACHE_REPL_HISTORY];
+	struct uwsgi_cache_repl_peer *next;
+};
+
+static struct uwsgi_cache_repl_peer *cache_replication_peer(struct uwsgi_cache_repl_peer **peers, struct sockaddr_in *addr) {
+	struct uwsgi_cache_repl_peer *peer = *peers;
+	while (peer) {
+		if (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr && peer->addr.sin_port == addr->sin_port) return peer;
+		peer = peer->next;
+	}
+	peer = uwsgi_calloc(sizeof(struct uwsgi_cache_repl_peer));
+	memcpy(&peer->addr, addr, sizeof(struct sockaddr_in));
+	// the first received batch sets the sequence
+	peer->expected = UINT64_MAX;
+	peer->next = *peers;
+	*peers = peer;
+	return peer;
+}
+
+// apply a whole batch (body is seq + records)
+static void cache_replication_apply(struct uwsgi_cache *uc, char *body, uint16_t body_len) {
+	uint64_t pos = 8;
+	struct uwsgi_cache *locked = NULL;
+
+	while (pos + UWSGI_CACHE_REPL_RECORD_HEADER <= body_len) {
+		char *ptr = body + pos;
+		uint8_t cmd = (uint8_t) ptr[0];
+		uint16_t keylen = cache_repl_get16(ptr + 1);
+		uint16_t vallen = cache_repl_get16(ptr + 3);
+		uint64_t expires = cache_repl_get64(ptr + 5);
+		if (pos + UWSGI_CACHE_REPL_RECORD_HEADER + keylen + vallen > body_len) break;
+		char *key = ptr + UWSGI_CACHE_REPL_RECORD_HEADER;
+		char *val = key + keylen;
+		pos += UWSGI_CACHE_REPL_RECORD_HEADER + keylen + vallen;
+
+		struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, keylen);
+		if (ucs != locked) {
+			if (locked) uwsgi_rwunlock(locked->lock);
+			uwsgi_wlock(ucs->lock);
+			locked = ucs;
+		}
+
+		if (cmd == 10) {
+			if (uwsgi_cache_set2(ucs, key, keylen, val, vallen, expires, UWSGI_CACHE_FLAG_UPDATE|UWSGI_CACHE_FLAG_LOCAL|UWSGI_CACHE_FLAG_ABSEXPIRE)) {
+				uwsgi_log("[cache-udp-server] unable to update cache\n");
+			}
+		}
+		else if (cmd == 11) {
+			uwsgi_cache_del2(ucs, key, keylen, 0, UWSGI_CACHE_FLAG_LOCAL);
+		}
+		// forwarded to the Lord, applied as a non local write (so queued in our batches)
+		else if (cmd == 14) {
+			if (!cache_legion_lord(ucs)) continue;
+			if (uwsgi_cache_set2(ucs, key, keylen, val, vallen, expires, UWSGI_CACHE_FLAG_UPDATE|UWSGI_CACHE_FLAG_ABSEXPIRE)) {
+				uwsgi_log("[cache-udp-server] unable to update cache\n");
+			}
+		}
+		else if (cmd == 15) {
+			if (!cache_legion_lord(ucs)) continue;
+			uwsgi_cache_del2(ucs, key, keylen, 0, 0);
+		}
+	}
+
+	if (locked) uwsgi_rwunlock(locked->lock);
+}
+
+// apply the batches held back after a gap (stopping at the next hole)
+static void cache_replication_drain(struct uwsgi_cache *uc, struct uwsgi_cache_repl_peer *peer) {
+	for (;;) {
+		int slot = peer->expected % UWSGI_CACHE_REPL_HISTORY;
+		if (!peer->pending[slot] || cache_repl_get64(peer->pending[slot]) != peer->expected) break;
+		cache_replication_apply(uc, peer->pending[slot], peer->pending_len[slot]);
+		free(peer->pending[slot]);
+		peer->pending[slot] = NULL;
+		peer->expected++;
+	}
+	int i;
+	for (i = 0; i < UWSGI_CACHE_REPL_HISTORY; i++) {
+		if (peer->pending[i]) return;
+	}
+	peer->gap_since = 0;
+}
+
+static void cache_replication_nack(int fd, struct uwsgi_cache_repl_peer *peer, uint64_t from, uint64_t to) {
+	char buf[20];
+	buf[0] = 111;
+	cache_repl_put16(buf + 1, 16);
+	buf[3] = 13;
+	cache_repl_put64(buf + 4, from);
+	cache_repl_put64(buf + 12, to);
+	if (sendto(fd, buf, 20, 0, (struct sockaddr *) &peer->addr, sizeof(struct sockaddr_in)) < 0) {
+		uwsgi_error("[cache-udp-server] sendto()");
+	}
+}
+
+// forget the state of a peer (restarted sender), the next batch sets the sequence
+static void cache_replication_peer_reset(struct uwsgi_cache_repl_peer *peer) {
+	int i;
+	for (i = 0; i < UWSGI_CACHE_REPL_HISTORY; i++) {
+		free(peer->pending[i]);
+		peer->pending[i] = NULL;
+	}
+	peer->expected = UINT64_MAX;
+	peer->gap_since = 0;
+}
+
+static void cache_replication_receive(struct uwsgi_cache *uc, int fd, struct uwsgi_cache_repl_peer *peer, char *body, uint16_t body_len) {
+	uint64_t seq = cache_repl_get64(body);
+
+	peer->last_seen = uwsgi_now();
+
+	// new epoch or a sequence regression bigger than the retransmission history: the sender restarted
+	if (peer->expected != UINT64_MAX && ((seq >> 32) != (peer->expected >> 32) || seq + UWSGI_CACHE_REPL_HISTORY < peer->expected)) {
+		uwsgi_log("[cache-udp-server] replication sender %s:%d for cache \"%s\" restarted\n", inet_ntoa(peer->addr.sin_addr), ntohs(peer->addr.sin_port), uc->name);
+		cache_replication_peer_reset(peer);
+	}
+
+	if (peer->expected == UINT64_MAX) peer->expected = seq;
+
+	// duplicate
+	if (seq < peer->expected) return;
+
+	if (seq == peer->expected) {
+		cache_replication_apply(uc, body, body_len);
+		peer->expected++;
+		cache_replication_drain(uc, peer);
+		return;
+	}
+
+	// too far in the future, we cannot recover
+	if (seq - peer->expected >= UWSGI_CACHE_REPL_HISTORY) {
+		uwsgi_log("[cache-udp-server] lost %llu replication batches for cache \"%s\"\n", (unsigned long long) (seq - peer->expected), uc->name);
+		__atomic_add_fetch(&uc->replication_lost, seq - peer->expected, __ATOMIC_RELAXED);
+		cache_replication_peer_reset(peer);
+		peer->expected = seq + 1;
+		cache_replication_apply(uc, body, body_len);
+		return;
+	}
+
+	int slot = seq % UWSGI_CACHE_REPL_HISTORY;
+	if (peer->pending[slot]) return;
+	peer->pending[slot] = uwsgi_malloc(body_len);
+	memcpy(peer->pending[slot], body, body_len);
+	peer->pending_len[slot] = body_len;
+	if (!peer->gap_since) {
+		peer->gap_since = uwsgi_now();
+		cache_replication_nack(fd, peer, peer->expected, seq);
+	}
+}
+
+// skip the holes that have not been filled in time
+static void cache_replication_expire_gaps(struct uwsgi_cache *uc, struct uwsgi_cache_repl_peer *peers) {
+	time_t now = uwsgi_now();
+	struct uwsgi_cache_repl_peer *peer;
+	for (peer = peers; peer; peer = peer->next) {
+		if (!peer->gap_since || now - peer->gap_since < 3) continue;
+		uint64_t lost = 0;
+		while (peer->gap_since) {
+			int slot = peer->expected % UWSGI_CACHE_REPL_HISTORY;
+			if (!peer->pending[slot]) {
+				lost++;
+				peer->expected++;
+				continue;
+			}
+			cache_replication_drain(uc, peer);
+		}
+		uwsgi_log("[cache-udp-server] lost %llu replication batches for cache \"%s\"\n", (unsigned long long) lost, uc->name);
+		__atomic_add_fetch(&uc->replication_lost, lost, __ATOMIC_RELAXED);
+	}
+}
+
+// forget the peers not heard for a while
+static void cache_replication_expire_peers(struct uwsgi_cache_repl_peer **peers) {
+	time_t now = uwsgi_now();
+	struct uwsgi_cache_repl_peer **prev = peers;
+	while (*prev) {
+		struct uwsgi_cache_repl_peer *peer = *prev;
+		if (now - peer->last_seen < UWSGI_CACHE_REPL_PEER_TTL) {
+			prev = &peer->next;
+			continue;
+		}
+		*prev = peer->next;
+		cache_replication_peer_reset(peer);
+		free(peer);
+	}
+}
+
+// every udp server thread has its own sockets (bound with SO_REUSEPORT when more than one)
+struct uwsgi_cache_udp_server {
+	struct uwsgi_cache *uc;
+	int queue;
+};
+
+#define UWSGI_CACHE_UDP_BATCH 16
+
+void *cache_udp_server_loop(void *arg) {
         // block all signals
         sigset_t smask;
         sigfillset(&smask);
         pthread_sigmask(SIG_BLOCK, &smask, NULL);
 
-	struct uwsgi_cache *uc = (struct uwsgi_cache *) ucache;
-
-        int queue = event_queue_init();
-        struct uwsgi_string_list *usl = uc->udp_servers;
-        while(usl) {
-                if (strchr(usl->value, ':')) {
-                        int fd = bind_to_udp(usl->value, 0, 0);
-                        if (fd < 0) {
-                                uwsgi_log("[cache-udp-server] cannot bind to %s\n", usl->value);
-                                exit(1);
-                        }
-                        uwsgi_socket_nb(fd);
-                        event_queue_add_fd_read(queue, fd);
-                        uwsgi_log("*** udp server for cache \"%s\" running on %s ***\n", uc->name, usl->value);
-                }
-                usl = usl->next;
-        }
+	struct uwsgi_cache_udp_server *ucus = (struct uwsgi_cache_udp_server *) arg;
+	struct uwsgi_cache *uc = ucus->uc;
+	int queue = ucus->queue;
 
-        // allocate 64k chunk to receive messages
-        char *buf = uwsgi_malloc(UMAX16);
+        // receive up to 16 datagrams (64k each) with a single syscall
+	struct uwsgi_udp_batch *ub = uwsgi_udp_batch_new(UWSGI_CACHE_UDP_BATCH, UMAX16);
+	struct uwsgi_cache_repl_peer *peers = NULL;
 	
 	for(;;) {
-                uint16_t pktsize = 0, ss = 0;
                 int interesting_fd = -1;
-                int rlen = event_queue_wait(queue, -1, &interesting_fd);
+                int rlen = event_queue_wait(queue, peers ? 1 : -1, &interesting_fd);
+		if (peers) {
+			cache_replication_expire_gaps(uc, peers);
+			cache_replication_expire_peers(&peers);
+		}
                 if (rlen <= 0) continue;
                 if (interesting_fd < 0) continue;
-                ssize_t len = read(interesting_fd, buf, UMAX16);
-                if (len <= 7) {
-                        uwsgi_error("[cache-udp-server] read()");
-                }
+		int n = uwsgi_udp_batch_recv(ub, interesting_fd);
+		if (n < 0) {
+			uwsgi_error("[cache-udp-server] recv()");
+			continue;
+		}
+		int i;
+		for(i=0;i<n;i++) {
+		uint16_t pktsize = 0, ss = 0;
+		char *buf = uwsgi_udp_batch_buf(ub, i);
+		ssize_t len = ub->lens[i];
+		struct sockaddr_in *peer_addr = &ub->addrs[i];
+                if (len <= 7) continue;
                 if (buf[0] != 111) continue;
                 memcpy(&pktsize, buf+1, 2);
                 if (pktsize != len-4) continue;
 
+		// sequenced batch
+		if (buf[3] == 12) {
+			if (pktsize < 8) continue;
+			struct uwsgi_cache_repl_peer *peer = cache_replication_peer(&peers, peer_addr);
+			cache_replication_receive(uc, interesting_fd, peer, buf + 4, pktsize);
+			continue;
+		}
+
                 memcpy(&ss, buf + 4, 2);
                 if (4+ss > pktsize) continue;
                 uint16_t keylen = ss;
@@ -1083,32 +2729,65 @@ void *cache_udp_server_loop(void *ucache) {
                                 if (6+keylen+vallen+ss > pktsize) continue;
                                 expires = uwsgi_str_num(buf + 10 + keylen+vallen, ss);
                         }
-                        uwsgi_wlock(uc->lock);
-                        if (uwsgi_cache_set2(uc, key, keylen, val, vallen, expires, UWSGI_CACHE_FLAG_UPDATE|UWSGI_CACHE_FLAG_LOCAL|UWSGI_CACHE_FLAG_ABSEXPIRE)) {
+                        struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, keylen);
+                        uwsgi_wlock(ucs->lock);
+                        if (uwsgi_cache_set2(ucs, key, keylen, val, vallen, expires, UWSGI_CACHE_FLAG_UPDATE|UWSGI_CACHE_FLAG_LOCAL|UWSGI_CACHE_FLAG_ABSEXPIRE)) {
                                 uwsgi_log("[cache-udp-server] unable to update cache\n");
                         }
-                        uwsgi_rwunlock(uc->lock);
+                        uwsgi_rwunlock(ucs->lock);
                 }
                 // cache del
                 else if (buf[3] == 11) {
-                        uwsgi_wlock(uc->lock);
-                        if (uwsgi_cache_del2(uc, key, keylen, 0, UWSGI_CACHE_FLAG_LOCAL)) {
+                        struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, keylen);
+                        uwsgi_wlock(ucs->lock);
+                        if (uwsgi_cache_del2(ucs, key, keylen, 0, UWSGI_CACHE_FLAG_LOCAL)) {
                                 uwsgi_log("[cache-udp-server] unable to update cache\n");
                         }
-                        uwsgi_rwunlock(uc->lock);
+                        uwsgi_rwunlock(ucs->lock);
                 }
+		}
         }
 
         return NULL;
 }
 
+static uint64_t cache_sweeper_free_wheel(struct uwsgi_cache *uc) {
+	uint64_t freed_items = 0;
+	uint64_t now = (uint64_t) uwsgi.current_time;
+
+	uwsgi_wlock(uc->lock);
+	uint64_t pos = uc->wheel_pos;
+	// after a long stop, a single round is enough
+	if (now >= pos + UWSGI_CACHE_WHEEL_SLOTS)
+		pos = now - UWSGI_CACHE_WHEEL_SLOTS + 1;
+	for (; pos <= now; pos++) {
+		uint64_t index = uc->expire_wheel[pos % UWSGI_CACHE_WHEEL_SLOTS];
+		while (index) {
+			struct uwsgi_cache_item *uci = cache_item(index);
+			uint64_t next = uci->lru_next;
+			if (uci->expires <= now) {
+				uwsgi_cache_del2(uc, NULL, 0, index, UWSGI_CACHE_FLAG_LOCAL);
+				freed_items++;
+			}
+			index = next;
+		}
+	}
+	uc->wheel_pos = now + 1;
+	uwsgi_rwunlock(uc->lock);
+
+	return freed_items;
+}
+
 static uint64_t cache_sweeper_free_items(struct uwsgi_cache *uc) {
 	uint64_t i;
 	uint64_t freed_items = 0;
 
-	if (uc->no_expire || uc->purge_lru || uc->lazy_expire)
+	if (uc->no_expire || uc->purge_lru || uc->lazy_expire || uc->shards)
 		return 0;
 
+	if (uc->expire_wheel)
+		return cache_sweeper_free_wheel(uc);
+
 	uwsgi_rlock(uc->lock);
 	if (!uc->next_scan || uc->next_scan > (uint64_t)uwsgi.current_time) {
 		uwsgi_rwunlock(uc->lock);
@@ -1170,7 +2849,7 @@ void uwsgi_cache_sync_all() {
 
 	struct uwsgi_cache *uc = uwsgi.caches;
 	while(uc) {
-		if (uc->store && (uwsgi.master_cycles == 0 || (uc->store_sync > 0 && (uwsgi.master_cycles % uc->store_sync) == 0))) {
+		if (uc->store && uc->items && (uwsgi.master_cycles == 0 || (uc->store_sync > 0 && (uwsgi.master_cycles % uc->store_sync) == 0))) {
                 	if (msync(uc->items, uc->filesize, MS_ASYNC)) {
                         	uwsgi_error("uwsgi_cache_sync_all()/msync()");
                         }
@@ -1205,19 +2884,50 @@ void uwsgi_cache_start_sweepers() {
         uwsgi_log("cache sweeper thread enabled\n");
 }
 
+static void *cache_sync_stream_loop(void *);
+
 void uwsgi_cache_start_sync_servers() {
 
 	struct uwsgi_cache *uc = uwsgi.caches;
 	while(uc) {
+		if (uc->sync_stream && uc->sync_nodes && !uc->shard_of) {
+			pthread_t cache_sync_stream;
+			if (pthread_create(&cache_sync_stream, NULL, cache_sync_stream_loop, (void *) uc)) {
+				uwsgi_error("pthread_create()");
+				uwsgi_log("unable to run the cache sync thread !!!\n");
+			}
+		}
 		if (!uc->udp_servers) goto next;		
-		pthread_t cache_udp_server;
-                if (pthread_create(&cache_udp_server, NULL, cache_udp_server_loop, (void *) uc)) {
-                        uwsgi_error("pthread_create()");
-                        uwsgi_log("unable to run the cache udp server !!!\n");
-                }
-                else {
-                        uwsgi_log("udp server thread enabled for cache \"%s\"\n", uc->name);
-                }
+		int threads = uc->udp_threads > 0 ? uc->udp_threads : 1;
+		int t;
+		for(t=0;t<threads;t++) {
+			struct uwsgi_cache_udp_server *ucus = uwsgi_calloc(sizeof(struct uwsgi_cache_udp_server));
+			ucus->uc = uc;
+			ucus->queue = event_queue_init();
+			// sockets are bound here, so a failure is reported before the workers start
+			struct uwsgi_string_list *usl = uc->udp_servers;
+			while(usl) {
+				if (strchr(usl->value, ':')) {
+					int fd = threads > 1 ? bind_to_udp_reuse_port(usl->value) : bind_to_udp(usl->value, 0, 0);
+					if (fd < 0) {
+						uwsgi_log("[cache-udp-server] cannot bind to %s\n", usl->value);
+						exit(1);
+					}
+					uwsgi_socket_nb(fd);
+					event_queue_add_fd_read(ucus->queue, fd);
+					if (t == 0) {
+						uwsgi_log("*** udp server for cache \"%s\" running on %s ***\n", uc->name, usl->value);
+					}
+				}
+				usl = usl->next;
+			}
+			pthread_t cache_udp_server;
+			if (pthread_create(&cache_udp_server, NULL, cache_udp_server_loop, (void *) ucus)) {
+				uwsgi_error("pthread_create()");
+				uwsgi_log("unable to run the cache udp server !!!\n");
+			}
+		}
+		uwsgi_log("udp server enabled for cache \"%s\" (%d threads)\n", uc->name, threads);
 next:
 		uc = uc->next;
         }
@@ -1274,6 +2984,7 @@ struct uwsgi_cache *uwsgi_cache_create(char *arg) {
 		char *c_nodes = NULL;
 		char *c_sync = NULL;
 		char *c_udp_servers = NULL;
+		char *c_udp_threads = NULL;
 		char *c_bitmap = NULL;
 		char *c_use_last_modified = NULL;
 		char *c_math_initial = NULL;
@@ -1283,6 +2994,20 @@ struct uwsgi_cache *uwsgi_cache_create(char *arg) {
 		char *c_sweep_on_full = NULL;
 		char *c_clear_on_full = NULL;
 		char *c_no_expire = NULL;
+		char *c_shards = NULL;
+		char *c_seqlock = NULL;
+		char *c_layout = NULL;
+		char *c_policy = NULL;
+		char *c_tinylfu = NULL;
+		char *c_expire_wheel = NULL;
+		char *c_replication = NULL;
+		char *c_replication_buffer = NULL;
+		char *c_legion = NULL;
+		char *c_sync_stream = NULL;
+		char *c_snapshot = NULL;
+		char *c_snapshot_freq = NULL;
+		char *c_histograms = NULL;
+		char *c_immutable = NULL;
 
 		if (uwsgi_kvlist_parse(arg, strlen(arg), ',', '=',
                         "name", &c_name,
@@ -1309,6 +3034,7 @@ struct uwsgi_cache *uwsgi_cache_create(char *arg) {
                         "udp_server", &c_udp_servers,
                         "udpservers", &c_udp_servers,
                         "udpserver", &c_udp_servers,
+                        "udp_threads", &c_udp_threads,
                         "bitmap", &c_bitmap,
                         "lastmod", &c_use_last_modified,
                         "math_initial", &c_math_initial,
@@ -1320,6 +3046,23 @@ struct uwsgi_cache *uwsgi_cache_create(char *arg) {
 			"sweep_on_full", &c_sweep_on_full,
 			"clear_on_full", &c_clear_on_full,
 			"no_expire", &c_no_expire,
+			"shards", &c_shards,
+			"seqlock", &c_seqlock,
+			"lockless_reads", &c_seqlock,
+			"layout", &c_layout,
+			"policy", &c_policy,
+			"eviction", &c_policy,
+			"tinylfu", &c_tinylfu,
+			"expire_wheel", &c_expire_wheel,
+			"wheel", &c_expire_wheel,
+			"replication", &c_replication,
+			"replication_buffer", &c_replication_buffer,
+			"legion", &c_legion,
+			"sync_stream", &c_sync_stream,
+			"snapshot", &c_snapshot,
+			"snapshot_freq", &c_snapshot_freq,
+			"histograms", &c_histograms,
+			"immutable", &c_immutable,
                 	NULL)) {
 			uwsgi_log("unable to parse cache definition\n");
 			exit(1);
@@ -1328,6 +3071,18 @@ struct uwsgi_cache *uwsgi_cache_create(char *arg) {
 			uwsgi_log("you have to specify a cache name\n");
 			exit(1);
 		}
+		if (c_immutable) {
+			if (c_store || c_snapshot || c_nodes || c_sync || c_udp_servers || c_shards || c_replication || c_legion || c_sync_stream || c_bitmap || c_purge_lru || c_policy || c_tinylfu) {
+				uwsgi_log("immutable cache \"%s\" cannot be combined with store, snapshot, replication, sync, sharding or eviction options\n", c_name);
+				exit(1);
+			}
+			// the (empty) items area is only allocated to keep the other cache subsystems happy
+			c_max_items = "1";
+			c_blocksize = "1";
+			c_blocks = NULL;
+			c_hashsize = "1";
+			c_keysize = NULL;
+		}
 		if (!c_max_items) {
 			uwsgi_log("you have to specify the maximum number of cache items\n");
 			exit(1);
@@ -1409,13 +3164,121 @@ struct uwsgi_cache *uwsgi_cache_create(char *arg) {
                         uwsgi_foreach_token(c_udp_servers, ";", p, ctx) {
                                 uwsgi_string_new_list(&uc->udp_servers, p);
                         }
+			if (c_udp_threads) uc->udp_threads = atoi(c_udp_threads);
                 }
 		
 		if (c_purge_lru)
 			uc->purge_lru = 1;
+
+		if (c_policy) {
+			uc->purge_lru = 1;
+			if (!strcmp(c_policy, "slru")) {
+				uc->policy = UWSGI_CACHE_POLICY_SLRU;
+			}
+			else if (!strcmp(c_policy, "clock")) {
+				uc->policy = UWSGI_CACHE_POLICY_CLOCK;
+			}
+			else if (strcmp(c_policy, "lru")) {
+				uwsgi_log("invalid cache policy for \"%s\", allowed values are \"lru\", \"slru\" and \"clock\"\n", uc->name);
+				exit(1);
+			}
+		}
+
+		if (c_tinylfu) {
+			uc->purge_lru = 1;
+			uc->tinylfu = 1;
+		}
+
+		if (c_expire_wheel) {
+			if (uc->purge_lru) {
+				uwsgi_log("expire_wheel cannot be used with evicting caches (\"%s\")\n", uc->name);
+				exit(1);
+			}
+			uc->use_expire_wheel = 1;
+		}
+
+		if (c_histograms) uc->histograms = 1;
+
+		if (c_snapshot) {
+			if (c_store) {
+				uwsgi_log("you cannot use both store and snapshot for cache \"%s\"\n", uc->name);
+				exit(1);
+			}
+			if (!uwsgi.master_process) {
+				uwsgi_log("snapshots for cache \"%s\" require the master process\n", uc->name);
+				exit(1);
+			}
+			uc->snapshot = c_snapshot;
+			uc->snapshot_freq = 60;
+			if (c_snapshot_freq) uc->snapshot_freq = uwsgi_n64(c_snapshot_freq);
+			// the first snapshot is taken after snapshot_freq seconds
+			uc->snapshot_last = uwsgi_now();
+		}
+
+		if (c_sync_stream) {
+			if (!uwsgi.master_process) {
+				uwsgi_log("streaming sync for cache \"%s\" requires the master process\n", uc->name);
+				exit(1);
+			}
+			uc->sync_stream = 1;
+			// a value bigger than 1 sets the number of items per chunk
+			uc->sync_stream_chunk = uwsgi_n64(c_sync_stream);
+			if (uc->sync_stream_chunk <= 1) uc->sync_stream_chunk = 1000;
+		}
+
+		if (c_legion) {
+#ifdef UWSGI_SSL
+			uc->legion = uwsgi_legion_get_by_name(c_legion);
+			if (!uc->legion) {
+				uwsgi_log("unknown legion \"%s\" for cache \"%s\"\n", c_legion, uc->name);
+				exit(1);
+			}
+			if (!c_nodes || !c_udp_servers) {
+				uwsgi_log("legion replication for cache \"%s\" requires both nodes and udp servers\n", uc->name);
+				exit(1);
+			}
+			// the Lord always sends sequenced batches
+			if (!c_replication) c_replication = "10";
+#else
+			uwsgi_log("legion replication for cache \"%s\" requires SSL support\n", uc->name);
+			exit(1);
+#endif
+		}
+
+		if (c_replication) {
+			uc->replication_window = uwsgi_n64(c_replication);
+			if (!uwsgi.master_process) {
+				uwsgi_log("batched replication for cache \"%s\" requires the master process\n", uc->name);
+				exit(1);
+			}
+			uc->replication_buffer_size = 4 * 1024 * 1024;
+			if (c_replication_buffer) uc->replication_buffer_size = uwsgi_n64(c_replication_buffer);
+			if (uc->replication_buffer_size < UWSGI_CACHE_REPL_MAXPKT) uc->replication_buffer_size = UWSGI_CACHE_REPL_MAXPKT;
+		}
+
+		if (c_shards) uc->shards_count = uwsgi_n64(c_shards);
+		if (c_seqlock) uc->seqlock = 1;
+		uc->immutable = c_immutable;
+		if (c_layout) {
+			if (!strcmp(c_layout, "open") || !strcmp(c_layout, "oa")) {
+				uc->open_addressing = 1;
+			}
+			else if (strcmp(c_layout, "chain")) {
+				uwsgi_log("invalid cache layout for \"%s\", allowed values are \"chain\" and \"open\"\n", uc->name);
+				exit(1);
+			}
+		}
 	}
 
-	uwsgi_cache_init(uc);
+	if (uc->shards_count > 1) {
+		uwsgi_cache_init_shards(uc);
+	}
+	else {
+		uwsgi_cache_init(uc);
+	}
+	if (uc->immutable) {
+		uwsgi_cache_immutable_init(uc);
+	}
 	return uc;
 }
 
@@ -1469,6 +3332,25 @@ void uwsgi_cache_create_all() {
 	uwsgi.cache_setup = 1;
 }
 
+int uwsgi_cache_clear(struct uwsgi_cache *uc) {
+	uint64_t i;
+	if (uc->shards) {
+		for (i = 0; i < uc->shards_count; i++) {
+			if (uwsgi_cache_clear(uc->shards[i])) return -1;
+		}
+		return 0;
+	}
+	uwsgi_wlock(uc->lock);
+	for (i = 1; i < uc->max_items; i++) {
+		if (uwsgi_cache_del2(uc, NULL, 0, i, 0)) {
+			uwsgi_rwunlock(uc->lock);
+			return -1;
+		}
+	}
+	uwsgi_rwunlock(uc->lock);
+	return 0;
+}
+
 /*
  * uWSGI cache magic functions. They can be used by plugin to easily access local and remote caches
  *
@@ -1516,7 +3398,7 @@ void uwsgi_cache_magic_context_hook(char *key, uint16_t key_len, char *value, ui
         }
 }
 
-static struct uwsgi_buffer *uwsgi_cache_prepare_magic_get(char *cache_name, uint16_t cache_name_len, char *key, uint16_t key_len) {
+struct uwsgi_buffer *uwsgi_cache_prepare_magic_get(char *cache_name, uint16_t cache_name_len, char *key, uint16_t key_len) {
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
 	ub->pos = 4;
 
@@ -1644,6 +3526,66 @@ static int cache_magic_send_and_manage(int fd, struct uwsgi_buffer *ub, char *st
 	return 0;
 }
 
+static void cache_histogram_add(uint64_t *histogram, uint64_t us) {
+	int bucket = 0;
+	while (bucket < UWSGI_CACHE_HIST_BUCKETS - 1 && us >= (1ULL << bucket)) bucket++;
+	__atomic_fetch_add(&histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*
+	fragmentation (percentage) reported by the metrics subsystem
+
+	bitmap caches: how much of the free space is not part of the biggest free run of blocks
+	(the bigger the value, the smaller the biggest storable item)
+
+	fixed block caches: the space wasted in the blocks by items smaller than blocksize
+*/
+uint64_t uwsgi_cache_fragmentation(struct uwsgi_cache *uc) {
+	uint64_t i;
+	if (uc->shards) {
+		uint64_t total = 0;
+		for (i = 0; i < uc->shards_count; i++) {
+			total += uwsgi_cache_fragmentation(uc->shards[i]);
+		}
+		return total / uc->shards_count;
+	}
+
+	uint64_t ret = 0;
+	uwsgi_rlock(uc->lock);
+	if (uc->blocks_bitmap) {
+		uint64_t free_blocks = 0, run = 0, biggest = 0;
+		for (i = 0; i < uc->blocks; i++) {
+			if (uc->blocks_bitmap[i / 8] & (1 << (7 - (i % 8)))) {
+				run = 0;
+				continue;
+			}
+			free_blocks++;
+			run++;
+			if (run > biggest) biggest = run;
+		}
+		if (free_blocks) ret = 100 - ((biggest * 100) / free_blocks);
+	}
+	else if (uc->n_items) {
+		uint64_t used = 0;
+		for (i = 1; i < uc->max_items; i++) {
+			struct uwsgi_cache_item *uci = cache_item(i);
+			if (uci->keysize) used += uci->valsize;
+		}
+		ret = 100 - ((used * 100) / (uc->n_items * uc->blocksize));
+	}
+	uwsgi_rwunlock(uc->lock);
+	return ret;
+}
+
+// lru caches update their lists on every get
+static void cache_magic_get_lock(struct uwsgi_cache *uc) {
+	// clock caches only set a reference bit on hits
+	if (uc->purge_lru && (uc->policy != UWSGI_CACHE_POLICY_CLOCK || uc->tinylfu))
+		uwsgi_wlock(uc->lock);
+	else
+		uwsgi_rlock(uc->lock);
+}
+
 char *uwsgi_cache_magic_get(char *key, uint16_t keylen, uint64_t *vallen, uint64_t *expires, char *cache) {
 	struct uwsgi_cache_magic_context ucmc;
 	struct uwsgi_cache *uc = NULL;
@@ -1668,18 +3610,39 @@ char *uwsgi_cache_magic_get(char *key, uint16_t keylen, uint64_t *vallen, uint64
 
 	// we have a local cache !!!
 	if (uc) {
-		if (uc->purge_lru)
-			uwsgi_wlock(uc->lock);
-		else
-			uwsgi_rlock(uc->lock);
+		uc = uwsgi_cache_shard(uc, key, keylen);
+		// immutable caches are read-only mappings, no locking needed
+		if (uc->immutable) {
+			char *value = uwsgi_cache_immutable_get(uc, key, keylen, vallen);
+			if (!value) return NULL;
+			if (expires) *expires = 0;
+			char *buf = uwsgi_malloc(*vallen);
+			memcpy(buf, value, *vallen);
+			return buf;
+		}
+		uint64_t start = uc->histograms ? uwsgi_micros() : 0;
+		// lru caches need to update the list on every get, so they cannot use lockless reads
+		if (uc->seqlock && !uc->purge_lru) {
+			int retries;
+			for (retries = 0; retries < UWSGI_CACHE_SEQLOCK_RETRIES; retries++) {
+				char *buf = NULL;
+				if (!cache_seq_read(uc, key, keylen, &buf, vallen, expires)) {
+					if (uc->histograms) cache_histogram_add(uc->get_latency, uwsgi_micros() - start);
+					return buf;
+				}
+			}
+			// too much write activity, fallback to the rwlock
+		}
+		cache_magic_get_lock(uc);
+		if (uc->histograms) cache_histogram_add(uc->lock_wait, uwsgi_micros() - start);
+		char *buf = NULL;
 		char *value = uwsgi_cache_get3(uc, key, keylen, vallen, expires);
-		if (!value) {
-			uwsgi_rwunlock(uc->lock);
-			return NULL;
+		if (value) {
+			buf = uwsgi_malloc(*vallen);
+			memcpy(buf, value, *vallen);
 		}
-		char *buf = uwsgi_malloc(*vallen);
-		memcpy(buf, value, *vallen);
 		uwsgi_rwunlock(uc->lock);
+		if (uc->histograms) cache_histogram_add(uc->get_latency, uwsgi_micros() - start);
 		return buf;
 	}
 
@@ -1753,6 +3716,47 @@ char *uwsgi_cache_magic_get(char *key, uint16_t keylen, uint64_t *vallen, uint64
 	return NULL;
 }
 
+/*
+	get a number (the 64bit slots managed by the math operations) without allocating it (for local caches),
+	returns 0 on hit, -1 on miss or when the value is not a number
+*/
+int uwsgi_cache_magic_num(char *key, uint16_t keylen, int64_t *num, char *cache) {
+	struct uwsgi_cache *uc = uwsgi.caches;
+	int ret = -1;
+	uint64_t vallen = 0;
+	char *value = NULL;
+
+	if (cache && strchr(cache, '@')) {
+		value = uwsgi_cache_magic_get(key, keylen, &vallen, NULL, cache);
+		if (!value) return -1;
+		if (vallen == 8) {
+			memcpy(num, value, 8);
+			ret = 0;
+		}
+		free(value);
+		return ret;
+	}
+
+	if (cache) uc = uwsgi_cache_by_name(cache);
+	if (!uc) return -1;
+
+	uc = uwsgi_cache_shard(uc, key, keylen);
+	if (uc->immutable) {
+		value = uwsgi_cache_immutable_get(uc, key, keylen, &vallen);
+		if (!value || vallen != 8) return -1;
+		memcpy(num, value, 8);
+		return 0;
+	}
+	cache_magic_get_lock(uc);
+	value = uwsgi_cache_get2(uc, key, keylen, &vallen);
+	if (value && vallen == 8) {
+		memcpy(num, value, 8);
+		ret = 0;
+	}
+	uwsgi_rwunlock(uc->lock);
+	return ret;
+}
+
 int uwsgi_cache_magic_exists(char *key, uint16_t keylen, char *cache) {
         struct uwsgi_cache_magic_context ucmc;
         struct uwsgi_cache *uc = NULL;
@@ -1777,6 +3781,8 @@ int uwsgi_cache_magic_exists(char *key, uint16_t keylen, char *cache) {
 
         // we have a local cache !!!
         if (uc) {
+                uc = uwsgi_cache_shard(uc, key, keylen);
+		if (uc->immutable) return uwsgi_cache_exists2(uc, key, keylen) ? 1 : 0;
                 uwsgi_rlock(uc->lock);
                 if (!uwsgi_cache_exists2(uc, key, keylen)) {
                         uwsgi_rwunlock(uc->lock);
@@ -1849,9 +3855,13 @@ int uwsgi_cache_magic_set(char *key, uint16_t keylen, char *value, uint64_t vall
 
 	// we have a local cache !!!
 	if (uc) {
+                uc = uwsgi_cache_shard(uc, key, keylen);
+		uint64_t start = uc->histograms ? uwsgi_micros() : 0;
                 uwsgi_wlock(uc->lock);
+		if (uc->histograms) cache_histogram_add(uc->lock_wait, uwsgi_micros() - start);
                 int ret = uwsgi_cache_set2(uc, key, keylen, value, vallen, expires, flags);
                 uwsgi_rwunlock(uc->lock);
+		if (uc->histograms) cache_histogram_add(uc->set_latency, uwsgi_micros() - start);
 		return ret;
         }
 
@@ -1900,6 +3910,93 @@ int uwsgi_cache_magic_set(char *key, uint16_t keylen, char *value, uint64_t vall
 
 }
 
+/*
+	batched get/set
+
+	on local caches the lock is taken only once for every group of keys mapped to the same
+	shard. Remote caches (and lockless caches) fallback to the single-key functions.
+
+	mget fills values/vallens (values must be freed, NULL on miss) and returns the number of hits,
+	mset returns the number of items that cannot be stored.
+*/
+
+static struct uwsgi_cache *cache_magic_local(char *cache) {
+	if (!cache) return uwsgi.caches;
+	if (strchr(cache, '@')) return NULL;
+	return uwsgi_cache_by_name(cache);
+}
+
+uint64_t uwsgi_cache_magic_mget(char **keys, uint16_t *keylens, char **values, uint64_t *vallens, uint64_t n, char *cache) {
+	uint64_t i, j, hits = 0;
+	struct uwsgi_cache *uc = cache_magic_local(cache);
+
+	if (!uc || uc->immutable || (uc->seqlock && !uc->purge_lru)) {
+		for (i = 0; i < n; i++) {
+			values[i] = uwsgi_cache_magic_get(keys[i], keylens[i], &vallens[i], NULL, cache);
+			if (values[i]) hits++;
+		}
+		return hits;
+	}
+
+	struct uwsgi_cache **shards = uwsgi_malloc(sizeof(struct uwsgi_cache *) * n);
+	for (i = 0; i < n; i++) {
+		shards[i] = uwsgi_cache_shard(uc, keys[i], keylens[i]);
+		values[i] = NULL;
+		vallens[i] = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct uwsgi_cache *ucs = shards[i];
+		if (!ucs) continue;
+		cache_magic_get_lock(ucs);
+		for (j = i; j < n; j++) {
+			if (shards[j] != ucs) continue;
+			shards[j] = NULL;
+			char *value = uwsgi_cache_get3(ucs, keys[j], keylens[j], &vallens[j], NULL);
+			if (!value) continue;
+			values[j] = uwsgi_malloc(vallens[j]);
+			memcpy(values[j], value, vallens[j]);
+			hits++;
+		}
+		uwsgi_rwunlock(ucs->lock);
+	}
+
+	free(shards);
+	return hits;
+}
+
+uint64_t uwsgi_cache_magic_mset(char **keys, uint16_t *keylens, char **values, uint64_t *vallens, uint64_t n, uint64_t expires, uint64_t flags, char *cache) {
+	uint64_t i, j, failed = 0;
+	struct uwsgi_cache *uc = cache_magic_local(cache);
+
+	if (!uc) {
+		for (i = 0; i < n; i++) {
+			if (uwsgi_cache_magic_set(keys[i], keylens[i], values[i], vallens[i], expires, flags, cache)) failed++;
+		}
+		return failed;
+	}
+
+	struct uwsgi_cache **shards = uwsgi_malloc(sizeof(struct uwsgi_cache *) * n);
+	for (i = 0; i < n; i++) {
+		shards[i] = uwsgi_cache_shard(uc, keys[i], keylens[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct uwsgi_cache *ucs = shards[i];
+		if (!ucs) continue;
+		uwsgi_wlock(ucs->lock);
+		for (j = i; j < n; j++) {
+			if (shards[j] != ucs) continue;
+			shards[j] = NULL;
+			if (uwsgi_cache_set2(ucs, keys[j], keylens[j], values[j], vallens[j], expires, flags)) failed++;
+		}
+		uwsgi_rwunlock(ucs->lock);
+	}
+
+	free(shards);
+	return failed;
+}
+
 int uwsgi_cache_magic_del(char *key, uint16_t keylen, char *cache) {
 
 	struct uwsgi_cache_magic_context ucmc;
@@ -1925,6 +4022,7 @@ int uwsgi_cache_magic_del(char *key, uint16_t keylen, char *cache) {
 
         // we have a local cache !!!
         if (uc) {
+                uc = uwsgi_cache_shard(uc, key, keylen);
                 uwsgi_wlock(uc->lock);
                 if (uwsgi_cache_del2(uc, key, keylen, 0, 0)) {
                         uwsgi_rwunlock(uc->lock);
@@ -1997,16 +4095,7 @@ int uwsgi_cache_magic_clear(char *cache) {
 
         // we have a local cache !!!
         if (uc) {
-		uint64_t i;
-                uwsgi_wlock(uc->lock);
-		for (i = 1; i < uc->max_items; i++) {
-                	if (uwsgi_cache_del2(uc, NULL, 0, i, 0)) {
-                        	uwsgi_rwunlock(uc->lock);
-                        	return -1;
-                	}
-		}
-                uwsgi_rwunlock(uc->lock);
-                return 0;
+		return uwsgi_cache_clear(uc);
         }
 
         // we have a remote one
@@ -2050,6 +4139,8 @@ int uwsgi_cache_magic_clear(char *cache) {
 
 void uwsgi_cache_sync_from_nodes(struct uwsgi_cache *uc) {
 	struct uwsgi_string_list *usl = uc->sync_nodes;
+	// streamed by a master thread (see uwsgi_cache_start_sync_servers)
+	if (uc->sync_stream) return;
 	while(usl) {
 		uwsgi_log("[cache-sync] getting cache dump from %s ...\n", usl->value);
 		int fd = uwsgi_connect(usl->value, 0, 0);
@@ -2097,7 +4188,8 @@ void uwsgi_cache_sync_from_nodes(struct uwsgi_cache *uc) {
                 }
 
 		// reset the hashtable
-		memset(uc->hashtable, 0, sizeof(uint64_t) * UMAX16);
+		memset(uc->hashtable, 0, sizeof(uint64_t) * uc->hashsize);
+		if (uc->tags) memset(uc->tags, 0, uc->hashsize + UWSGI_CACHE_OA_GROUP);
 		// re-fill the hashtable
                 uwsgi_cache_fix(uc);
 
@@ -2114,6 +4206,181 @@ next:
 }
 
 
+/*
+	streaming sync
+
+	with sync_stream=1 the cache is not copied in one shot before forking: a master thread
+	asks the sync nodes for ranges of items (modifier2 8, { cache, from, count }), while
+	the workers are already serving (with cache misses). Every response (modifier2 9) is a
+	{ next, total, size } dict followed by size bytes of records:
+
+	keylen(2) vallen(8) expires(8) key value (little endian)
+
+	Items already present in the local cache are not overwritten (they are newer).
+	On errors the transfer resumes from the last received position using the next node.
+*/
+
+struct uwsgi_buffer *uwsgi_cache_dump_range(struct uwsgi_cache *uc, uint64_t from, uint64_t count, uint64_t *next, uint64_t *total) {
+	uint64_t i;
+
+	// sharded caches expose their shards as a single range of positions
+	if (uc->shards) {
+		uint64_t shard_items = uc->shards[0]->max_items;
+		*total = shard_items * uc->shards_count;
+		if (from >= *total) {
+			*next = *total;
+			return uwsgi_buffer_new(uwsgi.page_size);
+		}
+		uint64_t shard = from / shard_items;
+		uint64_t shard_next = 0, shard_total = 0;
+		struct uwsgi_buffer *ub = uwsgi_cache_dump_range(uc->shards[shard], from % shard_items, count, &shard_next, &shard_total);
+		if (ub) *next = (shard * shard_items) + shard_next;
+		return ub;
+	}
+
+	*total = uc->max_items;
+	// slot 0 is never used
+	if (!from) from = 1;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	uwsgi_rlock(uc->lock);
+	for (i = from; i < uc->max_items && count > 0; i++) {
+		struct uwsgi_cache_item *uci = cache_item(i);
+		if (!uci->keysize) continue;
+		if (uwsgi_buffer_u16le(ub, uci->keysize)) goto error;
+		if (uwsgi_buffer_u64le(ub, uci->valsize)) goto error;
+		if (uwsgi_buffer_u64le(ub, uci->expires)) goto error;
+		if (uwsgi_buffer_append(ub, uci->key, uci->keysize)) goto error;
+		if (uwsgi_buffer_append(ub, uc->data + (uci->first_block * uc->blocksize), uci->valsize)) goto error;
+		count--;
+		// do not hold the lock (and the memory) for too much time
+		if (ub->pos >= 4 * 1024 * 1024) {
+			i++;
+			break;
+		}
+	}
+	uwsgi_rwunlock(uc->lock);
+	*next = i;
+	return ub;
+error:
+	uwsgi_rwunlock(uc->lock);
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+struct uwsgi_cache_sync_chunk {
+	uint64_t next;
+	uint64_t total;
+	uint64_t size;
+};
+
+static void cache_sync_chunk_hook(char *k, uint16_t kl, char *v, uint16_t vl, void *data) {
+	struct uwsgi_cache_sync_chunk *ucsc = (struct uwsgi_cache_sync_chunk *) data;
+	if (!uwsgi_strncmp(k, kl, "next", 4)) ucsc->next = uwsgi_str_num(v, vl);
+	else if (!uwsgi_strncmp(k, kl, "total", 5)) ucsc->total = uwsgi_str_num(v, vl);
+	else if (!uwsgi_strncmp(k, kl, "size", 4)) ucsc->size = uwsgi_str_num(v, vl);
+}
+
+static uint64_t cache_sync_stream_apply(struct uwsgi_cache *uc, char *buf, uint64_t len) {
+	uint64_t pos = 0, applied = 0;
+	while (pos + 18 <= len) {
+		uint16_t keylen;
+		uint64_t vallen, expires;
+		memcpy(&keylen, buf + pos, 2);
+		memcpy(&vallen, buf + pos + 2, 8);
+		memcpy(&expires, buf + pos + 10, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		keylen = __builtin_bswap16(keylen);
+		vallen = __builtin_bswap64(vallen);
+		expires = __builtin_bswap64(expires);
+#endif
+		if (pos + 18 + keylen + vallen > len) break;
+		char *key = buf + pos + 18;
+		char *val = key + keylen;
+		pos += 18 + keylen + vallen;
+
+		struct uwsgi_cache *ucs = uwsgi_cache_shard(uc, key, keylen);
+		uwsgi_wlock(ucs->lock);
+		if (!uwsgi_cache_set2(ucs, key, keylen, val, vallen, expires, UWSGI_CACHE_FLAG_LOCAL|UWSGI_CACHE_FLAG_ABSEXPIRE)) applied++;
+		uwsgi_rwunlock(ucs->lock);
+	}
+	return applied;
+}
+
+// returns 0 when the whole range has been received
+static int cache_sync_stream_chunk(struct uwsgi_cache *uc, char *node, uint64_t *pos, uint64_t *applied) {
+	struct uwsgi_cache_sync_chunk ucsc;
+	int ret = -1;
+	char *body = NULL;
+
+	int fd = uwsgi_connect(node, 0, 0);
+	if (fd < 0) return -1;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	ub->pos = 4;
+	if (uwsgi_buffer_append_keyval(ub, "cache", 5, uc->name, uc->name_len)) goto end;
+	if (uwsgi_buffer_append_keynum(ub, "from", 4, *pos)) goto end;
+	if (uwsgi_buffer_append_keynum(ub, "count", 5, uc->sync_stream_chunk)) goto end;
+	if (uwsgi_buffer_set_uh(ub, 111, 8)) goto end;
+	if (uwsgi_write_nb(fd, ub->buf, ub->pos, uwsgi.socket_timeout)) goto end;
+
+	size_t rlen = ub->len;
+	uint8_t modifier2 = 0;
+	if (uwsgi_read_with_realloc(fd, &ub->buf, &rlen, uwsgi.socket_timeout, NULL, &modifier2)) goto end;
+	if (modifier2 != 9) goto end;
+
+	memset(&ucsc, 0, sizeof(struct uwsgi_cache_sync_chunk));
+	if (uwsgi_hooked_parse(ub->buf, rlen, cache_sync_chunk_hook, &ucsc)) goto end;
+	if (ucsc.next <= *pos && ucsc.next < ucsc.total) goto end;
+
+	if (ucsc.size > 0) {
+		body = uwsgi_malloc(ucsc.size);
+		if (uwsgi_read_nb(fd, body, ucsc.size, uwsgi.socket_timeout)) goto end;
+		*applied += cache_sync_stream_apply(uc, body, ucsc.size);
+	}
+
+	*pos = ucsc.next;
+	ret = *pos >= ucsc.total ? 0 : 1;
+end:
+	free(body);
+	uwsgi_buffer_destroy(ub);
+	close(fd);
+	return ret;
+}
+
+static void *cache_sync_stream_loop(void *arg) {
+	// block all signals
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	struct uwsgi_cache *uc = (struct uwsgi_cache *) arg;
+	struct uwsgi_string_list *usl = uc->sync_nodes;
+	uint64_t pos = 0, applied = 0;
+	int failures = 0, nodes = 0;
+	struct uwsgi_string_list *n;
+	uwsgi_foreach(n, uc->sync_nodes) nodes++;
+
+	uwsgi_log("[cache-sync] streaming cache \"%s\" from %s ...\n", uc->name, usl->value);
+	for (;;) {
+		int ret = cache_sync_stream_chunk(uc, usl->value, &pos, &applied);
+		if (ret == 0) break;
+		if (ret > 0) {
+			failures = 0;
+			continue;
+		}
+		// give up after three rounds of failures
+		if (++failures >= nodes * 3) {
+			uwsgi_log("[cache-sync] unable to complete the sync of cache \"%s\" (%llu items received)\n", uc->name, (unsigned long long) applied);
+			return NULL;
+		}
+		usl = usl->next ? usl->next : uc->sync_nodes;
+		uwsgi_log("[cache-sync] resuming cache \"%s\" sync from %s at position %llu ...\n", uc->name, usl->value, (unsigned long long) pos);
+		sleep(1);
+	}
+	uwsgi_log("[cache-sync] cache \"%s\" synced: %llu items received\n", uc->name, (unsigned long long) applied);
+	return NULL;
+}
+
 void uwsgi_cache_setup_nodes(struct uwsgi_cache *uc) {
 	struct uwsgi_string_list *usl = uc->nodes;
 	while(usl) {
@@ -2133,6 +4400,24 @@ void uwsgi_cache_setup_nodes(struct uwsgi_cache *uc) {
 
 struct uwsgi_cache_item *uwsgi_cache_keys(struct uwsgi_cache *uc, uint64_t *pos, struct uwsgi_cache_item **uci) {
 
+	// sharded caches map pos to <shard, slot> (all of the shards have the same hashsize)
+	if (uc->shards) {
+		uint64_t shard_hashsize = uc->shards[0]->hashsize;
+		while (*pos < shard_hashsize * uc->shards_count) {
+			uint64_t base = *pos - (*pos % shard_hashsize);
+			uint64_t shard_pos = *pos % shard_hashsize;
+			struct uwsgi_cache_item *item = uwsgi_cache_keys(uc->shards[base / shard_hashsize], &shard_pos, uci);
+			if (item) {
+				*pos = base + shard_pos;
+				return item;
+			}
+			*pos = base + shard_hashsize;
+			*uci = NULL;
+		}
+		(*pos)++;
+		return NULL;
+	}
+
 	// security check
 	if (*pos >= uc->hashsize) return NULL;
 	// iterate hashtable
@@ -2154,10 +4439,25 @@ struct uwsgi_cache_item *uwsgi_cache_keys(struct uwsgi_cache *uc, uint64_t *pos,
 }
 
 void uwsgi_cache_rlock(struct uwsgi_cache *uc) {
+	uint64_t i;
+	if (uc->shards) {
+		// always in the same order, so concurrent full scans cannot deadlock
+		for (i = 0; i < uc->shards_count; i++) {
+			uwsgi_rlock(uc->shards[i]->lock);
+		}
+		return;
+	}
 	uwsgi_rlock(uc->lock);
 }
 
 void uwsgi_cache_rwunlock(struct uwsgi_cache *uc) {
+	uint64_t i;
+	if (uc->shards) {
+		for (i = 0; i < uc->shards_count; i++) {
+			uwsgi_rwunlock(uc->shards[i]->lock);
+		}
+		return;
+	}
 	uwsgi_rwunlock(uc->lock);
 }
 
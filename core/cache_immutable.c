@@ -0,0 +1,525 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	immutable caches (--cache2 name=<name>,immutable=<file>)
+
+	the data is built offline (--cache-immutable-build src=<file>,dst=<file>) in a single file
+	indexed by a perfect hash (hash and displace): keys are grouped in buckets (4 keys per
+	bucket on average) and every bucket stores the displacement that maps all of its keys to
+	distinct slots. A lookup costs two hashes, two array reads and a key comparison, without
+	locks and without writing to shared memory (hits/miss counters are not updated).
+
+	The file is mapped read-only (MAP_SHARED) before forking, so all of the processes share the
+	same page cache. On SIGUSR2 (or the 'M' master fifo command) the master maps and verifies the
+	(new) file at the same path, then bumps the generation of the cache: every process remaps
+	the file on its next lookup. The previous mapping is released only at the next swap, as a
+	concurrent reader could still be copying a value from it.
+
+	file layout (native byte order, every section is 8 bytes aligned):
+
+		header
+		uint32_t displacements[buckets]
+		uint64_t slots[slots] (offset of the entry, 0 for empty slots)
+		entries: uint64_t vallen, uint16_t keylen, key, value
+*/
+
+#define UWSGI_CACHE_IMMUTABLE_MAGIC "uWSGImph"
+#define UWSGI_CACHE_IMMUTABLE_VERSION 1
+#define UWSGI_CACHE_IMMUTABLE_LAMBDA 4
+#define UWSGI_CACHE_IMMUTABLE_TRIES (1 << 20)
+#define UWSGI_CACHE_IMMUTABLE_SEEDS 16
+
+struct uwsgi_cache_immutable_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t seed;
+	uint64_t items;
+	uint64_t buckets;
+	uint64_t slots;
+	uint64_t size;
+	// of everything after the header
+	uint64_t checksum;
+};
+
+struct uwsgi_cache_immutable {
+	char *map;
+	uint64_t generation;
+	char *old_map;
+	uint64_t old_size;
+	pthread_mutex_t lock;
+};
+
+struct uwsgi_cache_immutable_record {
+	uint64_t hash;
+	char *key;
+	char *value;
+	uint64_t vallen;
+	uint16_t keylen;
+	uint64_t offset;
+};
+
+#define cache_immutable_align(x) (((x) + 7) & ~((uint64_t) 7))
+#define cache_immutable_slots_offset(buckets) cache_immutable_align(sizeof(struct uwsgi_cache_immutable_header) + ((buckets) * 4))
+#define cache_immutable_entries_offset(buckets, slots) (cache_immutable_slots_offset(buckets) + ((slots) * 8))
+#define cache_immutable_entry_size(keylen, vallen) cache_immutable_align(10 + (keylen) + (vallen))
+
+static uint64_t cache_immutable_mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t cache_immutable_hash(char *key, uint16_t keylen, uint32_t seed) {
+	uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+	uint16_t i;
+	for (i = 0; i < keylen; i++) {
+		h ^= (uint8_t) key[i];
+		h *= 0x100000001b3ULL;
+	}
+	return cache_immutable_mix(h);
+}
+
+static uint64_t cache_immutable_slot(uint64_t hash, uint32_t displacement, uint64_t slots) {
+	return cache_immutable_mix(hash ^ ((uint64_t) displacement * 0x9e3779b97f4a7c15ULL)) % slots;
+}
+
+static uint64_t cache_immutable_checksum(char *map, uint64_t size) {
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	uint64_t i;
+	for (i = sizeof(struct uwsgi_cache_immutable_header); i + 8 <= size; i += 8) {
+		uint64_t w = *((uint64_t *) (map + i));
+		h = ((h ^ w) * 0xff51afd7ed558ccdULL);
+		h = (h << 31) | (h >> 33);
+	}
+	return cache_immutable_mix(h);
+}
+
+// lookup a key in a mapped file, the value points to the mapping
+char *uwsgi_cache_immutable_lookup(char *map, char *key, uint16_t keylen, uint64_t *vallen) {
+	struct uwsgi_cache_immutable_header *uch = (struct uwsgi_cache_immutable_header *) map;
+	if (!uch->items) return NULL;
+
+	uint64_t hash = cache_immutable_hash(key, keylen, uch->seed);
+	uint32_t *displacements = (uint32_t *) (map + sizeof(struct uwsgi_cache_immutable_header));
+	uint64_t *slots = (uint64_t *) (map + cache_immutable_slots_offset(uch->buckets));
+
+	uint64_t offset = slots[cache_immutable_slot(hash, displacements[hash % uch->buckets], uch->slots)];
+	if (!offset || offset + 10 + keylen > uch->size) return NULL;
+
+	uint16_t entry_keylen = *((uint16_t *) (map + offset + 8));
+	if (entry_keylen != keylen || memcmp(map + offset + 10, key, keylen)) return NULL;
+
+	uint64_t entry_vallen = *((uint64_t *) (map + offset));
+	if (entry_vallen > uch->size - (offset + 10 + keylen)) return NULL;
+
+	*vallen = entry_vallen;
+	return map + offset + 10 + keylen;
+}
+
+static char *cache_immutable_map(char *path, int verify) {
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		uwsgi_error_open(path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st)) {
+		uwsgi_error("cache_immutable_map()/fstat()");
+		close(fd);
+		return NULL;
+	}
+
+	if ((uint64_t) st.st_size < sizeof(struct uwsgi_cache_immutable_header)) {
+		uwsgi_log("[immutable-cache] invalid file %s\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		uwsgi_error("cache_immutable_map()/mmap()");
+		return NULL;
+	}
+
+	struct uwsgi_cache_immutable_header *uch = (struct uwsgi_cache_immutable_header *) map;
+	uint64_t size = st.st_size;
+	if (memcmp(uch->magic, UWSGI_CACHE_IMMUTABLE_MAGIC, 8) || uch->version != UWSGI_CACHE_IMMUTABLE_VERSION || uch->size != size
+		|| !uch->buckets || !uch->slots || uch->buckets > size / 4 || uch->slots > size / 8
+		|| cache_immutable_entries_offset(uch->buckets, uch->slots) > size) {
+		uwsgi_log("[immutable-cache] invalid file %s\n", path);
+		goto error;
+	}
+
+	if (verify && cache_immutable_checksum(map, size) != uch->checksum) {
+		uwsgi_log("[immutable-cache] invalid checksum for %s\n", path);
+		goto error;
+	}
+
+	return map;
+
+error:
+	munmap(map, size);
+	return NULL;
+}
+
+static void cache_immutable_install(struct uwsgi_cache_immutable *im, char *map, uint64_t generation) {
+	if (im->old_map) munmap(im->old_map, im->old_size);
+	im->old_map = im->map;
+	im->old_size = ((struct uwsgi_cache_immutable_header *) im->map)->size;
+	__atomic_store_n(&im->map, map, __ATOMIC_RELEASE);
+	__atomic_store_n(&im->generation, generation, __ATOMIC_RELEASE);
+}
+
+void uwsgi_cache_immutable_init(struct uwsgi_cache *uc) {
+	struct uwsgi_cache_immutable *im = uwsgi_calloc(sizeof(struct uwsgi_cache_immutable));
+	pthread_mutex_init(&im->lock, NULL);
+	im->map = cache_immutable_map(uc->immutable, 1);
+	if (!im->map) exit(1);
+
+	struct uwsgi_cache_immutable_header *uch = (struct uwsgi_cache_immutable_header *) im->map;
+	uc->immutable_map = im;
+	uc->n_items = uch->items;
+	uwsgi.cache_immutable++;
+	uwsgi_log("*** Cache \"%s\" mapped (immutable) from %s: %llu items, %llu bytes ***\n", uc->name, uc->immutable,
+		(unsigned long long) uch->items, (unsigned long long) uch->size);
+}
+
+// the master already verified the file, the other processes only check its header
+static void cache_immutable_remap(struct uwsgi_cache *uc, struct uwsgi_cache_immutable *im, uint64_t generation) {
+	// another thread is remapping, use the current mapping
+	if (pthread_mutex_trylock(&im->lock)) return;
+	if (im->generation != generation) {
+		char *map = cache_immutable_map(uc->immutable, 0);
+		if (map) {
+			cache_immutable_install(im, map, generation);
+		}
+		else {
+			uwsgi_log("[immutable-cache] unable to remap cache \"%s\", keeping the current data\n", uc->name);
+			__atomic_store_n(&im->generation, generation, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&im->lock);
+}
+
+char *uwsgi_cache_immutable_get(struct uwsgi_cache *uc, char *key, uint16_t keylen, uint64_t *valsize) {
+	struct uwsgi_cache_immutable *im = uc->immutable_map;
+	uint64_t generation = __atomic_load_n(&uc->immutable_generation, __ATOMIC_ACQUIRE);
+	if (generation != __atomic_load_n(&im->generation, __ATOMIC_ACQUIRE)) {
+		cache_immutable_remap(uc, im, generation);
+	}
+	return uwsgi_cache_immutable_lookup(__atomic_load_n(&im->map, __ATOMIC_ACQUIRE), key, keylen, valsize);
+}
+
+// run by the master: verify the new files and publish them
+void uwsgi_cache_immutable_swap(int signum) {
+	uwsgi.cache_immutable_swap = 0;
+	struct uwsgi_cache *uc = uwsgi.caches;
+	while (uc) {
+		if (!uc->immutable_map) goto next;
+		char *map = cache_immutable_map(uc->immutable, 1);
+		if (!map) {
+			uwsgi_log_verbose("[immutable-cache] unable to swap cache \"%s\", keeping the current data\n", uc->name);
+			goto next;
+		}
+		struct uwsgi_cache_immutable *im = uc->immutable_map;
+		pthread_mutex_lock(&im->lock);
+		uint64_t generation = uc->immutable_generation + 1;
+		cache_immutable_install(im, map, generation);
+		pthread_mutex_unlock(&im->lock);
+		uc->n_items = ((struct uwsgi_cache_immutable_header *) map)->items;
+		__atomic_store_n(&uc->immutable_generation, generation, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&uc->generation, 1, __ATOMIC_RELEASE);
+		uwsgi_log_verbose("[immutable-cache] cache \"%s\" swapped to %s: %llu items (generation %llu)\n", uc->name, uc->immutable,
+			(unsigned long long) uc->n_items, (unsigned long long) generation);
+next:
+		uc = uc->next;
+	}
+}
+
+// signal handler, the swap is run in the master cycle
+void uwsgi_cache_immutable_swap_signal(int signum) {
+	uwsgi.cache_immutable_swap = 1;
+}
+
+/*
+	build an immutable cache file from a tab separated file (one "key<TAB>value" per line),
+	the file is written to a temporary path and then renamed, so it can be safely built
+	over the one in use
+*/
+
+static int cache_immutable_place(struct uwsgi_cache_immutable_record *records, uint64_t *members, uint64_t n, uint32_t *displacement, uint8_t *taken, uint64_t slots, uint64_t *positions) {
+	uint32_t d;
+	uint64_t i, j;
+	for (d = 1; d <= UWSGI_CACHE_IMMUTABLE_TRIES; d++) {
+		for (i = 0; i < n; i++) {
+			positions[i] = cache_immutable_slot(records[members[i]].hash, d, slots);
+			if (taken[positions[i]]) break;
+			for (j = 0; j < i; j++) {
+				if (positions[j] == positions[i]) break;
+			}
+			if (j < i) break;
+		}
+		if (i < n) continue;
+		for (i = 0; i < n; i++) taken[positions[i]] = 1;
+		*displacement = d;
+		return 0;
+	}
+	return -1;
+}
+
+int uwsgi_cache_immutable_build(char *src, char *dst) {
+	int ret = -1;
+	struct stat st;
+	char *map = NULL, *out = NULL, *tmp = NULL;
+	uint64_t map_size = 0, size = 0, items = 0, i, j;
+	struct uwsgi_cache_immutable_record *records = NULL;
+	uint64_t *counts = NULL, *starts = NULL, *members = NULL, *order = NULL, *slots_offsets = NULL;
+	uint32_t *displacements = NULL;
+	uint8_t *taken = NULL;
+	int out_fd = -1;
+
+	int fd = open(src, O_RDONLY);
+	if (fd < 0) {
+		uwsgi_error_open(src);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		uwsgi_error("uwsgi_cache_immutable_build()/fstat()");
+		close(fd);
+		return -1;
+	}
+	map_size = st.st_size;
+	if (map_size > 0) {
+		map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			uwsgi_error("uwsgi_cache_immutable_build()/mmap()");
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+
+	// parse the records
+	uint64_t records_size = 0;
+	uint64_t line = 0;
+	char *ptr = map, *end = map + map_size;
+	while (ptr < end) {
+		line++;
+		char *nl = memchr(ptr, '\n', end - ptr);
+		char *line_end = nl ? nl : end;
+		if (line_end == ptr) goto next_line;
+		char *tab = memchr(ptr, '\t', line_end - ptr);
+		if (!tab) {
+			uwsgi_log("[immutable-cache] %s line %llu: missing tab separator\n", src, (unsigned long long) line);
+			goto end;
+		}
+		if (tab == ptr || tab - ptr >= UMAX16 || tab + 1 == line_end) {
+			uwsgi_log("[immutable-cache] %s line %llu: invalid key or empty value\n", src, (unsigned long long) line);
+			goto end;
+		}
+		if (items >= records_size) {
+			records_size = records_size ? records_size * 2 : 4096;
+			records = realloc(records, sizeof(struct uwsgi_cache_immutable_record) * records_size);
+			if (!records) {
+				uwsgi_error("uwsgi_cache_immutable_build()/realloc()");
+				goto end;
+			}
+		}
+		records[items].key = ptr;
+		records[items].keylen = tab - ptr;
+		records[items].value = tab + 1;
+		records[items].vallen = line_end - (tab + 1);
+		items++;
+next_line:
+		ptr = line_end + 1;
+	}
+
+	uint64_t buckets = (items / UWSGI_CACHE_IMMUTABLE_LAMBDA) + 1;
+	// ~90% load factor
+	uint64_t slots = items + (items / 8) + 1;
+	uint32_t seed;
+
+	counts = uwsgi_calloc(sizeof(uint64_t) * buckets);
+	starts = uwsgi_calloc(sizeof(uint64_t) * (buckets + 1));
+	order = uwsgi_calloc(sizeof(uint64_t) * buckets);
+	members = uwsgi_calloc(sizeof(uint64_t) * (items + 1));
+	displacements = uwsgi_calloc(sizeof(uint32_t) * buckets);
+	taken = uwsgi_calloc(slots);
+
+	for (seed = 0; seed < UWSGI_CACHE_IMMUTABLE_SEEDS; seed++) {
+		memset(counts, 0, sizeof(uint64_t) * buckets);
+		memset(displacements, 0, sizeof(uint32_t) * buckets);
+		memset(taken, 0, slots);
+
+		for (i = 0; i < items; i++) {
+			records[i].hash = cache_immutable_hash(records[i].key, records[i].keylen, seed);
+			counts[records[i].hash % buckets]++;
+		}
+
+		// members of each bucket (counting sort)
+		uint64_t max_bucket = 0;
+		starts[0] = 0;
+		for (i = 0; i < buckets; i++) {
+			starts[i + 1] = starts[i] + counts[i];
+			if (counts[i] > max_bucket) max_bucket = counts[i];
+			counts[i] = 0;
+		}
+		for (i = 0; i < items; i++) {
+			uint64_t b = records[i].hash % buckets;
+			members[starts[b] + counts[b]] = i;
+			counts[b]++;
+		}
+
+		// place the biggest buckets first
+		uint64_t *by_size = uwsgi_calloc(sizeof(uint64_t) * (max_bucket + 2));
+		for (i = 0; i < buckets; i++) by_size[counts[i]]++;
+		uint64_t pos = 0;
+		for (j = max_bucket + 1; j > 0; j--) {
+			uint64_t n = by_size[j - 1];
+			by_size[j - 1] = pos;
+			pos += n;
+		}
+		for (i = 0; i < buckets; i++) order[by_size[counts[i]]++] = i;
+		free(by_size);
+
+		uint64_t *positions = uwsgi_malloc(sizeof(uint64_t) * (max_bucket + 1));
+		int collision = 0;
+		for (i = 0; i < buckets; i++) {
+			uint64_t b = order[i];
+			uint64_t n = counts[b];
+			if (!n) break;
+			uint64_t *m = members + starts[b];
+			uint64_t k, l;
+			// duplicated keys (or full 64bit hash collisions) cannot be placed
+			for (k = 0; k < n && !collision; k++) {
+				for (l = k + 1; l < n; l++) {
+					struct uwsgi_cache_immutable_record *r1 = &records[m[k]], *r2 = &records[m[l]];
+					if (r1->hash != r2->hash) continue;
+					if (r1->keylen == r2->keylen && !memcmp(r1->key, r2->key, r1->keylen)) {
+						uwsgi_log("[immutable-cache] %s: duplicated key \"%.*s\"\n", src, r1->keylen, r1->key);
+						free(positions);
+						goto end;
+					}
+					collision = 1;
+					break;
+				}
+			}
+			if (collision) break;
+			if (cache_immutable_place(records, m, n, &displacements[b], taken, slots, positions)) {
+				collision = 1;
+				break;
+			}
+		}
+		free(positions);
+		if (!collision) break;
+	}
+
+	if (seed >= UWSGI_CACHE_IMMUTABLE_SEEDS) {
+		uwsgi_log("[immutable-cache] %s: unable to build the perfect hash\n", src);
+		goto end;
+	}
+
+	// compute the layout
+	size = cache_immutable_entries_offset(buckets, slots);
+	for (i = 0; i < items; i++) {
+		records[i].offset = size;
+		size += cache_immutable_entry_size(records[i].keylen, records[i].vallen);
+	}
+
+	tmp = uwsgi_concat2(dst, ".XXXXXX");
+	out_fd = mkstemp(tmp);
+	if (out_fd < 0) {
+		uwsgi_error_open(tmp);
+		goto end;
+	}
+	// mkstemp() creates it as 0600
+	if (fchmod(out_fd, 0644)) {
+		uwsgi_error("uwsgi_cache_immutable_build()/fchmod()");
+		goto end;
+	}
+	if (ftruncate(out_fd, size)) {
+		uwsgi_error("uwsgi_cache_immutable_build()/ftruncate()");
+		goto end;
+	}
+	out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+	if (out == MAP_FAILED) {
+		out = NULL;
+		uwsgi_error("uwsgi_cache_immutable_build()/mmap()");
+		goto end;
+	}
+
+	memcpy(out + sizeof(struct uwsgi_cache_immutable_header), displacements, sizeof(uint32_t) * buckets);
+	slots_offsets = (uint64_t *) (out + cache_immutable_slots_offset(buckets));
+	for (i = 0; i < items; i++) {
+		struct uwsgi_cache_immutable_record *r = &records[i];
+		slots_offsets[cache_immutable_slot(r->hash, displacements[r->hash % buckets], slots)] = r->offset;
+		*((uint64_t *) (out + r->offset)) = r->vallen;
+		*((uint16_t *) (out + r->offset + 8)) = r->keylen;
+		memcpy(out + r->offset + 10, r->key, r->keylen);
+		memcpy(out + r->offset + 10 + r->keylen, r->value, r->vallen);
+	}
+
+	struct uwsgi_cache_immutable_header *uch = (struct uwsgi_cache_immutable_header *) out;
+	memcpy(uch->magic, UWSGI_CACHE_IMMUTABLE_MAGIC, 8);
+	uch->version = UWSGI_CACHE_IMMUTABLE_VERSION;
+	uch->seed = seed;
+	uch->items = items;
+	uch->buckets = buckets;
+	uch->slots = slots;
+	uch->size = size;
+	uch->checksum = cache_immutable_checksum(out, size);
+
+	if (msync(out, size, MS_SYNC) || fsync(out_fd)) {
+		uwsgi_error("uwsgi_cache_immutable_build()/fsync()");
+		goto end;
+	}
+
+	if (rename(tmp, dst)) {
+		uwsgi_error("uwsgi_cache_immutable_build()/rename()");
+		goto end;
+	}
+
+	uwsgi_log("[immutable-cache] built %s: %llu items, %llu buckets, %llu slots, %llu bytes\n", dst,
+		(unsigned long long) items, (unsigned long long) buckets, (unsigned long long) slots, (unsigned long long) size);
+	ret = 0;
+
+end:
+	if (out) munmap(out, size);
+	if (out_fd >= 0) {
+		close(out_fd);
+		if (ret) unlink(tmp);
+	}
+	if (tmp) free(tmp);
+	if (map) munmap(map, map_size);
+	free(records);
+	free(counts);
+	free(starts);
+	free(order);
+	free(members);
+	free(displacements);
+	free(taken);
+	return ret;
+}
+
+void uwsgi_opt_cache_immutable_build(char *opt, char *value, void *none) {
+	char *src = NULL, *dst = NULL;
+	if (uwsgi_kvlist_parse(value, strlen(value), ',', '=',
+		"src", &src,
+		"dst", &dst,
+		NULL)) {
+		uwsgi_log("unable to parse --%s value\n", opt);
+		exit(1);
+	}
+	if (!src || !dst) {
+		uwsgi_log("--%s requires both src and dst\n", opt);
+		exit(1);
+	}
+	exit(uwsgi_cache_immutable_build(src, dst) ? 1 : 0);
+}
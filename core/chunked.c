@@ -15,6 +15,14 @@ extern struct uwsgi_server uwsgi;
 	timeout = -1 (wait forever)
 	timeout = 0 (default)
 
+	The decoder keeps a read cursor in the receive buffer (chunked_input_off), the body
+	bytes are never moved: uwsgi_chunked_read() returns whole chunks (so they have to fit
+	in --chunked-input-limit), while uwsgi_chunked_read_slice() returns whatever part of the
+	current chunk is already in the buffer (no limit and no copy). Both pointers are valid
+	until the next call.
+
+	In non-blocking mode NULL is returned (with errno set to EAGAIN) when no data is available.
+
 */
 
 static ssize_t uwsgi_chunked_input_recv(struct wsgi_request *wsgi_req, int timeout, int nb) {
@@ -53,187 +61,164 @@ wait:
         return -1;
 }
 
-static ssize_t uwsgi_chunked_readline(struct wsgi_request *wsgi_req) {
+// parse a chunk size line, returns -2 if it is still incomplete
+static ssize_t uwsgi_chunked_readline(char *buf, size_t len, size_t *consumed) {
 	size_t i;
 	int found = 0;
-	for(i=0;i<wsgi_req->chunked_input_buf->pos;i++) {
+	for(i=0;i<len;i++) {
 		if (found) {
-			if (wsgi_req->chunked_input_buf->buf[i] == '\n') {
+			if (buf[i] == '\n') {
 				// strtoul will stop at \r
-				size_t num =  strtoul(wsgi_req->chunked_input_buf->buf, NULL, 16);
-				if (uwsgi_buffer_decapitate(wsgi_req->chunked_input_buf, i+1)) return -1;
-				return num;
+				*consumed = i+1;
+				return strtoul(buf, NULL, 16);
 			}
 			return -1;
 		}
-		if ((wsgi_req->chunked_input_buf->buf[i] >= '0' && wsgi_req->chunked_input_buf->buf[i] <= '9') || 
-			(wsgi_req->chunked_input_buf->buf[i] >= 'a' && wsgi_req->chunked_input_buf->buf[i] <= 'z') ||
-			(wsgi_req->chunked_input_buf->buf[i] >= 'A' && wsgi_req->chunked_input_buf->buf[i] <= 'Z')) continue;
-		if (wsgi_req->chunked_input_buf->buf[i] == '\r') { found = 1; continue; }
+		if ((buf[i] >= '0' && buf[i] <= '9') || 
+			(buf[i] >= 'a' && buf[i] <= 'z') ||
+			(buf[i] >= 'A' && buf[i] <= 'Z')) continue;
+		if (buf[i] == '\r') { found = 1; continue; }
 		return -1;
 	}
 
 	return -2;
 }
 
+static void uwsgi_chunked_input_init(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->chunked_input_buf) {
+		wsgi_req->chunked_input_buf = uwsgi_buffer_new(uwsgi.page_size);
+		wsgi_req->chunked_input_buf->limit = uwsgi.chunked_input_limit;
+	}
+}
+
+// read more data (at least "need" bytes of room), moving the unconsumed ones at the start of the buffer
+static int uwsgi_chunked_input_fill(struct wsgi_request *wsgi_req, size_t need, int timeout, int nb) {
+	struct uwsgi_buffer *ub = wsgi_req->chunked_input_buf;
+	if (wsgi_req->chunked_input_off > 0) {
+		if (uwsgi_buffer_decapitate(ub, wsgi_req->chunked_input_off)) return -1;
+		wsgi_req->chunked_input_off = 0;
+	}
+	if (uwsgi_buffer_ensure(ub, UMAX((uint64_t)uwsgi.page_size, need))) return -1;
+	ssize_t rlen = uwsgi_chunked_input_recv(wsgi_req, timeout, nb);
+	if (rlen <= 0) return -1;
+	ub->pos += rlen;
+	return 0;
+}
+
 /*
 
-	0 -> waiting for \r\n
-	1 -> waiting for whole body
+	0 -> waiting for the chunk size line
+	1 -> in the chunk body (chunked_input_chunk_len bytes remaining)
+	2 -> waiting for the \r\n after the body
 
-*/
+	returns 1 when body data (or the end of the stream) is available, 0 when more data are needed
 
-struct uwsgi_buffer *uwsgi_chunked_read_smart(struct wsgi_request *wsgi_req, size_t len, int timeout) {
-	// check for buffer
-	if (!wsgi_req->body_chunked_buf)
-		wsgi_req->body_chunked_buf = uwsgi_buffer_new(uwsgi.page_size);	
-	// first case: asking for all
-	if (!len) {
-		for(;;) {
-			size_t chunked_len = 0;
-			char *buf = uwsgi_chunked_read(wsgi_req, &chunked_len, timeout, 0);
-			if (chunked_len == 0) {
-				struct uwsgi_buffer *ret = uwsgi_buffer_new(wsgi_req->body_chunked_buf->pos);
-				if (uwsgi_buffer_append(ret, wsgi_req->body_chunked_buf->buf, wsgi_req->body_chunked_buf->pos)) {
-					uwsgi_buffer_destroy(ret);
-					return NULL;
+*/
+static int uwsgi_chunked_parse(struct wsgi_request *wsgi_req) {
+	struct uwsgi_buffer *ub = wsgi_req->chunked_input_buf;
+	for(;;) {
+		char *ptr = ub->buf + wsgi_req->chunked_input_off;
+		size_t avail = ub->pos - wsgi_req->chunked_input_off;
+		switch(wsgi_req->chunked_input_parser_status) {
+			case 0: {
+				size_t consumed = 0;
+				ssize_t num = uwsgi_chunked_readline(ptr, avail, &consumed);
+				if (num == -2) return 0;
+				if (num < 0) return -1;
+				wsgi_req->chunked_input_off += consumed;
+				if (num == 0) {
+					wsgi_req->chunked_input_complete = 1;
+					return 1;
 				}
-				uwsgi_buffer_decapitate(wsgi_req->body_chunked_buf, wsgi_req->body_chunked_buf->pos);
-				return ret;
-			}
-			if (uwsgi_buffer_append(wsgi_req->body_chunked_buf, buf, chunked_len)) {
-				return NULL;
+				wsgi_req->chunked_input_chunk_len = num;
+				wsgi_req->chunked_input_parser_status = 1;
+				return 1;
 			}
+			case 1:
+				return 1;
+			case 2:
+				if (avail < 2) return 0;
+				wsgi_req->chunked_input_off += 2;
+				wsgi_req->chunked_input_parser_status = 0;
+				break;
+			default:
+				return -1;
 		}
-	} 
-
-	// asking for littler part
-	if (len <= wsgi_req->body_chunked_buf->pos) {
-		struct uwsgi_buffer *ret = uwsgi_buffer_new(len);
-		if (uwsgi_buffer_append(ret, wsgi_req->body_chunked_buf->buf, len)) {
-			uwsgi_buffer_destroy(ret);
-			return NULL;
-		}
-		uwsgi_buffer_decapitate(wsgi_req->body_chunked_buf, len);
-		return ret;
 	}
+}
 
-	// more data required
-	size_t remains = len;
-	struct uwsgi_buffer *ret = uwsgi_buffer_new(remains);
-	if (wsgi_req->body_chunked_buf->pos > 0) {
-		if (uwsgi_buffer_append(ret, wsgi_req->body_chunked_buf->buf, wsgi_req->body_chunked_buf->pos)) {
-			uwsgi_buffer_destroy(ret);
-			return NULL;
+// get up to "max" bytes (0 for no limit) of the current chunk directly from the receive buffer
+char *uwsgi_chunked_read_slice(struct wsgi_request *wsgi_req, size_t *len, size_t max, int timeout, int nb) {
+	uwsgi_chunked_input_init(wsgi_req);
+	struct uwsgi_buffer *ub = wsgi_req->chunked_input_buf;
+	*len = 0;
+	for(;;) {
+		// the whole chunk stream has been consumed
+		if (wsgi_req->chunked_input_complete) return ub->buf;
+		int ret = uwsgi_chunked_parse(wsgi_req);
+		if (ret < 0) return NULL;
+		if (ret > 0) {
+			if (wsgi_req->chunked_input_complete) continue;
+			size_t avail = ub->pos - wsgi_req->chunked_input_off;
+			if (avail > 0) {
+				size_t slice = UMIN(avail, (size_t) wsgi_req->chunked_input_chunk_len);
+				if (max > 0 && slice > max) slice = max;
+				char *ptr = ub->buf + wsgi_req->chunked_input_off;
+				wsgi_req->chunked_input_off += slice;
+				wsgi_req->chunked_input_chunk_len -= slice;
+				if (!wsgi_req->chunked_input_chunk_len) wsgi_req->chunked_input_parser_status = 2;
+				*len = slice;
+				return ptr;
+			}
 		}
-		remains -= wsgi_req->body_chunked_buf->pos;
-		uwsgi_buffer_decapitate(wsgi_req->body_chunked_buf, wsgi_req->body_chunked_buf->pos);
+		if (uwsgi_chunked_input_fill(wsgi_req, 0, timeout, nb)) return NULL;
 	}
+}
 
-	while(remains) {
-		size_t chunked_len = 0;
-                char *buf = uwsgi_chunked_read(wsgi_req, &chunked_len, timeout, 0);
-                if (chunked_len == 0) {
-			break;
-		}
-		if (uwsgi_buffer_append(wsgi_req->body_chunked_buf, buf, chunked_len)) {
+struct uwsgi_buffer *uwsgi_chunked_read_smart(struct wsgi_request *wsgi_req, size_t len, int timeout) {
+	struct uwsgi_buffer *ret = uwsgi_buffer_new(len ? UMIN(len, (size_t) uwsgi.page_size) : (size_t) uwsgi.page_size);
+	// 0 -> asking for all
+	while (!len || ret->pos < len) {
+		size_t slice_len = 0;
+		char *buf = uwsgi_chunked_read_slice(wsgi_req, &slice_len, len ? len - ret->pos : 0, timeout, 0);
+		// end of the stream (or error)
+		if (!buf || slice_len == 0) break;
+		if (uwsgi_buffer_append(ret, buf, slice_len)) {
 			uwsgi_buffer_destroy(ret);
 			return NULL;
 		}
-
-		if (chunked_len > remains) {
-			if (uwsgi_buffer_append(ret, wsgi_req->body_chunked_buf->buf, wsgi_req->body_chunked_buf->pos - (chunked_len - remains))) {
-                                uwsgi_buffer_destroy(ret);
-                                return NULL;
-                        }       
-                        uwsgi_buffer_decapitate(wsgi_req->body_chunked_buf, wsgi_req->body_chunked_buf->pos - (chunked_len - remains));
-                        return ret;
-		}
-		remains -= chunked_len;
 	}
-
-	if (uwsgi_buffer_append(ret, wsgi_req->body_chunked_buf->buf, wsgi_req->body_chunked_buf->pos)) {
-		uwsgi_buffer_destroy(ret);
-		return NULL;
-	}
-	uwsgi_buffer_decapitate(wsgi_req->body_chunked_buf, wsgi_req->body_chunked_buf->pos);
 	return ret;
 }
 
 char *uwsgi_chunked_read(struct wsgi_request *wsgi_req, size_t *len, int timeout, int nb) {
 
-	if (!wsgi_req->chunked_input_buf) {
-		wsgi_req->chunked_input_buf = uwsgi_buffer_new(uwsgi.page_size);
-		wsgi_req->chunked_input_buf->limit = uwsgi.chunked_input_limit;
-	}
-
-	// the whole chunk stream has been consumed
-	if (wsgi_req->chunked_input_complete) {
-		*len = 0;
-		return wsgi_req->chunked_input_buf->buf;
-	}
-
-	if (wsgi_req->chunked_input_decapitate > 0) {
-		if (uwsgi_buffer_decapitate(wsgi_req->chunked_input_buf, wsgi_req->chunked_input_decapitate)) return NULL;
-		wsgi_req->chunked_input_decapitate = 0;
-	}
+	uwsgi_chunked_input_init(wsgi_req);
+	struct uwsgi_buffer *ub = wsgi_req->chunked_input_buf;
 
 	for(;;) {
-		if (wsgi_req->chunked_input_need > 0 || wsgi_req->chunked_input_buf->pos == 0) {
-			if (uwsgi_buffer_ensure(wsgi_req->chunked_input_buf, UMAX((uint64_t)uwsgi.page_size, wsgi_req->chunked_input_need))) return NULL;
-			ssize_t rlen = uwsgi_chunked_input_recv(wsgi_req, timeout, nb);	
-			if (rlen <= 0) return NULL;
-			// update buffer position
-			wsgi_req->chunked_input_buf->pos += rlen;
-			if (wsgi_req->chunked_input_need > 0) {
-				if ((size_t)rlen > wsgi_req->chunked_input_need) {
-					wsgi_req->chunked_input_need = 0;
-				}
-				else {
-					wsgi_req->chunked_input_need -= rlen;
-				}
-			}
+		// the whole chunk stream has been consumed
+		if (wsgi_req->chunked_input_complete) {
+			*len = 0;
+			return ub->buf;
 		}
-
-		if (wsgi_req->chunked_input_need > 0) continue;
-
-		// ok we have a frame, let's parse it
-		if (wsgi_req->chunked_input_buf->pos > 0) {
-			switch(wsgi_req->chunked_input_parser_status) {
-				case 0:
-					wsgi_req->chunked_input_chunk_len = uwsgi_chunked_readline(wsgi_req);
-					if (wsgi_req->chunked_input_chunk_len == -2) {
-						wsgi_req->chunked_input_need++;
-						break;
-					}
-					else if (wsgi_req->chunked_input_chunk_len < 0) {
-						return NULL;
-					}
-					else if (wsgi_req->chunked_input_chunk_len == 0) {
-						*len = 0;
-						wsgi_req->chunked_input_complete = 1;
-						return wsgi_req->chunked_input_buf->buf;
-					}
-					// if here the buffer has been already decapitated
-					if ((size_t)(wsgi_req->chunked_input_chunk_len+2) > wsgi_req->chunked_input_buf->pos) {
-						wsgi_req->chunked_input_need = (wsgi_req->chunked_input_chunk_len+2) - wsgi_req->chunked_input_buf->pos;
-						wsgi_req->chunked_input_parser_status = 1;
-						break;
-					}
-					*len = wsgi_req->chunked_input_chunk_len;
-					wsgi_req->chunked_input_decapitate = wsgi_req->chunked_input_chunk_len+2;
-					return wsgi_req->chunked_input_buf->buf;
-				case 1:
-					if ((size_t)(wsgi_req->chunked_input_chunk_len+2) > wsgi_req->chunked_input_buf->pos) {
-                                                wsgi_req->chunked_input_need = (wsgi_req->chunked_input_chunk_len+2) - wsgi_req->chunked_input_buf->pos;
-						break;
-                                        }	
-					*len = wsgi_req->chunked_input_chunk_len;
-					wsgi_req->chunked_input_decapitate = wsgi_req->chunked_input_chunk_len+2;
-					wsgi_req->chunked_input_parser_status = 0;
-                                        return wsgi_req->chunked_input_buf->buf;
-					
+		int ret = uwsgi_chunked_parse(wsgi_req);
+		if (ret < 0) return NULL;
+		size_t need = 0;
+		if (ret > 0) {
+			if (wsgi_req->chunked_input_complete) continue;
+			size_t avail = ub->pos - wsgi_req->chunked_input_off;
+			if (avail >= (size_t) wsgi_req->chunked_input_chunk_len) {
+				char *ptr = ub->buf + wsgi_req->chunked_input_off;
+				*len = wsgi_req->chunked_input_chunk_len;
+				wsgi_req->chunked_input_off += wsgi_req->chunked_input_chunk_len;
+				wsgi_req->chunked_input_chunk_len = 0;
+				wsgi_req->chunked_input_parser_status = 2;
+				return ptr;
 			}
+			// the whole chunk must fit in the buffer
+			need = wsgi_req->chunked_input_chunk_len - avail;
 		}
+		if (uwsgi_chunked_input_fill(wsgi_req, need, timeout, nb)) return NULL;
 	}
 }
@@ -639,6 +639,215 @@ restart:
 }
 
 
+/*
+
+	compiled configs
+
+	the resolved exported options (after @-magic, placeholders and logic options)
+	are serialized as a list of records:
+
+	[flags:u8][keylen:u16le][key][vallen:u32le][value]
+
+	flags: 1 -> NULL value, 2 -> placeholder only
+
+	the loaders and the logic options are not stored, their effects already are
+
+*/
+
+#define UWSGI_COMPILED_CONFIG_MAGIC "uwsgicc\1"
+
+static struct uwsgi_option *compiled_config_opt(char *key) {
+	struct uwsgi_option *op = uwsgi.options;
+	while (op->name) {
+		if (!strcmp(key, op->name))
+			return op;
+		op++;
+	}
+	return NULL;
+}
+
+static int compiled_config_skip(struct uwsgi_opt *uo, struct uwsgi_option *op, int keep_inherit) {
+	if (!strcmp(uo->key, "end"))
+		return 1;
+	if (!op)
+		return 0;
+	if (op->func == uwsgi_opt_logic || op->func == uwsgi_opt_noop || op->func == uwsgi_opt_set_placeholder)
+		return 1;
+	if (op->func == uwsgi_opt_load_compiled || op->func == uwsgi_opt_load_ini || op->func == uwsgi_opt_load_config)
+		return 1;
+#ifdef UWSGI_XML
+	if (op->func == uwsgi_opt_load_xml)
+		return 1;
+#endif
+#ifdef UWSGI_YAML
+	if (op->func == uwsgi_opt_load_yml)
+		return 1;
+#endif
+#ifdef UWSGI_JSON
+	if (op->func == uwsgi_opt_load_json)
+		return 1;
+#endif
+	// --inherit is not immediate, its options are appended at the end of the list
+	if (op->func == uwsgi_opt_load) {
+		if (op->flags & UWSGI_OPT_IMMEDIATE)
+			return 1;
+		return !keep_inherit;
+	}
+	if (!strcmp(op->name, "compile-config"))
+		return 1;
+	return 0;
+}
+
+struct uwsgi_buffer *uwsgi_compiled_config_build(int start, int end, int keep_inherit) {
+	int i;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	if (uwsgi_buffer_append(ub, UWSGI_COMPILED_CONFIG_MAGIC, 8))
+		goto error;
+	for (i = start; i < end; i++) {
+		struct uwsgi_opt *uo = uwsgi.exported_opts[i];
+		struct uwsgi_option *op = compiled_config_opt(uo->key);
+		if (compiled_config_skip(uo, op, keep_inherit))
+			continue;
+		uint8_t flags = 0;
+		size_t keylen = strlen(uo->key);
+		size_t vallen = 0;
+		if (!uo->value)
+			flags |= 1;
+		else
+			vallen = strlen(uo->value);
+		if (!op)
+			flags |= 2;
+		if (keylen > 0xffff)
+			goto error;
+		if (uwsgi_buffer_u8(ub, flags))
+			goto error;
+		if (uwsgi_buffer_u16le(ub, keylen))
+			goto error;
+		if (uwsgi_buffer_append(ub, uo->key, keylen))
+			goto error;
+		if (uwsgi_buffer_u32le(ub, vallen))
+			goto error;
+		if (uwsgi_buffer_append(ub, uo->value, vallen))
+			goto error;
+	}
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+// returns 0 if the buffer is not a compiled config
+int uwsgi_compiled_config_apply(char *buf, size_t len) {
+	if (len < 8 || memcmp(buf, UWSGI_COMPILED_CONFIG_MAGIC, 8))
+		return 0;
+
+	char *ptr = buf + 8;
+	char *watermark = buf + len;
+
+	while (ptr < watermark) {
+		if (ptr + 3 > watermark)
+			goto invalid;
+		uint8_t flags = (uint8_t) * ptr;
+		uint16_t keylen = (uint8_t) ptr[1] | ((uint8_t) ptr[2] << 8);
+		ptr += 3;
+		if (ptr + keylen + 4 > watermark)
+			goto invalid;
+		char *key = uwsgi_strncopy(ptr, keylen);
+		ptr += keylen;
+		uint32_t vallen = (uint8_t) ptr[0] | ((uint8_t) ptr[1] << 8) | ((uint8_t) ptr[2] << 16) | ((uint32_t) (uint8_t) ptr[3] << 24);
+		ptr += 4;
+		if (vallen > (size_t) (watermark - ptr))
+			goto invalid;
+		char *value = NULL;
+		if (!(flags & 1))
+			value = uwsgi_strncopy(ptr, vallen);
+		ptr += vallen;
+		add_exported_option_do(key, value, 0, flags & 2);
+	}
+	return 1;
+
+invalid:
+	uwsgi_log("invalid compiled config\n");
+	exit(1);
+}
+
+void uwsgi_opt_load_compiled(char *opt, char *filename, void *none) {
+	size_t len = 0;
+	char *buf = uwsgi_open_and_read(filename, &len, 0, NULL);
+
+	if (uwsgi_compiled_config_apply(buf, len)) {
+		free(buf);
+		return;
+	}
+
+	if (uwsgi_endswith(filename, ".ucc")) {
+		uwsgi_log("invalid compiled config %s\n", filename);
+		exit(1);
+	}
+
+	// not compiled, parse it with the regular loaders (the emperor pipe can be read only once)
+	if (!uwsgi_starts_with(filename, strlen(filename), "emperor://", 10)) {
+		uwsgi.emperor_config_stash = buf;
+		uwsgi.emperor_config_stash_len = len;
+	}
+	else {
+		free(buf);
+	}
+
+	uwsgi.compiled_config_start = uwsgi.exported_opts_cnt;
+	uwsgi_opt_load(opt, filename, none);
+	uwsgi.compiled_config_end = uwsgi.exported_opts_cnt;
+
+	if (uwsgi.emperor_config_stash) {
+		free(uwsgi.emperor_config_stash);
+		uwsgi.emperor_config_stash = NULL;
+	}
+}
+
+void uwsgi_compiled_config_dump() {
+	struct uwsgi_buffer *ub = uwsgi_compiled_config_build(0, uwsgi.exported_opts_cnt, 0);
+	if (!ub) {
+		uwsgi_log("unable to compile the config\n");
+		exit(1);
+	}
+	int fd = open(uwsgi.compile_config, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		uwsgi_error_open(uwsgi.compile_config);
+		exit(1);
+	}
+	if (write(fd, ub->buf, ub->pos) != (ssize_t) ub->pos) {
+		uwsgi_error("uwsgi_compiled_config_dump()/write()");
+		exit(1);
+	}
+	close(fd);
+	uwsgi_log("compiled config (%llu bytes) written to %s\n", (unsigned long long) ub->pos, uwsgi.compile_config);
+	uwsgi_buffer_destroy(ub);
+}
+
+// give the emperor the resolved config, it will be pushed back on the next reload
+void uwsgi_compiled_config_send_to_emperor() {
+	if (!uwsgi.has_emperor || uwsgi.emperor_fd_config < 0 || uwsgi.compiled_config_start < 0)
+		return;
+	struct uwsgi_buffer *ub = uwsgi_compiled_config_build(uwsgi.compiled_config_start, uwsgi.compiled_config_end, 1);
+	if (!ub)
+		return;
+	if (ub->pos > 0xffff)
+		goto end;
+	char buf[5];
+	uint32_t len = ub->pos;
+	buf[0] = 32;
+	memcpy(buf + 1, &len, 4);
+	if (write(uwsgi.emperor_fd, buf, 5) != 5) {
+		uwsgi_error("uwsgi_compiled_config_send_to_emperor()/write()");
+		goto end;
+	}
+	if (write(uwsgi.emperor_fd, ub->buf, ub->pos) != (ssize_t) ub->pos) {
+		uwsgi_error("uwsgi_compiled_config_send_to_emperor()/write()");
+	}
+end:
+	uwsgi_buffer_destroy(ub);
+}
+
 void uwsgi_opt_custom(char *key, char *value, void *data ) {
         struct uwsgi_custom_option *uco = (struct uwsgi_custom_option *)data;
         size_t i, count = 1;
@@ -216,106 +216,192 @@ int uwsgi_signal_add_cron(uint8_t sig, int minute, int hour, int day, int month,
         return 0;
 }
 
-void uwsgi_manage_signal_cron(time_t now) {
+/*
 
-        struct tm *uwsgi_cron_delta;
-        int i;
+	cron scheduling
 
-        uwsgi_cron_delta = localtime(&now);
+	instead of matching every cron entry against the current time at every master cycle, every entry
+	is precomputed to its next firing minute and armed in a (msecs) timer wheel, the master only computes
+	the next expiration (folded in its wait timeout) and pops the expired entries.
 
-        if (uwsgi_cron_delta) {
+	--cron-spread <secs> delays the firings of every entry by a stable offset (a hash of the hostname, the
+	master pid and the entry) in the [0, secs) range, so vassals sharing the same crontabs do not run them at the same time.
+	--cron-jitter <secs> adds a random delay (recomputed at every firing) in the same way.
 
-                // fix month
-                uwsgi_cron_delta->tm_mon++;
-
-                uwsgi_lock(uwsgi.cron_table_lock);
-                for (i = 0; i < ushared->cron_cnt; i++) {
-
-                        struct uwsgi_cron *ucron = &ushared->cron[i];
-
-                        int run_task = uwsgi_cron_task_needs_execution(uwsgi_cron_delta, ucron->minute, ucron->hour, ucron->day, ucron->month, ucron->week);
-
-                        if (run_task == 1) {
-                                // date match, signal it ?
-                                if (now - ucron->last_job >= 60) {
-                                        uwsgi_log_verbose("[uwsgi-cron] routing signal %d\n", ucron->sig);
-                                        uwsgi_route_signal(ucron->sig);
-                                        ucron->last_job = now;
-                                }
-                        }
-
-                }
-                uwsgi_unlock(uwsgi.cron_table_lock);
-        }
-        else {
-                uwsgi_error("localtime()");
-        }
+*/
 
+static int cron_field_match(int value, int spec) {
+	// negative values as interval -1 = * , -5 = */5
+	if (spec < 0) return (value % abs(spec)) == 0;
+	return value == spec;
 }
 
-void uwsgi_manage_command_cron(time_t now) {
-
-        struct tm *uwsgi_cron_delta;
-
-        struct uwsgi_cron *current_cron = uwsgi.crons;
+static int cron_day_match(struct uwsgi_cron *uc, struct tm *tm) {
+	// support 7 as alias for sunday (0) to match crontab behaviour
+	int mday = cron_field_match(tm->tm_mday, uc->day);
+	int wday = cron_field_match(tm->tm_wday, uc->week == 7 ? 0 : uc->week);
+	// mday and wday are ORed
+	if (uc->day >= 0 && uc->week >= 0) return mday || wday;
+	return mday && wday;
+}
 
-        uwsgi_cron_delta = localtime(&now);
+/*
+	the start of the first minute (starting from the one containing "start") matching the entry,
+	0 if the entry can never match
+*/
+time_t uwsgi_cron_next(struct uwsgi_cron *uc, time_t start) {
+	struct tm tm;
+	time_t start_minute = start - (start % 60);
+	if (!localtime_r(&start, &tm)) return 0;
+	tm.tm_sec = 0;
+	int i;
+	// more than enough for every valid combination (and a few centuries for the impossible ones)
+	for (i = 0; i < 100000; i++) {
+		tm.tm_isdst = -1;
+		time_t t = mktime(&tm);
+		if (t == (time_t) -1) return 0;
+		if (!cron_field_match(tm.tm_mon + 1, uc->month)) {
+			tm.tm_mon++;
+			tm.tm_mday = 1;
+			tm.tm_hour = 0;
+			tm.tm_min = 0;
+			continue;
+		}
+		if (!cron_day_match(uc, &tm)) {
+			tm.tm_mday++;
+			tm.tm_hour = 0;
+			tm.tm_min = 0;
+			continue;
+		}
+		if (!cron_field_match(tm.tm_hour, uc->hour)) {
+			tm.tm_hour++;
+			tm.tm_min = 0;
+			continue;
+		}
+		// the repeated hour at the end of DST could move us back
+		if (!cron_field_match(tm.tm_min, uc->minute) || t < start_minute) {
+			tm.tm_min++;
+			continue;
+		}
+		return t;
+	}
+	return 0;
+}
 
+static uint64_t cron_offset(struct uwsgi_cron *uc) {
+	uint64_t offset = 0;
+	if (uwsgi.cron_spread > 0) {
+		char key[512];
+		int len = snprintf(key, sizeof(key), "%s %d %s %d", uwsgi.hostname, (int) uwsgi.workers[0].pid, uc->command ? uc->command : "", uc->sig);
+		if (len < 0 || len >= (int) sizeof(key)) len = sizeof(key) - 1;
+		offset += djb33x_hash(key, len) % ((uint64_t) uwsgi.cron_spread * 1000);
+	}
+	if (uwsgi.cron_jitter > 0) {
+		offset += (uint64_t) rand() % ((uint64_t) uwsgi.cron_jitter * 1000);
+	}
+	return offset;
+}
 
-        if (!uwsgi_cron_delta) {
-                uwsgi_error("uwsgi_manage_command_cron()/localtime()");
-                return;
-        }
+// arm the timer of the entry for its first firing starting from the minute containing "start"
+static void cron_schedule(struct uwsgi_cron *uc, time_t start) {
+	uc->next_fire = uwsgi_cron_next(uc, start);
+	if (!uc->next_fire) {
+		if (uc->command) {
+			uwsgi_log("[uwsgi-cron] command \"%s\" will never run\n", uc->command);
+		}
+		else {
+			uwsgi_log("[uwsgi-cron] signal %d will never be routed\n", uc->sig);
+		}
+		return;
+	}
+	// the wheel uses the uWSGI clock (that could be monotonic), the crontab the wall clock
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	int64_t delta = ((int64_t) uc->next_fire * 1000) + cron_offset(uc) - (((int64_t) tv.tv_sec * 1000) + (tv.tv_usec / 1000));
+	if (delta < 0) delta = 0;
+	uwsgi_timer_wheel_add(uwsgi.cron_wheel, &uc->timer, uwsgi_millis() + delta, uc);
+}
 
-        // fix month
-        uwsgi_cron_delta->tm_mon++;
+// called by the master before entering its loop
+void uwsgi_cron_setup() {
+	uwsgi.cron_wheel = uwsgi_timer_wheel_new(uwsgi_millis());
+	time_t now = time(NULL);
+	struct uwsgi_cron *uc = uwsgi.crons;
+	while (uc) {
+		cron_schedule(uc, now);
+		uc->registered = 1;
+		uc = uc->next;
+	}
+}
 
-        while (current_cron) {
+// msecs until the next cron firing, -1 if none
+int64_t uwsgi_cron_timeout() {
+	if (!uwsgi.cron_wheel) return -1;
+	// signal crons can be added at runtime by the workers (their number can only increase)
+	if (ushared->cron_cnt) {
+		int i;
+		uwsgi_lock(uwsgi.cron_table_lock);
+		for (i = 0; i < ushared->cron_cnt; i++) {
+			struct uwsgi_cron *ucron = &ushared->cron[i];
+			if (ucron->registered) continue;
+			cron_schedule(ucron, time(NULL));
+			ucron->registered = 1;
+		}
+		uwsgi_unlock(uwsgi.cron_table_lock);
+	}
+	return uwsgi_timer_wheel_next(uwsgi.cron_wheel, uwsgi_millis());
+}
 
+static void cron_run_command(struct uwsgi_cron *current_cron, time_t now) {
 #ifdef UWSGI_SSL
-                // check for legion cron
-                if (current_cron->legion) {
-                        if (!uwsgi_legion_i_am_the_lord(current_cron->legion))
-                            goto next;
-                }
+	// check for legion cron
+	if (current_cron->legion) {
+		if (!uwsgi_legion_i_am_the_lord(current_cron->legion))
+			return;
+	}
 #endif
 
-		// skip unique crons that are still running
-		if (current_cron->unique && current_cron->pid >= 0)
-			goto next;
-
-                int run_task = uwsgi_cron_task_needs_execution(uwsgi_cron_delta, current_cron->minute, current_cron->hour, current_cron->day, current_cron->month, current_cron->week);
-                if (run_task == 1) {
-
-                        // date match, run command ?
-                        if (now - current_cron->last_job >= 60) {
-                                //call command
-                                if (current_cron->command) {
-					if (current_cron->func) {
-						current_cron->func(current_cron, now);
-					}
-					else {
-						pid_t pid = uwsgi_run_command(current_cron->command, NULL, -1);
-						if (pid >= 0) {
-							current_cron->pid = pid;
-							current_cron->started_at = now;
-							uwsgi_log_verbose("[uwsgi-cron] running \"%s\" (pid %d)\n", current_cron->command, current_cron->pid);
-							if (current_cron->mercy) {
-								//uwsgi_cron->mercy can be negative to inform master that harakiri should be disabled for this cron
-								if (current_cron->mercy > 0)
-									current_cron->harakiri = now + current_cron->mercy;
-							}
-							else if (uwsgi.cron_harakiri)
-								current_cron->harakiri = now + uwsgi.cron_harakiri;
-						}
-					}
-                                }
-                                current_cron->last_job = now;
-                        }
-                }
+	// skip unique crons that are still running
+	if (current_cron->unique && current_cron->pid >= 0)
+		return;
 
-next:
-                current_cron = current_cron->next;
-        }
+	if (current_cron->func) {
+		current_cron->func(current_cron, now);
+	}
+	else {
+		pid_t pid = uwsgi_run_command(current_cron->command, NULL, -1);
+		if (pid >= 0) {
+			current_cron->pid = pid;
+			current_cron->started_at = now;
+			uwsgi_log_verbose("[uwsgi-cron] running \"%s\" (pid %d)\n", current_cron->command, current_cron->pid);
+			if (current_cron->mercy) {
+				//uwsgi_cron->mercy can be negative to inform master that harakiri should be disabled for this cron
+				if (current_cron->mercy > 0)
+					current_cron->harakiri = now + current_cron->mercy;
+			}
+			else if (uwsgi.cron_harakiri)
+				current_cron->harakiri = now + uwsgi.cron_harakiri;
+		}
+	}
+	current_cron->last_job = now;
 }
 
+// run the expired entries and re-arm them
+void uwsgi_cron_expire() {
+	if (!uwsgi.cron_wheel) return;
+	struct uwsgi_wheel_timer *uwt;
+	time_t now = uwsgi_now();
+	while ((uwt = uwsgi_timer_wheel_pop(uwsgi.cron_wheel, uwsgi_millis()))) {
+		struct uwsgi_cron *uc = (struct uwsgi_cron *) uwt->data;
+		// signal crons have no command
+		if (uc->command) {
+			cron_run_command(uc, now);
+		}
+		else {
+			uwsgi_log_verbose("[uwsgi-cron] routing signal %d\n", uc->sig);
+			uwsgi_route_signal(uc->sig);
+			uc->last_job = now;
+		}
+		cron_schedule(uc, uc->next_fire + 60);
+	}
+}
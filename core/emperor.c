@@ -4,11 +4,16 @@ The uWSGI Emperor
 
 */
 #include "uwsgi.h"
+#include <fnmatch.h>
 
 extern struct uwsgi_server uwsgi;
 extern char **environ;
 
 static void emperor_send_stats(int);
+static void emperor_send_aggregated_stats(int);
+static void emperor_stats_aggregate(void);
+static int emperor_spawn_tier(char *);
+static void emperor_spawn_queued(void);
 static void emperor_manage_command(int);
 
 time_t emperor_throttle;
@@ -132,6 +137,9 @@ static char **vassal_new_argv(struct uwsgi_instance *n_ui, int *slot_to_free) {
 		}
 		usl = usl->next;
 	}
+	// the vassal will get the plain or the compiled config from the pipe
+	if (uwsgi.emperor_compiled_config && n_ui->use_config && !uwsgi.emperor_magic_exec)
+		vassal_argv[counter] = "--compiled-config";
 	if (colon)
 		colon[0] = ':';
 
@@ -422,108 +430,100 @@ static char *emperor_check_on_demand_socket(char *filename, struct uwsgi_dyn_dic
 	return NULL;
 }
 
-// this is the monitor for non-glob directories
-void uwsgi_imperial_monitor_directory(struct uwsgi_emperor_scanner *ues) {
+// check (add, reload or stop) the vassal of a single file of a directory monitor (cwd must be the directory)
+static void imperial_monitor_dir_file(struct uwsgi_emperor_scanner *ues, char *name) {
 	struct uwsgi_instance *ui_current;
-	struct dirent *de;
 	struct stat st;
 
-	if (chdir(ues->arg)) {
-		uwsgi_error("chdir()");
+	if (!uwsgi_emperor_is_valid(name))
 		return;
+
+	if (uwsgi.emperor_nofollow) {
+		if (lstat(name, &st))
+			return;
+		if (!S_ISLNK(st.st_mode) && !S_ISREG(st.st_mode))
+			return;
+	}
+	else {
+		if (stat(name, &st))
+			return;
+		if (!S_ISREG(st.st_mode))
+			return;
 	}
 
-	DIR *dir = opendir(".");
-	while ((de = readdir(dir)) != NULL) {
+	ui_current = emperor_get(name);
 
-		if (!uwsgi_emperor_is_valid(de->d_name))
-			continue;
+	uid_t t_uid = st.st_uid;
+	gid_t t_gid = st.st_gid;
 
-		if (uwsgi.emperor_nofollow) {
-			if (lstat(de->d_name, &st))
-				continue;
-			if (!S_ISLNK(st.st_mode) && !S_ISREG(st.st_mode))
-				continue;
-		}
-		else {
-			if (stat(de->d_name, &st))
-				continue;
-			if (!S_ISREG(st.st_mode))
-				continue;
+	if (uwsgi.emperor_tyrant && uwsgi.emperor_tyrant_nofollow) {
+		struct stat lst;
+		if (lstat(name, &lst)) {
+			uwsgi_error("[emperor-tyrant]/lstat()");
+			if (ui_current) {
+				uwsgi_log("!!! availability of file %s changed. stopping the instance... !!!\n", name);
+				emperor_stop(ui_current);
+			}
+			return;
 		}
+		t_uid = lst.st_uid;
+		t_gid = lst.st_gid;
+	}
 
-		ui_current = emperor_get(de->d_name);
-
-		uid_t t_uid = st.st_uid;
-		gid_t t_gid = st.st_gid;
-
-		if (uwsgi.emperor_tyrant && uwsgi.emperor_tyrant_nofollow) {
-			struct stat lst;
-			if (lstat(de->d_name, &lst)) {
-				uwsgi_error("[emperor-tyrant]/lstat()");
-				if (ui_current) {
-					uwsgi_log("!!! availability of file %s changed. stopping the instance... !!!\n", de->d_name);
-					emperor_stop(ui_current);
-				}
-				continue;
+	if (ui_current) {
+		// check if uid or gid are changed, in such case, stop the instance
+		if (uwsgi.emperor_tyrant) {
+			if (t_uid != ui_current->uid || t_gid != ui_current->gid) {
+				uwsgi_log("!!! permissions of file %s changed. stopping the instance... !!!\n", name);
+				emperor_stop(ui_current);
+				return;
 			}
-			t_uid = lst.st_uid;
-			t_gid = lst.st_gid;
 		}
-
-		if (ui_current) {
-			// check if uid or gid are changed, in such case, stop the instance
-			if (uwsgi.emperor_tyrant) {
-				if (t_uid != ui_current->uid || t_gid != ui_current->gid) {
-					uwsgi_log("!!! permissions of file %s changed. stopping the instance... !!!\n", de->d_name);
+		// check if mtime is changed and the uWSGI instance must be reloaded
+		if (st.st_mtime > ui_current->last_mod) {
+			if (uwsgi.emperor_force_config_pipe) {
+				char *config = uwsgi_simple_file_read(name);
+				if (!config) {
+					uwsgi_log_verbose("[emperor] unable to read %s\n", name);
 					emperor_stop(ui_current);
-					continue;
-				}
-			}
-			// check if mtime is changed and the uWSGI instance must be reloaded
-			if (st.st_mtime > ui_current->last_mod) {
-				if (uwsgi.emperor_force_config_pipe) {
-					char *config = uwsgi_simple_file_read(de->d_name);
-					if (!config) {
-						uwsgi_log_verbose("[emperor] unable to read %s\n", de->d_name);
-						emperor_stop(ui_current);
-                                        	continue;
-					}
-					if (ui_current->config)
-                                        	free(ui_current->config);
-                                	ui_current->config = config;
-                                	ui_current->config_len = strlen(ui_current->config);
+					return;
 				}
-				emperor_respawn(ui_current, st.st_mtime);
+				if (ui_current->config)
+					free(ui_current->config);
+				ui_current->config = config;
+				ui_current->config_len = strlen(ui_current->config);
 			}
+			emperor_respawn(ui_current, st.st_mtime);
 		}
-		else {
-			struct uwsgi_dyn_dict *attrs = NULL;
-			if (uwsgi.emperor_collect_attributes) {
-				if (uwsgi_endswith(de->d_name, ".ini")) {
-					uwsgi_emperor_ini_attrs(de->d_name, NULL, &attrs);
-				}
+	}
+	else {
+		struct uwsgi_dyn_dict *attrs = NULL;
+		if (uwsgi.emperor_collect_attributes) {
+			if (uwsgi_endswith(name, ".ini")) {
+				uwsgi_emperor_ini_attrs(name, NULL, &attrs);
 			}
-			char *socket_name = emperor_check_on_demand_socket(de->d_name, attrs);
-			if (uwsgi.emperor_force_config_pipe) {
-				char *config = uwsgi_simple_file_read(de->d_name);
-				if (config) {
-					emperor_add_with_attrs(ues, de->d_name, st.st_mtime, config, strlen(config), t_uid, t_gid, socket_name, attrs);
-				}
-				else {
-					uwsgi_log_verbose("[emperor] unable to read %s\n", de->d_name);
-				}
+		}
+		char *socket_name = emperor_check_on_demand_socket(name, attrs);
+		if (uwsgi.emperor_force_config_pipe) {
+			char *config = uwsgi_simple_file_read(name);
+			if (config) {
+				emperor_add_with_attrs(ues, name, st.st_mtime, config, strlen(config), t_uid, t_gid, socket_name, attrs);
 			}
 			else {
-				emperor_add_with_attrs(ues, de->d_name, st.st_mtime, NULL, 0, t_uid, t_gid, socket_name, attrs);
+				uwsgi_log_verbose("[emperor] unable to read %s\n", name);
 			}
-			if (socket_name)
-				free(socket_name);
 		}
+		else {
+			emperor_add_with_attrs(ues, name, st.st_mtime, NULL, 0, t_uid, t_gid, socket_name, attrs);
+		}
+		if (socket_name)
+			free(socket_name);
 	}
-	closedir(dir);
+}
 
-	// now check for removed instances
+// stop the vassals of a directory monitor whose file is gone (only the ones of the file 'name' if not NULL)
+static void imperial_monitor_dir_removed(struct uwsgi_emperor_scanner *ues, char *name) {
+	struct stat st;
 	struct uwsgi_instance *c_ui = ui->ui_next;
 
 	while (c_ui) {
@@ -536,20 +536,22 @@ void uwsgi_imperial_monitor_directory(struct uwsgi_emperor_scanner *ues) {
 				else {
 					char *filename = uwsgi_calloc(0xff);
 					memcpy(filename, c_ui->name, colon - c_ui->name);
-					if (uwsgi.emperor_nofollow) {
-						if (lstat(filename, &st)) {
-							emperor_stop(c_ui);
+					if (!name || !strcmp(filename, name)) {
+						if (uwsgi.emperor_nofollow) {
+							if (lstat(filename, &st)) {
+								emperor_stop(c_ui);
+							}
 						}
-					}
-					else {
-						if (stat(filename, &st)) {
-							emperor_stop(c_ui);
+						else {
+							if (stat(filename, &st)) {
+								emperor_stop(c_ui);
+							}
 						}
 					}
 					free(filename);
 				}
 			}
-			else {
+			else if (!name || !strcmp(c_ui->name, name)) {
 				if (uwsgi.emperor_nofollow) {
 					if (lstat(c_ui->name, &st)) {
 						emperor_stop(c_ui);
@@ -566,6 +568,25 @@ void uwsgi_imperial_monitor_directory(struct uwsgi_emperor_scanner *ues) {
 	}
 }
 
+// this is the monitor for non-glob directories
+void uwsgi_imperial_monitor_directory(struct uwsgi_emperor_scanner *ues) {
+	struct dirent *de;
+
+	if (chdir(ues->arg)) {
+		uwsgi_error("chdir()");
+		return;
+	}
+
+	DIR *dir = opendir(".");
+	while ((de = readdir(dir)) != NULL) {
+		imperial_monitor_dir_file(ues, de->d_name);
+	}
+	closedir(dir);
+
+	// now check for removed instances
+	imperial_monitor_dir_removed(ues, NULL);
+}
+
 // this is the monitor for glob patterns
 void uwsgi_imperial_monitor_glob(struct uwsgi_emperor_scanner *ues) {
 
@@ -806,47 +827,84 @@ static void emperor_stats(int signum) {
 
 }
 
+/*
+
+	vassal indexes
+
+	instances are hashed by name and by the emperor side of their pipe and their on demand socket,
+	so events (and commands) do not need to walk the whole list of vassals
+
+*/
+#define UWSGI_EMPEROR_HASH_SIZE 4096
+#define EMPEROR_HASH_NAME 0
+#define EMPEROR_HASH_FD 1
+#define EMPEROR_HASH_SOCKET_FD 2
+
+static struct uwsgi_instance *emperor_hash[3][UWSGI_EMPEROR_HASH_SIZE];
+
+static void emperor_hash_add(int index, uint32_t slot, struct uwsgi_instance *c_ui) {
+	slot %= UWSGI_EMPEROR_HASH_SIZE;
+	c_ui->hash_next[index] = emperor_hash[index][slot];
+	emperor_hash[index][slot] = c_ui;
+}
+
+static void emperor_hash_del(int index, uint32_t slot, struct uwsgi_instance *c_ui) {
+	struct uwsgi_instance **ptr = &emperor_hash[index][slot % UWSGI_EMPEROR_HASH_SIZE];
+	while (*ptr) {
+		if (*ptr == c_ui) {
+			*ptr = c_ui->hash_next[index];
+			break;
+		}
+		ptr = &(*ptr)->hash_next[index];
+	}
+	c_ui->hash_next[index] = NULL;
+}
+
+static uint32_t emperor_hash_name(char *name) {
+	return djb33x_hash(name, strlen(name));
+}
+
 struct uwsgi_instance *emperor_get_by_fd(int fd) {
 
-	struct uwsgi_instance *c_ui = ui;
+	if (fd < 0)
+		return NULL;
 
-	while (c_ui->ui_next) {
-		c_ui = c_ui->ui_next;
+	struct uwsgi_instance *c_ui = emperor_hash[EMPEROR_HASH_FD][fd % UWSGI_EMPEROR_HASH_SIZE];
 
+	while (c_ui) {
 		if (c_ui->pipe[0] == fd) {
 			return c_ui;
 		}
+		c_ui = c_ui->hash_next[EMPEROR_HASH_FD];
 	}
 	return NULL;
 }
 
 struct uwsgi_instance *emperor_get_by_socket_fd(int fd) {
 
-	struct uwsgi_instance *c_ui = ui;
+	if (fd < 0)
+		return NULL;
 
-	while (c_ui->ui_next) {
-		c_ui = c_ui->ui_next;
+	struct uwsgi_instance *c_ui = emperor_hash[EMPEROR_HASH_SOCKET_FD][fd % UWSGI_EMPEROR_HASH_SIZE];
 
-		// over engineering...
-		if (c_ui->on_demand_fd > -1 && c_ui->on_demand_fd == fd) {
+	while (c_ui) {
+		if (c_ui->on_demand_fd == fd) {
 			return c_ui;
 		}
+		c_ui = c_ui->hash_next[EMPEROR_HASH_SOCKET_FD];
 	}
 	return NULL;
 }
 
-
-
 struct uwsgi_instance *emperor_get(char *name) {
 
-	struct uwsgi_instance *c_ui = ui;
-
-	while (c_ui->ui_next) {
-		c_ui = c_ui->ui_next;
+	struct uwsgi_instance *c_ui = emperor_hash[EMPEROR_HASH_NAME][emperor_hash_name(name) % UWSGI_EMPEROR_HASH_SIZE];
 
+	while (c_ui) {
 		if (!strcmp(c_ui->name, name)) {
 			return c_ui;
 		}
+		c_ui = c_ui->hash_next[EMPEROR_HASH_NAME];
 	}
 	return NULL;
 }
@@ -861,6 +919,10 @@ void emperor_del(struct uwsgi_instance *c_ui) {
 		child_ui->ui_prev = parent_ui;
 	}
 
+	emperor_hash_del(EMPEROR_HASH_NAME, emperor_hash_name(c_ui->name), c_ui);
+	if (c_ui->pipe[0] != -1) emperor_hash_del(EMPEROR_HASH_FD, c_ui->pipe[0], c_ui);
+	if (c_ui->on_demand_fd > -1) emperor_hash_del(EMPEROR_HASH_SOCKET_FD, c_ui->on_demand_fd, c_ui);
+
 	// this will destroy the whole uWSGI instance (and workers)
 	if (c_ui->pipe[0] != -1) close(c_ui->pipe[0]);
 	if (c_ui->pipe[1] != -1) close(c_ui->pipe[1]);
@@ -899,6 +961,9 @@ void emperor_del(struct uwsgi_instance *c_ui) {
 		close(c_ui->on_demand_fd);
 	}
 	if (c_ui->config) free(c_ui->config);
+	if (c_ui->compiled_config) free(c_ui->compiled_config);
+
+	uwsgi_emperor_cgroup_del(c_ui);
 
 	struct uwsgi_dyn_dict *attr = c_ui->attrs;
         while(attr) {
@@ -911,6 +976,50 @@ void emperor_del(struct uwsgi_instance *c_ui) {
 	free(c_ui);
 }
 
+/*
+
+	on demand hibernation (--emperor-on-demand-hibernate)
+
+	on demand vassals are spawned immediately and, once accepting requests, hibernated: the vassal
+	suspends (SIGSTOP) its warm workers and the Emperor waits for connections on the on demand socket,
+	waking it up (SIGCONT) on the first one. Idle vassals (--idle + --die-on-idle) are hibernated again
+	instead of being stopped.
+
+*/
+static void emperor_hibernate(struct uwsgi_instance *c_ui) {
+	if (c_ui->hibernated || c_ui->status > 0)
+		return;
+
+	if (write(c_ui->pipe[0], "\3", 1) != 1) {
+		uwsgi_error("emperor_hibernate()/write()");
+		emperor_curse(c_ui);
+		return;
+	}
+
+	c_ui->hibernated = 1;
+	event_queue_add_fd_read(uwsgi.emperor_queue, c_ui->on_demand_fd);
+	uwsgi_log_verbose("[emperor] hibernating instance %s, waiting for connections on socket \"%s\" ...\n", c_ui->name, c_ui->socket_name);
+}
+
+static void emperor_thaw(struct uwsgi_instance *c_ui) {
+	if (!c_ui->hibernated)
+		return;
+
+	event_queue_del_fd(uwsgi.emperor_queue, c_ui->on_demand_fd, event_queue_read());
+	c_ui->hibernated = 0;
+
+	if (c_ui->status > 0)
+		return;
+
+	if (write(c_ui->pipe[0], "\4", 1) != 1) {
+		uwsgi_error("emperor_thaw()/write()");
+		emperor_curse(c_ui);
+		return;
+	}
+
+	uwsgi_log_verbose("[emperor] waking up instance %s\n", c_ui->name);
+}
+
 void emperor_back_to_ondemand(struct uwsgi_instance *c_ui) {
 	if (c_ui->status > 0)
 		return;
@@ -971,20 +1080,57 @@ static void emperor_push_config(struct uwsgi_instance *c_ui) {
 	struct uwsgi_header uh;
 
 	if (c_ui->use_config) {
+		char *config = c_ui->config;
+		uint32_t config_len = c_ui->config_len;
 		uh.modifier1 = 115;
-		uh._pktsize = c_ui->config_len;
 		uh.modifier2 = 0;
+		c_ui->pushed_config_hash = djb33x_hash(c_ui->config, c_ui->config_len);
+		// the compiled version is valid only for the config it has been built from
+		if (c_ui->compiled_config && c_ui->compiled_config_hash == c_ui->pushed_config_hash) {
+			config = c_ui->compiled_config;
+			config_len = c_ui->compiled_config_len;
+			uh.modifier2 = 1;
+		}
+		uh._pktsize = config_len;
 		if (write(c_ui->pipe_config[0], &uh, 4) != 4) {
 			uwsgi_error("[uwsgi-emperor] write() header config");
 		}
 		else {
-			if (write(c_ui->pipe_config[0], c_ui->config, c_ui->config_len) != (long) c_ui->config_len) {
+			if (write(c_ui->pipe_config[0], config, config_len) != (long) config_len) {
 				uwsgi_error("[uwsgi-emperor] write() config");
 			}
 		}
 	}
 }
 
+// store the compiled config built by the vassal from the last pushed config
+static void emperor_get_compiled_config(struct uwsgi_instance *c_ui, int fd) {
+	uint32_t len = 0;
+	if (uwsgi_read_nb(fd, (char *) &len, 4, uwsgi.socket_timeout)) {
+		uwsgi_log("[emperor] unable to read compiled config from vassal %s\n", c_ui->name);
+		return;
+	}
+	if (len == 0 || len > 0xffff) {
+		uwsgi_log("[emperor] invalid compiled config size from vassal %s\n", c_ui->name);
+		return;
+	}
+	char *buf = uwsgi_malloc(len);
+	if (uwsgi_read_nb(fd, buf, len, uwsgi.socket_timeout)) {
+		uwsgi_log("[emperor] unable to read compiled config from vassal %s\n", c_ui->name);
+		free(buf);
+		return;
+	}
+	if (!uwsgi.emperor_compiled_config || !c_ui->use_config) {
+		free(buf);
+		return;
+	}
+	if (c_ui->compiled_config)
+		free(c_ui->compiled_config);
+	c_ui->compiled_config = buf;
+	c_ui->compiled_config_len = len;
+	c_ui->compiled_config_hash = c_ui->pushed_config_hash;
+}
+
 void emperor_respawn(struct uwsgi_instance *c_ui, time_t mod) {
 
 	// if the vassal is being destroyed, do not honour respawns
@@ -1002,6 +1148,12 @@ void emperor_respawn(struct uwsgi_instance *c_ui, time_t mod) {
 		return;
 	}
 
+	// still queued, it will be started with the new config
+	if (c_ui->pid == -1 && c_ui->spawn_queued) {
+		c_ui->last_mod = mod;
+		return;
+	}
+
 	// check if we are in on_demand mode (the respawn will be ignored)
 	if (c_ui->pid == -1 && c_ui->on_demand_fd > -1) {
 		c_ui->last_mod = mod;
@@ -1016,6 +1168,12 @@ void emperor_respawn(struct uwsgi_instance *c_ui, time_t mod) {
 		return;
 	}
 
+	// the vassal wakes up by itself on reload
+	if (c_ui->hibernated) {
+		event_queue_del_fd(uwsgi.emperor_queue, c_ui->on_demand_fd, event_queue_read());
+		c_ui->hibernated = 0;
+	}
+
 	// reload the uWSGI instance
 	if (write(c_ui->pipe[0], "\1", 1) != 1) {
 		// the vassal could be already dead, better to curse it
@@ -1133,6 +1291,8 @@ void emperor_add_with_attrs(struct uwsgi_emperor_scanner *ues, char *name, time_
 
 	n_ui->scanner = ues;
 	memcpy(n_ui->name, name, strlen(name));
+	emperor_hash_add(EMPEROR_HASH_NAME, emperor_hash_name(n_ui->name), n_ui);
+	uwsgi_emperor_cgroup_new(n_ui);
 	n_ui->born = born;
 	n_ui->uid = uid;
 	n_ui->gid = gid;
@@ -1178,12 +1338,26 @@ void emperor_add_with_attrs(struct uwsgi_emperor_scanner *ues, char *name, time_
 			emperor_del(n_ui);
 			return;
 		}
+		emperor_hash_add(EMPEROR_HASH_SOCKET_FD, n_ui->on_demand_fd, n_ui);
 
-		event_queue_add_fd_read(uwsgi.emperor_queue, n_ui->on_demand_fd);
-		uwsgi_log("[uwsgi-emperor] %s -> \"on demand\" instance detected, waiting for connections on socket \"%s\" ...\n", name, socket_name);
-		if (uwsgi_hooks_run_and_return(uwsgi.hook_as_on_demand_vassal, "as-on-demand-vassal", name, 0)) {
-			emperor_del(n_ui);
+		if (!uwsgi.emperor_on_demand_hibernate) {
+			event_queue_add_fd_read(uwsgi.emperor_queue, n_ui->on_demand_fd);
+			uwsgi_log("[uwsgi-emperor] %s -> \"on demand\" instance detected, waiting for connections on socket \"%s\" ...\n", name, socket_name);
+			if (uwsgi_hooks_run_and_return(uwsgi.hook_as_on_demand_vassal, "as-on-demand-vassal", name, 0)) {
+				emperor_del(n_ui);
+			}
+			return;
 		}
+
+		// warm up the instance now, it will be hibernated as soon as it is accepting requests
+		n_ui->hibernate_on_accepting = 1;
+		uwsgi_log("[uwsgi-emperor] %s -> \"on demand\" instance detected, warming it up for hibernation on socket \"%s\" ...\n", name, socket_name);
+	}
+
+	// the vassal will be started by emperor_spawn_queued() when a slot is free
+	if (uwsgi.emperor_spawn_parallel > 0) {
+		n_ui->spawn_queued = 1;
+		n_ui->spawn_tier = emperor_spawn_tier(name);
 		return;
 	}
 
@@ -1193,6 +1367,80 @@ void emperor_add_with_attrs(struct uwsgi_emperor_scanner *ues, char *name, time_
 	}
 }
 
+/*
+
+	rate-controlled spawning (--emperor-spawn-parallel)
+
+	at most emperor-spawn-parallel vassals are starting (spawned but still not accepting requests,
+	for no more than emperor-spawn-timeout seconds) at the same time, the others are queued
+	and started by tier (the index of the first matching --emperor-spawn-priority glob) and arrival.
+	With --emperor-spawn-cpu-budget no queued vassal is started while the load average is over
+	the budget (unless nothing is starting, so the queue always progresses)
+
+*/
+static int emperor_spawn_tier(char *name) {
+	int tier = 0;
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uwsgi.emperor_spawn_priority) {
+		if (!fnmatch(usl->value, name, 0)) return tier;
+		tier++;
+	}
+	return tier;
+}
+
+static int emperor_spawn_over_budget() {
+	if (uwsgi.emperor_spawn_cpu_budget <= 0) return 0;
+	double load = 0;
+	if (getloadavg(&load, 1) != 1) return 0;
+	return (load * 100) > (double) (uwsgi.emperor_spawn_cpu_budget * uwsgi.cpus);
+}
+
+static void emperor_spawn_queued() {
+	if (uwsgi.emperor_spawn_parallel <= 0) return;
+
+	time_t now = uwsgi_now();
+	int starting = 0;
+	int queued = 0;
+	struct uwsgi_instance *c_ui = ui->ui_next;
+	while (c_ui) {
+		if (c_ui->spawn_queued) {
+			queued++;
+		}
+		else if (c_ui->pid > 0 && c_ui->spawn_started > 0) {
+			if (c_ui->accepting || c_ui->loyal || now - c_ui->spawn_started >= uwsgi.emperor_spawn_timeout) {
+				c_ui->spawn_started = 0;
+			}
+			else {
+				starting++;
+			}
+		}
+		c_ui = c_ui->ui_next;
+	}
+
+	while (queued > 0 && starting < uwsgi.emperor_spawn_parallel) {
+		if (starting > 0 && emperor_spawn_over_budget()) return;
+
+		struct uwsgi_instance *next_ui = NULL;
+		c_ui = ui->ui_next;
+		while (c_ui) {
+			if (c_ui->spawn_queued && (!next_ui || c_ui->spawn_tier < next_ui->spawn_tier)) {
+				next_ui = c_ui;
+			}
+			c_ui = c_ui->ui_next;
+		}
+		if (!next_ui) return;
+
+		next_ui->spawn_queued = 0;
+		queued--;
+		// stopped while waiting
+		if (next_ui->status > 0) continue;
+		starting++;
+		if (uwsgi_emperor_vassal_start(next_ui)) {
+			emperor_del(next_ui);
+		}
+	}
+}
+
 static int uwsgi_emperor_spawn_vassal(struct uwsgi_instance *);
 
 static void vassal_fork_server_parser_hook(char *key, uint16_t key_len, char *value, uint16_t value_len, void *data) {
@@ -1224,6 +1472,20 @@ static pid_t emperor_connect_to_fork_server(char *socket, struct uwsgi_instance
 	int slot_to_free = -1;
 	char **vassal_argv = vassal_new_argv(n_ui, &slot_to_free);
 
+	// the fork server runs in its own directory, so relative vassal files need the absolute path
+	if (slot_to_free < 0 && n_ui->name[0] != '/') {
+		char *cwd = uwsgi_get_cwd();
+		int i;
+		for (i = 1; cwd && vassal_argv[i]; i++) {
+			if (vassal_argv[i] == n_ui->name) {
+				vassal_argv[i] = uwsgi_concat3(cwd, "/", n_ui->name);
+				slot_to_free = i;
+				break;
+			}
+		}
+		free(cwd);
+	}
+
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
 	// leave space for uwsgi header
 	ub->pos = 4;
@@ -1306,6 +1568,136 @@ end2:
 	return -1;
 }
 
+/*
+
+	managed fork servers (--emperor-fork-server "<socket> [config]")
+
+	the Emperor runs (and respawns) a fork server per runtime: an instance stopped after the config
+	parsing (with its plugins and --fork-server-preload libraries loaded) forking the vassals choosing it
+	(via --emperor-use-fork-server or the --emperor-fork-server-attr attribute), so that all of them
+	share those pages. Fork servers get an Emperor pipe and exit as soon as it is closed.
+
+*/
+struct uwsgi_emperor_fork_server {
+	char *socket;
+	char *config;
+	pid_t pid;
+	int pipe;
+	time_t last_spawn;
+	struct uwsgi_emperor_fork_server *next;
+};
+
+static struct uwsgi_emperor_fork_server *emperor_fork_servers;
+
+static void emperor_fork_server_spawn(struct uwsgi_emperor_fork_server *uefs) {
+	int fs_pipe[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fs_pipe)) {
+		uwsgi_error("emperor_fork_server_spawn()/socketpair()");
+		return;
+	}
+
+	uefs->last_spawn = uwsgi_now();
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		uwsgi_error("emperor_fork_server_spawn()/fork()");
+		close(fs_pipe[0]);
+		close(fs_pipe[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		int i;
+		for (i = 3; i < (int) uwsgi.max_fd; i++) {
+			if (i != fs_pipe[1])
+				close(i);
+		}
+		char *uef = uwsgi_num2str(fs_pipe[1]);
+		if (setenv("UWSGI_EMPEROR_FD", uef, 1)) {
+			uwsgi_error("emperor_fork_server_spawn()/setenv()");
+			exit(1);
+		}
+		free(uef);
+		unsetenv("UWSGI_EMPEROR_FD_CONFIG");
+
+		char *argv[5];
+		argv[0] = uwsgi.binary_path;
+		argv[1] = "--fork-server";
+		argv[2] = uefs->socket;
+		argv[3] = uefs->config;
+		argv[4] = NULL;
+		execvp(argv[0], argv);
+		uwsgi_error("emperor_fork_server_spawn()/execvp()");
+		exit(1);
+	}
+
+	close(fs_pipe[1]);
+	uefs->pipe = fs_pipe[0];
+	uefs->pid = pid;
+	uwsgi_log("[emperor] spawned fork server %s (pid: %d)\n", uefs->socket, (int) pid);
+}
+
+static void emperor_fork_servers_start() {
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uwsgi.emperor_fork_servers) {
+		struct uwsgi_emperor_fork_server *uefs = uwsgi_calloc(sizeof(struct uwsgi_emperor_fork_server));
+		uefs->socket = uwsgi_str(usl->value);
+		char *space = strchr(uefs->socket, ' ');
+		if (space) {
+			*space = 0;
+			uefs->config = space + 1;
+		}
+		uefs->pid = -1;
+		uefs->pipe = -1;
+		uefs->next = emperor_fork_servers;
+		emperor_fork_servers = uefs;
+		emperor_fork_server_spawn(uefs);
+	}
+
+	// wait for the sockets (vassals spawned before they are bound would fail)
+	struct uwsgi_emperor_fork_server *uefs = emperor_fork_servers;
+	while (uefs) {
+		int i;
+		for (i = 0; i < uwsgi.socket_timeout * 10 && uefs->socket[0] != '@'; i++) {
+			struct stat st;
+			if (!stat(uefs->socket, &st) && S_ISSOCK(st.st_mode))
+				break;
+			usleep(100 * 1000);
+		}
+		uefs = uefs->next;
+	}
+}
+
+// returns 1 if the died pid was a managed fork server
+static int emperor_fork_server_check_death(pid_t diedpid) {
+	struct uwsgi_emperor_fork_server *uefs = emperor_fork_servers;
+	while (uefs) {
+		if (uefs->pid == diedpid) {
+			uwsgi_log("[emperor] fork server %s (pid: %d) died\n", uefs->socket, (int) diedpid);
+			close(uefs->pipe);
+			uefs->pipe = -1;
+			uefs->pid = -1;
+			return 1;
+		}
+		uefs = uefs->next;
+	}
+	return 0;
+}
+
+// respawn dead fork servers (at most once per second)
+static void emperor_fork_servers_respawn() {
+	if (on_royal_death)
+		return;
+	time_t now = uwsgi_now();
+	struct uwsgi_emperor_fork_server *uefs = emperor_fork_servers;
+	while (uefs) {
+		if (uefs->pid <= 0 && now > uefs->last_spawn) {
+			emperor_fork_server_spawn(uefs);
+		}
+		uefs = uefs->next;
+	}
+}
+
 int uwsgi_emperor_vassal_start(struct uwsgi_instance *n_ui) {
 
 	pid_t pid;
@@ -1315,6 +1707,7 @@ int uwsgi_emperor_vassal_start(struct uwsgi_instance *n_ui) {
 		return -1;
 	}
 	uwsgi_socket_nb(n_ui->pipe[0]);
+	emperor_hash_add(EMPEROR_HASH_FD, n_ui->pipe[0], n_ui);
 
 	event_queue_add_fd_read(uwsgi.emperor_queue, n_ui->pipe[0]);
 
@@ -1365,6 +1758,11 @@ int uwsgi_emperor_vassal_start(struct uwsgi_instance *n_ui) {
 	}
 	else if (pid > 0) {
 		n_ui->pid = pid;
+		n_ui->spawn_started = uwsgi_now();
+		// vassals from fork servers cannot join the cgroup by themselves
+		if (n_ui->adopted) {
+			uwsgi_emperor_cgroup_attach(n_ui, pid);
+		}
 		// close the right side of the pipe
 		close(n_ui->pipe[1]);
 		n_ui->pipe[1] = -1;
@@ -1492,6 +1890,7 @@ static int uwsgi_emperor_spawn_vassal(struct uwsgi_instance *n_ui) {
 	if (prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0)) {
 		uwsgi_error("prctl()");
 	}
+	uwsgi_emperor_cgroup_attach(n_ui, 0);
 #ifdef CLONE_NEWUSER
 	if (uwsgi.emperor_clone & CLONE_NEWUSER) {
 		if (setuid(0)) {
@@ -1790,36 +2189,150 @@ static int uwsgi_emperor_spawn_vassal(struct uwsgi_instance *n_ui) {
 	uwsgi_log("[emperor] binary path: %s\n", vassal_argv[0]);
 	uwsgi_log("[emperor] is the uwsgi binary in your system PATH ?\n");
 
-	// trying fallback
-	uwsgi_foreach(usl, uwsgi.emperor_wrapper_fallback) {
-		uwsgi_log("[emperor] trying to use %s as binary fallback ...\n", usl->value);
-                vassal_argv[0] = usl->value;
-                execvp(vassal_argv[0], vassal_argv);
-                // not here if the binary is found
-        }
-	// never here
-	exit(UWSGI_EXILE_CODE);
+	// trying fallback
+	uwsgi_foreach(usl, uwsgi.emperor_wrapper_fallback) {
+		uwsgi_log("[emperor] trying to use %s as binary fallback ...\n", usl->value);
+                vassal_argv[0] = usl->value;
+                execvp(vassal_argv[0], vassal_argv);
+                // not here if the binary is found
+        }
+	// never here
+	exit(UWSGI_EXILE_CODE);
+
+	return 0;
+}
+
+void uwsgi_imperial_monitor_glob_init(struct uwsgi_emperor_scanner *ues) {
+	if (chdir(uwsgi.cwd)) {
+		uwsgi_error("chdir()");
+		exit(1);
+	}
+
+	uwsgi.emperor_absolute_dir = uwsgi.cwd;
+
+	if (!uwsgi_startswith(ues->arg, "glob://", 7)) {
+		ues->arg += 7;
+	}
+}
+
+void uwsgi_imperial_monitor_directory_init(struct uwsgi_emperor_scanner *ues) {
+
+	if (!uwsgi_startswith(ues->arg, "dir://", 6)) {
+		ues->arg += 6;
+	}
+
+	if (chdir(ues->arg)) {
+		uwsgi_error("chdir()");
+		exit(1);
+	}
+
+	uwsgi.emperor_absolute_dir = uwsgi_malloc(PATH_MAX + 1);
+	if (realpath(".", uwsgi.emperor_absolute_dir) == NULL) {
+		uwsgi_error("realpath()");
+		exit(1);
+	}
+
+	ues->arg = uwsgi.emperor_absolute_dir;
+
+}
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+/*
+
+	the inotify monitor (inotify://<dir>)
+
+	works like the dir monitor, but instead of stat()ing every file on each emperor cycle
+	it reacts to the inotify events of the directory, checking only the changed files.
+
+	A full scan is still done at startup, on events queue overflow and when a vassal of the
+	monitor has been removed while its file is still there (cursed or blacklisted vassals),
+	as they have to be added again (with the usual throttling).
+
+*/
+struct uwsgi_imperial_inotify {
+	int wd;
+	int rescan;
+	int vassals;
+};
+
+static int imperial_monitor_inotify_vassals(struct uwsgi_emperor_scanner *ues) {
+	int count = 0;
+	struct uwsgi_instance *c_ui = ui->ui_next;
+	while (c_ui) {
+		if (c_ui->scanner == ues)
+			count++;
+		c_ui = c_ui->ui_next;
+	}
+	return count;
+}
+
+static void imperial_monitor_inotify_event(struct uwsgi_emperor_scanner *ues) {
+	struct uwsgi_imperial_inotify *uii = (struct uwsgi_imperial_inotify *) ues->data;
+	char buf[8192] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	if (chdir(ues->arg)) {
+		uwsgi_error("imperial_monitor_inotify_event()/chdir()");
+		return;
+	}
+
+	for (;;) {
+		ssize_t rlen = read(ues->fd, buf, sizeof(buf));
+		if (rlen < 0) {
+			if (!uwsgi_is_again() && errno != EINTR) {
+				uwsgi_error("imperial_monitor_inotify_event()/read()");
+			}
+			break;
+		}
+		if (rlen == 0)
+			break;
+
+		char *ptr = buf;
+		while (ptr < buf + rlen) {
+			struct inotify_event *ie = (struct inotify_event *) ptr;
+			ptr += sizeof(struct inotify_event) + ie->len;
 
-	return 0;
-}
+			if (ie->mask & IN_Q_OVERFLOW) {
+				uwsgi_log_verbose("[emperor] inotify events queue overflow for %s, rescanning it\n", ues->arg);
+				uii->rescan = 1;
+				continue;
+			}
+			if (ie->mask & IN_IGNORED) {
+				uwsgi_log_verbose("[emperor] inotify watch of %s removed\n", ues->arg);
+				continue;
+			}
+			if (!ie->len)
+				continue;
 
-void uwsgi_imperial_monitor_glob_init(struct uwsgi_emperor_scanner *ues) {
-	if (chdir(uwsgi.cwd)) {
-		uwsgi_error("chdir()");
-		exit(1);
+			if (ie->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				imperial_monitor_dir_removed(ues, ie->name);
+			}
+			else {
+				imperial_monitor_dir_file(ues, ie->name);
+			}
+		}
 	}
 
-	uwsgi.emperor_absolute_dir = uwsgi.cwd;
+	uii->vassals = imperial_monitor_inotify_vassals(ues);
+}
 
-	if (!uwsgi_startswith(ues->arg, "glob://", 7)) {
-		ues->arg += 7;
+void uwsgi_imperial_monitor_inotify(struct uwsgi_emperor_scanner *ues) {
+	struct uwsgi_imperial_inotify *uii = (struct uwsgi_imperial_inotify *) ues->data;
+
+	int vassals = imperial_monitor_inotify_vassals(ues);
+	if (uii->rescan || vassals < uii->vassals) {
+		uii->rescan = 0;
+		uwsgi_imperial_monitor_directory(ues);
+		vassals = imperial_monitor_inotify_vassals(ues);
 	}
+	uii->vassals = vassals;
 }
 
-void uwsgi_imperial_monitor_directory_init(struct uwsgi_emperor_scanner *ues) {
+void uwsgi_imperial_monitor_inotify_init(struct uwsgi_emperor_scanner *ues) {
 
-	if (!uwsgi_startswith(ues->arg, "dir://", 6)) {
-		ues->arg += 6;
+	if (!uwsgi_startswith(ues->arg, "inotify://", 10)) {
+		ues->arg += 10;
 	}
 
 	if (chdir(ues->arg)) {
@@ -1835,7 +2348,26 @@ void uwsgi_imperial_monitor_directory_init(struct uwsgi_emperor_scanner *ues) {
 
 	ues->arg = uwsgi.emperor_absolute_dir;
 
+	struct uwsgi_imperial_inotify *uii = uwsgi_calloc(sizeof(struct uwsgi_imperial_inotify));
+	uii->rescan = 1;
+
+	ues->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ues->fd < 0) {
+		uwsgi_error("uwsgi_imperial_monitor_inotify_init()/inotify_init1()");
+		exit(1);
+	}
+
+	uii->wd = inotify_add_watch(ues->fd, ues->arg, IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO);
+	if (uii->wd < 0) {
+		uwsgi_error("uwsgi_imperial_monitor_inotify_init()/inotify_add_watch()");
+		exit(1);
+	}
+
+	ues->data = uii;
+	ues->event_func = imperial_monitor_inotify_event;
+	event_queue_add_fd_read(uwsgi.emperor_queue, ues->fd);
 }
+#endif
 
 struct uwsgi_imperial_monitor *imperial_monitor_get_by_id(char *scheme) {
 	struct uwsgi_imperial_monitor *uim = uwsgi.emperor_monitors;
@@ -1957,14 +2489,14 @@ static void emperor_cleanup(int signum) {
 void emperor_loop() {
 
 #if defined(__linux__) && defined(PR_SET_CHILD_SUBREAPER)
-        if (uwsgi.emperor_use_fork_server || uwsgi.emperor_subreaper || uwsgi.emperor_fork_server_attr) {
+        if (uwsgi.emperor_use_fork_server || uwsgi.emperor_subreaper || uwsgi.emperor_fork_server_attr || uwsgi.emperor_fork_servers) {
                 if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0)) {
                         uwsgi_error("uwsgi_fork_server()/fork()");
                         exit(1);
                 }
         }
 #else
-	if (uwsgi.emperor_use_fork_server || uwsgi.emperor_subreaper || uwsgi.emperor_fork_server_attr) {
+	if (uwsgi.emperor_use_fork_server || uwsgi.emperor_subreaper || uwsgi.emperor_fork_server_attr || uwsgi.emperor_fork_servers) {
 		uwsgi_log("*** DANGER: your kernel misses PR_SET_CHILD_SUBREAPER feature, required by the fork server ***\n");
 		uwsgi_log("*** your Emperor will not be able to correctly wait() on vassals ***\n");
 	}
@@ -1990,6 +2522,7 @@ void emperor_loop() {
 	uwsgi.disable_nuclear_blast = 1;
 
 	uwsgi.emperor_stats_fd = -1;
+	uwsgi.emperor_stats_aggregate_fd = -1;
 
 	if (uwsgi.emperor_pidfile) {
 		uwsgi_write_pidfile(uwsgi.emperor_pidfile);
@@ -2019,6 +2552,9 @@ void emperor_loop() {
 	// the queue must be initialized before adding scanners
 	uwsgi.emperor_queue = event_queue_init();
 
+	uwsgi_emperor_cgroup_init();
+	emperor_fork_servers_start();
+
 	emperor_build_scanners();
 
 	events = event_queue_alloc(64);
@@ -2047,6 +2583,25 @@ void emperor_loop() {
 		uwsgi_log("*** Emperor stats server enabled on %s fd: %d ***\n", uwsgi.emperor_stats, uwsgi.emperor_stats_fd);
 	}
 
+	if (uwsgi.emperor_stats_aggregate) {
+		if (uwsgi.emperor_stats_aggregate_freq < 1) {
+			uwsgi.emperor_stats_aggregate_freq = 1;
+		}
+		char *tcp_port = strchr(uwsgi.emperor_stats_aggregate, ':');
+		if (tcp_port) {
+			int current_defer_accept = uwsgi.no_defer_accept;
+			uwsgi.no_defer_accept = 1;
+			uwsgi.emperor_stats_aggregate_fd = bind_to_tcp(uwsgi.emperor_stats_aggregate, uwsgi.listen_queue, tcp_port);
+			uwsgi.no_defer_accept = current_defer_accept;
+		}
+		else {
+			uwsgi.emperor_stats_aggregate_fd = bind_to_unix(uwsgi.emperor_stats_aggregate, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
+		}
+
+		event_queue_add_fd_read(uwsgi.emperor_queue, uwsgi.emperor_stats_aggregate_fd);
+		uwsgi_log("*** Emperor aggregated stats server enabled on %s fd: %d (every %d seconds) ***\n", uwsgi.emperor_stats_aggregate, uwsgi.emperor_stats_aggregate_fd, uwsgi.emperor_stats_aggregate_freq);
+	}
+
 
 	if (uwsgi.emperor_trigger_socket) {
 		char *tcp_port = strchr(uwsgi.emperor_trigger_socket, ':');
@@ -2130,6 +2685,10 @@ void emperor_loop() {
 
 		nevents = event_queue_wait_multi(uwsgi.emperor_queue, freq, events, 64);
 		freq = uwsgi.emperor_freq;
+		// wake up in time for the metrics collection
+		if (uwsgi.emperor_stats_aggregate && uwsgi.emperor_stats_aggregate_freq < freq) {
+			freq = uwsgi.emperor_stats_aggregate_freq;
+		}
 
 		for (i = 0; i < nevents; i++) {
 			interesting_fd = event_queue_interesting_fd(events, i);
@@ -2139,6 +2698,11 @@ void emperor_loop() {
 				continue;
 			}
 
+			if (uwsgi.emperor_stats_aggregate && uwsgi.emperor_stats_aggregate_fd > -1 && interesting_fd == uwsgi.emperor_stats_aggregate_fd) {
+				emperor_send_aggregated_stats(uwsgi.emperor_stats_aggregate_fd);
+				continue;
+			}
+
 			if (uwsgi.emperor_command_socket && uwsgi.emperor_command_socket_fd > -1 && interesting_fd == uwsgi.emperor_command_socket_fd) {
 				emperor_manage_command(uwsgi.emperor_command_socket_fd);
 				continue;
@@ -2180,7 +2744,12 @@ void emperor_loop() {
 					else if (byte == 22) {
 						// command 22 changes meaning when in "on_demand" mode
 						if (ui_current->on_demand_fd != -1) {
-							emperor_back_to_ondemand(ui_current);
+							if (uwsgi.emperor_on_demand_hibernate) {
+								emperor_hibernate(ui_current);
+							}
+							else {
+								emperor_back_to_ondemand(ui_current);
+							}
 						}
 						else {
 							emperor_stop(ui_current);
@@ -2197,6 +2766,16 @@ void emperor_loop() {
 						ui_current->accepting = 1;
 						ui_current->last_accepting = uwsgi_now();
 						uwsgi_log_verbose("[emperor] vassal %s is ready to accept requests\n", ui_current->name);
+						// warmed up, hibernate it (unless connections are already waiting)
+						if (ui_current->hibernate_on_accepting) {
+							ui_current->hibernate_on_accepting = 0;
+							struct pollfd upoll;
+							upoll.fd = ui_current->on_demand_fd;
+							upoll.events = POLLIN;
+							if (poll(&upoll, 1, 0) == 0) {
+								emperor_hibernate(ui_current);
+							}
+						}
 					}
 					else if (byte == 1) {
 						ui_current->ready = 1;
@@ -2206,11 +2785,27 @@ void emperor_loop() {
 					else if (byte == 2) {
 						emperor_push_config(ui_current);
 					}
+					// metrics (--emperor-stats-aggregate)
+					else if (byte == 31) {
+						if (uwsgi_read_nb(interesting_fd, (char *) &ui_current->metrics, sizeof(struct uwsgi_emperor_vassal_metrics), uwsgi.socket_timeout)) {
+							uwsgi_log("[emperor] unable to read metrics from vassal %s\n", ui_current->name);
+						}
+						else {
+							ui_current->metrics_updated = uwsgi_now();
+						}
+					}
+					// compiled config (--emperor-compiled-config)
+					else if (byte == 32) {
+						emperor_get_compiled_config(ui_current, interesting_fd);
+					}
 				}
 			}
 			else {
 				ui_current = emperor_get_by_socket_fd(interesting_fd);
-				if (ui_current) {
+				if (ui_current && ui_current->hibernated) {
+					emperor_thaw(ui_current);
+				}
+				else if (ui_current) {
 					event_queue_del_fd(uwsgi.emperor_queue, ui_current->on_demand_fd, event_queue_read());
 					if (uwsgi_emperor_vassal_start(ui_current)) {
 						emperor_del(ui_current);
@@ -2226,6 +2821,14 @@ void emperor_loop() {
 
 		uwsgi_emperor_run_scanners();
 
+		emperor_fork_servers_respawn();
+
+		emperor_spawn_queued();
+
+		uwsgi_emperor_cgroup_policy();
+
+		emperor_stats_aggregate();
+
 		// check for heartbeat (if required)
 		ui_current = ui->ui_next;
 		while (ui_current) {
@@ -2272,7 +2875,12 @@ recheck:
 		}
 		else {
 			// vacuum
-			waitpid(WAIT_ANY, &waitpid_status, WNOHANG);
+			diedpid = waitpid(WAIT_ANY, &waitpid_status, WNOHANG);
+			if (diedpid > 0)
+				emperor_fork_server_check_death(diedpid);
+			diedpid = 0;
+		}
+		if (diedpid > 0 && emperor_fork_server_check_death(diedpid)) {
 			diedpid = 0;
 		}
 		if (diedpid < 0) {
@@ -2330,6 +2938,7 @@ recheck:
 				// back to on_demand mode ...
 				else if (ui_current->status == 2) {
 					event_queue_add_fd_read(uwsgi.emperor_queue, ui_current->on_demand_fd);
+					emperor_hash_del(EMPEROR_HASH_FD, ui_current->pipe[0], ui_current);
 					close(ui_current->pipe[0]);
 					ui_current->pipe[0] = -1;
 					if (ui_current->use_config) {
@@ -2516,6 +3125,26 @@ static void emperor_manage_command(int fd) {
 	}
 }
 
+static void emperor_stats_write(int fd, struct uwsgi_stats *us) {
+	size_t remains = us->pos;
+	off_t pos = 0;
+	while (remains > 0) {
+		int ret = uwsgi_waitfd_write(fd, uwsgi.socket_timeout);
+		if (ret <= 0) {
+			return;
+		}
+		ssize_t res = write(fd, us->base + pos, remains);
+		if (res <= 0) {
+			if (res < 0) {
+				uwsgi_error("write()");
+			}
+			return;
+		}
+		pos += res;
+		remains -= res;
+	}
+}
+
 static void emperor_send_stats(int fd) {
 
 	struct sockaddr_un client_src;
@@ -2625,9 +3254,18 @@ static void emperor_send_stats(int fd) {
 		if (uwsgi_stats_keylong_comma(us, "suspended", (unsigned long long) c_ui->suspended))
 			goto end0;
 
+		if (uwsgi_stats_keylong_comma(us, "spawn_queued", (unsigned long long) c_ui->spawn_queued))
+			goto end0;
+
+		if (uwsgi_stats_keylong_comma(us, "hibernated", (unsigned long long) c_ui->hibernated))
+			goto end0;
+
 		if (uwsgi_stats_keylong_comma(us, "adopted", (unsigned long long) c_ui->adopted))
 			goto end0;
 
+		if (uwsgi_emperor_cgroup_stats(us, c_ui))
+			goto end0;
+
 		if (uwsgi_stats_keylong_comma(us, "uid", (unsigned long long) c_ui->uid))
 			goto end0;
 		if (uwsgi_stats_keylong_comma(us, "gid", (unsigned long long) c_ui->gid))
@@ -2727,23 +3365,7 @@ static void emperor_send_stats(int fd) {
 	if (uwsgi_stats_object_close(us))
 		goto end0;
 
-	size_t remains = us->pos;
-	off_t pos = 0;
-	while (remains > 0) {
-		int ret = uwsgi_waitfd_write(client_fd, uwsgi.socket_timeout);
-		if (ret <= 0) {
-			goto end0;
-		}
-		ssize_t res = write(client_fd, us->base + pos, remains);
-		if (res <= 0) {
-			if (res < 0) {
-				uwsgi_error("write()");
-			}
-			goto end0;
-		}
-		pos += res;
-		remains -= res;
-	}
+	emperor_stats_write(client_fd, us);
 
 end0:
 	free(cwd);
@@ -2753,6 +3375,202 @@ end:
 	close(client_fd);
 }
 
+/*
+
+	aggregated stats (--emperor-stats-aggregate)
+
+	every --emperor-stats-aggregate-freq seconds the Emperor asks (byte 5) the running vassals for their metrics
+	(sent back as byte 31 followed by a struct uwsgi_emperor_vassal_metrics) and rebuilds the document
+	(fleet totals + per-vassal metrics) served as-is to the clients, without touching the vassals.
+
+	Vassals not answering for two rounds are reported as stale and excluded from the totals.
+
+*/
+
+static struct uwsgi_stats *emperor_aggregated_stats;
+
+static int emperor_stats_metrics(struct uwsgi_stats *us, struct uwsgi_emperor_vassal_metrics *uevm) {
+	if (uwsgi_stats_keylong_comma(us, "workers", (unsigned long long) uevm->workers))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "busy_workers", (unsigned long long) uevm->busy_workers))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "requests", (unsigned long long) uevm->requests))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "exceptions", (unsigned long long) uevm->exceptions))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "harakiri_count", (unsigned long long) uevm->harakiri_count))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "respawn_count", (unsigned long long) uevm->respawn_count))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "tx", (unsigned long long) uevm->tx))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "rss", (unsigned long long) uevm->rss_size))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "vsz", (unsigned long long) uevm->vsz_size))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "avg_rt", (unsigned long long) uevm->avg_rt))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "load", (unsigned long long) uevm->load))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "listen_queue", (unsigned long long) uevm->listen_queue))
+		return -1;
+	return uwsgi_stats_keylong(us, "listen_queue_errors", (unsigned long long) uevm->listen_queue_errors);
+}
+
+static struct uwsgi_stats *emperor_stats_aggregate_build(time_t now) {
+	struct uwsgi_emperor_vassal_metrics totals;
+	memset(&totals, 0, sizeof(struct uwsgi_emperor_vassal_metrics));
+	uint64_t vassals = 0, reporting = 0, rt_sum = 0;
+
+	struct uwsgi_stats *us = uwsgi_stats_new(8192);
+
+	if (uwsgi_stats_keyval_comma(us, "version", UWSGI_VERSION))
+		goto error;
+	if (uwsgi_stats_keylong_comma(us, "pid", (unsigned long long) getpid()))
+		goto error;
+	if (uwsgi_stats_keylong_comma(us, "updated", (unsigned long long) now))
+		goto error;
+	if (uwsgi_stats_keylong_comma(us, "freq", (unsigned long long) uwsgi.emperor_stats_aggregate_freq))
+		goto error;
+
+	if (uwsgi_stats_key(us, "vassals"))
+		goto error;
+	if (uwsgi_stats_list_open(us))
+		goto error;
+
+	struct uwsgi_instance *c_ui = ui->ui_next;
+	while (c_ui) {
+		vassals++;
+		int stale = !c_ui->metrics_updated || now - c_ui->metrics_updated > uwsgi.emperor_stats_aggregate_freq * 2;
+		if (!stale) {
+			reporting++;
+			totals.workers += c_ui->metrics.workers;
+			totals.busy_workers += c_ui->metrics.busy_workers;
+			totals.requests += c_ui->metrics.requests;
+			totals.exceptions += c_ui->metrics.exceptions;
+			totals.harakiri_count += c_ui->metrics.harakiri_count;
+			totals.respawn_count += c_ui->metrics.respawn_count;
+			totals.tx += c_ui->metrics.tx;
+			totals.rss_size += c_ui->metrics.rss_size;
+			totals.vsz_size += c_ui->metrics.vsz_size;
+			totals.load += c_ui->metrics.load;
+			totals.listen_queue += c_ui->metrics.listen_queue;
+			totals.listen_queue_errors += c_ui->metrics.listen_queue_errors;
+			rt_sum += c_ui->metrics.avg_rt;
+		}
+
+		if (uwsgi_stats_object_open(us))
+			goto error;
+		if (uwsgi_stats_keyval_comma(us, "id", c_ui->name))
+			goto error;
+		if (uwsgi_stats_keyslong_comma(us, "pid", (long long) c_ui->pid))
+			goto error;
+		if (uwsgi_stats_keylong_comma(us, "updated", (unsigned long long) c_ui->metrics_updated))
+			goto error;
+		if (uwsgi_stats_keylong_comma(us, "stale", (unsigned long long) stale))
+			goto error;
+		if (emperor_stats_metrics(us, &c_ui->metrics))
+			goto error;
+		if (uwsgi_stats_object_close(us))
+			goto error;
+
+		c_ui = c_ui->ui_next;
+		if (c_ui) {
+			if (uwsgi_stats_comma(us))
+				goto error;
+		}
+	}
+
+	if (uwsgi_stats_list_close(us))
+		goto error;
+	if (uwsgi_stats_comma(us))
+		goto error;
+
+	if (reporting)
+		totals.avg_rt = rt_sum / reporting;
+
+	if (uwsgi_stats_keylong_comma(us, "vassals_count", (unsigned long long) vassals))
+		goto error;
+	if (uwsgi_stats_keylong_comma(us, "reporting", (unsigned long long) reporting))
+		goto error;
+	if (uwsgi_stats_key(us, "totals"))
+		goto error;
+	if (uwsgi_stats_object_open(us))
+		goto error;
+	if (emperor_stats_metrics(us, &totals))
+		goto error;
+	if (uwsgi_stats_object_close(us))
+		goto error;
+
+	if (uwsgi_stats_object_close(us))
+		goto error;
+
+	return us;
+
+error:
+	free(us->base);
+	free(us);
+	return NULL;
+}
+
+static void emperor_stats_aggregate() {
+	static time_t last_run = 0;
+
+	if (!uwsgi.emperor_stats_aggregate)
+		return;
+
+	time_t now = uwsgi_now();
+	if (now - last_run < uwsgi.emperor_stats_aggregate_freq)
+		return;
+	last_run = now;
+
+	// the document reports the answers to the previous round
+	struct uwsgi_stats *us = emperor_stats_aggregate_build(now);
+	if (us) {
+		if (emperor_aggregated_stats) {
+			free(emperor_aggregated_stats->base);
+			free(emperor_aggregated_stats);
+		}
+		emperor_aggregated_stats = us;
+	}
+
+	char byte = 5;
+	struct uwsgi_instance *c_ui = ui->ui_next;
+	while (c_ui) {
+		if (c_ui->pid > 0 && c_ui->ready && c_ui->pipe[0] > -1) {
+			if (write(c_ui->pipe[0], &byte, 1) != 1) {
+				uwsgi_error("emperor_stats_aggregate()/write()");
+			}
+		}
+		c_ui = c_ui->ui_next;
+	}
+}
+
+static void emperor_send_aggregated_stats(int fd) {
+
+	struct sockaddr_un client_src;
+	socklen_t client_src_len = 0;
+
+	int client_fd = accept(fd, (struct sockaddr *) &client_src, &client_src_len);
+	if (client_fd < 0) {
+		uwsgi_error("accept()");
+		return;
+	}
+
+	if (uwsgi.stats_http) {
+		if (uwsgi_send_http_stats(client_fd)) {
+			close(client_fd);
+			return;
+		}
+	}
+
+	if (emperor_aggregated_stats) {
+		emperor_stats_write(client_fd, emperor_aggregated_stats);
+	}
+
+	close(client_fd);
+}
+
 void uwsgi_emperor_start() {
 
 	if (!uwsgi.sockets && !ushared->gateways_cnt && !uwsgi.master_process) {
@@ -2951,6 +3769,67 @@ void uwsgi_emperor_simple_do(struct uwsgi_emperor_scanner *ues, char *name, char
 	uwsgi_emperor_simple_do_with_attrs(ues, name, config, ts, uid, gid, socket_name, NULL);
 }
 
+// suspend (or resume) the workers on Emperor request
+static void vassal_hibernate(int hibernate) {
+	if (uwsgi.status.hibernated == hibernate)
+		return;
+	int i;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		if (uwsgi.workers[i].pid > 0 && !uwsgi.workers[i].cheaped) {
+			if (kill(uwsgi.workers[i].pid, hibernate ? SIGSTOP : SIGCONT)) {
+				uwsgi_error("vassal_hibernate()/kill()");
+			}
+		}
+	}
+	uwsgi.status.hibernated = hibernate;
+	// back from --die-on-idle, start checking for idle again
+	if (!hibernate && uwsgi.die_on_idle) {
+		uwsgi.status.is_cheap = 0;
+	}
+	uwsgi_log_verbose("%s\n", hibernate ? "hibernating, workers suspended" : "woken up, workers resumed");
+}
+
+// answer to the Emperor metrics request (--emperor-stats-aggregate)
+static void vassal_send_metrics() {
+	struct uwsgi_emperor_vassal_metrics uevm;
+	memset(&uevm, 0, sizeof(struct uwsgi_emperor_vassal_metrics));
+	uint64_t rt_sum = 0, rt_workers = 0;
+	int i;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		struct uwsgi_worker *uw = &uwsgi.workers[i];
+		uevm.requests += uw->requests;
+		uevm.exceptions += uwsgi_worker_exceptions(i);
+		uevm.harakiri_count += uw->harakiri_count;
+		uevm.respawn_count += uw->respawn_count;
+		uevm.tx += uw->tx;
+		if (uw->pid <= 0 || uw->cheaped)
+			continue;
+		uevm.workers++;
+		if (uwsgi_worker_is_busy(i))
+			uevm.busy_workers++;
+		uevm.rss_size += uw->rss_size;
+		uevm.vsz_size += uw->vsz_size;
+		if (uw->avg_response_time) {
+			rt_sum += uw->avg_response_time;
+			rt_workers++;
+		}
+	}
+	if (rt_workers)
+		uevm.avg_rt = rt_sum / rt_workers;
+	uevm.load = uwsgi.shared->load;
+#ifdef __linux__
+	uevm.listen_queue = uwsgi.shared->backlog;
+	uevm.listen_queue_errors = uwsgi.shared->backlog_errors;
+#endif
+
+	char buf[1 + sizeof(struct uwsgi_emperor_vassal_metrics)];
+	buf[0] = 31;
+	memcpy(buf + 1, &uevm, sizeof(struct uwsgi_emperor_vassal_metrics));
+	if (write(uwsgi.emperor_fd, buf, sizeof(buf)) != sizeof(buf)) {
+		uwsgi_error("vassal_send_metrics()/write()");
+	}
+}
+
 void uwsgi_master_manage_emperor() {
 	char byte;
 #ifdef UWSGI_EVENT_USE_PORT
@@ -2965,7 +3844,16 @@ void uwsgi_master_manage_emperor() {
         uwsgi_socket_b(uwsgi.emperor_fd);
 #endif
 	if (rlen > 0) {
+		// metrics requests are periodic and do not wake up the instance
+		if (byte == 5) {
+			vassal_send_metrics();
+			return;
+		}
 		uwsgi_log_verbose("received message %d from emperor\n", byte);
+		// stopped workers would not honour reloads and shutdowns
+		if (byte != 3) {
+			vassal_hibernate(0);
+		}
 		// remove me
 		if (byte == 0) {
 			uwsgi_hooks_run(uwsgi.hook_emperor_stop, "emperor-stop", 0);
@@ -2991,6 +3879,10 @@ void uwsgi_master_manage_emperor() {
 				gracefully_kill_them_all(0);
 			}
 		}
+		// hibernate (the Emperor will wake us up with 4)
+		else if (byte == 3) {
+			vassal_hibernate(1);
+		}
 	}
 #ifdef UWSGI_EVENT_USE_PORT
         // special cose for port event system
@@ -0,0 +1,282 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+extern struct uwsgi_instance *ui;
+
+/*
+
+	cgroup v2 placement of vassals (--emperor-cgroup <dir>, Linux only)
+
+	every vassal runs in its own cgroup (<dir>/<vassal name>, with the --emperor-cgroup-opt values applied)
+	and its cpu and memory usage and pressure stall information (PSI, avg10 in hundredths of percent)
+	are exposed in the Emperor stats.
+
+	With --emperor-cgroup-pressure the Emperor protects the latency-sensitive vassals (--emperor-cgroup-protect):
+	while the cpu or memory pressure of one of them is over the threshold (percent), every second the non protected
+	vassal eating more cpu is throttled to --emperor-cgroup-throttle-weight cpu.weight, and when the pressure
+	falls under half the threshold the throttled vassals get back the default weight, one per second.
+
+*/
+
+#ifdef __linux__
+#include <fnmatch.h>
+
+static ssize_t cgroup_read(char *cgroup, char *file, char *buf, size_t len) {
+	char *path = uwsgi_concat3(cgroup, "/", file);
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return -1;
+	ssize_t rlen = read(fd, buf, len - 1);
+	close(fd);
+	if (rlen < 0)
+		return -1;
+	buf[rlen] = 0;
+	return rlen;
+}
+
+static int cgroup_write(char *cgroup, char *file, char *value) {
+	char *path = uwsgi_concat3(cgroup, "/", file);
+	int fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		uwsgi_error_open(path);
+		free(path);
+		return -1;
+	}
+	size_t len = strlen(value);
+	if (write(fd, value, len) != (ssize_t) len) {
+		uwsgi_log("[emperor-cgroup] unable to write \"%s\" to %s: %s\n", value, path, strerror(errno));
+		close(fd);
+		free(path);
+		return -1;
+	}
+	close(fd);
+	free(path);
+	return 0;
+}
+
+// the value of a "key value" line (cpu.stat) or of a single value file (memory.current)
+static int64_t cgroup_read_num(char *cgroup, char *file, char *key) {
+	char buf[4096];
+	if (cgroup_read(cgroup, file, buf, sizeof(buf)) <= 0)
+		return -1;
+	char *ptr = buf;
+	if (key) {
+		size_t key_len = strlen(key);
+		for (;;) {
+			if (!strncmp(ptr, key, key_len) && ptr[key_len] == ' ') {
+				ptr += key_len + 1;
+				break;
+			}
+			ptr = strchr(ptr, '\n');
+			if (!ptr)
+				return -1;
+			ptr++;
+		}
+	}
+	return strtoll(ptr, NULL, 10);
+}
+
+// avg10 of the "some" (or "full") line of a PSI file, in hundredths of percent
+static int64_t cgroup_pressure(char *cgroup, char *file, int full) {
+	char buf[256];
+	if (cgroup_read(cgroup, file, buf, sizeof(buf)) <= 0)
+		return -1;
+	char *line = full ? strstr(buf, "full ") : strstr(buf, "some ");
+	if (!line)
+		return -1;
+	char *avg10 = strstr(line, "avg10=");
+	if (!avg10)
+		return -1;
+	return (int64_t) (strtod(avg10 + 6, NULL) * 100);
+}
+
+void uwsgi_emperor_cgroup_init() {
+	if (!uwsgi.emperor_cgroup)
+		return;
+
+	if (mkdir(uwsgi.emperor_cgroup, 0755) && errno != EEXIST) {
+		uwsgi_error("uwsgi_emperor_cgroup_init()/mkdir()");
+		exit(1);
+	}
+
+	// enable the controllers for the vassals (they could be unavailable)
+	char *controllers[] = { "+cpu", "+memory", "+io", NULL };
+	char **controller = controllers;
+	while (*controller) {
+		cgroup_write(uwsgi.emperor_cgroup, "cgroup.subtree_control", *controller);
+		controller++;
+	}
+
+	uwsgi_log("*** Emperor cgroup enabled on %s ***\n", uwsgi.emperor_cgroup);
+}
+
+void uwsgi_emperor_cgroup_new(struct uwsgi_instance *c_ui) {
+	if (!uwsgi.emperor_cgroup)
+		return;
+
+	char *name = uwsgi_str(c_ui->name);
+	char *ptr = name;
+	while (*ptr) {
+		if (*ptr == '/')
+			*ptr = '_';
+		ptr++;
+	}
+	c_ui->cgroup = uwsgi_concat3(uwsgi.emperor_cgroup, "/", name);
+	free(name);
+
+	if (mkdir(c_ui->cgroup, 0755) && errno != EEXIST) {
+		uwsgi_error("uwsgi_emperor_cgroup_new()/mkdir()");
+		free(c_ui->cgroup);
+		c_ui->cgroup = NULL;
+		return;
+	}
+
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uwsgi.emperor_cgroup_opt) {
+		char *equal = strchr(usl->value, '=');
+		if (!equal) {
+			uwsgi_log("[emperor-cgroup] invalid option %s, syntax is key=value\n", usl->value);
+			continue;
+		}
+		*equal = 0;
+		cgroup_write(c_ui->cgroup, usl->value, equal + 1);
+		*equal = '=';
+	}
+
+	uwsgi_foreach(usl, uwsgi.emperor_cgroup_protect) {
+		if (!fnmatch(usl->value, c_ui->name, 0)) {
+			c_ui->cgroup_protected = 1;
+			break;
+		}
+	}
+}
+
+// pid 0 is the calling process
+void uwsgi_emperor_cgroup_attach(struct uwsgi_instance *c_ui, pid_t pid) {
+	if (!c_ui->cgroup)
+		return;
+	char *num = uwsgi_num2str(pid);
+	cgroup_write(c_ui->cgroup, "cgroup.procs", num);
+	free(num);
+}
+
+void uwsgi_emperor_cgroup_del(struct uwsgi_instance *c_ui) {
+	if (!c_ui->cgroup)
+		return;
+	// fails if some process is still there
+	rmdir(c_ui->cgroup);
+	free(c_ui->cgroup);
+	c_ui->cgroup = NULL;
+}
+
+int uwsgi_emperor_cgroup_stats(struct uwsgi_stats *us, struct uwsgi_instance *c_ui) {
+	if (!c_ui->cgroup)
+		return 0;
+
+	if (uwsgi_stats_key(us, "cgroup"))
+		return -1;
+	if (uwsgi_stats_object_open(us))
+		return -1;
+	if (uwsgi_stats_keyval_comma(us, "path", c_ui->cgroup))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "cpu_usage_usec", (long long) cgroup_read_num(c_ui->cgroup, "cpu.stat", "usage_usec")))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "memory_current", (long long) cgroup_read_num(c_ui->cgroup, "memory.current", NULL)))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "cpu_pressure_some", (long long) cgroup_pressure(c_ui->cgroup, "cpu.pressure", 0)))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "memory_pressure_some", (long long) cgroup_pressure(c_ui->cgroup, "memory.pressure", 0)))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "memory_pressure_full", (long long) cgroup_pressure(c_ui->cgroup, "memory.pressure", 1)))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "io_pressure_some", (long long) cgroup_pressure(c_ui->cgroup, "io.pressure", 0)))
+		return -1;
+	if (uwsgi_stats_keyslong_comma(us, "io_pressure_full", (long long) cgroup_pressure(c_ui->cgroup, "io.pressure", 1)))
+		return -1;
+	if (uwsgi_stats_keylong_comma(us, "protected", (unsigned long long) c_ui->cgroup_protected))
+		return -1;
+	if (uwsgi_stats_keylong(us, "throttled", (unsigned long long) c_ui->cgroup_throttled))
+		return -1;
+	if (uwsgi_stats_object_close(us))
+		return -1;
+	return uwsgi_stats_comma(us);
+}
+
+void uwsgi_emperor_cgroup_policy() {
+	static time_t last_check = 0;
+
+	if (!uwsgi.emperor_cgroup || uwsgi.emperor_cgroup_pressure <= 0)
+		return;
+
+	time_t now = uwsgi_now();
+	if (now == last_check)
+		return;
+	last_check = now;
+
+	int64_t max_pressure = -1;
+	struct uwsgi_instance *noisy = NULL;
+	struct uwsgi_instance *throttled = NULL;
+	struct uwsgi_instance *c_ui = ui->ui_next;
+	while (c_ui) {
+		if (!c_ui->cgroup || c_ui->pid <= 0)
+			goto next;
+
+		int64_t usage = cgroup_read_num(c_ui->cgroup, "cpu.stat", "usage_usec");
+		if (usage >= 0) {
+			c_ui->cgroup_cpu_delta = (c_ui->cgroup_cpu_usec && (uint64_t) usage >= c_ui->cgroup_cpu_usec) ? usage - c_ui->cgroup_cpu_usec : 0;
+			c_ui->cgroup_cpu_usec = usage;
+		}
+
+		if (c_ui->cgroup_protected) {
+			int64_t pressure = cgroup_pressure(c_ui->cgroup, "cpu.pressure", 0);
+			if (pressure > max_pressure)
+				max_pressure = pressure;
+			pressure = cgroup_pressure(c_ui->cgroup, "memory.pressure", 0);
+			if (pressure > max_pressure)
+				max_pressure = pressure;
+		}
+		else if (!c_ui->cgroup_throttled) {
+			if (!noisy || c_ui->cgroup_cpu_delta > noisy->cgroup_cpu_delta)
+				noisy = c_ui;
+		}
+		else if (!throttled) {
+			throttled = c_ui;
+		}
+next:
+		c_ui = c_ui->ui_next;
+	}
+
+	if (max_pressure >= (int64_t) uwsgi.emperor_cgroup_pressure * 100) {
+		if (noisy && noisy->cgroup_cpu_delta > 0) {
+			char *weight = uwsgi_num2str(uwsgi.emperor_cgroup_throttle_weight);
+			if (!cgroup_write(noisy->cgroup, "cpu.weight", weight)) {
+				uwsgi_log_verbose("[emperor-cgroup] pressure on protected vassals at %lld.%02lld%%, throttling vassal %s (cpu.weight %s)\n", (long long) max_pressure / 100, (long long) max_pressure % 100, noisy->name, weight);
+			}
+			// do not try it again on failure
+			noisy->cgroup_throttled = 1;
+			free(weight);
+		}
+	}
+	else if (throttled && max_pressure < (int64_t) uwsgi.emperor_cgroup_pressure * 50) {
+		if (!cgroup_write(throttled->cgroup, "cpu.weight", "100")) {
+			uwsgi_log_verbose("[emperor-cgroup] pressure on protected vassals back to normal, restoring vassal %s\n", throttled->name);
+		}
+		throttled->cgroup_throttled = 0;
+	}
+}
+
+#else
+void uwsgi_emperor_cgroup_init() {
+	if (uwsgi.emperor_cgroup) {
+		uwsgi_log("--emperor-cgroup is supported only on Linux\n");
+		exit(1);
+	}
+}
+
+void uwsgi_emperor_cgroup_new(struct uwsgi_instance *c_ui) {}
+void uwsgi_emperor_cgroup_attach(struct uwsgi_instance *c_ui, pid_t pid) {}
+void uwsgi_emperor_cgroup_del(struct uwsgi_instance *c_ui) {}
+int uwsgi_emperor_cgroup_stats(struct uwsgi_stats *us, struct uwsgi_instance *c_ui) { return 0; }
+void uwsgi_emperor_cgroup_policy() {}
+#endif
@@ -163,11 +163,11 @@ int event_queue_del_fd(int eq, int fd, int event) {
 	pthread_mutex_unlock(&upe->lock);
 	return ret;
 }
-int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
+int event_queue_wait_multi_ms(int eq, int timeout, void *events, int nevents) {
 	struct uwsgi_poll_event *upe = uwsgi_poll_event_queue[eq];
 	pthread_mutex_lock(&upe->lock);
         uwsgi_poll_queue_rebuild(upe);
-        int ret = poll(upe->poll, upe->nevents, timeout * 1000);
+        int ret = poll(upe->poll, upe->nevents, timeout);
 	int cnt = 0;
 	if (ret > 0) {
                 int i;
@@ -400,7 +400,7 @@ int event_queue_interesting_fd(void *events, int id) {
 	return fd;
 }
 
-int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
+int event_queue_wait_multi_ms(int eq, int timeout, void *events, int nevents) {
 
 	int ret;
 	uint_t nget = 1;
@@ -408,8 +408,8 @@ int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
 	
 
 	if (timeout >= 0) {
-		ts.tv_sec = timeout;
-		ts.tv_nsec = 0;
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
 		ret = port_getn(eq, events, nevents, &nget, &ts);
 	}
 	else {
@@ -693,14 +693,10 @@ int event_queue_interesting_fd_is_write(void *events, int id) {
 }
 
 
-int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
+int event_queue_wait_multi_ms(int eq, int timeout, void *events, int nevents) {
 
 	int ret;
 
-	if (timeout > 0) {
-		timeout = timeout * 1000;
-	}
-
 	ret = epoll_wait(eq, (struct epoll_event *) events, nevents, timeout);
 	if (ret < 0) {
 		if (errno != EINTR)
@@ -888,7 +884,7 @@ void *event_queue_alloc(int nevents) {
 	return uwsgi_malloc(sizeof(struct kevent) * nevents);
 }
 
-int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
+int event_queue_wait_multi_ms(int eq, int timeout, void *events, int nevents) {
 
 	int ret;
 	struct timespec ts;
@@ -898,7 +894,8 @@ int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
 	}
 	else {
 		memset(&ts, 0, sizeof(struct timespec));
-		ts.tv_sec = timeout;
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
 		ret = kevent(eq, NULL, 0, (struct kevent *) events, nevents, &ts);
 	}
 
@@ -1423,3 +1420,10 @@ int event_queue_read() {
 int event_queue_write() {
 	return UWSGI_EVENT_OUT;
 }
+
+// timeout in seconds (the _ms variant takes milliseconds)
+int event_queue_wait_multi(int eq, int timeout, void *events, int nevents) {
+	if (timeout > 0)
+		timeout = timeout * 1000;
+	return event_queue_wait_multi_ms(eq, timeout, events, nevents);
+}
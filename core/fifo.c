@@ -85,6 +85,7 @@ void uwsgi_master_fifo_prepare() {
 	uwsgi_fifo_table['C'] = uwsgi_go_cheap;
 	uwsgi_fifo_table['E'] = emperor_rescan;
 	uwsgi_fifo_table['f'] = uwsgi_refork_master;
+	uwsgi_fifo_table['M'] = uwsgi_cache_immutable_swap;
 	uwsgi_fifo_table['l'] = uwsgi_log_reopen;
 	uwsgi_fifo_table['L'] = uwsgi_log_rotate;
 	uwsgi_fifo_table['p'] = suspend_resume_them_all;
@@ -27,6 +27,16 @@ void uwsgi_fork_server(char *socket) {
 	// map fd 0 to /dev/null to avoid mess
 	uwsgi_remap_fd(0, "/dev/null");
 
+	// preload the shared libraries (relocations included), their pages will be shared by the forked processes
+	struct uwsgi_string_list *usl_preload;
+	uwsgi_foreach(usl_preload, uwsgi.fork_server_preload) {
+		if (!dlopen(usl_preload->value, RTLD_NOW | RTLD_GLOBAL)) {
+			uwsgi_log("[uwsgi-fork-server] unable to preload %s: %s\n", usl_preload->value, dlerror());
+			exit(1);
+		}
+		uwsgi_log_verbose("[uwsgi-fork-server] preloaded %s\n", usl_preload->value);
+	}
+
 	int fd = bind_to_unix(socket, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
 	if (fd < 0) exit(1);
 
@@ -58,6 +58,379 @@ static uint32_t murmur2_hash(char *key, uint64_t keylen) {
 	return h;
 }
 
+/*
+	XXH3-64 by Yann Collet (BSD 2-Clause), seedless variant with the default secret.
+
+	The short-input paths are the interesting ones for cache keys (up to 240 bytes),
+	long inputs use the stripe accumulator with SSE2/AVX2 code paths when available.
+*/
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH3_SECRET_SIZE 192
+#define XXH3_STRIPE_LEN 64
+#define XXH3_ACC_NB 8
+
+static const uint8_t xxh3_secret[XXH3_SECRET_SIZE] __attribute__((aligned(64))) = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint32_t hash_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t hash_read64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint64_t hash_rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh3_mul128_fold64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t product = (__uint128_t) a * b;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else
+	uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+	uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+	uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+	uint64_t hi_hi = (a >> 32) * (b >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+	return lower ^ upper;
+#endif
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h) {
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len) {
+	h ^= hash_rotl64(h, 49) ^ hash_rotl64(h, 24);
+	h *= XXH_PRIME_MX2;
+	h ^= (h >> 35) + len;
+	h *= XXH_PRIME_MX2;
+	h ^= h >> 28;
+	return h;
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t *in, const uint8_t *sec) {
+	return xxh3_mul128_fold64(hash_read64(in) ^ hash_read64(sec), hash_read64(in + 8) ^ hash_read64(sec + 8));
+}
+
+static void xxh3_accumulate_512(uint64_t *acc, const uint8_t *in, const uint8_t *sec) {
+#if defined(__AVX2__)
+	int i;
+	__m256i *xacc = (__m256i *) acc;
+	for (i = 0; i < XXH3_STRIPE_LEN / 32; i++) {
+		__m256i data_vec = _mm256_loadu_si256((const __m256i *) (in + (i * 32)));
+		__m256i key_vec = _mm256_loadu_si256((const __m256i *) (sec + (i * 32)));
+		__m256i data_key = _mm256_xor_si256(data_vec, key_vec);
+		__m256i data_key_lo = _mm256_srli_epi64(data_key, 32);
+		__m256i product = _mm256_mul_epu32(data_key, data_key_lo);
+		__m256i data_swap = _mm256_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+		__m256i sum = _mm256_add_epi64(_mm256_loadu_si256(xacc + i), data_swap);
+		_mm256_storeu_si256(xacc + i, _mm256_add_epi64(product, sum));
+	}
+#elif defined(__SSE2__)
+	int i;
+	__m128i *xacc = (__m128i *) acc;
+	for (i = 0; i < XXH3_STRIPE_LEN / 16; i++) {
+		__m128i data_vec = _mm_loadu_si128((const __m128i *) (in + (i * 16)));
+		__m128i key_vec = _mm_loadu_si128((const __m128i *) (sec + (i * 16)));
+		__m128i data_key = _mm_xor_si128(data_vec, key_vec);
+		__m128i data_key_lo = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+		__m128i product = _mm_mul_epu32(data_key, data_key_lo);
+		__m128i data_swap = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+		__m128i sum = _mm_add_epi64(_mm_loadu_si128(xacc + i), data_swap);
+		_mm_storeu_si128(xacc + i, _mm_add_epi64(product, sum));
+	}
+#else
+	int i;
+	for (i = 0; i < XXH3_ACC_NB; i++) {
+		uint64_t data_val = hash_read64(in + (i * 8));
+		uint64_t data_key = data_val ^ hash_read64(sec + (i * 8));
+		acc[i ^ 1] += data_val;
+		acc[i] += (data_key & 0xffffffff) * (data_key >> 32);
+	}
+#endif
+}
+
+static void xxh3_scramble(uint64_t *acc, const uint8_t *sec) {
+#if defined(__AVX2__)
+	int i;
+	__m256i *xacc = (__m256i *) acc;
+	const __m256i prime32 = _mm256_set1_epi32((int) XXH_PRIME32_1);
+	for (i = 0; i < XXH3_STRIPE_LEN / 32; i++) {
+		__m256i acc_vec = _mm256_loadu_si256(xacc + i);
+		__m256i shifted = _mm256_srli_epi64(acc_vec, 47);
+		__m256i data_vec = _mm256_xor_si256(acc_vec, shifted);
+		__m256i key_vec = _mm256_loadu_si256((const __m256i *) (sec + (i * 32)));
+		__m256i data_key = _mm256_xor_si256(data_vec, key_vec);
+		__m256i data_key_hi = _mm256_srli_epi64(data_key, 32);
+		__m256i prod_lo = _mm256_mul_epu32(data_key, prime32);
+		__m256i prod_hi = _mm256_mul_epu32(data_key_hi, prime32);
+		_mm256_storeu_si256(xacc + i, _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32)));
+	}
+#elif defined(__SSE2__)
+	int i;
+	__m128i *xacc = (__m128i *) acc;
+	const __m128i prime32 = _mm_set1_epi32((int) XXH_PRIME32_1);
+	for (i = 0; i < XXH3_STRIPE_LEN / 16; i++) {
+		__m128i acc_vec = _mm_loadu_si128(xacc + i);
+		__m128i shifted = _mm_srli_epi64(acc_vec, 47);
+		__m128i data_vec = _mm_xor_si128(acc_vec, shifted);
+		__m128i key_vec = _mm_loadu_si128((const __m128i *) (sec + (i * 16)));
+		__m128i data_key = _mm_xor_si128(data_vec, key_vec);
+		__m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+		__m128i prod_lo = _mm_mul_epu32(data_key, prime32);
+		__m128i prod_hi = _mm_mul_epu32(data_key_hi, prime32);
+		_mm_storeu_si128(xacc + i, _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32)));
+	}
+#else
+	int i;
+	for (i = 0; i < XXH3_ACC_NB; i++) {
+		uint64_t acc64 = acc[i];
+		acc64 ^= acc64 >> 47;
+		acc64 ^= hash_read64(sec + (i * 8));
+		acc64 *= XXH_PRIME32_1;
+		acc[i] = acc64;
+	}
+#endif
+}
+
+static uint64_t xxh3_hash_long(const uint8_t *in, uint64_t len) {
+	uint64_t acc[XXH3_ACC_NB] __attribute__((aligned(32))) = {
+		XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+		XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+	};
+	const uint64_t stripes_per_block = (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / 8;
+	const uint64_t block_len = XXH3_STRIPE_LEN * stripes_per_block;
+	const uint64_t nb_blocks = (len - 1) / block_len;
+	uint64_t i, n;
+
+	for (n = 0; n < nb_blocks; n++) {
+		for (i = 0; i < stripes_per_block; i++) {
+			xxh3_accumulate_512(acc, in + (n * block_len) + (i * XXH3_STRIPE_LEN), xxh3_secret + (i * 8));
+		}
+		xxh3_scramble(acc, xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+	}
+
+	uint64_t nb_stripes = ((len - 1) - (block_len * nb_blocks)) / XXH3_STRIPE_LEN;
+	for (i = 0; i < nb_stripes; i++) {
+		xxh3_accumulate_512(acc, in + (nb_blocks * block_len) + (i * XXH3_STRIPE_LEN), xxh3_secret + (i * 8));
+	}
+	// last stripe
+	xxh3_accumulate_512(acc, in + len - XXH3_STRIPE_LEN, xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7);
+
+	uint64_t result = len * XXH_PRIME64_1;
+	for (i = 0; i < 4; i++) {
+		const uint8_t *sec = xxh3_secret + 11 + (16 * i);
+		result += xxh3_mul128_fold64(acc[2 * i] ^ hash_read64(sec), acc[(2 * i) + 1] ^ hash_read64(sec + 8));
+	}
+	return xxh3_avalanche(result);
+}
+
+uint64_t uwsgi_xxh3_64(char *key, uint64_t len) {
+	const uint8_t *in = (const uint8_t *) key;
+	const uint8_t *sec = xxh3_secret;
+	uint64_t acc, i;
+
+	if (len <= 16) {
+		if (len > 8) {
+			uint64_t lo = hash_read64(in) ^ (hash_read64(sec + 24) ^ hash_read64(sec + 32));
+			uint64_t hi = hash_read64(in + len - 8) ^ (hash_read64(sec + 40) ^ hash_read64(sec + 48));
+			acc = len + __builtin_bswap64(lo) + hi + xxh3_mul128_fold64(lo, hi);
+			return xxh3_avalanche(acc);
+		}
+		if (len >= 4) {
+			uint64_t input64 = hash_read32(in + len - 4) + ((uint64_t) hash_read32(in) << 32);
+			return xxh3_rrmxmx(input64 ^ (hash_read64(sec + 8) ^ hash_read64(sec + 16)), len);
+		}
+		if (len > 0) {
+			uint32_t combined = ((uint32_t) in[0] << 16) | ((uint32_t) in[len >> 1] << 24) | ((uint32_t) in[len - 1]) | ((uint32_t) len << 8);
+			return xxh64_avalanche((uint64_t) combined ^ (uint64_t) (hash_read32(sec) ^ hash_read32(sec + 4)));
+		}
+		return xxh64_avalanche(hash_read64(sec + 56) ^ hash_read64(sec + 64));
+	}
+
+	if (len <= 128) {
+		acc = len * XXH_PRIME64_1;
+		if (len > 32) {
+			if (len > 64) {
+				if (len > 96) {
+					acc += xxh3_mix16(in + 48, sec + 96);
+					acc += xxh3_mix16(in + len - 64, sec + 112);
+				}
+				acc += xxh3_mix16(in + 32, sec + 64);
+				acc += xxh3_mix16(in + len - 48, sec + 80);
+			}
+			acc += xxh3_mix16(in + 16, sec + 32);
+			acc += xxh3_mix16(in + len - 32, sec + 48);
+		}
+		acc += xxh3_mix16(in, sec);
+		acc += xxh3_mix16(in + len - 16, sec + 16);
+		return xxh3_avalanche(acc);
+	}
+
+	if (len <= 240) {
+		uint64_t rounds = len / 16;
+		acc = len * XXH_PRIME64_1;
+		for (i = 0; i < 8; i++) {
+			acc += xxh3_mix16(in + (16 * i), sec + (16 * i));
+		}
+		acc = xxh3_avalanche(acc);
+		for (i = 8; i < rounds; i++) {
+			acc += xxh3_mix16(in + (16 * i), sec + (16 * (i - 8)) + 3);
+		}
+		acc += xxh3_mix16(in + len - 16, sec + 136 - 17);
+		return xxh3_avalanche(acc);
+	}
+
+	return xxh3_hash_long(in, len);
+}
+
+static uint32_t xxh3_hash(char *key, uint64_t keylen) {
+	return (uint32_t) uwsgi_xxh3_64(key, keylen);
+}
+
+/*
+	SipHash-2-4 (Aumasson/Bernstein), keyed hash resistant to hash-flooding.
+
+	The key is taken from --hash-siphash-key or generated randomly in the master
+	(before fork, so all of the workers share it) the first time the algorithm is
+	looked up, so /dev/urandom is not needed when siphash is not used.
+	Use a fixed key when the hashed data outlives the instance (like persistent cache stores).
+*/
+
+static uint64_t siphash_k0, siphash_k1;
+static int siphash_key_ready = 0;
+
+#define SIPROUND do { \
+	v0 += v1; v1 = hash_rotl64(v1, 13); v1 ^= v0; v0 = hash_rotl64(v0, 32); \
+	v2 += v3; v3 = hash_rotl64(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = hash_rotl64(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = hash_rotl64(v1, 17); v1 ^= v2; v2 = hash_rotl64(v2, 32); \
+} while(0)
+
+uint64_t uwsgi_siphash(char *key, uint64_t len, uint64_t k0, uint64_t k1) {
+	const uint8_t *in = (const uint8_t *) key;
+	const uint8_t *end = in + (len - (len % 8));
+	uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ k1;
+	uint64_t b = len << 56;
+
+	for (; in != end; in += 8) {
+		uint64_t m = hash_read64(in);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	switch (len & 7) {
+		case 7: b |= ((uint64_t) in[6]) << 48;
+			/* fallthrough */
+		case 6: b |= ((uint64_t) in[5]) << 40;
+			/* fallthrough */
+		case 5: b |= ((uint64_t) in[4]) << 32;
+			/* fallthrough */
+		case 4: b |= ((uint64_t) in[3]) << 24;
+			/* fallthrough */
+		case 3: b |= ((uint64_t) in[2]) << 16;
+			/* fallthrough */
+		case 2: b |= ((uint64_t) in[1]) << 8;
+			/* fallthrough */
+		case 1: b |= ((uint64_t) in[0]);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void siphash_key_init() {
+	uint8_t k[16];
+	if (siphash_key_ready) return;
+	memset(k, 0, 16);
+	if (uwsgi.hash_siphash_key) {
+		size_t klen = strlen(uwsgi.hash_siphash_key);
+		memcpy(k, uwsgi.hash_siphash_key, klen > 16 ? 16 : klen);
+	}
+	else {
+		int fd = open("/dev/urandom", O_RDONLY);
+		if (fd < 0 || read(fd, k, 16) != 16) {
+			uwsgi_error("siphash_key_init()/read()");
+			exit(1);
+		}
+		close(fd);
+	}
+	siphash_k0 = hash_read64(k);
+	siphash_k1 = hash_read64(k + 8);
+	siphash_key_ready = 1;
+}
+
+static uint32_t siphash_hash(char *key, uint64_t keylen) {
+	return (uint32_t) uwsgi_siphash(key, keylen, siphash_k0, siphash_k1);
+}
+
 static uint32_t random_hash(char *key, uint64_t keylen) {
 	return (uint32_t) rand();
 }
@@ -80,6 +453,7 @@ struct uwsgi_hash_algo *uwsgi_hash_algo_get(char *name) {
 	struct uwsgi_hash_algo *uha = uwsgi.hash_algos;
 	while(uha) {
 		if (!strcmp(name, uha->name)) {
+			if (uha->func == siphash_hash) siphash_key_init();
 			return uha;
 		}
 		uha = uha->next;
@@ -109,6 +483,8 @@ void uwsgi_hash_algo_register(char *name, uint32_t (*func)(char *, uint64_t)) {
 void uwsgi_hash_algo_register_all() {
 	uwsgi_hash_algo_register("djb33x", djb33x_hash);
 	uwsgi_hash_algo_register("murmur2", murmur2_hash);
+	uwsgi_hash_algo_register("xxh3", xxh3_hash);
+	uwsgi_hash_algo_register("siphash", siphash_hash);
 	uwsgi_hash_algo_register("random", random_hash);
 	uwsgi_hash_algo_register("rand", random_hash);
 	uwsgi_hash_algo_register("rr", rr_hash);
@@ -70,6 +70,7 @@ struct http_status_codes hsc[] = {
 void uwsgi_init_default() {
 
 	uwsgi.cpus = 1;
+	uwsgi.lock_spin = 100;
 	uwsgi.new_argc = -1;
 	uwsgi.binary_argc = 1;
 
@@ -81,18 +82,24 @@ void uwsgi_init_default() {
 	uwsgi.signal_socket = -1;
 	uwsgi.my_signal_socket = -1;
 	uwsgi.stats_fd = -1;
+	uwsgi.stats_openmetrics_fd = -1;
 
 	uwsgi.stats_pusher_default_freq = 3;
+	uwsgi.stats_pusher_mtu = 1400;
 
 	uwsgi.original_log_fd = 2;
 
 	uwsgi.emperor_fd_config = -1;
+	uwsgi.compiled_config_start = -1;
 	uwsgi.emperor_fd_proxy = -1;
 	// default emperor scan frequency
 	uwsgi.emperor_freq = 3;
 	uwsgi.emperor_throttle = 1000;
 	uwsgi.emperor_heartbeat = 30;
 	uwsgi.emperor_curse_tolerance = 30;
+	uwsgi.emperor_spawn_timeout = 60;
+	uwsgi.emperor_cgroup_throttle_weight = 10;
+	uwsgi.emperor_stats_aggregate_freq = 5;
 	// max 3 minutes throttling
 	uwsgi.emperor_max_throttle = 1000 * 180;
 	uwsgi.emperor_pid = -1;
@@ -100,6 +107,7 @@ void uwsgi_init_default() {
 	uwsgi.subscribe_freq = 10;
 	uwsgi.subscription_tolerance = 17;
 	uwsgi.subscription_tolerance_inactive = 17;
+	uwsgi.subscription_ejection_time = 10000;
 
 	uwsgi.cores = 1;
 	uwsgi.threads = 1;
@@ -110,10 +118,13 @@ void uwsgi_init_default() {
 	uwsgi.rpc_max = 64;
 
 	uwsgi.offload_threads_events = 64;
+	uwsgi.offload_http_keepalive = 8;
+	uwsgi.connection_pool_size = 8;
 
 	uwsgi.default_app = -1;
 
 	uwsgi.buffer_size = 4096;
+	uwsgi.request_arena_size = 8192;
 	uwsgi.body_read_warning = 8;
 	uwsgi.numproc = 1;
 
@@ -157,12 +168,18 @@ void uwsgi_init_default() {
 	uwsgi.shared->worker_req_log_pipe[0] = -1;
 	uwsgi.shared->worker_req_log_pipe[1] = -1;
 
+	uwsgi.shared->req_log_ring_pipe[0] = -1;
+	uwsgi.shared->req_log_ring_pipe[1] = -1;
+
 	uwsgi.req_log_fd = 2;
 
 #ifdef UWSGI_SSL
 	// 1 day of tolerance
 	uwsgi.subscriptions_sign_check_tolerance = 3600 * 24;
 	uwsgi.ssl_sessions_timeout = 300;
+	uwsgi.ssl_tickets_rotate = 3600;
+	uwsgi.ssl_ocsp_refresh = 3600;
+	uwsgi.ssl_ocsp_timeout = 5;
 	uwsgi.ssl_verify_depth = 1;
 #endif
 
@@ -382,7 +399,10 @@ void uwsgi_setup_workers() {
 		void *ts = uwsgi_calloc_shared(sizeof(void *) * uwsgi.max_apps * uwsgi.cores);
 		// add 4 bytes for uwsgi header
 		void *buffers = uwsgi_malloc_shared((uwsgi.buffer_size+4) * uwsgi.cores);
-		void *hvec = uwsgi_malloc_shared(sizeof(struct iovec) * uwsgi.vec_size * uwsgi.cores);
+		// with --compact-cores every core allocates (and grows) its own vector at the first request
+		void *hvec = NULL;
+		if (!uwsgi.compact_cores)
+			hvec = uwsgi_malloc_shared(sizeof(struct iovec) * uwsgi.vec_size * uwsgi.cores);
 		void *post_buf = NULL;
 		if (uwsgi.post_buffering > 0)
 			post_buf = uwsgi_malloc_shared(uwsgi.post_buffering_bufsize * uwsgi.cores);
@@ -394,7 +414,10 @@ void uwsgi_setup_workers() {
 			// raw per-request buffer (+4 bytes for uwsgi header)
 			uwsgi.workers[i].cores[j].buffer = buffers + ((uwsgi.buffer_size+4) * j);
 			// iovec for uwsgi vars
-			uwsgi.workers[i].cores[j].hvec = hvec + ((sizeof(struct iovec) * uwsgi.vec_size) * j);
+			if (hvec) {
+				uwsgi.workers[i].cores[j].hvec = hvec + ((sizeof(struct iovec) * uwsgi.vec_size) * j);
+				uwsgi.workers[i].cores[j].hvec_size = uwsgi.vec_size;
+			}
 			if (post_buf)
 				uwsgi.workers[i].cores[j].post_buf = post_buf + (uwsgi.post_buffering_bufsize * j);
 		}
@@ -402,12 +425,28 @@ void uwsgi_setup_workers() {
 		// master does not need to following steps...
 		if (i == 0)
 			continue;
+		if (uwsgi.req_log_ring) {
+			size_t ring_size = sizeof(struct uwsgi_log_ring) + uwsgi.req_log_ring;
+			char *rings = uwsgi_calloc_shared(ring_size * uwsgi.cores);
+			for (j = 0; j < uwsgi.cores; j++) {
+				uwsgi.workers[i].cores[j].req_log_ring = (struct uwsgi_log_ring *) (rings + (ring_size * j));
+				uwsgi.workers[i].cores[j].req_log_ring->size = uwsgi.req_log_ring;
+			}
+		}
 		uwsgi.workers[i].signal_pipe[0] = -1;
 		uwsgi.workers[i].signal_pipe[1] = -1;
 		snprintf(uwsgi.workers[i].name, 0xff, "uWSGI worker %d", i);
 	}
 
-	uint64_t total_memory = (sizeof(struct uwsgi_app) * uwsgi.max_apps) + (sizeof(struct uwsgi_core) * uwsgi.cores) + (sizeof(void *) * uwsgi.max_apps * uwsgi.cores) + (uwsgi.buffer_size * uwsgi.cores) + (sizeof(struct iovec) * uwsgi.vec_size * uwsgi.cores);
+	// process local, every worker gets its own zeroed copy on fork()
+	if (uwsgi.accept_batch > 1) {
+		uwsgi.accept_batches = uwsgi_calloc(sizeof(struct uwsgi_accept_batch) * uwsgi.cores);
+	}
+
+	uint64_t total_memory = (sizeof(struct uwsgi_app) * uwsgi.max_apps) + (sizeof(struct uwsgi_core) * uwsgi.cores) + (sizeof(void *) * uwsgi.max_apps * uwsgi.cores) + (uwsgi.buffer_size * uwsgi.cores);
+	if (!uwsgi.compact_cores) {
+		total_memory += (sizeof(struct iovec) * uwsgi.vec_size * uwsgi.cores);
+	}
 	if (uwsgi.post_buffering > 0) {
 		total_memory += (uwsgi.post_buffering_bufsize * uwsgi.cores);
 	}
@@ -462,6 +501,29 @@ pid_t uwsgi_daemonize2() {
 // fix/check related options
 void sanitize_args() {
 
+	if (uwsgi.req_log_ring) {
+		if (!uwsgi.master_process || !uwsgi.req_log_master) {
+			uwsgi_log("--req-log-ring requires the master and a request logger (--req-logger)\n");
+			exit(1);
+		}
+		// keep the rings 8 bytes aligned
+		uwsgi.req_log_ring = (uwsgi.req_log_ring + 7) & ~((uint64_t) 7);
+		if (uwsgi.req_log_ring < uwsgi.log_master_bufsize + 4) {
+			uwsgi_log("--req-log-ring must be bigger than --log-master-bufsize\n");
+			exit(1);
+		}
+	}
+
+	if (uwsgi.log_async_buffer && uwsgi.log_async_buffer < (uwsgi.log_master_bufsize + 4) * 2) {
+		uwsgi_log("--log-async-buffer must be at least twice --log-master-bufsize\n");
+		exit(1);
+	}
+
+	if (uwsgi.logformat_msgpack && !uwsgi.logformat) {
+		uwsgi_log("--logformat-msgpack requires --logformat\n");
+		exit(1);
+	}
+
         if (uwsgi.async > 0) {
                 uwsgi.cores = uwsgi.async;
         }
@@ -471,6 +533,18 @@ void sanitize_args() {
                 uwsgi.cores = uwsgi.threads;
         }
 
+	if (uwsgi.spooler_threads > 1) {
+		if (uwsgi.spooler_batch > 1) {
+			uwsgi_log("--spooler-threads and --spooler-batch cannot be used together\n");
+			exit(1);
+		}
+		if (uwsgi.spooler_chdir) {
+			uwsgi_log("--spooler-chdir is not supported with --spooler-threads\n");
+			exit(1);
+		}
+		uwsgi.has_threads = 1;
+	}
+
         if (uwsgi.harakiri_options.workers > 0) {
                 if (!uwsgi.post_buffering) {
                         uwsgi_log(" *** WARNING: you have enabled harakiri without post buffering. Slow upload could be rejected on post-unbuffered webservers *** \n");
@@ -530,6 +604,55 @@ void sanitize_args() {
 		if (!uwsgi.mem_collector_freq) uwsgi.mem_collector_freq = 3;
 	}
 
+	if (uwsgi.zerg_server_reuseport) {
+		if (uwsgi.reuse_port_per_worker) {
+			uwsgi_log("--zerg-server-reuseport cannot be used with --reuse-port-per-worker\n");
+			exit(1);
+		}
+		// the zergs get twins of the sockets
+		uwsgi.reuse_port = 1;
+	}
+
+	if (uwsgi.reuse_port_per_worker) {
+		if (uwsgi.cheaper) {
+			uwsgi_log("--reuse-port-per-worker cannot be used in cheaper mode (connections would be queued to stopped workers)\n");
+			exit(1);
+		}
+		// every worker accepts on its own socket
+		uwsgi.reuse_port = 1;
+		uwsgi.use_thunder_lock = 0;
+	}
+	else if (uwsgi.reuse_port_cpu_steering) {
+		uwsgi_log("--reuse-port-cpu-steering requires --reuse-port-per-worker\n");
+		exit(1);
+	}
+	else if (uwsgi.reuse_port_numa_steering) {
+		uwsgi_log("--reuse-port-numa-steering requires --reuse-port-per-worker\n");
+		exit(1);
+	}
+
+	if (uwsgi.spooler_index) {
+		struct uwsgi_spooler *uspool, *other;
+		for (uspool = uwsgi.spoolers; uspool; uspool = uspool->next) {
+			for (other = uspool->next; other; other = other->next) {
+				if (!strcmp(uspool->dir, other->dir)) {
+					uwsgi_log("--spooler-index requires a single spooler process for each directory (%s)\n", uspool->dir);
+					exit(1);
+				}
+			}
+		}
+	}
+
+	if (uwsgi.shared_hugepages && strcmp(uwsgi.shared_hugepages, "hugetlb") && strcmp(uwsgi.shared_hugepages, "thp")) {
+		uwsgi_log("invalid --shared-hugepages value \"%s\" (must be \"hugetlb\" or \"thp\")\n", uwsgi.shared_hugepages);
+		exit(1);
+	}
+
+	if (uwsgi.reuse_port_numa_steering && !uwsgi.numa_affinity) {
+		uwsgi_log("--reuse-port-numa-steering requires --numa-affinity\n");
+		exit(1);
+	}
+
 	/* here we try to choose if thunder lock is a good thing */
 #ifdef UNBIT
 	if (uwsgi.numproc > 1 && !uwsgi.map_socket) {
@@ -258,6 +258,17 @@ static char *uwsgi_scheme_emperor(char *url, size_t *size, int add_zero) {
 		uwsgi_log("this is not a vassal instance\n");
 		exit(1);
 	}
+
+	// already read by --compiled-config
+	if (uwsgi.emperor_config_stash) {
+		char *buffer = uwsgi_calloc(uwsgi.emperor_config_stash_len + add_zero);
+		memcpy(buffer, uwsgi.emperor_config_stash, uwsgi.emperor_config_stash_len);
+		*size = uwsgi.emperor_config_stash_len + add_zero;
+		free(uwsgi.emperor_config_stash);
+		uwsgi.emperor_config_stash = NULL;
+		return buffer;
+	}
+
 	ssize_t rlen;
 	struct uwsgi_header uh;
 	size_t remains = 4;
@@ -0,0 +1,207 @@
+#include "uwsgi.h"
+
+/*
+
+	minimal io_uring support (no liburing needed)
+
+	rings are meant to be used by a single thread: requests are queued with the
+	uwsgi_io_uring_* functions and sent to the kernel in a single syscall with uwsgi_io_uring_submit().
+	Completions are notified via an eventfd, so the ring can be monitored by a standard uWSGI event queue.
+
+	The data pointer of each request is returned with the completion, so the owner must
+	not free it until the completion has been received.
+
+*/
+
+#ifdef UWSGI_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+extern struct uwsgi_server uwsgi;
+
+struct uwsgi_io_uring {
+	int fd;
+	int eventfd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	// local tail (published on submit)
+	unsigned tail;
+	unsigned pending;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+struct uwsgi_io_uring *uwsgi_io_uring_new(uint32_t entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(struct io_uring_params));
+
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0) {
+		uwsgi_error("uwsgi_io_uring_new()/io_uring_setup()");
+		return NULL;
+	}
+
+	size_t sq_size = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+	size_t cq_size = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size) sq_size = cq_size;
+		cq_size = sq_size;
+	}
+
+	char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) {
+		uwsgi_error("uwsgi_io_uring_new()/mmap()");
+		close(fd);
+		return NULL;
+	}
+
+	char *cq = sq;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) {
+			uwsgi_error("uwsgi_io_uring_new()/mmap()");
+			munmap(sq, sq_size);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	struct io_uring_sqe *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		uwsgi_error("uwsgi_io_uring_new()/mmap()");
+		sqes = NULL;
+		goto error;
+	}
+
+	int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0) {
+		uwsgi_error("uwsgi_io_uring_new()/eventfd()");
+		goto error;
+	}
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0) {
+		uwsgi_error("uwsgi_io_uring_new()/io_uring_register()");
+		close(efd);
+		goto error;
+	}
+
+	struct uwsgi_io_uring *ring = uwsgi_calloc(sizeof(struct uwsgi_io_uring));
+	ring->fd = fd;
+	ring->eventfd = efd;
+	ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->sqes = sqes;
+	ring->tail = *ring->sq_tail;
+	ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	return ring;
+
+error:
+	if (sqes) munmap(sqes, sqes_size);
+	if (cq != sq) munmap(cq, cq_size);
+	munmap(sq, sq_size);
+	close(fd);
+	return NULL;
+}
+
+int uwsgi_io_uring_eventfd(struct uwsgi_io_uring *ring) {
+	return ring->eventfd;
+}
+
+int uwsgi_io_uring_submit(struct uwsgi_io_uring *ring) {
+	if (!ring->pending) return 0;
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+	for (;;) {
+		int ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			uwsgi_error("uwsgi_io_uring_submit()/io_uring_enter()");
+			return -1;
+		}
+		ring->pending -= ret;
+		return ret;
+	}
+}
+
+// get a free sqe, flushing the queue if it is full
+static struct io_uring_sqe *io_uring_get_sqe(struct uwsgi_io_uring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->tail - head >= ring->sq_entries) {
+		if (uwsgi_io_uring_submit(ring) < 0) return NULL;
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (ring->tail - head >= ring->sq_entries) return NULL;
+	}
+	unsigned index = ring->tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	ring->tail++;
+	ring->pending++;
+	return sqe;
+}
+
+int uwsgi_io_uring_send(struct uwsgi_io_uring *ring, int fd, char *buf, size_t len, void *data) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) buf;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uint64_t) (uintptr_t) data;
+	return 0;
+}
+
+// offsets are -1 for pipes and for the current file position
+int uwsgi_io_uring_splice(struct uwsgi_io_uring *ring, int fd_in, int64_t off_in, int fd_out, int64_t off_out, size_t len, void *data) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_SPLICE;
+	sqe->splice_fd_in = fd_in;
+	sqe->splice_off_in = (uint64_t) off_in;
+	sqe->fd = fd_out;
+	sqe->off = (uint64_t) off_out;
+	sqe->len = len;
+	sqe->splice_flags = SPLICE_F_MOVE;
+	sqe->user_data = (uint64_t) (uintptr_t) data;
+	return 0;
+}
+
+int uwsgi_io_uring_poll(struct uwsgi_io_uring *ring, int fd, int events, void *data) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = (uint64_t) (uintptr_t) data;
+	return 0;
+}
+
+// returns 1 if a completion is available
+int uwsgi_io_uring_complete(struct uwsgi_io_uring *ring, void **data, int32_t *res) {
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+	struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+	*data = (void *) (uintptr_t) cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+#endif
@@ -11,9 +11,30 @@ extern struct uwsgi_server uwsgi;
 	Lord of the Legion. There can only be one (and only one) Lord for each Legion.
 	If a member of a Legion spawns with an higher valor than the current Lord, it became the new Lord.
 
+	With --legion-scroll-delta the announces carry only the version (a checksum) of the scroll:
+	the scroll itself is pushed once when it changes, while nodes missing it (unknown or stale version)
+	fetch it lazily with a unicast scroll request to the announcing node.
+
+	The scrolls list is rebuilt at most once per round (only when a node joins, leaves or changes its scroll).
+
+	For fast failover the announces can be sent every --legion-freq-ms milliseconds and a node is considered
+	dead after --legion-tolerance-ms or, with --legion-phi, as soon as the phi accrual failure detector
+	(based on the mean and the variance of the heartbeats inter-arrival times of the node) reaches the threshold.
+	Every change of the members view is announced immediately, so a new Lord is elected without waiting a round.
 
 */
 
+#define LEGION_SEND_SCROLL 1
+#define LEGION_SEND_SCROLL_REQUEST 2
+#define LEGION_SEND_OOB 4
+
+static int legion_send(struct uwsgi_legion *, int, struct sockaddr *, socklen_t);
+static int legion_announce(struct uwsgi_legion *, int);
+
+// failure detector, in usecs
+static uint64_t legion_tolerance_us;
+static double legion_phi_threshold;
+
 struct uwsgi_legion *uwsgi_legion_get_by_socket(int fd) {
 	struct uwsgi_legion *ul = uwsgi.legions;
 	while (ul) {
@@ -79,11 +100,28 @@ void uwsgi_parse_legion(char *key, uint16_t keylen, char *value, uint16_t vallen
 		ul->scroll = value;
 		ul->scroll_len = vallen;
 	}
+	else if (!uwsgi_strncmp(key, keylen, "scroll_version", 14)) {
+		ul->scroll_version = uwsgi_str_num(value, vallen);
+		ul->scroll_versioned = 1;
+	}
+	else if (!uwsgi_strncmp(key, keylen, "scroll_request", 14)) {
+		ul->scroll_request = 1;
+	}
+	else if (!uwsgi_strncmp(key, keylen, "oob", 3)) {
+		ul->oob = 1;
+	}
 	else if (!uwsgi_strncmp(key, keylen, "dead", 4)) {
 		ul->dead = 1;
 	}
 }
 
+// 0 is reserved for the empty scroll
+static uint32_t legion_scroll_version(char *scroll, uint16_t len) {
+	if (!len) return 0;
+	uint32_t version = djb33x_hash(scroll, len);
+	return version ? version : 1;
+}
+
 // this function is called when a node is added or removed (heavy locking is needed)
 static void legion_rebuild_scrolls(struct uwsgi_legion *ul) {
 	uint64_t max_size = ul->scrolls_max_size;
@@ -177,7 +215,7 @@ void uwsgi_legion_remove_node(struct uwsgi_legion *ul, struct uwsgi_legion_node
 
 	free(node);
 
-	legion_rebuild_scrolls(ul);
+	ul->scrolls_dirty = 1;
 }
 
 struct uwsgi_legion_node *uwsgi_legion_get_node(struct uwsgi_legion *ul, uint64_t valor, char *name, uint16_t name_len, char *uuid) {
@@ -198,18 +236,58 @@ next:
 	return NULL;
 }
 
+// update the inter-arrival stats (exponentially weighted) of a node, only periodic announces are sampled
+static void legion_node_heartbeat(struct uwsgi_legion_node *node, int periodic) {
+	uint64_t now = uwsgi_micros();
+	node->last_heartbeat = now;
+	node->last_seen = now / 1000000;
+	if (!periodic) return;
+	if (node->last_periodic_heartbeat && now > node->last_periodic_heartbeat) {
+		double interval = now - node->last_periodic_heartbeat;
+		if (node->interval_mean <= 0) {
+			node->interval_mean = interval;
+			node->interval_var = (interval / 4) * (interval / 4);
+		}
+		else {
+			double diff = interval - node->interval_mean;
+			node->interval_mean += diff / 8;
+			node->interval_var = (node->interval_var + (diff * diff) / 8) * 7 / 8;
+		}
+	}
+	node->last_periodic_heartbeat = now;
+}
+
+// -log10 of the probability of a heartbeat arriving later than elapsed (logistic approximation of the normal distribution)
+static double legion_node_phi(struct uwsgi_legion_node *node, uint64_t elapsed) {
+	if (node->interval_mean <= 0) return 0;
+	double stddev = sqrt(node->interval_var);
+	// tolerate some jitter even with very regular heartbeats
+	if (stddev < node->interval_mean / 4) stddev = node->interval_mean / 4;
+	double y = (elapsed - node->interval_mean) / stddev;
+	double e = exp(-y * (1.5976 + 0.070566 * y * y));
+	if (elapsed > node->interval_mean) return -log10(e / (1.0 + e));
+	return -log10(1.0 - 1.0 / (1.0 + e));
+}
+
 static void legions_check_nodes() {
 
 	struct uwsgi_legion *legion = uwsgi.legions;
 	while (legion) {
-		time_t now = uwsgi_now();
+		uint64_t now = uwsgi_micros();
 
 		struct uwsgi_legion_node *node = legion->nodes_head;
 		while (node) {
-			if (now - node->last_seen > uwsgi.legion_tolerance) {
+			uint64_t elapsed = now > node->last_heartbeat ? now - node->last_heartbeat : 0;
+			double phi = legion_phi_threshold > 0 ? legion_node_phi(node, elapsed) : 0;
+			if (elapsed > legion_tolerance_us || (legion_phi_threshold > 0 && phi >= legion_phi_threshold)) {
 				struct uwsgi_legion_node *tmp_node = node;
 				node = node->next;
-				uwsgi_log("[uwsgi-legion] %s: %.*s valor: %llu uuid: %.*s left Legion %s\n", tmp_node->valor > 0 ? "node" : "arbiter", tmp_node->name_len, tmp_node->name, tmp_node->valor, 36, tmp_node->uuid, legion->legion);
+				if (elapsed > legion_tolerance_us) {
+					uwsgi_log("[uwsgi-legion] %s: %.*s valor: %llu uuid: %.*s left Legion %s\n", tmp_node->valor > 0 ? "node" : "arbiter", tmp_node->name_len, tmp_node->name, tmp_node->valor, 36, tmp_node->uuid, legion->legion);
+				}
+				else {
+					uwsgi_log("[uwsgi-legion] %s: %.*s valor: %llu uuid: %.*s left Legion %s (phi: %.2f, last heartbeat %llu msecs ago)\n", tmp_node->valor > 0 ? "node" : "arbiter", tmp_node->name_len, tmp_node->name, tmp_node->valor, 36, tmp_node->uuid, legion->legion, phi, (unsigned long long) (elapsed / 1000));
+				}
 				uwsgi_wlock(legion->lock);
 				uwsgi_legion_remove_node(legion, tmp_node);
 				uwsgi_rwunlock(legion->lock);
@@ -291,15 +369,30 @@ static void legions_check_nodes_step2() {
 
 		// calculate the checksum
 		uint64_t new_checksum = uwsgi_legion_checksum(ul);
+		int view_changed = 0;
 		if (new_checksum != ul->checksum) {
 			ul->changed = 1;
+			view_changed = 1;
 		}
 		ul->checksum = new_checksum;
 
+		// let the other nodes know our new view (and vote) without waiting for the next round
+		if (view_changed) {
+			uwsgi_legion_announce(ul);
+		}
+
+		int alive = 1;
+		struct uwsgi_legion_node *nodes = ul->nodes_head;
+		while (nodes) {
+			alive++;
+			nodes = nodes->next;
+		}
+		ul->alive_nodes = alive;
+
 		// ... ok let's see if all of the nodes agree on the lord
 		// ... but first check if i am not alone...
 		int votes = 1;
-		struct uwsgi_legion_node *nodes = ul->nodes_head;
+		nodes = ul->nodes_head;
 		while (nodes) {
 			if (nodes->checksum != ul->checksum) {
 				votes = 0;
@@ -317,8 +410,10 @@ static void legions_check_nodes_step2() {
 			nodes = nodes->next;
 		}
 
+		ul->has_quorum = (votes > 0 && votes >= ul->quorum);
+
 		// we have quorum !!!
-		if (votes > 0 && votes >= ul->quorum) {
+		if (ul->has_quorum) {
 			if (!ul->joined) {
 				// triggering join hooks
 				struct uwsgi_string_list *usl = ul->join_hooks;
@@ -355,6 +450,9 @@ static void legions_check_nodes_step2() {
 						}
 						usl = usl->next;
 					}
+					if (ul->ssl_tickets) {
+						uwsgi_ssl_tickets_rotate(ul, 1);
+					}
 					if (ul->scroll_len > 0 && ul->scroll_len <= ul->lord_scroll_size) {
                 				uwsgi_wlock(ul->lock);
                 				ul->lord_scroll_len = ul->scroll_len;
@@ -369,11 +467,15 @@ static void legions_check_nodes_step2() {
 					// trick: reduce the time needed by the old lord to unlord itself
 					uwsgi_legion_announce(ul);
 				}
+				else if (ul->ssl_tickets) {
+					uwsgi_ssl_tickets_rotate(ul, 0);
+				}
 			}
 			else {
 				if (ul->i_am_the_lord) {
 					uwsgi_log("[uwsgi-legion] a new Lord (valor: %llu uuid: %.*s) raised for Legion %s...\n", ul->lord_valor, 36, ul->lord_uuid, ul->legion);
-					if (ul->lord_scroll_len > 0) {
+					// never log the ssl ticket keys
+					if (ul->lord_scroll_len > 0 && !ul->ssl_tickets) {
 						uwsgi_log("*********** The New Lord Scroll ***********\n");
 						uwsgi_log("%.*s\n", ul->lord_scroll_len, ul->lord_scroll);
 						uwsgi_log("*********** End of the New Lord Scroll ***********\n");
@@ -476,9 +578,29 @@ next:
 }
 
 
+// track the changes of our scroll and rebuild the scrolls lists changed in the last round
+static void legions_update_scrolls() {
+	struct uwsgi_legion *ul = uwsgi.legions;
+	while (ul) {
+		uint32_t version = legion_scroll_version(ul->scroll, ul->scroll_len);
+		if (version != ul->scroll_version) {
+			ul->scroll_version = version;
+			ul->scrolls_dirty = 1;
+		}
+		if (ul->scrolls_dirty) {
+			uwsgi_wlock(ul->lock);
+			legion_rebuild_scrolls(ul);
+			uwsgi_rwunlock(ul->lock);
+			ul->scrolls_dirty = 0;
+		}
+		ul = ul->next;
+	}
+}
+
 static void *legion_loop(void *foobar) {
 
-	time_t last_round = uwsgi_now();
+	uint64_t last_round = uwsgi_micros();
+	void *events = event_queue_alloc(1);
 
 	unsigned char *crypted_buf = uwsgi_malloc(UMAX16 - EVP_MAX_BLOCK_LENGTH - 4);
 	unsigned char *clear_buf = uwsgi_malloc(UMAX16);
@@ -492,21 +614,27 @@ static void *legion_loop(void *foobar) {
 	if (!uwsgi.legion_skew_tolerance)
 		uwsgi.legion_skew_tolerance = 60;
 
+	uint64_t freq_us = uwsgi.legion_freq_ms > 0 ? (uint64_t) uwsgi.legion_freq_ms * 1000 : (uint64_t) uwsgi.legion_freq * 1000000;
+	legion_tolerance_us = uwsgi.legion_tolerance_ms > 0 ? (uint64_t) uwsgi.legion_tolerance_ms * 1000 : (uint64_t) uwsgi.legion_tolerance * 1000000;
+	if (uwsgi.legion_phi) {
+		legion_phi_threshold = strtod(uwsgi.legion_phi, NULL);
+	}
+
 	int first_round = 1;
 	for (;;) {
-		int timeout = uwsgi.legion_freq;
-		time_t now = uwsgi_now();
-		if (now > last_round) {
-			timeout -= (now - last_round);
-			if (timeout < 0) {
-				timeout = 0;
-			}
+		uint64_t now_us = uwsgi_micros();
+		int timeout = 0;
+		if (now_us < last_round + freq_us) {
+			timeout = (last_round + freq_us - now_us) / 1000;
 		}
-		last_round = now;
+		legions_update_scrolls();
 		// wait for event
 		int interesting_fd = -1;
 		if (uwsgi_instance_is_reloading || uwsgi_instance_is_dying) return NULL;
-		int rlen = event_queue_wait(uwsgi.legion_queue, timeout, &interesting_fd);
+		int rlen = event_queue_wait_multi_ms(uwsgi.legion_queue, timeout, events, 1);
+		if (rlen > 0) {
+			interesting_fd = event_queue_interesting_fd(events, 0);
+		}
 
 		if (rlen < 0 && errno != EINTR) {
 			if (uwsgi_instance_is_reloading || uwsgi_instance_is_dying) return NULL;
@@ -514,14 +642,14 @@ static void *legion_loop(void *foobar) {
 			return NULL;	
 		}
 
-		now = uwsgi_now();
-		if (timeout == 0 || rlen == 0 || (now - last_round) >= timeout) {
+		now_us = uwsgi_micros();
+		if (now_us >= last_round + freq_us) {
 			struct uwsgi_legion *legions = uwsgi.legions;
 			while (legions) {
-				uwsgi_legion_announce(legions);
+				legion_announce(legions, 0);
 				legions = legions->next;
 			}
-			last_round = now;
+			last_round = now_us;
 		}
 
 		// check the nodes
@@ -531,10 +659,13 @@ static void *legion_loop(void *foobar) {
 			struct uwsgi_legion *ul = uwsgi_legion_get_by_socket(interesting_fd);
 			if (!ul)
 				continue;
+			// the sender address is used for unicast scroll requests/replies
+			struct sockaddr_storage src;
+			socklen_t src_len = sizeof(struct sockaddr_storage);
 			// ensure the first 4 bytes are valid
-			ssize_t len = read(ul->socket, crypted_buf, (UMAX16 - EVP_MAX_BLOCK_LENGTH - 4));
+			ssize_t len = recvfrom(ul->socket, crypted_buf, (UMAX16 - EVP_MAX_BLOCK_LENGTH - 4), 0, (struct sockaddr *) &src, &src_len);
 			if (len < 0) {
-				uwsgi_error("[uwsgi-legion] read()");
+				uwsgi_error("[uwsgi-legion] recvfrom()");
 				continue;
 			}
 			else if (len < 4) {
@@ -618,9 +749,8 @@ static void *legion_loop(void *foobar) {
 					node->scroll_len = legion_msg.scroll_len;
 					memcpy(node->scroll, legion_msg.scroll, node->scroll_len);
 				}
-				// we are still locked (and safe), let's rebuild the scrolls list
-				legion_rebuild_scrolls(ul);
 				uwsgi_rwunlock(ul->lock);
+				ul->scrolls_dirty = 1;
 				uwsgi_log("[uwsgi-legion] %s: %.*s valor: %llu uuid: %.*s joined Legion %s\n", node->valor > 0 ? "node" : "arbiter", node->name_len, node->name, node->valor, 36, node->uuid, ul->legion);
 				// trigger node_joined hooks
 				struct uwsgi_string_list *usl = ul->node_joined_hooks;
@@ -641,7 +771,40 @@ static void *legion_loop(void *foobar) {
 				continue;
 			}
 
-			node->last_seen = uwsgi_now();
+			// delta announces carry only the version of a (non empty) scroll, unless it just changed or has been requested
+			int has_scroll = !legion_msg.scroll_versioned || legion_msg.scroll_len > 0 || !legion_msg.scroll_version;
+
+			// the scroll of a node can change (e.g. ssl ticket keys rotation)
+			if (has_scroll && (legion_msg.scroll_len != node->scroll_len || (node->scroll_len > 0 && memcmp(legion_msg.scroll, node->scroll, node->scroll_len)))) {
+				uwsgi_wlock(ul->lock);
+				if (node->scroll_len) {
+					free(node->scroll);
+					node->scroll = NULL;
+				}
+				node->scroll_len = legion_msg.scroll_len;
+				if (node->scroll_len > 0) {
+					node->scroll = uwsgi_malloc(node->scroll_len);
+					memcpy(node->scroll, legion_msg.scroll, node->scroll_len);
+				}
+				uwsgi_rwunlock(ul->lock);
+				ul->scrolls_dirty = 1;
+			}
+
+			time_t now = uwsgi_now();
+			if (has_scroll) {
+				node->scroll_version = legion_msg.scroll_version;
+			}
+			// fetch the new scroll (at most once per round)
+			else if (legion_msg.scroll_version != node->scroll_version && now - node->scroll_requested >= uwsgi.legion_freq) {
+				node->scroll_requested = now;
+				legion_send(ul, LEGION_SEND_SCROLL_REQUEST | LEGION_SEND_OOB, (struct sockaddr *) &src, src_len);
+			}
+
+			if (legion_msg.scroll_request) {
+				legion_send(ul, LEGION_SEND_SCROLL | LEGION_SEND_OOB, (struct sockaddr *) &src, src_len);
+			}
+
+			legion_node_heartbeat(node, !legion_msg.oob);
 			node->lord_valor = legion_msg.lord_valor;
 			node->checksum = legion_msg.checksum;
 			memcpy(node->lord_uuid, legion_msg.lord_uuid, 36);
@@ -747,6 +910,19 @@ void uwsgi_start_legions() {
 	uwsgi_log("WARNING: you are not using libuuid to generate Legions UUID\n");
 #endif
 
+	if (uwsgi.ssl_tickets_legion) {
+		legion = uwsgi_legion_get_by_name(uwsgi.ssl_tickets_legion);
+		if (!legion) {
+			uwsgi_log("[uwsgi-legion] unable to find Legion %s for ssl session tickets\n", uwsgi.ssl_tickets_legion);
+			exit(1);
+		}
+		if (legion->scroll_len) {
+			uwsgi_log("[uwsgi-legion] Legion %s cannot have a scroll, it is used for ssl session tickets\n", legion->legion);
+			exit(1);
+		}
+		legion->ssl_tickets = 1;
+	}
+
 	if (pthread_create(&legion_loop_t, NULL, legion_loop, NULL)) {
 		uwsgi_error("pthread_create()");
 		uwsgi_log("unable to run the legion server !!!\n");
@@ -772,7 +948,22 @@ void uwsgi_legion_add(struct uwsgi_legion *ul) {
 	}
 }
 
+static int legion_announce(struct uwsgi_legion *ul, int flags) {
+	// in delta mode the scroll is pushed only when it changes
+	if (ul->scroll_version != ul->scroll_announced_version) {
+		flags |= LEGION_SEND_SCROLL;
+		ul->scroll_announced_version = ul->scroll_version;
+	}
+	return legion_send(ul, flags, NULL, 0);
+}
+
+// out of band announce (the periodic ones are sent by the legion loop)
 int uwsgi_legion_announce(struct uwsgi_legion *ul) {
+	return legion_announce(ul, LEGION_SEND_OOB);
+}
+
+// send an announce to the nodes of the legion (or only to addr)
+static int legion_send(struct uwsgi_legion *ul, int flags, struct sockaddr *addr, socklen_t addr_len) {
 	time_t now = uwsgi_now();
 
 	if (now <= ul->suspended_til) return 0;
@@ -802,7 +993,16 @@ int uwsgi_legion_announce(struct uwsgi_legion *ul) {
 	if (uwsgi_buffer_append_keyval(ub, "lord_uuid", 9, ul->lord_uuid, 36))
 		goto err;
 
-	if (ul->scroll_len > 0) {
+	if (uwsgi.legion_scroll_delta) {
+		if (uwsgi_buffer_append_keynum(ub, "scroll_version", 14, ul->scroll_version))
+			goto err;
+		if (flags & LEGION_SEND_SCROLL_REQUEST) {
+			if (uwsgi_buffer_append_keyval(ub, "scroll_request", 14, "1", 1))
+				goto err;
+		}
+	}
+
+	if (ul->scroll_len > 0 && (!uwsgi.legion_scroll_delta || (flags & LEGION_SEND_SCROLL))) {
 		if (uwsgi_buffer_append_keyval(ub, "scroll", 6, ul->scroll, ul->scroll_len))
                 	goto err;
 	}
@@ -812,6 +1012,11 @@ int uwsgi_legion_announce(struct uwsgi_legion *ul) {
                 	goto err;
 	}
 
+	if (flags & LEGION_SEND_OOB) {
+		if (uwsgi_buffer_append_keyval(ub, "oob", 3, "1", 1))
+			goto err;
+	}
+
 	encrypted = uwsgi_malloc(ub->pos + 4 + EVP_MAX_BLOCK_LENGTH);
 	if (EVP_EncryptInit_ex(ul->encrypt_ctx, NULL, NULL, NULL, NULL) <= 0) {
 		uwsgi_error("[uwsgi-legion] EVP_EncryptInit_ex()");
@@ -838,12 +1043,19 @@ int uwsgi_legion_announce(struct uwsgi_legion *ul) {
 	encrypted[2] = (unsigned char) ((pktsize >> 8) & 0xff);
 	encrypted[3] = 0;
 
-	struct uwsgi_string_list *usl = ul->nodes;
-	while (usl) {
-		if (sendto(ul->socket, encrypted, e_len + 4, 0, usl->custom_ptr, usl->custom) != e_len + 4) {
+	if (addr) {
+		if (sendto(ul->socket, encrypted, e_len + 4, 0, addr, addr_len) != e_len + 4) {
 			uwsgi_error("[uwsgi-legion] sendto()");
 		}
-		usl = usl->next;
+	}
+	else {
+		struct uwsgi_string_list *usl = ul->nodes;
+		while (usl) {
+			if (sendto(ul->socket, encrypted, e_len + 4, 0, usl->custom_ptr, usl->custom) != e_len + 4) {
+				uwsgi_error("[uwsgi-legion] sendto()");
+			}
+			usl = usl->next;
+		}
 	}
 
 	uwsgi_buffer_destroy(ub);
@@ -1148,6 +1360,7 @@ struct uwsgi_legion *uwsgi_legion_register(char *legion, char *addr, char *valor
 	ul->lord_scroll = uwsgi_calloc_shared(ul->lord_scroll_size);
 	ul->scrolls_max_size = uwsgi.legion_scroll_list_max_size;
 	ul->scrolls = uwsgi_calloc_shared(ul->scrolls_max_size);
+	ul->scrolls_dirty = 1;
 
 	uwsgi_legion_add(ul);
 
@@ -1233,6 +1446,14 @@ int uwsgi_legion_i_am_the_lord(char *name) {
 	return 0;
 }
 
+// the number of nodes (us included) seen in the last round, usable by workers too
+int uwsgi_legion_nodes(char *name) {
+	struct uwsgi_legion *legion = uwsgi_legion_get_by_name(name);
+	if (!legion) return 0;
+	if (legion->alive_nodes < 1) return 1;
+	return legion->alive_nodes;
+}
+
 char *uwsgi_legion_lord_scroll(char *name, uint16_t *rlen) {
 	char *buf = NULL;
 	struct uwsgi_legion *legion = uwsgi_legion_get_by_name(name);
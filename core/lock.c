@@ -6,7 +6,7 @@ static struct uwsgi_lock_item *uwsgi_register_lock(char *id, int rw) {
 
 	struct uwsgi_lock_item *uli = uwsgi.registered_locks;
 	if (!uli) {
-		uwsgi.registered_locks = uwsgi_malloc_shared(sizeof(struct uwsgi_lock_item));
+		uwsgi.registered_locks = uwsgi_calloc_shared(sizeof(struct uwsgi_lock_item));
 		uwsgi.registered_locks->id = id;
 		uwsgi.registered_locks->pid = 0;
 		if (rw) {
@@ -22,7 +22,7 @@ static struct uwsgi_lock_item *uwsgi_register_lock(char *id, int rw) {
 
 	while (uli) {
 		if (!uli->next) {
-			uli->next = uwsgi_malloc_shared(sizeof(struct uwsgi_lock_item));
+			uli->next = uwsgi_calloc_shared(sizeof(struct uwsgi_lock_item));
 			if (rw) {
 				uli->next->lock_ptr = uwsgi_malloc_shared(uwsgi.rwlock_size);
 			}
@@ -665,6 +665,191 @@ pid_t uwsgi_rwlock_ipcsem_check(struct uwsgi_lock_item *uli) {
 	return uwsgi_lock_ipcsem_check(uli);
 }
 
+#ifdef __linux__
+/*
+	futex based locks (--lock-engine futex or futex-rb)
+
+	the lock word lives in the shared memory area, the uncontended paths are a single atomic
+	operation and the kernel is entered only by waiters. Before sleeping, waiters spin for
+	a bounded number of iterations (--lock-spin, 0 on single cpu systems) adapted to the
+	time the lock has been required for the last acquisitions.
+
+	rwlocks prefer writers (new readers wait for the queued writers), futex-rb prefers readers.
+
+	As the locks are not robust, the holder pid is tracked for the deadlock detector.
+*/
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define UWSGI_FUTEX_WRITER 0x80000000
+
+struct uwsgi_futex_lock {
+	uint32_t state;
+	int32_t spins;
+};
+
+struct uwsgi_futex_rwlock {
+	// writer bit + number of readers
+	uint32_t state;
+	uint32_t writers_waiting;
+	// bumped on every release, the waiters sleep on it
+	uint32_t seq;
+	uint32_t waiters;
+	int32_t spins;
+};
+
+static int uwsgi_futex_reader_biased = 0;
+
+static void uwsgi_futex_wait(uint32_t *addr, uint32_t value) {
+	syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void uwsgi_futex_wake(uint32_t *addr, int n) {
+	syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+static inline void uwsgi_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// spin until try() succeeds or the adaptive limit is reached
+static int uwsgi_futex_spin(int32_t *spins, int (*try)(void *), void *lock) {
+	int32_t estimate = __atomic_load_n(spins, __ATOMIC_RELAXED);
+	int32_t limit = UMIN(uwsgi.lock_spin, estimate * 2 + 10);
+	int32_t i;
+	int ret = 0;
+	for(i=0;i<limit;i++) {
+		if (try(lock)) {
+			ret = 1;
+			break;
+		}
+		uwsgi_cpu_relax();
+	}
+	if (limit > 0) {
+		__atomic_store_n(spins, estimate + (i - estimate) / 8, __ATOMIC_RELAXED);
+	}
+	return ret;
+}
+
+static int uwsgi_futex_try_lock(void *lock) {
+	struct uwsgi_futex_lock *ufl = (struct uwsgi_futex_lock *) lock;
+	uint32_t c = 0;
+	if (__atomic_load_n(&ufl->state, __ATOMIC_RELAXED) != 0) return 0;
+	return __atomic_compare_exchange_n(&ufl->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static struct uwsgi_lock_item *uwsgi_lock_futex_init(char *id) {
+	struct uwsgi_lock_item *uli = uwsgi_register_lock(id, 0);
+	memset(uli->lock_ptr, 0, sizeof(struct uwsgi_futex_lock));
+	uli->can_deadlock = 1;
+	return uli;
+}
+
+/*
+	0 unlocked, 1 locked, 2 locked with (possible) waiters
+*/
+static void uwsgi_lock_futex(struct uwsgi_lock_item *uli) {
+	struct uwsgi_futex_lock *ufl = (struct uwsgi_futex_lock *) uli->lock_ptr;
+	uint32_t c = 0;
+	if (__atomic_compare_exchange_n(&ufl->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) goto locked;
+	if (uwsgi_futex_spin(&ufl->spins, uwsgi_futex_try_lock, ufl)) goto locked;
+	while (__atomic_exchange_n(&ufl->state, 2, __ATOMIC_ACQUIRE) != 0) {
+		uwsgi_futex_wait(&ufl->state, 2);
+	}
+locked:
+	uli->pid = uwsgi.mypid;
+}
+
+static void uwsgi_unlock_futex(struct uwsgi_lock_item *uli) {
+	struct uwsgi_futex_lock *ufl = (struct uwsgi_futex_lock *) uli->lock_ptr;
+	uli->pid = 0;
+	if (__atomic_exchange_n(&ufl->state, 0, __ATOMIC_RELEASE) == 2) {
+		uwsgi_futex_wake(&ufl->state, 1);
+	}
+}
+
+static pid_t uwsgi_lock_futex_check(struct uwsgi_lock_item *uli) {
+	struct uwsgi_futex_lock *ufl = (struct uwsgi_futex_lock *) uli->lock_ptr;
+	if (__atomic_load_n(&ufl->state, __ATOMIC_ACQUIRE) == 0) return 0;
+	return uli->pid;
+}
+
+static int uwsgi_futex_try_rlock(void *lock) {
+	struct uwsgi_futex_rwlock *ufr = (struct uwsgi_futex_rwlock *) lock;
+	uint32_t s = __atomic_load_n(&ufr->state, __ATOMIC_RELAXED);
+	if (s & UWSGI_FUTEX_WRITER) return 0;
+	if (!uwsgi_futex_reader_biased && __atomic_load_n(&ufr->writers_waiting, __ATOMIC_RELAXED)) return 0;
+	return __atomic_compare_exchange_n(&ufr->state, &s, s + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static int uwsgi_futex_try_wlock(void *lock) {
+	struct uwsgi_futex_rwlock *ufr = (struct uwsgi_futex_rwlock *) lock;
+	uint32_t s = 0;
+	if (__atomic_load_n(&ufr->state, __ATOMIC_RELAXED) != 0) return 0;
+	return __atomic_compare_exchange_n(&ufr->state, &s, UWSGI_FUTEX_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void uwsgi_futex_rwlock_acquire(struct uwsgi_futex_rwlock *ufr, int (*try)(void *), int writer) {
+	if (try(ufr)) return;
+	if (uwsgi_futex_spin(&ufr->spins, try, ufr)) return;
+	if (writer) __atomic_fetch_add(&ufr->writers_waiting, 1, __ATOMIC_SEQ_CST);
+	for(;;) {
+		uint32_t seq = __atomic_load_n(&ufr->seq, __ATOMIC_SEQ_CST);
+		if (try(ufr)) break;
+		__atomic_fetch_add(&ufr->waiters, 1, __ATOMIC_SEQ_CST);
+		// returns immediately if the lock has been released after reading seq
+		uwsgi_futex_wait(&ufr->seq, seq);
+		__atomic_fetch_sub(&ufr->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+	if (writer) __atomic_fetch_sub(&ufr->writers_waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+static struct uwsgi_lock_item *uwsgi_rwlock_futex_init(char *id) {
+	struct uwsgi_lock_item *uli = uwsgi_register_lock(id, 1);
+	memset(uli->lock_ptr, 0, sizeof(struct uwsgi_futex_rwlock));
+	uli->can_deadlock = 1;
+	return uli;
+}
+
+static void uwsgi_rlock_futex(struct uwsgi_lock_item *uli) {
+	uwsgi_futex_rwlock_acquire((struct uwsgi_futex_rwlock *) uli->lock_ptr, uwsgi_futex_try_rlock, 0);
+}
+
+static void uwsgi_wlock_futex(struct uwsgi_lock_item *uli) {
+	uwsgi_futex_rwlock_acquire((struct uwsgi_futex_rwlock *) uli->lock_ptr, uwsgi_futex_try_wlock, 1);
+	uli->pid = uwsgi.mypid;
+}
+
+static void uwsgi_rwunlock_futex(struct uwsgi_lock_item *uli) {
+	struct uwsgi_futex_rwlock *ufr = (struct uwsgi_futex_rwlock *) uli->lock_ptr;
+	uint32_t s = __atomic_load_n(&ufr->state, __ATOMIC_RELAXED);
+	if (s & UWSGI_FUTEX_WRITER) {
+		uli->pid = 0;
+		__atomic_store_n(&ufr->state, 0, __ATOMIC_RELEASE);
+	}
+	// the last reader wakes up the writers
+	else if (__atomic_sub_fetch(&ufr->state, 1, __ATOMIC_RELEASE) != 0) {
+		return;
+	}
+	__atomic_fetch_add(&ufr->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ufr->waiters, __ATOMIC_SEQ_CST)) {
+		uwsgi_futex_wake(&ufr->seq, INT_MAX);
+	}
+}
+
+// only the writers are tracked
+static pid_t uwsgi_rwlock_futex_check(struct uwsgi_lock_item *uli) {
+	struct uwsgi_futex_rwlock *ufr = (struct uwsgi_futex_rwlock *) uli->lock_ptr;
+	if (!(__atomic_load_n(&ufr->state, __ATOMIC_ACQUIRE) & UWSGI_FUTEX_WRITER)) return 0;
+	return uli->pid;
+}
+#endif
+
 /*
 	Unbit-specific workaround for robust-mutexes
 */
@@ -690,6 +875,48 @@ void uwsgi_robust_mutexes_watchdog() {
         }
 }
 
+/*
+	lock profiling (--lock-stats)
+
+	the engine functions are wrapped for counting acquisitions and the time spent waiting
+	for the lock. Acquisitions taking more than 1 microsecond are considered contended
+	(an uncontended lock is a single atomic operation) and only their wait time is accounted.
+*/
+static struct uwsgi_lock_ops uwsgi_lock_engine_ops;
+
+static uint64_t uwsgi_lock_nanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void uwsgi_lock_account(struct uwsgi_lock_item *uli, uint64_t start) {
+	uint64_t wait = uwsgi_lock_nanos() - start;
+	__atomic_fetch_add(&uli->acquisitions, 1, __ATOMIC_RELAXED);
+	if (wait > 1000) {
+		__atomic_fetch_add(&uli->contended, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&uli->wait_us, wait / 1000, __ATOMIC_RELAXED);
+	}
+}
+
+static void uwsgi_lock_profiled(struct uwsgi_lock_item *uli) {
+	uint64_t start = uwsgi_lock_nanos();
+	uwsgi_lock_engine_ops.lock(uli);
+	uwsgi_lock_account(uli, start);
+}
+
+static void uwsgi_rlock_profiled(struct uwsgi_lock_item *uli) {
+	uint64_t start = uwsgi_lock_nanos();
+	uwsgi_lock_engine_ops.rlock(uli);
+	uwsgi_lock_account(uli, start);
+}
+
+static void uwsgi_wlock_profiled(struct uwsgi_lock_item *uli) {
+	uint64_t start = uwsgi_lock_nanos();
+	uwsgi_lock_engine_ops.wlock(uli);
+	uwsgi_lock_account(uli, start);
+}
+
 void uwsgi_setup_locking() {
 
 	int i;
@@ -714,6 +941,26 @@ void uwsgi_setup_locking() {
 			uwsgi.rwlock_size = 8;
 			goto ready;
 		}
+#ifdef __linux__
+		if (!strcmp(uwsgi.lock_engine, "futex") || !strcmp(uwsgi.lock_engine, "futex-rb")) {
+			uwsgi_futex_reader_biased = !strcmp(uwsgi.lock_engine, "futex-rb");
+			// spinning is useless without another cpu releasing the lock
+			if (uwsgi.cpus < 2) uwsgi.lock_spin = 0;
+			uwsgi_log_initial("lock engine: %s (spin: %d)\n", uwsgi_futex_reader_biased ? "futex, reader-biased rwlocks" : "futex", uwsgi.lock_spin);
+			uwsgi.lock_ops.lock_init = uwsgi_lock_futex_init;
+			uwsgi.lock_ops.lock_check = uwsgi_lock_futex_check;
+			uwsgi.lock_ops.lock = uwsgi_lock_futex;
+			uwsgi.lock_ops.unlock = uwsgi_unlock_futex;
+			uwsgi.lock_ops.rwlock_init = uwsgi_rwlock_futex_init;
+			uwsgi.lock_ops.rwlock_check = uwsgi_rwlock_futex_check;
+			uwsgi.lock_ops.rlock = uwsgi_rlock_futex;
+			uwsgi.lock_ops.wlock = uwsgi_wlock_futex;
+			uwsgi.lock_ops.rwunlock = uwsgi_rwunlock_futex;
+			uwsgi.lock_size = sizeof(struct uwsgi_futex_lock);
+			uwsgi.rwlock_size = sizeof(struct uwsgi_futex_rwlock);
+			goto ready;
+		}
+#endif
 		uwsgi_log("unable to find lock engine \"%s\"\n", uwsgi.lock_engine);
 		exit(1);
 	}
@@ -735,6 +982,13 @@ void uwsgi_setup_locking() {
 	uwsgi.rwlock_size = UWSGI_RWLOCK_SIZE;
 
 ready:
+	if (uwsgi.lock_stats) {
+		uwsgi_lock_engine_ops = uwsgi.lock_ops;
+		uwsgi.lock_ops.lock = uwsgi_lock_profiled;
+		uwsgi.lock_ops.rlock = uwsgi_rlock_profiled;
+		uwsgi.lock_ops.wlock = uwsgi_wlock_profiled;
+	}
+
 	// application generic lock
 	uwsgi.user_lock = uwsgi_malloc(sizeof(void *) * (uwsgi.locks + 1));
 	for (i = 0; i < uwsgi.locks + 1; i++) {
@@ -234,6 +234,16 @@ void create_logpipe(void) {
 		uwsgi_socket_nb(uwsgi.shared->worker_req_log_pipe[0]);
 		uwsgi_socket_nb(uwsgi.shared->worker_req_log_pipe[1]);
 		uwsgi.req_log_fd = uwsgi.shared->worker_req_log_pipe[1];
+
+		// the doorbell of the request log rings
+		if (uwsgi.req_log_ring) {
+			if (socketpair(AF_UNIX, SOCK_DGRAM, 0, uwsgi.shared->req_log_ring_pipe)) {
+				uwsgi_error("create_logpipe()/socketpair()\n");
+				exit(1);
+			}
+			uwsgi_socket_nb(uwsgi.shared->req_log_ring_pipe[0]);
+			uwsgi_socket_nb(uwsgi.shared->req_log_ring_pipe[1]);
+		}
 	}
 
 }
@@ -428,6 +438,8 @@ void uwsgi_setup_log_master(void) {
 	}
 #endif
 
+	uwsgi_log_async_setup();
+
 	uwsgi.original_log_fd = dup(1);
 	create_logpipe();
 }
@@ -458,7 +470,7 @@ void uwsgi_logvar_add(struct wsgi_request *wsgi_req, char *key, uint8_t keylen,
 	if (lv) {
 		while (lv) {
 			if (!lv->next) {
-				lv->next = uwsgi_malloc(sizeof(struct uwsgi_logvar));
+				lv->next = uwsgi_req_alloc(wsgi_req, sizeof(struct uwsgi_logvar));
 				lv = lv->next;
 				break;
 			}
@@ -466,7 +478,7 @@ void uwsgi_logvar_add(struct wsgi_request *wsgi_req, char *key, uint8_t keylen,
 		}
 	}
 	else {
-		lv = uwsgi_malloc(sizeof(struct uwsgi_logvar));
+		lv = uwsgi_req_alloc(wsgi_req, sizeof(struct uwsgi_logvar));
 		wsgi_req->logvars = lv;
 	}
 
@@ -601,6 +613,37 @@ void uwsgi_log_reopen() {
 }
 
 
+/*
+	sampling (--log-sample) and rate limiting (--log-rate-limit) are applied before the line is built,
+	so dropped requests do not pay for formatting. The rate limit is a token bucket per core (no locking),
+	refilled with the time of the end of the request (no additional syscall).
+*/
+static int log_request_drop(struct wsgi_request *wsgi_req) {
+	struct uwsgi_core *uc = &uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id];
+	if (uwsgi.logging_options.sample > 1) {
+		if (uc->log_sampled++ % uwsgi.logging_options.sample) goto drop;
+	}
+	if (uwsgi.logging_options.rate_limit) {
+		// tokens are in millionths, a bucket holds one second of lines
+		uint64_t max_tokens = uwsgi.logging_options.rate_limit * 1000000;
+		uint64_t now = wsgi_req->end_of_request;
+		if (!uc->log_tokens_ts) {
+			uc->log_tokens = max_tokens;
+		}
+		else if (now > uc->log_tokens_ts) {
+			uc->log_tokens += (now - uc->log_tokens_ts) * uwsgi.logging_options.rate_limit;
+			if (uc->log_tokens > max_tokens) uc->log_tokens = max_tokens;
+		}
+		uc->log_tokens_ts = now;
+		if (uc->log_tokens < 1000000) goto drop;
+		uc->log_tokens -= 1000000;
+	}
+	return 0;
+drop:
+	uc->log_dropped++;
+	return 1;
+}
+
 void log_request(struct wsgi_request *wsgi_req) {
 
 	int log_it = uwsgi.logging_options.enabled;
@@ -638,11 +681,93 @@ void log_request(struct wsgi_request *wsgi_req) {
 	if (!log_it)
 		return;
 
+	if (uwsgi.logging_options.sample || uwsgi.logging_options.rate_limit) {
+		if (log_request_drop(wsgi_req))
+			return;
+	}
+
 logit:
 
 	uwsgi.logit(wsgi_req);
 }
 
+/*
+
+	request log rings (--req-log-ring <size>)
+
+	instead of a write() on the request logpipe for each request, every core of the workers appends
+	its log lines to a shared memory ring (single producer, the core, single consumer, the master or the
+	threaded logger). The consumer is woken up (with a datagram on req_log_ring_pipe) only when a line is
+	added to a ring it has already drained, then it drains all of the rings in a batch: when no encoder
+	or log route is configured and all of the request loggers are stream based, the lines are passed
+	to the loggers in a single message (a single write() for file, fd, stdio and pipe loggers).
+
+	When a ring is full the line is written to the logpipe as before.
+
+*/
+
+// copy data in (or out of) a ring at the specified (absolute) position, wrapping around the end
+static void req_log_ring_copy_in(struct uwsgi_log_ring *ring, uint64_t pos, char *buf, size_t len) {
+	size_t offset = pos % ring->size;
+	size_t chunk = ring->size - offset;
+	if (chunk > len) chunk = len;
+	memcpy(ring->buf + offset, buf, chunk);
+	if (len > chunk) memcpy(ring->buf, buf + chunk, len - chunk);
+}
+
+static void req_log_ring_copy_out(struct uwsgi_log_ring *ring, uint64_t pos, char *buf, size_t len) {
+	size_t offset = pos % ring->size;
+	size_t chunk = ring->size - offset;
+	if (chunk > len) chunk = len;
+	memcpy(buf, ring->buf + offset, chunk);
+	if (len > chunk) memcpy(buf + chunk, ring->buf, len - chunk);
+}
+
+static int req_log_ring_push(struct wsgi_request *wsgi_req, struct iovec *iov, int cnt) {
+	if (uwsgi.mywid == 0) return -1;
+	struct uwsgi_log_ring *ring = uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].req_log_ring;
+	if (!ring) return -1;
+
+	size_t len = 0;
+	int i;
+	for (i = 0; i < cnt; i++) len += iov[i].iov_len;
+	// lines are truncated like the logpipe reader does
+	if (len > uwsgi.log_master_bufsize) len = uwsgi.log_master_bufsize;
+
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (ring->size - (head - tail) < len + 4) return -1;
+
+	uint32_t len32 = len;
+	req_log_ring_copy_in(ring, head, (char *) &len32, 4);
+	uint64_t pos = head + 4;
+	size_t remains = len;
+	for (i = 0; i < cnt && remains > 0; i++) {
+		size_t chunk = iov[i].iov_len;
+		if (chunk > remains) chunk = remains;
+		req_log_ring_copy_in(ring, pos, iov[i].iov_base, chunk);
+		pos += chunk;
+		remains -= chunk;
+	}
+	__atomic_store_n(&ring->head, pos, __ATOMIC_SEQ_CST);
+
+	// the consumer could have drained the ring before this line, wake it up
+	// (it re-checks the head after publishing the tail, so no wakeup is lost)
+	if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head) {
+		char bell = 0;
+		// a full doorbell means wakeups are already pending
+		if (write(uwsgi.shared->req_log_ring_pipe[1], &bell, 1) < 0) return 0;
+	}
+	return 0;
+}
+
+static void req_log_write(struct wsgi_request *wsgi_req, struct iovec *iov, int cnt) {
+	if (uwsgi.req_log_ring && !req_log_ring_push(wsgi_req, iov, cnt)) return;
+	// do not check for errors
+	ssize_t rlen = writev(uwsgi.req_log_fd, iov, cnt);
+	(void) rlen;
+}
+
 void uwsgi_logit_simple(struct wsgi_request *wsgi_req) {
 
 	// optimize this (please)
@@ -755,8 +880,7 @@ void uwsgi_logit_simple(struct wsgi_request *wsgi_req) {
 	logvec[logvecpos].iov_base = logpkt;
 	logvec[logvecpos].iov_len = rlen;
 
-	// do not check for errors
-	rlen = writev(uwsgi.req_log_fd, logvec, logvecpos + 1);
+	req_log_write(wsgi_req, logvec, logvecpos + 1);
 }
 
 void get_memusage(uint64_t * rss, uint64_t * vsz) {
@@ -879,8 +1003,11 @@ void get_memusage(uint64_t * rss, uint64_t * vsz) {
 }
 
 #ifdef __linux__
-void get_memusage_extra(uint64_t * uss, uint64_t * pss) {
-	FILE *file = fopen("/proc/self/smaps", "r");
+void get_memusage_extra(uint64_t * uss, uint64_t * pss, uint64_t * shared) {
+	// smaps_rollup (Linux 4.14+) is way cheaper than walking all the mappings
+	FILE *file = fopen("/proc/self/smaps_rollup", "r");
+	if (!file) file = fopen("/proc/self/smaps", "r");
+	if (!file) return;
 
 	char line [BUFSIZ];
 	while (fgets(line, sizeof line, file)) {
@@ -894,13 +1021,17 @@ void get_memusage_extra(uint64_t * uss, uint64_t * pss) {
 				*uss += n * 1024;
 			else if (strcmp(substr, "Pss") == 0)
 				*pss += n * 1024;
+			else if (strcmp(substr, "Shared_Clean") == 0)
+				*shared += n * 1024;
+			else if (strcmp(substr, "Shared_Dirty") == 0)
+				*shared += n * 1024;
 		}
 	}
 	fclose(file);
 }
 #endif
 
-void uwsgi_register_logger(char *name, ssize_t(*func) (struct uwsgi_logger *, char *, size_t)) {
+struct uwsgi_logger *uwsgi_register_logger(char *name, ssize_t(*func) (struct uwsgi_logger *, char *, size_t)) {
 
 	struct uwsgi_logger *ul = uwsgi.loggers, *old_ul;
 
@@ -925,11 +1056,15 @@ void uwsgi_register_logger(char *name, ssize_t(*func) (struct uwsgi_logger *, ch
 	ul->fd = -1;
 	ul->data = NULL;
 	ul->buf = NULL;
+	ul->stream = 0;
+	ul->batch_max = 0;
+	ul->async = NULL;
 
 
 #ifdef UWSGI_DEBUG
 	uwsgi_log("[uwsgi-logger] registered \"%s\"\n", ul->name);
 #endif
+	return ul;
 }
 
 void uwsgi_append_logger(struct uwsgi_logger *ul) {
@@ -994,44 +1129,77 @@ struct uwsgi_logger *uwsgi_get_logger_from_id(char *id) {
 }
 
 
+// room for a rendered int64_t (sign included)
+#define UWSGI_LF_NUM_LEN 24
+
+// render a number at the end of a UWSGI_LF_NUM_LEN slot, returns the start of the string
+static char *uwsgi_lf_num2str(char *slot, int64_t num, size_t *len) {
+	char *ptr = slot + UWSGI_LF_NUM_LEN;
+	uint64_t n = num < 0 ? -((uint64_t) num) : (uint64_t) num;
+	do {
+		*--ptr = '0' + (n % 10);
+		n /= 10;
+	} while (n);
+	if (num < 0)
+		*--ptr = '-';
+	*len = (slot + UWSGI_LF_NUM_LEN) - ptr;
+	return ptr;
+}
+
 void uwsgi_logit_lf(struct wsgi_request *wsgi_req) {
 	struct uwsgi_logchunk *logchunk = uwsgi.logchunks;
+	struct iovec *vec = uwsgi.logvectors[wsgi_req->async_id];
+	char *buf = uwsgi.logbuffers ? uwsgi.logbuffers[wsgi_req->async_id] : NULL;
+	int need_free = 0;
 	ssize_t rlen = 0;
 	const char *empty_var = "-";
 	while (logchunk) {
 		int pos = logchunk->vec;
 		// raw string
 		if (logchunk->type == 0) {
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = logchunk->ptr;
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = logchunk->len;
+			vec[pos].iov_base = logchunk->ptr;
+			vec[pos].iov_len = logchunk->len;
+			logchunk = logchunk->next;
+			continue;
 		}
 		// offsetof
 		else if (logchunk->type == 1) {
 			char **var = (char **) (((char *) wsgi_req) + logchunk->pos);
 			uint16_t *varlen = (uint16_t *) (((char *) wsgi_req) + logchunk->pos_len);
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = *var;
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = *varlen;
+			vec[pos].iov_base = *var;
+			vec[pos].iov_len = *varlen;
+		}
+		// number
+		else if (logchunk->type == 6) {
+			vec[pos].iov_base = uwsgi_lf_num2str(buf + logchunk->buf_pos, logchunk->num(wsgi_req), &vec[pos].iov_len);
+		}
+		// rendered in the per-core buffer
+		else if (logchunk->type == 7) {
+			vec[pos].iov_base = buf + logchunk->buf_pos;
+			rlen = logchunk->render(wsgi_req, buf + logchunk->buf_pos, logchunk->render_len);
+			vec[pos].iov_len = rlen > 0 ? rlen : 0;
 		}
 		// logvar
 		else if (logchunk->type == 2) {
 			struct uwsgi_logvar *lv = uwsgi_logvar_get(wsgi_req, logchunk->ptr, logchunk->len);
 			if (lv) {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = lv->val;
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = lv->vallen;
+				vec[pos].iov_base = lv->val;
+				vec[pos].iov_len = lv->vallen;
 			}
 			else {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = NULL;
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = 0;
+				vec[pos].iov_base = NULL;
+				vec[pos].iov_len = 0;
 			}
 		}
 		// func
 		else if (logchunk->type == 3) {
-			rlen = logchunk->func(wsgi_req, (char **) &uwsgi.logvectors[wsgi_req->async_id][pos].iov_base);
+			rlen = logchunk->func(wsgi_req, (char **) &vec[pos].iov_base);
 			if (rlen > 0) {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = rlen;
+				vec[pos].iov_len = rlen;
+				if (logchunk->free) need_free = 1;
 			}
 			else {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = 0;
+				vec[pos].iov_len = 0;
 			}
 		}
 		// var
@@ -1039,38 +1207,123 @@ void uwsgi_logit_lf(struct wsgi_request *wsgi_req) {
 			uint16_t value_len = 0;
 			char *value = uwsgi_get_var(wsgi_req, logchunk->ptr, logchunk->len, &value_len);
 			// could be NULL
-                        uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = value;
-                        uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = (size_t) value_len;
-                }
+			vec[pos].iov_base = value;
+			vec[pos].iov_len = (size_t) value_len;
+		}
 		// metric
 		else if (logchunk->type == 4) {
 			int64_t metric = uwsgi_metric_get(logchunk->ptr, NULL);
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = uwsgi_64bit2str(metric);
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = strlen(uwsgi.logvectors[wsgi_req->async_id][pos].iov_base);
+			vec[pos].iov_base = uwsgi_lf_num2str(buf + logchunk->buf_pos, metric, &vec[pos].iov_len);
 		}
 
-		if (uwsgi.logvectors[wsgi_req->async_id][pos].iov_len == 0 && logchunk->type != 0) {
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = (char *) empty_var;
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = 1;
+		if (vec[pos].iov_len == 0) {
+			vec[pos].iov_base = (char *) empty_var;
+			vec[pos].iov_len = 1;
 		}
 		logchunk = logchunk->next;
 	}
 
-	// do not check for errors
-	rlen = writev(uwsgi.req_log_fd, uwsgi.logvectors[wsgi_req->async_id], uwsgi.logformat_vectors);
+	req_log_write(wsgi_req, vec, uwsgi.logformat_vectors);
+
+	if (!need_free) return;
 
-	// free allocated memory
+	// free memory allocated by func chunks
 	logchunk = uwsgi.logchunks;
 	while (logchunk) {
-		if (logchunk->free) {
-			if (uwsgi.logvectors[wsgi_req->async_id][logchunk->vec].iov_len > 0) {
-				if (uwsgi.logvectors[wsgi_req->async_id][logchunk->vec].iov_base != empty_var) {
-					free(uwsgi.logvectors[wsgi_req->async_id][logchunk->vec].iov_base);
-				}
+		if (logchunk->type == 3 && logchunk->free) {
+			if (vec[logchunk->vec].iov_base != empty_var) {
+				free(vec[logchunk->vec].iov_base);
+			}
+		}
+		logchunk = logchunk->next;
+	}
+}
+
+/*
+	--logformat-msgpack: the variables of the logformat are sent as a msgpack map (name -> value),
+	numbers as msgpack integers, so collectors do not need to parse text lines. Raw text is ignored.
+*/
+void uwsgi_logit_lf_msgpack(struct wsgi_request *wsgi_req) {
+	struct uwsgi_logchunk *logchunk = uwsgi.logchunks;
+	struct uwsgi_buffer *ub = uwsgi.logformat_ub[wsgi_req->async_id];
+	char *buf = uwsgi.logbuffers ? uwsgi.logbuffers[wsgi_req->async_id] : NULL;
+	uint32_t items = 0;
+	ub->pos = 0;
+
+	while (logchunk) {
+		if (logchunk->type != 0) items++;
+		logchunk = logchunk->next;
+	}
+	if (uwsgi_buffer_msgpack_map(ub, items)) return;
+
+	logchunk = uwsgi.logchunks;
+	while (logchunk) {
+		char *value = NULL;
+		ssize_t value_len = 0;
+		if (logchunk->type == 0) {
+			logchunk = logchunk->next;
+			continue;
+		}
+		if (uwsgi_buffer_msgpack_str(ub, logchunk->ptr, logchunk->len)) return;
+		// offsetof
+		if (logchunk->type == 1) {
+			value = *(char **) (((char *) wsgi_req) + logchunk->pos);
+			value_len = *(uint16_t *) (((char *) wsgi_req) + logchunk->pos_len);
+		}
+		// number
+		else if (logchunk->type == 6) {
+			if (uwsgi_buffer_msgpack_int(ub, logchunk->num(wsgi_req))) return;
+			goto next;
+		}
+		// metric
+		else if (logchunk->type == 4) {
+			if (uwsgi_buffer_msgpack_int(ub, uwsgi_metric_get(logchunk->ptr, NULL))) return;
+			goto next;
+		}
+		// rendered in the per-core buffer
+		else if (logchunk->type == 7) {
+			value = buf + logchunk->buf_pos;
+			value_len = logchunk->render(wsgi_req, value, logchunk->render_len);
+		}
+		// logvar
+		else if (logchunk->type == 2) {
+			struct uwsgi_logvar *lv = uwsgi_logvar_get(wsgi_req, logchunk->ptr, logchunk->len);
+			if (lv) {
+				value = lv->val;
+				value_len = lv->vallen;
 			}
 		}
+		// func
+		else if (logchunk->type == 3) {
+			value_len = logchunk->func(wsgi_req, &value);
+			if (value_len > 0) {
+				int ret = uwsgi_buffer_msgpack_str(ub, value, value_len);
+				if (logchunk->free) free(value);
+				if (ret) return;
+				goto next;
+			}
+		}
+		// var
+		else if (logchunk->type == 5) {
+			uint16_t var_len = 0;
+			value = uwsgi_get_var(wsgi_req, logchunk->ptr, logchunk->len, &var_len);
+			value_len = var_len;
+		}
+
+		if (value && value_len > 0) {
+			if (uwsgi_buffer_msgpack_str(ub, value, value_len)) return;
+		}
+		else {
+			if (uwsgi_buffer_msgpack_nil(ub)) return;
+		}
+next:
 		logchunk = logchunk->next;
 	}
+
+	struct iovec iov;
+	iov.iov_base = ub->buf;
+	iov.iov_len = ub->pos;
+	req_log_write(wsgi_req, &iov, 1);
 }
 
 void uwsgi_build_log_format(char *format) {
@@ -1123,181 +1376,174 @@ void uwsgi_build_log_format(char *format) {
 
 }
 
-static ssize_t uwsgi_lf_status(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->status);
-	return strlen(*buf);
+static int64_t uwsgi_lf_status(struct wsgi_request *wsgi_req) {
+	return wsgi_req->status;
 }
 
-static ssize_t uwsgi_lf_rsize(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_size2str(wsgi_req->response_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rsize(struct wsgi_request *wsgi_req) {
+	return wsgi_req->response_size;
 }
 
-static ssize_t uwsgi_lf_hsize(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_size2str(wsgi_req->headers_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_hsize(struct wsgi_request *wsgi_req) {
+	return wsgi_req->headers_size;
 }
 
-static ssize_t uwsgi_lf_size(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_size2str(wsgi_req->headers_size+wsgi_req->response_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_size(struct wsgi_request *wsgi_req) {
+	return wsgi_req->headers_size+wsgi_req->response_size;
 }
 
-static ssize_t uwsgi_lf_cl(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->post_cl);
-	return strlen(*buf);
+static int64_t uwsgi_lf_cl(struct wsgi_request *wsgi_req) {
+	return wsgi_req->post_cl;
 }
 
 
-static ssize_t uwsgi_lf_epoch(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi_now());
-	return strlen(*buf);
+static int64_t uwsgi_lf_epoch(struct wsgi_request * wsgi_req) {
+	return uwsgi_now();
 }
 
-static ssize_t uwsgi_lf_ctime(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_malloc(26);
+static ssize_t uwsgi_lf_ctime(struct wsgi_request * wsgi_req, char *buf, size_t len) {
 #if defined(__sun__) && !defined(__clang__)
-	ctime_r((const time_t *) &wsgi_req->start_of_request_in_sec, *buf, 26);
+	ctime_r((const time_t *) &wsgi_req->start_of_request_in_sec, buf, len);
 #else
-	ctime_r((const time_t *) &wsgi_req->start_of_request_in_sec, *buf);
+	ctime_r((const time_t *) &wsgi_req->start_of_request_in_sec, buf);
 #endif
 	return 24;
 }
 
-static ssize_t uwsgi_lf_time(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->start_of_request / 1000000);
-	return strlen(*buf);
+static int64_t uwsgi_lf_time(struct wsgi_request * wsgi_req) {
+	return wsgi_req->start_of_request / 1000000;
 }
 
 
-static ssize_t uwsgi_lf_ltime(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_malloc(64);
+static ssize_t uwsgi_lf_ltime(struct wsgi_request * wsgi_req, char *buf, size_t len) {
+	struct tm tm;
 	time_t now = wsgi_req->start_of_request / 1000000;
-	size_t ret = strftime(*buf, 64, "%d/%b/%Y:%H:%M:%S %z", localtime(&now));
-	if (ret == 0) {
-		*buf[0] = 0;
-		return 0;
-	}
-	return ret;
+	// localtime_r() does not re-read the timezone at every call
+	return strftime(buf, len, "%d/%b/%Y:%H:%M:%S %z", localtime_r(&now, &tm));
 }
 
-static ssize_t uwsgi_lf_ftime(struct wsgi_request * wsgi_req, char **buf) {
+static ssize_t uwsgi_lf_ftime(struct wsgi_request * wsgi_req, char *buf, size_t len) {
 	if (!uwsgi.logformat_strftime || !uwsgi.log_strftime) {
-		return uwsgi_lf_ltime(wsgi_req, buf);
+		return uwsgi_lf_ltime(wsgi_req, buf, len);
 	}
-	*buf = uwsgi_malloc(64);
+	struct tm tm;
 	time_t now = wsgi_req->start_of_request / 1000000;
-	size_t ret = strftime(*buf, 64, uwsgi.log_strftime, localtime(&now));
-	if (ret == 0) {
-		*buf[0] = 0;
-		return 0;
-	}
-	return ret;
+	return strftime(buf, len, uwsgi.log_strftime, localtime_r(&now, &tm));
+}
+
+static int64_t uwsgi_lf_tmsecs(struct wsgi_request * wsgi_req) {
+	return wsgi_req->start_of_request / (int64_t) 1000;
+}
+
+static int64_t uwsgi_lf_tmicros(struct wsgi_request * wsgi_req) {
+	return wsgi_req->start_of_request;
+}
+
+static int64_t uwsgi_lf_micros(struct wsgi_request * wsgi_req) {
+	return wsgi_req->end_of_request - wsgi_req->start_of_request;
+}
+
+static int64_t uwsgi_lf_msecs(struct wsgi_request * wsgi_req) {
+	return (wsgi_req->end_of_request - wsgi_req->start_of_request) / 1000;
+}
+
+static ssize_t uwsgi_lf_secs(struct wsgi_request * wsgi_req, char *buf, size_t len) {
+	int ret = snprintf(buf, len, "%f", (float) ((wsgi_req->end_of_request - wsgi_req->start_of_request) / 1000000.0));
+	if (ret <= 0) return 0;
+	return (size_t) ret < len ? (size_t) ret : len - 1;
 }
 
-static ssize_t uwsgi_lf_tmsecs(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_64bit2str(wsgi_req->start_of_request / (int64_t) 1000);
-	return strlen(*buf);
+// latency breakdown
+static int64_t uwsgi_lf_headers_micros(struct wsgi_request * wsgi_req) {
+	uint64_t headers, body, app, first_byte;
+	uwsgi_req_latency(wsgi_req, &headers, &body, &app, &first_byte);
+	return headers;
 }
 
-static ssize_t uwsgi_lf_tmicros(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_64bit2str(wsgi_req->start_of_request);
-	return strlen(*buf);
+static int64_t uwsgi_lf_body_micros(struct wsgi_request * wsgi_req) {
+	uint64_t headers, body, app, first_byte;
+	uwsgi_req_latency(wsgi_req, &headers, &body, &app, &first_byte);
+	return body;
 }
 
-static ssize_t uwsgi_lf_micros(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->end_of_request - wsgi_req->start_of_request);
-	return strlen(*buf);
+static int64_t uwsgi_lf_app_micros(struct wsgi_request * wsgi_req) {
+	uint64_t headers, body, app, first_byte;
+	uwsgi_req_latency(wsgi_req, &headers, &body, &app, &first_byte);
+	return app;
 }
 
-static ssize_t uwsgi_lf_msecs(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str((wsgi_req->end_of_request - wsgi_req->start_of_request) / 1000);
-	return strlen(*buf);
+static int64_t uwsgi_lf_ttfb_micros(struct wsgi_request * wsgi_req) {
+	uint64_t headers, body, app, first_byte;
+	uwsgi_req_latency(wsgi_req, &headers, &body, &app, &first_byte);
+	return first_byte;
 }
 
-static ssize_t uwsgi_lf_secs(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_float2str((wsgi_req->end_of_request - wsgi_req->start_of_request) / 1000000.0);
-	return strlen(*buf);
+static int64_t uwsgi_lf_queue_micros(struct wsgi_request * wsgi_req) {
+	return wsgi_req->queue_time;
 }
 
-static ssize_t uwsgi_lf_pid(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.mypid);
-	return strlen(*buf);
+static int64_t uwsgi_lf_pid(struct wsgi_request * wsgi_req) {
+	return uwsgi.mypid;
 }
 
-static ssize_t uwsgi_lf_wid(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.mywid);
-	return strlen(*buf);
+static int64_t uwsgi_lf_wid(struct wsgi_request * wsgi_req) {
+	return uwsgi.mywid;
 }
 
-static ssize_t uwsgi_lf_switches(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->switches);
-	return strlen(*buf);
+static int64_t uwsgi_lf_switches(struct wsgi_request * wsgi_req) {
+	return wsgi_req->switches;
 }
 
-static ssize_t uwsgi_lf_vars(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->var_cnt);
-	return strlen(*buf);
+static int64_t uwsgi_lf_vars(struct wsgi_request * wsgi_req) {
+	return wsgi_req->var_cnt;
 }
 
-static ssize_t uwsgi_lf_core(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->async_id);
-	return strlen(*buf);
+static int64_t uwsgi_lf_core(struct wsgi_request * wsgi_req) {
+	return wsgi_req->async_id;
 }
 
-static ssize_t uwsgi_lf_vsz(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].vsz_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_vsz(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].vsz_size;
 }
 
-static ssize_t uwsgi_lf_rss(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].rss_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rss(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].rss_size;
 }
 
-static ssize_t uwsgi_lf_vszM(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].vsz_size / 1024 / 1024);
-	return strlen(*buf);
+static int64_t uwsgi_lf_vszM(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].vsz_size / 1024 / 1024;
 }
 
-static ssize_t uwsgi_lf_rssM(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].rss_size / 1024 / 1024);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rssM(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].rss_size / 1024 / 1024;
 }
 
-static ssize_t uwsgi_lf_pktsize(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->len);
-	return strlen(*buf);
+static int64_t uwsgi_lf_pktsize(struct wsgi_request * wsgi_req) {
+	return wsgi_req->len;
 }
 
-static ssize_t uwsgi_lf_modifier1(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->uh->modifier1);
-	return strlen(*buf);
+static int64_t uwsgi_lf_modifier1(struct wsgi_request * wsgi_req) {
+	return wsgi_req->uh->modifier1;
 }
 
-static ssize_t uwsgi_lf_modifier2(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->uh->modifier2);
-	return strlen(*buf);
+static int64_t uwsgi_lf_modifier2(struct wsgi_request * wsgi_req) {
+	return wsgi_req->uh->modifier2;
 }
 
-static ssize_t uwsgi_lf_headers(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->header_cnt);
-	return strlen(*buf);
+static int64_t uwsgi_lf_headers(struct wsgi_request * wsgi_req) {
+	return wsgi_req->header_cnt;
 }
 
-static ssize_t uwsgi_lf_werr(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str((int) wsgi_req->write_errors);
-	return strlen(*buf);
+static int64_t uwsgi_lf_werr(struct wsgi_request * wsgi_req) {
+	return wsgi_req->write_errors;
 }
 
-static ssize_t uwsgi_lf_rerr(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str((int) wsgi_req->read_errors);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rerr(struct wsgi_request * wsgi_req) {
+	return wsgi_req->read_errors;
 }
 
-static ssize_t uwsgi_lf_ioerr(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str((int) (wsgi_req->write_errors + wsgi_req->read_errors));
-	return strlen(*buf);
+static int64_t uwsgi_lf_ioerr(struct wsgi_request * wsgi_req) {
+	return wsgi_req->write_errors + wsgi_req->read_errors;
 }
 
 struct uwsgi_logchunk *uwsgi_register_logchunk(char *name, ssize_t (*func)(struct wsgi_request *, char **), int need_free) {
@@ -1322,6 +1568,23 @@ found:
 	return logchunk;
 }
 
+// numeric chunks are rendered without allocations in the per-core buffer
+struct uwsgi_logchunk *uwsgi_register_logchunk_num(char *name, int64_t (*func)(struct wsgi_request *)) {
+	struct uwsgi_logchunk *logchunk = uwsgi_register_logchunk(name, NULL, 0);
+	logchunk->num = func;
+	logchunk->type = 6;
+	return logchunk;
+}
+
+// the func writes at most len bytes in the per-core buffer and returns the size of the chunk
+struct uwsgi_logchunk *uwsgi_register_logchunk_render(char *name, ssize_t (*func)(struct wsgi_request *, char *, size_t), size_t len) {
+	struct uwsgi_logchunk *logchunk = uwsgi_register_logchunk(name, NULL, 0);
+	logchunk->render = func;
+	logchunk->render_len = len;
+	logchunk->type = 7;
+	return logchunk;
+}
+
 struct uwsgi_logchunk *uwsgi_get_logchunk_by_name(char *name, size_t name_len) {
 	struct uwsgi_logchunk *logchunk = uwsgi.registered_logchunks;
 	while(logchunk) {
@@ -1359,6 +1622,8 @@ void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
 	   3 -> func
 	   4 -> metric
 	   5 -> request variable
+	   6 -> number
+	   7 -> rendered in the per-core buffer
 	 */
 
 	logchunk->type = variable;
@@ -1379,6 +1644,19 @@ void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
 				logchunk->func = rlc->func;
 				logchunk->free = rlc->free;
 			}
+			else if (rlc->type == 6) {
+				logchunk->type = 6;
+				logchunk->num = rlc->num;
+				logchunk->buf_pos = uwsgi.logformat_buffer_size;
+				uwsgi.logformat_buffer_size += UWSGI_LF_NUM_LEN;
+			}
+			else if (rlc->type == 7) {
+				logchunk->type = 7;
+				logchunk->render = rlc->render;
+				logchunk->render_len = rlc->render_len;
+				logchunk->buf_pos = uwsgi.logformat_buffer_size;
+				uwsgi.logformat_buffer_size += rlc->render_len;
+			}
 		}
 		// var
 		else if (!uwsgi_starts_with(ptr, len, "var.", 4)) {
@@ -1391,7 +1669,9 @@ void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
 		else if (!uwsgi_starts_with(ptr, len, "metric.", 7)) {
 			logchunk->type = 4;
 			logchunk->ptr = uwsgi_concat2n(ptr+7, len - 7, "", 0);
-			logchunk->free = 1;
+			logchunk->len = len - 7;
+			logchunk->buf_pos = uwsgi.logformat_buffer_size;
+			uwsgi.logformat_buffer_size += UWSGI_LF_NUM_LEN;
 		}
 		// logvar
 		else {
@@ -1400,6 +1680,114 @@ void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
 	}
 }
 
+/*
+
+	async loggers (--log-async-buffer <size>)
+
+	every configured logger gets a thread and a bounded buffer: the dispatcher (the master or the
+	threaded logger) only copies the message in the buffer, so a slow endpoint does not stall the
+	draining of the log pipes. When the buffer is full the message is dropped (and counted), or with
+	--log-async-block the dispatcher waits for the logger thread (backpressure up to the workers).
+
+	queued bytes and dropped messages are exposed as the logger.N.* and req_logger.N.* metrics
+
+*/
+
+static void log_async_copy(struct uwsgi_log_async *la, uint64_t pos, char *buf, size_t len, int out) {
+	size_t offset = pos % la->size;
+	size_t chunk = la->size - offset;
+	if (chunk > len) chunk = len;
+	if (out) {
+		memcpy(buf, la->buf + offset, chunk);
+		if (len > chunk) memcpy(buf + chunk, la->buf, len - chunk);
+	}
+	else {
+		memcpy(la->buf + offset, buf, chunk);
+		if (len > chunk) memcpy(la->buf, buf + chunk, len - chunk);
+	}
+}
+
+static void log_async_push(struct uwsgi_log_async *la, char *msg, size_t len) {
+	uint32_t len32 = len;
+	pthread_mutex_lock(&la->lock);
+	if (len + 4 > la->size) goto drop;
+	while (la->size - (la->head - la->tail) < len + 4) {
+		if (!uwsgi.log_async_block) goto drop;
+		pthread_cond_wait(&la->room, &la->lock);
+	}
+	log_async_copy(la, la->head, (char *) &len32, 4, 0);
+	log_async_copy(la, la->head + 4, msg, len, 0);
+	la->head += len + 4;
+	la->queued = la->head - la->tail;
+	pthread_cond_signal(&la->data);
+	pthread_mutex_unlock(&la->lock);
+	return;
+drop:
+	la->dropped++;
+	pthread_mutex_unlock(&la->lock);
+}
+
+static void *log_async_loop(void *arg) {
+	struct uwsgi_logger *ul = (struct uwsgi_logger *) arg;
+	struct uwsgi_log_async *la = ul->async;
+
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	char *msg = uwsgi_malloc(la->size);
+	for (;;) {
+		uint32_t len = 0;
+		pthread_mutex_lock(&la->lock);
+		while (la->head == la->tail) {
+			pthread_cond_wait(&la->data, &la->lock);
+		}
+		log_async_copy(la, la->tail, (char *) &len, 4, 1);
+		log_async_copy(la, la->tail + 4, msg, len, 1);
+		la->tail += len + 4;
+		la->queued = la->head - la->tail;
+		pthread_cond_signal(&la->room);
+		pthread_mutex_unlock(&la->lock);
+		ul->func(ul, msg, len);
+	}
+	return NULL;
+}
+
+static void log_async_setup(struct uwsgi_logger *ul) {
+	for (; ul; ul = ul->next) {
+		struct uwsgi_log_async *la = uwsgi_calloc(sizeof(struct uwsgi_log_async));
+		pthread_mutex_init(&la->lock, NULL);
+		pthread_cond_init(&la->data, NULL);
+		pthread_cond_init(&la->room, NULL);
+		la->size = uwsgi.log_async_buffer;
+		la->buf = uwsgi_malloc(la->size);
+		ul->async = la;
+	}
+}
+
+static void log_async_spawn(struct uwsgi_logger *ul) {
+	for (; ul; ul = ul->next) {
+		pthread_t t;
+		if (pthread_create(&t, NULL, log_async_loop, ul)) {
+			uwsgi_error("log_async_spawn()/pthread_create()");
+			exit(1);
+		}
+	}
+}
+
+void uwsgi_log_async_setup() {
+	if (!uwsgi.log_async_buffer) return;
+	log_async_setup(uwsgi.choosen_logger);
+	log_async_setup(uwsgi.choosen_req_logger);
+}
+
+// called by the process dispatching the logs
+void uwsgi_log_async_spawn() {
+	if (!uwsgi.log_async_buffer) return;
+	log_async_spawn(uwsgi.choosen_logger);
+	log_async_spawn(uwsgi.choosen_req_logger);
+}
+
 static void uwsgi_log_func_do(struct uwsgi_string_list *encoders, struct uwsgi_logger *ul, char *msg, size_t len) {
 	struct uwsgi_string_list *usl = encoders;
 	// note: msg must not be freed !!!
@@ -1428,7 +1816,12 @@ next:
 		usl = usl->next;
 	}
 	if (ul) {
-		ul->func(ul, new_msg, new_msg_len);
+		if (ul->async) {
+			log_async_push(ul->async, new_msg, new_msg_len);
+		}
+		else {
+			ul->func(ul, new_msg, new_msg_len);
+		}
 	}
 	else {
 		new_msg_len = (size_t) write(uwsgi.original_log_fd, new_msg, new_msg_len);
@@ -1505,52 +1898,130 @@ next:
         return -1;
 }
 
-int uwsgi_master_req_log(void) {
-
-        ssize_t rlen = read(uwsgi.shared->worker_req_log_pipe[0], uwsgi.log_master_buf, uwsgi.log_master_bufsize);
-        if (rlen > 0) {
+static void req_log_dispatch(char *buf, size_t len) {
 #ifdef UWSGI_PCRE
-                struct uwsgi_regexp_list *url = uwsgi.log_req_route;
-                int finish = 0;
-                while (url) {
-                        if (uwsgi_regexp_match(url->pattern, url->pattern_extra, uwsgi.log_master_buf, rlen) >= 0) {
-                                struct uwsgi_logger *ul_route = (struct uwsgi_logger *) url->custom_ptr;
-                                if (ul_route) {
-                                        uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul_route, uwsgi.log_master_buf, rlen);
-                                        finish = 1;
-                                }
-                        }
-                        url = url->next;
-                }
-                if (finish)
-                        return 0;
+	struct uwsgi_regexp_list *url = uwsgi.log_req_route;
+	int finish = 0;
+	while (url) {
+		if (uwsgi_regexp_match(url->pattern, url->pattern_extra, buf, len) >= 0) {
+			struct uwsgi_logger *ul_route = (struct uwsgi_logger *) url->custom_ptr;
+			if (ul_route) {
+				uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul_route, buf, len);
+				finish = 1;
+			}
+		}
+		url = url->next;
+	}
+	if (finish)
+		return;
 #endif
 
-                int raw_log = 1;
+	int raw_log = 1;
 
-                struct uwsgi_logger *ul = uwsgi.choosen_req_logger;
-                while (ul) {
-                        // check for named logger
-                        if (ul->id) {
-                                goto next;
-                        }
-                        uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul, uwsgi.log_master_buf, rlen);
-                        raw_log = 0;
+	struct uwsgi_logger *ul = uwsgi.choosen_req_logger;
+	while (ul) {
+		// check for named logger
+		if (ul->id) {
+			goto next;
+		}
+		uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul, buf, len);
+		raw_log = 0;
 next:
-                        ul = ul->next;
-                }
+		ul = ul->next;
+	}
 
-                if (raw_log) {
-			uwsgi_log_func_do(uwsgi.requested_log_req_encoders, NULL, uwsgi.log_master_buf, rlen);
-                }
+	if (raw_log) {
+		uwsgi_log_func_do(uwsgi.requested_log_req_encoders, NULL, buf, len);
+	}
+}
+
+int uwsgi_master_req_log(void) {
+
+        ssize_t rlen = read(uwsgi.shared->worker_req_log_pipe[0], uwsgi.log_master_buf, uwsgi.log_master_bufsize);
+        if (rlen > 0) {
+		req_log_dispatch(uwsgi.log_master_buf, rlen);
                 return 0;
         }
 
         return -1;
 }
 
+// lines can be passed in batches only if they are not inspected and the loggers write to a stream
+static int req_log_can_batch() {
+	if (uwsgi.requested_log_req_encoders) return 0;
+#ifdef UWSGI_PCRE
+	if (uwsgi.log_req_route) return 0;
+#endif
+	struct uwsgi_logger *ul = uwsgi.choosen_req_logger;
+	while (ul) {
+		if (!ul->id && !ul->stream) return 0;
+		if (ul->batch_max && ul->batch_max < uwsgi.req_log_batch_size) uwsgi.req_log_batch_size = ul->batch_max;
+		ul = ul->next;
+	}
+	// leave room for more than a batch in the async buffers
+	if (uwsgi.log_async_buffer && uwsgi.log_async_buffer / 2 < uwsgi.req_log_batch_size) uwsgi.req_log_batch_size = uwsgi.log_async_buffer / 2;
+	return 1;
+}
+
+int uwsgi_master_req_log_rings(void) {
+	char bells[64];
+	while (read(uwsgi.shared->req_log_ring_pipe[0], bells, sizeof(bells)) > 0);
+
+	// the batch buffer is as big as a ring
+	if (!uwsgi.req_log_batch) {
+		uwsgi.req_log_batch = uwsgi_malloc(uwsgi.req_log_ring);
+		uwsgi.req_log_batch_size = uwsgi.req_log_ring;
+		uwsgi.req_log_batchable = req_log_can_batch();
+	}
+
+	size_t pos = 0;
+	int again = 1;
+	while (again) {
+		again = 0;
+		int i, j;
+		for (i = 1; i <= uwsgi.numproc; i++) {
+			for (j = 0; j < uwsgi.cores; j++) {
+				struct uwsgi_log_ring *ring = uwsgi.workers[i].cores[j].req_log_ring;
+				uint64_t tail = ring->tail;
+				// do not stay on a busy ring forever
+				uint64_t limit = tail + ring->size;
+				for (;;) {
+					uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+					if (tail == head) break;
+					if (tail >= limit) {
+						again = 1;
+						break;
+					}
+					while (tail != head) {
+						uint32_t len = 0;
+						req_log_ring_copy_out(ring, tail, (char *) &len, 4);
+						if (pos > 0 && pos + len > uwsgi.req_log_batch_size) {
+							req_log_dispatch(uwsgi.req_log_batch, pos);
+							pos = 0;
+						}
+						req_log_ring_copy_out(ring, tail + 4, uwsgi.req_log_batch + pos, len);
+						pos += len;
+						tail += 4 + len;
+						if (!uwsgi.req_log_batchable) {
+							req_log_dispatch(uwsgi.req_log_batch, pos);
+							pos = 0;
+						}
+					}
+					// publish the tail before checking the head again
+					__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+				}
+			}
+		}
+	}
+
+	if (pos > 0) {
+		req_log_dispatch(uwsgi.req_log_batch, pos);
+	}
+	return 0;
+}
+
 static void *logger_thread_loop(void *noarg) {
-        struct pollfd logpoll[2];
+        struct pollfd logpoll[3];
 
         // block all signals
         sigset_t smask;
@@ -1566,6 +2037,11 @@ static void *logger_thread_loop(void *noarg) {
                 logpoll[1].events = POLLIN;
                 logpoll[1].fd = uwsgi.shared->worker_req_log_pipe[0];
 		logpolls++;
+		if (uwsgi.req_log_ring) {
+			logpoll[2].events = POLLIN;
+			logpoll[2].fd = uwsgi.shared->req_log_ring_pipe[0];
+			logpolls++;
+		}
         }
 
 
@@ -1582,6 +2058,11 @@ static void *logger_thread_loop(void *noarg) {
                                 uwsgi_master_req_log();
                                 pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
                         }
+			else if (logpolls > 2 && logpoll[2].revents & POLLIN) {
+				pthread_mutex_lock(&uwsgi.threaded_logger_lock);
+				uwsgi_master_req_log_rings();
+				pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
+			}
 
                 }
         }
@@ -1600,6 +2081,9 @@ void uwsgi_threaded_logger_spawn() {
                 event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_log_pipe[0]);
                 if (uwsgi.req_log_master) {
                 	event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_req_log_pipe[0]);
+			if (uwsgi.req_log_ring) {
+				event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->req_log_ring_pipe[0]);
+			}
                 }
                 uwsgi.threaded_logger = 0;
 	}
@@ -1612,6 +2096,8 @@ void uwsgi_threaded_logger_worker_spawn() {
 
 	uwsgi.log_master_buf = uwsgi_malloc(uwsgi.log_master_bufsize);
 
+	uwsgi_log_async_spawn();
+
         if (pthread_create(&logger_thread, NULL, logger_thread_loop, NULL)) {
                 uwsgi_error_safe("uwsgi_threaded_logger_worker_spawn()/pthread_create()");
 		exit(1);
@@ -1927,22 +2413,10 @@ static char *uwsgi_log_encoder_json(struct uwsgi_log_encoder *ule, char *msg, si
                         if (!uwsgi_strncmp(usl->value, usl->len, "msg", 3)) {
 				size_t msg_len = len;
                                 if (msg[len-1] == '\n') msg_len--;
-				char *e_json = uwsgi_malloc((msg_len * 2)+1);
-				escape_json(msg, msg_len, e_json);
-				if (uwsgi_buffer_append(ub, e_json, strlen(e_json))){
-                                	free(e_json);
-                                        goto end;
-                                }
-                                free(e_json);
+				if (uwsgi_buffer_append_json(ub, msg, msg_len)) goto end;
                         }
                         else if (!uwsgi_strncmp(usl->value, usl->len, "msgnl", 5)) {
-				char *e_json = uwsgi_malloc((len * 2)+1);
-                                escape_json(msg, len, e_json);
-                                if (uwsgi_buffer_append(ub, e_json, strlen(e_json))){
-                                        free(e_json);
-                                        goto end;
-                                }
-                                free(e_json);
+				if (uwsgi_buffer_append_json(ub, msg, len)) goto end;
                         }
                         else if (!uwsgi_strncmp(usl->value, usl->len, "unix", 4)) {
                                 if (uwsgi_buffer_num64(ub, uwsgi_now())) goto end;
@@ -1960,13 +2434,7 @@ static char *uwsgi_log_encoder_json(struct uwsgi_log_encoder *ule, char *msg, si
                                 int strftime_len = strftime(sftime, 64, buf, localtime(&now));
                                 free(buf);
                                 if (strftime_len > 0) {
-					char *e_json = uwsgi_malloc((strftime_len * 2)+1);
-					escape_json(sftime, strftime_len, e_json);
-                                        if (uwsgi_buffer_append(ub, e_json, strlen(e_json))){
-						free(e_json);
-						goto end;
-					}
-					free(e_json);
+					if (uwsgi_buffer_append_json(ub, sftime, strftime_len)) goto end;
                                 }
                         }
                 }
@@ -1983,7 +2451,8 @@ end:
         return buf;
 }
 
-#define r_logchunk(x) uwsgi_register_logchunk(#x, uwsgi_lf_ ## x, 1)
+#define r_logchunk(x) uwsgi_register_logchunk_num(#x, uwsgi_lf_ ## x)
+#define r_logchunk_render(x, y) uwsgi_register_logchunk_render(#x, uwsgi_lf_ ## x, y)
 #define r_logchunk_offset(x, y) { struct uwsgi_logchunk *lc = uwsgi_register_logchunk(#x, NULL, 0); lc->pos = offsetof(struct wsgi_request, y); lc->pos_len = offsetof(struct wsgi_request, y ## _len); lc->type = 1; lc->free=0;}
 void uwsgi_register_logchunks() {
 	// offsets
@@ -1996,7 +2465,7 @@ void uwsgi_register_logchunks() {
 	r_logchunk_offset(uagent, user_agent);
 	r_logchunk_offset(referer, referer);
 
-	// funcs
+	// numbers and rendered chunks
 	r_logchunk(status);
 	r_logchunk(rsize);
 	r_logchunk(hsize);
@@ -2004,13 +2473,18 @@ void uwsgi_register_logchunks() {
 	r_logchunk(cl);
 	r_logchunk(micros);
 	r_logchunk(msecs);
-	r_logchunk(secs);
+	r_logchunk_render(secs, 32);
 	r_logchunk(tmsecs);
 	r_logchunk(tmicros);
+	r_logchunk(headers_micros);
+	r_logchunk(body_micros);
+	r_logchunk(app_micros);
+	r_logchunk(ttfb_micros);
+	r_logchunk(queue_micros);
 	r_logchunk(time);
-	r_logchunk(ltime);
-	r_logchunk(ftime);
-	r_logchunk(ctime);
+	r_logchunk_render(ltime, 64);
+	r_logchunk_render(ftime, 64);
+	r_logchunk_render(ctime, 26);
 	r_logchunk(epoch);
 	r_logchunk(pid);
 	r_logchunk(wid);
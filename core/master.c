@@ -83,53 +83,66 @@ void uwsgi_unblock_signal(int signum) {
 	}
 }
 
-void uwsgi_master_manage_udp(int udp_fd) {
-	char buf[4096];
-	struct sockaddr_in udp_client;
+static void master_manage_udp_packet(int udp_fd, char *buf, ssize_t rlen, struct sockaddr_in *udp_client) {
 	char udp_client_addr[16];
 	int i;
 
-	socklen_t udp_len = sizeof(udp_client);
-	ssize_t rlen = recvfrom(udp_fd, buf, 4096, 0, (struct sockaddr *) &udp_client, &udp_len);
-
-	if (rlen < 0) {
-		uwsgi_error("uwsgi_master_manage_udp()/recvfrom()");
+	memset(udp_client_addr, 0, 16);
+	if (!inet_ntop(AF_INET, &udp_client->sin_addr.s_addr, udp_client_addr, 16)) {
+		uwsgi_error("uwsgi_master_manage_udp()/inet_ntop()");
+		return;
 	}
-	else if (rlen > 0) {
 
-		memset(udp_client_addr, 0, 16);
-		if (inet_ntop(AF_INET, &udp_client.sin_addr.s_addr, udp_client_addr, 16)) {
-			if (buf[0] == UWSGI_MODIFIER_MULTICAST_ANNOUNCE) {
-			}
-			else if (buf[0] == 0x30 && uwsgi.snmp) {
-				manage_snmp(udp_fd, (uint8_t *) buf, rlen, &udp_client);
-			}
-			else {
-
-				// loop the various udp manager until one returns true
-				int udp_managed = 0;
-				for (i = 0; i < 256; i++) {
-					if (uwsgi.p[i]->manage_udp) {
-						if (uwsgi.p[i]->manage_udp(udp_client_addr, udp_client.sin_port, buf, rlen)) {
-							udp_managed = 1;
-							break;
-						}
-					}
-				}
+	if (buf[0] == UWSGI_MODIFIER_MULTICAST_ANNOUNCE) {
+	}
+	else if (buf[0] == 0x30 && uwsgi.snmp) {
+		manage_snmp(udp_fd, (uint8_t *) buf, rlen, udp_client);
+	}
+	else {
 
-				// else a simple udp logger
-				if (!udp_managed) {
-					uwsgi_log("[udp:%s:%d] %.*s", udp_client_addr, ntohs(udp_client.sin_port), (int) rlen, buf);
+		// loop the various udp manager until one returns true
+		int udp_managed = 0;
+		for (i = 0; i < 256; i++) {
+			if (uwsgi.p[i]->manage_udp) {
+				if (uwsgi.p[i]->manage_udp(udp_client_addr, udp_client->sin_port, buf, rlen)) {
+					udp_managed = 1;
+					break;
 				}
 			}
 		}
-		else {
-			uwsgi_error("uwsgi_master_manage_udp()/inet_ntop()");
-		}
 
+		// else a simple udp logger
+		if (!udp_managed) {
+			uwsgi_log("[udp:%s:%d] %.*s", udp_client_addr, ntohs(udp_client->sin_port), (int) rlen, buf);
+		}
 	}
 }
 
+// bursts of datagrams are drained in batches (the socket is never blocked), a flood
+// cannot hold the master for more than a few rounds (the fd is still readable for the next cycle)
+#define UWSGI_MASTER_UDP_BATCH 32
+#define UWSGI_MASTER_UDP_ROUNDS 4
+
+void uwsgi_master_manage_udp(int udp_fd) {
+	static struct uwsgi_udp_batch *ub = NULL;
+	int i, n, rounds = 0;
+
+	if (!ub) ub = uwsgi_udp_batch_new(UWSGI_MASTER_UDP_BATCH, 4096);
+
+	do {
+		n = uwsgi_udp_batch_recv(ub, udp_fd);
+		if (n < 0) {
+			uwsgi_error("uwsgi_master_manage_udp()/recvmmsg()");
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			if (ub->lens[i] > 0) {
+				master_manage_udp_packet(udp_fd, uwsgi_udp_batch_buf(ub, i), ub->lens[i], &ub->addrs[i]);
+			}
+		}
+	} while (n == ub->n && ++rounds < UWSGI_MASTER_UDP_ROUNDS);
+}
+
 void suspend_resume_them_all(int signum) {
 
 	int i;
@@ -193,33 +206,22 @@ void uwsgi_master_check_mercy() {
 }
 
 
-void expire_rb_timeouts(struct uwsgi_rbtree *tree) {
+static void expire_rb_timeouts(struct uwsgi_timer_wheel *wheel) {
 
-	uint64_t current = (uint64_t) uwsgi_now();
-	struct uwsgi_rb_timer *urbt;
+	uint64_t current = uwsgi_millis();
+	struct uwsgi_wheel_timer *uwt;
 	struct uwsgi_signal_rb_timer *usrbt;
 
-	for (;;) {
-
-		urbt = uwsgi_min_rb_timer(tree, NULL);
-
-		if (urbt == NULL)
-			return;
-
-		if (urbt->value <= current) {
-			// remove the timeout and add another
-			usrbt = (struct uwsgi_signal_rb_timer *) urbt->data;
-			uwsgi_del_rb_timer(tree, urbt);
-			free(urbt);
-			usrbt->iterations_done++;
-			uwsgi_route_signal(usrbt->sig);
-			if (!usrbt->iterations || usrbt->iterations_done < usrbt->iterations) {
-				usrbt->uwsgi_rb_timer = uwsgi_add_rb_timer(tree, uwsgi_now() + usrbt->value, usrbt);
-			}
-			continue;
+	while ((uwt = uwsgi_timer_wheel_pop(wheel, current))) {
+		usrbt = (struct uwsgi_signal_rb_timer *) uwt->data;
+		usrbt->iterations_done++;
+		uwsgi_route_signal(usrbt->sig);
+		if (!usrbt->iterations || usrbt->iterations_done < usrbt->iterations) {
+			// re-arm from the expected expiration, so the period does not drift
+			uint64_t next = uwt->value + usrbt->value;
+			if (next <= current) next = current + usrbt->value;
+			uwsgi_timer_wheel_add(wheel, uwt, next, usrbt);
 		}
-
-		break;
 	}
 }
 
@@ -352,8 +354,12 @@ int master_loop(char **argv, char **environ) {
 
 	int check_interval = 1;
 
-	struct uwsgi_rb_timer *min_timeout;
-	struct uwsgi_rbtree *rb_timers = uwsgi_init_rb_timer();
+	// signal rb_timers (msecs resolution)
+	struct uwsgi_timer_wheel *rb_timers = uwsgi_timer_wheel_new(uwsgi_millis());
+	void *rb_timers_events = NULL;
+
+	// cron tasks are armed in their own wheel
+	uwsgi_cron_setup();
 
 	if (uwsgi.procname_master) {
 		uwsgi_set_processname(uwsgi.procname_master);
@@ -376,6 +382,10 @@ int master_loop(char **argv, char **environ) {
 
 	uwsgi_unix_signal(SIGINT, kill_them_all);
 	uwsgi_unix_signal(SIGUSR1, stats);
+	// swap the immutable caches
+	if (uwsgi.cache_immutable) {
+		uwsgi_unix_signal(SIGUSR2, uwsgi_cache_immutable_swap_signal);
+	}
 
 	atexit(uwsgi_master_cleanup_hooks);
 
@@ -386,6 +396,7 @@ int master_loop(char **argv, char **environ) {
 	uwsgi_log("adding %d to signal poll\n", uwsgi.shared->worker_signal_pipe[0]);
 #endif
 	event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_signal_pipe[0]);
+	event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->deadline_pipe[0]);
 
 	if (uwsgi.master_fifo) {
 		uwsgi.master_fifo_fd = uwsgi_master_fifo();
@@ -408,6 +419,7 @@ int master_loop(char **argv, char **environ) {
 
 	if (uwsgi.log_master) {
 		uwsgi.log_master_buf = uwsgi_malloc(uwsgi.log_master_bufsize);
+		uwsgi_log_async_spawn();
 		if (!uwsgi.threaded_logger) {
 #ifdef UWSGI_DEBUG
 			uwsgi_log("adding %d to master logging\n", uwsgi.shared->worker_log_pipe[0]);
@@ -415,6 +427,9 @@ int master_loop(char **argv, char **environ) {
 			event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_log_pipe[0]);
 			if (uwsgi.req_log_master) {
 				event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_req_log_pipe[0]);
+				if (uwsgi.req_log_ring) {
+					event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->req_log_ring_pipe[0]);
+				}
 			}
 		}
 		else {
@@ -432,6 +447,8 @@ int master_loop(char **argv, char **environ) {
 
 	uwsgi_cache_start_sweepers();
 	uwsgi_cache_start_sync_servers();
+	uwsgi_cache_start_replicators();
+	uwsgi_cache_start_snapshotters();
 
 	uwsgi.wsgi_req->buffer = uwsgi.workers[0].cores[0].buffer;
 
@@ -466,6 +483,9 @@ int master_loop(char **argv, char **environ) {
 		uwsgi.zerg_server_fd = bind_to_unix(uwsgi.zerg_server, uwsgi.listen_queue, 0, 0);
 		event_queue_add_fd_read(uwsgi.master_queue, uwsgi.zerg_server_fd);
 		uwsgi_log("*** Zerg server enabled on %s ***\n", uwsgi.zerg_server);
+		if (uwsgi.zerg_server_reuseport) {
+			uwsgi.zerg_balancer = uwsgi_zerg_balancer_new(0, NULL, 1, !uwsgi.is_a_reload);
+		}
 	}
 
 	if (uwsgi.stats) {
@@ -485,6 +505,22 @@ int master_loop(char **argv, char **environ) {
 		uwsgi_log("*** Stats server enabled on %s fd: %d ***\n", uwsgi.stats, uwsgi.stats_fd);
 	}
 
+	if (uwsgi.stats_openmetrics) {
+		char *tcp_port = strrchr(uwsgi.stats_openmetrics, ':');
+		if (tcp_port) {
+			int current_defer_accept = uwsgi.no_defer_accept;
+			uwsgi.no_defer_accept = 1;
+			uwsgi.stats_openmetrics_fd = bind_to_tcp(uwsgi.stats_openmetrics, uwsgi.listen_queue, tcp_port);
+			uwsgi.no_defer_accept = current_defer_accept;
+		}
+		else {
+			uwsgi.stats_openmetrics_fd = bind_to_unix(uwsgi.stats_openmetrics, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
+		}
+
+		event_queue_add_fd_read(uwsgi.master_queue, uwsgi.stats_openmetrics_fd);
+		uwsgi_log("*** OpenMetrics server enabled on %s fd: %d ***\n", uwsgi.stats_openmetrics, uwsgi.stats_openmetrics_fd);
+	}
+
 
 	if (uwsgi.stats_pusher_instances) {
 		if (!uwsgi_thread_new(uwsgi_stats_pusher_loop)) {
@@ -738,29 +774,43 @@ int master_loop(char **argv, char **environ) {
 			// locking is not needed as rb_timers can only increase
 			for (i = 0; i < ushared->rb_timers_cnt; i++) {
 				if (!ushared->rb_timers[i].registered) {
-					ushared->rb_timers[i].uwsgi_rb_timer = uwsgi_add_rb_timer(rb_timers, uwsgi_now() + ushared->rb_timers[i].value, &ushared->rb_timers[i]);
+					uwsgi_timer_wheel_add(rb_timers, &ushared->rb_timers[i].timer, uwsgi_millis() + ushared->rb_timers[i].value, &ushared->rb_timers[i]);
 					ushared->rb_timers[i].registered = 1;
 				}
 			}
 
 			int interesting_fd = -1;
 
+			int64_t rb_delta = -1;
 			if (ushared->rb_timers_cnt > 0) {
-				min_timeout = uwsgi_min_rb_timer(rb_timers, NULL);
-				if (min_timeout) {
-					int delta = min_timeout->value - uwsgi_now();
-					if (delta <= 0) {
-						expire_rb_timeouts(rb_timers);
-					}
-					// if the timer expires before the check_interval, override it
-					else if (delta < check_interval) {
-						check_interval = delta;
-					}
+				rb_delta = uwsgi_timer_wheel_next(rb_timers, uwsgi_millis());
+				if (rb_delta == 0) {
+					expire_rb_timeouts(rb_timers);
+					rb_delta = uwsgi_timer_wheel_next(rb_timers, uwsgi_millis());
 				}
 			}
 
+			// the earliest harakiri of the workers is a deadline too
+			int64_t harakiri_delta = uwsgi_master_deadline_timeout();
+			if (harakiri_delta >= 0 && (rb_delta < 0 || harakiri_delta < rb_delta)) {
+				rb_delta = harakiri_delta;
+			}
+
+			int64_t cron_delta = uwsgi_cron_timeout();
+			if (cron_delta >= 0 && (rb_delta < 0 || cron_delta < rb_delta)) {
+				rb_delta = cron_delta;
+			}
+
 			// wait for event
-			rlen = event_queue_wait(uwsgi.master_queue, check_interval, &interesting_fd);
+			// if a rb_timer (or a harakiri, or a cron) expires before the check_interval, wait for it with msecs precision
+			if (rb_delta >= 0 && rb_delta < (int64_t) check_interval * 1000) {
+				if (!rb_timers_events) rb_timers_events = event_queue_alloc(1);
+				rlen = event_queue_wait_multi_ms(uwsgi.master_queue, (int) rb_delta, rb_timers_events, 1);
+				if (rlen > 0) interesting_fd = event_queue_interesting_fd(rb_timers_events, 0);
+			}
+			else {
+				rlen = event_queue_wait(uwsgi.master_queue, check_interval, &interesting_fd);
+			}
 
 			if (rlen == 0) {
 				if (ushared->rb_timers_cnt > 0) {
@@ -774,13 +824,11 @@ int master_loop(char **argv, char **environ) {
 			master_check_processes();
 
 
-			// check uwsgi-cron table
-			if (ushared->cron_cnt) {
-				uwsgi_manage_signal_cron(uwsgi_now());
-			}
+			// run the expired cron tasks
+			uwsgi_cron_expire();
 
-			if (uwsgi.crons) {
-				uwsgi_manage_command_cron(uwsgi_now());
+			if (uwsgi.cache_immutable_swap) {
+				uwsgi_cache_immutable_swap(0);
 			}
 
 			// some event returned
@@ -793,6 +841,8 @@ int master_loop(char **argv, char **environ) {
 
 			now = uwsgi_now();
 			if (now - uwsgi.current_time < 1) {
+				// expired harakiri do not wait for the next cycle
+				uwsgi_master_check_workers_harakiri(now);
 				continue;
 			}
 			uwsgi.current_time = now;
@@ -822,6 +872,10 @@ int master_loop(char **argv, char **environ) {
 			// check listen_queue status
 			master_check_listen_queue();
 
+			if (uwsgi.zerg_balancer) {
+				uwsgi_zerg_balancer_update(uwsgi.zerg_balancer);
+			}
+
 			int someone_killed = 0;
 			// check if some worker has to die (harakiri, evil checks...)
 			if (uwsgi_master_check_workers_deadline()) someone_killed++;
@@ -848,6 +902,10 @@ int master_loop(char **argv, char **environ) {
 
 			uwsgi_cache_sync_all();
 
+			if (uwsgi.stats_snapshot > 0 && uwsgi.stats_fd > -1 && (uwsgi.master_cycles % uwsgi.stats_snapshot) == 0) {
+				uwsgi_stats_snapshot_refresh(uwsgi_master_generate_stats);
+			}
+
 			if (uwsgi.queue_store && uwsgi.queue_filesize && uwsgi.queue_store_sync && ((uwsgi.master_cycles % uwsgi.queue_store_sync) == 0)) {
 				if (msync(uwsgi.queue_header, uwsgi.queue_filesize, MS_ASYNC)) {
 					uwsgi_error("msync()");
@@ -887,6 +945,8 @@ int master_loop(char **argv, char **environ) {
 					if (uwsgi.status.chain_reloading == 0) {
 						uwsgi_log_verbose("*** %s has been touched... chain reload !!! ***\n", touched);
 						uwsgi.status.chain_reloading = 1;
+						uwsgi_standby_destroy();
+						uwsgi_zygote_reload();
 					}
 					else {
 						uwsgi_log_verbose("*** %s has been touched... but chain reload is already running ***\n", touched);
@@ -974,6 +1034,11 @@ int master_loop(char **argv, char **environ) {
 
 		 */
 
+		// standby workers are not in the pid table, they will be replaced by the cheaper subsystem,
+		// while the zygote is respawned on the next worker spawn
+		if (uwsgi_standby_check_death(diedpid)) continue;
+		if (uwsgi_zygote_check_death(diedpid)) continue;
+
 		int thewid = find_worker_id(diedpid);
 		if (thewid <= 0) {
 			// check spooler, mules, gateways and daemons
@@ -1040,6 +1105,18 @@ next:
 			}
 		}
 
+		// account the time the worker took for draining its requests
+		if (uwsgi.workers[thewid].drain_started_at) {
+			uint64_t drain_time = (uwsgi_micros() - uwsgi.workers[thewid].drain_started_at) / 1000;
+			uwsgi.workers[thewid].drain_started_at = 0;
+			if (uwsgi.worker_drain) {
+				uwsgi.shared->drained_workers++;
+				uwsgi.shared->drain_time_last = drain_time;
+				if (drain_time > uwsgi.shared->drain_time_max) uwsgi.shared->drain_time_max = drain_time;
+				uwsgi_log("worker %d drained in %llu msecs\n", thewid, (unsigned long long) drain_time);
+			}
+		}
+
 		// ok, if we are reloading or dying, just continue the master loop
 		// as soon as all of the workers have pid == 0, the action (exit, or reload) is triggered
 		if (uwsgi_instance_is_reloading || uwsgi_instance_is_dying) {
@@ -1110,8 +1187,8 @@ next:
 		uwsgi.respawn_delta = last_respawn.tv_sec;
 
 		// are we chain reloading it ?
-		if (uwsgi.status.chain_reloading == thewid) {
-			uwsgi.status.chain_reloading++;
+		if (uwsgi.workers[thewid].chain_reload == 1) {
+			uwsgi.workers[thewid].chain_reload = 2;
 		}
 
 		// respawn the worker (if needed)
@@ -1127,6 +1204,9 @@ next:
 void uwsgi_reload_workers() {
 	int i;
 	uwsgi_block_signal(SIGHUP);
+	// standby workers and the zygote could run old code, just kill them
+	uwsgi_standby_destroy();
+	uwsgi_zygote_reload();
 	for (i = 1; i <= uwsgi.numproc; i++) {
 		if (uwsgi.workers[i].pid > 0) {
 			uwsgi_curse(i, SIGHUP);
@@ -1165,6 +1245,8 @@ void uwsgi_chain_reload() {
 	if (!uwsgi.status.chain_reloading) {
 		uwsgi_log_verbose("chain reload starting...\n");
 		uwsgi.status.chain_reloading = 1;
+		uwsgi_standby_destroy();
+		uwsgi_zygote_reload();
 	}
 	else {
 		uwsgi_log_verbose("chain reload already running...\n");
@@ -1173,6 +1255,8 @@ void uwsgi_chain_reload() {
 
 void uwsgi_brutally_reload_workers() {
 	int i;
+	uwsgi_standby_destroy();
+	uwsgi_zygote_reload();
 	for (i = 1; i <= uwsgi.numproc; i++) {
 		if (uwsgi.workers[i].pid > 0) {
 			uwsgi_log_verbose("killing worker %d (pid: %d)\n", i, (int) uwsgi.workers[i].pid);
@@ -45,25 +45,42 @@ int uwsgi_master_check_reload(char **argv) {
 // check for chain reload
 void uwsgi_master_check_chain() {
 	static time_t last_check = 0;
+	int i;
 
 	if (!uwsgi.status.chain_reloading) return;
 
-	// we need to ensure the previous worker (if alive) is accepting new requests
-	// before going on
-	if (uwsgi.status.chain_reloading > 1) {
-		struct uwsgi_worker *previous_worker = &uwsgi.workers[uwsgi.status.chain_reloading-1];
-		// is the previous worker alive ?
-		if (previous_worker->pid > 0 && !previous_worker->cheaped) {
-			// the worker has been respawned but it is still not ready
-			if (previous_worker->accepting == 0) {
-				time_t now = uwsgi_now();
-				if (now != last_check) {
-					uwsgi_log_verbose("chain is still waiting for worker %d...\n", uwsgi.status.chain_reloading-1);
-					last_check = now;
-				}
-				return;
+	// we need to ensure the workers of the current step (if alive) are accepting new requests
+	// (and are ready, when the app manages readiness by itself) before going on
+	int waiting = 0;
+	int timeout = uwsgi.chain_reload_ready_timeout > 0 ? uwsgi.chain_reload_ready_timeout : uwsgi.worker_reload_mercy;
+	for(i=1;i<=uwsgi.numproc;i++) {
+		struct uwsgi_worker *uw = &uwsgi.workers[i];
+		if (!uw->chain_reload) continue;
+		// still not dead
+		if (uw->chain_reload == 1) {
+			waiting++;
+			continue;
+		}
+		// the worker has been respawned but it is still not ready
+		if (uw->pid > 0 && !uw->cheaped && (!uw->accepting || !uw->ready)) {
+			if (uw->accepting && timeout > 0 && uwsgi_now() - uw->last_spawn >= timeout) {
+				uwsgi_log_verbose("worker %d is still not ready after %d seconds, chain goes on\n", i, timeout);
+			}
+			else {
+				waiting++;
+				continue;
 			}
 		}
+		uw->chain_reload = 0;
+	}
+
+	if (waiting > 0) {
+		time_t now = uwsgi_now();
+		if (now != last_check) {
+			uwsgi_log_verbose("chain is still waiting for %d worker(s)...\n", waiting);
+			last_check = now;
+		}
+		return;
 	}
 
 	// if all the processes are recycled, the chain is over
@@ -73,21 +90,20 @@ void uwsgi_master_check_chain() {
 		return;
 	}
 
+	int concurrency = uwsgi.chain_reload_concurrency > 0 ? uwsgi.chain_reload_concurrency : 1;
 	uwsgi_block_signal(SIGHUP);
-	int i;
-	for(i=uwsgi.status.chain_reloading;i<=uwsgi.numproc;i++) {
+	for(i=uwsgi.status.chain_reloading;i<=uwsgi.numproc && concurrency > 0;i++) {
 		struct uwsgi_worker *uw = &uwsgi.workers[i];
 		if (uw->pid > 0 && !uw->cheaped && uw->accepting) {
+			uw->chain_reload = 1;
 			// the worker could have been already cursed
 			if (uw->cursed_at == 0) {
 				uwsgi_log_verbose("chain next victim is worker %d\n", i);
 				uwsgi_curse(i, SIGHUP);
 			}
-			break;
-		}
-		else {
-			uwsgi.status.chain_reloading++;
+			concurrency--;
 		}
+		uwsgi.status.chain_reloading++;
         }
 	uwsgi_unblock_signal(SIGHUP);
 }
@@ -108,8 +124,14 @@ void uwsgi_master_check_idle() {
 	int i;
 	int waitpid_status;
 
-	if (!uwsgi.idle || uwsgi.status.is_cheap)
+	if (!uwsgi.idle)
+		return;
+
+	// restart the idle timer when leaving cheap mode (or hibernation)
+	if (uwsgi.status.is_cheap) {
+		last_request_timecheck = 0;
 		return;
+	}
 
 	uwsgi.current_time = uwsgi_now();
 	if (!last_request_timecheck)
@@ -180,30 +202,103 @@ done:
 
 }
 
-int uwsgi_master_check_workers_deadline() {
+/*
+	deadline-driven harakiri
+
+	the master does not scan the cores of the workers for expired harakiri at every cycle:
+	it tracks the earliest deadline (uwsgi.shared->workers_next_deadline, 0 if none) and sleeps
+	until it (or the next cycle) is due. A core setting a deadline earlier than the tracked one
+	lowers it and wakes the master via the deadline pipe, so generally only the first request
+	after a scan notifies the master.
+*/
+
+static int uwsgi_master_deadline_lower(time_t deadline) {
+	time_t next = __atomic_load_n(&uwsgi.shared->workers_next_deadline, __ATOMIC_SEQ_CST);
+	while (next == 0 || deadline < next) {
+		if (__atomic_compare_exchange_n(&uwsgi.shared->workers_next_deadline, &next, deadline, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// called by the workers after having set a deadline
+void uwsgi_master_deadline_notify(time_t deadline) {
+	// pairs with the reset done by the master before scanning the cores
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (uwsgi_master_deadline_lower(deadline)) {
+		if (write(uwsgi.shared->deadline_pipe[1], "", 1) < 0) {
+			// the pipe is full, the master is going to wake up anyway
+		}
+	}
+}
+
+// msecs until the earliest deadline of the workers is due, -1 if none
+int64_t uwsgi_master_deadline_timeout() {
+	time_t next = __atomic_load_n(&uwsgi.shared->workers_next_deadline, __ATOMIC_SEQ_CST);
+	if (!next) return -1;
+	// harakiri triggers when the deadline is in the past
+	int64_t delta = ((int64_t) (next + 1) * 1000) - (int64_t) uwsgi_millis();
+	return delta < 0 ? 0 : delta;
+}
+
+int uwsgi_master_check_workers_harakiri(time_t now) {
 	int i,j;
 	int ret = 0;
+	time_t next = __atomic_load_n(&uwsgi.shared->workers_next_deadline, __ATOMIC_SEQ_CST);
+	if (!next || next >= now) return 0;
+	// from now on the workers notify the new deadlines
+	__atomic_store_n(&uwsgi.shared->workers_next_deadline, 0, __ATOMIC_SEQ_CST);
+	time_t pending = 0;
 	for (i = 1; i <= uwsgi.numproc; i++) {
 		for(j=0;j<uwsgi.cores;j++) {
 			/* first check for harakiri */
-			if (uwsgi.workers[i].cores[j].harakiri > 0) {
-				if (uwsgi.workers[i].cores[j].harakiri < (time_t) uwsgi.current_time) {
+			time_t harakiri = uwsgi.workers[i].cores[j].harakiri;
+			if (harakiri > 0) {
+				if (harakiri < now) {
+					if (uwsgi.harakiri_soft) {
+						time_t soft = uwsgi.workers[i].cores[j].soft_harakiri;
+						if (!soft) {
+							trigger_soft_harakiri(i, j);
+							soft = now;
+						}
+						// give the request the time to abort
+						if (soft + uwsgi.harakiri_soft > now) {
+							if (!pending || soft + uwsgi.harakiri_soft < pending) pending = soft + uwsgi.harakiri_soft;
+							continue;
+						}
+					}
 					uwsgi_log_verbose("HARAKIRI triggered by worker %d core %d !!!\n", i, j);
 					trigger_harakiri(i);
 					ret = 1;
 					break;
 				}
+				if (!pending || harakiri < pending) pending = harakiri;
 			}
 			/* then user-defined harakiri */
-			if (uwsgi.workers[i].cores[j].user_harakiri > 0) {
-				uwsgi_log_verbose("HARAKIRI (user) triggered by worker %d core %d !!!\n", i, j);
-				if (uwsgi.workers[i].cores[j].user_harakiri < (time_t) uwsgi.current_time) {
+			time_t user_harakiri = uwsgi.workers[i].cores[j].user_harakiri;
+			if (user_harakiri > 0) {
+				if (user_harakiri < now) {
+					uwsgi_log_verbose("HARAKIRI (user) triggered by worker %d core %d !!!\n", i, j);
 					trigger_harakiri(i);
 					ret = 1;
 					break;
 				}
+				if (!pending || user_harakiri < pending) pending = user_harakiri;
 			}
 		}
+	}
+	if (pending) {
+		uwsgi_master_deadline_lower(pending);
+	}
+	return ret;
+}
+
+int uwsgi_master_check_workers_deadline() {
+	int i;
+	int ret = uwsgi_master_check_workers_harakiri(uwsgi.current_time);
+	if (!uwsgi.evil_reload_on_as && !uwsgi.evil_reload_on_rss && !uwsgi.max_worker_lifetime) return ret;
+	for (i = 1; i <= uwsgi.numproc; i++) {
 		// then for evil memory checkers
 		if (uwsgi.evil_reload_on_as) {
 			if ((rlim_t) uwsgi.workers[i].vsz_size >= uwsgi.evil_reload_on_as) {
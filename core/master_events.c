@@ -16,6 +16,10 @@ int uwsgi_master_manage_events(int interesting_fd) {
 			uwsgi_master_req_log();
 			return 0;
 		}
+		if (uwsgi.req_log_ring && interesting_fd == uwsgi.shared->req_log_ring_pipe[0]) {
+			uwsgi_master_req_log_rings();
+			return 0;
+		}
 	}
 
 	if (uwsgi.master_fifo_fd > -1 && interesting_fd == uwsgi.master_fifo_fd) {
@@ -29,15 +33,30 @@ int uwsgi_master_manage_events(int interesting_fd) {
 	// stats server ?
 	if (uwsgi.stats && uwsgi.stats_fd > -1) {
 		if (interesting_fd == uwsgi.stats_fd) {
-			uwsgi_send_stats(uwsgi.stats_fd, uwsgi_master_generate_stats);
+			if (uwsgi.stats_snapshot) {
+				uwsgi_send_stats_snapshot(uwsgi.stats_fd, uwsgi_master_generate_stats);
+			}
+			else {
+				uwsgi_send_stats(uwsgi.stats_fd, uwsgi_master_generate_stats);
+			}
 			return 0;
 		}
 	}
 
+	if (uwsgi.stats_openmetrics_fd > -1 && interesting_fd == uwsgi.stats_openmetrics_fd) {
+		uwsgi_send_openmetrics(interesting_fd);
+		return 0;
+	}
+
 	// a zerg connection ?
 	if (uwsgi.zerg_server) {
 		if (interesting_fd == uwsgi.zerg_server_fd) {
-			uwsgi_manage_zerg(uwsgi.zerg_server_fd, 0, NULL);
+			if (uwsgi.zerg_balancer) {
+				uwsgi_manage_zerg_balanced(uwsgi.zerg_balancer, uwsgi.zerg_server_fd);
+			}
+			else {
+				uwsgi_manage_zerg(uwsgi.zerg_server_fd, 0, NULL);
+			}
 			return 0;
 		}
 	}
@@ -197,6 +216,13 @@ int uwsgi_master_manage_events(int interesting_fd) {
 		}
 	}
 
+	// a core set an earlier harakiri, the master loop will recompute its timeout
+	if (interesting_fd == uwsgi.shared->deadline_pipe[0]) {
+		char buf[64];
+		while (read(interesting_fd, buf, sizeof(buf)) > 0);
+		return 0;
+	}
+
 	uint8_t uwsgi_signal;
 	// check for worker signal
 	if (interesting_fd == uwsgi.shared->worker_signal_pipe[0]) {
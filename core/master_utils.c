@@ -1,5 +1,10 @@
 #include "uwsgi.h"
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 extern struct uwsgi_server uwsgi;
 
 void worker_wakeup() {
@@ -16,6 +21,9 @@ uint64_t uwsgi_worker_exceptions(int wid) {
 }
 
 void uwsgi_curse(int wid, int sig) {
+	if (!uwsgi.workers[wid].drain_started_at) {
+		uwsgi.workers[wid].drain_started_at = uwsgi_micros();
+	}
 	uwsgi.workers[wid].cursed_at = uwsgi_now();
         uwsgi.workers[wid].no_mercy_at = uwsgi.workers[wid].cursed_at + uwsgi.worker_reload_mercy;
 
@@ -50,6 +58,9 @@ void uwsgi_destroy_processes() {
 	int i;
 	int waitpid_status;
 
+	uwsgi_standby_destroy();
+	uwsgi_zygote_destroy();
+
         uwsgi_signal_spoolers(SIGKILL);
 
         uwsgi_detach_daemons();
@@ -175,7 +186,14 @@ int uwsgi_calc_cheaper(void) {
 
 safe:
 	if (needed_workers > 0) {
-		for (i = 1; i <= uwsgi.numproc; i++) {
+		// standby workers are activated first
+		for (i = 1; i <= uwsgi.numproc && needed_workers > 0; i++) {
+			if (uwsgi.workers[i].standby_pid > 0 && uwsgi.workers[i].pid == 0) {
+				uwsgi_respawn_worker(i);
+				needed_workers--;
+			}
+		}
+		for (i = 1; i <= uwsgi.numproc && needed_workers > 0; i++) {
 			if (uwsgi.workers[i].cheaped == 1 && uwsgi.workers[i].pid == 0) {
 				if (uwsgi_respawn_worker(i)) {
 					uwsgi.cheaper_fifo_delta += needed_workers;
@@ -183,8 +201,6 @@ safe:
 				}
 				needed_workers--;
 			}
-			if (needed_workers == 0)
-				break;
 		}
 	}
 	else if (needed_workers < 0) {
@@ -219,6 +235,20 @@ safe:
 		}
 	}
 
+	// keep the standby pool full
+	if (uwsgi.cheaper_standby > 0 && !uwsgi_instance_is_reloading && !uwsgi_instance_is_dying) {
+		int standby = 0;
+		for (i = 1; i <= uwsgi.numproc; i++) {
+			if (uwsgi.workers[i].standby_pid > 0) standby++;
+		}
+		for (i = 1; i <= uwsgi.numproc && standby < uwsgi.cheaper_standby; i++) {
+			if (uwsgi.workers[i].cheaped == 1 && uwsgi.workers[i].pid == 0 && uwsgi.workers[i].standby_pid == 0) {
+				if (uwsgi_standby_spawn(i)) return 0;
+				standby++;
+			}
+		}
+	}
+
 	return 1;
 }
 
@@ -639,6 +669,7 @@ void uwsgi_fixup_fds(int wid, int muleid, struct uwsgi_gateway *ug) {
 		}
 		// fix the communication pipe
 		close(uwsgi.shared->worker_signal_pipe[0]);
+		close(uwsgi.shared->deadline_pipe[0]);
 		for (i = 1; i <= uwsgi.numproc; i++) {
 			if (uwsgi.workers[i].signal_pipe[0] != -1)
 				close(uwsgi.workers[i].signal_pipe[0]);
@@ -710,11 +741,182 @@ void uwsgi_fixup_fds(int wid, int muleid, struct uwsgi_gateway *ug) {
 
 }
 
+/*
+
+	standby workers
+
+	with --cheaper-standby cheaped slots are filled with pre-forked workers, they load the apps
+	(even with lazy-apps) and then park on a futex (a polling loop on non-Linux systems) until
+	the master activates them. Until then their pid is only in standby_pid, so the cheaper algorithms
+	still see the slot as cheaped, while uwsgi_respawn_worker() activates them instead of forking.
+
+*/
+
+static void uwsgi_standby_wake(int wid) {
+	__atomic_store_n(&uwsgi.workers[wid].standby, 0, __ATOMIC_RELEASE);
+#ifdef __linux__
+	syscall(SYS_futex, &uwsgi.workers[wid].standby, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+// run by the worker before starting accepting requests
+void uwsgi_standby_park() {
+	if (!__atomic_load_n(&uwsgi.workers[uwsgi.mywid].standby, __ATOMIC_ACQUIRE)) return;
+	uwsgi_log("worker %d (pid: %d) ready in standby mode\n", uwsgi.mywid, (int) uwsgi.mypid);
+	pid_t master_pid = uwsgi.workers[0].pid;
+#if defined(__linux__) && defined(PR_SET_PDEATHSIG)
+	// when forked by the master, follow it (the zygote case is managed by the check below)
+	if (getppid() == master_pid) {
+		if (prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0)) {
+			uwsgi_error("uwsgi_standby_park()/prctl()");
+		}
+	}
+#endif
+	uint64_t rounds = 0;
+	while (__atomic_load_n(&uwsgi.workers[uwsgi.mywid].standby, __ATOMIC_ACQUIRE)) {
+#ifdef __linux__
+		// wake up every second to check the master is still alive
+		struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+		syscall(SYS_futex, &uwsgi.workers[uwsgi.mywid].standby, FUTEX_WAIT, 1, &ts, NULL, 0);
+#else
+		usleep(10000);
+		if (++rounds % 100) continue;
+#endif
+		// a standby worker never reaches the master death checks of the request loop
+		if (master_pid > 0 && kill(master_pid, 0) && errno == ESRCH) {
+			uwsgi_log("master died, standby worker %d (pid: %d) exiting\n", uwsgi.mywid, (int) uwsgi.mypid);
+			exit(1);
+		}
+	}
+	(void) rounds;
+}
+
+static int uwsgi_standby_activate(int wid) {
+	uwsgi.workers[wid].pid = uwsgi.workers[wid].standby_pid;
+	uwsgi.workers[wid].standby_pid = 0;
+	uwsgi.workers[wid].cheaped = 0;
+	uwsgi.workers[wid].last_spawn = uwsgi.current_time;
+	uwsgi.workers[wid].cursed_at = 0;
+	uwsgi.workers[wid].no_mercy_at = 0;
+	uwsgi_standby_wake(wid);
+	uwsgi_log("activated standby uWSGI worker %d (pid: %d)\n", wid, (int) uwsgi.workers[wid].pid);
+	return 0;
+}
+
+// returns 1 if the diedpid was a standby worker
+int uwsgi_standby_check_death(pid_t diedpid) {
+	int i;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		if (uwsgi.workers[i].standby_pid == diedpid) {
+			uwsgi.workers[i].standby_pid = 0;
+			uwsgi.workers[i].standby = 0;
+			if (!uwsgi_instance_is_reloading && !uwsgi_instance_is_dying) {
+				uwsgi_log("standby uWSGI worker %d (pid: %d) died\n", i, (int) diedpid);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// kill the standby workers (on reloads and shutdown)
+void uwsgi_standby_destroy() {
+	int i;
+	int waitpid_status;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		pid_t pid = uwsgi.workers[i].standby_pid;
+		if (pid <= 0) continue;
+		kill(pid, SIGKILL);
+		if (waitpid(pid, &waitpid_status, 0) == pid) {
+			uwsgi.workers[i].standby_pid = 0;
+			uwsgi.workers[i].standby = 0;
+		}
+	}
+}
+
+// initialize the process state of a just forked worker (from the master or the zygote)
+void uwsgi_worker_child_setup(int wid) {
+	int i;
+	signal(SIGWINCH, worker_wakeup);
+	signal(SIGTSTP, worker_wakeup);
+	uwsgi.mywid = wid;
+	uwsgi.mypid = getpid();
+	// pid is updated by the master
+	//uwsgi.workers[uwsgi.mywid].pid = uwsgi.mypid;
+	// OVERENGINEERING (just to be safe)
+	uwsgi.workers[uwsgi.mywid].id = uwsgi.mywid;
+	if (uwsgi.memory_stats)
+		uwsgi_memory_stats_worker_init();
+	/*
+	   uwsgi.workers[uwsgi.mywid].harakiri = 0;
+	   uwsgi.workers[uwsgi.mywid].user_harakiri = 0;
+	   uwsgi.workers[uwsgi.mywid].rss_size = 0;
+	   uwsgi.workers[uwsgi.mywid].vsz_size = 0;
+	 */
+	// do not reset worker counters on reload !!!
+	//uwsgi.workers[uwsgi.mywid].requests = 0;
+	// ...but maintain a delta counter (yes this is racy in multithread)
+	//uwsgi.workers[uwsgi.mywid].delta_requests = 0;
+	//uwsgi.workers[uwsgi.mywid].failed_requests = 0;
+	//uwsgi.workers[uwsgi.mywid].respawn_count++;
+	//uwsgi.workers[uwsgi.mywid].last_spawn = uwsgi.current_time;
+	uwsgi.workers[uwsgi.mywid].manage_next_request = 1;
+	/*
+	   uwsgi.workers[uwsgi.mywid].cheaped = 0;
+	   uwsgi.workers[uwsgi.mywid].suspended = 0;
+	   uwsgi.workers[uwsgi.mywid].sig = 0;
+	 */
+
+	// reset the apps count with a copy from the master 
+	uwsgi.workers[uwsgi.mywid].apps_cnt = uwsgi.workers[0].apps_cnt;
+
+	// reset wsgi_request structures
+	for(i=0;i<uwsgi.cores;i++) {
+		uwsgi.workers[uwsgi.mywid].cores[i].in_request = 0;
+		// the vector of the previous worker is not mapped in this process
+		if (uwsgi.compact_cores) {
+			uwsgi.workers[uwsgi.mywid].cores[i].hvec = NULL;
+			uwsgi.workers[uwsgi.mywid].cores[i].hvec_size = 0;
+		}
+		uwsgi.workers[uwsgi.mywid].cores[i].arena_size = 0;
+		memset(&uwsgi.workers[uwsgi.mywid].cores[i].req, 0, sizeof(struct wsgi_request));
+		memset(uwsgi.workers[uwsgi.mywid].cores[i].buffer, 0, sizeof(struct uwsgi_header));
+	}
+
+	uwsgi_fixup_fds(wid, 0, NULL);
+
+	uwsgi.my_signal_socket = uwsgi.workers[wid].signal_pipe[1];
+
+	if (uwsgi.master_process) {
+		if ((uwsgi.workers[uwsgi.mywid].respawn_count || uwsgi.status.is_cheap)) {
+			for (i = 0; i < 256; i++) {
+				if (uwsgi.p[i]->master_fixup) {
+					uwsgi.p[i]->master_fixup(1);
+				}
+			}
+		}
+	}
+}
+
+static int uwsgi_spawn_worker(int wid, int standby);
+
 int uwsgi_respawn_worker(int wid) {
+	if (uwsgi.workers[wid].standby_pid > 0) {
+		return uwsgi_standby_activate(wid);
+	}
+	return uwsgi_spawn_worker(wid, 0);
+}
+
+int uwsgi_standby_spawn(int wid) {
+	return uwsgi_spawn_worker(wid, 1);
+}
+
+static int uwsgi_spawn_worker(int wid, int standby) {
 	int i;
 	int respawns = uwsgi.workers[wid].respawn_count;
 	// the workers is not accepting (obviously)
 	uwsgi.workers[wid].accepting = 0;
+	uwsgi.workers[wid].ready = 0;
 	// we count the respawns before errors...
 	uwsgi.workers[wid].respawn_count++;
 	// ... same for update time
@@ -729,13 +931,16 @@ int uwsgi_respawn_worker(int wid) {
 	uwsgi.workers[wid].vsz_size = 0;
 	uwsgi.workers[wid].uss_size = 0;
 	uwsgi.workers[wid].pss_size = 0;
+	uwsgi.workers[wid].shared_size = 0;
 	// ... reset stopped_at
 	uwsgi.workers[wid].cursed_at = 0;
 	uwsgi.workers[wid].no_mercy_at = 0;
 
 	// internal statuses should be reset too
 
-	uwsgi.workers[wid].cheaped = 0;
+	// standby workers are still cheaped until activation
+	uwsgi.workers[wid].cheaped = standby;
+	uwsgi.workers[wid].standby = standby;
 	// SUSPENSION is managed by the user, not the master...
 	//uwsgi.workers[wid].suspended = 0;
 	uwsgi.workers[wid].sig = 0;
@@ -743,91 +948,49 @@ int uwsgi_respawn_worker(int wid) {
 	// this is required for various checks
 	uwsgi.workers[wid].delta_requests = 0;
 
-	if (uwsgi.threaded_logger) {
-		pthread_mutex_lock(&uwsgi.threaded_logger_lock);
-	}
-
-	pid_t pid = uwsgi_fork(uwsgi.workers[wid].name);
-
-	if (pid == 0) {
-		signal(SIGWINCH, worker_wakeup);
-		signal(SIGTSTP, worker_wakeup);
-		uwsgi.mywid = wid;
-		uwsgi.mypid = getpid();
-		// pid is updated by the master
-		//uwsgi.workers[uwsgi.mywid].pid = uwsgi.mypid;
-		// OVERENGINEERING (just to be safe)
-		uwsgi.workers[uwsgi.mywid].id = uwsgi.mywid;
-		/*
-		   uwsgi.workers[uwsgi.mywid].harakiri = 0;
-		   uwsgi.workers[uwsgi.mywid].user_harakiri = 0;
-		   uwsgi.workers[uwsgi.mywid].rss_size = 0;
-		   uwsgi.workers[uwsgi.mywid].vsz_size = 0;
-		 */
-		// do not reset worker counters on reload !!!
-		//uwsgi.workers[uwsgi.mywid].requests = 0;
-		// ...but maintain a delta counter (yes this is racy in multithread)
-		//uwsgi.workers[uwsgi.mywid].delta_requests = 0;
-		//uwsgi.workers[uwsgi.mywid].failed_requests = 0;
-		//uwsgi.workers[uwsgi.mywid].respawn_count++;
-		//uwsgi.workers[uwsgi.mywid].last_spawn = uwsgi.current_time;
-		uwsgi.workers[uwsgi.mywid].manage_next_request = 1;
-		/*
-		   uwsgi.workers[uwsgi.mywid].cheaped = 0;
-		   uwsgi.workers[uwsgi.mywid].suspended = 0;
-		   uwsgi.workers[uwsgi.mywid].sig = 0;
-		 */
-
-		// reset the apps count with a copy from the master 
-		uwsgi.workers[uwsgi.mywid].apps_cnt = uwsgi.workers[0].apps_cnt;
-
-		// reset wsgi_request structures
-		for(i=0;i<uwsgi.cores;i++) {
-			uwsgi.workers[uwsgi.mywid].cores[i].in_request = 0;
-			memset(&uwsgi.workers[uwsgi.mywid].cores[i].req, 0, sizeof(struct wsgi_request));
-			memset(uwsgi.workers[uwsgi.mywid].cores[i].buffer, 0, sizeof(struct uwsgi_header));
-		}
-
-		uwsgi_fixup_fds(wid, 0, NULL);
-
-		uwsgi.my_signal_socket = uwsgi.workers[wid].signal_pipe[1];
-
-		if (uwsgi.master_process) {
-			if ((uwsgi.workers[uwsgi.mywid].respawn_count || uwsgi.status.is_cheap)) {
-				for (i = 0; i < 256; i++) {
-					if (uwsgi.p[i]->master_fixup) {
-						uwsgi.p[i]->master_fixup(1);
-					}
-				}
+	pid_t pid = -1;
+	if (uwsgi.zygote) {
+		pid = uwsgi_zygote_fork(wid);
+	}
+
+	if (pid < 0) {
+		if (uwsgi.threaded_logger) {
+			pthread_mutex_lock(&uwsgi.threaded_logger_lock);
+		}
+
+		pid = uwsgi_fork(uwsgi.workers[wid].name);
+		if (pid == 0) {
+			uwsgi_worker_child_setup(wid);
+			if (uwsgi.threaded_logger) {
+				pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
 			}
+			return 1;
 		}
 
 		if (uwsgi.threaded_logger) {
 			pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
 		}
-
-		return 1;
 	}
-	else if (pid < 1) {
+
+	if (pid < 1) {
 		uwsgi_error("fork()");
 	}
 	else {
 		// the pid is set only in the master, as the worker should never use it
-		uwsgi.workers[wid].pid = pid;
-
-		if (respawns > 0) {
+		if (standby) {
+			uwsgi.workers[wid].standby_pid = pid;
+			uwsgi_log("spawned uWSGI standby worker %d (pid: %d, cores: %d)\n", wid, pid, uwsgi.cores);
+		}
+		else if (respawns > 0) {
+			uwsgi.workers[wid].pid = pid;
 			uwsgi_log("Respawned uWSGI worker %d (new pid: %d)\n", wid, (int) pid);
 		}
 		else {
+			uwsgi.workers[wid].pid = pid;
 			uwsgi_log("spawned uWSGI worker %d (pid: %d, cores: %d)\n", wid, pid, uwsgi.cores);
 		}
 	}
 
-	if (uwsgi.threaded_logger) {
-		pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
-	}
-
-
 	return 0;
 }
 
@@ -919,7 +1082,17 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 	while (uli) {
 		if (uwsgi_stats_object_open(us))
 			goto end;
-		if (uwsgi_stats_keylong(us, uli->id, (unsigned long long) uli->pid))
+		if (uwsgi.lock_stats) {
+			if (uwsgi_stats_keylong_comma(us, uli->id, (unsigned long long) uli->pid))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "acquisitions", (unsigned long long) uli->acquisitions))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "contended", (unsigned long long) uli->contended))
+				goto end;
+			if (uwsgi_stats_keylong(us, "wait_us", (unsigned long long) uli->wait_us))
+				goto end;
+		}
+		else if (uwsgi_stats_keylong(us, uli->id, (unsigned long long) uli->pid))
 			goto end;
 		if (uwsgi_stats_object_close(us))
 			goto end;
@@ -935,6 +1108,11 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 	if (uwsgi_stats_comma(us))
 		goto end;
 
+	if (uwsgi.caches && uwsgi.memory_stats) {
+		if (uwsgi_stats_keylong_comma(us, "cache_memory", (unsigned long long) uwsgi_memory_caches()))
+			goto end;
+	}
+
 	if (uwsgi.caches) {
 
 		
@@ -969,18 +1147,65 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 			if (uwsgi_stats_keylong_comma(us, "blocksize", (unsigned long long) uc->blocksize))
 				goto end;
 
-			if (uwsgi_stats_keylong_comma(us, "items", (unsigned long long) uc->n_items))
+			// the page size backing the items (huge pages)
+			if (uwsgi_stats_keylong_comma(us, "page_size", (unsigned long long) (uc->shards ? uc->shards[0]->items_page_size : uc->items_page_size)))
+				goto end;
+
+			// sharded caches report the sum of their shards
+			uint64_t n_items = uc->n_items, hits = uc->hits, miss = uc->miss, full = uc->full, rejected = uc->rejected, replication_dropped = uc->replication_dropped;
+			uint64_t legion_forwarded = uc->legion_forwarded, legion_refused = uc->legion_refused;
+			if (uc->shards) {
+				uint64_t i;
+				for (i = 0; i < uc->shards_count; i++) {
+					n_items += uc->shards[i]->n_items;
+					hits += uc->shards[i]->hits;
+					miss += uc->shards[i]->miss;
+					full += uc->shards[i]->full;
+					rejected += uc->shards[i]->rejected;
+					replication_dropped += uc->shards[i]->replication_dropped;
+					legion_forwarded += uc->shards[i]->legion_forwarded;
+					legion_refused += uc->shards[i]->legion_refused;
+				}
+				if (uwsgi_stats_keylong_comma(us, "shards", (unsigned long long) uc->shards_count))
+					goto end;
+			}
+
+			if (uwsgi_stats_keylong_comma(us, "items", (unsigned long long) n_items))
 				goto end;
 
-			if (uwsgi_stats_keylong_comma(us, "hits", (unsigned long long) uc->hits))
+			if (uwsgi_stats_keylong_comma(us, "hits", (unsigned long long) hits))
 				goto end;
 
-			if (uwsgi_stats_keylong_comma(us, "miss", (unsigned long long) uc->miss))
+			if (uwsgi_stats_keylong_comma(us, "miss", (unsigned long long) miss))
 				goto end;
 
-			if (uwsgi_stats_keylong_comma(us, "full", (unsigned long long) uc->full))
+			if (uwsgi_stats_keylong_comma(us, "full", (unsigned long long) full))
 				goto end;
 
+			if (uc->replication_window) {
+				if (uwsgi_stats_keylong_comma(us, "replication_dropped", (unsigned long long) replication_dropped))
+					goto end;
+			}
+
+#ifdef UWSGI_SSL
+			if (uc->legion) {
+				if (uwsgi_stats_keylong_comma(us, "legion_forwarded", (unsigned long long) legion_forwarded))
+					goto end;
+				if (uwsgi_stats_keylong_comma(us, "legion_refused", (unsigned long long) legion_refused))
+					goto end;
+			}
+#endif
+
+			if (uc->udp_servers) {
+				if (uwsgi_stats_keylong_comma(us, "replication_lost", (unsigned long long) uc->replication_lost))
+					goto end;
+			}
+
+			if (uc->tinylfu) {
+				if (uwsgi_stats_keylong_comma(us, "rejected", (unsigned long long) rejected))
+					goto end;
+			}
+
 			if (uwsgi_stats_keylong(us, "last_modified_at", (unsigned long long) uc->last_modified_at))
 				goto end;
 
@@ -1001,6 +1226,43 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 		goto end;
 	}
 
+	if (uwsgi.sharedareas_cnt > 0) {
+		if (uwsgi_stats_key(us, "sharedareas"))
+			goto end;
+
+		if (uwsgi_stats_list_open(us)) goto end;
+
+		int i;
+		for (i = 0; i < uwsgi.sharedareas_cnt; i++) {
+			struct uwsgi_sharedarea *sa = uwsgi.sharedareas[i];
+			if (uwsgi_stats_object_open(us))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "id", (unsigned long long) sa->id))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "pages", (unsigned long long) sa->pages))
+				goto end;
+			if (uwsgi_stats_keylong(us, "page_size", (unsigned long long) sa->mem_page_size))
+				goto end;
+			if (uwsgi_stats_object_close(us))
+				goto end;
+			if (i < uwsgi.sharedareas_cnt - 1) {
+				if (uwsgi_stats_comma(us))
+					goto end;
+			}
+		}
+
+		if (uwsgi_stats_list_close(us))
+			goto end;
+
+		if (uwsgi_stats_comma(us))
+			goto end;
+	}
+
+	if (uwsgi.queue_size > 0) {
+		if (uwsgi_stats_keylong_comma(us, "queue_page_size", (unsigned long long) uwsgi.queue_page_size))
+			goto end;
+	}
+
 	if (uwsgi.has_metrics && !uwsgi.stats_no_metrics) {
 		if (uwsgi_stats_key(us, "metrics"))
                 	goto end;
@@ -1094,6 +1356,18 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 		if (uwsgi_stats_keylong(us, "can_offload", (unsigned long long) uwsgi_sock->can_offload))
 			goto end;
 
+		if (uwsgi_sock->post_buffering_policy) {
+			struct uwsgi_post_buffering_policy *upbp = uwsgi_sock->post_buffering_policy;
+			if (uwsgi_stats_comma(us))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "post_buffering", (unsigned long long) upbp->threshold))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "post_buffered_in_memory", (unsigned long long) upbp->in_memory))
+				goto end;
+			if (uwsgi_stats_keylong(us, "post_buffered_in_disk", (unsigned long long) upbp->in_disk))
+				goto end;
+		}
+
 		if (uwsgi_stats_object_close(us))
 			goto end;
 
@@ -1125,6 +1399,8 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 			goto end;
 		if (uwsgi_stats_keylong_comma(us, "accepting", (unsigned long long) uwsgi.workers[i + 1].accepting))
 			goto end;
+		if (uwsgi_stats_keylong_comma(us, "ready", (unsigned long long) uwsgi.workers[i + 1].ready))
+			goto end;
 		if (uwsgi_stats_keylong_comma(us, "requests", (unsigned long long) uwsgi.workers[i + 1].requests))
 			goto end;
 		if (uwsgi_stats_keylong_comma(us, "delta_requests", (unsigned long long) uwsgi.workers[i + 1].delta_requests))
@@ -1133,6 +1409,22 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 			goto end;
 		if (uwsgi_stats_keylong_comma(us, "harakiri_count", (unsigned long long) uwsgi.workers[i + 1].harakiri_count))
 			goto end;
+		if (uwsgi.harakiri_soft) {
+			if (uwsgi_stats_keylong_comma(us, "soft_harakiri_count", (unsigned long long) uwsgi.workers[i + 1].soft_harakiri_count))
+				goto end;
+		}
+		if (uwsgi.admission_max_wait || uwsgi.admission_codel || uwsgi.admission_socket_max_wait) {
+			if (uwsgi_stats_keylong_comma(us, "admission_refused", (unsigned long long) uwsgi.workers[i + 1].admission_refused))
+				goto end;
+		}
+		if (uwsgi.priority_classes) {
+			if (uwsgi_stats_keylong_comma(us, "priority_handovers", (unsigned long long) uwsgi.workers[i + 1].priority_handovers))
+				goto end;
+		}
+		if (uwsgi.affinity_fds) {
+			if (uwsgi_stats_keylong_comma(us, "affinity_handovers", (unsigned long long) uwsgi.workers[i + 1].affinity_handovers))
+				goto end;
+		}
 		if (uwsgi_stats_keylong_comma(us, "signals", (unsigned long long) uwsgi.workers[i + 1].signals))
 			goto end;
 
@@ -1174,6 +1466,44 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 			goto end;
 		if (uwsgi_stats_keylong_comma(us, "pss", (unsigned long long) uwsgi.workers[i + 1].pss_size))
 			goto end;
+		if (uwsgi_stats_keylong_comma(us, "shared", (unsigned long long) uwsgi.workers[i + 1].shared_size))
+			goto end;
+
+		if (uwsgi.memory_stats) {
+			struct uwsgi_worker *uw = &uwsgi.workers[i + 1];
+			if (uwsgi_stats_key(us, "memory"))
+				goto end;
+			if (uwsgi_stats_object_open(us))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "heap_used", (unsigned long long) uw->heap_used))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "heap_free", (unsigned long long) uw->heap_free))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "heap_mapped", (unsigned long long) uw->heap_mapped))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "fragmentation", (unsigned long long) uw->heap_fragmentation))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "alloc_count", (unsigned long long) uw->alloc_count))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "alloc_bytes", (unsigned long long) uw->alloc_bytes))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "alloc_rate", (unsigned long long) uw->alloc_rate))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "alloc_buffers", (unsigned long long) uw->alloc_buffers))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "alloc_routing", (unsigned long long) uw->alloc_routing))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "alloc_plugins", (unsigned long long) uw->alloc_plugins))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "buffers", (unsigned long long) uw->mem_buffers))
+				goto end;
+			if (uwsgi_stats_keylong(us, "plugins", (unsigned long long) uw->mem_plugins))
+				goto end;
+			if (uwsgi_stats_object_close(us))
+				goto end;
+			if (uwsgi_stats_comma(us))
+				goto end;
+		}
 
 		if (uwsgi_stats_keylong_comma(us, "running_time", (unsigned long long) uwsgi.workers[i + 1].running_time))
 			goto end;
@@ -1273,9 +1603,18 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 			if (uwsgi_stats_keylong_comma(us, "read_errors", (unsigned long long) uc->read_errors))
 				goto end;
 
+			if (uwsgi_stats_keylong_comma(us, "log_dropped", (unsigned long long) uc->log_dropped))
+				goto end;
+
 			if (uwsgi_stats_keylong_comma(us, "in_request", (unsigned long long) uc->in_request))
 				goto end;
 
+			if (uwsgi_stats_keylong_comma(us, "memory", (unsigned long long) uwsgi_memory_core(uc)))
+				goto end;
+
+			if (uwsgi_stats_keylong_comma(us, "hvec_size", (unsigned long long) uc->hvec_size))
+				goto end;
+
 			if (uwsgi_stats_key(us, "vars"))
 				goto end;
 
@@ -1662,6 +2001,32 @@ void trigger_harakiri(int i) {
 
 }
 
+/*
+	--harakiri-soft: the plugins dump the stack of the worker (as on harakiri) and the worker
+	is asked (SIGXCPU) to abort the request of the core, it is killed only if the request is
+	still running after harakiri-soft seconds
+*/
+void trigger_soft_harakiri(int i, int j) {
+	int k;
+	uwsgi_log_verbose("*** SOFT HARAKIRI ON WORKER %d CORE %d (pid: %d), killing it in %d seconds ***\n", i, j, uwsgi.workers[i].pid, uwsgi.harakiri_soft);
+	uwsgi.workers[i].cores[j].soft_harakiri = uwsgi_now();
+	if (uwsgi.workers[i].pid <= 0) return;
+
+	for (k = 0; k < uwsgi.gp_cnt; k++) {
+		if (uwsgi.gp[k]->harakiri) {
+			uwsgi.gp[k]->harakiri(i);
+		}
+	}
+	for (k = 0; k < 256; k++) {
+		if (uwsgi.p[k]->harakiri) {
+			uwsgi.p[k]->harakiri(i);
+		}
+	}
+
+	kill(uwsgi.workers[i].pid, SIGXCPU);
+	uwsgi.workers[i].soft_harakiri_count++;
+}
+
 void uwsgi_master_fix_request_counters() {
 	int i;
 	uint64_t total_counter = 0;
@@ -0,0 +1,193 @@
+#include "uwsgi.h"
+
+#if defined(UWSGI_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#elif defined(UWSGI_TCMALLOC)
+#include <gperftools/malloc_extension_c.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	allocator statistics (--memory-stats)
+
+	every worker periodically (at most once per second, at the end of a request) asks the allocator
+	it has been linked with (libc, jemalloc or tcmalloc, see the malloc_implementation build option)
+	how much heap is used and how much is retained but free, and publishes it in its (shared) worker
+	structure so the master can expose it via the stats server and the metrics subsystem.
+
+	allocations made through uwsgi_malloc()/uwsgi_calloc() (and uwsgi_buffer growth) are counted too, and attributed
+	to the subsystem the current thread is running (core, buffers, routing or plugins request handlers).
+	Those counters are cumulative (they never decrease on free) and are meant to find allocation hot spots.
+
+*/
+
+static __thread int memory_subsystem;
+
+void uwsgi_memory_account_to(int subsystem, size_t size) {
+	__atomic_add_fetch(&uwsgi.memory_alloc_count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&uwsgi.memory_alloc_bytes[subsystem], size, __ATOMIC_RELAXED);
+}
+
+void uwsgi_memory_account(size_t size) {
+	uwsgi_memory_account_to(memory_subsystem, size);
+}
+
+// returns the previous subsystem (to be passed to uwsgi_memory_leave())
+int uwsgi_memory_enter(int subsystem) {
+	if (!uwsgi.memory_stats) return -1;
+	int old = memory_subsystem;
+	memory_subsystem = subsystem;
+	return old;
+}
+
+void uwsgi_memory_leave(int old) {
+	if (old < 0) return;
+	memory_subsystem = old;
+}
+
+char *uwsgi_memory_allocator() {
+#if defined(UWSGI_JEMALLOC)
+	return "jemalloc";
+#elif defined(UWSGI_TCMALLOC)
+	return "tcmalloc";
+#elif defined(__GLIBC__)
+	return "glibc";
+#else
+	return NULL;
+#endif
+}
+
+// used: bytes given to the application, free: bytes retained by the allocator but not used, mapped: total heap
+int uwsgi_memory_heap(uint64_t *used, uint64_t *free_bytes, uint64_t *mapped) {
+#if defined(UWSGI_JEMALLOC)
+	uint64_t epoch = 1;
+	size_t allocated = 0, resident = 0, len = sizeof(size_t);
+	// stats are cached by jemalloc, refresh them
+	mallctl("epoch", NULL, NULL, &epoch, sizeof(epoch));
+	if (mallctl("stats.allocated", &allocated, &len, NULL, 0)) return -1;
+	len = sizeof(size_t);
+	if (mallctl("stats.resident", &resident, &len, NULL, 0)) return -1;
+	*used = allocated;
+	*mapped = resident;
+	*free_bytes = resident > allocated ? resident - allocated : 0;
+	return 0;
+#elif defined(UWSGI_TCMALLOC)
+	size_t allocated = 0, heap = 0, unmapped = 0;
+	if (!MallocExtension_GetNumericProperty("generic.current_allocated_bytes", &allocated)) return -1;
+	if (!MallocExtension_GetNumericProperty("generic.heap_size", &heap)) return -1;
+	MallocExtension_GetNumericProperty("tcmalloc.pageheap_unmapped_bytes", &unmapped);
+	*used = allocated;
+	*mapped = heap > unmapped ? heap - unmapped : 0;
+	*free_bytes = *mapped > allocated ? *mapped - allocated : 0;
+	return 0;
+#elif defined(__GLIBC__)
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+	*used = (uint64_t) mi.uordblks + (uint64_t) mi.hblkhd;
+	*free_bytes = (uint64_t) mi.fordblks;
+	*mapped = (uint64_t) mi.arena + (uint64_t) mi.hblkhd;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+// the per-core memory areas mapped for every worker (see uwsgi_setup_workers())
+static uint64_t memory_buffers() {
+	uint64_t size = (uwsgi.buffer_size + 4) * uwsgi.cores;
+	if (!uwsgi.compact_cores)
+		size += sizeof(struct iovec) * uwsgi.vec_size * uwsgi.cores;
+	if (uwsgi.post_buffering > 0)
+		size += uwsgi.post_buffering_bufsize * uwsgi.cores;
+	if (uwsgi.req_log_ring)
+		size += (sizeof(struct uwsgi_log_ring) + uwsgi.req_log_ring) * uwsgi.cores;
+	return size;
+}
+
+// called in the master before the apps are loaded, and in the worker after lazy loading
+void uwsgi_memory_stats_apps_begin() {
+	uint64_t free_bytes, mapped;
+	if (uwsgi_memory_heap(&uwsgi.memory_apps_heap, &free_bytes, &mapped)) uwsgi.memory_apps_heap = 0;
+}
+
+void uwsgi_memory_stats_apps_end() {
+	uint64_t used, free_bytes, mapped;
+	if (uwsgi_memory_heap(&used, &free_bytes, &mapped)) return;
+	if (used > uwsgi.memory_apps_heap)
+		uwsgi.memory_plugins += used - uwsgi.memory_apps_heap;
+}
+
+// the counters are inherited from the master, every worker starts from zero
+void uwsgi_memory_stats_worker_init() {
+	int i;
+	uwsgi.memory_alloc_count = 0;
+	for (i = 0; i < UWSGI_MEM_SUBSYSTEMS; i++) {
+		uwsgi.memory_alloc_bytes[i] = 0;
+	}
+	uwsgi.memory_last_bytes = 0;
+	uwsgi.workers[uwsgi.mywid].memory_stats_at = 0;
+	uwsgi.workers[uwsgi.mywid].alloc_rate = 0;
+	uwsgi.workers[uwsgi.mywid].mem_buffers = memory_buffers();
+}
+
+void uwsgi_memory_stats_update(uint64_t now) {
+	struct uwsgi_worker *uw = &uwsgi.workers[uwsgi.mywid];
+	// once per second is enough
+	if (uw->memory_stats_at && now - uw->memory_stats_at < 1000000) return;
+
+	uint64_t used, free_bytes, mapped;
+	if (!uwsgi_memory_heap(&used, &free_bytes, &mapped)) {
+		uw->heap_used = used;
+		uw->heap_free = free_bytes;
+		uw->heap_mapped = mapped;
+		uw->heap_fragmentation = mapped ? (free_bytes * 100) / mapped : 0;
+	}
+
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < UWSGI_MEM_SUBSYSTEMS; i++) {
+		bytes += __atomic_load_n(&uwsgi.memory_alloc_bytes[i], __ATOMIC_RELAXED);
+	}
+	if (uw->memory_stats_at) {
+		uw->alloc_rate = ((bytes - uwsgi.memory_last_bytes) * 1000000) / (now - uw->memory_stats_at);
+	}
+	uwsgi.memory_last_bytes = bytes;
+
+	uw->alloc_count = __atomic_load_n(&uwsgi.memory_alloc_count, __ATOMIC_RELAXED);
+	uw->alloc_bytes = bytes;
+	uw->alloc_buffers = __atomic_load_n(&uwsgi.memory_alloc_bytes[UWSGI_MEM_BUFFERS], __ATOMIC_RELAXED);
+	uw->alloc_routing = __atomic_load_n(&uwsgi.memory_alloc_bytes[UWSGI_MEM_ROUTING], __ATOMIC_RELAXED);
+	uw->alloc_plugins = __atomic_load_n(&uwsgi.memory_alloc_bytes[UWSGI_MEM_PLUGINS], __ATOMIC_RELAXED);
+	uw->mem_plugins = uwsgi.memory_plugins;
+	uw->memory_stats_at = now;
+}
+
+// shared memory mapped by the caches (shards are in the list too, their parent maps nothing)
+uint64_t uwsgi_memory_caches() {
+	uint64_t size = 0;
+	struct uwsgi_cache *uc = uwsgi.caches;
+	while (uc) {
+		size += uc->filesize;
+		uc = uc->next;
+	}
+	return size;
+}
+
+// memory used by a core: its structure, buffers, vars vector and request arena
+uint64_t uwsgi_memory_core(struct uwsgi_core *uc) {
+	uint64_t size = sizeof(struct uwsgi_core) + (uwsgi.buffer_size + 4) + (sizeof(void *) * uwsgi.max_apps);
+	size += sizeof(struct iovec) * uc->hvec_size;
+	if (uwsgi.post_buffering > 0)
+		size += uwsgi.post_buffering_bufsize;
+	if (uc->req_log_ring)
+		size += sizeof(struct uwsgi_log_ring) + uwsgi.req_log_ring;
+	size += uc->arena_size;
+	return size;
+}
@@ -26,8 +26,9 @@ extern struct uwsgi_server uwsgi;
 	counter
 	absolute
 
-	metrics are managed by a dedicated thread (in the master) holding a linked list of all the items. For few metrics it is a good (read: simple) approach,
-	but you can cache lookups in a uWSGI cache for really big list. (TODO)
+	metrics are managed by a dedicated thread (in the master) holding a linked list of all the items. Lookups by name, oid
+	and asn/ber representation go through per-process hash indexes (built while registering, before fork), and the
+	SNMP walks (GETNEXT/GETBULK) use an array sorted by oid, so even thousands of metrics are cheap to reach.
 
 	struct uwsgi_metric *um = uwsgi_register_metric("worker.1.requests", "3.1.1", UWSGI_METRIC_COUNTER, "ptr", &uwsgi.workers[1].requests, 0, NULL);
 	prototype: struct uwsgi_metric *uwsgi_register_metric(char *name, char *oid, uint8_t value_type, char *collector, void *ptr, uint32_t freq, void *custom);
@@ -55,6 +56,9 @@ extern struct uwsgi_server uwsgi;
 
 	Updating metrics from your app MUST BE ATOMIC, for such a reason a uWSGI rwlock is initialized on startup and used for each operation (simple reading from a metric does not require locking)
 
+	metric_inc and metric_dec do not lock: every worker adds to its own cacheline and the collector thread folds the
+	pending increments in the value every second (metric_get and the other operations include them immediately)
+
 	Metrics can be updated from the internal routing subsystem too:
 
 		route-if = equal:${REQUEST_URI};/foobar metricinc:foobar.test 2
@@ -63,6 +67,13 @@ extern struct uwsgi_server uwsgi;
 
 	The stats server exports the metrics list in the "metrics" attribute (obviously some info could be redundant)
 
+	Histograms (type=histogram) count observations in log2 buckets (one row for each worker, updated lock-free),
+	the value of the metric is the number of observations. Their sum and percentiles are exposed as additional
+	metrics <name>.sum, <name>.p50, <name>.p90, <name>.p99 and <name>.p999 (oid <oid>.1 ... <oid>.5), so they are
+	available to the stats server, SNMP and the pushers like any other metric.
+
+	uwsgi.metric_observe("foo.latency", N)
+
 */
 
 
@@ -174,21 +185,160 @@ static int uwsgi_validate_metric_oid(char *buf) {
         return 1;
 }
 
-void uwsgi_metric_append(struct uwsgi_metric *um) {
-	struct uwsgi_metric *old_metric=NULL,*metric=uwsgi.metrics;
+/*
+
+	metrics indexes
+
+	three chained hash tables (name, oid and asn) over the metrics in the list, the chains use the
+	name_next/oid_next/asn_next fields of the metrics themselves. The tables are doubled when the
+	number of metrics reaches their size.
+
+	the array sorted by asn is rebuilt lazily (on the first SNMP walk after an oid change).
+
+*/
+
+static struct {
+	struct uwsgi_metric **by_name;
+	struct uwsgi_metric **by_oid;
+	struct uwsgi_metric **by_asn;
+	uint64_t size;
+	struct uwsgi_metric *tail;
+	struct uwsgi_metric **sorted;
+	uint64_t sorted_cnt;
+	int sorted_dirty;
+} metrics_index;
+
+static void metrics_index_link(struct uwsgi_metric **table, struct uwsgi_metric *um, char *key, size_t len, size_t next_off) {
+	uint64_t slot = djb33x_hash(key, len) & (metrics_index.size - 1);
+	*(struct uwsgi_metric **) (((char *) um) + next_off) = table[slot];
+	table[slot] = um;
+}
+
+static void metrics_index_unlink(struct uwsgi_metric **table, struct uwsgi_metric *um, char *key, size_t len, size_t next_off) {
+	struct uwsgi_metric **cur = &table[djb33x_hash(key, len) & (metrics_index.size - 1)];
+	while(*cur) {
+		struct uwsgi_metric **next = (struct uwsgi_metric **) (((char *) *cur) + next_off);
+		if (*cur == um) {
+			*cur = *next;
+			return;
+		}
+		cur = next;
+	}
+}
+
+static void metrics_index_add_oid(struct uwsgi_metric *um) {
+	if (!um->oid) return;
+	metrics_index_link(metrics_index.by_oid, um, um->oid, um->oid_len, offsetof(struct uwsgi_metric, oid_next));
+	metrics_index_link(metrics_index.by_asn, um, um->asn, um->asn_len, offsetof(struct uwsgi_metric, asn_next));
+	metrics_index.sorted_dirty = 1;
+}
+
+static void metrics_index_del_oid(struct uwsgi_metric *um) {
+	if (!um->oid) return;
+	metrics_index_unlink(metrics_index.by_oid, um, um->oid, um->oid_len, offsetof(struct uwsgi_metric, oid_next));
+	metrics_index_unlink(metrics_index.by_asn, um, um->asn, um->asn_len, offsetof(struct uwsgi_metric, asn_next));
+	metrics_index.sorted_dirty = 1;
+}
+
+// called after the metric has been added to the list
+static void metrics_index_add(struct uwsgi_metric *um) {
+	metrics_index.tail = um;
+	um->indexed = 1;
+	if (uwsgi.metrics_cnt < metrics_index.size) {
+		metrics_index_link(metrics_index.by_name, um, um->name, um->name_len, offsetof(struct uwsgi_metric, name_next));
+		metrics_index_add_oid(um);
+		return;
+	}
+
+	// grow and rebuild from the list (the new metric included)
+	free(metrics_index.by_name);
+	free(metrics_index.by_oid);
+	free(metrics_index.by_asn);
+	metrics_index.size = metrics_index.size ? metrics_index.size * 2 : 256;
+	metrics_index.by_name = uwsgi_calloc(sizeof(struct uwsgi_metric *) * metrics_index.size);
+	metrics_index.by_oid = uwsgi_calloc(sizeof(struct uwsgi_metric *) * metrics_index.size);
+	metrics_index.by_asn = uwsgi_calloc(sizeof(struct uwsgi_metric *) * metrics_index.size);
+	struct uwsgi_metric *metric = uwsgi.metrics;
 	while(metric) {
-		old_metric = metric;
-                metric = metric->next;
+		metrics_index_link(metrics_index.by_name, metric, metric->name, metric->name_len, offsetof(struct uwsgi_metric, name_next));
+		metrics_index_add_oid(metric);
+		metric = metric->next;
 	}
+}
 
-	if (old_metric) {
-                       old_metric->next = um;
-        }
-        else {
-        	uwsgi.metrics = um;
-        }
+// compare two asn/ber encoded oids arc by arc
+int uwsgi_metric_asn_cmp(char *a, size_t a_len, char *b, size_t b_len) {
+	size_t i = 0, j = 0;
+	while(i < a_len && j < b_len) {
+		uint64_t arc_a = 0, arc_b = 0;
+		while(i < a_len) {
+			uint8_t c = a[i++];
+			arc_a = (arc_a << 7) | (c & 0x7f);
+			if (!(c & 0x80)) break;
+		}
+		while(j < b_len) {
+			uint8_t c = b[j++];
+			arc_b = (arc_b << 7) | (c & 0x7f);
+			if (!(c & 0x80)) break;
+		}
+		if (arc_a != arc_b) return arc_a < arc_b ? -1 : 1;
+	}
+	if (i < a_len) return 1;
+	if (j < b_len) return -1;
+	return 0;
+}
+
+static int metrics_sorted_cmp(const void *a, const void *b) {
+	struct uwsgi_metric *um_a = *(struct uwsgi_metric **) a;
+	struct uwsgi_metric *um_b = *(struct uwsgi_metric **) b;
+	return uwsgi_metric_asn_cmp(um_a->asn, um_a->asn_len, um_b->asn, um_b->asn_len);
+}
+
+static void metrics_index_sort() {
+	free(metrics_index.sorted);
+	metrics_index.sorted = uwsgi_malloc(sizeof(struct uwsgi_metric *) * (uwsgi.metrics_cnt + 1));
+	metrics_index.sorted_cnt = 0;
+	struct uwsgi_metric *um = uwsgi.metrics;
+	while(um) {
+		if (um->oid && um->asn) {
+			metrics_index.sorted[metrics_index.sorted_cnt++] = um;
+		}
+		um = um->next;
+	}
+	qsort(metrics_index.sorted, metrics_index.sorted_cnt, sizeof(struct uwsgi_metric *), metrics_sorted_cmp);
+	metrics_index.sorted_dirty = 0;
+}
+
+// the metric with the lowest oid greater than asn (the first one if asn is NULL)
+struct uwsgi_metric *uwsgi_metric_find_next_by_asn(char *asn, size_t len) {
+	if (metrics_index.sorted_dirty || !metrics_index.sorted) metrics_index_sort();
+	uint64_t low = 0, high = metrics_index.sorted_cnt;
+	if (asn) {
+		while(low < high) {
+			uint64_t mid = low + ((high - low) / 2);
+			struct uwsgi_metric *um = metrics_index.sorted[mid];
+			if (uwsgi_metric_asn_cmp(um->asn, um->asn_len, asn, len) <= 0) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+	}
+	if (low >= metrics_index.sorted_cnt) return NULL;
+	return metrics_index.sorted[low];
+}
+
+void uwsgi_metric_append(struct uwsgi_metric *um) {
+	if (metrics_index.tail) {
+		metrics_index.tail->next = um;
+	}
+	else {
+		uwsgi.metrics = um;
+	}
 
-        uwsgi.metrics_cnt++;
+	uwsgi.metrics_cnt++;
+	metrics_index_add(um);
 }
 
 struct uwsgi_metric_collector *uwsgi_metric_collector_by_name(char *name) {
@@ -202,9 +352,12 @@ struct uwsgi_metric_collector *uwsgi_metric_collector_by_name(char *name) {
 	exit(1);
 }
 
+static void uwsgi_metric_histogram_children(struct uwsgi_metric *);
+
 struct uwsgi_metric *uwsgi_register_metric_do(char *name, char *oid, uint8_t value_type, char *collector, void *ptr, uint32_t freq, void *custom, int do_not_push) {
 	if (!uwsgi.has_metrics) return NULL;
-	struct uwsgi_metric *old_metric=NULL,*metric=uwsgi.metrics;
+	struct uwsgi_metric *metric = NULL;
+	int created = 0;
 
 	if (!uwsgi_validate_metric_name(name)) {
 		uwsgi_log("invalid metric name: %s\n", name);
@@ -216,31 +369,21 @@ struct uwsgi_metric *uwsgi_register_metric_do(char *name, char *oid, uint8_t val
 		exit(1);
 	}
 
-	while(metric) {
-		if (!strcmp(metric->name, name)) {
-			goto found;
-		}
-		old_metric = metric;
-		metric = metric->next;
-	}
+	metric = uwsgi_metric_find_by_name(name);
+	if (metric) goto found;
 
 	metric = uwsgi_calloc(sizeof(struct uwsgi_metric));
 	// always make a copy of the name (so we can use stack for building strings)
 	metric->name = uwsgi_str(name);
 	metric->name_len = strlen(metric->name);
+	created = 1;
 
 	if (!do_not_push) {
-		if (old_metric) {
-			old_metric->next = metric;
-		}
-		else {
-			uwsgi.metrics = metric;
-		}
-
-		uwsgi.metrics_cnt++;
+		uwsgi_metric_append(metric);
 	}
 
 found:
+	if (metric->indexed) metrics_index_del_oid(metric);
 	metric->oid = oid;
 	if (metric->oid) {
 		metric->oid_len = strlen(oid);
@@ -261,8 +404,11 @@ found:
 		ub->buf = NULL;
 		uwsgi_buffer_destroy(ub);
 		free(oid_tmp);
+		if (metric->indexed) metrics_index_add_oid(metric);
 	}
 	metric->type = value_type;
+	// the value of a histogram is the number of observations
+	if (value_type == UWSGI_METRIC_HISTOGRAM && !collector) collector = "histogram";
 	metric->collector = uwsgi_metric_collector_by_name(collector);
 	metric->ptr = ptr;
 	metric->freq = freq;
@@ -299,9 +445,37 @@ found:
 		free(filename);
 	}
 
+	if (created && value_type == UWSGI_METRIC_HISTOGRAM) {
+		uwsgi_metric_histogram_children(metric);
+	}
+
 	return metric;
 }
 
+/*
+	metrics derived from a histogram, arg1n is the percentile (per mille) or -1 for the sum
+*/
+static void uwsgi_metric_histogram_child(struct uwsgi_metric *um, char *suffix, int oid, uint8_t type, int64_t arg1n) {
+	char buf[4096];
+	char buf2[4096];
+	int ret = snprintf(buf, 4096, "%s.%s", um->name, suffix);
+	if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric name for histogram %s\n", um->name); exit(1);}
+	if (um->oid) {
+		ret = snprintf(buf2, 4096, "%s.%d", um->oid, oid);
+		if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric oid for histogram %s\n", um->name); exit(1);}
+	}
+	struct uwsgi_metric *child = uwsgi_register_metric(buf, um->oid ? buf2 : NULL, type, "histogram", NULL, um->freq, um);
+	child->arg1n = arg1n;
+}
+
+static void uwsgi_metric_histogram_children(struct uwsgi_metric *um) {
+	uwsgi_metric_histogram_child(um, "sum", 1, UWSGI_METRIC_COUNTER, -1);
+	uwsgi_metric_histogram_child(um, "p50", 2, UWSGI_METRIC_GAUGE, 500);
+	uwsgi_metric_histogram_child(um, "p90", 3, UWSGI_METRIC_GAUGE, 900);
+	uwsgi_metric_histogram_child(um, "p99", 4, UWSGI_METRIC_GAUGE, 990);
+	uwsgi_metric_histogram_child(um, "p999", 5, UWSGI_METRIC_GAUGE, 999);
+}
+
 struct uwsgi_metric *uwsgi_register_metric(char *name, char *oid, uint8_t value_type, char *collector, void *ptr, uint32_t freq, void *custom) {
 	return uwsgi_register_metric_do(name, oid, value_type, collector, ptr, freq, custom, 0);
 }
@@ -367,6 +541,9 @@ struct uwsgi_metric *uwsgi_register_keyval_metric(char *arg) {
 		else if (!strcmp(m_type, "alias")) {
 			type = UWSGI_METRIC_ALIAS;
 		}
+		else if (!strcmp(m_type, "histogram")) {
+			type = UWSGI_METRIC_HISTOGRAM;
+		}
 	}
 
 	if (m_collector) {
@@ -437,6 +614,25 @@ struct uwsgi_metric *uwsgi_register_keyval_metric(char *arg) {
 	return um;
 }
 
+// move the pending increments of the workers into the value (call it in wlocked context)
+static void uwsgi_metric_fold(struct uwsgi_metric *um) {
+	int i;
+	for(i=0;i<=uwsgi.numproc;i++) {
+		*um->value += __atomic_exchange_n(&um->shards[i * UWSGI_METRIC_SHARD_SLOT], 0, __ATOMIC_RELAXED);
+	}
+}
+
+// the value including the pending increments (call it in locked context)
+static int64_t uwsgi_metric_current(struct uwsgi_metric *um) {
+	int64_t value = *um->value;
+	if (!um->shards) return value;
+	int i;
+	for(i=0;i<=uwsgi.numproc;i++) {
+		value += __atomic_load_n(&um->shards[i * UWSGI_METRIC_SHARD_SLOT], __ATOMIC_RELAXED);
+	}
+	return value;
+}
+
 static void *uwsgi_metrics_loop(void *arg) {
 
 	// block signals on this thread
@@ -452,6 +648,12 @@ static void *uwsgi_metrics_loop(void *arg) {
 		// every second scan the whole metrics tree
 		time_t now = uwsgi_now();
 		while(metric) {
+			// pending increments are always folded, whatever the frequency of the metric
+			if (metric->shards) {
+				uwsgi_wlock(uwsgi.metrics_lock);
+				uwsgi_metric_fold(metric);
+				uwsgi_rwunlock(uwsgi.metrics_lock);
+			}
 			if (!metric->last_update) {
 				metric->last_update = now;
 			}
@@ -520,29 +722,22 @@ void uwsgi_metrics_start_collector() {
 }
 
 struct uwsgi_metric *uwsgi_metric_find_by_name(char *name) {
-	struct uwsgi_metric *um = uwsgi.metrics;
+	return uwsgi_metric_find_by_namen(name, strlen(name));
+}
+
+struct uwsgi_metric *uwsgi_metric_find_by_namen(char *name, size_t len) {
+	if (!metrics_index.size) return NULL;
+	struct uwsgi_metric *um = metrics_index.by_name[djb33x_hash(name, len) & (metrics_index.size - 1)];
 	while(um) {
-		if (!strcmp(um->name, name)) {
+		if (!uwsgi_strncmp(um->name, um->name_len, name, len)) {
 			return um;
-		}	
-		um = um->next;
+		}
+		um = um->name_next;
 	}
 
 	return NULL;
 }
 
-struct uwsgi_metric *uwsgi_metric_find_by_namen(char *name, size_t len) {
-        struct uwsgi_metric *um = uwsgi.metrics;
-        while(um) {
-                if (!uwsgi_strncmp(um->name, um->name_len, name, len)) {
-                        return um;
-                }
-                um = um->next;
-        }
-
-        return NULL;
-}
-
 struct uwsgi_metric_child *uwsgi_metric_add_child(struct uwsgi_metric *parent, struct uwsgi_metric *child) {
 	struct uwsgi_metric_child *umc = parent->children, *old_umc = NULL;
 	while(umc) {
@@ -562,39 +757,33 @@ struct uwsgi_metric_child *uwsgi_metric_add_child(struct uwsgi_metric *parent, s
 }
 
 struct uwsgi_metric *uwsgi_metric_find_by_oid(char *oid) {
-        struct uwsgi_metric *um = uwsgi.metrics;
-        while(um) {
-                if (um->oid && !strcmp(um->oid, oid)) {
-                        return um;
-                }
-                um = um->next;
-        }
-
-        return NULL;
+	return uwsgi_metric_find_by_oidn(oid, strlen(oid));
 }
 
 struct uwsgi_metric *uwsgi_metric_find_by_oidn(char *oid, size_t len) {
-        struct uwsgi_metric *um = uwsgi.metrics;
-        while(um) {
-                if (um->oid && !uwsgi_strncmp(um->oid, um->oid_len, oid, len)) {
-                        return um;
-                }
-                um = um->next;
-        }
+	if (!metrics_index.size) return NULL;
+	struct uwsgi_metric *um = metrics_index.by_oid[djb33x_hash(oid, len) & (metrics_index.size - 1)];
+	while(um) {
+		if (!uwsgi_strncmp(um->oid, um->oid_len, oid, len)) {
+			return um;
+		}
+		um = um->oid_next;
+	}
 
-        return NULL;
+	return NULL;
 }
 
 struct uwsgi_metric *uwsgi_metric_find_by_asn(char *asn, size_t len) {
-        struct uwsgi_metric *um = uwsgi.metrics;
-        while(um) {
-                if (um->oid && um->asn && !uwsgi_strncmp(um->asn, um->asn_len, asn, len)) {
-                        return um;
-                }
-                um = um->next;
-        }
+	if (!metrics_index.size) return NULL;
+	struct uwsgi_metric *um = metrics_index.by_asn[djb33x_hash(asn, len) & (metrics_index.size - 1)];
+	while(um) {
+		if (!uwsgi_strncmp(um->asn, um->asn_len, asn, len)) {
+			return um;
+		}
+		um = um->asn_next;
+	}
 
-        return NULL;
+	return NULL;
 }
 
 
@@ -610,7 +799,7 @@ struct uwsgi_metric *uwsgi_metric_find_by_asn(char *asn, size_t len) {
 
 */
 
-#define um_op struct uwsgi_metric *um = NULL;\
+#define um_find struct uwsgi_metric *um = NULL;\
 	if (!uwsgi.has_metrics) return -1;\
 	if (name) {\
                 um = uwsgi_metric_find_by_name(name);\
@@ -619,8 +808,19 @@ struct uwsgi_metric *uwsgi_metric_find_by_asn(char *asn, size_t len) {
                 um = uwsgi_metric_find_by_oid(oid);\
         }\
         if (!um) return -1;\
-	if (um->collector || um->type == UWSGI_METRIC_ALIAS) return -1;\
-	uwsgi_wlock(uwsgi.metrics_lock)
+	if (um->collector || um->type == UWSGI_METRIC_ALIAS) return -1
+
+#define um_op um_find;\
+	uwsgi_wlock(uwsgi.metrics_lock);\
+	if (um->shards) uwsgi_metric_fold(um)
+
+// increments are lock-free, the collector thread folds them in the value
+static void uwsgi_metric_shard_add(struct uwsgi_metric *um, int64_t value) {
+	int wid = uwsgi.mywid;
+	// mules, spoolers and the master share the first line
+	if (wid < 0 || wid > uwsgi.numproc) wid = 0;
+	__atomic_fetch_add(&um->shards[wid * UWSGI_METRIC_SHARD_SLOT], value, __ATOMIC_RELAXED);
+}
 
 int uwsgi_metric_set(char *name, char *oid, int64_t value) {
 	um_op;
@@ -630,14 +830,24 @@ int uwsgi_metric_set(char *name, char *oid, int64_t value) {
 }
 
 int uwsgi_metric_inc(char *name, char *oid, int64_t value) {
-        um_op;
+        um_find;
+	if (um->shards) {
+		uwsgi_metric_shard_add(um, value);
+		return 0;
+	}
+	uwsgi_wlock(uwsgi.metrics_lock);
 	*um->value += value;
 	uwsgi_rwunlock(uwsgi.metrics_lock);
 	return 0;
 }
 
 int uwsgi_metric_dec(char *name, char *oid, int64_t value) {
-        um_op;
+        um_find;
+	if (um->shards) {
+		uwsgi_metric_shard_add(um, -value);
+		return 0;
+	}
+	uwsgi_wlock(uwsgi.metrics_lock);
 	*um->value -= value;
 	uwsgi_rwunlock(uwsgi.metrics_lock);
 	return 0;
@@ -674,7 +884,7 @@ int64_t uwsgi_metric_get(char *name, char *oid) {
 	// now (in rlocked context) we get the value from
 	// the map
 	uwsgi_rlock(uwsgi.metrics_lock);
-	ret = *um->value;
+	ret = uwsgi_metric_current(um);
 	// unlock
 	uwsgi_rwunlock(uwsgi.metrics_lock);
 	return ret;
@@ -695,7 +905,7 @@ int64_t uwsgi_metric_getn(char *name, size_t nlen, char *oid, size_t olen) {
         // now (in rlocked context) we get the value from
         // the map
         uwsgi_rlock(uwsgi.metrics_lock);
-        ret = *um->value;
+        ret = uwsgi_metric_current(um);
         // unlock
         uwsgi_rwunlock(uwsgi.metrics_lock);
         return ret;
@@ -717,12 +927,81 @@ int uwsgi_metric_set_min(char *name, char *oid, int64_t value) {
 	return 0;
 }
 
+// lock-free, every worker updates its own row
+void uwsgi_metric_histogram_add(struct uwsgi_metric *um, int64_t value) {
+	if (!um || !um->histogram) return;
+	if (uwsgi.mywid < 0 || uwsgi.mywid > uwsgi.numproc) return;
+	uint64_t *row = um->histogram + (uwsgi.mywid * (UWSGI_METRIC_HIST_BUCKETS + 1));
+	int bucket = 0;
+	if (value > 0) {
+		bucket = 64 - __builtin_clzll((uint64_t) value);
+		if (bucket >= UWSGI_METRIC_HIST_BUCKETS) bucket = UWSGI_METRIC_HIST_BUCKETS - 1;
+	}
+	__atomic_fetch_add(&row[bucket], 1, __ATOMIC_RELAXED);
+	if (value > 0) {
+		__atomic_fetch_add(&row[UWSGI_METRIC_HIST_BUCKETS], (uint64_t) value, __ATOMIC_RELAXED);
+	}
+}
+
+int uwsgi_metric_observe(char *name, char *oid, int64_t value) {
+	struct uwsgi_metric *um = NULL;
+	if (!uwsgi.has_metrics) return -1;
+	if (name) {
+		um = uwsgi_metric_find_by_name(name);
+	}
+	else if (oid) {
+		um = uwsgi_metric_find_by_oid(oid);
+	}
+	if (!um || um->type != UWSGI_METRIC_HISTOGRAM) return -1;
+	uwsgi_metric_histogram_add(um, value);
+	return 0;
+}
+
 #define uwsgi_metric_name(f, n) ret = snprintf(buf, 4096, f, n); if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric name %s\n", f); exit(1);}
 #define uwsgi_metric_name2(f, n, n2) ret = snprintf(buf, 4096, f, n, n2); if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric name %s\n", f); exit(1);}
 
 #define uwsgi_metric_oid(f, n) ret = snprintf(buf2, 4096, f, n); if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric oid %s\n", f); exit(1);}
 #define uwsgi_metric_oid2(f, n, n2) ret = snprintf(buf2, 4096, f, n, n2); if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric oid %s\n", f); exit(1);}
 
+/*
+	cache metrics are named cache.<name>.<metric> (oid 8.<n>.<metric>), arg1n is the offset
+	of the counter in struct uwsgi_cache (0 for fragmentation). Latency histograms have a metric
+	for each bucket: cache.<name>.get_latency.<upper bound in microseconds|inf>
+*/
+static void uwsgi_metric_cache(struct uwsgi_cache *uc, int pos, char *key, int oid, uint8_t type, uint64_t offset, uint32_t freq) {
+	char buf[4096];
+	char buf2[4096];
+	int ret = snprintf(buf, 4096, "cache.%s.%s", uc->name, key);
+	if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric name for cache %s\n", uc->name); exit(1);}
+	uwsgi_metric_oid2("8.%d.%d", pos, oid);
+	struct uwsgi_metric *um = uwsgi_register_metric(buf, buf2, type, "cache", NULL, freq, uc);
+	um->arg1n = offset;
+}
+
+static void uwsgi_metric_cache_bucket(struct uwsgi_cache *uc, int pos, char *key, int oid, int bucket, uint64_t offset) {
+	char buf[4096];
+	char buf2[4096];
+	int ret;
+	if (bucket < UWSGI_CACHE_HIST_BUCKETS - 1) {
+		ret = snprintf(buf, 4096, "cache.%s.%s.%llu", uc->name, key, (unsigned long long) (1ULL << bucket));
+	}
+	else {
+		ret = snprintf(buf, 4096, "cache.%s.%s.inf", uc->name, key);
+	}
+	if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric name for cache %s\n", uc->name); exit(1);}
+	ret = snprintf(buf2, 4096, "8.%d.%d.%d", pos, oid, bucket + 1);
+	if (ret <= 1 || ret >= 4096) { uwsgi_log("unable to register metric oid for cache %s\n", uc->name); exit(1);}
+	struct uwsgi_metric *um = uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "cache", NULL, 0, uc);
+	um->arg1n = offset;
+}
+
+// metrics without a collector are only updated via the api
+static int uwsgi_metric_shardable(struct uwsgi_metric *um) {
+	if (um->collector) return 0;
+	if (um->type == UWSGI_METRIC_ALIAS || um->type == UWSGI_METRIC_HISTOGRAM) return 0;
+	return 1;
+}
+
 void uwsgi_setup_metrics() {
 
 	if (!uwsgi.has_metrics) return;
@@ -750,6 +1029,14 @@ void uwsgi_setup_metrics() {
 	uwsgi_register_metric("core.busy_workers", "5.3", UWSGI_METRIC_GAUGE, "ptr", &uwsgi.shared->busy_workers, 0, NULL);
 	uwsgi_register_metric("core.idle_workers", "5.4", UWSGI_METRIC_GAUGE, "ptr", &uwsgi.shared->idle_workers, 0, NULL);
 	uwsgi_register_metric("core.overloaded", "5.5", UWSGI_METRIC_COUNTER, "ptr", &uwsgi.shared->overloaded, 0, NULL);
+	uwsgi_register_metric("core.drained_workers", "5.6", UWSGI_METRIC_COUNTER, "ptr", &uwsgi.shared->drained_workers, 0, NULL);
+	uwsgi_register_metric("core.drain_time_last", "5.7", UWSGI_METRIC_GAUGE, "ptr", &uwsgi.shared->drain_time_last, 0, NULL);
+	uwsgi_register_metric("core.drain_time_max", "5.8", UWSGI_METRIC_GAUGE, "ptr", &uwsgi.shared->drain_time_max, 0, NULL);
+	if (uwsgi.memory_stats) {
+		// caches are never resized, their footprint is computed once
+		uwsgi.memory_caches = uwsgi_memory_caches();
+		uwsgi_register_metric("core.cache_memory", "5.9", UWSGI_METRIC_GAUGE, "ptr", &uwsgi.memory_caches, 0, NULL);
+	}
 
 	// parents are appended only at the end
 	struct uwsgi_metric *total_tx = uwsgi_register_metric_do("core.total_tx", "5.100", UWSGI_METRIC_COUNTER, "sum", NULL, 0, NULL, 1);
@@ -758,6 +1045,17 @@ void uwsgi_setup_metrics() {
 	struct uwsgi_metric *total_avg_rt = uwsgi_register_metric_do("core.avg_response_time", "5.103", UWSGI_METRIC_GAUGE, "avg", NULL, 0, NULL, 1);
 	struct uwsgi_metric *total_running_time = uwsgi_register_metric_do("core.total_running_time", "5.104", UWSGI_METRIC_COUNTER, "sum", NULL, 0, NULL, 1);
 
+	// request latency (in microseconds)
+	uwsgi.metric_response_time = uwsgi_register_metric("core.response_time", "5.105", UWSGI_METRIC_HISTOGRAM, NULL, NULL, 0, NULL);
+	// latency breakdown (see uwsgi_req_latency())
+	uwsgi.metric_headers_time = uwsgi_register_metric("core.headers_time", "5.106", UWSGI_METRIC_HISTOGRAM, NULL, NULL, 0, NULL);
+	uwsgi.metric_body_time = uwsgi_register_metric("core.body_time", "5.107", UWSGI_METRIC_HISTOGRAM, NULL, NULL, 0, NULL);
+	uwsgi.metric_app_time = uwsgi_register_metric("core.app_time", "5.108", UWSGI_METRIC_HISTOGRAM, NULL, NULL, 0, NULL);
+	uwsgi.metric_first_byte_time = uwsgi_register_metric("core.first_byte_time", "5.109", UWSGI_METRIC_HISTOGRAM, NULL, NULL, 0, NULL);
+	if (uwsgi.queue_time_var) {
+		uwsgi.metric_queue_time = uwsgi_register_metric("core.queue_time", "5.110", UWSGI_METRIC_HISTOGRAM, NULL, NULL, 0, NULL);
+	}
+
 	int ret;
 
 	// create the 'worker' namespace
@@ -799,6 +1097,41 @@ void uwsgi_setup_metrics() {
 		// skip core metrics for worker 0
 		if (i == 0) continue;
 
+		if (uwsgi.memory_stats) {
+			uwsgi_metric_name("worker.%d.heap_used", i) ; uwsgi_metric_oid("3.%d.20", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &uwsgi.workers[i].heap_used, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.heap_free", i) ; uwsgi_metric_oid("3.%d.21", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &uwsgi.workers[i].heap_free, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.heap_fragmentation", i) ; uwsgi_metric_oid("3.%d.22", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &uwsgi.workers[i].heap_fragmentation, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.alloc_count", i) ; uwsgi_metric_oid("3.%d.23", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uwsgi.workers[i].alloc_count, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.alloc_bytes", i) ; uwsgi_metric_oid("3.%d.24", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uwsgi.workers[i].alloc_bytes, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.alloc_rate", i) ; uwsgi_metric_oid("3.%d.25", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &uwsgi.workers[i].alloc_rate, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.alloc_buffers", i) ; uwsgi_metric_oid("3.%d.26", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uwsgi.workers[i].alloc_buffers, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.alloc_routing", i) ; uwsgi_metric_oid("3.%d.27", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uwsgi.workers[i].alloc_routing, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.alloc_plugins", i) ; uwsgi_metric_oid("3.%d.28", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uwsgi.workers[i].alloc_plugins, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.memory_buffers", i) ; uwsgi_metric_oid("3.%d.29", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &uwsgi.workers[i].mem_buffers, 0, NULL);
+
+			uwsgi_metric_name("worker.%d.memory_plugins", i) ; uwsgi_metric_oid("3.%d.30", i);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &uwsgi.workers[i].mem_plugins, 0, NULL);
+		}
+
 		if (uwsgi.metrics_no_cores) continue;
 
 		int j;
@@ -844,6 +1177,73 @@ void uwsgi_setup_metrics() {
 		uwsgi_sock = uwsgi_sock->next;
 	}
 
+	// async loggers
+	struct uwsgi_logger *ul;
+	pos = 0;
+	for (ul = uwsgi.choosen_logger; ul; ul = ul->next) {
+		if (!ul->async) continue;
+		uwsgi_metric_name("logger.%d.queued", pos) ; uwsgi_metric_oid("9.%d.1", pos);
+		uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &ul->async->queued, 0, NULL);
+		uwsgi_metric_name("logger.%d.dropped", pos) ; uwsgi_metric_oid("9.%d.2", pos);
+		uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &ul->async->dropped, 0, NULL);
+		pos++;
+	}
+	pos = 0;
+	for (ul = uwsgi.choosen_req_logger; ul; ul = ul->next) {
+		if (!ul->async) continue;
+		uwsgi_metric_name("req_logger.%d.queued", pos) ; uwsgi_metric_oid("10.%d.1", pos);
+		uwsgi_register_metric(buf, buf2, UWSGI_METRIC_GAUGE, "ptr", &ul->async->queued, 0, NULL);
+		uwsgi_metric_name("req_logger.%d.dropped", pos) ; uwsgi_metric_oid("10.%d.2", pos);
+		uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &ul->async->dropped, 0, NULL);
+		pos++;
+	}
+
+	// caches
+	struct uwsgi_cache *uc;
+	pos = 0;
+	for (uc = uwsgi.caches; uc; uc = uc->next) {
+		// shards are summed in the parent
+		if (uc->shard_of) continue;
+		uwsgi_metric_cache(uc, pos, "hits", 1, UWSGI_METRIC_COUNTER, offsetof(struct uwsgi_cache, hits), 0);
+		uwsgi_metric_cache(uc, pos, "miss", 2, UWSGI_METRIC_COUNTER, offsetof(struct uwsgi_cache, miss), 0);
+		uwsgi_metric_cache(uc, pos, "full", 3, UWSGI_METRIC_COUNTER, offsetof(struct uwsgi_cache, full), 0);
+		uwsgi_metric_cache(uc, pos, "evictions", 4, UWSGI_METRIC_COUNTER, offsetof(struct uwsgi_cache, evictions), 0);
+		uwsgi_metric_cache(uc, pos, "items", 5, UWSGI_METRIC_GAUGE, offsetof(struct uwsgi_cache, n_items), 0);
+		// requires a scan of the cache, do not run it too often
+		uwsgi_metric_cache(uc, pos, "fragmentation", 6, UWSGI_METRIC_GAUGE, 0, 10);
+		if (uc->histograms) {
+			int i;
+			for(i = 0; i < UWSGI_CACHE_HIST_BUCKETS; i++) {
+				uwsgi_metric_cache_bucket(uc, pos, "get_latency", 7, i, offsetof(struct uwsgi_cache, get_latency) + (i * sizeof(uint64_t)));
+				uwsgi_metric_cache_bucket(uc, pos, "set_latency", 8, i, offsetof(struct uwsgi_cache, set_latency) + (i * sizeof(uint64_t)));
+				uwsgi_metric_cache_bucket(uc, pos, "lock_wait", 9, i, offsetof(struct uwsgi_cache, lock_wait) + (i * sizeof(uint64_t)));
+			}
+		}
+		pos++;
+	}
+
+	// locks (lock.<id>.<metric>, non alphanumeric chars of the id are replaced with _)
+	if (uwsgi.lock_stats) {
+		struct uwsgi_lock_item *uli;
+		pos = 0;
+		for (uli = uwsgi.registered_locks; uli; uli = uli->next) {
+			char *id = uwsgi_str(uli->id);
+			char *ptr = id;
+			while (*ptr) {
+				if (!isalnum((int) *ptr)) *ptr = '_';
+				ptr++;
+			}
+			uwsgi_metric_name("lock.%s.acquisitions", id) ; uwsgi_metric_oid("11.%d.1", pos);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uli->acquisitions, 0, NULL);
+			uwsgi_metric_name("lock.%s.contended", id) ; uwsgi_metric_oid("11.%d.2", pos);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uli->contended, 0, NULL);
+			uwsgi_metric_name("lock.%s.wait_us", id) ; uwsgi_metric_oid("11.%d.3", pos);
+			uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, "ptr", &uli->wait_us, 0, NULL);
+			free(id);
+			pos++;
+		}
+	}
+
 	// create aliases
 	uwsgi_register_metric("rss_size", NULL, UWSGI_METRIC_ALIAS, NULL, total_rss, 0, NULL);
 	uwsgi_register_metric("vsz_size", NULL, UWSGI_METRIC_ALIAS, NULL, total_vsz, 0, NULL);
@@ -860,17 +1260,37 @@ void uwsgi_setup_metrics() {
 	// allocate shared memory
 	int64_t *values = uwsgi_calloc_shared(sizeof(int64_t) * uwsgi.metrics_cnt);
 	pos = 0;
+	int shards_cnt = 0;
 
 	struct uwsgi_metric *metric = uwsgi.metrics;
 	while(metric) {
 		metric->value = &values[pos];
 		pos++;
+		if (uwsgi_metric_shardable(metric)) shards_cnt++;
 		metric = metric->next;
 	}
 
+	// increments of the metrics managed by the api go to the cacheline of the worker
+	if (shards_cnt) {
+		size_t shard_size = UWSGI_METRIC_SHARD_SLOT * (uwsgi.numproc + 1);
+		int64_t *shards = uwsgi_calloc_shared(sizeof(int64_t) * shard_size * shards_cnt);
+		pos = 0;
+		metric = uwsgi.metrics;
+		while(metric) {
+			if (uwsgi_metric_shardable(metric)) {
+				metric->shards = &shards[shard_size * pos];
+				pos++;
+			}
+			metric = metric->next;
+		}
+	}
+
 	// remap aliases
 	metric = uwsgi.metrics;
         while(metric) {
+		if (metric->type == UWSGI_METRIC_HISTOGRAM) {
+			metric->histogram = uwsgi_calloc_shared(sizeof(uint64_t) * (UWSGI_METRIC_HIST_BUCKETS + 1) * (uwsgi.numproc + 1));
+		}
 		if (metric->type == UWSGI_METRIC_ALIAS) {
 			struct uwsgi_metric *alias = (struct uwsgi_metric *) metric->ptr;
 			if (!alias) {
@@ -1064,6 +1484,59 @@ static int64_t uwsgi_metric_collector_avg(struct uwsgi_metric *um) {
         return total/count;
 }
 
+static int64_t uwsgi_metric_collector_cache(struct uwsgi_metric *um) {
+	struct uwsgi_cache *uc = (struct uwsgi_cache *) um->custom;
+	if (!um->arg1n) return uwsgi_cache_fragmentation(uc);
+	if (!uc->shards) return *((int64_t *) (((char *) uc) + um->arg1n));
+	int64_t total = 0;
+	uint64_t i;
+	for (i = 0; i < uc->shards_count; i++) {
+		total += *((int64_t *) (((char *) uc->shards[i]) + um->arg1n));
+	}
+	return total;
+}
+
+/*
+	merge the rows of the workers, percentiles are interpolated in their bucket
+	(bucket n holds the values between 2^(n-1) and 2^n - 1)
+*/
+static void uwsgi_metric_histogram_merge(struct uwsgi_metric *hist, uint64_t *buckets) {
+	memset(buckets, 0, sizeof(uint64_t) * (UWSGI_METRIC_HIST_BUCKETS + 1));
+	int i, j;
+	for (i = 0; i <= uwsgi.numproc; i++) {
+		uint64_t *row = hist->histogram + (i * (UWSGI_METRIC_HIST_BUCKETS + 1));
+		for (j = 0; j <= UWSGI_METRIC_HIST_BUCKETS; j++) {
+			buckets[j] += __atomic_load_n(&row[j], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static int64_t uwsgi_metric_collector_histogram(struct uwsgi_metric *um) {
+	struct uwsgi_metric *hist = um->custom ? (struct uwsgi_metric *) um->custom : um;
+	if (!hist->histogram) return 0;
+	uint64_t buckets[UWSGI_METRIC_HIST_BUCKETS + 1];
+	uwsgi_metric_histogram_merge(hist, buckets);
+	int j;
+	if (um->arg1n < 0) return buckets[UWSGI_METRIC_HIST_BUCKETS];
+
+	uint64_t count = 0;
+	for (j = 0; j < UWSGI_METRIC_HIST_BUCKETS; j++) count += buckets[j];
+	if (!um->custom) return count;
+	if (!count) return 0;
+
+	uint64_t rank = ((count * um->arg1n) + 999) / 1000;
+	if (!rank) rank = 1;
+	uint64_t cumulative = 0;
+	for (j = 0; j < UWSGI_METRIC_HIST_BUCKETS; j++) {
+		if (cumulative + buckets[j] >= rank) break;
+		cumulative += buckets[j];
+	}
+	if (j == 0) return 0;
+	uint64_t low = 1ULL << (j - 1);
+	if (j >= UWSGI_METRIC_HIST_BUCKETS - 1) return low;
+	return low + ((low * (rank - cumulative)) / buckets[j]);
+}
+
 static int64_t uwsgi_metric_collector_func(struct uwsgi_metric *um) {
 	if (!um->arg1) return 0;
 	int64_t (*func)(struct uwsgi_metric *) = (int64_t (*)(struct uwsgi_metric *)) um->custom;
@@ -1084,4 +1557,147 @@ void uwsgi_metrics_collectors_setup() {
 	uwsgi_register_metric_collector("multiplier", uwsgi_metric_collector_multiplier);
 	uwsgi_register_metric_collector("avg", uwsgi_metric_collector_avg);
 	uwsgi_register_metric_collector("func", uwsgi_metric_collector_func);
+	uwsgi_register_metric_collector("cache", uwsgi_metric_collector_cache);
+	uwsgi_register_metric_collector("histogram", uwsgi_metric_collector_histogram);
+}
+
+/*
+	OpenMetrics exposition (--stats-openmetrics)
+
+	metric names are prefixed with "uwsgi_" and every char not allowed by the format is mapped to '_',
+	histograms are exported natively (their derived metrics are skipped).
+
+	The page is rendered directly from the metrics values in a buffer reused for every scrape.
+*/
+
+static struct uwsgi_buffer *openmetrics_ub;
+
+static int uwsgi_openmetrics_name(struct uwsgi_buffer *ub, struct uwsgi_metric *um, char *suffix, size_t suffix_len) {
+	if (uwsgi_buffer_append(ub, "uwsgi_", 6)) return -1;
+	size_t base = ub->pos;
+	if (uwsgi_buffer_append(ub, um->name, um->name_len)) return -1;
+	size_t i;
+	for(i=base;i<ub->pos;i++) {
+		char c = ub->buf[i];
+		if (!isalnum((int) c) && c != '_' && c != ':') ub->buf[i] = '_';
+	}
+	return uwsgi_buffer_append(ub, suffix, suffix_len);
+}
+
+static int uwsgi_openmetrics_type(struct uwsgi_buffer *ub, struct uwsgi_metric *um, char *type) {
+	if (uwsgi_buffer_append(ub, "# TYPE ", 7)) return -1;
+	if (uwsgi_openmetrics_name(ub, um, " ", 1)) return -1;
+	if (uwsgi_buffer_append(ub, type, strlen(type))) return -1;
+	return uwsgi_buffer_append(ub, "\n", 1);
+}
+
+static int uwsgi_openmetrics_sample(struct uwsgi_buffer *ub, struct uwsgi_metric *um, char *suffix, size_t suffix_len, int64_t value) {
+	if (uwsgi_openmetrics_name(ub, um, suffix, suffix_len)) return -1;
+	if (uwsgi_buffer_append(ub, " ", 1)) return -1;
+	if (uwsgi_buffer_num64(ub, value)) return -1;
+	return uwsgi_buffer_append(ub, "\n", 1);
+}
+
+static int uwsgi_openmetrics_histogram(struct uwsgi_buffer *ub, struct uwsgi_metric *um) {
+	uint64_t buckets[UWSGI_METRIC_HIST_BUCKETS + 1];
+	uwsgi_metric_histogram_merge(um, buckets);
+	if (uwsgi_openmetrics_type(ub, um, "histogram")) return -1;
+	uint64_t count = 0;
+	int j;
+	// bucket n holds the values up to 2^n - 1, the last one is unbounded
+	for(j=0;j<UWSGI_METRIC_HIST_BUCKETS;j++) {
+		count += buckets[j];
+		if (uwsgi_openmetrics_name(ub, um, "_bucket{le=\"", 12)) return -1;
+		if (j < UWSGI_METRIC_HIST_BUCKETS - 1) {
+			if (uwsgi_buffer_num64(ub, (int64_t) ((1ULL << j) - 1))) return -1;
+		}
+		else {
+			if (uwsgi_buffer_append(ub, "+Inf", 4)) return -1;
+		}
+		if (uwsgi_buffer_append(ub, "\"} ", 3)) return -1;
+		if (uwsgi_buffer_num64(ub, count)) return -1;
+		if (uwsgi_buffer_append(ub, "\n", 1)) return -1;
+	}
+	if (uwsgi_openmetrics_sample(ub, um, "_count", 6, count)) return -1;
+	return uwsgi_openmetrics_sample(ub, um, "_sum", 4, buckets[UWSGI_METRIC_HIST_BUCKETS]);
+}
+
+static int uwsgi_openmetrics_render(struct uwsgi_buffer *ub) {
+	int ret = -1;
+	uwsgi_rlock(uwsgi.metrics_lock);
+	struct uwsgi_metric *um = uwsgi.metrics;
+	while(um) {
+		// aliases and histogram-derived metrics would be duplicates
+		if (um->type == UWSGI_METRIC_ALIAS) goto next;
+		if (um->collector && um->collector->func == uwsgi_metric_collector_histogram && um->custom) goto next;
+
+		if (um->type == UWSGI_METRIC_HISTOGRAM) {
+			if (um->histogram && uwsgi_openmetrics_histogram(ub, um)) goto end;
+		}
+		else if (um->type == UWSGI_METRIC_COUNTER) {
+			if (uwsgi_openmetrics_type(ub, um, "counter")) goto end;
+			if (uwsgi_openmetrics_sample(ub, um, "_total", 6, *um->value)) goto end;
+		}
+		else {
+			if (uwsgi_openmetrics_type(ub, um, "gauge")) goto end;
+			if (uwsgi_openmetrics_sample(ub, um, "", 0, *um->value)) goto end;
+		}
+next:
+		um = um->next;
+	}
+	ret = uwsgi_buffer_append(ub, "# EOF\n", 6);
+end:
+	uwsgi_rwunlock(uwsgi.metrics_lock);
+	return ret;
+}
+
+void uwsgi_send_openmetrics(int fd) {
+	struct sockaddr_un client_src;
+	socklen_t client_src_len = 0;
+
+	int client_fd = accept(fd, (struct sockaddr *) &client_src, &client_src_len);
+	if (client_fd < 0) {
+		uwsgi_error("uwsgi_send_openmetrics()/accept()");
+		return;
+	}
+
+	// the request is not parsed, every path returns the metrics
+	char buf[4096];
+	int ret = uwsgi_waitfd(client_fd, uwsgi.socket_timeout);
+	if (ret <= 0) goto end;
+	if (read(client_fd, buf, 4096) <= 0) goto end;
+
+	if (!openmetrics_ub) {
+		openmetrics_ub = uwsgi_buffer_new(uwsgi.page_size);
+	}
+
+	// leave room for the headers, so the response can be sent with a single write
+	struct uwsgi_buffer *ub = openmetrics_ub;
+	size_t headers_size = 256;
+	ub->pos = headers_size;
+	if (uwsgi_openmetrics_render(ub)) goto end;
+
+	char headers[256];
+	ret = snprintf(headers, 256, "HTTP/1.0 200 OK\r\nConnection: close\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\nContent-Length: %llu\r\n\r\n", (unsigned long long) (ub->pos - headers_size));
+	if (ret <= 0 || ret >= 256) goto end;
+	memcpy(ub->buf + headers_size - ret, headers, ret);
+
+	size_t remains = ub->pos - (headers_size - ret);
+	char *ptr = ub->buf + headers_size - ret;
+	while (remains > 0) {
+		ret = uwsgi_waitfd_write(client_fd, uwsgi.socket_timeout);
+		if (ret <= 0) goto end;
+		ssize_t res = write(client_fd, ptr, remains);
+		if (res <= 0) {
+			if (res < 0) {
+				uwsgi_error("uwsgi_send_openmetrics()/write()");
+			}
+			goto end;
+		}
+		ptr += res;
+		remains -= res;
+	}
+
+end:
+	close(client_fd);
 }
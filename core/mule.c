@@ -8,15 +8,258 @@ By default they born in signal-only mode, but if you patch them (passing the scr
 
 #include "uwsgi.h"
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 extern struct uwsgi_server uwsgi;
 
 void uwsgi_mule_handler(void);
 
+/*
+
+	mule message rings (--mule-msg-ring <size>)
+
+	instead of the socketpairs, messages are copied in shared memory rings (a 32 bit size followed by the message),
+	one for each mule, one for each member of a farm and one for the shared queue.
+	The consumer is woken up via an eventfd only when the ring becomes non-empty, and it signals it again if
+	messages are left after a pull, so the other mules consuming the same ring (the shared one) can get them.
+
+	Farm messages are enqueued in the ring of the member with the lowest backlog, and idle members steal
+	from the rings of the other members of their farms.
+
+	The socketpairs are still created, as their descriptors identify the queues in the mule_send_msg() api.
+
+*/
+
+static struct uwsgi_mule_ring *mule_ring_new(char *name) {
+	struct uwsgi_mule_ring *ring = uwsgi_calloc_shared(sizeof(struct uwsgi_mule_ring) + uwsgi.mule_msg_ring);
+	ring->size = uwsgi.mule_msg_ring;
+	ring->lock = uwsgi_lock_init(name);
+#ifdef __linux__
+	ring->wakeup[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->wakeup[0] < 0) {
+		uwsgi_error("mule_ring_new()/eventfd()");
+		exit(1);
+	}
+	ring->wakeup[1] = ring->wakeup[0];
+#else
+	if (pipe(ring->wakeup)) {
+		uwsgi_error("mule_ring_new()/pipe()");
+		exit(1);
+	}
+	uwsgi_socket_nb(ring->wakeup[0]);
+	uwsgi_socket_nb(ring->wakeup[1]);
+#endif
+	return ring;
+}
+
+static void mule_ring_wakeup(struct uwsgi_mule_ring *ring) {
+#ifdef __linux__
+	uint64_t one = 1;
+	if (write(ring->wakeup[1], &one, sizeof(uint64_t)) != sizeof(uint64_t)) {
+#else
+	char one = 1;
+	if (write(ring->wakeup[1], &one, 1) != 1) {
+#endif
+		if (!uwsgi_is_again()) uwsgi_error("mule_ring_wakeup()/write()");
+	}
+}
+
+// consume the wakeup notifications
+static void mule_ring_ack(struct uwsgi_mule_ring *ring) {
+	char buf[64];
+	while (read(ring->wakeup[0], buf, sizeof(buf)) > 0);
+}
+
+static void mule_ring_copy_in(struct uwsgi_mule_ring *ring, uint64_t pos, char *buf, size_t len) {
+	uint64_t off = pos % ring->size;
+	size_t chunk = UMIN(len, ring->size - off);
+	memcpy(ring->data + off, buf, chunk);
+	if (chunk < len) memcpy(ring->data, buf + chunk, len - chunk);
+}
+
+static void mule_ring_copy_out(struct uwsgi_mule_ring *ring, uint64_t pos, char *buf, size_t len) {
+	uint64_t off = pos % ring->size;
+	size_t chunk = UMIN(len, ring->size - off);
+	memcpy(buf, ring->data + off, chunk);
+	if (chunk < len) memcpy(buf + chunk, ring->data, len - chunk);
+}
+
+static int mule_ring_push(struct uwsgi_mule_ring *ring, char *message, size_t len) {
+	uint32_t msg_len = len;
+	uwsgi_lock(ring->lock);
+	if (ring->size - (ring->tail - ring->head) < len + 4) {
+		uwsgi_unlock(ring->lock);
+		return -1;
+	}
+	int was_empty = ring->tail == ring->head;
+	mule_ring_copy_in(ring, ring->tail, (char *) &msg_len, 4);
+	mule_ring_copy_in(ring, ring->tail + 4, message, len);
+	ring->tail += 4 + len;
+	uwsgi_unlock(ring->lock);
+	if (was_empty) mule_ring_wakeup(ring);
+	return 0;
+}
+
+// returns -1 if the ring is empty, messages bigger than buffer_size are truncated
+static ssize_t mule_ring_pull(struct uwsgi_mule_ring *ring, char *message, size_t buffer_size) {
+	uint32_t msg_len = 0;
+	if (ring->tail == ring->head) return -1;
+	uwsgi_lock(ring->lock);
+	if (ring->tail == ring->head) {
+		uwsgi_unlock(ring->lock);
+		return -1;
+	}
+	mule_ring_copy_out(ring, ring->head, (char *) &msg_len, 4);
+	mule_ring_copy_out(ring, ring->head + 4, message, UMIN(msg_len, buffer_size));
+	ring->head += 4 + msg_len;
+	int left = ring->tail != ring->head;
+	uwsgi_unlock(ring->lock);
+	if (left) mule_ring_wakeup(ring);
+	return UMIN(msg_len, buffer_size);
+}
+
+static int mule_ring_send(int fd, char *message, size_t len) {
+	int i;
+	if (len + 4 > uwsgi.mule_msg_ring) {
+		uwsgi_log("*** MULE MSG TOO BIG: %llu bytes (the rings are %llu bytes) ***\n", (unsigned long long) len, (unsigned long long) uwsgi.mule_msg_ring);
+		return -1;
+	}
+	struct uwsgi_mule_ring *ring = NULL;
+	if (fd == uwsgi.shared->mule_queue_pipe[0]) {
+		ring = uwsgi.mule_ring;
+	}
+	for (i = 0; !ring && i < uwsgi.mules_cnt; i++) {
+		if (uwsgi.mules[i].queue_pipe[0] == fd) ring = uwsgi.mules[i].ring;
+	}
+	if (ring) goto push;
+
+	for (i = 0; i < uwsgi.farms_cnt; i++) {
+		if (uwsgi.farms[i].queue_pipe[0] != fd) continue;
+		// choose the member with the lowest backlog
+		struct uwsgi_mule_farm *umf = uwsgi.farms[i].mules;
+		uint64_t backlog = 0;
+		while (umf) {
+			if (!ring || umf->ring->tail - umf->ring->head < backlog) {
+				ring = umf->ring;
+				backlog = ring->tail - ring->head;
+			}
+			umf = umf->next;
+		}
+		if (ring) goto push;
+		break;
+	}
+	uwsgi_log("*** invalid mule queue ***\n");
+	return -1;
+
+push:
+	if (!mule_ring_push(ring, message, len)) return 0;
+	uwsgi_log("*** MULE MSG QUEUE IS FULL: ring size %llu bytes (you can tune it with --mule-msg-ring) ***\n", (unsigned long long) uwsgi.mule_msg_ring);
+	return -1;
+}
+
+// get a message from the rings of the mule: its own, the shared one, its farms and then the other members of its farms
+static ssize_t mule_ring_pull_any(int manage_farms, char *message, size_t buffer_size) {
+	int i;
+	ssize_t len = mule_ring_pull(uwsgi.mules[uwsgi.muleid - 1].ring, message, buffer_size);
+	if (len >= 0) return len;
+	len = mule_ring_pull(uwsgi.mule_ring, message, buffer_size);
+	if (len >= 0) return len;
+	if (!manage_farms) return -1;
+	struct uwsgi_mule_farm *umf;
+	for (i = 0; i < uwsgi.farms_cnt; i++) {
+		for (umf = uwsgi.farms[i].mules; umf; umf = umf->next) {
+			if (umf->mule->id != uwsgi.muleid) continue;
+			len = mule_ring_pull(umf->ring, message, buffer_size);
+			if (len >= 0) return len;
+		}
+	}
+	// work stealing
+	for (i = 0; i < uwsgi.farms_cnt; i++) {
+		if (!uwsgi_farm_has_mule(&uwsgi.farms[i], uwsgi.muleid)) continue;
+		for (umf = uwsgi.farms[i].mules; umf; umf = umf->next) {
+			if (umf->mule->id == uwsgi.muleid) continue;
+			len = mule_ring_pull(umf->ring, message, buffer_size);
+			if (len >= 0) return len;
+		}
+	}
+	return -1;
+}
+
+// returns the ring of the mule having the specified wakeup fd (or NULL)
+static struct uwsgi_mule_ring *mule_ring_by_wakeup_fd(int fd) {
+	int i;
+	if (!uwsgi.mule_msg_ring) return NULL;
+	if (uwsgi.mules[uwsgi.muleid - 1].ring->wakeup[0] == fd) return uwsgi.mules[uwsgi.muleid - 1].ring;
+	if (uwsgi.mule_ring->wakeup[0] == fd) return uwsgi.mule_ring;
+	for (i = 0; i < uwsgi.farms_cnt; i++) {
+		struct uwsgi_mule_farm *umf;
+		for (umf = uwsgi.farms[i].mules; umf; umf = umf->next) {
+			if (umf->mule->id == uwsgi.muleid && umf->ring->wakeup[0] == fd) return umf->ring;
+		}
+	}
+	return NULL;
+}
+
+// ack the ready rings in a pollfd array, returns 1 if at least one was ready
+static int mule_ring_ack_ready(struct pollfd *pfds, int n) {
+	int i, found = 0;
+	for (i = 0; i < n; i++) {
+		if (!(pfds[i].revents & POLLIN)) continue;
+		struct uwsgi_mule_ring *ring = mule_ring_by_wakeup_fd(pfds[i].fd);
+		if (ring) {
+			mule_ring_ack(ring);
+			found = 1;
+		}
+	}
+	return found;
+}
+
+static void mule_ring_add_to_queue(int queue) {
+	int i;
+	event_queue_add_fd_read(queue, uwsgi.mules[uwsgi.muleid - 1].ring->wakeup[0]);
+	event_queue_add_fd_read(queue, uwsgi.mule_ring->wakeup[0]);
+	for (i = 0; i < uwsgi.farms_cnt; i++) {
+		struct uwsgi_mule_farm *umf;
+		for (umf = uwsgi.farms[i].mules; umf; umf = umf->next) {
+			if (umf->mule->id == uwsgi.muleid) event_queue_add_fd_read(queue, umf->ring->wakeup[0]);
+		}
+	}
+}
+
+static void mule_dispatch_msg(char *message, ssize_t len) {
+	int i;
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->mule_msg) {
+			if (uwsgi.p[i]->mule_msg(message, len)) {
+				return;
+			}
+		}
+	}
+	uwsgi_log("*** mule %d received a %ld bytes message ***\n", uwsgi.muleid, (long) len);
+}
+
+// run the handlers of the signals received from fd (more than one when they are coalesced)
+static void mule_signal_handler(int fd, uint8_t sig) {
+	uint8_t sigs[256];
+	int i, n = uwsgi_signal_pending_get(fd, sig, sigs);
+	for (i = 0; i < n; i++) {
+		if (uwsgi_signal_handler(NULL, sigs[i])) {
+			uwsgi_log_verbose("error managing signal %d on mule %d\n", sigs[i], uwsgi.muleid);
+		}
+	}
+}
+
 int mule_send_msg(int fd, char *message, size_t len) {
 
 	socklen_t so_bufsize_len = sizeof(int);
 	int so_bufsize = 0;
 
+	if (uwsgi.mule_msg_ring) {
+		return mule_ring_send(fd, message, len);
+	}
+
 	if (write(fd, message, len) != (ssize_t) len) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
 			if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &so_bufsize, &so_bufsize_len)) {
@@ -183,13 +426,30 @@ void uwsgi_mule_handler() {
 	event_queue_add_fd_read(mule_queue, uwsgi.mules[uwsgi.muleid - 1].queue_pipe[1]);
 	event_queue_add_fd_read(mule_queue, uwsgi.shared->mule_queue_pipe[1]);
 
+	if (uwsgi.mule_msg_ring) {
+		mule_ring_add_to_queue(mule_queue);
+	}
 	uwsgi_mule_add_farm_to_queue(mule_queue);
 
 	int fatal_errors_counter = 0;
+	// with rings, messages are pulled until they are available (polling signals between them)
+	int ring_busy = uwsgi.mule_msg_ring ? 1 : 0;
 
 	for (;;) {
-		rlen = event_queue_wait(mule_queue, -1, &interesting_fd);
+		rlen = event_queue_wait(mule_queue, ring_busy ? 0 : -1, &interesting_fd);
 		if (rlen == 0) {
+			if (ring_busy) {
+				if (!message) {
+					ring_busy = 0;
+					continue;
+				}
+				len = mule_ring_pull_any(1, message, uwsgi.mule_msg_recv_size);
+				if (len < 0) {
+					ring_busy = 0;
+					continue;
+				}
+				mule_dispatch_msg(message, len);
+			}
 			continue;
 		}
 
@@ -206,6 +466,13 @@ void uwsgi_mule_handler() {
 
 		fatal_errors_counter = 0;
 
+		struct uwsgi_mule_ring *ring = mule_ring_by_wakeup_fd(interesting_fd);
+		if (ring) {
+			mule_ring_ack(ring);
+			ring_busy = 1;
+			continue;
+		}
+
 		if (interesting_fd == uwsgi.signal_socket || interesting_fd == uwsgi.my_signal_socket || farm_has_signaled(interesting_fd)) {
 			len = read(interesting_fd, &uwsgi_signal, 1);
 			if (len <= 0) {
@@ -216,9 +483,7 @@ void uwsgi_mule_handler() {
 #ifdef UWSGI_DEBUG
 			uwsgi_log_verbose("master sent signal %d to mule %d\n", uwsgi_signal, uwsgi.muleid);
 #endif
-			if (uwsgi_signal_handler(NULL, uwsgi_signal)) {
-				uwsgi_log_verbose("error managing signal %d on mule %d\n", uwsgi_signal, uwsgi.muleid);
-			}
+			mule_signal_handler(interesting_fd, uwsgi_signal);
 		}
 		else if (interesting_fd == uwsgi.mules[uwsgi.muleid - 1].queue_pipe[1] || interesting_fd == uwsgi.shared->mule_queue_pipe[1] || farm_has_msg(interesting_fd)) {
 			if(!message) {
@@ -232,17 +497,7 @@ void uwsgi_mule_handler() {
 				}
 			}
 			else {
-				int i, found = 0;
-				for (i = 0; i < 256; i++) {
-					if (uwsgi.p[i]->mule_msg) {
-						if (uwsgi.p[i]->mule_msg(message, len)) {
-							found = 1;
-							break;
-						}
-					}
-				}
-				if (!found)
-					uwsgi_log("*** mule %d received a %ld bytes message ***\n", uwsgi.muleid, (long) len);
+				mule_dispatch_msg(message, len);
 			}
 		}
 	}
@@ -295,6 +550,7 @@ struct uwsgi_mule_farm *uwsgi_mule_farm_new(struct uwsgi_mule_farm **umf, struct
 	}
 
 	uwsgi_mf->mule = um;
+	uwsgi_mf->ring = NULL;
 	uwsgi_mf->next = NULL;
 
 	return uwsgi_mf;
@@ -324,6 +580,11 @@ ssize_t uwsgi_mule_get_msg(int manage_signals, int manage_farms, char *message,
 	}
 next:
 
+	if (uwsgi.mule_msg_ring) {
+		len = mule_ring_pull_any(manage_farms, message, buffer_size);
+		if (len >= 0) return len;
+	}
+
 	if (timeout > -1)
 		timeout = timeout * 1000;
 
@@ -333,6 +594,10 @@ next:
 	mulepoll[0].events = POLLIN;
 	mulepoll[1].fd = uwsgi.shared->mule_queue_pipe[1];
 	mulepoll[1].events = POLLIN;
+	if (uwsgi.mule_msg_ring) {
+		mulepoll[0].fd = uwsgi.mules[uwsgi.muleid - 1].ring->wakeup[0];
+		mulepoll[1].fd = uwsgi.mule_ring->wakeup[0];
+	}
 	if (count > 2) {
 		mulepoll[2].fd = uwsgi.signal_socket;
 		mulepoll[2].events = POLLIN;
@@ -345,6 +610,12 @@ next:
 		for (i = 0; i < uwsgi.farms_cnt; i++) {
 			if (uwsgi_farm_has_mule(&uwsgi.farms[i], uwsgi.muleid)) {
 				mulepoll[count + tmp_cnt].fd = uwsgi.farms[i].queue_pipe[1];
+				if (uwsgi.mule_msg_ring) {
+					struct uwsgi_mule_farm *umf;
+					for (umf = uwsgi.farms[i].mules; umf; umf = umf->next) {
+						if (umf->mule->id == uwsgi.muleid) mulepoll[count + tmp_cnt].fd = umf->ring->wakeup[0];
+					}
+				}
 				mulepoll[count + tmp_cnt].events = POLLIN;
 				tmp_cnt++;
 			}
@@ -357,6 +628,12 @@ retry:
 	if (ret < 0) {
 		uwsgi_error("uwsgi_mule_get_msg()/poll()");
 	}
+	else if (ret > 0 && uwsgi.mule_msg_ring && mule_ring_ack_ready(mulepoll, count + farms_count)) {
+		len = mule_ring_pull_any(manage_farms, message, buffer_size);
+		// another mule got it
+		if (len < 0) goto retry;
+		goto clear;
+	}
 	else if (ret > 0 ) {
 		if (mulepoll[0].revents & POLLIN) {
 			len = read(uwsgi.mules[uwsgi.muleid - 1].queue_pipe[1], message, buffer_size);
@@ -384,9 +661,7 @@ retry:
 #ifdef UWSGI_DEBUG
 					uwsgi_log_verbose("master sent signal %d to mule %d\n", uwsgi_signal, uwsgi.muleid);
 #endif
-					if (uwsgi_signal_handler(NULL, uwsgi_signal)) {
-						uwsgi_log_verbose("error managing signal %d on mule %d\n", uwsgi_signal, uwsgi.muleid);
-					}
+					mule_signal_handler(interesting_fd, uwsgi_signal);
 					// set the error condition
 					len = -1;
 					goto clear;
@@ -443,11 +718,17 @@ void uwsgi_setup_mules_and_farms() {
 
 		create_signal_pipe(uwsgi.shared->mule_signal_pipe);
 		create_msg_pipe(uwsgi.shared->mule_queue_pipe, uwsgi.mule_msg_size);
+		if (uwsgi.mule_msg_ring) {
+			uwsgi.mule_ring = mule_ring_new("mule ring 0");
+		}
 
 		for (i = 0; i < uwsgi.mules_cnt; i++) {
 			// create the socket pipe
 			create_signal_pipe(uwsgi.mules[i].signal_pipe);
 			create_msg_pipe(uwsgi.mules[i].queue_pipe, uwsgi.mule_msg_size);
+			if (uwsgi.mule_msg_ring) {
+				uwsgi.mules[i].ring = mule_ring_new("mule ring");
+			}
 
 			uwsgi.mules[i].id = i + 1;
 
@@ -486,7 +767,10 @@ void uwsgi_setup_mules_and_farms() {
 					exit(1);
 				}
 
-				uwsgi_mule_farm_new(&uwsgi.farms[i].mules, um);
+				struct uwsgi_mule_farm *umf = uwsgi_mule_farm_new(&uwsgi.farms[i].mules, um);
+				if (uwsgi.mule_msg_ring) {
+					umf->ring = mule_ring_new("mule farm ring");
+				}
 			}
 			uwsgi_log("created farm %d name: %s mules:%s\n", i + 1, uwsgi.farms[i].name, strchr(farm_name->value, ':') + 1);
 
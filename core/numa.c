@@ -0,0 +1,253 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	NUMA awareness (Linux only)
+
+	--numa-affinity maps workers to the NUMA nodes in round robin (worker = node (wid-1) % nodes),
+	restricting them to the cpus of their node (or to --cpu-affinity cpus of it) and preferring
+	the memory of the same node for their allocations.
+
+	--numa-interleave interleaves the shared memory allocated by the master (caches, sharedareas,
+	the workers table...) across the nodes, so no node pays remote accesses for all of it.
+
+	--reuse-port-numa-steering (with --reuse-port-per-worker) attaches a REUSE_PORT program mapping
+	each cpu to a worker of its node, so a connection is accepted by a worker running (and allocating
+	memory) on the node that received it.
+
+	the topology is read from /sys/devices/system/node, without requiring libnuma
+
+*/
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <linux/filter.h>
+#include <sys/syscall.h>
+
+struct uwsgi_numa_node {
+	int id;
+	int *cpus;
+	int cpus_cnt;
+};
+
+static struct uwsgi_numa_node *numa_nodes;
+static int numa_nodes_cnt;
+static int numa_max_node;
+static int numa_loaded;
+
+// parse a cpulist ("0-3,8-11") in a newly allocated array
+static int *numa_parse_cpulist(char *list, int *cnt) {
+	int *cpus = NULL;
+	*cnt = 0;
+	char *p = list;
+	while (*p) {
+		char *end = NULL;
+		long first = strtol(p, &end, 10);
+		if (end == p) break;
+		long last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p) break;
+		}
+		long i;
+		for (i = first; i <= last; i++) {
+			cpus = realloc(cpus, sizeof(int) * (*cnt + 1));
+			if (!cpus) {
+				uwsgi_error("numa_parse_cpulist()/realloc()");
+				exit(1);
+			}
+			cpus[(*cnt)++] = i;
+		}
+		if (*end != ',') break;
+		p = end + 1;
+	}
+	return cpus;
+}
+
+static void numa_load() {
+	if (numa_loaded) return;
+	numa_loaded = 1;
+
+	DIR *d = opendir("/sys/devices/system/node");
+	if (!d) {
+		uwsgi_error("numa_load()/opendir()");
+		return;
+	}
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		int id;
+		char *end = NULL;
+		if (strncmp(de->d_name, "node", 4)) continue;
+		id = strtol(de->d_name + 4, &end, 10);
+		if (end == de->d_name + 4 || *end) continue;
+		if (id > numa_max_node) numa_max_node = id;
+
+		char *path = uwsgi_concat3("/sys/devices/system/node/", de->d_name, "/cpulist");
+		size_t size = 0;
+		char *list = uwsgi_open_and_read(path, &size, 1, NULL);
+		free(path);
+		int cpus_cnt = 0;
+		int *cpus = numa_parse_cpulist(list, &cpus_cnt);
+		free(list);
+		// memory-only nodes cannot run workers
+		if (!cpus_cnt) continue;
+
+		numa_nodes = realloc(numa_nodes, sizeof(struct uwsgi_numa_node) * (numa_nodes_cnt + 1));
+		if (!numa_nodes) {
+			uwsgi_error("numa_load()/realloc()");
+			exit(1);
+		}
+		numa_nodes[numa_nodes_cnt].id = id;
+		numa_nodes[numa_nodes_cnt].cpus = cpus;
+		numa_nodes[numa_nodes_cnt].cpus_cnt = cpus_cnt;
+		numa_nodes_cnt++;
+	}
+	closedir(d);
+
+	// keep them sorted by id, readdir() order is not guaranteed
+	int i, j;
+	for (i = 1; i < numa_nodes_cnt; i++) {
+		struct uwsgi_numa_node tmp = numa_nodes[i];
+		for (j = i; j > 0 && numa_nodes[j - 1].id > tmp.id; j--) {
+			numa_nodes[j] = numa_nodes[j - 1];
+		}
+		numa_nodes[j] = tmp;
+	}
+}
+
+void uwsgi_numa_init() {
+	if (!uwsgi.numa_affinity && !uwsgi.numa_interleave && !uwsgi.reuse_port_numa_steering) return;
+	numa_load();
+	if (!numa_nodes_cnt) {
+		uwsgi_log("unable to detect NUMA topology, NUMA options disabled\n");
+		uwsgi.numa_affinity = 0;
+		uwsgi.numa_interleave = 0;
+		uwsgi.reuse_port_numa_steering = 0;
+		return;
+	}
+	uwsgi_log_initial("detected NUMA nodes: %d\n", numa_nodes_cnt);
+}
+
+// the node (index) of a worker
+static int numa_worker_node(int wid) {
+	return (wid - 1) % numa_nodes_cnt;
+}
+
+static long numa_mempolicy(int mode, unsigned long *mask, unsigned long maxnode) {
+	return syscall(SYS_set_mempolicy, mode, mask, maxnode);
+}
+
+void uwsgi_numa_set_worker_affinity() {
+	numa_load();
+	if (!numa_nodes_cnt) return;
+	struct uwsgi_numa_node *node = &numa_nodes[numa_worker_node(uwsgi.mywid)];
+
+	char buf[4096];
+	int pos = snprintf(buf, 4096, "mapping worker %d to NUMA node %d (CPUs:", uwsgi.mywid, node->id);
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	int i;
+	if (uwsgi.cpu_affinity) {
+		// the index of the worker among the ones of its node
+		int base = (((uwsgi.mywid - 1) / numa_nodes_cnt) * uwsgi.cpu_affinity) % node->cpus_cnt;
+		for (i = 0; i < uwsgi.cpu_affinity && i < node->cpus_cnt; i++) {
+			int cpu = node->cpus[(base + i) % node->cpus_cnt];
+			CPU_SET(cpu, &cpuset);
+			if (pos < 4000) pos += snprintf(buf + pos, 4096 - pos, " %d", cpu);
+		}
+	}
+	else {
+		for (i = 0; i < node->cpus_cnt; i++) {
+			CPU_SET(node->cpus[i], &cpuset);
+			if (pos < 4000) pos += snprintf(buf + pos, 4096 - pos, " %d", node->cpus[i]);
+		}
+	}
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset)) {
+		uwsgi_error("uwsgi_numa_set_worker_affinity()/sched_setaffinity()");
+	}
+
+	unsigned long mask[(numa_max_node / (8 * sizeof(unsigned long))) + 1];
+	memset(mask, 0, sizeof(mask));
+	mask[node->id / (8 * sizeof(unsigned long))] |= 1UL << (node->id % (8 * sizeof(unsigned long)));
+	if (numa_mempolicy(MPOL_PREFERRED, mask, numa_max_node + 2)) {
+		uwsgi_error("uwsgi_numa_set_worker_affinity()/set_mempolicy()");
+	}
+
+	uwsgi_log("%s)\n", buf);
+}
+
+// interleave a (not yet touched) shared memory area across the nodes
+void uwsgi_numa_interleave(void *addr, size_t len) {
+	numa_load();
+	if (numa_nodes_cnt < 2) return;
+	unsigned long mask[(numa_max_node / (8 * sizeof(unsigned long))) + 1];
+	memset(mask, 0, sizeof(mask));
+	int i;
+	for (i = 0; i < numa_nodes_cnt; i++) {
+		int id = numa_nodes[i].id;
+		mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+	}
+	if (syscall(SYS_mbind, addr, len, MPOL_INTERLEAVE, mask, numa_max_node + 2, 0)) {
+		uwsgi_error("uwsgi_numa_interleave()/mbind()");
+	}
+}
+
+/*
+	the program compares the receiving cpu with each known cpu and returns the index of a worker
+	of its node (spreading the cpus of a node among its workers), unknown cpus fall back to cpu % workers
+*/
+void uwsgi_numa_steer_reuse_port(int fd) {
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+	numa_load();
+	int i, j, ncpus = 0;
+	for (i = 0; i < numa_nodes_cnt; i++) ncpus += numa_nodes[i].cpus_cnt;
+
+	int len = 1 + (ncpus * 2) + 2;
+	if (len > BPF_MAXINSNS) {
+		uwsgi_log("too many cpus (%d) for REUSE_PORT NUMA steering\n", ncpus);
+		exit(1);
+	}
+	struct sock_filter *code = uwsgi_calloc(sizeof(struct sock_filter) * len);
+	int pc = 0;
+	code[pc++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+	for (i = 0; i < numa_nodes_cnt; i++) {
+		// the workers of this node are i + 1, i + 1 + nodes, i + 1 + (2 * nodes)...
+		int node_workers = 0;
+		if (i < uwsgi.numproc) node_workers = ((uwsgi.numproc - 1 - i) / numa_nodes_cnt) + 1;
+		for (j = 0; j < numa_nodes[i].cpus_cnt; j++) {
+			int cpu = numa_nodes[i].cpus[j];
+			int socket_index = cpu % uwsgi.numproc;
+			if (node_workers) socket_index = i + ((j % node_workers) * numa_nodes_cnt);
+			code[pc++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpu, 0, 1);
+			code[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, socket_index);
+		}
+	}
+	code[pc++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, uwsgi.numproc);
+	code[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+	struct sock_fprog prog = { .len = pc, .filter = code };
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+		uwsgi_error("uwsgi_numa_steer_reuse_port()/setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+		exit(1);
+	}
+	free(code);
+#else
+	uwsgi_log("!!! your system does not support REUSE_PORT cpu steering !!!\n");
+#endif
+}
+
+#else
+void uwsgi_numa_init() {
+	if (uwsgi.numa_affinity || uwsgi.numa_interleave || uwsgi.reuse_port_numa_steering) {
+		uwsgi_log("NUMA options are supported only on Linux\n");
+		exit(1);
+	}
+}
+
+void uwsgi_numa_set_worker_affinity() {}
+void uwsgi_numa_interleave(void *addr, size_t len) {}
+void uwsgi_numa_steer_reuse_port(int fd) {}
+#endif
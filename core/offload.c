@@ -1,5 +1,9 @@
 #include "uwsgi.h"
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 /*
 
 	uWSGI offloading subsystem
@@ -36,27 +40,129 @@ void uwsgi_offload_setup(struct uwsgi_offload_engine *uoe, struct uwsgi_offload_
 	// an engine could changes behaviour based on pipe anf takeover values
 	uor->pipe[0] = -1;
 	uor->pipe[1] = -1;
+	uor->splice_pipe[0] = -1;
+	uor->splice_pipe[1] = -1;
 	uor->takeover = takeover;
 
 }
 
+/*
+	requests are passed to the offload threads via a bounded lock-free ring (multiple
+	producers, the cores of the worker, and a single consumer, the offload thread).
+
+	The thread is woken up (eventfd on Linux, the thread socketpair elsewhere) only when
+	it is not already going to drain the ring, so a burst of offloads costs a single wakeup.
+*/
+
+#define UWSGI_OFFLOAD_RING_SIZE 1024
+
+struct uwsgi_offload_ring_slot {
+	uint64_t seq;
+	struct uwsgi_offload_request *uor;
+};
+
+struct uwsgi_offload_ring {
+	uint64_t head;
+	uint64_t tail;
+	// number of sessions managed by the thread (used for least-loaded dispatching)
+	uint64_t active;
+	int pending;
+	int wakeup_read;
+	int wakeup_write;
+	// idle upstream connections of the http engine (owned by the thread)
+	struct uwsgi_offload_http_idle *http_idle;
+	int http_idle_cnt;
+	// socketpair of the cold reads helper thread (see --sendfile-readahead)
+	int prefetch[2];
+	struct uwsgi_offload_ring_slot slots[UWSGI_OFFLOAD_RING_SIZE];
+};
+
+struct uwsgi_offload_http_idle {
+	int fd;
+	char *name;
+	struct uwsgi_offload_http_idle *next;
+};
+
+static int uwsgi_offload_ring_push(struct uwsgi_offload_ring *ring, struct uwsgi_offload_request *uor) {
+	uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	struct uwsgi_offload_ring_slot *slot;
+	for(;;) {
+		slot = &ring->slots[pos % UWSGI_OFFLOAD_RING_SIZE];
+		int64_t diff = (int64_t) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (int64_t) pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+		// the ring is full
+		else if (diff < 0) {
+			return -1;
+		}
+		else {
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		}
+	}
+	slot->uor = uor;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static struct uwsgi_offload_request *uwsgi_offload_ring_pop(struct uwsgi_offload_ring *ring) {
+	struct uwsgi_offload_ring_slot *slot = &ring->slots[ring->tail % UWSGI_OFFLOAD_RING_SIZE];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->tail + 1) return NULL;
+	struct uwsgi_offload_request *uor = slot->uor;
+	__atomic_store_n(&slot->seq, ring->tail + UWSGI_OFFLOAD_RING_SIZE, __ATOMIC_RELEASE);
+	ring->tail++;
+	return uor;
+}
+
+static void uwsgi_offload_ring_wakeup(struct uwsgi_offload_ring *ring) {
+	if (__atomic_exchange_n(&ring->pending, 1, __ATOMIC_SEQ_CST)) return;
+#ifdef __linux__
+	uint64_t one = 1;
+	if (write(ring->wakeup_write, &one, sizeof(uint64_t)) != sizeof(uint64_t)) {
+#else
+	if (write(ring->wakeup_write, "", 1) != 1) {
+#endif
+		if (!uwsgi_is_again()) uwsgi_error("uwsgi_offload_ring_wakeup()/write()");
+	}
+}
+
 static int uwsgi_offload_enqueue(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor) {
 	struct uwsgi_core *uc = &uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id];
 	uc->offloaded_requests++;
-	// round robin
+	// least loaded thread, the round robin start breaks the ties
 	if (uc->offload_rr >= uwsgi.offload_threads) {
 		uc->offload_rr = 0;
 	}
-	struct uwsgi_thread *ut = uwsgi.offload_thread[uc->offload_rr];
+	struct uwsgi_thread *ut = NULL;
+	uint64_t min_active = 0;
+	int i;
+	for(i=0;i<uwsgi.offload_threads;i++) {
+		struct uwsgi_thread *candidate = uwsgi.offload_thread[(uc->offload_rr + i) % uwsgi.offload_threads];
+		struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) candidate->data;
+		uint64_t active = __atomic_load_n(&ring->active, __ATOMIC_RELAXED);
+		if (!ut || active < min_active) {
+			ut = candidate;
+			min_active = active;
+			if (!active) break;
+		}
+	}
 	uc->offload_rr++;
-	if (write(ut->pipe[0], uor, sizeof(struct uwsgi_offload_request)) != sizeof(struct uwsgi_offload_request)) {
+
+	struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) ut->data;
+	struct uwsgi_offload_request *task = uwsgi_malloc(sizeof(struct uwsgi_offload_request));
+	memcpy(task, uor, sizeof(struct uwsgi_offload_request));
+	__atomic_fetch_add(&ring->active, 1, __ATOMIC_RELAXED);
+	if (uwsgi_offload_ring_push(ring, task)) {
+		__atomic_fetch_sub(&ring->active, 1, __ATOMIC_RELAXED);
+		free(task);
 		if (uor->takeover) {
 			wsgi_req->fd_closed = 0;
 		}
 		return -1;
 	}
+	uwsgi_offload_ring_wakeup(ring);
 #ifdef UWSGI_DEBUG
-        uwsgi_log("[offload] created session %p\n", uor);
+        uwsgi_log("[offload] created session %p\n", task);
 #endif
 	return 0;
 }
@@ -94,6 +200,32 @@ static int u_offload_memory_prepare(struct wsgi_request *wsgi_req, struct uwsgi_
 }
 
 
+/*
+
+	cache offload engine:
+		data -> the cache
+		custom1 -> the pin of the value
+		buf -> pointer to the pinned value (in the shared memory)
+		len -> size of the value
+
+	the transfer is managed by the memory engine functions, the value is unpinned at the end
+
+*/
+
+static int u_offload_cache_prepare(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor) {
+
+	if (!uor->data || !uor->buf || !uor->len) {
+		return -1;
+	}
+	return 0;
+}
+
+static void u_offload_cache_free(struct uwsgi_offload_request *uor) {
+	uwsgi_cache_unpin((struct uwsgi_cache *) uor->data, uor->custom1);
+	// the memory is not owned by the task
+	uor->buf = NULL;
+}
+
 /*
 
 	transfer offload engine:
@@ -117,6 +249,25 @@ static int u_offload_transfer_prepare(struct wsgi_request *wsgi_req, struct uwsg
 	return 0;
 }
 
+/*
+
+	http offload engine:
+		ubuf1 -> upstream address
+		ubuf -> the http request (with "Connection: Keep-Alive")
+		custom4 -> the request does not expect a body (HEAD)
+
+	the response is streamed to the client, and the upstream connection is parked
+	(for the next requests managed by the same thread) when its end is known
+
+*/
+
+static int u_offload_http_prepare(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor) {
+	if (!uor->ubuf1 || !uor->ubuf) {
+		return -1;
+	}
+	return 0;
+}
+
 /*
 
 	sendfile offload engine:
@@ -236,8 +387,16 @@ static void uwsgi_offload_close(struct uwsgi_thread *ut, struct uwsgi_offload_re
 		close(uor->pipe[0]);
 	}
 
+	if (uor->splice_pipe[0] != -1) {
+		close(uor->splice_pipe[1]);
+		close(uor->splice_pipe[0]);
+	}
+
 	free(uor);
 
+	struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) ut->data;
+	__atomic_fetch_sub(&ring->active, 1, __ATOMIC_RELAXED);
+
 #ifdef UWSGI_DEBUG
 	uwsgi_log("[offload] destroyed session %p\n", uor);
 #endif
@@ -269,30 +428,289 @@ static struct uwsgi_offload_request *uwsgi_offload_get_by_fd(struct uwsgi_thread
 	return NULL;
 }
 
+/*
+	sendfile readahead and pacing
+
+	with --sendfile-readahead the kernel is asked (posix_fadvise) to keep the next window of the
+	file in the page cache. Before every chunk the first page is probed with a non blocking read
+	(preadv2(RWF_NOWAIT), Linux only): if it is not cached the task is parked (removed from the event
+	queue) and the window is read by a helper thread of the offload thread with readahead(), so a slow
+	disk does not stall all of the other transfers.
+
+	with --offload-sendfile-rate every transfer is paced to the specified bytes per second,
+	tasks over their budget are parked until the loop timeout resumes them.
+
+	parked:
+		1 -> waiting for the helper thread
+		2 -> waiting for pacing
+*/
+
+#if defined(__linux__) && defined(RWF_NOWAIT)
+#define UWSGI_OFFLOAD_PREFETCH
+
+struct uwsgi_offload_prefetch {
+	struct uwsgi_offload_request *uor;
+	int fd;
+	off_t pos;
+	size_t len;
+};
+
+static void *uwsgi_offload_prefetch_loop(void *arg) {
+	int fd = (int) (long) arg;
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+	for (;;) {
+		struct uwsgi_offload_prefetch uop;
+		ssize_t rlen = read(fd, &uop, sizeof(struct uwsgi_offload_prefetch));
+		if (rlen <= 0) {
+			if (rlen < 0 && errno == EINTR) continue;
+			break;
+		}
+		if (rlen != sizeof(struct uwsgi_offload_prefetch)) continue;
+		// blocks until the pages are in the cache
+		if (readahead(uop.fd, uop.pos, uop.len)) {
+			uwsgi_error("uwsgi_offload_prefetch_loop()/readahead()");
+		}
+		if (write(fd, &uop, sizeof(struct uwsgi_offload_prefetch)) != sizeof(struct uwsgi_offload_prefetch)) {
+			uwsgi_error("uwsgi_offload_prefetch_loop()/write()");
+		}
+	}
+	return NULL;
+}
+
+static void uwsgi_offload_prefetch_setup(struct uwsgi_thread *ut, struct uwsgi_offload_ring *ring) {
+	ring->prefetch[0] = -1;
+	ring->prefetch[1] = -1;
+	if (!uwsgi.sendfile_readahead) return;
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, ring->prefetch)) {
+		uwsgi_error("uwsgi_offload_prefetch_setup()/socketpair()");
+		goto error;
+	}
+	pthread_t tid;
+	if (pthread_create(&tid, NULL, uwsgi_offload_prefetch_loop, (void *) (long) ring->prefetch[1])) {
+		uwsgi_error("uwsgi_offload_prefetch_setup()/pthread_create()");
+		goto error;
+	}
+	pthread_detach(tid);
+	uwsgi_socket_nb(ring->prefetch[0]);
+	if (event_queue_add_fd_read(ut->queue, ring->prefetch[0])) goto error;
+	return;
+error:
+	uwsgi_log("[offload] unable to start the readahead helper, cold reads will block the offload thread\n");
+	if (ring->prefetch[0] > -1) close(ring->prefetch[0]);
+	ring->prefetch[0] = -1;
+}
+
+static void uwsgi_offload_prefetch_done(struct uwsgi_thread *ut, struct uwsgi_offload_ring *ring) {
+	struct uwsgi_offload_prefetch uop;
+	while (read(ring->prefetch[0], &uop, sizeof(struct uwsgi_offload_prefetch)) == sizeof(struct uwsgi_offload_prefetch)) {
+		struct uwsgi_offload_request *uor = uop.uor;
+		uor->parked = 0;
+		uor->prefetched = uop.pos + uop.len;
+		if (event_queue_add_fd_write(ut->queue, uor->fd2)) {
+			uwsgi_offload_close(ut, uor);
+		}
+	}
+}
+#endif
+
+static int uwsgi_offload_park(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, int reason) {
+	if (event_queue_del_fd(ut->queue, uor->fd2, event_queue_write())) return -1;
+	uor->parked = reason;
+	return 1;
+}
+
+/*
+	returns 0 if the chunk can be sent (eventually reduced to the hot window),
+	1 if the task has been parked, -1 on error
+*/
+static int u_offload_sendfile_readahead(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, size_t *chunk) {
+	off_t end = uor->pos + (uor->len - uor->written);
+	off_t window = uwsgi.sendfile_readahead;
+	if (uor->prefetched < uor->pos) uor->prefetched = uor->pos;
+#ifdef UWSGI_OFFLOAD_PREFETCH
+	struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) ut->data;
+	if (ring->prefetch[0] > -1) {
+		char probe;
+		struct iovec iov = { .iov_base = &probe, .iov_len = 1 };
+		if (preadv2(uor->fd, &iov, 1, uor->pos, RWF_NOWAIT) < 0 && errno == EAGAIN) {
+			struct uwsgi_offload_prefetch uop;
+			uop.uor = uor;
+			uop.fd = uor->fd;
+			uop.pos = uor->pos;
+			uop.len = UMIN(window, end - uor->pos);
+			// if the helper is too busy, read it in place
+			if (write(ring->prefetch[0], &uop, sizeof(struct uwsgi_offload_prefetch)) == sizeof(struct uwsgi_offload_prefetch)) {
+				return uwsgi_offload_park(ut, uor, 1);
+			}
+		}
+	}
+#endif
+#ifdef POSIX_FADV_WILLNEED
+	// keep the window ahead of the transfer
+	if (uor->prefetched < end && uor->prefetched - uor->pos < window / 2) {
+		off_t len = UMIN(window, end - uor->prefetched);
+		if (posix_fadvise(uor->fd, uor->prefetched, len, POSIX_FADV_WILLNEED) == 0) {
+			uor->prefetched += len;
+		}
+	}
+	if (uor->prefetched > uor->pos) {
+		*chunk = UMIN(*chunk, (size_t) (uor->prefetched - uor->pos));
+	}
+#endif
+	return 0;
+}
+
+/*
+	returns 0 if the chunk (eventually reduced to the budget) can be sent,
+	1 if the task has been parked, -1 on error
+*/
+static int u_offload_sendfile_pace(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, size_t *chunk) {
+	uint64_t rate = uwsgi.offload_sendfile_rate;
+	// at most 100ms of traffic in a single burst
+	uint64_t burst = UMAX(rate / 10, 4096);
+	uint64_t allowed = (((uwsgi_micros() - uor->started_at) * rate) / 1000000) + burst;
+	if (uor->written < allowed) {
+		*chunk = UMIN(*chunk, allowed - uor->written);
+		return 0;
+	}
+	uor->paused_until = uor->started_at + ((uor->written * 1000000) / rate);
+	return uwsgi_offload_park(ut, uor, 2);
+}
+
+// resume the paced tasks, returns the msecs to wait for the next one
+static int uwsgi_offload_resume_paced(struct uwsgi_thread *ut) {
+	int timeout = -1;
+	uint64_t now = uwsgi_micros();
+	struct uwsgi_offload_request *uor = ut->offload_requests_head;
+	while (uor) {
+		struct uwsgi_offload_request *next = uor->next;
+		if (uor->parked == 2) {
+			if (uor->paused_until <= now) {
+				uor->parked = 0;
+				if (event_queue_add_fd_write(ut->queue, uor->fd2)) {
+					uwsgi_offload_close(ut, uor);
+				}
+			}
+			else {
+				int wait = ((uor->paused_until - now) / 1000) + 1;
+				if (timeout < 0 || wait < timeout) timeout = wait;
+			}
+		}
+		uor = next;
+	}
+	return timeout;
+}
+
+#ifdef UWSGI_IO_URING
+/*
+	with --offload-io-uring, engines supporting it (memory and sendfile) queue their
+	transfers to the io_uring of the thread instead of waiting for write readiness.
+	All of the requests queued in a loop cycle are submitted with a single syscall, and
+	completions are notified to the event queue by the ring eventfd.
+
+	An io_uring task has a single request in flight (the data pointer of the request is the task
+	itself), so it can be safely closed only when its completion has been received.
+*/
+static void uwsgi_offload_io_uring_setup(struct uwsgi_thread *ut) {
+	ut->io_uring = uwsgi_io_uring_new(uwsgi.offload_threads_events);
+	if (!ut->io_uring) {
+		uwsgi_log("[offload] unable to initialize io_uring, falling back to standard offloading\n");
+		return;
+	}
+	if (event_queue_add_fd_read(ut->queue, uwsgi_io_uring_eventfd(ut->io_uring))) {
+		uwsgi_log("[offload] unable to monitor the io_uring eventfd, falling back to standard offloading\n");
+		ut->io_uring = NULL;
+	}
+}
+
+static void uwsgi_offload_io_uring_completions(struct uwsgi_thread *ut) {
+	uint64_t counter;
+	if (read(uwsgi_io_uring_eventfd(ut->io_uring), &counter, sizeof(uint64_t)) < 0) {
+		if (!uwsgi_is_again()) uwsgi_error("uwsgi_offload_io_uring_completions()/read()");
+	}
+	void *data = NULL;
+	int32_t res = 0;
+	while (uwsgi_io_uring_complete(ut->io_uring, &data, &res)) {
+		struct uwsgi_offload_request *uor = (struct uwsgi_offload_request *) data;
+		if (uor->engine->io_uring_func(ut, uor, res)) {
+			uwsgi_offload_close(ut, uor);
+		}
+	}
+}
+
+#define uwsgi_offload_io_uring(ut, uor) (ut->io_uring && uor->engine->io_uring_func)
+#endif
+
+static void uwsgi_offload_ring_drain(struct uwsgi_thread *ut, struct uwsgi_offload_ring *ring) {
+	char buf[8];
+	// the wakeup is consumed before the ring, so later pushes trigger a new one
+	while (read(ring->wakeup_read, buf, sizeof(buf)) > 0);
+	__atomic_exchange_n(&ring->pending, 0, __ATOMIC_SEQ_CST);
+
+	struct uwsgi_offload_request *uor;
+	while ((uor = uwsgi_offload_ring_pop(ring))) {
+		uor->prev = NULL;
+		uor->next = NULL;
+		// call the event function for the first time
+		if (uor->engine->event_func(ut, uor, -1)) {
+			uwsgi_offload_close(ut, uor);
+			continue;
+		}
+		uwsgi_offload_append(ut, uor);
+	}
+}
+
 static void uwsgi_offload_loop(struct uwsgi_thread *ut) {
 
 	int i;
 	void *events = event_queue_alloc(uwsgi.offload_threads_events);
+	struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) ut->data;
 
+#ifdef __linux__
+	if (event_queue_add_fd_read(ut->queue, ring->wakeup_read)) {
+		uwsgi_log("[offload] unable to monitor the wakeup eventfd !!!\n");
+		exit(1);
+	}
+#endif
+
+#ifdef UWSGI_IO_URING
+	if (uwsgi.offload_io_uring) {
+		uwsgi_offload_io_uring_setup(ut);
+	}
+#endif
+
+#ifdef UWSGI_OFFLOAD_PREFETCH
+	uwsgi_offload_prefetch_setup(ut, ring);
+#endif
+
+	int timeout = -1;
 	for (;;) {
-		// TODO make timeout tunable
-		int nevents = event_queue_wait_multi(ut->queue, -1, events, uwsgi.offload_threads_events);
+#ifdef UWSGI_IO_URING
+		// send all of the requests queued in the previous cycle
+		if (ut->io_uring) {
+			uwsgi_io_uring_submit(ut->io_uring);
+		}
+#endif
+		// the timeout is only used to resume paced transfers
+		int nevents = event_queue_wait_multi_ms(ut->queue, timeout, events, uwsgi.offload_threads_events);
 		for (i = 0; i < nevents; i++) {
 			int interesting_fd = event_queue_interesting_fd(events, i);
-			if (interesting_fd == ut->pipe[1]) {
-				struct uwsgi_offload_request *uor = uwsgi_malloc(sizeof(struct uwsgi_offload_request));
-				ssize_t len = read(ut->pipe[1], uor, sizeof(struct uwsgi_offload_request));
-				if (len != sizeof(struct uwsgi_offload_request)) {
-					uwsgi_error("read()");
-					free(uor);
-					continue;
-				}
-				// cal the event function for the first time
-				if (uor->engine->event_func(ut, uor, -1)) {
-					uwsgi_offload_close(ut, uor);
-					continue;
-				}
-				uwsgi_offload_append(ut, uor);
+#ifdef UWSGI_OFFLOAD_PREFETCH
+			if (interesting_fd == ring->prefetch[0]) {
+				uwsgi_offload_prefetch_done(ut, ring);
+				continue;
+			}
+#endif
+#ifdef UWSGI_IO_URING
+			if (ut->io_uring && interesting_fd == uwsgi_io_uring_eventfd(ut->io_uring)) {
+				uwsgi_offload_io_uring_completions(ut);
+				continue;
+			}
+#endif
+			if (interesting_fd == ring->wakeup_read) {
+				uwsgi_offload_ring_drain(ut, ring);
 				continue;
 			}
 
@@ -305,11 +723,40 @@ static void uwsgi_offload_loop(struct uwsgi_thread *ut) {
 				uwsgi_offload_close(ut, uor);
 			}
 		}
+		if (uwsgi.offload_sendfile_rate) {
+			timeout = uwsgi_offload_resume_paced(ut);
+		}
 	}
 }
 
 struct uwsgi_thread *uwsgi_offload_thread_start() {
-	return uwsgi_thread_new(uwsgi_offload_loop);
+	struct uwsgi_offload_ring *ring = uwsgi_calloc(sizeof(struct uwsgi_offload_ring));
+	uint64_t i;
+	for(i=0;i<UWSGI_OFFLOAD_RING_SIZE;i++) {
+		ring->slots[i].seq = i;
+	}
+#ifdef __linux__
+	ring->wakeup_read = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->wakeup_read < 0) {
+		uwsgi_error("uwsgi_offload_thread_start()/eventfd()");
+		free(ring);
+		return NULL;
+	}
+	ring->wakeup_write = ring->wakeup_read;
+#endif
+	struct uwsgi_thread *ut = uwsgi_thread_new_with_data(uwsgi_offload_loop, ring);
+	if (!ut) {
+#ifdef __linux__
+		close(ring->wakeup_read);
+#endif
+		free(ring);
+		return NULL;
+	}
+#ifndef __linux__
+	ring->wakeup_read = ut->pipe[1];
+	ring->wakeup_write = ut->pipe[0];
+#endif
+	return ut;
 }
 
 /*
@@ -324,8 +771,40 @@ struct uwsgi_thread *uwsgi_offload_thread_start() {
 
 */
 
+#ifdef UWSGI_IO_URING
+/*
+	status:
+		0 -> sending
+		1 -> waiting for the socket to be writable
+*/
+static int u_offload_memory_io_uring(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, int32_t res) {
+	if (uor->status == 1) {
+		if (res < 0) return -1;
+		uor->status = 0;
+	}
+	else if (res == -EAGAIN) {
+		uor->status = 1;
+		return uwsgi_io_uring_poll(ut->io_uring, uor->s, POLLOUT, uor);
+	}
+	else if (res <= 0) {
+		if (res < 0) uwsgi_log("[offload] u_offload_memory_io_uring(): %s\n", strerror(-res));
+		return -1;
+	}
+	else {
+		uor->written += res;
+		if (uor->written >= uor->len) return -1;
+	}
+	return uwsgi_io_uring_send(ut->io_uring, uor->s, uor->buf + uor->written, uor->len - uor->written, uor);
+}
+#endif
+
 static int u_offload_memory_do(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, int fd) {
 	if (fd == -1) {
+#ifdef UWSGI_IO_URING
+		if (uwsgi_offload_io_uring(ut, uor)) {
+			return uwsgi_io_uring_send(ut->io_uring, uor->s, uor->buf, uor->len, uor);
+		}
+#endif
                 if (event_queue_add_fd_write(ut->queue, uor->s)) return -1;
                 return 0;
         }
@@ -356,14 +835,91 @@ the offload task starts after having acquired the file fd
 
 */
 
+#ifdef UWSGI_IO_URING
+/*
+	the file is moved to the socket via a pipe (two splice() per chunk)
+
+	status:
+		0 -> file to pipe
+		1 -> pipe to socket (uor->to_write bytes in the pipe)
+		2 -> waiting for the socket to be writable
+*/
+static int u_offload_sendfile_io_uring_chunk(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor) {
+	size_t remains = uor->len - uor->written;
+	if (remains > 64 * 1024) remains = 64 * 1024;
+	uor->status = 0;
+	return uwsgi_io_uring_splice(ut->io_uring, uor->fd, uor->pos, uor->splice_pipe[1], -1, remains, uor);
+}
+
+static int u_offload_sendfile_io_uring(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, int32_t res) {
+	switch(uor->status) {
+		case 0:
+			if (res == -EAGAIN) return u_offload_sendfile_io_uring_chunk(ut, uor);
+			// end of file (or error)
+			if (res <= 0) {
+				if (res < 0) uwsgi_log("[offload] u_offload_sendfile_io_uring(): %s\n", strerror(-res));
+				return -1;
+			}
+			uor->pos += res;
+			uor->to_write = res;
+			break;
+		case 1:
+			if (res == -EAGAIN) {
+				uor->status = 2;
+				return uwsgi_io_uring_poll(ut->io_uring, uor->fd2, POLLOUT, uor);
+			}
+			if (res <= 0) {
+				if (res < 0) uwsgi_log("[offload] u_offload_sendfile_io_uring(): %s\n", strerror(-res));
+				return -1;
+			}
+			uor->to_write -= res;
+			uor->written += res;
+			if (uor->to_write == 0) {
+				if (uor->written >= uor->len) return -1;
+				return u_offload_sendfile_io_uring_chunk(ut, uor);
+			}
+			break;
+		default:
+			if (res < 0) return -1;
+			break;
+	}
+	uor->status = 1;
+	return uwsgi_io_uring_splice(ut->io_uring, uor->splice_pipe[0], -1, uor->fd2, -1, uor->to_write, uor);
+}
+#endif
+
 static int u_offload_sendfile_do(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, int fd) {
 
 	if (fd == -1) {
+#ifdef UWSGI_IO_URING
+		if (uwsgi_offload_io_uring(ut, uor)) {
+			if (pipe(uor->splice_pipe)) {
+				uwsgi_error("u_offload_sendfile_do()/pipe()");
+				return -1;
+			}
+			return u_offload_sendfile_io_uring_chunk(ut, uor);
+		}
+#endif
+#ifdef POSIX_FADV_SEQUENTIAL
+		if (uwsgi.sendfile_readahead) {
+			posix_fadvise(uor->fd, uor->pos, uor->len, POSIX_FADV_SEQUENTIAL);
+		}
+#endif
+		uor->started_at = uwsgi_micros();
 		if (event_queue_add_fd_write(ut->queue, uor->fd2)) return -1;
 		return 0;
 	}
+	size_t chunk = 128 * 1024;
+	if (uwsgi.offload_sendfile_rate) {
+		int ret = u_offload_sendfile_pace(ut, uor, &chunk);
+		if (ret) return ret > 0 ? 0 : -1;
+	}
+	if (uwsgi.sendfile_readahead) {
+		int ret = u_offload_sendfile_readahead(ut, uor, &chunk);
+		if (ret) return ret > 0 ? 0 : -1;
+	}
 #if defined(__linux__) || defined(__sun__) || defined(__GNU_kFreeBSD__)
-	ssize_t len = sendfile(uor->fd2, uor->fd, &uor->pos, 128 * 1024);
+	ssize_t len = sendfile(uor->fd2, uor->fd, &uor->pos, chunk);
 	if (len > 0) {
         	uor->written += len;
                 if (uor->written >= uor->len) {
@@ -595,6 +1151,276 @@ static int u_offload_transfer_do(struct uwsgi_thread *ut, struct uwsgi_offload_r
 	return -1;
 }
 
+/*
+	http proxy offloading
+
+	status:
+		0 -> connecting and sending the request to fd (write event)
+		1 -> reading the response headers from fd
+		2 -> reading the response body from fd
+		3 -> write to s
+
+	custom1 -> remaining body (-1 if delimited by the connection close)
+	custom2 -> the upstream connection can be reused
+	custom3 -> the upstream connection comes from the idle pool
+*/
+
+static int u_offload_http_connect(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor) {
+	struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) ut->data;
+	struct uwsgi_offload_http_idle *idle = ring->http_idle, *prev = NULL;
+
+	uor->custom3 = 0;
+	while (idle) {
+		if (!strcmp(idle->name, uor->ubuf1->buf)) {
+			if (prev) {
+				prev->next = idle->next;
+			}
+			else {
+				ring->http_idle = idle->next;
+			}
+			ring->http_idle_cnt--;
+			int fd = idle->fd;
+			free(idle->name);
+			free(idle);
+			char byte;
+			// the upstream closed (or sent garbage on) the idle connection
+			if (recv(fd, &byte, 1, MSG_PEEK|MSG_DONTWAIT) < 0 && uwsgi_is_again()) {
+				uor->fd = fd;
+				uor->custom3 = 1;
+				break;
+			}
+			close(fd);
+			idle = prev ? prev->next : ring->http_idle;
+			continue;
+		}
+		prev = idle;
+		idle = idle->next;
+	}
+
+	if (!uor->custom3) {
+		uor->fd = uwsgi_connect(uor->ubuf1->buf, 0, 1);
+		if (uor->fd < 0) {
+			uwsgi_error("u_offload_http_connect()/connect()");
+			return -1;
+		}
+	}
+
+	uor->status = 0;
+	uor->written = 0;
+	if (event_queue_add_fd_write(ut->queue, uor->fd)) return -1;
+	return 0;
+}
+
+// a reused connection failed before the response, retry with a new one
+static int u_offload_http_retry(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor) {
+	if (!uor->custom3 || (uor->ubuf2 && uor->ubuf2->pos > 0)) return -1;
+	close(uor->fd);
+	uor->fd = -1;
+	return u_offload_http_connect(ut, uor);
+}
+
+static void u_offload_http_park(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor) {
+	struct uwsgi_offload_ring *ring = (struct uwsgi_offload_ring *) ut->data;
+	if (ring->http_idle_cnt >= uwsgi.offload_http_keepalive) return;
+	struct uwsgi_offload_http_idle *idle = uwsgi_malloc(sizeof(struct uwsgi_offload_http_idle));
+	idle->fd = uor->fd;
+	idle->name = uwsgi_str(uor->ubuf1->buf);
+	idle->next = ring->http_idle;
+	ring->http_idle = idle;
+	ring->http_idle_cnt++;
+	// the fd is no more part of the session
+	uor->fd = -1;
+}
+
+/*
+	parse the response headers, rewriting them for a non-persistent client connection
+
+	returns 1 when the headers are complete, 0 if more data is needed, -1 on error
+*/
+static int u_offload_http_headers(struct uwsgi_offload_request *uor) {
+	struct uwsgi_buffer *ub = uor->ubuf2;
+	char *buf = ub->buf;
+	size_t i, headers_len = 0;
+	for(i=3;i<ub->pos;i++) {
+		if (buf[i] == '\n' && buf[i-1] == '\r' && buf[i-2] == '\n' && buf[i-3] == '\r') {
+			headers_len = i + 1;
+			break;
+		}
+	}
+	if (!headers_len) return ub->pos > UMAX16 ? -1 : 0;
+
+	if (headers_len < 16 || uwsgi_starts_with(buf, headers_len, "HTTP/1.", 7) || buf[8] != ' ') return -1;
+	int status = uwsgi_str3_num(buf + 9);
+
+	int64_t content_length = -1;
+	int keepalive = 0;
+	int chunked = 0;
+
+	struct uwsgi_buffer *out = uwsgi_buffer_new(headers_len + uwsgi.page_size);
+	char *eol = memchr(buf, '\n', headers_len);
+	if (uwsgi_buffer_append(out, buf, (eol + 1) - buf)) goto error;
+	char *key = eol + 1;
+	while (key < buf + headers_len - 2) {
+		eol = memchr(key, '\n', (buf + headers_len) - key);
+		if (!eol) goto error;
+		char *colon = memchr(key, ':', eol - key);
+		if (!colon) goto error;
+		char *value = colon + 1;
+		while (value < eol && *value == ' ') value++;
+		size_t vallen = eol - value;
+		if (vallen > 0 && value[vallen-1] == '\r') vallen--;
+		if (!uwsgi_strnicmp(key, colon - key, "Connection", 10)) {
+			if (uwsgi_contains_n(value, vallen, "keep-alive", 10) || uwsgi_contains_n(value, vallen, "Keep-Alive", 10)) keepalive = 1;
+			goto next;
+		}
+		if (!uwsgi_strnicmp(key, colon - key, "Keep-Alive", 10)) goto next;
+		if (!uwsgi_strnicmp(key, colon - key, "Content-Length", 14)) {
+			content_length = uwsgi_str_num(value, vallen);
+		}
+		else if (!uwsgi_strnicmp(key, colon - key, "Transfer-Encoding", 17)) {
+			chunked = 1;
+		}
+		if (uwsgi_buffer_append(out, key, (eol + 1) - key)) goto error;
+next:
+		key = eol + 1;
+	}
+	if (uwsgi_buffer_append(out, "Connection: close\r\n\r\n", 21)) goto error;
+
+	// responses without a body
+	if (uor->custom4 || status == 204 || status == 304 || (status >= 100 && status < 200)) {
+		uor->custom1 = 0;
+	}
+	else if (content_length >= 0 && !chunked) {
+		uor->custom1 = content_length;
+	}
+	else {
+		uor->custom1 = -1;
+	}
+	uor->custom2 = keepalive && uor->custom1 >= 0;
+
+	// the body already received
+	size_t body = ub->pos - headers_len;
+	if (uor->custom1 >= 0 && (int64_t) body > uor->custom1) {
+		body = uor->custom1;
+		uor->custom2 = 0;
+	}
+	if (uwsgi_buffer_append(out, buf + headers_len, body)) goto error;
+	if (uor->custom1 > 0) uor->custom1 -= body;
+
+	uwsgi_buffer_destroy(uor->ubuf3);
+	uor->ubuf3 = out;
+	return 1;
+error:
+	uwsgi_buffer_destroy(out);
+	return -1;
+}
+
+static int u_offload_http_do(struct uwsgi_thread *ut, struct uwsgi_offload_request *uor, int fd) {
+
+	ssize_t rlen;
+
+	// setup
+	if (fd == -1) {
+		uor->ubuf2 = uwsgi_buffer_new(uwsgi.page_size);
+		uor->ubuf3 = uwsgi_buffer_new(uwsgi.page_size);
+		return u_offload_http_connect(ut, uor);
+	}
+
+	switch(uor->status) {
+		// write event (connected)
+		case 0:
+			if (fd != uor->fd) return -1;
+			rlen = write(uor->fd, uor->ubuf->buf + uor->written, uor->ubuf->pos - uor->written);
+			if (rlen > 0) {
+				uor->written += rlen;
+				if (uor->written >= (size_t) uor->ubuf->pos) {
+					if (event_queue_fd_write_to_read(ut->queue, uor->fd)) return -1;
+					uor->status = 1;
+				}
+				return 0;
+			}
+			if (rlen < 0) {
+				uwsgi_offload_retry
+			}
+			if (!u_offload_http_retry(ut, uor)) return 0;
+			uwsgi_error("u_offload_http_do() -> write()/fd");
+			return -1;
+		// read event on fd (headers)
+		case 1:
+			if (fd != uor->fd) return -1;
+			if (uwsgi_buffer_ensure(uor->ubuf2, 4096)) return -1;
+			rlen = read(uor->fd, uor->ubuf2->buf + uor->ubuf2->pos, 4096);
+			if (rlen > 0) {
+				uor->ubuf2->pos += rlen;
+				int ret = u_offload_http_headers(uor);
+				if (ret < 0) return -1;
+				if (ret == 0) return 0;
+				uor->pos = 0;
+				uor->to_write = uor->ubuf3->pos;
+				if (event_queue_del_fd(ut->queue, uor->fd, event_queue_read())) return -1;
+				if (event_queue_add_fd_write(ut->queue, uor->s)) return -1;
+				uor->status = 3;
+				return 0;
+			}
+			if (rlen < 0) {
+				uwsgi_offload_retry
+			}
+			if (!u_offload_http_retry(ut, uor)) return 0;
+			return -1;
+		// read event on fd (body)
+		case 2:
+			if (fd != uor->fd) return -1;
+			size_t chunk = uor->ubuf3->len;
+			if (uor->custom1 > 0 && (size_t) uor->custom1 < chunk) chunk = uor->custom1;
+			rlen = read(uor->fd, uor->ubuf3->buf, chunk);
+			if (rlen > 0) {
+				if (uor->custom1 > 0) uor->custom1 -= rlen;
+				uor->pos = 0;
+				uor->to_write = rlen;
+				if (event_queue_del_fd(ut->queue, uor->fd, event_queue_read())) return -1;
+				if (event_queue_add_fd_write(ut->queue, uor->s)) return -1;
+				uor->status = 3;
+				return 0;
+			}
+			if (rlen < 0) {
+				uwsgi_offload_retry
+				uwsgi_error("u_offload_http_do() -> read()/fd");
+			}
+			// end of a connection delimited body (or truncated response)
+			return -1;
+		// write event on s
+		case 3:
+			if (fd != uor->s) return -1;
+			rlen = write(uor->s, uor->ubuf3->buf + uor->pos, uor->to_write);
+			if (rlen > 0) {
+				uor->to_write -= rlen;
+				uor->pos += rlen;
+				if (uor->to_write == 0) {
+					if (event_queue_del_fd(ut->queue, uor->s, event_queue_write())) return -1;
+					// the response is complete
+					if (uor->custom1 == 0) {
+						if (uor->custom2) {
+							u_offload_http_park(ut, uor);
+						}
+						return -1;
+					}
+					if (event_queue_add_fd_read(ut->queue, uor->fd)) return -1;
+					uor->status = 2;
+				}
+				return 0;
+			}
+			else if (rlen < 0) {
+				uwsgi_offload_retry
+				uwsgi_error("u_offload_http_do() -> write()/s");
+			}
+			return -1;
+		default:
+			break;
+	}
+
+	return -1;
+}
+
 int uwsgi_offload_run(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor, int *wait) {
 
 	if (uor->engine->prepare_func(wsgi_req, uor)) {
@@ -669,9 +1495,20 @@ struct uwsgi_offload_engine *uwsgi_offload_register_engine(char *name, int (*pre
 
 void uwsgi_offload_engines_register_all() {
 	uwsgi.offload_engine_sendfile = uwsgi_offload_register_engine("sendfile", u_offload_sendfile_prepare, u_offload_sendfile_do);
+#ifdef UWSGI_IO_URING
+	uwsgi.offload_engine_sendfile->io_uring_func = u_offload_sendfile_io_uring;
+#endif
 	uwsgi.offload_engine_transfer = uwsgi_offload_register_engine("transfer", u_offload_transfer_prepare, u_offload_transfer_do);
 	uwsgi.offload_engine_memory = uwsgi_offload_register_engine("memory", u_offload_memory_prepare, u_offload_memory_do);
+#ifdef UWSGI_IO_URING
+	uwsgi.offload_engine_memory->io_uring_func = u_offload_memory_io_uring;
+#endif
 	uwsgi.offload_engine_pipe = uwsgi_offload_register_engine("pipe", u_offload_pipe_prepare, u_offload_pipe_do);
+	uwsgi.offload_engine_http = uwsgi_offload_register_engine("http", u_offload_http_prepare, u_offload_http_do);
+	uwsgi.offload_engine_cache = uwsgi_offload_register_engine("cache", u_offload_cache_prepare, u_offload_memory_do);
+#ifdef UWSGI_IO_URING
+	uwsgi.offload_engine_cache->io_uring_func = u_offload_memory_io_uring;
+#endif
 }
 
 int uwsgi_offload_request_sendfile_do(struct wsgi_request *wsgi_req, int fd, size_t pos, size_t len) {
@@ -699,6 +1536,18 @@ int uwsgi_offload_request_memory_do(struct wsgi_request *wsgi_req, char *buf, si
         return uwsgi_offload_run(wsgi_req, &uor, NULL);
 }
 
+// on error the value is still pinned (and owned by the caller)
+int uwsgi_offload_request_cache_do(struct wsgi_request *wsgi_req, struct uwsgi_cache *uc, uint64_t pin, char *buf, uint64_t len) {
+	struct uwsgi_offload_request uor;
+	uwsgi_offload_setup(uwsgi.offload_engine_cache, &uor, wsgi_req, 1);
+	uor.data = uc;
+	uor.custom1 = pin;
+	uor.buf = buf;
+	uor.len = len;
+	uor.free = u_offload_cache_free;
+	return uwsgi_offload_run(wsgi_req, &uor, NULL);
+}
+
 int uwsgi_offload_request_pipe_do(struct wsgi_request *wsgi_req, int fd, size_t len) {
         struct uwsgi_offload_request uor;
         uwsgi_offload_setup(uwsgi.offload_engine_pipe, &uor, wsgi_req, 1);
@@ -706,3 +1555,49 @@ int uwsgi_offload_request_pipe_do(struct wsgi_request *wsgi_req, int fd, size_t
         uor.len = len;
         return uwsgi_offload_run(wsgi_req, &uor, NULL);
 }
+
+/*
+	proxy a request to an http upstream
+
+	ubuf is a request generated by uwsgi_to_http(), its connection is made persistent
+	(the buffer is not modified, so on error it can still be used for a non-offloaded proxy)
+*/
+int uwsgi_offload_request_http_do(struct wsgi_request *wsgi_req, char *socketname, struct uwsgi_buffer *ubuf) {
+	char *close_header = "\r\nConnection: close\r\n";
+	size_t close_header_len = strlen(close_header);
+	char *ptr = NULL;
+	size_t i;
+	for(i=0;i+close_header_len<=ubuf->pos;i++) {
+		if (!memcmp(ubuf->buf + i, close_header, close_header_len)) {
+			ptr = ubuf->buf + i;
+			break;
+		}
+	}
+	if (!ptr) return -1;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(ubuf->pos + 8);
+	if (uwsgi_buffer_append(ub, ubuf->buf, (ptr - ubuf->buf) + 2)) goto error;
+	if (uwsgi_buffer_append(ub, "Connection: Keep-Alive", 22)) goto error;
+	if (uwsgi_buffer_append(ub, ptr + close_header_len - 2, ubuf->pos - ((ptr - ubuf->buf) + close_header_len - 2))) goto error;
+
+	struct uwsgi_offload_request uor;
+	uwsgi_offload_setup(uwsgi.offload_engine_http, &uor, wsgi_req, 1);
+	uor.ubuf = ub;
+	uor.ubuf1 = uwsgi_buffer_new(strlen(socketname) + 1);
+	// the address is used as a string
+	if (uwsgi_buffer_append(uor.ubuf1, socketname, strlen(socketname) + 1)) {
+		uwsgi_buffer_destroy(uor.ubuf1);
+		goto error;
+	}
+	uor.custom4 = !uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4);
+	if (uwsgi_offload_run(wsgi_req, &uor, NULL)) {
+		uwsgi_buffer_destroy(uor.ubuf1);
+		goto error;
+	}
+	// the original request buffer is no more needed
+	uwsgi_buffer_destroy(ubuf);
+	return 0;
+error:
+	uwsgi_buffer_destroy(ub);
+	return -1;
+}
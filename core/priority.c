@@ -0,0 +1,411 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	request priority classes (worker pools with reserved capacity)
+
+	--priority-class bulk=3,4 reserves workers 3 and 4 for the "bulk" class: they stop accepting
+	from the sockets and only manage the requests handed over to them.
+
+	--priority-route "bulk /export" assigns the requests whose PATH_INFO starts with /export to the "bulk" class.
+
+	the remaining (default) workers act as the acceptors: after accept() they peek (without consuming it)
+	the head of the request (HTTP or uwsgi protocol), apply the priority routes and pass the connection
+	to the pool of the matching class via SCM_RIGHTS on a datagram socketpair shared by its workers.
+	The receiving worker parses the request from scratch with the protocol of the original socket
+	(and closes the connection after the response, even in HTTP 1.1 keepalive mode).
+
+	Unmatched requests (and requests not classifiable, like the ones on non-parsable protocols)
+	are managed by the acceptor itself, so the default pool is never consumed by the other classes
+	and a saturated class (full handover queue) gets a 503 instead of stealing default workers.
+
+*/
+
+struct uwsgi_priority_class *uwsgi_priority_class_by_name(char *name, size_t len) {
+	struct uwsgi_priority_class *upc = uwsgi.priority_classes;
+	while(upc) {
+		if (!uwsgi_strncmp(upc->name, strlen(upc->name), name, len)) return upc;
+		upc = upc->next;
+	}
+	return NULL;
+}
+
+// parse a worker list like 3,4,7-9
+static void priority_class_add_workers(struct uwsgi_priority_class *upc, char *list) {
+	char *p, *ctx = NULL;
+	uwsgi_foreach_token(list, ",", p, ctx) {
+		int from = atoi(p), to = from;
+		char *dash = strchr(p, '-');
+		if (dash) to = atoi(dash + 1);
+		int w;
+		for(w = from; w <= to; w++) {
+			if (w < 1 || w > uwsgi.numproc) {
+				uwsgi_log("invalid worker num for priority class %s: %d\n", upc->name, w);
+				exit(1);
+			}
+			struct uwsgi_priority_class *other = uwsgi.priority_classes;
+			while(other) {
+				if (other->workers[w]) {
+					uwsgi_log("worker %d is already mapped to priority class %s\n", w, other->name);
+					exit(1);
+				}
+				other = other->next;
+			}
+			upc->workers[w] = 1;
+		}
+	}
+}
+
+// called by the master before spawning the workers
+void uwsgi_priority_setup() {
+	struct uwsgi_string_list *usl;
+	if (!uwsgi.priority_class_list) return;
+
+	if (uwsgi.numproc < 2) {
+		uwsgi_log("priority classes require at least 2 workers\n");
+		exit(1);
+	}
+
+	int reserved = 0;
+	uwsgi_foreach(usl, uwsgi.priority_class_list) {
+		char *equal = strchr(usl->value, '=');
+		if (!equal) {
+			uwsgi_log("invalid priority class syntax, must be <name>=<worker>[,worker...]\n");
+			exit(1);
+		}
+		struct uwsgi_priority_class *upc = uwsgi_calloc(sizeof(struct uwsgi_priority_class));
+		upc->name = uwsgi_concat2n(usl->value, equal - usl->value, "", 0);
+		if (uwsgi_priority_class_by_name(upc->name, strlen(upc->name))) {
+			uwsgi_log("priority class %s is already defined\n", upc->name);
+			exit(1);
+		}
+		upc->workers = uwsgi_calloc(sizeof(char) * (uwsgi.numproc + 1));
+		char *list = uwsgi_str(equal + 1);
+		priority_class_add_workers(upc, list);
+		free(list);
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, upc->fd)) {
+			uwsgi_error("uwsgi_priority_setup()/socketpair()");
+			exit(1);
+		}
+		uwsgi_socket_nb(upc->fd[0]);
+		uwsgi_socket_nb(upc->fd[1]);
+
+		int w;
+		for(w = 1; w <= uwsgi.numproc; w++) reserved += upc->workers[w];
+
+		upc->next = uwsgi.priority_classes;
+		uwsgi.priority_classes = upc;
+	}
+
+	if (reserved >= uwsgi.numproc) {
+		uwsgi_log("at least one worker must be left out of the priority classes (it is the acceptor)\n");
+		exit(1);
+	}
+
+	uwsgi_foreach(usl, uwsgi.priority_route_list) {
+		char *space = strchr(usl->value, ' ');
+		if (!space) {
+			uwsgi_log("invalid priority route syntax, must be \"<class> <path prefix>\"\n");
+			exit(1);
+		}
+		usl->custom_ptr = uwsgi_priority_class_by_name(usl->value, space - usl->value);
+		if (!usl->custom_ptr) {
+			uwsgi_log("unknown priority class: %.*s\n", (int) (space - usl->value), usl->value);
+			exit(1);
+		}
+		usl->custom = strlen(space + 1);
+		usl->custom2 = (space + 1) - usl->value;
+	}
+}
+
+/*
+	connections handover between workers
+
+	the connection fd is passed via SCM_RIGHTS on a datagram socket, the body of the message is
+	the name of the socket that accepted it: the receiver parses the request with its protocol.
+	Nothing is consumed from the connection before the handover (the head of the request is only peeked)
+*/
+
+int uwsgi_handover_accept(struct wsgi_request *wsgi_req, int fd) {
+	char name[1024];
+	struct iovec iov;
+	struct msghdr msg;
+	void *msg_control = uwsgi_calloc(CMSG_SPACE(sizeof(int)));
+	int client_fd = -1;
+
+	iov.iov_base = name;
+	iov.iov_len = sizeof(name) - 1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = msg_control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int));
+
+	ssize_t len = recvmsg(fd, &msg, 0);
+	if (len <= 0) {
+		if (!uwsgi_is_again()) uwsgi_error("uwsgi_handover_accept()/recvmsg()");
+		goto end;
+	}
+	name[len] = 0;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) goto end;
+	memcpy(&client_fd, CMSG_DATA(cmsg), sizeof(int));
+
+	// from now on the request belongs to the original socket (and its protocol)
+	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
+	while(uwsgi_sock) {
+		if (uwsgi_sock->name && !strcmp(uwsgi_sock->name, name) && uwsgi_sock->proto_accept != uwsgi_handover_accept) break;
+		uwsgi_sock = uwsgi_sock->next;
+	}
+	if (!uwsgi_sock) {
+		uwsgi_log("uwsgi_handover_accept(): unknown socket %s\n", name);
+		close(client_fd);
+		client_fd = -1;
+		goto end;
+	}
+	wsgi_req->socket = uwsgi_sock;
+	wsgi_req->handed_over = 1;
+	// do not keep alive the connection, its next request could belong to another class
+	if (uwsgi.priority_my_class) {
+		wsgi_req->http_connection_close = 1;
+	}
+	wsgi_req->c_len = sizeof(struct sockaddr_un);
+	if (getpeername(client_fd, (struct sockaddr *) &wsgi_req->client_addr, (socklen_t *) &wsgi_req->c_len)) {
+		wsgi_req->c_len = 0;
+	}
+end:
+	free(msg_control);
+	return client_fd;
+}
+
+// add the receiving end of a handover socketpair to the sockets of the worker
+struct uwsgi_socket *uwsgi_handover_socket(char *name, int fd) {
+	struct uwsgi_socket *uwsgi_sock = uwsgi_new_socket(NULL);
+	uwsgi_sock->name = name;
+	uwsgi_sock->name_len = strlen(name);
+	uwsgi_sock->proto_name = "handover";
+	uwsgi_sock->fd = fd;
+	uwsgi_sock->bound = 1;
+	uwsgi_sock->proto_accept = uwsgi_handover_accept;
+	return uwsgi_sock;
+}
+
+// returns 0 if the connection has been passed (the caller still has to release it)
+int uwsgi_handover_send(struct wsgi_request *wsgi_req, int fd) {
+	struct msghdr msg;
+	struct iovec iov;
+	char msg_control[CMSG_SPACE(sizeof(int))];
+	memset(&msg, 0, sizeof(msg));
+	memset(msg_control, 0, sizeof(msg_control));
+	iov.iov_base = wsgi_req->socket->name;
+	iov.iov_len = strlen(wsgi_req->socket->name);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = msg_control;
+	msg.msg_controllen = sizeof(msg_control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	memcpy(CMSG_DATA(cmsg), &wsgi_req->fd, sizeof(int));
+
+	if (sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (!uwsgi_is_again()) uwsgi_error("uwsgi_handover_send()/sendmsg()");
+		return -1;
+	}
+	return 0;
+}
+
+// the connection now belongs to another worker
+void uwsgi_handover_release(struct wsgi_request *wsgi_req) {
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+	close(wsgi_req->fd);
+	if (uwsgi_sock->retry && uwsgi_sock->retry[wsgi_req->async_id]) {
+		uwsgi_sock->retry[wsgi_req->async_id] = 0;
+		uwsgi_sock->fd_threads[wsgi_req->async_id] = -1;
+	}
+}
+
+// peek the head of the request (waiting for it if needed), NULL if it cannot be inspected
+char *uwsgi_handover_peek(struct wsgi_request *wsgi_req, size_t *len) {
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+	// pipelined requests are already in our memory
+	if (uwsgi_sock->proto_parser_carry && uwsgi_sock->proto_parser_carry[wsgi_req->async_id] > 0) return NULL;
+
+	if (!uwsgi.handover_peek_bufs) {
+		uwsgi.handover_peek_bufs = uwsgi_calloc(sizeof(char *) * uwsgi.cores);
+	}
+	char **buf = &uwsgi.handover_peek_bufs[wsgi_req->async_id];
+	if (!*buf) *buf = uwsgi_malloc(uwsgi.buffer_size);
+
+	ssize_t rlen = recv(wsgi_req->fd, *buf, uwsgi.buffer_size, MSG_PEEK | MSG_DONTWAIT);
+	if (rlen < 0 && uwsgi_is_again()) {
+		int ret = uwsgi_wait_read_req(wsgi_req);
+		if (ret <= 0) return NULL;
+		rlen = recv(wsgi_req->fd, *buf, uwsgi.buffer_size, MSG_PEEK | MSG_DONTWAIT);
+	}
+	if (rlen <= 0) return NULL;
+	*len = rlen;
+	return *buf;
+}
+
+// compare an HTTP header name with the CGI form of a var (HTTP_ prefix already stripped)
+static int handover_header_match(char *header, size_t header_len, char *var, size_t var_len) {
+	size_t i;
+	if (header_len != var_len) return 0;
+	for(i = 0; i < header_len; i++) {
+		char c = toupper((int) header[i]);
+		if (c == '-') c = '_';
+		if (c != var[i]) return 0;
+	}
+	return 1;
+}
+
+/*
+	get a var (in its CGI form, like PATH_INFO or HTTP_COOKIE) from the peeked head of a request,
+	only HTTP and uwsgi sockets are supported
+*/
+char *uwsgi_handover_head_var(struct uwsgi_socket *uwsgi_sock, char *buf, size_t len, char *var, size_t var_len, size_t *vlen) {
+	char *proto = uwsgi_sock->proto_name;
+	char *end = buf + len;
+	if (proto && (!strcmp(proto, "http") || !strcmp(proto, "http11"))) {
+		char *ptr;
+		if (!uwsgi_strncmp(var, var_len, "PATH_INFO", 9)) {
+			char *space = memchr(buf, ' ', len);
+			if (!space) return NULL;
+			char *path = space + 1;
+			ptr = path;
+			while(ptr < end && *ptr != ' ' && *ptr != '?') ptr++;
+			if (ptr == end) return NULL;
+			*vlen = ptr - path;
+			return path;
+		}
+		if (var_len <= 5 || uwsgi_starts_with(var, var_len, "HTTP_", 5)) return NULL;
+		// skip the request line
+		ptr = memchr(buf, '\n', len);
+		while(ptr && ptr + 1 < end) {
+			char *line = ptr + 1;
+			char *eol = memchr(line, '\n', end - line);
+			if (!eol) return NULL;
+			size_t line_len = eol - line;
+			if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+			// end of headers
+			if (line_len == 0) return NULL;
+			char *colon = memchr(line, ':', line_len);
+			if (colon && handover_header_match(line, colon - line, var + 5, var_len - 5)) {
+				char *value = colon + 1;
+				while(value < line + line_len && *value == ' ') value++;
+				*vlen = (line + line_len) - value;
+				return value;
+			}
+			ptr = eol;
+		}
+		return NULL;
+	}
+
+	if (proto && strcmp(proto, "uwsgi")) return NULL;
+
+	// uwsgi protocol
+	if (len < 4) return NULL;
+	size_t pktsize = (uint8_t) buf[1] | ((uint8_t) buf[2] << 8);
+	char *ptr = buf + 4;
+	end = buf + UMIN(len, pktsize + 4);
+	while(ptr + 2 <= end) {
+		uint16_t keylen = (uint8_t) ptr[0] | ((uint8_t) ptr[1] << 8);
+		ptr += 2;
+		if (ptr + keylen + 2 > end) break;
+		char *key = ptr;
+		ptr += keylen;
+		uint16_t vallen = (uint8_t) ptr[0] | ((uint8_t) ptr[1] << 8);
+		ptr += 2;
+		if (ptr + vallen > end) break;
+		if (!uwsgi_strncmp(key, keylen, var, var_len)) {
+			*vlen = vallen;
+			return ptr;
+		}
+		ptr += vallen;
+	}
+	return NULL;
+}
+
+// called by each worker after the sockets mapping
+void uwsgi_priority_worker_setup() {
+	if (!uwsgi.priority_classes) return;
+
+	struct uwsgi_priority_class *upc = uwsgi.priority_classes;
+	while(upc) {
+		if (upc->workers[uwsgi.mywid]) {
+			uwsgi.priority_my_class = upc;
+			close(upc->fd[1]);
+		}
+		else {
+			close(upc->fd[0]);
+		}
+		upc = upc->next;
+	}
+
+	if (!uwsgi.priority_my_class) return;
+
+	// park the listening sockets (the fd number stays busy, so it cannot be confused with a received connection)
+	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
+	while(uwsgi_sock) {
+		if (uwsgi_sock->fd > -1) {
+			close(uwsgi_sock->fd);
+			uwsgi_remap_fd(uwsgi_sock->fd, "/dev/null");
+		}
+		uwsgi_sock->disabled = 1;
+		uwsgi_sock = uwsgi_sock->next;
+	}
+
+	uwsgi_handover_socket(uwsgi_concat2("priority:", uwsgi.priority_my_class->name), uwsgi.priority_my_class->fd[0]);
+	uwsgi_log("worker %d reserved for priority class %s\n", uwsgi.mywid, uwsgi.priority_my_class->name);
+}
+
+static struct uwsgi_priority_class *priority_classify(struct wsgi_request *wsgi_req) {
+	size_t len = 0;
+	char *buf = uwsgi_handover_peek(wsgi_req, &len);
+	if (!buf) return NULL;
+
+	size_t path_len = 0;
+	char *path = uwsgi_handover_head_var(wsgi_req->socket, buf, len, "PATH_INFO", 9, &path_len);
+	if (!path) return NULL;
+
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uwsgi.priority_route_list) {
+		if (!uwsgi_starts_with(path, path_len, usl->value + usl->custom2, usl->custom)) {
+			return (struct uwsgi_priority_class *) usl->custom_ptr;
+		}
+	}
+	return NULL;
+}
+
+/*
+	returns 0 if the request must be managed by the current worker,
+	-1 if it has been handed over to another pool (or refused)
+*/
+int uwsgi_priority_dispatch(struct wsgi_request *wsgi_req) {
+	// reserved workers manage everything they receive
+	if (uwsgi.priority_my_class || wsgi_req->handed_over) return 0;
+
+	struct uwsgi_priority_class *upc = priority_classify(wsgi_req);
+	if (!upc) return 0;
+
+	if (uwsgi_handover_send(wsgi_req, upc->fd[1])) {
+		// the pool is saturated, do not steal capacity from the default one
+		char *response = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+		if (write(wsgi_req->fd, response, strlen(response)) < 0) {
+			// the client is already gone
+		}
+	}
+	else {
+		uwsgi.workers[uwsgi.mywid].priority_handovers++;
+	}
+
+	uwsgi_handover_release(wsgi_req);
+	return -1;
+}
@@ -124,71 +124,106 @@ int uwsgi_parse_array(char *buffer, uint16_t size, char **argv, uint16_t argvs[]
 	return 0;
 }
 
-int uwsgi_simple_parse_vars(struct wsgi_request *wsgi_req, char *ptrbuf, char *bufferend) {
+// the first request of a core starts with this number of hvec items (--compact-cores)
+#define UWSGI_COMPACT_HVEC 64
+
+// the number of hvec items the request can currently store (4 + 1 are reserved, see uwsgi_parse_vars())
+int uwsgi_req_hvec_capacity(struct wsgi_request *wsgi_req) {
+	if (!uwsgi.compact_cores) return uwsgi.vec_size;
+	return uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].hvec_size;
+}
+
+/*
+	ensure there is room for n more hvec items
+
+	with --compact-cores the vector of the core is allocated by the first request and doubled on
+	demand (up to the --max-vars limit), the grown vector is kept for the following requests.
+	Beware: wsgi_req->hvec could change, do not cache it over calls.
+*/
+int uwsgi_req_hvec_room(struct wsgi_request *wsgi_req, int n) {
+	int needed = wsgi_req->var_cnt + n + (4 + 1);
+	if (needed > uwsgi.vec_size) return -1;
+	if (!uwsgi.compact_cores) return 0;
+	struct uwsgi_core *uc = &uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id];
+	if (needed <= uc->hvec_size) return 0;
+	int size = uc->hvec_size ? uc->hvec_size : UWSGI_COMPACT_HVEC;
+	while (size < needed) size *= 2;
+	if (size > uwsgi.vec_size) size = uwsgi.vec_size;
+	struct iovec *hvec = realloc(uc->hvec, sizeof(struct iovec) * size);
+	if (!hvec) {
+		uwsgi_error("uwsgi_req_hvec_room()/realloc()");
+		return -1;
+	}
+	uc->hvec = hvec;
+	uc->hvec_size = size;
+	wsgi_req->hvec = hvec;
+	return 0;
+}
 
-	uint16_t strsize;
+/*
+	single pass parser of the uwsgi packet vars:
+
+	every var is validated (and stored in hvec) in one shot, the
+	vector limit is computed only once.
+
+	When "hooks" is set, the proto hooks (detecting the well-known vars) are called
+	(they expect wsgi_req->var_cnt to be the position of the key)
+*/
+static int uwsgi_parse_packet_vars(struct wsgi_request *wsgi_req, char *ptrbuf, char *bufferend, int hooks) {
+
+	struct iovec *hvec = wsgi_req->hvec;
+	// room for both the key and the value
+	int max_cnt = uwsgi_req_hvec_capacity(wsgi_req) - (4 + 1) - 1;
 
 	while (ptrbuf < bufferend) {
-		if (ptrbuf + 2 < bufferend) {
-			memcpy(&strsize, ptrbuf, 2);
-#ifdef __BIG_ENDIAN__
-			strsize = uwsgi_swap16(strsize);
-#endif
-			/* key cannot be null */
-			if (!strsize) {
-				uwsgi_log("uwsgi key cannot be null. skip this request.\n");
+		// key size and at least one byte of key
+		if (ptrbuf + 2 >= bufferend) goto invalid;
+		uint16_t keysize = (uint8_t) ptrbuf[0] | ((uint8_t) ptrbuf[1] << 8);
+		/* key cannot be null */
+		if (!keysize) {
+			uwsgi_log("uwsgi key cannot be null. skip this var.\n");
+			return -1;
+		}
+		char *key = ptrbuf + 2;
+		// value can be null (even at the end) so use <=
+		if (key + keysize + 2 > bufferend) goto invalid;
+		char *val = key + keysize + 2;
+		uint16_t valsize = (uint8_t) val[-2] | ((uint8_t) val[-1] << 8);
+		if (val + valsize > bufferend) goto invalid;
+
+		if (hooks && keysize > UWSGI_PROTO_MIN_CHECK && keysize < UWSGI_PROTO_MAX_CHECK && uwsgi.proto_hooks[keysize]) {
+			if (uwsgi.proto_hooks[keysize](wsgi_req, key, val, valsize)) {
 				return -1;
 			}
+		}
 
-			ptrbuf += 2;
-			if (ptrbuf + strsize < bufferend) {
-				// var key
-				wsgi_req->hvec[wsgi_req->var_cnt].iov_base = ptrbuf;
-				wsgi_req->hvec[wsgi_req->var_cnt].iov_len = strsize;
-				ptrbuf += strsize;
-				// value can be null (even at the end) so use <=
-				if (ptrbuf + 2 <= bufferend) {
-					memcpy(&strsize, ptrbuf, 2);
-#ifdef __BIG_ENDIAN__
-					strsize = uwsgi_swap16(strsize);
-#endif
-					ptrbuf += 2;
-					if (ptrbuf + strsize <= bufferend) {
-
-						if (wsgi_req->var_cnt < uwsgi.vec_size - (4 + 1)) {
-							wsgi_req->var_cnt++;
-						}
-						else {
-							uwsgi_log("max vec size reached. skip this header.\n");
-							return -1;
-						}
-						// var value
-						wsgi_req->hvec[wsgi_req->var_cnt].iov_base = ptrbuf;
-						wsgi_req->hvec[wsgi_req->var_cnt].iov_len = strsize;
-
-						if (wsgi_req->var_cnt < uwsgi.vec_size - (4 + 1)) {
-							wsgi_req->var_cnt++;
-						}
-						else {
-							uwsgi_log("max vec size reached. skip this var.\n");
-							return -1;
-						}
-						ptrbuf += strsize;
-					}
-					else {
-						uwsgi_log("invalid uwsgi request (current strsize: %d). skip.\n", strsize);
-						return -1;
-					}
-				}
-				else {
-					uwsgi_log("invalid uwsgi request (current strsize: %d). skip.\n", strsize);
-					return -1;
-				}
+		if (wsgi_req->var_cnt >= max_cnt) {
+			if (uwsgi_req_hvec_room(wsgi_req, 2)) {
+				uwsgi_log("max vec size reached. skip this var.\n");
+				return -1;
 			}
+			hvec = wsgi_req->hvec;
+			max_cnt = uwsgi_req_hvec_capacity(wsgi_req) - (4 + 1) - 1;
 		}
+
+		hvec[wsgi_req->var_cnt].iov_base = key;
+		hvec[wsgi_req->var_cnt].iov_len = keysize;
+		hvec[wsgi_req->var_cnt + 1].iov_base = val;
+		hvec[wsgi_req->var_cnt + 1].iov_len = valsize;
+		wsgi_req->var_cnt += 2;
+
+		ptrbuf = val + valsize;
 	}
 
 	return 0;
+
+invalid:
+	uwsgi_log("invalid uwsgi request (truncated var). skip.\n");
+	return -1;
+}
+
+int uwsgi_simple_parse_vars(struct wsgi_request *wsgi_req, char *ptrbuf, char *bufferend) {
+	return uwsgi_parse_packet_vars(wsgi_req, ptrbuf, bufferend, 0);
 }
 
 #define uwsgi_proto_key(x, y) memcmp(x, key, y)
@@ -277,12 +312,9 @@ static void uwsgi_parse_http_range(char *buf, uint16_t len, enum uwsgi_range *pa
 
 static int uwsgi_proto_check_10(struct wsgi_request *wsgi_req, char *key, char *buf, uint16_t len) {
 
-	if (uwsgi.honour_range && !uwsgi_proto_key("HTTP_IF_RANGE", 13)) {
-		wsgi_req->if_range = buf;
-		wsgi_req->if_range_len = len;
-	}
-
 	if (uwsgi.honour_range && !uwsgi_proto_key("HTTP_RANGE", 10)) {
+		wsgi_req->range = buf;
+		wsgi_req->range_len = len;
 		uwsgi_parse_http_range(buf, len, &wsgi_req->range_parsed,
 				&wsgi_req->range_from, &wsgi_req->range_to);
 		// set deprecated fields for binary compatibility
@@ -440,6 +472,12 @@ static int uwsgi_proto_check_13(struct wsgi_request *wsgi_req, char *key, char *
 		wsgi_req->document_root_len = len;
 		return 0;
 	}
+
+	if (uwsgi.honour_range && !uwsgi_proto_key("HTTP_IF_RANGE", 13)) {
+		wsgi_req->if_range = buf;
+		wsgi_req->if_range_len = len;
+		return 0;
+	}
 	return 0;
 }
 
@@ -495,6 +533,13 @@ static int uwsgi_proto_check_15(struct wsgi_request *wsgi_req, char *key, char *
 		return 0;
 	}
 
+	if (!uwsgi_proto_key("HTTP_CONNECTION", 15)) {
+		if (uwsgi_contains_n(buf, len, "close", 5) || uwsgi_contains_n(buf, len, "Close", 5)) {
+			wsgi_req->http_connection_close = 1;
+		}
+		return 0;
+	}
+
 	if (uwsgi.caches && !uwsgi_proto_key("UWSGI_CACHE_GET", 15)) {
 		wsgi_req->cache_get = buf;
 		wsgi_req->cache_get_len = len;
@@ -517,6 +562,12 @@ static int uwsgi_proto_check_18(struct wsgi_request *wsgi_req, char *key, char *
 		return 0;
 	}
 
+	if (!uwsgi_proto_key("HTTP_IF_NONE_MATCH", 18)) {
+		wsgi_req->if_none_match = buf;
+		wsgi_req->if_none_match_len = len;
+		return 0;
+	}
+
 	return 0;
 }
 
@@ -580,6 +631,17 @@ static int uwsgi_proto_check_27(struct wsgi_request *wsgi_req, char *key, char *
         return 0;
 }
 
+static int uwsgi_proto_check_29(struct wsgi_request *wsgi_req, char *key, char *buf, uint16_t len) {
+
+        if (!uwsgi_proto_key("HTTP_SEC_WEBSOCKET_EXTENSIONS", 29)) {
+                wsgi_req->http_sec_websocket_extensions = buf;
+                wsgi_req->http_sec_websocket_extensions_len = len;
+                return 0;
+        }
+
+        return 0;
+}
+
 
 void uwsgi_proto_hooks_setup() {
 	int i = 0;
@@ -599,16 +661,16 @@ void uwsgi_proto_hooks_setup() {
 	uwsgi.proto_hooks[20] = uwsgi_proto_check_20;
 	uwsgi.proto_hooks[22] = uwsgi_proto_check_22;
 	uwsgi.proto_hooks[27] = uwsgi_proto_check_27;
+	uwsgi.proto_hooks[29] = uwsgi_proto_check_29;
 }
 
 
-int uwsgi_parse_vars(struct wsgi_request *wsgi_req) {
+static int uwsgi_parse_vars_do(struct wsgi_request *wsgi_req) {
 
 	char *buffer = wsgi_req->buffer;
 
 	char *ptrbuf, *bufferend;
 
-	uint16_t strsize = 0;
 	struct uwsgi_dyn_dict *udd;
 
 	ptrbuf = buffer;
@@ -635,90 +697,27 @@ int uwsgi_parse_vars(struct wsgi_request *wsgi_req) {
 	wsgi_req->script_name_pos = -1;
 	wsgi_req->path_info_pos = -1;
 
-	while (ptrbuf < bufferend) {
-		if (ptrbuf + 2 < bufferend) {
-			memcpy(&strsize, ptrbuf, 2);
-#ifdef __BIG_ENDIAN__
-			strsize = uwsgi_swap16(strsize);
-#endif
-			/* key cannot be null */
-			if (!strsize) {
-				uwsgi_log("uwsgi key cannot be null. skip this var.\n");
-				return -1;
-			}
-
-			ptrbuf += 2;
-			if (ptrbuf + strsize < bufferend) {
-				// var key
-				wsgi_req->hvec[wsgi_req->var_cnt].iov_base = ptrbuf;
-				wsgi_req->hvec[wsgi_req->var_cnt].iov_len = strsize;
-				ptrbuf += strsize;
-				// value can be null (even at the end) so use <=
-				if (ptrbuf + 2 <= bufferend) {
-					memcpy(&strsize, ptrbuf, 2);
-#ifdef __BIG_ENDIAN__
-					strsize = uwsgi_swap16(strsize);
-#endif
-					ptrbuf += 2;
-					if (ptrbuf + strsize <= bufferend) {
-						if (wsgi_req->hvec[wsgi_req->var_cnt].iov_len > UWSGI_PROTO_MIN_CHECK &&
-							wsgi_req->hvec[wsgi_req->var_cnt].iov_len < UWSGI_PROTO_MAX_CHECK &&
-								uwsgi.proto_hooks[wsgi_req->hvec[wsgi_req->var_cnt].iov_len]) {
-							if (uwsgi.proto_hooks[wsgi_req->hvec[wsgi_req->var_cnt].iov_len](wsgi_req, wsgi_req->hvec[wsgi_req->var_cnt].iov_base, ptrbuf, strsize)) {
-								return -1;
-							}
-						}
-						//uwsgi_log("uwsgi %.*s = %.*s\n", wsgi_req->hvec[wsgi_req->var_cnt].iov_len, wsgi_req->hvec[wsgi_req->var_cnt].iov_base, strsize, ptrbuf);
-
-						if (wsgi_req->var_cnt < uwsgi.vec_size - (4 + 1)) {
-							wsgi_req->var_cnt++;
-						}
-						else {
-							uwsgi_log("max vec size reached. skip this var.\n");
-							return -1;
-						}
-						// var value
-						wsgi_req->hvec[wsgi_req->var_cnt].iov_base = ptrbuf;
-						wsgi_req->hvec[wsgi_req->var_cnt].iov_len = strsize;
-						//uwsgi_log("%.*s = %.*s\n", wsgi_req->hvec[wsgi_req->var_cnt-1].iov_len, wsgi_req->hvec[wsgi_req->var_cnt-1].iov_base, wsgi_req->hvec[wsgi_req->var_cnt].iov_len, wsgi_req->hvec[wsgi_req->var_cnt].iov_base);
-						if (wsgi_req->var_cnt < uwsgi.vec_size - (4 + 1)) {
-							wsgi_req->var_cnt++;
-						}
-						else {
-							uwsgi_log("max vec size reached. skip this var.\n");
-							return -1;
-						}
-						ptrbuf += strsize;
-					}
-					else {
-						uwsgi_log("invalid uwsgi request (current strsize: %d). skip.\n", strsize);
-						return -1;
-					}
-				}
-				else {
-					uwsgi_log("invalid uwsgi request (current strsize: %d). skip.\n", strsize);
-					return -1;
-				}
-			}
-		}
-		else {
-			uwsgi_log("invalid uwsgi request (current strsize: %d). skip.\n", strsize);
-			return -1;
-		}
+	if (uwsgi_parse_packet_vars(wsgi_req, ptrbuf, bufferend, 1)) {
+		return -1;
 	}
 
 next:
 
+	wsgi_req->headers_at = uwsgi_micros();
+	if (!wsgi_req->post_cl) wsgi_req->body_at = wsgi_req->headers_at;
+
 	// manage post buffering (if needed as post_file could be created before)
 	if (uwsgi.post_buffering > 0 && !wsgi_req->post_file) {
 		// read to disk if post_cl > post_buffering (it will eventually do upload progress...)
-		if (wsgi_req->post_cl >= uwsgi.post_buffering) {
+		if (wsgi_req->post_cl >= uwsgi_post_buffering_threshold(wsgi_req)) {
+			if (wsgi_req->post_cl) uwsgi_post_buffering_account(wsgi_req, 1);
 			if (uwsgi_postbuffer_do_in_disk(wsgi_req)) {
 				return -1;
 			}
 		}
 		// on tiny post use memory
 		else {
+			if (wsgi_req->post_cl) uwsgi_post_buffering_account(wsgi_req, 0);
 			if (uwsgi_postbuffer_do_in_mem(wsgi_req)) {
 				return -1;
 			}
@@ -756,7 +755,7 @@ next:
 			int orig_path_info_len = wsgi_req->path_info_len;
 			// if SCRIPT_NAME is not allocated, add a slot for it
 			if (wsgi_req->script_name_pos == -1) {
-				if (wsgi_req->var_cnt >= uwsgi.vec_size - (4 + 2)) {
+				if (uwsgi_req_hvec_room(wsgi_req, 2)) {
 					uwsgi_log("max vec size reached. skip this var.\n");
 					return -1;
 				}
@@ -931,6 +930,16 @@ nextsm2:
 	return 0;
 }
 
+int uwsgi_parse_vars(struct wsgi_request *wsgi_req) {
+	int ret = uwsgi_parse_vars_do(wsgi_req);
+	// from now on the request belongs to the app
+	if (!ret) {
+		wsgi_req->app_at = uwsgi_micros();
+		if (uwsgi.queue_time_var) uwsgi_req_queue_time(wsgi_req);
+	}
+	return ret;
+}
+
 int uwsgi_hooked_parse(char *buffer, size_t len, void (*hook) (char *, uint16_t, char *, uint16_t, void *), void *data) {
 
 	char *ptrbuf, *bufferend;
@@ -1089,7 +1098,7 @@ char *uwsgi_req_append(struct wsgi_request *wsgi_req, char *key, uint16_t keylen
 		return NULL;
 	}
 
-	if (wsgi_req->var_cnt >= uwsgi.vec_size - (4 + 2)) {
+	if (uwsgi_req_hvec_room(wsgi_req, 2)) {
         	uwsgi_log("max vec size reached. skip this header.\n");
 		return NULL;
 	}
@@ -1145,7 +1154,7 @@ int uwsgi_req_append_path_info_with_index(struct wsgi_request *wsgi_req, char *i
                 return -1;
         }
 
-	if (wsgi_req->var_cnt >= uwsgi.vec_size - (4 + 2)) {
+	if (uwsgi_req_hvec_room(wsgi_req, 2)) {
                 uwsgi_log("max vec size reached for PATH_INFO + index. skip this request.\n");
                 return -1;
         }
@@ -1,7 +1,41 @@
 #include "uwsgi.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 extern struct uwsgi_server uwsgi;
 
+/*
+
+	lock-free mode (--queue-lockfree)
+
+	push and pull do not take the queue lock: the blocks are a bounded MPMC ring (Vyukov style),
+	each block has a sequence number telling if it is ready to be written (seq == ticket)
+	or to be read (seq == ticket + 1), tickets are taken with a CAS on the enqueue/dequeue counters.
+
+	Differently from the locked queue, a push on a full queue fails instead of overwriting the oldest item,
+	pop is a FIFO pull (a LIFO pop cannot be implemented over the ring) and random access (get/set/last)
+	is not available.
+
+	pullers can wait for new items: they sleep on a futex (a polling loop on non-Linux systems)
+	incremented by every push.
+
+*/
+
+struct uwsgi_queue_lockfree {
+	uint64_t enqueue_pos;
+	char pad0[56];
+	uint64_t dequeue_pos;
+	char pad1[56];
+	uint32_t signal;
+	uint32_t waiters;
+	char pad2[56];
+	uint64_t seq[];
+};
+
+static struct uwsgi_queue_lockfree *queue_lf;
+
 void uwsgi_init_queue() {
 	if (!uwsgi.queue_blocksize)
 		uwsgi.queue_blocksize = 8192;
@@ -43,6 +77,7 @@ void uwsgi_init_queue() {
 			exit(1);
 		}
 		uwsgi.queue = mmap(NULL, uwsgi.queue_filesize, PROT_READ | PROT_WRITE, MAP_SHARED, queue_fd, 0);
+		uwsgi.queue_page_size = uwsgi.page_size;
 
 		// fix header
 		uwsgi.queue_header = uwsgi.queue;
@@ -50,7 +85,7 @@ void uwsgi_init_queue() {
 		close(queue_fd);
 	}
 	else {
-		uwsgi.queue = mmap(NULL, (uwsgi.queue_blocksize * uwsgi.queue_size) + 16, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+		uwsgi.queue = uwsgi_mmap_shared((uwsgi.queue_blocksize * uwsgi.queue_size) + 16, &uwsgi.queue_page_size);
 		// fix header
 		uwsgi.queue_header = uwsgi.queue;
 		uwsgi.queue += 16;
@@ -66,7 +101,19 @@ void uwsgi_init_queue() {
 
 	uwsgi.queue_lock = uwsgi_rwlock_init("queue");
 
-	uwsgi_log("*** Queue subsystem initialized: %luMB preallocated ***\n", (uwsgi.queue_blocksize * uwsgi.queue_size) / (1024 * 1024));
+	if (uwsgi.queue_lockfree) {
+		if (uwsgi.queue_store) {
+			uwsgi_log("--queue-lockfree cannot be used with --queue-store\n");
+			exit(1);
+		}
+		queue_lf = uwsgi_calloc_shared(sizeof(struct uwsgi_queue_lockfree) + (sizeof(uint64_t) * uwsgi.queue_size));
+		uint64_t i;
+		for (i = 0; i < uwsgi.queue_size; i++) {
+			queue_lf->seq[i] = i;
+		}
+	}
+
+	uwsgi_log("*** Queue subsystem initialized: %luMB preallocated%s ***\n", (uwsgi.queue_blocksize * uwsgi.queue_size) / (1024 * 1024), uwsgi.queue_lockfree ? " (lock-free)" : "");
 }
 
 char *uwsgi_queue_get(uint64_t index, uint64_t * size) {
@@ -74,7 +121,7 @@ char *uwsgi_queue_get(uint64_t index, uint64_t * size) {
 	struct uwsgi_queue_item *uqi;
 	char *ptr = (char *) uwsgi.queue;
 
-	if (index >= uwsgi.queue_size)
+	if (index >= uwsgi.queue_size || uwsgi.queue_lockfree)
 		return NULL;
 
 	ptr = ptr + (uwsgi.queue_blocksize * index);
@@ -178,7 +225,7 @@ int uwsgi_queue_set(uint64_t pos, char *message, uint64_t size) {
 	if (!size)
 		return 0;
 
-	if (pos >= uwsgi.queue_size)
+	if (pos >= uwsgi.queue_size || uwsgi.queue_lockfree)
 		return 0;
 
 	ptr = ptr + (uwsgi.queue_blocksize * pos);
@@ -192,3 +239,152 @@ int uwsgi_queue_set(uint64_t pos, char *message, uint64_t size) {
 
 	return 1;
 }
+
+static int queue_lf_push(char *message, uint64_t size) {
+	if (size > uwsgi.queue_blocksize - sizeof(struct uwsgi_queue_item))
+		return 0;
+
+	if (!size)
+		return 0;
+
+	uint64_t pos = __atomic_load_n(&queue_lf->enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		uint64_t seq = __atomic_load_n(&queue_lf->seq[pos % uwsgi.queue_size], __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t) seq - (int64_t) pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue_lf->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		// full
+		else if (diff < 0) {
+			return 0;
+		}
+		else {
+			pos = __atomic_load_n(&queue_lf->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	char *ptr = ((char *) uwsgi.queue) + (uwsgi.queue_blocksize * (pos % uwsgi.queue_size));
+	struct uwsgi_queue_item *uqi = (struct uwsgi_queue_item *) ptr;
+	uqi->size = size;
+	uqi->ts = uwsgi_now();
+	memcpy(ptr + sizeof(struct uwsgi_queue_item), message, size);
+
+	__atomic_store_n(&queue_lf->seq[pos % uwsgi.queue_size], pos + 1, __ATOMIC_RELEASE);
+	// only informative
+	uwsgi.queue_header->pos = (pos + 1) % uwsgi.queue_size;
+
+	__atomic_add_fetch(&queue_lf->signal, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&queue_lf->waiters, __ATOMIC_SEQ_CST)) {
+#ifdef __linux__
+		syscall(SYS_futex, &queue_lf->signal, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+	}
+	return 1;
+}
+
+// returns a copy of the oldest item
+static char *queue_lf_pull(uint64_t *size) {
+	uint64_t pos = __atomic_load_n(&queue_lf->dequeue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		uint64_t seq = __atomic_load_n(&queue_lf->seq[pos % uwsgi.queue_size], __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t) seq - (int64_t) (pos + 1);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue_lf->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		// empty
+		else if (diff < 0) {
+			return NULL;
+		}
+		else {
+			pos = __atomic_load_n(&queue_lf->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	char *ptr = ((char *) uwsgi.queue) + (uwsgi.queue_blocksize * (pos % uwsgi.queue_size));
+	struct uwsgi_queue_item *uqi = (struct uwsgi_queue_item *) ptr;
+	*size = uqi->size;
+	char *storage = uwsgi_malloc(*size);
+	memcpy(storage, ptr + sizeof(struct uwsgi_queue_item), *size);
+	uqi->size = 0;
+
+	// the block can be reused by the next round of pushes
+	__atomic_store_n(&queue_lf->seq[pos % uwsgi.queue_size], pos + uwsgi.queue_size, __ATOMIC_RELEASE);
+	// only informative
+	uwsgi.queue_header->pull_pos = (pos + 1) % uwsgi.queue_size;
+	return storage;
+}
+
+// wait up to timeout msecs (-1 forever) for an item
+static char *queue_lf_pull_wait(uint64_t *size, int timeout) {
+	uint64_t deadline = 0;
+	if (timeout > 0) deadline = uwsgi_micros() + ((uint64_t) timeout * 1000);
+	for (;;) {
+		uint32_t signal = __atomic_load_n(&queue_lf->signal, __ATOMIC_SEQ_CST);
+		char *message = queue_lf_pull(size);
+		if (message || timeout == 0) return message;
+
+		int64_t remains = -1;
+		if (deadline) {
+			remains = (int64_t) deadline - (int64_t) uwsgi_micros();
+			if (remains <= 0) return NULL;
+		}
+
+		__atomic_add_fetch(&queue_lf->waiters, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+		struct timespec ts;
+		if (remains > 0) {
+			ts.tv_sec = remains / 1000000;
+			ts.tv_nsec = (remains % 1000000) * 1000;
+		}
+		// the futex returns immediately if a push happened after our snapshot of the signal
+		syscall(SYS_futex, &queue_lf->signal, FUTEX_WAIT, signal, remains > 0 ? &ts : NULL, NULL, 0);
+#else
+		usleep(remains > 0 && remains < 10000 ? remains : 10000);
+#endif
+		__atomic_sub_fetch(&queue_lf->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*
+	the api for the language bindings: messages are copied (and must be freed by the caller),
+	the queue lock is managed here (or not used at all in lock-free mode).
+
+	timeout (msecs, -1 waits forever) is honoured only in lock-free mode
+*/
+int uwsgi_queue_push_message(char *message, uint64_t size) {
+	if (uwsgi.queue_lockfree) {
+		return queue_lf_push(message, size);
+	}
+	uwsgi_wlock(uwsgi.queue_lock);
+	int ret = uwsgi_queue_push(message, size);
+	uwsgi_rwunlock(uwsgi.queue_lock);
+	return ret;
+}
+
+static char *queue_message(char *(*func)(uint64_t *), uint64_t *size) {
+	char *storage = NULL;
+	uwsgi_wlock(uwsgi.queue_lock);
+	char *message = func(size);
+	if (message && *size > 0) {
+		storage = uwsgi_malloc(*size);
+		memcpy(storage, message, *size);
+	}
+	uwsgi_rwunlock(uwsgi.queue_lock);
+	return storage;
+}
+
+char *uwsgi_queue_pull_message(uint64_t *size, int timeout) {
+	if (uwsgi.queue_lockfree) {
+		return queue_lf_pull_wait(size, timeout);
+	}
+	return queue_message(uwsgi_queue_pull, size);
+}
+
+char *uwsgi_queue_pop_message(uint64_t *size, int timeout) {
+	if (uwsgi.queue_lockfree) {
+		return queue_lf_pull_wait(size, timeout);
+	}
+	return queue_message(uwsgi_queue_pop, size);
+}
@@ -126,8 +126,12 @@ static void uwsgi_rbt_add(struct uwsgi_rb_timer *temp, struct uwsgi_rb_timer *no
 
 
 struct uwsgi_rb_timer *uwsgi_add_rb_timer(struct uwsgi_rbtree *tree, uint64_t value, void *data) {
+	return uwsgi_insert_rb_timer(tree, uwsgi_malloc(sizeof(struct uwsgi_rb_timer)), value, data);
+}
+
+// insert a caller-owned (e.g. pooled) node, uwsgi_del_rb_timer() never frees it
+struct uwsgi_rb_timer *uwsgi_insert_rb_timer(struct uwsgi_rbtree *tree, struct uwsgi_rb_timer *node, uint64_t value, void *data) {
 
-	struct uwsgi_rb_timer *node = uwsgi_malloc(sizeof(struct uwsgi_rb_timer));
 	struct uwsgi_rb_timer *new_node = node;
 	node->value = value;
 	node->data = data;
@@ -67,6 +67,20 @@ int uwsgi_simple_wait_read2_hook(int fd0, int fd1, int timeout, int *fd) {
 	seek()/rewind() language-independent implementations.
 */
 
+static int uwsgi_postbuffer_stream(struct wsgi_request *, size_t);
+
+// ensure the whole body of a disk buffered request is in the post_file (it could be still streaming)
+int uwsgi_request_body_buffer(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->post_file) return -1;
+	if (uwsgi_postbuffer_stream(wsgi_req, wsgi_req->post_cl)) return -1;
+	// flush pending writes, the file could be mapped
+	if (fflush(wsgi_req->post_file)) {
+		uwsgi_req_error("uwsgi_request_body_buffer()/fflush()");
+		return -1;
+	}
+	return 0;
+}
+
 void uwsgi_request_body_seek(struct wsgi_request *wsgi_req, off_t pos) {
 	if (wsgi_req->post_file) {
 		if (pos < 0) {
@@ -78,6 +92,12 @@ void uwsgi_request_body_seek(struct wsgi_request *wsgi_req, off_t pos) {
 			return;
 		}
 
+		// seeking over the already buffered part of a streamed body
+		if (uwsgi_postbuffer_stream(wsgi_req, pos)) {
+			wsgi_req->read_errors++;
+			return;
+		}
+
 		if (fseek(wsgi_req->post_file, pos, SEEK_SET)) {
 			uwsgi_req_error("uwsgi_request_body_seek()/fseek()");
 			wsgi_req->read_errors++;
@@ -95,8 +115,9 @@ void uwsgi_request_body_seek(struct wsgi_request *wsgi_req, off_t pos) {
 			wsgi_req->post_pos -= pos;
 			return;
 		}
-		if (pos >= (off_t) uwsgi.post_buffering) {
-			pos = uwsgi.post_buffering - 1;	
+		// the whole body is in memory (and the threshold could be per-socket)
+		if (pos > (off_t) wsgi_req->post_cl) {
+			pos = wsgi_req->post_cl;
 		}
 		wsgi_req->post_pos = pos;
 	}
@@ -121,6 +142,13 @@ void uwsgi_request_body_seek(struct wsgi_request *wsgi_req, off_t pos) {
                         (unsigned long long) x,\
                         (unsigned long long) wsgi_req->post_cl, (unsigned long long) wsgi_req->post_pos, (unsigned long long) wsgi_req->post_cl-wsgi_req->post_pos);
 
+// mark the end of the body (for the latency breakdown)
+static void uwsgi_request_body_check(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->body_at && wsgi_req->post_pos >= wsgi_req->post_cl) {
+		wsgi_req->body_at = uwsgi_micros();
+	}
+}
+
 static int consume_body_for_readline(struct wsgi_request *wsgi_req) {
 
 	size_t remains = UMIN(uwsgi.buffer_size, wsgi_req->post_cl - wsgi_req->post_pos);
@@ -153,6 +181,7 @@ static int consume_body_for_readline(struct wsgi_request *wsgi_req) {
 
 	// read from a file
 	if (wsgi_req->post_file) {
+		if (uwsgi_postbuffer_stream(wsgi_req, wsgi_req->post_pos + remains)) return -1;
 		size_t ret = fread(wsgi_req->post_readline_buf + wsgi_req->post_readline_watermark, remains, 1, wsgi_req->post_file);	
 		if (ret == 0) {
 			uwsgi_req_error("consume_body_for_readline()/fread()");
@@ -177,6 +206,7 @@ static int consume_body_for_readline(struct wsgi_request *wsgi_req) {
 	if (len > 0) {
 		wsgi_req->post_pos += len;
 		wsgi_req->post_readline_watermark += len;
+		uwsgi_request_body_check(wsgi_req);
 		return 0;
 	}
 	if (len == 0) {
@@ -199,6 +229,7 @@ wait:
                 if (len > 0) {
 			wsgi_req->post_pos += len;
 			wsgi_req->post_readline_watermark += len;
+			uwsgi_request_body_check(wsgi_req);
 			return 0;
 		}
 		uwsgi_read_error(remains);
@@ -396,6 +427,11 @@ char *uwsgi_request_body_read(struct wsgi_request *wsgi_req, ssize_t hint, ssize
 
 	// check for disk buffered body first (they are all read in one shot)
 	if (wsgi_req->post_file) {
+		if (uwsgi_postbuffer_stream(wsgi_req, wsgi_req->post_pos + remains)) {
+			*rlen = -1;
+			wsgi_req->read_errors++;
+			return NULL;
+		}
 		if (fread(wsgi_req->post_read_buf + *rlen, remains, 1, wsgi_req->post_file) != 1) {
 			*rlen = -1;
 			uwsgi_req_error("uwsgi_request_body_read()/fread()");
@@ -466,6 +502,7 @@ wait:
 		return NULL;
 	}
 
+	uwsgi_request_body_check(wsgi_req);
 	return wsgi_req->post_read_buf;
 }
 
@@ -473,8 +510,70 @@ wait:
 
 	post buffering
 
+	every socket has its own threshold (--post-buffering-socket, defaulting to --post-buffering), bodies
+	smaller than it are read in the per-core memory buffer, the others go to disk (or memfd).
+
+	with --post-buffering-adaptive the sizes of the bodies are accounted (in power of two buckets, shared by all
+	the workers) and every 64 requests the threshold is moved to keep 90% of them in memory, without going
+	below the configured value or above the memory buffer (--post-buffering-bufsize).
+	The bucket counters are halved every time, so the threshold follows the traffic changes.
+
 */
 
+#define UWSGI_POST_BUFFERING_ADAPT_EVERY 64
+
+size_t uwsgi_post_buffering_threshold(struct wsgi_request *wsgi_req) {
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+	// sockets added after startup (zerg...) use the global value
+	if (!uwsgi_sock || !uwsgi_sock->post_buffering_policy) return uwsgi.post_buffering;
+	return __atomic_load_n(&uwsgi_sock->post_buffering_policy->threshold, __ATOMIC_RELAXED);
+}
+
+static void uwsgi_post_buffering_adapt(struct uwsgi_socket *uwsgi_sock, struct uwsgi_post_buffering_policy *upbp) {
+	uint64_t total = 0, sum = 0;
+	int i;
+	for (i = 0; i < UWSGI_POST_BUFFERING_BUCKETS; i++) {
+		total += __atomic_load_n(&upbp->hist[i], __ATOMIC_RELAXED);
+	}
+	if (!total) return;
+	uint64_t threshold = uwsgi_sock->post_buffering;
+	for (i = 0; i < UWSGI_POST_BUFFERING_BUCKETS; i++) {
+		sum += __atomic_load_n(&upbp->hist[i], __ATOMIC_RELAXED);
+		if (sum * 10 >= total * 9) {
+			// bodies up to 2^i bytes go in memory
+			threshold = (1ULL << i) + 1;
+			break;
+		}
+	}
+	if (threshold < uwsgi_sock->post_buffering) threshold = uwsgi_sock->post_buffering;
+	if (threshold > uwsgi.post_buffering_bufsize) threshold = uwsgi.post_buffering_bufsize;
+	__atomic_store_n(&upbp->threshold, threshold, __ATOMIC_RELAXED);
+	// decay
+	for (i = 0; i < UWSGI_POST_BUFFERING_BUCKETS; i++) {
+		__atomic_store_n(&upbp->hist[i], __atomic_load_n(&upbp->hist[i], __ATOMIC_RELAXED) / 2, __ATOMIC_RELAXED);
+	}
+}
+
+void uwsgi_post_buffering_account(struct wsgi_request *wsgi_req, int in_disk) {
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+	if (!uwsgi_sock || !uwsgi_sock->post_buffering_policy) return;
+	struct uwsgi_post_buffering_policy *upbp = uwsgi_sock->post_buffering_policy;
+	if (in_disk) {
+		__atomic_add_fetch(&upbp->in_disk, 1, __ATOMIC_RELAXED);
+	}
+	else {
+		__atomic_add_fetch(&upbp->in_memory, 1, __ATOMIC_RELAXED);
+	}
+	if (!uwsgi.post_buffering_adaptive) return;
+
+	int bucket = 0;
+	while (bucket < UWSGI_POST_BUFFERING_BUCKETS - 1 && (1ULL << bucket) < wsgi_req->post_cl) bucket++;
+	__atomic_add_fetch(&upbp->hist[bucket], 1, __ATOMIC_RELAXED);
+	if (__atomic_add_fetch(&upbp->samples, 1, __ATOMIC_RELAXED) % UWSGI_POST_BUFFERING_ADAPT_EVERY == 0) {
+		uwsgi_post_buffering_adapt(uwsgi_sock, upbp);
+	}
+}
+
 int uwsgi_postbuffer_do_in_mem(struct wsgi_request *wsgi_req) {
 
         size_t remains = wsgi_req->post_cl;
@@ -524,51 +623,60 @@ wait:
                 return -1;
 	}
 
+        wsgi_req->body_at = uwsgi_micros();
         return 0;
 
 }
 
 
-int uwsgi_postbuffer_do_in_disk(struct wsgi_request *wsgi_req) {
+/*
 
-        size_t post_remains = wsgi_req->post_cl;
-        int ret;
-        int upload_progress_fd = -1;
-        char *upload_progress_filename = NULL;
+	disk buffering
 
-        wsgi_req->post_file = uwsgi_tmpfile();
-        if (!wsgi_req->post_file) {
-                uwsgi_req_error("uwsgi_postbuffer_do_in_disk()/uwsgi_tmpfile()");
-		wsgi_req->read_errors++;
-                return -1;
-        }
+	the body is stored in a temp file (or in a memfd, when it is smaller than --post-buffering-memfd),
+	with --post-buffering-stream the app is started as soon as the file is created, and the body
+	is buffered while the app reads it (read-through), so seeking backward still works.
 
-        if (uwsgi.upload_progress) {
-                // first check for X-Progress-ID size
-                // separator + 'X-Progress-ID' + '=' + uuid     
-                upload_progress_filename = uwsgi_upload_progress_create(wsgi_req, &upload_progress_fd);
-                if (!upload_progress_filename) {
-                        uwsgi_log("invalid X-Progress-ID value: must be a UUID\n");
-                }
-        }
+*/
 
-        // manage buffered data and upload progress
-        while (post_remains > 0) {
+static FILE *uwsgi_postbuffer_file(struct wsgi_request *wsgi_req) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	if (wsgi_req->post_cl <= uwsgi.post_buffering_memfd) {
+		int fd = memfd_create("uwsgi-body", MFD_CLOEXEC);
+		if (fd >= 0) {
+			FILE *f = fdopen(fd, "w+");
+			if (f) return f;
+			close(fd);
+		}
+		// fallback to a temp file
+	}
+#endif
+	return uwsgi_tmpfile();
+}
+
+// store the body in the file up to the specified position
+static int uwsgi_postbuffer_fill(struct wsgi_request *wsgi_req, size_t upto, int upload_progress_fd, char **upload_progress_filename) {
+
+	int ret;
+
+	if (upto > wsgi_req->post_cl) upto = wsgi_req->post_cl;
+
+	while (wsgi_req->post_buffered < upto) {
 
                 // during post buffering we need to constantly reset the harakiri
                 if (uwsgi.harakiri_options.workers > 0) {
                         inc_harakiri(wsgi_req, uwsgi.harakiri_options.workers);
                 }
 
-                // we use the already available post buffering buffer to read chunks....
-                size_t remains = UMIN(post_remains, uwsgi.post_buffering);
+                // we use the already available post buffering buffer to read chunks (as big as possible, to reduce syscalls)....
+                size_t remains = UMIN(wsgi_req->post_cl - wsgi_req->post_buffered, uwsgi.post_buffering_bufsize);
 
                 // first try to read data (there could be something already available
                 ssize_t rlen = wsgi_req->socket->proto_read_body(wsgi_req, wsgi_req->post_buffering_buf, remains);
                 if (rlen > 0) goto write;
                 if (rlen == 0) {
 			uwsgi_read_error0(remains);
-			goto end;
+			return -1;
 		}
                 if (rlen < 0) {
                         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS) {
@@ -576,7 +684,7 @@ int uwsgi_postbuffer_do_in_disk(struct wsgi_request *wsgi_req) {
                         }
 			uwsgi_read_error(remains);
 			wsgi_req->read_errors++;
-                        goto end;
+                        return -1;
                 }
 
 wait:
@@ -591,33 +699,88 @@ wait:
 				uwsgi_read_error(remains);
 				wsgi_req->read_errors++;
 			}
-                        goto end;
+                        return -1;
 		}
                 if (ret < 0) {
 			uwsgi_read_error(remains);
 			wsgi_req->read_errors++;
-                        goto end;
+                        return -1;
                 }
 		uwsgi_read_timeout(remains);
-                goto end;
+                return -1;
 
 write:
                 if (fwrite(wsgi_req->post_buffering_buf, rlen, 1, wsgi_req->post_file) != 1) {
-                        uwsgi_req_error("uwsgi_postbuffer_do_in_disk()/fwrite()");
+                        uwsgi_req_error("uwsgi_postbuffer_fill()/fwrite()");
 			wsgi_req->read_errors++;
-                        goto end;
+                        return -1;
                 }
 
-                post_remains -= rlen;
+                wsgi_req->post_buffered += rlen;
 
-		if (upload_progress_filename) {
+		if (upload_progress_filename && *upload_progress_filename) {
                         // stop updating it on errors
-                        if (uwsgi_upload_progress_update(wsgi_req, upload_progress_fd, post_remains)) {
-                                uwsgi_upload_progress_destroy(upload_progress_filename, upload_progress_fd);
-                                upload_progress_filename = NULL;
+                        if (uwsgi_upload_progress_update(wsgi_req, upload_progress_fd, wsgi_req->post_cl - wsgi_req->post_buffered)) {
+                                uwsgi_upload_progress_destroy(*upload_progress_filename, upload_progress_fd);
+                                *upload_progress_filename = NULL;
                         }
                 }
         }
+
+	if (!wsgi_req->body_at && wsgi_req->post_buffered >= wsgi_req->post_cl) {
+		wsgi_req->body_at = uwsgi_micros();
+	}
+
+	return 0;
+}
+
+// read-through for streamed bodies, the file position is restored to post_pos
+static int uwsgi_postbuffer_stream(struct wsgi_request *wsgi_req, size_t upto) {
+	if (!wsgi_req->post_streaming) return 0;
+	if (wsgi_req->post_buffered >= UMIN(upto, wsgi_req->post_cl)) return 0;
+	// appending, the read buffer of the FILE is discarded by the final fseek()
+	if (fseek(wsgi_req->post_file, 0, SEEK_END)) {
+		uwsgi_req_error("uwsgi_postbuffer_stream()/fseek()");
+		return -1;
+	}
+	int ret = uwsgi_postbuffer_fill(wsgi_req, upto, -1, NULL);
+	if (fseek(wsgi_req->post_file, wsgi_req->post_pos, SEEK_SET)) {
+		uwsgi_req_error("uwsgi_postbuffer_stream()/fseek()");
+		return -1;
+	}
+	return ret;
+}
+
+int uwsgi_postbuffer_do_in_disk(struct wsgi_request *wsgi_req) {
+
+        int upload_progress_fd = -1;
+        char *upload_progress_filename = NULL;
+
+        wsgi_req->post_file = uwsgi_postbuffer_file(wsgi_req);
+        if (!wsgi_req->post_file) {
+                uwsgi_req_error("uwsgi_postbuffer_do_in_disk()/uwsgi_tmpfile()");
+		wsgi_req->read_errors++;
+                return -1;
+        }
+
+        if (uwsgi.upload_progress) {
+                // first check for X-Progress-ID size
+                // separator + 'X-Progress-ID' + '=' + uuid     
+                upload_progress_filename = uwsgi_upload_progress_create(wsgi_req, &upload_progress_fd);
+                if (!upload_progress_filename) {
+                        uwsgi_log("invalid X-Progress-ID value: must be a UUID\n");
+                }
+        }
+
+	// the body will be buffered while the app reads it (upload progress requires the whole body)
+	if (uwsgi.post_buffering_stream && !upload_progress_filename) {
+		wsgi_req->post_streaming = 1;
+		return 0;
+	}
+
+        // manage buffered data and upload progress
+        if (uwsgi_postbuffer_fill(wsgi_req, wsgi_req->post_cl, upload_progress_fd, &upload_progress_filename)) goto end;
+
         rewind(wsgi_req->post_file);
 
         if (upload_progress_filename) {
@@ -632,4 +795,3 @@ end:
         }
         return -1;
 }
-
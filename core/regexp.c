@@ -107,4 +107,85 @@ char *uwsgi_regexp_apply_ovec(char *src, int src_n, char *dst, int dst_n, int *o
 	return res;
 }
 
+#ifdef UWSGI_HYPERSCAN
+#include <hs.h>
+
+/*
+	multiple regexps compiled in a single hyperscan database (in prefilter mode):
+	a scan returns a superset of the matching regexps, so each of them still
+	needs to be confirmed (and its ovector filled) by pcre
+*/
+
+struct uwsgi_regexp_set {
+	hs_database_t *db;
+	// one for each core
+	hs_scratch_t **scratch;
+};
+
+static int uwsgi_regexp_set_on_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int flags, void *ctx) {
+	uint64_t *matches = (uint64_t *) ctx;
+	matches[id / 64] |= (uint64_t) 1 << (id % 64);
+	return 0;
+}
+
+// the patterns not supported by hyperscan are marked in "unsupported" (they always need pcre)
+struct uwsgi_regexp_set *uwsgi_regexp_set_build(char **patterns, uint32_t cnt, uint64_t *unsupported) {
+	struct uwsgi_regexp_set *set = NULL;
+	hs_database_t *db = NULL;
+	const char **exprs = uwsgi_malloc(sizeof(char *) * cnt);
+	unsigned int *flags = uwsgi_malloc(sizeof(unsigned int) * cnt);
+	unsigned int *ids = uwsgi_malloc(sizeof(unsigned int) * cnt);
+	uint32_t i;
+	int j;
+
+	for (;;) {
+		uint32_t n = 0;
+		for (i = 0; i < cnt; i++) {
+			if (unsupported[i / 64] & ((uint64_t) 1 << (i % 64)))
+				continue;
+			exprs[n] = patterns[i];
+			flags[n] = HS_FLAG_SINGLEMATCH | HS_FLAG_ALLOWEMPTY | HS_FLAG_PREFILTER;
+			ids[n] = i;
+			n++;
+		}
+		if (n == 0)
+			goto end;
+		hs_compile_error_t *err = NULL;
+		if (hs_compile_multi(exprs, flags, ids, n, HS_MODE_BLOCK, NULL, &db, &err) == HS_SUCCESS)
+			break;
+		if (err->expression < 0) {
+			uwsgi_log("[hyperscan] unable to compile routes database: %s\n", err->message);
+			hs_free_compile_error(err);
+			goto end;
+		}
+		uwsgi_log("[hyperscan] regexp \"%s\" will be matched by pcre only: %s\n", exprs[err->expression], err->message);
+		unsupported[ids[err->expression] / 64] |= (uint64_t) 1 << (ids[err->expression] % 64);
+		hs_free_compile_error(err);
+	}
+
+	set = uwsgi_calloc(sizeof(struct uwsgi_regexp_set));
+	set->db = db;
+	set->scratch = uwsgi_calloc(sizeof(hs_scratch_t *) * uwsgi.cores);
+	for (j = 0; j < uwsgi.cores; j++) {
+		if (hs_alloc_scratch(db, &set->scratch[j]) != HS_SUCCESS) {
+			uwsgi_log("[hyperscan] unable to allocate scratch space\n");
+			exit(1);
+		}
+	}
+
+end:
+	free(exprs);
+	free(flags);
+	free(ids);
+	return set;
+}
+
+// set the bit of each (possibly) matching pattern
+int uwsgi_regexp_set_scan(struct uwsgi_regexp_set *set, int core, char *subject, size_t len, uint64_t *matches) {
+	if (hs_scan(set->db, subject, len, 0, set->scratch[core], uwsgi_regexp_set_on_match, matches) != HS_SUCCESS)
+		return -1;
+	return 0;
+}
+#endif
+
 #endif
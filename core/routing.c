@@ -40,26 +40,75 @@ struct uwsgi_route_var *uwsgi_get_route_var(char *name, uint16_t name_len) {
 	return NULL;
 }
 
-struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *wsgi_req, struct uwsgi_route *ur, char *subject, uint16_t subject_len, char *data, size_t data_len) {
-
-	char *pass1 = data;
-	size_t pass1_len = data_len;
-
-	if (ur->condition_ub[wsgi_req->async_id] && ur->ovn[wsgi_req->async_id] > 0) {
-		pass1 = uwsgi_regexp_apply_ovec(ur->condition_ub[wsgi_req->async_id]->buf, ur->condition_ub[wsgi_req->async_id]->pos, data, data_len, ur->ovector[wsgi_req->async_id], ur->ovn[wsgi_req->async_id]);
-		pass1_len = strlen(pass1);
+/*
+	route arguments are compiled to a list of segments (literals and variables),
+	so translating them is only a matter of copying the segments values.
+
+	The compiled forms of the (static) arguments are cached on the route (one set for each core)
+*/
+
+#define UWSGI_ROUTE_TEMPLATES 4
+#define UWSGI_ROUTE_TEMPLATE_MAX 1024
+
+#define UWSGI_ROUTE_SEG_LITERAL 0
+#define UWSGI_ROUTE_SEG_VAR 1
+#define UWSGI_ROUTE_SEG_ROUTE_VAR 2
+
+struct uwsgi_route_template_seg {
+	uint8_t type;
+	char *ptr;
+	size_t len;
+	struct uwsgi_route_var *urv;
+};
+
+struct uwsgi_route_template {
+	// the original argument
+	char *data;
+	size_t data_len;
+	// the ovector pass has been applied
+	int ovec;
+	// the argument after the ovector pass (segments point to it)
+	char *buf;
+	size_t buf_len;
+	struct uwsgi_route_template_seg *segs;
+	size_t segs_cnt;
+	size_t segs_size;
+};
+
+static void uwsgi_route_template_add(struct uwsgi_route_template *urt, uint8_t type, char *ptr, size_t len, struct uwsgi_route_var *urv) {
+	if (type == UWSGI_ROUTE_SEG_LITERAL && urt->segs_cnt > 0) {
+		struct uwsgi_route_template_seg *last = &urt->segs[urt->segs_cnt-1];
+		// merge contiguous literals
+		if (last->type == UWSGI_ROUTE_SEG_LITERAL && last->ptr + last->len == ptr) {
+			last->len += len;
+			return;
+		}
 	}
-	// cannot fail
-	else if (subject) {
-		pass1 = uwsgi_regexp_apply_ovec(subject, subject_len, data, data_len, ur->ovector[wsgi_req->async_id], ur->ovn[wsgi_req->async_id]);
-		pass1_len = strlen(pass1);
+	if (urt->segs_cnt >= urt->segs_size) {
+		urt->segs_size = urt->segs_size ? urt->segs_size * 2 : 8;
+		struct uwsgi_route_template_seg *segs = realloc(urt->segs, sizeof(struct uwsgi_route_template_seg) * urt->segs_size);
+		if (!segs) {
+			uwsgi_error("uwsgi_route_template_add()/realloc()");
+			exit(1);
+		}
+		urt->segs = segs;
 	}
+	struct uwsgi_route_template_seg *seg = &urt->segs[urt->segs_cnt++];
+	seg->type = type;
+	seg->ptr = ptr;
+	seg->len = len;
+	seg->urv = urv;
+}
 
-	struct uwsgi_buffer *ub = uwsgi_buffer_new(pass1_len);
+static void uwsgi_route_template_compile(struct uwsgi_route_template *urt, char *pass1, size_t pass1_len) {
 	size_t i;
 	int status = 0;
 	char *key = NULL;
 	size_t keylen = 0;
+
+	urt->buf = pass1;
+	urt->buf_len = pass1_len;
+
 	for(i=0;i<pass1_len;i++) {
 		switch(status) {
 			case 0:
@@ -67,7 +116,7 @@ struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *wsgi_req, stru
 					status = 1;
 					break;
 				}
-				if (uwsgi_buffer_append(ub, pass1 + i, 1)) goto error;
+				uwsgi_route_template_add(urt, UWSGI_ROUTE_SEG_LITERAL, pass1 + i, 1, NULL);
 				break;
 			case 1:
 				if (pass1[i] == '{') {
@@ -79,44 +128,27 @@ struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *wsgi_req, stru
 				status = 0;
 				key = NULL;
 				keylen = 0;
-				if (uwsgi_buffer_append(ub, "$", 1)) goto error;
-				if (uwsgi_buffer_append(ub, pass1 + i, 1)) goto error;
+				// the '$' and the current char
+				uwsgi_route_template_add(urt, UWSGI_ROUTE_SEG_LITERAL, pass1 + i - 1, 2, NULL);
 				break;
 			case 2:
 				if (pass1[i] == '}') {
-					uint16_t vallen = 0;
-					int need_free = 0;
-					char *value = NULL;
+					struct uwsgi_route_var *urv = NULL;
 					char *bracket = memchr(key, '[', keylen);
 					if (bracket && keylen > 0 && key[keylen-1] == ']') {
-						struct uwsgi_route_var *urv = uwsgi_get_route_var(key, bracket - key);
-						if (urv) {
-							need_free = urv->need_free;
-							value = urv->func(wsgi_req, bracket + 1, keylen - (urv->name_len+2), &vallen); 
-						}
-						else {
-							value = uwsgi_get_var(wsgi_req, key, keylen, &vallen);
-						}
+						urv = uwsgi_get_route_var(key, bracket - key);
 					}
-					else {
-						value = uwsgi_get_var(wsgi_req, key, keylen, &vallen);
+					if (urv) {
+						uwsgi_route_template_add(urt, UWSGI_ROUTE_SEG_ROUTE_VAR, bracket + 1, keylen - (urv->name_len+2), urv);
 					}
-					if (value) {
-						if (uwsgi_buffer_append(ub, value, vallen)) {
-							if (need_free) {
-								free(value);
-							}
-							goto error;
-						}
-						if (need_free) {
-							free(value);
-						}
+					else {
+						uwsgi_route_template_add(urt, UWSGI_ROUTE_SEG_VAR, key, keylen, NULL);
 					}
-                                        status = 0;
+					status = 0;
 					key = NULL;
 					keylen = 0;
-                                        break;
-                                }
+					break;
+				}
 				keylen++;
 				break;
 			default:
@@ -124,14 +156,88 @@ struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *wsgi_req, stru
 		}
 	}
 
-	// fix the buffer
+	// fix the template
 	if (status == 1) {
-		if (uwsgi_buffer_append(ub, "$", 1)) goto error;
+		uwsgi_route_template_add(urt, UWSGI_ROUTE_SEG_LITERAL, pass1 + pass1_len - 1, 1, NULL);
 	}
 	else if (status == 2) {
-		if (uwsgi_buffer_append(ub, "${", 2)) goto error;
-		if (keylen > 0) {
-			if (uwsgi_buffer_append(ub, key, keylen)) goto error;
+		uwsgi_route_template_add(urt, UWSGI_ROUTE_SEG_LITERAL, key - 2, keylen + 2, NULL);
+	}
+}
+
+// the values of route vars only depending on the request vars are memoized
+static char *uwsgi_route_var_value(struct wsgi_request *wsgi_req, struct uwsgi_route_var *urv, char *arg, uint16_t arg_len, uint16_t *vallen, int *need_free) {
+	if (!urv->memoize) {
+		*need_free = urv->need_free;
+		return urv->func(wsgi_req, arg, arg_len, vallen);
+	}
+
+	struct uwsgi_route_memo *urm = wsgi_req->route_memo;
+	while(urm) {
+		// appending a var invalidates the memo
+		if (urm->urv == urv && urm->var_cnt == wsgi_req->var_cnt && !uwsgi_strncmp(urm->arg, urm->arg_len, arg, arg_len)) {
+			*need_free = 0;
+			*vallen = urm->value_len;
+			return urm->value;
+		}
+		urm = urm->next;
+	}
+
+	*vallen = 0;
+	char *value = urv->func(wsgi_req, arg, arg_len, vallen);
+	urm = uwsgi_req_alloc(wsgi_req, sizeof(struct uwsgi_route_memo));
+	urm->urv = urv;
+	urm->arg = uwsgi_req_alloc(wsgi_req, arg_len);
+	memcpy(urm->arg, arg, arg_len);
+	urm->arg_len = arg_len;
+	urm->value = value;
+	urm->value_len = value ? *vallen : 0;
+	urm->need_free = urv->need_free;
+	urm->var_cnt = wsgi_req->var_cnt;
+	urm->next = wsgi_req->route_memo;
+	wsgi_req->route_memo = urm;
+	*need_free = 0;
+	return value;
+}
+
+void uwsgi_routing_free_memo(struct wsgi_request *wsgi_req) {
+	struct uwsgi_route_memo *urm = wsgi_req->route_memo;
+	while(urm) {
+		// the memo items live in the request arena
+		if (urm->need_free && urm->value) free(urm->value);
+		urm = urm->next;
+	}
+	wsgi_req->route_memo = NULL;
+}
+
+static struct uwsgi_buffer *uwsgi_route_template_run(struct wsgi_request *wsgi_req, struct uwsgi_route_template *urt) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(urt->buf_len);
+	size_t i;
+	for(i=0;i<urt->segs_cnt;i++) {
+		struct uwsgi_route_template_seg *seg = &urt->segs[i];
+		if (seg->type == UWSGI_ROUTE_SEG_LITERAL) {
+			if (uwsgi_buffer_append(ub, seg->ptr, seg->len)) goto error;
+			continue;
+		}
+		uint16_t vallen = 0;
+		int need_free = 0;
+		char *value = NULL;
+		if (seg->type == UWSGI_ROUTE_SEG_ROUTE_VAR) {
+			value = uwsgi_route_var_value(wsgi_req, seg->urv, seg->ptr, seg->len, &vallen, &need_free);
+		}
+		else {
+			value = uwsgi_get_var(wsgi_req, seg->ptr, seg->len, &vallen);
+		}
+		if (value) {
+			if (uwsgi_buffer_append(ub, value, vallen)) {
+				if (need_free) {
+					free(value);
+				}
+				goto error;
+			}
+			if (need_free) {
+				free(value);
+			}
 		}
 	}
 
@@ -139,10 +245,6 @@ struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *wsgi_req, stru
 	if (uwsgi_buffer_append(ub, "\0", 1)) goto error;
 	// .. but came back of 1 position to avoid accounting it
 	ub->pos--;
-
-	if (pass1 != data) {
-		free(pass1);
-	}
 	return ub;
 
 error:
@@ -150,6 +252,86 @@ error:
 	return NULL;
 }
 
+// $N references need the ovector of the current request
+static int uwsgi_route_data_has_refs(char *data, size_t data_len) {
+	size_t i;
+	for(i=1;i<data_len;i++) {
+		if (data[i-1] == '$' && isdigit((int) data[i])) return 1;
+	}
+	return 0;
+}
+
+static struct uwsgi_route_template *uwsgi_route_template_get(struct wsgi_request *wsgi_req, struct uwsgi_route *ur, char *data, size_t data_len, int ovec) {
+	if (!ur->templates || data_len > UWSGI_ROUTE_TEMPLATE_MAX || (ovec && uwsgi_route_data_has_refs(data, data_len))) return NULL;
+	struct uwsgi_route_template **slots = &ur->templates[wsgi_req->async_id * UWSGI_ROUTE_TEMPLATES];
+	int i;
+	for(i=0;i<UWSGI_ROUTE_TEMPLATES;i++) {
+		struct uwsgi_route_template *urt = slots[i];
+		if (!urt) break;
+		// the data could be a transient buffer, so check its content too
+		if (urt->ovec == ovec && urt->data_len == data_len && !memcmp(urt->data, data, data_len)) return urt;
+	}
+	if (i >= UWSGI_ROUTE_TEMPLATES) {
+		i = data_len % UWSGI_ROUTE_TEMPLATES;
+		struct uwsgi_route_template *old = slots[i];
+		if (old->buf != old->data) free(old->buf);
+		free(old->data);
+		free(old->segs);
+		free(old);
+	}
+	struct uwsgi_route_template *urt = uwsgi_calloc(sizeof(struct uwsgi_route_template));
+	urt->data = uwsgi_malloc(data_len + 1);
+	memcpy(urt->data, data, data_len);
+	urt->data[data_len] = 0;
+	urt->data_len = data_len;
+	urt->ovec = ovec;
+	if (ovec) {
+		// without references the ovector is never accessed
+		char *pass1 = uwsgi_regexp_apply_ovec(NULL, 0, urt->data, data_len, NULL, 0);
+		uwsgi_route_template_compile(urt, pass1, strlen(pass1));
+	}
+	else {
+		uwsgi_route_template_compile(urt, urt->data, data_len);
+	}
+	slots[i] = urt;
+	return urt;
+}
+
+struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *wsgi_req, struct uwsgi_route *ur, char *subject, uint16_t subject_len, char *data, size_t data_len) {
+
+	int ovec = (ur->condition_ub[wsgi_req->async_id] && ur->ovn[wsgi_req->async_id] > 0) || subject;
+
+	struct uwsgi_route_template *urt = uwsgi_route_template_get(wsgi_req, ur, data, data_len, ovec);
+	if (urt) {
+		return uwsgi_route_template_run(wsgi_req, urt);
+	}
+
+	char *pass1 = data;
+	size_t pass1_len = data_len;
+
+	if (ur->condition_ub[wsgi_req->async_id] && ur->ovn[wsgi_req->async_id] > 0) {
+		pass1 = uwsgi_regexp_apply_ovec(ur->condition_ub[wsgi_req->async_id]->buf, ur->condition_ub[wsgi_req->async_id]->pos, data, data_len, ur->ovector[wsgi_req->async_id], ur->ovn[wsgi_req->async_id]);
+		pass1_len = strlen(pass1);
+	}
+	// cannot fail
+	else if (subject) {
+		pass1 = uwsgi_regexp_apply_ovec(subject, subject_len, data, data_len, ur->ovector[wsgi_req->async_id], ur->ovn[wsgi_req->async_id]);
+		pass1_len = strlen(pass1);
+	}
+
+	// one-shot template
+	struct uwsgi_route_template tmp;
+	memset(&tmp, 0, sizeof(struct uwsgi_route_template));
+	uwsgi_route_template_compile(&tmp, pass1, pass1_len);
+	struct uwsgi_buffer *ub = uwsgi_route_template_run(wsgi_req, &tmp);
+	free(tmp.segs);
+
+	if (pass1 != data) {
+		free(pass1);
+	}
+	return ub;
+}
+
 static void uwsgi_routing_reset_memory(struct wsgi_request *wsgi_req, struct uwsgi_route *routes) {
 	// free dynamic memory structures
 	if (routes->if_func) {
@@ -166,6 +348,83 @@ static void uwsgi_routing_reset_memory(struct wsgi_request *wsgi_req, struct uws
 
 }
 
+static struct uwsgi_route_literal *uwsgi_route_group_find(struct uwsgi_route_group *urg, char *key, size_t len, int prefix) {
+	struct uwsgi_route_literal *url = urg->table[djb33x_hash(key, len) % urg->table_size];
+	while(url) {
+		if (url->prefix == prefix && url->key_len == len && !memcmp(url->key, key, len)) return url;
+		url = url->next;
+	}
+	return NULL;
+}
+
+static void uwsgi_route_literal_first(struct uwsgi_route_literal *url, uint32_t from, int64_t *found) {
+	uint32_t i;
+	if (!url) return;
+	for(i=0;i<url->members_cnt;i++) {
+		if (url->members[i] < from) continue;
+		if (*found < 0 || url->members[i] < *found) *found = url->members[i];
+		return;
+	}
+}
+
+// get the first route of the group (starting from "from") matching the subject, -1 if none
+static int64_t uwsgi_route_group_lookup(struct uwsgi_route_group *urg, char *subject, size_t subject_len, uint32_t from) {
+	int64_t found = -1;
+	uint32_t i;
+
+	if (!subject) return -1;
+
+	uwsgi_route_literal_first(uwsgi_route_group_find(urg, subject, subject_len, 0), from, &found);
+	// like pcre, '$' matches before a final newline too
+	if (subject_len > 0 && subject[subject_len-1] == '\n') {
+		uwsgi_route_literal_first(uwsgi_route_group_find(urg, subject, subject_len-1, 0), from, &found);
+	}
+	for(i=0;i<urg->prefix_lens_cnt;i++) {
+		if (urg->prefix_lens[i] > subject_len) continue;
+		uwsgi_route_literal_first(uwsgi_route_group_find(urg, subject, urg->prefix_lens[i], 1), from, &found);
+	}
+	return found;
+}
+
+#ifdef UWSGI_HYPERSCAN
+// regexp routes on the same subject, scanned once for each routes pass
+struct uwsgi_route_set {
+	size_t subject;
+	size_t subject_len;
+	uint32_t routes_cnt;
+	uint32_t words;
+	struct uwsgi_regexp_set *rs;
+	uint64_t *unsupported;
+	// one for each core
+	uint64_t **matches;
+	uint64_t *scan_id;
+	char **scanned;
+	uint16_t *scanned_len;
+};
+
+// incremented (for each core) on every routes pass
+static uint64_t *uwsgi_route_scans;
+
+// returns 0 if the route at "pos" cannot match the subject
+static int uwsgi_route_set_check(struct uwsgi_route_set *urs, uint32_t pos, int core, char *subject, uint16_t subject_len) {
+	uint64_t bit = (uint64_t) 1 << (pos % 64);
+	if (urs->unsupported[pos / 64] & bit) return 1;
+	uint64_t *matches = urs->matches[core];
+	// the subject could have been rewritten by a previous route
+	if (urs->scan_id[core] != uwsgi_route_scans[core] || urs->scanned[core] != subject || urs->scanned_len[core] != subject_len) {
+		memset(matches, 0, sizeof(uint64_t) * urs->words);
+		if (uwsgi_regexp_set_scan(urs->rs, core, subject, subject_len, matches)) {
+			// let pcre do the work
+			memset(matches, 0xff, sizeof(uint64_t) * urs->words);
+		}
+		urs->scan_id[core] = uwsgi_route_scans[core];
+		urs->scanned[core] = subject;
+		urs->scanned_len[core] = subject_len;
+	}
+	return (matches[pos / 64] & bit) ? 1 : 0;
+}
+#endif
+
 int uwsgi_apply_routes_do(struct uwsgi_route *routes, struct wsgi_request *wsgi_req, char *subject, uint16_t subject_len) {
 
 	int n = -1;
@@ -189,6 +448,10 @@ int uwsgi_apply_routes_do(struct uwsgi_route *routes, struct wsgi_request *wsgi_
 		r_pc = &wsgi_req->final_route_pc;
 	}
 
+#ifdef UWSGI_HYPERSCAN
+	if (uwsgi_route_scans) uwsgi_route_scans[wsgi_req->async_id]++;
+#endif
+
 	while (routes) {
 
 		if (routes->label) goto next;
@@ -199,6 +462,27 @@ int uwsgi_apply_routes_do(struct uwsgi_route *routes, struct wsgi_request *wsgi_
 
 		*r_goto = 0;
 
+		// literal routes: jump straight to the next matching one (if any)
+		if (routes->group) {
+			struct uwsgi_route_group *urg = routes->group;
+			if (!subject) {
+				char **subject2 = (char **) (((char *) (wsgi_req)) + urg->subject);
+				uint16_t *subject_len2 = (uint16_t *) (((char *) (wsgi_req)) + urg->subject_len);
+				subject = *subject2 ;
+				subject_len = *subject_len2;
+			}
+			int64_t found = uwsgi_route_group_lookup(urg, subject, subject_len, routes->group_pos);
+			if (found < 0) {
+				*r_pc += (urg->routes_cnt - 1) - routes->group_pos;
+				routes = urg->routes[urg->routes_cnt - 1];
+				goto next;
+			}
+			*r_pc += found - routes->group_pos;
+			routes = urg->routes[found];
+			n = 1;
+			goto run;
+		}
+
 		if (!routes->if_func) {
 			// could be a "run"
 			if (!routes->subject) {
@@ -211,6 +495,11 @@ int uwsgi_apply_routes_do(struct uwsgi_route *routes, struct wsgi_request *wsgi_
 				subject = *subject2 ;
 				subject_len = *subject_len2;
 			}
+#ifdef UWSGI_HYPERSCAN
+			if (routes->set && subject && !uwsgi_route_set_check(routes->set, routes->set_pos, wsgi_req->async_id, subject, subject_len)) {
+				goto next;
+			}
+#endif
 			n = uwsgi_regexp_match_ovec(routes->pattern, routes->pattern_extra, subject, subject_len, routes->ovector[wsgi_req->async_id], routes->ovn[wsgi_req->async_id]);
 		}
 		else {
@@ -283,7 +572,10 @@ int uwsgi_apply_routes(struct wsgi_request *wsgi_req) {
 		return UWSGI_ROUTE_CONTINUE;
 	}
 
-	return uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0);
+	int mem_old = uwsgi_memory_enter(UWSGI_MEM_ROUTING);
+	int ret = uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0);
+	uwsgi_memory_leave(mem_old);
+	return ret;
 }
 
 void uwsgi_apply_final_routes(struct wsgi_request *wsgi_req) {
@@ -295,7 +587,9 @@ void uwsgi_apply_final_routes(struct wsgi_request *wsgi_req) {
 
 	wsgi_req->is_final_routing = 1;
 
+	int mem_old = uwsgi_memory_enter(UWSGI_MEM_ROUTING);
         uwsgi_apply_routes_do(uwsgi.final_routes, wsgi_req, NULL, 0);
+	uwsgi_memory_leave(mem_old);
 }
 
 int uwsgi_apply_error_routes(struct wsgi_request *wsgi_req) {
@@ -307,7 +601,10 @@ int uwsgi_apply_error_routes(struct wsgi_request *wsgi_req) {
 
         wsgi_req->is_error_routing = 1;
 
-	return uwsgi_apply_routes_do(uwsgi.error_routes, wsgi_req, NULL, 0);
+	int mem_old = uwsgi_memory_enter(UWSGI_MEM_ROUTING);
+	int ret = uwsgi_apply_routes_do(uwsgi.error_routes, wsgi_req, NULL, 0);
+	uwsgi_memory_leave(mem_old);
+	return ret;
 }
 
 int uwsgi_apply_response_routes(struct wsgi_request *wsgi_req) {
@@ -497,12 +794,189 @@ done:
 	exit(1);
 }
 
+// parse a "^literal" or "^literal$" regexp, returns the unescaped literal or NULL
+static char *uwsgi_route_literal_parse(char *re, size_t *len, int *prefix) {
+	if (!re || *re != '^') return NULL;
+	char *key = uwsgi_malloc(strlen(re) + 1);
+	size_t pos = 0;
+	char *p = re + 1;
+	*prefix = 1;
+	while(*p) {
+		if (*p == '\\') {
+			p++;
+			// \d, \w, \Q... are not literals
+			if (!*p || isalnum((unsigned char) *p)) goto notliteral;
+			key[pos++] = *p++;
+			continue;
+		}
+		if (*p == '$' && *(p+1) == 0) {
+			*prefix = 0;
+			break;
+		}
+		if (strchr(".[]()*+?{}|^$", *p)) goto notliteral;
+		key[pos++] = *p++;
+	}
+	if (pos == 0) goto notliteral;
+	*len = pos;
+	return key;
+notliteral:
+	free(key);
+	return NULL;
+}
+
+static int uwsgi_route_is_literal(struct uwsgi_route *ur) {
+	if (ur->label || ur->if_func || !ur->subject || !ur->subject_len) return 0;
+	size_t len;
+	int prefix;
+	char *key = uwsgi_route_literal_parse(ur->orig_route, &len, &prefix);
+	if (!key) return 0;
+	free(key);
+	return 1;
+}
+
+static void uwsgi_route_group_build(struct uwsgi_route *first, uint32_t cnt) {
+	struct uwsgi_route_group *urg = uwsgi_calloc(sizeof(struct uwsgi_route_group));
+	urg->subject = first->subject;
+	urg->subject_len = first->subject_len;
+	urg->routes = uwsgi_malloc(sizeof(struct uwsgi_route *) * cnt);
+	urg->routes_cnt = cnt;
+	urg->table_size = cnt * 2;
+	urg->table = uwsgi_calloc(sizeof(struct uwsgi_route_literal *) * urg->table_size);
+	urg->prefix_lens = uwsgi_malloc(sizeof(size_t) * cnt);
+
+	struct uwsgi_route *ur = first;
+	uint32_t i, j;
+	for(i=0;i<cnt;i++) {
+		size_t len;
+		int prefix;
+		char *key = uwsgi_route_literal_parse(ur->orig_route, &len, &prefix);
+		struct uwsgi_route_literal *url = uwsgi_route_group_find(urg, key, len, prefix);
+		if (url) {
+			free(key);
+		}
+		else {
+			uint32_t slot = djb33x_hash(key, len) % urg->table_size;
+			url = uwsgi_calloc(sizeof(struct uwsgi_route_literal));
+			url->key = key;
+			url->key_len = len;
+			url->prefix = prefix;
+			url->members = uwsgi_malloc(sizeof(uint32_t) * cnt);
+			url->next = urg->table[slot];
+			urg->table[slot] = url;
+			if (prefix) {
+				for(j=0;j<urg->prefix_lens_cnt;j++) {
+					if (urg->prefix_lens[j] == len) break;
+				}
+				if (j >= urg->prefix_lens_cnt) urg->prefix_lens[urg->prefix_lens_cnt++] = len;
+			}
+		}
+		url->members[url->members_cnt++] = i;
+		ur->group = urg;
+		ur->group_pos = i;
+		urg->routes[i] = ur;
+		ur = ur->next;
+	}
+}
+
+#define UWSGI_ROUTE_GROUP_MIN 4
+
+#ifdef UWSGI_HYPERSCAN
+/*
+	the remaining regexp routes sharing a subject are compiled
+	in a single multi-pattern database
+*/
+static void uwsgi_routes_compile_sets(struct uwsgi_route *routes) {
+	struct uwsgi_route *ur = routes;
+	while(ur) {
+		if (ur->set || ur->group || ur->label || ur->if_func || !ur->subject || !ur->subject_len) goto next;
+		// count the routes on the same subject
+		uint32_t cnt = 0;
+		struct uwsgi_route *ur2 = ur;
+		while(ur2) {
+			if (!ur2->group && !ur2->label && !ur2->if_func && ur2->subject == ur->subject && ur2->subject_len == ur->subject_len) cnt++;
+			ur2 = ur2->next;
+		}
+		if (cnt < UWSGI_ROUTE_GROUP_MIN) goto next;
+
+		struct uwsgi_route_set *urs = uwsgi_calloc(sizeof(struct uwsgi_route_set));
+		urs->subject = ur->subject;
+		urs->subject_len = ur->subject_len;
+		urs->words = (cnt + 63) / 64;
+		urs->unsupported = uwsgi_calloc(sizeof(uint64_t) * urs->words);
+		char **patterns = uwsgi_malloc(sizeof(char *) * cnt);
+		struct uwsgi_route **members = uwsgi_malloc(sizeof(struct uwsgi_route *) * cnt);
+		ur2 = ur;
+		while(ur2) {
+			if (!ur2->group && !ur2->label && !ur2->if_func && ur2->subject == ur->subject && ur2->subject_len == ur->subject_len) {
+				members[urs->routes_cnt] = ur2;
+				patterns[urs->routes_cnt++] = ur2->orig_route;
+			}
+			ur2 = ur2->next;
+		}
+		urs->rs = uwsgi_regexp_set_build(patterns, cnt, urs->unsupported);
+		free(patterns);
+		if (!urs->rs) {
+			free(members);
+			free(urs->unsupported);
+			free(urs);
+			goto next;
+		}
+		uint32_t i;
+		for(i=0;i<cnt;i++) {
+			members[i]->set = urs;
+			members[i]->set_pos = i;
+		}
+		free(members);
+		int j;
+		urs->matches = uwsgi_malloc(sizeof(uint64_t *) * uwsgi.cores);
+		for(j=0;j<uwsgi.cores;j++) {
+			urs->matches[j] = uwsgi_calloc(sizeof(uint64_t) * urs->words);
+		}
+		urs->scan_id = uwsgi_calloc(sizeof(uint64_t) * uwsgi.cores);
+		urs->scanned = uwsgi_calloc(sizeof(char *) * uwsgi.cores);
+		urs->scanned_len = uwsgi_calloc(sizeof(uint16_t) * uwsgi.cores);
+		if (!uwsgi_route_scans) {
+			uwsgi_route_scans = uwsgi_calloc(sizeof(uint64_t) * uwsgi.cores);
+		}
+next:
+		ur = ur->next;
+	}
+}
+#endif
+
+/*
+	runs of literal routes ("^/foo" or "^/foo$") on the same subject are
+	dispatched with a hash lookup instead of calling pcre on each of them
+*/
+static void uwsgi_routes_compile(struct uwsgi_route *ur) {
+#ifdef UWSGI_HYPERSCAN
+	struct uwsgi_route *head = ur;
+#endif
+	while(ur) {
+		struct uwsgi_route *first = ur;
+		uint32_t cnt = 0;
+		while(ur && uwsgi_route_is_literal(ur) && ur->subject == first->subject && ur->subject_len == first->subject_len) {
+			cnt++;
+			ur = ur->next;
+		}
+		if (cnt >= UWSGI_ROUTE_GROUP_MIN) {
+			uwsgi_route_group_build(first, cnt);
+		}
+		if (!cnt) ur = ur->next;
+	}
+#ifdef UWSGI_HYPERSCAN
+	uwsgi_routes_compile_sets(head);
+#endif
+}
+
 void uwsgi_fixup_routes(struct uwsgi_route *ur) {
+	struct uwsgi_route *head = ur;
 	while(ur) {
 		// prepare the main pointers
 		ur->ovn = uwsgi_calloc(sizeof(int) * uwsgi.cores);
 		ur->ovector = uwsgi_calloc(sizeof(int *) * uwsgi.cores);
 		ur->condition_ub = uwsgi_calloc( sizeof(struct uwsgi_buffer *) * uwsgi.cores);
+		ur->templates = uwsgi_calloc(sizeof(struct uwsgi_route_template *) * uwsgi.cores * UWSGI_ROUTE_TEMPLATES);
 
 		// fill them if needed... (this is an optimization for route with a static subject)
 		if (ur->subject && ur->subject_len) {
@@ -520,6 +994,7 @@ void uwsgi_fixup_routes(struct uwsgi_route *ur) {
 		}
 		ur = ur->next;
         }
+	uwsgi_routes_compile(head);
 }
 
 int uwsgi_route_api_func(struct wsgi_request *wsgi_req, char *router, char *args) {
@@ -2107,10 +2582,13 @@ void uwsgi_register_embedded_routers() {
 
         uwsgi_register_route_condition("empty", uwsgi_route_condition_empty);
 
-        uwsgi_register_route_var("cookie", uwsgi_get_cookie);
-        uwsgi_register_route_var("qs", uwsgi_get_qs);
-        uwsgi_register_route_var("mime", uwsgi_route_var_mime);
-        struct uwsgi_route_var *urv = uwsgi_register_route_var("uwsgi", uwsgi_route_var_uwsgi);
+        struct uwsgi_route_var *urv = uwsgi_register_route_var("cookie", uwsgi_get_cookie);
+	urv->memoize = 1;
+        urv = uwsgi_register_route_var("qs", uwsgi_get_qs);
+	urv->memoize = 1;
+        urv = uwsgi_register_route_var("mime", uwsgi_route_var_mime);
+	urv->memoize = 1;
+        urv = uwsgi_register_route_var("uwsgi", uwsgi_route_var_uwsgi);
 	urv->need_free = 1;
         urv = uwsgi_register_route_var("time", uwsgi_route_var_time);
 	urv->need_free = 1;
@@ -2118,13 +2596,17 @@ void uwsgi_register_embedded_routers() {
 	urv->need_free = 1;
         urv = uwsgi_register_route_var("base64", uwsgi_route_var_base64);
 	urv->need_free = 1;
+	urv->memoize = 1;
 
         urv = uwsgi_register_route_var("hex", uwsgi_route_var_hex);
 	urv->need_free = 1;
+	urv->memoize = 1;
     urv = uwsgi_register_route_var("upper", uwsgi_route_var_upper);
     urv->need_free = 1;
+    urv->memoize = 1;
     urv = uwsgi_register_route_var("lower", uwsgi_route_var_lower);
     urv->need_free = 1;
+    urv->memoize = 1;
 }
 
 struct uwsgi_router *uwsgi_register_router(char *name, int (*func) (struct uwsgi_route *, char *)) {
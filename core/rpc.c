@@ -103,6 +103,439 @@ static void rpc_context_hook(char *key, uint16_t kl, char *value, uint16_t vl, v
 	}
 }
 
+/*
+
+	persistent (pipelined) RPC connections
+
+	a rpc stream is opened with an empty 173/6 packet, then each call is sent as a
+	[173][u16le array size][0][u32le id] frame followed by the uwsgi array (func + args).
+	The node answers (in order) with [173][0][0][found][u32le id][u32le len] followed by the response.
+
+	uwsgi_rpc_calls() sends the calls of each node in a single write (up to RPC_STREAM_WINDOW in flight)
+	on one connection, so multiple nodes run them in parallel. With --rpc-pool the connections are
+	kept (up to N per node) for the next calls (even uwsgi_do_rpc() ones).
+
+	Connections are checked out of the pool while in use, so threads and async cores never share them,
+	and all of the i/o goes through the wait hooks (an async core is suspended while waiting for a node).
+
+*/
+
+#define RPC_STREAM_WINDOW 64
+
+struct uwsgi_rpc_conn {
+	char *node;
+	int fd;
+	uint32_t id;
+	struct uwsgi_rpc_conn *next;
+};
+
+static struct uwsgi_rpc_conn *rpc_pool;
+static pthread_mutex_t rpc_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void rpc_conn_close(struct uwsgi_rpc_conn *conn) {
+	close(conn->fd);
+	free(conn->node);
+	free(conn);
+}
+
+static struct uwsgi_rpc_conn *rpc_conn_get(char *node) {
+	struct uwsgi_rpc_conn *conn;
+	for (;;) {
+		pthread_mutex_lock(&rpc_pool_lock);
+		struct uwsgi_rpc_conn *prev = NULL;
+		conn = rpc_pool;
+		while (conn) {
+			if (!strcmp(conn->node, node)) {
+				if (prev) prev->next = conn->next;
+				else rpc_pool = conn->next;
+				break;
+			}
+			prev = conn;
+			conn = conn->next;
+		}
+		pthread_mutex_unlock(&rpc_pool_lock);
+		if (!conn) break;
+
+		// the node could have closed the (idle) connection
+		char byte;
+		ssize_t rlen = recv(conn->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (rlen < 0 && uwsgi_is_again()) return conn;
+		rpc_conn_close(conn);
+	}
+
+	// connect to node (async way)
+	int fd = uwsgi_connect(node, 0, 1);
+	if (fd < 0) return NULL;
+
+	if (uwsgi.wait_write_hook(fd, uwsgi.socket_timeout) <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	char handshake[4];
+	handshake[0] = 173;
+	handshake[1] = 0;
+	handshake[2] = 0;
+	handshake[3] = UWSGI_RPC_STREAM;
+	if (uwsgi_write_true_nb(fd, handshake, 4, uwsgi.socket_timeout)) {
+		close(fd);
+		return NULL;
+	}
+
+	conn = uwsgi_calloc(sizeof(struct uwsgi_rpc_conn));
+	conn->node = uwsgi_str(node);
+	conn->fd = fd;
+	return conn;
+}
+
+static void rpc_conn_put(struct uwsgi_rpc_conn *conn) {
+	if (uwsgi.rpc_pool > 0) {
+		int count = 0;
+		pthread_mutex_lock(&rpc_pool_lock);
+		struct uwsgi_rpc_conn *c = rpc_pool;
+		while (c) {
+			if (!strcmp(c->node, conn->node)) count++;
+			c = c->next;
+		}
+		if (count < uwsgi.rpc_pool) {
+			conn->next = rpc_pool;
+			rpc_pool = conn;
+			conn = NULL;
+		}
+		pthread_mutex_unlock(&rpc_pool_lock);
+	}
+	if (conn) rpc_conn_close(conn);
+}
+
+static int rpc_stream_frame(struct uwsgi_buffer *ub, uint32_t id, struct uwsgi_rpc_call *call) {
+	uint8_t i;
+	size_t size = 2 + strlen(call->func);
+	for (i = 0; i < call->argc; i++) {
+		size += 2 + call->argvs[i];
+	}
+	if (size > 0xffff) {
+		uwsgi_log("RPC packet length overflow!!! Must be less than or equal to 65535, have %llu\n", (unsigned long long) size);
+		return -1;
+	}
+	if (uwsgi_buffer_u8(ub, 173)) return -1;
+	if (uwsgi_buffer_u16le(ub, size)) return -1;
+	if (uwsgi_buffer_u8(ub, 0)) return -1;
+	if (uwsgi_buffer_u32le(ub, id)) return -1;
+	if (uwsgi_buffer_u16le(ub, strlen(call->func))) return -1;
+	if (uwsgi_buffer_append(ub, call->func, strlen(call->func))) return -1;
+	for (i = 0; i < call->argc; i++) {
+		if (uwsgi_buffer_u16le(ub, call->argvs[i])) return -1;
+		if (uwsgi_buffer_append(ub, call->argv[i], call->argvs[i])) return -1;
+	}
+	return 0;
+}
+
+static int rpc_stream_response(struct uwsgi_rpc_conn *conn, uint32_t id, struct uwsgi_rpc_call *call) {
+	uint8_t hdr[12];
+	if (uwsgi_read_whole_true_nb(conn->fd, (char *) hdr, 12, uwsgi.socket_timeout)) return -1;
+	uint32_t rid = hdr[4] | (hdr[5] << 8) | (hdr[6] << 16) | ((uint32_t) hdr[7] << 24);
+	if (hdr[0] != 173 || rid != id) {
+		uwsgi_log("invalid RPC stream response from %s\n", conn->node);
+		return -1;
+	}
+	uint32_t len = hdr[8] | (hdr[9] << 8) | (hdr[10] << 16) | ((uint32_t) hdr[11] << 24);
+	if (!len) return 0;
+	char *buf = uwsgi_malloc(len);
+	if (uwsgi_read_whole_true_nb(conn->fd, buf, len, uwsgi.socket_timeout)) {
+		free(buf);
+		return -1;
+	}
+	// function not found
+	if (!hdr[3]) {
+		free(buf);
+		return 0;
+	}
+	call->response = buf;
+	call->len = len;
+	return 0;
+}
+
+struct rpc_group {
+	struct uwsgi_rpc_conn *conn;
+	int *calls;
+	int count;
+	int sent;
+	int received;
+};
+
+/*
+	run multiple RPC calls, the remote ones are pipelined over a connection per node
+	(local calls are run while the nodes work on the remote ones).
+
+	returns the number of calls with a response (call->response must be freed)
+*/
+int uwsgi_rpc_calls(struct uwsgi_rpc_call *calls, int n) {
+	int i, j, groups_cnt = 0, ok = 0;
+	struct rpc_group *groups = uwsgi_calloc(sizeof(struct rpc_group) * (n + 1));
+	int *order = uwsgi_malloc(sizeof(int) * (n + 1));
+	uint32_t *ids = uwsgi_calloc(sizeof(uint32_t) * (n + 1));
+	int *grouped = uwsgi_calloc(sizeof(int) * (n + 1));
+	int pos = 0;
+
+	for (i = 0; i < n; i++) {
+		calls[i].response = NULL;
+		calls[i].len = 0;
+		if (!calls[i].node || !calls[i].node[0] || grouped[i]) continue;
+		struct rpc_group *g = &groups[groups_cnt++];
+		g->calls = order + pos;
+		for (j = i; j < n; j++) {
+			if (grouped[j] || !calls[j].node || strcmp(calls[j].node, calls[i].node)) continue;
+			grouped[j] = 1;
+			g->calls[g->count++] = j;
+		}
+		pos += g->count;
+		g->conn = rpc_conn_get(calls[i].node);
+	}
+
+	int local_done = 0;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	for (;;) {
+		int active = 0;
+		// send the next window of calls to each node
+		for (i = 0; i < groups_cnt; i++) {
+			struct rpc_group *g = &groups[i];
+			if (!g->conn || g->sent >= g->count) continue;
+			ub->pos = 0;
+			int last = UMIN(g->count, g->sent + RPC_STREAM_WINDOW);
+			for (j = g->sent; j < last; j++) {
+				ids[g->calls[j]] = g->conn->id++;
+				if (rpc_stream_frame(ub, ids[g->calls[j]], &calls[g->calls[j]])) break;
+			}
+			if (j < last || uwsgi_write_true_nb(g->conn->fd, ub->buf, ub->pos, uwsgi.socket_timeout)) {
+				rpc_conn_close(g->conn);
+				g->conn = NULL;
+				continue;
+			}
+			g->sent = last;
+			active++;
+		}
+
+		if (!local_done) {
+			for (i = 0; i < n; i++) {
+				if (calls[i].node && calls[i].node[0]) continue;
+				if (!uwsgi.rpc_table) {
+					uwsgi_log("local rpc subsystem is still not initialized !!!\n");
+					break;
+				}
+				calls[i].len = uwsgi_rpc(calls[i].func, calls[i].argc, calls[i].argv, calls[i].argvs, &calls[i].response);
+				if (!calls[i].len && calls[i].response) {
+					free(calls[i].response);
+					calls[i].response = NULL;
+				}
+			}
+			local_done = 1;
+		}
+
+		if (!active) break;
+
+		// collect the responses
+		for (i = 0; i < groups_cnt; i++) {
+			struct rpc_group *g = &groups[i];
+			while (g->conn && g->received < g->sent) {
+				int c = g->calls[g->received];
+				if (rpc_stream_response(g->conn, ids[c], &calls[c])) {
+					rpc_conn_close(g->conn);
+					g->conn = NULL;
+					break;
+				}
+				g->received++;
+			}
+		}
+	}
+	uwsgi_buffer_destroy(ub);
+
+	for (i = 0; i < groups_cnt; i++) {
+		if (groups[i].conn) rpc_conn_put(groups[i].conn);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (calls[i].response) ok++;
+	}
+
+	free(groups);
+	free(order);
+	free(ids);
+	free(grouped);
+	return ok;
+}
+
+struct rpc_fanout_node {
+	int fd;
+	size_t sent;
+	char *buf;
+	size_t len;
+	size_t pos;
+	// size of the whole response
+	size_t need;
+	// start of the response body (0 = still reading the header)
+	size_t offset;
+};
+
+// returns 1 when the response is complete, -1 on error
+static int rpc_fanout_read(struct rpc_fanout_node *rfn) {
+	if (rfn->len - rfn->pos < 4096) {
+		char *tmp = realloc(rfn->buf, rfn->len + 4096);
+		if (!tmp) return -1;
+		rfn->buf = tmp;
+		rfn->len += 4096;
+	}
+	ssize_t rlen = read(rfn->fd, rfn->buf + rfn->pos, rfn->len - rfn->pos);
+	if (rlen < 0 && uwsgi_is_again()) return 0;
+	if (rlen <= 0) return -1;
+	rfn->pos += rlen;
+
+	if (!rfn->offset) {
+		if (rfn->pos < 4) return 0;
+		struct uwsgi_header *uh = (struct uwsgi_header *) rfn->buf;
+		uint16_t pktsize = uh->_pktsize;
+#ifdef __BIG_ENDIAN__
+		pktsize = uwsgi_swap16(pktsize);
+#endif
+		if (rfn->pos < (size_t) 4 + pktsize) return 0;
+		// 64bit response ?
+		if (uh->modifier2 == 5) {
+			size_t content_len = 0;
+			if (uwsgi_hooked_parse(rfn->buf + 4, pktsize, rpc_context_hook, &content_len)) return -1;
+			rfn->offset = 4 + pktsize;
+			rfn->need = rfn->offset + content_len;
+			if (rfn->need > rfn->len) {
+				char *tmp = realloc(rfn->buf, rfn->need);
+				if (!tmp) return -1;
+				rfn->buf = tmp;
+				rfn->len = rfn->need;
+			}
+		}
+		else {
+			rfn->offset = 4;
+			rfn->need = 4 + pktsize;
+		}
+	}
+	return rfn->pos >= rfn->need ? 1 : 0;
+}
+
+/*
+	fan out the same call to a list of nodes: the requests are sent concurrently
+	(non-blocking connect()s managed by an event queue) and the responses gathered
+	until the deadline (in msecs, 0 = socket-timeout).
+
+	responses[i]/lens[i] are set for each node answering in time (the responses must be freed),
+	returns the number of responses
+*/
+int uwsgi_rpc_multi(char **nodes, int n, char *func, uint8_t argc, char *argv[], uint16_t argvs[], int timeout, char **responses, uint64_t *lens) {
+	int i, ok = 0, pending = 0;
+	uint8_t j;
+
+	for (i = 0; i < n; i++) {
+		responses[i] = NULL;
+		lens[i] = 0;
+	}
+
+	size_t buffer_size = 2 + strlen(func);
+	for (j = 0; j < argc; j++) {
+		buffer_size += 2 + argvs[j];
+	}
+	if (buffer_size > 0xffff) {
+		uwsgi_log("RPC packet length overflow!!! Must be less than or equal to 65535, have %llu\n", (unsigned long long) buffer_size);
+		return 0;
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(4 + buffer_size);
+	if (uwsgi_buffer_u8(ub, 173)) goto end;
+	if (uwsgi_buffer_u16le(ub, buffer_size)) goto end;
+	if (uwsgi_buffer_u8(ub, 0)) goto end;
+	if (uwsgi_buffer_u16le(ub, strlen(func))) goto end;
+	if (uwsgi_buffer_append(ub, func, strlen(func))) goto end;
+	for (j = 0; j < argc; j++) {
+		if (uwsgi_buffer_u16le(ub, argvs[j])) goto end;
+		if (uwsgi_buffer_append(ub, argv[j], argvs[j])) goto end;
+	}
+
+	int queue = event_queue_init();
+	void *events = event_queue_alloc(n);
+	struct rpc_fanout_node *rfns = uwsgi_calloc(sizeof(struct rpc_fanout_node) * n);
+
+	for (i = 0; i < n; i++) {
+		rfns[i].fd = uwsgi_connect(nodes[i], 0, 1);
+		if (rfns[i].fd < 0) {
+			uwsgi_log("unable to connect to RPC node %s\n", nodes[i]);
+			continue;
+		}
+		if (event_queue_add_fd_write(queue, rfns[i].fd)) {
+			close(rfns[i].fd);
+			rfns[i].fd = -1;
+			continue;
+		}
+		pending++;
+	}
+
+	uint64_t deadline = uwsgi_millis() + (timeout > 0 ? timeout : uwsgi.socket_timeout * 1000);
+	while (pending > 0) {
+		uint64_t now = uwsgi_millis();
+		if (now >= deadline) break;
+		int nevents = event_queue_wait_multi_ms(queue, deadline - now, events, n);
+		if (nevents < 0) break;
+		int k;
+		for (k = 0; k < nevents; k++) {
+			int fd = event_queue_interesting_fd(events, k);
+			struct rpc_fanout_node *rfn = NULL;
+			for (i = 0; i < n; i++) {
+				if (rfns[i].fd == fd) {
+					rfn = &rfns[i];
+					break;
+				}
+			}
+			if (!rfn) continue;
+			int ret = 0;
+			if (rfn->sent < ub->pos) {
+				ssize_t wlen = write(fd, ub->buf + rfn->sent, ub->pos - rfn->sent);
+				if (wlen < 0 && !uwsgi_is_again()) {
+					uwsgi_log("unable to send RPC request to node %s\n", nodes[i]);
+					ret = -1;
+				}
+				else if (wlen > 0) {
+					rfn->sent += wlen;
+					if (rfn->sent == ub->pos && event_queue_fd_write_to_read(queue, fd)) ret = -1;
+				}
+			}
+			else {
+				ret = rpc_fanout_read(rfn);
+			}
+			if (ret == 0) continue;
+			if (ret > 0) {
+				lens[i] = rfn->need - rfn->offset;
+				if (lens[i] > 0) {
+					responses[i] = uwsgi_malloc(lens[i]);
+					memcpy(responses[i], rfn->buf + rfn->offset, lens[i]);
+					ok++;
+				}
+			}
+			event_queue_del_fd(queue, fd, event_queue_read());
+			close(fd);
+			rfn->fd = -1;
+			pending--;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (rfns[i].fd >= 0) {
+			uwsgi_log("RPC node %s did not answer in time\n", nodes[i]);
+			close(rfns[i].fd);
+		}
+		if (rfns[i].buf) free(rfns[i].buf);
+	}
+	free(rfns);
+	free(events);
+	close(queue);
+end:
+	uwsgi_buffer_destroy(ub);
+	return ok;
+}
+
 char *uwsgi_do_rpc(char *node, char *func, uint8_t argc, char *argv[], uint16_t argvs[], uint64_t * len) {
 
 	uint8_t i;
@@ -124,6 +557,19 @@ char *uwsgi_do_rpc(char *node, char *func, uint8_t argc, char *argv[], uint16_t
 		return NULL;
 	}
 
+	if (uwsgi.rpc_pool > 0) {
+		struct uwsgi_rpc_call call;
+		memset(&call, 0, sizeof(struct uwsgi_rpc_call));
+		call.node = node;
+		call.func = func;
+		call.argc = argc;
+		call.argv = argv;
+		call.argvs = argvs;
+		uwsgi_rpc_calls(&call, 1);
+		*len = call.len;
+		return call.response;
+	}
+
 
 	// connect to node (async way)
 	int fd = uwsgi_connect(node, 0, 1);
@@ -8,6 +8,13 @@ ssize_t uwsgi_sendfile_do(int sockfd, int filefd, size_t pos, size_t len) {
 	// generally that platforms have very low memory, so use a 8k buffer
 	char buf[8192];
 
+#ifdef POSIX_FADV_WILLNEED
+	// ask the kernel to start reading the next window (--sendfile-readahead)
+	if (uwsgi.sendfile_readahead && len > 0) {
+		posix_fadvise(filefd, pos, UMIN(len, uwsgi.sendfile_readahead), POSIX_FADV_WILLNEED);
+	}
+#endif
+
 	if (uwsgi.disable_sendfile) goto no_sendfile;
 
 #if defined(__FreeBSD__) || defined(__DragonFly__)
@@ -136,6 +136,16 @@ void uwsgi_setup_inherited_sockets() {
 				continue;
 		}
 
+		if (uwsgi.shared->req_log_ring_pipe[0] > -1) {
+			if (j == uwsgi.shared->req_log_ring_pipe[0])
+				continue;
+		}
+
+		if (uwsgi.shared->req_log_ring_pipe[1] > -1) {
+			if (j == uwsgi.shared->req_log_ring_pipe[1])
+				continue;
+		}
+
 		if (uwsgi.original_log_fd > -1) {
 			if (j == uwsgi.original_log_fd)
 				continue;
@@ -155,7 +155,7 @@ int uwsgi_sharedarea_inc32(int id, uint64_t pos, int32_t amount) {
 int uwsgi_sharedarea_inc64(int id, uint64_t pos, int64_t amount) {
         struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, pos);
         if (!sa) return -1;
-        if (pos + 4 > sa->max_pos + 1) return -1;
+        if (pos + 8 > sa->max_pos + 1) return -1;
         uwsgi_wlock(sa->lock);
         int64_t *n_ptr = (int64_t *) (sa->area + pos);
         *n_ptr+=amount;
@@ -204,7 +204,7 @@ int uwsgi_sharedarea_dec32(int id, uint64_t pos, int32_t amount) {
 int uwsgi_sharedarea_dec64(int id, uint64_t pos, int64_t amount) {
         struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, pos);
         if (!sa) return -1;
-        if (pos + 4 > sa->max_pos + 1) return -1;
+        if (pos + 8 > sa->max_pos + 1) return -1;
         uwsgi_wlock(sa->lock);
         int64_t *n_ptr = (int64_t *) (sa->area + pos);
         *n_ptr-=amount;
@@ -213,7 +213,75 @@ int uwsgi_sharedarea_dec64(int id, uint64_t pos, int64_t amount) {
         return 0;
 }
 
+/*
+	lock-free operations on naturally aligned integers (the offset and the resulting
+	address must be a multiple of the width), the rwlock is not touched so they do not
+	serialize with uwsgi_sharedarea_lock()/wlock() users.
+
+	add returns the previous value in *old (if not NULL),
+	cas returns 0 on swap, 1 on mismatch (and stores the current value in *expected),
+	all of them return -1 on invalid or misaligned offsets.
+
+	the updates counter is always bumped (atomically) so uwsgi_sharedarea_wait() still works
+*/
+
+static struct uwsgi_sharedarea *sharedarea_atomic_get(int id, uint64_t pos, size_t width) {
+	struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, pos);
+	if (!sa) return NULL;
+	if (pos + width > sa->max_pos + 1) return NULL;
+	if ((uintptr_t) (sa->area + pos) % width) return NULL;
+	return sa;
+}
+
+#define uwsgi_sharedarea_atomic_ops(bits) \
+int uwsgi_sharedarea_atomic_add##bits(int id, uint64_t pos, int##bits##_t amount, int##bits##_t *old) {\
+	struct uwsgi_sharedarea *sa = sharedarea_atomic_get(id, pos, sizeof(int##bits##_t));\
+	if (!sa) return -1;\
+	int##bits##_t prev = __atomic_fetch_add((int##bits##_t *) (sa->area + pos), amount, __ATOMIC_SEQ_CST);\
+	__atomic_fetch_add(&sa->updates, 1, __ATOMIC_RELAXED);\
+	if (old) *old = prev;\
+	return 0;\
+}\
+int uwsgi_sharedarea_atomic_cas##bits(int id, uint64_t pos, int##bits##_t *expected, int##bits##_t desired) {\
+	struct uwsgi_sharedarea *sa = sharedarea_atomic_get(id, pos, sizeof(int##bits##_t));\
+	if (!sa) return -1;\
+	if (!__atomic_compare_exchange_n((int##bits##_t *) (sa->area + pos), expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return 1;\
+	__atomic_fetch_add(&sa->updates, 1, __ATOMIC_RELAXED);\
+	return 0;\
+}\
+int uwsgi_sharedarea_atomic_xchg##bits(int id, uint64_t pos, int##bits##_t value, int##bits##_t *old) {\
+	struct uwsgi_sharedarea *sa = sharedarea_atomic_get(id, pos, sizeof(int##bits##_t));\
+	if (!sa) return -1;\
+	int##bits##_t prev = __atomic_exchange_n((int##bits##_t *) (sa->area + pos), value, __ATOMIC_SEQ_CST);\
+	__atomic_fetch_add(&sa->updates, 1, __ATOMIC_RELAXED);\
+	if (old) *old = prev;\
+	return 0;\
+}\
+int uwsgi_sharedarea_atomic_load##bits(int id, uint64_t pos, int##bits##_t *value) {\
+	struct uwsgi_sharedarea *sa = sharedarea_atomic_get(id, pos, sizeof(int##bits##_t));\
+	if (!sa) return -1;\
+	*value = __atomic_load_n((int##bits##_t *) (sa->area + pos), __ATOMIC_SEQ_CST);\
+	return 0;\
+}\
+/* adds amounts[i] to the i-th of n consecutive counters starting at pos, every add is atomic (not the whole batch) */\
+int uwsgi_sharedarea_atomic_add##bits##_bulk(int id, uint64_t pos, int##bits##_t *amounts, uint64_t n) {\
+	if (!n) return 0;\
+	struct uwsgi_sharedarea *sa = sharedarea_atomic_get(id, pos, sizeof(int##bits##_t));\
+	if (!sa) return -1;\
+	if (n > (sa->max_pos + 1 - pos) / sizeof(int##bits##_t)) return -1;\
+	int##bits##_t *n_ptr = (int##bits##_t *) (sa->area + pos);\
+	uint64_t i;\
+	for(i=0;i<n;i++) {\
+		if (amounts[i]) __atomic_fetch_add(&n_ptr[i], amounts[i], __ATOMIC_SEQ_CST);\
+	}\
+	__atomic_fetch_add(&sa->updates, 1, __ATOMIC_RELAXED);\
+	return 0;\
+}
 
+uwsgi_sharedarea_atomic_ops(8)
+uwsgi_sharedarea_atomic_ops(16)
+uwsgi_sharedarea_atomic_ops(32)
+uwsgi_sharedarea_atomic_ops(64)
 
 /*
 	returns:
@@ -280,6 +348,7 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_fd(int fd, uint64_t len, off_t of
 	}
         uwsgi.sharedareas[id]->id = id;
         uwsgi.sharedareas[id]->fd = fd;
+        uwsgi.sharedareas[id]->mem_page_size = uwsgi.page_size;
         uwsgi.sharedareas[id]->pages = len / (size_t) uwsgi.page_size;
         if (len % (size_t) uwsgi.page_size != 0) uwsgi.sharedareas[id]->pages++;
         uwsgi.sharedareas[id]->max_pos = len-1;
@@ -292,7 +361,10 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_fd(int fd, uint64_t len, off_t of
 
 struct uwsgi_sharedarea *uwsgi_sharedarea_init(int pages) {
 	int id = uwsgi_sharedarea_new_id();
-	uwsgi.sharedareas[id] = uwsgi_calloc_shared((size_t)uwsgi.page_size * (size_t)(pages + 1));
+	size_t page_size = 0;
+	uwsgi.sharedareas[id] = uwsgi_mmap_shared((size_t)uwsgi.page_size * (size_t)(pages + 1), &page_size);
+	uwsgi_parallel_memset(uwsgi.sharedareas[id], (size_t)uwsgi.page_size * (size_t)(pages + 1));
+	uwsgi.sharedareas[id]->mem_page_size = page_size;
 	uwsgi.sharedareas[id]->area = ((char *) uwsgi.sharedareas[id]) + (size_t) uwsgi.page_size;
 	uwsgi.sharedareas[id]->id = id;
 	uwsgi.sharedareas[id]->fd = -1;
@@ -310,6 +382,7 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_ptr(char *area, uint64_t len) {
         uwsgi.sharedareas[id]->area = area;
         uwsgi.sharedareas[id]->id = id;
         uwsgi.sharedareas[id]->fd = -1;
+        uwsgi.sharedareas[id]->mem_page_size = uwsgi.page_size;
         uwsgi.sharedareas[id]->pages = len / (size_t) uwsgi.page_size;
 	if (len % (size_t) uwsgi.page_size != 0) uwsgi.sharedareas[id]->pages++;
         uwsgi.sharedareas[id]->max_pos = len-1;
@@ -319,6 +392,162 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_ptr(char *area, uint64_t len) {
 	return announce_sa(uwsgi.sharedareas[id]);
 }
 
+/*
+	lock-free hashmap on top of a sharedarea (keyval option hashmap=<max key size>)
+
+	fixed number of slots (all the area), open addressing with linear probing, keys
+	are never removed. Each key maps to an int64 value updated with atomic operations
+	and an optional expiration (in seconds): an expired value is reset to 0 by the first
+	add/set/cas hitting it (increments racing with the reset can be lost, this is fine
+	for rate limiting windows).
+
+	Lookups are lock-free. A new key is written under the area write lock and then its hash is
+	published (state goes from empty to hash), so readers never see half-written keys and a
+	worker dying while writing a key only leaves an empty slot. The busy state of the
+	previous (CAS based) versions is treated as empty, so stale file-backed areas are reclaimed.
+
+	The layout lives in the area itself, so file-backed sharedareas keep the hashmap
+	across restarts (if the key size does not change).
+*/
+
+#define UWSGI_SHAREDAREA_HASHMAP_MAGIC 0x70616d4947535775ULL
+#define UWSGI_SHAREDAREA_HASHMAP_BUSY 1ULL
+#define UWSGI_SHAREDAREA_HASHMAP_READY 0x8000000000000000ULL
+
+struct uwsgi_sharedarea_hashmap {
+	uint64_t magic;
+	uint64_t slots;
+	uint32_t key_size;
+	uint32_t slot_size;
+	uint64_t items;
+};
+
+struct uwsgi_sharedarea_hashmap_slot {
+	uint64_t state;
+	int64_t value;
+	uint64_t expires;
+	uint32_t keylen;
+	char key[];
+};
+
+int uwsgi_sharedarea_hashmap_init(struct uwsgi_sharedarea *sa, uint32_t key_size) {
+	struct uwsgi_sharedarea_hashmap *hm = (struct uwsgi_sharedarea_hashmap *) sa->area;
+	uint64_t slot_size = sizeof(struct uwsgi_sharedarea_hashmap_slot) + key_size;
+	// keep the 64bit fields aligned
+	if (slot_size % 8) slot_size += 8 - (slot_size % 8);
+	if (sa->max_pos + 1 < sizeof(struct uwsgi_sharedarea_hashmap) + slot_size) {
+		uwsgi_log("sharedarea %d is too small for a hashmap with %u bytes keys\n", sa->id, key_size);
+		return -1;
+	}
+	uint64_t slots = (sa->max_pos + 1 - sizeof(struct uwsgi_sharedarea_hashmap)) / slot_size;
+
+	if (hm->magic == UWSGI_SHAREDAREA_HASHMAP_MAGIC && hm->key_size == key_size && hm->slots == slots) {
+		uwsgi_log("sharedarea %d: reusing hashmap with %llu slots (%llu items)\n", sa->id, (unsigned long long) slots, (unsigned long long) hm->items);
+		return 0;
+	}
+
+	memset(sa->area, 0, sizeof(struct uwsgi_sharedarea_hashmap) + (slots * slot_size));
+	hm->magic = UWSGI_SHAREDAREA_HASHMAP_MAGIC;
+	hm->slots = slots;
+	hm->key_size = key_size;
+	hm->slot_size = slot_size;
+	uwsgi_log("sharedarea %d: hashmap with %llu slots (max key size %u)\n", sa->id, (unsigned long long) slots, key_size);
+	return 0;
+}
+
+static struct uwsgi_sharedarea_hashmap_slot *sharedarea_hashmap_slot(int id, char *key, uint16_t keylen, int create) {
+	struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, 0);
+	if (!sa) return NULL;
+	struct uwsgi_sharedarea_hashmap *hm = (struct uwsgi_sharedarea_hashmap *) sa->area;
+	if (hm->magic != UWSGI_SHAREDAREA_HASHMAP_MAGIC) return NULL;
+	if (keylen > hm->key_size) return NULL;
+
+	uint64_t hash = (uint64_t) djb33x_hash(key, keylen) | UWSGI_SHAREDAREA_HASHMAP_READY;
+	char *slots = sa->area + sizeof(struct uwsgi_sharedarea_hashmap);
+	uint64_t i, pos = hash % hm->slots;
+	for(i=0;i<hm->slots;i++) {
+		struct uwsgi_sharedarea_hashmap_slot *slot = (struct uwsgi_sharedarea_hashmap_slot *) (slots + (pos * hm->slot_size));
+		uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+		if (state == 0 || state == UWSGI_SHAREDAREA_HASHMAP_BUSY) {
+			if (!create) return NULL;
+			uwsgi_wlock(sa->lock);
+			// someone else could have claimed it (maybe for the same key)
+			state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+			if (state == 0 || state == UWSGI_SHAREDAREA_HASHMAP_BUSY) {
+				memcpy(slot->key, key, keylen);
+				slot->keylen = keylen;
+				slot->value = 0;
+				slot->expires = 0;
+				__atomic_store_n(&slot->state, hash, __ATOMIC_RELEASE);
+				__atomic_fetch_add(&hm->items, 1, __ATOMIC_RELAXED);
+				uwsgi_rwunlock(sa->lock);
+				return slot;
+			}
+			uwsgi_rwunlock(sa->lock);
+		}
+		if (state == hash && slot->keylen == keylen && !memcmp(slot->key, key, keylen)) {
+			return slot;
+		}
+		pos++;
+		if (pos >= hm->slots) pos = 0;
+	}
+	// the hashmap is full
+	return NULL;
+}
+
+// reset the value of an expired slot and (re)arm its expiration
+static void sharedarea_hashmap_expire(struct uwsgi_sharedarea_hashmap_slot *slot, uint64_t ttl) {
+	uint64_t expires = __atomic_load_n(&slot->expires, __ATOMIC_ACQUIRE);
+	uint64_t now = (uint64_t) uwsgi_now();
+	if (expires && expires > now) return;
+	if (!expires && !ttl) return;
+	uint64_t new_expires = ttl ? now + ttl : 0;
+	if (__atomic_compare_exchange_n(&slot->expires, &expires, new_expires, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// a brand new key has nothing to reset
+		if (expires) __atomic_store_n(&slot->value, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+	returns 0 on success and -1 on error (invalid sharedarea or key, hashmap full),
+	get and cas return 1 respectively when the key is not found (or expired) and when the value does not match
+*/
+int uwsgi_sharedarea_hashmap_add(int id, char *key, uint16_t keylen, int64_t amount, uint64_t ttl, int64_t *value) {
+	struct uwsgi_sharedarea_hashmap_slot *slot = sharedarea_hashmap_slot(id, key, keylen, 1);
+	if (!slot) return -1;
+	sharedarea_hashmap_expire(slot, ttl);
+	int64_t new_value = __atomic_add_fetch(&slot->value, amount, __ATOMIC_SEQ_CST);
+	if (value) *value = new_value;
+	return 0;
+}
+
+int uwsgi_sharedarea_hashmap_set(int id, char *key, uint16_t keylen, int64_t value, uint64_t ttl) {
+	struct uwsgi_sharedarea_hashmap_slot *slot = sharedarea_hashmap_slot(id, key, keylen, 1);
+	if (!slot) return -1;
+	sharedarea_hashmap_expire(slot, ttl);
+	__atomic_store_n(&slot->value, value, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+int uwsgi_sharedarea_hashmap_cas(int id, char *key, uint16_t keylen, int64_t *expected, int64_t desired, uint64_t ttl) {
+	struct uwsgi_sharedarea_hashmap_slot *slot = sharedarea_hashmap_slot(id, key, keylen, 1);
+	if (!slot) return -1;
+	sharedarea_hashmap_expire(slot, ttl);
+	if (!__atomic_compare_exchange_n(&slot->value, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return 1;
+	return 0;
+}
+
+int uwsgi_sharedarea_hashmap_get(int id, char *key, uint16_t keylen, int64_t *value) {
+	struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, 0);
+	if (!sa || ((struct uwsgi_sharedarea_hashmap *) sa->area)->magic != UWSGI_SHAREDAREA_HASHMAP_MAGIC) return -1;
+	struct uwsgi_sharedarea_hashmap_slot *slot = sharedarea_hashmap_slot(id, key, keylen, 0);
+	if (!slot) return 1;
+	uint64_t expires = __atomic_load_n(&slot->expires, __ATOMIC_ACQUIRE);
+	if (expires && expires <= (uint64_t) uwsgi_now()) return 1;
+	*value = __atomic_load_n(&slot->value, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
 struct uwsgi_sharedarea *uwsgi_sharedarea_init_keyval(char *arg) {
 	char *s_pages = NULL;
 	char *s_file = NULL;
@@ -326,6 +555,7 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_keyval(char *arg) {
 	char *s_ptr = NULL;
 	char *s_size = NULL;
 	char *s_offset = NULL;
+	char *s_hashmap = NULL;
 	if (uwsgi_kvlist_parse(arg, strlen(arg), ',', '=',
 		"pages", &s_pages,
 		"file", &s_file,
@@ -333,6 +563,7 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_keyval(char *arg) {
 		"ptr", &s_ptr,
 		"size", &s_size,
 		"offset", &s_offset,
+		"hashmap", &s_hashmap,
 		NULL)) {
 		uwsgi_log("invalid sharedarea keyval syntax\n");
 		exit(1);
@@ -398,6 +629,16 @@ struct uwsgi_sharedarea *uwsgi_sharedarea_init_keyval(char *arg) {
 		exit(1);
 	}
 
+	if (s_hashmap) {
+		int key_size = atoi(s_hashmap);
+		if (key_size <= 0 || key_size > 0xffff) {
+			uwsgi_log("invalid sharedarea hashmap key size: %s (1-65535)\n", s_hashmap);
+			exit(1);
+		}
+		if (uwsgi_sharedarea_hashmap_init(sa, key_size)) exit(1);
+		free(s_hashmap);
+	}
+
 	if (s_pages) free(s_pages);
 	if (s_file) free(s_file);
 	if (s_fd) free(s_fd);
@@ -214,8 +214,12 @@ int uwsgi_add_timer(uint8_t sig, int secs) {
 }
 
 int uwsgi_signal_add_rb_timer(uint8_t sig, int secs, int iterations) {
+	return uwsgi_signal_add_rb_timer_ms(sig, secs * 1000, iterations);
+}
+
+int uwsgi_signal_add_rb_timer_ms(uint8_t sig, int msecs, int iterations) {
 
-	if (!uwsgi.master_process)
+	if (!uwsgi.master_process || msecs <= 0)
 		return -1;
 
 	uwsgi_lock(uwsgi.rb_timer_table_lock);
@@ -223,7 +227,7 @@ int uwsgi_signal_add_rb_timer(uint8_t sig, int secs, int iterations) {
 	if (ushared->rb_timers_cnt < 64) {
 
 		// fill the timer table, the master will use it to add items to the event queue
-		ushared->rb_timers[ushared->rb_timers_cnt].value = secs;
+		ushared->rb_timers[ushared->rb_timers_cnt].value = msecs;
 		ushared->rb_timers[ushared->rb_timers_cnt].registered = 0;
 		ushared->rb_timers[ushared->rb_timers_cnt].iterations = iterations;
 		ushared->rb_timers[ushared->rb_timers_cnt].iterations_done = 0;
@@ -318,6 +322,71 @@ int uwsgi_signal_send(int fd, uint8_t sig) {
 
 }
 
+/*
+	signal coalescing (--signal-coalesce)
+
+	the master sets the bit of the signal in the pending bitmap of the destination pipe and writes
+	the wakeup byte only if one is not already in the pipe: a burst of signals costs a single wakeup,
+	and the receiver runs the handler of each pending signal once.
+*/
+static int signal_route_send(int fd, struct uwsgi_signal_pending *usp, uint8_t sig) {
+	if (!uwsgi.signal_coalesce) return uwsgi_signal_send(fd, sig);
+	__atomic_fetch_or(&usp->bits[sig / 64], 1ULL << (sig % 64), __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&usp->armed, 1, __ATOMIC_SEQ_CST)) {
+		uwsgi.shared->routed_signals++;
+		return 0;
+	}
+	if (uwsgi_signal_send(fd, sig)) {
+		__atomic_store_n(&usp->armed, 0, __ATOMIC_SEQ_CST);
+		return -1;
+	}
+	return 0;
+}
+
+// the pending bitmap of a signal pipe of the current process
+static struct uwsgi_signal_pending *signal_pending_by_fd(int fd) {
+	int i;
+	if (uwsgi.muleid > 0) {
+		if (fd == uwsgi.shared->mule_signal_pipe[1]) return &uwsgi.shared->mule_signals_pending;
+		if (fd == uwsgi.mules[uwsgi.muleid - 1].signal_pipe[1]) return &uwsgi.mules[uwsgi.muleid - 1].signals_pending;
+		for (i = 0; i < uwsgi.farms_cnt; i++) {
+			if (fd == uwsgi.farms[i].signal_pipe[1] && uwsgi_farm_has_mule(&uwsgi.farms[i], uwsgi.muleid)) return &uwsgi.farms[i].signals_pending;
+		}
+		return NULL;
+	}
+	if (uwsgi.i_am_a_spooler) {
+		if (fd == uwsgi.shared->spooler_signal_pipe[1]) return &uwsgi.shared->spooler_signals_pending;
+		return NULL;
+	}
+	if (uwsgi.mywid > 0) {
+		if (fd == uwsgi.shared->worker_signal_pipe[1]) return &uwsgi.shared->worker_signals_pending;
+		if (fd == uwsgi.workers[uwsgi.mywid].signal_pipe[1]) return &uwsgi.workers[uwsgi.mywid].signals_pending;
+	}
+	return NULL;
+}
+
+/*
+	fill sigs with the signals to manage after reading the byte sig from fd,
+	returns their number (the signal itself when coalescing is off)
+*/
+int uwsgi_signal_pending_get(int fd, uint8_t sig, uint8_t *sigs) {
+	struct uwsgi_signal_pending *usp = uwsgi.signal_coalesce ? signal_pending_by_fd(fd) : NULL;
+	if (!usp) {
+		sigs[0] = sig;
+		return 1;
+	}
+	// disarm before collecting, so a signal routed meanwhile writes a new wakeup byte
+	__atomic_store_n(&usp->armed, 0, __ATOMIC_SEQ_CST);
+	int i, j, n = 0;
+	for (i = 0; i < 4; i++) {
+		uint64_t bits = __atomic_exchange_n(&usp->bits[i], 0, __ATOMIC_SEQ_CST);
+		for (j = 0; bits; j++, bits >>= 1) {
+			if (bits & 1) sigs[n++] = (i * 64) + j;
+		}
+	}
+	return n;
+}
+
 void uwsgi_route_signal(uint8_t sig) {
 
 	int pos = (uwsgi.mywid * 256) + sig;
@@ -326,14 +395,14 @@ void uwsgi_route_signal(uint8_t sig) {
 
 	// send to first available worker
 	if (use->receiver[0] == 0 || !strcmp(use->receiver, "worker") || !strcmp(use->receiver, "worker0")) {
-		if (uwsgi_signal_send(ushared->worker_signal_pipe[0], sig)) {
+		if (signal_route_send(ushared->worker_signal_pipe[0], &ushared->worker_signals_pending, sig)) {
 			uwsgi_log("could not deliver signal %d to workers pool\n", sig);
 		}
 	}
 	// send to all workers
 	else if (!strcmp(use->receiver, "workers")) {
 		for (i = 1; i <= uwsgi.numproc; i++) {
-			if (uwsgi_signal_send(uwsgi.workers[i].signal_pipe[0], sig)) {
+			if (signal_route_send(uwsgi.workers[i].signal_pipe[0], &uwsgi.workers[i].signals_pending, sig)) {
 				uwsgi_log("could not deliver signal %d to worker %d\n", sig, i);
 			}
 		}
@@ -342,7 +411,7 @@ void uwsgi_route_signal(uint8_t sig) {
 	else if (!strcmp(use->receiver, "active-workers")) {
                 for (i = 1; i <= uwsgi.numproc; i++) {
 			if (uwsgi.workers[i].pid > 0 && !uwsgi.workers[i].cheaped && !uwsgi.workers[i].suspended) {
-                        	if (uwsgi_signal_send(uwsgi.workers[i].signal_pipe[0], sig)) {
+                        	if (signal_route_send(uwsgi.workers[i].signal_pipe[0], &uwsgi.workers[i].signals_pending, sig)) {
                                 	uwsgi_log("could not deliver signal %d to worker %d\n", sig, i);
                         	}
 			}
@@ -354,7 +423,7 @@ void uwsgi_route_signal(uint8_t sig) {
 		if (i > uwsgi.numproc) {
 			uwsgi_log("invalid signal target: %s\n", use->receiver);
 		}
-		if (uwsgi_signal_send(uwsgi.workers[i].signal_pipe[0], sig)) {
+		if (signal_route_send(uwsgi.workers[i].signal_pipe[0], &uwsgi.workers[i].signals_pending, sig)) {
 			uwsgi_log("could not deliver signal %d to worker %d\n", sig, i);
 		}
 	}
@@ -364,14 +433,14 @@ void uwsgi_route_signal(uint8_t sig) {
 	// route to spooler
 	else if (!strcmp(use->receiver, "spooler")) {
 		if (ushared->worker_signal_pipe[0] != -1) {
-			if (uwsgi_signal_send(ushared->spooler_signal_pipe[0], sig)) {
+			if (signal_route_send(ushared->spooler_signal_pipe[0], &ushared->spooler_signals_pending, sig)) {
 				uwsgi_log("could not deliver signal %d to the spooler\n", sig);
 			}
 		}
 	}
 	else if (!strcmp(use->receiver, "mules")) {
 		for (i = 0; i < uwsgi.mules_cnt; i++) {
-			if (uwsgi_signal_send(uwsgi.mules[i].signal_pipe[0], sig)) {
+			if (signal_route_send(uwsgi.mules[i].signal_pipe[0], &uwsgi.mules[i].signals_pending, sig)) {
 				uwsgi_log("could not deliver signal %d to mule %d\n", sig, i + 1);
 			}
 		}
@@ -382,12 +451,12 @@ void uwsgi_route_signal(uint8_t sig) {
 			uwsgi_log("invalid signal target: %s\n", use->receiver);
 		}
 		else if (i == 0) {
-			if (uwsgi_signal_send(ushared->mule_signal_pipe[0], sig)) {
+			if (signal_route_send(ushared->mule_signal_pipe[0], &ushared->mule_signals_pending, sig)) {
 				uwsgi_log("could not deliver signal %d to a mule\n", sig);
 			}
 		}
 		else {
-			if (uwsgi_signal_send(uwsgi.mules[i - 1].signal_pipe[0], sig)) {
+			if (signal_route_send(uwsgi.mules[i - 1].signal_pipe[0], &uwsgi.mules[i - 1].signals_pending, sig)) {
 				uwsgi_log("could not deliver signal %d to mule %d\n", sig, i);
 			}
 		}
@@ -399,7 +468,7 @@ void uwsgi_route_signal(uint8_t sig) {
 			uwsgi_log("unknown farm: %s\n", name);
 			return;
 		}
-		if (uwsgi_signal_send(uf->signal_pipe[0], sig)) {
+		if (signal_route_send(uf->signal_pipe[0], &uf->signals_pending, sig)) {
 			uwsgi_log("could not deliver signal %d to farm %d (%s)\n", sig, uf->id, uf->name);
 		}
 	}
@@ -409,7 +478,7 @@ void uwsgi_route_signal(uint8_t sig) {
 			uwsgi_log("invalid signal target: %s\n", use->receiver);
 		}
 		else {
-			if (uwsgi_signal_send(uwsgi.farms[i - 1].signal_pipe[0], sig)) {
+			if (signal_route_send(uwsgi.farms[i - 1].signal_pipe[0], &uwsgi.farms[i - 1].signals_pending, sig)) {
 				uwsgi_log("could not deliver signal %d to farm %d (%s)\n", sig, i, uwsgi.farms[i - 1].name);
 			}
 		}
@@ -442,31 +511,28 @@ int uwsgi_signal_wait(struct wsgi_request *wsgi_req, int signum) {
 cycle:
 	ret = poll(pfd, 2, -1);
 	if (ret > 0) {
-		if (pfd[0].revents == POLLIN) {
-			if (read(uwsgi.signal_socket, &uwsgi_signal, 1) != 1) {
+		int i, j;
+		for (i = 0; i < 2; i++) {
+			if (pfd[i].revents != POLLIN) continue;
+			if (read(pfd[i].fd, &uwsgi_signal, 1) != 1) {
 				uwsgi_error("read()");
+				continue;
 			}
-			else {
-				(void) uwsgi_signal_handler(wsgi_req, uwsgi_signal);
-				if (wait_for_specific_signal) {
-					if (signum != uwsgi_signal)
-						goto cycle;
+			uint8_t sigs[256];
+			int n = uwsgi_signal_pending_get(pfd[i].fd, uwsgi_signal, sigs);
+			// already managed by a previous wakeup
+			if (!n) goto cycle;
+			int found = 0;
+			for (j = 0; j < n; j++) {
+				(void) uwsgi_signal_handler(wsgi_req, sigs[j]);
+				if (!found || sigs[j] == signum) {
+					received_signal = sigs[j];
+					found = 1;
 				}
-				received_signal = uwsgi_signal;
-			}
-		}
-		if (pfd[1].revents == POLLIN) {
-			if (read(uwsgi.my_signal_socket, &uwsgi_signal, 1) != 1) {
-				uwsgi_error("read()");
 			}
-			else {
-				(void) uwsgi_signal_handler(wsgi_req, uwsgi_signal);
-				if (wait_for_specific_signal) {
-					if (signum != uwsgi_signal)
-						goto cycle;
-				}
+			if (wait_for_specific_signal && received_signal != signum) {
+				goto cycle;
 			}
-			received_signal = uwsgi_signal;
 		}
 
 	}
@@ -490,8 +556,12 @@ int uwsgi_receive_signal(struct wsgi_request *wsgi_req, int fd, char *name, int
 #ifdef UWSGI_DEBUG
 		uwsgi_log_verbose("master sent signal %d to %s %d\n", uwsgi_signal, name, id);
 #endif
-		if (uwsgi_signal_handler(wsgi_req, uwsgi_signal)) {
-			uwsgi_log_verbose("error managing signal %d on %s %d\n", uwsgi_signal, name, id);
+		uint8_t sigs[256];
+		int i, n = uwsgi_signal_pending_get(fd, uwsgi_signal, sigs);
+		for (i = 0; i < n; i++) {
+			if (uwsgi_signal_handler(wsgi_req, sigs[i])) {
+				uwsgi_log_verbose("error managing signal %d on %s %d\n", sigs[i], name, id);
+			}
 		}
 		return 1;
 	}
@@ -7,8 +7,13 @@ extern struct uwsgi_server uwsgi;
 #define SNMP_STRING		0x04
 #define SNMP_NULL	0x05
 #define SNMP_GET	0xA0
+#define SNMP_GETNEXT	0xA1
 #define SNMP_RES	0xA2
+#define SNMP_GETBULK	0xA5
 #define SNMP_OID	0x06
+#define SNMP_END_OF_MIB_VIEW	0x82
+
+#define SNMP_NO_SUCH_NAME	2
 
 #define SNMP_WATERMARK (127-8)
 
@@ -24,6 +29,7 @@ static uint8_t snmp_int_to_snmp(uint64_t, uint8_t, uint8_t *);
 
 static ssize_t build_snmp_response(uint8_t, uint8_t, uint8_t *, int, uint8_t *, uint8_t *, uint8_t *);
 static ssize_t build_snmp_metric_response(int64_t, uint8_t, uint8_t *, int, uint8_t *, uint8_t *, uint8_t *);
+static int manage_snmp_walk(int, uint8_t *, int, struct sockaddr_in *);
 
 void manage_snmp(int fd, uint8_t * buffer, int size, struct sockaddr_in *client_addr) {
 
@@ -43,6 +49,10 @@ void manage_snmp(int fd, uint8_t * buffer, int size, struct sockaddr_in *client_
 	uint64_t version = 0;
 
 
+	// GETNEXT and GETBULK requests (metrics walks) have their own parser
+	if (!manage_snmp_walk(fd, buffer, size, client_addr))
+		return;
+
 	// KISS for memory management
 	if (size > SNMP_WATERMARK)
 		return;
@@ -393,6 +403,303 @@ static ssize_t build_snmp_metric_response(int64_t value, uint8_t type, uint8_t *
 
 }
 
+/*
+
+	GETNEXT and GETBULK (SNMP walks over the metrics subsystem)
+
+	the metrics are reached in oid order via the sorted index of the metrics subsystem, every
+	requested oid before the uWSGI base (1.3.6.1.4.1.35156.17) maps to the first metric.
+	The whole response is assembled once in a buffer (no in-place patching), GETBULK responses
+	are truncated to the size of the request buffer (--buffer-size).
+
+*/
+
+// parse a TLV header of the specified type, on success ptr points to the value
+static int snmp_tlv(uint8_t ** ptr, uint8_t * end, uint8_t type, size_t * len) {
+	uint8_t *p = *ptr;
+	if (end - p < 2 || *p != type)
+		return -1;
+	p++;
+	size_t l = *p++;
+	if (l & 0x80) {
+		int n = l & 0x7f;
+		if (n < 1 || n > 2 || end - p < n)
+			return -1;
+		l = 0;
+		while (n--) {
+			l = (l << 8) | *p++;
+		}
+	}
+	if ((size_t) (end - p) < l)
+		return -1;
+	*len = l;
+	*ptr = p;
+	return 0;
+}
+
+static int snmp_tlv_uint(uint8_t ** ptr, uint8_t * end, uint64_t * val) {
+	size_t len = 0;
+	if (snmp_tlv(ptr, end, SNMP_INTEGER, &len) || len < 1 || len > 4)
+		return -1;
+	*val = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		*val = (*val << 8) | (*ptr)[i];
+	}
+	*ptr += len;
+	return 0;
+}
+
+static int snmp_append_header(struct uwsgi_buffer *ub, uint8_t type, size_t len) {
+	uint8_t hdr[4];
+	size_t hdr_len = 2;
+	hdr[0] = type;
+	if (len < 128) {
+		hdr[1] = len;
+	}
+	else if (len < 256) {
+		hdr[1] = 0x81;
+		hdr[2] = len;
+		hdr_len = 3;
+	}
+	else {
+		hdr[1] = 0x82;
+		hdr[2] = (len >> 8) & 0xff;
+		hdr[3] = len & 0xff;
+		hdr_len = 4;
+	}
+	return uwsgi_buffer_append(ub, (char *) hdr, hdr_len);
+}
+
+static size_t snmp_header_len(size_t len) {
+	if (len < 128)
+		return 2;
+	if (len < 256)
+		return 3;
+	return 4;
+}
+
+// append a varbind for um, or endOfMibView on prev (or on the requested oid) if the walk is over
+static int snmp_append_varbind(struct uwsgi_buffer *ub, uint8_t * oid, size_t oid_len, struct uwsgi_metric *prev, struct uwsgi_metric *um) {
+	uint8_t value[10];
+	size_t value_len = 2;
+	struct uwsgi_metric *named = um ? um : prev;
+	if (um) {
+		uwsgi_rlock(uwsgi.metrics_lock);
+		int64_t v = *um->value;
+		uwsgi_rwunlock(uwsgi.metrics_lock);
+		value[0] = um->type == UWSGI_METRIC_GAUGE ? SNMP_GAUGE : SNMP_COUNTER64;
+		value_len = 1 + snmp_int_to_snmp(v, value[0], value + 1);
+	}
+	else {
+		value[0] = SNMP_END_OF_MIB_VIEW;
+		value[1] = 0;
+	}
+	if (named)
+		oid_len = 9 + named->asn_len;
+
+	if (snmp_append_header(ub, SNMP_SEQUENCE, snmp_header_len(oid_len) + oid_len + value_len))
+		return -1;
+	if (snmp_append_header(ub, SNMP_OID, oid_len))
+		return -1;
+	if (named) {
+		if (uwsgi_buffer_append(ub, SNMP_UWSGI_BASE, 9))
+			return -1;
+		if (uwsgi_buffer_append(ub, named->asn, named->asn_len))
+			return -1;
+	}
+	else {
+		if (uwsgi_buffer_append(ub, (char *) oid, oid_len))
+			return -1;
+	}
+	return uwsgi_buffer_append(ub, (char *) value, value_len);
+}
+
+static struct uwsgi_metric *snmp_next_metric(uint8_t * oid, size_t oid_len) {
+	if (oid_len >= 9 && !memcmp(oid, SNMP_UWSGI_BASE, 9)) {
+		if (oid_len == 9)
+			return uwsgi_metric_find_next_by_asn(NULL, 0);
+		return uwsgi_metric_find_next_by_asn((char *) oid + 9, oid_len - 9);
+	}
+	if (uwsgi_metric_asn_cmp((char *) oid, oid_len, SNMP_UWSGI_BASE, 9) < 0)
+		return uwsgi_metric_find_next_by_asn(NULL, 0);
+	return NULL;
+}
+
+/*
+	returns -1 if the packet is not a GETNEXT/GETBULK request (the GET parser will manage it),
+	0 if it has been managed (or dropped)
+*/
+static int manage_snmp_walk(int fd, uint8_t * buffer, int size, struct sockaddr_in *client_addr) {
+	uint8_t *ptr = buffer, *end = buffer + size;
+	size_t len = 0;
+	uint64_t version = 0, request_id = 0, non_repeaters = 0, max_repetitions = 0;
+
+	if (snmp_tlv(&ptr, end, SNMP_SEQUENCE, &len))
+		return -1;
+	end = ptr + len;
+	uint8_t *version_tlv = ptr;
+	if (snmp_tlv_uint(&ptr, end, &version) || version > 1)
+		return -1;
+	uint8_t *community = ptr;
+	if (snmp_tlv(&ptr, end, SNMP_STRING, &len))
+		return -1;
+	uint8_t *community_value = ptr;
+	size_t community_len = len;
+	ptr += len;
+
+	if (ptr >= end || (*ptr != SNMP_GETNEXT && *ptr != SNMP_GETBULK))
+		return -1;
+	uint8_t pdu_type = *ptr;
+	// GETBULK is SNMPv2c only
+	if (pdu_type == SNMP_GETBULK && version != 1)
+		return 0;
+
+	if (strlen(uwsgi.shared->snmp_community) != community_len)
+		return 0;
+	if (memcmp(community_value, uwsgi.shared->snmp_community, community_len))
+		return 0;
+
+	if (snmp_tlv(&ptr, end, pdu_type, &len))
+		return 0;
+	end = ptr + len;
+	uint8_t *request_id_tlv = ptr;
+	if (snmp_tlv_uint(&ptr, end, &request_id))
+		return 0;
+	size_t request_id_tlv_len = ptr - request_id_tlv;
+	// error-status/error-index or non-repeaters/max-repetitions
+	if (snmp_tlv_uint(&ptr, end, &non_repeaters))
+		return 0;
+	if (snmp_tlv_uint(&ptr, end, &max_repetitions))
+		return 0;
+	if (pdu_type == SNMP_GETNEXT) {
+		non_repeaters = 0;
+		max_repetitions = 1;
+	}
+
+	if (snmp_tlv(&ptr, end, SNMP_SEQUENCE, &len))
+		return 0;
+	end = ptr + len;
+
+	// collect the requested oids
+	uint8_t *oids[16];
+	size_t oids_len[16];
+	uint64_t n_oids = 0;
+	while (ptr < end) {
+		uint8_t *vb = ptr;
+		if (snmp_tlv(&vb, end, SNMP_SEQUENCE, &len))
+			return 0;
+		ptr = vb + len;
+		if (snmp_tlv(&vb, ptr, SNMP_OID, &len))
+			return 0;
+		if (n_oids >= 16)
+			return 0;
+		oids[n_oids] = vb;
+		oids_len[n_oids] = len;
+		n_oids++;
+	}
+	if (!n_oids)
+		return 0;
+	if (non_repeaters > n_oids)
+		non_repeaters = n_oids;
+
+	uint64_t error_status = 0, error_index = 0;
+	struct uwsgi_buffer *vbs = uwsgi_buffer_new(uwsgi.page_size);
+	struct uwsgi_metric *cursor[16], *prev[16];
+	uint64_t i, r;
+
+	for (i = 0; i < n_oids; i++) {
+		prev[i] = NULL;
+		cursor[i] = snmp_next_metric(oids[i], oids_len[i]);
+		// SNMPv1 has no endOfMibView exception
+		if (!cursor[i] && version == 0) {
+			error_status = SNMP_NO_SUCH_NAME;
+			error_index = i + 1;
+			break;
+		}
+	}
+
+	if (error_status) {
+		// SNMPv1 errors echo the request varbinds
+		for (i = 0; i < n_oids; i++) {
+			if (snmp_append_header(vbs, SNMP_SEQUENCE, snmp_header_len(oids_len[i]) + oids_len[i] + 2))
+				goto end;
+			if (snmp_append_header(vbs, SNMP_OID, oids_len[i]))
+				goto end;
+			if (uwsgi_buffer_append(vbs, (char *) oids[i], oids_len[i]))
+				goto end;
+			if (uwsgi_buffer_append(vbs, "\x05\x00", 2))
+				goto end;
+		}
+	}
+	else {
+		// keep room for the headers
+		size_t max_vbs = uwsgi.buffer_size - (64 + community_len);
+		for (i = 0; i < non_repeaters; i++) {
+			if (snmp_append_varbind(vbs, oids[i], oids_len[i], NULL, cursor[i]))
+				goto end;
+		}
+		for (r = 0; r < max_repetitions; r++) {
+			int active = 0;
+			size_t pos = vbs->pos;
+			for (i = non_repeaters; i < n_oids; i++) {
+				if (cursor[i])
+					active = 1;
+				if (snmp_append_varbind(vbs, oids[i], oids_len[i], prev[i], cursor[i]))
+					goto end;
+			}
+			// a repetition must fit as a whole (but the first one is always sent)
+			if (r > 0 && vbs->pos > max_vbs) {
+				vbs->pos = pos;
+				break;
+			}
+			if (!active)
+				break;
+			for (i = non_repeaters; i < n_oids; i++) {
+				if (cursor[i]) {
+					prev[i] = cursor[i];
+					cursor[i] = uwsgi_metric_find_next_by_asn(cursor[i]->asn, cursor[i]->asn_len);
+				}
+			}
+		}
+	}
+
+	if (vbs->pos > 0xffff - 128)
+		goto end;
+
+	// and now the response (version and community are the same of the request)
+	size_t version_tlv_len = community - version_tlv;
+	size_t community_tlv_len = (community_value + community_len) - community;
+	size_t pdu_len = request_id_tlv_len + 6 + snmp_header_len(vbs->pos) + vbs->pos;
+	size_t msg_len = version_tlv_len + community_tlv_len + snmp_header_len(pdu_len) + pdu_len;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(snmp_header_len(msg_len) + msg_len);
+	if (snmp_append_header(ub, SNMP_SEQUENCE, msg_len))
+		goto end2;
+	if (uwsgi_buffer_append(ub, (char *) version_tlv, version_tlv_len + community_tlv_len))
+		goto end2;
+	if (snmp_append_header(ub, SNMP_RES, pdu_len))
+		goto end2;
+	if (uwsgi_buffer_append(ub, (char *) request_id_tlv, request_id_tlv_len))
+		goto end2;
+	uint8_t errors[6] = { SNMP_INTEGER, 1, error_status, SNMP_INTEGER, 1, error_index };
+	if (uwsgi_buffer_append(ub, (char *) errors, 6))
+		goto end2;
+	if (snmp_append_header(ub, SNMP_SEQUENCE, vbs->pos))
+		goto end2;
+	if (uwsgi_buffer_append(ub, vbs->buf, vbs->pos))
+		goto end2;
+
+	if (sendto(fd, ub->buf, ub->pos, 0, (struct sockaddr *) client_addr, sizeof(struct sockaddr_in)) < 0) {
+		uwsgi_error("sendto()");
+	}
+end2:
+	uwsgi_buffer_destroy(ub);
+end:
+	uwsgi_buffer_destroy(vbs);
+	return 0;
+}
+
 void uwsgi_opt_snmp(char *opt, char *value, void *foobar) {
 	uwsgi.snmp = 1;
 	if (value) {
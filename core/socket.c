@@ -1,5 +1,9 @@
 #include "uwsgi.h"
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 extern struct uwsgi_server uwsgi;
 
 static int connect_to_unix(char *, int, int);
@@ -266,7 +270,7 @@ int bind_to_unix(char *socket_name, int listen_queue, int chmod_socket, int abst
 	return serverfd;
 }
 
-int bind_to_udp(char *socket_name, int multicast, int broadcast) {
+static int bind_to_udp_do(char *socket_name, int multicast, int broadcast, int reuse_port) {
 	int serverfd;
 	struct sockaddr_in uws_addr;
 	char *udp_port;
@@ -333,6 +337,20 @@ int bind_to_udp(char *socket_name, int multicast, int broadcast) {
 		}
 	}
 
+	if (reuse_port) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(serverfd, SOL_SOCKET, SO_REUSEPORT, (const void *) &reuse_port, sizeof(int)) < 0) {
+			uwsgi_error("SO_REUSEPORT setsockopt()");
+			close(serverfd);
+			return -1;
+		}
+#else
+		uwsgi_log("!!! your system does not support SO_REUSEPORT !!!\n");
+		close(serverfd);
+		return -1;
+#endif
+	}
+
 	if (bind(serverfd, (struct sockaddr *) &uws_addr, sizeof(uws_addr)) != 0) {
 		uwsgi_error("bind()");
 		close(serverfd);
@@ -360,6 +378,70 @@ int bind_to_udp(char *socket_name, int multicast, int broadcast) {
 
 }
 
+int bind_to_udp(char *socket_name, int multicast, int broadcast) {
+	return bind_to_udp_do(socket_name, multicast, broadcast, 0);
+}
+
+// more sockets (each one managed by a different thread) can be bound to the same address
+int bind_to_udp_reuse_port(char *socket_name) {
+	return bind_to_udp_do(socket_name, 0, 0, 1);
+}
+
+/*
+	batched udp receive: up to n datagrams (truncated to bufsize bytes) are read with a single
+	recvmmsg() on Linux (with a loop of non-blocking recvfrom() on the other systems).
+	The socket is never blocked, 0 is returned when no datagram is available.
+*/
+struct uwsgi_udp_batch *uwsgi_udp_batch_new(int n, size_t bufsize) {
+	struct uwsgi_udp_batch *ub = uwsgi_calloc(sizeof(struct uwsgi_udp_batch));
+	ub->n = n;
+	ub->bufsize = bufsize;
+	ub->bufs = uwsgi_malloc(bufsize * n);
+	ub->addrs = uwsgi_calloc(sizeof(struct sockaddr_in) * n);
+	ub->lens = uwsgi_calloc(sizeof(ssize_t) * n);
+#ifdef __linux__
+	ub->iov = uwsgi_calloc(sizeof(struct iovec) * n);
+	ub->msgs = uwsgi_calloc(sizeof(struct mmsghdr) * n);
+	int i;
+	for (i = 0; i < n; i++) {
+		ub->iov[i].iov_base = ub->bufs + (i * bufsize);
+		ub->iov[i].iov_len = bufsize;
+		ub->msgs[i].msg_hdr.msg_name = &ub->addrs[i];
+		ub->msgs[i].msg_hdr.msg_iov = &ub->iov[i];
+		ub->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+	return ub;
+}
+
+int uwsgi_udp_batch_recv(struct uwsgi_udp_batch *ub, int fd) {
+	int i;
+#ifdef __linux__
+	for (i = 0; i < ub->n; i++) {
+		ub->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	int ret = recvmmsg(fd, ub->msgs, ub->n, MSG_DONTWAIT, NULL);
+	if (ret < 0) {
+		if (uwsgi_is_again()) return 0;
+		return -1;
+	}
+	for (i = 0; i < ret; i++) {
+		ub->lens[i] = ub->msgs[i].msg_len;
+	}
+	return ret;
+#else
+	for (i = 0; i < ub->n; i++) {
+		socklen_t addr_len = sizeof(struct sockaddr_in);
+		ub->lens[i] = recvfrom(fd, ub->bufs + (i * ub->bufsize), ub->bufsize, MSG_DONTWAIT, (struct sockaddr *) &ub->addrs[i], &addr_len);
+		if (ub->lens[i] < 0) {
+			if (i > 0 || uwsgi_is_again()) break;
+			return -1;
+		}
+	}
+	return i;
+#endif
+}
+
 static int uwsgi_connect_do(char *socket_name, int timeout, int async) {
         char *tcp_port = strchr(socket_name, ':');
 
@@ -386,6 +468,105 @@ int uwsgi_connect(char *socket_name, int timeout, int async) {
 	return fd;
 }
 
+/*
+	per-process pool of idle connections to backends (router_redis, router_memcached...)
+
+	up to --connection-pool-size idle connections are kept for each address,
+	connections found readable (closed by the peer or with stale data) are discarded on get.
+	The pool is process-local: the inherited one is dropped after a fork.
+*/
+struct uwsgi_connection_pool {
+	char *addr;
+	int *fds;
+	int cnt;
+	struct uwsgi_connection_pool *next;
+};
+
+static struct uwsgi_connection_pool *connection_pools;
+static pthread_mutex_t connection_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t connection_pools_pid;
+
+static struct uwsgi_connection_pool *connection_pool_find(char *addr) {
+	pid_t pid = getpid();
+	if (connection_pools_pid != pid) {
+		struct uwsgi_connection_pool *ucp = connection_pools;
+		while(ucp) {
+			struct uwsgi_connection_pool *next = ucp->next;
+			int i;
+			for(i=0;i<ucp->cnt;i++) close(ucp->fds[i]);
+			free(ucp->addr);
+			free(ucp->fds);
+			free(ucp);
+			ucp = next;
+		}
+		connection_pools = NULL;
+		connection_pools_pid = pid;
+	}
+	struct uwsgi_connection_pool *ucp = connection_pools;
+	while(ucp) {
+		if (!strcmp(ucp->addr, addr)) return ucp;
+		ucp = ucp->next;
+	}
+	return NULL;
+}
+
+// returns an idle connection to addr or -1
+int uwsgi_connection_pool_get(char *addr) {
+	int fd = -1;
+	if (uwsgi.connection_pool_size <= 0) return -1;
+	pthread_mutex_lock(&connection_pools_lock);
+	struct uwsgi_connection_pool *ucp = connection_pool_find(addr);
+	while (ucp && ucp->cnt > 0) {
+		fd = ucp->fds[--ucp->cnt];
+		struct pollfd upoll;
+		upoll.fd = fd;
+		upoll.events = POLLIN;
+		upoll.revents = 0;
+		if (poll(&upoll, 1, 0) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	pthread_mutex_unlock(&connection_pools_lock);
+	return fd;
+}
+
+// give back a connection (with no pending data) to the pool, it is closed when the pool is full
+void uwsgi_connection_pool_put(char *addr, int fd) {
+	if (uwsgi.connection_pool_size <= 0) {
+		close(fd);
+		return;
+	}
+	pthread_mutex_lock(&connection_pools_lock);
+	struct uwsgi_connection_pool *ucp = connection_pool_find(addr);
+	if (!ucp) {
+		ucp = uwsgi_calloc(sizeof(struct uwsgi_connection_pool));
+		ucp->addr = uwsgi_str(addr);
+		ucp->fds = uwsgi_malloc(sizeof(int) * uwsgi.connection_pool_size);
+		ucp->next = connection_pools;
+		connection_pools = ucp;
+	}
+	if (ucp->cnt < uwsgi.connection_pool_size) {
+		ucp->fds[ucp->cnt++] = fd;
+		fd = -1;
+	}
+	pthread_mutex_unlock(&connection_pools_lock);
+	if (fd > -1) close(fd);
+}
+
+// discard the pending bytes of the last response (trailers) and give back the connection
+void uwsgi_connection_pool_release(char *addr, int fd, size_t pending, int timeout) {
+	char buf[64];
+	while (pending > 0) {
+		size_t rlen = UMIN(pending, sizeof(buf));
+		if (uwsgi_read_whole_true_nb(fd, buf, rlen, timeout)) {
+			close(fd);
+			return;
+		}
+		pending -= rlen;
+	}
+	uwsgi_connection_pool_put(addr, fd);
+}
+
 int uwsgi_connect_udp(char *socket_name) {
 	int fd = -1;
 	char *zeroed_socket_name = uwsgi_str(socket_name);
@@ -1398,7 +1579,8 @@ void uwsgi_add_sockets_to_queue(int queue, int async_id) {
 		if (uwsgi_sock->fd_threads && async_id > -1 && uwsgi_sock->fd_threads[async_id] > -1) {
 			event_queue_add_fd_read(queue, uwsgi_sock->fd_threads[async_id]);
 		}
-		else if (uwsgi_sock->fd > -1) {
+		// parked sockets of the priority workers
+		else if (uwsgi_sock->fd > -1 && !uwsgi_sock->disabled) {
 			event_queue_add_fd_read(queue, uwsgi_sock->fd);
 		}
 		uwsgi_sock = uwsgi_sock->next;
@@ -1462,20 +1644,7 @@ nextsock:
 	return found;
 }
 
-void uwsgi_manage_zerg(int fd, int num_sockets, int *sockets) {
-	struct sockaddr_un zsun;
-	socklen_t zsun_len = sizeof(struct sockaddr_un);
-
-	int zerg_client = accept(fd, (struct sockaddr *) &zsun, &zsun_len);
-	if (zerg_client < 0) {
-		uwsgi_error("zerg: accept()");
-		return;
-	}
-
-	if (!num_sockets) {
-		num_sockets = uwsgi_count_sockets(uwsgi.sockets);
-	}
-
+static void zerg_send_sockets(int zerg_client, int num_sockets, int *sockets) {
 	struct msghdr zerg_msg;
 	void *zerg_msg_control = uwsgi_malloc(CMSG_SPACE(sizeof(int) * num_sockets));
 	struct iovec zerg_iov[2];
@@ -1502,36 +1671,334 @@ void uwsgi_manage_zerg(int fd, int num_sockets, int *sockets) {
 	cmsg->cmsg_type = SCM_RIGHTS;
 
 	unsigned char *zerg_fd_ptr = CMSG_DATA(cmsg);
+	memcpy(zerg_fd_ptr, sockets, sizeof(int) * num_sockets);
+
+	if (sendmsg(zerg_client, &zerg_msg, 0) < 0) {
+		uwsgi_error("sendmsg()");
+	}
+
+	free(zerg_msg_control);
+}
+
+// the unique sockets of the instance
+static int *zerg_uniq_sockets(int *count) {
+	int *sockets = uwsgi_calloc(sizeof(int) * (uwsgi_count_sockets(uwsgi.sockets) + 1));
+	int uniq_count = 0;
+	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
+	while (uwsgi_sock) {
+		if (uwsgi_sock->fd == -1)
+			goto nextsock;
+		if (!uwsgi_socket_uniq(uwsgi.sockets, uwsgi_sock)) {
+			sockets[uniq_count] = uwsgi_sock->fd;
+			uniq_count++;
+		}
+nextsock:
+		uwsgi_sock = uwsgi_sock->next;
+	}
+	*count = uniq_count;
+	return sockets;
+}
+
+void uwsgi_manage_zerg(int fd, int num_sockets, int *sockets) {
+	struct sockaddr_un zsun;
+	socklen_t zsun_len = sizeof(struct sockaddr_un);
+
+	int zerg_client = accept(fd, (struct sockaddr *) &zsun, &zsun_len);
+	if (zerg_client < 0) {
+		uwsgi_error("zerg: accept()");
+		return;
+	}
 
 	if (!sockets) {
-		struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
-		int uniq_count = 0;
-		while (uwsgi_sock) {
-			if (uwsgi_sock->fd == -1)
-				goto nextsock;
-			if (!uwsgi_socket_uniq(uwsgi.sockets, uwsgi_sock)) {
-				memcpy(zerg_fd_ptr, &uwsgi_sock->fd, sizeof(int));
-				zerg_fd_ptr += sizeof(int);
-				uniq_count++;
+		int *uniq_sockets = zerg_uniq_sockets(&num_sockets);
+		zerg_send_sockets(zerg_client, num_sockets, uniq_sockets);
+		free(uniq_sockets);
+	}
+	else {
+		zerg_send_sockets(zerg_client, num_sockets, sockets);
+	}
+
+	close(zerg_client);
+
+}
+
+/*
+	balanced zerg servers (--zerg-server-reuseport, --zergpool-reuseport)
+
+	every zerg gets its own REUSE_PORT twin of each TCP socket (UNIX sockets are still shared), so every
+	instance has its own accept queue. On Linux a BPF program steers the connections among the members of
+	each group with a weight inversely proportional to their accept queue (the busyness reported by the kernel),
+	it is rebuilt every second.
+
+	Zergs are tracked by the pid of their master: a reattaching zerg gets the same sockets again, the sockets of
+	a dead zerg are kept (with no weight) and given to the next one, so the group order (the BPF index) never changes.
+	Without steering (no BPF support, or after a reload of the server) the kernel hashes connections among all
+	of the members and the sockets of dead zergs are closed.
+*/
+struct uwsgi_zerg_balancer *uwsgi_zerg_balancer_new(int num_sockets, int *sockets, int owned, int steering) {
+	// the sockets of the instance
+	if (!sockets) {
+		int *uniq_sockets = zerg_uniq_sockets(&num_sockets);
+		struct uwsgi_zerg_balancer *uzb = uwsgi_zerg_balancer_new(num_sockets, uniq_sockets, owned, steering);
+		free(uniq_sockets);
+		return uzb;
+	}
+
+	struct uwsgi_zerg_balancer *uzb = uwsgi_calloc(sizeof(struct uwsgi_zerg_balancer));
+	uzb->num_sockets = num_sockets;
+	uzb->sockets = uwsgi_malloc(sizeof(int) * num_sockets);
+	memcpy(uzb->sockets, sockets, sizeof(int) * num_sockets);
+	uzb->balanced = uwsgi_calloc(sizeof(int) * num_sockets);
+
+	int i;
+	for (i = 0; i < num_sockets; i++) {
+#ifdef SO_REUSEPORT
+		union uwsgi_sockaddr usa;
+		socklen_t usa_len = sizeof(usa);
+		int reuse_port = 0;
+		socklen_t reuse_port_len = sizeof(int);
+		if (getsockname(sockets[i], &usa.sa, &usa_len))
+			continue;
+		if (usa.sa.sa_family != AF_INET
+#ifdef AF_INET6
+			&& usa.sa.sa_family != AF_INET6
+#endif
+		)
+			continue;
+		if (getsockopt(sockets[i], SOL_SOCKET, SO_REUSEPORT, &reuse_port, &reuse_port_len) || !reuse_port) {
+			uwsgi_log("[zerg-balancer] socket fd %d has no REUSE_PORT flag, it will be shared by all of the zergs\n", sockets[i]);
+			continue;
+		}
+		uzb->balanced[i] = 1;
+#endif
+	}
+
+	// the first member of each group (the server itself or the first zerg)
+	uzb->nodes = uwsgi_calloc(sizeof(struct uwsgi_zerg_node));
+	uzb->nodes->pid = owned ? 0 : -1;
+	uzb->nodes->fds = uwsgi_malloc(sizeof(int) * num_sockets);
+	memcpy(uzb->nodes->fds, sockets, sizeof(int) * num_sockets);
+	uzb->nodes_cnt = 1;
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	uzb->steering = steering;
+	if (!steering) {
+		// the members of the groups are unknown, let the kernel hash connections
+		struct sock_filter code[] = {
+			{ BPF_RET | BPF_K, 0, 0, 0xffffffff },
+		};
+		struct sock_fprog prog = { .len = 1, .filter = code };
+		for (i = 0; i < num_sockets; i++) {
+			if (!uzb->balanced[i]) continue;
+			if (setsockopt(sockets[i], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+				uwsgi_error("uwsgi_zerg_balancer_new()/setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
 			}
-nextsock:
-			uwsgi_sock = uwsgi_sock->next;
 		}
-		zerg_iov[1].iov_base = &uniq_count;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * uniq_count);
+		uwsgi_log("[zerg-balancer] connections steering disabled (the server has been restarted)\n");
 	}
-	else {
-		memcpy(zerg_fd_ptr, sockets, sizeof(int) * num_sockets);
+#endif
+
+	return uzb;
+}
+
+// a REUSE_PORT socket bound to the same address of fd
+static int zerg_balancer_twin(int fd) {
+	union uwsgi_sockaddr usa;
+	socklen_t usa_len = sizeof(usa);
+	if (getsockname(fd, &usa.sa, &usa_len)) {
+		uwsgi_error("zerg_balancer_twin()/getsockname()");
+		return -1;
 	}
 
-	if (sendmsg(zerg_client, &zerg_msg, 0) < 0) {
-		uwsgi_error("sendmsg()");
+	int twin = socket(usa.sa.sa_family, SOCK_STREAM, 0);
+	if (twin < 0) {
+		uwsgi_error("zerg_balancer_twin()/socket()");
+		return -1;
 	}
 
-	free(zerg_msg_control);
+	int reuse = 1;
+	if (setsockopt(twin, SOL_SOCKET, SO_REUSEADDR, (const void *) &reuse, sizeof(int)) < 0) {
+		uwsgi_error("zerg_balancer_twin()/setsockopt(SO_REUSEADDR)");
+		goto error;
+	}
+#ifdef SO_REUSEPORT
+	if (setsockopt(twin, SOL_SOCKET, SO_REUSEPORT, (const void *) &reuse, sizeof(int)) < 0) {
+		uwsgi_error("zerg_balancer_twin()/setsockopt(SO_REUSEPORT)");
+		goto error;
+	}
+#endif
+
+	if (bind(twin, &usa.sa, usa_len)) {
+		uwsgi_error("zerg_balancer_twin()/bind()");
+		goto error;
+	}
+
+	if (listen(twin, uwsgi.listen_queue)) {
+		uwsgi_error("zerg_balancer_twin()/listen()");
+		goto error;
+	}
+
+	if (fcntl(twin, F_SETFD, FD_CLOEXEC) < 0) {
+		uwsgi_error("zerg_balancer_twin()/fcntl()");
+	}
+
+	return twin;
+
+error:
+	close(twin);
+	return -1;
+}
+
+static struct uwsgi_zerg_node *zerg_balancer_node(struct uwsgi_zerg_balancer *uzb, pid_t pid) {
+	struct uwsgi_zerg_node *node = uzb->nodes, *last = NULL;
+	// an already known zerg (reattaching after a reload) or the sockets of a dead one
+	if (pid > 0) {
+		while (node) {
+			if (node->pid == pid) return node;
+			node = node->next;
+		}
+	}
+	node = uzb->nodes;
+	while (node) {
+		if (node->pid == -1) {
+			node->pid = pid;
+			return node;
+		}
+		last = node;
+		node = node->next;
+	}
+
+	node = uwsgi_calloc(sizeof(struct uwsgi_zerg_node));
+	node->pid = pid;
+	node->fds = uwsgi_malloc(sizeof(int) * uzb->num_sockets);
+	int i;
+	for (i = 0; i < uzb->num_sockets; i++) {
+		node->fds[i] = uzb->sockets[i];
+		if (!uzb->balanced[i]) continue;
+		int twin = zerg_balancer_twin(uzb->sockets[i]);
+		if (twin < 0) {
+			// the group order would be broken, stop balancing the socket
+			uwsgi_log("[zerg-balancer] unable to create a REUSE_PORT socket, socket fd %d will be shared by the next zergs\n", uzb->sockets[i]);
+			uzb->balanced[i] = 0;
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+			struct sock_filter code[] = {
+				{ BPF_RET | BPF_K, 0, 0, 0xffffffff },
+			};
+			struct sock_fprog prog = { .len = 1, .filter = code };
+			setsockopt(uzb->sockets[i], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+#endif
+			continue;
+		}
+		node->fds[i] = twin;
+	}
+	last->next = node;
+	uzb->nodes_cnt++;
+	return node;
+}
+
+void uwsgi_manage_zerg_balanced(struct uwsgi_zerg_balancer *uzb, int fd) {
+	struct sockaddr_un zsun;
+	socklen_t zsun_len = sizeof(struct sockaddr_un);
+
+	int zerg_client = accept(fd, (struct sockaddr *) &zsun, &zsun_len);
+	if (zerg_client < 0) {
+		uwsgi_error("zerg: accept()");
+		return;
+	}
 
+	pid_t pid = 0;
+#ifdef __linux__
+	struct ucred cr;
+	socklen_t cr_len = sizeof(struct ucred);
+	if (!getsockopt(zerg_client, SOL_SOCKET, SO_PEERCRED, &cr, &cr_len)) {
+		pid = cr.pid;
+	}
+#endif
+
+	struct uwsgi_zerg_node *node = zerg_balancer_node(uzb, pid);
+	zerg_send_sockets(zerg_client, uzb->num_sockets, node->fds);
 	close(zerg_client);
 
+	uwsgi_zerg_balancer_update(uzb);
+}
+
+// reap the dead zergs and rebuild the steering programs
+void uwsgi_zerg_balancer_update(struct uwsgi_zerg_balancer *uzb) {
+	struct uwsgi_zerg_node *node = uzb->nodes, *prev = NULL;
+	int i;
+	while (node) {
+		if (node->pid > 0 && kill(node->pid, 0) && errno == ESRCH) {
+			uwsgi_log("[zerg-balancer] zerg %d is dead\n", (int) node->pid);
+			node->pid = -1;
+			// without steering the sockets can be closed (the group order does not matter)
+			if (!uzb->steering && prev) {
+				for (i = 0; i < uzb->num_sockets; i++) {
+					if (node->fds[i] != uzb->sockets[i]) close(node->fds[i]);
+				}
+				prev->next = node->next;
+				free(node->fds);
+				free(node);
+				uzb->nodes_cnt--;
+				node = prev->next;
+				continue;
+			}
+		}
+		prev = node;
+		node = node->next;
+	}
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	if (!uzb->steering || uzb->nodes_cnt > (BPF_MAXINSNS - 3) / 2) return;
+
+	uint32_t *weights = uwsgi_calloc(sizeof(uint32_t) * uzb->nodes_cnt);
+	struct sock_filter *code = uwsgi_calloc(sizeof(struct sock_filter) * (3 + (uzb->nodes_cnt * 2)));
+	for (i = 0; i < uzb->num_sockets; i++) {
+		if (!uzb->balanced[i]) continue;
+		uint32_t total = 0;
+		int n = 0;
+		uwsgi_foreach(node, uzb->nodes) {
+			weights[n] = 0;
+			if (node->pid != -1) {
+				struct tcp_info ti;
+				socklen_t tis = sizeof(struct tcp_info);
+				uint32_t queue = 0;
+				if (!getsockopt(node->fds[i], IPPROTO_TCP, TCP_INFO, &ti, &tis)) {
+					queue = ti.tcpi_unacked;
+				}
+				weights[n] = 1000 / (1 + queue);
+				if (!weights[n]) weights[n] = 1;
+			}
+			total += weights[n];
+			n++;
+		}
+
+		int pc = 0;
+		if (!total) {
+			// let the kernel hash connections
+			code[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+		}
+		else {
+			// A = random % total, the member is the first one whose cumulative weight is greater than A
+			code[pc++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RANDOM);
+			code[pc++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, total);
+			uint32_t sum = 0;
+			for (n = 0; n < uzb->nodes_cnt; n++) {
+				if (!weights[n]) continue;
+				sum += weights[n];
+				code[pc++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, sum, 1, 0);
+				code[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, n);
+			}
+			code[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+		}
+
+		struct sock_fprog prog = { .len = pc, .filter = code };
+		if (setsockopt(uzb->sockets[i], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+			uwsgi_error("uwsgi_zerg_balancer_update()/setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+		}
+	}
+	free(code);
+	free(weights);
+#endif
 }
 
 
@@ -1671,6 +2138,19 @@ void uwsgi_setup_shared_sockets() {
 void uwsgi_map_sockets() {
 	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
 	while (uwsgi_sock) {
+		// keep only the REUSE_PORT socket of this worker
+		if (uwsgi_sock->reuse_port_fds && uwsgi.mywid > 0) {
+			int i;
+			int flags = fcntl(uwsgi_sock->fd, F_GETFL, NULL);
+			for (i = 1; i <= uwsgi.numproc; i++) {
+				if (i != uwsgi.mywid) close(uwsgi_sock->reuse_port_fds[i]);
+			}
+			uwsgi_sock->fd = uwsgi_sock->reuse_port_fds[uwsgi.mywid];
+			if (flags >= 0 && fcntl(uwsgi_sock->fd, F_SETFL, flags) < 0) {
+				uwsgi_error("uwsgi_map_sockets()/fcntl()");
+			}
+		}
+
 		struct uwsgi_string_list *usl = uwsgi.map_socket;
 		int enabled = 1;
 		while (usl) {
@@ -1723,6 +2203,72 @@ void uwsgi_map_sockets() {
 
 }
 
+/*
+	--reuse-port-per-worker
+
+	every TCP socket gets a REUSE_PORT twin for each worker: the kernel balances connections
+	between them, so workers never wake up for connections they cannot accept.
+	The master holds all of the sockets (a respawned worker gets its queue back), the twins
+	are closed on exec, as they are rebuilt after a reload.
+*/
+static void uwsgi_bind_reuse_port_sockets() {
+	struct uwsgi_socket *uwsgi_sock;
+	uwsgi_foreach(uwsgi_sock, uwsgi.sockets) {
+		if (uwsgi_sock->reuse_port_fds || uwsgi_sock->fd < 0) continue;
+		if (uwsgi_sock->family != AF_INET
+#ifdef AF_INET6
+			&& uwsgi_sock->family != AF_INET6
+#endif
+		) continue;
+		char *tcp_port = strrchr(uwsgi_sock->name, ':');
+		if (!tcp_port || uwsgi_sock->auto_port) {
+			uwsgi_log("uwsgi socket %d (%s) is shared by all of the workers\n", uwsgi_get_socket_num(uwsgi_sock), uwsgi_sock->name);
+			continue;
+		}
+
+		uwsgi_sock->reuse_port_fds = uwsgi_calloc(sizeof(int) * (uwsgi.numproc + 1));
+		uwsgi_sock->reuse_port_fds[1] = uwsgi_sock->fd;
+		int i;
+		for (i = 2; i <= uwsgi.numproc; i++) {
+			int current_defer_accept = uwsgi.no_defer_accept;
+			if (uwsgi_sock->no_defer) uwsgi.no_defer_accept = 1;
+			int fd = bind_to_tcp(uwsgi_sock->name, uwsgi.listen_queue, tcp_port);
+			uwsgi.no_defer_accept = current_defer_accept;
+			if (fd < 0) {
+				uwsgi_log("unable to create REUSE_PORT socket for worker %d on: %s\n", i, uwsgi_sock->name);
+				exit(1);
+			}
+			if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+				uwsgi_error("uwsgi_bind_reuse_port_sockets()/fcntl()");
+			}
+			uwsgi_sock->reuse_port_fds[i] = fd;
+		}
+
+		if (uwsgi.reuse_port_numa_steering) {
+			uwsgi_numa_steer_reuse_port(uwsgi_sock->fd);
+		}
+		else if (uwsgi.reuse_port_cpu_steering) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+			// sockets are selected in bind order: worker = (cpu % workers) + 1
+			struct sock_filter code[] = {
+				{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+				{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, uwsgi.numproc },
+				{ BPF_RET | BPF_A, 0, 0, 0 },
+			};
+			struct sock_fprog prog = { .len = 3, .filter = code };
+			if (setsockopt(uwsgi_sock->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+				uwsgi_error("uwsgi_bind_reuse_port_sockets()/setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+				exit(1);
+			}
+#else
+			uwsgi_log("!!! your system does not support REUSE_PORT cpu steering !!!\n");
+#endif
+		}
+
+		uwsgi_log("uwsgi socket %d (%s) bound %d times with REUSE_PORT (one socket per worker)\n", uwsgi_get_socket_num(uwsgi_sock), uwsgi_sock->name, uwsgi.numproc);
+	}
+}
+
 void uwsgi_bind_sockets() {
 	socklen_t socket_type_len;
 	union uwsgi_sockaddr usa;
@@ -1847,6 +2393,10 @@ void uwsgi_bind_sockets() {
 
 stdin_done:
 
+	if (uwsgi.reuse_port_per_worker && uwsgi.numproc > 1) {
+		uwsgi_bind_reuse_port_sockets();
+	}
+
 	// check for auto_port socket
 	uwsgi_sock = uwsgi.sockets;
 	while (uwsgi_sock) {
@@ -4,11 +4,28 @@
 #include "strings.h"
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#if defined(UWSGI_EVENT_FILEMONITOR_USE_INOTIFY) && !defined(OBSOLETE_LINUX_KERNEL)
+#include <sys/inotify.h>
+#define UWSGI_SPOOLER_INOTIFY
+#endif
+
 extern struct uwsgi_server uwsgi;
 
 static void spooler_readdir(struct uwsgi_spooler *, char *dir);
 static void spooler_scandir(struct uwsgi_spooler *, char *dir);
 static void spooler_manage_task(struct uwsgi_spooler *, char *, char *);
+static void spooler_journal_append(struct uwsgi_spooler *, char *, size_t, time_t, char *);
+static int spooler_index_run(struct uwsgi_spooler *, int);
+static void spooler_run_task(struct uwsgi_spooler *, char *, char *, char *, uint16_t, char *, size_t, int);
+static int spooler_batch_add(struct uwsgi_spooler *, char *, char *, char *, uint16_t, char *, size_t, int);
+static void spooler_batch_flush(struct uwsgi_spooler *);
+static int spooler_threads_inflight(char *, char *);
+static void spooler_threads_enqueue(struct uwsgi_spooler *, char *, char *, char *, uint16_t, char *, size_t, int);
+static void spooler_threads_init(struct uwsgi_spooler *);
 
 // increment it whenever a signal is raised
 static uint64_t wakeup = 0;
@@ -18,6 +35,89 @@ void spooler_wakeup(int signum) {
 	wakeup++;
 }
 
+/*
+	enqueuers wake up the spoolers of a directory via an eventfd (created by the master before forking),
+	so a task spooled while the spooler is busy is picked up as soon as the current one is done.
+	Without eventfd support SIGUSR1 is sent to idle spoolers.
+*/
+void uwsgi_spooler_wakeup_init(struct uwsgi_spooler *uspool) {
+	uspool->wakeup_fd = -1;
+#ifdef __linux__
+	uspool->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (uspool->wakeup_fd < 0) {
+		uwsgi_error("uwsgi_spooler_wakeup_init()/eventfd()");
+	}
+#endif
+}
+
+static void spooler_wakeup_dir(char *dir) {
+	struct uwsgi_spooler *spoolers = uwsgi.spoolers;
+	while (spoolers) {
+		if (!strcmp(spoolers->dir, dir)) {
+			if (spoolers->wakeup_fd >= 0) {
+				uint64_t one = 1;
+				if (write(spoolers->wakeup_fd, &one, sizeof(uint64_t)) != sizeof(uint64_t)) {
+					uwsgi_error("spooler_wakeup_dir()/write()");
+				}
+			}
+			else if (spoolers->pid > 0 && spoolers->running == 0) {
+				(void) kill(spoolers->pid, SIGUSR1);
+			}
+		}
+		spoolers = spoolers->next;
+	}
+}
+
+#ifdef UWSGI_SPOOLER_INOTIFY
+// externally dropped files (in the spool directory and in its priority subdirectories) wake up the spooler
+static int spooler_inotify_init(struct uwsgi_spooler *uspool) {
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		uwsgi_error("spooler_inotify_init()/inotify_init1()");
+		return -1;
+	}
+	if (inotify_add_watch(fd, uspool->dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB) < 0) {
+		uwsgi_error("spooler_inotify_init()/inotify_add_watch()");
+		close(fd);
+		return -1;
+	}
+	DIR *sdir = opendir(uspool->dir);
+	if (sdir) {
+		struct dirent *dp;
+		while ((dp = readdir(sdir)) != NULL) {
+			if (dp->d_name[0] == '.') continue;
+			char *path = uwsgi_concat3(uspool->dir, "/", dp->d_name);
+			struct stat st;
+			if (!lstat(path, &st) && S_ISDIR(st.st_mode)) {
+				(void) inotify_add_watch(fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+			}
+			free(path);
+		}
+		closedir(sdir);
+	}
+	return fd;
+}
+
+static void spooler_inotify_ack(struct uwsgi_spooler *uspool, int fd) {
+	char buf[8192] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len <= 0) break;
+		char *ptr = buf;
+		while (ptr < buf + len) {
+			struct inotify_event *ie = (struct inotify_event *) ptr;
+			// a new priority directory
+			if ((ie->mask & IN_CREATE) && (ie->mask & IN_ISDIR) && ie->len > 0) {
+				char *path = uwsgi_concat3(uspool->dir, "/", ie->name);
+				(void) inotify_add_watch(fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+				free(path);
+			}
+			ptr += sizeof(struct inotify_event) + ie->len;
+		}
+	}
+}
+#endif
+
 void uwsgi_opt_add_spooler(char *opt, char *directory, void *mode) {
 
 	int i;
@@ -355,6 +455,10 @@ char *uwsgi_spool_request(struct wsgi_request *wsgi_req, char *buf, size_t len,
 	// here the file will be unlocked too
 	close(fd);
 
+	if (uwsgi.spooler_index) {
+		spooler_journal_append(uspool, sr.priority, sr.priority_len, sr.at, filename);
+	}
+
 	if (!uwsgi.spooler_quiet)
 		uwsgi_log("[spooler] written %lu bytes to file %s\n", (unsigned long) len + body_len + 4, filename);
 
@@ -366,15 +470,7 @@ char *uwsgi_spool_request(struct wsgi_request *wsgi_req, char *buf, size_t len,
 	it could be a problem if a new process takes the old pid, but modern systems should avoid that
 */
 
-	struct uwsgi_spooler *spoolers = uwsgi.spoolers;
-	while (spoolers) {
-		if (!strcmp(spoolers->dir, uspool->dir)) {
-			if (spoolers->pid > 0 && spoolers->running == 0) {
-				(void) kill(spoolers->pid, SIGUSR1);
-			}
-		}
-		spoolers = spoolers->next;
-	}
+	spooler_wakeup_dir(uspool->dir);
 
 	return filename;
 
@@ -429,9 +525,29 @@ void spooler(struct uwsgi_spooler *uspool) {
 		event_queue_add_fd_read(spooler_event_queue, uwsgi.shared->spooler_signal_pipe[1]);
 	}
 
+	if (uspool->wakeup_fd >= 0) {
+		event_queue_add_fd_read(spooler_event_queue, uspool->wakeup_fd);
+	}
+
+	int inotify_fd = -1;
+	if (uwsgi.spooler_inotify) {
+#ifdef UWSGI_SPOOLER_INOTIFY
+		inotify_fd = spooler_inotify_init(uspool);
+		if (inotify_fd >= 0) {
+			event_queue_add_fd_read(spooler_event_queue, inotify_fd);
+		}
+#else
+		uwsgi_log("!!! inotify support is not available, --spooler-inotify ignored !!!\n");
+#endif
+	}
+
 	// reset the tasks counter
 	uspool->tasks = 0;
 
+	if (uwsgi.spooler_threads > 1) {
+		spooler_threads_init(uspool);
+	}
+
 	time_t last_task_managed = 0;
 
 	for (;;) {
@@ -441,13 +557,23 @@ void spooler(struct uwsgi_spooler *uspool) {
 			exit(1);
 		}
 
-		if (uwsgi.spooler_ordered) {
+		int timeout = uwsgi.shared->spooler_frequency ? uwsgi.shared->spooler_frequency : uwsgi.spooler_frequency;
+
+		if (uwsgi.spooler_index) {
+			timeout = spooler_index_run(uspool, timeout);
+		}
+		else if (uwsgi.spooler_ordered) {
 			spooler_scandir(uspool, NULL);
 		}
 		else {
 			spooler_readdir(uspool, NULL);
 		}
 
+		// the tasks left in the batch
+		spooler_batch_flush(uspool);
+
+		uwsgi_spooler_threads_check(uspool);
+
 		// here we check (if in cheap mode), if the spooler has done its job
 		if (uwsgi.spooler_cheap) {
 			if (last_task_managed == uspool->last_task_managed) {
@@ -458,13 +584,24 @@ void spooler(struct uwsgi_spooler *uspool) {
 		}
 
 
-		int timeout = uwsgi.shared->spooler_frequency ? uwsgi.shared->spooler_frequency : uwsgi.spooler_frequency;
 		if (wakeup > 0) {
 			timeout = 0;
 		}
 
 		if (event_queue_wait(spooler_event_queue, timeout, &interesting_fd) > 0) {
-			if (uwsgi.master_process) {
+			// new tasks, the directory (or the index) will be checked again in the next cycle
+			if (uspool->wakeup_fd >= 0 && interesting_fd == uspool->wakeup_fd) {
+				uint64_t counter;
+				if (read(uspool->wakeup_fd, &counter, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+					uwsgi_error("spooler()/read()");
+				}
+			}
+#ifdef UWSGI_SPOOLER_INOTIFY
+			else if (inotify_fd >= 0 && interesting_fd == inotify_fd) {
+				spooler_inotify_ack(uspool, inotify_fd);
+			}
+#endif
+			else if (uwsgi.master_process) {
 				if (interesting_fd == uwsgi.shared->spooler_signal_pipe[1]) {
 					if (uwsgi_receive_signal(NULL, interesting_fd, "spooler", (int) getpid())) {
 					    if (uwsgi.spooler_signal_as_task) {
@@ -592,8 +729,6 @@ int uwsgi_spooler_read_content(int spool_fd, char *spool_buf, char **body, size_
 
 void spooler_manage_task(struct uwsgi_spooler *uspool, char *dir, char *task) {
 
-	int i, ret;
-
 	char spool_buf[0xffff];
 	struct uwsgi_header uh;
 	char *body = NULL;
@@ -607,6 +742,11 @@ void spooler_manage_task(struct uwsgi_spooler *uspool, char *dir, char *task) {
 	if (!strncmp("uwsgi_spoolfile_on_", task, 19) || (uwsgi.spooler_ordered && is_a_number(task))) {
 		struct stat sf_lstat;
 
+		// already queued to (or running in) a spooler thread
+		if (uwsgi.spooler_threads > 1 && spooler_threads_inflight(dir, task)) {
+			return;
+		}
+
 		if (lstat(task, &sf_lstat)) {
 			return;
 		}
@@ -661,74 +801,216 @@ void spooler_manage_task(struct uwsgi_spooler *uspool, char *dir, char *task) {
 				return;
 			}
 
-			// now the task is running and should not be woken up
-			uspool->running = 1;
-			// this is used in cheap mode for making decision about who must die
-			uspool->last_task_managed = uwsgi_now();
+			if (uwsgi.spooler_threads > 1) {
+				spooler_threads_enqueue(uspool, dir, task, spool_buf, uh._pktsize, body, body_len, spool_fd);
+				return;
+			}
 
-			if (!uwsgi.spooler_quiet)
-				uwsgi_log("[spooler %s pid: %d] managing request %s ...\n", uspool->dir, (int) uwsgi.mypid, task);
+			if (uwsgi.spooler_batch > 1 && spooler_batch_add(uspool, dir, task, spool_buf, uh._pktsize, body, body_len, spool_fd)) {
+				return;
+			}
 
+			spooler_run_task(uspool, dir, task, spool_buf, uh._pktsize, body, body_len, spool_fd);
+		}
+	}
+}
 
-			// chdir before running the task (if requested)
-			if (uwsgi.spooler_chdir) {
-				if (chdir(uwsgi.spooler_chdir)) {
-					uwsgi_error("spooler_manage_task()/chdir()");
-				}
-			}
+static void spooler_run_task(struct uwsgi_spooler *uspool, char *dir, char *task, char *spool_buf, uint16_t pktsize, char *body, size_t body_len, int spool_fd) {
+	int i, ret;
 
-			int callable_found = 0;
-			for (i = 0; i < 256; i++) {
-				if (uwsgi.p[i]->spooler) {
-					time_t now = uwsgi_now();
-					if (uwsgi.harakiri_options.spoolers > 0) {
-						set_spooler_harakiri(uwsgi.harakiri_options.spoolers);
-					}
-					ret = uwsgi.p[i]->spooler(task, spool_buf, uh._pktsize, body, body_len);
-					if (uwsgi.harakiri_options.spoolers > 0) {
-						set_spooler_harakiri(0);
-					}
-					if (ret == 0)
-						continue;
-					callable_found = 1;
-					// increase task counter
-					uspool->tasks++;
-					if (ret == -2) {
-						if (!uwsgi.spooler_quiet)
-							uwsgi_log("[spooler %s pid: %d] done with task %s after %lld seconds\n", uspool->dir, (int) uwsgi.mypid, task, (long long) uwsgi_now() - now);
-						destroy_spool(dir, task);
-					}
-					// re-spool it
-					break;
-				}
+	// now the task is running and should not be woken up
+	uspool->running = 1;
+	// this is used in cheap mode for making decision about who must die
+	uspool->last_task_managed = uwsgi_now();
+
+	if (!uwsgi.spooler_quiet)
+		uwsgi_log("[spooler %s pid: %d] managing request %s ...\n", uspool->dir, (int) uwsgi.mypid, task);
+
+
+	// chdir before running the task (if requested)
+	if (uwsgi.spooler_chdir) {
+		if (chdir(uwsgi.spooler_chdir)) {
+			uwsgi_error("spooler_manage_task()/chdir()");
+		}
+	}
+
+	int callable_found = 0;
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->spooler) {
+			time_t now = uwsgi_now();
+			if (uwsgi.harakiri_options.spoolers > 0) {
+				set_spooler_harakiri(uwsgi.harakiri_options.spoolers);
 			}
+			ret = uwsgi.p[i]->spooler(task, spool_buf, pktsize, body, body_len);
+			if (uwsgi.harakiri_options.spoolers > 0) {
+				set_spooler_harakiri(0);
+			}
+			if (ret == 0)
+				continue;
+			callable_found = 1;
+			// increase task counter
+			uspool->tasks++;
+			if (ret == -2) {
+				if (!uwsgi.spooler_quiet)
+					uwsgi_log("[spooler %s pid: %d] done with task %s after %lld seconds\n", uspool->dir, (int) uwsgi.mypid, task, (long long) uwsgi_now() - now);
+				destroy_spool(dir, task);
+			}
+			// re-spool it
+			break;
+		}
+	}
+
+	if (body)
+		free(body);
+
+	// here we free and unlock the task
+	uwsgi_protected_close(spool_fd);
+	uspool->running = 0;
+
+
+	// need to recycle ?
+	if (uwsgi.spooler_max_tasks > 0 && uspool->tasks >= (uint64_t) uwsgi.spooler_max_tasks) {
+		uwsgi_log("[spooler %s pid: %d] maximum number of tasks reached (%d) recycling ...\n", uspool->dir, (int) uwsgi.mypid, uwsgi.spooler_max_tasks);
+		end_me(0);
+	}
+
+
+	if (chdir(dir)) {
+		uwsgi_error("chdir()");
+		uwsgi_log("[spooler] something horrible happened to the spooler. Better to kill it.\n");
+		exit(1);
+	}
 
-			if (body)
-				free(body);
+	if (!callable_found) {
+		uwsgi_log("unable to find the spooler function, have you loaded it into the spooler process ?\n");
+	}
+}
+
+/*
+
+	batched tasks (--spooler-batch N)
+
+	the loaded tasks are collected (up to N, keeping their files open) while scanning the spool directory
+	(or the index) and passed in a single call to the spooler_batch hook of the plugins, that sets the result
+	of each task (-2 done, -1 retry). If no plugin manages the batch (for example the app has not defined a batch
+	function) the tasks are run one by one with the spooler hook.
 
-			// here we free and unlock the task
+*/
+
+static struct uwsgi_spooler_task *spooler_batch_tasks;
+static int spooler_batch_cnt;
+
+static int spooler_batch_add(struct uwsgi_spooler *uspool, char *dir, char *task, char *spool_buf, uint16_t pktsize, char *body, size_t body_len, int spool_fd) {
+	int i;
+	int found = 0;
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->spooler_batch) {
+			found = 1;
+			break;
+		}
+	}
+	if (!found) return 0;
+
+	if (!spooler_batch_tasks) {
+		spooler_batch_tasks = uwsgi_calloc(sizeof(struct uwsgi_spooler_task) * uwsgi.spooler_batch);
+	}
+
+	// the same task could be found twice in a cycle (the index could have duplicates)
+	for (i = 0; i < spooler_batch_cnt; i++) {
+		if (!strcmp(spooler_batch_tasks[i].name, task) && !strcmp(spooler_batch_tasks[i].dir, dir)) {
+			if (body) free(body);
 			uwsgi_protected_close(spool_fd);
-			uspool->running = 0;
+			return 1;
+		}
+	}
 
+	struct uwsgi_spooler_task *ust = &spooler_batch_tasks[spooler_batch_cnt++];
+	memset(ust, 0, sizeof(struct uwsgi_spooler_task));
+	ust->dir = uwsgi_str(dir);
+	ust->name = uwsgi_str(task);
+	ust->filename = uwsgi_concat3(dir, "/", task);
+	ust->buf = uwsgi_malloc(pktsize);
+	memcpy(ust->buf, spool_buf, pktsize);
+	ust->len = pktsize;
+	ust->body = body;
+	ust->body_len = body_len;
+	ust->fd = spool_fd;
+	ust->ret = -1;
+
+	if (spooler_batch_cnt >= uwsgi.spooler_batch) {
+		spooler_batch_flush(uspool);
+	}
+	return 1;
+}
 
-			// need to recycle ?
-			if (uwsgi.spooler_max_tasks > 0 && uspool->tasks >= (uint64_t) uwsgi.spooler_max_tasks) {
-				uwsgi_log("[spooler %s pid: %d] maximum number of tasks reached (%d) recycling ...\n", uspool->dir, (int) uwsgi.mypid, uwsgi.spooler_max_tasks);
-				end_me(0);
-			}
+static void spooler_batch_flush(struct uwsgi_spooler *uspool) {
+	int i;
+	if (!spooler_batch_cnt) return;
 
+	uspool->running = 1;
+	uspool->last_task_managed = uwsgi_now();
 
-			if (chdir(dir)) {
-				uwsgi_error("chdir()");
-				uwsgi_log("[spooler] something horrible happened to the spooler. Better to kill it.\n");
-				exit(1);
-			}
+	if (!uwsgi.spooler_quiet)
+		uwsgi_log("[spooler %s pid: %d] managing a batch of %d requests ...\n", uspool->dir, (int) uwsgi.mypid, spooler_batch_cnt);
 
-			if (!callable_found) {
-				uwsgi_log("unable to find the spooler function, have you loaded it into the spooler process ?\n");
-			}
+	if (uwsgi.spooler_chdir) {
+		if (chdir(uwsgi.spooler_chdir)) {
+			uwsgi_error("spooler_batch_flush()/chdir()");
+		}
+	}
 
+	int managed = 0;
+	time_t now = uwsgi_now();
+	for (i = 0; i < 256; i++) {
+		if (!uwsgi.p[i]->spooler_batch) continue;
+		if (uwsgi.harakiri_options.spoolers > 0) {
+			set_spooler_harakiri(uwsgi.harakiri_options.spoolers);
+		}
+		managed = uwsgi.p[i]->spooler_batch(spooler_batch_tasks, spooler_batch_cnt);
+		if (uwsgi.harakiri_options.spoolers > 0) {
+			set_spooler_harakiri(0);
 		}
+		if (managed) break;
+	}
+
+	for (i = 0; i < spooler_batch_cnt; i++) {
+		struct uwsgi_spooler_task *ust = &spooler_batch_tasks[i];
+		if (!managed) {
+			// fallback to the single tasks api (that frees the body and closes the file)
+			if (chdir(ust->dir)) {
+				uwsgi_error("spooler_batch_flush()/chdir()");
+				goto clear;
+			}
+			spooler_run_task(uspool, ust->dir, ust->name, ust->buf, ust->len, ust->body, ust->body_len, ust->fd);
+			goto clear2;
+		}
+		uspool->tasks++;
+		if (ust->ret == -2) {
+			if (!uwsgi.spooler_quiet)
+				uwsgi_log("[spooler %s pid: %d] done with task %s after %lld seconds\n", uspool->dir, (int) uwsgi.mypid, ust->name, (long long) uwsgi_now() - now);
+			destroy_spool(ust->dir, ust->name);
+		}
+clear:
+		if (ust->body) free(ust->body);
+		uwsgi_protected_close(ust->fd);
+clear2:
+		free(ust->buf);
+		free(ust->filename);
+		free(ust->name);
+		free(ust->dir);
+	}
+	spooler_batch_cnt = 0;
+	uspool->running = 0;
+
+	if (uwsgi.spooler_max_tasks > 0 && uspool->tasks >= (uint64_t) uwsgi.spooler_max_tasks) {
+		uwsgi_log("[spooler %s pid: %d] maximum number of tasks reached (%d) recycling ...\n", uspool->dir, (int) uwsgi.mypid, uwsgi.spooler_max_tasks);
+		end_me(0);
+	}
+
+	if (chdir(uspool->dir)) {
+		uwsgi_error("chdir()");
+		uwsgi_log("[spooler] something horrible happened to the spooler. Better to kill it.\n");
+		exit(1);
 	}
 }
 
@@ -763,3 +1045,674 @@ next:
 		uspool = uspool->next;
 	}
 }
+
+/*
+
+	indexed spooler (--spooler-index)
+
+	instead of scanning the spool directory every --spooler-frequency seconds, the spooler keeps an
+	in-memory index of the pending tasks, fed by an append-only journal (.uwsgi_spooler_journal in the
+	spool directory) where uwsgi_spool_request() writes a line ("priority\tat\tfilename\n") for every new task.
+
+	The index is made of two heaps: the ready tasks ordered by priority (numeric priorities first, lower
+	is more important, then the other priorities and then the tasks without priority) and arrival, and the
+	tasks scheduled in the future ordered by their 'at'. Picking up a task is O(log n) and, as the spooler
+	is woken up by the enqueuers, immediate.
+
+	The directory is scanned only when the spooler starts (recovering the tasks spooled before, or
+	written by external tools), the journal is truncated when all of its entries have been consumed.
+	Tasks not removed by the spooler function (retries) are indexed again for the next --spooler-frequency cycle.
+
+*/
+
+#define SPOOLER_JOURNAL ".uwsgi_spooler_journal"
+
+struct spooler_index_task {
+	char *priority;
+	uint64_t priority_num;
+	time_t at;
+	uint64_t seq;
+	char *name;
+};
+
+struct spooler_heap {
+	struct spooler_index_task **items;
+	size_t len;
+	size_t size;
+	int (*cmp)(struct spooler_index_task *, struct spooler_index_task *);
+};
+
+static int spooler_ready_cmp(struct spooler_index_task *a, struct spooler_index_task *b) {
+	if (a->priority_num != b->priority_num) return a->priority_num < b->priority_num ? -1 : 1;
+	if (a->seq != b->seq) return a->seq < b->seq ? -1 : 1;
+	return 0;
+}
+
+static int spooler_timers_cmp(struct spooler_index_task *a, struct spooler_index_task *b) {
+	if (a->at != b->at) return a->at < b->at ? -1 : 1;
+	return spooler_ready_cmp(a, b);
+}
+
+static struct spooler_heap spooler_ready = { .cmp = spooler_ready_cmp };
+static struct spooler_heap spooler_timers = { .cmp = spooler_timers_cmp };
+static uint64_t spooler_index_seq;
+static int spooler_journal_fd = -1;
+static off_t spooler_journal_pos;
+
+static void spooler_heap_push(struct spooler_heap *h, struct spooler_index_task *task) {
+	if (h->len >= h->size) {
+		h->size = h->size ? h->size * 2 : 1024;
+		h->items = realloc(h->items, sizeof(struct spooler_index_task *) * h->size);
+		if (!h->items) {
+			uwsgi_error("spooler_heap_push()/realloc()");
+			exit(1);
+		}
+	}
+	size_t i = h->len++;
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (h->cmp(h->items[parent], task) <= 0) break;
+		h->items[i] = h->items[parent];
+		i = parent;
+	}
+	h->items[i] = task;
+}
+
+static struct spooler_index_task *spooler_heap_pop(struct spooler_heap *h) {
+	if (!h->len) return NULL;
+	struct spooler_index_task *top = h->items[0];
+	struct spooler_index_task *last = h->items[--h->len];
+	size_t i = 0;
+	for (;;) {
+		size_t child = (i * 2) + 1;
+		if (child >= h->len) break;
+		if (child + 1 < h->len && h->cmp(h->items[child + 1], h->items[child]) < 0) child++;
+		if (h->cmp(last, h->items[child]) <= 0) break;
+		h->items[i] = h->items[child];
+		i = child;
+	}
+	if (h->len) h->items[i] = last;
+	return top;
+}
+
+static void spooler_index_add(char *priority, size_t priority_len, time_t at, char *name, size_t name_len) {
+	struct spooler_index_task *task = uwsgi_calloc(sizeof(struct spooler_index_task));
+	task->priority_num = UINT64_MAX;
+	if (priority_len > 0) {
+		task->priority = uwsgi_concat2n(priority, priority_len, "", 0);
+		task->priority_num = is_a_number(task->priority) ? uwsgi_str_num(priority, priority_len) : UINT64_MAX - 1;
+	}
+	task->name = uwsgi_concat2n(name, name_len, "", 0);
+	task->at = at;
+	task->seq = spooler_index_seq++;
+	spooler_heap_push(&spooler_timers, task);
+}
+
+static void spooler_index_free(struct spooler_index_task *task) {
+	free(task->priority);
+	free(task->name);
+	free(task);
+}
+
+// index the tasks already in the directory (and in the priority subdirectories)
+static void spooler_index_scan(char *dir, char *priority) {
+	DIR *sdir = opendir(dir);
+	if (!sdir) {
+		uwsgi_error("spooler_index_scan()/opendir()");
+		return;
+	}
+	struct dirent *dp;
+	while ((dp = readdir(sdir)) != NULL) {
+		if (dp->d_name[0] == '.') continue;
+		char *path = uwsgi_concat3(dir, "/", dp->d_name);
+		struct stat st;
+		if (lstat(path, &st)) goto next;
+		if (S_ISDIR(st.st_mode) && !priority) {
+			spooler_index_scan(path, dp->d_name);
+		}
+		else if (S_ISREG(st.st_mode) && !strncmp("uwsgi_spoolfile_on_", dp->d_name, 19)) {
+			spooler_index_add(priority, priority ? strlen(priority) : 0, st.st_mtime, dp->d_name, strlen(dp->d_name));
+		}
+next:
+		free(path);
+	}
+	closedir(sdir);
+}
+
+static int spooler_journal_open(char *dir) {
+	char *path = uwsgi_concat3(dir, "/", SPOOLER_JOURNAL);
+	int fd = open(path, O_RDWR | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		uwsgi_error_open(path);
+	}
+	free(path);
+	return fd;
+}
+
+static void spooler_journal_append(struct uwsgi_spooler *uspool, char *priority, size_t priority_len, time_t at, char *filename) {
+	int fd = spooler_journal_open(uspool->dir);
+	if (fd < 0) return;
+	char *name = uwsgi_get_last_char(filename, '/');
+	name = name ? name + 1 : filename;
+	char *line = uwsgi_malloc(priority_len + strlen(name) + 64);
+	int len = sprintf(line, "%.*s\t%llu\t%s\n", (int) priority_len, priority_len ? priority : "", (unsigned long long) at, name);
+	// appends are concurrent (a single write() with O_APPEND), the spooler takes the exclusive lock for truncating
+	if (flock(fd, LOCK_SH)) {
+		uwsgi_error("spooler_journal_append()/flock()");
+	}
+	if (write(fd, line, len) != len) {
+		uwsgi_error("spooler_journal_append()/write()");
+	}
+	flock(fd, LOCK_UN);
+	free(line);
+	close(fd);
+}
+
+// index the new entries of the journal
+static void spooler_journal_read() {
+	struct stat st;
+	if (fstat(spooler_journal_fd, &st)) {
+		uwsgi_error("spooler_journal_read()/fstat()");
+		return;
+	}
+	if (st.st_size <= spooler_journal_pos) return;
+
+	size_t len = st.st_size - spooler_journal_pos;
+	char *buf = uwsgi_malloc(len);
+	ssize_t rlen = pread(spooler_journal_fd, buf, len, spooler_journal_pos);
+	if (rlen <= 0) {
+		free(buf);
+		return;
+	}
+
+	char *ptr = buf;
+	char *end = buf + rlen;
+	for (;;) {
+		char *nl = memchr(ptr, '\n', end - ptr);
+		// incomplete line (being written)
+		if (!nl) break;
+		char *tab1 = memchr(ptr, '\t', nl - ptr);
+		char *tab2 = tab1 ? memchr(tab1 + 1, '\t', nl - (tab1 + 1)) : NULL;
+		if (tab2) {
+			spooler_index_add(ptr, tab1 - ptr, uwsgi_str_num(tab1 + 1, tab2 - (tab1 + 1)), tab2 + 1, nl - (tab2 + 1));
+		}
+		ptr = nl + 1;
+	}
+	spooler_journal_pos += ptr - buf;
+	free(buf);
+}
+
+// truncate the journal when all of the entries have been consumed
+static void spooler_journal_compact() {
+	if (flock(spooler_journal_fd, LOCK_EX)) {
+		uwsgi_error("spooler_journal_compact()/flock()");
+		return;
+	}
+	struct stat st;
+	if (!fstat(spooler_journal_fd, &st) && st.st_size == spooler_journal_pos) {
+		if (ftruncate(spooler_journal_fd, 0)) {
+			uwsgi_error("spooler_journal_compact()/ftruncate()");
+		}
+		else {
+			spooler_journal_pos = 0;
+		}
+	}
+	flock(spooler_journal_fd, LOCK_UN);
+}
+
+static void spooler_index_init(struct uwsgi_spooler *uspool) {
+	spooler_journal_fd = spooler_journal_open(uspool->dir);
+	if (spooler_journal_fd < 0) exit(1);
+	// the journal is emptied before scanning, so new tasks are indexed by one of the two
+	if (flock(spooler_journal_fd, LOCK_EX)) {
+		uwsgi_error("spooler_index_init()/flock()");
+	}
+	if (ftruncate(spooler_journal_fd, 0)) {
+		uwsgi_error("spooler_index_init()/ftruncate()");
+	}
+	flock(spooler_journal_fd, LOCK_UN);
+	spooler_journal_pos = 0;
+	spooler_index_scan(uspool->dir, NULL);
+	uwsgi_log("[spooler %s pid: %d] indexed %llu tasks\n", uspool->dir, (int) uwsgi.mypid, (unsigned long long) spooler_timers.len);
+}
+
+static void spooler_index_run_task(struct uwsgi_spooler *uspool, struct spooler_index_task *task, int frequency) {
+	char *dir = uspool->dir;
+	if (task->priority) {
+		dir = uwsgi_concat3(uspool->dir, "/", task->priority);
+		if (chdir(dir)) {
+			uwsgi_error("spooler_index_run_task()/chdir()");
+			goto end;
+		}
+	}
+
+	spooler_manage_task(uspool, dir, task->name);
+
+	if (chdir(uspool->dir)) {
+		uwsgi_error("chdir()");
+		exit(1);
+	}
+
+	// the task has not been removed (future 'at', locked or to be retried), index it again
+	char *path = uwsgi_concat3(dir, "/", task->name);
+	struct stat st;
+	if (!lstat(path, &st)) {
+		time_t now = uwsgi_now();
+		task->at = st.st_mtime > now ? st.st_mtime : now + frequency;
+		free(path);
+		if (dir != uspool->dir) free(dir);
+		spooler_heap_push(&spooler_timers, task);
+		return;
+	}
+	free(path);
+end:
+	if (dir != uspool->dir) free(dir);
+	spooler_index_free(task);
+}
+
+// run the ready tasks and return the timeout for the next event_queue_wait()
+static int spooler_index_run(struct uwsgi_spooler *uspool, int frequency) {
+	if (spooler_journal_fd < 0) {
+		spooler_index_init(uspool);
+	}
+
+	for (;;) {
+		spooler_journal_read();
+		time_t now = uwsgi_now();
+		while (spooler_timers.len && spooler_timers.items[0]->at <= now) {
+			spooler_heap_push(&spooler_ready, spooler_heap_pop(&spooler_timers));
+		}
+		struct spooler_index_task *task = spooler_heap_pop(&spooler_ready);
+		if (!task) break;
+		spooler_index_run_task(uspool, task, frequency);
+	}
+
+	if (!spooler_timers.len) {
+		spooler_journal_compact();
+		return frequency;
+	}
+
+	int timeout = spooler_timers.items[0]->at - uwsgi_now();
+	if (timeout < 1) timeout = 1;
+	return timeout < frequency ? timeout : frequency;
+}
+
+/*
+
+	threaded spoolers (--spooler-threads N)
+
+	the spooler main thread scans the directory (or the index) and loads the tasks in an in-memory queue,
+	N threads pull from it and run them. A queued (or running) task is never loaded again, so the threads
+	claim tasks from the queue without racing on the spool files.
+
+	The threads do not change the working directory (it is shared by the whole process), so the
+	tasks are removed by absolute path and --spooler-chdir is not supported. The spooler harakiri is the
+	nearest deadline of the running tasks.
+
+*/
+
+static pthread_mutex_t spooler_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spooler_threads_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t spooler_threads_space = PTHREAD_COND_INITIALIZER;
+// the queued and the running tasks
+static struct uwsgi_spooler_task **spooler_threads_tasks;
+static int spooler_threads_tasks_cnt;
+static int spooler_threads_queue_size;
+static struct uwsgi_spooler_task **spooler_threads_queue;
+static int spooler_threads_queue_head;
+static int spooler_threads_queue_cnt;
+static time_t *spooler_threads_deadlines;
+static int spooler_threads_busy;
+
+static int spooler_threads_inflight(char *dir, char *task) {
+	int i, found = 0;
+	pthread_mutex_lock(&spooler_threads_lock);
+	for (i = 0; i < spooler_threads_tasks_cnt; i++) {
+		if (!strcmp(spooler_threads_tasks[i]->name, task) && !strcmp(spooler_threads_tasks[i]->dir, dir)) {
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&spooler_threads_lock);
+	return found;
+}
+
+static void spooler_threads_enqueue(struct uwsgi_spooler *uspool, char *dir, char *task, char *spool_buf, uint16_t pktsize, char *body, size_t body_len, int spool_fd) {
+	struct uwsgi_spooler_task *ust = uwsgi_calloc(sizeof(struct uwsgi_spooler_task));
+	ust->dir = uwsgi_str(dir);
+	ust->name = uwsgi_str(task);
+	ust->filename = uwsgi_concat3(dir, "/", task);
+	ust->buf = uwsgi_malloc(pktsize);
+	memcpy(ust->buf, spool_buf, pktsize);
+	ust->len = pktsize;
+	ust->body = body;
+	ust->body_len = body_len;
+	ust->fd = spool_fd;
+
+	pthread_mutex_lock(&spooler_threads_lock);
+	// the scanner waits for the threads when the queue is full
+	while (spooler_threads_queue_cnt >= spooler_threads_queue_size) {
+		pthread_cond_wait(&spooler_threads_space, &spooler_threads_lock);
+	}
+	spooler_threads_queue[(spooler_threads_queue_head + spooler_threads_queue_cnt) % spooler_threads_queue_size] = ust;
+	spooler_threads_queue_cnt++;
+	spooler_threads_tasks[spooler_threads_tasks_cnt++] = ust;
+	pthread_cond_signal(&spooler_threads_ready);
+	pthread_mutex_unlock(&spooler_threads_lock);
+}
+
+// must be called with the lock held
+static void spooler_threads_harakiri(struct uwsgi_spooler *uspool) {
+	int i;
+	time_t deadline = 0;
+	for (i = 0; i < uwsgi.spooler_threads; i++) {
+		if (spooler_threads_deadlines[i] && (!deadline || spooler_threads_deadlines[i] < deadline)) {
+			deadline = spooler_threads_deadlines[i];
+		}
+	}
+	uspool->harakiri = deadline;
+}
+
+static void spooler_threads_run_task(struct uwsgi_spooler *uspool, struct uwsgi_spooler_task *ust, int id) {
+	int i, ret;
+
+	if (!uwsgi.spooler_quiet)
+		uwsgi_log("[spooler %s pid: %d thread: %d] managing request %s ...\n", uspool->dir, (int) uwsgi.mypid, id, ust->name);
+
+	int callable_found = 0;
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->spooler) {
+			time_t now = uwsgi_now();
+			if (uwsgi.harakiri_options.spoolers > 0) {
+				pthread_mutex_lock(&spooler_threads_lock);
+				spooler_threads_deadlines[id] = now + uwsgi.harakiri_options.spoolers;
+				spooler_threads_harakiri(uspool);
+				pthread_mutex_unlock(&spooler_threads_lock);
+			}
+			ret = uwsgi.p[i]->spooler(ust->name, ust->buf, ust->len, ust->body, ust->body_len);
+			if (uwsgi.harakiri_options.spoolers > 0) {
+				pthread_mutex_lock(&spooler_threads_lock);
+				spooler_threads_deadlines[id] = 0;
+				spooler_threads_harakiri(uspool);
+				pthread_mutex_unlock(&spooler_threads_lock);
+			}
+			if (ret == 0)
+				continue;
+			callable_found = 1;
+			__atomic_add_fetch(&uspool->tasks, 1, __ATOMIC_SEQ_CST);
+			if (ret == -2) {
+				if (!uwsgi.spooler_quiet)
+					uwsgi_log("[spooler %s pid: %d thread: %d] done with task %s after %lld seconds\n", uspool->dir, (int) uwsgi.mypid, id, ust->name, (long long) uwsgi_now() - now);
+				if (unlink(ust->filename)) {
+					uwsgi_error("spooler_threads_run_task()/unlink()");
+				}
+			}
+			break;
+		}
+	}
+
+	if (!callable_found) {
+		uwsgi_log("unable to find the spooler function, have you loaded it into the spooler process ?\n");
+	}
+}
+
+static void *spooler_threads_loop(void *arg) {
+	struct uwsgi_spooler *uspool = uwsgi.i_am_a_spooler;
+	int i, id = (int) (long) arg;
+
+	// signals are managed by the main thread
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->init_thread) {
+			uwsgi.p[i]->init_thread(id);
+		}
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&spooler_threads_lock);
+		while (!spooler_threads_queue_cnt) {
+			pthread_cond_wait(&spooler_threads_ready, &spooler_threads_lock);
+		}
+		struct uwsgi_spooler_task *ust = spooler_threads_queue[spooler_threads_queue_head];
+		spooler_threads_queue_head = (spooler_threads_queue_head + 1) % spooler_threads_queue_size;
+		spooler_threads_queue_cnt--;
+		spooler_threads_busy++;
+		uspool->running = 1;
+		uspool->last_task_managed = uwsgi_now();
+		pthread_cond_signal(&spooler_threads_space);
+		pthread_mutex_unlock(&spooler_threads_lock);
+
+		spooler_threads_run_task(uspool, ust, id);
+
+		if (ust->body) free(ust->body);
+		uwsgi_protected_close(ust->fd);
+
+		pthread_mutex_lock(&spooler_threads_lock);
+		for (i = 0; i < spooler_threads_tasks_cnt; i++) {
+			if (spooler_threads_tasks[i] == ust) {
+				spooler_threads_tasks[i] = spooler_threads_tasks[--spooler_threads_tasks_cnt];
+				break;
+			}
+		}
+		spooler_threads_busy--;
+		if (!spooler_threads_busy) uspool->running = 0;
+		pthread_mutex_unlock(&spooler_threads_lock);
+
+		free(ust->buf);
+		free(ust->filename);
+		free(ust->name);
+		free(ust->dir);
+		free(ust);
+
+		// the main thread could be waiting for tasks to end
+		if (uwsgi.spooler_max_tasks > 0 && uspool->tasks >= (uint64_t) uwsgi.spooler_max_tasks) {
+			if (uspool->wakeup_fd >= 0) {
+				uint64_t one = 1;
+				if (write(uspool->wakeup_fd, &one, sizeof(uint64_t)) != sizeof(uint64_t)) {
+					uwsgi_error("spooler_threads_loop()/write()");
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void spooler_threads_init(struct uwsgi_spooler *uspool) {
+	int i;
+	spooler_threads_queue_size = uwsgi.spooler_threads * 2;
+	spooler_threads_queue = uwsgi_calloc(sizeof(struct uwsgi_spooler_task *) * spooler_threads_queue_size);
+	spooler_threads_tasks = uwsgi_calloc(sizeof(struct uwsgi_spooler_task *) * (spooler_threads_queue_size + uwsgi.spooler_threads));
+	spooler_threads_deadlines = uwsgi_calloc(sizeof(time_t) * uwsgi.spooler_threads);
+
+	for (i = 0; i < uwsgi.spooler_threads; i++) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, spooler_threads_loop, (void *) (long) i)) {
+			uwsgi_error("spooler_threads_init()/pthread_create()");
+			exit(1);
+		}
+	}
+	uwsgi_log("[spooler %s pid: %d] started %d threads\n", uspool->dir, (int) uwsgi.mypid, uwsgi.spooler_threads);
+}
+
+// called by the main thread: recycle the spooler when the threads reached the maximum number of tasks
+void uwsgi_spooler_threads_check(struct uwsgi_spooler *uspool) {
+	if (uwsgi.spooler_threads <= 1) return;
+	if (uwsgi.spooler_max_tasks > 0 && uspool->tasks >= (uint64_t) uwsgi.spooler_max_tasks) {
+		uwsgi_log("[spooler %s pid: %d] maximum number of tasks reached (%d) recycling ...\n", uspool->dir, (int) uwsgi.mypid, uwsgi.spooler_max_tasks);
+		end_me(0);
+	}
+}
+
+/*
+
+	remote spooling streams
+
+	a stream is a persistent connection to a remote spooler (the spooler plugin, modifier1 17)
+	opened by a request with modifier2 UWSGI_SPOOLER_STREAM. Then each task is a frame:
+
+		[17][vars size (16 bit le)][flags] vars [body size (32 bit le) and body if flags & UWSGI_SPOOLER_STREAM_BODY]
+
+	and the remote side answers in order with a 4 bytes ack for each frame ([255][0][0][1, or 0 on failure]).
+
+	Frames are pipelined (coalesced in big writes) up to --spooler-stream-window unacknowledged tasks,
+	the client stops sending when the window is full, so a slow spooler box throttles its submitters.
+
+	connections are cached (per process) by address and reused by the next submissions.
+
+*/
+
+struct uwsgi_spooler_stream {
+	char *addr;
+	int fd;
+	struct uwsgi_spooler_stream *next;
+};
+
+static struct uwsgi_spooler_stream *spooler_streams;
+static pthread_mutex_t spooler_streams_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct uwsgi_spooler_stream *spooler_stream_get(char *addr) {
+	struct uwsgi_spooler_stream *uss = spooler_streams;
+	while (uss) {
+		if (!strcmp(uss->addr, addr)) break;
+		uss = uss->next;
+	}
+	if (!uss) {
+		uss = uwsgi_calloc(sizeof(struct uwsgi_spooler_stream));
+		uss->addr = uwsgi_str(addr);
+		uss->fd = -1;
+		uss->next = spooler_streams;
+		spooler_streams = uss;
+	}
+
+	// the remote side could have closed the (idle) connection
+	if (uss->fd >= 0) {
+		char byte;
+		ssize_t rlen = recv(uss->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (rlen == 0 || (rlen < 0 && !uwsgi_is_again())) {
+			close(uss->fd);
+			uss->fd = -1;
+		}
+	}
+
+	if (uss->fd < 0) {
+		uss->fd = uwsgi_connect(uss->addr, uwsgi.socket_timeout, 0);
+		if (uss->fd < 0) {
+			uwsgi_log("[uwsgi-spooler] unable to connect to remote spooler %s\n", uss->addr);
+			return NULL;
+		}
+		uwsgi_socket_nb(uss->fd);
+		struct uwsgi_header uh;
+		uh.modifier1 = UWSGI_MODIFIER_SPOOL_REQUEST;
+		uh._pktsize = 0;
+		uh.modifier2 = UWSGI_SPOOLER_STREAM;
+		if (uwsgi_write_nb(uss->fd, (char *) &uh, 4, uwsgi.socket_timeout)) {
+			uwsgi_error("spooler_stream_get()/write()");
+			close(uss->fd);
+			uss->fd = -1;
+			return NULL;
+		}
+	}
+	return uss;
+}
+
+static int spooler_stream_frame(struct uwsgi_buffer *ub, char *buf, size_t len, char *body, size_t body_len) {
+	if (len > 0xffff || body_len > 0xffffffff) {
+		uwsgi_log("[uwsgi-spooler] task too big for a spooler stream\n");
+		return -1;
+	}
+	if (uwsgi_buffer_u8(ub, UWSGI_MODIFIER_SPOOL_REQUEST)) return -1;
+	if (uwsgi_buffer_u16le(ub, len)) return -1;
+	if (uwsgi_buffer_u8(ub, body_len ? UWSGI_SPOOLER_STREAM_BODY : 0)) return -1;
+	if (uwsgi_buffer_append(ub, buf, len)) return -1;
+	if (body_len) {
+		if (uwsgi_buffer_u32le(ub, body_len)) return -1;
+		if (uwsgi_buffer_append(ub, body, body_len)) return -1;
+	}
+	return 0;
+}
+
+/*
+	spool n tasks (uwsgi-encoded vars and optional bodies) to a remote spooler,
+	results[i] is set to 1 for each acknowledged task.
+
+	returns the number of acknowledged tasks or -1 on connection errors
+	(tasks sent but not acknowledged could have been spooled anyway)
+*/
+int uwsgi_spool_remote(char *addr, int n, char **bufs, size_t *lens, char **bodies, size_t *body_lens, char *results) {
+	int sent = 0, acked = 0, ok = 0;
+	int window = uwsgi.spooler_stream_window > 0 ? uwsgi.spooler_stream_window : 1000;
+	char acks[4 * 1024];
+	size_t acks_pos = 0;
+
+	memset(results, 0, n);
+
+	pthread_mutex_lock(&spooler_streams_lock);
+	struct uwsgi_spooler_stream *uss = spooler_stream_get(addr);
+	if (!uss) goto error;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(64 * 1024);
+	while (acked < n) {
+		// fill the window
+		ub->pos = 0;
+		while (sent < n && sent - acked < window && ub->pos < 64 * 1024) {
+			if (spooler_stream_frame(ub, bufs[sent], lens[sent], bodies ? bodies[sent] : NULL, body_lens ? body_lens[sent] : 0)) {
+				uwsgi_buffer_destroy(ub);
+				goto error;
+			}
+			sent++;
+		}
+		if (ub->pos > 0 && uwsgi_write_nb(uss->fd, ub->buf, ub->pos, uwsgi.socket_timeout)) {
+			uwsgi_error("uwsgi_spool_remote()/write()");
+			uwsgi_buffer_destroy(ub);
+			goto error;
+		}
+
+		// wait for acks only when we cannot send more
+		int blocking = (sent == n || sent - acked >= window);
+		for (;;) {
+			ssize_t rlen = read(uss->fd, acks + acks_pos, UMIN(sizeof(acks), (size_t) (sent - acked) * 4) - acks_pos);
+			if (rlen > 0) {
+				acks_pos += rlen;
+				size_t i;
+				for (i = 0; i + 4 <= acks_pos; i += 4) {
+					if (acks[i + 3] == 1) {
+						results[acked] = 1;
+						ok++;
+					}
+					acked++;
+				}
+				// keep the partial ack
+				memmove(acks, acks + i, acks_pos - i);
+				acks_pos -= i;
+				if (acks_pos == 0 || acked == sent) break;
+				continue;
+			}
+			if (rlen == 0 || !uwsgi_is_again()) {
+				uwsgi_log("[uwsgi-spooler] remote spooler %s closed the connection\n", uss->addr);
+				uwsgi_buffer_destroy(ub);
+				goto error;
+			}
+			if (!blocking) break;
+			if (uwsgi_waitfd(uss->fd, uwsgi.socket_timeout) <= 0) {
+				uwsgi_log("[uwsgi-spooler] timeout waiting for acks from remote spooler %s\n", uss->addr);
+				uwsgi_buffer_destroy(ub);
+				goto error;
+			}
+		}
+	}
+	uwsgi_buffer_destroy(ub);
+	pthread_mutex_unlock(&spooler_streams_lock);
+	return ok;
+
+error:
+	if (uss && uss->fd >= 0) {
+		close(uss->fd);
+		uss->fd = -1;
+	}
+	pthread_mutex_unlock(&spooler_streams_lock);
+	return -1;
+}
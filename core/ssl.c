@@ -2,6 +2,11 @@
 #include <openssl/rand.h>
 #include <openssl/sha.h>
 #include <openssl/md5.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
 extern struct uwsgi_server uwsgi;
 /*
@@ -49,6 +54,13 @@ int uwsgi_ssl_verify_callback(int ok, X509_STORE_CTX * x509_store) {
 }
 
 #ifdef UWSGI_SSL_SESSION_CACHE
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define SSL_SESSION_get_id(sess, len) (*(len) = sess->session_id_length, sess->session_id)
+#define UWSGI_SSL_SESSION_KEY unsigned char
+#else
+#define UWSGI_SSL_SESSION_KEY const unsigned char
+#endif
+
 int uwsgi_ssl_session_new_cb(SSL *ssl, SSL_SESSION *sess) {
         char session_blob[4096];
         int len = i2d_SSL_SESSION(sess, NULL);
@@ -62,26 +74,31 @@ int uwsgi_ssl_session_new_cb(SSL *ssl, SSL_SESSION *sess) {
         unsigned char *p = (unsigned char *) session_blob;
         i2d_SSL_SESSION(sess, &p);
 
+        unsigned int id_len = 0;
+        const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+
         // ok let's write the value to the cache
-        uwsgi_wlock(uwsgi.ssl_sessions_cache->lock);
-        if (uwsgi_cache_set2(uwsgi.ssl_sessions_cache, (char *) sess->session_id, sess->session_id_length, session_blob, len, uwsgi.ssl_sessions_timeout, 0)) {
+        struct uwsgi_cache *ucs = uwsgi_cache_shard(uwsgi.ssl_sessions_cache, (char *) id, id_len);
+        uwsgi_wlock(ucs->lock);
+        if (uwsgi_cache_set2(ucs, (char *) id, id_len, session_blob, len, uwsgi.ssl_sessions_timeout, 0)) {
                 if (uwsgi.ssl_verbose) {
                         uwsgi_log("[uwsgi-ssl] unable to store session of size %d in the cache\n", len);
                 }
         }
-        uwsgi_rwunlock(uwsgi.ssl_sessions_cache->lock);
+        uwsgi_rwunlock(ucs->lock);
         return 0;
 }
 
-SSL_SESSION *uwsgi_ssl_session_get_cb(SSL *ssl, unsigned char *key, int keylen, int *copy) {
+SSL_SESSION *uwsgi_ssl_session_get_cb(SSL *ssl, UWSGI_SSL_SESSION_KEY *key, int keylen, int *copy) {
 
         uint64_t valsize = 0;
 
         *copy = 0;
-        uwsgi_rlock(uwsgi.ssl_sessions_cache->lock);
-        char *value = uwsgi_cache_get2(uwsgi.ssl_sessions_cache, (char *)key, keylen, &valsize);
+        struct uwsgi_cache *ucs = uwsgi_cache_shard(uwsgi.ssl_sessions_cache, (char *) key, keylen);
+        uwsgi_rlock(ucs->lock);
+        char *value = uwsgi_cache_get2(ucs, (char *)key, keylen, &valsize);
         if (!value) {
-                uwsgi_rwunlock(uwsgi.ssl_sessions_cache->lock);
+                uwsgi_rwunlock(ucs->lock);
                 if (uwsgi.ssl_verbose) {
                         uwsgi_log("[uwsgi-ssl] cache miss\n");
                 }
@@ -92,21 +109,289 @@ SSL_SESSION *uwsgi_ssl_session_get_cb(SSL *ssl, unsigned char *key, int keylen,
 #else
         SSL_SESSION *sess = d2i_SSL_SESSION(NULL, (unsigned char **)&value, valsize);
 #endif
-        uwsgi_rwunlock(uwsgi.ssl_sessions_cache->lock);
+        uwsgi_rwunlock(ucs->lock);
         return sess;
 }
 
 void uwsgi_ssl_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess) {
-        uwsgi_wlock(uwsgi.ssl_sessions_cache->lock);
-        if (uwsgi_cache_del2(uwsgi.ssl_sessions_cache, (char *) sess->session_id, sess->session_id_length, 0, 0)) {
+        unsigned int id_len = 0;
+        const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+        struct uwsgi_cache *ucs = uwsgi_cache_shard(uwsgi.ssl_sessions_cache, (char *) id, id_len);
+        uwsgi_wlock(ucs->lock);
+        if (uwsgi_cache_del2(ucs, (char *) id, id_len, 0, 0)) {
                 if (uwsgi.ssl_verbose) {
                         uwsgi_log("[uwsgi-ssl] error removing cache item\n");
                 }
         }
-        uwsgi_rwunlock(uwsgi.ssl_sessions_cache->lock);
+        uwsgi_rwunlock(ucs->lock);
 }
 #endif
 
+/*
+
+	session tickets keys shared via a legion
+
+	the Lord of the legion generates a new key every --ssl-tickets-rotate seconds and publishes
+	the next, the current and the previous one (hex encoded, comma separated) in its scroll.
+	Tickets are encrypted with the current key, the next one is announced in advance so nodes
+	that have still to receive the new scroll can already decrypt the tickets issued after the rotation.
+	Every node (and every worker/gateway of it) reads the keys from the Lord scroll, so
+	tickets issued by any node can be decrypted by all of the others.
+	Legion packets are encrypted with the legion secret, so the keys never travel in clear.
+
+*/
+
+#define UWSGI_SSL_TICKET_KEYS 3
+
+struct uwsgi_ssl_ticket_key {
+	unsigned char name[16];
+	unsigned char hmac[32];
+	unsigned char aes[32];
+};
+
+static int ssl_tickets_hex(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// parse a scroll, returns the number of keys found
+static int ssl_tickets_parse(char *scroll, uint16_t len, struct uwsgi_ssl_ticket_key *keys) {
+	int n = 0;
+	uint16_t i = 0;
+	while (n < UWSGI_SSL_TICKET_KEYS && i + (sizeof(struct uwsgi_ssl_ticket_key) * 2) <= len) {
+		unsigned char *ptr = (unsigned char *) &keys[n];
+		size_t j;
+		for (j = 0; j < sizeof(struct uwsgi_ssl_ticket_key); j++) {
+			int h = ssl_tickets_hex(scroll[i++]);
+			int l = ssl_tickets_hex(scroll[i++]);
+			if (h < 0 || l < 0) return n;
+			ptr[j] = (h << 4) | l;
+		}
+		n++;
+		if (i >= len || scroll[i] != ',') break;
+		i++;
+	}
+	return n;
+}
+
+static int ssl_tickets_keys(struct uwsgi_ssl_ticket_key *keys) {
+	uint16_t len = 0;
+	char *scroll = uwsgi_legion_lord_scroll(uwsgi.ssl_tickets_legion, &len);
+	if (!scroll) return 0;
+	int n = ssl_tickets_parse(scroll, len, keys);
+	free(scroll);
+	return n;
+}
+
+// called by the legion thread of the Lord, force is set on election
+void uwsgi_ssl_tickets_rotate(struct uwsgi_legion *ul, int force) {
+	struct uwsgi_ssl_ticket_key keys[UWSGI_SSL_TICKET_KEYS + 1];
+	time_t now = uwsgi_now();
+	int n = 0;
+
+	if (force) {
+		// continue with the keys of the old Lord (if any), so its tickets remain valid
+		uwsgi_rlock(ul->lock);
+		n = ssl_tickets_parse(ul->lord_scroll, ul->lord_scroll_len, keys + 1);
+		uwsgi_rwunlock(ul->lock);
+		if (n > 0) {
+			ul->ssl_tickets_rotated = now;
+			goto publish;
+		}
+	}
+
+	if (ul->scroll_len && now - ul->ssl_tickets_rotated < uwsgi.ssl_tickets_rotate) return;
+
+	n = ssl_tickets_parse(ul->scroll, ul->scroll_len, keys + 1);
+	// the first time both the current and the next keys are generated
+	do {
+		if (RAND_bytes((unsigned char *) &keys[0], sizeof(struct uwsgi_ssl_ticket_key)) != 1) {
+			uwsgi_log("[uwsgi-ssl] unable to generate session ticket key\n");
+			return;
+		}
+		// the oldest key is dropped
+		memmove(keys + 1, keys, sizeof(struct uwsgi_ssl_ticket_key) * UWSGI_SSL_TICKET_KEYS);
+		if (n < UWSGI_SSL_TICKET_KEYS) n++;
+	} while (n < 2);
+	ul->ssl_tickets_rotated = now;
+	if (uwsgi.ssl_verbose) {
+		uwsgi_log("[uwsgi-ssl] rotated session ticket keys for Legion %s\n", ul->legion);
+	}
+
+publish:
+	{
+		struct uwsgi_buffer *ub = uwsgi_buffer_new(sizeof(struct uwsgi_ssl_ticket_key) * 2 * n + n);
+		int i;
+		for (i = 1; i <= n; i++) {
+			char *hex = uwsgi_str_to_hex((char *) &keys[i], sizeof(struct uwsgi_ssl_ticket_key));
+			if (i > 1) uwsgi_buffer_append(ub, ",", 1);
+			uwsgi_buffer_append(ub, hex, sizeof(struct uwsgi_ssl_ticket_key) * 2);
+			free(hex);
+		}
+		memset(keys, 0, sizeof(keys));
+
+		// the scroll is only used by the legion thread (announces)
+		if (ul->scroll) {
+			memset(ul->scroll, 0, ul->scroll_len);
+			free(ul->scroll);
+		}
+		ul->scroll = ub->buf;
+		ul->scroll_len = ub->pos;
+		ub->buf = NULL;
+		uwsgi_buffer_destroy(ub);
+
+		if (ul->scroll_len <= ul->lord_scroll_size) {
+			uwsgi_wlock(ul->lock);
+			ul->lord_scroll_len = ul->scroll_len;
+			memcpy(ul->lord_scroll, ul->scroll, ul->lord_scroll_len);
+			uwsgi_rwunlock(ul->lock);
+		}
+	}
+}
+
+static int ssl_tickets_find(struct uwsgi_ssl_ticket_key *keys, int n, unsigned char *key_name) {
+	int i;
+	for (i = 0; i < n; i++) {
+		if (!memcmp(keys[i].name, key_name, 16)) return i;
+	}
+	return -1;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int uwsgi_ssl_ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc) {
+#else
+static int uwsgi_ssl_ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc) {
+#endif
+	struct uwsgi_ssl_ticket_key keys[UWSGI_SSL_TICKET_KEYS];
+	int ret = 0;
+	int n = ssl_tickets_keys(keys);
+	// no Lord (or no keys) yet, full handshakes only
+	if (n <= 0) return 0;
+
+	// the first key is the next one
+	int k = n > 1 ? 1 : 0;
+	if (enc) {
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) goto end;
+		memcpy(key_name, keys[k].name, 16);
+		ret = 1;
+	}
+	else {
+		k = ssl_tickets_find(keys, n, key_name);
+		if (k < 0) goto end;
+		// tickets encrypted with the previous key are renewed
+		ret = k <= 1 ? 1 : 2;
+	}
+
+	if (enc) {
+		if (EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, keys[k].aes, iv) != 1) { ret = -1; goto end; }
+	}
+	else {
+		if (EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, keys[k].aes, iv) != 1) { ret = -1; goto end; }
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, keys[k].hmac, 32);
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (EVP_MAC_CTX_set_params(hctx, params) != 1) ret = -1;
+#else
+	if (HMAC_Init_ex(hctx, keys[k].hmac, 32, EVP_sha256(), NULL) != 1) ret = -1;
+#endif
+
+end:
+	memset(keys, 0, sizeof(keys));
+	return ret;
+}
+
+/*
+	SNI contexts are indexed by name in a chained hash table (grown at 75% load), so the lookup
+	does not depend on the number of domains. Dynamic contexts (sni-dir, subscriptions) could be
+	added and removed by the router threads while others run handshakes, so the table is protected
+	by a process-local rwlock (the contexts are process-local too).
+	On duplicated names the first registered context wins (as with the old list walk).
+*/
+struct uwsgi_sni_entry {
+	uint32_t hash;
+	struct uwsgi_string_list *usl;
+	struct uwsgi_sni_entry *next;
+};
+
+static struct uwsgi_sni_entry **sni_table;
+static uint64_t sni_table_size;
+static uint64_t sni_table_count;
+static pthread_rwlock_t sni_table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void sni_table_grow() {
+	uint64_t new_size = sni_table_size ? sni_table_size * 2 : 64;
+	struct uwsgi_sni_entry **new_table = uwsgi_calloc(sizeof(struct uwsgi_sni_entry *) * new_size);
+	uint64_t i;
+	for(i = 0; i < sni_table_size; i++) {
+		struct uwsgi_sni_entry *use = sni_table[i];
+		while(use) {
+			struct uwsgi_sni_entry *next = use->next;
+			// append to preserve the order of the chain
+			struct uwsgi_sni_entry **slot = &new_table[use->hash & (new_size - 1)];
+			while(*slot) slot = &(*slot)->next;
+			use->next = NULL;
+			*slot = use;
+			use = next;
+		}
+	}
+	free(sni_table);
+	sni_table = new_table;
+	sni_table_size = new_size;
+}
+
+static void sni_table_add(struct uwsgi_string_list *usl) {
+	pthread_rwlock_wrlock(&sni_table_lock);
+	if ((sni_table_count + 1) * 4 > sni_table_size * 3) {
+		sni_table_grow();
+	}
+	struct uwsgi_sni_entry *use = uwsgi_malloc(sizeof(struct uwsgi_sni_entry));
+	use->hash = djb33x_hash(usl->value, usl->len);
+	use->usl = usl;
+	use->next = NULL;
+	struct uwsgi_sni_entry **slot = &sni_table[use->hash & (sni_table_size - 1)];
+	while(*slot) slot = &(*slot)->next;
+	*slot = use;
+	sni_table_count++;
+	pthread_rwlock_unlock(&sni_table_lock);
+}
+
+// must be called with the write lock held
+static void sni_table_del(struct uwsgi_string_list *usl) {
+	if (!sni_table) return;
+	uint32_t hash = djb33x_hash(usl->value, usl->len);
+	struct uwsgi_sni_entry **slot = &sni_table[hash & (sni_table_size - 1)];
+	while(*slot) {
+		if ((*slot)->usl == usl) {
+			struct uwsgi_sni_entry *use = *slot;
+			*slot = use->next;
+			free(use);
+			sni_table_count--;
+			return;
+		}
+		slot = &(*slot)->next;
+	}
+}
+
+// must be called with the lock held
+static SSL_CTX *sni_table_get(char *name, size_t name_len) {
+	if (!sni_table) return NULL;
+	uint32_t hash = djb33x_hash(name, name_len);
+	struct uwsgi_sni_entry *use = sni_table[hash & (sni_table_size - 1)];
+	while(use) {
+		if (use->hash == hash && !uwsgi_strncmp(use->usl->value, use->usl->len, name, name_len)) {
+			return (SSL_CTX *) use->usl->custom_ptr;
+		}
+		use = use->next;
+	}
+	return NULL;
+}
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
 static int uwsgi_sni_cb(SSL *ssl, int *ad, void *arg) {
         const char *servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
@@ -116,22 +401,22 @@ static int uwsgi_sni_cb(SSL *ssl, int *ad, void *arg) {
 	int count = 5;
 
 	while(count > 0) {
-        	struct uwsgi_string_list *usl = uwsgi.sni;
-        	while(usl) {
-                	if (!uwsgi_strncmp(usl->value, usl->len, (char *)servername, servername_len)) {
-                        	SSL_set_SSL_CTX(ssl, (SSL_CTX *) usl->custom_ptr);
-				// the following steps are taken from nginx
-				SSL_set_verify(ssl, SSL_CTX_get_verify_mode((SSL_CTX *)usl->custom_ptr),
-				SSL_CTX_get_verify_callback((SSL_CTX *)usl->custom_ptr));
-				SSL_set_verify_depth(ssl, SSL_CTX_get_verify_depth((SSL_CTX *)usl->custom_ptr));	
+		pthread_rwlock_rdlock(&sni_table_lock);
+		SSL_CTX *ctx = sni_table_get((char *) servername, servername_len);
+		if (ctx) {
+			// the ssl object takes a reference to the context, so it can be destroyed after the unlock
+			SSL_set_SSL_CTX(ssl, ctx);
+			pthread_rwlock_unlock(&sni_table_lock);
+			// the following steps are taken from nginx
+			SSL_set_verify(ssl, SSL_CTX_get_verify_mode(ctx), SSL_CTX_get_verify_callback(ctx));
+			SSL_set_verify_depth(ssl, SSL_CTX_get_verify_depth(ctx));
 #ifdef SSL_CTRL_CLEAR_OPTIONS
-				SSL_clear_options(ssl, SSL_get_options(ssl) & ~SSL_CTX_get_options((SSL_CTX *)usl->custom_ptr));
+			SSL_clear_options(ssl, SSL_get_options(ssl) & ~SSL_CTX_get_options(ctx));
 #endif
-				SSL_set_options(ssl, SSL_CTX_get_options((SSL_CTX *)usl->custom_ptr));
-                        	return SSL_TLSEXT_ERR_OK;
-                	}
-                	usl = usl->next;
-        	}
+			SSL_set_options(ssl, SSL_CTX_get_options(ctx));
+			return SSL_TLSEXT_ERR_OK;
+		}
+		pthread_rwlock_unlock(&sni_table_lock);
 		if (!uwsgi.subscription_dotsplit) break;
 		char *next = memchr(servername+1, '.', servername_len-1);
 		if (next) {
@@ -235,6 +520,16 @@ SSL_CTX *uwsgi_ssl_new_server_context(char *name, char *crt, char *key, char *ci
 		ssloptions |= SSL_OP_NO_TLSv1;
 	}
 
+	// record encryption is moved to the kernel after the handshake (when the cipher allows it),
+	// so sendfile() and plain writes can be used on the socket
+	if (uwsgi.ssl_ktls) {
+#ifdef UWSGI_SSL_KTLS
+		ssloptions |= SSL_OP_ENABLE_KTLS;
+#else
+		uwsgi_log("[uwsgi-ssl] kTLS is not supported by this OpenSSL build, context \"%s\" will use userspace encryption\n", name);
+#endif
+	}
+
 // release/reuse buffers as soon as possible
 #ifdef SSL_MODE_RELEASE_BUFFERS
         SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
@@ -409,7 +704,10 @@ SSL_CTX *uwsgi_ssl_new_server_context(char *name, char *crt, char *key, char *ci
                         SSL_SESS_CACHE_NO_AUTO_CLEAR);
 
 #ifdef SSL_OP_NO_TICKET
-                ssloptions |= SSL_OP_NO_TICKET;
+		// clients supporting tickets resume with the shared keys
+		if (!uwsgi.ssl_tickets_legion) {
+                	ssloptions |= SSL_OP_NO_TICKET;
+		}
 #endif
 
                 // just for fun
@@ -424,6 +722,14 @@ SSL_CTX *uwsgi_ssl_new_server_context(char *name, char *crt, char *key, char *ci
 
         SSL_CTX_set_timeout(ctx, uwsgi.ssl_sessions_timeout);
 
+	if (uwsgi.ssl_tickets_legion) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, uwsgi_ssl_ticket_key_cb);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, uwsgi_ssl_ticket_key_cb);
+#endif
+	}
+
 	struct uwsgi_string_list *usl = NULL;
 	uwsgi_foreach(usl, uwsgi.ssl_options) {
 		ssloptions |= atoi(usl->value);
@@ -431,6 +737,9 @@ SSL_CTX *uwsgi_ssl_new_server_context(char *name, char *crt, char *key, char *ci
 
         SSL_CTX_set_options(ctx, ssloptions);
 
+	if (uwsgi.ssl_ocsp_stapling) {
+		uwsgi_ssl_ocsp_setup(ctx, name);
+	}
 
         return ctx;
 }
@@ -637,6 +946,7 @@ void uwsgi_opt_sni(char *opt, char *value, void *foobar) {
 #endif
                 struct uwsgi_string_list *usl = uwsgi_string_new_list(&uwsgi.sni, v);
                 usl->custom_ptr = ctx;
+		sni_table_add(usl);
 #ifdef UWSGI_PCRE
         }
 #endif
@@ -654,16 +964,20 @@ struct uwsgi_string_list *uwsgi_ssl_add_sni_item(char *name, char *crt, char *ke
 		return NULL;
 	}
 
+	pthread_rwlock_wrlock(&sni_table_lock);
 	struct uwsgi_string_list *usl = uwsgi_string_new_list(&uwsgi.sni, name);
 	usl->custom_ptr = ctx;
 	// mark it as dynamic
 	usl->custom = 1;
+	pthread_rwlock_unlock(&sni_table_lock);
+	sni_table_add(usl);
 	uwsgi_log_verbose("[uwsgi-sni for pid %d] added SSL context for %s\n", (int) getpid(), name);
 	return usl;
 }
 
 void uwsgi_ssl_del_sni_item(char *name, uint16_t name_len) {
 	struct uwsgi_string_list *usl = NULL, *last_sni = NULL, *sni_item = NULL;
+	pthread_rwlock_wrlock(&sni_table_lock);
 	uwsgi_foreach(usl, uwsgi.sni) {
 		if (!uwsgi_strncmp(usl->value, usl->len, name, name_len) && usl->custom) {
 			sni_item = usl;
@@ -672,7 +986,10 @@ void uwsgi_ssl_del_sni_item(char *name, uint16_t name_len) {
 		last_sni = usl;
 	}
 
-	if (!sni_item) return;
+	if (!sni_item) {
+		pthread_rwlock_unlock(&sni_table_lock);
+		return;
+	}
 
 	if (last_sni) {
 		last_sni->next = sni_item->next;
@@ -680,8 +997,11 @@ void uwsgi_ssl_del_sni_item(char *name, uint16_t name_len) {
 	else {
 		uwsgi.sni = sni_item->next;
 	}
+	sni_table_del(sni_item);
+	pthread_rwlock_unlock(&sni_table_lock);
 
-	// we are free to destroy it as no more clients are using it
+	// the running handshakes hold their own references
+	uwsgi_ssl_ocsp_free((SSL_CTX *) sni_item->custom_ptr);
 	SSL_CTX_free((SSL_CTX *) sni_item->custom_ptr);
 	free(sni_item->value);
 	free(sni_item);	
@@ -0,0 +1,383 @@
+#include "uwsgi.h"
+#include <openssl/ocsp.h>
+#include <openssl/x509v3.h>
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	OCSP stapling (--ssl-ocsp-stapling)
+
+	every server context gets the OCSP responder of its certificate (from the AIA extension or --ssl-ocsp-responder)
+	and the issuer (from the certificate chain loaded with the context).
+
+	The responses are fetched and refreshed by short-lived background threads: the handshakes never wait for
+	the responder, they staple the last valid response (if any) and start a new fetch when it is older than
+	--ssl-ocsp-refresh seconds (or half of its validity). The first handshakes of a context are not stapled.
+
+	As the contexts are process-local (and the threads do not survive a fork) everything is lazily done
+	in the process running the handshakes.
+
+*/
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+struct uwsgi_ssl_ocsp {
+	char *name;
+	X509 *cert;
+	X509 *issuer;
+
+	char *host;
+	char *port;
+	char *path;
+
+	pthread_mutex_t lock;
+	// DER encoded response
+	unsigned char *resp;
+	int resp_len;
+	// the response can be stapled up to its nextUpdate
+	time_t valid_until;
+	time_t refresh_at;
+	int fetching;
+	// the context has been destroyed while fetching
+	int dead;
+};
+
+// retry failed fetches after 60 seconds
+#define UWSGI_SSL_OCSP_RETRY 60
+// max size of a response
+#define UWSGI_SSL_OCSP_MAX_SIZE (64 * 1024)
+
+static void ssl_ocsp_free(struct uwsgi_ssl_ocsp *uso) {
+	X509_free(uso->cert);
+	X509_free(uso->issuer);
+	OPENSSL_free(uso->host);
+	OPENSSL_free(uso->port);
+	OPENSSL_free(uso->path);
+	if (uso->resp) OPENSSL_free(uso->resp);
+	pthread_mutex_destroy(&uso->lock);
+	free(uso->name);
+	free(uso);
+}
+
+static int ssl_ocsp_connect(struct uwsgi_ssl_ocsp *uso) {
+	struct addrinfo hints, *res = NULL, *ai;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(uso->host, uso->port, &hints, &res)) return -1;
+
+	struct timeval tv;
+	tv.tv_sec = uwsgi.ssl_ocsp_timeout;
+	tv.tv_usec = 0;
+
+	int fd = -1;
+	for(ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) continue;
+		// connect(), write() and read() honour the timeouts
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval));
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval));
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+// POST the request to the responder and return the response body
+static struct uwsgi_buffer *ssl_ocsp_http(struct uwsgi_ssl_ocsp *uso, unsigned char *req, int req_len) {
+	int fd = ssl_ocsp_connect(uso);
+	if (fd < 0) return NULL;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	if (uwsgi_buffer_append(ub, "POST ", 5)) goto error;
+	if (uwsgi_buffer_append(ub, uso->path, strlen(uso->path))) goto error;
+	if (uwsgi_buffer_append(ub, " HTTP/1.0\r\nHost: ", 17)) goto error;
+	if (uwsgi_buffer_append(ub, uso->host, strlen(uso->host))) goto error;
+	if (uwsgi_buffer_append(ub, "\r\nContent-Type: application/ocsp-request\r\nContent-Length: ", 58)) goto error;
+	if (uwsgi_buffer_num64(ub, req_len)) goto error;
+	if (uwsgi_buffer_append(ub, "\r\n\r\n", 4)) goto error;
+	if (uwsgi_buffer_append(ub, (char *) req, req_len)) goto error;
+
+	size_t remains = ub->pos;
+	while(remains) {
+		ssize_t len = write(fd, ub->buf + (ub->pos - remains), remains);
+		if (len <= 0) goto error;
+		remains -= len;
+	}
+
+	// read the whole response (the responder closes the connection)
+	ub->pos = 0;
+	for(;;) {
+		if (uwsgi_buffer_ensure(ub, uwsgi.page_size)) goto error;
+		ssize_t len = read(fd, ub->buf + ub->pos, ub->len - ub->pos);
+		if (len < 0) goto error;
+		if (len == 0) break;
+		ub->pos += len;
+		if (ub->pos > UWSGI_SSL_OCSP_MAX_SIZE) goto error;
+	}
+	close(fd);
+
+	if (ub->pos < 12 || memcmp(ub->buf, "HTTP/1.", 7) || ub->buf[9] != '2') goto error2;
+	size_t i;
+	for(i = 0; i + 4 <= ub->pos; i++) {
+		if (!memcmp(ub->buf + i, "\r\n\r\n", 4)) {
+			size_t body_len = ub->pos - (i + 4);
+			memmove(ub->buf, ub->buf + i + 4, body_len);
+			ub->pos = body_len;
+			return ub;
+		}
+	}
+	goto error2;
+
+error:
+	close(fd);
+error2:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+// returns the validity (in seconds) of the response, -1 if it is not usable
+static time_t ssl_ocsp_check(struct uwsgi_ssl_ocsp *uso, OCSP_RESPONSE *resp, OCSP_CERTID *id) {
+	time_t validity = -1;
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) return -1;
+
+	OCSP_BASICRESP *basic = OCSP_response_get1_basic(resp);
+	if (!basic) return -1;
+
+	// the clients verify the response against their trust store, here we only check it is signed by the issuer (or its delegate)
+	STACK_OF(X509) *certs = sk_X509_new_null();
+	if (!certs) goto end;
+	sk_X509_push(certs, uso->issuer);
+	X509_STORE *store = X509_STORE_new();
+	int verified = store && OCSP_basic_verify(basic, certs, store, OCSP_TRUSTOTHER | OCSP_NOVERIFY) == 1;
+	if (store) X509_STORE_free(store);
+	sk_X509_free(certs);
+	if (!verified) goto end;
+
+	int status, reason;
+	ASN1_GENERALIZEDTIME *thisupd = NULL, *nextupd = NULL;
+	if (!OCSP_resp_find_status(basic, id, &status, &reason, NULL, &thisupd, &nextupd)) goto end;
+	if (status != V_OCSP_CERTSTATUS_GOOD) goto end;
+	// 5 minutes of tolerance for clock skew
+	if (!OCSP_check_validity(thisupd, nextupd, 300, -1)) goto end;
+
+	validity = uwsgi.ssl_ocsp_refresh * 2;
+	if (nextupd) {
+		int days = 0, secs = 0;
+		if (!ASN1_TIME_diff(&days, &secs, NULL, nextupd)) goto end;
+		validity = ((time_t) days * 86400) + secs;
+	}
+end:
+	OCSP_BASICRESP_free(basic);
+	return validity;
+}
+
+static void *ssl_ocsp_fetch(void *arg) {
+	struct uwsgi_ssl_ocsp *uso = (struct uwsgi_ssl_ocsp *) arg;
+
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	unsigned char *der = NULL;
+	int der_len = 0;
+	time_t validity = -1;
+	struct uwsgi_buffer *ub = NULL;
+	OCSP_RESPONSE *resp = NULL;
+
+	OCSP_REQUEST *req = OCSP_REQUEST_new();
+	OCSP_CERTID *id = OCSP_cert_to_id(NULL, uso->cert, uso->issuer);
+	if (!req || !id) goto end;
+	OCSP_CERTID *req_id = OCSP_CERTID_dup(id);
+	if (!req_id) goto end;
+	if (!OCSP_request_add0_id(req, req_id)) {
+		OCSP_CERTID_free(req_id);
+		goto end;
+	}
+
+	unsigned char *req_der = NULL;
+	int req_der_len = i2d_OCSP_REQUEST(req, &req_der);
+	if (req_der_len <= 0) goto end;
+	ub = ssl_ocsp_http(uso, req_der, req_der_len);
+	OPENSSL_free(req_der);
+	if (!ub) goto end;
+
+	const unsigned char *ptr = (const unsigned char *) ub->buf;
+	resp = d2i_OCSP_RESPONSE(NULL, &ptr, ub->pos);
+	if (!resp) goto end;
+
+	validity = ssl_ocsp_check(uso, resp, id);
+	if (validity <= 0) goto end;
+
+	der_len = i2d_OCSP_RESPONSE(resp, &der);
+	if (der_len <= 0) {
+		der = NULL;
+		validity = -1;
+	}
+
+end:
+	if (resp) OCSP_RESPONSE_free(resp);
+	if (ub) uwsgi_buffer_destroy(ub);
+	if (id) OCSP_CERTID_free(id);
+	if (req) OCSP_REQUEST_free(req);
+
+	time_t now = uwsgi_now();
+	pthread_mutex_lock(&uso->lock);
+	uso->fetching = 0;
+	if (uso->dead) {
+		pthread_mutex_unlock(&uso->lock);
+		if (der) OPENSSL_free(der);
+		ssl_ocsp_free(uso);
+		return NULL;
+	}
+	if (validity > 0 && der) {
+		if (uso->resp) OPENSSL_free(uso->resp);
+		uso->resp = der;
+		uso->resp_len = der_len;
+		uso->valid_until = now + validity;
+		uso->refresh_at = now + UMIN((time_t) uwsgi.ssl_ocsp_refresh, validity / 2);
+	}
+	else {
+		uso->refresh_at = now + UWSGI_SSL_OCSP_RETRY;
+	}
+	pthread_mutex_unlock(&uso->lock);
+
+	if (validity > 0) {
+		uwsgi_log_verbose("[uwsgi-ssl] OCSP response for \"%s\" refreshed (valid for %d seconds)\n", uso->name, (int) validity);
+	}
+	else {
+		uwsgi_log("[uwsgi-ssl] unable to get a valid OCSP response for \"%s\" from %s:%s%s\n", uso->name, uso->host, uso->port, uso->path);
+	}
+	return NULL;
+}
+
+static int ssl_ocsp_status_cb(SSL *ssl, void *arg) {
+	struct uwsgi_ssl_ocsp *uso = (struct uwsgi_ssl_ocsp *) arg;
+	unsigned char *resp = NULL;
+	int resp_len = 0;
+	time_t now = uwsgi_now();
+
+	pthread_mutex_lock(&uso->lock);
+	if (!uso->fetching && now >= uso->refresh_at) {
+		pthread_t t;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		uso->fetching = 1;
+		if (pthread_create(&t, &attr, ssl_ocsp_fetch, uso)) {
+			uwsgi_error("ssl_ocsp_status_cb()/pthread_create()");
+			uso->fetching = 0;
+			uso->refresh_at = now + UWSGI_SSL_OCSP_RETRY;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	if (uso->resp && now < uso->valid_until) {
+		// openssl takes the ownership of the memory
+		resp = OPENSSL_malloc(uso->resp_len);
+		if (resp) {
+			memcpy(resp, uso->resp, uso->resp_len);
+			resp_len = uso->resp_len;
+		}
+	}
+	pthread_mutex_unlock(&uso->lock);
+
+	if (!resp) return SSL_TLSEXT_ERR_NOACK;
+	SSL_set_tlsext_status_ocsp_resp(ssl, resp, resp_len);
+	return SSL_TLSEXT_ERR_OK;
+}
+
+void uwsgi_ssl_ocsp_setup(SSL_CTX *ctx, char *name) {
+	X509 *cert = SSL_CTX_get0_certificate(ctx);
+	if (!cert) return;
+
+	// the issuer is taken from the chain loaded with the certificate
+	X509 *issuer = NULL;
+	STACK_OF(X509) *chain = NULL;
+	if (SSL_CTX_get0_chain_certs(ctx, &chain) && chain) {
+		int i;
+		for(i = 0; i < sk_X509_num(chain); i++) {
+			X509 *candidate = sk_X509_value(chain, i);
+			if (X509_check_issued(candidate, cert) == X509_V_OK) {
+				issuer = candidate;
+				break;
+			}
+		}
+	}
+	if (!issuer) {
+		uwsgi_log("[uwsgi-ssl] OCSP stapling disabled for \"%s\": the issuer certificate is not in the chain\n", name);
+		return;
+	}
+
+	char *url = uwsgi.ssl_ocsp_responder;
+	STACK_OF(OPENSSL_STRING) *urls = NULL;
+	if (!url) {
+		urls = X509_get1_ocsp(cert);
+		if (urls && sk_OPENSSL_STRING_num(urls) > 0) {
+			url = sk_OPENSSL_STRING_value(urls, 0);
+		}
+	}
+	if (!url) {
+		uwsgi_log("[uwsgi-ssl] OCSP stapling disabled for \"%s\": the certificate has no OCSP responder\n", name);
+		goto end;
+	}
+
+	char *host = NULL, *port = NULL, *path = NULL;
+	int use_ssl = 0;
+	if (!OCSP_parse_url(url, &host, &port, &path, &use_ssl)) {
+		uwsgi_log("[uwsgi-ssl] OCSP stapling disabled for \"%s\": invalid responder url %s\n", name, url);
+		goto end;
+	}
+	if (use_ssl) {
+		uwsgi_log("[uwsgi-ssl] OCSP stapling disabled for \"%s\": https responders are not supported (%s)\n", name, url);
+		OPENSSL_free(host);
+		OPENSSL_free(port);
+		OPENSSL_free(path);
+		goto end;
+	}
+
+	struct uwsgi_ssl_ocsp *uso = uwsgi_calloc(sizeof(struct uwsgi_ssl_ocsp));
+	uso->name = uwsgi_str(name ? name : "default");
+	X509_up_ref(cert);
+	uso->cert = cert;
+	X509_up_ref(issuer);
+	uso->issuer = issuer;
+	uso->host = host;
+	uso->port = port;
+	uso->path = path;
+	pthread_mutex_init(&uso->lock, NULL);
+
+	SSL_CTX_set_tlsext_status_cb(ctx, ssl_ocsp_status_cb);
+	SSL_CTX_set_tlsext_status_arg(ctx, uso);
+end:
+	if (urls) X509_email_free(urls);
+}
+
+// called before destroying a context
+void uwsgi_ssl_ocsp_free(SSL_CTX *ctx) {
+	struct uwsgi_ssl_ocsp *uso = NULL;
+	if (SSL_CTX_get_tlsext_status_arg(ctx, (void **) &uso) <= 0 || !uso) return;
+	SSL_CTX_set_tlsext_status_arg(ctx, NULL);
+	pthread_mutex_lock(&uso->lock);
+	if (uso->fetching) {
+		// the fetch thread will release it
+		uso->dead = 1;
+		pthread_mutex_unlock(&uso->lock);
+		return;
+	}
+	pthread_mutex_unlock(&uso->lock);
+	ssl_ocsp_free(uso);
+}
+
+#else
+
+void uwsgi_ssl_ocsp_setup(SSL_CTX *ctx, char *name) {
+	uwsgi_log("[uwsgi-ssl] OCSP stapling is not supported by this OpenSSL build, context \"%s\" will not staple responses\n", name);
+}
+
+void uwsgi_ssl_ocsp_free(SSL_CTX *ctx) {
+}
+
+#endif
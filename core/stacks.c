@@ -0,0 +1,93 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	pooled stacks for the coroutine engines (ugreen...)
+
+	stacks are mapped the first time a core needs one (so --async 10000 does not map 10000 stacks
+	when only a few requests run concurrently) with MAP_NORESERVE: pages are committed only when touched.
+	Both ends are protected by a guard page.
+
+	When a request is over its stack goes back to the pool free list, only up to max_free stacks are kept
+	(the others are unmapped). With trim, the pages of a recycled stack (but the topmost, always touched
+	ones) are given back to the kernel, so a single deep request does not pin memory forever.
+
+	The pool is not thread safe (the coroutine engines run in a single thread).
+
+*/
+
+// the topmost part of the stack is touched by every request, there is no point in releasing it
+#define UWSGI_STACK_HOT_PAGES 4
+
+struct uwsgi_stack_pool *uwsgi_stack_pool_new(size_t stack_size, int max_free, int trim) {
+	struct uwsgi_stack_pool *usp = uwsgi_calloc(sizeof(struct uwsgi_stack_pool));
+	// round to pages
+	usp->stack_size = ((stack_size + uwsgi.page_size - 1) / uwsgi.page_size) * uwsgi.page_size;
+	usp->max_free = max_free;
+	usp->trim = trim;
+	return usp;
+}
+
+static struct uwsgi_stack *uwsgi_stack_map(struct uwsgi_stack_pool *usp) {
+	int flags = MAP_ANON | MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+	flags |= MAP_STACK;
+#endif
+	size_t map_size = usp->stack_size + (uwsgi.page_size * 2);
+	char *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (base == MAP_FAILED) {
+		uwsgi_error("uwsgi_stack_map()/mmap()");
+		return NULL;
+	}
+	// guard pages
+	if (mprotect(base, uwsgi.page_size, PROT_NONE) || mprotect(base + uwsgi.page_size + usp->stack_size, uwsgi.page_size, PROT_NONE)) {
+		uwsgi_error("uwsgi_stack_map()/mprotect()");
+		munmap(base, map_size);
+		return NULL;
+	}
+	struct uwsgi_stack *us = uwsgi_calloc(sizeof(struct uwsgi_stack));
+	us->base = base;
+	us->map_size = map_size;
+	us->sp = base + uwsgi.page_size;
+	us->size = usp->stack_size;
+	usp->mapped++;
+	return us;
+}
+
+struct uwsgi_stack *uwsgi_stack_get(struct uwsgi_stack_pool *usp) {
+	struct uwsgi_stack *us = usp->free_list;
+	if (us) {
+		usp->free_list = us->next;
+		usp->free_count--;
+		usp->recycled++;
+	}
+	else {
+		us = uwsgi_stack_map(usp);
+		if (!us) return NULL;
+	}
+	us->next = NULL;
+	usp->in_use++;
+	return us;
+}
+
+void uwsgi_stack_put(struct uwsgi_stack_pool *usp, struct uwsgi_stack *us) {
+	usp->in_use--;
+	if (usp->free_count >= usp->max_free) {
+		munmap(us->base, us->map_size);
+		free(us);
+		usp->mapped--;
+		return;
+	}
+	if (usp->trim && us->size > (size_t) (uwsgi.page_size * UWSGI_STACK_HOT_PAGES)) {
+		// stacks grow down, the hot pages are at the end
+		madvise(us->sp, us->size - (uwsgi.page_size * UWSGI_STACK_HOT_PAGES), MADV_DONTNEED);
+	}
+	us->next = usp->free_list;
+	usp->free_list = us;
+	usp->free_count++;
+}
@@ -3,15 +3,16 @@
 extern struct uwsgi_server uwsgi;
 
 int uwsgi_static_want_gzip(struct wsgi_request *wsgi_req, char *filename, size_t *filename_len, struct stat *st) {
-	char can_gzip = 0, can_br = 0;
+	char can_gzip = 0, can_br = 0, can_zstd = 0;
 
 	// check for filename size
-	if (*filename_len + 4 > PATH_MAX) return 0;
+	if (*filename_len + 5 > PATH_MAX) return 0;
 	// check for supported encodings
 	can_br = uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "br", 2);
+	can_zstd = uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "zstd", 4);
 	can_gzip = uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "gzip", 4);
 
-	if(!can_br && !can_gzip)
+	if(!can_br && !can_zstd && !can_gzip)
 		return 0;
 
 	// check for 'all'
@@ -57,6 +58,14 @@ gzip:
 		filename[*filename_len] = 0;
 	}
 
+	if(can_zstd) {
+		memcpy(filename + *filename_len, ".zst\0", 5);
+		*filename_len += 4;
+		if (!stat(filename, st)) return 3;
+		*filename_len -= 4;
+		filename[*filename_len] = 0;
+	}
+
 	if(can_gzip) {
 		memcpy(filename + *filename_len, ".gz\0", 4);
 		*filename_len += 3;
@@ -184,6 +193,46 @@ time_t uwsgi_parse_http_date(char *buf, uint16_t len) {
 	return parse_http_date(buf, len);
 }
 
+// strong ETag of a static file (buf must be at least 64 bytes), encoded variants built in memory need a suffix
+int uwsgi_static_etag(struct stat *st, char *suffix, char *buf) {
+	int ret = snprintf(buf, 64, "\"%llx-%llx-%llx%s\"", (unsigned long long) st->st_ino, (unsigned long long) st->st_mtime, (unsigned long long) st->st_size, suffix ? suffix : "");
+	if (ret <= 0 || ret >= 64) return 0;
+	return ret;
+}
+
+// check the etag against an If-None-Match list (weak comparison, as required by rfc7232)
+static int static_etag_match(char *list, uint16_t list_len, char *etag, int etag_len) {
+	char *ptr = list;
+	char *end = list + list_len;
+	while (ptr < end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == ',')) ptr++;
+		if (ptr >= end) break;
+		if (*ptr == '*') return 1;
+		if (end - ptr > 2 && ptr[0] == 'W' && ptr[1] == '/') ptr += 2;
+		char *tag = ptr;
+		if (*ptr == '"') {
+			ptr++;
+			while (ptr < end && *ptr != '"') ptr++;
+			if (ptr < end) ptr++;
+		}
+		if (ptr - tag == etag_len && !memcmp(tag, etag, etag_len)) return 1;
+		while (ptr < end && *ptr != ',') ptr++;
+	}
+	return 0;
+}
+
+// If-None-Match takes precedence over If-Modified-Since
+static int static_not_modified(struct wsgi_request *wsgi_req, time_t mtime, char *etag, int etag_len) {
+	if (etag_len && wsgi_req->if_none_match_len) {
+		return static_etag_match(wsgi_req->if_none_match, wsgi_req->if_none_match_len, etag, etag_len);
+	}
+	if (wsgi_req->if_modified_since_len) {
+		time_t ims = parse_http_date(wsgi_req->if_modified_since, wsgi_req->if_modified_since_len);
+		if (mtime <= ims) return 1;
+	}
+	return 0;
+}
+
 
 int uwsgi_add_expires_type(struct wsgi_request *wsgi_req, char *mime_type, int mime_type_len, struct stat *st) {
 
@@ -457,24 +506,618 @@ void uwsgi_request_fix_range_for_size(struct wsgi_request *wsgi_req, int64_t siz
 			&wsgi_req->range_from, &wsgi_req->range_to, size);
 }
 
-int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st) {
+/*
+
+	static fd cache (--static-fd-cache N)
+
+	each core keeps (in a direct mapped table of N slots, indexed by the hash of the requested path)
+	the resolved path, the open fd, the struct stat and the mime type of the served files,
+	so a hit costs no filesystem syscalls (only sendfile() of the cached fd).
+
+	Entries are invalidated by a per-process inotify instance watching the cached files (any change
+	of the inode bumps the stamp of its watch descriptor), and optionally by --static-fd-cache-ttl
+	(without inotify support, or if the watch fails, entries are revalidated every second).
+	Replacing a file with rename() is detected too (the old inode gets an IN_ATTRIB on unlink).
+
+	compressed variants (--static-gzip*) are not cached (they are still searched on each request)
+
+*/
+
+struct uwsgi_static_fd {
+	char *filename;
+	size_t filename_len;
+	char *real_filename;
+	size_t real_filename_len;
+	struct uwsgi_string_list *index;
+	struct stat st;
+	int fd;
+	char *mime_type;
+	size_t mime_type_size;
+	int wd;
+	uint64_t stamp;
+	time_t validated;
+};
+
+static struct uwsgi_static_fd **static_fd_caches;
+static pthread_mutex_t static_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef __linux__
+#include <sys/inotify.h>
+static int static_fd_inotify = -1;
+static uint64_t *static_fd_stamps;
+static int static_fd_stamps_cnt;
+
+// consume the pending inotify events (must be called with the lock held)
+static void static_fd_inotify_check() {
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t rlen = read(static_fd_inotify, buf, sizeof(buf));
+		if (rlen <= 0) return;
+		char *ptr = buf;
+		while (ptr + sizeof(struct inotify_event) <= buf + rlen) {
+			struct inotify_event *ie = (struct inotify_event *) ptr;
+			if (ie->wd >= 0 && ie->wd < static_fd_stamps_cnt) {
+				static_fd_stamps[ie->wd]++;
+			}
+			ptr += sizeof(struct inotify_event) + ie->len;
+		}
+	}
+}
+
+static int static_fd_watch(char *filename, uint64_t *stamp) {
+	if (static_fd_inotify < 0) {
+		static_fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (static_fd_inotify < 0) {
+			uwsgi_error("static_fd_watch()/inotify_init1()");
+			return -1;
+		}
+	}
+	int wd = inotify_add_watch(static_fd_inotify, filename, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+	if (wd < 0) return -1;
+	if (wd >= static_fd_stamps_cnt) {
+		int cnt = wd + 64;
+		uint64_t *tmp = realloc(static_fd_stamps, sizeof(uint64_t) * cnt);
+		if (!tmp) return -1;
+		memset(tmp + static_fd_stamps_cnt, 0, sizeof(uint64_t) * (cnt - static_fd_stamps_cnt));
+		static_fd_stamps = tmp;
+		static_fd_stamps_cnt = cnt;
+	}
+	*stamp = static_fd_stamps[wd];
+	return wd;
+}
+#endif
+
+static void static_fd_reset(struct uwsgi_static_fd *usf) {
+	if (usf->fd >= 0) close(usf->fd);
+	free(usf->filename);
+	free(usf->real_filename);
+	memset(usf, 0, sizeof(struct uwsgi_static_fd));
+	usf->fd = -1;
+}
+
+static struct uwsgi_static_fd *static_fd_slot(struct wsgi_request *wsgi_req, char *filename, size_t filename_len) {
+	if (!static_fd_caches) {
+		pthread_mutex_lock(&static_fd_lock);
+		if (!static_fd_caches) {
+			static_fd_caches = uwsgi_calloc(sizeof(struct uwsgi_static_fd *) * uwsgi.cores);
+		}
+		pthread_mutex_unlock(&static_fd_lock);
+	}
+	// each core has its own table (no locking, and fds are never closed under an in-flight request)
+	if (!static_fd_caches[wsgi_req->async_id]) {
+		struct uwsgi_static_fd *table = uwsgi_calloc(sizeof(struct uwsgi_static_fd) * uwsgi.static_fd_cache);
+		int i;
+		for (i = 0; i < uwsgi.static_fd_cache; i++) table[i].fd = -1;
+		static_fd_caches[wsgi_req->async_id] = table;
+	}
+	return &static_fd_caches[wsgi_req->async_id][djb33x_hash(filename, filename_len) % uwsgi.static_fd_cache];
+}
+
+static struct uwsgi_static_fd *static_fd_cache_get(struct wsgi_request *wsgi_req, char *filename, size_t filename_len) {
+	struct uwsgi_static_fd *usf = static_fd_slot(wsgi_req, filename, filename_len);
+	if (usf->fd < 0 || usf->filename_len != filename_len || memcmp(usf->filename, filename, filename_len)) return NULL;
+
+	int ttl = uwsgi.static_fd_cache_ttl;
+#ifdef __linux__
+	if (usf->wd >= 0) {
+		if (uwsgi.threads > 1) pthread_mutex_lock(&static_fd_lock);
+		static_fd_inotify_check();
+		int changed = static_fd_stamps[usf->wd] != usf->stamp;
+		if (uwsgi.threads > 1) pthread_mutex_unlock(&static_fd_lock);
+		if (changed) goto invalid;
+	}
+	else
+#endif
+	if (!ttl) ttl = 1;
+
+	if (ttl > 0 && uwsgi_now() - usf->validated >= ttl) goto invalid;
+	return usf;
+
+invalid:
+	static_fd_reset(usf);
+	return NULL;
+}
+
+static struct uwsgi_static_fd *static_fd_cache_set(struct wsgi_request *wsgi_req, char *filename, size_t filename_len, char *real_filename, size_t real_filename_len, struct stat *st, struct uwsgi_string_list *index) {
+	// only GET and HEAD requests are served
+	if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "GET", 3) && uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) return NULL;
+
+	struct uwsgi_static_fd *usf = static_fd_slot(wsgi_req, filename, filename_len);
+	// evict the old entry
+	static_fd_reset(usf);
+
+	int fd = open(real_filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	// the file could have been replaced after stat()
+	struct stat fst;
+	if (fstat(fd, &fst) || fst.st_ino != st->st_ino || fst.st_dev != st->st_dev) {
+		close(fd);
+		return NULL;
+	}
+
+	usf->wd = -1;
+#ifdef __linux__
+	if (uwsgi.threads > 1) pthread_mutex_lock(&static_fd_lock);
+	// events read from now on are about the new entry
+	if (static_fd_inotify >= 0) static_fd_inotify_check();
+	usf->wd = static_fd_watch(real_filename, &usf->stamp);
+	if (uwsgi.threads > 1) pthread_mutex_unlock(&static_fd_lock);
+#endif
+
+	usf->fd = fd;
+	usf->filename = uwsgi_concat2n(filename, filename_len, "", 0);
+	usf->filename_len = filename_len;
+	usf->real_filename = uwsgi_concat2n(real_filename, real_filename_len, "", 0);
+	usf->real_filename_len = real_filename_len;
+	usf->index = index;
+	memcpy(&usf->st, &fst, sizeof(struct stat));
+	usf->mime_type = uwsgi_get_mime_type(real_filename, real_filename_len, &usf->mime_type_size);
+	usf->validated = uwsgi_now();
+	return usf;
+}
+
+/*
+
+	static files pinning (--static-pin <glob>)
+
+	at startup the master loads the regular files matching the globs (up to --static-pin-max-size bytes each)
+	in a shared memory area, together with their compressed variants (.br, .zst and .gz files found on disk,
+	a gzip one is built with zlib when missing) and the precomputed Content-Type, Content-Length,
+	Last-Modified, Content-Encoding, Vary and (with --static-etag) ETag headers of each variant,
+	plus the headers block of its 304 response.
+
+	GET and HEAD requests for a pinned file are answered from memory: the header block is appended
+	to the response headers and headers and body leave with a single writev().
+	Pinned files are never reloaded: if the stat() of the file does not match the pinned one it is served
+	from disk. Range requests, nginx/apache modes and non-base protocols (or header filters)
+	use the standard path too.
+
+*/
+
+struct uwsgi_static_pin_variant {
+	char *headers;
+	size_t headers_len;
+	uint16_t headers_cnt;
+	char *headers_304;
+	size_t headers_304_len;
+	uint16_t headers_304_cnt;
+	char etag[64];
+	int etag_len;
+	char *body;
+	size_t len;
+};
+
+struct uwsgi_static_pin {
+	char *filename;
+	size_t filename_len;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	char *mime_type;
+	size_t mime_type_size;
+	// indexed like the uwsgi_static_want_gzip() result: identity, gzip, br, zstd
+	struct uwsgi_static_pin_variant variants[4];
+	struct uwsgi_static_pin *next;
+};
+
+static struct uwsgi_static_pin **static_pins;
+static uint64_t static_pins_cnt;
+
+static char *static_pin_encodings[] = { NULL, "gzip", "br", "zstd" };
+static char *static_pin_exts[] = { NULL, ".gz", ".br", ".zst" };
+
+static char *static_pin_read(char *filename, struct stat *st, size_t *len) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	if (fstat(fd, st) || !S_ISREG(st->st_mode) || (uint64_t) st->st_size > uwsgi.static_pin_max_size) {
+		close(fd);
+		return NULL;
+	}
+	char *buf = uwsgi_malloc(st->st_size + 1);
+	size_t pos = 0;
+	while (pos < (size_t) st->st_size) {
+		ssize_t rlen = read(fd, buf + pos, st->st_size - pos);
+		if (rlen < 0 && errno == EINTR) continue;
+		if (rlen <= 0) {
+			uwsgi_log("[static-pin] unable to read %s\n", filename);
+			free(buf);
+			close(fd);
+			return NULL;
+		}
+		pos += rlen;
+	}
+	close(fd);
+	*len = pos;
+	return buf;
+}
+
+static int static_pin_headers(struct uwsgi_static_pin *usp, int v, int vary) {
+	struct uwsgi_static_pin_variant *usv = &usp->variants[v];
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(256);
+	char buf[sizeof(UMAX64_STR) + 1];
+	char http_last_modified[49];
+
+	if (usp->mime_type_size > 0 && usp->mime_type) {
+		if (uwsgi_proto_base_append_header(ub, "Content-Type", 12, usp->mime_type, usp->mime_type_size)) goto error;
+		usv->headers_cnt++;
+	}
+	int ret = snprintf(buf, sizeof(UMAX64_STR) + 1, "%llu", (unsigned long long) usv->len);
+	if (uwsgi_proto_base_append_header(ub, "Content-Length", 14, buf, ret)) goto error;
+	int size = uwsgi_http_date(usp->mtime, http_last_modified);
+	if (uwsgi_proto_base_append_header(ub, "Last-Modified", 13, http_last_modified, size)) goto error;
+	usv->headers_cnt += 2;
+	if (v) {
+		if (uwsgi_proto_base_append_header(ub, "Content-Encoding", 16, static_pin_encodings[v], strlen(static_pin_encodings[v]))) goto error;
+		usv->headers_cnt++;
+	}
+	// the 304 response gets only ETag and Vary
+	size_t pos_304 = ub->pos;
+	if (usv->etag_len) {
+		if (uwsgi_proto_base_append_header(ub, "ETag", 4, usv->etag, usv->etag_len)) goto error;
+		usv->headers_cnt++;
+		usv->headers_304_cnt++;
+	}
+	if (vary) {
+		if (uwsgi_proto_base_append_header(ub, "Vary", 4, "Accept-Encoding", 15)) goto error;
+		usv->headers_cnt++;
+		usv->headers_304_cnt++;
+	}
+	usv->headers = ub->buf;
+	usv->headers_len = ub->pos;
+	usv->headers_304 = ub->buf + pos_304;
+	usv->headers_304_len = ub->pos - pos_304;
+	ub->buf = NULL;
+	uwsgi_buffer_destroy(ub);
+	return 0;
+error:
+	uwsgi_buffer_destroy(ub);
+	return -1;
+}
+
+static struct uwsgi_static_pin *static_pin_load(char *path) {
+	char real_filename[PATH_MAX + 1];
+	if (!realpath(path, real_filename)) return NULL;
+
+	struct stat st;
+	size_t len = 0;
+	char *body = static_pin_read(real_filename, &st, &len);
+	if (!body) return NULL;
+
+	struct uwsgi_static_pin *usp = uwsgi_calloc(sizeof(struct uwsgi_static_pin));
+	usp->filename_len = strlen(real_filename);
+	usp->filename = uwsgi_concat2n(real_filename, usp->filename_len, "", 0);
+	usp->dev = st.st_dev;
+	usp->ino = st.st_ino;
+	usp->size = st.st_size;
+	usp->mtime = st.st_mtime;
+	usp->mime_type = uwsgi_get_mime_type(real_filename, usp->filename_len, &usp->mime_type_size);
+	usp->variants[0].body = body;
+	usp->variants[0].len = len;
+	if (uwsgi.static_etag) usp->variants[0].etag_len = uwsgi_static_etag(&st, NULL, usp->variants[0].etag);
+
+	int v, vary = 0;
+	for (v = 1; v < 4; v++) {
+		if (usp->filename_len + 5 > PATH_MAX) break;
+		char *variant = uwsgi_concat2(usp->filename, static_pin_exts[v]);
+		struct stat vst;
+		usp->variants[v].body = static_pin_read(variant, &vst, &usp->variants[v].len);
+		free(variant);
+		if (usp->variants[v].body) {
+			// the same ETag of the variant served from disk
+			if (uwsgi.static_etag) usp->variants[v].etag_len = uwsgi_static_etag(&vst, NULL, usp->variants[v].etag);
+			vary = 1;
+		}
+	}
+#ifdef UWSGI_ZLIB
+	// build the gzip variant only if it is worth it
+	if (!usp->variants[1].body && len > 0) {
+		struct uwsgi_buffer *ub = uwsgi_gzip(body, len);
+		if (ub && ub->pos < len - (len / 10)) {
+			usp->variants[1].body = ub->buf;
+			usp->variants[1].len = ub->pos;
+			ub->buf = NULL;
+			if (uwsgi.static_etag) usp->variants[1].etag_len = uwsgi_static_etag(&st, "-gzip", usp->variants[1].etag);
+			vary = 1;
+		}
+		if (ub) uwsgi_buffer_destroy(ub);
+	}
+#endif
+
+	for (v = 0; v < 4; v++) {
+		if (v && !usp->variants[v].body) continue;
+		if (static_pin_headers(usp, v, vary)) {
+			uwsgi_log("[static-pin] unable to build the headers for %s\n", usp->filename);
+			exit(1);
+		}
+	}
+	return usp;
+}
+
+void uwsgi_static_pin_init() {
+	if (!uwsgi.static_pin) return;
+	if (!uwsgi.static_pin_max_size) uwsgi.static_pin_max_size = 1024 * 1024;
+
+	struct uwsgi_static_pin *pins = NULL, *usp, *next;
+	size_t total = 0;
+	int v;
+	size_t i;
+
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uwsgi.static_pin) {
+		glob_t g;
+		if (glob(usl->value, 0, NULL, &g)) {
+			uwsgi_log("[static-pin] no file matching \"%s\"\n", usl->value);
+			continue;
+		}
+		for (i = 0; i < g.gl_pathc; i++) {
+			usp = static_pin_load(g.gl_pathv[i]);
+			if (!usp) continue;
+			for (v = 0; v < 4; v++) {
+				total += usp->variants[v].headers_len + usp->variants[v].len;
+			}
+			usp->next = pins;
+			pins = usp;
+			static_pins_cnt++;
+		}
+		globfree(&g);
+	}
+
+	if (!static_pins_cnt) return;
+
+	// move headers and bodies to a single shared area (workers will not get a copy of it)
+	char *area = uwsgi_malloc_shared(total);
+	char *ptr = area;
+	static_pins = uwsgi_calloc(sizeof(struct uwsgi_static_pin *) * static_pins_cnt);
+	for (usp = pins; usp; usp = next) {
+		next = usp->next;
+		for (v = 0; v < 4; v++) {
+			struct uwsgi_static_pin_variant *usv = &usp->variants[v];
+			if (!usv->headers) continue;
+			memcpy(ptr, usv->headers, usv->headers_len);
+			free(usv->headers);
+			// the 304 block is the tail of the headers
+			usv->headers_304 = ptr + (usv->headers_len - usv->headers_304_len);
+			usv->headers = ptr;
+			ptr += usv->headers_len;
+			memcpy(ptr, usv->body, usv->len);
+			free(usv->body);
+			usv->body = ptr;
+			ptr += usv->len;
+		}
+		uint64_t slot = djb33x_hash(usp->filename, usp->filename_len) % static_pins_cnt;
+		usp->next = static_pins[slot];
+		static_pins[slot] = usp;
+	}
+
+	uwsgi_log("[static-pin] pinned %llu files (%llu bytes) in shared memory\n", (unsigned long long) static_pins_cnt, (unsigned long long) total);
+}
+
+static struct uwsgi_static_pin *static_pin_get(struct wsgi_request *wsgi_req, char *filename, size_t filename_len, struct stat *st) {
+	// the precomputed header block is valid only for the base protocols without header filters
+	if (uwsgi.file_serve_mode || wsgi_req->socket->proto_add_header != uwsgi_proto_base_add_header) return NULL;
+	if (uwsgi.remove_headers || wsgi_req->remove_headers || uwsgi.pull_headers || uwsgi.collect_headers) return NULL;
+	if (wsgi_req->range_parsed != UWSGI_RANGE_NOT_PARSED) return NULL;
+
+	struct uwsgi_static_pin *usp = static_pins[djb33x_hash(filename, filename_len) % static_pins_cnt];
+	while (usp) {
+		if (usp->filename_len == filename_len && !memcmp(usp->filename, filename, filename_len)) {
+			// changed on disk ?
+			if (usp->dev != st->st_dev || usp->ino != st->st_ino || usp->size != st->st_size || usp->mtime != st->st_mtime) return NULL;
+			return usp;
+		}
+		usp = usp->next;
+	}
+	return NULL;
+}
+
+static int static_pin_serve(struct wsgi_request *wsgi_req, struct uwsgi_static_pin *usp, struct stat *st) {
+	struct uwsgi_static_pin_variant *usv = &usp->variants[0];
+	if (wsgi_req->encoding_len) {
+		if (usp->variants[2].body && uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "br", 2)) usv = &usp->variants[2];
+		else if (usp->variants[3].body && uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "zstd", 4)) usv = &usp->variants[3];
+		else if (usp->variants[1].body && uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "gzip", 4)) usv = &usp->variants[1];
+	}
+
+	// the pre-rendered 304
+	if (static_not_modified(wsgi_req, usp->mtime, usv->etag, usv->etag_len)) {
+		if (uwsgi_response_prepare_headers(wsgi_req, "304 Not Modified", 16)) return -1;
+		if (uwsgi_buffer_append(wsgi_req->headers, usv->headers_304, usv->headers_304_len)) {
+			wsgi_req->write_errors++;
+			return -1;
+		}
+		wsgi_req->header_cnt += usv->headers_304_cnt;
+		return uwsgi_response_write_headers_do(wsgi_req);
+	}
+
+	// static file - don't update avg_rt after request
+	wsgi_req->do_not_account_avg_rt = 1;
+
+	if (uwsgi_response_prepare_headers(wsgi_req, "200 OK", 6)) return -1;
+
+#ifdef UWSGI_PCRE
+	uwsgi_add_expires(wsgi_req, usp->filename, usp->filename_len, st);
+	uwsgi_add_expires_path_info(wsgi_req, st);
+	uwsgi_add_expires_uri(wsgi_req, st);
+#endif
+	if (usp->mime_type_size > 0 && usp->mime_type) {
+		uwsgi_add_expires_type(wsgi_req, usp->mime_type, usp->mime_type_size, st);
+	}
+
+	if (uwsgi_buffer_append(wsgi_req->headers, usv->headers, usv->headers_len)) {
+		wsgi_req->write_errors++;
+		return -1;
+	}
+	wsgi_req->header_cnt += usv->headers_cnt;
+
+	uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].static_requests++;
+	wsgi_req->status = 200;
+
+	// if it is a HEAD request just skip transfer
+	if (!uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) return 0;
+
+	// headers and body are sent with a single writev()
+	uwsgi_response_write_body_do(wsgi_req, usv->body, usv->len);
+	return 0;
+}
+
+/*
+
+	multiple ranges (multipart/byteranges)
+
+	with --honour-range a Range header with more than one range gets a multipart/byteranges response:
+	the part headers (boundary, Content-Type and Content-Range) are built in a single buffer and written
+	between the sendfile() of each segment, so the file data is never copied.
+	Up to UWSGI_STATIC_RANGES_MAX ranges are honoured (more ranges, or a malformed header, get the whole file)
+
+*/
+
+#define UWSGI_STATIC_RANGES_MAX 16
+
+// returns the number of satisfiable ranges (-1 if the header has to be ignored)
+static int static_parse_ranges(char *buf, uint16_t len, int64_t size, int64_t *froms, int64_t *tos) {
+	if (len < 6 || memcmp(buf, "bytes=", 6)) return -1;
+	char *ptr = buf + 6;
+	char *end = buf + len;
+	int cnt = 0;
+	while (ptr < end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t')) ptr++;
+		char *spec = ptr;
+		while (ptr < end && *ptr != ',') ptr++;
+		char *spec_end = ptr;
+		if (ptr < end) ptr++;
+		while (spec_end > spec && (spec_end[-1] == ' ' || spec_end[-1] == '\t')) spec_end--;
+		// empty elements are allowed
+		if (spec == spec_end) continue;
+
+		char *dash = memchr(spec, '-', spec_end - spec);
+		if (!dash) return -1;
+		int64_t from, to;
+		if (dash == spec) {
+			// suffix range (bytes=-N)
+			if (dash + 1 == spec_end) return -1;
+			int64_t n = uwsgi_str_num(dash + 1, spec_end - (dash + 1));
+			if (n <= 0 || size == 0) continue;
+			from = n > size ? 0 : size - n;
+			to = size - 1;
+		}
+		else {
+			from = uwsgi_str_num(spec, dash - spec);
+			to = size - 1;
+			if (dash + 1 < spec_end) {
+				to = uwsgi_str_num(dash + 1, spec_end - (dash + 1));
+				if (to < from) return -1;
+				if (to > size - 1) to = size - 1;
+			}
+			// unsatisfiable
+			if (from >= size) continue;
+		}
+		if (cnt >= UWSGI_STATIC_RANGES_MAX) return -1;
+		froms[cnt] = from;
+		tos[cnt] = to;
+		cnt++;
+	}
+	return cnt;
+}
+
+// build the part headers (and the closing boundary), offsets[i] is the start of the header of part i
+static struct uwsgi_buffer *static_ranges_parts(char *boundary, int boundary_len, char *mime_type, size_t mime_type_size, int64_t size, int64_t *froms, int64_t *tos, int cnt, size_t *offsets, uint64_t *cl) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	*cl = 0;
+	int i;
+	for (i = 0; i < cnt; i++) {
+		offsets[i] = ub->pos;
+		if (i > 0 && uwsgi_buffer_append(ub, "\r\n", 2)) goto error;
+		if (uwsgi_buffer_append(ub, "--", 2)) goto error;
+		if (uwsgi_buffer_append(ub, boundary, boundary_len)) goto error;
+		if (uwsgi_buffer_append(ub, "\r\n", 2)) goto error;
+		if (mime_type_size > 0 && mime_type) {
+			if (uwsgi_buffer_append(ub, "Content-Type: ", 14)) goto error;
+			if (uwsgi_buffer_append(ub, mime_type, mime_type_size)) goto error;
+			if (uwsgi_buffer_append(ub, "\r\n", 2)) goto error;
+		}
+		if (uwsgi_buffer_append(ub, "Content-Range: bytes ", 21)) goto error;
+		if (uwsgi_buffer_num64(ub, froms[i])) goto error;
+		if (uwsgi_buffer_append(ub, "-", 1)) goto error;
+		if (uwsgi_buffer_num64(ub, tos[i])) goto error;
+		if (uwsgi_buffer_append(ub, "/", 1)) goto error;
+		if (uwsgi_buffer_num64(ub, size)) goto error;
+		if (uwsgi_buffer_append(ub, "\r\n\r\n", 4)) goto error;
+		*cl += (tos[i] - froms[i]) + 1;
+	}
+	offsets[cnt] = ub->pos;
+	if (uwsgi_buffer_append(ub, "\r\n--", 4)) goto error;
+	if (uwsgi_buffer_append(ub, boundary, boundary_len)) goto error;
+	if (uwsgi_buffer_append(ub, "--\r\n", 4)) goto error;
+	*cl += ub->pos;
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+static void static_ranges_send(struct wsgi_request *wsgi_req, int fd, struct uwsgi_buffer *parts, size_t *offsets, int64_t *froms, int64_t *tos, int cnt) {
+	wsgi_req->no_sendfile_offload = 1;
+	int i;
+	for (i = 0; i < cnt; i++) {
+		if (uwsgi_response_write_body_do(wsgi_req, parts->buf + offsets[i], offsets[i + 1] - offsets[i])) return;
+		if (uwsgi_response_sendfile_do_can_close(wsgi_req, fd, froms[i], (tos[i] - froms[i]) + 1, 0)) return;
+	}
+	uwsgi_response_write_body_do(wsgi_req, parts->buf + offsets[cnt], parts->pos - offsets[cnt]);
+}
+
+static int static_file_serve(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st, struct uwsgi_static_fd *usf) {
 
 	size_t mime_type_size = 0;
 	char http_last_modified[49];
+	char etag[64];
+	int etag_len = 0;
 	int use_gzip = 0;
 
-	char *mime_type = uwsgi_get_mime_type(real_filename, real_filename_len, &mime_type_size);
+	if (static_pins) {
+		struct uwsgi_static_pin *usp = static_pin_get(wsgi_req, real_filename, real_filename_len, st);
+		if (usp) return static_pin_serve(wsgi_req, usp, st);
+	}
+
+	char *mime_type = NULL;
+	if (usf) {
+		mime_type = usf->mime_type;
+		mime_type_size = usf->mime_type_size;
+	}
+	else {
+		mime_type = uwsgi_get_mime_type(real_filename, real_filename_len, &mime_type_size);
+	}
 
 	// here we need to choose if we want the gzip variant;
 	use_gzip = uwsgi_static_want_gzip(wsgi_req, real_filename, &real_filename_len, st);
 
-	if (wsgi_req->if_modified_since_len) {
-		time_t ims = parse_http_date(wsgi_req->if_modified_since, wsgi_req->if_modified_since_len);
-		if (st->st_mtime <= ims) {
-			if (uwsgi_response_prepare_headers(wsgi_req, "304 Not Modified", 16))
-				return -1;
-			return uwsgi_response_write_headers_do(wsgi_req);
-		}
+	if (uwsgi.static_etag) etag_len = uwsgi_static_etag(st, NULL, etag);
+
+	if (static_not_modified(wsgi_req, st->st_mtime, etag, etag_len)) {
+		if (uwsgi_response_prepare_headers(wsgi_req, "304 Not Modified", 16))
+			return -1;
+		if (etag_len && uwsgi_response_add_header(wsgi_req, "ETag", 4, etag, etag_len)) return -1;
+		return uwsgi_response_write_headers_do(wsgi_req);
 	}
 #ifdef UWSGI_DEBUG
 	uwsgi_log("[uwsgi-fileserve] file %s found, mimetype %s\n", real_filename, mime_type);
@@ -485,6 +1128,27 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 
 	int64_t fsize = (int64_t)st->st_size;
 	uwsgi_request_fix_range_for_size(wsgi_req, fsize);
+
+	int64_t ranges_from[UWSGI_STATIC_RANGES_MAX];
+	int64_t ranges_to[UWSGI_STATIC_RANGES_MAX];
+	int ranges_cnt = 0;
+	// multiple ranges are only sent directly by uWSGI
+	if (uwsgi.file_serve_mode == 0 && wsgi_req->range_len > 0 && memchr(wsgi_req->range, ',', wsgi_req->range_len)) {
+		ranges_cnt = static_parse_ranges(wsgi_req->range, wsgi_req->range_len, fsize, ranges_from, ranges_to);
+		if (ranges_cnt < 0) {
+			wsgi_req->range_parsed = UWSGI_RANGE_NOT_PARSED;
+		}
+		else if (ranges_cnt == 0) {
+			wsgi_req->range_parsed = UWSGI_RANGE_INVALID;
+		}
+		else {
+			wsgi_req->range_parsed = UWSGI_RANGE_PARSED;
+			wsgi_req->range_from = ranges_from[0];
+			wsgi_req->range_to = ranges_to[0];
+			uwsgi_request_fix_range_for_size(wsgi_req, fsize);
+		}
+		if (ranges_cnt < 2) ranges_cnt = 0;
+	}
 	switch (wsgi_req->range_parsed) {
 	case UWSGI_RANGE_INVALID:
 		if (uwsgi_response_prepare_headers(wsgi_req,
@@ -497,7 +1161,11 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 			time_t when = 0;
 			if (wsgi_req->if_range != NULL) {
 				when = parse_http_date(wsgi_req->if_range, wsgi_req->if_range_len);
-				// an ETag will result in when == 0
+				// an ETag will result in when == 0, a not matching one forces the whole file
+				if (etag_len && wsgi_req->if_range_len > 0 && wsgi_req->if_range[0] == '"'
+					&& uwsgi_strncmp(wsgi_req->if_range, wsgi_req->if_range_len, etag, etag_len)) {
+					when = st->st_mtime;
+				}
 			}
 		
 			if (when < st->st_mtime) {
@@ -508,6 +1176,7 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 		}
 		/* fallthrough */
 	default: /* UWSGI_RANGE_NOT_PARSED */
+		ranges_cnt = 0;
 		if (uwsgi_response_prepare_headers(wsgi_req, "200 OK", 6)) return -1;
 	}
 
@@ -521,15 +1190,21 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 		if (uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "gzip", 4)) return -1;
 	} else if (use_gzip == 2) {
 		if (uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "br", 2)) return -1;
-    }
+	} else if (use_gzip == 3) {
+		if (uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "zstd", 4)) return -1;
+	}
 
-	// Content-Type (if available)
+	// Content-Type (if available), multiple ranges have it in each part
 	if (mime_type_size > 0 && mime_type) {
-		if (uwsgi_response_add_content_type(wsgi_req, mime_type, mime_type_size)) return -1;
+		if (!ranges_cnt && uwsgi_response_add_content_type(wsgi_req, mime_type, mime_type_size)) return -1;
 		// check for content-type related headers
 		uwsgi_add_expires_type(wsgi_req, mime_type, mime_type_size, st);
 	}
 
+	if (etag_len) {
+		if (uwsgi_response_add_header(wsgi_req, "ETag", 4, etag, etag_len)) return -1;
+	}
+
 	// increase static requests counter
 	uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].static_requests++;
 
@@ -547,6 +1222,39 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 		int size = uwsgi_http_date(st->st_mtime, http_last_modified);
 		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, size)) return -1;
 	}
+	// multiple ranges
+	else if (ranges_cnt) {
+		char boundary[25];
+		int boundary_len = snprintf(boundary, sizeof(boundary), "%016llx%08x", (unsigned long long) uwsgi_micros(), (unsigned int) (st->st_ino ^ wsgi_req->async_id));
+		size_t offsets[UWSGI_STATIC_RANGES_MAX + 1];
+		uint64_t cl = 0;
+		struct uwsgi_buffer *parts = static_ranges_parts(boundary, boundary_len, mime_type, mime_type_size, st->st_size, ranges_from, ranges_to, ranges_cnt, offsets, &cl);
+		if (!parts) return -1;
+		char *ctype = uwsgi_concat2n("multipart/byteranges; boundary=", 31, boundary, boundary_len);
+		int ret = uwsgi_response_add_content_type(wsgi_req, ctype, 31 + boundary_len);
+		free(ctype);
+		if (ret || uwsgi_response_add_content_length(wsgi_req, cl)) goto rerror;
+		int size = uwsgi_http_date(st->st_mtime, http_last_modified);
+		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, size)) goto rerror;
+
+		if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) {
+			if (usf && !use_gzip) {
+				static_ranges_send(wsgi_req, usf->fd, parts, offsets, ranges_from, ranges_to, ranges_cnt);
+			}
+			else {
+				int fd = open(real_filename, O_RDONLY);
+				if (fd < 0) goto rerror;
+				static_ranges_send(wsgi_req, fd, parts, offsets, ranges_from, ranges_to, ranges_cnt);
+				close(fd);
+			}
+		}
+		uwsgi_buffer_destroy(parts);
+		wsgi_req->status = 206;
+		return 0;
+rerror:
+		uwsgi_buffer_destroy(parts);
+		return -1;
+	}
 	// raw
 	else {
 		// set Content-Length (to fsize NOT st->st_size)
@@ -566,16 +1274,63 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 
 		// Ok, the file must be transferred from uWSGI
 		// offloading will be automatically managed
-		int fd = open(real_filename, O_RDONLY);
-		if (fd < 0) return -1;
-		// fd will be closed in the following function
-		uwsgi_response_sendfile_do(wsgi_req, fd, wsgi_req->range_from, fsize);
+		if (usf && !use_gzip) {
+			// the cached fd is not closed
+			uwsgi_response_sendfile_do_can_close(wsgi_req, usf->fd, wsgi_req->range_from, fsize, 0);
+		}
+		else {
+			int fd = open(real_filename, O_RDONLY);
+			if (fd < 0) return -1;
+			// fd will be closed in the following function
+			uwsgi_response_sendfile_do(wsgi_req, fd, wsgi_req->range_from, fsize);
+		}
 	}
 
 	wsgi_req->status = 200;
 	return 0;
 }
 
+int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st) {
+	return static_file_serve(wsgi_req, real_filename, real_filename_len, st, NULL);
+}
+
+// the file has been found (and it is safe to serve it)
+static int static_file_found(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st, struct uwsgi_string_list *index, struct uwsgi_static_fd *usf) {
+
+	if (index) {
+		// if we are here the PATH_INFO need to be changed
+		if (uwsgi_req_append_path_info_with_index(wsgi_req, index->value, index->len)) {
+			return -1;
+		}
+	}
+
+	// skip methods other than GET and HEAD
+	if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "GET", 3) && uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) {
+		return -1;
+	}
+
+	// check for skippable ext
+	struct uwsgi_string_list *sse = uwsgi.static_skip_ext;
+	while (sse) {
+		if (real_filename_len >= sse->len) {
+			if (!uwsgi_strncmp(real_filename + (real_filename_len - sse->len), sse->len, sse->value, sse->len)) {
+				return -1;
+			}
+		}
+		sse = sse->next;
+	}
+
+#ifdef UWSGI_ROUTING
+	// before sending the file, we need to check if some rule applies
+	if (!wsgi_req->is_routing && uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0) == UWSGI_ROUTE_BREAK) {
+		return 0;
+	}
+	wsgi_req->routes_applied = 1;
+#endif
+
+	return static_file_serve(wsgi_req, real_filename, real_filename_len, st, usf);
+}
+
 
 int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_t document_root_len, char *path_info, uint16_t path_info_len, int is_a_file) {
 
@@ -600,18 +1355,30 @@ int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_
 	uwsgi_log("[uwsgi-fileserve] checking for %s\n", filename);
 #endif
 
+	if (uwsgi.static_fd_cache > 0) {
+		struct uwsgi_static_fd *usf = static_fd_cache_get(wsgi_req, filename, filename_len);
+		if (usf) {
+			free(filename);
+			// the gzip lookup could change the name and the stat() of the file
+			memcpy(real_filename, usf->real_filename, usf->real_filename_len + 1);
+			memcpy(&st, &usf->st, sizeof(struct stat));
+			return static_file_found(wsgi_req, real_filename, usf->real_filename_len, &st, usf->index, usf);
+		}
+	}
+
 	if (uwsgi.static_cache_paths) {
-		uwsgi_rlock(uwsgi.static_cache_paths->lock);
+		struct uwsgi_cache *ucs = uwsgi_cache_shard(uwsgi.static_cache_paths, filename, filename_len);
+		uwsgi_rlock(ucs->lock);
 		uint64_t item_len;
-		char *item = uwsgi_cache_get2(uwsgi.static_cache_paths, filename, filename_len, &item_len);
+		char *item = uwsgi_cache_get2(ucs, filename, filename_len, &item_len);
 		if (item && item_len > 0 && item_len <= PATH_MAX) {
 			memcpy(real_filename, item, item_len);
 			real_filename_len = item_len;
 			real_filename[real_filename_len] = 0;
-			uwsgi_rwunlock(uwsgi.static_cache_paths->lock);
+			uwsgi_rwunlock(ucs->lock);
 			goto found;
 		}
-		uwsgi_rwunlock(uwsgi.static_cache_paths->lock);
+		uwsgi_rwunlock(ucs->lock);
 	}
 
 	if (!realpath(filename, real_filename)) {
@@ -624,13 +1391,13 @@ int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_
 	real_filename_len = strlen(real_filename);
 
 	if (uwsgi.static_cache_paths) {
-		uwsgi_wlock(uwsgi.static_cache_paths->lock);
-		uwsgi_cache_set2(uwsgi.static_cache_paths, filename, filename_len, real_filename, real_filename_len, uwsgi.use_static_cache_paths, UWSGI_CACHE_FLAG_UPDATE);
-		uwsgi_rwunlock(uwsgi.static_cache_paths->lock);
+		struct uwsgi_cache *ucs = uwsgi_cache_shard(uwsgi.static_cache_paths, filename, filename_len);
+		uwsgi_wlock(ucs->lock);
+		uwsgi_cache_set2(ucs, filename, filename_len, real_filename, real_filename_len, uwsgi.use_static_cache_paths, UWSGI_CACHE_FLAG_UPDATE);
+		uwsgi_rwunlock(ucs->lock);
 	}
 
 found:
-	free(filename);
 
 	if (uwsgi_starts_with(real_filename, real_filename_len, document_root, document_root_len)) {
 		struct uwsgi_string_list *safe = uwsgi.static_safe;
@@ -641,47 +1408,22 @@ found:
 			safe = safe->next;
 		}
 		uwsgi_log("[uwsgi-fileserve] security error: %s is not under %.*s or a safe path\n", real_filename, document_root_len, document_root);
+		free(filename);
 		return -1;
 	}
 
 safe:
 
 	if (!uwsgi_static_stat(wsgi_req, real_filename, &real_filename_len, &st, &index)) {
-
-		if (index) {
-			// if we are here the PATH_INFO need to be changed
-			if (uwsgi_req_append_path_info_with_index(wsgi_req, index->value, index->len)) {
-				return -1;
-			}
+		struct uwsgi_static_fd *usf = NULL;
+		if (uwsgi.static_fd_cache > 0) {
+			usf = static_fd_cache_set(wsgi_req, filename, filename_len, real_filename, real_filename_len, &st, index);
 		}
-
-		// skip methods other than GET and HEAD
-		if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "GET", 3) && uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) {
-			return -1;
-		}
-
-		// check for skippable ext
-		struct uwsgi_string_list *sse = uwsgi.static_skip_ext;
-		while (sse) {
-			if (real_filename_len >= sse->len) {
-				if (!uwsgi_strncmp(real_filename + (real_filename_len - sse->len), sse->len, sse->value, sse->len)) {
-					return -1;
-				}
-			}
-			sse = sse->next;
-		}
-
-#ifdef UWSGI_ROUTING
-		// before sending the file, we need to check if some rule applies
-		if (!wsgi_req->is_routing && uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0) == UWSGI_ROUTE_BREAK) {
-			return 0;
-		}
-		wsgi_req->routes_applied = 1;
-#endif
-
-		return uwsgi_real_file_serve(wsgi_req, real_filename, real_filename_len, &st);
+		free(filename);
+		return static_file_found(wsgi_req, real_filename, real_filename_len, &st, index, usf);
 	}
 
+	free(filename);
 	return -1;
 
 }
@@ -1,6 +1,9 @@
 #include "uwsgi.h"
 /*
 	utility functions for fast generating json output for the stats subsystem
+
+	the document is streamed in a single growing memory area: keys and values are
+	memcpy()'ed and numbers are converted in place, no printf-family function is involved
 */
 
 extern struct uwsgi_server uwsgi;
@@ -22,21 +25,61 @@ struct uwsgi_stats *uwsgi_stats_new(size_t chunk_size) {
 	return us;
 }
 
-int uwsgi_stats_symbol(struct uwsgi_stats *us, char sym) {
+// make room for len more bytes
+static int uwsgi_stats_ensure(struct uwsgi_stats *us, size_t len) {
+	size_t needed = us->pos + len;
+	if (needed <= us->size)
+		return 0;
+	size_t new_size = us->size + us->chunk;
+	if (new_size < needed)
+		new_size = needed + us->chunk;
+	char *new_base = realloc(us->base, new_size);
+	if (!new_base)
+		return -1;
+	us->base = new_base;
+	us->size = new_size;
+	return 0;
+}
+
+static int uwsgi_stats_append(struct uwsgi_stats *us, char *buf, size_t len) {
+	if (uwsgi_stats_ensure(us, len))
+		return -1;
+	memcpy(us->base + us->pos, buf, len);
+	us->pos += len;
+	return 0;
+}
+
+// "key":
+static int uwsgi_stats_append_key(struct uwsgi_stats *us, char *key) {
+	size_t len = strlen(key);
+	if (uwsgi_stats_ensure(us, len + 3))
+		return -1;
 	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
+	*ptr++ = '"';
+	memcpy(ptr, key, len);
+	ptr += len;
+	*ptr++ = '"';
+	*ptr++ = ':';
+	us->pos += len + 3;
+	return 0;
+}
 
-	if (ptr + 1 > watermark) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-	}
+static int uwsgi_stats_append_num(struct uwsgi_stats *us, unsigned long long num, int negative) {
+	char buf[sizeof(UMAX64_STR) + 1];
+	char *ptr = buf + sizeof(buf);
+	do {
+		*--ptr = '0' + (num % 10);
+		num /= 10;
+	} while (num);
+	if (negative)
+		*--ptr = '-';
+	return uwsgi_stats_append(us, ptr, (buf + sizeof(buf)) - ptr);
+}
 
-	*ptr = sym;
-	us->pos++;
+int uwsgi_stats_symbol(struct uwsgi_stats *us, char sym) {
+	if (uwsgi_stats_ensure(us, 1))
+		return -1;
+	us->base[us->pos++] = sym;
 	return 0;
 }
 
@@ -57,11 +100,10 @@ int uwsgi_stats_comma(struct uwsgi_stats *us) {
 int uwsgi_stats_apply_tabs(struct uwsgi_stats *us) {
 	if (us->minified)
 		return 0;
-	size_t i;
-	for (i = 0; i < us->tabs; i++) {
-		if (uwsgi_stats_symbol(us, '\t'))
-			return -1;
-	};
+	if (uwsgi_stats_ensure(us, us->tabs))
+		return -1;
+	memset(us->base + us->pos, '\t', us->tabs);
+	us->pos += us->tabs;
 	return 0;
 }
 
@@ -102,34 +144,11 @@ int uwsgi_stats_list_close(struct uwsgi_stats *us) {
 }
 
 int uwsgi_stats_keyval(struct uwsgi_stats *us, char *key, char *value) {
-
 	if (uwsgi_stats_apply_tabs(us))
 		return -1;
-
-	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
-	size_t available = watermark - ptr;
-
-	int ret = snprintf(ptr, available, "\"%s\":\"%s\"", key, value);
-	if (ret <= 0)
+	if (uwsgi_stats_append_key(us, key))
 		return -1;
-	while (ret >= (int) available) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-		watermark = us->base + us->size;
-		available = watermark - ptr;
-		ret = snprintf(ptr, available, "\"%s\":\"%s\"", key, value);
-		if (ret <= 0)
-			return -1;
-	}
-
-	us->pos += ret;
-	return 0;
-
+	return uwsgi_stats_str(us, value);
 }
 
 int uwsgi_stats_keyval_comma(struct uwsgi_stats *us, char *key, char *value) {
@@ -140,34 +159,17 @@ int uwsgi_stats_keyval_comma(struct uwsgi_stats *us, char *key, char *value) {
 }
 
 int uwsgi_stats_keyvalnum(struct uwsgi_stats *us, char *key, char *value, unsigned long long num) {
-
 	if (uwsgi_stats_apply_tabs(us))
 		return -1;
-
-	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
-	size_t available = watermark - ptr;
-
-	int ret = snprintf(ptr, available, "\"%s\":\"%s%llu\"", key, value, num);
-	if (ret <= 0)
+	if (uwsgi_stats_append_key(us, key))
 		return -1;
-	while (ret >= (int) available) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-		watermark = us->base + us->size;
-		available = watermark - ptr;
-		ret = snprintf(ptr, available, "\"%s\":\"%s%llu\"", key, value, num);
-		if (ret <= 0)
-			return -1;
-	}
-
-	us->pos += ret;
-	return 0;
-
+	if (uwsgi_stats_symbol(us, '"'))
+		return -1;
+	if (uwsgi_stats_append(us, value, strlen(value)))
+		return -1;
+	if (uwsgi_stats_append_num(us, num, 0))
+		return -1;
+	return uwsgi_stats_symbol(us, '"');
 }
 
 int uwsgi_stats_keyvalnum_comma(struct uwsgi_stats *us, char *key, char *value, unsigned long long num) {
@@ -179,34 +181,20 @@ int uwsgi_stats_keyvalnum_comma(struct uwsgi_stats *us, char *key, char *value,
 
 
 int uwsgi_stats_keyvaln(struct uwsgi_stats *us, char *key, char *value, int vallen) {
-
 	if (uwsgi_stats_apply_tabs(us))
 		return -1;
-
-	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
-	size_t available = watermark - ptr;
-
-	int ret = snprintf(ptr, available, "\"%s\":\"%.*s\"", key, vallen, value);
-	if (ret <= 0)
+	if (uwsgi_stats_append_key(us, key))
 		return -1;
-	while (ret >= (int) available) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-		watermark = us->base + us->size;
-		available = watermark - ptr;
-		ret = snprintf(ptr, available, "\"%s\":\"%.*s\"", key, vallen, value);
-		if (ret <= 0)
-			return -1;
-	}
-
-	us->pos += ret;
+	// as with "%.*s", stop at the first NUL
+	size_t len = vallen < 0 ? strlen(value) : strnlen(value, vallen);
+	if (uwsgi_stats_ensure(us, len + 2))
+		return -1;
+	char *ptr = us->base + us->pos;
+	*ptr++ = '"';
+	memcpy(ptr, value, len);
+	ptr[len] = '"';
+	us->pos += len + 2;
 	return 0;
-
 }
 
 int uwsgi_stats_keyvaln_comma(struct uwsgi_stats *us, char *key, char *value, int vallen) {
@@ -218,93 +206,42 @@ int uwsgi_stats_keyvaln_comma(struct uwsgi_stats *us, char *key, char *value, in
 
 
 int uwsgi_stats_key(struct uwsgi_stats *us, char *key) {
-
 	if (uwsgi_stats_apply_tabs(us))
 		return -1;
-
-	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
-	size_t available = watermark - ptr;
-
-	int ret = snprintf(ptr, available, "\"%s\":", key);
-	if (ret <= 0)
-		return -1;
-	while (ret >= (int) available) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-		watermark = us->base + us->size;
-		available = watermark - ptr;
-		ret = snprintf(ptr, available, "\"%s\":", key);
-		if (ret <= 0)
-			return -1;
-	}
-
-	us->pos += ret;
-	return 0;
+	return uwsgi_stats_append_key(us, key);
 }
 
 int uwsgi_stats_str(struct uwsgi_stats *us, char *str) {
-
+	size_t len = strlen(str);
+	if (uwsgi_stats_ensure(us, len + 2))
+		return -1;
 	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
-	size_t available = watermark - ptr;
+	*ptr++ = '"';
+	memcpy(ptr, str, len);
+	ptr[len] = '"';
+	us->pos += len + 2;
+	return 0;
+}
 
-	int ret = snprintf(ptr, available, "\"%s\"", str);
-	if (ret <= 0)
+// a json-escaped string
+int uwsgi_stats_strn_json(struct uwsgi_stats *us, char *str, size_t len) {
+	if (uwsgi_stats_ensure(us, (len * 2) + 2))
 		return -1;
-	while (ret >= (int) available) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-		watermark = us->base + us->size;
-		available = watermark - ptr;
-		ret = snprintf(ptr, available, "\"%s\"", str);
-		if (ret <= 0)
-			return -1;
-	}
-
-	us->pos += ret;
+	char *ptr = us->base + us->pos;
+	*ptr++ = '"';
+	ptr += uwsgi_json_escape(ptr, str, len);
+	*ptr++ = '"';
+	us->pos = ptr - us->base;
 	return 0;
 }
 
 
-
-
 int uwsgi_stats_keylong(struct uwsgi_stats *us, char *key, unsigned long long num) {
-
 	if (uwsgi_stats_apply_tabs(us))
 		return -1;
-
-	char *ptr = us->base + us->pos;
-	char *watermark = us->base + us->size;
-	size_t available = watermark - ptr;
-
-	int ret = snprintf(ptr, available, "\"%s\":%llu", key, num);
-	if (ret <= 0)
+	if (uwsgi_stats_append_key(us, key))
 		return -1;
-	while (ret >= (int) available) {
-		char *new_base = realloc(us->base, us->size + us->chunk);
-		if (!new_base)
-			return -1;
-		us->base = new_base;
-		us->size += us->chunk;
-		ptr = us->base + us->pos;
-		watermark = us->base + us->size;
-		available = watermark - ptr;
-		ret = snprintf(ptr, available, "\"%s\":%llu", key, num);
-		if (ret <= 0)
-			return -1;
-	}
-
-	us->pos += ret;
-	return 0;
+	return uwsgi_stats_append_num(us, num, 0);
 }
 
 
@@ -316,33 +253,13 @@ int uwsgi_stats_keylong_comma(struct uwsgi_stats *us, char *key, unsigned long l
 }
 
 int uwsgi_stats_keyslong(struct uwsgi_stats *us, char *key, long long num) {
-
         if (uwsgi_stats_apply_tabs(us))
                 return -1;
-
-        char *ptr = us->base + us->pos;
-        char *watermark = us->base + us->size;
-        size_t available = watermark - ptr;
-
-        int ret = snprintf(ptr, available, "\"%s\":%lld", key, num);
-        if (ret <= 0)
+        if (uwsgi_stats_append_key(us, key))
                 return -1;
-        while (ret >= (int) available) {
-                char *new_base = realloc(us->base, us->size + us->chunk);
-                if (!new_base)
-                        return -1;
-                us->base = new_base;
-                us->size += us->chunk;
-                ptr = us->base + us->pos;
-                watermark = us->base + us->size;
-                available = watermark - ptr;
-                ret = snprintf(ptr, available, "\"%s\":%lld", key, num);
-                if (ret <= 0)
-                        return -1;
-        }
-
-        us->pos += ret;
-        return 0;
+        if (num < 0)
+                return uwsgi_stats_append_num(us, 0ULL - (unsigned long long) num, 1);
+        return uwsgi_stats_append_num(us, num, 0);
 }
 
 
@@ -402,6 +319,122 @@ end:
 	close(client_fd);
 }
 
+/*
+	stats snapshot (--stats-snapshot)
+
+	the master regenerates the document every N seconds and serves it as-is. A new document only
+	replaces the current one (bumping the sequence) when its content changed, so --stats-http clients
+	can ask for "/?since=<seq>" (the sequence is in the X-uWSGI-Stats-Seq header) and get an empty
+	304 response when nothing changed.
+*/
+
+static struct uwsgi_stats *stats_snapshot;
+static uint64_t stats_snapshot_seq;
+
+void uwsgi_stats_snapshot_refresh(struct uwsgi_stats *(*func) (void)) {
+	struct uwsgi_stats *us = func();
+	if (!us) return;
+	if (stats_snapshot && stats_snapshot->pos == us->pos && !memcmp(stats_snapshot->base, us->base, us->pos)) {
+		free(us->base);
+		free(us);
+		return;
+	}
+	// swap the buffers
+	struct uwsgi_stats *old = stats_snapshot;
+	stats_snapshot = us;
+	stats_snapshot_seq++;
+	if (old) {
+		free(old->base);
+		free(old);
+	}
+}
+
+static int uwsgi_stats_snapshot_http(int fd) {
+	char buf[4096];
+	int ret = uwsgi_waitfd(fd, uwsgi.socket_timeout);
+	if (ret <= 0) return -1;
+	ssize_t len = read(fd, buf, 4095);
+	if (len <= 0) return -1;
+	buf[len] = 0;
+
+	int not_modified = 0;
+	// only the request line is checked
+	char *eol = strchr(buf, '\n');
+	if (eol) *eol = 0;
+	char *since = strstr(buf, "since=");
+	if (since && (uint64_t) strtoull(since + 6, NULL, 10) == stats_snapshot_seq) {
+		not_modified = 1;
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	if (not_modified) {
+		if (uwsgi_buffer_append(ub, "HTTP/1.0 304 Not Modified\r\n", 27)) goto error;
+	}
+	else {
+		if (uwsgi_buffer_append(ub, "HTTP/1.0 200 OK\r\n", 17)) goto error;
+		if (uwsgi_buffer_append(ub, "Content-Type: application/json\r\n", 32)) goto error;
+		if (uwsgi_buffer_append(ub, "Content-Length: ", 16)) goto error;
+		if (uwsgi_buffer_num64(ub, stats_snapshot->pos)) goto error;
+		if (uwsgi_buffer_append(ub, "\r\n", 2)) goto error;
+	}
+	if (uwsgi_buffer_append(ub, "Connection: close\r\n", 19)) goto error;
+	if (uwsgi_buffer_append(ub, "Access-Control-Allow-Origin: *\r\n", 32)) goto error;
+	if (uwsgi_buffer_append(ub, "X-uWSGI-Stats-Seq: ", 19)) goto error;
+	if (uwsgi_buffer_num64(ub, stats_snapshot_seq)) goto error;
+	if (uwsgi_buffer_append(ub, "\r\n\r\n", 4)) goto error;
+	if (uwsgi_buffer_send(ub, fd)) goto error;
+	uwsgi_buffer_destroy(ub);
+	return not_modified;
+
+error:
+	uwsgi_buffer_destroy(ub);
+	return -1;
+}
+
+void uwsgi_send_stats_snapshot(int fd, struct uwsgi_stats *(*func) (void)) {
+
+	struct sockaddr_un client_src;
+	socklen_t client_src_len = 0;
+
+	int client_fd = accept(fd, (struct sockaddr *) &client_src, &client_src_len);
+	if (client_fd < 0) {
+		uwsgi_error("accept()");
+		return;
+	}
+
+	// the first request happened before the first refresh
+	if (!stats_snapshot) {
+		uwsgi_stats_snapshot_refresh(func);
+		if (!stats_snapshot) goto end;
+	}
+
+	if (uwsgi.stats_http) {
+		// error or not modified
+		if (uwsgi_stats_snapshot_http(client_fd)) goto end;
+	}
+
+	size_t remains = stats_snapshot->pos;
+	off_t pos = 0;
+	while (remains > 0) {
+		int ret = uwsgi_waitfd_write(client_fd, uwsgi.socket_timeout);
+		if (ret <= 0) {
+			goto end;
+		}
+		ssize_t res = write(client_fd, stats_snapshot->base + pos, remains);
+		if (res <= 0) {
+			if (res < 0) {
+				uwsgi_error("write()");
+			}
+			goto end;
+		}
+		pos += res;
+		remains -= res;
+	}
+
+end:
+	close(client_fd);
+}
+
 struct uwsgi_stats_pusher *uwsgi_stats_pusher_get(char *name) {
 	struct uwsgi_stats_pusher *usp = uwsgi.stats_pushers;
 	while (usp) {
@@ -436,6 +469,78 @@ struct uwsgi_stats_pusher_instance *uwsgi_stats_pusher_add(struct uwsgi_stats_pu
 	return uspi;
 }
 
+/*
+	batching of metrics for raw pushers
+
+	records are joined with newlines in packets of at most "size" bytes, datagrams are sent
+	to "addr", connected sockets are written in non-blocking mode (with the specified timeout)
+*/
+
+struct uwsgi_stats_pusher_batch *uwsgi_stats_pusher_batch_new(int fd, struct sockaddr *addr, socklen_t addr_len, size_t size, int timeout) {
+	struct uwsgi_stats_pusher_batch *upb = uwsgi_calloc(sizeof(struct uwsgi_stats_pusher_batch));
+	upb->fd = fd;
+	upb->addr = addr;
+	upb->addr_len = addr_len;
+	upb->size = size;
+	upb->timeout = timeout;
+	upb->ub = uwsgi_buffer_new(size);
+	return upb;
+}
+
+int uwsgi_stats_pusher_batch_flush(struct uwsgi_stats_pusher_batch *upb) {
+	if (upb->ub->pos == 0) return 0;
+	int ret = 0;
+	if (upb->addr) {
+		if (sendto(upb->fd, upb->ub->buf, upb->ub->pos, 0, upb->addr, upb->addr_len) < 0) {
+			// drop if we were to block
+			if (errno != EAGAIN) {
+				uwsgi_error("uwsgi_stats_pusher_batch_flush()/sendto()");
+				ret = -1;
+			}
+		}
+	}
+	else {
+		if (uwsgi_write_nb(upb->fd, upb->ub->buf, upb->ub->pos, upb->timeout)) {
+			uwsgi_error("uwsgi_stats_pusher_batch_flush()/write()");
+			ret = -1;
+		}
+	}
+	upb->packets++;
+	upb->ub->pos = 0;
+	return ret;
+}
+
+int uwsgi_stats_pusher_batch_add(struct uwsgi_stats_pusher_batch *upb, char *record, size_t len) {
+	// a record bigger than a packet is sent alone
+	if (upb->ub->pos > 0 && upb->ub->pos + len + 1 > upb->size) {
+		if (uwsgi_stats_pusher_batch_flush(upb)) return -1;
+	}
+	if (uwsgi_buffer_append(upb->ub, record, len)) return -1;
+	return uwsgi_buffer_append(upb->ub, "\n", 1);
+}
+
+void uwsgi_stats_pusher_batch_destroy(struct uwsgi_stats_pusher_batch *upb) {
+	uwsgi_buffer_destroy(upb->ub);
+	free(upb);
+}
+
+/*
+	with --stats-push-changed-only, returns 0 if the metric (by position) has the same value
+	of the last push of the instance
+*/
+int uwsgi_stats_pusher_changed(struct uwsgi_stats_pusher_instance *uspi, int pos, int64_t value) {
+	if (!uwsgi.stats_push_changed_only) return 1;
+	if (pos < 0 || (uint64_t) pos >= uwsgi.metrics_cnt) return 1;
+	if (!uspi->last_values) {
+		uspi->last_values = uwsgi_malloc(sizeof(int64_t) * uwsgi.metrics_cnt);
+		uspi->last_pushed = uwsgi_calloc(uwsgi.metrics_cnt);
+	}
+	if (uspi->last_pushed[pos] && uspi->last_values[pos] == value) return 0;
+	uspi->last_values[pos] = value;
+	uspi->last_pushed[pos] = 1;
+	return 1;
+}
+
 void uwsgi_stats_pusher_loop(struct uwsgi_thread *ut) {
 	void *events = event_queue_alloc(1);
 	for (;;) {
@@ -552,15 +657,12 @@ static void stats_dump_var(char *k, uint16_t kl, char *v, uint16_t vl, void *dat
 	struct uwsgi_stats *us = (struct uwsgi_stats *) data;
 	if (us->dirty) return;
 	char *var = uwsgi_concat3n(k, kl, "=", 1, v,vl);
-	char *escaped_var = uwsgi_malloc(((kl+vl+1)*2)+1);
-	escape_json(var, strlen(var), escaped_var);
+	int ret = uwsgi_stats_strn_json(us, var, strlen(var));
 	free(var);
-	if (uwsgi_stats_str(us, escaped_var)) {
+	if (ret) {
 		us->dirty = 1;
-		free(escaped_var);
 		return;
 	}
-	free(escaped_var);
 	if (uwsgi_stats_comma(us)) {
 		us->dirty = 1;
 	}	
@@ -4,11 +4,12 @@
 
 	subscription subsystem
 
-	each subscription slot is as an hashed item in a dictionary
+	each subscription slot is an hashed item in an open addressing (linear probing) table
 
-	each slot has a circular linked list containing the nodes names
+	buckets store the hash of the key, the table doubles when it is 75% full and halves
+	when it is less than 1/8 full (deletions shift back the following buckets, so there are no tombstones)
 
-	the structure and system is very similar to uwsgi_dyn_dict already used by the mime type parser
+	each slot has a linked list containing the nodes names
 
 	This system is not mean to run on shared memory. If you have multiple processes for the same app, you have to create
 	a new subscriptions slot list.
@@ -82,60 +83,112 @@ int uwsgi_subscription_credentials_check(struct uwsgi_subscribe_slot *slot, stru
 	return 0;
 }
 
-struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscribe_slot **slot, char *key, uint16_t keylen) {
-	int retried = 0;
-retry:
+static uint32_t uwsgi_subscription_hash(char *key, uint16_t keylen) {
+	if (uwsgi.subscription_hash) {
+		return uwsgi.subscription_hash->func(key, keylen);
+	}
+	return djb33x_hash(key, keylen);
+}
 
-	if (keylen > 0xff)
-		return NULL;
+// the chash ring references the nodes, so it has to be rebuilt whenever they change
+static void subscription_ring_reset(struct uwsgi_subscribe_slot *slot) {
+	if (slot->ring) {
+		free(slot->ring);
+		slot->ring = NULL;
+	}
+	slot->ring_size = 0;
+}
 
-	uint32_t hash = djb33x_hash(key, keylen);
-	int hash_key = hash % 0xffff;
+#define UWSGI_SUBSCRIPTIONS_MIN_SIZE 64
 
-	struct uwsgi_subscribe_slot *current_slot = slot[hash_key];
+// spread the bits of weak hash functions (like djb33x) before masking them
+static uint64_t subscriptions_bucket(struct uwsgi_subscriptions *ht, uint32_t hash) {
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash & (ht->size - 1);
+}
 
+static void subscriptions_insert(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_slot *slot) {
+	uint64_t i = subscriptions_bucket(ht, slot->hash);
+	while (ht->buckets[i].slot) {
+		i = (i + 1) & (ht->size - 1);
+	}
+	ht->buckets[i].hash = slot->hash;
+	ht->buckets[i].slot = slot;
+}
 
-#ifdef UWSGI_DEBUG
-	uwsgi_log("****************************\n");
-	while (current_slot) {
-		uwsgi_log("slot %.*s %d\n", current_slot->keylen, current_slot->key, current_slot->hits);
-		current_slot = current_slot->next;
+static void subscriptions_resize(struct uwsgi_subscriptions *ht, uint64_t size) {
+	struct uwsgi_subscribe_bucket *buckets = ht->buckets;
+	uint64_t i, old_size = ht->size;
+	ht->buckets = uwsgi_calloc(sizeof(struct uwsgi_subscribe_bucket) * size);
+	ht->size = size;
+	for (i = 0; i < old_size; i++) {
+		if (buckets[i].slot) {
+			subscriptions_insert(ht, buckets[i].slot);
+		}
 	}
-	uwsgi_log("****************************\n");
-	current_slot = slot[hash_key];
-#endif
+	free(buckets);
+}
 
-	while (current_slot) {
-		if (!uwsgi_strncmp(key, keylen, current_slot->key, current_slot->keylen)) {
-			// auto optimization
-			if (current_slot->prev) {
-				if (current_slot->hits > current_slot->prev->hits) {
-					struct uwsgi_subscribe_slot *slot_parent = current_slot->prev->prev, *slot_prev = current_slot->prev;
-					if (slot_parent) {
-						slot_parent->next = current_slot;
-					}
-					else {
-						slot[hash_key] = current_slot;
-					}
+static void subscriptions_delete(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_slot *slot) {
+	uint64_t mask = ht->size - 1;
+	uint64_t i = subscriptions_bucket(ht, slot->hash);
+	while (ht->buckets[i].slot != slot) {
+		if (!ht->buckets[i].slot)
+			return;
+		i = (i + 1) & mask;
+	}
 
-					if (current_slot->next) {
-						current_slot->next->prev = slot_prev;
-					}
+	// move back the items of the cluster that would be unreachable
+	uint64_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!ht->buckets[j].slot)
+			break;
+		uint64_t k = subscriptions_bucket(ht, ht->buckets[j].hash);
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			ht->buckets[i] = ht->buckets[j];
+			i = j;
+		}
+	}
+	ht->buckets[i].slot = NULL;
+	ht->buckets[i].hash = 0;
+	ht->count--;
 
-					slot_prev->prev = current_slot;
-					slot_prev->next = current_slot->next;
+	if (ht->size > UWSGI_SUBSCRIPTIONS_MIN_SIZE && ht->count * 8 < ht->size) {
+		subscriptions_resize(ht, ht->size / 2);
+	}
+}
 
-					current_slot->next = slot_prev;
-					current_slot->prev = slot_parent;
+// iterate the slots (pos must start from 0)
+struct uwsgi_subscribe_slot *uwsgi_subscriptions_next(struct uwsgi_subscriptions *ht, uint64_t *pos) {
+	while (*pos < ht->size) {
+		struct uwsgi_subscribe_slot *slot = ht->buckets[(*pos)++].slot;
+		if (slot)
+			return slot;
+	}
+	return NULL;
+}
 
-				}
-			}
-			return current_slot;
+struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscriptions *ht, char *key, uint16_t keylen) {
+	int retried = 0;
+retry:
+
+	if (keylen > 0xff)
+		return NULL;
+
+	uint32_t hash = uwsgi_subscription_hash(key, keylen);
+	uint64_t i = subscriptions_bucket(ht, hash);
+
+	while (ht->buckets[i].slot) {
+		struct uwsgi_subscribe_bucket *bucket = &ht->buckets[i];
+		if (bucket->hash == hash && bucket->slot->keylen == keylen && !memcmp(bucket->slot->key, key, keylen)) {
+			return bucket->slot;
 		}
-		current_slot = current_slot->next;
-		// check for loopy optimization
-		if (current_slot == slot[hash_key])
-			break;
+		i = (i + 1) & (ht->size - 1);
 	}
 
 	// if we are here and in mountpoints mode, try the domain only variant
@@ -151,7 +204,9 @@ retry:
 	return NULL;
 }
 
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscribe_slot **slot, char *key, uint16_t keylen, struct uwsgi_subscription_client *client) {
+static void subscription_slot_ejections(struct uwsgi_subscribe_slot *);
+
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscriptions *slot, char *key, uint16_t keylen, struct uwsgi_subscription_client *client) {
 
 	if (keylen > 0xff)
 		return NULL;
@@ -160,8 +215,9 @@ struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscribe_slo
 	if (!current_slot)
 		return NULL;
 
-	// slot found, move up in the list increasing hits
 	current_slot->hits++;
+	if (uwsgi.subscription_outlier_failures > 0 || uwsgi.subscription_outlier_latency > 0)
+		subscription_slot_ejections(current_slot);
 	time_t now = uwsgi_now();
 	struct uwsgi_subscribe_node *node = current_slot->nodes;
 	int subscription_age;
@@ -203,7 +259,7 @@ struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscribe_slo
 	return current_slot->algo(current_slot, node, client);
 }
 
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscribe_slot **slot, char *key, uint16_t keylen, char *val, uint16_t vallen) {
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscriptions *slot, char *key, uint16_t keylen, char *val, uint16_t vallen) {
 
 	if (keylen > 0xff)
 		return NULL;
@@ -221,19 +277,14 @@ struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subsc
 	return NULL;
 }
 
-int uwsgi_remove_subscribe_node(struct uwsgi_subscribe_slot **slot, struct uwsgi_subscribe_node *node) {
-
-	int ret = 0;
+int uwsgi_remove_subscribe_node(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_node *node) {
 
 	struct uwsgi_subscribe_node *a_node;
 	struct uwsgi_subscribe_slot *node_slot = node->slot;
-	struct uwsgi_subscribe_slot *prev_slot = node_slot->prev;
-	struct uwsgi_subscribe_slot *next_slot = node_slot->next;
-
-	int hash_key = node_slot->hash;
 
 	// over-engineering to avoid race conditions
 	node->len = 0;
+	subscription_ring_reset(node_slot);
 
 	if (node == node_slot->nodes) {
 		node_slot->nodes = node->next;
@@ -250,54 +301,27 @@ int uwsgi_remove_subscribe_node(struct uwsgi_subscribe_slot **slot, struct uwsgi
 	}
 
 	free(node);
-	// no more nodes, remove the slot too
-	if (node_slot->nodes == NULL) {
 
-		ret = 1;
+	if (node_slot->nodes)
+		return 0;
 
-		// first check if i am the only node
-		if ((!prev_slot && !next_slot) || next_slot == node_slot) {
+	// no more nodes, remove the slot too
+	subscriptions_delete(ht, node_slot);
 #ifdef UWSGI_SSL
-			if (node_slot->sign_ctx) {
-				EVP_PKEY_free(node_slot->sign_public_key);
-				EVP_MD_CTX_destroy(node_slot->sign_ctx);
-			}
+	if (node_slot->sign_ctx) {
+		EVP_PKEY_free(node_slot->sign_public_key);
+		EVP_MD_CTX_destroy(node_slot->sign_ctx);
+	}
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
-			// if there is a SNI context active, destroy it
-			if (node_slot->sni_enabled) {
-				uwsgi_ssl_del_sni_item(node_slot->key, node_slot->keylen);
-			}
+	// if there is a SNI context active, destroy it
+	if (node_slot->sni_enabled) {
+		uwsgi_ssl_del_sni_item(node_slot->key, node_slot->keylen);
+	}
 #endif
 #endif
-			free(node_slot);
-			slot[hash_key] = NULL;
-			goto end;
-		}
-
-		// if i am the main entry point, set the next value
-		if (node_slot == slot[hash_key]) {
-			slot[hash_key] = next_slot;
-		}
-
-		if (prev_slot) {
-			prev_slot->next = next_slot;
-		}
-		if (next_slot) {
-			next_slot->prev = prev_slot;
-		}
-
-#ifdef UWSGI_SSL
-		if (node_slot->sign_ctx) {
-			EVP_PKEY_free(node_slot->sign_public_key);
-			EVP_MD_CTX_destroy(node_slot->sign_ctx);
-		}
-#endif
-		free(node_slot);
-	}
-
-end:
-
-	return ret;
+	subscription_ring_reset(node_slot);
+	free(node_slot);
+	return 1;
 }
 
 #ifdef UWSGI_SSL
@@ -305,9 +329,9 @@ static int subscription_new_sign_ctx(struct uwsgi_subscribe_slot *, struct uwsgi
 static int subscription_is_safe(struct uwsgi_subscribe_req *);
 #endif
 
-struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slot **slot, struct uwsgi_subscribe_req *usr) {
+struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_req *usr) {
 
-	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(slot, usr->key, usr->keylen), *old_slot = NULL, *a_slot;
+	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(ht, usr->key, usr->keylen);
 	struct uwsgi_subscribe_node *node, *old_node = NULL;
 
 	if ((usr->address_len > 0xff || usr->address_len == 0) && (usr->vassal_len > 0xff || usr->vassal_len == 0))
@@ -350,12 +374,14 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 						// record already exists, clear it ?
 						if (usr->clear) {
 							node->len = 0;
+							subscription_ring_reset(current_slot);
 							uwsgi_log("[uwsgi-subscription for pid %d] %.*s => cleared address for vassal node: %.*s (weight: %d, backup: %d)\n", (int) uwsgi.mypid, usr->keylen, usr->key, (int) usr->vassal_len, usr->vassal, usr->weight, usr->backup_level);
 						}
 					}
 					else {
 						memcpy(node->name, usr->address, usr->address_len);
 						node->len = usr->address_len;
+						subscription_ring_reset(current_slot);
 						uwsgi_log("[uwsgi-subscription for pid %d] %.*s => updated vassal node: %.*s with address %.*s (weight: %d, backup: %d)\n", (int) uwsgi.mypid, usr->keylen, usr->key, (int) usr->vassal_len, usr->vassal, (int) usr->address_len, usr->address, usr->weight, usr->backup_level);	
 					}
 				}
@@ -365,6 +391,7 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 				node->last_check = uwsgi_now();
 				node->cores = usr->cores;
 				node->load = usr->load;
+				uint64_t old_weight = node->weight;
 				node->weight = usr->weight;
 				node->backup_level = usr->backup_level;
 				if (usr->proto_len > 0) {
@@ -372,6 +399,8 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 				}	
 				if (!node->weight)
 					node->weight = 1;
+				if (node->weight != old_weight)
+					subscription_ring_reset(current_slot);
 				node->last_requests = 0;
 				return node;
 			}
@@ -410,6 +439,11 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 		if (!node->weight)
 			node->weight = 1;
 		node->wrr = 0;
+		node->latency = 0;
+		node->consecutive_failures = 0;
+		node->ejected_until = 0;
+		node->ejections = 0;
+		node->ejected = 0;
 		node->pid = usr->pid;
 		node->uid = usr->uid;
 		node->gid = usr->gid;
@@ -431,6 +465,7 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 			old_node->next = node;
 		}
 		node->next = NULL;
+		subscription_ring_reset(current_slot);
 
 		uwsgi_log("[uwsgi-subscription for pid %d] %.*s => new node: %.*s (weight: %d, backup: %d)\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->address_len, usr->address, usr->weight, usr->backup_level);
 		if (node->notify[0]) {
@@ -450,9 +485,7 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 			return NULL;
 		}
 #endif
-		uint32_t hash = djb33x_hash(usr->key, usr->keylen);
-		int hash_key = hash % 0xffff;
-		current_slot->hash = hash_key;
+		current_slot->hash = uwsgi_subscription_hash(usr->key, usr->keylen);
 		current_slot->keylen = usr->keylen;
 		memcpy(current_slot->key, usr->key, usr->keylen);
 		if (uwsgi.subscriptions_credentials_check_dir) {
@@ -464,6 +497,9 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 
 		current_slot->key[usr->keylen] = 0;
 		current_slot->hits = 0;
+		current_slot->ring = NULL;
+		current_slot->ring_size = 0;
+		memset(&current_slot->breaker, 0, sizeof(struct uwsgi_subscribe_breaker));
 #ifdef UWSGI_SSL
 		current_slot->sni_enabled = 0;
 		uwsgi_subscription_sni_check(current_slot, usr);
@@ -491,6 +527,11 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 		if (!current_slot->nodes->weight)
 			current_slot->nodes->weight = 1;
 		current_slot->nodes->wrr = 0;
+		current_slot->nodes->latency = 0;
+		current_slot->nodes->consecutive_failures = 0;
+		current_slot->nodes->ejected_until = 0;
+		current_slot->nodes->ejections = 0;
+		current_slot->nodes->ejected = 0;
 		current_slot->nodes->pid = usr->pid;
 		current_slot->nodes->uid = usr->uid;
 		current_slot->nodes->gid = usr->gid;
@@ -508,28 +549,17 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 
 		current_slot->nodes->next = NULL;
 
-		a_slot = slot[hash_key];
-		while (a_slot) {
-			old_slot = a_slot;
-			a_slot = a_slot->next;
-		}
-
-
-		if (old_slot) {
-			old_slot->next = current_slot;
-		}
-
-		current_slot->prev = old_slot;
-		current_slot->next = NULL;
-
 		current_slot->algo = usr->algo;
 		if (!current_slot->algo) current_slot->algo = uwsgi.subscription_algo;
 
-		if (!slot[hash_key] || current_slot->prev == NULL) {
-			slot[hash_key] = current_slot;
+		// keep the load factor under 75%
+		if ((ht->count + 1) * 4 > ht->size * 3) {
+			subscriptions_resize(ht, ht->size * 2);
 		}
+		subscriptions_insert(ht, current_slot);
+		ht->count++;
 
-		uwsgi_log("[uwsgi-subscription for pid %d] new pool: %.*s (hash key: %d, algo: %s)\n", (int) uwsgi.mypid, usr->keylen, usr->key, current_slot->hash, uwsgi_subscription_algo_name(current_slot->algo));
+		uwsgi_log("[uwsgi-subscription for pid %d] new pool: %.*s (hash: %u, algo: %s)\n", (int) uwsgi.mypid, usr->keylen, usr->key, current_slot->hash, uwsgi_subscription_algo_name(current_slot->algo));
 		if (usr->address_len > 0) {
 			uwsgi_log("[uwsgi-subscription for pid %d] %.*s => new node: %.*s (weight: %d, backup: %d)\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->address_len, usr->address, usr->weight, usr->backup_level);
 		}
@@ -548,7 +578,78 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 
 }
 
+static void send_subscription_now(int sfd, char *host, char *message, uint16_t message_size);
+
+/*
+	batched announces
+
+	while uwsgi_subscribe_all() runs with --subscriptions-batch, the packets for the same
+	server are concatenated (each one keeps its uwsgi header) in datagrams of up to
+	UWSGI_SUBSCRIPTION_BATCH_SIZE bytes (the size of the subscription servers receive buffer)
+*/
+#define UWSGI_SUBSCRIPTION_BATCH_SIZE 4096
+
+struct uwsgi_subscription_batch {
+	char *host;
+	struct uwsgi_buffer *ub;
+	struct uwsgi_subscription_batch *next;
+};
+
+static int subscription_batching = 0;
+static struct uwsgi_subscription_batch *subscription_batches = NULL;
+
+static void subscription_batch_flush() {
+	struct uwsgi_subscription_batch *usb = subscription_batches;
+	while (usb) {
+		struct uwsgi_subscription_batch *current = usb;
+		usb = usb->next;
+		if (current->ub->pos > 0) {
+			send_subscription_now(-2, current->host, current->ub->buf, current->ub->pos);
+		}
+		uwsgi_buffer_destroy(current->ub);
+		free(current->host);
+		free(current);
+	}
+	subscription_batches = NULL;
+}
+
+static int subscription_batch_add(char *host, char *message, uint16_t message_size) {
+	if (message_size > UWSGI_SUBSCRIPTION_BATCH_SIZE)
+		return -1;
+	struct uwsgi_subscription_batch *usb = subscription_batches, *last = NULL;
+	while (usb) {
+		if (!strcmp(usb->host, host))
+			break;
+		last = usb;
+		usb = usb->next;
+	}
+	if (!usb) {
+		usb = uwsgi_calloc(sizeof(struct uwsgi_subscription_batch));
+		usb->host = uwsgi_str(host);
+		usb->ub = uwsgi_buffer_new(UWSGI_SUBSCRIPTION_BATCH_SIZE);
+		if (last) {
+			last->next = usb;
+		}
+		else {
+			subscription_batches = usb;
+		}
+	}
+	if (usb->ub->pos + message_size > UWSGI_SUBSCRIPTION_BATCH_SIZE) {
+		send_subscription_now(-2, usb->host, usb->ub->buf, usb->ub->pos);
+		usb->ub->pos = 0;
+	}
+	return uwsgi_buffer_append(usb->ub, message, message_size);
+}
+
 static void send_subscription(int sfd, char *host, char *message, uint16_t message_size) {
+	if (subscription_batching && sfd == -1) {
+		if (!subscription_batch_add(host, message, message_size))
+			return;
+	}
+	send_subscription_now(sfd, host, message, message_size);
+}
+
+static void send_subscription_now(int sfd, char *host, char *message, uint16_t message_size) {
 
 	int fd = sfd;
 	struct sockaddr_in udp_addr;
@@ -820,13 +921,8 @@ int uwsgi_subscription_sign_check(struct uwsgi_subscribe_slot *slot, struct uwsg
 }
 #endif
 
-int uwsgi_no_subscriptions(struct uwsgi_subscribe_slot **slot) {
-	int i;
-	for (i = 0; i < UMAX16; i++) {
-		if (slot[i])
-			return 0;
-	}
-	return 1;
+int uwsgi_no_subscriptions(struct uwsgi_subscriptions *ht) {
+	return ht->count == 0;
 }
 
 void uwsgi_subscribe(char *subscription, uint8_t cmd) {
@@ -1172,6 +1268,7 @@ void uwsgi_subscribe_all(uint8_t cmd, int verbose) {
 
 	if (uwsgi.subscriptions_blocked)
 		return;
+	subscription_batching = uwsgi.subscriptions_batch;
 	// -- subscribe
 	struct uwsgi_string_list *subscriptions = uwsgi.subscriptions;
 	while (subscriptions) {
@@ -1192,6 +1289,85 @@ void uwsgi_subscribe_all(uint8_t cmd, int verbose) {
 		subscriptions = subscriptions->next;
 	}
 
+	if (subscription_batching) {
+		subscription_batch_flush();
+		subscription_batching = 0;
+	}
+}
+
+/*
+	passive health checks
+
+	the routers report the outcome of every request to a node, after
+	--subscription-outlier-failures consecutive failures (or when its latency is
+	--subscription-outlier-latency times the mean of the other nodes) the node is
+	ejected (skipped by the algos) for --subscription-ejection-time milliseconds.
+	If all of the nodes of a slot are ejected they are all used again (fail open).
+*/
+#define subscription_node_usable(x) (!(x)->death_mark && !(x)->ejected)
+
+static void subscription_node_eject(struct uwsgi_subscribe_node *node, char *reason) {
+	node->ejected_until = uwsgi_micros() + ((uint64_t) uwsgi.subscription_ejection_time * 1000);
+	node->ejected = 1;
+	node->ejections++;
+	node->consecutive_failures = 0;
+	uwsgi_log("[uwsgi-subscription for pid %d] %.*s => ejecting %.*s for %d msecs (%s)\n", (int) uwsgi.mypid, node->slot->keylen, node->slot->key, node->len, node->name, uwsgi.subscription_ejection_time, reason);
+}
+
+// the latency average needs some sample before being meaningful
+#define UWSGI_SUBSCRIPTION_OUTLIER_MIN_REQUESTS 16
+
+static int subscription_node_latency_outlier(struct uwsgi_subscribe_node *node) {
+	uint64_t sum = 0, count = 0;
+	if (node->requests < UWSGI_SUBSCRIPTION_OUTLIER_MIN_REQUESTS)
+		return 0;
+	struct uwsgi_subscribe_node *other = node->slot->nodes;
+	while (other) {
+		if (other != node && subscription_node_usable(other) && other->latency && other->requests >= UWSGI_SUBSCRIPTION_OUTLIER_MIN_REQUESTS) {
+			sum += other->latency;
+			count++;
+		}
+		other = other->next;
+	}
+	if (!count)
+		return 0;
+	return node->latency > (sum / count) * (uint64_t) uwsgi.subscription_outlier_latency;
+}
+
+void uwsgi_subscribe_node_report(struct uwsgi_subscribe_node *node, int failed) {
+	if (node->ejected)
+		return;
+	if (failed) {
+		node->consecutive_failures++;
+		if (uwsgi.subscription_outlier_failures > 0 && node->consecutive_failures >= (uint64_t) uwsgi.subscription_outlier_failures) {
+			subscription_node_eject(node, "consecutive failures");
+		}
+		return;
+	}
+	node->consecutive_failures = 0;
+	if (uwsgi.subscription_outlier_latency > 0 && subscription_node_latency_outlier(node)) {
+		subscription_node_eject(node, "latency outlier");
+	}
+}
+
+// refresh the ejection status of the nodes of a slot before running the algo
+static void subscription_slot_ejections(struct uwsgi_subscribe_slot *slot) {
+	uint64_t now = uwsgi_micros();
+	uint64_t usable = 0;
+	struct uwsgi_subscribe_node *node = slot->nodes;
+	while (node) {
+		node->ejected = node->ejected_until > now;
+		if (subscription_node_usable(node))
+			usable++;
+		node = node->next;
+	}
+	if (usable)
+		return;
+	node = slot->nodes;
+	while (node) {
+		node->ejected = 0;
+		node = node->next;
+	}
 }
 
 // iphash
@@ -1207,7 +1383,7 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_iphash(struct uwsgi_
 	// first step is counting the number of nodes
 	node = current_slot->nodes;
 	while(node) {
-		if (!node->death_mark) count++;
+		if (subscription_node_usable(node)) count++;
 		node = node->next;
 	}
 	if (count == 0) return NULL;
@@ -1229,7 +1405,7 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_iphash(struct uwsgi_
         struct uwsgi_subscribe_node *chosen_node = NULL;
         node = current_slot->nodes;
         while (node) {
-                if (!node->death_mark) {
+                if (subscription_node_usable(node)) {
 			if (count == hash) {
 				chosen_node = node;
 				break;
@@ -1246,6 +1422,212 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_iphash(struct uwsgi_
         return chosen_node;
 }
 
+/*
+	consistent hashing (ketama-like ring)
+
+	each node is mapped to 40 points (times its weight, up to 64) on a 32bit ring,
+	the client (its ip or the key passed by the router) is hashed on the same ring and
+	the first live node clockwise is chosen. When a node joins or leaves only the clients
+	mapped to its points are moved.
+
+	The ring is built on the first request and dropped whenever the nodes change.
+*/
+#define UWSGI_SUBSCRIPTION_RING_POINTS 40
+#define UWSGI_SUBSCRIPTION_RING_MAX_WEIGHT 64
+
+static uint32_t subscription_ring_hash(char *buf, size_t len, uint32_t seed) {
+	// fnv1a
+	uint32_t hash = 2166136261U ^ seed;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) buf[i];
+		hash *= 16777619U;
+	}
+	// murmur3 finalizer
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static int subscription_ring_cmp(const void *a, const void *b) {
+	const struct uwsgi_subscribe_point *pa = (const struct uwsgi_subscribe_point *) a;
+	const struct uwsgi_subscribe_point *pb = (const struct uwsgi_subscribe_point *) b;
+	if (pa->hash < pb->hash)
+		return -1;
+	if (pa->hash > pb->hash)
+		return 1;
+	return 0;
+}
+
+static uint64_t subscription_ring_node_points(struct uwsgi_subscribe_node *node) {
+	uint64_t weight = node->weight;
+	if (weight > UWSGI_SUBSCRIPTION_RING_MAX_WEIGHT)
+		weight = UWSGI_SUBSCRIPTION_RING_MAX_WEIGHT;
+	return UWSGI_SUBSCRIPTION_RING_POINTS * weight;
+}
+
+static void subscription_ring_build(struct uwsgi_subscribe_slot *slot) {
+	uint64_t size = 0;
+	struct uwsgi_subscribe_node *node = slot->nodes;
+	while (node) {
+		size += subscription_ring_node_points(node);
+		node = node->next;
+	}
+	if (size == 0)
+		return;
+
+	slot->ring = uwsgi_malloc(sizeof(struct uwsgi_subscribe_point) * size);
+	uint64_t pos = 0;
+	node = slot->nodes;
+	while (node) {
+		// vassal nodes (without an address) are placed by their vassal name
+		char *name = node->len ? node->name : node->vassal;
+		uint16_t name_len = node->len ? node->len : node->vassal_len;
+		uint64_t i, points = subscription_ring_node_points(node);
+		for (i = 0; i < points; i++) {
+			slot->ring[pos].hash = subscription_ring_hash(name, name_len, (uint32_t) i);
+			slot->ring[pos].node = node;
+			pos++;
+		}
+		node = node->next;
+	}
+	qsort(slot->ring, size, sizeof(struct uwsgi_subscribe_point), subscription_ring_cmp);
+	slot->ring_size = size;
+}
+
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_chash(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_node *node, struct uwsgi_subscription_client *client) {
+	// if node is NULL we are in the second step (we do not use the first step)
+	if (node)
+		return NULL;
+
+	if (!client)
+		return NULL;
+
+	uint32_t hash = 0;
+	// the router can pass its own key (e.g. a request header), otherwise the client address is used
+	if (client->cookie && client->cookie_len > 0) {
+		hash = subscription_ring_hash(client->cookie, client->cookie_len, 0);
+	}
+	else if (client->sockaddr && client->sockaddr->sa.sa_family == AF_INET) {
+		hash = subscription_ring_hash((char *) &client->sockaddr->sa_in.sin_addr.s_addr, 4, 0);
+	}
+#ifdef AF_INET6
+	else if (client->sockaddr && client->sockaddr->sa.sa_family == AF_INET6) {
+		hash = subscription_ring_hash((char *) client->sockaddr->sa_in6.sin6_addr.s6_addr, 16, 0);
+	}
+#endif
+	else {
+		return NULL;
+	}
+
+	if (!current_slot->ring) {
+		subscription_ring_build(current_slot);
+		if (!current_slot->ring)
+			return NULL;
+	}
+
+	// the first point >= hash
+	uint64_t low = 0, high = current_slot->ring_size;
+	while (low < high) {
+		uint64_t mid = low + ((high - low) / 2);
+		if (current_slot->ring[mid].hash < hash) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+
+	// walk clockwise skipping dead nodes
+	uint64_t i;
+	for (i = 0; i < current_slot->ring_size; i++) {
+		struct uwsgi_subscribe_node *chosen_node = current_slot->ring[(low + i) % current_slot->ring_size].node;
+		if (subscription_node_usable(chosen_node)) {
+			chosen_node->reference++;
+			return chosen_node;
+		}
+	}
+
+	return NULL;
+}
+
+// power of two choices, the best of two random nodes by (latency * in-flight requests)
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_p2c(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_node *node, struct uwsgi_subscription_client *client) {
+	uint64_t backup_level = 0;
+	uint64_t has_backup = 0;
+
+	// if node is NULL we are in the second step (in p2c mode we do not use the first step)
+	if (node)
+		return NULL;
+
+	struct uwsgi_subscribe_node *chosen_node = NULL;
+retry:
+	has_backup = 0;
+	uint64_t count = 0;
+	node = current_slot->nodes;
+	while (node) {
+		if (subscription_node_usable(node)) {
+			if (node->backup_level == backup_level) {
+				count++;
+			}
+			else if (node->backup_level > backup_level && (!has_backup || has_backup > node->backup_level)) {
+				has_backup = node->backup_level;
+			}
+		}
+		node = node->next;
+	}
+
+	if (count == 0) {
+		if (has_backup) {
+			backup_level = has_backup;
+			goto retry;
+		}
+		return NULL;
+	}
+
+	uint64_t first = rand() % count;
+	uint64_t second = first;
+	if (count > 1) {
+		second = rand() % (count - 1);
+		if (second >= first)
+			second++;
+	}
+
+	struct uwsgi_subscribe_node *candidates[2] = { NULL, NULL };
+	count = 0;
+	node = current_slot->nodes;
+	while (node) {
+		if (subscription_node_usable(node) && node->backup_level == backup_level) {
+			if (count == first)
+				candidates[0] = node;
+			if (count == second)
+				candidates[1] = node;
+			count++;
+		}
+		node = node->next;
+	}
+
+	// nodes without samples have a 0 score, so new nodes are probed soon
+	struct uwsgi_subscribe_node *loser = candidates[1];
+	chosen_node = candidates[0];
+	double score0 = (double) candidates[0]->latency * (double) (candidates[0]->reference + 1);
+	double score1 = (double) candidates[1]->latency * (double) (candidates[1]->reference + 1);
+	if (score1 < score0 || (score1 == score0 && candidates[1]->reference < candidates[0]->reference)) {
+		chosen_node = candidates[1];
+		loser = candidates[0];
+	}
+	// slowly forget the latency of the discarded node, so a recovered node is probed again
+	if (loser != chosen_node) {
+		loser->latency -= loser->latency >> 4;
+	}
+
+	chosen_node->reference++;
+	return chosen_node;
+}
+
 // least reference count
 static struct uwsgi_subscribe_node *uwsgi_subscription_algo_lrc(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_node *node, struct uwsgi_subscription_client *client) {
 	uint64_t backup_level = 0;
@@ -1260,7 +1642,7 @@ retry:
         node = current_slot->nodes;
         uint64_t min_rc = 0;
         while (node) {
-                if (!node->death_mark) {
+                if (subscription_node_usable(node)) {
 			if (node->backup_level == backup_level) {
                         	if (min_rc == 0 || node->reference < min_rc) {
                                 	min_rc = node->reference;
@@ -1302,7 +1684,7 @@ retry:
 	has_backup = 0;
         double min_rc = 0;
         while (node) {
-                if (!node->death_mark) {
+                if (subscription_node_usable(node)) {
 			if (node->backup_level == backup_level) {
                         	// node->weight is always >= 1, we can safely use it as divider
                         	double ref = (double) node->reference / (double) node->weight;
@@ -1341,7 +1723,7 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wrr(struct uwsgi_sub
 	uint64_t has_backup = 0;
         // if node is NULL we are in the second step
         if (node) {
-                if (node->death_mark == 0 && node->wrr > 0) {
+                if (subscription_node_usable(node) && node->wrr > 0) {
                         node->wrr--;
                         node->reference++;
                         return node;
@@ -1353,7 +1735,7 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wrr(struct uwsgi_sub
         node = current_slot->nodes;
         uint64_t min_weight = 0;
         while (node) {
-                if (!node->death_mark) {
+                if (subscription_node_usable(node)) {
                         if (min_weight == 0 || node->weight < min_weight)
                                 min_weight = node->weight;
                 }
@@ -1366,7 +1748,7 @@ retry:
 	has_backup = 0;
         struct uwsgi_subscribe_node *chosen_node = NULL;
         while (node) {
-                if (!node->death_mark) {
+                if (subscription_node_usable(node)) {
 			if (node->backup_level == backup_level) {
                         	node->wrr = node->weight / min_weight;
                         	chosen_node = node;
@@ -1394,6 +1776,8 @@ void uwsgi_subscription_init_algos() {
 	uwsgi_register_subscription_algo("lrc", uwsgi_subscription_algo_lrc);
 	uwsgi_register_subscription_algo("wlrc", uwsgi_subscription_algo_wlrc);
 	uwsgi_register_subscription_algo("iphash", uwsgi_subscription_algo_iphash);
+	uwsgi_register_subscription_algo("chash", uwsgi_subscription_algo_chash);
+	uwsgi_register_subscription_algo("p2c", uwsgi_subscription_algo_p2c);
 }
 
 void uwsgi_subscription_set_algo(char *algo) {
@@ -1410,11 +1794,14 @@ wrr:
 }
 
 // we are lazy for subscription algos, we initialize them only if needed
-struct uwsgi_subscribe_slot **uwsgi_subscription_init_ht() {
+struct uwsgi_subscriptions *uwsgi_subscription_init_ht() {
         if (!uwsgi.subscription_algo) {
                 uwsgi_subscription_set_algo(NULL);
         }
-        return uwsgi_calloc(sizeof(struct uwsgi_subscription_slot *) * UMAX16);
+        struct uwsgi_subscriptions *ht = uwsgi_calloc(sizeof(struct uwsgi_subscriptions));
+        ht->size = UWSGI_SUBSCRIPTIONS_MIN_SIZE;
+        ht->buckets = uwsgi_calloc(sizeof(struct uwsgi_subscribe_bucket) * ht->size);
+        return ht;
 }
 
 struct uwsgi_subscribe_node *(*uwsgi_subscription_algo_get(char *name , size_t len))(struct uwsgi_subscribe_slot *, struct uwsgi_subscribe_node *, struct uwsgi_subscription_client *) {
@@ -0,0 +1,167 @@
+#include "uwsgi.h"
+
+/*
+
+	hierarchical timing wheel
+
+	UWSGI_TIMER_WHEEL_LEVELS levels of UWSGI_TIMER_WHEEL_SLOTS slots (doubly linked lists of timers),
+	level 0 has a slot per tick, every slot of level N covers a whole rotation of level N - 1.
+
+	A timer is linked in the slot of the lowest level covering its expiration, so adding and removing
+	it is O(1). When level 0 wraps around the next slot of the upper level(s) is cascaded (its timers
+	are relinked in the lower levels). Timers farther than the whole wheel span are parked in the
+	farthest slot of the last level and cascaded again when their slot is reached.
+
+	The timers are embedded in the objects using them (no allocation on re-arming).
+	The unit of the ticks is chosen by the user (the corerouters and the master use msecs).
+
+*/
+
+#define WHEEL_MASK (UWSGI_TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << (UWSGI_TIMER_WHEEL_BITS * UWSGI_TIMER_WHEEL_LEVELS))
+
+struct uwsgi_timer_wheel *uwsgi_timer_wheel_new(uint64_t now) {
+	struct uwsgi_timer_wheel *w = uwsgi_calloc(sizeof(struct uwsgi_timer_wheel));
+	w->now = now;
+	return w;
+}
+
+static void wheel_link(struct uwsgi_timer_wheel *w, struct uwsgi_wheel_timer *t) {
+	int level = 0;
+	uint64_t value = t->value;
+	if (value < w->now) {
+		// already expired, it will be popped on the next call
+		value = w->now;
+	}
+	else {
+		uint64_t delta = value - w->now;
+		if (delta >= WHEEL_SPAN) {
+			value = w->now + WHEEL_SPAN - 1;
+			delta = WHEEL_SPAN - 1;
+		}
+		while (delta >= (1ULL << (UWSGI_TIMER_WHEEL_BITS * (level + 1)))) level++;
+	}
+	int idx = (value >> (UWSGI_TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+	int slot = (level * UWSGI_TIMER_WHEEL_SLOTS) + idx;
+
+	t->prev = NULL;
+	t->next = w->slots[slot];
+	if (t->next) t->next->prev = t;
+	w->slots[slot] = t;
+	w->occupied[level] |= 1ULL << idx;
+	t->slot = slot + 1;
+}
+
+static void wheel_unlink(struct uwsgi_timer_wheel *w, struct uwsgi_wheel_timer *t) {
+	int slot = t->slot - 1;
+	if (t->prev) {
+		t->prev->next = t->next;
+	}
+	else {
+		w->slots[slot] = t->next;
+		if (!t->next) w->occupied[slot / UWSGI_TIMER_WHEEL_SLOTS] &= ~(1ULL << (slot & WHEEL_MASK));
+	}
+	if (t->next) t->next->prev = t->prev;
+	t->prev = NULL;
+	t->next = NULL;
+	t->slot = 0;
+}
+
+// (re)arm a timer
+void uwsgi_timer_wheel_add(struct uwsgi_timer_wheel *w, struct uwsgi_wheel_timer *t, uint64_t value, void *data) {
+	if (t->slot) {
+		wheel_unlink(w, t);
+	}
+	else {
+		w->count++;
+	}
+	t->value = value;
+	t->data = data;
+	wheel_link(w, t);
+}
+
+// disarm a timer (no-op if it is not armed)
+void uwsgi_timer_wheel_del(struct uwsgi_timer_wheel *w, struct uwsgi_wheel_timer *t) {
+	if (!t->slot) return;
+	wheel_unlink(w, t);
+	w->count--;
+}
+
+// relink the timers of the current slot of the specified level
+static void wheel_cascade(struct uwsgi_timer_wheel *w, int level) {
+	int idx = (w->now >> (UWSGI_TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+	int slot = (level * UWSGI_TIMER_WHEEL_SLOTS) + idx;
+	struct uwsgi_wheel_timer *t = w->slots[slot];
+	w->slots[slot] = NULL;
+	w->occupied[level] &= ~(1ULL << idx);
+	while (t) {
+		struct uwsgi_wheel_timer *next = t->next;
+		wheel_link(w, t);
+		t = next;
+	}
+}
+
+// the wheel reached the start of a level 0 rotation
+static void wheel_rotate(struct uwsgi_timer_wheel *w) {
+	int level = 1;
+	// higher levels first, as their timers could land in the current slot of the lower ones
+	while (level < UWSGI_TIMER_WHEEL_LEVELS - 1 && !((w->now >> (UWSGI_TIMER_WHEEL_BITS * level)) & WHEEL_MASK)) level++;
+	for (; level > 0; level--) {
+		wheel_cascade(w, level);
+	}
+}
+
+// detach an expired timer (call it until it returns NULL)
+struct uwsgi_wheel_timer *uwsgi_timer_wheel_pop(struct uwsgi_timer_wheel *w, uint64_t now) {
+	for (;;) {
+		int idx = w->now & WHEEL_MASK;
+		struct uwsgi_wheel_timer *t = w->slots[idx];
+		if (t) {
+			uwsgi_timer_wheel_del(w, t);
+			return t;
+		}
+		if (w->now >= now) return NULL;
+		if (!w->count) {
+			w->now = now;
+			return NULL;
+		}
+		// jump to the next busy slot of level 0 or to the end of the rotation
+		uint64_t busy = w->occupied[0] & ~((2ULL << idx) - 1);
+		uint64_t step = busy ? (uint64_t) (__builtin_ctzll(busy) - idx) : (uint64_t) (UWSGI_TIMER_WHEEL_SLOTS - idx);
+		if (w->now + step > now) {
+			w->now = now;
+			return NULL;
+		}
+		w->now += step;
+		if (!busy) wheel_rotate(w);
+	}
+}
+
+// ticks before the next expiration (or cascade), -1 if there are no timers
+int64_t uwsgi_timer_wheel_next(struct uwsgi_timer_wheel *w, uint64_t now) {
+	if (!w->count) return -1;
+	uint64_t base = now > w->now ? now : w->now;
+	int idx = w->now & WHEEL_MASK;
+	uint64_t busy = w->occupied[0] & ~((1ULL << idx) - 1);
+	if (busy) {
+		uint64_t next = w->now + (__builtin_ctzll(busy) - idx);
+		return next > base ? (int64_t) (next - base) : 0;
+	}
+	uint64_t next = UINT64_MAX;
+	// wrapped level 0 slots are reached after the next rotation
+	if (w->occupied[0]) {
+		next = ((w->now >> UWSGI_TIMER_WHEEL_BITS) + 1) << UWSGI_TIMER_WHEEL_BITS;
+	}
+	int level;
+	for (level = 1; level < UWSGI_TIMER_WHEEL_LEVELS; level++) {
+		if (!w->occupied[level]) continue;
+		int shift = UWSGI_TIMER_WHEEL_BITS * level;
+		uint64_t cursor = (w->now >> shift) & WHEEL_MASK;
+		// the first busy slot after the cursor (wrapping around)
+		uint64_t rotated = (w->occupied[level] >> ((cursor + 1) & WHEEL_MASK)) | (w->occupied[level] << ((UWSGI_TIMER_WHEEL_SLOTS - ((cursor + 1) & WHEEL_MASK)) & WHEEL_MASK));
+		uint64_t steps = __builtin_ctzll(rotated) + 1;
+		uint64_t cascade = ((w->now >> shift) + steps) << shift;
+		if (cascade < next) next = cascade;
+	}
+	return next > base ? (int64_t) (next - base) : 0;
+}
@@ -8,6 +8,11 @@
 
 	some of them supports streaming, other requires buffering
 
+	streaming transformations do not own their chunk: they work on one of the two
+	buffers of the request (allocated once and reused for every chunk), modifying it in place
+	or writing their output to the other one (see uwsgi_transformation_spare()), so a chain
+	of streaming transformations runs in constant memory with a single copy of the body
+
 	at the end of the request the "final chain" is called (and the whole chain freed)
 
 	Transformations (if required) could completely swallow already set headers
@@ -16,6 +21,46 @@
 
 extern struct uwsgi_server uwsgi;
 
+static int uwsgi_transformation_shared(struct wsgi_request *wsgi_req, struct uwsgi_buffer *ub) {
+	return ub && (ub == wsgi_req->transformation_bufs[0] || ub == wsgi_req->transformation_bufs[1]);
+}
+
+// the buffer a streaming transformation can write its output to (it must set it as its chunk)
+struct uwsgi_buffer *uwsgi_transformation_spare(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	int i = ut->chunk == wsgi_req->transformation_bufs[0] ? 1 : 0;
+	if (!wsgi_req->transformation_bufs[i]) {
+		wsgi_req->transformation_bufs[i] = uwsgi_buffer_new(uwsgi.page_size);
+	}
+	wsgi_req->transformation_bufs[i]->pos = 0;
+	return wsgi_req->transformation_bufs[i];
+}
+
+/*
+	run a streaming transformation on the current data
+
+	*cur is the shared buffer holding the data (NULL if the data is not in a shared buffer yet)
+*/
+static int uwsgi_transformation_stream(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut, char **t_buf, size_t *t_len, struct uwsgi_buffer **cur) {
+	if (!*cur) {
+		if (!wsgi_req->transformation_bufs[0]) {
+			wsgi_req->transformation_bufs[0] = uwsgi_buffer_new(UMAX(*t_len, (size_t) uwsgi.page_size));
+		}
+		*cur = wsgi_req->transformation_bufs[0];
+		(*cur)->pos = 0;
+		if (uwsgi_buffer_append(*cur, *t_buf, *t_len)) return -1;
+	}
+	ut->chunk = *cur;
+
+	ut->round++;
+	if (ut->func(wsgi_req, ut)) return -1;
+
+	// the transformation could have moved its output to the spare buffer
+	*cur = ut->chunk;
+	*t_buf = (*cur)->buf;
+	*t_len = (*cur)->pos;
+	return 0;
+}
+
 // -1 error, 0 = no buffer, send the body, 1 = buffer
 int uwsgi_apply_transformations(struct wsgi_request *wsgi_req, char *buf, size_t len) {
 	wsgi_req->transformed_chunk = NULL;
@@ -23,32 +68,28 @@ int uwsgi_apply_transformations(struct wsgi_request *wsgi_req, char *buf, size_t
 	struct uwsgi_transformation *ut = wsgi_req->transformations;
 	char *t_buf = buf;
 	size_t t_len = len;
+	struct uwsgi_buffer *cur = NULL;
 	uint8_t flushed = 0;
 	while(ut) {
-		// allocate the buffer (if needed)
-		if (!ut->chunk) {
-			ut->chunk = uwsgi_buffer_new(t_len);
-		}
 		// skip final transformations before appending data
 		if (ut->is_final) goto next;
-		if (uwsgi_buffer_append(ut->chunk, t_buf, t_len)) {
-			return -1;
-		}
 
 		// if the transformation cannot stream, continue buffering (the func will be called at the end)
-		if (!ut->can_stream) return 1;
-		
-		ut->round++;
-		if (ut->func(wsgi_req, ut)) {
+		if (!ut->can_stream) {
+			if (!ut->chunk) {
+				ut->chunk = uwsgi_buffer_new(UMAX(t_len, (size_t) uwsgi.page_size));
+			}
+			if (uwsgi_buffer_append(ut->chunk, t_buf, t_len)) {
+				return -1;
+			}
+			return 1;
+		}
+
+		if (uwsgi_transformation_stream(wsgi_req, ut, &t_buf, &t_len, &cur)) {
 			return -1;
 		}
 
 		if (ut->flushed) flushed = 1;
-
-		t_buf = ut->chunk->buf;
-		t_len = ut->chunk->pos;
-		// we reset the buffer, so we do not waste memory
-		ut->chunk->pos = 0;
 next:
 		ut = ut->next;
 	}
@@ -74,6 +115,7 @@ int uwsgi_apply_final_transformations(struct wsgi_request *wsgi_req) {
         wsgi_req->transformed_chunk_len = 0;
 	char *t_buf = NULL;
 	size_t t_len = 0;
+	struct uwsgi_buffer *cur = NULL;
 	uint8_t flushed = 0;
 	int found_nostream = 0;
 	while(ut) {
@@ -84,37 +126,39 @@ int uwsgi_apply_final_transformations(struct wsgi_request *wsgi_req) {
 			else {
 				// stop the chain if no chunk is available
 				if (!ut->chunk) return 0;
-				t_buf = ut->chunk->buf;
-                		t_len = ut->chunk->pos;
+				// the streamed chunks have already been sent
 				goto next;
 			}
 		}
 
-		if (!ut->chunk) {
-			if (t_len > 0) {
-				ut->chunk = uwsgi_buffer_new(t_len);
-			}
-			else {
-				ut->chunk = uwsgi_buffer_new(uwsgi.page_size);
+		if (ut->can_stream && !ut->is_final) {
+			if (uwsgi_transformation_stream(wsgi_req, ut, &t_buf, &t_len, &cur)) {
+				return -1;
 			}
 		}
-		
-		if (t_len > 0) {
-			if (uwsgi_buffer_append(ut->chunk, t_buf, t_len)) {
+		else {
+			if (!ut->chunk) {
+				ut->chunk = uwsgi_buffer_new(UMAX(t_len, (size_t) uwsgi.page_size));
+			}
+
+			if (t_len > 0) {
+				if (uwsgi_buffer_append(ut->chunk, t_buf, t_len)) {
+					return -1;
+				}
+			}
+
+			// run the transformation
+			ut->round++;
+			if (ut->func(wsgi_req, ut)) {
 				return -1;
-                	}
+			}
+
+			t_buf = ut->chunk->buf;
+			t_len = ut->chunk->pos;
+			cur = NULL;
 		}
-		
-		// run the transformation
-		ut->round++;
-		if (ut->func(wsgi_req, ut)) {
-			return -1;
-                }
 
 		if (ut->flushed) flushed = 1;
-
-		t_buf = ut->chunk->buf;
-		t_len = ut->chunk->pos;
 next:
 		ut = ut->next;
 	}
@@ -131,7 +175,7 @@ void uwsgi_free_transformations(struct wsgi_request *wsgi_req) {
 	struct uwsgi_transformation *ut = wsgi_req->transformations;
 	while(ut) {
 		struct uwsgi_transformation *current_ut = ut;
-		if (current_ut->chunk) {
+		if (current_ut->chunk && !uwsgi_transformation_shared(wsgi_req, current_ut->chunk)) {
 			uwsgi_buffer_destroy(current_ut->chunk);
 		}
 		if (current_ut->ub) {
@@ -141,8 +185,17 @@ void uwsgi_free_transformations(struct wsgi_request *wsgi_req) {
 			close(current_ut->fd);
 		}
 		ut = ut->next;
-		free(current_ut);
 	}
+	if (wsgi_req->transformation_bufs[0]) {
+		uwsgi_buffer_destroy(wsgi_req->transformation_bufs[0]);
+		wsgi_req->transformation_bufs[0] = NULL;
+	}
+	if (wsgi_req->transformation_bufs[1]) {
+		uwsgi_buffer_destroy(wsgi_req->transformation_bufs[1]);
+		wsgi_req->transformation_bufs[1] = NULL;
+	}
+	// the structures live in the request arena
+	wsgi_req->transformations = NULL;
 }
 
 struct uwsgi_transformation *uwsgi_add_transformation(struct wsgi_request *wsgi_req, int (*func)(struct wsgi_request *, struct uwsgi_transformation *), void *data) {
@@ -152,7 +205,7 @@ struct uwsgi_transformation *uwsgi_add_transformation(struct wsgi_request *wsgi_
 		ut = ut->next;
 	}
 
-	ut = uwsgi_calloc(sizeof(struct uwsgi_transformation));
+	ut = uwsgi_req_calloc(wsgi_req, sizeof(struct uwsgi_transformation));
 	ut->func = func;
 	ut->fd = -1;
 	ut->data = data;
@@ -166,3 +219,43 @@ struct uwsgi_transformation *uwsgi_add_transformation(struct wsgi_request *wsgi_
 
 	return ut;
 }
+
+/*
+
+	compression metrics
+
+	plugins register them in the init hook (before the metrics subsystem allocates the values)
+	and add the bytes received, the bytes generated and the microseconds spent compressing at
+	the end of each response:
+
+	plugin.<name>.bytes_in (<oid>.1)
+	plugin.<name>.bytes_out (<oid>.2)
+	plugin.<name>.time (<oid>.3)
+
+*/
+
+void uwsgi_transformation_metrics_register(struct uwsgi_transformation_metrics *utm, char *name, char *oid) {
+	char buf[4096];
+	char buf2[4096];
+
+	if (!uwsgi.has_metrics) return;
+
+	if (snprintf(buf, 4096, "plugin.%s.bytes_in", name) >= 4096 || snprintf(buf2, 4096, "%s.1", oid) >= 4096) goto error;
+	utm->bytes_in = uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, NULL, NULL, 0, NULL);
+	if (snprintf(buf, 4096, "plugin.%s.bytes_out", name) >= 4096 || snprintf(buf2, 4096, "%s.2", oid) >= 4096) goto error;
+	utm->bytes_out = uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, NULL, NULL, 0, NULL);
+	if (snprintf(buf, 4096, "plugin.%s.time", name) >= 4096 || snprintf(buf2, 4096, "%s.3", oid) >= 4096) goto error;
+	utm->time = uwsgi_register_metric(buf, buf2, UWSGI_METRIC_COUNTER, NULL, NULL, 0, NULL);
+	return;
+error:
+	uwsgi_log("unable to register metrics for %s\n", name);
+	exit(1);
+}
+
+// the values are updated by multiple workers without taking the metrics lock
+void uwsgi_transformation_metrics_add(struct uwsgi_transformation_metrics *utm, uint64_t bytes_in, uint64_t bytes_out, uint64_t usecs) {
+	if (!utm->bytes_in) return;
+	__atomic_fetch_add(utm->bytes_in->value, bytes_in, __ATOMIC_RELAXED);
+	__atomic_fetch_add(utm->bytes_out->value, bytes_out, __ATOMIC_RELAXED);
+	__atomic_fetch_add(utm->time->value, usecs, __ATOMIC_RELAXED);
+}
@@ -54,11 +54,15 @@ void inc_harakiri(struct wsgi_request *wsgi_req, int sec) {
 // set worker harakiri
 void set_harakiri(struct wsgi_request *wsgi_req, int sec) {
 	if (!wsgi_req) return;
+	uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].soft_harakiri = 0;
 	if (sec == 0) {
 		uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].harakiri = 0;
 	}
 	else {
 		uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].harakiri = uwsgi_now() + sec;
+		if (uwsgi.master_process) {
+			uwsgi_master_deadline_notify(uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].harakiri);
+		}
 	}
 	if (!uwsgi.master_process) {
 		alarm(sec);
@@ -84,6 +88,9 @@ void set_user_harakiri(struct wsgi_request *wsgi_req, int sec) {
 	}
 	else if (wsgi_req) {
 		uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].user_harakiri = timeout;
+		if (timeout) {
+			uwsgi_master_deadline_notify(timeout);
+		}
 	}
 }
 
@@ -1044,10 +1051,14 @@ void uwsgi_destroy_request(struct wsgi_request *wsgi_req) {
 	// thanks Marko Tiikkaja for catching it
 	wsgi_req->uh->_pktsize = 0;
 
+	uwsgi_req_arena_reset(wsgi_req);
+
 	// some plugins expected async_id to be defined before setup
         int tmp_id = wsgi_req->async_id;
+	struct uwsgi_arena_block *arena = wsgi_req->arena;
         memset(wsgi_req, 0, sizeof(struct wsgi_request));
         wsgi_req->async_id = tmp_id;
+	wsgi_req->arena = arena;
 }
 
 // finalize/close/free a request
@@ -1057,7 +1068,7 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 	int tmp_id;
 	uint64_t tmp_rt, rss = 0, vsz = 0;
 #ifdef __linux__
-	uint64_t uss = 0, pss = 0;
+	uint64_t uss = 0, pss = 0, shared = 0;
 #endif
 
 	// apply transformations
@@ -1085,6 +1096,25 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 		tmp_rt = wsgi_req->end_of_request - wsgi_req->start_of_request;
 		uwsgi.workers[uwsgi.mywid].running_time += tmp_rt;
 		uwsgi.workers[uwsgi.mywid].avg_response_time = (uwsgi.workers[uwsgi.mywid].avg_response_time + tmp_rt) / 2;
+		int rt_bucket = tmp_rt;
+		if (tmp_rt >= 4) {
+			int msb = 63 - __builtin_clzll(tmp_rt);
+			rt_bucket = (4 * (msb - 1)) + ((tmp_rt >> (msb - 2)) & 3);
+		}
+		__atomic_fetch_add(&uwsgi.workers[uwsgi.mywid].rt_histogram[UMIN(rt_bucket, UWSGI_WORKER_RT_BUCKETS - 1)], 1, __ATOMIC_RELAXED);
+		uwsgi_metric_histogram_add(uwsgi.metric_response_time, tmp_rt);
+		if (uwsgi.metric_headers_time) {
+			uint64_t headers_time, body_time, app_time, first_byte_time;
+			uwsgi_req_latency(wsgi_req, &headers_time, &body_time, &app_time, &first_byte_time);
+			uwsgi_metric_histogram_add(uwsgi.metric_headers_time, headers_time);
+			if (wsgi_req->body_at) uwsgi_metric_histogram_add(uwsgi.metric_body_time, body_time);
+			if (wsgi_req->app_at) uwsgi_metric_histogram_add(uwsgi.metric_app_time, app_time);
+			if (wsgi_req->first_byte_at) uwsgi_metric_histogram_add(uwsgi.metric_first_byte_time, first_byte_time);
+		}
+		// requests without the start timestamp are not accounted
+		if (wsgi_req->queue_time) {
+			uwsgi_metric_histogram_add(uwsgi.metric_queue_time, wsgi_req->queue_time);
+		}
 	}
 
 	// get memory usage
@@ -1094,11 +1124,15 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 		uwsgi.workers[uwsgi.mywid].rss_size = rss;
 	}
 
+	if (uwsgi.memory_stats)
+		uwsgi_memory_stats_update(end_of_request);
+
 #ifdef __linux__
-	if (uwsgi.logging_options.memory_report || uwsgi.reload_on_uss || uwsgi.reload_on_pss) {
-		get_memusage_extra(&uss, &pss);
+	if (uwsgi.logging_options.memory_report || uwsgi.reload_on_uss || uwsgi.reload_on_pss || uwsgi.force_get_memusage_extra) {
+		get_memusage_extra(&uss, &pss, &shared);
 		uwsgi.workers[uwsgi.mywid].uss_size = uss;
 		uwsgi.workers[uwsgi.mywid].pss_size = pss;
+		uwsgi.workers[uwsgi.mywid].shared_size = shared;
 	}
 #endif
 
@@ -1115,6 +1149,7 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 #ifdef UWSGI_ROUTING
 	// apply final routes after accounting
 	uwsgi_apply_final_routes(wsgi_req);
+	uwsgi_routing_free_memo(wsgi_req);
 #endif
 
 	// close socket and free parsers-allocated memory
@@ -1161,40 +1196,11 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 		while (waitpid(WAIT_ANY, &waitpid_status, WNOHANG) > 0);
 	}
 
-	// free logvars
-	struct uwsgi_logvar *lv = wsgi_req->logvars;
-	while (lv) {
-		struct uwsgi_logvar *ptr = lv;
-		lv = lv->next;
-		free(ptr);
-	}
-
-	// free additional headers
-	struct uwsgi_string_list *ah = wsgi_req->additional_headers;
-	while (ah) {
-		struct uwsgi_string_list *ptr = ah;
-		ah = ah->next;
-		free(ptr->value);
-		free(ptr);
-	}
-	// free remove headers
-	ah = wsgi_req->remove_headers;
-	while (ah) {
-		struct uwsgi_string_list *ptr = ah;
-		ah = ah->next;
-		free(ptr->value);
-		free(ptr);
-	}
-
 	// free chunked input
 	if (wsgi_req->chunked_input_buf) {
 		uwsgi_buffer_destroy(wsgi_req->chunked_input_buf);
 	}
 
-	if (wsgi_req->body_chunked_buf) {
-		uwsgi_buffer_destroy(wsgi_req->body_chunked_buf);
-	}
-
 	// free websocket engine
 	if (wsgi_req->websocket_buf) {
 		uwsgi_buffer_destroy(wsgi_req->websocket_buf);
@@ -1202,14 +1208,20 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 	if (wsgi_req->websocket_send_buf) {
 		uwsgi_buffer_destroy(wsgi_req->websocket_send_buf);
 	}
+	uwsgi_websocket_deflate_free(wsgi_req);
+
 
+	// logvars, transformations, additional headers...
+	uwsgi_req_arena_reset(wsgi_req);
 
 	// reset request
 	wsgi_req->uh->_pktsize = 0;
 	tmp_id = wsgi_req->async_id;
+	struct uwsgi_arena_block *arena = wsgi_req->arena;
 	memset(wsgi_req, 0, sizeof(struct wsgi_request));
 	// some plugins expected async_id to be defined before setup
 	wsgi_req->async_id = tmp_id;
+	wsgi_req->arena = arena;
 	// yes, this is pretty useless but we cannot ensure all of the plugin have the same behaviour
 	uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].in_request = 0;
 
@@ -1434,6 +1446,81 @@ int wsgi_req_async_recv(struct wsgi_request *wsgi_req) {
 	return 0;
 }
 
+#define uwsgi_req_delta(a, b) ((a) && (b) > (a) ? (b) - (a) : 0)
+
+/*
+	the phases of a request (in microseconds):
+
+	headers: from accept to the parsed request vars (includes the time waiting for the client)
+	body: from the parsed vars to the whole body received (by post-buffering or by the app)
+	app: from the start of the app to the end of the request
+	first_byte: from accept to the first byte of the response
+*/
+void uwsgi_req_latency(struct wsgi_request *wsgi_req, uint64_t *headers, uint64_t *body, uint64_t *app, uint64_t *first_byte) {
+	uint64_t start = wsgi_req->accepted_at ? wsgi_req->accepted_at : wsgi_req->start_of_request;
+	uint64_t end = wsgi_req->end_of_request ? wsgi_req->end_of_request : uwsgi_micros();
+	*headers = uwsgi_req_delta(start, wsgi_req->headers_at);
+	*body = uwsgi_req_delta(wsgi_req->headers_at, wsgi_req->body_at);
+	*app = uwsgi_req_delta(wsgi_req->app_at, end);
+	*first_byte = uwsgi_req_delta(start, wsgi_req->first_byte_at);
+}
+
+/*
+	the frontend stamps the request with its start time (like X-Request-Start: t=1694544000.123),
+	seconds with a fractional part or integers in seconds, milliseconds or microseconds are accepted
+*/
+void uwsgi_req_queue_time(struct wsgi_request *wsgi_req) {
+	uint16_t len = 0;
+	char *value = uwsgi_get_var(wsgi_req, uwsgi.queue_time_var, strlen(uwsgi.queue_time_var), &len);
+	if (!value) return;
+	if (len > 2 && value[0] == 't' && value[1] == '=') {
+		value += 2;
+		len -= 2;
+	}
+
+	uint64_t integer = 0, fraction = 0, scale = 1;
+	int digits = 0;
+	int in_fraction = 0;
+	uint16_t i;
+	for(i=0;i<len;i++) {
+		char c = value[i];
+		if (c == '.' && !in_fraction) {
+			in_fraction = 1;
+			continue;
+		}
+		if (!isdigit((int) c)) break;
+		if (in_fraction) {
+			// microseconds resolution is enough
+			if (scale < 1000000) {
+				fraction = (fraction * 10) + (c - '0');
+				scale *= 10;
+			}
+		}
+		else {
+			integer = (integer * 10) + (c - '0');
+			digits++;
+		}
+	}
+	if (!digits) return;
+
+	uint64_t start;
+	if (in_fraction || digits <= 10) {
+		start = (integer * 1000000) + ((fraction * 1000000) / scale);
+	}
+	else if (digits <= 13) {
+		start = integer * 1000;
+	}
+	else {
+		start = integer;
+	}
+
+	uint64_t accepted_at = wsgi_req->accepted_at ? wsgi_req->accepted_at : wsgi_req->start_of_request;
+	// ignore clock skews
+	if (accepted_at > start) {
+		wsgi_req->queue_time = accepted_at - start;
+	}
+}
+
 // receive a new request
 int wsgi_req_recv(int queue, struct wsgi_request *wsgi_req) {
 
@@ -1468,7 +1555,9 @@ int wsgi_req_recv(int queue, struct wsgi_request *wsgi_req) {
 		return 0;
 #endif
 
+	int mem_old = uwsgi_memory_enter(UWSGI_MEM_PLUGINS);
 	wsgi_req->async_status = uwsgi.p[wsgi_req->uh->modifier1]->request(wsgi_req);
+	uwsgi_memory_leave(mem_old);
 
 	return 0;
 }
@@ -1497,6 +1586,20 @@ int wsgi_req_simple_accept(struct wsgi_request *wsgi_req, int fd) {
 		return -1;
 	}
 
+	wsgi_req->accepted_at = uwsgi_micros();
+
+	if (uwsgi.admission_enabled && uwsgi_admission_check(wsgi_req)) {
+		return -1;
+	}
+
+	if (uwsgi.priority_classes && uwsgi_priority_dispatch(wsgi_req)) {
+		return -1;
+	}
+
+	if (uwsgi.affinity_fds && uwsgi_affinity_dispatch(wsgi_req)) {
+		return -1;
+	}
+
 	uwsgi_post_accept(wsgi_req);
 
 	return 0;
@@ -1519,6 +1622,43 @@ void uwsgi_heartbeat() {
 
 }
 
+/*
+	get the next interesting fd for wsgi_req_accept() when --accept-batch is in use:
+
+	the last listener that accepted a connection is retried (at most accept_batch times in a row)
+	until accept() returns EAGAIN, then the remaining events harvested by the last
+	event_queue_wait_multi() are consumed, and only when both are exhausted the event queue is waited again.
+*/
+static int wsgi_req_accept_batch(int queue, int timeout, int core_id, int *interesting_fd) {
+	struct uwsgi_accept_batch *ab = &uwsgi.accept_batches[core_id];
+
+	if (ab->drain) {
+		ab->drain = 0;
+		*interesting_fd = ab->drain_fd;
+		return 1;
+	}
+
+	if (ab->pos < ab->count) {
+		*interesting_fd = event_queue_interesting_fd(ab->events, ab->pos++);
+		ab->streak = 0;
+		return 1;
+	}
+
+	if (!ab->events) {
+		ab->events = event_queue_alloc(uwsgi.accept_batch);
+	}
+
+	ab->count = 0;
+	ab->pos = 0;
+	ab->streak = 0;
+	int ret = event_queue_wait_multi(queue, timeout, ab->events, uwsgi.accept_batch);
+	if (ret <= 0)
+		return ret;
+	ab->count = ret;
+	*interesting_fd = event_queue_interesting_fd(ab->events, ab->pos++);
+	return 1;
+}
+
 // accept a request
 int wsgi_req_accept(int queue, struct wsgi_request *wsgi_req) {
 
@@ -1567,7 +1707,12 @@ int wsgi_req_accept(int queue, struct wsgi_request *wsgi_req) {
 		uwsgi_sock = uwsgi.sockets;
 	}
 
-	ret = event_queue_wait(queue, timeout, &interesting_fd);
+	if (uwsgi.accept_batches && !uwsgi.is_et) {
+		ret = wsgi_req_accept_batch(queue, timeout, wsgi_req->async_id, &interesting_fd);
+	}
+	else {
+		ret = event_queue_wait(queue, timeout, &interesting_fd);
+	}
 	if (ret < 0) {
 		thunder_unlock;
 		return -1;
@@ -1604,12 +1749,34 @@ int wsgi_req_accept(int queue, struct wsgi_request *wsgi_req) {
 			wsgi_req->socket = uwsgi_sock;
 			wsgi_req->fd = wsgi_req->socket->proto_accept(wsgi_req, interesting_fd);
 			thunder_unlock;
+			if (uwsgi.accept_batches && !uwsgi.is_et) {
+				struct uwsgi_accept_batch *ab = &uwsgi.accept_batches[wsgi_req->async_id];
+				// more connections could be waiting in the backlog, retry without waiting the queue
+				// (only non-blocking shared listeners can be safely retried)
+				if (wsgi_req->fd >= 0 && interesting_fd == uwsgi_sock->fd && !uwsgi_sock->per_core && ab->streak < uwsgi.accept_batch) {
+					ab->drain = 1;
+					ab->drain_fd = interesting_fd;
+					ab->streak++;
+				}
+				else {
+					ab->streak = 0;
+				}
+			}
 			if (wsgi_req->fd < 0) {
 				if (uwsgi.threads > 1)
 					pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &ret);
 				return -1;
 			}
 
+			wsgi_req->accepted_at = uwsgi_micros();
+
+			if ((uwsgi.admission_enabled && uwsgi_admission_check(wsgi_req)) || (uwsgi.priority_classes && uwsgi_priority_dispatch(wsgi_req))
+				|| (uwsgi.affinity_fds && uwsgi_affinity_dispatch(wsgi_req))) {
+				if (uwsgi.threads > 1)
+					pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &ret);
+				return -1;
+			}
+
 			if (!uwsgi_sock->edge_trigger) {
 				uwsgi_post_accept(wsgi_req);
 			}
@@ -1841,9 +2008,73 @@ void *uwsgi_malloc(size_t size) {
 		exit(1);
 	}
 
+	if (uwsgi.memory_stats)
+		uwsgi_memory_account(size);
+	return ptr;
+}
+
+/*
+	per-request bump allocator: small objects living until the end of the request
+	(logvars, transformations, additional headers...) are carved from a block
+	attached to the wsgi_request, and released all at once by the request reset
+*/
+#define UWSGI_ARENA_ALIGN 16
+
+static struct uwsgi_arena_block *uwsgi_arena_block_new(size_t size) {
+	struct uwsgi_arena_block *block = uwsgi_malloc(sizeof(struct uwsgi_arena_block) + size);
+	block->next = NULL;
+	block->size = size;
+	block->pos = 0;
+	return block;
+}
+
+void *uwsgi_req_alloc(struct wsgi_request *wsgi_req, size_t size) {
+	size = (size + (UWSGI_ARENA_ALIGN - 1)) & ~((size_t) UWSGI_ARENA_ALIGN - 1);
+	struct uwsgi_arena_block *block = wsgi_req->arena;
+	if (!block || block->pos + size > block->size) {
+		size_t block_size = uwsgi.request_arena_size;
+		if (size > block_size) block_size = size;
+		struct uwsgi_arena_block *new_block = uwsgi_arena_block_new(block_size);
+		new_block->next = block;
+		wsgi_req->arena = new_block;
+		// the first block of the core (the following ones are merged by the reset)
+		if (!block && uwsgi.workers && uwsgi.mywid > 0)
+			uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].arena_size = block_size;
+		block = new_block;
+	}
+	void *ptr = block->data + block->pos;
+	block->pos += size;
+	return ptr;
+}
+
+void *uwsgi_req_calloc(struct wsgi_request *wsgi_req, size_t size) {
+	void *ptr = uwsgi_req_alloc(wsgi_req, size);
+	memset(ptr, 0, size);
 	return ptr;
 }
 
+void uwsgi_req_arena_reset(struct wsgi_request *wsgi_req) {
+	struct uwsgi_arena_block *block = wsgi_req->arena;
+	if (!block) return;
+	if (!block->next) {
+		block->pos = 0;
+		return;
+	}
+	// the request overflowed the block, merge them for the next one (up to 4 times the default size)
+	size_t total = 0;
+	while(block) {
+		struct uwsgi_arena_block *next = block->next;
+		total += block->size;
+		free(block);
+		block = next;
+	}
+	if (total > uwsgi.request_arena_size * 4) total = uwsgi.request_arena_size * 4;
+	wsgi_req->arena = uwsgi_arena_block_new(total);
+	// exposed in the cores stats
+	if (uwsgi.workers && uwsgi.mywid > 0)
+		uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].arena_size = total;
+}
+
 void *uwsgi_calloc(size_t size) {
 	// thanks Mathieu Dupuy for pointing out that calloc is faster
 	// than malloc + memset
@@ -1854,6 +2085,8 @@ void *uwsgi_calloc(size_t size) {
 		uwsgi_backtrace(uwsgi.backtrace_depth);
 		exit(1);
 	}
+	if (uwsgi.memory_stats)
+		uwsgi_memory_account(size);
 	return ptr;
 }
 
@@ -2283,19 +2516,99 @@ void uwsgi_dyn_dict_free(struct uwsgi_dyn_dict **dd) {
 	*dd = NULL;
 }
 
-void *uwsgi_malloc_shared(size_t size) {
+#ifdef __linux__
+// the size of huge pages (from /proc/meminfo), 0 if unavailable
+static size_t uwsgi_hugepage_size() {
+	static size_t hugepage_size = 0;
+	static int checked = 0;
+	if (checked) return hugepage_size;
+	checked = 1;
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (!f) return 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long kb = 0;
+		if (sscanf(line, "Hugepagesize: %llu kB", &kb) == 1) {
+			hugepage_size = kb * 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return hugepage_size;
+}
 
-	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+// transparent huge pages are used for shared memory only if shmem_enabled allows them
+static int uwsgi_thp_shmem_enabled() {
+	size_t size = 0;
+	char *policy = uwsgi_open_and_read("/sys/kernel/mm/transparent_hugepage/shmem_enabled", &size, 1, NULL);
+	int ret = strstr(policy, "[never]") == NULL && strstr(policy, "[deny]") == NULL;
+	free(policy);
+	return ret;
+}
+#endif
+
+/*
+	allocate shared memory, eventually backed by huge pages (--shared-hugepages hugetlb|thp):
+	hugetlb falls back to thp (and thp to regular pages) when not available,
+	the page size obtained is stored in page_size (when not NULL)
+*/
+void *uwsgi_mmap_shared(size_t size, size_t *page_size) {
+
+	void *addr = MAP_FAILED;
+	size_t obtained = uwsgi.page_size;
+
+#ifdef __linux__
+	size_t hugepage_size = 0;
+	if (uwsgi.shared_hugepages) {
+		hugepage_size = uwsgi_hugepage_size();
+		// smaller areas would waste most of the huge page
+		if (size < hugepage_size) hugepage_size = 0;
+	}
+#ifdef MAP_HUGETLB
+	if (hugepage_size && !strcmp(uwsgi.shared_hugepages, "hugetlb")) {
+		size_t hsize = ((size + hugepage_size - 1) / hugepage_size) * hugepage_size;
+		addr = mmap(NULL, hsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED) {
+			obtained = hugepage_size;
+		}
+		else {
+			uwsgi_log("unable to allocate %llu bytes with hugetlb pages (%s), falling back to transparent huge pages\n", (unsigned long long) hsize, strerror(errno));
+		}
+	}
+#endif
+#endif
 
 	if (addr == MAP_FAILED) {
-		uwsgi_log("unable to allocate %llu bytes (%lluMB)\n", (unsigned long long) size, (unsigned long long) (size / (1024 * 1024)));
-		uwsgi_error("mmap()");
-		exit(1);
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+		if (addr == MAP_FAILED) {
+			uwsgi_log("unable to allocate %llu bytes (%lluMB)\n", (unsigned long long) size, (unsigned long long) (size / (1024 * 1024)));
+			uwsgi_error("mmap()");
+			exit(1);
+		}
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+		if (hugepage_size) {
+			if (madvise(addr, size, MADV_HUGEPAGE)) {
+				uwsgi_error("uwsgi_mmap_shared()/madvise()");
+			}
+			else if (uwsgi_thp_shmem_enabled()) {
+				obtained = hugepage_size;
+			}
+		}
+#endif
+	}
+
+	if (uwsgi.numa_interleave) {
+		uwsgi_numa_interleave(addr, size);
 	}
 
+	if (page_size) *page_size = obtained;
 	return addr;
 }
 
+void *uwsgi_malloc_shared(size_t size) {
+	return uwsgi_mmap_shared(size, NULL);
+}
+
 void *uwsgi_calloc_shared(size_t size) {
 	void *ptr = uwsgi_malloc_shared(size);
 	// NOTE by Mathieu Dupuy:
@@ -2304,10 +2617,123 @@ void *uwsgi_calloc_shared(size_t size) {
 	// we should trust it, but history has taught us it is better to be paranoid.
 	// Lucky enough this function is called ony in startup phases, so performance
 	// tips/tricks are irrelevant (So, le'ts call memset...)
-	memset(ptr, 0, size);
+	// ...but big areas can be split between the --startup-threads
+	uwsgi_parallel_memset(ptr, size);
 	return ptr;
 }
 
+struct uwsgi_parallel_job {
+	uint64_t from;
+	uint64_t to;
+	void (*func)(uint64_t, uint64_t, void *);
+	void *data;
+};
+
+static void *uwsgi_parallel_job_run(void *arg) {
+	struct uwsgi_parallel_job *job = (struct uwsgi_parallel_job *) arg;
+	job->func(job->from, job->to, job->data);
+	return NULL;
+}
+
+/*
+	split [0, n) in ranges of at least "grain" items and run func() on them using
+	--startup-threads threads. It is meant for startup phases (the threads are joined
+	before returning, so nothing survives fork()), when the cost is dominated by page faults
+	of big shared memory areas.
+*/
+void uwsgi_parallel_for(uint64_t n, uint64_t grain, void (*func)(uint64_t, uint64_t, void *), void *data) {
+	uint64_t threads = uwsgi.startup_threads > 1 ? uwsgi.startup_threads : 1;
+	if (!grain) grain = 1;
+	if (n / grain < threads) threads = n / grain;
+	if (threads <= 1) {
+		func(0, n, data);
+		return;
+	}
+
+	struct uwsgi_parallel_job *jobs = uwsgi_calloc(sizeof(struct uwsgi_parallel_job) * threads);
+	pthread_t *tids = uwsgi_calloc(sizeof(pthread_t) * threads);
+	int *started = uwsgi_calloc(sizeof(int) * threads);
+	uint64_t chunk = n / threads;
+	uint64_t i;
+	for (i = 0; i < threads; i++) {
+		jobs[i].from = i * chunk;
+		jobs[i].to = (i == threads - 1) ? n : (i + 1) * chunk;
+		jobs[i].func = func;
+		jobs[i].data = data;
+	}
+
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, uwsgi_parallel_job_run, &jobs[i])) {
+			uwsgi_error("uwsgi_parallel_for()/pthread_create()");
+			// run it in the calling thread
+			uwsgi_parallel_job_run(&jobs[i]);
+			continue;
+		}
+		started[i] = 1;
+	}
+
+	uwsgi_parallel_job_run(&jobs[0]);
+
+	for (i = 1; i < threads; i++) {
+		if (started[i]) pthread_join(tids[i], NULL);
+	}
+
+	free(started);
+	free(tids);
+	free(jobs);
+}
+
+static void uwsgi_parallel_memset_range(uint64_t from, uint64_t to, void *data) {
+	memset(((char *) data) + from, 0, to - from);
+}
+
+void uwsgi_parallel_memset(void *ptr, size_t size) {
+	// areas smaller than 16MB are not worth a thread
+	uwsgi_parallel_for(size, 16 * 1024 * 1024, uwsgi_parallel_memset_range, ptr);
+}
+
+// phases use the wall clock, as --clock could change the uwsgi one in the middle of the startup
+static uint64_t uwsgi_startup_trace_now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return ((uint64_t) tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+void uwsgi_startup_trace_init() {
+	uwsgi.startup_trace_start = uwsgi_startup_trace_now();
+	uwsgi.startup_trace_last = uwsgi.startup_trace_start;
+}
+
+void uwsgi_startup_trace_phase(char *phase) {
+	if (!uwsgi.startup_trace) return;
+	uint64_t now = uwsgi_startup_trace_now();
+
+	// plugins are loaded while parsing the options, so they are reported with the first phase
+	struct uwsgi_string_list *usl = uwsgi.startup_trace_loads;
+	while (usl) {
+		struct uwsgi_string_list *next = usl->next;
+		uwsgi_log("[startup-trace] plugin %s loaded in %llu.%03llu ms\n", usl->value,
+			(unsigned long long) usl->custom / 1000, (unsigned long long) usl->custom % 1000);
+		free(usl->value);
+		free(usl);
+		usl = next;
+	}
+	uwsgi.startup_trace_loads = NULL;
+
+	uint64_t elapsed = now - uwsgi.startup_trace_last;
+	uint64_t total = now - uwsgi.startup_trace_start;
+	uwsgi_log("[startup-trace] %s: %llu.%03llu ms (%llu.%03llu ms since start)\n", phase,
+		(unsigned long long) elapsed / 1000, (unsigned long long) elapsed % 1000,
+		(unsigned long long) total / 1000, (unsigned long long) total % 1000);
+	uwsgi.startup_trace_last = now;
+}
+
+void uwsgi_startup_trace_hook(const char *name, char *hook, uint64_t since) {
+	uint64_t elapsed = uwsgi_micros() - since;
+	uwsgi_log("[startup-trace] %s %s(): %llu.%03llu ms\n", name ? name : "unnamed", hook,
+		(unsigned long long) elapsed / 1000, (unsigned long long) elapsed % 1000);
+}
+
 
 struct uwsgi_string_list *uwsgi_string_new_list(struct uwsgi_string_list **list, char *value) {
 
@@ -3244,38 +3670,75 @@ void escape_shell_arg(char *src, size_t len, char *dst) {
 	*ptr++ = 0;
 }
 
-void escape_json(char *src, size_t len, char *dst) {
+/*
+	json escaping
 
-	size_t i;
-	char *ptr = dst;
+	only \t, \n, \r, " and \ are escaped, so the output is at most twice the input.
+	Long runs of plain bytes are skipped 8 at a time (a word contains a byte to escape only
+	if it has a '"', a '\' or a control char) and copied with a single memcpy().
+*/
 
-	for (i = 0; i < len; i++) {
-		if (src[i] == '\t') {
+#define UWSGI_JSON_ONES 0x0101010101010101ULL
+#define UWSGI_JSON_HIGHS 0x8080808080808080ULL
+#define uwsgi_json_has_zero(x) (((x) - UWSGI_JSON_ONES) & ~(x) & UWSGI_JSON_HIGHS)
+#define uwsgi_json_has_less(x, n) (((x) - (UWSGI_JSON_ONES * (n))) & ~(x) & UWSGI_JSON_HIGHS)
+
+// number of leading bytes not requiring escaping
+size_t uwsgi_json_plain_len(char *src, size_t len) {
+	size_t i = 0;
+	while (i + 8 <= len) {
+		uint64_t w;
+		memcpy(&w, src + i, 8);
+		if (uwsgi_json_has_less(w, 0x20) | uwsgi_json_has_zero(w ^ (UWSGI_JSON_ONES * '"')) | uwsgi_json_has_zero(w ^ (UWSGI_JSON_ONES * '\\')))
+			break;
+		i += 8;
+	}
+	for (; i < len; i++) {
+		unsigned char c = src[i];
+		if (c < 0x20 || c == '"' || c == '\\') break;
+	}
+	return i;
+}
+
+// dst must be at least (len * 2) bytes, returns the number of bytes written
+size_t uwsgi_json_escape(char *dst, char *src, size_t len) {
+	char *ptr = dst;
+	size_t i = 0;
+	while (i < len) {
+		size_t plain = uwsgi_json_plain_len(src + i, len - i);
+		memcpy(ptr, src + i, plain);
+		ptr += plain;
+		i += plain;
+		if (i >= len) break;
+		switch (src[i]) {
+		case '\t':
 			*ptr++ = '\\';
 			*ptr++ = 't';
-		}
-		else if (src[i] == '\n') {
+			break;
+		case '\n':
 			*ptr++ = '\\';
 			*ptr++ = 'n';
-		}
-		else if (src[i] == '\r') {
+			break;
+		case '\r':
 			*ptr++ = '\\';
 			*ptr++ = 'r';
-		}
-		else if (src[i] == '"') {
-			*ptr++ = '\\';
-			*ptr++ = '"';
-		}
-		else if (src[i] == '\\') {
-			*ptr++ = '\\';
+			break;
+		case '"':
+		case '\\':
 			*ptr++ = '\\';
-		}
-		else {
 			*ptr++ = src[i];
+			break;
+		default:
+			*ptr++ = src[i];
+			break;
 		}
+		i++;
 	}
+	return ptr - dst;
+}
 
-	*ptr++ = 0;
+void escape_json(char *src, size_t len, char *dst) {
+	dst[uwsgi_json_escape(dst, src, len)] = 0;
 }
 
 /*
@@ -3467,17 +3930,61 @@ void http_url_decode4(char *buf, uint16_t * len, char *dst, int no_slash_decode)
 
 
 /*
-	we scan the table in reverse, as updated values are at the end
+	vars are indexed (lazily) in an open addressing hash table of hvec positions
+	allocated in the request arena.
+
+	Vars are only appended (updated values are at the end) so the index catches up
+	with the new pairs on every lookup, the latest position of a key wins
 */
+static void uwsgi_vars_index_add(struct uwsgi_vars_index *uvi, struct wsgi_request *wsgi_req, uint16_t pos) {
+	uint32_t mask = uvi->size - 1;
+	uint32_t slot = djb33x_hash(wsgi_req->hvec[pos].iov_base, wsgi_req->hvec[pos].iov_len) & mask;
+	for (;;) {
+		uint16_t current = uvi->slots[slot];
+		if (!current) break;
+		if (!uwsgi_strncmp(wsgi_req->hvec[pos].iov_base, wsgi_req->hvec[pos].iov_len, wsgi_req->hvec[current - 1].iov_base, wsgi_req->hvec[current - 1].iov_len)) break;
+		slot = (slot + 1) & mask;
+	}
+	uvi->slots[slot] = pos + 1;
+}
+
+static struct uwsgi_vars_index *uwsgi_vars_index_update(struct wsgi_request *wsgi_req) {
+	struct uwsgi_vars_index *uvi = wsgi_req->vars_index;
+	if (!uvi) {
+		// at least twice the number of pairs
+		uint32_t size = 16;
+		while (size < (uint32_t) uwsgi.vec_size) size <<= 1;
+		uvi = uwsgi_req_calloc(wsgi_req, sizeof(struct uwsgi_vars_index) + (sizeof(uint16_t) * size));
+		uvi->size = size;
+		wsgi_req->vars_index = uvi;
+	}
+	else if (uvi->indexed > wsgi_req->var_cnt) {
+		memset(uvi->slots, 0, sizeof(uint16_t) * uvi->size);
+		uvi->indexed = 0;
+	}
+	while (uvi->indexed + 1 < wsgi_req->var_cnt) {
+		uwsgi_vars_index_add(uvi, wsgi_req, uvi->indexed);
+		uvi->indexed += 2;
+	}
+	return uvi;
+}
+
 char *uwsgi_get_var(struct wsgi_request *wsgi_req, char *key, uint16_t keylen, uint16_t * len) {
 
-	int i;
+	if (wsgi_req->var_cnt < 2) return NULL;
 
-	for (i = wsgi_req->var_cnt - 1; i > 0; i -= 2) {
-		if (!uwsgi_strncmp(key, keylen, wsgi_req->hvec[i - 1].iov_base, wsgi_req->hvec[i - 1].iov_len)) {
-			*len = wsgi_req->hvec[i].iov_len;
-			return wsgi_req->hvec[i].iov_base;
+	struct uwsgi_vars_index *uvi = uwsgi_vars_index_update(wsgi_req);
+	uint32_t mask = uvi->size - 1;
+	uint32_t slot = djb33x_hash(key, keylen) & mask;
+	for (;;) {
+		uint16_t pos = uvi->slots[slot];
+		if (!pos) break;
+		pos--;
+		if (!uwsgi_strncmp(key, keylen, wsgi_req->hvec[pos].iov_base, wsgi_req->hvec[pos].iov_len)) {
+			*len = wsgi_req->hvec[pos + 1].iov_len;
+			return wsgi_req->hvec[pos + 1].iov_base;
 		}
+		slot = (slot + 1) & mask;
 	}
 
 	return NULL;
@@ -3647,11 +4154,43 @@ int uwsgi_file_to_string_list(char *filename, struct uwsgi_string_list **list) {
 
 void uwsgi_setup_post_buffering() {
 
+	// the plugins only check for uwsgi.post_buffering to know if the body has been buffered
+	if (!uwsgi.post_buffering) {
+		uwsgi_log("--post-buffering-socket requires --post-buffering\n");
+		exit(1);
+	}
+
 	if (!uwsgi.post_buffering_bufsize)
 		uwsgi.post_buffering_bufsize = 8192;
 
-	if (uwsgi.post_buffering_bufsize < uwsgi.post_buffering) {
-		uwsgi.post_buffering_bufsize = uwsgi.post_buffering;
+	size_t max_post_buffering = uwsgi.post_buffering;
+	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
+	while(uwsgi_sock) {
+		uwsgi_sock->post_buffering = uwsgi.post_buffering;
+		struct uwsgi_string_list *usl;
+		uwsgi_foreach(usl, uwsgi.post_buffering_socket) {
+			char *equal = strrchr(usl->value, '=');
+			if (!equal) {
+				uwsgi_log("invalid post-buffering-socket syntax, must be <socket>=<bytes>\n");
+				exit(1);
+			}
+			if (!uwsgi_strncmp(usl->value, equal - usl->value, uwsgi_sock->name, uwsgi_sock->name_len)) {
+				uwsgi_sock->post_buffering = uwsgi_n64(equal + 1);
+				if (!uwsgi_sock->post_buffering) {
+					uwsgi_log("invalid post buffering size for socket %s\n", uwsgi_sock->name);
+					exit(1);
+				}
+			}
+		}
+		if (uwsgi_sock->post_buffering > max_post_buffering)
+			max_post_buffering = uwsgi_sock->post_buffering;
+		uwsgi_sock->post_buffering_policy = uwsgi_calloc_shared(sizeof(struct uwsgi_post_buffering_policy));
+		uwsgi_sock->post_buffering_policy->threshold = uwsgi_sock->post_buffering;
+		uwsgi_sock = uwsgi_sock->next;
+	}
+
+	if (uwsgi.post_buffering_bufsize < max_post_buffering) {
+		uwsgi.post_buffering_bufsize = max_post_buffering;
 		uwsgi_log("setting request body buffering size to %lu bytes\n", (unsigned long) uwsgi.post_buffering_bufsize);
 	}
 
@@ -3724,6 +4263,10 @@ void uwsgi_set_cpu_affinity() {
 	char buf[4096];
 	int ret;
 	int pos = 0;
+	if (uwsgi.numa_affinity) {
+		uwsgi_numa_set_worker_affinity();
+		return;
+	}
 	if (uwsgi.cpu_affinity) {
 		int base_cpu = (uwsgi.mywid - 1) * uwsgi.cpu_affinity;
 		if (base_cpu >= uwsgi.cpus) {
@@ -4134,15 +4677,23 @@ int uwsgi_uuid_cmp(char *x, char *y) {
 	return 0;
 }
 
+// the header (and its list item) live in the request arena
+static void uwsgi_req_header_list_add(struct wsgi_request *wsgi_req, struct uwsgi_string_list **list, char *hh, uint16_t hh_len) {
+	struct uwsgi_string_list *usl = uwsgi_req_calloc(wsgi_req, sizeof(struct uwsgi_string_list));
+	usl->value = uwsgi_req_alloc(wsgi_req, hh_len + 1);
+	memcpy(usl->value, hh, hh_len);
+	usl->value[hh_len] = 0;
+	usl->len = hh_len;
+	while(*list) list = &(*list)->next;
+	*list = usl;
+}
+
 void uwsgi_additional_header_add(struct wsgi_request *wsgi_req, char *hh, uint16_t hh_len) {
-	// will be freed on request's end
-	char *header = uwsgi_concat2n(hh, hh_len, "", 0);
-	uwsgi_string_new_list(&wsgi_req->additional_headers, header);
+	uwsgi_req_header_list_add(wsgi_req, &wsgi_req->additional_headers, hh, hh_len);
 }
 
 void uwsgi_remove_header(struct wsgi_request *wsgi_req, char *hh, uint16_t hh_len) {
-	char *header = uwsgi_concat2n(hh, hh_len, "", 0);
-	uwsgi_string_new_list(&wsgi_req->remove_headers, header);
+	uwsgi_req_header_list_add(wsgi_req, &wsgi_req->remove_headers, hh, hh_len);
 }
 
 // based on nginx implementation
@@ -44,6 +44,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 #endif
 
 	{"http-socket", required_argument, 0, "bind to the specified UNIX/TCP socket using HTTP protocol", uwsgi_opt_add_socket, "http", 0},
+	{"http-socket-keepalive", no_argument, 0, "enable HTTP 1.1 keepalive and pipelining on --http-socket (like --http11-socket)", uwsgi_opt_true, &uwsgi.http_socket_keepalive, 0},
 	{"http-socket-modifier1", required_argument, 0, "force the specified modifier1 when using HTTP protocol", uwsgi_opt_set_64bit, &uwsgi.http_modifier1, 0},
 	{"http-socket-modifier2", required_argument, 0, "force the specified modifier2 when using HTTP protocol", uwsgi_opt_set_64bit, &uwsgi.http_modifier2, 0},
 
@@ -80,9 +81,11 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"processes", required_argument, 'p', "spawn the specified number of workers/processes", uwsgi_opt_set_int, &uwsgi.numproc, 0},
 	{"workers", required_argument, 'p', "spawn the specified number of workers/processes", uwsgi_opt_set_int, &uwsgi.numproc, 0},
 	{"thunder-lock", no_argument, 0, "serialize accept() usage (if possible)", uwsgi_opt_true, &uwsgi.use_thunder_lock, 0},
+	{"accept-batch", required_argument, 0, "harvest up to <n> ready listeners per event queue wakeup and accept() up to <n> connections in a row from the same listener", uwsgi_opt_set_int, &uwsgi.accept_batch, 0},
 	{"thunder-lock-watchdog", no_argument, 0, "watchdog for buggy pthread robust mutexes", uwsgi_opt_true, &uwsgi.use_thunder_lock_watchdog, 0},
 	{"harakiri", required_argument, 't', "set harakiri timeout", uwsgi_opt_set_int, &uwsgi.harakiri_options.workers, 0},
 	{"harakiri-verbose", no_argument, 0, "enable verbose mode for harakiri", uwsgi_opt_true, &uwsgi.harakiri_verbose, 0},
+	{"harakiri-soft", required_argument, 0, "on harakiri ask the app to abort the request (dumping its stack) and kill the worker only if it is still running after the specified seconds", uwsgi_opt_set_int, &uwsgi.harakiri_soft, UWSGI_OPT_MASTER},
 	{"harakiri-no-arh", no_argument, 0, "do not enable harakiri during after-request-hook", uwsgi_opt_true, &uwsgi.harakiri_no_arh, 0},
 	{"no-harakiri-arh", no_argument, 0, "do not enable harakiri during after-request-hook", uwsgi_opt_true, &uwsgi.harakiri_no_arh, 0},
 	{"no-harakiri-after-req-hook", no_argument, 0, "do not enable harakiri during after-request-hook", uwsgi_opt_true, &uwsgi.harakiri_no_arh, 0},
@@ -184,9 +187,12 @@ static struct uwsgi_option uwsgi_base_options[] = {
 
 	{"listen", required_argument, 'l', "set the socket listen queue size", uwsgi_opt_set_int, &uwsgi.listen_queue, UWSGI_OPT_IMMEDIATE},
 	{"max-vars", required_argument, 'v', "set the amount of internal iovec/vars structures", uwsgi_opt_max_vars, NULL, 0},
+	{"compact-cores", no_argument, 0, "allocate the per-core vars vectors on demand (saves memory with lots of async cores)", uwsgi_opt_true, &uwsgi.compact_cores, 0},
 	{"max-apps", required_argument, 0, "set the maximum number of per-worker applications", uwsgi_opt_set_int, &uwsgi.max_apps, 0},
 	{"buffer-size", required_argument, 'b', "set internal buffer size", uwsgi_opt_set_64bit, &uwsgi.buffer_size, 0},
+	{"request-arena-size", required_argument, 0, "set the size of the per-request memory arena (default 8k)", uwsgi_opt_set_64bit, &uwsgi.request_arena_size, 0},
 	{"memory-report", optional_argument, 'm', "enable memory report. 1 for basic (default), 2 for uss/pss (Linux only)", uwsgi_opt_set_int, &uwsgi.logging_options.memory_report, 0},
+	{"memory-stats", no_argument, 0, "expose per-worker allocator statistics (heap usage, fragmentation, allocation rate and per-subsystem counters)", uwsgi_opt_true, &uwsgi.memory_stats, 0},
 	{"profiler", required_argument, 0, "enable the specified profiler", uwsgi_opt_set_str, &uwsgi.profiler, 0},
 	{"cgi-mode", no_argument, 'c', "force CGI-mode for plugins supporting it", uwsgi_opt_true, &uwsgi.cgi_mode, 0},
 	{"abstract-socket", no_argument, 'a', "force UNIX socket in abstract mode (Linux only)", uwsgi_opt_true, &uwsgi.abstract_socket, 0},
@@ -198,6 +204,11 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"freebind", no_argument, 0, "put socket in freebind mode", uwsgi_opt_true, &uwsgi.freebind, 0},
 #endif
 	{"map-socket", required_argument, 0, "map sockets to specific workers", uwsgi_opt_add_string_list, &uwsgi.map_socket, 0},
+	{"priority-class", required_argument, 0, "reserve the specified workers for a class of requests (syntax: <name>=<worker>[,worker...])", uwsgi_opt_add_string_list, &uwsgi.priority_class_list, 0},
+	{"priority-route", required_argument, 0, "hand over the requests with the specified path prefix to the workers of a priority class (syntax: \"<class> <prefix>\")", uwsgi_opt_add_string_list, &uwsgi.priority_route_list, 0},
+	{"affinity-header", required_argument, 0, "steer the requests with the same value of the specified header to the same worker", uwsgi_opt_set_str, &uwsgi.affinity_header, 0},
+	{"affinity-cookie", required_argument, 0, "steer the requests with the same value of the specified cookie to the same worker", uwsgi_opt_set_str, &uwsgi.affinity_cookie, 0},
+	{"affinity-hash", required_argument, 0, "use the specified hash algorithm for affinity dispatch (default murmur2)", uwsgi_opt_set_str, &uwsgi.affinity_hash_name, 0},
 	{"enable-threads", no_argument, 'T', "enable threads", uwsgi_opt_true, &uwsgi.has_threads, 0},
 	{"no-threads-wait", no_argument, 0, "do not wait for threads cancellation on quit/reload", uwsgi_opt_true, &uwsgi.no_threads_wait, 0},
 
@@ -210,6 +221,8 @@ static struct uwsgi_option uwsgi_base_options[] = {
 
 	{"single-interpreter", no_argument, 'i', "do not use multiple interpreters (where available)", uwsgi_opt_true, &uwsgi.single_interpreter, 0},
 	{"need-app", no_argument, 0, "exit if no app can be loaded", uwsgi_opt_true, &uwsgi.need_app, 0},
+	{"startup-trace", no_argument, 0, "report the time spent in each startup phase and plugin hook", uwsgi_opt_true, &uwsgi.startup_trace, 0},
+	{"startup-threads", required_argument, 0, "use the specified number of threads to initialize big shared memory areas (caches, sharedareas) at startup", uwsgi_opt_set_int, &uwsgi.startup_threads, 0},
 	{"dynamic-apps", no_argument, 0, "allows apps to be dynamically loaded via uwsgi protocol", uwsgi_opt_true, &uwsgi.dynamic_apps, 0},
 	{"master", no_argument, 'M', "enable master process", uwsgi_opt_true, &uwsgi.master_process, 0},
 	{"honour-stdin", no_argument, 0, "do not remap stdin to /dev/null", uwsgi_opt_true, &uwsgi.honour_stdin, 0},
@@ -229,6 +242,8 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"emperor-tyrant-initgroups", no_argument, 0, "add additional groups set via initgroups() in Tyrant mode", uwsgi_opt_true, &uwsgi.emperor_tyrant_initgroups, 0},
 	{"emperor-stats", required_argument, 0, "run the Emperor stats server", uwsgi_opt_set_str, &uwsgi.emperor_stats, 0},
 	{"emperor-stats-server", required_argument, 0, "run the Emperor stats server", uwsgi_opt_set_str, &uwsgi.emperor_stats, 0},
+	{"emperor-stats-aggregate", required_argument, 0, "run the Emperor aggregated stats server (metrics collected from the vassals)", uwsgi_opt_set_str, &uwsgi.emperor_stats_aggregate, 0},
+	{"emperor-stats-aggregate-freq", required_argument, 0, "collect the vassals metrics every <n> seconds (default 5)", uwsgi_opt_set_int, &uwsgi.emperor_stats_aggregate_freq, 0},
 	{"emperor-trigger-socket", required_argument, 0, "enable the Emperor trigger socket", uwsgi_opt_set_str, &uwsgi.emperor_trigger_socket, 0},
 
 	{"early-emperor", no_argument, 0, "spawn the emperor as soon as possible", uwsgi_opt_true, &uwsgi.early_emperor, 0},
@@ -240,12 +255,22 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"emperor-broodlord", required_argument, 0, "run the emperor in BroodLord mode", uwsgi_opt_set_int, &uwsgi.emperor_broodlord, 0},
 	{"emperor-throttle", required_argument, 0, "set throttling level (in milliseconds) for bad behaving vassals (default 1000)", uwsgi_opt_set_int, &uwsgi.emperor_throttle, 0},
 	{"emperor-max-throttle", required_argument, 0, "set max throttling level (in milliseconds) for bad behaving vassals (default 3 minutes)", uwsgi_opt_set_int, &uwsgi.emperor_max_throttle, 0},
+	{"emperor-spawn-parallel", required_argument, 0, "limit the number of vassals starting at the same time (queueing the others)", uwsgi_opt_set_int, &uwsgi.emperor_spawn_parallel, 0},
+	{"emperor-spawn-cpu-budget", required_argument, 0, "do not start queued vassals while the load average is over the specified percentage of the cpu cores", uwsgi_opt_set_int, &uwsgi.emperor_spawn_cpu_budget, 0},
+	{"emperor-spawn-timeout", required_argument, 0, "consider started a vassal not ready to accept requests after the specified seconds (default 60)", uwsgi_opt_set_int, &uwsgi.emperor_spawn_timeout, 0},
+	{"emperor-spawn-priority", required_argument, 0, "add a spawn priority tier (glob of vassal names), queued vassals are started in tiers order", uwsgi_opt_add_string_list, &uwsgi.emperor_spawn_priority, 0},
 	{"emperor-magic-exec", no_argument, 0, "prefix vassals config files with exec:// if they have the executable bit", uwsgi_opt_true, &uwsgi.emperor_magic_exec, 0},
 	{"emperor-on-demand-extension", required_argument, 0, "search for text file (vassal name + extension) containing the on demand socket name", uwsgi_opt_set_str, &uwsgi.emperor_on_demand_extension, 0},
 	{"emperor-on-demand-ext", required_argument, 0, "search for text file (vassal name + extension) containing the on demand socket name", uwsgi_opt_set_str, &uwsgi.emperor_on_demand_extension, 0},
 	{"emperor-on-demand-directory", required_argument, 0, "enable on demand mode binding to the unix socket in the specified directory named like the vassal + .socket", uwsgi_opt_set_str, &uwsgi.emperor_on_demand_directory, 0},
 	{"emperor-on-demand-dir", required_argument, 0, "enable on demand mode binding to the unix socket in the specified directory named like the vassal + .socket", uwsgi_opt_set_str, &uwsgi.emperor_on_demand_directory, 0},
 	{"emperor-on-demand-exec", required_argument, 0, "use the output of the specified command as on demand socket name (the vassal name is passed as the only argument)", uwsgi_opt_set_str, &uwsgi.emperor_on_demand_exec, 0},
+	{"emperor-on-demand-hibernate", no_argument, 0, "warm up on demand vassals and suspend their workers when idle (instead of stopping them), waking them up on connection", uwsgi_opt_true, &uwsgi.emperor_on_demand_hibernate, 0},
+	{"emperor-cgroup", required_argument, 0, "place each vassal in its own cgroup (cgroup v2) under the specified directory", uwsgi_opt_set_str, &uwsgi.emperor_cgroup, 0},
+	{"emperor-cgroup-opt", required_argument, 0, "set a value (key=value) in each vassal cgroup", uwsgi_opt_add_string_list, &uwsgi.emperor_cgroup_opt, 0},
+	{"emperor-cgroup-protect", required_argument, 0, "protect the latency-sensitive vassals matching the specified glob from noisy neighbours", uwsgi_opt_add_string_list, &uwsgi.emperor_cgroup_protect, 0},
+	{"emperor-cgroup-pressure", required_argument, 0, "throttle the busiest non protected vassal when the cpu/memory pressure (percent) of a protected one reaches the specified value", uwsgi_opt_set_int, &uwsgi.emperor_cgroup_pressure, 0},
+	{"emperor-cgroup-throttle-weight", required_argument, 0, "cpu.weight of throttled vassals (default 10)", uwsgi_opt_set_int, &uwsgi.emperor_cgroup_throttle_weight, 0},
 	{"emperor-extra-extension", required_argument, 0, "allows the specified extension in the Emperor (vassal will be called with --config)", uwsgi_opt_add_string_list, &uwsgi.emperor_extra_extension, 0},
 	{"emperor-extra-ext", required_argument, 0, "allows the specified extension in the Emperor (vassal will be called with --config)", uwsgi_opt_add_string_list, &uwsgi.emperor_extra_extension, 0},
 	{"emperor-no-blacklist", no_argument, 0, "disable Emperor blacklisting subsystem", uwsgi_opt_true, &uwsgi.emperor_no_blacklist, 0},
@@ -254,6 +279,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 #endif
 	{"emperor-use-fork-server", required_argument, 0, "connect to the specified fork server instead of using plain fork() for new vassals", uwsgi_opt_set_str, &uwsgi.emperor_use_fork_server, 0},
 	{"vassal-fork-base", required_argument, 0, "use plain fork() for the specified vassal (instead of a fork-server)", uwsgi_opt_add_string_list, &uwsgi.vassal_fork_base, 0},
+	{"emperor-fork-server", required_argument, 0, "run (and respawn) a fork server for vassals, syntax: <socket> [config]", uwsgi_opt_add_string_list, &uwsgi.emperor_fork_servers, 0},
 	{"emperor-subreaper", no_argument, 0, "force the Emperor to be a sub-reaper (if supported)", uwsgi_opt_true, &uwsgi.emperor_subreaper, 0},
 	{"emperor-graceful-shutdown", no_argument, 0, "use vassals graceful shutdown during ragnarok", uwsgi_opt_true, &uwsgi.emperor_graceful_shutdown, 0},
 #ifdef UWSGI_CAP
@@ -266,6 +292,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"emperor-fork-server-attr", required_argument, 0, "set the vassal's attribute to get when checking for fork-server", uwsgi_opt_set_str, &uwsgi.emperor_fork_server_attr, 0},
 	{"emperor-wrapper-attr", required_argument, 0, "set the vassal's attribute to get when checking for fork-wrapper", uwsgi_opt_set_str, &uwsgi.emperor_wrapper_attr, 0},
 	{"emperor-chdir-attr", required_argument, 0, "set the vassal's attribute to get when checking for chdir", uwsgi_opt_set_str, &uwsgi.emperor_chdir_attr, 0},
+	{"emperor-compiled-config", no_argument, 0, "cache the compiled config of vassals using the config pipe and push it on reloads", uwsgi_opt_true, &uwsgi.emperor_compiled_config, 0},
 	{"imperial-monitor-list", no_argument, 0, "list enabled imperial monitors", uwsgi_opt_true, &uwsgi.imperial_monitor_list, 0},
 	{"imperial-monitors-list", no_argument, 0, "list enabled imperial monitors", uwsgi_opt_true, &uwsgi.imperial_monitor_list, 0},
 	{"vassals-inherit", required_argument, 0, "add config templates to vassals config (uses --inherit)", uwsgi_opt_add_string_list, &uwsgi.vassals_templates, 0},
@@ -285,6 +312,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 
 	{"reload-mercy", required_argument, 0, "set the maximum time (in seconds) we wait for workers and other processes to die during reload/shutdown", uwsgi_opt_set_int, &uwsgi.reload_mercy, 0},
 	{"worker-reload-mercy", required_argument, 0, "set the maximum time (in seconds) a worker can take to reload/shutdown (default is 60)", uwsgi_opt_set_int, &uwsgi.worker_reload_mercy, 0},
+	{"worker-drain", no_argument, 0, "drain connections on graceful reload/shutdown (close keepalive connections, send going-away to websockets) and report drain times", uwsgi_opt_true, &uwsgi.worker_drain, 0},
 	{"mule-reload-mercy", required_argument, 0, "set the maximum time (in seconds) a mule can take to reload/shutdown (default is 60)", uwsgi_opt_set_int, &uwsgi.mule_reload_mercy, 0},
 	{"exit-on-reload", no_argument, 0, "force exit even if a reload is requested", uwsgi_opt_true, &uwsgi.exit_on_reload, 0},
 	{"die-on-term", no_argument, 0, "exit instead of brutal reload on SIGTERM (no more needed)", uwsgi_opt_deprecated, &uwsgi.die_on_term, 0},
@@ -303,9 +331,12 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"max-worker-lifetime-delta", required_argument, 0, "add (worker_id * delta) seconds to the max_worker_lifetime value of each worker", uwsgi_opt_set_int, &uwsgi.max_worker_lifetime_delta, 0},
 
 	{"socket-timeout", required_argument, 'z', "set internal sockets timeout", uwsgi_opt_set_int, &uwsgi.socket_timeout, 0},
+	{"zerocopy-threshold", required_argument, 0, "send response bodies bigger than the specified size with MSG_ZEROCOPY (Linux only)", uwsgi_opt_set_64bit, &uwsgi.zerocopy_threshold, 0},
 	{"no-fd-passing", no_argument, 0, "disable file descriptor passing", uwsgi_opt_true, &uwsgi.no_fd_passing, 0},
 	{"locks", required_argument, 0, "create the specified number of shared locks", uwsgi_opt_set_int, &uwsgi.locks, 0},
 	{"lock-engine", required_argument, 0, "set the lock engine", uwsgi_opt_set_str, &uwsgi.lock_engine, 0},
+	{"lock-stats", no_argument, 0, "count acquisitions, contended acquisitions and wait time of every lock (exported in stats and metrics)", uwsgi_opt_true, &uwsgi.lock_stats, 0},
+	{"lock-spin", required_argument, 0, "set the max number of spins before sleeping on a contended futex lock (default 100)", uwsgi_opt_set_int, &uwsgi.lock_spin, 0},
 	{"ftok", required_argument, 0, "set the ipcsem key via ftok() for avoiding duplicates", uwsgi_opt_set_str, &uwsgi.ftok, 0},
 	{"persistent-ipcsem", no_argument, 0, "do not remove ipcsem's on shutdown", uwsgi_opt_true, &uwsgi.persistent_ipcsem, 0},
 	{"sharedarea", required_argument, 'A', "create a raw shared memory area of specified pages (note: it supports keyval too)", uwsgi_opt_add_string_list, &uwsgi.sharedareas_list, 0},
@@ -323,6 +354,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"cache-udp-server", required_argument, 0, "bind the cache udp server (used only for set/update/delete) to the specified socket", uwsgi_opt_add_string_list, &uwsgi.cache_udp_server, UWSGI_OPT_MASTER},
 	{"cache-udp-node", required_argument, 0, "send cache update/deletion to the specified cache udp server", uwsgi_opt_add_string_list, &uwsgi.cache_udp_node, UWSGI_OPT_MASTER},
 	{"cache-sync", required_argument, 0, "copy the whole content of another uWSGI cache server on server startup", uwsgi_opt_set_str, &uwsgi.cache_sync, 0},
+	{"hash-siphash-key", required_argument, 0, "set the key (max 16 bytes) of the siphash algorithm (default is random)", uwsgi_opt_set_str, &uwsgi.hash_siphash_key, 0},
 	{"cache-use-last-modified", no_argument, 0, "update last_modified_at timestamp on every cache item modification (default is disabled)", uwsgi_opt_true, &uwsgi.cache_use_last_modified, 0},
 
 	{"add-cache-item", required_argument, 0, "add an item in the cache", uwsgi_opt_add_string_list, &uwsgi.add_cache_item, 0},
@@ -332,16 +364,23 @@ static struct uwsgi_option uwsgi_base_options[] = {
 #endif
 
 	{"cache2", required_argument, 0, "create a new generation shared cache (keyval syntax)", uwsgi_opt_add_string_list, &uwsgi.cache2, 0},
+	{"cache-immutable-build", required_argument, 0, "build an immutable (perfect hash) cache file from a tab separated key/value file, syntax: src=<file>,dst=<file> (immediate option)", uwsgi_opt_cache_immutable_build, NULL, UWSGI_OPT_IMMEDIATE},
 
 
 	{"queue", required_argument, 0, "enable shared queue", uwsgi_opt_set_int, &uwsgi.queue_size, 0},
 	{"queue-blocksize", required_argument, 0, "set queue blocksize", uwsgi_opt_set_int, &uwsgi.queue_blocksize, 0},
 	{"queue-store", required_argument, 0, "enable persistent queue to disk", uwsgi_opt_set_str, &uwsgi.queue_store, UWSGI_OPT_MASTER},
 	{"queue-store-sync", required_argument, 0, "set frequency of sync for persistent queue", uwsgi_opt_set_int, &uwsgi.queue_store_sync, 0},
+	{"queue-lockfree", no_argument, 0, "use a lock-free ring for the shared queue (FIFO only, push fails when full, pullers can wait for items)", uwsgi_opt_true, &uwsgi.queue_lockfree, 0},
 
 	{"spooler", required_argument, 'Q', "run a spooler on the specified directory", uwsgi_opt_add_spooler, NULL, UWSGI_OPT_MASTER},
 	{"spooler-external", required_argument, 0, "map spoolers requests to a spooler directory managed by an external instance", uwsgi_opt_add_spooler, (void *) UWSGI_SPOOLER_EXTERNAL, UWSGI_OPT_MASTER},
 	{"spooler-ordered", no_argument, 0, "try to order the execution of spooler tasks", uwsgi_opt_true, &uwsgi.spooler_ordered, 0},
+	{"spooler-inotify", no_argument, 0, "wake up the spoolers when files are dropped in their directories (Linux only)", uwsgi_opt_true, &uwsgi.spooler_inotify, 0},
+	{"spooler-threads", required_argument, 0, "run the spooler tasks in the specified number of threads pulling from an in-memory queue", uwsgi_opt_set_int, &uwsgi.spooler_threads, 0},
+	{"spooler-batch", required_argument, 0, "pass up to the specified number of tasks in a single call to the spooler batch functions of the plugins", uwsgi_opt_set_int, &uwsgi.spooler_batch, 0},
+	{"spooler-index", no_argument, 0, "index the spooler tasks (priority and 'at' heaps fed by a journal) instead of scanning the spool directories", uwsgi_opt_true, &uwsgi.spooler_index, 0},
+	{"spooler-stream-window", required_argument, 0, "set the maximum number of unacknowledged tasks in remote spooler streams (default 1000)", uwsgi_opt_set_int, &uwsgi.spooler_stream_window, 0},
 	{"spooler-chdir", required_argument, 0, "chdir() to specified directory before each spooler task", uwsgi_opt_set_str, &uwsgi.spooler_chdir, 0},
 	{"spooler-processes", required_argument, 0, "set the number of processes for spoolers", uwsgi_opt_set_int, &uwsgi.spooler_numproc, UWSGI_OPT_IMMEDIATE},
 	{"spooler-quiet", no_argument, 0, "do not be verbose with spooler tasks", uwsgi_opt_true, &uwsgi.spooler_quiet, 0},
@@ -356,9 +395,11 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"mules", required_argument, 0, "add the specified number of mules", uwsgi_opt_add_mules, NULL, UWSGI_OPT_MASTER},
 	{"farm", required_argument, 0, "add a mule farm", uwsgi_opt_add_farm, NULL, UWSGI_OPT_MASTER},
 	{"mule-msg-size", required_argument, 0, "set mule message buffer size", uwsgi_opt_set_int, &uwsgi.mule_msg_size, UWSGI_OPT_MASTER},
+	{"mule-msg-ring", required_argument, 0, "deliver mule messages via shared memory rings of the specified size (per mule, farm member and shared queue)", uwsgi_opt_set_64bit, &uwsgi.mule_msg_ring, UWSGI_OPT_MASTER},
 	{"mule-msg-recv-size", required_argument, 0, "set mule message recv buffer size", uwsgi_opt_set_int, &uwsgi.mule_msg_recv_size, UWSGI_OPT_MASTER},
 
 	{"signal", required_argument, 0, "send a uwsgi signal to a server", uwsgi_opt_signal, NULL, UWSGI_OPT_IMMEDIATE},
+	{"signal-coalesce", no_argument, 0, "coalesce the signals routed to a process while it is busy (a single wakeup, every pending handler runs once)", uwsgi_opt_true, &uwsgi.signal_coalesce, UWSGI_OPT_MASTER},
 	{"signal-bufsize", required_argument, 0, "set buffer size for signal queue", uwsgi_opt_set_int, &uwsgi.signal_bufsize, 0},
 	{"signals-bufsize", required_argument, 0, "set buffer size for signal queue", uwsgi_opt_set_int, &uwsgi.signal_bufsize, 0},
 
@@ -369,6 +410,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"rbtimer", required_argument, 0, "add a redblack timer (syntax: <signal> <seconds>)", uwsgi_opt_add_string_list, &uwsgi.rb_signal_timers, UWSGI_OPT_MASTER},
 
 	{"rpc-max", required_argument, 0, "maximum number of rpc slots (default: 64)", uwsgi_opt_set_64bit, &uwsgi.rpc_max, 0},
+	{"rpc-pool", required_argument, 0, "keep up to N idle persistent (pipelined) connections to each remote RPC node", uwsgi_opt_set_int, &uwsgi.rpc_pool, 0},
 
 	{"disable-logging", no_argument, 'L', "disable request logging", uwsgi_opt_false, &uwsgi.logging_options.enabled, 0},
 
@@ -407,6 +449,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"setns-preopen", no_argument, 0, "open /proc/self/ns as soon as possible and cache fds", uwsgi_opt_true, &uwsgi.setns_preopen, 0},
 	{"fork-socket", required_argument, 0, "suspend the execution after early initialization and fork() at every unix socket connection", uwsgi_opt_set_str, &uwsgi.fork_socket, 0},
 	{"fork-server", required_argument, 0, "suspend the execution after early initialization and fork() at every unix socket connection", uwsgi_opt_set_str, &uwsgi.fork_socket, 0},
+	{"fork-server-preload", required_argument, 0, "load the specified shared library in the fork server (so its pages are shared by the forked processes)", uwsgi_opt_add_string_list, &uwsgi.fork_server_preload, 0},
 #endif
 	{"jailed", no_argument, 0, "mark the instance as jailed (force the execution of post_jail hooks)", uwsgi_opt_true, &uwsgi.jailed, 0},
 #if defined(__FreeBSD__) || defined(__GNU_kFreeBSD__)
@@ -544,6 +587,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 
 
 	{"ini", required_argument, 0, "load config from ini file", uwsgi_opt_load_ini, NULL, UWSGI_OPT_IMMEDIATE},
+	{"compiled-config", required_argument, 0, "load a compiled config (falls back to the regular loaders for plain files)", uwsgi_opt_load_compiled, NULL, UWSGI_OPT_IMMEDIATE},
 #ifdef UWSGI_YAML
 	{"yaml", required_argument, 'y', "load config from yaml file", uwsgi_opt_load_yml, NULL, UWSGI_OPT_IMMEDIATE},
 	{"yml", required_argument, 'y', "load config from yaml file", uwsgi_opt_load_yml, NULL, UWSGI_OPT_IMMEDIATE},
@@ -594,6 +638,9 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"touch-mules-reload", required_argument, 0, "reload mules if the specified file is modified/touched", uwsgi_opt_add_string_list, &uwsgi.touch_mules_reload, UWSGI_OPT_MASTER},
 	{"touch-spoolers-reload", required_argument, 0, "reload spoolers if the specified file is modified/touched", uwsgi_opt_add_string_list, &uwsgi.touch_spoolers_reload, UWSGI_OPT_MASTER},
 	{"touch-chain-reload", required_argument, 0, "trigger chain reload if the specified file is modified/touched", uwsgi_opt_add_string_list, &uwsgi.touch_chain_reload, UWSGI_OPT_MASTER},
+	{"chain-reload-concurrency", required_argument, 0, "set the number of workers reloaded together by each step of a chain reload (default 1)", uwsgi_opt_set_int, &uwsgi.chain_reload_concurrency, UWSGI_OPT_MASTER},
+	{"chain-reload-wait-ready", no_argument, 0, "during chain reload wait for the app to mark the new workers as ready (uwsgi.worker_ready() in python)", uwsgi_opt_true, &uwsgi.chain_reload_wait_ready, UWSGI_OPT_MASTER},
+	{"chain-reload-ready-timeout", required_argument, 0, "set the maximum time (in seconds) to wait for a chain reloaded worker to be ready (default is worker-reload-mercy)", uwsgi_opt_set_int, &uwsgi.chain_reload_ready_timeout, UWSGI_OPT_MASTER},
 	{"touch-logrotate", required_argument, 0, "trigger logrotation if the specified file is modified/touched", uwsgi_opt_add_string_list, &uwsgi.touch_logrotate, UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
 	{"touch-logreopen", required_argument, 0, "trigger log reopen if the specified file is modified/touched", uwsgi_opt_add_string_list, &uwsgi.touch_logreopen, UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
 	{"touch-exec", required_argument, 0, "run command when the specified file is modified/touched (syntax: file command)", uwsgi_opt_add_string_list, &uwsgi.touch_exec, UWSGI_OPT_MASTER},
@@ -613,8 +660,15 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"no-orphans", no_argument, 0, "automatically kill workers if master dies (can be dangerous for availability)", uwsgi_opt_true, &uwsgi.no_orphans, 0},
 	{"prio", required_argument, 0, "set processes/threads priority", uwsgi_opt_set_rawint, &uwsgi.prio, 0},
 	{"cpu-affinity", required_argument, 0, "set cpu affinity", uwsgi_opt_set_int, &uwsgi.cpu_affinity, 0},
+	{"numa-affinity", no_argument, 0, "map workers to NUMA nodes in round robin, binding them to the cpus (or to --cpu-affinity cpus) and preferring the memory of their node (Linux only)", uwsgi_opt_true, &uwsgi.numa_affinity, 0},
+	{"shared-hugepages", required_argument, 0, "back the shared memory allocated by the master (caches, sharedareas, queue...) with huge pages: 'hugetlb' (MAP_HUGETLB, falling back to thp) or 'thp' (transparent huge pages)", uwsgi_opt_set_str, &uwsgi.shared_hugepages, 0},
+	{"numa-interleave", no_argument, 0, "interleave the shared memory allocated by the master (caches, sharedareas...) across the NUMA nodes (Linux only)", uwsgi_opt_true, &uwsgi.numa_interleave, 0},
 	{"post-buffering", required_argument, 0, "set size in bytes after which will buffer to disk instead of memory", uwsgi_opt_set_64bit, &uwsgi.post_buffering, 0},
 	{"post-buffering-bufsize", required_argument, 0, "set buffer size for read() in post buffering mode", uwsgi_opt_set_64bit, &uwsgi.post_buffering_bufsize, 0},
+	{"post-buffering-memfd", required_argument, 0, "buffer request bodies up to the specified size in anonymous memory (memfd) instead of temp files", uwsgi_opt_set_64bit, &uwsgi.post_buffering_memfd, 0},
+	{"post-buffering-stream", no_argument, 0, "run the app as soon as disk buffering starts, reading the body through the buffer file", uwsgi_opt_true, &uwsgi.post_buffering_stream, 0},
+	{"post-buffering-socket", required_argument, 0, "set the post buffering size of a socket (syntax: <socket>=<bytes>)", uwsgi_opt_add_string_list, &uwsgi.post_buffering_socket, 0},
+	{"post-buffering-adaptive", no_argument, 0, "raise the post buffering size of every socket (up to --post-buffering-bufsize) to keep the most common request bodies in memory", uwsgi_opt_true, &uwsgi.post_buffering_adaptive, 0},
 	{"body-read-warning", required_argument, 0, "set the amount of allowed memory allocation (in megabytes) for request body before starting printing a warning", uwsgi_opt_set_64bit, &uwsgi.body_read_warning, 0},
 	{"upload-progress", required_argument, 0, "enable creation of .json files in the specified directory during a file upload", uwsgi_opt_set_str, &uwsgi.upload_progress, 0},
 	{"no-default-app", no_argument, 0, "do not fallback to default app", uwsgi_opt_true, &uwsgi.no_default_app, 0},
@@ -645,9 +699,13 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"stats-http", no_argument, 0, "prefix stats server json output with http headers", uwsgi_opt_true, &uwsgi.stats_http, UWSGI_OPT_MASTER},
 	{"stats-minified", no_argument, 0, "minify statistics json output", uwsgi_opt_true, &uwsgi.stats_minified, UWSGI_OPT_MASTER},
 	{"stats-min", no_argument, 0, "minify statistics json output", uwsgi_opt_true, &uwsgi.stats_minified, UWSGI_OPT_MASTER},
+	{"stats-snapshot", required_argument, 0, "serve a stats snapshot refreshed every <n> seconds instead of generating it for every request", uwsgi_opt_set_int, &uwsgi.stats_snapshot, UWSGI_OPT_MASTER},
+	{"stats-openmetrics", required_argument, 0, "expose the metrics in OpenMetrics text format (over http) on the specified address", uwsgi_opt_set_str, &uwsgi.stats_openmetrics, UWSGI_OPT_MASTER|UWSGI_OPT_METRICS},
 	{"stats-push", required_argument, 0, "push the stats json to the specified destination", uwsgi_opt_add_string_list, &uwsgi.requested_stats_pushers, UWSGI_OPT_MASTER|UWSGI_OPT_METRICS},
 	{"stats-pusher-default-freq", required_argument, 0, "set the default frequency of stats pushers", uwsgi_opt_set_int, &uwsgi.stats_pusher_default_freq, UWSGI_OPT_MASTER},
 	{"stats-pushers-default-freq", required_argument, 0, "set the default frequency of stats pushers", uwsgi_opt_set_int, &uwsgi.stats_pusher_default_freq, UWSGI_OPT_MASTER},
+	{"stats-pusher-mtu", required_argument, 0, "set the max size of the datagrams sent by stats pushers (default 1400)", uwsgi_opt_set_int, &uwsgi.stats_pusher_mtu, UWSGI_OPT_MASTER},
+	{"stats-push-changed-only", no_argument, 0, "stats pushers only send the metrics changed since their last push", uwsgi_opt_true, &uwsgi.stats_push_changed_only, UWSGI_OPT_MASTER},
 	{"stats-no-cores", no_argument, 0, "disable generation of cores-related stats", uwsgi_opt_true, &uwsgi.stats_no_cores, UWSGI_OPT_MASTER},
 	{"stats-no-metrics", no_argument, 0, "do not include metrics in stats output", uwsgi_opt_true, &uwsgi.stats_no_metrics, UWSGI_OPT_MASTER},
 	{"multicast", required_argument, 0, "subscribe to specified multicast group", uwsgi_opt_set_str, &uwsgi.multicast_group, UWSGI_OPT_MASTER},
@@ -667,7 +725,10 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"legion-mcast", required_argument, 0, "became a member of a legion (shortcut for multicast)", uwsgi_opt_legion_mcast, NULL, UWSGI_OPT_MASTER},
 	{"legion-node", required_argument, 0, "add a node to a legion", uwsgi_opt_legion_node, NULL, UWSGI_OPT_MASTER},
 	{"legion-freq", required_argument, 0, "set the frequency of legion packets", uwsgi_opt_set_int, &uwsgi.legion_freq, UWSGI_OPT_MASTER},
+	{"legion-freq-ms", required_argument, 0, "set the frequency of legion packets in milliseconds (overrides --legion-freq)", uwsgi_opt_set_int, &uwsgi.legion_freq_ms, UWSGI_OPT_MASTER},
 	{"legion-tolerance", required_argument, 0, "set the tolerance of legion subsystem", uwsgi_opt_set_int, &uwsgi.legion_tolerance, UWSGI_OPT_MASTER},
+	{"legion-tolerance-ms", required_argument, 0, "set the tolerance of legion subsystem in milliseconds (overrides --legion-tolerance)", uwsgi_opt_set_int, &uwsgi.legion_tolerance_ms, UWSGI_OPT_MASTER},
+	{"legion-phi", required_argument, 0, "consider dead a node when the phi accrual failure detector reaches the specified threshold (e.g. 8)", uwsgi_opt_set_str, &uwsgi.legion_phi, UWSGI_OPT_MASTER},
 	{"legion-death-on-lord-error", required_argument, 0, "declare itself as a dead node for the specified amount of seconds if one of the lord hooks fails", uwsgi_opt_set_int, &uwsgi.legion_death_on_lord_error, UWSGI_OPT_MASTER},
 	{"legion-skew-tolerance", required_argument, 0, "set the clock skew tolerance of legion subsystem (default 30 seconds)", uwsgi_opt_set_int, &uwsgi.legion_skew_tolerance, UWSGI_OPT_MASTER},
 	{"legion-lord", required_argument, 0, "action to call on Lord election", uwsgi_opt_legion_hook, NULL, UWSGI_OPT_MASTER},
@@ -681,6 +742,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"legion-scroll", required_argument, 0, "set the scroll of a legion", uwsgi_opt_legion_scroll, NULL, UWSGI_OPT_MASTER},
 	{"legion-scroll-max-size", required_argument, 0, "set max size of legion scroll buffer", uwsgi_opt_set_16bit, &uwsgi.legion_scroll_max_size, 0},
 	{"legion-scroll-list-max-size", required_argument, 0, "set max size of legion scroll list buffer", uwsgi_opt_set_64bit, &uwsgi.legion_scroll_list_max_size, 0},
+	{"legion-scroll-delta", no_argument, 0, "announce only the version of the scrolls, sending them only on change or on request", uwsgi_opt_true, &uwsgi.legion_scroll_delta, UWSGI_OPT_MASTER},
 	{"subscriptions-sign-check", required_argument, 0, "set digest algorithm and certificate directory for secured subscription system", uwsgi_opt_scd, NULL, UWSGI_OPT_MASTER},
 	{"subscriptions-sign-check-tolerance", required_argument, 0, "set the maximum tolerance (in seconds) of clock skew for secured subscription system", uwsgi_opt_set_int, &uwsgi.subscriptions_sign_check_tolerance, UWSGI_OPT_MASTER},
 	{"subscriptions-sign-skip-uid", required_argument, 0, "skip signature check for the specified uid when using unix sockets credentials", uwsgi_opt_add_string_list, &uwsgi.subscriptions_sign_skip_uid, UWSGI_OPT_MASTER},
@@ -688,6 +750,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"subscriptions-credentials-check", required_argument, 0, "add a directory to search for subscriptions key credentials", uwsgi_opt_add_string_list, &uwsgi.subscriptions_credentials_check_dir, UWSGI_OPT_MASTER},
 	{"subscriptions-use-credentials", no_argument, 0, "enable management of SCM_CREDENTIALS in subscriptions UNIX sockets", uwsgi_opt_true, &uwsgi.subscriptions_use_credentials, 0},
 	{"subscription-algo", required_argument, 0, "set load balancing algorithm for the subscription system", uwsgi_opt_ssa, NULL, 0},
+	{"subscription-hash", required_argument, 0, "set the hash algorithm used for the subscription system keys (default djb33x)", uwsgi_opt_set_str, &uwsgi.subscription_hash_name, 0},
 	{"subscription-dotsplit", no_argument, 0, "try to fallback to the next part (dot based) in subscription key", uwsgi_opt_true, &uwsgi.subscription_dotsplit, 0},
 	{"subscribe-to", required_argument, 0, "subscribe to the specified subscription server", uwsgi_opt_add_string_list, &uwsgi.subscriptions, UWSGI_OPT_MASTER},
 	{"st", required_argument, 0, "subscribe to the specified subscription server", uwsgi_opt_add_string_list, &uwsgi.subscriptions, UWSGI_OPT_MASTER},
@@ -696,11 +759,15 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"subscribe-freq", required_argument, 0, "send subscription announce at the specified interval", uwsgi_opt_set_int, &uwsgi.subscribe_freq, 0},
 	{"subscription-tolerance", required_argument, 0, "set tolerance for subscription servers", uwsgi_opt_set_int, &uwsgi.subscription_tolerance, 0},
 	{"subscription-tolerance-inactive", required_argument, 0, "set tolerance for subscription servers for inactive vassals", uwsgi_opt_set_int, &uwsgi.subscription_tolerance_inactive, 0},
+	{"subscription-outlier-failures", required_argument, 0, "eject subscription nodes after the specified number of consecutive failures (connect errors, timeouts, 5xx responses)", uwsgi_opt_set_int, &uwsgi.subscription_outlier_failures, 0},
+	{"subscription-outlier-latency", required_argument, 0, "eject subscription nodes whose average response time is more than the specified number of times the mean of the others", uwsgi_opt_set_int, &uwsgi.subscription_outlier_latency, 0},
+	{"subscription-ejection-time", required_argument, 0, "set the ejection window (in milliseconds) of outlier subscription nodes (default: 10000)", uwsgi_opt_set_int, &uwsgi.subscription_ejection_time, 0},
 	{"unsubscribe-on-graceful-reload", no_argument, 0, "force unsubscribe request even during graceful reload", uwsgi_opt_true, &uwsgi.unsubscribe_on_graceful_reload, 0},
 	{"start-unsubscribed", no_argument, 0, "configure subscriptions but do not send them (useful with master fifo)", uwsgi_opt_true, &uwsgi.subscriptions_blocked, 0},
 	{"subscription-clear-on-shutdown", no_argument, 0, "force clear instead of unsubscribe during shutdown", uwsgi_opt_true, &uwsgi.subscription_clear_on_shutdown, 0},
 
 	{"subscribe-with-modifier1", required_argument, 0, "force the specified modifier1 when subscribing", uwsgi_opt_set_str, &uwsgi.subscribe_with_modifier1, UWSGI_OPT_MASTER},
+	{"subscriptions-batch", no_argument, 0, "pack all of the subscription announces for the same server in as few datagrams as possible (requires an up to date subscription server)", uwsgi_opt_true, &uwsgi.subscriptions_batch, UWSGI_OPT_MASTER},
 
 	{"snmp", optional_argument, 0, "enable the embedded snmp server", uwsgi_opt_snmp, NULL, 0},
 	{"snmp-community", required_argument, 0, "set the snmp community string", uwsgi_opt_snmp_community, NULL, 0},
@@ -714,13 +781,20 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"ssl-sessions-timeout", required_argument, 0, "set SSL sessions timeout (default: 300 seconds)", uwsgi_opt_set_int, &uwsgi.ssl_sessions_timeout, 0},
 	{"ssl-session-timeout", required_argument, 0, "set SSL sessions timeout (default: 300 seconds)", uwsgi_opt_set_int, &uwsgi.ssl_sessions_timeout, 0},
 #endif
+	{"ssl-tickets-legion", required_argument, 0, "share the ssl session ticket keys between the nodes of the specified legion (the Lord generates and rotates them)", uwsgi_opt_set_str, &uwsgi.ssl_tickets_legion, UWSGI_OPT_MASTER},
+	{"ssl-tickets-rotate", required_argument, 0, "set the ssl session ticket keys rotation frequency (default: 3600 seconds)", uwsgi_opt_set_int, &uwsgi.ssl_tickets_rotate, 0},
 	{"sni", required_argument, 0, "add an SNI-governed SSL context", uwsgi_opt_sni, NULL, 0},
 	{"sni-dir", required_argument, 0, "check for cert/key/client_ca file in the specified directory and create a sni/ssl context on demand", uwsgi_opt_set_str, &uwsgi.sni_dir, 0},
 	{"sni-dir-ciphers", required_argument, 0, "set ssl ciphers for sni-dir option", uwsgi_opt_set_str, &uwsgi.sni_dir_ciphers, 0},
 	{"ssl-enable3", no_argument, 0, "enable SSLv3 (insecure)", uwsgi_opt_true, &uwsgi.sslv3, 0},
 	{"ssl-enable-sslv3", no_argument, 0, "enable SSLv3 (insecure)", uwsgi_opt_true, &uwsgi.sslv3, 0},
 	{"ssl-enable-tlsv1", no_argument, 0, "enable TLSv1 (insecure)", uwsgi_opt_true, &uwsgi.tlsv1, 0},
+	{"ssl-ktls", no_argument, 0, "enable kernel TLS offload after the handshake (if supported by OpenSSL and the kernel)", uwsgi_opt_true, &uwsgi.ssl_ktls, 0},
 	{"ssl-option", required_argument, 0, "set a raw ssl option (numeric value)", uwsgi_opt_add_string_list, &uwsgi.ssl_options, 0},
+	{"ssl-ocsp-stapling", no_argument, 0, "staple OCSP responses (fetched and refreshed in background) in the TLS handshakes", uwsgi_opt_true, &uwsgi.ssl_ocsp_stapling, 0},
+	{"ssl-ocsp-responder", required_argument, 0, "use the specified OCSP responder url instead of the one in the certificates", uwsgi_opt_set_str, &uwsgi.ssl_ocsp_responder, 0},
+	{"ssl-ocsp-refresh", required_argument, 0, "set the OCSP responses refresh frequency (default: 3600 seconds)", uwsgi_opt_set_int, &uwsgi.ssl_ocsp_refresh, 0},
+	{"ssl-ocsp-timeout", required_argument, 0, "set the timeout of the OCSP responders (default: 5 seconds)", uwsgi_opt_set_int, &uwsgi.ssl_ocsp_timeout, 0},
 #ifdef UWSGI_PCRE
 	{"sni-regexp", required_argument, 0, "add an SNI-governed SSL context (the key is a regexp)", uwsgi_opt_sni, NULL, 0},
 #endif
@@ -742,6 +816,8 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"logformat", required_argument, 0, "set advanced format for request logging", uwsgi_opt_set_str, &uwsgi.logformat, 0},
 	{"logformat-strftime", no_argument, 0, "apply strftime to logformat output", uwsgi_opt_true, &uwsgi.logformat_strftime, 0},
 	{"log-format-strftime", no_argument, 0, "apply strftime to logformat output", uwsgi_opt_true, &uwsgi.logformat_strftime, 0},
+	{"logformat-msgpack", no_argument, 0, "send the logformat variables as a msgpack map instead of a text line", uwsgi_opt_true, &uwsgi.logformat_msgpack, 0},
+	{"log-format-msgpack", no_argument, 0, "send the logformat variables as a msgpack map instead of a text line", uwsgi_opt_true, &uwsgi.logformat_msgpack, 0},
 	{"logfile-chown", no_argument, 0, "chown logfiles", uwsgi_opt_true, &uwsgi.logfile_chown, 0},
 	{"logfile-chmod", required_argument, 0, "chmod logfiles", uwsgi_opt_logfile_chmod, NULL, 0},
 	{"log-syslog", optional_argument, 0, "log to syslog", uwsgi_opt_set_logger, "syslog", UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
@@ -784,6 +860,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"alarm-lq", required_argument, 0, "raise the specified alarm when the socket backlog queue is full", uwsgi_opt_add_string_list, &uwsgi.alarm_backlog, UWSGI_OPT_MASTER},
 	{"alarm-listen-queue", required_argument, 0, "raise the specified alarm when the socket backlog queue is full", uwsgi_opt_add_string_list, &uwsgi.alarm_backlog, UWSGI_OPT_MASTER},
 	{"listen-queue-alarm", required_argument, 0, "raise the specified alarm when the socket backlog queue is full", uwsgi_opt_add_string_list, &uwsgi.alarm_backlog, UWSGI_OPT_MASTER},
+	{"queue-time-var", required_argument, 0, "compute the time spent in the listen queue from the request start timestamp in the specified var (e.g. HTTP_X_REQUEST_START)", uwsgi_opt_set_str, &uwsgi.queue_time_var, 0},
 #ifdef UWSGI_PCRE
 	{"log-alarm", required_argument, 0, "raise the specified alarm when a log line matches the specified regexp, syntax: <alarm>[,alarm...] <regexp>", uwsgi_opt_add_string_list, &uwsgi.alarm_logs_list, UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
 	{"alarm-log", required_argument, 0, "raise the specified alarm when a log line matches the specified regexp, syntax: <alarm>[,alarm...] <regexp>", uwsgi_opt_add_string_list, &uwsgi.alarm_logs_list, UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
@@ -794,9 +871,12 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"alarms-list", no_argument, 0, "list enabled alarms", uwsgi_opt_true, &uwsgi.alarms_list, 0},
 	{"alarm-msg-size", required_argument, 0, "set the max size of an alarm message (default 8192)", uwsgi_opt_set_64bit, &uwsgi.alarm_msg_size, 0},
 	{"log-master", no_argument, 0, "delegate logging to master process", uwsgi_opt_true, &uwsgi.log_master, UWSGI_OPT_MASTER|UWSGI_OPT_LOG_MASTER},
+	{"log-async-buffer", required_argument, 0, "send logs from a thread per logger, queueing up to the specified amount of bytes", uwsgi_opt_set_64bit, &uwsgi.log_async_buffer, UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
+	{"log-async-block", no_argument, 0, "wait for the async loggers when their buffer is full instead of dropping the messages", uwsgi_opt_true, &uwsgi.log_async_block, 0},
 	{"log-master-bufsize", required_argument, 0, "set the buffer size for the master logger. bigger log messages will be truncated", uwsgi_opt_set_64bit, &uwsgi.log_master_bufsize, 0},
 	{"log-master-stream", no_argument, 0, "create the master logpipe as SOCK_STREAM", uwsgi_opt_true, &uwsgi.log_master_stream, 0},
 	{"log-master-req-stream", no_argument, 0, "create the master requests logpipe as SOCK_STREAM", uwsgi_opt_true, &uwsgi.log_master_req_stream, 0},
+	{"req-log-ring", required_argument, 0, "buffer the request logs of each core in a shared memory ring of the specified size, drained in batches by the master", uwsgi_opt_set_64bit, &uwsgi.req_log_ring, 0},
 	{"log-reopen", no_argument, 0, "reopen log after reload", uwsgi_opt_true, &uwsgi.log_reopen, 0},
 	{"log-truncate", no_argument, 0, "truncate log on startup", uwsgi_opt_true, &uwsgi.log_truncate, 0},
 	{"log-maxsize", required_argument, 0, "set maximum logfile size", uwsgi_opt_set_64bit, &uwsgi.log_maxsize, UWSGI_OPT_MASTER|UWSGI_OPT_LOG_MASTER},
@@ -813,6 +893,8 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"log-big", required_argument, 0, "log requests bigger than the specified size", uwsgi_opt_set_64bit,  &uwsgi.logging_options.big, 0},
 	{"log-sendfile", required_argument, 0, "log sendfile requests", uwsgi_opt_true, &uwsgi.logging_options.sendfile, 0},
 	{"log-ioerror", required_argument, 0, "log requests with io errors", uwsgi_opt_true, &uwsgi.logging_options.ioerror, 0},
+	{"log-sample", required_argument, 0, "log only one request every N (requests matched by the log-* conditions are always logged)", uwsgi_opt_set_64bit, &uwsgi.logging_options.sample, 0},
+	{"log-rate-limit", required_argument, 0, "log at most the specified number of requests per second on each core (requests matched by the log-* conditions are always logged)", uwsgi_opt_set_64bit, &uwsgi.logging_options.rate_limit, 0},
 	{"log-micros", no_argument, 0, "report response time in microseconds instead of milliseconds", uwsgi_opt_true, &uwsgi.log_micros, 0},
 	{"log-x-forwarded-for", no_argument, 0, "use the ip from X-Forwarded-For header instead of REMOTE_ADDR", uwsgi_opt_true, &uwsgi.logging_options.log_x_forwarded_for, 0},
 	{"master-as-root", no_argument, 0, "leave master process running as root", uwsgi_opt_true, &uwsgi.master_as_root, 0},
@@ -826,8 +908,16 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"chdir2", required_argument, 0, "chdir to specified directory after apps loading", uwsgi_opt_set_str, &uwsgi.chdir2, 0},
 	{"lazy", no_argument, 0, "set lazy mode (load apps in workers instead of master)", uwsgi_opt_true, &uwsgi.lazy, 0},
 	{"lazy-apps", no_argument, 0, "load apps in each worker instead of the master", uwsgi_opt_true, &uwsgi.lazy_apps, 0},
+	{"warmup-request", required_argument, 0, "run the specified request (\"[METHOD ]URI\") in each new worker before accepting traffic", uwsgi_opt_add_string_list, &uwsgi.warmup_requests, 0},
+	{"admission-max-wait", required_argument, 0, "refuse requests that waited more than the specified msecs in the listen queue", uwsgi_opt_set_int, &uwsgi.admission_max_wait, 0},
+	{"admission-socket-max-wait", required_argument, 0, "refuse requests that waited more than the specified msecs in the listen queue of a socket (syntax: <socket>=<ms>)", uwsgi_opt_add_string_list, &uwsgi.admission_socket_max_wait, 0},
+	{"admission-codel", required_argument, 0, "enable CoDel-like load shedding with the specified target (msecs) for the listen queue wait", uwsgi_opt_set_int, &uwsgi.admission_codel, 0},
+	{"admission-codel-interval", required_argument, 0, "set the interval (msecs) of the CoDel-like load shedding (default 100)", uwsgi_opt_set_int, &uwsgi.admission_codel_interval, 0},
+	{"admission-503", no_argument, 0, "answer requests refused by the admission controller with a 503 instead of closing the connection", uwsgi_opt_true, &uwsgi.admission_503, 0},
+	{"zygote", no_argument, 0, "load apps once in a zygote process and fork lazy-apps workers from it", uwsgi_opt_true, &uwsgi.zygote, UWSGI_OPT_MASTER},
 	{"cheap", no_argument, 0, "set cheap mode (spawn workers only after the first request)", uwsgi_opt_true, &uwsgi.status.is_cheap, UWSGI_OPT_MASTER},
 	{"cheaper", required_argument, 0, "set cheaper mode (adaptive process spawning)", uwsgi_opt_set_int, &uwsgi.cheaper_count, UWSGI_OPT_MASTER | UWSGI_OPT_CHEAPER},
+	{"cheaper-standby", required_argument, 0, "keep the specified number of pre-forked workers (with apps loaded) parked for instant cheaper scale-up", uwsgi_opt_set_int, &uwsgi.cheaper_standby, UWSGI_OPT_MASTER | UWSGI_OPT_CHEAPER},
 	{"cheaper-initial", required_argument, 0, "set the initial number of processes to spawn in cheaper mode", uwsgi_opt_set_int, &uwsgi.cheaper_initial, UWSGI_OPT_MASTER | UWSGI_OPT_CHEAPER},
 	{"cheaper-algo", required_argument, 0, "choose to algorithm used for adaptive process spawning", uwsgi_opt_set_str, &uwsgi.requested_cheaper_algo, UWSGI_OPT_MASTER},
 	{"cheaper-step", required_argument, 0, "number of additional processes to spawn at each overload", uwsgi_opt_set_int, &uwsgi.cheaper_step, UWSGI_OPT_MASTER | UWSGI_OPT_CHEAPER},
@@ -928,6 +1018,12 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"websockets-max-size", required_argument, 0, "set the max allowed size of websocket messages (in Kbytes, default 1024)", uwsgi_opt_set_64bit, &uwsgi.websockets_max_size, 0},
 	{"websocket-max-size", required_argument, 0, "set the max allowed size of websocket messages (in Kbytes, default 1024)", uwsgi_opt_set_64bit, &uwsgi.websockets_max_size, 0},
 
+	{"websockets-deflate", no_argument, 0, "negotiate the permessage-deflate extension (RFC 7692) with websockets clients", uwsgi_opt_true, &uwsgi.websockets_deflate, 0},
+	{"websocket-deflate", no_argument, 0, "negotiate the permessage-deflate extension (RFC 7692) with websockets clients", uwsgi_opt_true, &uwsgi.websockets_deflate, 0},
+	{"websockets-deflate-no-context-takeover", no_argument, 0, "do not keep the websockets compression contexts between messages (less memory, worse ratio)", uwsgi_opt_true, &uwsgi.websockets_deflate_no_context_takeover, 0},
+	{"websockets-deflate-window-bits", required_argument, 0, "set the max compression window (9-15, default 15) of websockets permessage-deflate", uwsgi_opt_set_int, &uwsgi.websockets_deflate_window_bits, 0},
+	{"websockets-hub", required_argument, 0, "publish the websockets channel messages to the specified http router websockets hub socket (udp address or unix path)", uwsgi_opt_set_str, &uwsgi.websockets_hub, 0},
+
 	{"chunked-input-limit", required_argument, 0, "set the max size of a chunked input part (default 1MB, in bytes)", uwsgi_opt_set_64bit, &uwsgi.chunked_input_limit, 0},
 	{"chunked-input-timeout", required_argument, 0, "set default timeout for chunked input", uwsgi_opt_set_int, &uwsgi.chunked_input_timeout, 0},
 
@@ -954,6 +1050,11 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"static-safe", required_argument, 0, "skip security checks if the file is under the specified path", uwsgi_opt_add_string_list, &uwsgi.static_safe, UWSGI_OPT_MIME},
 	{"static-cache-paths", required_argument, 0, "put resolved paths in the uWSGI cache for the specified amount of seconds", uwsgi_opt_set_int, &uwsgi.use_static_cache_paths, UWSGI_OPT_MIME|UWSGI_OPT_MASTER},
 	{"static-cache-paths-name", required_argument, 0, "use the specified cache for static paths", uwsgi_opt_set_str, &uwsgi.static_cache_paths_name, UWSGI_OPT_MIME|UWSGI_OPT_MASTER},
+	{"static-fd-cache", required_argument, 0, "cache the open fds, stat() and mime types of up to N static files in each core (invalidated via inotify)", uwsgi_opt_set_int, &uwsgi.static_fd_cache, UWSGI_OPT_MIME},
+	{"static-fd-cache-ttl", required_argument, 0, "revalidate the entries of the static fd cache after the specified number of seconds", uwsgi_opt_set_int, &uwsgi.static_fd_cache_ttl, UWSGI_OPT_MIME},
+	{"static-etag", no_argument, 0, "add strong ETags (from inode, mtime and size) to static files and honour If-None-Match", uwsgi_opt_true, &uwsgi.static_etag, UWSGI_OPT_MIME},
+	{"static-pin", required_argument, 0, "load the static files matching the specified glob (and their compressed variants) in shared memory at startup", uwsgi_opt_add_string_list, &uwsgi.static_pin, UWSGI_OPT_MIME},
+	{"static-pin-max-size", required_argument, 0, "set the max size of the pinned static files (default 1M)", uwsgi_opt_set_64bit, &uwsgi.static_pin_max_size, UWSGI_OPT_MIME},
 #ifdef __APPLE__
 	{"mimefile", required_argument, 0, "set mime types file path (default /etc/apache2/mime.types)", uwsgi_opt_add_string_list, &uwsgi.mime_file, UWSGI_OPT_MIME},
 	{"mime-file", required_argument, 0, "set mime types file path (default /etc/apache2/mime.types)", uwsgi_opt_add_string_list, &uwsgi.mime_file, UWSGI_OPT_MIME},
@@ -985,7 +1086,14 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"honour-range", no_argument, 0, "enable support for the HTTP Range header", uwsgi_opt_true, &uwsgi.honour_range, 0},
 
 	{"offload-threads", required_argument, 0, "set the number of offload threads to spawn (per-worker, default 0)", uwsgi_opt_set_int, &uwsgi.offload_threads, 0},
+#ifdef UWSGI_IO_URING
+	{"offload-io-uring", no_argument, 0, "use io_uring for memory and sendfile offloading (batched submissions, no readiness polling)", uwsgi_opt_true, &uwsgi.offload_io_uring, 0},
+#endif
 	{"offload-thread", required_argument, 0, "set the number of offload threads to spawn (per-worker, default 0)", uwsgi_opt_set_int, &uwsgi.offload_threads, 0},
+	{"offload-sendfile-rate", required_argument, 0, "limit every offloaded sendfile transfer to the specified bytes per second", uwsgi_opt_set_64bit, &uwsgi.offload_sendfile_rate, 0},
+	{"sendfile-readahead", required_argument, 0, "prefetch the specified amount of bytes ahead of sendfile transfers (cold reads of offloaded transfers are moved to a helper thread)", uwsgi_opt_set_64bit, &uwsgi.sendfile_readahead, 0},
+	{"offload-http-keepalive", required_argument, 0, "set the max number of idle upstream connections kept by each offload thread for http proxying (default 8)", uwsgi_opt_set_int, &uwsgi.offload_http_keepalive, 0},
+	{"connection-pool-size", required_argument, 0, "set the max number of idle backend connections (redis, memcached...) kept by each process for every address (default 8, 0 disables pooling)", uwsgi_opt_set_int, &uwsgi.connection_pool_size, 0},
 
 	{"file-serve-mode", required_argument, 0, "set static file serving mode", uwsgi_opt_fileserve_mode, NULL, UWSGI_OPT_MIME},
 	{"fileserve-mode", required_argument, 0, "set static file serving mode", uwsgi_opt_fileserve_mode, NULL, UWSGI_OPT_MIME},
@@ -1015,6 +1123,9 @@ static struct uwsgi_option uwsgi_base_options[] = {
 #endif
 	{"enable-proxy-protocol", no_argument, 0, "enable PROXY1 protocol support (only for http parsers)", uwsgi_opt_true, &uwsgi.enable_proxy_protocol, 0},
 	{"reuse-port", no_argument, 0, "enable REUSE_PORT flag on socket (BSD and Linux >3.9 only)", uwsgi_opt_true, &uwsgi.reuse_port, 0},
+	{"reuse-port-per-worker", no_argument, 0, "bind a REUSE_PORT TCP socket for each worker, the kernel balances connections without accept() contention", uwsgi_opt_true, &uwsgi.reuse_port_per_worker, 0},
+	{"reuse-port-numa-steering", no_argument, 0, "steer connections to a worker on the NUMA node of the cpu receiving them (Linux only, requires --reuse-port-per-worker and --numa-affinity)", uwsgi_opt_true, &uwsgi.reuse_port_numa_steering, 0},
+	{"reuse-port-cpu-steering", no_argument, 0, "steer connections to the worker associated with the cpu receiving them (Linux only, requires --reuse-port-per-worker)", uwsgi_opt_true, &uwsgi.reuse_port_cpu_steering, 0},
 	{"tcp-fast-open", required_argument, 0, "enable TCP_FASTOPEN flag on TCP sockets with the specified qlen value", uwsgi_opt_set_int, &uwsgi.tcp_fast_open, 0},
 	{"tcp-fastopen", required_argument, 0, "enable TCP_FASTOPEN flag on TCP sockets with the specified qlen value", uwsgi_opt_set_int, &uwsgi.tcp_fast_open, 0},
 	{"tcp-fast-open-client", no_argument, 0, "use sendto(..., MSG_FASTOPEN, ...) instead of connect() if supported", uwsgi_opt_true, &uwsgi.tcp_fast_open_client, 0},
@@ -1022,11 +1133,14 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"zerg", required_argument, 0, "attach to a zerg server", uwsgi_opt_add_string_list, &uwsgi.zerg_node, 0},
 	{"zerg-fallback", no_argument, 0, "fallback to normal sockets if the zerg server is not available", uwsgi_opt_true, &uwsgi.zerg_fallback, 0},
 	{"zerg-server", required_argument, 0, "enable the zerg server on the specified UNIX socket", uwsgi_opt_set_str, &uwsgi.zerg_server, UWSGI_OPT_MASTER},
+	{"zerg-server-reuseport", no_argument, 0, "give every zerg its own REUSE_PORT TCP sockets (on Linux connections are steered to the less busy ones)", uwsgi_opt_true, &uwsgi.zerg_server_reuseport, UWSGI_OPT_MASTER},
 
 	{"cron", required_argument, 0, "add a cron task", uwsgi_opt_add_cron, NULL, UWSGI_OPT_MASTER},
 	{"cron2", required_argument, 0, "add a cron task (key=val syntax)", uwsgi_opt_add_cron2, NULL, UWSGI_OPT_MASTER},
 	{"unique-cron", required_argument, 0, "add a unique cron task", uwsgi_opt_add_unique_cron, NULL, UWSGI_OPT_MASTER},
 	{"cron-harakiri", required_argument, 0, "set the maximum time (in seconds) we wait for cron command to complete", uwsgi_opt_set_int, &uwsgi.cron_harakiri, 0},
+	{"cron-spread", required_argument, 0, "delay every cron task by a stable per-instance offset up to the specified number of seconds", uwsgi_opt_set_int, &uwsgi.cron_spread, 0},
+	{"cron-jitter", required_argument, 0, "delay every cron task run by a random time up to the specified number of seconds", uwsgi_opt_set_int, &uwsgi.cron_jitter, 0},
 #ifdef UWSGI_SSL
 	{"legion-cron", required_argument, 0, "add a cron task runnable only when the instance is a lord of the specified legion", uwsgi_opt_add_legion_cron, NULL, UWSGI_OPT_MASTER},
 	{"cron-legion", required_argument, 0, "add a cron task runnable only when the instance is a lord of the specified legion", uwsgi_opt_add_legion_cron, NULL, UWSGI_OPT_MASTER},
@@ -1064,6 +1178,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 
 	{"dump-options", no_argument, 0, "dump the full list of available options", uwsgi_opt_true, &uwsgi.dump_options, 0},
 	{"show-config", no_argument, 0, "show the current config reformatted as ini", uwsgi_opt_true, &uwsgi.show_config, 0},
+	{"compile-config", required_argument, 0, "write the resolved config to the specified file in compiled form and exit", uwsgi_opt_set_str, &uwsgi.compile_config, 0},
 	{"binary-append-data", required_argument, 0, "return the content of a resource to stdout for appending to a uwsgi binary (for data:// usage)", uwsgi_opt_binary_append_data, NULL, UWSGI_OPT_IMMEDIATE},
 	{"print", required_argument, 0, "simple print", uwsgi_opt_print, NULL, 0},
 	{"iprint", required_argument, 0, "simple print (immediate version)", uwsgi_opt_print, NULL, UWSGI_OPT_IMMEDIATE},
@@ -1557,6 +1672,29 @@ void stats(int signum) {
 	uwsgi_log("\n");
 }
 
+// --harakiri-soft: abort the requests over the harakiri timeout (they could be already finished)
+void soft_harakiri(int signum) {
+	int i;
+	time_t now = uwsgi_now();
+	for (i = 0; i < uwsgi.cores; i++) {
+		time_t harakiri = uwsgi.workers[uwsgi.mywid].cores[i].harakiri;
+		if (harakiri > 0 && harakiri < now) break;
+	}
+	if (i >= uwsgi.cores) return;
+
+	uwsgi_log("SOFT HARAKIRI: asking worker %d (pid: %d) to abort the request on core %d\n", uwsgi.mywid, uwsgi.mypid, i);
+	int j, k;
+	for (j = 0; j < 256; j++) {
+		if (!uwsgi.p[j]->soft_harakiri) continue;
+		// a plugin can be mapped to more than one modifier1
+		for (k = 0; k < j; k++) {
+			if (uwsgi.p[k] == uwsgi.p[j]) break;
+		}
+		if (k < j) continue;
+		uwsgi.p[j]->soft_harakiri(i);
+	}
+}
+
 void what_i_am_doing() {
 
 	struct wsgi_request *wsgi_req;
@@ -2139,7 +2277,6 @@ void uwsgi_setup(int argc, char *argv[], char *envp[]) {
 
 	int i;
 
-
 	// signal mask is inherited, and sme process manager could make a real mess...
 	sigset_t smask;
         sigfillset(&smask);
@@ -2170,6 +2307,8 @@ void uwsgi_setup(int argc, char *argv[], char *envp[]) {
 	uwsgi_register_clock(&uwsgi_unix_clock);
 	uwsgi_set_clock("unix");
 
+	uwsgi_startup_trace_init();
+
 	// fallback config
 	atexit(uwsgi_fallback_config);
 	// manage/flush logs
@@ -2336,6 +2475,11 @@ configure:
 	// ok, the options dictionary is available, lets manage it
 	uwsgi_configure();
 
+	uwsgi_startup_trace_phase("configuration");
+
+	// the emperor will push it back on reload
+	uwsgi_compiled_config_send_to_emperor();
+
 	// stop the execution until a connection arrives on the fork socket
 	if (uwsgi.fork_socket) {
 		uwsgi_log_verbose("waiting for fork-socket connections...\n");
@@ -2436,6 +2580,9 @@ configure:
 	// setup imperial monitors
 	uwsgi_register_imperial_monitor("dir", uwsgi_imperial_monitor_directory_init, uwsgi_imperial_monitor_directory);
 	uwsgi_register_imperial_monitor("glob", uwsgi_imperial_monitor_glob_init, uwsgi_imperial_monitor_glob);
+#ifdef __linux__
+	uwsgi_register_imperial_monitor("inotify", uwsgi_imperial_monitor_inotify_init, uwsgi_imperial_monitor_inotify);
+#endif
 
 	// setup stats pushers
 	uwsgi_stats_pusher_setup();
@@ -2457,6 +2604,11 @@ configure:
 	if (uwsgi.show_config)
 		show_config();
 
+	if (uwsgi.compile_config) {
+		uwsgi_compiled_config_dump();
+		exit(0);
+	}
+
 	if (uwsgi.plugins_list)
 		plugins_list();
 
@@ -2837,6 +2989,9 @@ int uwsgi_start(void *v_argv) {
 		}
 	}
 
+	// load the pinned static files (after the mime types)
+	uwsgi_static_pin_init();
+
 	if (uwsgi.async > 0) {
 		if ((unsigned long) uwsgi.max_fd < (unsigned long) uwsgi.async) {
 			uwsgi_log_initial("- your current max open files limit is %lu, this is lower than requested async cores !!! -\n", (unsigned long) uwsgi.max_fd);
@@ -2874,12 +3029,28 @@ int uwsgi_start(void *v_argv) {
 		uwsgi_log_initial("thunder lock: disabled (you can enable it with --thunder-lock)\n");
 	}
 
+	if (uwsgi.memory_stats) {
+		char *allocator = uwsgi_memory_allocator();
+		if (!allocator) {
+			uwsgi_log("!!! heap statistics are not available for this allocator, only allocation counters will be reported !!!\n");
+		}
+		else {
+			uwsgi_log_initial("memory stats: enabled (allocator: %s)\n", allocator);
+		}
+	}
+
+	uwsgi_startup_trace_phase("core setup and locking");
+
 	// allocate rpc structures
         uwsgi_rpc_init();
 
+	uwsgi_numa_init();
+
 	// initialize sharedareas
 	uwsgi_sharedareas_init();
 
+	uwsgi_startup_trace_phase("sharedareas");
+
 	uwsgi.snmp_lock = uwsgi_lock_init("snmp");
 
 	// setup queue
@@ -2889,6 +3060,16 @@ int uwsgi_start(void *v_argv) {
 
 	uwsgi_cache_create_all();
 
+	uwsgi_startup_trace_phase("queue and caches");
+
+	if (uwsgi.subscription_hash_name) {
+		uwsgi.subscription_hash = uwsgi_hash_algo_get(uwsgi.subscription_hash_name);
+		if (!uwsgi.subscription_hash) {
+			uwsgi_log("unable to find hash algorithm \"%s\"\n", uwsgi.subscription_hash_name);
+			exit(1);
+		}
+	}
+
 	if (uwsgi.use_check_cache) {
 		uwsgi.check_cache = uwsgi_cache_by_name(uwsgi.use_check_cache);
 		if (!uwsgi.check_cache) {
@@ -2925,9 +3106,7 @@ int uwsgi_start(void *v_argv) {
 
 	/* plugin initialization */
 	for (i = 0; i < uwsgi.gp_cnt; i++) {
-		if (uwsgi.gp[i]->init) {
-			uwsgi.gp[i]->init();
-		}
+		uwsgi_plugin_hook_call(uwsgi.gp[i], init);
 	}
 
 	if (!uwsgi.no_server) {
@@ -2958,15 +3137,14 @@ int uwsgi_start(void *v_argv) {
 		// put listening socket in non-blocking state and set the protocol
 		uwsgi_set_sockets_protocols();
 
+		uwsgi_startup_trace_phase("sockets");
 	}
 
 
 	// initialize request plugin only if workers or master are available
 	if (uwsgi.sockets || uwsgi.master_process || uwsgi.no_server || uwsgi.command_mode || uwsgi.loop) {
 		for (i = 0; i < 256; i++) {
-			if (uwsgi.p[i]->init) {
-				uwsgi.p[i]->init();
-			}
+			uwsgi_plugin_hook_call(uwsgi.p[i], init);
 		}
 	}
 
@@ -2978,20 +3156,18 @@ int uwsgi_start(void *v_argv) {
 
 	/* gp/plugin initialization */
 	for (i = 0; i < uwsgi.gp_cnt; i++) {
-		if (uwsgi.gp[i]->post_init) {
-			uwsgi.gp[i]->post_init();
-		}
+		uwsgi_plugin_hook_call(uwsgi.gp[i], post_init);
 	}
 
 	// again check for workers/sockets...
 	if (uwsgi.sockets || uwsgi.master_process || uwsgi.no_server || uwsgi.command_mode || uwsgi.loop) {
 		for (i = 0; i < 256; i++) {
-			if (uwsgi.p[i]->post_init) {
-				uwsgi.p[i]->post_init();
-			}
+			uwsgi_plugin_hook_call(uwsgi.p[i], post_init);
 		}
 	}
 
+	uwsgi_startup_trace_phase("plugins init");
+
 	uwsgi.current_wsgi_req = simple_current_wsgi_req;
 
 
@@ -3134,12 +3310,16 @@ unsafe:
 
 
 	// initialize post buffering values
-	if (uwsgi.post_buffering > 0)
+	if (uwsgi.post_buffering > 0 || uwsgi.post_buffering_socket)
 		uwsgi_setup_post_buffering();
 
 	// initialize workers/master shared memory segments
 	uwsgi_setup_workers();
 
+	// create the pools of the priority classes (before forking)
+	uwsgi_priority_setup();
+	uwsgi_affinity_setup();
+
 	// create signal pipes if master is enabled
 	if (uwsgi.master_process) {
 		for (i = 1; i <= uwsgi.numproc; i++) {
@@ -3193,13 +3373,25 @@ unsafe:
 	// cores are allocated, lets allocate logformat (if required)
 	if (uwsgi.logformat) {
 		uwsgi_build_log_format(uwsgi.logformat);
-		uwsgi.logit = uwsgi_logit_lf;
+		uwsgi.logit = uwsgi.logformat_msgpack ? uwsgi_logit_lf_msgpack : uwsgi_logit_lf;
 		uwsgi.logvectors = uwsgi_malloc(sizeof(struct iovec *) * uwsgi.cores);
 		for (j = 0; j < uwsgi.cores; j++) {
 			uwsgi.logvectors[j] = uwsgi_malloc(sizeof(struct iovec) * uwsgi.logformat_vectors);
 			uwsgi.logvectors[j][uwsgi.logformat_vectors - 1].iov_base = "\n";
 			uwsgi.logvectors[j][uwsgi.logformat_vectors - 1].iov_len = 1;
 		}
+		if (uwsgi.logformat_buffer_size) {
+			uwsgi.logbuffers = uwsgi_malloc(sizeof(char *) * uwsgi.cores);
+			for (j = 0; j < uwsgi.cores; j++) {
+				uwsgi.logbuffers[j] = uwsgi_malloc(uwsgi.logformat_buffer_size);
+			}
+		}
+		if (uwsgi.logformat_msgpack) {
+			uwsgi.logformat_ub = uwsgi_malloc(sizeof(struct uwsgi_buffer *) * uwsgi.cores);
+			for (j = 0; j < uwsgi.cores; j++) {
+				uwsgi.logformat_ub[j] = uwsgi_buffer_new(uwsgi.page_size);
+			}
+		}
 	}
 
 	// initialize locks and socket as soon as possible, as the master could enqueue tasks
@@ -3209,6 +3401,7 @@ unsafe:
 		while (uspool) {
 			// lock is required even in EXTERNAL mode
 			uspool->lock = uwsgi_lock_init(uwsgi_concat2("spooler on ", uspool->dir));
+			uwsgi_spooler_wakeup_init(uspool);
 			if (uspool->mode == UWSGI_SPOOLER_EXTERNAL)
 				goto next;
 			create_signal_pipe(uspool->signal_pipe);
@@ -3217,17 +3410,15 @@ next:
 		}
 	}
 
+	uwsgi_startup_trace_phase("workers, mules and spoolers setup");
+
 	// preinit apps (create the language environment)
 	for (i = 0; i < 256; i++) {
-		if (uwsgi.p[i]->preinit_apps) {
-			uwsgi.p[i]->preinit_apps();
-		}
+		uwsgi_plugin_hook_call(uwsgi.p[i], preinit_apps);
 	}
 
 	for (i = 0; i < uwsgi.gp_cnt; i++) {
-		if (uwsgi.gp[i]->preinit_apps) {
-			uwsgi.gp[i]->preinit_apps();
-		}
+		uwsgi_plugin_hook_call(uwsgi.gp[i], preinit_apps);
 	}
 
 	//init apps hook (if not lazy)
@@ -3235,6 +3426,8 @@ next:
 		uwsgi_init_all_apps();
 	}
 
+	uwsgi_startup_trace_phase("apps");
+
 	// Register uwsgi atexit plugin callbacks after all applications have
 	// been loaded. This ensures plugin atexit callbacks are called prior
 	// to application registered atexit callbacks.
@@ -3247,17 +3440,15 @@ next:
 
 	// postinit apps (setup specific features after app initialization)
 	for (i = 0; i < 256; i++) {
-		if (uwsgi.p[i]->postinit_apps) {
-			uwsgi.p[i]->postinit_apps();
-		}
+		uwsgi_plugin_hook_call(uwsgi.p[i], postinit_apps);
 	}
 
 	for (i = 0; i < uwsgi.gp_cnt; i++) {
-		if (uwsgi.gp[i]->postinit_apps) {
-			uwsgi.gp[i]->postinit_apps();
-		}
+		uwsgi_plugin_hook_call(uwsgi.gp[i], postinit_apps);
 	}
 
+	uwsgi_startup_trace_phase("postinit apps");
+
 	// initialize after_request hooks
 	uwsgi_foreach(usl, uwsgi.after_request_hooks) {
 		usl->custom_ptr =  dlsym(RTLD_DEFAULT, usl->value);
@@ -3376,6 +3567,18 @@ next2:
 		// setup internal signalling system
 		create_signal_pipe(uwsgi.shared->worker_signal_pipe);
 		uwsgi.signal_socket = uwsgi.shared->worker_signal_pipe[1];
+		// wakes up the master when a core sets an earlier harakiri
+		if (pipe(uwsgi.shared->deadline_pipe)) {
+			uwsgi_error("pipe()");
+			exit(1);
+		}
+		uwsgi_socket_nb(uwsgi.shared->deadline_pipe[0]);
+		uwsgi_socket_nb(uwsgi.shared->deadline_pipe[1]);
+	}
+
+	// the zygote must be ready before spawning workers
+	if (uwsgi.master_process) {
+		uwsgi_zygote_init();
 	}
 
 	// uWSGI is ready
@@ -3470,6 +3673,10 @@ int uwsgi_run() {
 	// eventually maps (or disable) sockets for the  worker
 	uwsgi_map_sockets();
 
+	// reserved workers stop accepting and wait for handed over connections
+	uwsgi_priority_worker_setup();
+	uwsgi_affinity_worker_setup();
+
 	// eventually set cpu affinity policies (OS-dependent)
 	uwsgi_set_cpu_affinity();
 
@@ -3582,7 +3789,8 @@ void uwsgi_worker_run() {
 
 	int i;
 
-	if (uwsgi.lazy || uwsgi.lazy_apps) {
+	// workers forked by the zygote already have the apps loaded
+	if ((uwsgi.lazy || uwsgi.lazy_apps) && !uwsgi.zygote_worker) {
 		uwsgi_init_all_apps();
 	}
 
@@ -3612,6 +3820,9 @@ void uwsgi_worker_run() {
 
 	uwsgi_unix_signal(SIGUSR1, stats);
 	signal(SIGUSR2, (void *) &what_i_am_doing);
+	if (uwsgi.harakiri_soft) {
+		uwsgi_unix_signal(SIGXCPU, soft_harakiri);
+	}
 	if (!uwsgi.ignore_sigpipe) {
 		signal(SIGPIPE, (void *) &warn_pipe);
 	}
@@ -3694,8 +3905,21 @@ void uwsgi_ignition() {
 		}
 	}
 
+	// resolve the admission control limits of the sockets
+	uwsgi_admission_setup();
+
+	// run the warmup requests (if any) before accepting traffic
+	uwsgi_warmup();
+
+	// with --cheaper-standby wait (warm) for the master to activate us
+	uwsgi_standby_park();
+
 	// mark the worker as "accepting" (this is a mark used by chain reloading)
 	uwsgi.workers[uwsgi.mywid].accepting = 1;
+	// ...and as ready, unless the app wants to do it by itself
+	if (!uwsgi.chain_reload_wait_ready) {
+		uwsgi.workers[uwsgi.mywid].ready = 1;
+	}
 	// ready to accept request, if i am a vassal signal Emperor about it
         if (uwsgi.has_emperor && uwsgi.mywid == 1) {
                 char byte = 5;
@@ -3922,6 +4146,10 @@ void uwsgi_init_all_apps() {
 
 	int i, j;
 
+	// the heap grown while loading the apps is accounted to the plugins
+	if (uwsgi.memory_stats)
+		uwsgi_memory_stats_apps_begin();
+
 	uwsgi_hooks_run(uwsgi.hook_pre_app, "pre app", 1);
 
 	// now run the pre-app scripts
@@ -3945,15 +4173,11 @@ void uwsgi_init_all_apps() {
 
 
 	for (i = 0; i < 256; i++) {
-		if (uwsgi.p[i]->init_apps) {
-			uwsgi.p[i]->init_apps();
-		}
+		uwsgi_plugin_hook_call(uwsgi.p[i], init_apps);
 	}
 
 	for (i = 0; i < uwsgi.gp_cnt; i++) {
-		if (uwsgi.gp[i]->init_apps) {
-			uwsgi.gp[i]->init_apps();
-		}
+		uwsgi_plugin_hook_call(uwsgi.gp[i], init_apps);
 	}
 
 	struct uwsgi_string_list *app_mps = uwsgi.mounts;
@@ -3965,7 +4189,10 @@ void uwsgi_init_all_apps() {
 			for (j = 0; j < 256; j++) {
 				if (uwsgi.p[j]->mount_app) {
 					uwsgi_log("mounting %s on %s\n", what, app_mps->value[0] == 0 ? "/" : app_mps->value);
-					if (uwsgi.p[j]->mount_app(app_mps->value[0] == 0 ? "/" : app_mps->value, what) != -1)
+					uint64_t mount_start = uwsgi_micros();
+					int ret = uwsgi.p[j]->mount_app(app_mps->value[0] == 0 ? "/" : app_mps->value, what);
+					if (uwsgi.startup_trace) uwsgi_startup_trace_hook(uwsgi.p[j]->name, "mount_app", mount_start);
+					if (ret != -1)
 						break;
 				}
 			}
@@ -4017,6 +4244,8 @@ void uwsgi_init_all_apps() {
                 }
         }
 
+	if (uwsgi.memory_stats)
+		uwsgi_memory_stats_apps_end();
 }
 
 void uwsgi_init_worker_mount_apps() {
@@ -4554,8 +4783,12 @@ void uwsgi_opt_load_plugin(char *opt, char *value, void *none) {
 #ifdef UWSGI_DEBUG
 		uwsgi_debug("loading plugin %s\n", p);
 #endif
+		uint64_t load_start = uwsgi_micros();
 		if (uwsgi_load_plugin(-1, p, NULL)) {
 			build_options();
+			// --startup-trace could still be unparsed, so keep the timing until the first phase report
+			struct uwsgi_string_list *usl = uwsgi_string_new_list(&uwsgi.startup_trace_loads, uwsgi_str(p));
+			usl->custom = uwsgi_micros() - load_start;
 		}
 		else if (!uwsgi_startswith(opt, "need-", 5)) {
 			uwsgi_log("unable to load plugin \"%s\"\n", p);
@@ -4787,6 +5020,10 @@ void uwsgi_opt_load(char *opt, char *filename, void *none) {
 		uwsgi_opt_load_ini(opt, filename, none);
 		goto end;
 	}
+	if (uwsgi_endswith(filename, ".ucc")) {
+		uwsgi_opt_load_compiled(opt, filename, none);
+		goto end;
+	}
 #ifdef UWSGI_XML
 	if (uwsgi_endswith(filename, ".xml")) {
 		uwsgi_opt_load_xml(opt, filename, none);
@@ -0,0 +1,154 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	warmup requests (--warmup-request "[METHOD ]URI")
+
+	before entering the accepting phase a freshly spawned worker runs the configured requests
+	through the normal request handlers: the uwsgi packet is written in a socketpair and parsed by
+	the uwsgi protocol (as a web server would send it), while the response is discarded by
+	the write hooks of a fake socket.
+
+	apps can recognize warmup requests by the HTTP_X_UWSGI_WARMUP var
+
+*/
+
+static int warmup_write(struct wsgi_request *wsgi_req, char *buf, size_t len) {
+	wsgi_req->write_pos = len;
+	return UWSGI_OK;
+}
+
+static int warmup_writev(struct wsgi_request *wsgi_req, struct iovec *iov, size_t *len) {
+	size_t i;
+	for(i=0;i<*len;i++) wsgi_req->write_pos += iov[i].iov_len;
+	return UWSGI_OK;
+}
+
+static int warmup_sendfile(struct wsgi_request *wsgi_req, int fd, size_t pos, size_t len) {
+	wsgi_req->write_pos = len;
+	return UWSGI_OK;
+}
+
+static struct uwsgi_buffer *warmup_packet(char *request) {
+	char *method = "GET";
+	size_t method_len = 3;
+	char *uri = request;
+
+	char *space = strchr(request, ' ');
+	if (space) {
+		method = request;
+		method_len = space - request;
+		uri = space + 1;
+	}
+	size_t uri_len = strlen(uri);
+
+	char *path = uri;
+	size_t path_len = uri_len;
+	char *query = "";
+	size_t query_len = 0;
+	char *qm = memchr(uri, '?', uri_len);
+	if (qm) {
+		path_len = qm - uri;
+		query = qm + 1;
+		query_len = uri_len - (path_len + 1);
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	// leave space for the uwsgi header
+	ub->pos = 4;
+	if (uwsgi_buffer_append_keyval(ub, "REQUEST_METHOD", 14, method, method_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "REQUEST_URI", 11, uri, uri_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "PATH_INFO", 9, path, path_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "QUERY_STRING", 12, query, query_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "SERVER_PROTOCOL", 15, "HTTP/1.1", 8)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "SERVER_NAME", 11, "localhost", 9)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "SERVER_PORT", 11, "0", 1)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "REMOTE_ADDR", 11, "127.0.0.1", 9)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "HTTP_HOST", 9, "localhost", 9)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "HTTP_X_UWSGI_WARMUP", 19, "1", 1)) goto error;
+	if (uwsgi_buffer_set_uh(ub, uwsgi.http_modifier1, uwsgi.http_modifier2)) goto error;
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+void uwsgi_warmup() {
+	if (!uwsgi.warmup_requests) return;
+
+	if (uwsgi.async > 0) {
+		uwsgi_log("*** warmup requests are not supported in async mode ***\n");
+		return;
+	}
+
+	static struct uwsgi_socket warmup_socket;
+	memset(&warmup_socket, 0, sizeof(struct uwsgi_socket));
+	warmup_socket.name = "warmup";
+	warmup_socket.fd = -1;
+	uwsgi_proto_uwsgi_setup(&warmup_socket);
+	warmup_socket.proto_write = warmup_write;
+	warmup_socket.proto_write_headers = warmup_write;
+	warmup_socket.proto_writev = warmup_writev;
+	warmup_socket.proto_sendfile = warmup_sendfile;
+	warmup_socket.can_offload = 0;
+
+	struct wsgi_request *wsgi_req = &uwsgi.workers[uwsgi.mywid].cores[0].req;
+	uwsgi.wsgi_req = wsgi_req;
+	if (uwsgi.threads > 1) {
+		pthread_setspecific(uwsgi.tur_key, (void *) wsgi_req);
+	}
+
+	int count = 0, failed = 0;
+	uint64_t start = uwsgi_micros();
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uwsgi.warmup_requests) {
+		struct uwsgi_buffer *ub = warmup_packet(usl->value);
+		if (!ub) {
+			uwsgi_log("[warmup] unable to build request \"%s\"\n", usl->value);
+			failed++;
+			continue;
+		}
+
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+			uwsgi_error("uwsgi_warmup()/socketpair()");
+			uwsgi_buffer_destroy(ub);
+			break;
+		}
+
+		if (write(fds[1], ub->buf, ub->pos) != (ssize_t) ub->pos) {
+			uwsgi_error("uwsgi_warmup()/write()");
+			uwsgi_buffer_destroy(ub);
+			close(fds[0]);
+			close(fds[1]);
+			failed++;
+			continue;
+		}
+		uwsgi_buffer_destroy(ub);
+
+		wsgi_req_setup(wsgi_req, 0, &warmup_socket);
+		wsgi_req->fd = fds[0];
+		wsgi_req->do_not_log = 1;
+		wsgi_req->do_not_account = 1;
+		wsgi_req->do_not_account_avg_rt = 1;
+
+		count++;
+		if (wsgi_req_recv(0, wsgi_req)) {
+			uwsgi_log("[warmup] request \"%s\" failed\n", usl->value);
+			failed++;
+			uwsgi_destroy_request(wsgi_req);
+		}
+		else {
+			if (wsgi_req->status >= 500) {
+				uwsgi_log("[warmup] request \"%s\" returned %d\n", usl->value, wsgi_req->status);
+				failed++;
+			}
+			uwsgi_close_request(wsgi_req);
+		}
+		close(fds[1]);
+	}
+
+	uwsgi_log("warmup of worker %d done: %d requests (%d failed) in %llu msecs\n", uwsgi.mywid, count, failed, (unsigned long long) ((uwsgi_micros() - start) / 1000));
+}
@@ -12,7 +12,242 @@ extern struct uwsgi_server uwsgi;
 
 #define REQ_DATA wsgi_req->method_len, wsgi_req->method, wsgi_req->uri_len, wsgi_req->uri, wsgi_req->remote_addr_len, wsgi_req->remote_addr 
 
-static struct uwsgi_buffer *uwsgi_websocket_message(struct wsgi_request *wsgi_req, char *msg, size_t len, uint8_t opcode) {
+#define UWSGI_WEBSOCKET_DEFLATE 1
+#define UWSGI_WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT 2
+#define UWSGI_WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT 4
+
+/*
+
+	permessage-deflate (RFC 7692)
+
+	with --websockets-deflate the extension is accepted in the handshake, text and binary messages are sent compressed
+	(with the RSV1 bit) and compressed messages from the client are inflated (up to --websockets-max-size).
+
+	By default the compression contexts are kept for the whole connection (the best ratio for repetitive traffic),
+	--websockets-deflate-no-context-takeover asks both peers to reset them after every message: the streams are
+	allocated only while a message is processed, so idle connections do not hold the zlib windows.
+	--websockets-deflate-window-bits reduces the window (and the memory) of the server compressor.
+
+*/
+
+#ifdef UWSGI_ZLIB
+static z_stream *uwsgi_websocket_deflater(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->websocket_deflater) {
+		z_stream *z = uwsgi_malloc(sizeof(z_stream));
+		if (uwsgi_deflate_init_raw(z, wsgi_req->websocket_deflate_window_bits)) {
+			free(z);
+			return NULL;
+		}
+		wsgi_req->websocket_deflater = z;
+	}
+	return (z_stream *) wsgi_req->websocket_deflater;
+}
+
+static z_stream *uwsgi_websocket_inflater(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->websocket_inflater) {
+		z_stream *z = uwsgi_malloc(sizeof(z_stream));
+		if (uwsgi_inflate_init_raw(z)) {
+			free(z);
+			return NULL;
+		}
+		wsgi_req->websocket_inflater = z;
+	}
+	return (z_stream *) wsgi_req->websocket_inflater;
+}
+
+static void uwsgi_websocket_deflater_free(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->websocket_deflater) return;
+	deflateEnd((z_stream *) wsgi_req->websocket_deflater);
+	free(wsgi_req->websocket_deflater);
+	wsgi_req->websocket_deflater = NULL;
+}
+
+static void uwsgi_websocket_inflater_free(struct wsgi_request *wsgi_req) {
+	if (!wsgi_req->websocket_inflater) return;
+	inflateEnd((z_stream *) wsgi_req->websocket_inflater);
+	free(wsgi_req->websocket_inflater);
+	wsgi_req->websocket_inflater = NULL;
+}
+
+// compress a whole message (without the final empty block)
+static struct uwsgi_buffer *uwsgi_websocket_compress(struct wsgi_request *wsgi_req, char *msg, size_t len) {
+	z_stream *z = uwsgi_websocket_deflater(wsgi_req);
+	if (!z) return NULL;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new((len / 2) + 64);
+	z->next_in = (Bytef *) msg;
+	z->avail_in = len;
+	do {
+		if (uwsgi_buffer_ensure(ub, 4096)) goto error;
+		z->next_out = (Bytef *) ub->buf + ub->pos;
+		z->avail_out = ub->len - ub->pos;
+		int ret = deflate(z, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR) goto error;
+		ub->pos = ub->len - z->avail_out;
+	} while (z->avail_out == 0);
+
+	// strip the 0x00 0x00 0xff 0xff tail
+	if (ub->pos >= 4) ub->pos -= 4;
+
+	if (wsgi_req->websocket_deflate & UWSGI_WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT) {
+		uwsgi_websocket_deflater_free(wsgi_req);
+	}
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	uwsgi_websocket_deflater_free(wsgi_req);
+	return NULL;
+}
+
+// inflate a whole message (the buffer is extended with the final empty block)
+static struct uwsgi_buffer *uwsgi_websocket_decompress(struct wsgi_request *wsgi_req, struct uwsgi_buffer *msg) {
+	z_stream *z = uwsgi_websocket_inflater(wsgi_req);
+	if (!z) return NULL;
+	if (uwsgi_buffer_append(msg, "\0\0\xff\xff", 4)) return NULL;
+
+	uint64_t max_size = uwsgi.websockets_max_size * 1024;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new((msg->pos * 2) + 64);
+	z->next_in = (Bytef *) msg->buf;
+	z->avail_in = msg->pos;
+	for (;;) {
+		if (uwsgi_buffer_ensure(ub, 4096)) goto error;
+		z->next_out = (Bytef *) ub->buf + ub->pos;
+		z->avail_out = ub->len - ub->pos;
+		int ret = inflate(z, Z_SYNC_FLUSH);
+		ub->pos = ub->len - z->avail_out;
+		if (ub->pos > max_size) {
+			uwsgi_log("[uwsgi-websocket] \"%.*s %.*s\" (%.*s) invalid compressed message, inflated size over %llu\n", REQ_DATA, (unsigned long long) max_size);
+			goto error;
+		}
+		// the peer could have ended the deflate stream
+		if (ret == Z_STREAM_END) {
+			if (z->avail_in == 0) {
+				inflateReset(z);
+				break;
+			}
+			inflateReset(z);
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			uwsgi_log("[uwsgi-websocket] \"%.*s %.*s\" (%.*s) invalid compressed message\n", REQ_DATA);
+			goto error;
+		}
+		if (z->avail_in == 0 && z->avail_out > 0) break;
+		// no progress
+		if (ret == Z_BUF_ERROR && z->avail_out > 0) break;
+	}
+
+	if (wsgi_req->websocket_deflate & UWSGI_WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT) {
+		uwsgi_websocket_inflater_free(wsgi_req);
+	}
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	uwsgi_websocket_inflater_free(wsgi_req);
+	return NULL;
+}
+
+#ifdef UWSGI_SSL
+// parse the permessage-deflate offer of the client and build the response (the handshake needs sha1)
+static int uwsgi_websocket_deflate_negotiate(struct wsgi_request *wsgi_req, char **response, uint16_t *response_len) {
+	char *ptr = wsgi_req->http_sec_websocket_extensions;
+	char *end = ptr + wsgi_req->http_sec_websocket_extensions_len;
+	int server_no_context = uwsgi.websockets_deflate_no_context_takeover;
+	int window_bits = uwsgi.websockets_deflate_window_bits;
+	if (window_bits < 9) window_bits = 9;
+	if (window_bits > 15) window_bits = 15;
+
+	while (ptr < end) {
+		// an offer is a comma terminated list of semicolon separated params
+		char *offer_end = memchr(ptr, ',', end - ptr);
+		if (!offer_end) offer_end = end;
+		int found = 0;
+		char *param = ptr;
+		while (param < offer_end) {
+			char *param_end = memchr(param, ';', offer_end - param);
+			if (!param_end) param_end = offer_end;
+			char *p = param;
+			while (p < param_end && isspace((unsigned char) *p)) p++;
+			char *pe = param_end;
+			while (pe > p && isspace((unsigned char) pe[-1])) pe--;
+			size_t plen = pe - p;
+			if (param == ptr) {
+				if (uwsgi_strncmp(p, plen, "permessage-deflate", 18)) break;
+				found = 1;
+			}
+			else if (!uwsgi_strncmp(p, plen, "server_no_context_takeover", 26)) {
+				server_no_context = 1;
+			}
+			else if (plen > 23 && !uwsgi_starts_with(p, plen, "server_max_window_bits=", 23)) {
+				int bits = uwsgi_str_num(p + 23, plen - 23);
+				// zlib does not support 8 bits windows for raw deflate
+				if (bits < 9 || bits > 15) {
+					found = 0;
+					break;
+				}
+				if (bits < window_bits) window_bits = bits;
+			}
+			// the client params are hints, the inflater always uses the max window
+			else if (uwsgi_strncmp(p, plen, "client_no_context_takeover", 26) && uwsgi_starts_with(p, plen, "client_max_window_bits", 22)) {
+				// unknown param, decline the offer
+				found = 0;
+				break;
+			}
+			param = param_end + 1;
+		}
+		if (found) {
+			char *window = uwsgi_num2str(window_bits);
+			char *ext = uwsgi_concat4("permessage-deflate",
+				server_no_context ? "; server_no_context_takeover" : "",
+				uwsgi.websockets_deflate_no_context_takeover ? "; client_no_context_takeover" : "",
+				window_bits < 15 ? "; server_max_window_bits=" : "");
+			if (window_bits < 15) {
+				char *tmp = uwsgi_concat2(ext, window);
+				free(ext);
+				ext = tmp;
+			}
+			free(window);
+			*response = ext;
+			*response_len = strlen(ext);
+			wsgi_req->websocket_deflate = UWSGI_WEBSOCKET_DEFLATE;
+			if (server_no_context) wsgi_req->websocket_deflate |= UWSGI_WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT;
+			if (uwsgi.websockets_deflate_no_context_takeover) wsgi_req->websocket_deflate |= UWSGI_WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT;
+			wsgi_req->websocket_deflate_window_bits = window_bits;
+			return 1;
+		}
+		ptr = offer_end + 1;
+	}
+	return 0;
+}
+#endif
+#endif
+
+void uwsgi_websocket_deflate_free(struct wsgi_request *wsgi_req) {
+#ifdef UWSGI_ZLIB
+	uwsgi_websocket_deflater_free(wsgi_req);
+	uwsgi_websocket_inflater_free(wsgi_req);
+#endif
+}
+
+static struct uwsgi_buffer *uwsgi_websocket_frame(struct wsgi_request *wsgi_req, char *msg, size_t len, uint8_t opcode);
+
+// build a frame (opcode includes the FIN bit) in the send buffer of the request,
+// text and binary messages are compressed when permessage-deflate has been negotiated
+struct uwsgi_buffer *uwsgi_websocket_message(struct wsgi_request *wsgi_req, char *msg, size_t len, uint8_t opcode) {
+#ifdef UWSGI_ZLIB
+	if (wsgi_req->websocket_deflate && (opcode == 0x81 || opcode == 0x82)) {
+		struct uwsgi_buffer *compressed = uwsgi_websocket_compress(wsgi_req, msg, len);
+		if (!compressed) return NULL;
+		// RSV1 marks the message as compressed
+		struct uwsgi_buffer *ub = uwsgi_websocket_frame(wsgi_req, compressed->buf, compressed->pos, opcode | 0x40);
+		uwsgi_buffer_destroy(compressed);
+		return ub;
+	}
+#endif
+	return uwsgi_websocket_frame(wsgi_req, msg, len, opcode);
+}
+
+static struct uwsgi_buffer *uwsgi_websocket_frame(struct wsgi_request *wsgi_req, char *msg, size_t len, uint8_t opcode) {
 	struct uwsgi_buffer *ub = wsgi_req->websocket_send_buf;
 	if (!ub) {
 		wsgi_req->websocket_send_buf = uwsgi_buffer_new(10 + len);
@@ -150,20 +385,43 @@ static void uwsgi_websocket_parse_header(struct wsgi_request *wsgi_req) {
 	uint8_t byte2 = wsgi_req->websocket_buf->buf[1];
 	wsgi_req->websocket_is_fin = byte1 >> 7;
 	wsgi_req->websocket_opcode = byte1 & 0xf;
+	// RSV1 (compression) is in the first frame of a message
+	if (wsgi_req->websocket_opcode == 1 || wsgi_req->websocket_opcode == 2) {
+		wsgi_req->websocket_compressed = (byte1 >> 6) & 1;
+	}
 	wsgi_req->websocket_has_mask = byte2 >> 7;
 	wsgi_req->websocket_size = byte2 & 0x7f;
 }
 
+/*
+	(un)mask a websocket payload with the 4 bytes key, a 64bit word at a time
+	(memcpy() keeps it safe on unaligned buffers and lets the compiler vectorize the loop)
+*/
+void uwsgi_websocket_mask(char *buf, size_t len, char *mask) {
+	size_t i = 0;
+	if (len >= 8) {
+		uint64_t mask64;
+		memcpy(&mask64, mask, 4);
+		memcpy(((char *) &mask64) + 4, mask, 4);
+		for(;i+8<=len;i+=8) {
+			uint64_t word;
+			memcpy(&word, buf + i, 8);
+			word ^= mask64;
+			memcpy(buf + i, &word, 8);
+		}
+	}
+	// i is a multiple of 8, so the key is still aligned with the payload
+	for(;i<len;i++) {
+		buf[i] ^= mask[i%4];
+	}
+}
+
 static struct uwsgi_buffer *uwsgi_websockets_parse(struct wsgi_request *wsgi_req) {
 	// de-mask buffer
-	uint8_t *ptr = (uint8_t *) (wsgi_req->websocket_buf->buf + (wsgi_req->websocket_pktsize - wsgi_req->websocket_size));
-	size_t i;
+	char *ptr = wsgi_req->websocket_buf->buf + (wsgi_req->websocket_pktsize - wsgi_req->websocket_size);
 
 	if (wsgi_req->websocket_has_mask) {
-		uint8_t *mask = ptr-4;
-		for(i=0;i<wsgi_req->websocket_size;i++) {
-			ptr[i] = ptr[i] ^ mask[i%4];	
-		}
+		uwsgi_websocket_mask(ptr, wsgi_req->websocket_size, ptr-4);
 	}
 
 	struct uwsgi_buffer *ub = NULL;
@@ -177,13 +435,24 @@ static struct uwsgi_buffer *uwsgi_websockets_parse(struct wsgi_request *wsgi_req
 	else {
 		ub = uwsgi_buffer_new(wsgi_req->websocket_size);
 	}
-	if (uwsgi_buffer_append(ub, (char *) ptr, wsgi_req->websocket_size)) goto error;	
+	if (uwsgi_buffer_append(ub, ptr, wsgi_req->websocket_size)) goto error;	
 	if (uwsgi_buffer_decapitate(wsgi_req->websocket_buf, wsgi_req->websocket_pktsize)) goto error;
 	wsgi_req->websocket_phase = 0;
 	wsgi_req->websocket_need = 2;
 
 	if (wsgi_req->websocket_is_fin) {
 		uwsgi.websockets_continuation_buffer = NULL;
+#ifdef UWSGI_ZLIB
+		if (wsgi_req->websocket_compressed && wsgi_req->websocket_deflate) {
+			struct uwsgi_buffer *inflated = uwsgi_websocket_decompress(wsgi_req, ub);
+			uwsgi_buffer_destroy(ub);
+			return inflated;
+		}
+#endif
+		if (wsgi_req->websocket_compressed) {
+			uwsgi_log("[uwsgi-websocket] \"%.*s %.*s\" (%.*s) compressed message without permessage-deflate\n", REQ_DATA);
+			return NULL;
+		}
 		/// Freeing websockets_continuation_buffer is done by the caller
 		return ub;
 	}
@@ -375,12 +644,27 @@ static void clear_continuation_buffer() {
 	}
 }
 
+/*
+	a draining worker (--worker-drain) closes the websockets with 1001 (going away),
+	so clients can reconnect to the new generation of workers
+*/
+static int uwsgi_websocket_drain(struct wsgi_request *wsgi_req) {
+	if (!uwsgi.worker_drain || uwsgi.workers[uwsgi.mywid].manage_next_request) return 0;
+	if (!wsgi_req->websocket_closed) {
+		uwsgi_response_write_body_do(wsgi_req, "\x88\x02\x03\xe9", 4);
+		clear_continuation_buffer();
+		wsgi_req->websocket_closed = 1;
+	}
+	return 1;
+}
+
 struct uwsgi_buffer *uwsgi_websocket_recv(struct wsgi_request *wsgi_req) {
-	if (wsgi_req->websocket_closed) {
+	if (wsgi_req->websocket_closed || uwsgi_websocket_drain(wsgi_req)) {
 		return NULL;
 	}
 	struct uwsgi_buffer *ub = uwsgi_websocket_recv_do(wsgi_req, 0);
-	if (!ub) {
+	// the wait could have been interrupted by the graceful stop
+	if (!ub && !uwsgi_websocket_drain(wsgi_req)) {
 		clear_continuation_buffer();
 		wsgi_req->websocket_closed = 1;
 	}
@@ -388,11 +672,11 @@ struct uwsgi_buffer *uwsgi_websocket_recv(struct wsgi_request *wsgi_req) {
 }
 
 struct uwsgi_buffer *uwsgi_websocket_recv_nb(struct wsgi_request *wsgi_req) {
-        if (wsgi_req->websocket_closed) {
+        if (wsgi_req->websocket_closed || uwsgi_websocket_drain(wsgi_req)) {
                 return NULL;
         }
         struct uwsgi_buffer *ub = uwsgi_websocket_recv_do(wsgi_req, 1);
-        if (!ub) {
+        if (!ub && !uwsgi_websocket_drain(wsgi_req)) {
 		clear_continuation_buffer();
                 wsgi_req->websocket_closed = 1;
         }
@@ -409,7 +693,8 @@ ssize_t uwsgi_websockets_simple_send(struct wsgi_request *wsgi_req, struct uwsgi
 	return len;
 }
 
-int uwsgi_websocket_handshake(struct wsgi_request *wsgi_req, char *key, uint16_t key_len, char *origin, uint16_t origin_len, char *proto, uint16_t proto_len) {
+// prepare the handshake response headers without sending them
+int uwsgi_websocket_handshake_prepare(struct wsgi_request *wsgi_req, char *key, uint16_t key_len, char *origin, uint16_t origin_len, char *proto, uint16_t proto_len) {
 #ifdef UWSGI_SSL
 	if (!key_len) {
 		key = wsgi_req->http_sec_websocket_key;
@@ -442,6 +727,17 @@ int uwsgi_websocket_handshake(struct wsgi_request *wsgi_req, char *key, uint16_t
 		}
 		if (uwsgi_response_add_header(wsgi_req, "Sec-WebSocket-Protocol", 22, proto, proto_len)) return -1;
 	}
+#ifdef UWSGI_ZLIB
+	if (uwsgi.websockets_deflate && wsgi_req->http_sec_websocket_extensions_len > 0) {
+		char *ext = NULL;
+		uint16_t ext_len = 0;
+		if (uwsgi_websocket_deflate_negotiate(wsgi_req, &ext, &ext_len)) {
+			int ret = uwsgi_response_add_header(wsgi_req, "Sec-WebSocket-Extensions", 24, ext, ext_len);
+			free(ext);
+			if (ret) return -1;
+		}
+	}
+#endif
 	// generate websockets sha1 and encode it to base64
         if (!uwsgi_sha1_2n(key, key_len, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36, sha1)) return -1;
 	size_t b64_len = 0;
@@ -456,13 +752,80 @@ int uwsgi_websocket_handshake(struct wsgi_request *wsgi_req, char *key, uint16_t
 
 	wsgi_req->websocket_last_pong = uwsgi_now();
 
-	return uwsgi_response_write_headers_do(wsgi_req);
+	return 0;
 #else
 	uwsgi_log("you need to build uWSGI with SSL support to use the websocket handshake api function !!!\n");
 	return -1;
 #endif
 }
 
+int uwsgi_websocket_handshake(struct wsgi_request *wsgi_req, char *key, uint16_t key_len, char *origin, uint16_t origin_len, char *proto, uint16_t proto_len) {
+	if (uwsgi_websocket_handshake_prepare(wsgi_req, key, key_len, origin, origin_len, proto, proto_len)) return -1;
+	return uwsgi_response_write_headers_do(wsgi_req);
+}
+
+/*
+	publish a message to the subscribers of a channel of the http router websockets hub (--websockets-hub)
+
+	the message is a uwsgi packet sent to the datagram socket of the hub, so it must fit in a single datagram
+*/
+int uwsgi_websocket_publish(char *channel, uint16_t channel_len, char *msg, size_t len, int binary) {
+	static union uwsgi_sockaddr hub_addr;
+	static socklen_t hub_addr_len = 0;
+
+	if (!uwsgi.websockets_hub) {
+		uwsgi_log("[uwsgi-websocket] the websockets hub is not configured (use --websockets-hub)\n");
+		return -1;
+	}
+
+	if (len > (size_t) (0xffff - channel_len - 32)) {
+		uwsgi_log("[uwsgi-websocket] message too big for the websockets hub: %llu bytes\n", (unsigned long long) len);
+		return -1;
+	}
+
+	if (!hub_addr_len) {
+		union uwsgi_sockaddr addr;
+		socklen_t addr_len;
+		char *hub = uwsgi_str(uwsgi.websockets_hub);
+		char *colon = strchr(hub, ':');
+		if (colon) {
+			addr_len = socket_to_in_addr(hub, colon, 0, &addr.sa_in);
+		}
+		else {
+			addr_len = socket_to_un_addr(hub, &addr.sa_un);
+		}
+		free(hub);
+		memcpy(&hub_addr, &addr, sizeof(union uwsgi_sockaddr));
+		hub_addr_len = addr_len;
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(4 + channel_len + len + 32);
+	if (uwsgi_buffer_append(ub, "\0\0\0\0", 4)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "channel", 7, channel, channel_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "message", 7, msg, len)) goto error;
+	if (binary) {
+		if (uwsgi_buffer_append_keyval(ub, "binary", 6, "1", 1)) goto error;
+	}
+	if (uwsgi_buffer_set_uh(ub, 0, 0)) goto error;
+
+	int fd = socket(hub_addr.sa.sa_family, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		uwsgi_error("uwsgi_websocket_publish()/socket()");
+		goto error;
+	}
+	if (sendto(fd, ub->buf, ub->pos, 0, &hub_addr.sa, hub_addr_len) < 0) {
+		uwsgi_error("uwsgi_websocket_publish()/sendto()");
+		close(fd);
+		goto error;
+	}
+	close(fd);
+	uwsgi_buffer_destroy(ub);
+	return 0;
+error:
+	uwsgi_buffer_destroy(ub);
+	return -1;
+}
+
 void uwsgi_websockets_init() {
         uwsgi.websockets_pong = uwsgi_buffer_new(2);
         uwsgi_buffer_append(uwsgi.websockets_pong, "\x8A\0", 2);
@@ -473,5 +836,6 @@ void uwsgi_websockets_init() {
 	uwsgi.websockets_ping_freq = 30;
 	uwsgi.websockets_pong_tolerance = 3;
 	uwsgi.websockets_max_size = 1024;
+	uwsgi.websockets_deflate_window_bits = 15;
 	uwsgi.websockets_continuation_buffer = NULL;
 }
@@ -1,7 +1,59 @@
 #include "uwsgi.h"
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define UWSGI_ZEROCOPY 1
+#endif
+
 extern struct uwsgi_server uwsgi;
 
+/*
+	response headers are built directly in wsgi_req->headers, preallocated with the running
+	p99 of the headers size seen by this process (64 bytes buckets, halved every 4096 samples
+	to follow changes in the traffic). Counters are not locked as they are only a sizing hint.
+*/
+#define UWSGI_HEADERS_BUCKET 64
+#define UWSGI_HEADERS_BUCKETS 128
+#define UWSGI_HEADERS_DECAY 4096
+
+static struct uwsgi_headers_stats {
+	uint32_t buckets[UWSGI_HEADERS_BUCKETS];
+	uint32_t samples;
+	size_t p99;
+} uwsgi_headers_stats;
+
+static void uwsgi_headers_stats_add(size_t size) {
+	struct uwsgi_headers_stats *uhs = &uwsgi_headers_stats;
+	size_t bucket = UMIN(size / UWSGI_HEADERS_BUCKET, UWSGI_HEADERS_BUCKETS - 1);
+	uhs->buckets[bucket]++;
+	uhs->samples++;
+	// recompute the percentile every 64 samples
+	if (uhs->samples % 64) return;
+	uint32_t threshold = uhs->samples - (uhs->samples / 100);
+	uint32_t sum = 0;
+	int i;
+	for(i=0;i<UWSGI_HEADERS_BUCKETS;i++) {
+		sum += uhs->buckets[i];
+		if (sum >= threshold) {
+			uhs->p99 = (i+1) * UWSGI_HEADERS_BUCKET;
+			break;
+		}
+	}
+	if (uhs->samples >= UWSGI_HEADERS_DECAY) {
+		uhs->samples = 0;
+		for(i=0;i<UWSGI_HEADERS_BUCKETS;i++) {
+			uhs->buckets[i] /= 2;
+			uhs->samples += uhs->buckets[i];
+		}
+	}
+}
+
+static void uwsgi_response_headers_init(struct wsgi_request *wsgi_req) {
+	if (wsgi_req->headers) return;
+	wsgi_req->headers = uwsgi_buffer_new(uwsgi_headers_stats.p99 ? uwsgi_headers_stats.p99 : (size_t) uwsgi.page_size);
+	wsgi_req->headers->limit = uwsgi.response_header_limit;
+}
+
 int uwsgi_response_add_content_length(struct wsgi_request *wsgi_req, uint64_t cl) {
 	char buf[sizeof(UMAX64_STR)+1];
         int ret = snprintf(buf, sizeof(UMAX64_STR)+1, "%llu", (unsigned long long) cl);
@@ -79,10 +131,7 @@ int uwsgi_response_prepare_headers(struct wsgi_request *wsgi_req, char *status,
 
 	if (wsgi_req->headers_sent || wsgi_req->headers_size || wsgi_req->response_size || status_len < 3 || wsgi_req->write_errors) return -1;
 
-	if (!wsgi_req->headers) {
-		wsgi_req->headers = uwsgi_buffer_new(uwsgi.page_size);
-		wsgi_req->headers->limit = uwsgi.response_header_limit;
-	}
+	uwsgi_response_headers_init(wsgi_req);
 
 	// reset the buffer (could be useful for rollbacks...)
 	wsgi_req->headers->pos = 0;
@@ -101,6 +150,25 @@ int uwsgi_response_prepare_headers(struct wsgi_request *wsgi_req, char *status,
 		wsgi_req->is_error_routing = 0;
 	}
 #endif
+	// the base protocols write the status line directly in the headers buffer
+	int cgi = wsgi_req->socket->proto_prepare_headers == uwsgi_proto_base_cgi_prepare_headers;
+	if (cgi || wsgi_req->socket->proto_prepare_headers == uwsgi_proto_base_prepare_headers) {
+		const char *sc = NULL;
+		uint16_t sc_len = 0;
+		if (status_len <= 4) {
+			sc = uwsgi_http_status_msg(status, &sc_len);
+			if (!sc) {
+				sc = "Unknown";
+				sc_len = 7;
+			}
+			status_len = 3;
+		}
+		if (uwsgi_proto_base_append_status(wsgi_req, wsgi_req->headers, cgi, status, status_len, sc, sc_len)) {
+			wsgi_req->write_errors++;
+			return -1;
+		}
+		return 0;
+	}
 	if (status_len <= 4) {
 		char *new_sc = NULL;
 		size_t new_sc_len = 0;
@@ -154,10 +222,26 @@ static int uwsgi_response_add_header_do(struct wsgi_request *wsgi_req, char *key
 		}
 	}
 
-        if (!wsgi_req->headers) {
-                wsgi_req->headers = uwsgi_buffer_new(uwsgi.page_size);
-                wsgi_req->headers->limit = uwsgi.response_header_limit;
-        }
+        uwsgi_response_headers_init(wsgi_req);
+
+	// keepalive protocols need to know if the client will be able to find the end of the body
+	if (!uwsgi_strnicmp(key, key_len, "Content-Length", 14) || !uwsgi_strnicmp(key, key_len, "Transfer-Encoding", 17)) {
+		wsgi_req->response_has_length = 1;
+	}
+
+	if (!uwsgi_strnicmp(key, key_len, "Connection", 10)) {
+		wsgi_req->response_has_connection = 1;
+	}
+
+	// no need for a temporary buffer with the base protocols
+	if (wsgi_req->socket->proto_add_header == uwsgi_proto_base_add_header) {
+		if (uwsgi_proto_base_append_header(wsgi_req->headers, key, key_len, value, value_len)) {
+			wsgi_req->write_errors++;
+			return -1;
+		}
+		wsgi_req->header_cnt++;
+		return 0;
+	}
 
         struct uwsgi_buffer *hh = wsgi_req->socket->proto_add_header(wsgi_req, key, key_len, value, value_len);
         if (!hh) { wsgi_req->write_errors++ ; return -1;}
@@ -229,9 +313,17 @@ static int uwsgi_response_write_headers_do0(struct wsgi_request *wsgi_req) {
                 ah = ah->next;
         }
 
+	// a draining worker will close the connection after the response
+	if (uwsgi.worker_drain && wsgi_req->socket->keepalive && !uwsgi.workers[uwsgi.mywid].manage_next_request && !wsgi_req->response_has_connection) {
+		if (uwsgi_response_add_header_force(wsgi_req, "Connection", 10, "close", 5)) return -1;
+	}
 
 	if (wsgi_req->socket->proto_fix_headers(wsgi_req)) { wsgi_req->write_errors++ ; return -1;}
 
+	uwsgi_headers_stats_add(wsgi_req->headers->pos);
+
+	if (!wsgi_req->first_byte_at) wsgi_req->first_byte_at = uwsgi_micros();
+
 	return UWSGI_AGAIN;
 }
 
@@ -271,35 +363,41 @@ int uwsgi_response_write_headers_do(struct wsgi_request *wsgi_req) {
         return UWSGI_OK;
 }
 
+/*
+	for writers not using the blocking functions (like the ASGI one): finalize the headers and
+	mark them as sent, if UWSGI_AGAIN is returned they are in wsgi_req->headers and have to be written
+*/
+int uwsgi_response_headers_finalize(struct wsgi_request *wsgi_req) {
+	int ret = uwsgi_response_write_headers_do0(wsgi_req);
+	if (ret != UWSGI_AGAIN) return ret;
+	wsgi_req->headers_size += wsgi_req->headers->pos;
+	wsgi_req->headers_sent = 1;
+	return UWSGI_AGAIN;
+}
+
 /*
 	private function for highly optimized writes (1 single syscall for headers and body)
 */
-static int uwsgi_response_writev_headers_and_body_do(struct wsgi_request *wsgi_req, char *buf, size_t len) {
+#define UWSGI_HEADERS_IOVEC_MAX 16
 
-	struct iovec iov[2];
+static int uwsgi_response_writev_headers_and_body_do(struct wsgi_request *wsgi_req, struct iovec *body, size_t body_cnt) {
+
+	struct iovec iov[UWSGI_HEADERS_IOVEC_MAX+1];
 
         int ret = uwsgi_response_write_headers_do0(wsgi_req);
         if (ret != UWSGI_AGAIN) return ret;
 
 	iov[0].iov_base = wsgi_req->headers->buf;
 	iov[0].iov_len = wsgi_req->headers->pos;
-	iov[1].iov_base = buf;
-	iov[1].iov_len = len;
+	size_t i;
+	for(i=0;i<body_cnt;i++) {
+		iov[i+1] = body[i];
+	}
 
-	size_t iov_len = 2;
+	// proto_writev rebuilds the vector (and its length) on partial writes
+	size_t iov_len = body_cnt + 1;
         for(;;) {
                 errno = 0;
-		// no need to use writev if a single iovec remains
-		if (iov_len == 1) {
-			buf = iov[0].iov_base;	
-			len = iov[0].iov_len;
-			// update counters
-			wsgi_req->headers_size += wsgi_req->headers->pos;
-			wsgi_req->headers_sent = 1;
-			wsgi_req->response_size += wsgi_req->write_pos - wsgi_req->headers_size;
-			wsgi_req->write_pos = 0;
-			goto fallback;
-		}
                 int ret = wsgi_req->socket->proto_writev(wsgi_req, iov, &iov_len);
                 if (ret < 0) {
                         if (!uwsgi.ignore_write_errors) {
@@ -322,47 +420,153 @@ static int uwsgi_response_writev_headers_and_body_do(struct wsgi_request *wsgi_r
         }
 
 	wsgi_req->headers_size += wsgi_req->headers->pos;
-	wsgi_req->response_size += len;
+	wsgi_req->response_size += wsgi_req->write_pos - wsgi_req->headers->pos;
 	wsgi_req->headers_sent = 1;
 
 	// reset for the next write
         wsgi_req->write_pos = 0;
 
         return UWSGI_OK;
+}
 
-fallback:
+#ifdef UWSGI_ZEROCOPY
+/*
+	MSG_ZEROCOPY support
+
+	the kernel pins the pages of the buffer instead of copying them, so the memory must not be
+	changed (or given back to the plugin) until the completion notifications for every send
+	are received on the socket error queue.
+	For this reason uwsgi_response_write_body_zerocopy() returns only when all of the data
+	has been acknowledged by the kernel.
+*/
 
+// consume the pending notifications, returns the number of completed sends (or -1)
+static int zerocopy_reap(struct wsgi_request *wsgi_req) {
+	int completed = 0;
 	for(;;) {
-                errno = 0;
-                int ret = wsgi_req->socket->proto_write(wsgi_req, buf, len);
-                if (ret < 0) {
-                        if (!uwsgi.ignore_write_errors) {
-				// here we use the parent name
-                                uwsgi_req_error("uwsgi_response_write_body_do()");
-                        }
-                        wsgi_req->write_errors++;
-                        return -1;
-                }
-                if (ret == UWSGI_OK) {
-                        break;
-                }
-                if (!uwsgi_is_again()) continue;
-                ret = uwsgi_wait_write_req(wsgi_req);
-                if (ret < 0) { wsgi_req->write_errors++; return -1;}
-                if (ret == 0) {
-			// here we use the parent name
-                        uwsgi_log("uwsgi_response_write_body_do() TIMEOUT !!!\n");
-                        wsgi_req->write_errors++;
-                        return -1;
-                }
-        }
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(wsgi_req->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return completed;
+			return -1;
+		}
+		struct cmsghdr *cmsg;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err *serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+			// [ee_info, ee_data] is the range of completed sends
+			uint64_t n = (uint32_t) (serr->ee_data - serr->ee_info) + 1;
+			if (n > wsgi_req->zerocopy_pending) n = wsgi_req->zerocopy_pending;
+			wsgi_req->zerocopy_pending -= n;
+			completed += n;
+		}
+	}
+}
 
-        wsgi_req->response_size += wsgi_req->write_pos;
-        // reset for the next write
-        wsgi_req->write_pos = 0;
+static int zerocopy_wait(struct wsgi_request *wsgi_req) {
+	while (wsgi_req->zerocopy_pending) {
+		int ret = zerocopy_reap(wsgi_req);
+		if (ret < 0) return -1;
+		if (!wsgi_req->zerocopy_pending) break;
+		// only errors (and the error queue) are reported with empty events
+		struct pollfd upoll;
+		upoll.fd = wsgi_req->fd;
+		upoll.events = 0;
+		upoll.revents = 0;
+		ret = poll(&upoll, 1, uwsgi.socket_timeout * 1000);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			uwsgi_req_error("zerocopy_wait()/poll()");
+			return -1;
+		}
+		if (ret == 0) {
+			uwsgi_log("uwsgi_response_write_body_do() MSG_ZEROCOPY TIMEOUT !!!\n");
+			return -1;
+		}
+		if (upoll.revents & (POLLHUP|POLLNVAL)) return -1;
+	}
+	return 0;
+}
 
-        return UWSGI_OK;
+static int uwsgi_response_write_body_zerocopy(struct wsgi_request *wsgi_req, char *buf, size_t len) {
+	for(;;) {
+		int flags = MSG_NOSIGNAL | MSG_ZEROCOPY;
+retry:
+		errno = 0;
+		ssize_t wlen = send(wsgi_req->fd, buf + wsgi_req->write_pos, len - wsgi_req->write_pos, flags);
+		if (wlen > 0) {
+			wsgi_req->write_pos += wlen;
+			if (flags & MSG_ZEROCOPY) wsgi_req->zerocopy_pending++;
+			if (wsgi_req->write_pos == len) break;
+			continue;
+		}
+		if (wlen < 0) {
+			// out of optmem, copy this chunk
+			if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+				flags &= ~MSG_ZEROCOPY;
+				goto retry;
+			}
+			if (uwsgi_is_again()) {
+				// free the error queue (its notifications would wake up the wait hook)
+				if (zerocopy_reap(wsgi_req) < 0) goto error;
+				int ret = uwsgi_wait_write_req(wsgi_req);
+				if (ret < 0) {
+					// a completion could have been queued in the meantime
+					if (zerocopy_reap(wsgi_req) > 0) continue;
+					goto error;
+				}
+				if (ret == 0) {
+					uwsgi_log("uwsgi_response_write_body_do() TIMEOUT !!!\n");
+					goto error;
+				}
+				continue;
+			}
+			if (errno == EINTR) continue;
+			if (!uwsgi.ignore_write_errors) {
+				uwsgi_req_error("uwsgi_response_write_body_do()");
+			}
+		}
+		goto error;
+	}
+
+	if (zerocopy_wait(wsgi_req)) {
+		wsgi_req->write_errors++;
+		return -1;
+	}
+
+	wsgi_req->response_size += wsgi_req->write_pos;
+	wsgi_req->write_pos = 0;
+	return UWSGI_OK;
+
+error:
+	// do not give back the buffer while the kernel could still reference it
+	zerocopy_wait(wsgi_req);
+	wsgi_req->write_errors++;
+	return -1;
+}
+#endif
 
+// check if the body can be sent with MSG_ZEROCOPY (only plain sockets without framing)
+static int uwsgi_response_can_zerocopy(struct wsgi_request *wsgi_req, size_t len) {
+#ifdef UWSGI_ZEROCOPY
+	if (!uwsgi.zerocopy_threshold || len < uwsgi.zerocopy_threshold) return 0;
+	if (wsgi_req->zerocopy < 0) return 0;
+	if (wsgi_req->socket->proto_write != uwsgi_proto_base_write) return 0;
+	if (!wsgi_req->zerocopy) {
+		int one = 1;
+		if (setsockopt(wsgi_req->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(int))) {
+			wsgi_req->zerocopy = -1;
+			return 0;
+		}
+		wsgi_req->zerocopy = 1;
+	}
+	return 1;
+#else
+	return 0;
+#endif
 }
 
 // this is the function called by all request plugins to send chunks to the client
@@ -407,8 +611,11 @@ int uwsgi_response_write_body_do(struct wsgi_request *wsgi_req, char *buf, size_
 write:
 	// send headers if not already sent
 	if (!wsgi_req->headers_sent) {
-		if (wsgi_req->socket->proto_writev && len > 0 && wsgi_req->headers) {
-			return uwsgi_response_writev_headers_and_body_do(wsgi_req, buf, len);
+		if (wsgi_req->socket->proto_writev && len > 0 && wsgi_req->headers && !uwsgi_response_can_zerocopy(wsgi_req, len)) {
+			struct iovec iov;
+			iov.iov_base = buf;
+			iov.iov_len = len;
+			return uwsgi_response_writev_headers_and_body_do(wsgi_req, &iov, 1);
 		}
 		int ret = uwsgi_response_write_headers_do(wsgi_req);
                 if (ret == UWSGI_OK) goto sendbody;
@@ -420,6 +627,12 @@ write:
 sendbody:
 
 	if (len == 0) return UWSGI_OK;
+
+#ifdef UWSGI_ZEROCOPY
+	if (uwsgi_response_can_zerocopy(wsgi_req, len)) {
+		return uwsgi_response_write_body_zerocopy(wsgi_req, buf, len);
+	}
+#endif
 	
 	for(;;) {
 		errno = 0;
@@ -472,34 +685,20 @@ int uwsgi_response_writev_body_do(struct wsgi_request *wsgi_req, struct iovec *i
 #endif
 
 	size_t i;
-	int buffering = 0;
-	// transformations apply to every vector
-	for(i=0;i<len;i++) {	
-        	// if the transformation chain returns 1, we are in buffering mode
-        	if (wsgi_req->transformed_chunk_len == 0 && wsgi_req->transformations) {
-                	int t_ret = uwsgi_apply_transformations(wsgi_req, iov[i].iov_base, iov[i].iov_len);
-                	if (t_ret == 0) {
-                        	iov[i].iov_base = wsgi_req->transformed_chunk;
-                        	iov[i].iov_len = wsgi_req->transformed_chunk_len;
-                        	// reset transformation
-                        	wsgi_req->transformed_chunk = NULL;
-                        	wsgi_req->transformed_chunk_len = 0;
-                        	goto write;
-                	}
-                	if (t_ret == 1) {
-				buffering = 1;
-				continue;
-                	}
-                	wsgi_req->write_errors++;
-                	return -1;
+	// transformations apply to every vector (in order, they share the request buffers)
+	if (wsgi_req->transformations) {
+		for(i=0;i<len;i++) {
+			if (uwsgi_response_write_body_do(wsgi_req, iov[i].iov_base, iov[i].iov_len)) return -1;
 		}
-        }
-
-	if (buffering) return UWSGI_OK;
+		return UWSGI_OK;
+	}
 
-write:
         // send headers if not already sent
         if (!wsgi_req->headers_sent) {
+		// headers and body in the same syscall
+		if (wsgi_req->socket->proto_writev && len > 0 && len <= UWSGI_HEADERS_IOVEC_MAX && wsgi_req->headers) {
+			return uwsgi_response_writev_headers_and_body_do(wsgi_req, iov, len);
+		}
                 int ret = uwsgi_response_write_headers_do(wsgi_req);
                 if (ret == UWSGI_OK) goto sendbody;
                 if (ret == UWSGI_AGAIN) return UWSGI_AGAIN;
@@ -621,7 +820,7 @@ sendfile:
 		len = st.st_size;
 	}
 
-	if (wsgi_req->socket->can_offload) {
+	if (wsgi_req->socket->can_offload && !wsgi_req->no_sendfile_offload) {
 		// of we cannot close the socket (before the app will close it later)
 		// let's dup it
 		if (!can_close) {
@@ -95,6 +95,29 @@ int uwsgi_deflate_init(z_stream *z, char *dict, size_t dict_len) {
 	return 0;
 }
 
+// raw deflate stream with a custom window (used by websockets permessage-deflate)
+int uwsgi_deflate_init_raw(z_stream *z, int window_bits) {
+        z->zalloc = Z_NULL;
+        z->zfree = Z_NULL;
+        z->opaque = Z_NULL;
+        if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+	return 0;
+}
+
+int uwsgi_inflate_init_raw(z_stream *z) {
+        z->zalloc = Z_NULL;
+        z->zfree = Z_NULL;
+        z->opaque = Z_NULL;
+	z->next_in = Z_NULL;
+	z->avail_in = 0;
+        if (inflateInit2(z, -MAX_WBITS) != Z_OK) {
+                return -1;
+        }
+        return 0;
+}
+
 int uwsgi_inflate_init(z_stream *z, char *dict, size_t dict_len) {
         z->zalloc = Z_NULL;
         z->zfree = Z_NULL;
@@ -162,6 +185,22 @@ char *uwsgi_deflate(z_stream *z, char *buf, size_t len, size_t *dlen) {
         return (char *) dbuf;
 }
 
+// deflate (with a sync flush) a chunk appending the output to the buffer
+int uwsgi_deflate_buffer(z_stream *z, char *buf, size_t len, struct uwsgi_buffer *ub) {
+	z->avail_in = len;
+	z->next_in = (Bytef *) buf;
+	for(;;) {
+		if (uwsgi_buffer_ensure(ub, len + 64)) return -1;
+		z->avail_out = ub->len - ub->pos;
+		z->next_out = (Bytef *) ub->buf + ub->pos;
+		int ret = deflate(z, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR) return -1;
+		ub->pos = ub->len - z->avail_out;
+		// the flush is complete when there is room left in the output
+		if (z->avail_out > 0) return 0;
+	}
+}
+
 void uwsgi_crc32(uint32_t *ctx, char *buf, size_t len) {
 	if (!buf) {
 		*ctx = crc32(*ctx, Z_NULL, 0);
@@ -0,0 +1,282 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	the zygote (--zygote, requires --lazy-apps)
+
+	the zygote is forked by the master, loads the apps once (like a non-lazy master would do)
+	and then forks the new workers from that warm state, so (chain) reloads do not need
+	to load the apps in each worker and more memory pages are shared copy-on-write.
+
+	Every worker is double fork()ed by the zygote, and as the master is a subreaper
+	it is reparented to it, so from the master point of view it is a worker like the others.
+
+	The master and the zygote talk via a socketpair: the zygote sends 0 when the apps are loaded,
+	then for each worker id sent by the master the zygote answers with the pid of the new worker (or -1).
+
+	Until the zygote is ready the master falls back to plain fork(), and on workers reload (graceful,
+	brutal or chain) the old zygote is destroyed and a new one (loading the new code) is spawned.
+
+*/
+
+static void zygote_worker(int fd, int wid, struct uwsgi_worker *shared) {
+	// the apps are loaded in the zygote-private copy of the workers table
+	struct uwsgi_app *apps = uwsgi.workers[0].apps;
+	int apps_cnt = uwsgi.workers[0].apps_cnt;
+
+	uwsgi.workers = shared;
+	memcpy(uwsgi.workers[wid].apps, apps, sizeof(struct uwsgi_app) * apps_cnt);
+
+	uwsgi_worker_child_setup(wid);
+	uwsgi.workers[wid].apps_cnt = apps_cnt;
+	uwsgi.zygote_worker = 1;
+
+	int32_t pid = getpid();
+	if (write(fd, &pid, sizeof(int32_t)) != sizeof(int32_t)) {
+		uwsgi_error("zygote_worker()/write()");
+		exit(1);
+	}
+	close(fd);
+
+	// continue as a standard worker
+	uwsgi_run();
+	_exit(0);
+}
+
+static void zygote_loop(int fd) {
+	int i;
+
+	// the zygote has no master duties
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+	signal(SIGUSR2, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+#if defined(__linux__) && defined(PR_SET_PDEATHSIG)
+	if (prctl(PR_SET_PDEATHSIG, SIGKILL)) {
+		uwsgi_error("zygote_loop()/prctl()");
+	}
+#endif
+
+	uwsgi.mypid = getpid();
+
+	// apps are loaded as in the master (worker id 0), but in a private copy of the workers table
+	// as the running workers (from the previous zygote) are still using the shared one
+	struct uwsgi_worker *shared = uwsgi.workers;
+	uwsgi.workers = uwsgi_malloc(sizeof(struct uwsgi_worker) * (uwsgi.numproc + 1));
+	memcpy(uwsgi.workers, shared, sizeof(struct uwsgi_worker) * (uwsgi.numproc + 1));
+	uwsgi.workers[0].apps = uwsgi_calloc(sizeof(struct uwsgi_app) * uwsgi.max_apps);
+	uwsgi.workers[0].apps_cnt = 0;
+	// the fork() COW emulation writes here
+	struct uwsgi_app *cow = uwsgi_calloc(sizeof(struct uwsgi_app) * uwsgi.max_apps);
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		uwsgi.workers[i].apps = cow;
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->master_fixup) {
+			uwsgi.p[i]->master_fixup(1);
+		}
+	}
+
+	uwsgi.wsgi_req = &uwsgi.workers[0].cores[0].req;
+	uwsgi_init_all_apps();
+
+	// we are going to fork() workers from here
+	for (i = 0; i < 256; i++) {
+		if (uwsgi.p[i]->master_fixup) {
+			uwsgi.p[i]->master_fixup(0);
+		}
+	}
+
+	uwsgi_log("uWSGI zygote ready (pid: %d, apps: %d)\n", (int) uwsgi.mypid, uwsgi.workers[0].apps_cnt);
+
+	int32_t ready = 0;
+	if (write(fd, &ready, sizeof(int32_t)) != sizeof(int32_t)) {
+		uwsgi_error("zygote_loop()/write()");
+		exit(1);
+	}
+
+	for (;;) {
+		int32_t wid = 0;
+		ssize_t rlen = read(fd, &wid, sizeof(int32_t));
+		if (rlen < 0 && errno == EINTR) continue;
+		// master closed the channel
+		if (rlen != sizeof(int32_t)) exit(0);
+		if (wid < 1 || wid > uwsgi.numproc) continue;
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			pid_t wpid = fork();
+			if (wpid == 0) {
+				zygote_worker(fd, wid, shared);
+			}
+			if (wpid < 0) {
+				uwsgi_error("zygote_loop()/fork()");
+				int32_t err = -1;
+				if (write(fd, &err, sizeof(int32_t)) != sizeof(int32_t)) {
+					uwsgi_error("zygote_loop()/write()");
+				}
+			}
+			// the worker is now reparented to the master
+			_exit(0);
+		}
+		else if (pid < 0) {
+			uwsgi_error("zygote_loop()/fork()");
+			int32_t err = -1;
+			if (write(fd, &err, sizeof(int32_t)) != sizeof(int32_t)) {
+				uwsgi_error("zygote_loop()/write()");
+			}
+			continue;
+		}
+		waitpid(pid, NULL, 0);
+	}
+}
+
+void uwsgi_zygote_init() {
+	if (!uwsgi.zygote) return;
+	if (!uwsgi.lazy_apps) {
+		uwsgi_log("--zygote requires --lazy-apps\n");
+		exit(1);
+	}
+#if defined(__linux__) && defined(PR_SET_CHILD_SUBREAPER)
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0)) {
+		uwsgi_error("uwsgi_zygote_init()/prctl()");
+		exit(1);
+	}
+#else
+	uwsgi_log("--zygote requires PR_SET_CHILD_SUBREAPER support\n");
+	exit(1);
+#endif
+	uwsgi.zygote_fd = -1;
+	// at startup we can wait for the apps to be loaded
+	if (uwsgi_zygote_spawn()) return;
+	struct pollfd pfd;
+	pfd.fd = uwsgi.zygote_fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+	uwsgi_zygote_is_ready();
+}
+
+int uwsgi_zygote_spawn() {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		uwsgi_error("uwsgi_zygote_spawn()/socketpair()");
+		return -1;
+	}
+
+	if (uwsgi.threaded_logger) {
+		pthread_mutex_lock(&uwsgi.threaded_logger_lock);
+	}
+
+	pid_t pid = uwsgi_fork("uWSGI zygote");
+	if (pid == 0) {
+		if (uwsgi.threaded_logger) {
+			pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
+		}
+		close(fds[0]);
+		zygote_loop(fds[1]);
+		// never here
+		_exit(1);
+	}
+
+	if (uwsgi.threaded_logger) {
+		pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
+	}
+
+	close(fds[1]);
+	if (pid < 0) {
+		uwsgi_error("uwsgi_zygote_spawn()/fork()");
+		close(fds[0]);
+		return -1;
+	}
+
+	uwsgi_socket_nb(fds[0]);
+	uwsgi.zygote_fd = fds[0];
+	uwsgi.zygote_pid = pid;
+	uwsgi.zygote_ready = 0;
+	uwsgi_log("spawned uWSGI zygote (pid: %d)\n", (int) pid);
+	return 0;
+}
+
+// non-blocking check for the zygote ready message
+int uwsgi_zygote_is_ready() {
+	if (uwsgi.zygote_pid <= 0) return 0;
+	if (uwsgi.zygote_ready) return 1;
+	int32_t ready = -1;
+	ssize_t rlen = read(uwsgi.zygote_fd, &ready, sizeof(int32_t));
+	if (rlen == sizeof(int32_t) && ready == 0) {
+		uwsgi.zygote_ready = 1;
+		return 1;
+	}
+	return 0;
+}
+
+// returns the pid of the new worker or -1 (the caller will fork() by itself)
+pid_t uwsgi_zygote_fork(int wid) {
+	if (uwsgi.zygote_pid <= 0) {
+		if (uwsgi_instance_is_dying || uwsgi_instance_is_reloading) return -1;
+		if (uwsgi_zygote_spawn()) return -1;
+	}
+	if (!uwsgi_zygote_is_ready()) return -1;
+
+	int32_t id = wid;
+	if (write(uwsgi.zygote_fd, &id, sizeof(int32_t)) != sizeof(int32_t)) {
+		uwsgi_error("uwsgi_zygote_fork()/write()");
+		goto error;
+	}
+
+	int32_t pid = -1;
+	if (uwsgi_read_nb(uwsgi.zygote_fd, (char *) &pid, sizeof(int32_t), uwsgi.socket_timeout)) {
+		uwsgi_log("unable to get the pid of worker %d from the zygote\n", wid);
+		goto error;
+	}
+	if (pid <= 0) return -1;
+	return pid;
+
+error:
+	uwsgi_zygote_destroy();
+	return -1;
+}
+
+static void zygote_reset() {
+	close(uwsgi.zygote_fd);
+	uwsgi.zygote_fd = -1;
+	uwsgi.zygote_pid = 0;
+	uwsgi.zygote_ready = 0;
+}
+
+// returns 1 if the diedpid was the zygote
+int uwsgi_zygote_check_death(pid_t diedpid) {
+	if (!uwsgi.zygote || uwsgi.zygote_pid <= 0 || diedpid != uwsgi.zygote_pid) return 0;
+	if (!uwsgi_instance_is_reloading && !uwsgi_instance_is_dying) {
+		uwsgi_log("uWSGI zygote (pid: %d) died\n", (int) diedpid);
+	}
+	zygote_reset();
+	return 1;
+}
+
+// kill the zygote (on reloads and shutdown)
+void uwsgi_zygote_destroy() {
+	if (!uwsgi.zygote || uwsgi.zygote_pid <= 0) return;
+	pid_t pid = uwsgi.zygote_pid;
+	int waitpid_status;
+	kill(pid, SIGKILL);
+	if (waitpid(pid, &waitpid_status, 0) != pid) {
+		uwsgi_error("uwsgi_zygote_destroy()/waitpid()");
+	}
+	zygote_reset();
+}
+
+// on workers reload a new zygote loads the new code
+void uwsgi_zygote_reload() {
+	if (!uwsgi.zygote) return;
+	uwsgi_zygote_destroy();
+	uwsgi_zygote_spawn();
+}
@@ -0,0 +1,1149 @@
+#include "asyncio.h"
+
+extern struct uwsgi_server uwsgi;
+extern struct uwsgi_python up;
+extern struct uwsgi_asyncio uasyncio;
+
+#ifdef PYTHREE
+
+/*
+
+	native ASGI 3.0 support (--asgi <module>[:<callable>], the callable defaults to "app")
+
+	requests parsed by the asyncio loop engine are not run in a coroutine engine (greenlets):
+	each one is an asyncio Task running app(scope, receive, send).
+
+	receive() and send() return asyncio futures: data is read from (and written to) the non blocking
+	socket of the request directly, and when it is not ready a reader/writer on the fd of the loop
+	completes the operation. The http and websocket scopes are supported (the websocket handshake
+	requires SSL support), the lifespan startup is run before accepting requests.
+
+	The request is closed (and logged) as soon as the response is complete and written, a task still
+	running after that (background tasks) gets disconnect events from receive() and errors from send().
+
+*/
+
+#define UWSGI_ASGI_READ_SIZE 65536
+#define REQ_DATA wsgi_req->method_len, wsgi_req->method, wsgi_req->uri_len, wsgi_req->uri, wsgi_req->remote_addr_len, wsgi_req->remote_addr
+
+struct uwsgi_asgi_core {
+	struct wsgi_request *wsgi_req;
+	int active;
+	// bumped at the end of every request, the callables of a previous request become no-ops
+	uint64_t generation;
+	int websocket;
+	// 0: nothing sent, 1: response started (or websocket accepted), 2: response complete
+	int phase;
+	int connected;
+	int body_done;
+	int disconnected;
+	// the peer sent something after the body, stop watching for disconnections
+	int pipelined;
+	uint8_t ws_opcode;
+
+	PyObject *receive_waiter;
+	PyObject *read_timeout;
+	int reading;
+
+	struct uwsgi_buffer *out;
+	size_t out_body;
+	PyObject *send_waiters;
+	PyObject *write_timeout;
+	int writing;
+};
+
+static struct uwsgi_asgi_core *asgi_cores;
+
+static struct uwsgi_asgi_callbacks {
+	PyObject *on_readable;
+	PyObject *on_read_timeout;
+	PyObject *on_writable;
+	PyObject *on_write_timeout;
+	PyObject *lifespan_started;
+	int lifespan_startup_sent;
+} asgi_cb;
+
+static void asgi_finish(struct uwsgi_asgi_core *);
+static PyObject *asgi_flush(struct uwsgi_asgi_core *);
+
+// steals the reference to the value
+static int asgi_dict_set(PyObject *dict, char *key, PyObject *value) {
+	if (!value) return -1;
+	int ret = PyDict_SetItemString(dict, key, value);
+	Py_DECREF(value);
+	return ret;
+}
+
+static PyObject *asgi_event(char *type) {
+	PyObject *event = PyDict_New();
+	if (!event) return NULL;
+	if (asgi_dict_set(event, "type", PyUnicode_FromString(type))) {
+		Py_DECREF(event);
+		return NULL;
+	}
+	return event;
+}
+
+static PyObject *asgi_disconnect_event(int websocket) {
+	if (!websocket) return asgi_event("http.disconnect");
+	PyObject *event = asgi_event("websocket.disconnect");
+	if (!event) return NULL;
+	if (asgi_dict_set(event, "code", PyLong_FromLong(1005))) {
+		Py_DECREF(event);
+		return NULL;
+	}
+	return event;
+}
+
+static PyObject *asgi_self(struct uwsgi_asgi_core *ac) {
+	return Py_BuildValue("(iKi)", (int) (ac - asgi_cores), (unsigned long long) ac->generation, ac->websocket);
+}
+
+// the core of a still running request, NULL for callables of previous requests
+static struct uwsgi_asgi_core *asgi_core(PyObject *self, int *websocket) {
+	int id = 0, ws = 0;
+	unsigned long long generation = 0;
+	if (!self || !PyArg_ParseTuple(self, "iKi", &id, &generation, &ws)) {
+		PyErr_Clear();
+		return NULL;
+	}
+	if (websocket) *websocket = ws;
+	if (id < 0 || id >= uwsgi.async) return NULL;
+	struct uwsgi_asgi_core *ac = &asgi_cores[id];
+	if (!ac->active || ac->generation != generation) return NULL;
+	return ac;
+}
+
+// a new future, already completed if result is not NULL
+static PyObject *asgi_future(PyObject *result) {
+	PyObject *fut = PyObject_CallMethod(uasyncio.loop, "create_future", NULL);
+	if (!fut || !result) return fut;
+	PyObject *ret = PyObject_CallMethod(fut, "set_result", "O", result);
+	if (!ret) {
+		Py_DECREF(fut);
+		return NULL;
+	}
+	Py_DECREF(ret);
+	return fut;
+}
+
+// complete a future (unless it has been cancelled), with an IOError if result is NULL
+static void asgi_future_set(PyObject *fut, PyObject *result, char *error) {
+	PyObject *done = PyObject_CallMethod(fut, "done", NULL);
+	if (!done) goto end;
+	int is_done = PyObject_IsTrue(done);
+	Py_DECREF(done);
+	if (is_done) return;
+	PyObject *ret = NULL;
+	if (result) {
+		ret = PyObject_CallMethod(fut, "set_result", "O", result);
+	}
+	else {
+		PyObject *exc = PyObject_CallFunction(PyExc_IOError, "s", error);
+		if (!exc) goto end;
+		ret = PyObject_CallMethod(fut, "set_exception", "O", exc);
+		Py_DECREF(exc);
+	}
+	if (ret) {
+		Py_DECREF(ret);
+		return;
+	}
+end:
+	PyErr_Print();
+}
+
+static void asgi_loop_call(char *method, int fd) {
+	PyObject *ret = PyObject_CallMethod(uasyncio.loop, method, "i", fd);
+	if (!ret) {
+		PyErr_Print();
+		return;
+	}
+	Py_DECREF(ret);
+}
+
+static void asgi_timer_cancel(PyObject **timer) {
+	if (!*timer) return;
+	PyObject *ret = PyObject_CallMethod(*timer, "cancel", NULL);
+	if (!ret) PyErr_Print();
+	Py_XDECREF(ret);
+	Py_CLEAR(*timer);
+}
+
+// the fd is watched (and an optional timeout armed) calling cb(self)
+static int asgi_watch(struct uwsgi_asgi_core *ac, char *method, PyObject *cb, int timeout, PyObject *timeout_cb, PyObject **timer) {
+	PyObject *self = asgi_self(ac);
+	if (!self) return -1;
+	PyObject *ret = PyObject_CallMethod(uasyncio.loop, method, "iOO", ac->wsgi_req->fd, cb, self);
+	if (!ret) goto error;
+	Py_DECREF(ret);
+	if (timeout > 0) {
+		*timer = PyObject_CallMethod(uasyncio.loop, "call_later", "iOO", timeout, timeout_cb, self);
+		if (!*timer) goto error;
+	}
+	Py_DECREF(self);
+	return 0;
+error:
+	Py_DECREF(self);
+	return -1;
+}
+
+static void asgi_stop_reading(struct uwsgi_asgi_core *ac) {
+	if (ac->reading) {
+		asgi_loop_call("remove_reader", ac->wsgi_req->fd);
+		ac->reading = 0;
+	}
+	asgi_timer_cancel(&ac->read_timeout);
+}
+
+static int asgi_start_reading(struct uwsgi_asgi_core *ac) {
+	// websockets wake up at every ping interval to manage the ping/pong exchange
+	int timeout = ac->websocket ? uwsgi.websockets_ping_freq : (ac->body_done ? 0 : uwsgi.socket_timeout);
+	ac->reading = 1;
+	if (asgi_watch(ac, "add_reader", asgi_cb.on_readable, timeout, asgi_cb.on_read_timeout, &ac->read_timeout)) {
+		PyObject *type, *value, *traceback;
+		PyErr_Fetch(&type, &value, &traceback);
+		asgi_stop_reading(ac);
+		PyErr_Restore(type, value, traceback);
+		return -1;
+	}
+	return 0;
+}
+
+static void asgi_stop_writing(struct uwsgi_asgi_core *ac) {
+	if (ac->writing) {
+		asgi_loop_call("remove_writer", ac->wsgi_req->fd);
+		ac->writing = 0;
+	}
+	asgi_timer_cancel(&ac->write_timeout);
+}
+
+static int asgi_start_writing(struct uwsgi_asgi_core *ac) {
+	ac->writing = 1;
+	if (asgi_watch(ac, "add_writer", asgi_cb.on_writable, uwsgi.socket_timeout, asgi_cb.on_write_timeout, &ac->write_timeout)) {
+		PyObject *type, *value, *traceback;
+		PyErr_Fetch(&type, &value, &traceback);
+		asgi_stop_writing(ac);
+		PyErr_Restore(type, value, traceback);
+		return -1;
+	}
+	return 0;
+}
+
+static PyObject *asgi_read_websocket(struct uwsgi_asgi_core *ac) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+	for(;;) {
+		struct uwsgi_buffer *ub = uwsgi_websocket_recv_nb(wsgi_req);
+		if (!ub) {
+			ac->disconnected = 1;
+			return asgi_disconnect_event(1);
+		}
+		// would block
+		if (ub->pos == 0) {
+			uwsgi_buffer_destroy(ub);
+			return NULL;
+		}
+		// the opcode of a fragmented message is in its first frame
+		if (wsgi_req->websocket_opcode) ac->ws_opcode = wsgi_req->websocket_opcode;
+		if (!wsgi_req->websocket_is_fin) {
+			uwsgi_buffer_destroy(ub);
+			continue;
+		}
+		PyObject *event = asgi_event("websocket.receive");
+		if (event) {
+			int ret = ac->ws_opcode == 1 ?
+				asgi_dict_set(event, "text", PyUnicode_DecodeUTF8(ub->buf, ub->pos, "replace")) :
+				asgi_dict_set(event, "bytes", PyBytes_FromStringAndSize(ub->buf, ub->pos));
+			if (ret) Py_CLEAR(event);
+		}
+		uwsgi_buffer_destroy(ub);
+		return event;
+	}
+}
+
+// a new event, NULL (without an exception) if the socket is not ready
+static PyObject *asgi_read_event(struct uwsgi_asgi_core *ac) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+
+	if (ac->disconnected) return asgi_disconnect_event(ac->websocket);
+
+	if (ac->websocket && !ac->connected) {
+		ac->connected = 1;
+		return asgi_event("websocket.connect");
+	}
+
+	if (ac->websocket && ac->phase > 0) return asgi_read_websocket(ac);
+
+	// nothing to read (the body has been consumed or the handshake has still to be sent), wait for the peer to go away
+	if (ac->websocket || ac->body_done) {
+		char byte;
+		ssize_t rlen = recv(wsgi_req->fd, &byte, 1, MSG_PEEK);
+		if (rlen == 0 || (rlen < 0 && !uwsgi_is_again())) {
+			ac->disconnected = 1;
+			return asgi_disconnect_event(ac->websocket);
+		}
+		if (rlen > 0) ac->pipelined = 1;
+		return NULL;
+	}
+
+	PyObject *body = NULL;
+	int more_body = 1;
+
+	if (wsgi_req->body_is_chunked) {
+		size_t len = 0;
+		errno = 0;
+		char *buf = uwsgi_chunked_read_slice(wsgi_req, &len, UWSGI_ASGI_READ_SIZE, 0, 1);
+		if (!buf) {
+			if (uwsgi_is_again()) return NULL;
+			goto disconnect;
+		}
+		// end of the chunked stream
+		if (len == 0) more_body = 0;
+		body = PyBytes_FromStringAndSize(buf, len);
+	}
+	// buffered body (or nothing to read)
+	else if (uwsgi.post_buffering > 0 || wsgi_req->post_pos >= wsgi_req->post_cl) {
+		ssize_t rlen = 0;
+		char *buf = uwsgi_request_body_read(wsgi_req, UWSGI_ASGI_READ_SIZE, &rlen);
+		if (!buf) goto disconnect;
+		if (buf == uwsgi.empty) rlen = 0;
+		body = PyBytes_FromStringAndSize(buf, rlen);
+		more_body = wsgi_req->post_pos < wsgi_req->post_cl;
+	}
+	else {
+		size_t len = UMIN(wsgi_req->post_cl - wsgi_req->post_pos, UWSGI_ASGI_READ_SIZE);
+		body = PyBytes_FromStringAndSize(NULL, len);
+		if (!body) return NULL;
+		errno = 0;
+		ssize_t rlen = wsgi_req->socket->proto_read_body(wsgi_req, PyBytes_AS_STRING(body), len);
+		if (rlen < 0 && uwsgi_is_again()) {
+			Py_DECREF(body);
+			return NULL;
+		}
+		if (rlen <= 0) {
+			Py_DECREF(body);
+			if (rlen < 0) {
+				uwsgi_req_error("uwsgi_asgi_receive()");
+			}
+			goto disconnect;
+		}
+		wsgi_req->post_pos += rlen;
+		if (_PyBytes_Resize(&body, rlen)) return NULL;
+		more_body = wsgi_req->post_pos < wsgi_req->post_cl;
+	}
+
+	if (!body) return NULL;
+
+	if (!more_body) {
+		ac->body_done = 1;
+		if (!wsgi_req->body_at) wsgi_req->body_at = uwsgi_micros();
+	}
+
+	PyObject *event = asgi_event("http.request");
+	if (!event) {
+		Py_DECREF(body);
+		return NULL;
+	}
+	if (asgi_dict_set(event, "body", body) || asgi_dict_set(event, "more_body", PyBool_FromLong(more_body))) {
+		Py_DECREF(event);
+		return NULL;
+	}
+	return event;
+
+disconnect:
+	wsgi_req->read_errors++;
+	ac->disconnected = 1;
+	return asgi_disconnect_event(0);
+}
+
+// deliver an event to the waiting receive(), called by the loop reader and its timeout
+static void asgi_read_ready(struct uwsgi_asgi_core *ac, int timed_out) {
+	if (!ac->receive_waiter) {
+		asgi_stop_reading(ac);
+		return;
+	}
+
+	if (timed_out) {
+		Py_CLEAR(ac->read_timeout);
+		if (!ac->websocket) {
+			struct wsgi_request *wsgi_req = ac->wsgi_req;
+			uwsgi_log("[uwsgi-asgi] \"%.*s %.*s\" (%.*s) timeout reading the request body\n", REQ_DATA);
+			wsgi_req->read_errors++;
+			ac->disconnected = 1;
+		}
+	}
+
+	PyObject *event = asgi_read_event(ac);
+	if (!event) {
+		if (!PyErr_Occurred()) {
+			if (ac->pipelined) {
+				asgi_stop_reading(ac);
+			}
+			// re-arm the ping interval
+			else if (timed_out && asgi_start_reading(ac)) {
+				PyErr_Print();
+			}
+			return;
+		}
+		PyErr_Print();
+	}
+
+	asgi_stop_reading(ac);
+	PyObject *fut = ac->receive_waiter;
+	ac->receive_waiter = NULL;
+	asgi_future_set(fut, event, "error reading the ASGI request");
+	Py_DECREF(fut);
+	Py_XDECREF(event);
+}
+
+static PyObject *asgi_receive(PyObject *self, PyObject *unused) {
+	int websocket = 0;
+	struct uwsgi_asgi_core *ac = asgi_core(self, &websocket);
+	if (!ac) {
+		PyObject *event = asgi_disconnect_event(websocket);
+		if (!event) return NULL;
+		PyObject *fut = asgi_future(event);
+		Py_DECREF(event);
+		return fut;
+	}
+
+	if (ac->receive_waiter) {
+		PyObject *done = PyObject_CallMethod(ac->receive_waiter, "done", NULL);
+		if (!done) return NULL;
+		int is_done = PyObject_IsTrue(done);
+		Py_DECREF(done);
+		if (!is_done) {
+			PyErr_SetString(PyExc_RuntimeError, "receive() is already waiting for an ASGI event");
+			return NULL;
+		}
+		// cancelled by the app
+		Py_CLEAR(ac->receive_waiter);
+		asgi_stop_reading(ac);
+	}
+
+	PyObject *event = asgi_read_event(ac);
+	if (event) {
+		PyObject *fut = asgi_future(event);
+		Py_DECREF(event);
+		return fut;
+	}
+	if (PyErr_Occurred()) return NULL;
+
+	PyObject *fut = asgi_future(NULL);
+	if (!fut) return NULL;
+	if (!ac->pipelined && asgi_start_reading(ac)) {
+		Py_DECREF(fut);
+		return NULL;
+	}
+	Py_INCREF(fut);
+	ac->receive_waiter = fut;
+	return fut;
+}
+
+// write the pending output: 0 done, 1 the socket is not ready, -1 error
+static int asgi_write(struct uwsgi_asgi_core *ac) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+	struct uwsgi_buffer *ub = ac->out;
+	while (ub->pos > 0) {
+		errno = 0;
+		int ret = wsgi_req->socket->proto_write(wsgi_req, ub->buf, ub->pos);
+		if (ret < 0) {
+			if (!uwsgi.ignore_write_errors) {
+				uwsgi_req_error("uwsgi_asgi_write()");
+			}
+			wsgi_req->write_errors++;
+			return -1;
+		}
+		if (ret == UWSGI_OK) {
+			wsgi_req->response_size += ac->out_body;
+			ac->out_body = 0;
+			wsgi_req->write_pos = 0;
+			ub->pos = 0;
+			break;
+		}
+		if (!uwsgi_is_again()) continue;
+		return 1;
+	}
+	return 0;
+}
+
+static void asgi_send_waiters_done(struct uwsgi_asgi_core *ac, int error) {
+	Py_ssize_t i, n = PyList_Size(ac->send_waiters);
+	for(i=0;i<n;i++) {
+		asgi_future_set(PyList_GET_ITEM(ac->send_waiters, i), error ? NULL : Py_None, "error writing the ASGI response");
+	}
+	if (PyList_SetSlice(ac->send_waiters, 0, n, NULL)) PyErr_Print();
+}
+
+// the response headers (if not already sent) are queued in the output
+static int asgi_add_headers(struct uwsgi_asgi_core *ac) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+	int ret = uwsgi_response_headers_finalize(wsgi_req);
+	if (ret < 0) {
+		PyErr_SetString(PyExc_IOError, "unable to generate the ASGI response headers");
+		return -1;
+	}
+	if (ret == UWSGI_AGAIN && uwsgi_buffer_append(ac->out, wsgi_req->headers->buf, wsgi_req->headers->pos)) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	return 0;
+}
+
+static int asgi_add_body(struct uwsgi_asgi_core *ac, char *buf, size_t len) {
+	if (uwsgi_buffer_append(ac->out, buf, len)) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	ac->out_body += len;
+	return 0;
+}
+
+static int asgi_add_response_headers(struct uwsgi_asgi_core *ac, PyObject *headers) {
+	if (!headers || headers == Py_None) return 0;
+	PyObject *iter = PyObject_GetIter(headers);
+	if (!iter) return -1;
+	PyObject *item;
+	while ((item = PyIter_Next(iter))) {
+		PyObject *pair = PySequence_Fast(item, "ASGI headers must be (name, value) pairs");
+		Py_DECREF(item);
+		if (!pair) goto error;
+		if (PySequence_Fast_GET_SIZE(pair) != 2 || !PyBytes_Check(PySequence_Fast_GET_ITEM(pair, 0)) || !PyBytes_Check(PySequence_Fast_GET_ITEM(pair, 1))) {
+			Py_DECREF(pair);
+			PyErr_SetString(PyExc_TypeError, "ASGI headers must be (name, value) pairs of bytes");
+			goto error;
+		}
+		PyObject *name = PySequence_Fast_GET_ITEM(pair, 0);
+		PyObject *value = PySequence_Fast_GET_ITEM(pair, 1);
+		int ret = uwsgi_response_add_header(ac->wsgi_req, PyBytes_AS_STRING(name), PyBytes_GET_SIZE(name), PyBytes_AS_STRING(value), PyBytes_GET_SIZE(value));
+		Py_DECREF(pair);
+		if (ret) {
+			PyErr_SetString(PyExc_IOError, "unable to add ASGI response header");
+			goto error;
+		}
+	}
+	Py_DECREF(iter);
+	return PyErr_Occurred() ? -1 : 0;
+error:
+	Py_DECREF(iter);
+	return -1;
+}
+
+static int asgi_send_http(struct uwsgi_asgi_core *ac, const char *type, PyObject *message) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+
+	if (!strcmp(type, "http.response.start")) {
+		if (ac->phase != 0) {
+			PyErr_SetString(PyExc_RuntimeError, "the ASGI response has already been started");
+			return -1;
+		}
+		PyObject *status = PyDict_GetItemString(message, "status");
+		long code = status ? PyLong_AsLong(status) : -1;
+		if (code < 100 || code > 999) {
+			if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "invalid ASGI response status");
+			return -1;
+		}
+		if (uwsgi_response_prepare_headers_int(wsgi_req, code)) {
+			PyErr_SetString(PyExc_IOError, "unable to prepare the ASGI response headers");
+			return -1;
+		}
+		if (asgi_add_response_headers(ac, PyDict_GetItemString(message, "headers"))) return -1;
+		ac->phase = 1;
+		return 0;
+	}
+
+	if (!strcmp(type, "http.response.body")) {
+		if (ac->phase != 1) {
+			PyErr_SetString(PyExc_RuntimeError, ac->phase ? "the ASGI response is already complete" : "http.response.start has not been sent");
+			return -1;
+		}
+		if (asgi_add_headers(ac)) return -1;
+		PyObject *body = PyDict_GetItemString(message, "body");
+		if (body) {
+			Py_buffer pbuf;
+			if (PyObject_GetBuffer(body, &pbuf, PyBUF_SIMPLE)) return -1;
+			int ret = asgi_add_body(ac, pbuf.buf, pbuf.len);
+			PyBuffer_Release(&pbuf);
+			if (ret) return -1;
+		}
+		PyObject *more_body = PyDict_GetItemString(message, "more_body");
+		if (!more_body || !PyObject_IsTrue(more_body)) ac->phase = 2;
+		return 0;
+	}
+
+	PyErr_Format(PyExc_RuntimeError, "unsupported ASGI http message: %s", type);
+	return -1;
+}
+
+static int asgi_send_websocket(struct uwsgi_asgi_core *ac, const char *type, PyObject *message) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+
+	if (!strcmp(type, "websocket.accept")) {
+		if (ac->phase != 0) {
+			PyErr_SetString(PyExc_RuntimeError, "the ASGI websocket has already been accepted");
+			return -1;
+		}
+		char *proto = NULL;
+		Py_ssize_t proto_len = 0;
+		PyObject *subprotocol = PyDict_GetItemString(message, "subprotocol");
+		if (subprotocol && subprotocol != Py_None) {
+			proto = (char *) PyUnicode_AsUTF8AndSize(subprotocol, &proto_len);
+			if (!proto) return -1;
+		}
+		if (uwsgi_websocket_handshake_prepare(wsgi_req, NULL, 0, NULL, 0, proto, proto_len)) {
+			PyErr_SetString(PyExc_IOError, "unable to prepare the websocket handshake");
+			return -1;
+		}
+		if (asgi_add_response_headers(ac, PyDict_GetItemString(message, "headers"))) return -1;
+		if (asgi_add_headers(ac)) return -1;
+		ac->phase = 1;
+		return 0;
+	}
+
+	if (!strcmp(type, "websocket.send")) {
+		if (ac->phase != 1) {
+			PyErr_SetString(PyExc_RuntimeError, ac->phase ? "the ASGI websocket is closed" : "websocket.accept has not been sent");
+			return -1;
+		}
+		char *buf = NULL;
+		Py_ssize_t len = 0;
+		uint8_t opcode = 0x82;
+		PyObject *text = PyDict_GetItemString(message, "text");
+		PyObject *bytes = PyDict_GetItemString(message, "bytes");
+		if (text && text != Py_None) {
+			buf = (char *) PyUnicode_AsUTF8AndSize(text, &len);
+			if (!buf) return -1;
+			opcode = 0x81;
+		}
+		else if (bytes && bytes != Py_None) {
+			if (PyBytes_AsStringAndSize(bytes, &buf, &len)) return -1;
+		}
+		struct uwsgi_buffer *ub = uwsgi_websocket_message(wsgi_req, buf ? buf : "", len, opcode);
+		if (!ub || asgi_add_body(ac, ub->buf, ub->pos)) {
+			if (!PyErr_Occurred()) PyErr_NoMemory();
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "websocket.close")) {
+		// closed before the handshake
+		if (ac->phase == 0) {
+			if (uwsgi_response_prepare_headers_int(wsgi_req, 403) || uwsgi_response_add_content_length(wsgi_req, 0)) {
+				PyErr_SetString(PyExc_IOError, "unable to prepare the ASGI response headers");
+				return -1;
+			}
+			if (asgi_add_headers(ac)) return -1;
+		}
+		else if (ac->phase == 1) {
+			PyObject *code = PyDict_GetItemString(message, "code");
+			long close_code = code ? PyLong_AsLong(code) : 1000;
+			if (close_code == -1 && PyErr_Occurred()) return -1;
+			char payload[125];
+			payload[0] = (uint8_t) (close_code >> 8);
+			payload[1] = (uint8_t) (close_code & 0xff);
+			size_t len = 2;
+			PyObject *reason = PyDict_GetItemString(message, "reason");
+			if (reason && reason != Py_None) {
+				Py_ssize_t reason_len = 0;
+				char *r = (char *) PyUnicode_AsUTF8AndSize(reason, &reason_len);
+				if (!r) return -1;
+				reason_len = UMIN(reason_len, (Py_ssize_t) sizeof(payload) - 2);
+				memcpy(payload + 2, r, reason_len);
+				len += reason_len;
+			}
+			struct uwsgi_buffer *ub = uwsgi_websocket_message(wsgi_req, payload, len, 0x88);
+			if (!ub || asgi_add_body(ac, ub->buf, ub->pos)) {
+				if (!PyErr_Occurred()) PyErr_NoMemory();
+				return -1;
+			}
+		}
+		ac->phase = 2;
+		return 0;
+	}
+
+	PyErr_Format(PyExc_RuntimeError, "unsupported ASGI websocket message: %s", type);
+	return -1;
+}
+
+static PyObject *asgi_send(PyObject *self, PyObject *message) {
+	struct uwsgi_asgi_core *ac = asgi_core(self, NULL);
+	if (!ac || ac->disconnected) {
+		PyErr_SetString(PyExc_IOError, "the ASGI connection is closed");
+		return NULL;
+	}
+
+	if (!PyDict_Check(message)) {
+		PyErr_SetString(PyExc_TypeError, "ASGI messages must be dictionaries");
+		return NULL;
+	}
+	PyObject *type = PyDict_GetItemString(message, "type");
+	const char *type_str = type ? PyUnicode_AsUTF8(type) : NULL;
+	if (!type_str) {
+		if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "ASGI messages require a type");
+		return NULL;
+	}
+
+	if (ac->websocket) {
+		if (asgi_send_websocket(ac, type_str, message)) return NULL;
+	}
+	else {
+		if (asgi_send_http(ac, type_str, message)) return NULL;
+	}
+
+	return asgi_flush(ac);
+}
+
+// write the pending output, the returned future is done when it has been written
+static PyObject *asgi_flush(struct uwsgi_asgi_core *ac) {
+	if (!ac->writing) {
+		int ret = asgi_write(ac);
+		if (ret < 0) {
+			asgi_finish(ac);
+			PyErr_SetString(PyExc_IOError, "error writing the ASGI response");
+			return NULL;
+		}
+		if (ret == 0) {
+			PyObject *fut = asgi_future(Py_None);
+			if (ac->phase == 2) asgi_finish(ac);
+			return fut;
+		}
+		if (asgi_start_writing(ac)) return NULL;
+	}
+	PyObject *fut = asgi_future(NULL);
+	if (!fut) return NULL;
+	if (PyList_Append(ac->send_waiters, fut)) {
+		Py_DECREF(fut);
+		return NULL;
+	}
+	return fut;
+}
+
+static void asgi_finish(struct uwsgi_asgi_core *ac) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+
+	asgi_stop_reading(ac);
+	asgi_stop_writing(ac);
+
+	if (ac->receive_waiter) {
+		PyObject *event = asgi_disconnect_event(ac->websocket);
+		PyObject *fut = ac->receive_waiter;
+		ac->receive_waiter = NULL;
+		asgi_future_set(fut, event, "ASGI connection closed");
+		Py_DECREF(fut);
+		Py_XDECREF(event);
+	}
+	// unwritten data (if any) is lost
+	asgi_send_waiters_done(ac, ac->out->pos > 0);
+
+	ac->out->pos = 0;
+	ac->out_body = 0;
+	ac->active = 0;
+	ac->generation++;
+
+	uwsgi.wsgi_req = wsgi_req;
+	uwsgi_close_request(wsgi_req);
+	free_req_queue;
+}
+
+// the app failed (or returned) without completing the response
+static void asgi_abort_response(struct uwsgi_asgi_core *ac) {
+	if (ac->phase == 0 && !ac->disconnected) {
+		if (!uwsgi_response_prepare_headers_int(ac->wsgi_req, 500) && !uwsgi_response_add_content_length(ac->wsgi_req, 0)) {
+			if (asgi_add_headers(ac)) PyErr_Print();
+		}
+	}
+	ac->phase = 2;
+	if (ac->writing) return;
+	PyObject *fut = asgi_flush(ac);
+	if (!fut) {
+		PyErr_Print();
+		return;
+	}
+	Py_DECREF(fut);
+}
+
+static PyObject *asgi_task_done(PyObject *self, PyObject *task) {
+	PyObject *ret = PyObject_CallMethod(uasyncio.asgi_tasks, "discard", "O", task);
+	if (!ret) PyErr_Print();
+	Py_XDECREF(ret);
+
+	PyObject *cancelled = PyObject_CallMethod(task, "cancelled", NULL);
+	if (cancelled && !PyObject_IsTrue(cancelled)) {
+		PyObject *exc = PyObject_CallMethod(task, "exception", NULL);
+		if (exc && exc != Py_None) {
+			uwsgi_log("[uwsgi-asgi] exception in the ASGI app:\n");
+			Py_INCREF(exc);
+			PyErr_Restore((PyObject *) Py_TYPE(exc), exc, PyException_GetTraceback(exc));
+			Py_INCREF(Py_TYPE(exc));
+			PyErr_Print();
+		}
+		Py_XDECREF(exc);
+	}
+	Py_XDECREF(cancelled);
+	if (PyErr_Occurred()) PyErr_Print();
+
+	struct uwsgi_asgi_core *ac = asgi_core(self, NULL);
+	if (ac && ac->phase < 2) {
+		asgi_abort_response(ac);
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *asgi_on_readable(PyObject *module, PyObject *self) {
+	struct uwsgi_asgi_core *ac = asgi_core(self, NULL);
+	if (ac) asgi_read_ready(ac, 0);
+	Py_RETURN_NONE;
+}
+
+static PyObject *asgi_on_read_timeout(PyObject *module, PyObject *self) {
+	struct uwsgi_asgi_core *ac = asgi_core(self, NULL);
+	if (ac) asgi_read_ready(ac, 1);
+	Py_RETURN_NONE;
+}
+
+static PyObject *asgi_on_writable(PyObject *module, PyObject *self) {
+	struct uwsgi_asgi_core *ac = asgi_core(self, NULL);
+	if (!ac) Py_RETURN_NONE;
+	int ret = asgi_write(ac);
+	if (ret > 0) Py_RETURN_NONE;
+	asgi_stop_writing(ac);
+	if (ret < 0 || ac->phase == 2) {
+		asgi_finish(ac);
+	}
+	else {
+		asgi_send_waiters_done(ac, 0);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *asgi_on_write_timeout(PyObject *module, PyObject *self) {
+	struct uwsgi_asgi_core *ac = asgi_core(self, NULL);
+	if (!ac) Py_RETURN_NONE;
+	Py_CLEAR(ac->write_timeout);
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+	uwsgi_log("[uwsgi-asgi] \"%.*s %.*s\" (%.*s) timeout writing the response\n", REQ_DATA);
+	wsgi_req->write_errors++;
+	asgi_finish(ac);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef asgi_receive_def[] = { {"receive", asgi_receive, METH_NOARGS, ""} };
+static PyMethodDef asgi_send_def[] = { {"send", asgi_send, METH_O, ""} };
+static PyMethodDef asgi_task_done_def[] = { {"uwsgi_asgi_task_done", asgi_task_done, METH_O, ""} };
+static PyMethodDef asgi_on_readable_def[] = { {"uwsgi_asgi_on_readable", asgi_on_readable, METH_O, ""} };
+static PyMethodDef asgi_on_read_timeout_def[] = { {"uwsgi_asgi_on_read_timeout", asgi_on_read_timeout, METH_O, ""} };
+static PyMethodDef asgi_on_writable_def[] = { {"uwsgi_asgi_on_writable", asgi_on_writable, METH_O, ""} };
+static PyMethodDef asgi_on_write_timeout_def[] = { {"uwsgi_asgi_on_write_timeout", asgi_on_write_timeout, METH_O, ""} };
+
+static PyObject *asgi_str(char *buf, uint16_t len, char *default_value) {
+	if (!len) return PyUnicode_FromString(default_value);
+	return PyUnicode_DecodeLatin1(buf, len, NULL);
+}
+
+static PyObject *asgi_addr(struct wsgi_request *wsgi_req, char *addr, uint16_t addr_len, char *port_var, uint16_t port_var_len) {
+	uint16_t port_len = 0;
+	char *port = uwsgi_get_var(wsgi_req, port_var, port_var_len, &port_len);
+	if (!addr_len) Py_RETURN_NONE;
+	return Py_BuildValue("(Ni)", PyUnicode_DecodeLatin1(addr, addr_len, NULL), port ? uwsgi_str_num(port, port_len) : 0);
+}
+
+static PyObject *asgi_headers(struct wsgi_request *wsgi_req) {
+	PyObject *headers = PyList_New(0);
+	if (!headers) return NULL;
+	int i;
+	for (i = 0; i < wsgi_req->var_cnt; i += 2) {
+		char *key = wsgi_req->hvec[i].iov_base;
+		size_t key_len = wsgi_req->hvec[i].iov_len;
+		if (key_len > 5 && !memcmp(key, "HTTP_", 5)) {
+			key += 5;
+			key_len -= 5;
+		}
+		else if (!uwsgi_strncmp(key, key_len, "CONTENT_TYPE", 12) || !uwsgi_strncmp(key, key_len, "CONTENT_LENGTH", 14)) {
+			// managed below
+		}
+		else {
+			continue;
+		}
+		PyObject *name = PyBytes_FromStringAndSize(NULL, key_len);
+		if (!name) goto error;
+		char *ptr = PyBytes_AS_STRING(name);
+		size_t j;
+		for (j = 0; j < key_len; j++) {
+			ptr[j] = key[j] == '_' ? '-' : tolower((int) key[j]);
+		}
+		PyObject *header = Py_BuildValue("(Ny#)", name, wsgi_req->hvec[i + 1].iov_base, (Py_ssize_t) wsgi_req->hvec[i + 1].iov_len);
+		if (!header) goto error;
+		int ret = PyList_Append(headers, header);
+		Py_DECREF(header);
+		if (ret) goto error;
+	}
+	return headers;
+error:
+	Py_DECREF(headers);
+	return NULL;
+}
+
+static PyObject *asgi_scope(struct uwsgi_asgi_core *ac) {
+	struct wsgi_request *wsgi_req = ac->wsgi_req;
+	PyObject *scope = PyDict_New();
+	if (!scope) return NULL;
+
+	int https = wsgi_req->https_len > 0 && (wsgi_req->https[0] == 'o' || wsgi_req->https[0] == 'O' || wsgi_req->https[0] == '1');
+	char *scheme = ac->websocket ? (https ? "wss" : "ws") : (https ? "https" : "http");
+
+	char *http_version = "1.1";
+	if (wsgi_req->protocol_len == 8 && !memcmp(wsgi_req->protocol, "HTTP/1.0", 8)) http_version = "1.0";
+	else if (wsgi_req->protocol_len >= 6 && !memcmp(wsgi_req->protocol, "HTTP/2", 6)) http_version = "2";
+
+	uint16_t raw_path_len = wsgi_req->uri_len;
+	char *qm = memchr(wsgi_req->uri, '?', wsgi_req->uri_len);
+	if (qm) raw_path_len = qm - wsgi_req->uri;
+
+	if (asgi_dict_set(scope, "type", PyUnicode_FromString(ac->websocket ? "websocket" : "http"))) goto error;
+	if (asgi_dict_set(scope, "asgi", Py_BuildValue("{ssss}", "version", "3.0", "spec_version", "2.3"))) goto error;
+	if (asgi_dict_set(scope, "http_version", PyUnicode_FromString(http_version))) goto error;
+	if (!ac->websocket) {
+		if (asgi_dict_set(scope, "method", asgi_str(wsgi_req->method, wsgi_req->method_len, "GET"))) goto error;
+	}
+	if (asgi_dict_set(scope, "scheme", wsgi_req->scheme_len ? (ac->websocket ? PyUnicode_FromString(scheme) : asgi_str(wsgi_req->scheme, wsgi_req->scheme_len, scheme)) : PyUnicode_FromString(scheme))) goto error;
+	if (asgi_dict_set(scope, "path", PyUnicode_DecodeUTF8(wsgi_req->path_info, wsgi_req->path_info_len, "replace"))) goto error;
+	if (asgi_dict_set(scope, "raw_path", PyBytes_FromStringAndSize(wsgi_req->uri, raw_path_len))) goto error;
+	if (asgi_dict_set(scope, "query_string", PyBytes_FromStringAndSize(wsgi_req->query_string, wsgi_req->query_string_len))) goto error;
+	if (asgi_dict_set(scope, "root_path", asgi_str(wsgi_req->script_name, wsgi_req->script_name_len, ""))) goto error;
+	if (asgi_dict_set(scope, "headers", asgi_headers(wsgi_req))) goto error;
+	if (asgi_dict_set(scope, "client", asgi_addr(wsgi_req, wsgi_req->remote_addr, wsgi_req->remote_addr_len, "REMOTE_PORT", 11))) goto error;
+
+	uint16_t server_name_len = 0;
+	char *server_name = uwsgi_get_var(wsgi_req, "SERVER_NAME", 11, &server_name_len);
+	if (asgi_dict_set(scope, "server", asgi_addr(wsgi_req, server_name, server_name_len, "SERVER_PORT", 11))) goto error;
+
+	if (ac->websocket) {
+		PyObject *subprotocols = PyList_New(0);
+		if (!subprotocols) goto error;
+		if (wsgi_req->http_sec_websocket_protocol_len > 0) {
+			char *protocols = uwsgi_concat2n(wsgi_req->http_sec_websocket_protocol, wsgi_req->http_sec_websocket_protocol_len, "", 0);
+			char *p, *ctx = NULL;
+			uwsgi_foreach_token(protocols, ",", p, ctx) {
+				while (*p == ' ') p++;
+				PyObject *subprotocol = PyUnicode_FromString(p);
+				if (!subprotocol || PyList_Append(subprotocols, subprotocol)) {
+					Py_XDECREF(subprotocol);
+					free(protocols);
+					Py_DECREF(subprotocols);
+					goto error;
+				}
+				Py_DECREF(subprotocol);
+			}
+			free(protocols);
+		}
+		if (asgi_dict_set(scope, "subprotocols", subprotocols)) goto error;
+	}
+
+	if (asgi_dict_set(scope, "state", PyDict_Copy(uasyncio.asgi_state))) goto error;
+
+	return scope;
+error:
+	Py_DECREF(scope);
+	return NULL;
+}
+
+void uwsgi_asgi_request(struct wsgi_request *wsgi_req) {
+	struct uwsgi_asgi_core *ac = &asgi_cores[wsgi_req->async_id];
+	PyObject *self = NULL, *scope = NULL, *receive = NULL, *send = NULL, *coro = NULL, *task = NULL, *done_cb = NULL, *ret = NULL;
+
+	if (!wsgi_req->len || uwsgi_parse_vars(wsgi_req)) {
+		uwsgi.wsgi_req = wsgi_req;
+		uwsgi_close_request(wsgi_req);
+		free_req_queue;
+		return;
+	}
+
+	ac->wsgi_req = wsgi_req;
+	ac->active = 1;
+	ac->websocket = wsgi_req->http_sec_websocket_key_len > 0;
+	ac->phase = 0;
+	ac->connected = 0;
+	ac->body_done = 0;
+	ac->disconnected = 0;
+	ac->pipelined = 0;
+	ac->ws_opcode = 0;
+	ac->out->pos = 0;
+	ac->out_body = 0;
+
+	self = asgi_self(ac);
+	if (!self) goto error;
+	scope = asgi_scope(ac);
+	if (!scope) goto error;
+	receive = PyCFunction_New(asgi_receive_def, self);
+	if (!receive) goto error;
+	send = PyCFunction_New(asgi_send_def, self);
+	if (!send) goto error;
+
+	coro = PyObject_CallFunctionObjArgs(uasyncio.asgi_app, scope, receive, send, NULL);
+	if (!coro) goto error;
+	task = PyObject_CallMethod(uasyncio.loop, "create_task", "O", coro);
+	if (!task) goto error;
+	ret = PyObject_CallMethod(uasyncio.asgi_tasks, "add", "O", task);
+	if (!ret) goto error;
+	Py_DECREF(ret);
+	done_cb = PyCFunction_New(asgi_task_done_def, self);
+	if (!done_cb) goto error;
+	ret = PyObject_CallMethod(task, "add_done_callback", "O", done_cb);
+	if (!ret) goto error;
+	Py_DECREF(ret);
+	goto end;
+
+error:
+	PyErr_Print();
+	// the task has not been created
+	if (!task && ac->active) asgi_abort_response(ac);
+end:
+	Py_XDECREF(done_cb);
+	Py_XDECREF(task);
+	Py_XDECREF(coro);
+	Py_XDECREF(send);
+	Py_XDECREF(receive);
+	Py_XDECREF(scope);
+	Py_XDECREF(self);
+}
+
+static PyObject *asgi_lifespan_receive(PyObject *self, PyObject *unused) {
+	if (asgi_cb.lifespan_startup_sent) {
+		// workers do not notify the shutdown
+		return asgi_future(NULL);
+	}
+	asgi_cb.lifespan_startup_sent = 1;
+	PyObject *event = asgi_event("lifespan.startup");
+	if (!event) return NULL;
+	PyObject *fut = asgi_future(event);
+	Py_DECREF(event);
+	return fut;
+}
+
+static PyObject *asgi_lifespan_send(PyObject *self, PyObject *message) {
+	PyObject *type = PyDict_Check(message) ? PyDict_GetItemString(message, "type") : NULL;
+	const char *type_str = type ? PyUnicode_AsUTF8(type) : NULL;
+	if (!type_str) {
+		if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "ASGI messages require a type");
+		return NULL;
+	}
+	if (!strcmp(type_str, "lifespan.startup.complete")) {
+		asgi_future_set(asgi_cb.lifespan_started, Py_True, NULL);
+	}
+	else if (!strcmp(type_str, "lifespan.startup.failed")) {
+		PyObject *msg = PyDict_GetItemString(message, "message");
+		const char *msg_str = msg ? PyUnicode_AsUTF8(msg) : NULL;
+		if (!msg_str) PyErr_Clear();
+		uwsgi_log("[uwsgi-asgi] lifespan startup failed: %s\n", msg_str ? msg_str : "");
+		asgi_future_set(asgi_cb.lifespan_started, Py_False, NULL);
+	}
+	return asgi_future(Py_None);
+}
+
+static PyObject *asgi_lifespan_done(PyObject *self, PyObject *task) {
+	PyObject *ret = PyObject_CallMethod(uasyncio.asgi_tasks, "discard", "O", task);
+	Py_XDECREF(ret);
+	PyObject *done = PyObject_CallMethod(asgi_cb.lifespan_started, "done", NULL);
+	if (done && !PyObject_IsTrue(done)) {
+		// apps not supporting the lifespan protocol raise an exception
+		uwsgi_log("[uwsgi-asgi] the ASGI app does not support the lifespan protocol\n");
+		PyObject *exc = PyObject_CallMethod(task, "exception", NULL);
+		Py_XDECREF(exc);
+		asgi_future_set(asgi_cb.lifespan_started, Py_True, NULL);
+	}
+	Py_XDECREF(done);
+	if (PyErr_Occurred()) PyErr_Print();
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef asgi_lifespan_receive_def[] = { {"receive", asgi_lifespan_receive, METH_NOARGS, ""} };
+static PyMethodDef asgi_lifespan_send_def[] = { {"send", asgi_lifespan_send, METH_O, ""} };
+static PyMethodDef asgi_lifespan_done_def[] = { {"uwsgi_asgi_lifespan_done", asgi_lifespan_done, METH_O, ""} };
+
+static void asgi_lifespan() {
+	asgi_cb.lifespan_started = asgi_future(NULL);
+	if (!asgi_cb.lifespan_started) uwsgi_pyexit;
+
+	PyObject *scope = Py_BuildValue("{sssNsO}", "type", "lifespan",
+		"asgi", Py_BuildValue("{ssss}", "version", "3.0", "spec_version", "2.0"),
+		"state", uasyncio.asgi_state);
+	if (!scope) uwsgi_pyexit;
+	PyObject *receive = PyCFunction_New(asgi_lifespan_receive_def, NULL);
+	PyObject *send = PyCFunction_New(asgi_lifespan_send_def, NULL);
+	PyObject *done_cb = PyCFunction_New(asgi_lifespan_done_def, NULL);
+	if (!receive || !send || !done_cb) uwsgi_pyexit;
+
+	PyObject *coro = PyObject_CallFunctionObjArgs(uasyncio.asgi_app, scope, receive, send, NULL);
+	if (!coro) uwsgi_pyexit;
+	PyObject *task = PyObject_CallMethod(uasyncio.loop, "create_task", "O", coro);
+	if (!task) uwsgi_pyexit;
+	PyObject *ret = PyObject_CallMethod(uasyncio.asgi_tasks, "add", "O", task);
+	if (!ret) uwsgi_pyexit;
+	Py_DECREF(ret);
+	ret = PyObject_CallMethod(task, "add_done_callback", "O", done_cb);
+	if (!ret) uwsgi_pyexit;
+	Py_DECREF(ret);
+
+	PyObject *started = PyObject_CallMethod(uasyncio.loop, "run_until_complete", "O", asgi_cb.lifespan_started);
+	if (!started) uwsgi_pyexit;
+	if (!PyObject_IsTrue(started)) {
+		exit(1);
+	}
+
+	Py_DECREF(started);
+	Py_DECREF(task);
+	Py_DECREF(coro);
+	Py_DECREF(done_cb);
+	Py_DECREF(send);
+	Py_DECREF(receive);
+	Py_DECREF(scope);
+}
+
+void uwsgi_asgi_init() {
+	char *module = uwsgi_str(uasyncio.asgi);
+	char *callable = "app";
+	char *colon = strchr(module, ':');
+	if (colon) {
+		*colon = 0;
+		callable = colon + 1;
+	}
+
+	PyObject *mod = PyImport_ImportModule(module);
+	if (!mod) uwsgi_pyexit;
+	uasyncio.asgi_app = PyObject_GetAttrString(mod, callable);
+	if (!uasyncio.asgi_app) uwsgi_pyexit;
+	Py_DECREF(mod);
+
+	uasyncio.asgi_state = PyDict_New();
+	uasyncio.asgi_tasks = PySet_New(NULL);
+	if (!uasyncio.asgi_state || !uasyncio.asgi_tasks) uwsgi_pyexit;
+
+	asgi_cb.on_readable = PyCFunction_New(asgi_on_readable_def, NULL);
+	asgi_cb.on_read_timeout = PyCFunction_New(asgi_on_read_timeout_def, NULL);
+	asgi_cb.on_writable = PyCFunction_New(asgi_on_writable_def, NULL);
+	asgi_cb.on_write_timeout = PyCFunction_New(asgi_on_write_timeout_def, NULL);
+	if (!asgi_cb.on_readable || !asgi_cb.on_read_timeout || !asgi_cb.on_writable || !asgi_cb.on_write_timeout) uwsgi_pyexit;
+
+	asgi_cores = uwsgi_calloc(sizeof(struct uwsgi_asgi_core) * uwsgi.async);
+	int i;
+	for(i=0;i<uwsgi.async;i++) {
+		asgi_cores[i].out = uwsgi_buffer_new(uwsgi.page_size);
+		asgi_cores[i].send_waiters = PyList_New(0);
+		if (!asgi_cores[i].send_waiters) uwsgi_pyexit;
+	}
+
+	asgi_lifespan();
+
+	uwsgi_log("ASGI app %s:%s ready on worker %d\n", module, callable, uwsgi.mywid);
+	free(module);
+}
+
+#else
+void uwsgi_asgi_init() {
+	uwsgi_log("ASGI apps require python 3\n");
+	exit(1);
+}
+
+void uwsgi_asgi_request(struct wsgi_request *wsgi_req) {}
+#endif
@@ -1,4 +1,4 @@
-#include "../python/uwsgi_python.h"
+#include "asyncio.h"
 
 /*
 
@@ -13,16 +13,7 @@
 extern struct uwsgi_server uwsgi;
 extern struct uwsgi_python up;
 
-static struct uwsgi_asyncio {
-	PyObject *mod;
-	PyObject *loop;
-	PyObject *request;
-	PyObject *hook_fd;
-	PyObject *hook_timeout;
-	PyObject *hook_fix;
-} uasyncio;
-
-#define free_req_queue uwsgi.async_queue_unused_ptr++; uwsgi.async_queue_unused[uwsgi.async_queue_unused_ptr] = wsgi_req
+struct uwsgi_asyncio uasyncio;
 
 static void uwsgi_opt_setup_asyncio(char *opt, char *value, void *null) {
 
@@ -36,8 +27,17 @@ static void uwsgi_opt_setup_asyncio(char *opt, char *value, void *null) {
 
 }
 
+static void uwsgi_opt_asgi(char *opt, char *value, void *null) {
+	uasyncio.asgi = value;
+	// the ASGI app can only run in the asyncio loop engine
+	uwsgi.loop = "asyncio";
+	// the app is loaded by the loop engine, not as a WSGI app
+	uwsgi.need_app = 0;
+}
+
 static struct uwsgi_option asyncio_options[] = {
         {"asyncio", required_argument, 0, "a shortcut enabling asyncio loop engine with the specified number of async cores and optimal parameters", uwsgi_opt_setup_asyncio, NULL, UWSGI_OPT_THREADS},
+        {"asgi", required_argument, 0, "run the specified ASGI app (<module>[:<callable>], default callable is app) in the asyncio loop engine", uwsgi_opt_asgi, NULL, 0},
         {0, 0, 0, 0, 0, 0, 0},
 
 };
@@ -156,6 +156,11 @@ static PyObject *py_uwsgi_asyncio_request(PyObject *self, PyObject *args) {
 	if (status == 0) {
 		// we call this two time... overengineering :(
 		uwsgi.async_proto_fd_table[wsgi_req->fd] = NULL;
+		// ASGI requests are asyncio tasks, they close the request by themselves
+		if (uasyncio.asgi) {
+			uwsgi_asgi_request(wsgi_req);
+			goto again;
+		}
 		uwsgi.schedule_to_req();
 		goto again;
 	}
@@ -317,7 +322,7 @@ static void asyncio_loop() {
 		exit(1);
 	}
 
-	if (!uwsgi.schedule_to_main) {
+	if (!uwsgi.schedule_to_main && !uasyncio.asgi) {
                 uwsgi_log("*** DANGER *** asyncio mode without coroutine/greenthread engine loaded !!!\n");
         }
 
@@ -359,6 +364,11 @@ static void asyncio_loop() {
 	Py_INCREF(uasyncio.hook_timeout);
 	Py_INCREF(uasyncio.hook_fix);
 
+	// load the ASGI app and run its lifespan startup before accepting requests
+	if (uasyncio.asgi) {
+		uwsgi_asgi_init();
+	}
+
 	// call add_handler on each socket
 	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
 	while(uwsgi_sock) {
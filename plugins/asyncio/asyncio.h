@@ -0,0 +1,22 @@
+#include "../python/uwsgi_python.h"
+
+#define free_req_queue uwsgi.async_queue_unused_ptr++; uwsgi.async_queue_unused[uwsgi.async_queue_unused_ptr] = wsgi_req
+
+struct uwsgi_asyncio {
+	PyObject *mod;
+	PyObject *loop;
+	PyObject *request;
+	PyObject *hook_fd;
+	PyObject *hook_timeout;
+	PyObject *hook_fix;
+
+	char *asgi;
+	PyObject *asgi_app;
+	// lifespan state, copied in the scope of every request
+	PyObject *asgi_state;
+	// strong references to the running tasks (the loop keeps only weak ones)
+	PyObject *asgi_tasks;
+};
+
+void uwsgi_asgi_init(void);
+void uwsgi_asgi_request(struct wsgi_request *);
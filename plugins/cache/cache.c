@@ -26,6 +26,9 @@
 
 		6 -> dump the whole cache
 
+		8 -> dump a range of items -> [111, pktsize, 8] + (cache|from|count) / response is [111, pktsize, 9] + (next|total|size) + size bytes of records
+			(keylen(2) vallen(8) expires(8) key value, little endian), used by the streaming sync
+
 		17 -> magic interface for plugins remote access { "cmd": "get|set|update|del|exists", "key": "cache key", "expires": "seconds", "cache": "the cache name"}
 			returns: {"status":"ok|notfound|error", "size": "size of the following body, if present"} + stream
 
@@ -74,6 +77,21 @@ static void manage_magic_context(struct wsgi_request *wsgi_req, struct uwsgi_cac
 
 	if (!uc) return;
 
+	// cache clear
+        if (!uwsgi_strncmp(ucmc->cmd, ucmc->cmd_len, "clear", 5)) {
+		if (uwsgi_cache_clear(uc)) return;
+                ub = uwsgi_buffer_new(uwsgi.page_size);
+                ub->pos = 4;
+                if (uwsgi_buffer_append_keyval(ub, "status", 6, "ok", 2)) goto error2;
+                if (uwsgi_buffer_set_uh(ub, 111, 17)) goto error2;
+                uwsgi_response_write_body_do(wsgi_req, ub->buf, ub->pos);
+                uwsgi_buffer_destroy(ub);
+                return;
+        }
+
+	// all of the other commands work on a single key (and so on a single shard)
+	uc = uwsgi_cache_shard(uc, ucmc->key, ucmc->key_len);
+
 	// cache get
 	if (!uwsgi_strncmp(ucmc->cmd, ucmc->cmd_len, "get", 3)) {
 		uint64_t vallen = 0;
@@ -139,28 +157,6 @@ static void manage_magic_context(struct wsgi_request *wsgi_req, struct uwsgi_cac
                 return;
         }
 
-	// cache clear
-        if (!uwsgi_strncmp(ucmc->cmd, ucmc->cmd_len, "clear", 5)) {
-		uint64_t i;
-		uwsgi_wlock(uc->lock);
-		for (i = 1; i < uwsgi.caches->max_items; i++) {
-			if (uwsgi_cache_del2(uc, NULL, 0, i, 0)) {
-                                uwsgi_rwunlock(uc->lock);
-                                return;
-                        }	
-		}
-                // we are still locked !!!
-                ub = uwsgi_buffer_new(uwsgi.page_size);
-                ub->pos = 4;
-                if (uwsgi_buffer_append_keyval(ub, "status", 6, "ok", 2)) goto error;
-                if (uwsgi_buffer_set_uh(ub, 111, 17)) goto error;
-                // unlock !!!
-                uwsgi_rwunlock(uc->lock);
-                uwsgi_response_write_body_do(wsgi_req, ub->buf, ub->pos);
-                uwsgi_buffer_destroy(ub);
-                return;
-        }
-
 	// cache set
 	if (!uwsgi_strncmp(ucmc->cmd, ucmc->cmd_len, "set", 3) || !uwsgi_strncmp(ucmc->cmd, ucmc->cmd_len, "update", 6)) {
 		if (ucmc->size == 0 || ucmc->size > uc->max_item_size) return;
@@ -191,6 +187,49 @@ static void manage_magic_context(struct wsgi_request *wsgi_req, struct uwsgi_cac
 error:
 	uwsgi_rwunlock(uc->lock);
 	uwsgi_buffer_destroy(ub);
+	return;
+error2:
+	uwsgi_buffer_destroy(ub);
+}
+
+struct cache_range_request {
+	char *cache;
+	uint16_t cache_len;
+	uint64_t from;
+	uint64_t count;
+};
+
+static void cache_range_request_hook(char *key, uint16_t keylen, char *val, uint16_t vallen, void *data) {
+	struct cache_range_request *ucr = (struct cache_range_request *) data;
+	if (!uwsgi_strncmp(key, keylen, "cache", 5)) {
+		ucr->cache = val;
+		ucr->cache_len = vallen;
+	}
+	else if (!uwsgi_strncmp(key, keylen, "from", 4)) {
+		ucr->from = uwsgi_str_num(val, vallen);
+	}
+	else if (!uwsgi_strncmp(key, keylen, "count", 5)) {
+		ucr->count = uwsgi_str_num(val, vallen);
+	}
+}
+
+static void cache_range(struct wsgi_request *wsgi_req, struct uwsgi_cache *uc, struct cache_range_request *ucr) {
+	uint64_t next = 0, total = 0;
+	if (!ucr->count) ucr->count = 1000;
+	struct uwsgi_buffer *records = uwsgi_cache_dump_range(uc, ucr->from, ucr->count, &next, &total);
+	if (!records) return;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	ub->pos = 4;
+	if (uwsgi_buffer_append_keynum(ub, "next", 4, next)) goto end;
+	if (uwsgi_buffer_append_keynum(ub, "total", 5, total)) goto end;
+	if (uwsgi_buffer_append_keynum(ub, "size", 4, records->pos)) goto end;
+	if (uwsgi_buffer_set_uh(ub, 111, 9)) goto end;
+	if (uwsgi_response_write_body_do(wsgi_req, ub->buf, ub->pos)) goto end;
+	if (records->pos > 0) uwsgi_response_write_body_do(wsgi_req, records->buf, records->pos);
+end:
+	uwsgi_buffer_destroy(ub);
+	uwsgi_buffer_destroy(records);
 }
 
 static int uwsgi_cache_request(struct wsgi_request *wsgi_req) {
@@ -201,6 +240,8 @@ static int uwsgi_cache_request(struct wsgi_request *wsgi_req) {
         uint16_t argvs[3];
         uint8_t argc = 0;
 
+	// used for modifier2 8
+	struct cache_range_request ucr;
 	// used for modifier2 17
 	struct uwsgi_cache_magic_context ucmc;
 	struct uwsgi_cache *uc = NULL;
@@ -269,7 +310,8 @@ static int uwsgi_cache_request(struct wsgi_request *wsgi_req) {
 				uc = uwsgi_cache_by_namelen(wsgi_req->buffer, wsgi_req->uh->_pktsize);
 			}
 
-			if (!uc) break;
+			// sharded caches are dumped one shard at a time (by <name>:<n>)
+			if (!uc || uc->shards) break;
 
 			uwsgi_wlock(uc->lock);
 			struct uwsgi_buffer *cache_dump = uwsgi_buffer_new(uwsgi.page_size + uc->filesize);
@@ -298,6 +340,15 @@ static int uwsgi_cache_request(struct wsgi_request *wsgi_req) {
 			uwsgi_response_write_body_do(wsgi_req, cache_dump->buf, cache_dump->pos);
 			uwsgi_buffer_destroy(cache_dump);
 			break;
+		case 8:
+			// dump a range of items
+			if (wsgi_req->uh->_pktsize == 0) break;
+			memset(&ucr, 0, sizeof(struct cache_range_request));
+			if (uwsgi_hooked_parse(wsgi_req->buffer, wsgi_req->uh->_pktsize, cache_range_request_hook, &ucr)) break;
+			uc = ucr.cache ? uwsgi_cache_by_namelen(ucr.cache, ucr.cache_len) : uwsgi.caches;
+			if (!uc) break;
+			cache_range(wsgi_req, uc, &ucr);
+			break;
 		case 17:
 			if (wsgi_req->uh->_pktsize == 0) break;
 			memset(&ucmc, 0, sizeof(struct uwsgi_cache_magic_context));
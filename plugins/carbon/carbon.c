@@ -166,7 +166,8 @@ static void carbon_post_init() {
 	uspi->raw=1;
 }
 
-static int carbon_write(int fd, char *fmt,...) {
+// lines are batched and written in chunks of up to 64k
+static int carbon_write(struct uwsgi_stats_pusher_batch *batch, char *fmt,...) {
 	va_list ap;
 	va_start(ap, fmt);
 
@@ -176,17 +177,17 @@ static int carbon_write(int fd, char *fmt,...) {
 	rlen = vsnprintf(ptr, 4096, fmt, ap);
 	va_end(ap);
 
-	if (rlen < 1) return 0;
+	if (rlen < 1 || rlen >= 4096) return 0;
 
-	if (uwsgi_write_nb(fd, ptr, rlen, u_carbon.timeout)) {
-		uwsgi_error("carbon_write()");
+	if (uwsgi_stats_pusher_batch_add(batch, ptr, rlen)) {
+		uwsgi_log("[carbon] unable to write metrics\n");
 		return 0;
 	}
 
 	return 1;
 }
 
-static int carbon_push_stats(int retry_cycle, time_t now) {
+static int carbon_push_stats(struct uwsgi_stats_pusher_instance *uspi, int retry_cycle, time_t now) {
 	struct carbon_server_list *usl = u_carbon.servers_data;
 	if (!u_carbon.servers_data) return 0;
 	int i;
@@ -202,6 +203,12 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 		u_carbon.was_busy[i] += uwsgi_worker_is_busy(i+1);
 	}
 
+	// metrics not changed since the last push (--stats-push-changed-only)
+	uint8_t *skip = NULL;
+	if (u_carbon.use_metrics && uspi && uwsgi.stats_push_changed_only) {
+		skip = uwsgi_calloc(uwsgi.metrics_cnt);
+	}
+
 	needs_retry = 0;
 	while(usl) {
 		if (retry_cycle && usl->healthy)
@@ -239,6 +246,7 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 		free(carbon_address);
 		// put the socket in non-blocking mode
 		uwsgi_socket_nb(fd);
+		struct uwsgi_stats_pusher_batch *batch = uwsgi_stats_pusher_batch_new(fd, NULL, 0, UMAX16, u_carbon.timeout);
 
 		if (u_carbon.use_metrics) goto metrics_loop;
 
@@ -259,7 +267,7 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 
 		int do_avg_push;
 
-		wok = carbon_write(fd, "%s%s.%s.requests %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.workers[0].requests, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.requests %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.workers[0].requests, (unsigned long long) now);
 		if (!wok) goto clear;
 
 		for(i=1;i<=uwsgi.numproc;i++) {
@@ -303,14 +311,14 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 			//skip per worker metrics when disabled
 			if (u_carbon.no_workers) continue;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.requests %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].requests, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.worker%d.requests %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].requests, (unsigned long long) now);
 			if (!wok) goto clear;
 
 			if (uwsgi.logging_options.memory_report || uwsgi.force_get_memusage) {
-				wok = carbon_write(fd, "%s%s.%s.worker%d.rss_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].rss_size, (unsigned long long) now);
+				wok = carbon_write(batch, "%s%s.%s.worker%d.rss_size %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].rss_size, (unsigned long long) now);
 				if (!wok) goto clear;
 
-				wok = carbon_write(fd, "%s%s.%s.worker%d.vsz_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].vsz_size, (unsigned long long) now);
+				wok = carbon_write(batch, "%s%s.%s.worker%d.vsz_size %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].vsz_size, (unsigned long long) now);
 				if (!wok) goto clear;
 			}
 
@@ -324,32 +332,32 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 				}
 			}
 			if (do_avg_push) {
-				wok = carbon_write(fd, "%s%s.%s.worker%d.avg_rt %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) avg_rt, (unsigned long long) now);
+				wok = carbon_write(batch, "%s%s.%s.worker%d.avg_rt %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) avg_rt, (unsigned long long) now);
 				if (!wok) goto clear;
 			}
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.tx %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].tx, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.worker%d.tx %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].tx, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.busyness %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) worker_busyness, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.worker%d.busyness %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) worker_busyness, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.harakiri %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].harakiri_count, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.worker%d.harakiri %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].harakiri_count, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.respawns %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].respawn_count, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.worker%d.respawns %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].respawn_count, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.exceptions %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) worker_exceptions, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.worker%d.exceptions %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) worker_exceptions, (unsigned long long) now);
 			if (!wok) goto clear;
 
 		}
 
 		if (uwsgi.logging_options.memory_report || uwsgi.force_get_memusage) {
-			wok = carbon_write(fd, "%s%s.%s.rss_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_rss, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.rss_size %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_rss, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.vsz_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_vsz, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.vsz_size %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_vsz, (unsigned long long) now);
 			if (!wok) goto clear;
 		}
 
@@ -364,11 +372,11 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 			}
 		}
 		if (do_avg_push) {
-			wok = carbon_write(fd, "%s%s.%s.avg_rt %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) c_total_avg_rt, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.avg_rt %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) c_total_avg_rt, (unsigned long long) now);
 			if (!wok) goto clear;
 		}
 
-		wok = carbon_write(fd, "%s%s.%s.tx %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_tx, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.tx %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_tx, (unsigned long long) now);
 		if (!wok) goto clear;
 
 		if (active_workers > 0) {
@@ -377,69 +385,83 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 		} else {
 			total_avg_busyness = 0;
 		}
-		wok = carbon_write(fd, "%s%s.%s.busyness %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_avg_busyness, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.busyness %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_avg_busyness, (unsigned long long) now);
 		if (!wok) goto clear;
 
-		wok = carbon_write(fd, "%s%s.%s.active_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) active_workers, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.active_workers %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) active_workers, (unsigned long long) now);
 		if (!wok) goto clear;
 
-		wok = carbon_write(fd, "%s%s.%s.busy_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) busy_workers, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.busy_workers %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) busy_workers, (unsigned long long) now);
 		if (!wok) goto clear;
 
-		wok = carbon_write(fd, "%s%s.%s.idle_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) idle_workers, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.idle_workers %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) idle_workers, (unsigned long long) now);
 		if (!wok) goto clear;
 
 		if (uwsgi.cheaper) {
-			wok = carbon_write(fd, "%s%s.%s.cheaped_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.numproc - active_workers, (unsigned long long) now);
+			wok = carbon_write(batch, "%s%s.%s.cheaped_workers %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.numproc - active_workers, (unsigned long long) now);
 			if (!wok) goto clear;
 		}
 
-		wok = carbon_write(fd, "%s%s.%s.harakiri %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_harakiri, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.harakiri %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_harakiri, (unsigned long long) now);
 		if (!wok) goto clear;
 
-		wok = carbon_write(fd, "%s%s.%s.respawns %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_respawns, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.respawns %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_respawns, (unsigned long long) now);
 		if (!wok) goto clear;
 
-		wok = carbon_write(fd, "%s%s.%s.exceptions %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_exceptions, (unsigned long long) now);
+		wok = carbon_write(batch, "%s%s.%s.exceptions %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_exceptions, (unsigned long long) now);
 		if (!wok) goto clear;
 
 metrics_loop:
 		if (u_carbon.use_metrics) {
 			struct uwsgi_metric *um = uwsgi.metrics;
+			int pos = 0;
+			wok = 1;
 			while(um) {
 				uwsgi_rlock(uwsgi.metrics_lock);
-				wok = carbon_write(fd, "%s%s.%s.%.*s %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, um->name_len, um->name, (unsigned long long) *um->value, (unsigned long long) now);
+				int64_t value = *um->value;
 				uwsgi_rwunlock(uwsgi.metrics_lock);
+				// the first server decides which metrics changed since the last push
+				if (skip && usl == u_carbon.servers_data) {
+					skip[pos] = !uwsgi_stats_pusher_changed(uspi, pos, value);
+				}
+				if (!skip || !skip[pos]) {
+					wok = carbon_write(batch, "%s%s.%s.%.*s %llu %llu", u_carbon.root_node, u_carbon.hostname, u_carbon.id, um->name_len, um->name, (unsigned long long) value, (unsigned long long) now);
+				}
 				if (um->reset_after_push){
 					uwsgi_wlock(uwsgi.metrics_lock);
 					*um->value = um->initial_value;
 					uwsgi_rwunlock(uwsgi.metrics_lock);
 				}
 				if (!wok) goto clear;
+				pos++;
 				um = um->next;
 			}
 		}
 
+		if (uwsgi_stats_pusher_batch_flush(batch)) goto clear;
+
 		usl->healthy = 1;
 		usl->errors = 0;
 
 		u_carbon.last_requests = uwsgi.workers[0].requests;
 
 clear:
+		uwsgi_stats_pusher_batch_destroy(batch);
 		close(fd);
 nxt:
 		usl = usl->next;
 	}
 
+	if (skip) free(skip);
 	return needs_retry;
 }
 
 static void carbon_push(struct uwsgi_stats_pusher_instance *uspi, time_t now, char *json, size_t json_len) {
-	uspi->needs_retry = carbon_push_stats(uspi->retries, now);
+	uspi->needs_retry = carbon_push_stats(uspi, uspi->retries, now);
 }
 
 static void carbon_cleanup() {
-	carbon_push_stats(0, uwsgi_now());
+	carbon_push_stats(NULL, 0, uwsgi_now());
 }
 
 static void carbon_register() {
@@ -0,0 +1,193 @@
+#include <uwsgi.h>
+
+/*
+
+	Latency (SLO) cheaper algorithm
+
+	at every cheaper check the p95 response time of the requests completed since the
+	previous check is computed from the per-worker response time histograms, then the
+	time spent in the listen queue (Linux only) is added, estimated with Little's law
+	(backlog / throughput).
+
+	If the resulting latency is over --cheaper-latency-target (msecs) cheaper-step workers are
+	spawned, if it stays under --cheaper-latency-low percent of the target for
+	--cheaper-latency-cooldown checks a worker is cheaped.
+
+*/
+
+extern struct uwsgi_server uwsgi;
+
+static struct uwsgi_cheaper_latency {
+	uint64_t target;
+	uint64_t low;
+	uint64_t cooldown;
+	uint64_t percentile;
+	int verbose;
+
+	uint64_t *last_histogram;
+	uint64_t last_check;
+	uint64_t below;
+} ucl;
+
+static struct uwsgi_option cheaper_latency_options[] = {
+	{"cheaper-latency-target", required_argument, 0, "set the target request latency in msecs (default 500)", uwsgi_opt_set_64bit, &ucl.target, 0},
+	{"cheaper-latency-low", required_argument, 0, "cheap workers when latency stays below the specified percent of the target (default 50)", uwsgi_opt_set_64bit, &ucl.low, 0},
+	{"cheaper-latency-cooldown", required_argument, 0, "cheap a worker only after the specified number of checks with low latency (default 10)", uwsgi_opt_set_64bit, &ucl.cooldown, 0},
+	{"cheaper-latency-percentile", required_argument, 0, "set the latency percentile to track (default 95)", uwsgi_opt_set_64bit, &ucl.percentile, 0},
+	{"cheaper-latency-verbose", no_argument, 0, "enable verbose log messages from the latency algorithm", uwsgi_opt_true, &ucl.verbose, 0},
+	UWSGI_END_OF_OPTIONS
+};
+
+// bounds of a response time bucket (see UWSGI_WORKER_RT_BUCKETS)
+static void cheaper_latency_bucket_bounds(int bucket, uint64_t *lower, uint64_t *upper) {
+	if (bucket < 4) {
+		*lower = bucket;
+		*upper = bucket + 1;
+		return;
+	}
+	int msb = (bucket / 4) + 1;
+	uint64_t sub = bucket % 4;
+	*lower = (4 + sub) << (msb - 2);
+	*upper = (5 + sub) << (msb - 2);
+}
+
+// get the percentile (in usecs) interpolating in the bucket, returns the number of samples
+static uint64_t cheaper_latency_percentile(uint64_t *buckets, uint64_t *value) {
+	int i;
+	uint64_t total = 0;
+	for(i=0;i<UWSGI_WORKER_RT_BUCKETS;i++) total += buckets[i];
+	*value = 0;
+	if (!total) return 0;
+
+	uint64_t rank = (total * ucl.percentile + 99) / 100;
+	uint64_t sum = 0;
+	for(i=0;i<UWSGI_WORKER_RT_BUCKETS;i++) {
+		if (!buckets[i]) continue;
+		if (sum + buckets[i] >= rank) {
+			uint64_t lower, upper;
+			cheaper_latency_bucket_bounds(i, &lower, &upper);
+			*value = lower + (((upper - lower) * (rank - sum)) / buckets[i]);
+			break;
+		}
+		sum += buckets[i];
+	}
+	return total;
+}
+
+static int cheaper_latency_spawn(int n) {
+	int i;
+	int decheaped = 0;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		if (uwsgi.workers[i].cheaped == 1 && uwsgi.workers[i].pid == 0) {
+			decheaped++;
+			if (decheaped >= n)
+				break;
+		}
+	}
+	return decheaped;
+}
+
+static int cheaper_latency_algo(int can_spawn) {
+
+	int i, j;
+	uint64_t buckets[UWSGI_WORKER_RT_BUCKETS];
+	memset(buckets, 0, sizeof(buckets));
+
+	if (!ucl.last_histogram) {
+		ucl.last_histogram = uwsgi_calloc(sizeof(uint64_t) * UWSGI_WORKER_RT_BUCKETS * uwsgi.numproc);
+	}
+
+	// collect the requests completed since the last check
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		uint64_t *last = ucl.last_histogram + ((i-1) * UWSGI_WORKER_RT_BUCKETS);
+		for(j=0;j<UWSGI_WORKER_RT_BUCKETS;j++) {
+			uint64_t current = uwsgi.workers[i].rt_histogram[j];
+			// a respawned worker could start from scratch
+			if (current >= last[j]) buckets[j] += current - last[j];
+			last[j] = current;
+		}
+	}
+
+	uint64_t now = uwsgi_micros();
+	uint64_t elapsed = ucl.last_check ? now - ucl.last_check : 0;
+	ucl.last_check = now;
+	// first run, only take the samples
+	if (!elapsed) return 0;
+
+	uint64_t latency = 0;
+	uint64_t completed = cheaper_latency_percentile(buckets, &latency);
+	uint64_t queue_wait = 0;
+	int backlog = 0;
+
+#ifdef __linux__
+	backlog = uwsgi.shared->backlog;
+	if (backlog > 0) {
+		// nothing completed, the queued requests waited for the whole interval
+		if (!completed) {
+			queue_wait = elapsed;
+		}
+		else {
+			queue_wait = ((uint64_t) backlog * elapsed) / completed;
+		}
+	}
+#endif
+
+	uint64_t total_latency = latency + queue_wait;
+	uint64_t target = ucl.target * 1000;
+
+	int active_workers = 0;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		if (uwsgi.workers[i].cheaped == 0 && uwsgi.workers[i].pid > 0) {
+			active_workers++;
+		}
+	}
+
+	if (ucl.verbose) {
+		uwsgi_log("[latency] p%llu: %llu msecs queue wait: %llu msecs (backlog %d) requests: %llu active workers: %d\n",
+			(unsigned long long) ucl.percentile, (unsigned long long) (latency / 1000), (unsigned long long) (queue_wait / 1000),
+			backlog, (unsigned long long) completed, active_workers);
+	}
+
+	if (total_latency > target) {
+		ucl.below = 0;
+		if (!can_spawn) return 0;
+		int decheaped = cheaper_latency_spawn(uwsgi.cheaper_step);
+		if (decheaped > 0) {
+			uwsgi_log("[latency] p%llu latency is %llu msecs (target %llu), spawning %d new worker(s)\n",
+				(unsigned long long) ucl.percentile, (unsigned long long) (total_latency / 1000), (unsigned long long) ucl.target, decheaped);
+		}
+		return decheaped;
+	}
+
+	// hysteresis, wait for a stable low latency before cheaping
+	if (total_latency < (target * ucl.low) / 100 && active_workers > uwsgi.cheaper_count) {
+		ucl.below++;
+		if (ucl.below >= ucl.cooldown) {
+			ucl.below = 0;
+			return -1;
+		}
+		return 0;
+	}
+
+	ucl.below = 0;
+	return 0;
+}
+
+static void cheaper_latency_register(void) {
+	uwsgi_register_cheaper_algo("latency", cheaper_latency_algo);
+}
+
+static int cheaper_latency_init(void) {
+	if (!ucl.target) ucl.target = 500;
+	if (!ucl.low || ucl.low >= 100) ucl.low = 50;
+	if (!ucl.cooldown) ucl.cooldown = 10;
+	if (!ucl.percentile || ucl.percentile > 100) ucl.percentile = 95;
+	return 0;
+}
+
+struct uwsgi_plugin cheaper_latency_plugin = {
+	.name = "cheaper_latency",
+	.options = cheaper_latency_options,
+	.on_load = cheaper_latency_register,
+	.init = cheaper_latency_init,
+};
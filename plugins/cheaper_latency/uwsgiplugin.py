@@ -0,0 +1,6 @@
+NAME = 'cheaper_latency'
+
+CFLAGS = []
+LDFLAGS = []
+LIBS = []
+GCC_LIST = ['cheaper_latency']
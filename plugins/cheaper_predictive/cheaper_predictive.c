@@ -0,0 +1,182 @@
+#include <uwsgi.h>
+
+/*
+
+	Predictive cheaper algorithm
+
+	the arrival rate (requests per second, sampled at every cheaper check) is forecast with
+	double exponential smoothing (Holt's linear method: level + trend), the forecast
+	--cheaper-predictive-horizon seconds ahead is turned in the number of needed workers
+	via Little's law:
+
+		needed = forecast_rate * avg_response_time / (cores * target_utilization)
+
+	so workers are spawned while the load is still ramping up, instead of waiting
+	for busyness or backlog to cross their thresholds. Workers are cheaped only when the
+	forecast stays below the running workers for cheaper-predictive-cooldown checks.
+
+	As a safety net the listen queue (Linux only) is still checked like the backlog algorithm does.
+
+*/
+
+extern struct uwsgi_server uwsgi;
+
+static struct uwsgi_cheaper_predictive {
+	// smoothing factors (percent)
+	uint64_t alpha;
+	uint64_t beta;
+	// seconds of lookahead
+	uint64_t horizon;
+	// target utilization of the workers (percent)
+	uint64_t utilization;
+	uint64_t cooldown;
+	int verbose;
+
+	uint64_t last_requests;
+	uint64_t last_check;
+	double level;
+	double trend;
+	int initialized;
+	uint64_t below;
+} ucp;
+
+static struct uwsgi_option cheaper_predictive_options[] = {
+	{"cheaper-predictive-alpha", required_argument, 0, "set the smoothing factor (percent) of the arrival rate level (default 50)", uwsgi_opt_set_64bit, &ucp.alpha, 0},
+	{"cheaper-predictive-beta", required_argument, 0, "set the smoothing factor (percent) of the arrival rate trend (default 20)", uwsgi_opt_set_64bit, &ucp.beta, 0},
+	{"cheaper-predictive-horizon", required_argument, 0, "forecast the arrival rate the specified number of seconds ahead (default 10)", uwsgi_opt_set_64bit, &ucp.horizon, 0},
+	{"cheaper-predictive-utilization", required_argument, 0, "set the target workers utilization percent (default 70)", uwsgi_opt_set_64bit, &ucp.utilization, 0},
+	{"cheaper-predictive-cooldown", required_argument, 0, "cheap a worker only after the specified number of checks with a lower forecast (default 10)", uwsgi_opt_set_64bit, &ucp.cooldown, 0},
+	{"cheaper-predictive-verbose", no_argument, 0, "enable verbose log messages from the predictive algorithm", uwsgi_opt_true, &ucp.verbose, 0},
+	UWSGI_END_OF_OPTIONS
+};
+
+static int cheaper_predictive_spawn(int n) {
+	int i;
+	int decheaped = 0;
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		if (uwsgi.workers[i].cheaped == 1 && uwsgi.workers[i].pid == 0) {
+			decheaped++;
+			if (decheaped >= n)
+				break;
+		}
+	}
+	return decheaped;
+}
+
+static int cheaper_predictive_algo(int can_spawn) {
+
+	int i;
+	uint64_t requests = 0;
+	uint64_t rt_sum = 0;
+	int rt_workers = 0;
+	int active_workers = 0;
+
+	for (i = 1; i <= uwsgi.numproc; i++) {
+		int j;
+		for(j=0;j<uwsgi.cores;j++) {
+			requests += uwsgi.workers[i].cores[j].requests;
+		}
+		if (uwsgi.workers[i].cheaped == 0 && uwsgi.workers[i].pid > 0) {
+			active_workers++;
+			if (uwsgi.workers[i].avg_response_time > 0) {
+				rt_sum += uwsgi.workers[i].avg_response_time;
+				rt_workers++;
+			}
+		}
+	}
+
+	uint64_t now = uwsgi_micros();
+	// first run, only take the samples
+	if (!ucp.last_check || requests < ucp.last_requests) {
+		ucp.last_check = now;
+		ucp.last_requests = requests;
+		return 0;
+	}
+
+	double elapsed = (double) (now - ucp.last_check) / 1000000.0;
+	if (elapsed <= 0) return 0;
+	double rate = (double) (requests - ucp.last_requests) / elapsed;
+	ucp.last_check = now;
+	ucp.last_requests = requests;
+
+	double alpha = (double) ucp.alpha / 100.0;
+	double beta = (double) ucp.beta / 100.0;
+	if (!ucp.initialized) {
+		ucp.level = rate;
+		ucp.trend = 0;
+		ucp.initialized = 1;
+	}
+	else {
+		double last_level = ucp.level;
+		ucp.level = (alpha * rate) + ((1.0 - alpha) * (ucp.level + ucp.trend));
+		ucp.trend = (beta * (ucp.level - last_level)) + ((1.0 - beta) * ucp.trend);
+	}
+
+	// the trend is per check, the horizon is in seconds
+	double forecast = ucp.level + (ucp.trend * ((double) ucp.horizon / elapsed));
+	if (forecast < 0) forecast = 0;
+
+	int needed_workers = active_workers;
+	if (rt_workers > 0) {
+		double avg_rt = ((double) rt_sum / (double) rt_workers) / 1000000.0;
+		double concurrency = forecast * avg_rt;
+		needed_workers = (int) ceil(concurrency / ((double) uwsgi.cores * ((double) ucp.utilization / 100.0)));
+	}
+	if (needed_workers < uwsgi.cheaper_count) needed_workers = uwsgi.cheaper_count;
+	if (needed_workers > uwsgi.numproc) needed_workers = uwsgi.numproc;
+
+	if (ucp.verbose) {
+		uwsgi_log("[predictive] rate: %.2f req/s level: %.2f trend: %.2f forecast: %.2f req/s needed workers: %d active: %d\n",
+			rate, ucp.level, ucp.trend, forecast, needed_workers, active_workers);
+	}
+
+#ifdef __linux__
+	// the forecast was too low, the requests are already queued
+	if (can_spawn && (int) uwsgi.shared->backlog > (int) uwsgi.cheaper_overload) {
+		ucp.below = 0;
+		return cheaper_predictive_spawn(uwsgi.cheaper_step);
+	}
+#endif
+
+	if (needed_workers > active_workers) {
+		ucp.below = 0;
+		if (!can_spawn) return 0;
+		int decheaped = cheaper_predictive_spawn(needed_workers - active_workers);
+		if (decheaped > 0) {
+			uwsgi_log("[predictive] forecast is %.2f req/s, spawning %d new worker(s)\n", forecast, decheaped);
+		}
+		return decheaped;
+	}
+
+	if (needed_workers < active_workers) {
+		ucp.below++;
+		if (ucp.below >= ucp.cooldown) {
+			ucp.below = 0;
+			return -1;
+		}
+		return 0;
+	}
+
+	ucp.below = 0;
+	return 0;
+}
+
+static void cheaper_predictive_register(void) {
+	uwsgi_register_cheaper_algo("predictive", cheaper_predictive_algo);
+}
+
+static int cheaper_predictive_init(void) {
+	if (!ucp.alpha || ucp.alpha > 100) ucp.alpha = 50;
+	if (!ucp.beta || ucp.beta > 100) ucp.beta = 20;
+	if (!ucp.horizon) ucp.horizon = 10;
+	if (!ucp.utilization || ucp.utilization > 100) ucp.utilization = 70;
+	if (!ucp.cooldown) ucp.cooldown = 10;
+	return 0;
+}
+
+struct uwsgi_plugin cheaper_predictive_plugin = {
+	.name = "cheaper_predictive",
+	.options = cheaper_predictive_options,
+	.on_load = cheaper_predictive_register,
+	.init = cheaper_predictive_init,
+};
@@ -0,0 +1,6 @@
+NAME = 'cheaper_predictive'
+
+CFLAGS = []
+LDFLAGS = []
+LIBS = []
+GCC_LIST = ['cheaper_predictive']
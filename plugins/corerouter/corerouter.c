@@ -46,7 +46,7 @@ struct corerouter_peer *uwsgi_cr_peer_add(struct corerouter_session *cs) {
 	peers->in = uwsgi_buffer_new(bufsize);
 	// add timeout
 	peers->current_timeout = cs->corerouter->socket_timeout;
-        peers->timeout = cr_add_timeout(cs->corerouter, peers);
+        cr_add_timeout(cs->corerouter, peers);
 	peers->prev = old_peers;
 
 	if (old_peers) {
@@ -67,6 +67,8 @@ void uwsgi_cr_peer_reset(struct corerouter_peer *peer) {
 	}
 
 	cr_del_timeout(peer->session->corerouter, peer);
+
+	corerouter_hedge_cancel(peer->session->corerouter, peer);
 	
 	if (peer->fd != -1) {
 		close(peer->fd);
@@ -85,6 +87,9 @@ void uwsgi_cr_peer_reset(struct corerouter_peer *peer) {
 	peer->failed = 0;
 	peer->soopt = 0;
 	peer->timed_out = 0;
+	peer->bad_response = 0;
+	peer->response_checked = 0;
+	peer->breaker_open = 0;
 
 	peer->un = NULL;
 	peer->static_node = NULL;
@@ -128,6 +133,81 @@ int uwsgi_cr_peer_del(struct corerouter_peer *peer) {
 	return 0;
 }
 
+/*
+	backend connections pool
+
+	when a router knows a response has been fully received on a persistent connection,
+	the socket is parked here (instead of being closed) and reused by the next
+	session connecting to the same address.
+
+	Connections idle for more than pool_idle seconds (or closed by the backend) are discarded.
+*/
+int uwsgi_cr_pool_get(struct corerouter_peer *peer) {
+	struct uwsgi_corerouter *ucr = peer->session->corerouter;
+	if (!peer->can_pool || !ucr->pool) return -1;
+
+	time_t now = uwsgi_now();
+	struct uwsgi_cr_pool_conn *pc = ucr->pool, *prev = NULL;
+	while (pc) {
+		struct uwsgi_cr_pool_conn *next = pc->next;
+		int expired = (now - pc->last_used) >= ucr->pool_idle;
+		if (expired || (pc->address_len == peer->instance_address_len && !memcmp(pc->address, peer->instance_address, pc->address_len))) {
+			if (prev) {
+				prev->next = next;
+			}
+			else {
+				ucr->pool = next;
+			}
+			ucr->pool_count--;
+			int fd = pc->fd;
+			free(pc->address);
+			free(pc);
+			if (!expired) {
+				// an alive idle connection has nothing to read
+				char byte;
+				ssize_t rlen = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+				if (rlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					return fd;
+				}
+			}
+			close(fd);
+			pc = next;
+			continue;
+		}
+		prev = pc;
+		pc = next;
+	}
+	return -1;
+}
+
+// detach the backend connection from the peer (closing it if the pool is full)
+void uwsgi_cr_pool_put(struct corerouter_peer *peer) {
+	struct uwsgi_corerouter *ucr = peer->session->corerouter;
+	if (peer->fd < 0) return;
+
+	uwsgi_cr_set_hooks(peer, NULL, NULL);
+	peer->last_hook_read = NULL;
+	peer->last_hook_write = NULL;
+	ucr->cr_table[peer->fd] = NULL;
+
+	if (ucr->pool_count >= ucr->pool_size || peer->instance_address_len == 0) {
+		close(peer->fd);
+	}
+	else {
+		struct uwsgi_cr_pool_conn *pc = uwsgi_malloc(sizeof(struct uwsgi_cr_pool_conn));
+		pc->fd = peer->fd;
+		pc->address = uwsgi_concat2n(peer->instance_address, peer->instance_address_len, "", 0);
+		pc->address_len = peer->instance_address_len;
+		pc->last_used = uwsgi_now();
+		pc->next = ucr->pool;
+		ucr->pool = pc;
+		ucr->pool_count++;
+	}
+
+	peer->fd = -1;
+	peer->can_pool = 0;
+}
+
 void uwsgi_opt_corerouter(char *opt, char *value, void *cr) {
 	struct uwsgi_corerouter *ucr = (struct uwsgi_corerouter *) cr;
         uwsgi_new_gateway_socket(value, ucr->name);
@@ -340,9 +420,12 @@ void corerouter_manage_subscription(char *key, uint16_t keylen, char *val, uint1
 void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
 	struct corerouter_session *cs = peer->session;
 
+	cr_lock_subscriptions(ucr);
 	// manage subscription reference count
 	if (ucr->subscriptions && peer->un && peer->un->len > 0) {
 
+		uwsgi_cr_breaker_release(ucr, peer, peer->failed || peer->timed_out || peer->bad_response);
+
                 // decrease reference count
 #ifdef UWSGI_DEBUG
 		uwsgi_log("[1] node %.*s refcnt: %llu\n", peer->un->len, peer->un->name, peer->un->reference);
@@ -351,8 +434,21 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
 #ifdef UWSGI_DEBUG
 		uwsgi_log("[2] node %.*s refcnt: %llu\n", peer->un->len, peer->un->name, peer->un->reference);
 #endif
-		
+		// update the moving average (alpha = 1/8) of the node response time
+		if (!peer->failed && peer->connect_time) {
+			uint64_t latency = uwsgi_micros() - peer->connect_time;
+			if (peer->un->latency) {
+				peer->un->latency = ((peer->un->latency * 7) + latency) / 8;
+			}
+			else {
+				peer->un->latency = latency;
+			}
+		}
+		if (!peer->failed) {
+			uwsgi_subscribe_node_report(peer->un, peer->bad_response);
+		}
         }
+	cr_unlock_subscriptions(ucr);
 
 	if (peer->failed) {
 		if (peer->soopt) {
@@ -369,11 +465,13 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
                 }
 
                 // now check for dead nodes
+		cr_lock_subscriptions(ucr);
                 if (ucr->subscriptions && peer->un && peer->un->len > 0) {
 
                         if (peer->un->death_mark == 0)
                                 uwsgi_log("[uwsgi-%s] %.*s => marking %.*s as failed\n", ucr->short_name, (int) peer->key_len, peer->key, (int) peer->instance_address_len, peer->instance_address);
 
+                        uwsgi_subscribe_node_report(peer->un, 1);
                         peer->un->failcnt++;
                         peer->un->death_mark = 1;
                         // check if i can remove the node
@@ -389,6 +487,7 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
 			peer->static_node->custom = uwsgi_now();
 			uwsgi_log("[uwsgi-%s] %.*s => marking %.*s as failed\n", ucr->short_name, (int) peer->key_len, peer->key, (int) peer->instance_address_len, peer->instance_address);
 		}
+		cr_unlock_subscriptions(ucr);
 
 		// check if the router supports the retry hook
 		if (!peer->can_retry) goto end;
@@ -398,7 +497,7 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
 		// reset the peer
 		uwsgi_cr_peer_reset(peer);
 		// set new timeout
-		peer->timeout = cr_add_timeout(ucr, peer);
+		cr_add_timeout(ucr, peer);
 
 		if (ucr->fallback) {
 			// ok let's try with the fallback nodes
@@ -435,12 +534,70 @@ end:
 		corerouter_close_session(ucr, cs);
 	}
 	else {
+		// another backend is still working on the hedged request
+		if (cs->hedging && cs->peers) {
+			return;
+		}
 		if (cs->can_keepalive == 0 && cs->wait_full_write == 0) {
 			corerouter_close_session(ucr, cs);
 		}
 	}
 }
 
+// destroy a backend peer without touching the session (used for the losers of hedged requests)
+void corerouter_drop_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
+	if (ucr->subscriptions && peer->un && peer->un->len > 0) {
+		cr_lock_subscriptions(ucr);
+		uwsgi_cr_breaker_release(ucr, peer, -1);
+		peer->un->reference--;
+		cr_unlock_subscriptions(ucr);
+	}
+	uwsgi_cr_peer_del(peer);
+}
+
+// arm the hedge timer of a backend peer
+void corerouter_hedge_timer(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
+	if (!ucr->hedge_timeouts)
+		return;
+	peer->hedge_timer = uwsgi_add_rb_timer(ucr->hedge_timeouts, (uwsgi_micros() / 1000) + ucr->hedge_delay, peer);
+}
+
+void corerouter_hedge_cancel(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
+	if (!peer->hedge_timer)
+		return;
+	uwsgi_del_rb_timer(ucr->hedge_timeouts, peer->hedge_timer);
+	free(peer->hedge_timer);
+	peer->hedge_timer = NULL;
+}
+
+static void corerouter_expire_hedges(struct uwsgi_corerouter *ucr) {
+	uint64_t now = uwsgi_micros() / 1000;
+	for (;;) {
+		struct uwsgi_rb_timer *urbt = uwsgi_min_rb_timer(ucr->hedge_timeouts, NULL);
+		if (urbt == NULL || urbt->value > now)
+			return;
+		struct corerouter_peer *peer = (struct corerouter_peer *) urbt->data;
+		uwsgi_del_rb_timer(ucr->hedge_timeouts, urbt);
+		free(urbt);
+		peer->hedge_timer = NULL;
+		if (peer->session->hedge && peer->session->hedge(peer) > 0) {
+			ucr->hedged++;
+		}
+	}
+}
+
+// msecs to wait for the next hedge timer (or the specified msecs delta)
+static int corerouter_hedge_wait(struct uwsgi_corerouter *ucr, int wait_ms) {
+	struct uwsgi_rb_timer *urbt = uwsgi_min_rb_timer(ucr->hedge_timeouts, NULL);
+	if (urbt) {
+		uint64_t now = uwsgi_micros() / 1000;
+		int hedge_ms = urbt->value > now ? (int) (urbt->value - now) : 0;
+		if (wait_ms < 0 || hedge_ms < wait_ms)
+			wait_ms = hedge_ms;
+	}
+	return wait_ms;
+}
+
 // destroy a session
 void corerouter_close_session(struct uwsgi_corerouter *ucr, struct corerouter_session *cr_session) {
 
@@ -456,7 +613,10 @@ void corerouter_close_session(struct uwsgi_corerouter *ucr, struct corerouter_se
 		peers = peers->next;
 		// special case here for subscription system
 		if (ucr->subscriptions && tmp_peer->un && tmp_peer->un->len) {
+			cr_lock_subscriptions(ucr);
+			uwsgi_cr_breaker_release(ucr, tmp_peer, -1);
 			tmp_peer->un->reference--;
+			cr_unlock_subscriptions(ucr);
 		}
 		if (uwsgi_cr_peer_del(tmp_peer) < 0) return; 
 	}
@@ -474,57 +634,57 @@ void corerouter_close_session(struct uwsgi_corerouter *ucr, struct corerouter_se
 	ucr->active_sessions--;
 }
 
-struct uwsgi_rb_timer *corerouter_reset_timeout(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
-	cr_del_timeout(ucr, peer);
-	return cr_add_timeout(ucr, peer);
+// re-arming a timer of the wheel just moves it to another slot
+void corerouter_reset_timeout(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
+	cr_add_timeout(ucr, peer);
 }
 
-struct uwsgi_rb_timer *corerouter_reset_timeout_fast(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer, time_t now) {
-        cr_del_timeout(ucr, peer);
-        return cr_add_timeout_fast(ucr, peer, now);
+static void corerouter_reset_timeout_fast(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer, uint64_t now_ms) {
+        cr_add_timeout_fast(ucr, peer, now_ms);
 }
 
 
-static void corerouter_expire_timeouts(struct uwsgi_corerouter *ucr, time_t now) {
+static void corerouter_expire_timeouts(struct uwsgi_corerouter *ucr, uint64_t now_ms) {
 
-	uint64_t current = (uint64_t) now;
-	struct uwsgi_rb_timer *urbt;
+	struct uwsgi_wheel_timer *uwt;
 	struct corerouter_peer *peer;
 
 	for (;;) {
-		urbt = uwsgi_min_rb_timer(ucr->timeouts, NULL);
-		if (urbt == NULL)
+		uwt = uwsgi_timer_wheel_pop(ucr->timeouts, now_ms);
+		if (uwt == NULL)
 			return;
 
-		if (urbt->value <= current) {
-			peer = (struct corerouter_peer *) urbt->data;
-			// you can manage deferred connections upto X retry times
-			if (peer->defer_connect) {
-				peer->defer_connect = 0;
-				peer->retries++;
-				// ignore return value
-				if (peer->un) {
-					if (peer->un->reference == 0) {
-						uwsgi_log("[BUG] subscription reference counting is 0 !!!\n");
-						corerouter_close_peer(ucr, peer);
-						continue;
-					}
-					peer->un->reference--;
+		peer = (struct corerouter_peer *) uwt->data;
+		// you can manage deferred connections upto X retry times
+		if (peer->defer_connect) {
+			peer->defer_connect = 0;
+			peer->retries++;
+			// ignore return value
+			if (peer->un) {
+				cr_lock_subscriptions(ucr);
+				if (peer->un->reference == 0) {
+					cr_unlock_subscriptions(ucr);
+					uwsgi_log("[BUG] subscription reference counting is 0 !!!\n");
+					corerouter_close_peer(ucr, peer);
+					continue;
 				}
-				peer->session->retry(peer);
-				// increase timeout;
-				urbt->value += peer->current_timeout;
-				continue;
+				peer->un->reference--;
+				cr_unlock_subscriptions(ucr);
 			}
-			peer->timed_out = 1;
-			if (peer->connecting) {
-				peer->failed = 1;
-			}
-			corerouter_close_peer(ucr, peer);
+			peer->session->retry(peer);
+			// increase timeout;
+			cr_add_timeout_fast(ucr, peer, now_ms);
 			continue;
 		}
-
-		break;
+		if (peer->session->timeout && !peer->session->timeout(peer)) {
+			cr_add_timeout_fast(ucr, peer, now_ms);
+			continue;
+		}
+		peer->timed_out = 1;
+		if (peer->connecting) {
+			peer->failed = 1;
+		}
+		corerouter_close_peer(ucr, peer);
 	}
 
 }
@@ -688,184 +848,57 @@ struct corerouter_session *corerouter_alloc_session(struct uwsgi_corerouter *ucr
 	}
 	else {
 		// truly set the timeout
-        	peer->timeout = cr_add_timeout(ucr, ucr->cr_table[new_connection]);
+        	cr_add_timeout(ucr, ucr->cr_table[new_connection]);
 	}
 
 	return cs;
 }
 
-void uwsgi_corerouter_loop(int id, void *data) {
+// the event loop of a corerouter (one for each thread)
+static void corerouter_run(struct uwsgi_corerouter *ucr, int id, void *events) {
 
 	int i;
-
-	struct uwsgi_corerouter *ucr = (struct uwsgi_corerouter *) data;
-
-	ucr->cr_stats_server = -1;
-
-	ucr->cr_table = uwsgi_malloc(sizeof(struct corerouter_session *) * uwsgi.max_fd);
-
-	for (i = 0; i < (int) uwsgi.max_fd; i++) {
-		ucr->cr_table[i] = NULL;
-	}
-
-	ucr->i_am_cheap = ucr->cheap;
-
-	void *events = uwsgi_corerouter_setup_event_queue(ucr, id);
-
-	if (ucr->has_subscription_sockets)
-		event_queue_add_fd_read(ucr->queue, ushared->gateways[id].internal_subscription_pipe[1]);
-
-
-	if (!ucr->socket_timeout)
-		ucr->socket_timeout = 60;
-
-	if (!ucr->defer_connect_timeout)
-		ucr->defer_connect_timeout = 5;
-
-	if (!ucr->static_node_gracetime)
-		ucr->static_node_gracetime = 30;
-
-	int i_am_the_first = 1;
-	for(i=0;i<id;i++) {
-		if (!strcmp(ushared->gateways[i].name, ucr->name)) {
-			i_am_the_first = 0;
-			break;
-		}
-	}
-
-	if (ucr->stats_server && i_am_the_first) {
-		char *tcp_port = strchr(ucr->stats_server, ':');
-		if (tcp_port) {
-			// disable deferred accept for this socket
-			int current_defer_accept = uwsgi.no_defer_accept;
-			uwsgi.no_defer_accept = 1;
-			ucr->cr_stats_server = bind_to_tcp(ucr->stats_server, uwsgi.listen_queue, tcp_port);
-			uwsgi.no_defer_accept = current_defer_accept;
-		}
-		else {
-			ucr->cr_stats_server = bind_to_unix(ucr->stats_server, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
-		}
-
-		event_queue_add_fd_read(ucr->queue, ucr->cr_stats_server);
-		uwsgi_log("*** %s stats server enabled on %s fd: %d ***\n", ucr->short_name, ucr->stats_server, ucr->cr_stats_server);
-	}
-
-	if (ucr->emperor_socket) {
-		char *colon = strchr(ucr->emperor_socket, ':');
-		if (colon) {
-			ucr->emperor_socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
-                        ucr->emperor_socket_addr_len = socket_to_in_addr(ucr->emperor_socket, colon, 0, &ucr->emperor_socket_addr.sa_in);
-		}
-		else {
-			ucr->emperor_socket_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
-	  		ucr->emperor_socket_addr_len = socket_to_un_addr(ucr->emperor_socket, &ucr->emperor_socket_addr.sa_un);
-		}
-		if (ucr->emperor_socket_fd < 0) {
-			uwsgi_error("error creating emperor socket client: socket()");
-			exit(1);
-		}
-		uwsgi_log("emperor socket mapped to: %s\n", ucr->emperor_socket);	
-	}
-
-
-	if (ucr->use_socket) {
-		ucr->to_socket = uwsgi_get_socket_by_num(ucr->socket_num);
-		if (ucr->to_socket) {
-			// fix socket name_len
-			if (ucr->to_socket->name_len == 0 && ucr->to_socket->name) {
-				ucr->to_socket->name_len = strlen(ucr->to_socket->name);
-			}
-		}
-	}
-
-	if (!ucr->pb_base_dir) {
-		ucr->pb_base_dir = getenv("TMPDIR");
-		if (!ucr->pb_base_dir)
-			ucr->pb_base_dir = "/tmp";
-	}
-
 	int nevents;
-
-	time_t delta;
-
-	struct uwsgi_rb_timer *min_timeout;
-
+	int delta;
 	int new_connection;
 
-
-	if (ucr->pattern) {
-		init_magic_table(ucr->magic_table);
-	}
-
 	union uwsgi_sockaddr cr_addr;
 	socklen_t cr_addr_len = sizeof(struct sockaddr_un);
 
-	ucr->mapper = uwsgi_cr_map_use_void;
-
-			if (ucr->use_cache) {
-				ucr->cache = uwsgi_cache_by_name(ucr->use_cache);
-				if (!ucr->cache) {
-					uwsgi_log("!!! unable to find cache \"%s\" !!!\n", ucr->use_cache);
-					exit(1);
-				}
-                        	ucr->mapper = uwsgi_cr_map_use_cache;
-                        }
-                        else if (ucr->pattern) {
-                                ucr->mapper = uwsgi_cr_map_use_pattern;
-                        }
-                        else if (ucr->has_subscription_sockets) {
-                                ucr->mapper = uwsgi_cr_map_use_subscription;
-				if (uwsgi.subscription_dotsplit) {
-                                	ucr->mapper = uwsgi_cr_map_use_subscription_dotsplit;
-				}
-                        }
-                        else if (ucr->base) {
-                                ucr->mapper = uwsgi_cr_map_use_base;
-                        }
-                        else if (ucr->code_string_code && ucr->code_string_function) {
-                                ucr->mapper = uwsgi_cr_map_use_cs;
-			}
-                        else if (ucr->to_socket) {
-                                ucr->mapper = uwsgi_cr_map_use_to;
-                        }
-                        else if (ucr->static_nodes) {
-                                ucr->mapper = uwsgi_cr_map_use_static_nodes;
-                        }
-
-	ucr->timeouts = uwsgi_init_rb_timer();
-
 	for (;;) {
 
 		time_t now = uwsgi_now();
+		uint64_t now_ms = uwsgi_millis();
 
 		// set timeouts and harakiri
-		min_timeout = uwsgi_min_rb_timer(ucr->timeouts, NULL);
-		if (min_timeout == NULL) {
-			delta = -1;
-		}
-		else {
-			delta = min_timeout->value - now;
-			if (delta <= 0) {
-				corerouter_expire_timeouts(ucr, now);
-				delta = 0;
-			}
+		int64_t next_timeout = uwsgi_timer_wheel_next(ucr->timeouts, now_ms);
+		if (next_timeout == 0) {
+			corerouter_expire_timeouts(ucr, now_ms);
+			next_timeout = uwsgi_timer_wheel_next(ucr->timeouts, now_ms);
 		}
+		delta = next_timeout > INT_MAX ? INT_MAX : (int) next_timeout;
 
-		if (uwsgi.master_process && ucr->harakiri > 0) {
+		if (uwsgi.master_process && ucr->harakiri > 0 && !ucr->thread_id) {
 			ushared->gateways_harakiri[id] = 0;
 		}
 
 		// wait for events
-		nevents = event_queue_wait_multi(ucr->queue, delta, events, ucr->nevents);
+		if (ucr->hedge_timeouts) {
+			nevents = event_queue_wait_multi_ms(ucr->queue, corerouter_hedge_wait(ucr, delta), events, ucr->nevents);
+		}
+		else {
+			nevents = event_queue_wait_multi_ms(ucr->queue, delta, events, ucr->nevents);
+		}
 
 		now = uwsgi_now();
+		now_ms = uwsgi_millis();
 
-		if (uwsgi.master_process && ucr->harakiri > 0) {
+		if (uwsgi.master_process && ucr->harakiri > 0 && !ucr->thread_id) {
 			ushared->gateways_harakiri[id] = now + ucr->harakiri;
 		}
 
 		if (nevents == 0) {
-			corerouter_expire_timeouts(ucr, now);
+			corerouter_expire_timeouts(ucr, now_ms);
 		}
 
 		for (i = 0; i < nevents; i++) {
@@ -926,6 +959,12 @@ void uwsgi_corerouter_loop(int id, void *data) {
 			else if (ucr->interesting_fd == ucr->cr_stats_server) {
 				corerouter_send_stats(ucr);
 			}
+			else if (ucr->plugin_fd_hook && ucr->interesting_fd == ucr->plugin_fd) {
+				ucr->plugin_fd_hook(ucr, ucr->interesting_fd);
+			}
+			else if (ucr->offload_ready && ucr->interesting_fd == ucr->offload_pipe[0]) {
+				ucr->offload_hook(ucr, ucr->interesting_fd);
+			}
 			else {
 				struct corerouter_peer *peer = ucr->cr_table[ucr->interesting_fd];
 
@@ -941,8 +980,8 @@ void uwsgi_corerouter_loop(int id, void *data) {
 				}
 
 				// set timeout (in main_peer too)
-				peer->timeout = corerouter_reset_timeout_fast(ucr, peer, now);
-				peer->session->main_peer->timeout = corerouter_reset_timeout_fast(ucr, peer->session->main_peer, now);
+				corerouter_reset_timeout_fast(ucr, peer, now_ms);
+				corerouter_reset_timeout_fast(ucr, peer->session->main_peer, now_ms);
 
 				ssize_t (*hook)(struct corerouter_peer *) = NULL;
 
@@ -973,8 +1012,259 @@ void uwsgi_corerouter_loop(int id, void *data) {
 				
 			}
 		}
+
+		if (ucr->hedge_timeouts) {
+			corerouter_expire_hedges(ucr);
+		}
+	}
+
+}
+
+struct corerouter_thread {
+	struct uwsgi_corerouter *ucr;
+	int id;
+	void *events;
+};
+
+static void *corerouter_thread_loop(void *arg) {
+	struct corerouter_thread *crt = (struct corerouter_thread *) arg;
+	// block all signals (they are managed by the main thread)
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	corerouter_run(crt->ucr, crt->id, crt->events);
+	return NULL;
+}
+
+/*
+	threaded mode
+
+	each additional thread gets a copy of the corerouter with its own event queue, timeouts,
+	fd table and backend pool, and accepts connections from the same gateway sockets.
+	Subscriptions (and the stats server) are managed by the main thread, the subscription table
+	is shared and protected by a mutex.
+*/
+static void corerouter_spawn_threads(struct uwsgi_corerouter *ucr, int id) {
+	int i;
+
+	if (ucr->cheap) {
+		uwsgi_log("[uwsgi-%s] cheap mode is not supported with threads\n", ucr->short_name);
+		exit(1);
+	}
+
+	if (ucr->mapper == uwsgi_cr_map_use_cs) {
+		uwsgi_log("[uwsgi-%s] code string mapping is not supported with threads\n", ucr->short_name);
+		exit(1);
+	}
+
+	ucr->subscriptions_lock = uwsgi_malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(ucr->subscriptions_lock, NULL);
+
+	ucr->thread_routers = uwsgi_calloc(sizeof(struct uwsgi_corerouter *) * ucr->threads);
+	ucr->thread_routers[0] = ucr;
+
+	for(i=1;i<ucr->threads;i++) {
+		struct uwsgi_corerouter *tucr = uwsgi_malloc(sizeof(struct uwsgi_corerouter));
+		memcpy(tucr, ucr, sizeof(struct uwsgi_corerouter));
+		tucr->thread_id = i;
+		tucr->cr_stats_server = -1;
+		tucr->active_sessions = 0;
+		tucr->pool = NULL;
+		tucr->pool_count = 0;
+		tucr->cr_table = uwsgi_calloc(sizeof(struct corerouter_peer *) * uwsgi.max_fd);
+		tucr->timeouts = uwsgi_timer_wheel_new(uwsgi_millis());
+		if (ucr->hedge_timeouts) {
+			tucr->hedge_timeouts = uwsgi_init_rb_timer();
+			tucr->hedged = 0;
+		}
+		tucr->coalesced = 0;
+		// every thread memoizes its own results
+		if (ucr->cache_memo_table) {
+			uwsgi_cr_cache_memo_init(tucr);
+			tucr->cache_memo_hits = 0;
+		}
+		tucr->queue = event_queue_init();
+
+		struct uwsgi_gateway_socket *ugs = uwsgi.gateway_sockets;
+		while (ugs) {
+			if (ugs->gateway == &ushared->gateways[id] && !ugs->subscription) {
+				event_queue_add_fd_read(tucr->queue, ugs->fd);
+			}
+			ugs = ugs->next;
+		}
+
+		ucr->thread_routers[i] = tucr;
+
+		struct corerouter_thread *crt = uwsgi_malloc(sizeof(struct corerouter_thread));
+		crt->ucr = tucr;
+		crt->id = id;
+		crt->events = event_queue_alloc(ucr->nevents);
+
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, corerouter_thread_loop, crt)) {
+			uwsgi_error("corerouter_spawn_threads()/pthread_create()");
+			exit(1);
+		}
+	}
+
+	uwsgi_log("[uwsgi-%s pid %d] running %d threads\n", ucr->short_name, (int) uwsgi.mypid, ucr->threads);
+}
+
+void uwsgi_corerouter_loop(int id, void *data) {
+
+	int i;
+
+	struct uwsgi_corerouter *ucr = (struct uwsgi_corerouter *) data;
+
+	ucr->cr_stats_server = -1;
+
+	ucr->cr_table = uwsgi_malloc(sizeof(struct corerouter_session *) * uwsgi.max_fd);
+
+	for (i = 0; i < (int) uwsgi.max_fd; i++) {
+		ucr->cr_table[i] = NULL;
+	}
+
+	ucr->i_am_cheap = ucr->cheap;
+
+	void *events = uwsgi_corerouter_setup_event_queue(ucr, id);
+
+	if (ucr->has_subscription_sockets)
+		event_queue_add_fd_read(ucr->queue, ushared->gateways[id].internal_subscription_pipe[1]);
+
+	if (ucr->plugin_fd_hook)
+		event_queue_add_fd_read(ucr->queue, ucr->plugin_fd);
+
+
+	if (!ucr->socket_timeout)
+		ucr->socket_timeout = 60;
+
+	if (!ucr->defer_connect_timeout)
+		ucr->defer_connect_timeout = 5;
+
+	if (!ucr->breaker_window)
+		ucr->breaker_window = 10;
+
+	if (!ucr->breaker_min_requests)
+		ucr->breaker_min_requests = 20;
+
+	if (!ucr->breaker_open_time)
+		ucr->breaker_open_time = 5000;
+
+	if (!ucr->pool_idle)
+		ucr->pool_idle = 3;
+
+	if (!ucr->static_node_gracetime)
+		ucr->static_node_gracetime = 30;
+
+	int i_am_the_first = 1;
+	for(i=0;i<id;i++) {
+		if (!strcmp(ushared->gateways[i].name, ucr->name)) {
+			i_am_the_first = 0;
+			break;
+		}
+	}
+
+	if (ucr->stats_server && i_am_the_first) {
+		char *tcp_port = strchr(ucr->stats_server, ':');
+		if (tcp_port) {
+			// disable deferred accept for this socket
+			int current_defer_accept = uwsgi.no_defer_accept;
+			uwsgi.no_defer_accept = 1;
+			ucr->cr_stats_server = bind_to_tcp(ucr->stats_server, uwsgi.listen_queue, tcp_port);
+			uwsgi.no_defer_accept = current_defer_accept;
+		}
+		else {
+			ucr->cr_stats_server = bind_to_unix(ucr->stats_server, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
+		}
+
+		event_queue_add_fd_read(ucr->queue, ucr->cr_stats_server);
+		uwsgi_log("*** %s stats server enabled on %s fd: %d ***\n", ucr->short_name, ucr->stats_server, ucr->cr_stats_server);
+	}
+
+	if (ucr->emperor_socket) {
+		char *colon = strchr(ucr->emperor_socket, ':');
+		if (colon) {
+			ucr->emperor_socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+                        ucr->emperor_socket_addr_len = socket_to_in_addr(ucr->emperor_socket, colon, 0, &ucr->emperor_socket_addr.sa_in);
+		}
+		else {
+			ucr->emperor_socket_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	  		ucr->emperor_socket_addr_len = socket_to_un_addr(ucr->emperor_socket, &ucr->emperor_socket_addr.sa_un);
+		}
+		if (ucr->emperor_socket_fd < 0) {
+			uwsgi_error("error creating emperor socket client: socket()");
+			exit(1);
+		}
+		uwsgi_log("emperor socket mapped to: %s\n", ucr->emperor_socket);	
+	}
+
+
+	if (ucr->use_socket) {
+		ucr->to_socket = uwsgi_get_socket_by_num(ucr->socket_num);
+		if (ucr->to_socket) {
+			// fix socket name_len
+			if (ucr->to_socket->name_len == 0 && ucr->to_socket->name) {
+				ucr->to_socket->name_len = strlen(ucr->to_socket->name);
+			}
+		}
+	}
+
+	if (!ucr->pb_base_dir) {
+		ucr->pb_base_dir = getenv("TMPDIR");
+		if (!ucr->pb_base_dir)
+			ucr->pb_base_dir = "/tmp";
+	}
+
+
+	if (ucr->pattern) {
+		init_magic_table(ucr->magic_table);
+	}
+
+	ucr->mapper = uwsgi_cr_map_use_void;
+
+			if (ucr->use_cache) {
+				ucr->cache = uwsgi_cache_by_name(ucr->use_cache);
+				if (!ucr->cache) {
+					uwsgi_log("!!! unable to find cache \"%s\" !!!\n", ucr->use_cache);
+					exit(1);
+				}
+                        	ucr->mapper = uwsgi_cr_map_use_cache;
+				if (ucr->cache_memo) uwsgi_cr_cache_memo_init(ucr);
+                        }
+                        else if (ucr->pattern) {
+                                ucr->mapper = uwsgi_cr_map_use_pattern;
+                        }
+                        else if (ucr->has_subscription_sockets) {
+                                ucr->mapper = uwsgi_cr_map_use_subscription;
+				if (uwsgi.subscription_dotsplit) {
+                                	ucr->mapper = uwsgi_cr_map_use_subscription_dotsplit;
+				}
+                        }
+                        else if (ucr->base) {
+                                ucr->mapper = uwsgi_cr_map_use_base;
+                        }
+                        else if (ucr->code_string_code && ucr->code_string_function) {
+                                ucr->mapper = uwsgi_cr_map_use_cs;
+			}
+                        else if (ucr->to_socket) {
+                                ucr->mapper = uwsgi_cr_map_use_to;
+                        }
+                        else if (ucr->static_nodes) {
+                                ucr->mapper = uwsgi_cr_map_use_static_nodes;
+                        }
+
+	ucr->timeouts = uwsgi_timer_wheel_new(uwsgi_millis());
+	if (ucr->hedge_delay > 0) {
+		ucr->hedge_timeouts = uwsgi_init_rb_timer();
 	}
 
+	if (ucr->threads > 1) {
+		corerouter_spawn_threads(ucr, id);
+	}
+
+	corerouter_run(ucr, id, events);
+
 }
 
 int uwsgi_corerouter_has_backends(struct uwsgi_corerouter *ucr) {
@@ -1050,6 +1340,7 @@ void corerouter_send_stats(struct uwsgi_corerouter *ucr) {
 
 	struct sockaddr_un client_src;
 	socklen_t client_src_len = 0;
+	int subscriptions_locked = 0;
 
 	int client_fd = accept(ucr->cr_stats_server, (struct sockaddr *) &client_src, &client_src_len);
 	if (client_fd < 0) {
@@ -1074,7 +1365,32 @@ void corerouter_send_stats(struct uwsgi_corerouter *ucr) {
         char *cwd = uwsgi_get_cwd();
         if (uwsgi_stats_keyval_comma(us, "cwd", cwd)) goto end0;
 
-        if (uwsgi_stats_keylong_comma(us, "active_sessions", (unsigned long long) ucr->active_sessions)) goto end0;
+	// in threaded mode report the whole router
+	uint64_t active_sessions = ucr->active_sessions;
+	uint64_t hedged = ucr->hedged;
+	uint64_t coalesced = ucr->coalesced;
+	uint64_t cache_memo_hits = ucr->cache_memo_hits;
+	int t;
+	for(t=1;t<ucr->threads;t++) {
+		active_sessions += ucr->thread_routers[t]->active_sessions;
+		hedged += ucr->thread_routers[t]->hedged;
+		coalesced += ucr->thread_routers[t]->coalesced;
+		cache_memo_hits += ucr->thread_routers[t]->cache_memo_hits;
+	}
+
+        if (uwsgi_stats_keylong_comma(us, "active_sessions", (unsigned long long) active_sessions)) goto end0;
+	if (ucr->threads > 1) {
+		if (uwsgi_stats_keylong_comma(us, "threads", (unsigned long long) ucr->threads)) goto end0;
+	}
+	if (ucr->hedge_delay > 0) {
+		if (uwsgi_stats_keylong_comma(us, "hedged", (unsigned long long) hedged)) goto end0;
+	}
+	if (ucr->coalesce) {
+		if (uwsgi_stats_keylong_comma(us, "coalesced", (unsigned long long) coalesced)) goto end0;
+	}
+	if (ucr->cache_memo_table) {
+		if (uwsgi_stats_keylong_comma(us, "cache_memo_hits", (unsigned long long) cache_memo_hits)) goto end0;
+	}
 
 	if (uwsgi_stats_key(us , ucr->short_name)) goto end0;
         if (uwsgi_stats_list_open(us)) goto end0;
@@ -1116,79 +1432,82 @@ void corerouter_send_stats(struct uwsgi_corerouter *ucr) {
         }
 
 	if (ucr->has_subscription_sockets) {
+		cr_lock_subscriptions(ucr);
+		subscriptions_locked = 1;
 		if (uwsgi_stats_key(us , "subscriptions")) goto end0;
 		if (uwsgi_stats_list_open(us)) goto end0;
 
-		int i;
-		int first_processed = 0;
-		for(i=0;i<UMAX16;i++) {
-			struct uwsgi_subscribe_slot *s_slot = ucr->subscriptions[i];
-			if (s_slot && first_processed) {
-				if (uwsgi_stats_comma(us)) goto end0;
-			}
-			while (s_slot) {
-				first_processed = 1;
-				if (uwsgi_stats_object_open(us)) goto end0;
-				if (uwsgi_stats_keyvaln_comma(us, "key", s_slot->key, s_slot->keylen)) goto end0;
-				if (uwsgi_stats_keylong_comma(us, "hash", (unsigned long long) s_slot->hash)) goto end0;
-				if (uwsgi_stats_keylong_comma(us, "hits", (unsigned long long) s_slot->hits)) goto end0;
+		uint64_t pos = 0;
+		struct uwsgi_subscribe_slot *s_slot = uwsgi_subscriptions_next(ucr->subscriptions, &pos);
+		while (s_slot) {
+			if (uwsgi_stats_object_open(us)) goto end0;
+			if (uwsgi_stats_keyvaln_comma(us, "key", s_slot->key, s_slot->keylen)) goto end0;
+			if (uwsgi_stats_keylong_comma(us, "hash", (unsigned long long) s_slot->hash)) goto end0;
+			if (uwsgi_stats_keylong_comma(us, "hits", (unsigned long long) s_slot->hits)) goto end0;
 #ifdef UWSGI_SSL
-				if (uwsgi_stats_keylong_comma(us, "sni_enabled", (unsigned long long) s_slot->sni_enabled)) goto end0;
+			if (uwsgi_stats_keylong_comma(us, "sni_enabled", (unsigned long long) s_slot->sni_enabled)) goto end0;
 #endif
-				if (uwsgi_stats_keyval_comma(us, "algo", uwsgi_subscription_algo_name(s_slot->algo))) goto end0;
-
-				if (uwsgi_stats_key(us , "nodes")) goto end0;
-				if (uwsgi_stats_list_open(us)) goto end0;
-
-				struct uwsgi_subscribe_node *s_node = s_slot->nodes;
-				while (s_node) {
-					if (uwsgi_stats_object_open(us)) goto end0;
-
-					if (uwsgi_stats_keyvaln_comma(us, "name", s_node->name, s_node->len)) goto end0;
-					if (uwsgi_stats_keyvaln_comma(us, "vassal", s_node->vassal, s_node->vassal_len)) goto end0;
-
-					if (uwsgi_stats_keylong_comma(us, "modifier1", (unsigned long long) s_node->modifier1)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "modifier2", (unsigned long long) s_node->modifier2)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "last_check", (unsigned long long) s_node->last_check)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "pid", (unsigned long long) s_node->pid)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "uid", (unsigned long long) s_node->uid)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "gid", (unsigned long long) s_node->gid)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "requests", (unsigned long long) s_node->requests)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "last_requests", (unsigned long long) s_node->last_requests)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "tx", (unsigned long long) s_node->tx)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "rx", (unsigned long long) s_node->rx)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "cores", (unsigned long long) s_node->cores)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "load", (unsigned long long) s_node->load)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "weight", (unsigned long long) s_node->weight)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "backup", (unsigned long long) s_node->backup_level)) goto end0;
-					if (uwsgi_stats_keyvaln_comma(us, "proto", &s_node->proto, 1)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "wrr", (unsigned long long) s_node->wrr)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "ref", (unsigned long long) s_node->reference)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "failcnt", (unsigned long long) s_node->failcnt)) goto end0;
-					if (uwsgi_stats_keylong(us, "death_mark", (unsigned long long) s_node->death_mark)) goto end0;
-
-					if (uwsgi_stats_object_close(us)) goto end0;
-					if (s_node->next) {
-						if (uwsgi_stats_comma(us)) goto end0;
-					}
-					s_node = s_node->next;
-				}
+			if (uwsgi_stats_keyval_comma(us, "algo", uwsgi_subscription_algo_name(s_slot->algo))) goto end0;
+			if (ucr->breaker_errors > 0 || ucr->breaker_inflight > 0) {
+				if (uwsgi_stats_keylong_comma(us, "breaker_state", (unsigned long long) s_slot->breaker.state)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "breaker_inflight", (unsigned long long) s_slot->breaker.inflight)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "breaker_trips", (unsigned long long) s_slot->breaker.trips)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "breaker_rejected", (unsigned long long) s_slot->breaker.rejected)) goto end0;
+			}
+
+			if (uwsgi_stats_key(us , "nodes")) goto end0;
+			if (uwsgi_stats_list_open(us)) goto end0;
+
+			struct uwsgi_subscribe_node *s_node = s_slot->nodes;
+			while (s_node) {
+				if (uwsgi_stats_object_open(us)) goto end0;
+
+				if (uwsgi_stats_keyvaln_comma(us, "name", s_node->name, s_node->len)) goto end0;
+				if (uwsgi_stats_keyvaln_comma(us, "vassal", s_node->vassal, s_node->vassal_len)) goto end0;
+
+				if (uwsgi_stats_keylong_comma(us, "modifier1", (unsigned long long) s_node->modifier1)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "modifier2", (unsigned long long) s_node->modifier2)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "last_check", (unsigned long long) s_node->last_check)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "pid", (unsigned long long) s_node->pid)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "uid", (unsigned long long) s_node->uid)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "gid", (unsigned long long) s_node->gid)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "requests", (unsigned long long) s_node->requests)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "last_requests", (unsigned long long) s_node->last_requests)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "tx", (unsigned long long) s_node->tx)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "rx", (unsigned long long) s_node->rx)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "cores", (unsigned long long) s_node->cores)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "load", (unsigned long long) s_node->load)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "weight", (unsigned long long) s_node->weight)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "backup", (unsigned long long) s_node->backup_level)) goto end0;
+				if (uwsgi_stats_keyvaln_comma(us, "proto", &s_node->proto, 1)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "wrr", (unsigned long long) s_node->wrr)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "latency", (unsigned long long) s_node->latency)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "ejected", (unsigned long long) s_node->ejected)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "ejections", (unsigned long long) s_node->ejections)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "ref", (unsigned long long) s_node->reference)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "failcnt", (unsigned long long) s_node->failcnt)) goto end0;
+				if (uwsgi_stats_keylong(us, "death_mark", (unsigned long long) s_node->death_mark)) goto end0;
 
-				if (uwsgi_stats_list_close(us)) goto end0;
 				if (uwsgi_stats_object_close(us)) goto end0;
-				if (s_slot->next) {
+				if (s_node->next) {
 					if (uwsgi_stats_comma(us)) goto end0;
 				}
+				s_node = s_node->next;
+			}
 
-				s_slot = s_slot->next;
-				// check for loopy optimization
-				if (s_slot == ucr->subscriptions[i])
-					break;
+			if (uwsgi_stats_list_close(us)) goto end0;
+			if (uwsgi_stats_object_close(us)) goto end0;
+
+			s_slot = uwsgi_subscriptions_next(ucr->subscriptions, &pos);
+			if (s_slot) {
+				if (uwsgi_stats_comma(us)) goto end0;
 			}
 		}
 
 			if (uwsgi_stats_list_close(us)) goto end0;
 			if (uwsgi_stats_comma(us)) goto end0;
+		cr_unlock_subscriptions(ucr);
+		subscriptions_locked = 0;
 	}
 
 	if (uwsgi_stats_keylong(us, "cheap", (unsigned long long) ucr->i_am_cheap)) goto end0;	
@@ -1214,6 +1533,9 @@ void corerouter_send_stats(struct uwsgi_corerouter *ucr) {
         }
 
 end0:
+	if (subscriptions_locked) {
+		cr_unlock_subscriptions(ucr);
+	}
         free(cwd);
 end:
         free(us->base);
@@ -3,9 +3,13 @@
 #define COREROUTER_STATUS_RECV_HDR 2
 #define COREROUTER_STATUS_RESPONSE 3
 
-#define cr_add_timeout(u, x) uwsgi_add_rb_timer(u->timeouts, uwsgi_now()+x->current_timeout, x)
-#define cr_add_timeout_fast(u, x, t) uwsgi_add_rb_timer(u->timeouts, t+x->current_timeout, x)
-#define cr_del_timeout(u, x) uwsgi_del_rb_timer(u->timeouts, x->timeout); free(x->timeout);
+#define COREROUTER_BREAKER_CLOSED 0
+#define COREROUTER_BREAKER_OPEN 1
+#define COREROUTER_BREAKER_HALF_OPEN 2
+
+#define cr_add_timeout(u, x) uwsgi_timer_wheel_add(u->timeouts, &x->timeout, uwsgi_millis() + (x->current_timeout * 1000), x)
+#define cr_add_timeout_fast(u, x, t) uwsgi_timer_wheel_add(u->timeouts, &x->timeout, t + (x->current_timeout * 1000), x)
+#define cr_del_timeout(u, x) uwsgi_timer_wheel_del(u->timeouts, &x->timeout)
 
 #define uwsgi_cr_error(x, y) uwsgi_log("[uwsgi-%s key: %.*s client_addr: %s client_port: %s] %s: %s [%s line %d]\n", x->session->corerouter->short_name, (x == x->session->main_peer) ? (x->session->peers ? x->session->peers->key_len: 0) : x->key_len, (x == x->session->main_peer) ? (x->session->peers ? x->session->peers->key: "") : x->key, x->session->client_address, x->session->client_port, y, strerror(errno), __FILE__, __LINE__)
 #define uwsgi_cr_log(x, y, ...) uwsgi_log("[uwsgi-%s key: %.*s client_addr: %s client_port: %s]" y, x->session->corerouter->short_name,  (x == x->session->main_peer) ? (x->session->peers ? x->session->peers->key_len: 0) : x->key_len, (x == x->session->main_peer) ? (x->session->peers ? x->session->peers->key: "") : x->key, x->session->client_address, x->session->client_port, __VA_ARGS__)
@@ -33,11 +37,15 @@
 	if (peer != peer->session->main_peer && peer->un) peer->un->rx+=len;\
         ubuf##_pos += len;
 
+#define cr_lock_subscriptions(ucr) if (ucr->subscriptions_lock) pthread_mutex_lock(ucr->subscriptions_lock)
+#define cr_unlock_subscriptions(ucr) if (ucr->subscriptions_lock) pthread_mutex_unlock(ucr->subscriptions_lock)
+
 #define cr_write_complete(peer) peer->out_pos == peer->out->pos
 
 #define cr_write_complete_buf(peer, buf) buf##_pos == buf->pos
 
-#define cr_connect(peer, f) peer->fd = uwsgi_connectn(peer->instance_address, peer->instance_address_len, 0, 1);\
+#define cr_connect(peer, f) peer->fd = uwsgi_cr_pool_get(peer);\
+	if (peer->fd < 0) peer->fd = uwsgi_connectn(peer->instance_address, peer->instance_address_len, 0, 1);\
         if (peer->fd < 0) {\
                 peer->failed = 1;\
                 peer->soopt = errno;\
@@ -45,6 +53,7 @@
         }\
         peer->session->corerouter->cr_table[peer->fd] = peer;\
         peer->connecting = 1;\
+	peer->connect_time = uwsgi_micros();\
 	cr_write_to_backend(peer, f);
 
 #define cr_read(peer, f) read(peer->fd, peer->in->buf + peer->in->pos, peer->in->len - peer->in->pos);\
@@ -148,8 +157,8 @@ struct corerouter_peer {
         int soopt;
 	// has the peer timed out ?
         int timed_out;
-	// the timeout rb_tree
-        struct uwsgi_rb_timer *timeout;
+	// the timeout (in the timing wheel)
+        struct uwsgi_wheel_timer timeout;
 
 	// each peer can map to a different instance
         char *tmp_socket_name;
@@ -170,6 +179,8 @@ struct corerouter_peer {
 
 	// stream id (could have various use)
 	uint32_t sid;
+	// flow control window of the stream (for multiplexed protocols)
+	int64_t window;
 
 	// internal parser status
 	int r_parser_status;
@@ -204,6 +215,47 @@ struct corerouter_peer {
 
 	char *vassal;
 	uint8_t vassal_len;
+
+	// the backend connection can be taken from (and given back to) the pool
+	int can_pool;
+
+	// when the backend connection has been started (used for subscription nodes latency)
+	uint64_t connect_time;
+	// the backend answered with an error (used by the subscription passive health checks)
+	int bad_response;
+	int response_checked;
+
+	// msecs timer for hedged requests
+	struct uwsgi_rb_timer *hedge_timer;
+
+	// optional key for hash based subscription algos (the client address is used otherwise)
+	char *hash_key;
+	uint16_t hash_key_len;
+
+	// the peer is accounted in the circuit breaker of its subscription key (as a probe if 2)
+	int breaker_counted;
+	// the circuit breaker of the key is open, the request must fail fast
+	int breaker_open;
+};
+
+// an idle (already connected) backend connection
+struct uwsgi_cr_pool_conn {
+	int fd;
+	char *address;
+	uint64_t address_len;
+	time_t last_used;
+	struct uwsgi_cr_pool_conn *next;
+};
+
+// a memoized key -> value result of the cache mapper (generation is 0 for empty entries)
+struct uwsgi_cr_cache_memo {
+	uint64_t generation;
+	struct uwsgi_cache *cache;
+	char *key;
+	uint16_t key_len;
+	char *value;
+	uint64_t value_len;
+	uint64_t hits;
 };
 
 struct uwsgi_corerouter {
@@ -222,10 +274,14 @@ struct uwsgi_corerouter {
         int processes;
         int quiet;
 
-        struct uwsgi_rbtree *timeouts;
+        struct uwsgi_timer_wheel *timeouts;
 
         char *use_cache;
 	struct uwsgi_cache *cache;
+	// memoized results of the cache mapper (power of 2 entries)
+	uint64_t cache_memo;
+	struct uwsgi_cr_cache_memo *cache_memo_table;
+	uint64_t cache_memo_hits;
         int nevents;
 
 	int max_retries;
@@ -254,7 +310,7 @@ struct uwsgi_corerouter {
         int socket_num;
         struct uwsgi_socket *to_socket;
 
-        struct uwsgi_subscribe_slot **subscriptions;
+        struct uwsgi_subscriptions *subscriptions;
 
         struct uwsgi_string_list *fallback;
 
@@ -296,6 +352,44 @@ struct uwsgi_corerouter {
 
 	char *fallback_key;
 	int fallback_key_len;
+
+	// idle backend connections
+	int pool_size;
+	int pool_idle;
+	int pool_count;
+	struct uwsgi_cr_pool_conn *pool;
+
+	// threaded mode: each thread runs its own copy of the corerouter (queue, timeouts, fd table)
+	int threads;
+	int thread_id;
+	struct uwsgi_corerouter **thread_routers;
+	// subscriptions are shared by all of the threads
+	pthread_mutex_t *subscriptions_lock;
+
+	// hedged requests: a second backend is tried if the first one does not answer in hedge_delay msecs
+	int hedge_delay;
+	struct uwsgi_rbtree *hedge_timeouts;
+	uint64_t hedged;
+
+	// identical concurrent requests wait for the response of the first one
+	int coalesce;
+	uint64_t coalesced;
+
+	// per subscription key circuit breakers
+	int breaker_errors;
+	int breaker_inflight;
+	int breaker_window;
+	int breaker_min_requests;
+	int breaker_open_time;
+
+	// an additional socket managed by the router plugin (added to the event queue when the hook is set)
+	int plugin_fd;
+	void (*plugin_fd_hook)(struct uwsgi_corerouter *, int);
+
+	// completion pipe of the jobs offloaded by the plugin to other threads (each event loop has its own)
+	int offload_ready;
+	int offload_pipe[2];
+	void (*offload_hook)(struct uwsgi_corerouter *, int);
 };
 
 // a session is started when a client connect to the router
@@ -315,6 +409,13 @@ struct corerouter_session {
 
 	void (*close)(struct corerouter_session *);
 	int (*retry)(struct corerouter_peer *);
+	// fire a hedged request for the peer (it has not answered in time)
+	int (*hedge)(struct corerouter_peer *);
+	// the peer timed out, return 0 to keep it alive (the timeout is re-armed)
+	int (*timeout)(struct corerouter_peer *);
+
+	// more than one backend is working on the same request, losing peers do not close the session
+	int hedging;
 
 	// leave the main peer alive
 	int can_keepalive;
@@ -360,15 +461,21 @@ void uwsgi_corerouter_setup_sockets(struct uwsgi_corerouter *);
 
 int uwsgi_corerouter_init(struct uwsgi_corerouter *);
 
+void corerouter_hedge_timer(struct uwsgi_corerouter *, struct corerouter_peer *);
+void corerouter_hedge_cancel(struct uwsgi_corerouter *, struct corerouter_peer *);
+void corerouter_drop_peer(struct uwsgi_corerouter *, struct corerouter_peer *);
+
 struct corerouter_session *corerouter_alloc_session(struct uwsgi_corerouter *, struct uwsgi_gateway_socket *, int, struct sockaddr *, socklen_t);
 void corerouter_close_session(struct uwsgi_corerouter *, struct corerouter_session *);
 
 int uwsgi_cr_map_use_void(struct uwsgi_corerouter *, struct corerouter_peer *);
 int uwsgi_cr_map_use_cache(struct uwsgi_corerouter *, struct corerouter_peer *);
+void uwsgi_cr_cache_memo_init(struct uwsgi_corerouter *);
 int uwsgi_cr_map_use_pattern(struct uwsgi_corerouter *, struct corerouter_peer *);
 int uwsgi_cr_map_use_cluster(struct uwsgi_corerouter *, struct corerouter_peer *);
 int uwsgi_cr_map_use_subscription(struct uwsgi_corerouter *, struct corerouter_peer *);
 int uwsgi_cr_map_use_subscription_dotsplit(struct uwsgi_corerouter *, struct corerouter_peer *);
+void uwsgi_cr_breaker_release(struct uwsgi_corerouter *, struct corerouter_peer *, int);
 int uwsgi_cr_map_use_base(struct uwsgi_corerouter *, struct corerouter_peer *);
 int uwsgi_cr_map_use_cs(struct uwsgi_corerouter *, struct corerouter_peer *);
 int uwsgi_cr_map_use_to(struct uwsgi_corerouter *, struct corerouter_peer *);
@@ -380,6 +487,8 @@ int uwsgi_cr_set_hooks(struct corerouter_peer *, ssize_t (*)(struct corerouter_p
 struct corerouter_peer *uwsgi_cr_peer_add(struct corerouter_session *);
 struct corerouter_peer *uwsgi_cr_peer_find_by_sid(struct corerouter_session *, uint32_t);
 void corerouter_close_peer(struct uwsgi_corerouter *, struct corerouter_peer *);
-struct uwsgi_rb_timer *corerouter_reset_timeout(struct uwsgi_corerouter *, struct corerouter_peer *);
+int uwsgi_cr_pool_get(struct corerouter_peer *);
+void uwsgi_cr_pool_put(struct corerouter_peer *);
+void corerouter_reset_timeout(struct uwsgi_corerouter *, struct corerouter_peer *);
 
 int corerouter_spawn_vassal(struct uwsgi_corerouter *, struct uwsgi_subscribe_node *, int);
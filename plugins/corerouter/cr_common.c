@@ -111,6 +111,21 @@ void *uwsgi_corerouter_setup_event_queue(struct uwsgi_corerouter *ucr, int id) {
 	return event_queue_alloc(ucr->nevents);
 }
 
+// get the next packet of a (possibly batched) subscription datagram
+static char *corerouter_subscription_packet(char **ptr, ssize_t *len, uint16_t *pktsize) {
+	if (*len < 4)
+		return NULL;
+	char *pkt = *ptr;
+	uint16_t size = (uint8_t) pkt[1] | ((uint8_t) pkt[2] << 8);
+	// the last (or only) packet takes the rest of the datagram
+	if (size > *len - 4)
+		size = *len - 4;
+	*pktsize = size;
+	*ptr += 4 + size;
+	*len -= 4 + size;
+	return pkt;
+}
+
 void uwsgi_corerouter_manage_subscription(struct uwsgi_corerouter *ucr, int id, struct uwsgi_gateway_socket *ugs) {
 
 	int i;
@@ -126,16 +141,33 @@ void uwsgi_corerouter_manage_subscription(struct uwsgi_corerouter *ucr, int id,
 	else {
 		len = recv(ugs->fd, bbuf, 4096, 0);
 	}
-	if (len > 0) {
-		uwsgi_hooked_parse(bbuf + 4, len - 4, corerouter_manage_subscription, &usr);
+	if (len <= 0)
+		return;
+
+	pid_t pid = usr.pid;
+	uid_t uid = usr.uid;
+	gid_t gid = usr.gid;
+	char *pkt = NULL;
+	uint16_t pktsize = 0;
+	char *ptr = bbuf;
+	ssize_t remains = len;
+	int rejected = 0;
+	// a datagram can contain multiple (batched) packets
+	while ((pkt = corerouter_subscription_packet(&ptr, &remains, &pktsize))) {
+		memset(&usr, 0, sizeof(struct uwsgi_subscribe_req));
+		usr.pid = pid;
+		usr.uid = uid;
+		usr.gid = gid;
+		uwsgi_hooked_parse(pkt + 4, pktsize, corerouter_manage_subscription, &usr);
 		if (usr.sign_len > 0) {
 			// calc the base size
-			usr.base = bbuf + 4;
-			usr.base_len = len - 4 - (2 + 4 + 2 + usr.sign_len);
+			usr.base = pkt + 4;
+			usr.base_len = pktsize - (2 + 4 + 2 + usr.sign_len);
 		}
 
+		cr_lock_subscriptions(ucr);
 		// subscribe request ?
-		if (bbuf[3] == 0) {
+		if (pkt[3] == 0) {
 			if (uwsgi_add_subscribe_node(ucr->subscriptions, &usr) && ucr->i_am_cheap) {
 				struct uwsgi_gateway_socket *ugs = uwsgi.gateway_sockets;
 				while (ugs) {
@@ -155,7 +187,9 @@ void uwsgi_corerouter_manage_subscription(struct uwsgi_corerouter *ucr, int id,
 #ifdef UWSGI_SSL
 				if (uwsgi.subscriptions_sign_check_dir) {
 					if (!uwsgi_subscription_sign_check(node->slot, &usr)) {
-						return;
+						cr_unlock_subscriptions(ucr);
+						rejected = 1;
+						continue;
 					}
 				}
 #endif
@@ -172,17 +206,7 @@ void uwsgi_corerouter_manage_subscription(struct uwsgi_corerouter *ucr, int id,
 				}
 			}
 		}
-
-		// propagate the subscription to other nodes
-		for (i = 0; i < ushared->gateways_cnt; i++) {
-			if (i == id)
-				continue;
-			if (!strcmp(ushared->gateways[i].name, ucr->name)) {
-				if (send(ushared->gateways[i].internal_subscription_pipe[0], bbuf, len, 0) != len) {
-					uwsgi_error("uwsgi_corerouter_manage_subscription()/send()");
-				}
-			}
-		}
+		cr_unlock_subscriptions(ucr);
 
 		// resubscribe if needed ?
 		if (ucr->resubscribe) {
@@ -218,10 +242,10 @@ void uwsgi_corerouter_manage_subscription(struct uwsgi_corerouter *ucr, int id,
 					if (rfd == -1) {
 						rfd = bind_to_udp(ucr->resubscribe_bind, 0, 0);
 					}
-					uwsgi_send_subscription_from_fd(rfd, usl->value, usr.key, usr.keylen, usr.modifier1, usr.modifier2, bbuf[3], address, NULL, sni_key, sni_cert, sni_ca);
+					uwsgi_send_subscription_from_fd(rfd, usl->value, usr.key, usr.keylen, usr.modifier1, usr.modifier2, pkt[3], address, NULL, sni_key, sni_cert, sni_ca);
 				}
 				else {
-					uwsgi_send_subscription_from_fd(-2, usl->value, usr.key, usr.keylen, usr.modifier1, usr.modifier2, bbuf[3], address, NULL, sni_key, sni_cert, sni_ca);
+					uwsgi_send_subscription_from_fd(-2, usl->value, usr.key, usr.keylen, usr.modifier1, usr.modifier2, pkt[3], address, NULL, sni_key, sni_cert, sni_ca);
 				}
 			}
 			if (sni_key) free(sni_key);
@@ -230,6 +254,20 @@ void uwsgi_corerouter_manage_subscription(struct uwsgi_corerouter *ucr, int id,
 		}
 	}
 
+	if (rejected)
+		return;
+
+	// propagate the subscription to other nodes
+	for (i = 0; i < ushared->gateways_cnt; i++) {
+		if (i == id)
+			continue;
+		if (!strcmp(ushared->gateways[i].name, ucr->name)) {
+			if (send(ushared->gateways[i].internal_subscription_pipe[0], bbuf, len, 0) != len) {
+				uwsgi_error("uwsgi_corerouter_manage_subscription()/send()");
+			}
+		}
+	}
+
 }
 
 void uwsgi_corerouter_manage_internal_subscription(struct uwsgi_corerouter *ucr, int fd) {
@@ -239,12 +277,16 @@ void uwsgi_corerouter_manage_internal_subscription(struct uwsgi_corerouter *ucr,
 	char bbuf[4096];
 
 	ssize_t len = recv(fd, bbuf, 4096, 0);
-	if (len > 0) {
+	char *pkt = NULL;
+	uint16_t pktsize = 0;
+	char *ptr = bbuf;
+	while ((pkt = corerouter_subscription_packet(&ptr, &len, &pktsize))) {
 		memset(&usr, 0, sizeof(struct uwsgi_subscribe_req));
-		uwsgi_hooked_parse(bbuf + 4, len - 4, corerouter_manage_subscription, &usr);
+		uwsgi_hooked_parse(pkt + 4, pktsize, corerouter_manage_subscription, &usr);
 
+		cr_lock_subscriptions(ucr);
 		// subscribe request ?
-		if (bbuf[3] == 0) {
+		if (pkt[3] == 0) {
 			if (uwsgi_add_subscribe_node(ucr->subscriptions, &usr) && ucr->i_am_cheap) {
 				struct uwsgi_gateway_socket *ugs = uwsgi.gateway_sockets;
 				while (ugs) {
@@ -274,6 +316,7 @@ void uwsgi_corerouter_manage_internal_subscription(struct uwsgi_corerouter *ucr,
 				}
 			}
 		}
+		cr_unlock_subscriptions(ucr);
 	}
 
 }
@@ -8,20 +8,29 @@ int uwsgi_cr_map_use_void(struct uwsgi_corerouter *ucr, struct corerouter_peer *
 	return 0;
 }
 
-int uwsgi_cr_map_use_cache(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
-	uint64_t hits = 0;
-	uwsgi_rlock(ucr->cache->lock);
-	char *value = uwsgi_cache_get4(ucr->cache, peer->key, peer->key_len, &peer->instance_address_len, &hits);
-	if (!value)
-		goto end;
-	peer->tmp_socket_name = uwsgi_concat2n(value, peer->instance_address_len, "", 0);
+/*
+	the results (misses included) of the cache mapper can be memoized in a per-process direct mapped
+	table (--<router>-cache-memo <n>): every update of a cache bumps its generation, so an entry is
+	valid only while the generation of its cache (shard) is unchanged and the hot keys are mapped
+	without touching the shared cache (and its lock). The nodes of a multi-node value are rotated
+	using the hits of the memoized entry.
+*/
+
+void uwsgi_cr_cache_memo_init(struct uwsgi_corerouter *ucr) {
+	uint64_t entries = 1;
+	while (entries < ucr->cache_memo) entries <<= 1;
+	ucr->cache_memo = entries;
+	ucr->cache_memo_table = uwsgi_calloc(sizeof(struct uwsgi_cr_cache_memo) * entries);
+}
+
+static int cr_map_cache_value(struct corerouter_peer *peer, uint64_t hits) {
 	size_t nodes = uwsgi_str_occurence(peer->tmp_socket_name, peer->instance_address_len, '|');
 	if (nodes > 0) {
 		size_t chosen_node = hits % (nodes + 1);
 		size_t chosen_node_len = 0;
 		peer->instance_address = uwsgi_str_split_nget(peer->tmp_socket_name, peer->instance_address_len, '|', chosen_node, &chosen_node_len);
 		if (!peer->instance_address)
-			goto end;
+			return 0;
 		peer->instance_address_len = chosen_node_len;
 	}
 	else {
@@ -32,11 +41,52 @@ int uwsgi_cr_map_use_cache(struct uwsgi_corerouter *ucr, struct corerouter_peer
 		peer->modifier1 = uwsgi_str_num(cs_mod + 1, (peer->instance_address_len - (cs_mod - peer->instance_address)) - 1);
 		peer->instance_address_len = (cs_mod - peer->instance_address);
 	}
-end:
-	uwsgi_rwunlock(ucr->cache->lock);
 	return 0;
 }
 
+int uwsgi_cr_map_use_cache(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
+	uint64_t hits = 0;
+	struct uwsgi_cache *ucs = uwsgi_cache_shard(ucr->cache, peer->key, peer->key_len);
+	struct uwsgi_cr_cache_memo *memo = NULL;
+
+	if (ucr->cache_memo_table) {
+		// read it before the lookup, a concurrent update invalidates the memoized result
+		uint64_t generation = __atomic_load_n(&ucs->generation, __ATOMIC_ACQUIRE) + 1;
+		memo = &ucr->cache_memo_table[ucs->hash->func(peer->key, peer->key_len) & (ucr->cache_memo - 1)];
+		if (memo->generation == generation && memo->cache == ucs && !uwsgi_strncmp(memo->key, memo->key_len, peer->key, peer->key_len)) {
+			ucr->cache_memo_hits++;
+			if (!memo->value) return 0;
+			hits = memo->hits++;
+			peer->tmp_socket_name = uwsgi_concat2n(memo->value, memo->value_len, "", 0);
+			peer->instance_address_len = memo->value_len;
+			return cr_map_cache_value(peer, hits);
+		}
+		free(memo->key);
+		free(memo->value);
+		memo->key = uwsgi_concat2n(peer->key, peer->key_len, "", 0);
+		memo->key_len = peer->key_len;
+		memo->value = NULL;
+		memo->value_len = 0;
+		memo->cache = ucs;
+		memo->generation = generation;
+	}
+
+	uwsgi_rlock(ucs->lock);
+	char *value = uwsgi_cache_get4(ucs, peer->key, peer->key_len, &peer->instance_address_len, &hits);
+	if (value) {
+		peer->tmp_socket_name = uwsgi_concat2n(value, peer->instance_address_len, "", 0);
+	}
+	uwsgi_rwunlock(ucs->lock);
+
+	if (!value) return 0;
+	if (memo) {
+		memo->value = uwsgi_concat2n(peer->tmp_socket_name, peer->instance_address_len, "", 0);
+		memo->value_len = peer->instance_address_len;
+		memo->hits = hits + 1;
+	}
+	return cr_map_cache_value(peer, hits);
+}
+
 int uwsgi_cr_map_use_pattern(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
 	size_t tmp_socket_name_len = 0;
 	ucr->magic_table['s'] = uwsgi_concat2n(peer->key, peer->key_len, "", 0);
@@ -48,17 +98,125 @@ int uwsgi_cr_map_use_pattern(struct uwsgi_corerouter *ucr, struct corerouter_pee
 }
 
 
+/*
+	per subscription key circuit breakers
+
+	when --<router>-breaker-errors is set, the outcome of the requests to the nodes of a key
+	is counted in windows of --<router>-breaker-window seconds: when (after at least
+	--<router>-breaker-min-requests requests) the failures reach the specified percentage
+	the breaker opens and the requests for the key fail fast (without consuming router fds)
+	for --<router>-breaker-open-time milliseconds. Then a single probe request is allowed (half-open):
+	its success closes the breaker, its failure opens it again.
+
+	--<router>-breaker-inflight fails fast the requests exceeding the specified number of running
+	requests for the same key.
+
+	everything runs under the subscriptions lock
+*/
+#define cr_breaker_enabled(ucr) (ucr->breaker_errors > 0 || ucr->breaker_inflight > 0)
+
+static void cr_breaker_trip(struct uwsgi_corerouter *ucr, struct uwsgi_subscribe_slot *slot, char *reason) {
+	struct uwsgi_subscribe_breaker *usb = &slot->breaker;
+	usb->state = COREROUTER_BREAKER_OPEN;
+	usb->open_until = uwsgi_micros() + ((uint64_t) ucr->breaker_open_time * 1000);
+	usb->requests = 0;
+	usb->failures = 0;
+	usb->trips++;
+	uwsgi_log("[uwsgi-%s] %.*s => circuit breaker open for %d msecs (%s)\n", ucr->short_name, (int) slot->keylen, slot->key, ucr->breaker_open_time, reason);
+}
+
+// returns -1 (and releases the node) if the request must fail fast
+static int cr_breaker_check(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
+	struct uwsgi_subscribe_breaker *usb = &peer->un->slot->breaker;
+
+	if (usb->state == COREROUTER_BREAKER_OPEN) {
+		if (uwsgi_micros() < usb->open_until) goto reject;
+		usb->state = COREROUTER_BREAKER_HALF_OPEN;
+		usb->probing = 0;
+	}
+
+	if (usb->state == COREROUTER_BREAKER_HALF_OPEN) {
+		// a single probe at a time
+		if (usb->probing) goto reject;
+		usb->probing = 1;
+		peer->breaker_counted = 2;
+	}
+	else {
+		if (ucr->breaker_inflight > 0 && usb->inflight >= (uint64_t) ucr->breaker_inflight) goto reject;
+		peer->breaker_counted = 1;
+	}
+	usb->inflight++;
+	return 0;
+
+reject:
+	usb->rejected++;
+	peer->un->reference--;
+	peer->un = NULL;
+	peer->breaker_open = 1;
+	return -1;
+}
+
+/*
+	called (under the subscriptions lock) when a backend peer releases its node
+
+	failed is -1 when the outcome of the request is not known (the client went away)
+*/
+void uwsgi_cr_breaker_release(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer, int failed) {
+	if (!peer->breaker_counted || !peer->un) return;
+
+	struct uwsgi_subscribe_slot *slot = peer->un->slot;
+	struct uwsgi_subscribe_breaker *usb = &slot->breaker;
+	int probe = peer->breaker_counted == 2;
+	peer->breaker_counted = 0;
+	if (usb->inflight > 0) usb->inflight--;
+
+	if (probe) {
+		usb->probing = 0;
+		// unknown outcome, the next request will be the probe
+		if (failed < 0) return;
+		if (failed) {
+			cr_breaker_trip(ucr, slot, "probe request failed");
+			return;
+		}
+		usb->state = COREROUTER_BREAKER_CLOSED;
+		usb->window = uwsgi_now();
+		usb->requests = 0;
+		usb->failures = 0;
+		uwsgi_log("[uwsgi-%s] %.*s => circuit breaker closed\n", ucr->short_name, (int) slot->keylen, slot->key);
+		return;
+	}
+
+	if (failed < 0 || ucr->breaker_errors <= 0 || usb->state != COREROUTER_BREAKER_CLOSED) return;
+
+	time_t now = uwsgi_now();
+	if (now - usb->window >= ucr->breaker_window) {
+		usb->window = now;
+		usb->requests = 0;
+		usb->failures = 0;
+	}
+	usb->requests++;
+	if (failed) usb->failures++;
+	if (usb->requests >= (uint64_t) ucr->breaker_min_requests && usb->failures * 100 >= usb->requests * (uint64_t) ucr->breaker_errors) {
+		cr_breaker_trip(ucr, slot, "error rate");
+	}
+}
+
 int uwsgi_cr_map_use_subscription(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
 
 	struct uwsgi_subscription_client usc;
 	usc.fd = peer->session->main_peer->fd;
 	usc.sockaddr = &peer->session->client_sockaddr;
-	usc.cookie = NULL;
+	usc.cookie = peer->hash_key;
+	usc.cookie_len = peer->hash_key_len;
 
+	cr_lock_subscriptions(ucr);
 	peer->un = uwsgi_get_subscribe_node(ucr->subscriptions, peer->key, peer->key_len, &usc);
 	if((peer->un == NULL) && (ucr->fallback_key != NULL)) {
 		peer->un = uwsgi_get_subscribe_node(ucr->subscriptions, ucr->fallback_key, ucr->fallback_key_len, &usc);
 	}
+	if (peer->un && peer->un->len && cr_breaker_enabled(ucr)) {
+		cr_breaker_check(ucr, peer);
+	}
 	// check if the node is ready or it requires a vassal spawn
 	if (peer->un && (peer->un->len || peer->un->vassal_len)) {
 		peer->modifier1 = peer->un->modifier1;
@@ -79,6 +237,7 @@ int uwsgi_cr_map_use_subscription(struct uwsgi_corerouter *ucr, struct coreroute
 		uwsgi_gateway_go_cheap(ucr->name, ucr->queue, &ucr->i_am_cheap);
 	}
 
+	cr_unlock_subscriptions(ucr);
 	return 0;
 }
 
@@ -92,11 +251,16 @@ int uwsgi_cr_map_use_subscription_dotsplit(struct uwsgi_corerouter *ucr, struct
 	struct uwsgi_subscription_client usc;
 	usc.fd = peer->session->main_peer->fd;
 	usc.sockaddr = &peer->session->client_sockaddr;
-	usc.cookie = NULL;
+	usc.cookie = peer->hash_key;
+	usc.cookie_len = peer->hash_key_len;
+
+	cr_lock_subscriptions(ucr);
 
 split:
-	if (!count)
+	if (!count) {
+		cr_unlock_subscriptions(ucr);
 		return 0;
+	}
 #ifdef UWSGI_DEBUG
 	uwsgi_log("trying with %.*s\n", name_len, name);
 #endif
@@ -111,6 +275,10 @@ split:
 		}
 	}
 
+	if (peer->un && peer->un->len && cr_breaker_enabled(ucr)) {
+		cr_breaker_check(ucr, peer);
+	}
+
 	if (peer->un && peer->un->len) {
 		peer->instance_address = peer->un->name;
 		peer->instance_address_len = peer->un->len;
@@ -122,6 +290,7 @@ split:
 		uwsgi_gateway_go_cheap(ucr->name, ucr->queue, &ucr->i_am_cheap);
 	}
 
+	cr_unlock_subscriptions(ucr);
 	return 0;
 }
 
@@ -28,8 +28,10 @@ static struct uwsgi_option fastrouter_options[] = {
 	{"fastrouter", required_argument, 0, "run the fastrouter on the specified port", uwsgi_opt_corerouter, &ufr, 0},
 	{"fastrouter-processes", required_argument, 0, "prefork the specified number of fastrouter processes", uwsgi_opt_set_int, &ufr.cr.processes, 0},
 	{"fastrouter-workers", required_argument, 0, "prefork the specified number of fastrouter processes", uwsgi_opt_set_int, &ufr.cr.processes, 0},
+	{"fastrouter-threads", required_argument, 0, "run the specified number of event loop threads in each fastrouter process (sharing subscriptions and stats)", uwsgi_opt_set_int, &ufr.cr.threads, 0},
 	{"fastrouter-zerg", required_argument, 0, "attach the fastrouter to a zerg server", uwsgi_opt_corerouter_zerg, &ufr, 0},
 	{"fastrouter-use-cache", optional_argument, 0, "use uWSGI cache as hostname->server mapper for the fastrouter", uwsgi_opt_set_str, &ufr.cr.use_cache, 0},
+	{"fastrouter-cache-memo", required_argument, 0, "memoize (per router process) the specified number of recent results of the cache mapper", uwsgi_opt_set_64bit, &ufr.cr.cache_memo, 0},
 
 	{"fastrouter-use-pattern", required_argument, 0, "use a pattern for fastrouter hostname->server mapping", uwsgi_opt_corerouter_use_pattern, &ufr, 0},
 	{"fastrouter-use-base", required_argument, 0, "use a base dir for fastrouter hostname->server mapping", uwsgi_opt_corerouter_use_base, &ufr, 0},
@@ -70,6 +72,12 @@ static struct uwsgi_option fastrouter_options[] = {
 	{"fastrouter-max-retries", required_argument, 0, "set fastrouter max retry attempts", uwsgi_opt_set_int, &ufr.cr.max_retries, 0},
 	{"fastrouter-subscription-fallback-key", required_argument, 0, "key to use for fallback fastrouter", uwsgi_opt_corerouter_fallback_key, &ufr.cr, 0},
 
+	{"fastrouter-breaker-errors", required_argument, 0, "open the circuit breaker of a subscription key when the specified percentage of its requests fails", uwsgi_opt_set_int, &ufr.cr.breaker_errors, 0},
+	{"fastrouter-breaker-inflight", required_argument, 0, "fail fast the requests exceeding the specified number of running requests for a subscription key", uwsgi_opt_set_int, &ufr.cr.breaker_inflight, 0},
+	{"fastrouter-breaker-window", required_argument, 0, "set the window (in seconds) of the circuit breakers error rate (default: 10)", uwsgi_opt_set_int, &ufr.cr.breaker_window, 0},
+	{"fastrouter-breaker-min-requests", required_argument, 0, "set the minimal number of requests in the window before opening a circuit breaker (default: 20)", uwsgi_opt_set_int, &ufr.cr.breaker_min_requests, 0},
+	{"fastrouter-breaker-open-time", required_argument, 0, "set how long (in milliseconds) a circuit breaker stays open before a probe request (default: 5000)", uwsgi_opt_set_int, &ufr.cr.breaker_open_time, 0},
+
 	UWSGI_END_OF_OPTIONS
 };
 
@@ -209,6 +217,27 @@ static ssize_t fr_write(struct corerouter_peer *main_peer) {
         return len;
 }
 
+// write the fast-fail response of an open circuit breaker and close the connection
+static ssize_t fr_write_error(struct corerouter_peer *main_peer) {
+	ssize_t len = cr_write(main_peer, "fr_write_error()");
+	if (!len) return 0;
+	if (cr_write_complete(main_peer)) return 0;
+	return len;
+}
+
+static int fr_breaker_fail(struct corerouter_peer *peer) {
+	struct corerouter_peer *main_peer = peer->session->main_peer;
+	// the request is not needed anymore, reuse its buffer
+	main_peer->in->pos = 0;
+	if (uwsgi_buffer_append(main_peer->in, "HTTP/1.0 503 Service Unavailable\r\nContent-Type: text/plain\r\nContent-Length: 20\r\n\r\nService Unavailable\n", 102)) return -1;
+	main_peer->out = main_peer->in;
+	main_peer->out_pos = 0;
+	// the backend peer could be destroyed before the response is sent
+	peer->session->wait_full_write = 1;
+	cr_write_to_main(peer, fr_write_error);
+	return 0;
+}
+
 // data from instance
 static ssize_t fr_instance_read(struct corerouter_peer *peer) {
 	ssize_t len = cr_read(peer, "fr_instance_read()");
@@ -379,12 +408,17 @@ static ssize_t fr_recv_uwsgi_vars(struct corerouter_peer *main_peer) {
 		if (ucr->mapper(ucr, new_peer))
 			return -1;
 
+		if (new_peer->breaker_open) {
+			if (fr_breaker_fail(new_peer)) return -1;
+			return len;
+		}
+
 		// check instance
 		if (new_peer->instance_address_len == 0) {
 			// check if the connection was deferred
 			if (new_peer->defer_connect) {
 				new_peer->current_timeout = ufr.cr.defer_connect_timeout;
-                        	new_peer->timeout = corerouter_reset_timeout(&ufr.cr, new_peer);
+                        	corerouter_reset_timeout(&ufr.cr, new_peer);
 				// stop reading from the client
 				if (uwsgi_cr_set_hooks(main_peer, NULL, NULL)) return -1;
 				return len;
@@ -446,11 +480,16 @@ static int fr_retry(struct corerouter_peer *peer) {
                 return -1;
         }
 
+	if (peer->breaker_open) {
+		if (fr_breaker_fail(peer)) return -1;
+		return 1;
+	}
+
         if (peer->instance_address_len == 0) {
 		// first retry is consumed for the first attempt
 		if (peer->defer_connect && (peer->retries+1) < ufr.cr.max_retries) {
                 	peer->current_timeout = ufr.cr.defer_connect_timeout;
-                        peer->timeout = corerouter_reset_timeout(&ufr.cr, peer);
+                        corerouter_reset_timeout(&ufr.cr, peer);
 			// stop reading from the client
 			if (uwsgi_cr_set_hooks(peer->session->main_peer, NULL, NULL)) return -1;
                         return 1;
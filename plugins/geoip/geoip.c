@@ -1,143 +1,456 @@
 #include <uwsgi.h>
 
+#ifdef UWSGI_GEOIP_LEGACY
 #include <GeoIP.h>
 #include <GeoIPCity.h>
+#endif
+
+#ifdef UWSGI_GEOIP_MMDB
+#include <maxminddb.h>
+#endif
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	GeoIP route vars: ${geoip[country_code]}, ${geoip[city]}, ${geoip[asn]}...
+
+	databases are opened by the master (before fork()) and mmap()ed read-only, so every worker
+	shares the same (page cache) copy of them. Both the legacy GeoIP (.dat) format (--geoip-country, --geoip-city, --geoip-asn)
+	and the MaxMind DB (.mmdb) one (--geoip-mmdb, can be specified multiple times, e.g. for City + ASN) are supported.
+
+	every core keeps an LRU of the last looked up addresses (--geoip-cache-items, default 256) with all of the fields
+	already formatted, so the route vars do not need to allocate memory.
+
+*/
+
+struct uwsgi_geoip_record {
+	uint8_t addr[16];
+	uint32_t hash;
+	int found;
+	char continent[3];
+	char country_code[3];
+	char country_code3[4];
+	char country_name[64];
+	char region[8];
+	char region_name[64];
+	char city[64];
+	char postal_code[16];
+	char latitude[16];
+	char longitude[16];
+	char dma[12];
+	char area[12];
+	char asn[12];
+	char asn_name[128];
+	int prev;
+	int next;
+	int hnext;
+};
+
+struct uwsgi_geoip_cache {
+	int items;
+	int head;
+	int tail;
+	int *buckets;
+	struct uwsgi_geoip_record *records;
+};
 
 struct uwsgi_geoip {
 	char *country_db;
 	char *city_db;
+	char *asn_db;
+	struct uwsgi_string_list *mmdb;
+	int use_disk;
+	int cache_items;
+#ifdef UWSGI_GEOIP_LEGACY
 	GeoIP *country;
 	GeoIP *city;
-	int use_disk;
-	
+	GeoIP *asn;
+#endif
+#ifdef UWSGI_GEOIP_MMDB
+	MMDB_s *mmdbs;
+	int mmdbs_cnt;
+#endif
+	struct uwsgi_geoip_cache *caches;
 } ugeoip;
 
 struct uwsgi_option uwsgi_geoip_options[] = {
         {"geoip-country", required_argument, 0, "load the specified geoip country database", uwsgi_opt_set_str, &ugeoip.country_db, 0},
         {"geoip-city", required_argument, 0, "load the specified geoip city database", uwsgi_opt_set_str, &ugeoip.city_db, 0},
-        {"geoip-use-disk", no_argument, 0, "do not cache geoip databases in memory", uwsgi_opt_true, &ugeoip.use_disk, 0},
+        {"geoip-asn", required_argument, 0, "load the specified geoip ASN database", uwsgi_opt_set_str, &ugeoip.asn_db, 0},
+        {"geoip-mmdb", required_argument, 0, "load the specified MaxMind DB (mmdb) database", uwsgi_opt_add_string_list, &ugeoip.mmdb, 0},
+        {"geoip-use-disk", no_argument, 0, "do not map geoip databases in memory", uwsgi_opt_true, &ugeoip.use_disk, 0},
+        {"geoip-cache-items", required_argument, 0, "set the number of addresses cached by every core (default 256)", uwsgi_opt_set_int, &ugeoip.cache_items, 0},
 	UWSGI_END_OF_OPTIONS
 };
 
+#ifdef UWSGI_GEOIP_LEGACY
+static GeoIP *uwsgi_geoip_open(char *db, char *what) {
+	GeoIP *g = GeoIP_open(db, ugeoip.use_disk ? GEOIP_STANDARD : GEOIP_MMAP_CACHE);
+	if (!g) {
+		uwsgi_log("unable to open GeoIP %s database: %s\n", what, db);
+		exit(1);
+	}
+	return g;
+}
+#endif
+
 static int uwsgi_geoip_init() {
+#ifdef UWSGI_GEOIP_LEGACY
 	if (ugeoip.country_db) {
-		ugeoip.country = GeoIP_open(ugeoip.country_db, ugeoip.use_disk ? GEOIP_STANDARD : GEOIP_MEMORY_CACHE);
-		if (!ugeoip.country) {
-			uwsgi_log("unable to open GeoIP country database: %s\n", ugeoip.country_db);
-			exit(1);
-		}
+		ugeoip.country = uwsgi_geoip_open(ugeoip.country_db, "country");
 	}
 
 	if (ugeoip.city_db) {
-                ugeoip.city = GeoIP_open(ugeoip.city_db, ugeoip.use_disk ? GEOIP_STANDARD : GEOIP_MEMORY_CACHE);
-                if (!ugeoip.city) {
-                        uwsgi_log("unable to open GeoIP city database: %s\n", ugeoip.city_db);
-                        exit(1);
-                }
-        }
+		ugeoip.city = uwsgi_geoip_open(ugeoip.city_db, "city");
+	}
+
+	if (ugeoip.asn_db) {
+		ugeoip.asn = uwsgi_geoip_open(ugeoip.asn_db, "ASN");
+	}
+#else
+	if (ugeoip.country_db || ugeoip.city_db || ugeoip.asn_db) {
+		uwsgi_log("the geoip plugin has been built without legacy GeoIP support\n");
+		exit(1);
+	}
+#endif
+
+#ifdef UWSGI_GEOIP_MMDB
+	if (ugeoip.mmdb) {
+		int count = 0;
+		struct uwsgi_string_list *usl;
+		uwsgi_foreach(usl, ugeoip.mmdb) count++;
+		ugeoip.mmdbs = uwsgi_calloc(sizeof(MMDB_s) * count);
+		uwsgi_foreach(usl, ugeoip.mmdb) {
+			int ret = MMDB_open(usl->value, MMDB_MODE_MMAP, &ugeoip.mmdbs[ugeoip.mmdbs_cnt]);
+			if (ret != MMDB_SUCCESS) {
+				uwsgi_log("unable to open MaxMind database %s: %s\n", usl->value, MMDB_strerror(ret));
+				exit(1);
+			}
+			ugeoip.mmdbs_cnt++;
+		}
+	}
+#else
+	if (ugeoip.mmdb) {
+		uwsgi_log("the geoip plugin has been built without MaxMind DB (libmaxminddb) support\n");
+		exit(1);
+	}
+#endif
 	return 0;
 }
 
-static char *uwsgi_route_var_geoip(struct wsgi_request *wsgi_req, char *key, uint16_t keylen, uint16_t *vallen) {
+static void uwsgi_geoip_post_fork() {
+	if (!ugeoip.cache_items) ugeoip.cache_items = 256;
+	ugeoip.caches = uwsgi_calloc(sizeof(struct uwsgi_geoip_cache) * uwsgi.cores);
+	int i, j;
+	for(i=0;i<uwsgi.cores;i++) {
+		struct uwsgi_geoip_cache *ugc = &ugeoip.caches[i];
+		ugc->items = ugeoip.cache_items;
+		ugc->buckets = uwsgi_malloc(sizeof(int) * ugc->items);
+		ugc->records = uwsgi_calloc(sizeof(struct uwsgi_geoip_record) * ugc->items);
+		// all of the records start in the LRU list (unhashed)
+		for(j=0;j<ugc->items;j++) {
+			ugc->buckets[j] = -1;
+			ugc->records[j].prev = j - 1;
+			ugc->records[j].next = j + 1 < ugc->items ? j + 1 : -1;
+			ugc->records[j].hnext = -2;
+		}
+		ugc->head = 0;
+		ugc->tail = ugc->items - 1;
+	}
+}
+
+static void uwsgi_geoip_copy(char *dst, size_t dst_len, const char *src, size_t src_len) {
+	if (!src) return;
+	if (src_len >= dst_len) src_len = dst_len - 1;
+	memcpy(dst, src, src_len);
+	dst[src_len] = 0;
+}
+
+static void uwsgi_geoip_copy_str(char *dst, size_t dst_len, const char *src) {
+	if (src) uwsgi_geoip_copy(dst, dst_len, src, strlen(src));
+}
+
+#define uwsgi_geoip_set(field, value) uwsgi_geoip_copy_str(field, sizeof(field), value)
+
+#ifdef UWSGI_GEOIP_LEGACY
+static void uwsgi_geoip_lookup_legacy(struct uwsgi_geoip_record *ugr, int family, uint8_t *addr) {
+	// legacy databases are IPv4 only
+	if (family != AF_INET) return;
 	uint32_t ip;
-	char ip_str[16];
-	// should be enough for geo coords
-	char lonlat[64];
-	memset(ip_str, 0, 16);
-	memcpy(ip_str, wsgi_req->remote_addr, wsgi_req->remote_addr_len);
-	if (inet_pton(AF_INET, ip_str, &ip) <= 0) {
-		return NULL;
+	memcpy(&ip, addr + 12, 4);
+	ip = ntohl(ip);
+
+	// always prefer the city database
+	if (ugeoip.city) {
+		GeoIPRecord *gr = GeoIP_record_by_ipnum(ugeoip.city, ip);
+		if (gr) {
+			ugr->found = 1;
+			uwsgi_geoip_set(ugr->continent, gr->continent_code);
+			uwsgi_geoip_set(ugr->country_code, gr->country_code);
+			uwsgi_geoip_set(ugr->country_code3, gr->country_code3);
+			uwsgi_geoip_set(ugr->country_name, gr->country_name);
+			uwsgi_geoip_set(ugr->region, gr->region);
+			uwsgi_geoip_set(ugr->region_name, GeoIP_region_name_by_code(gr->country_code, gr->region));
+			uwsgi_geoip_set(ugr->city, gr->city);
+			uwsgi_geoip_set(ugr->postal_code, gr->postal_code);
+			snprintf(ugr->latitude, sizeof(ugr->latitude), "%f", gr->latitude);
+			snprintf(ugr->longitude, sizeof(ugr->longitude), "%f", gr->longitude);
+			snprintf(ugr->dma, sizeof(ugr->dma), "%d", gr->dma_code);
+			snprintf(ugr->area, sizeof(ugr->area), "%d", gr->area_code);
+			GeoIPRecord_delete(gr);
+		}
+	}
+	else if (ugeoip.country) {
+		const char *cc = GeoIP_country_code_by_ipnum(ugeoip.country, ip);
+		if (cc) {
+			ugr->found = 1;
+			uwsgi_geoip_set(ugr->country_code, cc);
+			uwsgi_geoip_set(ugr->country_code3, GeoIP_country_code3_by_ipnum(ugeoip.country, ip));
+			uwsgi_geoip_set(ugr->country_name, GeoIP_country_name_by_ipnum(ugeoip.country, ip));
+		}
 	}
-	ip = htonl(ip);
-	char *value = NULL;
-	// always prefer the city database;
-	GeoIP *g = ugeoip.city;
-	if (!g) {
-		g = ugeoip.country;
-		if (g) {
-			if (!uwsgi_strncmp(key, keylen, "country_code", 12)) {
-				value = (char *) GeoIP_country_code_by_ipnum(g, ip);
-			}
-			else if (!uwsgi_strncmp(key, keylen, "country_code3", 13)) {
-				value = (char *) GeoIP_country_code3_by_ipnum(g, ip);
-			}
-			else if (!uwsgi_strncmp(key, keylen, "country_name", 12)) {
-				value = (char *) GeoIP_country_name_by_ipnum(g, ip);
-			}
 
-			if (value) {
-				*vallen = strlen(value);
-				return uwsgi_str(value);
+	if (ugeoip.asn) {
+		// "AS<number> <organization>"
+		char *name = GeoIP_name_by_ipnum(ugeoip.asn, ip);
+		if (name) {
+			ugr->found = 1;
+			char *space = strchr(name, ' ');
+			if (!uwsgi_starts_with(name, strlen(name), "AS", 2)) {
+				uwsgi_geoip_copy(ugr->asn, sizeof(ugr->asn), name + 2, space ? (size_t) (space - (name + 2)) : strlen(name + 2));
 			}
+			if (space) uwsgi_geoip_set(ugr->asn_name, space + 1);
+			free(name);
+		}
+	}
+}
+#endif
+
+#ifdef UWSGI_GEOIP_MMDB
+static void uwsgi_geoip_mmdb_string(MMDB_entry_s *entry, char *dst, size_t dst_len, const char *const *path) {
+	if (*dst) return;
+	MMDB_entry_data_s ed;
+	if (MMDB_aget_value(entry, &ed, path) != MMDB_SUCCESS || !ed.has_data) return;
+	switch(ed.type) {
+		case MMDB_DATA_TYPE_UTF8_STRING:
+			uwsgi_geoip_copy(dst, dst_len, ed.utf8_string, ed.data_size);
+			break;
+		case MMDB_DATA_TYPE_DOUBLE:
+			snprintf(dst, dst_len, "%f", ed.double_value);
+			break;
+		case MMDB_DATA_TYPE_UINT16:
+			snprintf(dst, dst_len, "%u", ed.uint16);
+			break;
+		case MMDB_DATA_TYPE_UINT32:
+			snprintf(dst, dst_len, "%u", ed.uint32);
+			break;
+		default:
+			break;
+	}
+}
+
+static void uwsgi_geoip_lookup_mmdb(struct uwsgi_geoip_record *ugr, int family, uint8_t *addr) {
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} ua;
+	memset(&ua, 0, sizeof(ua));
+	if (family == AF_INET) {
+		ua.sin.sin_family = AF_INET;
+		memcpy(&ua.sin.sin_addr, addr + 12, 4);
+	}
+	else {
+		ua.sin6.sin6_family = AF_INET6;
+		memcpy(&ua.sin6.sin6_addr, addr, 16);
+	}
+
+	static const char *const continent[] = { "continent", "code", NULL };
+	static const char *const country_code[] = { "country", "iso_code", NULL };
+	static const char *const country_name[] = { "country", "names", "en", NULL };
+	static const char *const region[] = { "subdivisions", "0", "iso_code", NULL };
+	static const char *const region_name[] = { "subdivisions", "0", "names", "en", NULL };
+	static const char *const city[] = { "city", "names", "en", NULL };
+	static const char *const postal_code[] = { "postal", "code", NULL };
+	static const char *const latitude[] = { "location", "latitude", NULL };
+	static const char *const longitude[] = { "location", "longitude", NULL };
+	static const char *const dma[] = { "location", "metro_code", NULL };
+	static const char *const asn[] = { "autonomous_system_number", NULL };
+	static const char *const asn_name[] = { "autonomous_system_organization", NULL };
+
+	// the first database giving a value for a field wins
+	int i;
+	for(i=0;i<ugeoip.mmdbs_cnt;i++) {
+		int mmdb_error = 0;
+		MMDB_lookup_result_s r = MMDB_lookup_sockaddr(&ugeoip.mmdbs[i], &ua.sa, &mmdb_error);
+		if (mmdb_error != MMDB_SUCCESS || !r.found_entry) continue;
+		ugr->found = 1;
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->continent, sizeof(ugr->continent), continent);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->country_code, sizeof(ugr->country_code), country_code);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->country_name, sizeof(ugr->country_name), country_name);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->region, sizeof(ugr->region), region);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->region_name, sizeof(ugr->region_name), region_name);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->city, sizeof(ugr->city), city);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->postal_code, sizeof(ugr->postal_code), postal_code);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->latitude, sizeof(ugr->latitude), latitude);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->longitude, sizeof(ugr->longitude), longitude);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->dma, sizeof(ugr->dma), dma);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->asn, sizeof(ugr->asn), asn);
+		uwsgi_geoip_mmdb_string(&r.entry, ugr->asn_name, sizeof(ugr->asn_name), asn_name);
+	}
+}
+#endif
+
+// move a record to the head of the LRU list
+static void uwsgi_geoip_cache_touch(struct uwsgi_geoip_cache *ugc, int id) {
+	struct uwsgi_geoip_record *ugr = &ugc->records[id];
+	if (ugc->head == id) return;
+	// unlink
+	ugc->records[ugr->prev].next = ugr->next;
+	if (ugr->next >= 0) {
+		ugc->records[ugr->next].prev = ugr->prev;
+	}
+	else {
+		ugc->tail = ugr->prev;
+	}
+	// relink
+	ugr->prev = -1;
+	ugr->next = ugc->head;
+	ugc->records[ugc->head].prev = id;
+	ugc->head = id;
+}
+
+static void uwsgi_geoip_cache_unhash(struct uwsgi_geoip_cache *ugc, int id) {
+	struct uwsgi_geoip_record *ugr = &ugc->records[id];
+	if (ugr->hnext == -2) return;
+	int *ptr = &ugc->buckets[ugr->hash % ugc->items];
+	while(*ptr != id) {
+		ptr = &ugc->records[*ptr].hnext;
+	}
+	*ptr = ugr->hnext;
+	ugr->hnext = -2;
+}
+
+static struct uwsgi_geoip_record *uwsgi_geoip_lookup(struct wsgi_request *wsgi_req) {
+	char ip_str[INET6_ADDRSTRLEN];
+	uint8_t addr[16];
+	int family = AF_INET;
+
+	// not a worker
+	if (!ugeoip.caches) return NULL;
+	if (wsgi_req->remote_addr_len == 0 || wsgi_req->remote_addr_len >= INET6_ADDRSTRLEN) return NULL;
+	memcpy(ip_str, wsgi_req->remote_addr, wsgi_req->remote_addr_len);
+	ip_str[wsgi_req->remote_addr_len] = 0;
+
+	// IPv4 addresses are stored as IPv4-mapped IPv6 ones
+	memset(addr, 0, 10);
+	addr[10] = 0xff;
+	addr[11] = 0xff;
+	if (inet_pton(AF_INET, ip_str, addr + 12) <= 0) {
+		if (inet_pton(AF_INET6, ip_str, addr) <= 0) return NULL;
+		family = AF_INET6;
+	}
+
+	struct uwsgi_geoip_cache *ugc = &ugeoip.caches[wsgi_req->async_id];
+	uint32_t hash = djb33x_hash((char *) addr, 16);
+	int id = ugc->buckets[hash % ugc->items];
+	while(id >= 0) {
+		struct uwsgi_geoip_record *ugr = &ugc->records[id];
+		if (ugr->hash == hash && !memcmp(ugr->addr, addr, 16)) {
+			uwsgi_geoip_cache_touch(ugc, id);
+			return ugr;
 		}
-		return NULL;
+		id = ugr->hnext;
 	}
 
-	GeoIPRecord  *gr = GeoIP_record_by_ipnum(g, ip);
-	if (!gr) return NULL; 
+	// reuse the least recently used record
+	id = ugc->tail;
+	uwsgi_geoip_cache_unhash(ugc, id);
+	struct uwsgi_geoip_record *ugr = &ugc->records[id];
+	int prev = ugr->prev, next = ugr->next;
+	memset(ugr, 0, sizeof(struct uwsgi_geoip_record));
+	ugr->prev = prev;
+	ugr->next = next;
+	memcpy(ugr->addr, addr, 16);
+	ugr->hash = hash;
+
+#ifdef UWSGI_GEOIP_MMDB
+	uwsgi_geoip_lookup_mmdb(ugr, family, addr);
+#endif
+#ifdef UWSGI_GEOIP_LEGACY
+	uwsgi_geoip_lookup_legacy(ugr, family, addr);
+#endif
+
+	// misses are cached too
+	ugr->hnext = ugc->buckets[hash % ugc->items];
+	ugc->buckets[hash % ugc->items] = id;
+	uwsgi_geoip_cache_touch(ugc, id);
+	return ugr;
+}
+
+static char *uwsgi_route_var_geoip(struct wsgi_request *wsgi_req, char *key, uint16_t keylen, uint16_t *vallen) {
+	struct uwsgi_geoip_record *ugr = uwsgi_geoip_lookup(wsgi_req);
+	if (!ugr || !ugr->found) return NULL;
 
-	// ok let's generate the output
+	char *value = NULL;
 	if (!uwsgi_strncmp(key, keylen, "continent", 9)) {
-		value = gr->continent_code;
+		value = ugr->continent;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "country_code", 12)) {
-		value = gr->country_code;
+		value = ugr->country_code;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "country_code3", 13)) {
-		value = gr->country_code3;
+		value = ugr->country_code3;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "country_name", 12)) {
-		value = gr->country_name;
+		value = ugr->country_name;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "region", 6)) {
-		value = gr->region;
+		value = ugr->region;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "region_name", 11)) {
-		value = (char *) GeoIP_region_name_by_code(gr->country_code, gr->region);
+		value = ugr->region_name;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "city", 4)) {
-		value = gr->city;
+		value = ugr->city;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "postal_code", 11)) {
-		value = gr->postal_code;
+		value = ugr->postal_code;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "latitude", 8) || !uwsgi_strncmp(key, keylen, "lat", 3)) {
-		snprintf(lonlat, 64, "%f", gr->latitude);
-		value = lonlat;
+		value = ugr->latitude;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "longitude", 9) || !uwsgi_strncmp(key, keylen, "lon", 3)) {
-		snprintf(lonlat, 64, "%f", gr->longitude);
-		value = lonlat;
+		value = ugr->longitude;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "dma", 3)) {
-		snprintf(lonlat, 64, "%d", gr->dma_code);
-		value = lonlat;
+		value = ugr->dma;
 	}
 	else if (!uwsgi_strncmp(key, keylen, "area", 4)) {
-		snprintf(lonlat, 64, "%d", gr->area_code);
-		value = lonlat;
+		value = ugr->area;
 	}
-
-	
-	if (value) {
-		*vallen = strlen(value);
-                char *ret = uwsgi_str(value);
-		GeoIPRecord_delete(gr);
-		return ret;
+	else if (!uwsgi_strncmp(key, keylen, "asn", 3)) {
+		value = ugr->asn;
+	}
+	else if (!uwsgi_strncmp(key, keylen, "asn_name", 8)) {
+		value = ugr->asn_name;
 	}
 
-	GeoIPRecord_delete(gr);
-	return NULL;
+	if (!value || !*value) return NULL;
+	// the record lives in the core cache, no need to copy it
+	*vallen = strlen(value);
+	return value;
 }
 
 static void register_route_vars_geoip() {
-	struct uwsgi_route_var *urv = uwsgi_register_route_var("geoip", uwsgi_route_var_geoip);
-	urv->need_free = 1;
+	uwsgi_register_route_var("geoip", uwsgi_route_var_geoip);
 }
 
 struct uwsgi_plugin geoip_plugin = {
 	.name = "geoip",
 	.options = uwsgi_geoip_options,
 	.init = uwsgi_geoip_init,
+	.post_fork = uwsgi_geoip_post_fork,
 	.on_load = register_route_vars_geoip,
 };
@@ -2,6 +2,35 @@ NAME = 'geoip'
 
 CFLAGS = []
 LDFLAGS = []
-LIBS = ['-lGeoIP']
+LIBS = []
 
 GCC_LIST = ['geoip']
+
+import __main__
+has_geoip_legacy = __main__.test_snippet("""
+#include <GeoIP.h>
+int main()
+{
+    GeoIP *g = GeoIP_open("", GEOIP_MMAP_CACHE);
+    return g == NULL;
+}
+""", LIBS=['-lGeoIP'])
+has_maxminddb = __main__.test_snippet("""
+#include <maxminddb.h>
+int main()
+{
+    MMDB_s mmdb;
+    return MMDB_open("", MMDB_MODE_MMAP, &mmdb);
+}
+""", LIBS=['-lmaxminddb'])
+
+if has_geoip_legacy:
+    CFLAGS.append('-DUWSGI_GEOIP_LEGACY')
+    LIBS.append('-lGeoIP')
+if has_maxminddb:
+    CFLAGS.append('-DUWSGI_GEOIP_MMDB')
+    LIBS.append('-lmaxminddb')
+# keep the old behaviour (and error) when no library is available
+if not has_geoip_legacy and not has_maxminddb:
+    CFLAGS.append('-DUWSGI_GEOIP_LEGACY')
+    LIBS.append('-lGeoIP')
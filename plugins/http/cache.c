@@ -0,0 +1,247 @@
+/*
+
+   uWSGI HTTP router response cache
+
+   GET responses are stored (raw, as the backend generated them) in a local uWSGI cache
+   keyed by Host + REQUEST_URI, and served directly from the router on the following requests.
+
+   Only responses with a 200 status, a Content-Length and without Set-Cookie/Vary are stored,
+   for the time allowed by Cache-Control (s-maxage or max-age, or --http-cache-expires on
+   responses without Cache-Control).
+
+*/
+
+#include "common.h"
+
+extern struct uwsgi_http uhttp;
+
+struct hr_cache_control {
+	int no_store;
+	int no_cache;
+	int private;
+	int64_t max_age;
+	int64_t s_maxage;
+};
+
+static void hr_cache_control_parse(char *buf, size_t len, struct hr_cache_control *hcc) {
+	char *ptr = buf;
+	char *end = buf + len;
+	while (ptr < end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == ',')) ptr++;
+		char *directive = ptr;
+		while (ptr < end && *ptr != ',') ptr++;
+		size_t dlen = ptr - directive;
+		while (dlen > 0 && (directive[dlen-1] == ' ' || directive[dlen-1] == '\t')) dlen--;
+		if (!dlen) continue;
+
+		if (!uwsgi_strnicmp(directive, dlen, "no-store", 8)) {
+			hcc->no_store = 1;
+		}
+		else if (!uwsgi_strnicmp(directive, dlen, "no-cache", 8)) {
+			hcc->no_cache = 1;
+		}
+		else if (!uwsgi_strnicmp(directive, dlen, "private", 7)) {
+			hcc->private = 1;
+		}
+		else if (dlen > 8 && !uwsgi_strnicmp(directive, 8, "max-age=", 8)) {
+			hcc->max_age = uwsgi_str_num(directive + 8, dlen - 8);
+		}
+		else if (dlen > 9 && !uwsgi_strnicmp(directive, 9, "s-maxage=", 9)) {
+			hcc->s_maxage = uwsgi_str_num(directive + 9, dlen - 9);
+		}
+	}
+}
+
+// check a request header (called by the parser only for cacheable requests)
+void hr_cache_request_header(struct http_session *hr, char *hh, size_t hhlen) {
+	char *colon = memchr(hh, ':', hhlen);
+	if (!colon) return;
+	size_t keylen = colon - hh;
+	char *value = colon + 1;
+	while (value < hh + hhlen && (*value == ' ' || *value == '\t')) value++;
+	size_t vallen = (hh + hhlen) - value;
+
+	if (!uwsgi_strnicmp(hh, keylen, "Authorization", 13) ||
+		!uwsgi_strnicmp(hh, keylen, "Transfer-Encoding", 17) ||
+		!uwsgi_strnicmp(hh, keylen, "Upgrade", 7)) {
+		hr->cacheable = 0;
+	}
+	else if (!uwsgi_strnicmp(hh, keylen, "Content-Length", 14)) {
+		if (uwsgi_str_num(value, vallen) > 0) hr->cacheable = 0;
+	}
+	else if (!uwsgi_strnicmp(hh, keylen, "Cache-Control", 13)) {
+		struct hr_cache_control hcc = { .max_age = -1, .s_maxage = -1 };
+		hr_cache_control_parse(value, vallen, &hcc);
+		if (hcc.no_store) {
+			hr->cacheable = 0;
+		}
+		// the client wants a fresh response, it can still be stored
+		else if (hcc.no_cache || hcc.max_age == 0) {
+			hr->cache_refresh = 1;
+		}
+	}
+	else if (!uwsgi_strnicmp(hh, keylen, "Pragma", 6)) {
+		if (uwsgi_contains_n(value, vallen, "no-cache", 8)) hr->cache_refresh = 1;
+	}
+}
+
+/*
+	lookup the response of the request in the cache
+
+	returns 1 if the response has been served from the cache, 0 on miss
+	(the backend response will be collected for the cache) and -1 on error
+*/
+int hr_cache_serve(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	struct corerouter_peer *main_peer = peer->session->main_peer;
+
+	if (!hr->cache_key) {
+		hr->cache_key = uwsgi_buffer_new(peer->key_len + hr->request_uri_len);
+	}
+	hr->cache_key->pos = 0;
+	if (uwsgi_buffer_append(hr->cache_key, peer->key, peer->key_len)) return -1;
+	if (uwsgi_buffer_append(hr->cache_key, hr->request_uri, hr->request_uri_len)) return -1;
+	if (hr->cache_key->pos > uhttp.response_cache_uc->keysize) return 0;
+
+	char *value = NULL;
+	uint64_t vallen = 0;
+	if (!hr->cache_refresh) {
+		uint64_t expires = 0;
+		value = uwsgi_cache_magic_get(hr->cache_key->buf, hr->cache_key->pos, &vallen, &expires, uhttp.response_cache);
+		if (value) {
+			if (!expires || expires > (uint64_t) uwsgi_now()) {
+				goto hit;
+			}
+			free(value);
+		}
+	}
+
+	hr->cache_response = uwsgi_buffer_new(uwsgi.page_size);
+	hr->cache_response->limit = uhttp.response_cache_uc->max_item_size;
+	hr->cache_remains = -1;
+	return 0;
+
+hit:
+	hr->cache_response = uwsgi_buffer_new(0);
+	uwsgi_buffer_map(hr->cache_response, value, vallen);
+	hr->cache_remains = 0;
+
+	// the backend peer is not needed
+	corerouter_drop_peer(peer->session->corerouter, peer);
+
+	// stored responses of HTTP/1.0 clients cannot be used for keepalive
+	if (hr->session.can_keepalive && uwsgi_starts_with(value, vallen, "HTTP/1.1 ", 9)) {
+		hr->session.can_keepalive = 0;
+	}
+
+	// the request is over, prepare for the next one
+	hr->rnrn = 0;
+	main_peer->in->pos = 0;
+	if (hr->session.can_keepalive) {
+		http_set_timeout(main_peer, uhttp.keepalive > 1 ? uhttp.keepalive : uhttp.cr.socket_timeout);
+	}
+	else {
+		http_set_timeout(main_peer, uhttp.cr.socket_timeout);
+		hr->session.wait_full_write = 1;
+	}
+
+	main_peer->out = hr->cache_response;
+	main_peer->out_pos = 0;
+	if (uwsgi_cr_set_hooks(main_peer, NULL, hr->func_write)) return -1;
+	return 1;
+}
+
+/*
+	parse the headers of the collected backend response
+
+	returns 1 if the response can be stored, 0 if the headers are not complete and -1 if
+	the response cannot be stored
+*/
+static int hr_cache_response_headers(struct http_session *hr) {
+	struct uwsgi_buffer *ub = hr->cache_response;
+	char *buf = ub->buf;
+	size_t i;
+	size_t headers_len = 0;
+	for(i=3;i<ub->pos;i++) {
+		if (buf[i] == '\n' && buf[i-1] == '\r' && buf[i-2] == '\n' && buf[i-3] == '\r') {
+			headers_len = i + 1;
+			break;
+		}
+	}
+	if (!headers_len) return ub->pos > UMAX16 ? -1 : 0;
+
+	if (headers_len < 13 || uwsgi_starts_with(buf, headers_len, "HTTP/1.", 7) || memcmp(buf + 8, " 200", 4)) return -1;
+
+	struct hr_cache_control hcc = { .max_age = -1, .s_maxage = -1 };
+	int has_cache_control = 0;
+	int64_t size = -1;
+	char *key = memchr(buf, '\n', headers_len);
+	while (key && ++key < buf + headers_len - 2) {
+		char *eol = memchr(key, '\r', headers_len - (key - buf));
+		if (!eol) return -1;
+		char *colon = memchr(key, ':', eol - key);
+		if (!colon) return -1;
+		char *value = colon + 1;
+		while (value < eol && *value == ' ') value++;
+		if (!uwsgi_strnicmp(key, colon-key, "Content-Length", 14)) {
+			size = uwsgi_str_num(value, eol - value);
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Cache-Control", 13)) {
+			has_cache_control = 1;
+			hr_cache_control_parse(value, eol - value, &hcc);
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Transfer-Encoding", 17) ||
+			!uwsgi_strnicmp(key, colon-key, "Set-Cookie", 10) ||
+			!uwsgi_strnicmp(key, colon-key, "Vary", 4)) {
+			return -1;
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Connection", 10) && !uwsgi_strnicmp(value, eol - value, "close", 5)) {
+			return -1;
+		}
+		key = eol + 1;
+	}
+
+	if (size < 0) return -1;
+	if (hcc.no_store || hcc.no_cache || hcc.private) return -1;
+
+	if (hcc.s_maxage >= 0) {
+		hr->cache_expires = hcc.s_maxage;
+	}
+	else if (hcc.max_age >= 0) {
+		hr->cache_expires = hcc.max_age;
+	}
+	else if (!has_cache_control) {
+		hr->cache_expires = uhttp.response_cache_expires;
+	}
+	else {
+		return -1;
+	}
+	if (!hr->cache_expires) return -1;
+
+	hr->cache_remains = size - (int64_t) (ub->pos - headers_len);
+	if (hr->cache_remains < 0) return -1;
+	return 1;
+}
+
+// collect a chunk of the backend response, storing it in the cache when complete
+void hr_cache_collect(struct http_session *hr, char *buf, size_t len) {
+	if (uwsgi_buffer_append(hr->cache_response, buf, len)) goto drop;
+
+	if (hr->cache_remains < 0) {
+		int ret = hr_cache_response_headers(hr);
+		if (ret < 0) goto drop;
+		if (ret == 0) return;
+	}
+	else {
+		hr->cache_remains -= len;
+		if (hr->cache_remains < 0) goto drop;
+	}
+
+	if (hr->cache_remains > 0) return;
+
+	uwsgi_cache_magic_set(hr->cache_key->buf, hr->cache_key->pos, hr->cache_response->buf, hr->cache_response->pos, hr->cache_expires, UWSGI_CACHE_FLAG_UPDATE, uhttp.response_cache);
+
+drop:
+	uwsgi_buffer_destroy(hr->cache_response);
+	hr->cache_response = NULL;
+}
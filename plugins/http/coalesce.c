@@ -0,0 +1,415 @@
+/*
+
+   uWSGI HTTP router request coalescing
+
+   identical GET requests (same Host, REQUEST_URI and values of the --http-coalesce-header headers,
+   Accept-Encoding by default) arriving while the first one (the leader) is waiting for its backend
+   are not forwarded: they wait for the response of the leader, collected by the router and sent to
+   all of them as soon as it is complete.
+
+   Requests with a body, conditional/range requests and requests with Authorization or Cookie
+   (unless they are part of the key) are never coalesced.
+
+   Responses with Set-Cookie, Cache-Control private or no-store, a Vary header not covered by the key,
+   truncated or bigger than --http-coalesce-max-size are not shared: the waiting requests are forwarded
+   to the backends as usual (as when the leader session dies before its response is complete).
+
+   When the response starts arriving and nobody is waiting for it, the leader stops accepting new
+   waiters (the response is streamed without copies).
+
+   The in-flight requests live in the memory of every router thread, so only requests managed by
+   the same process and thread are coalesced.
+
+*/
+
+#include "common.h"
+
+extern struct uwsgi_http uhttp;
+
+#define HR_COALESCE_BUCKETS 4096
+
+#define HR_COALESCE_LEADER 1
+#define HR_COALESCE_WAITING 2
+#define HR_COALESCE_SERVED 3
+
+struct hr_coalesce_entry {
+	char *key;
+	size_t key_len;
+	// new identical requests can wait for the response
+	int linked;
+	// the leader and the sessions sending the response
+	uint64_t refs;
+	struct http_session *waiters;
+	struct uwsgi_buffer *response;
+	// the response can be followed by another request on the same connection
+	int keepalive;
+	struct hr_coalesce_entry *next;
+};
+
+static __thread struct hr_coalesce_entry **hr_coalesce_entries;
+
+// check a request header (called by the parser only for coalescing candidates)
+void hr_coalesce_request_header(struct http_session *hr, char *hh, size_t hhlen) {
+	char *colon = memchr(hh, ':', hhlen);
+	if (!colon) return;
+	size_t keylen = colon - hh;
+	char *value = colon + 1;
+	while (value < hh + hhlen && (*value == ' ' || *value == '\t')) value++;
+	size_t vallen = (hh + hhlen) - value;
+
+	int i = 0;
+	struct uwsgi_string_list *usl = uhttp.coalesce_headers;
+	while(usl) {
+		if (!uwsgi_strnicmp(hh, keylen, usl->value, usl->len)) {
+			hr->coalesce_values[i] = value;
+			hr->coalesce_values_len[i] = vallen;
+			return;
+		}
+		i++;
+		usl = usl->next;
+	}
+
+	if (!uwsgi_strnicmp(hh, keylen, "Authorization", 13) ||
+		!uwsgi_strnicmp(hh, keylen, "Cookie", 6) ||
+		!uwsgi_strnicmp(hh, keylen, "Range", 5) ||
+		!uwsgi_strnicmp(hh, keylen, "If-None-Match", 13) ||
+		!uwsgi_strnicmp(hh, keylen, "If-Modified-Since", 17) ||
+		!uwsgi_strnicmp(hh, keylen, "Transfer-Encoding", 17) ||
+		!uwsgi_strnicmp(hh, keylen, "Upgrade", 7)) {
+		hr->coalesce_candidate = 0;
+	}
+	else if (!uwsgi_strnicmp(hh, keylen, "Content-Length", 14)) {
+		if (uwsgi_str_num(value, vallen) > 0) hr->coalesce_candidate = 0;
+	}
+}
+
+static void hr_coalesce_unlink(struct hr_coalesce_entry *entry) {
+	if (!entry->linked) return;
+	uint32_t slot = djb33x_hash(entry->key, entry->key_len) % HR_COALESCE_BUCKETS;
+	struct hr_coalesce_entry **prev = &hr_coalesce_entries[slot];
+	while(*prev) {
+		if (*prev == entry) {
+			*prev = entry->next;
+			break;
+		}
+		prev = &(*prev)->next;
+	}
+	entry->linked = 0;
+}
+
+static void hr_coalesce_put(struct hr_coalesce_entry *entry) {
+	if (--entry->refs > 0) return;
+	hr_coalesce_unlink(entry);
+	uwsgi_buffer_destroy(entry->response);
+	free(entry->key);
+	free(entry);
+}
+
+static int hr_coalesce_vary_match(char *token, size_t len) {
+	struct uwsgi_string_list *usl = uhttp.coalesce_headers;
+	while(usl) {
+		if (!uwsgi_strnicmp(token, len, usl->value, usl->len)) return 1;
+		usl = usl->next;
+	}
+	return 0;
+}
+
+/*
+	check the headers of the collected response
+
+	returns 0 if the response can be sent to the waiting requests, -1 otherwise
+*/
+static int hr_coalesce_response_check(struct hr_coalesce_entry *entry) {
+	struct uwsgi_buffer *ub = entry->response;
+	char *buf = ub->buf;
+	size_t i;
+	size_t headers_len = 0;
+	for(i=3;i<ub->pos;i++) {
+		if (buf[i] == '\n' && buf[i-1] == '\r' && buf[i-2] == '\n' && buf[i-3] == '\r') {
+			headers_len = i + 1;
+			break;
+		}
+	}
+	if (headers_len < 13 || uwsgi_starts_with(buf, headers_len, "HTTP/1.", 7)) return -1;
+
+	int64_t size = -1;
+	int chunked = 0;
+	int close_conn = 0;
+	char *key = memchr(buf, '\n', headers_len);
+	while (key && ++key < buf + headers_len - 2) {
+		char *eol = memchr(key, '\r', headers_len - (key - buf));
+		if (!eol) return -1;
+		char *colon = memchr(key, ':', eol - key);
+		if (!colon) return -1;
+		char *value = colon + 1;
+		while (value < eol && *value == ' ') value++;
+		size_t vallen = eol - value;
+		if (!uwsgi_strnicmp(key, colon-key, "Content-Length", 14)) {
+			size = uwsgi_str_num(value, vallen);
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Set-Cookie", 10)) {
+			return -1;
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Cache-Control", 13)) {
+			if (uwsgi_contains_n(value, vallen, "private", 7) || uwsgi_contains_n(value, vallen, "no-store", 8)) return -1;
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Vary", 4)) {
+			// every header the response depends on must be part of the key
+			char *ptr = value;
+			while (ptr < eol) {
+				while (ptr < eol && (*ptr == ' ' || *ptr == '\t' || *ptr == ',')) ptr++;
+				char *token = ptr;
+				while (ptr < eol && *ptr != ',') ptr++;
+				size_t tlen = ptr - token;
+				while (tlen > 0 && (token[tlen-1] == ' ' || token[tlen-1] == '\t')) tlen--;
+				if (!tlen) continue;
+				if (!hr_coalesce_vary_match(token, tlen)) return -1;
+			}
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Transfer-Encoding", 17)) {
+			chunked = 1;
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Connection", 10) && !uwsgi_strnicmp(value, vallen, "close", 5)) {
+			close_conn = 1;
+		}
+		key = eol + 1;
+	}
+
+	if (size >= 0) {
+		// truncated
+		if (ub->pos - headers_len < (uint64_t) size) return -1;
+		ub->pos = headers_len + size;
+	}
+
+	// only the responses with a known size can be followed by another request
+	entry->keepalive = size >= 0 && !chunked && !close_conn && !uwsgi_starts_with(buf, headers_len, "HTTP/1.1 ", 9);
+	return 0;
+}
+
+/*
+	called before connecting the backend peer of a coalescing candidate
+
+	returns 1 if the request is waiting for an identical one (the peer must not be connected),
+	0 if it must be forwarded (the following identical requests will wait for it) and -1 on error
+*/
+int hr_coalesce(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	struct corerouter_peer *main_peer = peer->session->main_peer;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(peer->key_len + hr->request_uri_len + 64);
+	if (uwsgi_buffer_append(ub, peer->key, peer->key_len)) goto error;
+	if (uwsgi_buffer_append(ub, " ", 1)) goto error;
+	if (uwsgi_buffer_append(ub, hr->request_uri, hr->request_uri_len)) goto error;
+	int i;
+	for(i=0;i<uhttp.coalesce_headers_count;i++) {
+		// header values cannot contain newlines
+		if (uwsgi_buffer_append(ub, "\n", 1)) goto error;
+		if (uwsgi_buffer_append(ub, hr->coalesce_values[i], hr->coalesce_values_len[i])) goto error;
+	}
+
+	if (!hr_coalesce_entries) {
+		hr_coalesce_entries = uwsgi_calloc(sizeof(struct hr_coalesce_entry *) * HR_COALESCE_BUCKETS);
+	}
+
+	uint32_t slot = djb33x_hash(ub->buf, ub->pos) % HR_COALESCE_BUCKETS;
+	struct hr_coalesce_entry *entry = hr_coalesce_entries[slot];
+	while(entry) {
+		if (!uwsgi_strncmp(entry->key, entry->key_len, ub->buf, ub->pos)) break;
+		entry = entry->next;
+	}
+
+	if (entry) {
+		uwsgi_buffer_destroy(ub);
+		hr->coalesce = entry;
+		hr->coalesce_state = HR_COALESCE_WAITING;
+		hr->coalesce_prev = NULL;
+		hr->coalesce_next = entry->waiters;
+		if (entry->waiters) entry->waiters->coalesce_prev = hr;
+		entry->waiters = hr;
+		// the waiting peer timing out destroys the session
+		hr->coalesce_keepalive = hr->session.can_keepalive;
+		hr->session.can_keepalive = 0;
+		// the client is not read until the response is ready
+		if (uwsgi_cr_set_hooks(main_peer, NULL, NULL)) return -1;
+		http_set_timeout(main_peer, uhttp.cr.socket_timeout);
+		return 1;
+	}
+
+	entry = uwsgi_calloc(sizeof(struct hr_coalesce_entry));
+	entry->key = uwsgi_concat2n(ub->buf, ub->pos, "", 0);
+	entry->key_len = ub->pos;
+	uwsgi_buffer_destroy(ub);
+	entry->response = uwsgi_buffer_new(uwsgi.page_size);
+	entry->response->limit = uhttp.coalesce_max_size;
+	entry->refs = 1;
+	entry->linked = 1;
+	entry->next = hr_coalesce_entries[slot];
+	hr_coalesce_entries[slot] = entry;
+	hr->coalesce = entry;
+	hr->coalesce_state = HR_COALESCE_LEADER;
+	return 0;
+
+error:
+	uwsgi_buffer_destroy(ub);
+	return -1;
+}
+
+static int hr_coalesce_connect(struct corerouter_peer *peer) {
+	http_set_timeout(peer, uhttp.connect_timeout);
+	cr_connect(peer, hr_instance_connected);
+	return 0;
+}
+
+// the response cannot be shared, send the waiting request to a backend
+static void hr_coalesce_forward(struct http_session *hr) {
+	struct uwsgi_corerouter *ucr = hr->session.corerouter;
+	struct corerouter_peer *peer = hr->session.peers;
+	hr->coalesce = NULL;
+	hr->coalesce_state = 0;
+	hr->session.can_keepalive = hr->coalesce_keepalive;
+	if (!peer) {
+		corerouter_close_session(ucr, &hr->session);
+		return;
+	}
+	if (hr_coalesce_connect(peer)) {
+		hr->session.can_keepalive = 0;
+		// try another node (or destroy the session)
+		if (peer->failed) {
+			corerouter_close_peer(ucr, peer);
+		}
+		else {
+			corerouter_close_session(ucr, &hr->session);
+		}
+	}
+}
+
+// send the response of the leader to a waiting request
+static int hr_coalesce_serve(struct http_session *hr, struct hr_coalesce_entry *entry) {
+	struct corerouter_peer *main_peer = hr->session.main_peer;
+	struct uwsgi_corerouter *ucr = hr->session.corerouter;
+
+	hr->coalesce_state = HR_COALESCE_SERVED;
+	entry->refs++;
+
+	// the backend peer is not needed
+	if (hr->session.peers) {
+		corerouter_drop_peer(ucr, hr->session.peers);
+	}
+
+	// the response memory is shared by all of the waiters
+	hr->coalesce_out.buf = entry->response->buf;
+	hr->coalesce_out.pos = entry->response->pos;
+	hr->coalesce_out.len = entry->response->pos;
+
+	if (hr->coalesce_keepalive && entry->keepalive) {
+		// the request is over, prepare for the next one
+		hr->session.can_keepalive = 1;
+		hr->rnrn = 0;
+		main_peer->in->pos = 0;
+		main_peer->disabled = 0;
+		http_set_timeout(main_peer, uhttp.keepalive > 1 ? uhttp.keepalive : uhttp.cr.socket_timeout);
+	}
+	else {
+		http_set_timeout(main_peer, uhttp.cr.socket_timeout);
+		hr->session.wait_full_write = 1;
+	}
+
+	main_peer->out = &hr->coalesce_out;
+	main_peer->out_pos = 0;
+	return uwsgi_cr_set_hooks(main_peer, NULL, hr->func_write);
+}
+
+// the leader is done: share its response (if complete and allowed) or forward the waiting requests
+static void hr_coalesce_leader_done(struct http_session *hr, int complete) {
+	struct hr_coalesce_entry *entry = hr->coalesce;
+	struct uwsgi_corerouter *ucr = hr->session.corerouter;
+	hr->coalesce = NULL;
+	hr->coalesce_state = 0;
+	hr_coalesce_unlink(entry);
+
+	int shared = complete && entry->waiters && !hr_coalesce_response_check(entry);
+	struct http_session *waiter = entry->waiters;
+	entry->waiters = NULL;
+	while(waiter) {
+		// the session could be destroyed
+		struct http_session *next = waiter->coalesce_next;
+		waiter->coalesce_prev = NULL;
+		waiter->coalesce_next = NULL;
+		if (shared) {
+			if (hr_coalesce_serve(waiter, entry)) {
+				corerouter_close_session(ucr, &waiter->session);
+			}
+			else {
+				ucr->coalesced++;
+			}
+		}
+		else {
+			hr_coalesce_forward(waiter);
+		}
+		waiter = next;
+	}
+
+	hr_coalesce_put(entry);
+}
+
+// collect a chunk of the response of the leader
+void hr_coalesce_collect(struct http_session *hr, char *buf, size_t len) {
+	if (hr->coalesce_state != HR_COALESCE_LEADER) return;
+	struct hr_coalesce_entry *entry = hr->coalesce;
+	// nobody is waiting, do not waste memory
+	if (!entry->waiters || uwsgi_buffer_append(entry->response, buf, len)) {
+		hr_coalesce_leader_done(hr, 0);
+	}
+}
+
+// the backend response of the leader is complete
+void hr_coalesce_complete(struct http_session *hr) {
+	if (hr->coalesce_state != HR_COALESCE_LEADER) return;
+	hr_coalesce_leader_done(hr, 1);
+}
+
+// the request is over (or the session is closing)
+void hr_coalesce_release(struct http_session *hr) {
+	struct hr_coalesce_entry *entry = hr->coalesce;
+	if (!entry) return;
+	switch(hr->coalesce_state) {
+		case HR_COALESCE_LEADER:
+			hr_coalesce_leader_done(hr, 0);
+			return;
+		case HR_COALESCE_WAITING:
+			if (hr->coalesce_prev) hr->coalesce_prev->coalesce_next = hr->coalesce_next;
+			else entry->waiters = hr->coalesce_next;
+			if (hr->coalesce_next) hr->coalesce_next->coalesce_prev = hr->coalesce_prev;
+			hr->coalesce_prev = NULL;
+			hr->coalesce_next = NULL;
+			break;
+		case HR_COALESCE_SERVED:
+			hr->coalesce_out.buf = NULL;
+			hr->coalesce_out.pos = 0;
+			hr->coalesce_out.len = 0;
+			hr_coalesce_put(entry);
+			break;
+		default:
+			break;
+	}
+	hr->coalesce = NULL;
+	hr->coalesce_state = 0;
+}
+
+void hr_coalesce_init() {
+	if (!uhttp.cr.coalesce) return;
+
+	if (!uhttp.coalesce_headers) {
+		uwsgi_string_new_list(&uhttp.coalesce_headers, "Accept-Encoding");
+	}
+	struct uwsgi_string_list *usl = uhttp.coalesce_headers;
+	while(usl) {
+		uhttp.coalesce_headers_count++;
+		usl = usl->next;
+	}
+	if (uhttp.coalesce_headers_count > HR_COALESCE_MAX_HEADERS) {
+		uwsgi_log("the http router can coalesce requests by at most %d headers\n", HR_COALESCE_MAX_HEADERS);
+		exit(1);
+	}
+	if (!uhttp.coalesce_max_size) uhttp.coalesce_max_size = 1024 * 1024;
+}
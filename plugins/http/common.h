@@ -12,6 +12,15 @@ extern struct uwsgi_server uwsgi;
 #endif
 #endif
 
+#ifdef UWSGI_SSL
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+#define UWSGI_HTTP2
+#endif
+#endif
+
+// max number of request headers in the key of coalesced requests
+#define HR_COALESCE_MAX_HEADERS 8
+
 struct uwsgi_http {
 
         struct uwsgi_corerouter cr;
@@ -25,11 +34,15 @@ struct uwsgi_http {
         int keepalive;
         int auto_chunked;
         int auto_gzip;
+	struct uwsgi_string_list *gzip_types;
+	uint64_t gzip_min_size;
+	int gzip_level;
 
         int websockets;
 #ifdef UWSGI_SSL
         char *https_session_context;
         int https_export_cert;
+        int https_handshake_threads;
 #endif
 
         struct uwsgi_string_list *stud_prefix;
@@ -40,6 +53,10 @@ struct uwsgi_http {
 	size_t spdy3_settings_size;
 #endif
 
+#ifdef UWSGI_HTTP2
+	int http2_index;
+#endif
+
 	int server_name_as_http_host;
 
 	int headers_timeout;
@@ -51,6 +68,28 @@ struct uwsgi_http {
 
 	int proto_http;
 
+	char *chash_header;
+	size_t chash_header_len;
+
+	// local cache used for storing responses
+	char *response_cache;
+	struct uwsgi_cache *response_cache_uc;
+	uint64_t response_cache_expires;
+
+	// websockets terminated in the router (channels fed by the workers)
+	char *websockets_hub;
+	size_t websockets_hub_len;
+	char *websockets_hub_socket;
+	int websockets_hub_ping;
+	uint64_t websockets_hub_max_pending;
+	uint64_t websockets_hub_subscribers;
+	uint64_t websockets_hub_published;
+
+	// identical concurrent GET requests share the backend response
+	struct uwsgi_string_list *coalesce_headers;
+	int coalesce_headers_count;
+	uint64_t coalesce_max_size;
+
 }; 
 
 struct http_session {
@@ -90,6 +129,16 @@ struct http_session {
         char *ssl_cc;
         int force_https;
         struct uwsgi_buffer *force_ssl_buf;
+
+        // offloaded handshake (the memory bios are owned by the ssl object)
+        BIO *hs_rbio;
+        BIO *hs_wbio;
+        struct uwsgi_buffer *hs_out;
+        size_t hs_out_pos;
+        int hs_ret;
+        int hs_err;
+        int hs_pending;
+        struct http_session *hs_next;
 #endif
 
 #ifdef UWSGI_SPDY
@@ -119,6 +168,31 @@ struct http_session {
         ssize_t (*spdy_hook)(struct corerouter_peer *);
 #endif
 
+#ifdef UWSGI_HTTP2
+	int http2;
+	int http2_initialized;
+	int http2_phase;
+
+	// connection send window and initial send window of new streams
+	int64_t http2_window;
+	int64_t http2_initial_window;
+
+	uint32_t http2_last_stream_id;
+
+	// header block fragments waiting for CONTINUATION frames
+	struct uwsgi_buffer *http2_headers;
+	uint32_t http2_headers_stream_id;
+	uint8_t http2_headers_flags;
+
+	// the receive window to give back to the client
+	uint32_t http2_update_window;
+	uint32_t http2_update_window_size;
+
+	struct http2_hpack *http2_hpack;
+	// all the frames to the client are built here
+	struct uwsgi_buffer *http2_out;
+#endif
+
 #ifdef UWSGI_ZLIB
 	int can_gzip;
 	int has_gzip;
@@ -140,6 +214,58 @@ struct http_session {
 	ssize_t (*func_write)(struct corerouter_peer *);
 	int is_rtsp;
 
+	int is_head;
+	// GET or HEAD (the request can be hedged)
+	int is_idempotent;
+	// copy of the backend request, kept until the hedge timer fires or a backend answers
+	struct uwsgi_buffer *hedge_request;
+	// response bytes still expected from a pooled backend connection (-1 until headers are parsed)
+	int64_t backend_remains;
+	// chunked responses from pooled backend connections
+	int backend_chunked;
+	int backend_chunk_status;
+	// the backend peer to close after the last response chunk is sent
+	struct corerouter_peer *backend_done;
+
+	// GET request that can be served from (and stored in) the response cache
+	int cacheable;
+	// the client asked for a fresh response
+	int cache_refresh;
+	// Host + REQUEST_URI
+	struct uwsgi_buffer *cache_key;
+	// the cached response being sent, or the backend response being collected
+	struct uwsgi_buffer *cache_response;
+	uint64_t cache_expires;
+	// body bytes still expected before storing the response (-1 until headers are parsed)
+	int64_t cache_remains;
+
+	// websockets hub handshake (checked before reaching the backends)
+	int hub_upgrade;
+	char *hub_key;
+	uint16_t hub_key_len;
+	// websockets hub subscription
+	struct hr_hub_channel *hub_channel;
+	struct http_session *hub_prev;
+	struct http_session *hub_next;
+	// frames waiting to be sent to the client
+	struct uwsgi_buffer *hub_out;
+	int hub_ping_sent;
+
+	// GET request that can wait for the response of an identical one
+	int coalesce_candidate;
+	// values of the --http-coalesce-header headers (part of the key)
+	char *coalesce_values[HR_COALESCE_MAX_HEADERS];
+	uint16_t coalesce_values_len[HR_COALESCE_MAX_HEADERS];
+	// the in-flight request the session is leading, waiting for or sending
+	struct hr_coalesce_entry *coalesce;
+	int coalesce_state;
+	struct http_session *coalesce_prev;
+	struct http_session *coalesce_next;
+	// the keepalive status of the waiting request
+	int coalesce_keepalive;
+	// maps the shared response (the memory is owned by the entry)
+	struct uwsgi_buffer coalesce_out;
+
 	char *proxy_src;
         char *proxy_src_port;
         uint16_t proxy_src_len;
@@ -182,10 +308,18 @@ ssize_t spdy_parse(struct corerouter_peer *);
 void spdy_window_update(char *, uint32_t, uint32_t);
 #endif
 
+#ifdef UWSGI_HTTP2
+int uwsgi_http2_alpn(SSL *, const unsigned char **, unsigned char *, const unsigned char *, unsigned int, void *);
+ssize_t http2_parse(struct corerouter_peer *);
+int http2_window_update(struct http_session *);
+void http2_session_close(struct http_session *);
+#endif
+
 ssize_t hs_http_manage(struct corerouter_peer *, ssize_t);
 
 ssize_t hr_instance_connected(struct corerouter_peer *);
 ssize_t hr_instance_write(struct corerouter_peer *);
+ssize_t hr_instance_read(struct corerouter_peer *);
 
 ssize_t hr_instance_read_response(struct corerouter_peer *);
 ssize_t hr_read_body(struct corerouter_peer *);
@@ -193,5 +327,28 @@ ssize_t hr_write_body(struct corerouter_peer *);
 
 void hr_session_close(struct corerouter_session *);
 ssize_t http_parse(struct corerouter_peer *);
+ssize_t hr_write(struct corerouter_peer *);
 
 int http_response_parse(struct http_session *, struct uwsgi_buffer *, size_t);
+int hr_backend_response_size(struct corerouter_peer *, size_t);
+int hr_backend_release(struct http_session *);
+
+void http_set_timeout(struct corerouter_peer *, int);
+
+void hr_cache_request_header(struct http_session *, char *, size_t);
+int hr_cache_serve(struct corerouter_peer *);
+void hr_cache_collect(struct http_session *, char *, size_t);
+
+void hr_hub_init(void);
+void hr_hub_request_header(struct http_session *, char *, size_t);
+int hr_hub_match(struct http_session *, char **, uint16_t *);
+int hr_hub_accept(struct corerouter_peer *, char *, uint16_t);
+ssize_t hr_hub_parse(struct corerouter_peer *);
+void hr_hub_session_close(struct http_session *);
+
+void hr_coalesce_init(void);
+void hr_coalesce_request_header(struct http_session *, char *, size_t);
+int hr_coalesce(struct corerouter_peer *);
+void hr_coalesce_collect(struct http_session *, char *, size_t);
+void hr_coalesce_complete(struct http_session *);
+void hr_coalesce_release(struct http_session *);
@@ -13,13 +13,15 @@ struct uwsgi_option http_options[] = {
 	{"httprouter", required_argument, 0, "add an http router/server on the specified address", uwsgi_opt_corerouter, &uhttp, 0},
 #ifdef UWSGI_SSL
 	{"https", required_argument, 0, "add an https router/server on the specified address with specified certificate and key", uwsgi_opt_https, &uhttp, 0},
-	{"https2", required_argument, 0, "add an https/spdy router/server using keyval options", uwsgi_opt_https2, &uhttp, 0},
+	{"https2", required_argument, 0, "add an https/spdy/http2 router/server using keyval options", uwsgi_opt_https2, &uhttp, 0},
 	{"https-export-cert", no_argument, 0, "export uwsgi variable HTTPS_CC containing the raw client certificate", uwsgi_opt_true, &uhttp.https_export_cert, 0},
 	{"https-session-context", required_argument, 0, "set the session id context to the specified value", uwsgi_opt_set_str, &uhttp.https_session_context, 0},
+	{"https-handshake-threads", required_argument, 0, "run the TLS handshakes crypto in the specified number of threads (the event loop keeps serving the other sessions)", uwsgi_opt_set_int, &uhttp.https_handshake_threads, 0},
 	{"http-to-https", required_argument, 0, "add an http router/server on the specified address and redirect all of the requests to https", uwsgi_opt_http_to_https, &uhttp, 0},
 #endif
 	{"http-processes", required_argument, 0, "set the number of http processes to spawn", uwsgi_opt_set_int, &uhttp.cr.processes, 0},
 	{"http-workers", required_argument, 0, "set the number of http processes to spawn", uwsgi_opt_set_int, &uhttp.cr.processes, 0},
+	{"http-threads", required_argument, 0, "run the specified number of event loop threads in each http process (sharing subscriptions and stats)", uwsgi_opt_set_int, &uhttp.cr.threads, 0},
 	{"http-var", required_argument, 0, "add a key=value item to the generated uwsgi packet", uwsgi_opt_add_string_list, &uhttp.http_vars, 0},
 	{"http-to", required_argument, 0, "forward requests to the specified node (you can specify it multiple time for lb)", uwsgi_opt_add_string_list, &uhttp.cr.static_nodes, 0 },
 	{"http-zerg", required_argument, 0, "attach the http router to a zerg server", uwsgi_opt_corerouter_zerg, &uhttp, 0 },
@@ -27,6 +29,7 @@ struct uwsgi_option http_options[] = {
 	{"http-modifier1", required_argument, 0, "set uwsgi protocol modifier1", uwsgi_opt_set_int, &uhttp.modifier1, 0},
 	{"http-modifier2", required_argument, 0, "set uwsgi protocol modifier2", uwsgi_opt_set_int, &uhttp.modifier2, 0},
 	{"http-use-cache", optional_argument, 0, "use uWSGI cache as key->value virtualhost mapper", uwsgi_opt_set_str, &uhttp.cr.use_cache, 0},
+	{"http-cache-memo", required_argument, 0, "memoize (per router process) the specified number of recent results of the cache mapper", uwsgi_opt_set_64bit, &uhttp.cr.cache_memo, 0},
 	{"http-use-pattern", required_argument, 0, "use the specified pattern for mapping requests to unix sockets", uwsgi_opt_corerouter_use_pattern, &uhttp, 0},
 	{"http-use-base", required_argument, 0, "use the specified base for mapping requests to unix sockets", uwsgi_opt_corerouter_use_base, &uhttp, 0},
 	{"http-events", required_argument, 0, "set the number of concurrent http async events", uwsgi_opt_set_int, &uhttp.cr.nevents, 0},
@@ -38,10 +41,17 @@ struct uwsgi_option http_options[] = {
 	{"http-auto-chunked", no_argument, 0, "automatically transform output to chunked encoding during HTTP 1.1 keepalive (if needed)", uwsgi_opt_true, &uhttp.auto_chunked, 0},
 #ifdef UWSGI_ZLIB
 	{"http-auto-gzip", no_argument, 0, "automatically gzip content if uWSGI-Encoding header is set to gzip, but content size (Content-Length/Transfer-Encoding) and Content-Encoding are not specified", uwsgi_opt_true, &uhttp.auto_gzip, 0},
+	{"http-gzip-type", required_argument, 0, "gzip (in the router) responses with a Content-Type starting with the specified value when the client accepts it", uwsgi_opt_add_string_list, &uhttp.gzip_types, 0},
+	{"http-gzip-min-size", required_argument, 0, "do not gzip responses with a Content-Length lower than the specified value", uwsgi_opt_set_64bit, &uhttp.gzip_min_size, 0},
+	{"http-gzip-level", required_argument, 0, "set the compression level (1-9) used by the router gzip", uwsgi_opt_set_int, &uhttp.gzip_level, 0},
 #endif
 
 	{"http-raw-body", no_argument, 0, "blindly send HTTP body to backends (required for WebSockets and Icecast support in backends)", uwsgi_opt_true, &uhttp.raw_body, 0},
 	{"http-websockets", no_argument, 0, "automatically detect websockets connections and put the session in raw mode", uwsgi_opt_true, &uhttp.websockets, 0},
+	{"http-websockets-hub", required_argument, 0, "terminate in the router the websockets connections to the specified path prefix, subscribing them to the channel named by the rest of the path", uwsgi_opt_set_str, &uhttp.websockets_hub, 0},
+	{"http-websockets-hub-socket", required_argument, 0, "receive the messages to publish on the websockets hub channels from the specified datagram socket (udp address or unix path)", uwsgi_opt_set_str, &uhttp.websockets_hub_socket, 0},
+	{"http-websockets-hub-ping", required_argument, 0, "ping the idle websockets hub clients after the specified amount of seconds, closing them if they do not answer (default: 30)", uwsgi_opt_set_int, &uhttp.websockets_hub_ping, 0},
+	{"http-websockets-hub-max-pending", required_argument, 0, "close the websockets hub clients with more than the specified amount of bytes waiting to be sent (default: 1M)", uwsgi_opt_set_64bit, &uhttp.websockets_hub_max_pending, 0},
 	{"http-chunked-input", no_argument, 0, "automatically detect chunked input requests and put the session in raw mode", uwsgi_opt_true, &uhttp.chunked_input, 0},
 
 	{"http-use-code-string", required_argument, 0, "use code string as hostname->server mapper for the http router", uwsgi_opt_corerouter_cs, &uhttp, 0},
@@ -70,8 +80,22 @@ struct uwsgi_option http_options[] = {
 
 	{"http-backend-http", no_argument, 0, "use plain http protocol instead of uwsgi for backend nodes", uwsgi_opt_true, &uhttp.proto_http, 0},
 
+	{"http-chash-header", required_argument, 0, "use the value of the specified request header (instead of the client address) as the key of the chash subscription algo", uwsgi_opt_set_str, &uhttp.chash_header, 0},
+
+	{"http-cache", required_argument, 0, "serve GET requests from the specified uWSGI cache directly in the router (responses are stored by Host and REQUEST_URI honouring Cache-Control)", uwsgi_opt_set_str, &uhttp.response_cache, 0},
+	{"http-cache-expires", required_argument, 0, "store responses without Cache-Control in the http cache for the specified number of seconds (default: do not store them)", uwsgi_opt_set_64bit, &uhttp.response_cache_expires, 0},
+
 	{"http-manage-rtsp", no_argument, 0, "manage RTSP sessions", uwsgi_opt_true, &uhttp.manage_rtsp, 0},
 
+	{"http-hedge", required_argument, 0, "send GET and HEAD requests to a second subscription node when the first one has not answered in the specified number of milliseconds", uwsgi_opt_set_int, &uhttp.cr.hedge_delay, 0},
+
+	{"http-coalesce", no_argument, 0, "let identical concurrent GET requests wait for the response of the first one instead of reaching the backends", uwsgi_opt_true, &uhttp.cr.coalesce, 0},
+	{"http-coalesce-header", required_argument, 0, "add a request header to the key of coalesced requests, besides Host and REQUEST_URI (default: Accept-Encoding)", uwsgi_opt_add_string_list, &uhttp.coalesce_headers, 0},
+	{"http-coalesce-max-size", required_argument, 0, "do not share responses bigger than the specified amount of bytes between coalesced requests (default: 1M)", uwsgi_opt_set_64bit, &uhttp.coalesce_max_size, 0},
+
+	{"http-backend-pool", required_argument, 0, "keep up to the specified number of idle backend connections for reuse (backends must support persistent connections, like --puwsgi-socket)", uwsgi_opt_set_int, &uhttp.cr.pool_size, 0},
+	{"http-backend-pool-idle", required_argument, 0, "close pooled backend connections idle for more than the specified amount of seconds (default: 3)", uwsgi_opt_set_int, &uhttp.cr.pool_idle, 0},
+
 	{"http-post-buffering", required_argument, 0, "enable HTTP fastrouter post buffering", uwsgi_opt_set_64bit, &uhttp.cr.post_buffering, 0},
         {"http-post-buffering-dir", required_argument, 0, "put fastrouter buffered files to the specified directory (noop, use TMPDIR env)", uwsgi_opt_set_str, &uhttp.cr.pb_base_dir, 0},
 
@@ -110,10 +134,10 @@ static int rebuild_key_for_mountpoint(struct http_session *hr, struct corerouter
 	return 0;
 }
 
-static void http_set_timeout(struct corerouter_peer *peer, int timeout) {
+void http_set_timeout(struct corerouter_peer *peer, int timeout) {
 	if (peer->current_timeout == timeout) return;
 	peer->current_timeout = timeout;
-	peer->timeout = corerouter_reset_timeout(peer->session->corerouter, peer);
+	corerouter_reset_timeout(peer->session->corerouter, peer);
 }
 
 static int http_header_dumb_check(struct http_session *hr, struct corerouter_peer *peer, char *hh, size_t hhlen) {
@@ -193,7 +217,7 @@ static int http_header_dumb_check(struct http_session *hr, struct corerouter_pee
         }
 
 #ifdef UWSGI_ZLIB
-        else if (uhttp.auto_gzip && !uwsgi_strnicmp("ACCEPT-ENCODING", 15, hh, keylen)) {
+        else if ((uhttp.auto_gzip || uhttp.gzip_types) && !uwsgi_strnicmp("ACCEPT-ENCODING", 15, hh, keylen)) {
                 if ( uwsgi_contains_n(val, vallen, "gzip", 4) ) {
                         hr->can_gzip = 1;
                 }
@@ -304,7 +328,7 @@ static int http_add_uwsgi_header(struct corerouter_peer *peer, char *hh, size_t
 	}
 
 #ifdef UWSGI_ZLIB
-	else if (uhttp.auto_gzip && !uwsgi_strncmp("ACCEPT_ENCODING", 15, hh, keylen)) {
+	else if ((uhttp.auto_gzip || uhttp.gzip_types) && !uwsgi_strncmp("ACCEPT_ENCODING", 15, hh, keylen)) {
 		if ( uwsgi_contains_n(val, vallen, "gzip", 4) ) {
 			hr->can_gzip = 1;
 		}
@@ -355,6 +379,12 @@ static int http_headers_parse_first_round(struct corerouter_peer *peer) {
         // METHOD
         while (ptr < watermark) {
                 if (*ptr == ' ') {
+                        hr->is_head = !uwsgi_strncmp(base, ptr - base, "HEAD", 4);
+                        hr->is_idempotent = hr->is_head || !uwsgi_strncmp(base, ptr - base, "GET", 3);
+                        hr->cacheable = uhttp.response_cache && hr->is_idempotent && !hr->is_head;
+                        hr->cache_refresh = 0;
+                        hr->coalesce_candidate = uhttp.cr.coalesce && hr->is_idempotent && !hr->is_head;
+                        memset(hr->coalesce_values_len, 0, sizeof(hr->coalesce_values_len));
                         ptr++;
                         found = 1;
                         break;
@@ -393,6 +423,10 @@ static int http_headers_parse_first_round(struct corerouter_peer *peer) {
                                 return 0;
                         if (*(ptr + 1) != '\n')
                                 return 0;
+                        // cache hits do not reach the full parser
+                        if (hr->cacheable && uhttp.keepalive && !uwsgi_strncmp("HTTP/1.1", 8, base, ptr-base)) {
+                                hr->session.can_keepalive = 1;
+                        }
                         ptr += 2;
                         found = 1;
                         break;
@@ -406,6 +440,9 @@ static int http_headers_parse_first_round(struct corerouter_peer *peer) {
         memcpy(peer->key, uwsgi.hostname, uwsgi.hostname_len);
         peer->key_len = uwsgi.hostname_len;
 
+	hr->hub_upgrade = 0;
+	hr->hub_key_len = 0;
+
         //HEADERS
         base = ptr;
         while (ptr < watermark) {
@@ -428,6 +465,26 @@ static int http_headers_parse_first_round(struct corerouter_peer *peer) {
 					memcpy(peer->key, base + 6, peer->key_len);
 				}
                         }
+			else if (uhttp.chash_header_len && (size_t) (ptr - base) > uhttp.chash_header_len + 1 && base[uhttp.chash_header_len] == ':'
+				&& !uwsgi_strnicmp(uhttp.chash_header, uhttp.chash_header_len, base, uhttp.chash_header_len)) {
+				char *value = base + uhttp.chash_header_len + 1;
+				while (value < ptr && (*value == ' ' || *value == '\t')) value++;
+				if (ptr - value <= 0xffff) {
+					peer->hash_key = value;
+					peer->hash_key_len = ptr - value;
+				}
+			}
+			else if (hr->cacheable) {
+				hr_cache_request_header(hr, base, ptr - base);
+			}
+
+			if (uhttp.websockets_hub) {
+				hr_hub_request_header(hr, base, ptr - base);
+			}
+
+			if (hr->coalesce_candidate) {
+				hr_coalesce_request_header(hr, base, ptr - base);
+			}
 
                         // last line, do not waste time
                         if (ptr - base == 0) break;
@@ -897,8 +954,10 @@ ssize_t hr_instance_write(struct corerouter_peer *peer) {
 			peer->out->pos = 0;
 		}
                 cr_reset_hooks(peer);
-#ifdef UWSGI_SPDY
+#if defined(UWSGI_SPDY) || defined(UWSGI_HTTP2)
 		struct http_session *hr = (struct http_session *) peer->session;
+#endif
+#ifdef UWSGI_SPDY
 		if (hr->spdy) {
 			if (hr->spdy_update_window) {
 				if (uwsgi_buffer_fix(peer->in, 16)) return -1;
@@ -913,6 +972,18 @@ ssize_t hr_instance_write(struct corerouter_peer *peer) {
 			return spdy_parse(peer->session->main_peer);
 		}
 #endif
+#ifdef UWSGI_HTTP2
+		if (hr->http2) {
+			if (hr->http2_update_window_size) {
+				if (http2_window_update(hr)) return -1;
+				peer->session->main_peer->out = hr->http2_out;
+				peer->session->main_peer->out_pos = 0;
+				cr_write_to_main(peer, hr->func_write);
+				return 1;
+			}
+			return http2_parse(peer->session->main_peer);
+		}
+#endif
 		
         }
 
@@ -939,6 +1010,10 @@ ssize_t hr_write(struct corerouter_peer *main_peer) {
 			main_peer->session->connect_peer_after_write = NULL;
 			return len;
 		}
+		if (((struct http_session *) main_peer->session)->backend_done) {
+			if (hr_backend_release((struct http_session *) main_peer->session)) return -1;
+			return len;
+		}
                 cr_reset_hooks(main_peer);
         }
 
@@ -998,64 +1073,194 @@ int hr_check_response_keepalive(struct corerouter_peer *peer) {
 
 }
 
-// data from instance
-ssize_t hr_instance_read(struct corerouter_peer *peer) {
-        peer->in->limit = UMAX16;
-	if (uwsgi_buffer_ensure(peer->in, uwsgi.page_size)) return -1;
+// the backend response is over (called on EOF or when a pooled response is complete)
+static ssize_t hr_instance_done(struct corerouter_peer *peer) {
 	struct http_session *hr = (struct http_session *) peer->session;
-        ssize_t len = cr_read(peer, "hr_instance_read()");
-        if (!len) {
-		// disable keepalive on unread body
-		if (hr->content_length) hr->session.can_keepalive = 0;
-		if (hr->session.can_keepalive) {
-			peer->session->main_peer->disabled = 0;
-			hr->rnrn = 0;
+	// disable keepalive on unread body
+	if (hr->content_length) hr->session.can_keepalive = 0;
+	if (hr->session.can_keepalive) {
+		peer->session->main_peer->disabled = 0;
+		hr->rnrn = 0;
 #ifdef UWSGI_ZLIB
-			hr->can_gzip = 0;
-			hr->has_gzip = 0;
+		hr->can_gzip = 0;
+		hr->has_gzip = 0;
 #endif
-			if (uhttp.keepalive > 1) {
-				http_set_timeout(peer->session->main_peer, uhttp.keepalive);
-			}
+		if (uhttp.keepalive > 1) {
+			http_set_timeout(peer->session->main_peer, uhttp.keepalive);
 		}
+	}
 #ifdef UWSGI_ZLIB
-		if (hr->force_chunked || hr->force_gzip) {
+	if (hr->force_chunked || hr->force_gzip) {
 #else
-		if (hr->force_chunked) {
+	if (hr->force_chunked) {
 #endif
-			hr->force_chunked = 0;
-			if (!hr->last_chunked) {
-				hr->last_chunked = uwsgi_buffer_new(5);
-			}
+		hr->force_chunked = 0;
+		if (!hr->last_chunked) {
+			hr->last_chunked = uwsgi_buffer_new(5);
+		}
 #ifdef UWSGI_ZLIB
-			if (hr->force_gzip) {
-				hr->force_gzip = 0;
-				size_t zlen = 0;
-				char *gzipped = uwsgi_deflate(&hr->z, NULL, 0, &zlen);
-				if (!gzipped) return -1;
-				if (uwsgi_buffer_append_chunked(hr->last_chunked, zlen)) {free(gzipped) ; return -1;}
-				if (uwsgi_buffer_append(hr->last_chunked, gzipped, zlen)) {free(gzipped) ; return -1;}
-				free(gzipped);
-				if (uwsgi_buffer_append(hr->last_chunked, "\r\n", 2)) return -1;
-				if (uwsgi_buffer_append_chunked(hr->last_chunked, 8)) return -1;
-				if (uwsgi_buffer_u32le(hr->last_chunked, hr->gzip_crc32)) return -1;
-				if (uwsgi_buffer_u32le(hr->last_chunked, hr->gzip_size)) return -1;
-				if (uwsgi_buffer_append(hr->last_chunked, "\r\n", 2)) return -1;
-			}
+		if (hr->force_gzip) {
+			hr->force_gzip = 0;
+			size_t zlen = 0;
+			char *gzipped = uwsgi_deflate(&hr->z, NULL, 0, &zlen);
+			if (!gzipped) return -1;
+			if (uwsgi_buffer_append_chunked(hr->last_chunked, zlen)) {free(gzipped) ; return -1;}
+			if (uwsgi_buffer_append(hr->last_chunked, gzipped, zlen)) {free(gzipped) ; return -1;}
+			free(gzipped);
+			if (uwsgi_buffer_append(hr->last_chunked, "\r\n", 2)) return -1;
+			if (uwsgi_buffer_append_chunked(hr->last_chunked, 8)) return -1;
+			if (uwsgi_buffer_u32le(hr->last_chunked, hr->gzip_crc32)) return -1;
+			if (uwsgi_buffer_u32le(hr->last_chunked, hr->gzip_size)) return -1;
+			if (uwsgi_buffer_append(hr->last_chunked, "\r\n", 2)) return -1;
+		}
 #endif
-			if (uwsgi_buffer_append(hr->last_chunked, "0\r\n\r\n", 5)) return -1;
-			peer->session->main_peer->out = hr->last_chunked;
-			peer->session->main_peer->out_pos = 0;
-			cr_write_to_main(peer, hr->func_write);
-			if (!hr->session.can_keepalive) {
-				hr->session.wait_full_write = 1;
-			}
+		if (uwsgi_buffer_append(hr->last_chunked, "0\r\n\r\n", 5)) return -1;
+		peer->session->main_peer->out = hr->last_chunked;
+		peer->session->main_peer->out_pos = 0;
+		cr_write_to_main(peer, hr->func_write);
+		if (!hr->session.can_keepalive) {
+			hr->session.wait_full_write = 1;
 		}
-		else {
-			cr_reset_hooks(peer);
+	}
+	else {
+		cr_reset_hooks(peer);
+	}
+	return 0;
+}
+
+// called when the last chunk of a pooled response has been sent to the client
+int hr_backend_release(struct http_session *hr) {
+	struct corerouter_peer *peer = hr->session.peers;
+	// the peer could have been destroyed in the meantime (by a timeout)
+	while (peer && peer != hr->backend_done) peer = peer->next;
+	hr->backend_done = NULL;
+	if (!peer) {
+		cr_reset_hooks(hr->session.main_peer);
+		return 0;
+	}
+	if (hr_instance_done(peer) < 0) return -1;
+	corerouter_close_peer(hr->session.corerouter, peer);
+	return 0;
+}
+
+// the peer is the first one answering, destroy the other backends of the hedged request
+static void hr_hedge_winner(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	struct uwsgi_corerouter *ucr = peer->session->corerouter;
+	corerouter_hedge_cancel(ucr, peer);
+	struct corerouter_peer *peers = peer->session->peers;
+	while (peers) {
+		struct corerouter_peer *loser = peers;
+		peers = peers->next;
+		if (loser != peer) {
+			corerouter_drop_peer(ucr, loser);
 		}
+	}
+	peer->session->hedging = 0;
+	if (hr->hedge_request) {
+		uwsgi_buffer_destroy(hr->hedge_request);
+		hr->hedge_request = NULL;
+	}
+}
+
+// the backend did not answer in time, send the same request to another node
+static int hr_hedge(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	struct uwsgi_corerouter *ucr = peer->session->corerouter;
+
+	if (!hr->hedge_request || peer->response_checked)
+		return 0;
+
+	struct uwsgi_buffer *request = hr->hedge_request;
+	// only one hedge per request
+	hr->hedge_request = NULL;
+
+	struct corerouter_peer *new_peer = uwsgi_cr_peer_add(peer->session);
+	new_peer->last_hook_read = hr_instance_read;
+	memcpy(new_peer->key, peer->key, peer->key_len);
+	new_peer->key_len = peer->key_len;
+
+	if (ucr->mapper(ucr, new_peer))
+		goto drop;
+	// the algo could choose the same node again
+	if (new_peer->instance_address_len == 0 || new_peer->defer_connect || !uwsgi_strncmp(new_peer->instance_address, new_peer->instance_address_len, peer->instance_address, peer->instance_address_len))
+		goto drop;
+
+	new_peer->can_pool = peer->can_pool;
+	new_peer->fd = uwsgi_cr_pool_get(new_peer);
+	if (new_peer->fd < 0)
+		new_peer->fd = uwsgi_connectn(new_peer->instance_address, new_peer->instance_address_len, 0, 1);
+	if (new_peer->fd < 0)
+		goto drop;
+	ucr->cr_table[new_peer->fd] = new_peer;
+	new_peer->connecting = 1;
+	new_peer->connect_time = uwsgi_micros();
+
+	new_peer->out = request;
+	new_peer->out_need_free = 1;
+	new_peer->out_pos = 0;
+	peer->session->hedging = 1;
+
+	http_set_timeout(new_peer, uhttp.connect_timeout);
+	// the first backend can still answer while we are connecting
+	if (uwsgi_cr_set_hooks(new_peer, NULL, hr_instance_connected)) {
+		corerouter_drop_peer(ucr, new_peer);
 		return 0;
 	}
+	return 1;
+
+drop:
+	uwsgi_buffer_destroy(request);
+	corerouter_drop_peer(ucr, new_peer);
+	return 0;
+}
+
+// data from instance
+ssize_t hr_instance_read(struct corerouter_peer *peer) {
+        peer->in->limit = UMAX16;
+	if (uwsgi_buffer_ensure(peer->in, uwsgi.page_size)) return -1;
+	struct http_session *hr = (struct http_session *) peer->session;
+        ssize_t len = cr_read(peer, "hr_instance_read()");
+        if (!len) {
+		if (hr->coalesce) hr_coalesce_complete(hr);
+		return hr_instance_done(peer);
+	}
+
+	if (!peer->response_checked) {
+		// the first backend answering a hedged request wins
+		if (peer->hedge_timer || peer->session->hedging) {
+			hr_hedge_winner(peer);
+		}
+	}
+
+	// a 5xx status line counts as a failure of the subscription node
+	if (!peer->response_checked) {
+		peer->response_checked = 1;
+		if (peer->in->pos >= 12 && !memcmp(peer->in->buf, "HTTP/", 5) && peer->in->buf[8] == ' ' && peer->in->buf[9] == '5') {
+			peer->bad_response = 1;
+		}
+	}
+
+	if (hr->cache_response) {
+		hr_cache_collect(hr, peer->in->buf + (peer->in->pos - len), len);
+	}
+
+	if (hr->coalesce) {
+		hr_coalesce_collect(hr, peer->in->buf + (peer->in->pos - len), len);
+	}
+
+	if (peer->can_pool) {
+		int ret = hr_backend_response_size(peer, len);
+		if (ret < 0) {
+			peer->can_pool = 0;
+		}
+		else if (ret > 0) {
+			// the whole response is here, give back the connection and finish after the last write
+			uwsgi_cr_pool_put(peer);
+			hr->backend_done = peer;
+			if (hr->coalesce) hr_coalesce_complete(hr);
+		}
+	}
 
 	// need to parse response headers
 #ifdef UWSGI_ZLIB
@@ -1110,6 +1315,9 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
 	struct corerouter_session *cs = main_peer->session;
 	struct http_session *hr = (struct http_session *) cs;
 
+	// websocket frames of a hub client
+	if (hr->hub_channel) return hr_hub_parse(main_peer);
+
 	// is it http body ?
 	if (hr->rnrn == 4) {
 		// something bad happened in keepalive mode...
@@ -1175,6 +1383,9 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
 
 			struct uwsgi_corerouter *ucr = main_peer->session->corerouter;
 
+			// the shared response of the previous request is no more needed
+			if (hr->coalesce) hr_coalesce_release(hr);
+
 			// create a new peer
                 	struct corerouter_peer *new_peer = uwsgi_cr_peer_add(main_peer->session);
 			// default hook
@@ -1192,6 +1403,25 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
 				break;
 			}
 #endif
+			// terminate the websocket in the hub
+			if (uhttp.websockets_hub && hr->hub_upgrade == 2 && hr->hub_key_len > 0) {
+				char *channel = NULL;
+				uint16_t channel_len = 0;
+				if (hr_hub_match(hr, &channel, &channel_len)) {
+					if (hr_hub_accept(new_peer, channel, channel_len)) return -1;
+					break;
+				}
+			}
+			if (hr->cache_response) {
+				uwsgi_buffer_destroy(hr->cache_response);
+				hr->cache_response = NULL;
+			}
+			// serve the response from the cache without reaching the backends
+			if (hr->cacheable && hr->remains == 0) {
+				int ret = hr_cache_serve(new_peer);
+				if (ret < 0) return -1;
+				if (ret > 0) break;
+			}
 			if (uwsgi.subscription_mountpoints) {
 				if (rebuild_key_for_mountpoint(hr, new_peer)) return -1;
 			}
@@ -1262,7 +1492,31 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
         		}
 
 
+			// only requests without a body can use pooled backend connections
+			hr->backend_remains = -1;
+			hr->backend_done = NULL;
+			new_peer->can_pool = uhttp.cr.pool_size > 0 && !hr->raw_body && !hr->is_rtsp && hr->remains == 0 && hr->content_length == 0;
+
 			new_peer->can_retry = 1;
+
+			// wait for the response of an identical request already in flight
+			if (hr->coalesce_candidate && !hr->raw_body && !hr->is_rtsp && hr->remains == 0 && hr->content_length == 0) {
+				int ret = hr_coalesce(new_peer);
+				if (ret < 0) return -1;
+				if (ret > 0) break;
+			}
+
+			// keep a copy of the request for hedging
+			if (hr->hedge_request) {
+				uwsgi_buffer_destroy(hr->hedge_request);
+				hr->hedge_request = NULL;
+			}
+			if (ucr->hedge_delay > 0 && ucr->subscriptions && hr->is_idempotent && !hr->raw_body && !hr->is_rtsp && hr->remains == 0 && hr->content_length == 0) {
+				hr->hedge_request = uwsgi_buffer_new(new_peer->out->pos);
+				if (uwsgi_buffer_append(hr->hedge_request, new_peer->out->buf, new_peer->out->pos)) return -1;
+				corerouter_hedge_timer(ucr, new_peer);
+			}
+
 			// reset main timeout
 			http_set_timeout(main_peer, uhttp.cr.socket_timeout);
 			// set peer timeout
@@ -1301,6 +1555,22 @@ void hr_session_close(struct corerouter_session *cs) {
 		uwsgi_buffer_destroy(hr->last_chunked);
 	}
 
+	if (hr->hedge_request) {
+		uwsgi_buffer_destroy(hr->hedge_request);
+	}
+
+	if (hr->cache_key) {
+		uwsgi_buffer_destroy(hr->cache_key);
+	}
+
+	if (hr->cache_response) {
+		uwsgi_buffer_destroy(hr->cache_response);
+	}
+
+	hr_hub_session_close(hr);
+
+	hr_coalesce_release(hr);
+
 #ifdef UWSGI_ZLIB
 	if (hr->z.next_in) {
 		deflateEnd(&hr->z);
@@ -1366,6 +1636,7 @@ int http_alloc_session(struct uwsgi_corerouter *ucr, struct uwsgi_gateway_socket
 
 	// set the retry hook
         cs->retry = hr_retry;
+	cs->hedge = hr_hedge;
 	struct http_session *hr = (struct http_session *) cs;
 	// default hook
 	cs->main_peer->last_hook_read = hr_read;
@@ -1427,6 +1698,19 @@ int http_init() {
 
 	uhttp.cr.session_size = sizeof(struct http_session);
 	uhttp.cr.alloc_session = http_alloc_session;
+	if (uhttp.chash_header)
+		uhttp.chash_header_len = strlen(uhttp.chash_header);
+	if (uhttp.response_cache) {
+		uhttp.response_cache_uc = uwsgi_cache_by_name(uhttp.response_cache);
+		if (!uhttp.response_cache_uc) {
+			uwsgi_log("!!! unable to find cache \"%s\" !!!\n", uhttp.response_cache);
+			exit(1);
+		}
+	}
+	if (uhttp.cr.has_sockets) {
+		hr_hub_init();
+		hr_coalesce_init();
+	}
 	if (uhttp.cr.has_sockets && !uwsgi_corerouter_has_backends(&uhttp.cr)) {
 		if (!uwsgi.sockets) {
 			uwsgi_new_socket(uwsgi_concat2("127.0.0.1:0", ""));
@@ -0,0 +1,866 @@
+/*
+
+   uWSGI HTTP/2 router
+
+   It follows the same model of the SPDY3 one: each stream is mapped to a corerouter peer
+   (identified by its sid) and the responses of the backends (plain HTTP/1.x) are translated
+   to HEADERS/DATA frames.
+
+   The HPACK decoder is complete (huffman and dynamic table), while the encoder
+   sends every response header as a literal without indexing.
+
+*/
+
+#include "common.h"
+
+#ifdef UWSGI_HTTP2
+
+extern struct uwsgi_http uhttp;
+
+#include "http2.h"
+
+#define UWSGI_HTTP2_PHASE_PREFACE 0
+#define UWSGI_HTTP2_PHASE_FRAME 1
+
+#define HTTP2_DATA 0
+#define HTTP2_HEADERS 1
+#define HTTP2_PRIORITY 2
+#define HTTP2_RST_STREAM 3
+#define HTTP2_SETTINGS 4
+#define HTTP2_PUSH_PROMISE 5
+#define HTTP2_PING 6
+#define HTTP2_GOAWAY 7
+#define HTTP2_WINDOW_UPDATE 8
+#define HTTP2_CONTINUATION 9
+
+#define HTTP2_FLAG_END_STREAM 0x01
+#define HTTP2_FLAG_ACK 0x01
+#define HTTP2_FLAG_END_HEADERS 0x04
+#define HTTP2_FLAG_PADDED 0x08
+#define HTTP2_FLAG_PRIORITY 0x20
+
+#define HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+
+#define HTTP2_INTERNAL_ERROR 0x2
+
+// we never announce a bigger SETTINGS_MAX_FRAME_SIZE
+#define HTTP2_MAX_FRAME 16384
+#define HTTP2_DEFAULT_WINDOW 65535
+#define HTTP2_MAX_STREAMS 128
+#define HTTP2_HPACK_TABLE_SIZE 4096
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+struct http2_hpack {
+	// the newest entry is the first one
+	struct http2_hpack_field fields[HTTP2_HPACK_TABLE_SIZE / 32];
+	uint32_t count;
+	uint32_t size;
+	uint32_t max_size;
+};
+
+static struct {
+	int ready;
+	uint32_t first_code[31];
+	uint16_t count[31];
+	uint16_t offset[31];
+	uint16_t symbols[257];
+} http2_huffman;
+
+static void http2_huffman_init() {
+	uint32_t code = 0;
+	uint16_t n = 0;
+	int i, bits;
+	for(bits=1;bits<=30;bits++) {
+		http2_huffman.first_code[bits] = code;
+		http2_huffman.offset[bits] = n;
+		for(i=0;i<257;i++) {
+			if (http2_huffman_lengths[i] == bits) {
+				http2_huffman.symbols[n++] = i;
+				code++;
+			}
+		}
+		http2_huffman.count[bits] = n - http2_huffman.offset[bits];
+		code <<= 1;
+	}
+	http2_huffman.ready = 1;
+}
+
+static int http2_huffman_decode(struct uwsgi_buffer *ub, uint8_t *buf, size_t len) {
+	uint32_t code = 0;
+	uint8_t bits = 0;
+	size_t i;
+	int j;
+	for(i=0;i<len;i++) {
+		for(j=7;j>=0;j--) {
+			code = (code << 1) | ((buf[i] >> j) & 1);
+			bits++;
+			if (bits > 30) return -1;
+			if (code - http2_huffman.first_code[bits] < http2_huffman.count[bits]) {
+				uint16_t symbol = http2_huffman.symbols[http2_huffman.offset[bits] + (code - http2_huffman.first_code[bits])];
+				// EOS is not allowed in strings
+				if (symbol == 256) return -1;
+				if (uwsgi_buffer_u8(ub, symbol)) return -1;
+				code = 0;
+				bits = 0;
+			}
+		}
+	}
+	// padding must be the (at most 7 bits) EOS prefix
+	if (bits > 7 || code != (uint32_t) ((1 << bits) - 1)) return -1;
+	return 0;
+}
+
+static int http2_hpack_int(uint8_t **ptr, uint8_t *watermark, uint8_t prefix, uint32_t *value) {
+	uint8_t *p = *ptr;
+	if (p >= watermark) return -1;
+	uint32_t max = (1 << prefix) - 1;
+	uint32_t v = *p++ & max;
+	if (v == max) {
+		uint8_t shift = 0;
+		for(;;) {
+			if (p >= watermark || shift > 21) return -1;
+			uint8_t b = *p++;
+			v += (uint32_t) (b & 0x7f) << shift;
+			shift += 7;
+			if (!(b & 0x80)) break;
+		}
+	}
+	*value = v;
+	*ptr = p;
+	return 0;
+}
+
+static int http2_hpack_encode_int(struct uwsgi_buffer *ub, uint8_t flags, uint8_t prefix, uint32_t value) {
+	uint32_t max = (1 << prefix) - 1;
+	if (value < max) return uwsgi_buffer_u8(ub, flags | value);
+	if (uwsgi_buffer_u8(ub, flags | max)) return -1;
+	value -= max;
+	while(value >= 0x80) {
+		if (uwsgi_buffer_u8(ub, (value & 0x7f) | 0x80)) return -1;
+		value >>= 7;
+	}
+	return uwsgi_buffer_u8(ub, value);
+}
+
+// huffman encoded strings are decoded in the ub buffer, the others are directly referenced
+static int http2_hpack_string(uint8_t **ptr, uint8_t *watermark, struct uwsgi_buffer *ub, char **str, uint32_t *str_len) {
+	if (*ptr >= watermark) return -1;
+	int huffman = **ptr & 0x80;
+	uint32_t len = 0;
+	if (http2_hpack_int(ptr, watermark, 7, &len)) return -1;
+	if (len > (size_t) (watermark - *ptr)) return -1;
+	if (huffman) {
+		if (http2_huffman_decode(ub, *ptr, len)) return -1;
+		*str = ub->buf;
+		*str_len = ub->pos;
+	}
+	else {
+		*str = (char *) *ptr;
+		*str_len = len;
+	}
+	*ptr += len;
+	return 0;
+}
+
+static void http2_hpack_evict(struct http2_hpack *hp, uint32_t needed) {
+	while(hp->count > 0 && hp->size + needed > hp->max_size) {
+		struct http2_hpack_field *field = &hp->fields[hp->count - 1];
+		hp->size -= field->name_len + field->value_len + 32;
+		free(field->name);
+		hp->count--;
+	}
+}
+
+static void http2_hpack_add(struct http2_hpack *hp, char *name, uint32_t name_len, char *value, uint32_t value_len) {
+	uint32_t size = name_len + value_len + 32;
+	// an entry bigger than the table simply empties it
+	if (size > hp->max_size) {
+		http2_hpack_evict(hp, hp->max_size + 1);
+		return;
+	}
+	// copy before evicting, as the name could reference an entry of the table
+	char *buf = uwsgi_malloc(name_len + value_len + 1);
+	memcpy(buf, name, name_len);
+	memcpy(buf + name_len, value, value_len);
+	http2_hpack_evict(hp, size);
+	memmove(&hp->fields[1], &hp->fields[0], sizeof(struct http2_hpack_field) * hp->count);
+	hp->fields[0].name = buf;
+	hp->fields[0].name_len = name_len;
+	hp->fields[0].value = buf + name_len;
+	hp->fields[0].value_len = value_len;
+	hp->count++;
+	hp->size += size;
+}
+
+static struct http2_hpack_field *http2_hpack_get(struct http2_hpack *hp, uint32_t index) {
+	if (index == 0) return NULL;
+	if (index <= sizeof(http2_hpack_static_table) / sizeof(struct http2_hpack_field)) {
+		return &http2_hpack_static_table[index - 1];
+	}
+	index -= (sizeof(http2_hpack_static_table) / sizeof(struct http2_hpack_field)) + 1;
+	if (index >= hp->count) return NULL;
+	return &hp->fields[index];
+}
+
+static int http2_hpack_decode(struct http2_hpack *hp, uint8_t *block, size_t len, int (*hook)(void *, char *, uint32_t, char *, uint32_t), void *data) {
+	uint8_t *ptr = block;
+	uint8_t *watermark = block + len;
+	struct uwsgi_buffer *ub_key = uwsgi_buffer_new(64);
+	struct uwsgi_buffer *ub_val = uwsgi_buffer_new(64);
+	int ret = -1;
+
+	while(ptr < watermark) {
+		uint8_t b = *ptr;
+		uint32_t index = 0;
+		struct http2_hpack_field *field = NULL;
+
+		// indexed header field
+		if (b & 0x80) {
+			if (http2_hpack_int(&ptr, watermark, 7, &index)) goto end;
+			field = http2_hpack_get(hp, index);
+			if (!field) goto end;
+			if (hook(data, field->name, field->name_len, field->value, field->value_len)) goto end;
+			continue;
+		}
+
+		// dynamic table size update
+		if ((b & 0xe0) == 0x20) {
+			if (http2_hpack_int(&ptr, watermark, 5, &index)) goto end;
+			if (index > HTTP2_HPACK_TABLE_SIZE) goto end;
+			hp->max_size = index;
+			http2_hpack_evict(hp, 0);
+			continue;
+		}
+
+		// literal header field (with incremental indexing, without indexing or never indexed)
+		int indexing = (b & 0xc0) == 0x40;
+		char *name = NULL, *value = NULL;
+		uint32_t name_len = 0, value_len = 0;
+		ub_key->pos = 0;
+		ub_val->pos = 0;
+		if (http2_hpack_int(&ptr, watermark, indexing ? 6 : 4, &index)) goto end;
+		if (index) {
+			field = http2_hpack_get(hp, index);
+			if (!field) goto end;
+			name = field->name;
+			name_len = field->name_len;
+		}
+		else {
+			if (http2_hpack_string(&ptr, watermark, ub_key, &name, &name_len)) goto end;
+		}
+		if (http2_hpack_string(&ptr, watermark, ub_val, &value, &value_len)) goto end;
+		if (hook(data, name, name_len, value, value_len)) goto end;
+		if (indexing) {
+			http2_hpack_add(hp, name, name_len, value, value_len);
+		}
+	}
+
+	ret = 0;
+end:
+	uwsgi_buffer_destroy(ub_key);
+	uwsgi_buffer_destroy(ub_val);
+	return ret;
+}
+
+static int http2_frame_header(struct uwsgi_buffer *ub, uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id) {
+	if (uwsgi_buffer_u24be(ub, len)) return -1;
+	if (uwsgi_buffer_u8(ub, type)) return -1;
+	if (uwsgi_buffer_u8(ub, flags)) return -1;
+	return uwsgi_buffer_u32be(ub, stream_id & 0x7fffffff);
+}
+
+static int http2_strip_padding(uint8_t flags, uint8_t **payload, uint32_t *len) {
+	if (!(flags & HTTP2_FLAG_PADDED)) return 0;
+	if (*len < 1) return -1;
+	uint8_t pad = **payload;
+	if ((uint32_t) pad + 1 > *len) return -1;
+	*payload += 1;
+	*len -= pad + 1;
+	return 0;
+}
+
+struct http2_request {
+	struct corerouter_peer *peer;
+	struct uwsgi_buffer *cookies;
+	int has_method;
+	int has_path;
+	int has_host;
+};
+
+static int http2_request_host(struct http2_request *req, char *value, uint32_t value_len) {
+	struct corerouter_peer *peer = req->peer;
+	if (req->has_host) return 0;
+	req->has_host = 1;
+	if (value_len <= 0xff) {
+		memcpy(peer->key, value, value_len);
+		peer->key_len = value_len;
+	}
+	return uwsgi_buffer_append_keyval(peer->out, "HTTP_HOST", 9, value, value_len);
+}
+
+static int http2_request_header(void *data, char *name, uint32_t name_len, char *value, uint32_t value_len) {
+	struct http2_request *req = (struct http2_request *) data;
+	// trailers are decoded only to keep the HPACK state in sync
+	if (!req->peer) return 0;
+
+	struct uwsgi_buffer *out = req->peer->out;
+	uint32_t i;
+
+	if (name_len == 0 || name_len > 0xff00 || value_len > 0xffff) return -1;
+
+	if (name[0] == ':') {
+		if (!uwsgi_strncmp(name, name_len, ":method", 7)) {
+			req->has_method = 1;
+			return uwsgi_buffer_append_keyval(out, "REQUEST_METHOD", 14, value, value_len);
+		}
+
+		if (!uwsgi_strncmp(name, name_len, ":path", 5)) {
+			req->has_path = 1;
+			if (uwsgi_buffer_append_keyval(out, "REQUEST_URI", 11, value, value_len)) return -1;
+			uint16_t path_info_len = value_len;
+			char *query_string = memchr(value, '?', value_len);
+			if (query_string) {
+				query_string++;
+				path_info_len = (query_string - value) - 1;
+				if (uwsgi_buffer_append_keyval(out, "QUERY_STRING", 12, query_string, value_len - (path_info_len + 1))) return -1;
+			}
+			return uwsgi_buffer_append_keyval(out, "PATH_INFO", 9, value, path_info_len);
+		}
+
+		if (!uwsgi_strncmp(name, name_len, ":authority", 10)) {
+			return http2_request_host(req, value, value_len);
+		}
+
+		if (!uwsgi_strncmp(name, name_len, ":scheme", 7)) {
+			return uwsgi_buffer_append_keyval(out, "UWSGI_SCHEME", 12, value, value_len);
+		}
+
+		return 0;
+	}
+
+	// cookies can be split in multiple fields, they have to be merged back
+	if (!uwsgi_strncmp(name, name_len, "cookie", 6)) {
+		if (req->cookies->pos > 0) {
+			if (uwsgi_buffer_append(req->cookies, "; ", 2)) return -1;
+		}
+		return uwsgi_buffer_append(req->cookies, value, value_len);
+	}
+
+	if (!uwsgi_strncmp(name, name_len, "host", 4)) {
+		return http2_request_host(req, value, value_len);
+	}
+
+	if (!uwsgi_strncmp(name, name_len, "content-length", 14)) {
+		return uwsgi_buffer_append_keyval(out, "CONTENT_LENGTH", 14, value, value_len);
+	}
+
+	if (!uwsgi_strncmp(name, name_len, "content-type", 12)) {
+		return uwsgi_buffer_append_keyval(out, "CONTENT_TYPE", 12, value, value_len);
+	}
+
+	if (uwsgi_buffer_u16le(out, name_len + 5)) return -1;
+	if (uwsgi_buffer_append(out, "HTTP_", 5)) return -1;
+	for(i=0;i<name_len;i++) {
+		if (uwsgi_buffer_byte(out, name[i] == '-' ? '_' : toupper((int) name[i]))) return -1;
+	}
+	if (uwsgi_buffer_u16le(out, value_len)) return -1;
+	return uwsgi_buffer_append(out, value, value_len);
+}
+
+static ssize_t hr_instance_read_to_http2(struct corerouter_peer *);
+
+static ssize_t http2_new_stream(struct http_session *hr, uint32_t stream_id) {
+	struct http2_request req;
+	memset(&req, 0, sizeof(struct http2_request));
+	struct uwsgi_buffer *block = hr->http2_headers;
+
+	// trailers (or a reused stream id)
+	if (stream_id <= hr->http2_last_stream_id) {
+		if (http2_hpack_decode(hr->http2_hpack, (uint8_t *) block->buf, block->pos, http2_request_header, &req)) return -1;
+		return 1;
+	}
+	hr->http2_last_stream_id = stream_id;
+
+	struct corerouter_peer *new_peer = uwsgi_cr_peer_add(&hr->session);
+	new_peer->last_hook_read = hr_instance_read_to_http2;
+	new_peer->out = uwsgi_buffer_new(uwsgi.page_size);
+	// this will avoid the buffer being destroyed on the first instance write
+	new_peer->out_need_free = 2;
+	// leave space for uwsgi header
+	new_peer->out->pos = 4;
+	new_peer->sid = stream_id;
+	new_peer->window = hr->http2_initial_window;
+	memcpy(new_peer->key, uwsgi.hostname, uwsgi.hostname_len);
+	new_peer->key_len = uwsgi.hostname_len;
+
+	req.peer = new_peer;
+	req.cookies = uwsgi_buffer_new(64);
+	int ret = http2_hpack_decode(hr->http2_hpack, (uint8_t *) block->buf, block->pos, http2_request_header, &req);
+	if (!ret && req.cookies->pos > 0) {
+		ret = uwsgi_buffer_append_keyval(new_peer->out, "HTTP_COOKIE", 11, req.cookies->buf, req.cookies->pos);
+	}
+	uwsgi_buffer_destroy(req.cookies);
+	if (ret) return -1;
+
+	if (!req.has_method || !req.has_path) return -1;
+
+	struct uwsgi_buffer *out = new_peer->out;
+	struct corerouter_session *cs = &hr->session;
+
+	if (uwsgi_buffer_append_keyval(out, "SERVER_PROTOCOL", 15, "HTTP/2", 6)) return -1;
+	if (uwsgi_buffer_append_keyval(out, "SCRIPT_NAME", 11, "", 0)) return -1;
+	if (uwsgi_buffer_append_keyval(out, "SERVER_NAME", 11, uwsgi.hostname, uwsgi.hostname_len)) return -1;
+	if (uwsgi_buffer_append_keyval(out, "SERVER_PORT", 11, hr->port, hr->port_len)) return -1;
+	if (uwsgi_buffer_append_keyval(out, "UWSGI_ROUTER", 12, "http", 4)) return -1;
+	if (uwsgi_buffer_append_keyval(out, "REMOTE_ADDR", 11, cs->client_address, strlen(cs->client_address))) return -1;
+	if (uwsgi_buffer_append_keyval(out, "REMOTE_PORT", 11, cs->client_port, strlen(cs->client_port))) return -1;
+	if (uwsgi_buffer_append_keyval(out, "HTTPS", 5, "on", 2)) return -1;
+	if (uwsgi_buffer_append_keyval(out, "HTTP2", 5, "on", 2)) return -1;
+	if (uwsgi_buffer_append_keynum(out, "HTTP2.stream", 12, new_peer->sid)) return -1;
+
+	struct uwsgi_string_list *hv = uhttp.http_vars;
+	while (hv) {
+		char *equal = strchr(hv->value, '=');
+		if (equal) {
+			if (uwsgi_buffer_append_keyval(out, hv->value, equal - hv->value, equal + 1, strlen(equal + 1))) return -1;
+		}
+		hv = hv->next;
+	}
+
+	struct uwsgi_corerouter *ucr = cs->corerouter;
+
+	// get instance name
+	if (ucr->mapper(ucr, new_peer)) return -1;
+
+	if (new_peer->instance_address_len == 0) {
+		return -1;
+	}
+
+	if (out->pos - 4 > 0xffff) return -1;
+	uint16_t pktsize = out->pos - 4;
+	// fix modifiers
+	out->buf[0] = cs->main_peer->modifier1;
+	out->buf[3] = cs->main_peer->modifier2;
+	// fix pktsize
+	out->buf[1] = (uint8_t) (pktsize & 0xff);
+	out->buf[2] = (uint8_t) ((pktsize >> 8) & 0xff);
+
+	new_peer->can_retry = 1;
+
+	cr_connect(new_peer, hr_instance_connected);
+
+	return 2;
+}
+
+static int http2_is_hop_by_hop(char *name, size_t name_len) {
+	if (!uwsgi_strncmp(name, name_len, "connection", 10)) return 1;
+	if (!uwsgi_strncmp(name, name_len, "keep-alive", 10)) return 1;
+	if (!uwsgi_strncmp(name, name_len, "proxy-connection", 16)) return 1;
+	if (!uwsgi_strncmp(name, name_len, "transfer-encoding", 17)) return 1;
+	if (!uwsgi_strncmp(name, name_len, "upgrade", 7)) return 1;
+	return 0;
+}
+
+// translate the HTTP/1.x response headers to an HPACK block
+static int http2_response_headers(struct uwsgi_buffer *hb, char *buf, size_t len) {
+	char *watermark = buf + len;
+	char *space = memchr(buf, ' ', len);
+	if (!space || space + 4 > watermark) return -1;
+	char *status = space + 1;
+
+	// :status 200 is in the static table, the others use its name
+	if (!memcmp(status, "200", 3)) {
+		if (uwsgi_buffer_u8(hb, 0x88)) return -1;
+	}
+	else {
+		if (http2_hpack_encode_int(hb, 0, 4, 8)) return -1;
+		if (http2_hpack_encode_int(hb, 0, 7, 3)) return -1;
+		if (uwsgi_buffer_append(hb, status, 3)) return -1;
+	}
+
+	char *ptr = memchr(status, '\n', watermark - status);
+	if (!ptr) return -1;
+	ptr++;
+
+	while(ptr < watermark) {
+		char *nl = memchr(ptr, '\n', watermark - ptr);
+		size_t line_len = (nl ? nl : watermark) - ptr;
+		if (line_len > 0 && ptr[line_len - 1] == '\r') line_len--;
+		if (line_len == 0) break;
+		char *colon = memchr(ptr, ':', line_len);
+		if (!colon) return -1;
+		size_t name_len = colon - ptr;
+		char *value = colon + 1;
+		size_t value_len = line_len - (name_len + 1);
+		while(value_len > 0 && (*value == ' ' || *value == '\t')) {
+			value++;
+			value_len--;
+		}
+		size_t i;
+		for(i=0;i<name_len;i++) {
+			ptr[i] = tolower((int) ptr[i]);
+		}
+		if (!http2_is_hop_by_hop(ptr, name_len)) {
+			// literal header field without indexing, new name
+			if (uwsgi_buffer_u8(hb, 0)) return -1;
+			if (http2_hpack_encode_int(hb, 0, 7, name_len)) return -1;
+			if (uwsgi_buffer_append(hb, ptr, name_len)) return -1;
+			if (http2_hpack_encode_int(hb, 0, 7, value_len)) return -1;
+			if (uwsgi_buffer_append(hb, value, value_len)) return -1;
+		}
+		if (!nl) break;
+		ptr = nl + 1;
+	}
+	return 0;
+}
+
+static int http2_stream_headers(struct http_session *hr, struct corerouter_peer *peer, struct uwsgi_buffer *hb) {
+	size_t pos = 0;
+	uint8_t type = HTTP2_HEADERS;
+	do {
+		size_t chunk = hb->pos - pos;
+		if (chunk > HTTP2_MAX_FRAME) chunk = HTTP2_MAX_FRAME;
+		uint8_t flags = (pos + chunk == hb->pos) ? HTTP2_FLAG_END_HEADERS : 0;
+		if (http2_frame_header(hr->http2_out, chunk, type, flags, peer->sid)) return -1;
+		if (uwsgi_buffer_append(hr->http2_out, hb->buf + pos, chunk)) return -1;
+		pos += chunk;
+		type = HTTP2_CONTINUATION;
+	} while(pos < hb->pos);
+	return 0;
+}
+
+// send the buffered response body, as much as the flow control windows allow
+static int http2_stream_data(struct http_session *hr, struct corerouter_peer *peer) {
+	struct uwsgi_buffer *ub = peer->in;
+	while(ub->pos > 0) {
+		int64_t chunk = ub->pos;
+		if (chunk > HTTP2_MAX_FRAME) chunk = HTTP2_MAX_FRAME;
+		if (chunk > hr->http2_window) chunk = hr->http2_window;
+		if (chunk > peer->window) chunk = peer->window;
+		if (chunk <= 0) break;
+		if (http2_frame_header(hr->http2_out, chunk, HTTP2_DATA, 0, peer->sid)) return -1;
+		if (uwsgi_buffer_append(hr->http2_out, ub->buf, chunk)) return -1;
+		if (uwsgi_buffer_decapitate(ub, chunk)) return -1;
+		hr->http2_window -= chunk;
+		peer->window -= chunk;
+	}
+	return 0;
+}
+
+// resume the streams blocked by the flow control
+static int http2_flush_streams(struct http_session *hr) {
+	struct corerouter_peer *peer = hr->session.peers;
+	while(peer) {
+		if (peer->r_parser_status == 4 && peer->in->pos > 0) {
+			if (http2_stream_data(hr, peer)) return -1;
+			// the hooks will be restored after the write to the client
+			if (peer->in->pos == 0) {
+				peer->last_hook_read = hr_instance_read_to_http2;
+			}
+		}
+		peer = peer->next;
+	}
+	return 0;
+}
+
+static ssize_t hr_instance_read_to_http2(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	struct uwsgi_buffer *out = hr->http2_out;
+
+	if (uwsgi_buffer_ensure(peer->in, uwsgi.page_size)) return -1;
+	ssize_t len = cr_read(peer, "hr_instance_read_to_http2()");
+
+	// end of the stream
+	if (!len) {
+		// the response has not been sent at all
+		if (peer->r_parser_status != 4) {
+			if (http2_frame_header(out, 4, HTTP2_RST_STREAM, 0, peer->sid)) return -1;
+			if (uwsgi_buffer_u32be(out, HTTP2_INTERNAL_ERROR)) return -1;
+		}
+		else {
+			if (http2_frame_header(out, 0, HTTP2_DATA, HTTP2_FLAG_END_STREAM, peer->sid)) return -1;
+		}
+		peer->session->main_peer->out = out;
+		peer->session->main_peer->out_pos = 0;
+		cr_write_to_main(peer, hr_ssl_write);
+		return 0;
+	}
+
+	if (peer->r_parser_status != 4) {
+		size_t i;
+		for(i=peer->in->pos-len;i<peer->in->pos;i++) {
+			char c = peer->in->buf[i];
+			if (c == '\r' && (peer->r_parser_status == 0 || peer->r_parser_status == 2)) {
+				peer->r_parser_status++;
+			}
+			else if (c == '\r') {
+				peer->r_parser_status = 1;
+			}
+			else if (c == '\n' && peer->r_parser_status == 1) {
+				peer->r_parser_status = 2;
+			}
+			// parsing done
+			else if (c == '\n' && peer->r_parser_status == 3) {
+				peer->r_parser_status = 4;
+				break;
+			}
+			else {
+				peer->r_parser_status = 0;
+			}
+		}
+		// need more data
+		if (peer->r_parser_status != 4) return 1;
+
+		struct uwsgi_buffer *hb = uwsgi_buffer_new(uwsgi.page_size);
+		if (http2_response_headers(hb, peer->in->buf, i + 1) || http2_stream_headers(hr, peer, hb)) {
+			uwsgi_buffer_destroy(hb);
+			return -1;
+		}
+		uwsgi_buffer_destroy(hb);
+		if (uwsgi_buffer_decapitate(peer->in, i + 1)) return -1;
+	}
+
+	if (http2_stream_data(hr, peer)) return -1;
+
+	// the flow control windows are exhausted, stop reading from the backend
+	if (peer->in->pos > 0) {
+		peer->last_hook_read = NULL;
+		if (out->pos == 0) {
+			if (uwsgi_cr_set_hooks(peer, NULL, NULL)) return -1;
+			return 1;
+		}
+	}
+
+	peer->session->main_peer->out = out;
+	peer->session->main_peer->out_pos = 0;
+	cr_write_to_main(peer, hr_ssl_write);
+	return 1;
+}
+
+// give back to the client the receive windows consumed by a DATA frame
+int http2_window_update(struct http_session *hr) {
+	if (http2_frame_header(hr->http2_out, 4, HTTP2_WINDOW_UPDATE, 0, 0)) return -1;
+	if (uwsgi_buffer_u32be(hr->http2_out, hr->http2_update_window_size)) return -1;
+	if (hr->http2_update_window) {
+		if (http2_frame_header(hr->http2_out, 4, HTTP2_WINDOW_UPDATE, 0, hr->http2_update_window)) return -1;
+		if (uwsgi_buffer_u32be(hr->http2_out, hr->http2_update_window_size)) return -1;
+	}
+	hr->http2_update_window = 0;
+	hr->http2_update_window_size = 0;
+	return 0;
+}
+
+/*
+	returns -1 on error, 0 to close the connection, 1 to parse the next frame
+	and 2 when a write (to the client or to a backend) has been started
+*/
+static ssize_t http2_manage_frame(struct corerouter_peer *main_peer, uint8_t type, uint8_t flags, uint32_t stream_id, uint8_t *payload, uint32_t len) {
+	struct corerouter_session *cs = main_peer->session;
+	struct http_session *hr = (struct http_session *) cs;
+	struct corerouter_peer *peer = NULL;
+	uint32_t i;
+
+	switch(type) {
+		case HTTP2_DATA:
+			if (!stream_id) return -1;
+			hr->http2_update_window_size = len;
+			if (http2_strip_padding(flags, &payload, &len)) return -1;
+			peer = uwsgi_cr_peer_find_by_sid(cs, stream_id);
+			if (peer && !(flags & HTTP2_FLAG_END_STREAM)) {
+				hr->http2_update_window = stream_id;
+			}
+			// the window update will be sent after the write to the backend
+			if (peer && len > 0) {
+				peer->out->pos = 0;
+				if (uwsgi_buffer_append(peer->out, (char *) payload, len)) return -1;
+				peer->out_pos = 0;
+				cr_write_to_backend(peer, hr_instance_write);
+				return 2;
+			}
+			if (!hr->http2_update_window_size) return 1;
+			if (http2_window_update(hr)) return -1;
+			break;
+		case HTTP2_HEADERS:
+			if (!(stream_id & 1)) return -1;
+			if (http2_strip_padding(flags, &payload, &len)) return -1;
+			if (flags & HTTP2_FLAG_PRIORITY) {
+				if (len < 5) return -1;
+				payload += 5;
+				len -= 5;
+			}
+			if (!hr->http2_headers) {
+				hr->http2_headers = uwsgi_buffer_new(uwsgi.page_size);
+				hr->http2_headers->limit = UMAX16;
+			}
+			hr->http2_headers->pos = 0;
+			if (uwsgi_buffer_append(hr->http2_headers, (char *) payload, len)) return -1;
+			if (!(flags & HTTP2_FLAG_END_HEADERS)) {
+				hr->http2_headers_stream_id = stream_id;
+				return 1;
+			}
+			return http2_new_stream(hr, stream_id);
+		case HTTP2_CONTINUATION:
+			if (!hr->http2_headers_stream_id || stream_id != hr->http2_headers_stream_id) return -1;
+			if (uwsgi_buffer_append(hr->http2_headers, (char *) payload, len)) return -1;
+			if (!(flags & HTTP2_FLAG_END_HEADERS)) return 1;
+			hr->http2_headers_stream_id = 0;
+			return http2_new_stream(hr, stream_id);
+		case HTTP2_RST_STREAM:
+			peer = uwsgi_cr_peer_find_by_sid(cs, stream_id);
+			if (peer) {
+				corerouter_close_peer(cs->corerouter, peer);
+			}
+			return 1;
+		case HTTP2_SETTINGS:
+			if (stream_id || len % 6) return -1;
+			if (flags & HTTP2_FLAG_ACK) return 1;
+			for(i=0;i<len;i+=6) {
+				uint16_t id = uwsgi_be16((char *) payload + i);
+				uint32_t value = uwsgi_be32((char *) payload + i + 2);
+				if (id == HTTP2_SETTINGS_INITIAL_WINDOW_SIZE) {
+					if (value > 0x7fffffff) return -1;
+					int64_t delta = (int64_t) value - hr->http2_initial_window;
+					hr->http2_initial_window = value;
+					peer = cs->peers;
+					while(peer) {
+						peer->window += delta;
+						peer = peer->next;
+					}
+				}
+			}
+			if (http2_frame_header(hr->http2_out, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0)) return -1;
+			if (http2_flush_streams(hr)) return -1;
+			break;
+		case HTTP2_PING:
+			if (stream_id || len != 8) return -1;
+			if (flags & HTTP2_FLAG_ACK) return 1;
+			if (http2_frame_header(hr->http2_out, 8, HTTP2_PING, HTTP2_FLAG_ACK, 0)) return -1;
+			if (uwsgi_buffer_append(hr->http2_out, (char *) payload, 8)) return -1;
+			break;
+		case HTTP2_GOAWAY:
+			return 0;
+		case HTTP2_WINDOW_UPDATE:
+			if (len != 4) return -1;
+			uint32_t increment = uwsgi_be32((char *) payload) & 0x7fffffff;
+			if (!increment) return -1;
+			if (!stream_id) {
+				hr->http2_window += increment;
+			}
+			else {
+				peer = uwsgi_cr_peer_find_by_sid(cs, stream_id);
+				if (peer) peer->window += increment;
+			}
+			if (http2_flush_streams(hr)) return -1;
+			if (hr->http2_out->pos == 0) return 1;
+			break;
+		// clients cannot push
+		case HTTP2_PUSH_PROMISE:
+			return -1;
+		// PRIORITY and unknown frames are ignored
+		default:
+			return 1;
+	}
+
+	main_peer->out = hr->http2_out;
+	main_peer->out_pos = 0;
+	cr_write_to_main(main_peer, hr_ssl_write);
+	return 2;
+}
+
+/*
+
+	read from ssl peer (once "h2" has been negotiated via ALPN).
+
+	The parser stops after each frame requiring a write, and it is called again
+	when the write (to the client or to a backend) is complete.
+
+*/
+
+ssize_t http2_parse(struct corerouter_peer *main_peer) {
+	struct corerouter_session *cs = main_peer->session;
+	struct http_session *hr = (struct http_session *) cs;
+	struct uwsgi_buffer *ub = main_peer->in;
+
+	if (!hr->http2_initialized) {
+		if (!http2_huffman.ready) http2_huffman_init();
+		hr->http2_hpack = uwsgi_calloc(sizeof(struct http2_hpack));
+		hr->http2_hpack->max_size = HTTP2_HPACK_TABLE_SIZE;
+		hr->http2_out = uwsgi_buffer_new(uwsgi.page_size);
+		hr->http2_window = HTTP2_DEFAULT_WINDOW;
+		hr->http2_initial_window = HTTP2_DEFAULT_WINDOW;
+		hr->http2_phase = UWSGI_HTTP2_PHASE_PREFACE;
+		cs->can_keepalive = 1;
+		hr->http2_initialized = 1;
+		// frames are written as soon as they are ready, do not let them wait for delayed acks
+		if (cs->client_sockaddr.sa.sa_family != AF_UNIX) {
+			uwsgi_tcp_nodelay(main_peer->fd);
+		}
+
+		// server connection preface
+		if (http2_frame_header(hr->http2_out, 6, HTTP2_SETTINGS, 0, 0)) return -1;
+		if (uwsgi_buffer_u16be(hr->http2_out, HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS)) return -1;
+		if (uwsgi_buffer_u32be(hr->http2_out, HTTP2_MAX_STREAMS)) return -1;
+
+		main_peer->out = hr->http2_out;
+		main_peer->out_pos = 0;
+		cr_write_to_main(main_peer, hr_ssl_write);
+		return 1;
+	}
+
+	for(;;) {
+		if (hr->http2_phase == UWSGI_HTTP2_PHASE_PREFACE) {
+			if (ub->pos < 24) return 1;
+			if (memcmp(ub->buf, HTTP2_PREFACE, 24)) return -1;
+			if (uwsgi_buffer_decapitate(ub, 24)) return -1;
+			hr->http2_phase = UWSGI_HTTP2_PHASE_FRAME;
+			continue;
+		}
+
+		if (ub->pos < 9) return 1;
+		uint8_t *buf = (uint8_t *) ub->buf;
+		uint32_t len = (buf[0] << 16) | (buf[1] << 8) | buf[2];
+		if (len > HTTP2_MAX_FRAME) return -1;
+		if (ub->pos < 9 + len) return 1;
+		uint8_t type = buf[3];
+		uint32_t stream_id = uwsgi_be32((char *) buf + 5) & 0x7fffffff;
+
+		// header blocks cannot be interleaved with other frames
+		if (hr->http2_headers_stream_id && type != HTTP2_CONTINUATION) return -1;
+
+		ssize_t ret = http2_manage_frame(main_peer, type, buf[4], stream_id, buf + 9, len);
+		if (ret < 0) return -1;
+		if (uwsgi_buffer_decapitate(ub, 9 + len)) return -1;
+		if (ret == 0) return 0;
+		if (ret > 1) return 1;
+	}
+
+	return -1;
+}
+
+int uwsgi_http2_alpn(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+	if (SSL_select_next_proto((unsigned char **) out, outlen, (const unsigned char *) "\x02h2\x08http/1.1", 12, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+	if (*outlen == 2 && !memcmp(*out, "h2", 2)) {
+		struct http_session *hr = SSL_get_ex_data(ssl, uhttp.http2_index);
+		if (hr) hr->http2 = 1;
+	}
+	return SSL_TLSEXT_ERR_OK;
+}
+
+void http2_session_close(struct http_session *hr) {
+	if (hr->http2_hpack) {
+		http2_hpack_evict(hr->http2_hpack, HTTP2_HPACK_TABLE_SIZE + 1);
+		free(hr->http2_hpack);
+	}
+	if (hr->http2_headers) {
+		uwsgi_buffer_destroy(hr->http2_headers);
+	}
+	if (hr->http2_out) {
+		uwsgi_buffer_destroy(hr->http2_out);
+	}
+}
+
+#endif
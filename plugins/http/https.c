@@ -69,6 +69,7 @@ void uwsgi_opt_https2(char *opt, char *value, void *cr) {
 	char *s2_ciphers = NULL;
 	char *s2_clientca = NULL;
 	char *s2_spdy = NULL;
+	char *s2_http2 = NULL;
 
 	if (uwsgi_kvlist_parse(value, strlen(value), ',', '=',
                         "addr", &s2_addr,
@@ -79,6 +80,7 @@ void uwsgi_opt_https2(char *opt, char *value, void *cr) {
                         "clientca", &s2_clientca,
                         "client_ca", &s2_clientca,
                         "spdy", &s2_spdy,
+                        "http2", &s2_http2,
                 	NULL)) {
 		uwsgi_log("error parsing --https2 option\n");
 		exit(1);
@@ -129,6 +131,19 @@ void uwsgi_opt_https2(char *opt, char *value, void *cr) {
         	SSL_CTX_set_info_callback(ugs->ctx, uwsgi_spdy_info_cb);
         	SSL_CTX_set_next_protos_advertised_cb(ugs->ctx, uwsgi_spdy_npn, NULL);
 	}
+#endif
+#ifdef UWSGI_HTTP2
+	if (s2_http2) {
+		if (!uhttp.http2_index) {
+			uhttp.http2_index = SSL_get_ex_new_index(0, "http2", NULL, NULL, NULL);
+		}
+		SSL_CTX_set_alpn_select_cb(ugs->ctx, uwsgi_http2_alpn, NULL);
+	}
+#else
+	if (s2_http2) {
+		uwsgi_log("HTTP/2 support requires ALPN (OpenSSL >= 1.0.2)\n");
+		exit(1);
+	}
 #endif
         // set the ssl mode
         ugs->mode = UWSGI_HTTP_SSL;
@@ -231,6 +246,10 @@ void hr_session_ssl_close(struct corerouter_session *cs) {
                 X509_free(hr->ssl_client_cert);
         }
 
+        if (hr->hs_out) {
+                uwsgi_buffer_destroy(hr->hs_out);
+        }
+
 #ifdef UWSGI_SPDY
 	if (hr->spdy_ping) {
 		uwsgi_buffer_destroy(hr->spdy_ping);
@@ -240,6 +259,11 @@ void hr_session_ssl_close(struct corerouter_session *cs) {
 		deflateEnd(&hr->spdy_z_out);
 	}
 #endif
+#ifdef UWSGI_HTTP2
+	if (hr->http2) {
+		http2_session_close(hr);
+	}
+#endif
 
 	// clear the errors (otherwise they could be propagated)
 	ERR_clear_error();
@@ -293,11 +317,20 @@ ssize_t hr_ssl_write(struct corerouter_peer *main_peer) {
                         	main_peer->session->connect_peer_after_write = NULL;
                         	return ret;
                 	}
+			if (hr->backend_done) {
+				if (hr_backend_release(hr)) return -1;
+				return ret;
+			}
                         cr_reset_hooks(main_peer);
 #ifdef UWSGI_SPDY
 			if (hr->spdy) {
 				return spdy_parse(main_peer);
 			}
+#endif
+#ifdef UWSGI_HTTP2
+			if (hr->http2) {
+				return http2_parse(main_peer);
+			}
 #endif
                 }
                 return ret;
@@ -358,6 +391,11 @@ ssize_t hr_ssl_read(struct corerouter_peer *main_peer) {
                         //uwsgi_log("RUNNING THE SPDY PARSER FOR %d bytes\n", main_peer->in->pos);
                         return spdy_parse(main_peer);
                 }
+#endif
+#ifdef UWSGI_HTTP2
+                if (hr->http2) {
+                        return http2_parse(main_peer);
+                }
 #endif
                 return http_parse(main_peer);
         }
@@ -427,14 +465,260 @@ ssize_t hr_ssl_shutdown(struct corerouter_peer *peer) {
         return -1;
 }
 
+/*
+	offloaded handshakes (--https-handshake-threads)
+
+	the handshake runs on a pair of memory bios: the event loop reads the TLS records from the client
+	(one at a time, so no application data after the handshake ends up in the memory bio) and queues
+	the session to a pool of threads running SSL_do_handshake(). The result comes back to the event loop
+	via its completion pipe, and the generated records are written to the client by the event loop.
+	When the handshake is complete the ssl object is moved to the socket (so kTLS is not used for these sessions).
+
+	While a handshake is in a thread no event is monitored for the session and its timeout is postponed.
+*/
+
+// a TLS record is at most 2^14 bytes + 2048 of expansion
+#define HR_SSL_MAX_RECORD (5 + 16384 + 2048)
+
+static pthread_mutex_t hr_handshake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hr_handshake_cond = PTHREAD_COND_INITIALIZER;
+static struct http_session *hr_handshake_head;
+static struct http_session *hr_handshake_tail;
+static pthread_once_t hr_handshake_once = PTHREAD_ONCE_INIT;
+
+static void *hr_handshake_thread(void *arg) {
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	for(;;) {
+		pthread_mutex_lock(&hr_handshake_lock);
+		while(!hr_handshake_head) {
+			pthread_cond_wait(&hr_handshake_cond, &hr_handshake_lock);
+		}
+		struct http_session *hr = hr_handshake_head;
+		hr_handshake_head = hr->hs_next;
+		if (!hr_handshake_head) hr_handshake_tail = NULL;
+		pthread_mutex_unlock(&hr_handshake_lock);
+
+		ERR_clear_error();
+		hr->hs_ret = SSL_do_handshake(hr->ssl);
+		hr->hs_err = hr->hs_ret == 1 ? 0 : SSL_get_error(hr->ssl, hr->hs_ret);
+		if (hr->hs_err == SSL_ERROR_SSL && uwsgi.ssl_verbose) {
+			ERR_print_errors_fp(stderr);
+		}
+		ERR_clear_error();
+
+		int fd = hr->session.corerouter->offload_pipe[1];
+		if (write(fd, &hr, sizeof(struct http_session *)) != sizeof(struct http_session *)) {
+			uwsgi_error("hr_handshake_thread()/write()");
+		}
+	}
+	return NULL;
+}
+
+static void hr_handshake_threads_start() {
+	int i;
+	for(i=0;i<uhttp.https_handshake_threads;i++) {
+		pthread_t t;
+		if (pthread_create(&t, NULL, hr_handshake_thread, NULL)) {
+			uwsgi_error("hr_handshake_threads_start()/pthread_create()");
+			exit(1);
+		}
+	}
+}
+
+// keep the session alive while its handshake is running in a thread
+static int hr_handshake_timeout(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	return hr->hs_pending ? 0 : 1;
+}
+
+static ssize_t hr_handshake_read(struct corerouter_peer *);
+static void hr_handshake_done(struct uwsgi_corerouter *, int);
+
+static int hr_handshake_submit(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+	struct uwsgi_corerouter *ucr = main_peer->session->corerouter;
+
+	if (!ucr->offload_ready) {
+		if (pipe(ucr->offload_pipe)) {
+			uwsgi_error("hr_handshake_submit()/pipe()");
+			return -1;
+		}
+		uwsgi_socket_nb(ucr->offload_pipe[0]);
+		if (event_queue_add_fd_read(ucr->queue, ucr->offload_pipe[0])) return -1;
+		ucr->offload_hook = hr_handshake_done;
+		ucr->offload_ready = 1;
+	}
+	pthread_once(&hr_handshake_once, hr_handshake_threads_start);
+
+	if (uwsgi_cr_set_hooks(main_peer, NULL, NULL)) return -1;
+	hr->hs_pending = 1;
+	hr->session.timeout = hr_handshake_timeout;
+
+	hr->hs_next = NULL;
+	pthread_mutex_lock(&hr_handshake_lock);
+	if (hr_handshake_tail) {
+		hr_handshake_tail->hs_next = hr;
+	}
+	else {
+		hr_handshake_head = hr;
+	}
+	hr_handshake_tail = hr;
+	pthread_cond_signal(&hr_handshake_cond);
+	pthread_mutex_unlock(&hr_handshake_lock);
+	return 0;
+}
+
+// what to do after the output of a handshake step has been sent
+static int hr_handshake_next(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+
+	if (hr->hs_ret == 1) {
+		// move to the socket (the memory bios are freed)
+		SSL_set_fd(hr->ssl, main_peer->fd);
+		hr->hs_rbio = NULL;
+		hr->hs_wbio = NULL;
+		if (hr->hs_out) {
+			uwsgi_buffer_destroy(hr->hs_out);
+			hr->hs_out = NULL;
+		}
+		main_peer->in->pos = 0;
+		return uwsgi_cr_set_hooks(main_peer, hr_ssl_read, NULL);
+	}
+
+	if (hr->hs_err == SSL_ERROR_WANT_READ) {
+		return uwsgi_cr_set_hooks(main_peer, hr_handshake_read, NULL);
+	}
+
+	// the handshake failed (the alert, if any, has been already sent)
+	return -1;
+}
+
+static ssize_t hr_handshake_write(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+
+	ssize_t len = write(main_peer->fd, hr->hs_out->buf + hr->hs_out_pos, hr->hs_out->pos - hr->hs_out_pos);
+	if (len < 0) {
+		if (uwsgi_is_again()) {
+			if (uwsgi_cr_set_hooks(main_peer, NULL, hr_handshake_write)) return -1;
+			return 1;
+		}
+		uwsgi_cr_error(main_peer, "hr_handshake_write()");
+		return -1;
+	}
+	hr->hs_out_pos += len;
+	if (hr->hs_out_pos < hr->hs_out->pos) {
+		if (uwsgi_cr_set_hooks(main_peer, NULL, hr_handshake_write)) return -1;
+		return len;
+	}
+	hr->hs_out->pos = 0;
+	hr->hs_out_pos = 0;
+	if (hr_handshake_next(main_peer)) return -1;
+	return len;
+}
+
+// a handshake step completed in a thread
+static int hr_handshake_flush(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+	hr->hs_pending = 0;
+	hr->session.timeout = NULL;
+
+	size_t pending = BIO_ctrl_pending(hr->hs_wbio);
+	if (pending == 0) return hr_handshake_next(main_peer);
+
+	if (!hr->hs_out) {
+		hr->hs_out = uwsgi_buffer_new(pending);
+	}
+	hr->hs_out->pos = 0;
+	hr->hs_out_pos = 0;
+	if (uwsgi_buffer_ensure(hr->hs_out, pending)) return -1;
+	int rlen = BIO_read(hr->hs_wbio, hr->hs_out->buf, pending);
+	if (rlen <= 0) return -1;
+	hr->hs_out->pos = rlen;
+	return hr_handshake_write(main_peer) < 0 ? -1 : 0;
+}
+
+static void hr_handshake_done(struct uwsgi_corerouter *ucr, int fd) {
+	struct http_session *hrs[64];
+	for(;;) {
+		ssize_t len = read(fd, hrs, sizeof(hrs));
+		if (len <= 0) return;
+		size_t i;
+		for(i=0;i<(size_t) len / sizeof(struct http_session *);i++) {
+			struct corerouter_peer *main_peer = hrs[i]->session.main_peer;
+			if (hr_handshake_flush(main_peer)) {
+				main_peer->session->can_keepalive = 0;
+				corerouter_close_peer(ucr, main_peer);
+			}
+		}
+	}
+}
+
+// read a whole TLS record for the handshake
+static ssize_t hr_handshake_read(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+	struct uwsgi_buffer *in = main_peer->in;
+	ssize_t rlen = 0;
+
+	for(;;) {
+		size_t need = 5;
+		if (in->pos >= 5) {
+			// change_cipher_spec, alert, handshake or application_data
+			if ((uint8_t) in->buf[0] < 20 || (uint8_t) in->buf[0] > 23) {
+				uwsgi_cr_log(main_peer, "invalid TLS record type: %u\n", (uint8_t) in->buf[0]);
+				return -1;
+			}
+			need +=((uint8_t) in->buf[3] << 8) | (uint8_t) in->buf[4];
+			if (need > HR_SSL_MAX_RECORD) {
+				uwsgi_cr_log(main_peer, "invalid TLS record size: %llu\n", (unsigned long long) need);
+				return -1;
+			}
+			if (in->pos == need) break;
+		}
+		if (uwsgi_buffer_ensure(in, need - in->pos)) return -1;
+		ssize_t len = read(main_peer->fd, in->buf + in->pos, need - in->pos);
+		if (len < 0) {
+			// wait for the rest of the record
+			if (uwsgi_is_again() && rlen > 0) return rlen;
+			cr_try_again;
+			uwsgi_cr_error(main_peer, "hr_handshake_read()");
+			return -1;
+		}
+		if (len == 0) return 0;
+		in->pos += len;
+		rlen += len;
+	}
+
+	if (BIO_write(hr->hs_rbio, in->buf, in->pos) != (int) in->pos) return -1;
+	in->pos = 0;
+	if (hr_handshake_submit(main_peer)) return -1;
+	return rlen;
+}
+
 void hr_setup_ssl(struct http_session *hr, struct uwsgi_gateway_socket *ugs) {
  	hr->ssl = SSL_new(ugs->ctx);
-        SSL_set_fd(hr->ssl, hr->session.main_peer->fd);
+	if (uhttp.https_handshake_threads > 0) {
+		hr->hs_rbio = BIO_new(BIO_s_mem());
+		hr->hs_wbio = BIO_new(BIO_s_mem());
+		// report WANT_READ when the input is consumed
+		BIO_set_mem_eof_return(hr->hs_rbio, -1);
+		SSL_set_bio(hr->ssl, hr->hs_rbio, hr->hs_wbio);
+	}
+	else {
+        	SSL_set_fd(hr->ssl, hr->session.main_peer->fd);
+	}
         SSL_set_accept_state(hr->ssl);
 #ifdef UWSGI_SPDY
         SSL_set_ex_data(hr->ssl, uhttp.spdy_index, hr);
 #endif
-        uwsgi_cr_set_hooks(hr->session.main_peer, hr_ssl_read, NULL);
+#ifdef UWSGI_HTTP2
+	if (uhttp.http2_index > 0) {
+        	SSL_set_ex_data(hr->ssl, uhttp.http2_index, hr);
+	}
+#endif
+        uwsgi_cr_set_hooks(hr->session.main_peer, hr->hs_rbio ? hr_handshake_read : hr_ssl_read, NULL);
 	hr->session.main_peer->flush = hr_ssl_shutdown;
         hr->session.close = hr_session_ssl_close;
 	hr->func_write = hr_ssl_write;
@@ -0,0 +1,408 @@
+/*
+
+   uWSGI HTTP router websockets hub
+
+   websocket connections to the --http-websockets-hub prefix are terminated in the router
+   (no backend, no worker core) and subscribed to the channel named by the rest of the path.
+
+   The workers publish messages with uwsgi_websocket_publish() (uwsgi.websocket_publish() in python):
+   a uwsgi packet (modifier1 0) with the "channel" and "message" keys (and optionally "binary") sent to the
+   --http-websockets-hub-socket datagram socket. Every message is sent to all of the channel subscribers.
+
+   Clients are pinged after --http-websockets-hub-ping seconds of inactivity and disconnected if they do not
+   answer, slow clients with more than --http-websockets-hub-max-pending bytes waiting to be sent are disconnected.
+
+   As the channels live in the memory of the router, the hub requires a single http router process and thread.
+
+*/
+
+#include "common.h"
+
+extern struct uwsgi_http uhttp;
+
+#define HR_HUB_BUCKETS 4096
+
+struct hr_hub_channel {
+	char *name;
+	uint16_t name_len;
+	uint64_t subscribers;
+	struct http_session *sessions;
+	struct hr_hub_channel *next;
+};
+
+static struct hr_hub_channel *hr_hub_channels[HR_HUB_BUCKETS];
+
+static struct hr_hub_channel *hr_hub_channel_get(char *name, uint16_t name_len, int create) {
+	uint32_t slot = djb33x_hash(name, name_len) % HR_HUB_BUCKETS;
+	struct hr_hub_channel *channel = hr_hub_channels[slot];
+	while(channel) {
+		if (!uwsgi_strncmp(channel->name, channel->name_len, name, name_len)) return channel;
+		channel = channel->next;
+	}
+	if (!create) return NULL;
+	channel = uwsgi_calloc(sizeof(struct hr_hub_channel));
+	channel->name = uwsgi_concat2n(name, name_len, "", 0);
+	channel->name_len = name_len;
+	channel->next = hr_hub_channels[slot];
+	hr_hub_channels[slot] = channel;
+	return channel;
+}
+
+static void hr_hub_channel_del(struct hr_hub_channel *channel) {
+	uint32_t slot = djb33x_hash(channel->name, channel->name_len) % HR_HUB_BUCKETS;
+	struct hr_hub_channel **prev = &hr_hub_channels[slot];
+	while(*prev) {
+		if (*prev == channel) {
+			*prev = channel->next;
+			break;
+		}
+		prev = &(*prev)->next;
+	}
+	free(channel->name);
+	free(channel);
+}
+
+// check the handshake headers (called by the parser only when the hub is enabled)
+void hr_hub_request_header(struct http_session *hr, char *hh, size_t hhlen) {
+	char *colon = memchr(hh, ':', hhlen);
+	if (!colon) return;
+	size_t keylen = colon - hh;
+	char *value = colon + 1;
+	size_t vallen = hhlen - (keylen + 1);
+	while (vallen > 0 && (*value == ' ' || *value == '\t')) {
+		value++;
+		vallen--;
+	}
+
+	if (!uwsgi_strnicmp(hh, keylen, "Upgrade", 7)) {
+		if (!uwsgi_strnicmp(value, vallen, "websocket", 9)) hr->hub_upgrade++;
+	}
+	else if (!uwsgi_strnicmp(hh, keylen, "Connection", 10)) {
+		// could be "keep-alive, Upgrade"
+		if (uwsgi_contains_n(value, vallen, "Upgrade", 7) || uwsgi_contains_n(value, vallen, "upgrade", 7)) hr->hub_upgrade++;
+	}
+	else if (!uwsgi_strnicmp(hh, keylen, "Sec-WebSocket-Key", 17)) {
+		hr->hub_key = value;
+		hr->hub_key_len = vallen;
+	}
+}
+
+// the request is for the hub (the channel name is after the prefix, without the query string)
+int hr_hub_match(struct http_session *hr, char **name, uint16_t *name_len) {
+	if (hr->request_uri_len <= uhttp.websockets_hub_len) return 0;
+	if (memcmp(hr->request_uri, uhttp.websockets_hub, uhttp.websockets_hub_len)) return 0;
+	*name = hr->request_uri + uhttp.websockets_hub_len;
+	char *query = memchr(*name, '?', hr->request_uri_len - uhttp.websockets_hub_len);
+	*name_len = query ? (size_t) (query - *name) : hr->request_uri_len - uhttp.websockets_hub_len;
+	return *name_len > 0;
+}
+
+static ssize_t hr_hub_write(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+	ssize_t ret = hr->func_write(main_peer);
+	// everything has been sent, release the memory (idle connections do not need it)
+	if (ret > 0 && !main_peer->hook_write) {
+		uwsgi_buffer_destroy(hr->hub_out);
+		hr->hub_out = NULL;
+		main_peer->out = NULL;
+		main_peer->out_pos = 0;
+	}
+	return ret;
+}
+
+/*
+	queue a frame for the client, only plain connections without pending data
+	are written immediately (avoiding a copy of the message for every subscriber)
+*/
+static int hr_hub_frame(struct http_session *hr, uint8_t opcode, char *buf, size_t len, int direct) {
+	struct corerouter_peer *main_peer = hr->session.main_peer;
+	char header[10];
+	size_t header_len = 2;
+	header[0] = 0x80 | opcode;
+	if (len < 126) {
+		header[1] = len;
+	}
+	else if (len <= UMAX16) {
+		header[1] = 126;
+		header[2] = (uint8_t) ((len >> 8) & 0xff);
+		header[3] = (uint8_t) (len & 0xff);
+		header_len = 4;
+	}
+	else {
+		int i;
+		header[1] = 127;
+		for(i=0;i<8;i++) {
+			header[2+i] = (uint8_t) ((((uint64_t) len) >> (8 * (7-i))) & 0xff);
+		}
+		header_len = 10;
+	}
+
+	size_t skip = 0;
+	if (direct && !main_peer->hook_write && hr->func_write == hr_write) {
+		struct iovec iov[2];
+		iov[0].iov_base = header;
+		iov[0].iov_len = header_len;
+		iov[1].iov_base = buf;
+		iov[1].iov_len = len;
+		ssize_t wlen = writev(main_peer->fd, iov, 2);
+		if (wlen < 0) {
+			if (!uwsgi_is_again()) return -1;
+			wlen = 0;
+		}
+		if ((size_t) wlen == header_len + len) return 0;
+		skip = wlen;
+	}
+
+	if (!hr->hub_out) {
+		hr->hub_out = uwsgi_buffer_new(UMAX((size_t) uwsgi.page_size, header_len + len));
+	}
+	if (hr->hub_out->pos + header_len + len - skip > uhttp.websockets_hub_max_pending) {
+		uwsgi_cr_log(main_peer, "too much data pending for the websockets hub client (%llu bytes), closing it\n", (unsigned long long) (hr->hub_out->pos - main_peer->out_pos));
+		return -1;
+	}
+	if (skip < header_len) {
+		if (uwsgi_buffer_append(hr->hub_out, header + skip, header_len - skip)) return -1;
+		skip = 0;
+	}
+	else {
+		skip -= header_len;
+	}
+	if (uwsgi_buffer_append(hr->hub_out, buf + skip, len - skip)) return -1;
+
+	// a write is already in progress
+	if (main_peer->hook_write) return 0;
+	main_peer->out = hr->hub_out;
+	main_peer->out_pos = 0;
+	return uwsgi_cr_set_hooks(main_peer, NULL, hr_hub_write);
+}
+
+// ping the idle clients, close them if the previous ping has not been answered
+static int hr_hub_timeout(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	if (peer != peer->session->main_peer || hr->hub_ping_sent) return -1;
+	hr->hub_ping_sent = 1;
+	return hr_hub_frame(hr, 0x9, "", 0, 1);
+}
+
+int hr_hub_accept(struct corerouter_peer *peer, char *name, uint16_t name_len) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	struct corerouter_peer *main_peer = peer->session->main_peer;
+#ifdef UWSGI_SSL
+	char sha1[20];
+	if (!uwsgi_sha1_2n(hr->hub_key, hr->hub_key_len, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36, sha1)) return -1;
+	size_t b64_len = 0;
+	char *b64 = uwsgi_base64_encode(sha1, 20, &b64_len);
+	if (!b64) return -1;
+
+	// the backend peer is not needed
+	corerouter_drop_peer(peer->session->corerouter, peer);
+
+	hr->hub_out = uwsgi_buffer_new(uwsgi.page_size);
+	if (uwsgi_buffer_append(hr->hub_out, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ", 97)) goto error;
+	if (uwsgi_buffer_append(hr->hub_out, b64, b64_len)) goto error;
+	if (uwsgi_buffer_append(hr->hub_out, "\r\n\r\n", 4)) goto error;
+	free(b64);
+
+	struct hr_hub_channel *channel = hr_hub_channel_get(name, name_len, 1);
+	hr->hub_channel = channel;
+	hr->hub_next = channel->sessions;
+	if (channel->sessions) channel->sessions->hub_prev = hr;
+	channel->sessions = hr;
+	channel->subscribers++;
+	uhttp.websockets_hub_subscribers++;
+
+	hr->session.can_keepalive = 0;
+	hr->session.timeout = hr_hub_timeout;
+
+	// keep the frames already sent by the client
+	memmove(main_peer->in->buf, main_peer->in->buf + hr->headers_size + 1, hr->remains);
+	main_peer->in->pos = hr->remains;
+
+	http_set_timeout(main_peer, uhttp.websockets_hub_ping);
+
+	main_peer->out = hr->hub_out;
+	main_peer->out_pos = 0;
+	if (uwsgi_cr_set_hooks(main_peer, NULL, hr_hub_write)) return -1;
+	return 0;
+error:
+	free(b64);
+	return -1;
+#else
+	uwsgi_cr_log(main_peer, "the websockets hub handshake requires %s support\n", "SSL");
+	return -1;
+#endif
+}
+
+// parse the frames sent by a client (called by http_parse)
+ssize_t hr_hub_parse(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+	struct uwsgi_buffer *ub = main_peer->in;
+
+	// the client is alive
+	hr->hub_ping_sent = 0;
+
+	for(;;) {
+		if (ub->pos < 2) break;
+		uint8_t *p = (uint8_t *) ub->buf;
+		uint8_t opcode = p[0] & 0xf;
+		// clients must mask their frames
+		if (!(p[1] & 0x80)) return -1;
+		uint64_t size = p[1] & 0x7f;
+		size_t need = 2;
+		if (size == 126) {
+			need += 2;
+			if (ub->pos < need) break;
+			size = uwsgi_be16(ub->buf + 2);
+		}
+		else if (size == 127) {
+			need += 8;
+			if (ub->pos < need) break;
+			size = uwsgi_be64(ub->buf + 2);
+		}
+		// the buffer cannot grow over 64k
+		if (size > UMAX16 - 14) {
+			uwsgi_cr_log(main_peer, "websockets hub client frame too big: %llu bytes\n", (unsigned long long) size);
+			return -1;
+		}
+		need += 4;
+		if (ub->pos < need + size) break;
+
+		char *payload = ub->buf + need;
+		uwsgi_websocket_mask(payload, size, payload - 4);
+
+		switch(opcode) {
+			// close, answer with the status code and wait for the write
+			case 0x8:
+				if (hr_hub_frame(hr, 0x8, payload, UMIN(size, 2), 0)) return -1;
+				hr->session.wait_full_write = 1;
+				ub->pos = 0;
+				return 1;
+			// ping
+			case 0x9:
+				if (hr_hub_frame(hr, 0xA, payload, size, 1)) return -1;
+				break;
+			// pong and data frames from the clients are ignored
+			default:
+				break;
+		}
+
+		if (uwsgi_buffer_decapitate(ub, need + size)) return -1;
+	}
+
+	return 1;
+}
+
+void hr_hub_session_close(struct http_session *hr) {
+	if (hr->hub_out) {
+		uwsgi_buffer_destroy(hr->hub_out);
+		hr->hub_out = NULL;
+	}
+	struct hr_hub_channel *channel = hr->hub_channel;
+	if (!channel) return;
+	if (hr->hub_prev) hr->hub_prev->hub_next = hr->hub_next;
+	else channel->sessions = hr->hub_next;
+	if (hr->hub_next) hr->hub_next->hub_prev = hr->hub_prev;
+	hr->hub_channel = NULL;
+	uhttp.websockets_hub_subscribers--;
+	if (--channel->subscribers == 0) {
+		hr_hub_channel_del(channel);
+	}
+}
+
+struct hr_hub_message {
+	char *channel;
+	uint16_t channel_len;
+	char *message;
+	uint16_t message_len;
+	int binary;
+};
+
+static void hr_hub_message_parser(char *key, uint16_t keylen, char *value, uint16_t vallen, void *data) {
+	struct hr_hub_message *hhm = (struct hr_hub_message *) data;
+	if (!uwsgi_strncmp(key, keylen, "channel", 7)) {
+		hhm->channel = value;
+		hhm->channel_len = vallen;
+	}
+	else if (!uwsgi_strncmp(key, keylen, "message", 7)) {
+		hhm->message = value;
+		hhm->message_len = vallen;
+	}
+	else if (!uwsgi_strncmp(key, keylen, "binary", 6)) {
+		hhm->binary = vallen > 0 && value[0] != '0';
+	}
+}
+
+// a message has been published (the hook of the plugin fd)
+void hr_hub_publish(struct uwsgi_corerouter *ucr, int fd) {
+	char buf[UMAX16 + 4];
+	ssize_t len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0) {
+		if (!uwsgi_is_again()) uwsgi_error("hr_hub_publish()/recv()");
+		return;
+	}
+	if (len < 4) return;
+	struct uwsgi_header *uh = (struct uwsgi_header *) buf;
+	uint16_t pktsize = uh->_pktsize;
+#ifdef __BIG_ENDIAN__
+	pktsize = uwsgi_swap16(pktsize);
+#endif
+	if (uh->modifier1 != 0 || (size_t) len < (size_t) pktsize + 4) {
+		uwsgi_log("[uwsgi-http] invalid websockets hub packet\n");
+		return;
+	}
+
+	struct hr_hub_message hhm;
+	memset(&hhm, 0, sizeof(struct hr_hub_message));
+	if (uwsgi_hooked_parse(buf + 4, pktsize, hr_hub_message_parser, &hhm)) return;
+	if (!hhm.channel_len) return;
+
+	struct hr_hub_channel *channel = hr_hub_channel_get(hhm.channel, hhm.channel_len, 0);
+	if (!channel) return;
+	uhttp.websockets_hub_published++;
+
+	struct http_session *hr = channel->sessions;
+	while(hr) {
+		// the session could be destroyed (and the channel too, but only with its last session)
+		struct http_session *next = hr->hub_next;
+		if (hr_hub_frame(hr, hhm.binary ? 0x2 : 0x1, hhm.message, hhm.message_len, 1)) {
+			corerouter_close_session(ucr, &hr->session);
+		}
+		hr = next;
+	}
+}
+
+void hr_hub_init() {
+	if (!uhttp.websockets_hub) return;
+
+	if (!uhttp.websockets_hub_socket) {
+		uwsgi_log("--http-websockets-hub requires --http-websockets-hub-socket\n");
+		exit(1);
+	}
+
+	if (uhttp.cr.processes > 1 || uhttp.cr.threads > 1) {
+		uwsgi_log("the http websockets hub requires a single http router process and thread\n");
+		exit(1);
+	}
+
+	uhttp.websockets_hub_len = strlen(uhttp.websockets_hub);
+	if (!uhttp.websockets_hub_ping) uhttp.websockets_hub_ping = 30;
+	if (!uhttp.websockets_hub_max_pending) uhttp.websockets_hub_max_pending = 1024 * 1024;
+
+	char *colon = strchr(uhttp.websockets_hub_socket, ':');
+	if (colon) {
+		// bind_to_udp() modifies the string
+		char *addr = uwsgi_str(uhttp.websockets_hub_socket);
+		uhttp.cr.plugin_fd = bind_to_udp(addr, 0, 0);
+		free(addr);
+	}
+	else {
+		uhttp.cr.plugin_fd = bind_to_unix_dgram(uhttp.websockets_hub_socket);
+	}
+	if (uhttp.cr.plugin_fd < 0) {
+		uwsgi_log("unable to bind the http websockets hub socket %s\n", uhttp.websockets_hub_socket);
+		exit(1);
+	}
+	uwsgi_socket_nb(uhttp.cr.plugin_fd);
+	uhttp.cr.plugin_fd_hook = hr_hub_publish;
+	uwsgi_log("*** http websockets hub enabled on %s (messages from %s) ***\n", uhttp.websockets_hub, uhttp.websockets_hub_socket);
+}
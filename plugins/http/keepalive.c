@@ -6,6 +6,18 @@ extern struct uwsgi_http uhttp;
 static char gzheader[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 };
 #endif
 
+#ifdef UWSGI_ZLIB
+// check the Content-Type of a response against the --http-gzip-type list (prefixes)
+static int http_gzip_type(char *value, size_t len) {
+	struct uwsgi_string_list *usl = uhttp.gzip_types;
+	while (usl) {
+		if (len >= usl->len && !uwsgi_strnicmp(value, usl->len, usl->value, usl->len)) return 1;
+		usl = usl->next;
+	}
+	return 0;
+}
+#endif
+
 int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t len) {
 
         size_t i;
@@ -14,9 +26,15 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
 	char *buf = ub->buf;
 
         int found = 0;
+#ifdef UWSGI_ZLIB
+	int http11 = 0;
+#endif
         // protocol
         for(i=0;i<len;i++) {
                 if (buf[i] == ' ') {
+#ifdef UWSGI_ZLIB
+			http11 = !uwsgi_strncmp("HTTP/1.1", 8, buf, i);
+#endif
 			if (hr->session.can_keepalive && uwsgi_strncmp("HTTP/1.1", 8, buf, i)) {
 				goto end;
 			}
@@ -31,6 +49,9 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
 
         // status
         found = 0;
+#ifdef UWSGI_ZLIB
+	int status_ok = !uwsgi_starts_with(buf + next, len - next, "200 ", 4);
+#endif
         for(i=next;i<len;i++) {
                 if (buf[i] == '\r' || buf[i] == '\n') {
 			// status ready
@@ -60,6 +81,13 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
 
 	int has_size = 0;
 	int has_connection = 0;
+#ifdef UWSGI_ZLIB
+	int gzip_type = 0;
+	int has_transfer_encoding = 0;
+	int64_t content_length = -1;
+	// the Content-Length header (removed when gzipping by Content-Type)
+	size_t cl_start = 0, cl_end = 0;
+#endif
 
         for(i=next;i<len;i++) {
                 if (key) {
@@ -69,7 +97,7 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
                                 // security check
                                 if (colon+2 >= buf+len) return -1;
 #ifdef UWSGI_ZLIB
-				if (hr->session.can_keepalive || (uhttp.auto_gzip && hr->can_gzip)) {
+				if (hr->session.can_keepalive || ((uhttp.auto_gzip || uhttp.gzip_types) && hr->can_gzip)) {
 #else
 				if (hr->session.can_keepalive) {
 #endif
@@ -87,18 +115,29 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
 					}
 					else if (!uwsgi_strnicmp(key, colon-key, "Transfer-Encoding", 17)) {
 						has_size = 1;
+#ifdef UWSGI_ZLIB
+						has_transfer_encoding = 1;
+#endif
 					}
 				}
 #ifdef UWSGI_ZLIB
-				if (uhttp.auto_gzip && hr->can_gzip) {
+				if ((uhttp.auto_gzip || uhttp.gzip_types) && hr->can_gzip) {
 					if (!uwsgi_strnicmp(key, colon-key, "Content-Encoding", 16)) {
 						hr->can_gzip = 0;
 					}
-					else if (!uwsgi_strnicmp(key, colon-key, "uWSGI-Encoding", 14)) {
+					else if (uhttp.auto_gzip && !uwsgi_strnicmp(key, colon-key, "uWSGI-Encoding", 14)) {
 						if (!uwsgi_strnicmp(colon+2, h_len-((colon-key)+2), "gzip", 4)) {
 							hr->has_gzip = 1;
                                                 }
 					}
+					else if (uhttp.gzip_types && !uwsgi_strnicmp(key, colon-key, "Content-Type", 12)) {
+						gzip_type = http_gzip_type(colon+2, h_len-((colon-key)+2));
+					}
+					else if (uhttp.gzip_types && !uwsgi_strnicmp(key, colon-key, "Content-Length", 14)) {
+						content_length = uwsgi_str_num(colon+2, h_len-((colon-key)+2));
+						cl_start = key - buf;
+						cl_end = cl_start + h_len + 2;
+					}
 				}
 #endif
                                 key = NULL;
@@ -116,6 +155,23 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
                 }
         }
 
+#ifdef UWSGI_ZLIB
+	// compress by Content-Type, the Content-Length of the backend is replaced by chunked encoding
+	if (gzip_type && hr->can_gzip && !hr->has_gzip && !hr->is_head && http11 && status_ok && !has_transfer_encoding &&
+		content_length != 0 && (content_length < 0 || (uint64_t) content_length >= uhttp.gzip_min_size)) {
+		if (cl_end > 0 && cl_end <= len && buf[cl_end-2] == '\r' && buf[cl_end-1] == '\n') {
+			memmove(buf + cl_start, buf + cl_end, ub->pos - cl_end);
+			ub->pos -= cl_end - cl_start;
+			len -= cl_end - cl_start;
+			cl_end = 0;
+		}
+		if (!cl_end) {
+			has_size = 0;
+			hr->has_gzip = 1;
+		}
+	}
+#endif
+
 	if (!has_size) {
 #ifdef UWSGI_ZLIB
 		if (hr->has_gzip) {
@@ -124,6 +180,9 @@ int http_response_parse(struct http_session *hr, struct uwsgi_buffer *ub, size_t
 				hr->force_gzip = 0;
 				goto end;
 			}
+			if (uhttp.gzip_level > 0) {
+				deflateParams(&hr->z, uhttp.gzip_level, Z_DEFAULT_STRATEGY);
+			}
 			hr->gzip_crc32 = 0;
 			uwsgi_crc32(&hr->gzip_crc32, NULL, 0);
 			hr->gzip_size = 0;
@@ -185,3 +244,160 @@ end:
         return 0;
 }
 
+
+// states of the chunked body parser
+#define HR_CHUNK_SIZE		0
+#define HR_CHUNK_EXT		1
+#define HR_CHUNK_SIZE_LF	2
+#define HR_CHUNK_DATA		3
+#define HR_CHUNK_DATA_CR	4
+#define HR_CHUNK_DATA_LF	5
+#define HR_CHUNK_TRAILER	6
+#define HR_CHUNK_TRAILER_LINE	7
+#define HR_CHUNK_LAST_LF	8
+
+/*
+	follow the chunked encoding of a backend response (backend_remains holds the size of the current chunk)
+
+	returns 1 after the last chunk (and the trailers), 0 if more data is expected, -1 on invalid (or pipelined) data
+*/
+static int hr_backend_chunked(struct http_session *hr, char *buf, size_t len) {
+	size_t i;
+	for(i=0;i<len;i++) {
+		char c = buf[i];
+		switch(hr->backend_chunk_status) {
+			case HR_CHUNK_SIZE:
+				if (isxdigit((int) c)) {
+					// no chunk bigger than 1TB
+					if (hr->backend_remains >> 36) return -1;
+					hr->backend_remains = (hr->backend_remains << 4) + (isdigit((int) c) ? c - '0' : (tolower((int) c) - 'a') + 10);
+				}
+				else if (c == ';' || c == ' ' || c == '\t') {
+					hr->backend_chunk_status = HR_CHUNK_EXT;
+				}
+				else if (c == '\r') {
+					hr->backend_chunk_status = HR_CHUNK_SIZE_LF;
+				}
+				else {
+					return -1;
+				}
+				break;
+			case HR_CHUNK_EXT:
+				if (c == '\r') hr->backend_chunk_status = HR_CHUNK_SIZE_LF;
+				break;
+			case HR_CHUNK_SIZE_LF:
+				if (c != '\n') return -1;
+				hr->backend_chunk_status = hr->backend_remains ? HR_CHUNK_DATA : HR_CHUNK_TRAILER;
+				break;
+			case HR_CHUNK_DATA:
+				if ((int64_t) (len - i) >= hr->backend_remains) {
+					i += hr->backend_remains - 1;
+					hr->backend_remains = 0;
+					hr->backend_chunk_status = HR_CHUNK_DATA_CR;
+				}
+				else {
+					hr->backend_remains -= len - i;
+					i = len;
+				}
+				break;
+			case HR_CHUNK_DATA_CR:
+				if (c != '\r') return -1;
+				hr->backend_chunk_status = HR_CHUNK_DATA_LF;
+				break;
+			case HR_CHUNK_DATA_LF:
+				if (c != '\n') return -1;
+				hr->backend_chunk_status = HR_CHUNK_SIZE;
+				break;
+			case HR_CHUNK_TRAILER:
+				hr->backend_chunk_status = c == '\r' ? HR_CHUNK_LAST_LF : HR_CHUNK_TRAILER_LINE;
+				break;
+			case HR_CHUNK_TRAILER_LINE:
+				if (c == '\n') hr->backend_chunk_status = HR_CHUNK_TRAILER;
+				break;
+			case HR_CHUNK_LAST_LF:
+				if (c != '\n') return -1;
+				// the backend must not send anything after the response
+				return i + 1 == len ? 1 : -1;
+		}
+	}
+	return 0;
+}
+
+/*
+	track the end of a response coming from a pooled backend connection
+
+	the response headers must be in the first chunk and the response size must be known
+	(Content-Length, chunked encoding, HEAD requests, 204 and 304), otherwise the connection is not reusable.
+
+	returns 1 when the whole response has been received, 0 if more data is expected
+	and -1 if the connection cannot go back to the pool.
+*/
+int hr_backend_response_size(struct corerouter_peer *peer, size_t len) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	char *buf = peer->in->buf + (peer->in->pos - len);
+
+	if (hr->backend_remains >= 0) {
+		if (hr->backend_chunked) return hr_backend_chunked(hr, buf, len);
+		if ((int64_t) len > hr->backend_remains) return -1;
+		hr->backend_remains -= len;
+		return hr->backend_remains == 0;
+	}
+
+	size_t i;
+	size_t headers_len = 0;
+	for(i=3;i<len;i++) {
+		if (buf[i] == '\n' && buf[i-1] == '\r' && buf[i-2] == '\n' && buf[i-3] == '\r') {
+			headers_len = i + 1;
+			break;
+		}
+	}
+	if (!headers_len) return -1;
+
+	// status
+	char *space = memchr(buf, ' ', headers_len);
+	if (!space || space + 4 >= buf + headers_len) return -1;
+	int status = uwsgi_str_num(space + 1, 3);
+
+	int64_t size = -1;
+	hr->backend_chunked = 0;
+	char *key = memchr(space, '\n', headers_len - (space - buf));
+	while (key && ++key < buf + headers_len - 2) {
+		char *eol = memchr(key, '\r', headers_len - (key - buf));
+		if (!eol) return -1;
+		char *colon = memchr(key, ':', eol - key);
+		if (!colon) return -1;
+		char *value = colon + 1;
+		while (value < eol && *value == ' ') value++;
+		if (!uwsgi_strnicmp(key, colon-key, "Content-Length", 14)) {
+			size = uwsgi_str_num(value, eol - value);
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Transfer-Encoding", 17)) {
+			if (uwsgi_strnicmp(value, eol - value, "chunked", 7)) return -1;
+			hr->backend_chunked = 1;
+		}
+		else if (!uwsgi_strnicmp(key, colon-key, "Connection", 10) && !uwsgi_strnicmp(value, eol - value, "close", 5)) {
+			return -1;
+		}
+		key = eol + 1;
+	}
+
+	if (hr->is_head || status == 204 || status == 304) {
+		hr->backend_chunked = 0;
+		size = 0;
+	}
+	else if (status < 200) {
+		return -1;
+	}
+	else if (hr->backend_chunked) {
+		hr->backend_remains = 0;
+		hr->backend_chunk_status = HR_CHUNK_SIZE;
+		return hr_backend_chunked(hr, buf + headers_len, len - headers_len);
+	}
+	else if (size < 0) {
+		return -1;
+	}
+
+	if ((int64_t) (len - headers_len) > size) return -1;
+	hr->backend_remains = size - (len - headers_len);
+	return hr->backend_remains == 0;
+}
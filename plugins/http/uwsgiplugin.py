@@ -6,4 +6,4 @@ LIBS = []
 
 REQUIRES = ['corerouter']
 
-GCC_LIST = ['http', 'keepalive', 'https', 'spdy3']
+GCC_LIST = ['http', 'keepalive', 'https', 'spdy3', 'http2', 'cache', 'hub', 'coalesce']
@@ -48,6 +48,20 @@ static int legion_action_cache_fetch_from_legion(struct uwsgi_legion *ul, char *
 	}
 	uwsgi_rwunlock(ul->lock);
 
+	// sharded caches are synced shard by shard (they all share the nodes list)
+	if (uc->shards) {
+		uint64_t i;
+		uc->sync_nodes = dump_from_nodes;
+		for (i = 0; i < uc->shards_count; i++) {
+			struct uwsgi_cache *ucs = uc->shards[i];
+			uwsgi_rlock(ucs->lock);
+			ucs->sync_nodes = dump_from_nodes;
+			uwsgi_rwunlock(ucs->lock);
+			uwsgi_cache_sync_from_nodes(ucs);
+		}
+		return 0;
+	}
+
 	uwsgi_rlock(uc->lock);
 	uc->sync_nodes = dump_from_nodes;
 	uwsgi_rwunlock(uc->lock);
@@ -94,9 +94,9 @@ static ssize_t uwsgi_stdio_logger(struct uwsgi_logger *ul, char *message, size_t
 
 
 void uwsgi_file_logger_register() {
-	uwsgi_register_logger("file", uwsgi_file_logger);
-	uwsgi_register_logger("fd", uwsgi_fd_logger);
-	uwsgi_register_logger("stdio", uwsgi_stdio_logger);
+	uwsgi_register_logger("file", uwsgi_file_logger)->stream = 1;
+	uwsgi_register_logger("fd", uwsgi_fd_logger)->stream = 1;
+	uwsgi_register_logger("stdio", uwsgi_stdio_logger)->stream = 1;
 }
 
 struct uwsgi_plugin logfile_plugin = {
@@ -54,7 +54,7 @@ static ssize_t uwsgi_pipe_logger(struct uwsgi_logger *ul, char *message, size_t
 }
 
 static void uwsgi_pipe_logger_register() {
-	uwsgi_register_logger("pipe", uwsgi_pipe_logger);
+	uwsgi_register_logger("pipe", uwsgi_pipe_logger)->stream = 1;
 }
 
 struct uwsgi_plugin logpipe_plugin = {
@@ -63,6 +63,10 @@ ssize_t uwsgi_socket_logger(struct uwsgi_logger *ul, char *message, size_t len)
 
 void uwsgi_logsocket_register() {
 	uwsgi_register_logger("socket", uwsgi_socket_logger);
+	// with --req-log-ring request lines are sent in batches, up to the max size of an udp datagram
+	struct uwsgi_logger *ul = uwsgi_register_logger("batchsocket", uwsgi_socket_logger);
+	ul->stream = 1;
+	ul->batch_max = 65507;
 }
 
 struct uwsgi_plugin logsocket_plugin = {
@@ -24,6 +24,8 @@ struct uwsgi_lua {
 	uint8_t shell;
 	uint8_t shell_oneshot;
 	uint8_t wsapi;
+	int ffi;
+	int ffi_noenv;
 } ulua;
 
 struct ulua_websocket_handler {
@@ -103,6 +105,8 @@ static struct uwsgi_option uwsgi_lua_options[] = {
 	{"lua-shell-oneshot", no_argument, 0, "run the lua interactive shell (debug.debug(), one-shot variant)", uwsgi_opt_luashell_oneshot, NULL, 0},
 	{"luashell-oneshot", no_argument, 0, "run the lua interactive shell (debug.debug(), one-shot variant)", uwsgi_opt_luashell_oneshot, NULL, 0},
 	{"lua-gc-freq", required_argument, 0, "set the lua gc frequency (default: 1, runs after every request)", uwsgi_opt_set_int, &ulua.gc_freq, 0},
+	{"lua-ffi", no_argument, 0, "expose request vars and response writes to LuaJIT FFI as uwsgi.ffi (requires LuaJIT)", uwsgi_opt_true, &ulua.ffi, 0},
+	{"lua-ffi-noenv", no_argument, 0, "do not fill the WSAPI env table with request vars (implies --lua-ffi, read them via uwsgi.ffi)", uwsgi_opt_true, &ulua.ffi_noenv, 0},
 	{"lua-gc-full", no_argument, 0, "set the lua gc to perform a full garbage-collection cycle (default: 0, gc performs an incremental step of garbage collection)", uwsgi_opt_set_int, &ulua.gc_perform, 0},
 
 	{0, 0, 0, 0},
@@ -768,7 +772,7 @@ static int uwsgi_api_cache_keys(lua_State *L) {
 
 	lua_newtable(L);
 
-	uwsgi_rlock(uc->lock);
+	uwsgi_cache_rlock(uc);
 	do {
 		uci = uwsgi_cache_keys(uc, &pos, &uci);
 
@@ -778,7 +782,7 @@ static int uwsgi_api_cache_keys(lua_State *L) {
 		}
 
 	} while (uci);
-	uwsgi_rwunlock(uc->lock);
+	uwsgi_cache_rwunlock(uc);
 
 	return 1;
 }
@@ -2151,6 +2155,12 @@ static int uwsgi_api_mule_msg(lua_State *L) {
 	return 0;
 }
 
+// in lock-free mode the queue lock is not needed
+static int uwsgi_lua_queue_push(char *str, uint64_t len) {
+	if (uwsgi.queue_lockfree) return uwsgi_queue_push_message(str, len);
+	return uwsgi_queue_push(str, len);
+}
+
 static int uwsgi_api_queue_push(lua_State *L) {
 
 	size_t len;
@@ -2170,13 +2180,13 @@ static int uwsgi_api_queue_push(lua_State *L) {
 		str = (char *) uwsgi_lua_tolstring(L, 1, &len);
 
 		if (len) {
-			uwsgi_wlock(uwsgi.queue_lock);
+			if (!uwsgi.queue_lockfree) uwsgi_wlock(uwsgi.queue_lock);
 
-			if (uwsgi_queue_push(str, len)) {
+			if (uwsgi_lua_queue_push(str, len)) {
 				++error;
 			}
 
-			uwsgi_rwunlock(uwsgi.queue_lock);
+			if (!uwsgi.queue_lockfree) uwsgi_rwunlock(uwsgi.queue_lock);
 		} else {
 			++error;
 		}
@@ -2201,17 +2211,17 @@ static int uwsgi_api_queue_push(lua_State *L) {
 			list[i] = (char *) uwsgi_lua_tolstring(L, i + 1, &slen[i]);
 		}
 
-		uwsgi_wlock(uwsgi.queue_lock);
+		if (!uwsgi.queue_lockfree) uwsgi_wlock(uwsgi.queue_lock);
 
 		for (i = 0; i < argc; ++i) {
 
-			if (!slen[i] || uwsgi_queue_push(list[i], slen[i])) {
+			if (!slen[i] || uwsgi_lua_queue_push(list[i], slen[i])) {
 				++error;
 			}
 
 		}
 
-		uwsgi_rwunlock(uwsgi.queue_lock);
+		if (!uwsgi.queue_lockfree) uwsgi_rwunlock(uwsgi.queue_lock);
 
 		if (argc > ULUA_QUEUE_PUSH_STACK_SIZE) {
 			free(list);
@@ -2346,6 +2356,21 @@ static int uwsgi_lua_queue_pull_pop(lua_State *L, char* queue(uint64_t*)) {
 		return 0;
 	}
 
+	// pull and pop are the same FIFO operation in lock-free mode
+	if (uwsgi.queue_lockfree) {
+		for(i = num; i > 0; --i) {
+			len = 0;
+			str = uwsgi_queue_pull_message(&len, 0);
+			if (str) {
+				lua_pushlstring(L, str, (size_t) len);
+				free(str);
+			} else {
+				lua_pushnil(L);
+			}
+		}
+		return num;
+	}
+
 	uwsgi_wlock(uwsgi.queue_lock);
 
 	for(i = num; i > 0; --i) {
@@ -2810,6 +2835,63 @@ static void uwsgi_lua_api_push(lua_State *L, int target, const luaL_Reg *api) {
 	}
 }
 
+#ifdef LUA_FFILIBNAME
+/*
+	LuaJIT FFI fast path: the following functions are resolved via ffi.C, so
+	request vars are handed out as pointers to the request buffer and
+	no lua string is created (or interned) unless the handler asks for it.
+*/
+int uwsgi_lua_ffi_vars(struct iovec **vars) {
+	struct wsgi_request *wsgi_req = current_wsgi_req();
+	*vars = wsgi_req->hvec;
+	return wsgi_req->var_cnt;
+}
+
+char *uwsgi_lua_ffi_var(char *key, size_t keylen, size_t *vallen) {
+	struct wsgi_request *wsgi_req = current_wsgi_req();
+	uint16_t rlen = 0;
+	char *value = uwsgi_get_var(wsgi_req, key, keylen, &rlen);
+	*vallen = rlen;
+	return value;
+}
+
+int uwsgi_lua_ffi_status(char *status, size_t len) {
+	return uwsgi_response_prepare_headers(current_wsgi_req(), status, len);
+}
+
+int uwsgi_lua_ffi_header(char *key, size_t keylen, char *value, size_t vallen) {
+	return uwsgi_response_add_header(current_wsgi_req(), key, keylen, value, vallen);
+}
+
+int uwsgi_lua_ffi_write(char *buf, size_t len) {
+	return uwsgi_response_write_body_do(current_wsgi_req(), buf, len);
+}
+
+static const char *uwsgi_lua_ffi_code =
+	"local ffi = require('ffi')\n"
+	"ffi.cdef[[\n"
+	"struct uwsgi_lua_ffi_iovec { const char *base; size_t len; };\n"
+	"int uwsgi_lua_ffi_vars(struct uwsgi_lua_ffi_iovec **);\n"
+	"const char *uwsgi_lua_ffi_var(const char *, size_t, size_t *);\n"
+	"int uwsgi_lua_ffi_status(const char *, size_t);\n"
+	"int uwsgi_lua_ffi_header(const char *, size_t, const char *, size_t);\n"
+	"int uwsgi_lua_ffi_write(const char *, size_t);\n"
+	"]]\n"
+	"local C = ffi.C\n"
+	"local len = ffi.new('size_t[1]')\n"
+	"local vars = ffi.new('struct uwsgi_lua_ffi_iovec *[1]')\n"
+	"local api = {}\n"
+	// returns a const char * cdata and its length (nil if the var is missing)
+	"function api.var(k) local v = C.uwsgi_lua_ffi_var(k, #k, len) if v == nil then return nil end return v, tonumber(len[0]) end\n"
+	// returns the array of key/value iovecs (keys at even indexes) and its size
+	"function api.vars() local n = C.uwsgi_lua_ffi_vars(vars) return vars[0], n end\n"
+	"function api.status(s) return C.uwsgi_lua_ffi_status(s, #s) == 0 end\n"
+	"function api.header(k, v) return C.uwsgi_lua_ffi_header(k, #k, v, #v) == 0 end\n"
+	// accepts lua strings or (cdata, len)
+	"function api.write(b, l) return C.uwsgi_lua_ffi_write(b, l or #b) == 0 end\n"
+	"uwsgi.ffi = api\n";
+#endif
+
 static lua_State* uwsgi_lua_spawn_state() {
 
 	lua_State *L = luaL_newstate();
@@ -2874,6 +2956,14 @@ static lua_State* uwsgi_lua_spawn_state() {
 	// end
 	lua_pop(L, 1);
 
+#ifdef LUA_FFILIBNAME
+	// the bindings are compiled once per state, before fork() in non-lazy mode
+	if (ulua.ffi && (luaL_loadstring(L, uwsgi_lua_ffi_code) || lua_pcall(L, 0, 0, 0))) {
+		ulua_log("ERROR: unable to load the FFI bindings: %s", lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+#endif
+
 	return L;
 
 }
@@ -2932,6 +3022,16 @@ static int uwsgi_lua_init() {
 		ulua.gc_perform = LUA_GCCOLLECT;
 	}
 
+	if (ulua.ffi_noenv) {
+		ulua.ffi = 1;
+	}
+
+#ifndef LUA_FFILIBNAME
+	if (ulua.ffi) {
+		ulua_log("WARNING: --lua-ffi requires LuaJIT, uwsgi.ffi will not be available");
+	}
+#endif
+
 	if (ULUA_INITSTATE_ANYAPP) {
 		uwsgi_log(ULUA_LOG_HEADER " Initializing Lua Environment... ");
 		ULUA_STATE = uwsgi_calloc(sizeof(lua_State*) * uwsgi.cores);
@@ -3129,10 +3229,13 @@ static int uwsgi_lua_request(struct wsgi_request *wsgi_req) {
 	lua_pushstring(L, "");
 	lua_setfield(L, -2, "CONTENT_TYPE");
 
-	for(i = 0; i < wsgi_req->var_cnt; i+=2) {
-		lua_pushlstring(L, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len);
-		lua_pushlstring(L, wsgi_req->hvec[i+1].iov_base, wsgi_req->hvec[i+1].iov_len);
-		lua_rawset(L, -3);
+	// with --lua-ffi-noenv the handler reads the vars from uwsgi.ffi
+	if (!ulua.ffi_noenv) {
+		for(i = 0; i < wsgi_req->var_cnt; i+=2) {
+			lua_pushlstring(L, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len);
+			lua_pushlstring(L, wsgi_req->hvec[i+1].iov_base, wsgi_req->hvec[i+1].iov_len);
+			lua_rawset(L, -3);
+		}
 	}
 
 	// put "input" table
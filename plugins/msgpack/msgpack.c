@@ -50,117 +50,6 @@ struct uwsgi_msgpack_item *uwsgi_msgpack_item_add(struct uwsgi_msgpack_item **li
 	return umi;
 }
 
-int uwsgi_buffer_msgpack_map(struct uwsgi_buffer *ub, uint32_t len) {
-	if (len <= 15) {
-		return uwsgi_buffer_byte(ub, 0x80 + len);
-	}
-	else if (len <= 0xffff) {
-		if (uwsgi_buffer_byte(ub, 0xDE)) return -1;
-		return uwsgi_buffer_u16be(ub, (uint16_t) len);
-	}
-	
-	if (uwsgi_buffer_byte(ub, 0xDF)) return -1;
-	return uwsgi_buffer_u32be(ub, len);
-}
-
-int uwsgi_buffer_msgpack_array(struct uwsgi_buffer *ub, uint32_t len) {
-        if (len <= 15) {
-                return uwsgi_buffer_byte(ub, 0x90 + len);
-        }
-        else if (len <= 0xffff) {
-                if (uwsgi_buffer_byte(ub, 0xDC)) return -1;
-                return uwsgi_buffer_u16be(ub, (uint16_t) len);
-        }
-
-        if (uwsgi_buffer_byte(ub, 0xDD)) return -1;
-        return uwsgi_buffer_u32be(ub, len);
-}
-
-int uwsgi_buffer_msgpack_str(struct uwsgi_buffer *ub, char *str, uint32_t len) {
-        if (len <= 31) {
-                if (uwsgi_buffer_byte(ub, 0xA0 + len)) return -1;
-        }
-	// this is annoying, D9 does not work for older SPEC :(
-/*
-        else if (len <= 0xff) {
-                if (uwsgi_buffer_byte(ub, 0xD9)) return -1;
-                if (uwsgi_buffer_byte(ub, (uint8_t) len)) return -1;
-        }
-*/
-	else if (len <= 0xffff) {
-                if (uwsgi_buffer_byte(ub, 0xDA)) return -1;
-                if (uwsgi_buffer_u16be(ub, (uint16_t) len)) return -1;
-	}
-	else {
-                if (uwsgi_buffer_byte(ub, 0xDB)) return -1;
-                if (uwsgi_buffer_u32be(ub, len)) return -1;
-	}
-
-        return uwsgi_buffer_append(ub, str, len);
-}
-
-int uwsgi_buffer_msgpack_bin(struct uwsgi_buffer *ub, char *str, uint32_t len) {
-        if (len <= 0xff) {
-                if (uwsgi_buffer_byte(ub, 0xC4)) return -1;
-                if (uwsgi_buffer_byte(ub, (uint8_t) len)) return -1;
-        }
-        else if (len <= 0xffff) {
-                if (uwsgi_buffer_byte(ub, 0xC5)) return -1;
-		if (uwsgi_buffer_u16be(ub, (uint16_t) len)) return -1;
-        }
-        else {
-                if (uwsgi_buffer_byte(ub, 0xC6)) return -1;
-		if (uwsgi_buffer_u32be(ub, len)) return -1;
-        }
-
-        return uwsgi_buffer_append(ub, str, len);
-}
-
-
-int uwsgi_buffer_msgpack_int(struct uwsgi_buffer *ub, int64_t num) {
-	if (num > 0 && num <= 127) {
-		return uwsgi_buffer_byte(ub, (uint8_t) num);
-	}
-	else if (num < 0 && num >= -31) {
-		return uwsgi_buffer_byte(ub, 224 | (int8_t) num);
-	}
-	else if (num <= 127 && num >= -127) {
-		if (uwsgi_buffer_byte(ub, 0xD0)) return -1;
-		return uwsgi_buffer_byte(ub, (int8_t) num);
-	}
-	else if (num <= 32767 && num >= -32767) {
-		if (uwsgi_buffer_byte(ub, 0xD1)) return -1;
-		return uwsgi_buffer_u16be(ub, (uint16_t) num);
-	}
-	else if (num <= 2147483647LL && num >= -2147483648LL) {
-		if (uwsgi_buffer_byte(ub, 0xD2)) return -1;
-		return uwsgi_buffer_u32be(ub, (uint32_t) num);
-	}
-	if (uwsgi_buffer_byte(ub, 0xD3)) return -1;
-	return uwsgi_buffer_u64be(ub, (uint64_t)num);
-}
-
-int uwsgi_buffer_msgpack_float(struct uwsgi_buffer *ub, double num) {
-	if (num >= -126.0 && num <= 127.0) {
-        	if (uwsgi_buffer_byte(ub, 0xCA)) return -1;
-        	return uwsgi_buffer_f32be(ub, (float) num);
-	}
-	if (uwsgi_buffer_byte(ub, 0xCB)) return -1;
-        return uwsgi_buffer_f64be(ub, num);
-}
-
-int uwsgi_buffer_msgpack_nil(struct uwsgi_buffer *ub) {
-	return uwsgi_buffer_byte(ub, 0xC0);
-}
-
-int uwsgi_buffer_msgpack_true(struct uwsgi_buffer *ub) {
-	return uwsgi_buffer_byte(ub, 0xC3);
-}
-
-int uwsgi_buffer_msgpack_false(struct uwsgi_buffer *ub) {
-	return uwsgi_buffer_byte(ub, 0xC2);
-}
-
 static char *uwsgi_msgpack_log_encoder(struct uwsgi_log_encoder *ule, char *msg, size_t len, size_t *rlen) {
 	char *buf = NULL;
 	if (!ule->configured) {
@@ -35,6 +35,8 @@ struct uwsgi_php {
 	struct uwsgi_string_list *exec_before;
 	struct uwsgi_string_list *exec_after;
 
+	struct uwsgi_string_list *preload;
+
 	char *sapi_name;
 
 	int sapi_initialized;
@@ -80,6 +82,7 @@ struct uwsgi_option uwsgi_php_options[] = {
         {"php-exec-after", required_argument, 0, "run specified php code after the requested script", uwsgi_opt_add_string_list, &uphp.exec_after, 0},
         {"php-exec-end", required_argument, 0, "run specified php code after the requested script", uwsgi_opt_add_string_list, &uphp.exec_after, 0},
         {"php-sapi-name", required_argument, 0, "hack the sapi name (required for enabling zend opcode cache)", uwsgi_opt_set_str, &uphp.sapi_name, 0},
+        {"php-preload", required_argument, 0, "compile the specified script (or directory of scripts) in the opcache before forking workers", uwsgi_opt_add_string_list, &uphp.preload, 0},
 
         {"early-php", no_argument, 0, "initialize an early perl interpreter shared by all loaders", uwsgi_opt_early_php, NULL, UWSGI_OPT_IMMEDIATE},
         {"early-php-sapi-name", required_argument, 0, "hack the sapi name (required for enabling zend opcode cache)", uwsgi_opt_set_str, &uphp.sapi_name, UWSGI_OPT_IMMEDIATE},
@@ -1128,6 +1131,96 @@ end:
 	return 0;
 }
 
+static int uwsgi_php_preload_file(char *filename) {
+	zval fname, arg, retval;
+	int ret = -1;
+
+	ZVAL_STRING(&fname, "opcache_compile_file");
+	ZVAL_STRING(&arg, filename);
+	if (call_user_function(EG(function_table), NULL, &fname, &retval, 1, &arg) == SUCCESS) {
+		if (Z_TYPE(retval) == IS_TRUE) ret = 0;
+		zval_ptr_dtor(&retval);
+	}
+	zval_ptr_dtor(&arg);
+	zval_ptr_dtor(&fname);
+
+	if (ret) {
+		uwsgi_log("[php-preload] unable to compile %s\n", filename);
+	}
+	return ret;
+}
+
+static int uwsgi_php_preload_ext(char *filename) {
+	if (!uphp.allowed_ext) return uwsgi_endswith(filename, ".php");
+	struct uwsgi_string_list *usl;
+	uwsgi_foreach(usl, uphp.allowed_ext) {
+		if (uwsgi_endswith(filename, usl->value)) return 1;
+	}
+	return 0;
+}
+
+// returns the number of compiled scripts
+static int uwsgi_php_preload_path(char *path, int explicit) {
+	struct stat st;
+	if (stat(path, &st)) {
+		uwsgi_log("[php-preload] unable to stat %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		// directories are filtered by extension, explicitly listed files are not
+		if (!explicit && !uwsgi_php_preload_ext(path)) return 0;
+		return uwsgi_php_preload_file(path) ? 0 : 1;
+	}
+
+	DIR *dir = opendir(path);
+	if (!dir) {
+		uwsgi_error("uwsgi_php_preload_path()/opendir()");
+		return 0;
+	}
+
+	int count = 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') continue;
+		char *child = uwsgi_concat3(path, "/", de->d_name);
+		count += uwsgi_php_preload_path(child, 0);
+		free(child);
+	}
+	closedir(dir);
+	return count;
+}
+
+/*
+	opcache lives in a shared memory area allocated at module startup (in the master),
+	so everything compiled here is inherited by the workers instead of being compiled
+	again by each one of them.
+*/
+static void uwsgi_php_preload(void) {
+	int count = 0;
+	struct uwsgi_string_list *usl;
+
+	if (!uphp.preload) return;
+
+	if (php_request_startup() == FAILURE) {
+		uwsgi_log("[php-preload] unable to start the preload request\n");
+		return;
+	}
+
+	if (!zend_hash_str_exists(EG(function_table), "opcache_compile_file", sizeof("opcache_compile_file")-1)) {
+		uwsgi_log("[php-preload] opcache is not available, skipping preload\n");
+		goto end;
+	}
+
+	uwsgi_foreach(usl, uphp.preload) {
+		count += uwsgi_php_preload_path(usl->value, 1);
+	}
+	uwsgi_log("[php-preload] %d scripts compiled in the opcache\n", count);
+
+end:
+	php_request_shutdown(NULL);
+}
+
 void uwsgi_php_after_request(struct wsgi_request *wsgi_req) {
 
 	log_request(wsgi_req);
@@ -1140,6 +1233,7 @@ SAPI_API struct uwsgi_plugin php_plugin = {
 	.init = uwsgi_php_init,
 	.request = uwsgi_php_request,
 	.after_request = uwsgi_php_after_request,
+	.init_apps = uwsgi_php_preload,
 	.options = uwsgi_php_options,
 };
 
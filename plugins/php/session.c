@@ -18,6 +18,7 @@ PS_READ_FUNC(uwsgi) {
 		return SUCCESS;
 	}
 	*val = zend_string_init(value, valsize, 0);
+	free(value);
 	return SUCCESS;
 	
 }
@@ -46,7 +47,23 @@ PS_GC_FUNC(uwsgi) {
 	return SUCCESS;
 }
 
+PS_VALIDATE_SID_FUNC(uwsgi) {
+	char *cache = PS_GET_MOD_DATA();
+	if (uwsgi_cache_magic_exists(key->val, key->len, cache))
+		return SUCCESS;
+	return FAILURE;
+}
+
+/*
+	with session.lazy_write (the default) php calls this instead of write()
+	when the session data did not change. Items are stored without expiration,
+	so there is nothing to refresh and the (potentially big) copy in the cache is skipped.
+*/
+PS_UPDATE_TIMESTAMP_FUNC(uwsgi) {
+	return SUCCESS;
+}
+
 ps_module ps_mod_uwsgi = {
-	PS_MOD(uwsgi)
+	PS_MOD_UPDATE_TIMESTAMP(uwsgi)
 };
 
@@ -61,6 +61,10 @@ struct uwsgi_perl {
 
 	int enable_psgix_io;
 
+	// a cleared %env for each app and core
+	int reuse_env;
+	HV **env_cache;
+
 	char *shell;
 	int shell_oneshot;
 
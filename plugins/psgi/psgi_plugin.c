@@ -65,6 +65,7 @@ struct uwsgi_option uwsgi_perl_options[] = {
 
         {"psgi", required_argument, 0, "load a psgi app", uwsgi_opt_set_str, &uperl.psgi, 0},
         {"psgi-enable-psgix-io", no_argument, 0, "enable psgix.io support", uwsgi_opt_true, &uperl.enable_psgix_io, 0},
+        {"psgi-reuse-env", no_argument, 0, "reuse the %env hash of the previous request when the app does not hold references to it", uwsgi_opt_true, &uperl.reuse_env, 0},
         {"perl-no-die-catch", no_argument, 0, "do not catch $SIG{__DIE__}", uwsgi_opt_true, &uperl.no_die_catch, 0},
         {"perl-local-lib", required_argument, 0, "set perl locallib path", uwsgi_opt_set_str, &uperl.locallib, 0},
 #ifdef PERL_VERSION_STRING
@@ -318,18 +319,75 @@ AV *psgi_call(struct wsgi_request *wsgi_req, SV *psgi_func, SV *env) {
 	
 }
 
+// the keys added to %env by uWSGI, their hash is computed only once (see uwsgi_perl_init())
+enum {
+	PSGI_ENV_VERSION,
+	PSGI_ENV_MULTIPROCESS,
+	PSGI_ENV_MULTITHREAD,
+	PSGI_ENV_NONBLOCKING,
+	PSGI_ENV_HARAKIRI,
+	PSGI_ENV_RUN_ONCE,
+	PSGI_ENV_STREAMING,
+	PSGI_ENV_CLEANUP,
+	PSGI_ENV_URL_SCHEME,
+	PSGI_ENV_INPUT,
+	PSGI_ENV_INPUT_BUFFERED,
+	PSGI_ENV_LOGGER,
+	PSGI_ENV_CLEANUP_HANDLERS,
+	PSGI_ENV_IO,
+	PSGI_ENV_ERRORS,
+	PSGI_ENV_KEYS,
+};
+
+static struct {
+	char *key;
+	I32 len;
+	U32 hash;
+} psgi_env_keys[PSGI_ENV_KEYS] = {
+	{"psgi.version", 12, 0},
+	{"psgi.multiprocess", 17, 0},
+	{"psgi.multithread", 16, 0},
+	{"psgi.nonblocking", 16, 0},
+	{"psgix.harakiri", 14, 0},
+	{"psgi.run_once", 13, 0},
+	{"psgi.streaming", 14, 0},
+	{"psgix.cleanup", 13, 0},
+	{"psgi.url_scheme", 15, 0},
+	{"psgi.input", 10, 0},
+	{"psgix.input.buffered", 20, 0},
+	{"psgix.logger", 12, 0},
+	{"psgix.cleanup.handlers", 22, 0},
+	{"psgix.io", 8, 0},
+	{"psgi.errors", 11, 0},
+};
+
+#define psgi_env_store(env, k, v) hv_store(env, psgi_env_keys[k].key, psgi_env_keys[k].len, v, psgi_env_keys[k].hash)
+
+static void psgi_env_keys_hash() {
+	int i;
+	for(i=0;i<PSGI_ENV_KEYS;i++) {
+		PERL_HASH(psgi_env_keys[i].hash, psgi_env_keys[i].key, psgi_env_keys[i].len);
+	}
+}
+
 SV *build_psgi_env(struct wsgi_request *wsgi_req) {
 	int i;
 	struct uwsgi_app *wi = &uwsgi_apps[wsgi_req->app_id];
-	HV *env = newHV();
+	HV *env = NULL;
+
+	if (uperl.env_cache) {
+		env = uperl.env_cache[(wsgi_req->app_id * uwsgi.cores) + wsgi_req->async_id];
+		uperl.env_cache[(wsgi_req->app_id * uwsgi.cores) + wsgi_req->async_id] = NULL;
+	}
+	if (!env) env = newHV();
 
 	// fill perl hash
         for(i=0;i<wsgi_req->var_cnt;i++) {
                 if (wsgi_req->hvec[i+1].iov_len > 0) {
 
                         // check for multiline header
-                        if (hv_exists(env, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len)) {
-                                SV **already_available_header = hv_fetch(env, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len, 0);
+                        SV **already_available_header = hv_fetch(env, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len, 0);
+                        if (already_available_header) {
                                 STRLEN hlen;
                                 char *old_value = SvPV(*already_available_header, hlen );
                                 char *multiline_header = uwsgi_concat3n(old_value, hlen, ", ", 2, wsgi_req->hvec[i+1].iov_base, wsgi_req->hvec[i+1].iov_len);
@@ -355,17 +413,17 @@ SV *build_psgi_env(struct wsgi_request *wsgi_req) {
         AV *av = newAV();
         av_store( av, 0, newSViv(1));
         av_store( av, 1, newSViv(1));
-        if (!hv_store(env, "psgi.version", 12, newRV_noinc((SV *)av ), 0)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_VERSION, newRV_noinc((SV *)av ))) goto clear;
 
         // All the simple bools.
-        if (!hv_store(env, "psgi.multiprocess", 17, uwsgi.numproc > 1    ? &PL_sv_yes : &PL_sv_no, 0)) goto clear;
-        if (!hv_store(env, "psgi.multithread",  16, uwsgi.threads > 1    ? &PL_sv_yes : &PL_sv_no, 0)) goto clear;
-        if (!hv_store(env, "psgi.nonblocking",  16, uwsgi.async   > 0    ? &PL_sv_yes : &PL_sv_no, 0)) goto clear;
-        if (!hv_store(env, "psgix.harakiri",    14, uwsgi.master_process ? &PL_sv_yes : &PL_sv_no, 0)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_MULTIPROCESS, uwsgi.numproc > 1    ? &PL_sv_yes : &PL_sv_no)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_MULTITHREAD,  uwsgi.threads > 1    ? &PL_sv_yes : &PL_sv_no)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_NONBLOCKING,  uwsgi.async   > 0    ? &PL_sv_yes : &PL_sv_no)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_HARAKIRI,     uwsgi.master_process ? &PL_sv_yes : &PL_sv_no)) goto clear;
 
-        if (!hv_store(env, "psgi.run_once",  13, &PL_sv_no,  0)) goto clear;
-        if (!hv_store(env, "psgi.streaming", 14, &PL_sv_yes, 0)) goto clear;
-        if (!hv_store(env, "psgix.cleanup",  13, &PL_sv_yes, 0)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_RUN_ONCE,  &PL_sv_no)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_STREAMING, &PL_sv_yes)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_CLEANUP,   &PL_sv_yes)) goto clear;
 
 	SV *us;
         // psgi.url_scheme, honour HTTPS var or UWSGI_SCHEME
@@ -384,33 +442,33 @@ SV *build_psgi_env(struct wsgi_request *wsgi_req) {
                 us = newSVpv("http", 4);
         }
 
-        if (!hv_store(env, "psgi.url_scheme", 15, us, 0)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_URL_SCHEME, us)) goto clear;
 
 
 	SV *pi = uwsgi_perl_obj_new("uwsgi::input", 12);
-        if (!hv_store(env, "psgi.input", 10, pi, 0)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_INPUT, pi)) goto clear;
 	
-	if (!hv_store(env, "psgix.input.buffered", 20, newSViv(uwsgi.post_buffering), 0)) goto clear;
+	if (!psgi_env_store(env, PSGI_ENV_INPUT_BUFFERED, newSViv(uwsgi.post_buffering))) goto clear;
 
 	if (uwsgi.threads > 1) {
-		if (!hv_store(env, "psgix.logger", 12,newRV((SV*) ((SV **)wi->responder1)[wsgi_req->async_id]) ,0)) goto clear;
+		if (!psgi_env_store(env, PSGI_ENV_LOGGER, newRV((SV*) ((SV **)wi->responder1)[wsgi_req->async_id]))) goto clear;
 	}
 	else {
-		if (!hv_store(env, "psgix.logger", 12,newRV((SV*) ((SV **)wi->responder1)[0]) ,0)) goto clear;
+		if (!psgi_env_store(env, PSGI_ENV_LOGGER, newRV((SV*) ((SV **)wi->responder1)[0]))) goto clear;
 	}
 
 	// cleanup handlers array
 	av = newAV();
-	if (!hv_store(env, "psgix.cleanup.handlers", 22, newRV_noinc((SV *)av ), 0)) goto clear;
+	if (!psgi_env_store(env, PSGI_ENV_CLEANUP_HANDLERS, newRV_noinc((SV *)av ))) goto clear;
 
 	// this call requires a bunch of syscalls, so it hurts performance
 	if (uperl.enable_psgix_io) {
 		SV *io = uwsgi_perl_obj_new_from_fd("IO::Socket", 10, wsgi_req->fd);
-		if (!hv_store(env, "psgix.io", 8, io, 0)) goto clear;
+		if (!psgi_env_store(env, PSGI_ENV_IO, io)) goto clear;
 	}
 
 	SV *pe = uwsgi_perl_obj_new("uwsgi::error", 12);
-        if (!hv_store(env, "psgi.errors", 11, pe, 0)) goto clear;
+        if (!psgi_env_store(env, PSGI_ENV_ERRORS, pe)) goto clear;
 
 	(void) hv_delete(env, "HTTP_CONTENT_LENGTH", 19, G_DISCARD);
 	(void) hv_delete(env, "HTTP_CONTENT_TYPE", 17, G_DISCARD);
@@ -472,6 +530,11 @@ int uwsgi_perl_init(){
 	PERL_SET_CONTEXT(uperl.main[0]);
 
 already_initialized:
+	psgi_env_keys_hash();
+	if (uperl.reuse_env && !uperl.env_cache) {
+		uperl.env_cache = uwsgi_calloc(sizeof(HV *) * uwsgi.max_apps * uwsgi.cores);
+	}
+
 #ifdef PERL_VERSION_STRING
 	uwsgi_log_initial("initialized Perl %s main interpreter at %p\n", PERL_VERSION_STRING, uperl.main[0]);
 #else
@@ -669,6 +732,16 @@ void uwsgi_perl_after_request(struct wsgi_request *wsgi_req) {
 		if (SvTRUE(*harakiri)) wsgi_req->async_plagued = 1;
 	}
 
+	// keep the (cleared) hash for the next request if nobody else is using it
+	if (uperl.env_cache && SvREFCNT((SV *) wsgi_req->async_environ) == 1 && SvREFCNT(env) == 1 && !SvOBJECT(env) && !SvRMAGICAL(env)) {
+		HV **cached_env = &uperl.env_cache[(wsgi_req->app_id * uwsgi.cores) + wsgi_req->async_id];
+		if (!*cached_env) {
+			hv_clear((HV *)env);
+			SvREFCNT_inc(env);
+			*cached_env = (HV *) env;
+		}
+	}
+
 	// Free the $env hash
 	SvREFCNT_dec(wsgi_req->async_environ);
 
@@ -2,6 +2,9 @@
 
 extern struct uwsgi_server uwsgi;
 
+// max number of arrayref body elements sent with a single writev()
+#define PSGI_BODY_IOVEC 64
+
 int psgi_response(struct wsgi_request *wsgi_req, AV *response) {
 
 	SV **status_code, **hitem ;
@@ -185,14 +188,31 @@ int psgi_response(struct wsgi_request *wsgi_req, AV *response) {
 
                 body = (AV *) rv;
 
-                for(i=0; i<=av_len(body); i++) {
+		// the elements are held by the array, send them in batches with writev()
+		struct iovec iov[PSGI_BODY_IOVEC];
+		size_t iov_cnt = 0;
+		int body_len = (int) av_len(body);
+                for(i=0; i<=body_len; i++) {
                         hitem = av_fetch(body,i,0);
+			if (!hitem) continue;
                         chitem = SvPV(*hitem, hlen);
-			uwsgi_response_write_body_do(wsgi_req, chitem, hlen);
+			if (!hlen) continue;
+			iov[iov_cnt].iov_base = chitem;
+			iov[iov_cnt].iov_len = hlen;
+			iov_cnt++;
+			if (iov_cnt < PSGI_BODY_IOVEC && i < body_len) continue;
+			uwsgi_response_writev_body_do(wsgi_req, iov, iov_cnt);
+			iov_cnt = 0;
 			uwsgi_pl_check_write_errors {
 				break;
 			}
                 }
+		if (iov_cnt > 0) {
+			uwsgi_response_writev_body_do(wsgi_req, iov, iov_cnt);
+			uwsgi_pl_check_write_errors {
+				// noop
+			}
+		}
         }
         else {
 invalid_body:
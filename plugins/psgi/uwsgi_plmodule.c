@@ -161,6 +161,107 @@ XS(XS_cache_get) {
 	XSRETURN_UNDEF;
 }
 
+XS(XS_cache_get_many) {
+	dXSARGS;
+
+	char *cache = NULL;
+	I32 i;
+
+	psgi_check_args(1);
+
+	if (!SvROK(ST(0)) || SvTYPE(SvRV(ST(0))) != SVt_PVAV) {
+		croak("uwsgi::cache_get_many() requires an array reference");
+	}
+
+	AV *av_keys = (AV *) SvRV(ST(0));
+
+	if (items > 1) {
+		cache = SvPV_nolen(ST(1));
+	}
+
+	I32 n = av_len(av_keys) + 1;
+	char **keys = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint16_t *keylens = uwsgi_malloc(sizeof(uint16_t) * (n + 1));
+	char **values = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint64_t *vallens = uwsgi_malloc(sizeof(uint64_t) * (n + 1));
+
+	for (i = 0; i < n; i++) {
+		STRLEN keylen = 0;
+		SV **key = av_fetch(av_keys, i, 0);
+		keys[i] = key ? SvPV(*key, keylen) : "";
+		keylens[i] = keylen;
+	}
+
+	uwsgi_cache_magic_mget(keys, keylens, values, vallens, n, cache);
+
+	HV *hv_ret = newHV();
+	for (i = 0; i < n; i++) {
+		if (!values[i]) continue;
+		(void) hv_store(hv_ret, keys[i], keylens[i], newSVpv(values[i], vallens[i]), 0);
+		free(values[i]);
+	}
+
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+
+	ST(0) = sv_2mortal(newRV_noinc((SV *) hv_ret));
+	XSRETURN(1);
+}
+
+XS(XS_cache_set_many) {
+	dXSARGS;
+
+	uint64_t expires = 0;
+	char *cache = NULL;
+	uint64_t n = 0;
+
+	psgi_check_args(1);
+
+	if (!SvROK(ST(0)) || SvTYPE(SvRV(ST(0))) != SVt_PVHV) {
+		croak("uwsgi::cache_set_many() requires a hash reference");
+	}
+
+	HV *hv_items = (HV *) SvRV(ST(0));
+
+	if (items > 1) {
+		expires = SvIV(ST(1));
+		if (items > 2) {
+			cache = SvPV_nolen(ST(2));
+		}
+	}
+
+	I32 count = hv_iterinit(hv_items);
+	char **keys = uwsgi_malloc(sizeof(char *) * (count + 1));
+	uint16_t *keylens = uwsgi_malloc(sizeof(uint16_t) * (count + 1));
+	char **values = uwsgi_malloc(sizeof(char *) * (count + 1));
+	uint64_t *vallens = uwsgi_malloc(sizeof(uint64_t) * (count + 1));
+
+	HE *he;
+	while ((he = hv_iternext(hv_items)) && n < (uint64_t) count) {
+		I32 keylen = 0;
+		STRLEN vallen = 0;
+		keys[n] = hv_iterkey(he, &keylen);
+		keylens[n] = keylen;
+		values[n] = SvPV(hv_iterval(hv_items, he), vallen);
+		vallens[n] = vallen;
+		n++;
+	}
+
+	uint64_t failed = uwsgi_cache_magic_mset(keys, keylens, values, vallens, n, expires, 0, cache);
+
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+
+	if (!failed) {
+		XSRETURN_YES;
+	}
+	XSRETURN_UNDEF;
+}
+
 XS(XS_cache_exists) {
         dXSARGS;
 
@@ -874,6 +975,115 @@ XS(XS_sharedarea_write) {
 }
 
 
+XS(XS_sharedarea_hashmap_add) {
+	dXSARGS;
+	int id;
+	STRLEN keylen;
+	int64_t amount = 1;
+	uint64_t ttl = 0;
+	int64_t value = 0;
+
+	psgi_check_args(2);
+
+	id = SvIV(ST(0));
+	char *key = SvPV(ST(1), keylen);
+	if (keylen > 0xffff) croak("sharedarea hashmap key too long");
+	if (items > 2) {
+		amount = SvIV(ST(2));
+		if (items > 3) {
+			ttl = SvUV(ST(3));
+		}
+	}
+
+	if (uwsgi_sharedarea_hashmap_add(id, key, keylen, amount, ttl, &value)) {
+		croak("unable to add to hashmap in sharedarea %d", id);
+		XSRETURN_UNDEF;
+	}
+
+	ST(0) = newSViv(value);
+	sv_2mortal(ST(0));
+	XSRETURN(1);
+}
+
+XS(XS_sharedarea_hashmap_set) {
+	dXSARGS;
+	int id;
+	STRLEN keylen;
+	uint64_t ttl = 0;
+
+	psgi_check_args(3);
+
+	id = SvIV(ST(0));
+	char *key = SvPV(ST(1), keylen);
+	if (keylen > 0xffff) croak("sharedarea hashmap key too long");
+	int64_t value = SvIV(ST(2));
+	if (items > 3) {
+		ttl = SvUV(ST(3));
+	}
+
+	if (uwsgi_sharedarea_hashmap_set(id, key, keylen, value, ttl)) {
+		croak("unable to set hashmap item in sharedarea %d", id);
+		XSRETURN_UNDEF;
+	}
+
+	XSRETURN_YES;
+}
+
+XS(XS_sharedarea_hashmap_get) {
+	dXSARGS;
+	int id;
+	STRLEN keylen;
+	int64_t value = 0;
+
+	psgi_check_args(2);
+
+	id = SvIV(ST(0));
+	char *key = SvPV(ST(1), keylen);
+	if (keylen > 0xffff) croak("sharedarea hashmap key too long");
+
+	int ret = uwsgi_sharedarea_hashmap_get(id, key, keylen, &value);
+	if (ret < 0) {
+		croak("unable to get hashmap item from sharedarea %d", id);
+		XSRETURN_UNDEF;
+	}
+	if (ret) {
+		XSRETURN_UNDEF;
+	}
+
+	ST(0) = newSViv(value);
+	sv_2mortal(ST(0));
+	XSRETURN(1);
+}
+
+XS(XS_sharedarea_hashmap_cas) {
+	dXSARGS;
+	int id;
+	STRLEN keylen;
+	uint64_t ttl = 0;
+
+	psgi_check_args(4);
+
+	id = SvIV(ST(0));
+	char *key = SvPV(ST(1), keylen);
+	if (keylen > 0xffff) croak("sharedarea hashmap key too long");
+	int64_t expected = SvIV(ST(2));
+	int64_t desired = SvIV(ST(3));
+	if (items > 4) {
+		ttl = SvUV(ST(4));
+	}
+
+	int ret = uwsgi_sharedarea_hashmap_cas(id, key, keylen, &expected, desired, ttl);
+	if (ret < 0) {
+		croak("unable to cas hashmap item in sharedarea %d", id);
+		XSRETURN_UNDEF;
+	}
+	if (ret) {
+		XSRETURN_NO;
+	}
+
+	XSRETURN_YES;
+}
+
 XS(XS_chunked_read) {
 	dXSARGS;
         int timeout = 0;
@@ -1037,6 +1247,8 @@ void init_perl_embedded_module() {
 	psgi_xs(cache_get);
 	psgi_xs(cache_exists);
 	psgi_xs(cache_set);
+	psgi_xs(cache_get_many);
+	psgi_xs(cache_set_many);
 	psgi_xs(cache_del);
 	psgi_xs(cache_clear);
 
@@ -1089,6 +1301,10 @@ void init_perl_embedded_module() {
 	psgi_xs(sharedarea_readfast);
 	psgi_xs(sharedarea_write);
 	psgi_xs(sharedarea_wait);
+	psgi_xs(sharedarea_hashmap_add);
+	psgi_xs(sharedarea_hashmap_set);
+	psgi_xs(sharedarea_hashmap_get);
+	psgi_xs(sharedarea_hashmap_cas);
 
 	psgi_xs(spooler);
 	psgi_xs(spool);
@@ -0,0 +1,767 @@
+#include "uwsgi_python.h"
+
+extern struct uwsgi_server uwsgi;
+extern struct uwsgi_python up;
+
+/*
+
+	non-blocking cache and rpc calls
+
+	uwsgi.async_cache_get(), async_cache_set(), async_cache_update(), async_cache_del(), async_cache_exists()
+	and async_rpc() return a uwsgi.PendingCall object, remote calls are run as a state machine on a
+	non-blocking socket, even in loop engines that cannot suspend a C stack:
+
+		call.wait([timeout]) -> runs the call using the wait hooks of the loop engine (gevent and
+			greenlet based engines suspend the current greenlet, async cores are suspended...)
+		await call -> (python >= 3.5) runs the call in the running asyncio loop (add_reader/add_writer),
+			for ASGI apps and asyncio coroutines
+		call.fileno(), call.want_write(), call.step() -> for custom loops, step() never blocks
+			and returns True when the call is complete
+
+	call.result() returns the same values of the synchronous function. Local caches and local rpc functions
+	do not need network i/o, so they are run immediately (the call is already complete).
+
+*/
+
+#define UWSGI_PENDING_CACHE 0
+#define UWSGI_PENDING_CACHE_GET 1
+#define UWSGI_PENDING_CACHE_EXISTS 2
+#define UWSGI_PENDING_RPC 3
+
+#define UWSGI_PENDING_CONNECT 0
+#define UWSGI_PENDING_SEND 1
+#define UWSGI_PENDING_HEADER 2
+#define UWSGI_PENDING_BODY 3
+#define UWSGI_PENDING_RAW 4
+#define UWSGI_PENDING_DONE 5
+
+typedef struct {
+	PyObject_HEAD
+	int type;
+	int state;
+	int fd;
+	uint64_t deadline;
+	// the request, then the response packet
+	struct uwsgi_buffer *ub;
+	size_t pos;
+	char header[4];
+	size_t header_pos;
+	// the raw value following the response packet
+	char *raw;
+	size_t raw_len;
+	size_t raw_pos;
+	PyObject *result;
+	PyObject *error;
+	// await
+	PyObject *loop;
+	PyObject *future;
+	PyObject *timer;
+	PyObject *callback;
+	int watching;
+	int watched_fd;
+} uwsgi_PendingCall;
+
+static PyTypeObject uwsgi_PendingCallType;
+
+static void pending_stop(uwsgi_PendingCall *pc) {
+	pc->state = UWSGI_PENDING_DONE;
+	if (pc->fd >= 0) {
+		close(pc->fd);
+		pc->fd = -1;
+	}
+	if (pc->ub) {
+		uwsgi_buffer_destroy(pc->ub);
+		pc->ub = NULL;
+	}
+	if (pc->raw) {
+		free(pc->raw);
+		pc->raw = NULL;
+	}
+}
+
+static void pending_done(uwsgi_PendingCall *pc, PyObject *result) {
+	pending_stop(pc);
+	Py_XDECREF(pc->result);
+	pc->result = result;
+}
+
+static void pending_fail(uwsgi_PendingCall *pc, char *error) {
+	pending_stop(pc);
+	Py_XDECREF(pc->error);
+	pc->error = PyString_FromString(error);
+}
+
+static void pending_rpc_context_hook(char *key, uint16_t kl, char *value, uint16_t vl, void *data) {
+	size_t *r = (size_t *) data;
+	if (!uwsgi_strncmp(key, kl, "CONTENT_LENGTH", 14)) {
+		*r = uwsgi_str_num(value, vl);
+	}
+}
+
+// the response packet has been received
+static void pending_response(uwsgi_PendingCall *pc) {
+	char *body = pc->ub->buf;
+	size_t body_len = pc->ub->pos;
+
+	if (pc->type == UWSGI_PENDING_RPC) {
+		// 64bit response
+		if ((uint8_t) pc->header[3] == 5) {
+			size_t content_len = 0;
+			if (uwsgi_hooked_parse(body, body_len, pending_rpc_context_hook, &content_len)) {
+				pending_fail(pc, "invalid rpc response");
+				return;
+			}
+			if (content_len) {
+				pc->raw = uwsgi_malloc(content_len);
+				pc->raw_len = content_len;
+				pc->state = UWSGI_PENDING_RAW;
+				return;
+			}
+			body_len = 0;
+		}
+		if (!body_len) {
+			Py_INCREF(Py_None);
+			pending_done(pc, Py_None);
+			return;
+		}
+		pending_done(pc, PyString_FromStringAndSize(body, body_len));
+		return;
+	}
+
+	struct uwsgi_cache_magic_context ucmc;
+	memset(&ucmc, 0, sizeof(struct uwsgi_cache_magic_context));
+	if (uwsgi_hooked_parse(body, body_len, uwsgi_cache_magic_context_hook, &ucmc)) {
+		pending_fail(pc, "invalid cache response");
+		return;
+	}
+	if (uwsgi_strncmp(ucmc.status, ucmc.status_len, "ok", 2)) {
+		Py_INCREF(Py_None);
+		pending_done(pc, Py_None);
+		return;
+	}
+	if (pc->type == UWSGI_PENDING_CACHE_GET) {
+		if (!ucmc.size) {
+			Py_INCREF(Py_None);
+			pending_done(pc, Py_None);
+			return;
+		}
+		pc->raw = uwsgi_malloc(ucmc.size);
+		pc->raw_len = ucmc.size;
+		pc->state = UWSGI_PENDING_RAW;
+		return;
+	}
+	Py_INCREF(Py_True);
+	pending_done(pc, Py_True);
+}
+
+// run the call until it would block, returns 1 when complete
+static int pending_run(uwsgi_PendingCall *pc) {
+	while (pc->state != UWSGI_PENDING_DONE) {
+		if (uwsgi_millis() > pc->deadline) {
+			pending_fail(pc, "timeout");
+			break;
+		}
+		ssize_t len;
+		switch (pc->state) {
+		case UWSGI_PENDING_CONNECT: {
+			struct pollfd pfd = {.fd = pc->fd,.events = POLLOUT };
+			int ret = poll(&pfd, 1, 0);
+			if (ret == 0) return 0;
+			int soopt = 0;
+			socklen_t solen = sizeof(int);
+			if (ret < 0 || getsockopt(pc->fd, SOL_SOCKET, SO_ERROR, (void *) (&soopt), &solen) < 0 || soopt) {
+				pending_fail(pc, "unable to connect");
+				return 1;
+			}
+			pc->state = UWSGI_PENDING_SEND;
+			break;
+		}
+		case UWSGI_PENDING_SEND:
+			len = write(pc->fd, pc->ub->buf + pc->pos, pc->ub->pos - pc->pos);
+			if (len <= 0) {
+				if (len < 0 && uwsgi_is_again()) return 0;
+				pending_fail(pc, "unable to send the request");
+				return 1;
+			}
+			pc->pos += len;
+			if (pc->pos >= pc->ub->pos) {
+				pc->state = UWSGI_PENDING_HEADER;
+			}
+			break;
+		case UWSGI_PENDING_HEADER:
+			len = read(pc->fd, pc->header + pc->header_pos, 4 - pc->header_pos);
+			// the cache server closes the connection on misses and errors
+			if (len == 0 && pc->header_pos == 0 && pc->type != UWSGI_PENDING_RPC) {
+				Py_INCREF(Py_None);
+				pending_done(pc, Py_None);
+				return 1;
+			}
+			if (len <= 0) {
+				if (len < 0 && uwsgi_is_again()) return 0;
+				pending_fail(pc, "unable to read the response");
+				return 1;
+			}
+			pc->header_pos += len;
+			if (pc->header_pos == 4) {
+				// reuse the buffer of the request
+				size_t pktsize = (uint8_t) pc->header[1] | ((uint8_t) pc->header[2] << 8);
+				pc->ub->pos = 0;
+				if (uwsgi_buffer_ensure(pc->ub, pktsize + 1)) {
+					pending_fail(pc, "unable to allocate the response");
+					return 1;
+				}
+				pc->pos = pktsize;
+				pc->state = UWSGI_PENDING_BODY;
+				if (!pktsize) pending_response(pc);
+			}
+			break;
+		case UWSGI_PENDING_BODY:
+			len = read(pc->fd, pc->ub->buf + pc->ub->pos, pc->pos - pc->ub->pos);
+			if (len <= 0) {
+				if (len < 0 && uwsgi_is_again()) return 0;
+				pending_fail(pc, "unable to read the response");
+				return 1;
+			}
+			pc->ub->pos += len;
+			if (pc->ub->pos == pc->pos) {
+				pending_response(pc);
+			}
+			break;
+		case UWSGI_PENDING_RAW:
+			len = read(pc->fd, pc->raw + pc->raw_pos, pc->raw_len - pc->raw_pos);
+			if (len <= 0) {
+				if (len < 0 && uwsgi_is_again()) return 0;
+				pending_fail(pc, "unable to read the response");
+				return 1;
+			}
+			pc->raw_pos += len;
+			if (pc->raw_pos == pc->raw_len) {
+				pending_done(pc, PyString_FromStringAndSize(pc->raw, pc->raw_len));
+			}
+			break;
+		}
+	}
+	return 1;
+}
+
+static int pending_want_write(uwsgi_PendingCall *pc) {
+	return pc->state == UWSGI_PENDING_CONNECT || pc->state == UWSGI_PENDING_SEND;
+}
+
+static uwsgi_PendingCall *pending_new(int type) {
+	uwsgi_PendingCall *pc = PyObject_New(uwsgi_PendingCall, &uwsgi_PendingCallType);
+	if (!pc) return NULL;
+	pc->type = type;
+	pc->state = UWSGI_PENDING_DONE;
+	pc->fd = -1;
+	pc->deadline = uwsgi_millis() + (uwsgi.socket_timeout * 1000);
+	pc->ub = NULL;
+	pc->pos = 0;
+	pc->header_pos = 0;
+	pc->raw = NULL;
+	pc->raw_len = 0;
+	pc->raw_pos = 0;
+	pc->result = NULL;
+	pc->error = NULL;
+	pc->loop = NULL;
+	pc->future = NULL;
+	pc->timer = NULL;
+	pc->callback = NULL;
+	pc->watching = 0;
+	pc->watched_fd = -1;
+	return pc;
+}
+
+// a local call, already complete
+static PyObject *pending_complete(int type, PyObject *result) {
+	if (!result) return NULL;
+	uwsgi_PendingCall *pc = pending_new(type);
+	if (!pc) {
+		Py_DECREF(result);
+		return NULL;
+	}
+	pc->result = result;
+	return (PyObject *) pc;
+}
+
+// start a remote call (the request packet is consumed)
+static PyObject *pending_start(int type, char *node, struct uwsgi_buffer *ub) {
+	if (!ub) return PyErr_Format(PyExc_ValueError, "unable to build the request");
+	uwsgi_PendingCall *pc = pending_new(type);
+	if (!pc) {
+		uwsgi_buffer_destroy(ub);
+		return NULL;
+	}
+	pc->ub = ub;
+	pc->state = UWSGI_PENDING_CONNECT;
+	// the connection is asynchronous
+	pc->fd = uwsgi_connect(node, 0, 1);
+	if (pc->fd < 0) {
+		pending_fail(pc, "unable to connect");
+	}
+	return (PyObject *) pc;
+}
+
+static char *pending_cache_server(char *cache, uint16_t *cache_name_len) {
+	if (!cache) return NULL;
+	char *at = strchr(cache, '@');
+	if (!at) return NULL;
+	*cache_name_len = at - cache;
+	return at + 1;
+}
+
+static PyObject *py_uwsgi_async_cache_get(PyObject *self, PyObject *args) {
+	char *key;
+	Py_ssize_t keylen = 0;
+	char *cache = NULL;
+
+	if (!PyArg_ParseTuple(args, "s#|s:async_cache_get", &key, &keylen, &cache)) {
+		return NULL;
+	}
+
+	uint16_t cache_name_len = 0;
+	char *server = pending_cache_server(cache, &cache_name_len);
+	if (!server) {
+		uint64_t vallen = 0;
+		UWSGI_RELEASE_GIL
+		char *value = uwsgi_cache_magic_get(key, keylen, &vallen, NULL, cache);
+		UWSGI_GET_GIL
+		if (!value) {
+			Py_INCREF(Py_None);
+			return pending_complete(UWSGI_PENDING_CACHE_GET, Py_None);
+		}
+		PyObject *ret = PyString_FromStringAndSize(value, vallen);
+		free(value);
+		return pending_complete(UWSGI_PENDING_CACHE_GET, ret);
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_cache_prepare_magic_get(cache, cache_name_len, key, keylen);
+	if (ub && uwsgi_buffer_set_uh(ub, 111, 17)) {
+		uwsgi_buffer_destroy(ub);
+		ub = NULL;
+	}
+	return pending_start(UWSGI_PENDING_CACHE_GET, server, ub);
+}
+
+static PyObject *pending_cache_set(PyObject *args, uint64_t flags) {
+	char *key;
+	Py_ssize_t keylen = 0;
+	char *value;
+	Py_ssize_t vallen = 0;
+	uint64_t expires = 0;
+	char *cache = NULL;
+
+	char *format = flags ? "s#s#|ls:async_cache_update" : "s#s#|ls:async_cache_set";
+	if (!PyArg_ParseTuple(args, format, &key, &keylen, &value, &vallen, &expires, &cache)) {
+		return NULL;
+	}
+
+	uint16_t cache_name_len = 0;
+	char *server = pending_cache_server(cache, &cache_name_len);
+	if (!server) {
+		UWSGI_RELEASE_GIL
+		int ret = uwsgi_cache_magic_set(key, keylen, value, vallen, expires, flags, cache);
+		UWSGI_GET_GIL
+		PyObject *result = ret ? Py_None : Py_True;
+		Py_INCREF(result);
+		return pending_complete(UWSGI_PENDING_CACHE, result);
+	}
+
+	struct uwsgi_buffer *ub = NULL;
+	if (flags & UWSGI_CACHE_FLAG_UPDATE) {
+		ub = uwsgi_cache_prepare_magic_update(cache, cache_name_len, key, keylen, vallen, expires);
+	}
+	else {
+		ub = uwsgi_cache_prepare_magic_set(cache, cache_name_len, key, keylen, vallen, expires);
+	}
+	if (ub && (uwsgi_buffer_set_uh(ub, 111, 17) || uwsgi_buffer_append(ub, value, vallen))) {
+		uwsgi_buffer_destroy(ub);
+		ub = NULL;
+	}
+	return pending_start(UWSGI_PENDING_CACHE, server, ub);
+}
+
+static PyObject *py_uwsgi_async_cache_set(PyObject *self, PyObject *args) {
+	return pending_cache_set(args, 0);
+}
+
+static PyObject *py_uwsgi_async_cache_update(PyObject *self, PyObject *args) {
+	return pending_cache_set(args, UWSGI_CACHE_FLAG_UPDATE);
+}
+
+static PyObject *pending_cache_key(PyObject *args, char *format, int exists) {
+	char *key;
+	Py_ssize_t keylen = 0;
+	char *cache = NULL;
+
+	if (!PyArg_ParseTuple(args, format, &key, &keylen, &cache)) {
+		return NULL;
+	}
+
+	uint16_t cache_name_len = 0;
+	char *server = pending_cache_server(cache, &cache_name_len);
+	if (!server) {
+		int ret;
+		UWSGI_RELEASE_GIL
+		if (exists) {
+			ret = uwsgi_cache_magic_exists(key, keylen, cache) ? 0 : -1;
+		}
+		else {
+			ret = uwsgi_cache_magic_del(key, keylen, cache);
+		}
+		UWSGI_GET_GIL
+		PyObject *result = ret ? Py_None : Py_True;
+		Py_INCREF(result);
+		return pending_complete(UWSGI_PENDING_CACHE, result);
+	}
+
+	struct uwsgi_buffer *ub = NULL;
+	if (exists) {
+		ub = uwsgi_cache_prepare_magic_exists(cache, cache_name_len, key, keylen);
+	}
+	else {
+		ub = uwsgi_cache_prepare_magic_del(cache, cache_name_len, key, keylen);
+	}
+	if (ub && uwsgi_buffer_set_uh(ub, 111, 17)) {
+		uwsgi_buffer_destroy(ub);
+		ub = NULL;
+	}
+	return pending_start(UWSGI_PENDING_CACHE, server, ub);
+}
+
+static PyObject *py_uwsgi_async_cache_del(PyObject *self, PyObject *args) {
+	return pending_cache_key(args, "s#|s:async_cache_del", 0);
+}
+
+static PyObject *py_uwsgi_async_cache_exists(PyObject *self, PyObject *args) {
+	return pending_cache_key(args, "s#|s:async_cache_exists", 1);
+}
+
+static PyObject *py_uwsgi_async_rpc(PyObject *self, PyObject *args) {
+	char *node = NULL;
+	char *argv[256];
+	uint16_t argvs[256];
+	int i;
+
+	int argc = PyTuple_Size(args);
+	if (argc < 2 || argc > 257) {
+		return PyErr_Format(PyExc_ValueError, "async_rpc() requires a node, a function name and up to 255 arguments");
+	}
+
+	PyObject *py_node = PyTuple_GetItem(args, 0);
+	if (PyString_Check(py_node)) {
+		node = PyString_AsString(py_node);
+	}
+#ifdef PYTHREE
+	else if (PyUnicode_Check(py_node)) {
+		node = (char *) PyUnicode_AsUTF8(py_node);
+	}
+#endif
+
+	PyObject *py_func = PyTuple_GetItem(args, 1);
+	char *func = NULL;
+	if (PyString_Check(py_func)) {
+		func = PyString_AsString(py_func);
+	}
+#ifdef PYTHREE
+	else if (PyUnicode_Check(py_func)) {
+		func = (char *) PyUnicode_AsUTF8(py_func);
+	}
+#endif
+	if (!func) {
+		return PyErr_Format(PyExc_ValueError, "invalid rpc function name");
+	}
+
+	for (i = 0; i < (argc - 2); i++) {
+		PyObject *py_str = PyTuple_GetItem(args, i + 2);
+		if (!PyString_Check(py_str)) {
+			return PyErr_Format(PyExc_ValueError, "rpc arguments must be bytes");
+		}
+		argv[i] = PyString_AsString(py_str);
+		argvs[i] = PyString_Size(py_str);
+	}
+
+	// local function
+	if (!node || !node[0]) {
+		uint64_t size = 0;
+		UWSGI_RELEASE_GIL
+		char *response = uwsgi_do_rpc(NULL, func, argc - 2, argv, argvs, &size);
+		UWSGI_GET_GIL
+		if (!response) {
+			Py_INCREF(Py_None);
+			return pending_complete(UWSGI_PENDING_RPC, Py_None);
+		}
+		PyObject *ret = PyString_FromStringAndSize(response, size);
+		free(response);
+		return pending_complete(UWSGI_PENDING_RPC, ret);
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	ub->pos = 4;
+	if (uwsgi_buffer_u16le(ub, strlen(func))) goto error;
+	if (uwsgi_buffer_append(ub, func, strlen(func))) goto error;
+	for (i = 0; i < (argc - 2); i++) {
+		if (uwsgi_buffer_u16le(ub, argvs[i])) goto error;
+		if (uwsgi_buffer_append(ub, argv[i], argvs[i])) goto error;
+	}
+	if (ub->pos - 4 > 0xffff) {
+		uwsgi_buffer_destroy(ub);
+		return PyErr_Format(PyExc_ValueError, "rpc packet too big (max 65535 bytes)");
+	}
+	if (uwsgi_buffer_set_uh(ub, 173, 0)) goto error;
+	return pending_start(UWSGI_PENDING_RPC, node, ub);
+error:
+	uwsgi_buffer_destroy(ub);
+	return PyErr_Format(PyExc_ValueError, "unable to build the rpc request");
+}
+
+static PyObject *pending_result(uwsgi_PendingCall *pc) {
+	if (pc->state != UWSGI_PENDING_DONE) {
+		return PyErr_Format(PyExc_ValueError, "the call is not complete");
+	}
+	if (pc->error) {
+		return PyErr_Format(PyExc_IOError, "%s", PyString_AsString(pc->error));
+	}
+	Py_INCREF(pc->result);
+	return pc->result;
+}
+
+static PyObject *uwsgi_PendingCall_fileno(uwsgi_PendingCall *self, PyObject *args) {
+	return PyInt_FromLong(self->fd);
+}
+
+static PyObject *uwsgi_PendingCall_want_write(uwsgi_PendingCall *self, PyObject *args) {
+	return PyBool_FromLong(pending_want_write(self));
+}
+
+static PyObject *uwsgi_PendingCall_done(uwsgi_PendingCall *self, PyObject *args) {
+	return PyBool_FromLong(self->state == UWSGI_PENDING_DONE);
+}
+
+static PyObject *uwsgi_PendingCall_step(uwsgi_PendingCall *self, PyObject *args) {
+	return PyBool_FromLong(pending_run(self));
+}
+
+static PyObject *uwsgi_PendingCall_result(uwsgi_PendingCall *self, PyObject *args) {
+	return pending_result(self);
+}
+
+// run the call using the wait hooks of the loop engine
+static PyObject *uwsgi_PendingCall_wait(uwsgi_PendingCall *self, PyObject *args) {
+	int timeout = uwsgi.socket_timeout;
+	if (!PyArg_ParseTuple(args, "|i:wait", &timeout)) {
+		return NULL;
+	}
+	uint64_t deadline = uwsgi_millis() + (timeout * 1000);
+	if (deadline < self->deadline) self->deadline = deadline;
+
+	while (!pending_run(self)) {
+		int fd = self->fd;
+		int ret;
+		UWSGI_RELEASE_GIL
+		if (pending_want_write(self)) {
+			ret = uwsgi.wait_write_hook(fd, timeout);
+		}
+		else {
+			ret = uwsgi.wait_read_hook(fd, timeout);
+		}
+		UWSGI_GET_GIL
+		if (ret < 0) {
+			pending_fail(self, "error waiting for the response");
+		}
+		else if (ret == 0) {
+			pending_fail(self, "timeout");
+		}
+	}
+	return pending_result(self);
+}
+
+#if defined(PYTHREE) && PY_VERSION_HEX >= 0x03050000
+static void pending_unwatch(uwsgi_PendingCall *pc) {
+	if (!pc->watching) return;
+	PyObject *ret = PyObject_CallMethod(pc->loop, pc->watching == 2 ? "remove_writer" : "remove_reader", "i", pc->watched_fd);
+	if (!ret) PyErr_Clear();
+	Py_XDECREF(ret);
+	pc->watching = 0;
+}
+
+static void pending_await_complete(uwsgi_PendingCall *pc) {
+	pending_unwatch(pc);
+	if (pc->timer) {
+		PyObject *ret = PyObject_CallMethod(pc->timer, "cancel", NULL);
+		if (!ret) PyErr_Clear();
+		Py_XDECREF(ret);
+		Py_CLEAR(pc->timer);
+	}
+	PyObject *cancelled = PyObject_CallMethod(pc->future, "cancelled", NULL);
+	int is_cancelled = cancelled && PyObject_IsTrue(cancelled);
+	Py_XDECREF(cancelled);
+	PyObject *ret = NULL;
+	if (!is_cancelled) {
+		if (pc->error) {
+			PyObject *exc = PyObject_CallFunction(PyExc_IOError, "O", pc->error);
+			if (exc) {
+				ret = PyObject_CallMethod(pc->future, "set_exception", "O", exc);
+				Py_DECREF(exc);
+			}
+		}
+		else {
+			ret = PyObject_CallMethod(pc->future, "set_result", "O", pc->result);
+		}
+	}
+	if (!ret) PyErr_Clear();
+	Py_XDECREF(ret);
+	// break the reference cycles
+	Py_CLEAR(pc->callback);
+	Py_CLEAR(pc->future);
+	Py_CLEAR(pc->loop);
+}
+
+// (re)register the socket in the loop
+static int pending_watch(uwsgi_PendingCall *pc) {
+	int want = pending_want_write(pc) ? 2 : 1;
+	if (pc->watching == want) return 0;
+	pending_unwatch(pc);
+	PyObject *ret = PyObject_CallMethod(pc->loop, want == 2 ? "add_writer" : "add_reader", "iO", pc->fd, pc->callback);
+	if (!ret) return -1;
+	Py_DECREF(ret);
+	pc->watching = want;
+	pc->watched_fd = pc->fd;
+	return 0;
+}
+
+// called by the loop when the socket is ready (or on timeout)
+static PyObject *uwsgi_PendingCall_ready(uwsgi_PendingCall *self, PyObject *args) {
+	if (!self->future) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	if (PyTuple_Size(args) > 0) {
+		pending_fail(self, "timeout");
+	}
+	if (!pending_run(self) && !pending_watch(self)) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	if (self->state != UWSGI_PENDING_DONE) {
+		PyErr_Clear();
+		pending_fail(self, "unable to watch the socket");
+	}
+	pending_await_complete(self);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef uwsgi_PendingCall_ready_method = {"ready", (PyCFunction) uwsgi_PendingCall_ready, METH_VARARGS, ""};
+
+static PyObject *uwsgi_PendingCall_await(uwsgi_PendingCall *self) {
+	if (self->future) {
+		return PyErr_Format(PyExc_RuntimeError, "the call is already awaited");
+	}
+	PyObject *asyncio = PyImport_ImportModule("asyncio");
+	if (!asyncio) return NULL;
+	self->loop = PyObject_CallMethod(asyncio, "get_event_loop", NULL);
+	Py_DECREF(asyncio);
+	if (!self->loop) return NULL;
+	self->future = PyObject_CallMethod(self->loop, "create_future", NULL);
+	if (!self->future) goto error;
+	self->callback = PyCFunction_New(&uwsgi_PendingCall_ready_method, (PyObject *) self);
+	if (!self->callback) goto error;
+
+	// the iterator keeps a reference to the future
+	PyObject *future = self->future;
+	Py_INCREF(future);
+	if (pending_run(self)) {
+		pending_await_complete(self);
+	}
+	else {
+		double timeout = ((double) self->deadline - (double) uwsgi_millis()) / 1000.0;
+		if (pending_watch(self)) goto error2;
+		self->timer = PyObject_CallMethod(self->loop, "call_later", "dOi", timeout > 0 ? timeout : 0, self->callback, 1);
+		if (!self->timer) goto error2;
+	}
+	PyObject *iter = PyObject_CallMethod(future, "__await__", NULL);
+	Py_DECREF(future);
+	return iter;
+error2:
+	Py_DECREF(future);
+error:
+	pending_unwatch(self);
+	Py_CLEAR(self->callback);
+	Py_CLEAR(self->future);
+	Py_CLEAR(self->loop);
+	return NULL;
+}
+
+static PyAsyncMethods uwsgi_PendingCall_as_async = {
+	(unaryfunc) uwsgi_PendingCall_await,
+	NULL,
+	NULL,
+};
+#endif
+
+static void uwsgi_PendingCall_free(uwsgi_PendingCall *self) {
+	pending_stop(self);
+	Py_XDECREF(self->result);
+	Py_XDECREF(self->error);
+	Py_XDECREF(self->timer);
+	Py_XDECREF(self->callback);
+	Py_XDECREF(self->future);
+	Py_XDECREF(self->loop);
+	PyObject_Del(self);
+}
+
+static PyMethodDef uwsgi_PendingCall_methods[] = {
+	{"fileno", (PyCFunction) uwsgi_PendingCall_fileno, METH_NOARGS, ""},
+	{"want_write", (PyCFunction) uwsgi_PendingCall_want_write, METH_NOARGS, ""},
+	{"done", (PyCFunction) uwsgi_PendingCall_done, METH_NOARGS, ""},
+	{"step", (PyCFunction) uwsgi_PendingCall_step, METH_NOARGS, ""},
+	{"result", (PyCFunction) uwsgi_PendingCall_result, METH_NOARGS, ""},
+	{"wait", (PyCFunction) uwsgi_PendingCall_wait, METH_VARARGS, ""},
+	{NULL, NULL},
+};
+
+static PyTypeObject uwsgi_PendingCallType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "uwsgi.PendingCall",
+	.tp_basicsize = sizeof(uwsgi_PendingCall),
+	.tp_dealloc = (destructor) uwsgi_PendingCall_free,
+#if defined(PYTHREE) && PY_VERSION_HEX >= 0x03050000
+	.tp_as_async = &uwsgi_PendingCall_as_async,
+#endif
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "uwsgi non-blocking call",
+	.tp_methods = uwsgi_PendingCall_methods,
+};
+
+static PyMethodDef uwsgi_pending_methods[] = {
+	{"async_cache_get", py_uwsgi_async_cache_get, METH_VARARGS, ""},
+	{"async_cache_set", py_uwsgi_async_cache_set, METH_VARARGS, ""},
+	{"async_cache_update", py_uwsgi_async_cache_update, METH_VARARGS, ""},
+	{"async_cache_del", py_uwsgi_async_cache_del, METH_VARARGS, ""},
+	{"async_cache_exists", py_uwsgi_async_cache_exists, METH_VARARGS, ""},
+	{"async_rpc", py_uwsgi_async_rpc, METH_VARARGS, ""},
+	{NULL, NULL},
+};
+
+void init_uwsgi_module_pending(PyObject * current_uwsgi_module) {
+	PyMethodDef *uwsgi_function;
+	PyObject *uwsgi_module_dict;
+
+	uwsgi_module_dict = PyModule_GetDict(current_uwsgi_module);
+	if (!uwsgi_module_dict) {
+		uwsgi_log("could not get uwsgi module __dict__\n");
+		exit(1);
+	}
+
+	if (PyType_Ready(&uwsgi_PendingCallType) < 0) {
+		uwsgi_log("uwsgi.PendingCall not ready\n");
+		exit(1);
+	}
+
+	for (uwsgi_function = uwsgi_pending_methods; uwsgi_function->ml_name != NULL; uwsgi_function++) {
+		PyObject *func = PyCFunction_New(uwsgi_function, NULL);
+		PyDict_SetItemString(uwsgi_module_dict, uwsgi_function->ml_name, func);
+		Py_DECREF(func);
+	}
+}
@@ -13,6 +13,13 @@ int PyFrame_GetLineNumber(PyFrameObject *frame) {
 }
 #endif
 
+#if (PY_VERSION_HEX < 0x03090000)
+static PyCodeObject *PyFrame_GetCode(PyFrameObject *frame) {
+	Py_INCREF(frame->f_code);
+	return frame->f_code;
+}
+#endif
+
 #ifdef PYTHREE
 #undef PyString_AsString
 static char *PyString_AsString(PyObject *o) {
@@ -28,6 +35,9 @@ int uwsgi_python_profiler_call(PyObject *obj, PyFrameObject *frame, int what, Py
         uint64_t now = uwsgi_micros();
         uint64_t delta = 0;
 
+	// the frame objects are opaque since python 3.11
+	PyCodeObject *code = PyFrame_GetCode(frame);
+
 	switch(what) {
 		case PyTrace_CALL:
 			if (last_ts == 0) delta = 0;
@@ -35,9 +45,9 @@ int uwsgi_python_profiler_call(PyObject *obj, PyFrameObject *frame, int what, Py
                 	last_ts = now;
 			uwsgi_log("[uWSGI Python profiler %llu] CALL: %s (line %d) -> %s %d args, stacksize %d\n",
 				(unsigned long long) delta,
-				PyString_AsString(frame->f_code->co_filename),
+				PyString_AsString(code->co_filename),
 				PyFrame_GetLineNumber(frame),
-				PyString_AsString(frame->f_code->co_name), frame->f_code->co_argcount, frame->f_code->co_stacksize);
+				PyString_AsString(code->co_name), code->co_argcount, code->co_stacksize);
 			break;
 		case PyTrace_C_CALL:
 			if (last_ts == 0) delta = 0;
@@ -45,12 +55,13 @@ int uwsgi_python_profiler_call(PyObject *obj, PyFrameObject *frame, int what, Py
                 	last_ts = now;
 			uwsgi_log("[uWSGI Python profiler %llu] C CALL: %s (line %d) -> %s %d args, stacksize %d\n",
 				(unsigned long long) delta,
-				PyString_AsString(frame->f_code->co_filename),
+				PyString_AsString(code->co_filename),
 				PyFrame_GetLineNumber(frame),
-				PyEval_GetFuncName(arg), frame->f_code->co_argcount, frame->f_code->co_stacksize);
+				PyEval_GetFuncName(arg), code->co_argcount, code->co_stacksize);
 			break;
 	}
 
+	Py_DECREF(code);
 	return 0;
 }
 
@@ -68,7 +79,9 @@ int uwsgi_python_tracer(PyObject *obj, PyFrameObject *frame, int what, PyObject
 			delta = now - last_ts;
 		}
 		last_ts = now;
-		uwsgi_log("[uWSGI Python profiler %llu] file %s line %d: %s argc:%d\n", (unsigned long long)delta,  PyString_AsString(frame->f_code->co_filename), PyFrame_GetLineNumber(frame), PyString_AsString(frame->f_code->co_name), frame->f_code->co_argcount);
+		PyCodeObject *code = PyFrame_GetCode(frame);
+		uwsgi_log("[uWSGI Python profiler %llu] file %s line %d: %s argc:%d\n", (unsigned long long)delta,  PyString_AsString(code->co_filename), PyFrame_GetLineNumber(frame), PyString_AsString(code->co_name), code->co_argcount);
+		Py_DECREF(code);
 	}
 
         return 0;
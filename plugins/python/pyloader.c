@@ -19,6 +19,9 @@ PyMethodDef uwsgi_sendfile_method[] = {{"uwsgi_sendfile", py_uwsgi_sendfile, MET
 PyMethodDef uwsgi_eventfd_read_method[] = { {"uwsgi_eventfd_read", py_eventfd_read, METH_VARARGS, ""}};
 PyMethodDef uwsgi_eventfd_write_method[] = { {"uwsgi_eventfd_write", py_eventfd_write, METH_VARARGS, ""}};
 
+extern PyMethodDef uwsgi_spit_method[];
+extern PyMethodDef uwsgi_write_method[];
+
 void set_dyn_pyhome(char *home, uint16_t pyhome_len) {
 
 
@@ -370,6 +373,13 @@ int init_uwsgi_app(int loader, void *arg1, struct wsgi_request *wsgi_req, PyThre
 	}
 
 
+	// the core interpreters load the app again
+	if (up.app_loaders && loader != LOADER_CALLABLE && loader != LOADER_DYN) {
+		up.app_loaders[id].loader = loader;
+		up.app_loaders[id].arg = uwsgi_str((char *) arg1);
+		up.app_loaders[id].app_type = app_type;
+	}
+
 	uwsgi_apps_cnt++;
 
 multiapp:
@@ -810,3 +820,181 @@ PyObject *uwsgi_string_callable_loader(void *arg1) {
 
 	return PyDict_GetItem(up.loader_dict, UWSGI_PYFROMSTRING(callable));
 }
+
+/*
+
+	core interpreters (--py-core-interpreters, python >= 3.12)
+
+	every thread (core) of a worker, except the main one, runs in its own sub interpreter with its own GIL
+	(PEP 684), so the threads of a worker run python code in parallel.
+
+	The apps are loaded by the main interpreter (used by core 0) as usual, then every core loads them again
+	in its interpreter replaying their loaders (apps from callables or dynamically loaded ones are not supported).
+	Python objects cannot be shared between the interpreters: the hooks registered with the uwsgi api
+	(signal handlers, rpc functions, after_req_hook...) belong to the main interpreter, the cores run them
+	switching to it, and the registrations made by the apps loaded in the cores are ignored.
+
+*/
+
+struct uwsgi_python_core_interpreter *uwsgi_python_core_interpreter(struct wsgi_request *wsgi_req) {
+	if (!up.core_interpreter || !wsgi_req) return NULL;
+	struct uwsgi_python_core_interpreter *upci = &up.core_interpreter[wsgi_req->async_id];
+	if (!upci->ts) return NULL;
+	return upci;
+}
+
+// the app of the request in the interpreter of the core (NULL if it has not been loaded there)
+struct uwsgi_app *uwsgi_python_get_app(struct wsgi_request *wsgi_req) {
+	struct uwsgi_python_core_interpreter *upci = uwsgi_python_core_interpreter(wsgi_req);
+	if (!upci) return &uwsgi_apps[wsgi_req->app_id];
+	if (wsgi_req->app_id >= upci->apps_cnt || !upci->apps[wsgi_req->app_id].callable) return NULL;
+	return &upci->apps[wsgi_req->app_id];
+}
+
+// the calling thread (holding the GIL) is running a core interpreter
+int uwsgi_python_in_core_interpreter() {
+	if (!up.core_interpreter) return 0;
+	return PyThreadState_Get()->interp != up.main_thread->interp;
+}
+
+// switch a core thread (holding the GIL of its interpreter) to the main interpreter, NULL if it is already there
+PyThreadState *uwsgi_python_core_main_enter() {
+	if (!up.core_interpreter) return NULL;
+	PyThreadState *ts = PyThreadState_Get();
+	int i;
+	for(i=0;i<uwsgi.threads;i++) {
+		struct uwsgi_python_core_interpreter *upci = &up.core_interpreter[i];
+		if (upci->ts && upci->ts == ts) {
+			PyEval_SaveThread();
+			PyEval_RestoreThread(upci->main_ts);
+			return ts;
+		}
+	}
+	return NULL;
+}
+
+void uwsgi_python_core_main_exit(PyThreadState *ts) {
+	if (!ts) return;
+	PyEval_SaveThread();
+	PyEval_RestoreThread(ts);
+}
+
+#ifdef UWSGI_PYTHON_CORE_INTERPRETERS
+static void init_uwsgi_core_app(struct uwsgi_python_core_interpreter *upci, int id, int core_id) {
+	struct uwsgi_app *wi = &upci->apps[id];
+	struct uwsgi_python_app_loader *upal = &up.app_loaders[id];
+
+	// mountpoint, chdir and handlers
+	memcpy(wi, &uwsgi_apps[id], sizeof(struct uwsgi_app));
+	wi->requests = 0;
+	wi->exceptions = 0;
+	wi->callable = NULL;
+
+	// apps of other plugins
+	if (wi->modifier1 != python_plugin.modifier1) return;
+
+	if (!upal->arg || upal->app_type != PYTHON_APP_TYPE_WSGI) {
+		uwsgi_log("app %d (mountpoint='%.*s') cannot be loaded in the core interpreters, only WSGI apps from files or modules are supported\n", id, wi->mountpoint_len, wi->mountpoint);
+		exit(1);
+	}
+
+	if (wi->chdir[0] != 0) {
+		if (chdir(wi->chdir)) {
+			uwsgi_error("chdir()");
+		}
+	}
+
+	wi->interpreter = upci->ts;
+	wi->callable = up.loaders[upal->loader](upal->arg);
+	if (!wi->callable || PyDict_Check((PyObject *) wi->callable)) {
+		if (PyErr_Occurred()) PyErr_Print();
+		uwsgi_log("unable to load app %d (mountpoint='%.*s') in the interpreter of core %d\n", id, wi->mountpoint_len, wi->mountpoint, core_id);
+		exit(UWSGI_FAILED_APP_CODE);
+	}
+	Py_INCREF((PyObject *) wi->callable);
+
+	// only the slot of the core is used
+	wi->environ = uwsgi_calloc(sizeof(PyObject *) * uwsgi.cores);
+	wi->args = uwsgi_calloc(sizeof(PyObject *) * uwsgi.cores);
+	wi->environ[core_id] = PyDict_New();
+	wi->args[core_id] = PyTuple_New(2);
+	if (!wi->environ[core_id] || !wi->args[core_id]) uwsgi_pyexit;
+	Py_INCREF(Py_None);
+	PyTuple_SetItem(wi->args[core_id], 0, Py_None);
+	Py_INCREF(upci->spitout);
+	PyTuple_SetItem(wi->args[core_id], 1, upci->spitout);
+
+	wi->sendfile = PyCFunction_New(uwsgi_sendfile_method, NULL);
+	wi->eventfd_read = PyCFunction_New(uwsgi_eventfd_read_method, NULL);
+	wi->eventfd_write = PyCFunction_New(uwsgi_eventfd_write_method, NULL);
+	wi->error = PyFile_FromFile(stderr, "wsgi_errors", "w", NULL);
+	wi->gateway_version = Py_BuildValue("(ii)", 1, 0);
+	wi->uwsgi_version = PyString_FromString(UWSGI_VERSION);
+	wi->uwsgi_node = PyString_FromString(uwsgi.hostname);
+	if (!wi->sendfile || !wi->eventfd_read || !wi->eventfd_write || !wi->error || !wi->gateway_version || !wi->uwsgi_version || !wi->uwsgi_node) uwsgi_pyexit;
+}
+
+void uwsgi_python_core_interpreter_init(int core_id) {
+	struct uwsgi_python_core_interpreter *upci = &up.core_interpreter[core_id];
+	int i;
+
+	// the loaders are not thread safe
+	pthread_mutex_lock(&up.lock_pyloaders);
+
+	// the new interpreter is created from a thread state of the main one (whose GIL is released on success)
+	upci->main_ts = PyThreadState_New(up.main_thread->interp);
+	PyEval_RestoreThread(upci->main_ts);
+
+	PyInterpreterConfig config = {
+		.use_main_obmalloc = 0,
+		.allow_fork = 0,
+		.allow_exec = 0,
+		.allow_threads = 1,
+		.allow_daemon_threads = 0,
+		.check_multi_interp_extensions = 1,
+		.gil = PyInterpreterConfig_OWN_GIL,
+	};
+	PyStatus status = Py_NewInterpreterFromConfig(&upci->ts, &config);
+	if (PyStatus_Exception(status)) {
+		uwsgi_log("unable to initialize the python interpreter of core %d: %s\n", core_id, status.err_msg ? status.err_msg : "unknown error");
+		exit(1);
+	}
+
+	pthread_setspecific(up.upt_save_key, (void *) upci->ts);
+	pthread_setspecific(up.upt_gil_key, (void *) upci->ts);
+
+	// the global objects are the ones of the main interpreter
+	PyObject *embedded_dict = up.embedded_dict;
+	PyObject *workers_tuple = up.workers_tuple;
+	PyObject *loader_dict = up.loader_dict;
+
+	init_pyargv();
+	init_uwsgi_embedded_module();
+	init_uwsgi_vars();
+
+	upci->spitout = PyCFunction_New(uwsgi_spit_method, NULL);
+	upci->writeout = PyCFunction_New(uwsgi_write_method, NULL);
+	if (!upci->spitout || !upci->writeout) uwsgi_pyexit;
+	if (PyDict_SetItemString(up.embedded_dict, "start_response", upci->spitout)) uwsgi_pyexit;
+
+	uwsgi_python_set_thread_name(core_id);
+
+	upci->apps = uwsgi_calloc(sizeof(struct uwsgi_app) * uwsgi.max_apps);
+	for(i=0;i<uwsgi_apps_cnt;i++) {
+		init_uwsgi_core_app(upci, i, core_id);
+	}
+	upci->apps_cnt = uwsgi_apps_cnt;
+
+	up.embedded_dict = embedded_dict;
+	up.workers_tuple = workers_tuple;
+	up.loader_dict = loader_dict;
+
+	UWSGI_RELEASE_GIL
+
+	pthread_mutex_unlock(&up.lock_pyloaders);
+
+	uwsgi_log("python interpreter %p (with its own GIL) ready on core %d of worker %d, %d apps loaded\n", upci->ts, core_id, uwsgi.mywid, upci->apps_cnt);
+}
+#else
+void uwsgi_python_core_interpreter_init(int core_id) {}
+#endif
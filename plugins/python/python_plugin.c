@@ -169,6 +169,8 @@ struct uwsgi_option uwsgi_python_options[] = {
 	{"pyrun", required_argument, 0, "run a python script in the uWSGI environment", uwsgi_opt_pyrun, NULL, 0},
 
 	{"py-tracebacker", required_argument, 0, "enable the uWSGI python tracebacker", uwsgi_opt_set_str, &up.tracebacker, UWSGI_OPT_THREADS|UWSGI_OPT_MASTER},
+	{"py-sampler", required_argument, 0, "enable the uWSGI python sampling profiler at the specified frequency (Hz)", uwsgi_opt_set_int, &up.sampler, UWSGI_OPT_THREADS|UWSGI_OPT_MASTER},
+	{"py-sampler-socket", required_argument, 0, "expose the stacks collected by the python sampling profiler (folded format) on the specified unix socket (suffixed with the worker id)", uwsgi_opt_set_str, &up.sampler_socket, UWSGI_OPT_THREADS|UWSGI_OPT_MASTER},
 
 	{"py-auto-reload", required_argument, 0, "monitor python modules mtime to trigger reload (use only in development)", uwsgi_opt_set_int, &up.auto_reload, UWSGI_OPT_THREADS|UWSGI_OPT_MASTER},
 	{"py-autoreload", required_argument, 0, "monitor python modules mtime to trigger reload (use only in development)", uwsgi_opt_set_int, &up.auto_reload, UWSGI_OPT_THREADS|UWSGI_OPT_MASTER},
@@ -183,6 +185,9 @@ struct uwsgi_option uwsgi_python_options[] = {
 	{"wsgi-strict", no_argument, 0, "try to be fully PEP compliant disabling optimizations", uwsgi_opt_true, &up.wsgi_strict, 0},
 	{"wsgi-accept-buffer", no_argument, 0, "accept CPython buffer-compliant objects as WSGI response in addition to string/bytes", uwsgi_opt_true, &up.wsgi_accept_buffer, 0},
 	{"wsgi-accept-buffers", no_argument, 0, "accept CPython buffer-compliant objects as WSGI response in addition to string/bytes", uwsgi_opt_true, &up.wsgi_accept_buffer, 0},
+	{"wsgi-write-batch", required_argument, 0, "send the chunks of WSGI iterables with a single writev() up to the specified size (an empty chunk flushes)", uwsgi_opt_set_64bit, &up.wsgi_write_batch, 0},
+
+	{"py-core-interpreters", no_argument, 0, "run every thread of the workers in its own python sub interpreter with its own GIL (python >= 3.12)", uwsgi_opt_true, &up.core_interpreters, UWSGI_OPT_THREADS},
 
 	{"wsgi-disable-file-wrapper", no_argument, 0, "disable wsgi.file_wrapper feature", uwsgi_opt_true, &up.wsgi_disable_file_wrapper, 0},
 
@@ -195,6 +200,7 @@ struct uwsgi_option uwsgi_python_options[] = {
 #endif
 
 	{"py-call-osafterfork", no_argument, 0, "enable child processes running cpython to trap OS signals", uwsgi_opt_true, &up.call_osafterfork, 0},
+	{"py-gc-freeze", no_argument, 0, "disable the python gc in the master and freeze the loaded objects before forking workers (reduces copy-on-write)", uwsgi_opt_true, &up.gc_freeze, 0},
 
 	{"early-python", no_argument, 0, "load the python VM as soon as possible (useful for the fork server)", uwsgi_early_python, NULL, UWSGI_OPT_IMMEDIATE},
 	{"early-pyimport", required_argument, 0, "import a python module in the early phase", uwsgi_early_python_import, NULL, UWSGI_OPT_IMMEDIATE},
@@ -232,6 +238,10 @@ void uwsgi_python_pthread_child(void) {
 PyMethodDef uwsgi_spit_method[] = { {"uwsgi_spit", py_uwsgi_spit, METH_VARARGS, ""} };
 PyMethodDef uwsgi_write_method[] = { {"uwsgi_write", py_uwsgi_write, METH_VARARGS, ""} };
 
+#ifdef PYTHREE
+PyObject *init_uwsgi3(void);
+#endif
+
 int uwsgi_python_init() {
 
 	char *pyversion = strchr(Py_GetVersion(), '\n');
@@ -304,6 +314,11 @@ pep405:
 
 	Py_OptimizeFlag = up.optimize;
 
+#ifdef PYTHREE
+	// the inittab cannot be extended after Py_Initialize() since python 3.12
+	PyImport_AppendInittab("uwsgi", init_uwsgi3);
+#endif
+
 	Py_Initialize();
 
 ready:
@@ -317,6 +332,25 @@ ready:
 
 	up.main_thread = PyThreadState_Get();
 
+	if (up.sampler > 0 && !up.sampler_socket) {
+		uwsgi_log("--py-sampler requires --py-sampler-socket\n");
+		exit(1);
+	}
+
+	if (up.core_interpreters) {
+#ifndef UWSGI_PYTHON_CORE_INTERPRETERS
+		uwsgi_log("--py-core-interpreters requires python >= 3.12\n");
+		exit(1);
+#endif
+		if (uwsgi.async > 0 || up.raw) {
+			uwsgi_log("--py-core-interpreters is not compatible with async modes and --python-raw\n");
+			exit(1);
+		}
+		// the apps are loaded once by the main interpreter
+		uwsgi.single_interpreter = 1;
+		up.app_loaders = uwsgi_calloc(sizeof(struct uwsgi_python_app_loader) * uwsgi.max_apps);
+	}
+
         // by default set a fake GIL (little impact on performance)
         up.gil_get = gil_fake_get;
         up.gil_release = gil_fake_release;
@@ -336,12 +370,53 @@ ready:
 	}
 #endif
 
+	// the gc is re-enabled in the workers (post_fork)
+	if (up.gc_freeze) {
+		uwsgi_python_gc_call("disable");
+		uwsgi.force_get_memusage_extra = 1;
+	}
+
 	uwsgi_log_initial("Python main interpreter initialized at %p\n", up.main_thread);
 
 	return 1;
 
 }
 
+// call a no-args function of the gc module (returns -1 if not available)
+long uwsgi_python_gc_call(char *func) {
+	long ret = -1;
+	PyObject *gc_module = PyImport_ImportModule("gc");
+	if (gc_module) {
+		PyObject *gc_func = PyObject_GetAttrString(gc_module, func);
+		if (gc_func) {
+			PyObject *result = PyObject_CallObject(gc_func, NULL);
+			if (result) {
+				if (PyInt_Check(result)) {
+					ret = PyInt_AsLong(result);
+				}
+				else {
+					ret = 0;
+				}
+				Py_DECREF(result);
+			}
+			Py_DECREF(gc_func);
+		}
+		Py_DECREF(gc_module);
+	}
+	PyErr_Clear();
+	return ret;
+}
+
+// move all of the objects tracked by the gc to the permanent generation, so the
+// collections in workers do not touch (and copy) the pages shared with the master
+void uwsgi_python_gc_freeze() {
+	if (uwsgi_python_gc_call("freeze") < 0) {
+		uwsgi_log("gc.freeze() is not available, only disabling the python gc before fork\n");
+		return;
+	}
+	uwsgi_log("python gc frozen, %ld objects moved to the permanent generation\n", uwsgi_python_gc_call("get_freeze_count"));
+}
+
 void uwsgi_python_reset_random_seed() {
 
 	PyObject *random_module, *random_dict, *random_seed;
@@ -423,6 +498,10 @@ realstuff:
 	if (uwsgi.skip_atexit_teardown)
 		return;
 
+	// the core interpreters (still bound to their threads) cannot be finalized
+	if (up.core_interpreter && uwsgi.mywid > 0)
+		return;
+
 	Py_Finalize();
 }
 
@@ -443,6 +522,10 @@ void uwsgi_python_post_fork() {
 
 	uwsgi_python_reset_random_seed();
 
+	if (up.gc_freeze) {
+		uwsgi_python_gc_call("enable");
+	}
+
 	// call the post_fork_hook
 	PyObject *uwsgi_dict = get_uwsgi_pydict("uwsgi");
 	if (uwsgi_dict) {
@@ -465,6 +548,11 @@ void uwsgi_python_post_fork() {
 			pthread_t ptb_tid;
 			pthread_create(&ptb_tid, NULL, uwsgi_python_tracebacker_thread, NULL);
 		}
+		if (up.sampler > 0) {
+			// spawn the sampling profiler thread
+			pthread_t psp_tid;
+			pthread_create(&psp_tid, NULL, uwsgi_python_sampler_thread, NULL);
+		}
 	}
 
 UWSGI_RELEASE_GIL
@@ -686,7 +774,6 @@ void init_uwsgi_embedded_module() {
 
 
 #ifdef PYTHREE
-	PyImport_AppendInittab("uwsgi", init_uwsgi3);
 	new_uwsgi_module = PyImport_AddModule("uwsgi");
 #else
 	new_uwsgi_module = Py_InitModule3("uwsgi", NULL, uwsgi_py_doc);
@@ -940,6 +1027,7 @@ void init_uwsgi_embedded_module() {
 	}
 
 	init_uwsgi_module_cache(new_uwsgi_module);
+	init_uwsgi_module_pending(new_uwsgi_module);
 
 	if (uwsgi.queue_size > 0) {
 		init_uwsgi_module_queue(new_uwsgi_module);
@@ -1089,13 +1177,41 @@ void uwsgi_python_destroy_env_cheat(struct wsgi_request *wsgi_req) {
 // it is only slightly (better: irrelevant) slower, so no fear in enabling it...
 
 
-void *uwsgi_python_create_env_holy(struct wsgi_request *wsgi_req, struct uwsgi_app *wi) {
-	wsgi_req->async_args = PyTuple_New(2);
-	// set start_response()
+//
+// the dictionary (and the args tuple) of the core are recycled (cleared) only when nobody else
+// kept a reference to them at the end of the request, so apps never see a reused environ
+
+static PyObject *uwsgi_python_env_args(struct wsgi_request *wsgi_req) {
+	PyObject *args = PyTuple_New(2);
+	// set start_response() (every core interpreter has its own)
+	PyObject *spitout = up.wsgi_spitout;
+	struct uwsgi_python_core_interpreter *upci = uwsgi_python_core_interpreter(wsgi_req);
+	if (upci) spitout = upci->spitout;
 	Py_INCREF(Py_None);
-	Py_INCREF(up.wsgi_spitout);
-	PyTuple_SetItem((PyObject *)wsgi_req->async_args, 0, Py_None);
-	PyTuple_SetItem((PyObject *)wsgi_req->async_args, 1, up.wsgi_spitout);
+	Py_INCREF(spitout);
+	PyTuple_SetItem(args, 0, Py_None);
+	PyTuple_SetItem(args, 1, spitout);
+	return args;
+}
+
+void *uwsgi_python_create_env_holy(struct wsgi_request *wsgi_req, struct uwsgi_app *wi) {
+	if (wi->argc == 2) {
+		PyObject *env = wi->environ[wsgi_req->async_id];
+		PyObject *args = wi->args[wsgi_req->async_id];
+		if (Py_REFCNT(args) == 1 && PyDict_Size(env) == 0) {
+			if (PyTuple_GET_ITEM(args, 0) != env) {
+				Py_INCREF(env);
+				PyTuple_SetItem(args, 0, env);
+			}
+			if (Py_REFCNT(env) == 2) {
+				Py_INCREF(args);
+				Py_INCREF(env);
+				wsgi_req->async_args = args;
+				return env;
+			}
+		}
+	}
+	wsgi_req->async_args = uwsgi_python_env_args(wsgi_req);
 	PyObject *env = PyDict_New();
 	return env;
 }
@@ -1106,8 +1222,32 @@ void uwsgi_python_destroy_env_holy(struct wsgi_request *wsgi_req) {
 		// to equalise the refcount of the environ
 		PyDict_DelItemString(up.embedded_dict, "env");
 	}
-	Py_DECREF((PyObject *) wsgi_req->async_args);
-	Py_DECREF((PyObject *)wsgi_req->async_environ);
+	PyObject *env = (PyObject *) wsgi_req->async_environ;
+	PyObject *args = (PyObject *) wsgi_req->async_args;
+	struct uwsgi_app *wi = uwsgi_python_get_app(wsgi_req);
+	if (wi && wi->environ[wsgi_req->async_id] == env && wi->args[wsgi_req->async_id] == args) {
+		// us, the app and the args tuple
+		if (Py_REFCNT(env) == 3 && Py_REFCNT(args) == 2) {
+			PyDict_Clear(env);
+		}
+		else {
+			// still referenced, the core gets new ones
+			PyObject *new_env = PyDict_New();
+			PyObject *new_args = uwsgi_python_env_args(wsgi_req);
+			if (new_env && new_args) {
+				wi->environ[wsgi_req->async_id] = new_env;
+				wi->args[wsgi_req->async_id] = new_args;
+				Py_DECREF(env);
+				Py_DECREF(args);
+			}
+			else {
+				Py_XDECREF(new_env);
+				Py_XDECREF(new_args);
+			}
+		}
+	}
+	Py_DECREF(args);
+	Py_DECREF(env);
 }
 
 
@@ -1185,8 +1325,15 @@ void uwsgi_python_init_apps() {
 
 	// prepare for stack suspend/resume
 	if (uwsgi.async > 0) {
+#ifdef UWSGI_PY311
+		up.current_recursion_remaining = uwsgi_malloc(sizeof(int)*uwsgi.async);
+#ifdef UWSGI_PY312
+		up.current_c_recursion_remaining = uwsgi_malloc(sizeof(int)*uwsgi.async);
+#endif
+#else
 		up.current_recursion_depth = uwsgi_malloc(sizeof(int)*uwsgi.async);
-        	up.current_frame = uwsgi_malloc(sizeof(struct _frame)*uwsgi.async);
+#endif
+        	up.current_frame = uwsgi_malloc(sizeof(up.current_frame[0])*uwsgi.async);
 	}
 
 	struct uwsgi_string_list *upli = up.import_list;
@@ -1304,6 +1451,11 @@ void uwsgi_python_master_fixup(int step) {
 
 	if (!uwsgi.master_process) return;
 
+	// the GIL is still held here (master before forking, or the zygote)
+	if (step == 0 && up.gc_freeze) {
+		uwsgi_python_gc_freeze();
+	}
+
 	if (uwsgi.has_threads) {
 		if (step == 0) {
 			if (!master_fixed) {
@@ -1347,6 +1499,13 @@ void uwsgi_python_enable_threads() {
 	if (uwsgi.threads > 1) {
 		up.swap_ts = threaded_swap_ts;
 		up.reset_ts = threaded_reset_ts;
+		if (up.core_interpreters) {
+			up.core_interpreter = uwsgi_calloc(sizeof(struct uwsgi_python_core_interpreter) * uwsgi.threads);
+			// the cores do not share a GIL protecting the lazy allocation
+			if (up.wsgi_write_batch && !up.write_batch) {
+				up.write_batch = uwsgi_calloc(sizeof(struct uwsgi_python_write_batch) * uwsgi.cores);
+			}
+		}
 	}
 
 	
@@ -1388,6 +1547,12 @@ void uwsgi_python_set_thread_name(int core_id) {
 
 void uwsgi_python_init_thread(int core_id) {
 
+	// only the cores of the workers (the spooler threads use the main interpreter)
+	if (up.core_interpreter && !uwsgi.i_am_a_spooler && core_id < uwsgi.threads) {
+		uwsgi_python_core_interpreter_init(core_id);
+		return;
+	}
+
 	// set a new ThreadState for each thread
 	PyThreadState *pts;
 	pts = PyThreadState_New(up.main_thread->interp);
@@ -1581,12 +1746,32 @@ void uwsgi_python_suspend(struct wsgi_request *wsgi_req) {
 	PyGILState_Release(pgst);
 
 	if (wsgi_req) {
+#ifdef UWSGI_PY311
+#ifdef UWSGI_PY312
+		up.current_c_recursion_remaining[wsgi_req->async_id] = tstate->c_recursion_remaining;
+		up.current_recursion_remaining[wsgi_req->async_id] = tstate->py_recursion_remaining;
+#else
+		up.current_recursion_remaining[wsgi_req->async_id] = tstate->recursion_remaining;
+#endif
+		up.current_frame[wsgi_req->async_id] = tstate->cframe;
+#else
 		up.current_recursion_depth[wsgi_req->async_id] = tstate->recursion_depth;
 		up.current_frame[wsgi_req->async_id] = tstate->frame;
+#endif
 	}
 	else {
+#ifdef UWSGI_PY311
+#ifdef UWSGI_PY312
+		up.current_main_c_recursion_remaining = tstate->c_recursion_remaining;
+		up.current_main_recursion_remaining = tstate->py_recursion_remaining;
+#else
+		up.current_main_recursion_remaining = tstate->recursion_remaining;
+#endif
+		up.current_main_frame = tstate->cframe;
+#else
 		up.current_main_recursion_depth = tstate->recursion_depth;
 		up.current_main_frame = tstate->frame;
+#endif
 	}
 
 }
@@ -1656,13 +1841,17 @@ int uwsgi_python_signal_handler(uint8_t sig, void *handler) {
 
 	PyTuple_SetItem(args, 0, PyInt_FromLong(sig));
 
+	// the handlers belong to the main interpreter
+	PyThreadState *core_ts = uwsgi_python_core_main_enter();
 	ret = python_call(handler, args, 0, NULL);
 	Py_DECREF(args);
 	if (ret) {
 		Py_DECREF(ret);
+		uwsgi_python_core_main_exit(core_ts);
 		UWSGI_RELEASE_GIL;
 		return 0;
 	}
+	uwsgi_python_core_main_exit(core_ts);
 
 clear:
 	UWSGI_RELEASE_GIL;
@@ -1677,6 +1866,9 @@ uint64_t uwsgi_python_rpc(void *func, uint8_t argc, char **argv, uint16_t argvs[
 	char *rv;
 	size_t rl;
 
+	// the rpc functions belong to the main interpreter
+	PyThreadState *core_ts = uwsgi_python_core_main_enter();
+
 	PyObject *pyargs = PyTuple_New(argc);
 	PyObject *ret;
 
@@ -1697,6 +1889,7 @@ uint64_t uwsgi_python_rpc(void *func, uint8_t argc, char **argv, uint16_t argvs[
 				*buffer = uwsgi_malloc(rl);
 				memcpy(*buffer, rv, rl);
 				Py_DECREF(ret);
+				uwsgi_python_core_main_exit(core_ts);
 				UWSGI_RELEASE_GIL;
 				return rl;
 			}
@@ -1707,6 +1900,7 @@ uint64_t uwsgi_python_rpc(void *func, uint8_t argc, char **argv, uint16_t argvs[
 	if (PyErr_Occurred())
 		PyErr_Print();
 
+	uwsgi_python_core_main_exit(core_ts);
 	UWSGI_RELEASE_GIL;
 
 	return 0;
@@ -1807,6 +2001,81 @@ clear:
 	return retval;
 }
 
+/*
+	uwsgi.spooler_batch receives a list of spooler dicts and returns a result for each task
+	(a list with the same length) or a single result for all of them
+*/
+int uwsgi_python_spooler_batch(struct uwsgi_spooler_task *tasks, int n) {
+
+	int i;
+
+	UWSGI_GET_GIL;
+
+	if (!up.embedded_dict) {
+		UWSGI_RELEASE_GIL;
+		return 0;
+	}
+
+	PyObject *spool_func = PyDict_GetItemString(up.embedded_dict, "spooler_batch");
+	if (!spool_func) {
+		UWSGI_RELEASE_GIL;
+		return 0;
+	}
+
+	static int random_seed_reset = 0;
+	if (!random_seed_reset) {
+		uwsgi_python_reset_random_seed();
+		random_seed_reset = 1;
+	}
+
+	PyObject *spool_list = PyList_New(0);
+	for (i = 0; i < n; i++) {
+		tasks[i].ret = -1;
+		PyObject *spool_dict = uwsgi_python_dict_from_spooler_content(tasks[i].name, tasks[i].buf, tasks[i].len, tasks[i].body, tasks[i].body_len);
+		// broken task
+		if (!spool_dict) {
+			tasks[i].ret = -2;
+			Py_INCREF(Py_None);
+			spool_dict = Py_None;
+		}
+		PyList_Append(spool_list, spool_dict);
+		Py_DECREF(spool_dict);
+	}
+
+	PyObject *pyargs = PyTuple_New(1);
+	// PyTuple_SetItem steals a reference !!!
+	PyTuple_SetItem(pyargs, 0, spool_list);
+
+	PyObject *ret = python_call(spool_func, pyargs, 0, NULL);
+	if (ret) {
+		if (PyInt_Check(ret)) {
+			int retval = (int) PyInt_AsLong(ret);
+			for (i = 0; i < n; i++) {
+				if (tasks[i].ret != -2) tasks[i].ret = retval;
+			}
+		}
+		else if (PyList_Check(ret) || PyTuple_Check(ret)) {
+			PyObject *results = PySequence_Fast(ret, "");
+			Py_ssize_t results_cnt = PySequence_Fast_GET_SIZE(results);
+			for (i = 0; i < n && i < results_cnt; i++) {
+				PyObject *item = PySequence_Fast_GET_ITEM(results, i);
+				if (tasks[i].ret != -2 && PyInt_Check(item)) {
+					tasks[i].ret = (int) PyInt_AsLong(item);
+				}
+			}
+			Py_DECREF(results);
+		}
+		Py_DECREF(ret);
+	}
+	else if (PyErr_Occurred()) {
+		PyErr_Print();
+	}
+
+	Py_DECREF(pyargs);
+	UWSGI_RELEASE_GIL;
+	return n;
+}
+
 void uwsgi_python_resume(struct wsgi_request *wsgi_req) {
 
 	PyGILState_STATE pgst = PyGILState_Ensure();
@@ -1814,12 +2083,32 @@ void uwsgi_python_resume(struct wsgi_request *wsgi_req) {
 	PyGILState_Release(pgst);
 
 	if (wsgi_req) {
+#ifdef UWSGI_PY311
+#ifdef UWSGI_PY312
+		tstate->c_recursion_remaining = up.current_c_recursion_remaining[wsgi_req->async_id];
+		tstate->py_recursion_remaining = up.current_recursion_remaining[wsgi_req->async_id];
+#else
+		tstate->recursion_remaining = up.current_recursion_remaining[wsgi_req->async_id];
+#endif
+		tstate->cframe = up.current_frame[wsgi_req->async_id];
+#else
 		tstate->recursion_depth = up.current_recursion_depth[wsgi_req->async_id];
 		tstate->frame = up.current_frame[wsgi_req->async_id];
+#endif
 	}
 	else {
+#ifdef UWSGI_PY311
+#ifdef UWSGI_PY312
+		tstate->c_recursion_remaining = up.current_main_c_recursion_remaining;
+		tstate->py_recursion_remaining = up.current_main_recursion_remaining;
+#else
+		tstate->recursion_remaining = up.current_main_recursion_remaining;
+#endif
+		tstate->cframe = up.current_main_frame;
+#else
 		tstate->recursion_depth = up.current_main_recursion_depth;
 		tstate->frame = up.current_main_frame;
+#endif
 	}
 
 }
@@ -1991,6 +2280,42 @@ exit:
 	}
 
 }
+static volatile sig_atomic_t python_soft_harakiri_requested;
+
+// runs in the main thread, raising the exception in the current frame
+static int uwsgi_python_soft_harakiri_abort(void *arg) {
+	// the interpreter could run it again while unwinding
+	if (!python_soft_harakiri_requested) return 0;
+	python_soft_harakiri_requested = 0;
+	// the request could be already finished
+	time_t harakiri = uwsgi.workers[uwsgi.mywid].cores[0].harakiri;
+	if (!harakiri || harakiri >= uwsgi_now()) return 0;
+	PyObject *traceback = PyImport_ImportModule("traceback");
+	if (traceback) {
+		PyObject *ret = PyObject_CallMethod(traceback, "print_stack", NULL);
+		Py_XDECREF(ret);
+		Py_DECREF(traceback);
+	}
+	PyErr_Clear();
+#ifdef PYTHREE
+	PyErr_SetString(PyExc_TimeoutError, "uWSGI soft harakiri");
+#else
+	PyErr_SetString(PyExc_RuntimeError, "uWSGI soft harakiri");
+#endif
+	return -1;
+}
+
+/*
+	pending calls are run only by the main thread, so only the first core of
+	a sync worker can be aborted (the others wait for the hard harakiri)
+*/
+static void uwsgi_python_soft_harakiri(int core) {
+	if (core != 0 || uwsgi.async > 1) return;
+	if (python_soft_harakiri_requested) return;
+	python_soft_harakiri_requested = 1;
+	Py_AddPendingCall(uwsgi_python_soft_harakiri_abort, NULL);
+}
+
 /*
 	# you can use this logger to offload logging to python
 	# be sure to configure it to not log to stderr otherwise you will generate a loop
@@ -2104,6 +2429,7 @@ struct uwsgi_plugin python_plugin = {
 	.resume = uwsgi_python_resume,
 
 	.harakiri = uwsgi_python_harakiri,
+	.soft_harakiri = uwsgi_python_soft_harakiri,
 
 	.hijack_worker = uwsgi_python_hijack,
 	.spooler_init = uwsgi_python_spooler_init,
@@ -2117,6 +2443,7 @@ struct uwsgi_plugin python_plugin = {
 	.on_load = uwsgi_python_on_load,
 
 	.spooler = uwsgi_python_spooler,
+	.spooler_batch = uwsgi_python_spooler_batch,
 
 	.atexit = uwsgi_python_atexit,
 
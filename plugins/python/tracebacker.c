@@ -288,3 +288,199 @@ end2:
 	}
 	return NULL;
 }
+
+/*
+
+	the python sampling profiler (--py-sampler <hz> --py-sampler-socket <path>)
+
+	every worker runs a thread taking (hz times per second) a snapshot of the stacks of the threads
+	running python code (the same sys._current_frames() used by the tracebacker), counting
+	every different stack. Idle cores (waiting for requests in C code) have no python frames
+	and are not counted.
+
+	Connecting to <path><wid> returns the counters in the "folded" format (one "root;...;leaf count"
+	line per stack) eaten by flamegraph.pl and speedscope (they are cumulative since the worker started).
+
+	The cost is bounded by the sampling rate, as the sampler holds the GIL only to walk the frames.
+
+*/
+
+#define UWSGI_PY_SAMPLER_MAX_DEPTH 128
+
+#if (PY_VERSION_HEX < 0x03090000)
+static PyCodeObject *sampler_frame_code(PyFrameObject *frame) {
+	Py_INCREF(frame->f_code);
+	return frame->f_code;
+}
+
+static PyFrameObject *sampler_frame_back(PyFrameObject *frame) {
+	Py_XINCREF(frame->f_back);
+	return frame->f_back;
+}
+#else
+#define sampler_frame_code PyFrame_GetCode
+#define sampler_frame_back PyFrame_GetBack
+#endif
+
+#ifdef PYTHREE
+#define sampler_str(x) PyUnicode_AsUTF8(x)
+#else
+#define sampler_str(x) PyString_AsString(x)
+#endif
+
+// append the stack (from the root) in folded format, returns the number of frames or -1
+static int sampler_fold(struct uwsgi_buffer *ub, PyFrameObject *frame, int depth) {
+	int frames = 0;
+	if (depth < UWSGI_PY_SAMPLER_MAX_DEPTH) {
+		PyFrameObject *back = sampler_frame_back(frame);
+		if (back) {
+			frames = sampler_fold(ub, back, depth + 1);
+			Py_DECREF(back);
+			if (frames < 0) return -1;
+		}
+	}
+
+	PyCodeObject *code = sampler_frame_code(frame);
+	char *name = (char *) sampler_str(code->co_name);
+	char *filename = (char *) sampler_str(code->co_filename);
+	if (!name || !filename) {
+		PyErr_Clear();
+		name = "<unknown>";
+		filename = "<unknown>";
+	}
+	if (frames > 0 && uwsgi_buffer_append(ub, ";", 1)) goto error;
+	if (uwsgi_buffer_append(ub, name, strlen(name))) goto error;
+	if (uwsgi_buffer_append(ub, " (", 2)) goto error;
+	if (uwsgi_buffer_append(ub, filename, strlen(filename))) goto error;
+	if (uwsgi_buffer_append(ub, ":", 1)) goto error;
+	// the first line of the function, so all of its samples are merged
+	if (uwsgi_buffer_num64(ub, code->co_firstlineno)) goto error;
+	if (uwsgi_buffer_append(ub, ")", 1)) goto error;
+	Py_DECREF(code);
+	return frames + 1;
+error:
+	Py_DECREF(code);
+	return -1;
+}
+
+static void sampler_sample(PyObject *_current_frames, PyObject *stacks, struct uwsgi_buffer *ub) {
+	PyObject *current_frames = PyObject_CallObject(_current_frames, (PyObject *)NULL);
+	if (!current_frames) {
+		PyErr_Clear();
+		return;
+	}
+
+	Py_ssize_t pos = 0;
+	PyObject *thread_id, *frame;
+	while (PyDict_Next(current_frames, &pos, &thread_id, &frame)) {
+		ub->pos = 0;
+		if (sampler_fold(ub, (PyFrameObject *) frame, 0) <= 0) continue;
+		PyObject *stack = PyString_FromStringAndSize(ub->buf, ub->pos);
+		if (!stack) {
+			PyErr_Clear();
+			continue;
+		}
+		long count = 0;
+		PyObject *current = PyDict_GetItem(stacks, stack);
+		if (current) count = PyInt_AsLong(current);
+		PyObject *new_count = PyInt_FromLong(count + 1);
+		if (!new_count || PyDict_SetItem(stacks, stack, new_count)) {
+			PyErr_Clear();
+		}
+		Py_XDECREF(new_count);
+		Py_DECREF(stack);
+	}
+
+	Py_DECREF(current_frames);
+}
+
+static struct uwsgi_buffer *sampler_dump(PyObject *stacks) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	Py_ssize_t pos = 0;
+	PyObject *stack, *count;
+	while (PyDict_Next(stacks, &pos, &stack, &count)) {
+		if (uwsgi_buffer_append(ub, PyString_AsString(stack), PyString_Size(stack))) goto error;
+		if (uwsgi_buffer_append(ub, " ", 1)) goto error;
+		if (uwsgi_buffer_num64(ub, PyInt_AsLong(count))) goto error;
+		if (uwsgi_buffer_append(ub, "\n", 1)) goto error;
+	}
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+void *uwsgi_python_sampler_thread(void *foobar) {
+
+	PyObject *new_thread = uwsgi_python_setup_thread("uWSGISampler", up.main_thread->interp);
+	if (!new_thread) return NULL;
+
+	struct sockaddr_un so_sun;
+	socklen_t so_sun_len = 0;
+
+	char *str_wid = uwsgi_num2str(uwsgi.mywid);
+	char *sock_path = uwsgi_concat2(up.sampler_socket, str_wid);
+	free(str_wid);
+
+	int current_defer_accept = uwsgi.no_defer_accept;
+	uwsgi.no_defer_accept = 1;
+	int fd = bind_to_unix(sock_path, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
+	uwsgi.no_defer_accept = current_defer_accept;
+	if (fd < 0) {
+		free(sock_path);
+		UWSGI_RELEASE_GIL;
+		return NULL;
+	}
+
+	PyObject *sys_module = PyImport_ImportModule("sys");
+	PyObject *_current_frames = sys_module ? PyObject_GetAttrString(sys_module, "_current_frames") : NULL;
+	PyObject *stacks = PyDict_New();
+	if (!_current_frames || !stacks) {
+		PyErr_Print();
+		free(sock_path);
+		close(fd);
+		UWSGI_RELEASE_GIL;
+		return NULL;
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	int interval = 1000 / up.sampler;
+	if (interval < 1) interval = 1;
+
+	uwsgi_log("python sampling profiler (%d Hz) for worker %d available on %s\n", up.sampler, uwsgi.mywid, sock_path);
+	free(sock_path);
+
+	uint64_t next_sample = uwsgi_millis() + interval;
+	for(;;) {
+		uint64_t now = uwsgi_millis();
+		int timeout = next_sample > now ? (int) (next_sample - now) : 0;
+		UWSGI_RELEASE_GIL;
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int ret = poll(&pfd, 1, timeout);
+		if (ret < 0 && errno != EINTR) {
+			uwsgi_error("uwsgi_python_sampler_thread()/poll()");
+		}
+		if (ret > 0) {
+			int client_fd = accept(fd, (struct sockaddr *) &so_sun, &so_sun_len);
+			if (client_fd < 0) {
+				uwsgi_error("uwsgi_python_sampler_thread()/accept()");
+				UWSGI_GET_GIL;
+				continue;
+			}
+			UWSGI_GET_GIL;
+			struct uwsgi_buffer *dump = sampler_dump(stacks);
+			UWSGI_RELEASE_GIL;
+			if (dump) {
+				uwsgi_write_nb(client_fd, dump->buf, dump->pos, uwsgi.socket_timeout);
+				uwsgi_buffer_destroy(dump);
+			}
+			close(client_fd);
+			UWSGI_GET_GIL;
+			continue;
+		}
+		UWSGI_GET_GIL;
+		next_sample = uwsgi_millis() + interval;
+		sampler_sample(_current_frames, stacks, ub);
+	}
+	return NULL;
+}
@@ -342,6 +342,23 @@ PyObject *py_uwsgi_add_rb_timer(PyObject * self, PyObject * args) {
         return Py_None;
 }
 
+PyObject *py_uwsgi_add_ms_rb_timer(PyObject * self, PyObject * args) {
+
+        uint8_t uwsgi_signal;
+        int msecs;
+	int iterations = 0;
+
+        if (!PyArg_ParseTuple(args, "Bi|i:add_ms_rb_timer", &uwsgi_signal, &msecs, &iterations)) {
+                return NULL;
+        }
+
+        if (uwsgi_signal_add_rb_timer_ms(uwsgi_signal, msecs, iterations))
+                return PyErr_Format(PyExc_ValueError, "unable to add rb_timer");
+
+        Py_INCREF(Py_None);
+        return Py_None;
+}
+
 
 
 PyObject *py_uwsgi_add_file_monitor(PyObject * self, PyObject * args) {
@@ -487,6 +504,191 @@ PyObject *py_uwsgi_rpc(PyObject * self, PyObject * args) {
 
 }
 
+// uwsgi.rpc_multi(nodes, func, args..., timeout=msecs) -> [response or None, ...] (one for each node)
+static PyObject *py_uwsgi_rpc_fanout(PyObject *args, PyObject *kwargs) {
+
+	char *argv[256];
+	uint16_t argvs[256];
+	int timeout = 0;
+	Py_ssize_t i;
+	Py_ssize_t argc = PyTuple_Size(args);
+
+	if (argc > 257) goto clear;
+
+	if (kwargs) {
+		PyObject *py_timeout = PyDict_GetItemString(kwargs, "timeout");
+		if (py_timeout) {
+			timeout = PyInt_AsLong(py_timeout);
+			if (PyErr_Occurred()) return NULL;
+		}
+	}
+
+	PyObject *py_func = PyTuple_GetItem(args, 1);
+	if (!PyString_Check(py_func))
+		goto clear;
+	char *func = PyString_AsString(py_func);
+
+	for (i = 0; i < argc - 2; i++) {
+		PyObject *py_str = PyTuple_GetItem(args, i + 2);
+		if (!PyString_Check(py_str))
+			goto clear;
+		argv[i] = PyString_AsString(py_str);
+		argvs[i] = PyString_Size(py_str);
+	}
+
+	PyObject *py_list = PySequence_Fast(PyTuple_GetItem(args, 0), "rpc_multi requires a sequence of nodes");
+	if (!py_list) return NULL;
+
+	Py_ssize_t n = PySequence_Fast_GET_SIZE(py_list);
+	char **nodes = uwsgi_calloc(sizeof(char *) * (n + 1));
+	// keep the latin1 encoded nodes alive
+	PyObject *py_nodes = PyList_New(0);
+	for (i = 0; i < n; i++) {
+		PyObject *py_node = PySequence_Fast_GET_ITEM(py_list, i);
+		if (PyString_Check(py_node)) {
+			nodes[i] = PyString_AsString(py_node);
+		}
+#ifdef PYTHREE
+		else if (PyUnicode_Check(py_node)) {
+			PyObject *py_latin1 = PyUnicode_AsLatin1String(py_node);
+			if (!py_latin1) break;
+			PyList_Append(py_nodes, py_latin1);
+			Py_DECREF(py_latin1);
+			nodes[i] = PyBytes_AsString(py_latin1);
+		}
+#endif
+		else break;
+	}
+	if (i < n) {
+		free(nodes);
+		Py_DECREF(py_nodes);
+		Py_DECREF(py_list);
+		goto clear;
+	}
+
+	char **responses = uwsgi_calloc(sizeof(char *) * (n + 1));
+	uint64_t *lens = uwsgi_calloc(sizeof(uint64_t) * (n + 1));
+
+	UWSGI_RELEASE_GIL;
+	uwsgi_rpc_multi(nodes, n, func, argc - 2, argv, argvs, timeout, responses, lens);
+	UWSGI_GET_GIL;
+
+	PyObject *ret = PyList_New(n);
+	for (i = 0; i < n; i++) {
+		if (responses[i]) {
+			PyList_SetItem(ret, i, PyString_FromStringAndSize(responses[i], lens[i]));
+			free(responses[i]);
+		}
+		else {
+			Py_INCREF(Py_None);
+			PyList_SetItem(ret, i, Py_None);
+		}
+	}
+	free(responses);
+	free(lens);
+	free(nodes);
+	Py_DECREF(py_nodes);
+	Py_DECREF(py_list);
+	return ret;
+
+clear:
+	return PyErr_Format(PyExc_ValueError, "unable to call rpc function");
+}
+
+/*
+	uwsgi.rpc_multi([(node, func, args...), ...]) -> [response or None, ...]
+	uwsgi.rpc_multi(nodes, func, args..., timeout=msecs) fans out the same call to each node
+*/
+PyObject *py_uwsgi_rpc_multi(PyObject * self, PyObject * args, PyObject * kwargs) {
+
+	PyObject *py_calls;
+	Py_ssize_t i, j;
+
+	if (PyTuple_Size(args) >= 2) {
+		return py_uwsgi_rpc_fanout(args, kwargs);
+	}
+
+	if (!PyArg_ParseTuple(args, "O:rpc_multi", &py_calls)) {
+		return NULL;
+	}
+
+	PyObject *py_list = PySequence_Fast(py_calls, "rpc_multi requires a sequence of (node, func, args...) tuples");
+	if (!py_list) return NULL;
+
+	Py_ssize_t n = PySequence_Fast_GET_SIZE(py_list);
+	struct uwsgi_rpc_call *calls = uwsgi_calloc(sizeof(struct uwsgi_rpc_call) * (n + 1));
+	// keep the latin1 encoded nodes alive
+	PyObject *py_nodes = PyList_New(0);
+
+	for (i = 0; i < n; i++) {
+		PyObject *py_call = PySequence_Fast_GET_ITEM(py_list, i);
+		if (!PyTuple_Check(py_call) || PyTuple_Size(py_call) < 2 || PyTuple_Size(py_call) > 257)
+			goto clear;
+
+		PyObject *py_node = PyTuple_GetItem(py_call, 0);
+		if (PyString_Check(py_node)) {
+			calls[i].node = PyString_AsString(py_node);
+		}
+#ifdef PYTHREE
+		else if (PyUnicode_Check(py_node)) {
+			PyObject *py_latin1 = PyUnicode_AsLatin1String(py_node);
+			if (!py_latin1) goto clear;
+			PyList_Append(py_nodes, py_latin1);
+			Py_DECREF(py_latin1);
+			calls[i].node = PyBytes_AsString(py_latin1);
+		}
+#endif
+
+		PyObject *py_func = PyTuple_GetItem(py_call, 1);
+		if (!PyString_Check(py_func))
+			goto clear;
+		calls[i].func = PyString_AsString(py_func);
+
+		calls[i].argc = PyTuple_Size(py_call) - 2;
+		calls[i].argv = uwsgi_malloc(sizeof(char *) * (calls[i].argc + 1));
+		calls[i].argvs = uwsgi_malloc(sizeof(uint16_t) * (calls[i].argc + 1));
+		for (j = 0; j < calls[i].argc; j++) {
+			PyObject *py_str = PyTuple_GetItem(py_call, j + 2);
+			if (!PyString_Check(py_str))
+				goto clear;
+			calls[i].argv[j] = PyString_AsString(py_str);
+			calls[i].argvs[j] = PyString_Size(py_str);
+		}
+	}
+
+	UWSGI_RELEASE_GIL;
+	uwsgi_rpc_calls(calls, n);
+	UWSGI_GET_GIL;
+
+	PyObject *ret = PyList_New(n);
+	for (i = 0; i < n; i++) {
+		if (calls[i].response) {
+			PyList_SetItem(ret, i, PyString_FromStringAndSize(calls[i].response, calls[i].len));
+			free(calls[i].response);
+		}
+		else {
+			Py_INCREF(Py_None);
+			PyList_SetItem(ret, i, Py_None);
+		}
+		free(calls[i].argv);
+		free(calls[i].argvs);
+	}
+	free(calls);
+	Py_DECREF(py_nodes);
+	Py_DECREF(py_list);
+	return ret;
+
+clear:
+	for (i = 0; i < n; i++) {
+		if (calls[i].argv) free(calls[i].argv);
+		if (calls[i].argvs) free(calls[i].argvs);
+	}
+	free(calls);
+	Py_DECREF(py_nodes);
+	Py_DECREF(py_list);
+	return PyErr_Format(PyExc_ValueError, "unable to call rpc functions");
+}
+
 PyObject *py_uwsgi_register_rpc(PyObject * self, PyObject * args) {
 
 	uint8_t argc = 0;
@@ -497,6 +699,12 @@ PyObject *py_uwsgi_register_rpc(PyObject * self, PyObject * args) {
 		return NULL;
 	}
 
+	// already registered by the main interpreter
+	if (uwsgi_python_in_core_interpreter()) {
+		Py_INCREF(Py_True);
+		return Py_True;
+	}
+
 	Py_INCREF(func);
 
 	if (uwsgi_register_rpc(name, &python_plugin, argc, func)) {
@@ -602,6 +810,12 @@ PyObject *py_uwsgi_register_signal(PyObject * self, PyObject * args) {
 		return NULL;
 	}
 
+	// already registered by the main interpreter
+	if (uwsgi_python_in_core_interpreter()) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
 	Py_INCREF(handler);
 
 	if (uwsgi_register_signal(uwsgi_signal, signal_kind, handler, 0)) {
@@ -1176,6 +1390,32 @@ PyObject *py_uwsgi_websocket_send_binary(PyObject * self, PyObject * args, PyObj
         return Py_None;
 }
 
+PyObject *py_uwsgi_websocket_publish(PyObject * self, PyObject * args, PyObject * kwargs) {
+	char *channel = NULL;
+	Py_ssize_t channel_len = 0;
+	char *message = NULL;
+	Py_ssize_t message_len = 0;
+	int binary = 0;
+
+	static char *kwlist[] = {"channel", "message", "binary", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|i:websocket_publish", kwlist, &channel, &channel_len, &message, &message_len, &binary)) {
+		return NULL;
+	}
+
+	if (channel_len > 0xffff) {
+		return PyErr_Format(PyExc_ValueError, "invalid websocket channel name");
+	}
+
+	UWSGI_RELEASE_GIL
+	int ret = uwsgi_websocket_publish(channel, channel_len, message, message_len, binary);
+	UWSGI_GET_GIL
+	if (ret < 0) {
+		return PyErr_Format(PyExc_IOError, "unable to publish websocket message");
+	}
+	Py_INCREF(Py_None);
+	return Py_None;
+}
 
 PyObject *py_uwsgi_chunked_read(PyObject * self, PyObject * args) {
 	int timeout = 0; 
@@ -2044,198 +2284,461 @@ PyObject *py_uwsgi_sharedarea_read(PyObject * self, PyObject * args) {
 	return ret;
 }
 
-#if defined(PYTHREE) || defined(Py_TPFLAGS_HAVE_NEWBUFFER)
-#ifndef HAS_NOT_PyMemoryView_FromBuffer
-PyObject *py_uwsgi_sharedarea_memoryview(PyObject * self, PyObject * args) {
-        int id;
-	if (!PyArg_ParseTuple(args, "i:sharedarea_memoryview", &id)) {
-                return NULL;
-        }
-	struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, 0);
-	if (!sa) {
-        	return PyErr_Format(PyExc_ValueError, "cannot get a memoryview object from sharedarea %d", id);
-        }
-	Py_buffer info;
-	if (PyBuffer_FillInfo(&info, NULL, sa->area, sa->max_pos+1, 0, PyBUF_CONTIG) < 0)
-        	return PyErr_Format(PyExc_ValueError, "cannot get a memoryview object from sharedarea %d", id);
-	return PyMemoryView_FromBuffer(&info);
-}
-#endif
-
-PyObject *py_uwsgi_sharedarea_object(PyObject * self, PyObject * args) {
+/*
+	lock-free counters: width is 8, 16, 32 or 64 (default) bits and the offset must be aligned to it
+*/
+PyObject *py_uwsgi_sharedarea_atomic_add(PyObject * self, PyObject * args) {
 	int id;
-        if (!PyArg_ParseTuple(args, "i:sharedarea_object", &id)) {
-                return NULL;
-        }
-        struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, 0);
-        if (!sa) {
-                return PyErr_Format(PyExc_ValueError, "cannot get an object from sharedarea %d", id);
-        }
-	return (PyObject *) sa->obj;
+	uint64_t pos = 0;
+	long long amount = 1;
+	int width = 64;
+	int ret = -1;
+	long long old = 0;
+
+	if (!PyArg_ParseTuple(args, "iK|Li:sharedarea_atomic_add", &id, &pos, &amount, &width)) {
+		return NULL;
+	}
+
+	switch(width) {
+		case 8: { int8_t o; ret = uwsgi_sharedarea_atomic_add8(id, pos, amount, &o); old = o; break; }
+		case 16: { int16_t o; ret = uwsgi_sharedarea_atomic_add16(id, pos, amount, &o); old = o; break; }
+		case 32: { int32_t o; ret = uwsgi_sharedarea_atomic_add32(id, pos, amount, &o); old = o; break; }
+		case 64: { int64_t o; ret = uwsgi_sharedarea_atomic_add64(id, pos, amount, &o); old = o; break; }
+	}
+
+	if (ret) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_atomic_add%d()", width);
+	}
+
+	return PyLong_FromLongLong(old);
 }
-#endif
 
-PyObject *py_uwsgi_spooler_freq(PyObject * self, PyObject * args) {
+PyObject *py_uwsgi_sharedarea_atomic_xchg(PyObject * self, PyObject * args) {
+	int id;
+	uint64_t pos = 0;
+	long long value = 0;
+	int width = 64;
+	int ret = -1;
+	long long old = 0;
 
-	if (!PyArg_ParseTuple(args, "i", &uwsgi.shared->spooler_frequency)) {
+	if (!PyArg_ParseTuple(args, "iKL|i:sharedarea_atomic_xchg", &id, &pos, &value, &width)) {
 		return NULL;
 	}
 
-	Py_INCREF(Py_True);
-	return Py_True;
+	switch(width) {
+		case 8: { int8_t o; ret = uwsgi_sharedarea_atomic_xchg8(id, pos, value, &o); old = o; break; }
+		case 16: { int16_t o; ret = uwsgi_sharedarea_atomic_xchg16(id, pos, value, &o); old = o; break; }
+		case 32: { int32_t o; ret = uwsgi_sharedarea_atomic_xchg32(id, pos, value, &o); old = o; break; }
+		case 64: { int64_t o; ret = uwsgi_sharedarea_atomic_xchg64(id, pos, value, &o); old = o; break; }
+	}
 
-}
+	if (ret) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_atomic_xchg%d()", width);
+	}
 
-PyObject *py_uwsgi_spooler_jobs(PyObject * self, PyObject * args) {
+	return PyLong_FromLongLong(old);
+}
 
-	DIR *sdir;
-	struct dirent *dp;
-	char *abs_path;
-	struct stat sf_lstat;
+PyObject *py_uwsgi_sharedarea_atomic_load(PyObject * self, PyObject * args) {
+	int id;
+	uint64_t pos = 0;
+	int width = 64;
+	int ret = -1;
+	long long value = 0;
 
-	PyObject *jobslist = PyList_New(0);
+	if (!PyArg_ParseTuple(args, "iK|i:sharedarea_atomic_load", &id, &pos, &width)) {
+		return NULL;
+	}
 
-	struct uwsgi_spooler *uspool = uwsgi.spoolers;
+	switch(width) {
+		case 8: { int8_t v; ret = uwsgi_sharedarea_atomic_load8(id, pos, &v); value = v; break; }
+		case 16: { int16_t v; ret = uwsgi_sharedarea_atomic_load16(id, pos, &v); value = v; break; }
+		case 32: { int32_t v; ret = uwsgi_sharedarea_atomic_load32(id, pos, &v); value = v; break; }
+		case 64: { int64_t v; ret = uwsgi_sharedarea_atomic_load64(id, pos, &v); value = v; break; }
+	}
 
-	sdir = opendir(uspool->dir);
+	if (ret) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_atomic_load%d()", width);
+	}
 
-	if (sdir) {
-		while ((dp = readdir(sdir)) != NULL) {
-			if (!strncmp("uwsgi_spoolfile_on_", dp->d_name, 19)) {
-				abs_path = malloc(strlen(uspool->dir) + 1 + strlen(dp->d_name) + 1);
-				if (!abs_path) {
-					uwsgi_error("malloc()");
-					closedir(sdir);
-					goto clear;
-				}
+	return PyLong_FromLongLong(value);
+}
 
-				memset(abs_path, 0, strlen(uspool->dir) + 1 + strlen(dp->d_name) + 1);
+// returns True if the value has been swapped
+PyObject *py_uwsgi_sharedarea_atomic_cas(PyObject * self, PyObject * args) {
+	int id;
+	uint64_t pos = 0;
+	long long expected = 0;
+	long long desired = 0;
+	int width = 64;
+	int ret = -1;
 
-				memcpy(abs_path, uspool->dir, strlen(uspool->dir));
-				memcpy(abs_path + strlen(uspool->dir), "/", 1);
-				memcpy(abs_path + strlen(uspool->dir) + 1, dp->d_name, strlen(dp->d_name));
+	if (!PyArg_ParseTuple(args, "iKLL|i:sharedarea_atomic_cas", &id, &pos, &expected, &desired, &width)) {
+		return NULL;
+	}
 
+	switch(width) {
+		case 8: { int8_t e = expected; ret = uwsgi_sharedarea_atomic_cas8(id, pos, &e, desired); break; }
+		case 16: { int16_t e = expected; ret = uwsgi_sharedarea_atomic_cas16(id, pos, &e, desired); break; }
+		case 32: { int32_t e = expected; ret = uwsgi_sharedarea_atomic_cas32(id, pos, &e, desired); break; }
+		case 64: { int64_t e = expected; ret = uwsgi_sharedarea_atomic_cas64(id, pos, &e, desired); break; }
+	}
 
-				if (lstat(abs_path, &sf_lstat)) {
-					free(abs_path);
-					continue;
-				}
-				if (!S_ISREG(sf_lstat.st_mode)) {
-					free(abs_path);
-					continue;
-				}
-				if (!access(abs_path, R_OK | W_OK)) {
-					if (PyList_Append(jobslist, PyString_FromString(abs_path))) {
-						PyErr_Print();
-					}
-				}
-				free(abs_path);
-			}
-		}
-		closedir(sdir);
+	if (ret < 0) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_atomic_cas%d()", width);
 	}
 
-      clear:
-	return jobslist;
+	if (ret) {
+		Py_INCREF(Py_False);
+		return Py_False;
+	}
 
+	Py_INCREF(Py_True);
+	return Py_True;
 }
 
+// adds every item of the sequence to the consecutive counters starting at pos
+PyObject *py_uwsgi_sharedarea_atomic_add_bulk(PyObject * self, PyObject * args) {
+	int id;
+	uint64_t pos = 0;
+	PyObject *amounts;
+	int width = 64;
+	int ret = -1;
 
-PyObject *py_uwsgi_send_spool(PyObject * self, PyObject * args, PyObject *kw) {
-	PyObject *spool_dict, *spool_vars;
-	PyObject *zero, *key, *val;
-	uint16_t keysize, valsize;
-	char *body = NULL;
-	size_t body_len= 0;
+	if (!PyArg_ParseTuple(args, "iKO|i:sharedarea_atomic_add_bulk", &id, &pos, &amounts, &width)) {
+		return NULL;
+	}
 
-	spool_dict = PyTuple_GetItem(args, 0);
+	if (width != 8 && width != 16 && width != 32 && width != 64) {
+		return PyErr_Format(PyExc_ValueError, "invalid width for sharedarea_atomic_add_bulk()");
+	}
 
-	if (spool_dict) {
-		if (!PyDict_Check(spool_dict)) {
-			return PyErr_Format(PyExc_ValueError, "The argument of spooler callable must be a dictionary");
+	PyObject *seq = PySequence_Fast(amounts, "sharedarea_atomic_add_bulk() requires a sequence of integers");
+	if (!seq) return NULL;
+
+	Py_ssize_t i, n = PySequence_Fast_GET_SIZE(seq);
+	char *buf = uwsgi_malloc(n * (width/8) + 1);
+	for(i=0;i<n;i++) {
+		long long amount = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (amount == -1 && PyErr_Occurred()) {
+			free(buf);
+			Py_DECREF(seq);
+			return NULL;
+		}
+		switch(width) {
+			case 8: ((int8_t *) buf)[i] = amount; break;
+			case 16: ((int16_t *) buf)[i] = amount; break;
+			case 32: ((int32_t *) buf)[i] = amount; break;
+			case 64: ((int64_t *) buf)[i] = amount; break;
 		}
 	}
-	else {
-		// clear the error
-		PyErr_Clear();
-		spool_dict = kw;
-	}
+	Py_DECREF(seq);
 
-	if (!spool_dict) {
-		return PyErr_Format(PyExc_ValueError, "The argument of spooler callable must be a dictionary");
+	switch(width) {
+		case 8: ret = uwsgi_sharedarea_atomic_add8_bulk(id, pos, (int8_t *) buf, n); break;
+		case 16: ret = uwsgi_sharedarea_atomic_add16_bulk(id, pos, (int16_t *) buf, n); break;
+		case 32: ret = uwsgi_sharedarea_atomic_add32_bulk(id, pos, (int32_t *) buf, n); break;
+		case 64: ret = uwsgi_sharedarea_atomic_add64_bulk(id, pos, (int64_t *) buf, n); break;
 	}
+	free(buf);
 
-	PyObject *pybody = uwsgi_py_dict_get(spool_dict, "body");
-	if (pybody) {
-		if (PyString_Check(pybody)) {
-			body = PyString_AsString(pybody);
-			body_len = PyString_Size(pybody);
-			Py_INCREF(pybody);
-			uwsgi_py_dict_del(spool_dict, "body");
-		}
+	if (ret) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_atomic_add%d_bulk()", width);
 	}
 
-	spool_vars = PyDict_Items(spool_dict);
-	if (!spool_vars) {
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyObject *py_uwsgi_sharedarea_hashmap_add(PyObject * self, PyObject * args) {
+	int id;
+	char *key;
+	Py_ssize_t keylen = 0;
+	long long amount = 1;
+	unsigned long long ttl = 0;
+	int64_t value = 0;
+
+	if (!PyArg_ParseTuple(args, "is#|LK:sharedarea_hashmap_add", &id, &key, &keylen, &amount, &ttl)) {
+		return NULL;
+	}
+
+	if (keylen > 0xffff) {
+		return PyErr_Format(PyExc_ValueError, "sharedarea hashmap key too long");
+	}
+
+	if (uwsgi_sharedarea_hashmap_add(id, key, keylen, amount, ttl, &value)) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_hashmap_add()");
+	}
+
+	return PyLong_FromLongLong(value);
+}
+
+PyObject *py_uwsgi_sharedarea_hashmap_set(PyObject * self, PyObject * args) {
+	int id;
+	char *key;
+	Py_ssize_t keylen = 0;
+	long long value = 0;
+	unsigned long long ttl = 0;
+
+	if (!PyArg_ParseTuple(args, "is#L|K:sharedarea_hashmap_set", &id, &key, &keylen, &value, &ttl)) {
+		return NULL;
+	}
+
+	if (keylen > 0xffff) {
+		return PyErr_Format(PyExc_ValueError, "sharedarea hashmap key too long");
+	}
+
+	if (uwsgi_sharedarea_hashmap_set(id, key, keylen, value, ttl)) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_hashmap_set()");
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyObject *py_uwsgi_sharedarea_hashmap_get(PyObject * self, PyObject * args) {
+	int id;
+	char *key;
+	Py_ssize_t keylen = 0;
+	int64_t value = 0;
+
+	if (!PyArg_ParseTuple(args, "is#:sharedarea_hashmap_get", &id, &key, &keylen)) {
+		return NULL;
+	}
+
+	if (keylen > 0xffff) {
+		return PyErr_Format(PyExc_ValueError, "sharedarea hashmap key too long");
+	}
+
+	int ret = uwsgi_sharedarea_hashmap_get(id, key, keylen, &value);
+	if (ret < 0) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_hashmap_get()");
+	}
+
+	if (ret) {
 		Py_INCREF(Py_None);
 		return Py_None;
 	}
 
-	int i;
+	return PyLong_FromLongLong(value);
+}
+
+// returns True if the value has been swapped
+PyObject *py_uwsgi_sharedarea_hashmap_cas(PyObject * self, PyObject * args) {
+	int id;
+	char *key;
+	Py_ssize_t keylen = 0;
+	long long expected = 0;
+	long long desired = 0;
+	unsigned long long ttl = 0;
+
+	if (!PyArg_ParseTuple(args, "is#LL|K:sharedarea_hashmap_cas", &id, &key, &keylen, &expected, &desired, &ttl)) {
+		return NULL;
+	}
+
+	if (keylen > 0xffff) {
+		return PyErr_Format(PyExc_ValueError, "sharedarea hashmap key too long");
+	}
+
+	int64_t e = expected;
+	int ret = uwsgi_sharedarea_hashmap_cas(id, key, keylen, &e, desired, ttl);
+	if (ret < 0) {
+		return PyErr_Format(PyExc_ValueError, "error calling uwsgi_sharedarea_hashmap_cas()");
+	}
+
+	if (ret) {
+		Py_INCREF(Py_False);
+		return Py_False;
+	}
+
+	Py_INCREF(Py_True);
+	return Py_True;
+}
+
+#if defined(PYTHREE) || defined(Py_TPFLAGS_HAVE_NEWBUFFER)
+#ifndef HAS_NOT_PyMemoryView_FromBuffer
+PyObject *py_uwsgi_sharedarea_memoryview(PyObject * self, PyObject * args) {
+        int id;
+	if (!PyArg_ParseTuple(args, "i:sharedarea_memoryview", &id)) {
+                return NULL;
+        }
+	struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, 0);
+	if (!sa) {
+        	return PyErr_Format(PyExc_ValueError, "cannot get a memoryview object from sharedarea %d", id);
+        }
+	Py_buffer info;
+	if (PyBuffer_FillInfo(&info, NULL, sa->area, sa->max_pos+1, 0, PyBUF_CONTIG) < 0)
+        	return PyErr_Format(PyExc_ValueError, "cannot get a memoryview object from sharedarea %d", id);
+	return PyMemoryView_FromBuffer(&info);
+}
+#endif
+
+PyObject *py_uwsgi_sharedarea_object(PyObject * self, PyObject * args) {
+	int id;
+        if (!PyArg_ParseTuple(args, "i:sharedarea_object", &id)) {
+                return NULL;
+        }
+        struct uwsgi_sharedarea *sa = uwsgi_sharedarea_get_by_id(id, 0);
+        if (!sa) {
+                return PyErr_Format(PyExc_ValueError, "cannot get an object from sharedarea %d", id);
+        }
+	return (PyObject *) sa->obj;
+}
+#endif
+
+PyObject *py_uwsgi_spooler_freq(PyObject * self, PyObject * args) {
+
+	if (!PyArg_ParseTuple(args, "i", &uwsgi.shared->spooler_frequency)) {
+		return NULL;
+	}
+
+	Py_INCREF(Py_True);
+	return Py_True;
+
+}
+
+PyObject *py_uwsgi_spooler_jobs(PyObject * self, PyObject * args) {
+
+	DIR *sdir;
+	struct dirent *dp;
+	char *abs_path;
+	struct stat sf_lstat;
+
+	PyObject *jobslist = PyList_New(0);
+
+	struct uwsgi_spooler *uspool = uwsgi.spoolers;
+
+	sdir = opendir(uspool->dir);
+
+	if (sdir) {
+		while ((dp = readdir(sdir)) != NULL) {
+			if (!strncmp("uwsgi_spoolfile_on_", dp->d_name, 19)) {
+				abs_path = malloc(strlen(uspool->dir) + 1 + strlen(dp->d_name) + 1);
+				if (!abs_path) {
+					uwsgi_error("malloc()");
+					closedir(sdir);
+					goto clear;
+				}
+
+				memset(abs_path, 0, strlen(uspool->dir) + 1 + strlen(dp->d_name) + 1);
+
+				memcpy(abs_path, uspool->dir, strlen(uspool->dir));
+				memcpy(abs_path + strlen(uspool->dir), "/", 1);
+				memcpy(abs_path + strlen(uspool->dir) + 1, dp->d_name, strlen(dp->d_name));
+
+
+				if (lstat(abs_path, &sf_lstat)) {
+					free(abs_path);
+					continue;
+				}
+				if (!S_ISREG(sf_lstat.st_mode)) {
+					free(abs_path);
+					continue;
+				}
+				if (!access(abs_path, R_OK | W_OK)) {
+					if (PyList_Append(jobslist, PyString_FromString(abs_path))) {
+						PyErr_Print();
+					}
+				}
+				free(abs_path);
+			}
+		}
+		closedir(sdir);
+	}
+
+      clear:
+	return jobslist;
+
+}
+
+
+// encode a spooler dictionary (the "body" item, if a string, is returned apart), NULL on invalid items
+static struct uwsgi_buffer *py_uwsgi_spool_buffer(PyObject *spool_dict, PyObject **pybody) {
+	PyObject *spool_vars, *zero, *key, *val;
+	uint16_t keysize, valsize;
+
+	*pybody = uwsgi_py_dict_get(spool_dict, "body");
+	if (*pybody && !PyString_Check(*pybody)) {
+		*pybody = NULL;
+	}
+
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
 
+	spool_vars = PyDict_Items(spool_dict);
+	if (!spool_vars) {
+		return ub;
+	}
+
+	int i;
 	for (i = 0; i < PyList_Size(spool_vars); i++) {
 		zero = PyList_GetItem(spool_vars, i);
-		if (zero) {
-			if (PyTuple_Check(zero)) {
-				key = PyTuple_GetItem(zero, 0);
-				val = PyTuple_GetItem(zero, 1);
-
-				if (PyString_Check(key)) {
-
-					keysize = PyString_Size(key);
-		
-					if (PyString_Check(val)) {
-						valsize = PyString_Size(val);
-						if (uwsgi_buffer_append_keyval(ub, PyString_AsString(key), keysize, PyString_AsString(val), valsize)) {
-							uwsgi_buffer_destroy(ub);
-							goto error;
-						}
-					}
-					else {
+		if (!zero || !PyTuple_Check(zero)) goto error;
+		key = PyTuple_GetItem(zero, 0);
+		val = PyTuple_GetItem(zero, 1);
+
+		if (!PyString_Check(key)) goto error;
+		keysize = PyString_Size(key);
+
+		if (*pybody && val == *pybody && !uwsgi_strncmp(PyString_AsString(key), keysize, "body", 4)) continue;
+
+		if (PyString_Check(val)) {
+			valsize = PyString_Size(val);
+			if (uwsgi_buffer_append_keyval(ub, PyString_AsString(key), keysize, PyString_AsString(val), valsize)) goto error;
+		}
+		else {
 #ifdef PYTHREE
-						PyObject *str = PyObject_Bytes(val);
+			PyObject *str = PyObject_Bytes(val);
 #else
-						PyObject *str = PyObject_Str(val);
+			PyObject *str = PyObject_Str(val);
 #endif
-						if (!str) {
-							uwsgi_buffer_destroy(ub);
-							goto error;
-						}
-						if (uwsgi_buffer_append_keyval(ub, PyString_AsString(key), keysize, PyString_AsString(str), PyString_Size(str))) {
-							Py_DECREF(str);
-							uwsgi_buffer_destroy(ub);
-							goto error;
-						}
-						Py_DECREF(str);
-					}
-				}
-				else {
-					uwsgi_buffer_destroy(ub);
-                                        goto error;
-				}
-			}
-			else {
-				uwsgi_buffer_destroy(ub);
-                                goto error;
+			if (!str) goto error;
+			if (uwsgi_buffer_append_keyval(ub, PyString_AsString(key), keysize, PyString_AsString(str), PyString_Size(str))) {
+				Py_DECREF(str);
+				goto error;
 			}
+			Py_DECREF(str);
 		}
-		else {
-			uwsgi_buffer_destroy(ub);
-                        goto error;
+	}
+
+	Py_DECREF(spool_vars);
+	return ub;
+
+error:
+	Py_DECREF(spool_vars);
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+PyObject *py_uwsgi_send_spool(PyObject * self, PyObject * args, PyObject *kw) {
+	PyObject *spool_dict, *pybody;
+	char *body = NULL;
+	size_t body_len= 0;
+
+	spool_dict = PyTuple_GetItem(args, 0);
+
+	if (spool_dict) {
+		if (!PyDict_Check(spool_dict)) {
+			return PyErr_Format(PyExc_ValueError, "The argument of spooler callable must be a dictionary");
 		}
 	}
+	else {
+		// clear the error
+		PyErr_Clear();
+		spool_dict = kw;
+	}
 
+	if (!spool_dict) {
+		return PyErr_Format(PyExc_ValueError, "The argument of spooler callable must be a dictionary");
+	}
+
+	struct uwsgi_buffer *ub = py_uwsgi_spool_buffer(spool_dict, &pybody);
+	if (!ub) goto error;
+
+	if (pybody) {
+		body = PyString_AsString(pybody);
+		body_len = PyString_Size(pybody);
+		Py_INCREF(pybody);
+	}
 
 	UWSGI_RELEASE_GIL
 
@@ -2245,14 +2748,9 @@ PyObject *py_uwsgi_send_spool(PyObject * self, PyObject * args, PyObject *kw) {
 
 	UWSGI_GET_GIL
 
-
 	if (pybody) {
-		if (PyString_Check(pybody)) {
-			Py_DECREF(pybody);
-		}
+		Py_DECREF(pybody);
 	}
-	
-	Py_DECREF(spool_vars);
 
 	if (filename) {
 		PyObject *ret = PyString_FromString(filename);
@@ -2268,6 +2766,90 @@ error:
 #endif
 }
 
+/*
+	uwsgi.spool_remote(addr, tasks)
+
+	pipeline a list of spooler dictionaries to a remote spooler stream,
+	returns a list of booleans (True for the acknowledged tasks)
+*/
+PyObject *py_uwsgi_spool_remote(PyObject * self, PyObject * args) {
+	char *addr = NULL;
+	PyObject *tasks;
+
+	if (!PyArg_ParseTuple(args, "sO:spool_remote", &addr, &tasks)) {
+		return NULL;
+	}
+
+	PyObject *list = PySequence_Fast(tasks, "spool_remote() requires a list of dictionaries");
+	if (!list) return NULL;
+
+	int i, n = PySequence_Fast_GET_SIZE(list);
+	struct uwsgi_buffer **ubs = uwsgi_calloc(sizeof(struct uwsgi_buffer *) * (n + 1));
+	PyObject **pybodies = uwsgi_calloc(sizeof(PyObject *) * (n + 1));
+	char **bufs = uwsgi_calloc(sizeof(char *) * (n + 1));
+	size_t *lens = uwsgi_calloc(sizeof(size_t) * (n + 1));
+	char **bodies = uwsgi_calloc(sizeof(char *) * (n + 1));
+	size_t *body_lens = uwsgi_calloc(sizeof(size_t) * (n + 1));
+	char *results = uwsgi_calloc(n + 1);
+	PyObject *ret = NULL;
+	int rc = 0;
+
+	for (i = 0; i < n; i++) {
+		PyObject *spool_dict = PySequence_Fast_GET_ITEM(list, i);
+		if (!PyDict_Check(spool_dict)) {
+			PyErr_Format(PyExc_ValueError, "spool_remote() requires a list of dictionaries");
+			goto end;
+		}
+		ubs[i] = py_uwsgi_spool_buffer(spool_dict, &pybodies[i]);
+		if (!ubs[i]) {
+#ifdef PYTHREE
+			PyErr_Format(PyExc_ValueError, "spooler callable dictionary must contains only bytes");
+#else
+			PyErr_Format(PyExc_ValueError, "spooler callable dictionary must contains only strings");
+#endif
+			goto end;
+		}
+		bufs[i] = ubs[i]->buf;
+		lens[i] = ubs[i]->pos;
+		if (pybodies[i]) {
+			Py_INCREF(pybodies[i]);
+			bodies[i] = PyString_AsString(pybodies[i]);
+			body_lens[i] = PyString_Size(pybodies[i]);
+		}
+	}
+
+	UWSGI_RELEASE_GIL
+	rc = uwsgi_spool_remote(addr, n, bufs, lens, bodies, body_lens, results);
+	UWSGI_GET_GIL
+
+	if (rc < 0 && n > 0 && !results[0]) {
+		PyErr_Format(PyExc_IOError, "unable to spool tasks to %s", addr);
+		goto end;
+	}
+
+	ret = PyList_New(n);
+	for (i = 0; i < n; i++) {
+		PyObject *b = results[i] ? Py_True : Py_False;
+		Py_INCREF(b);
+		PyList_SET_ITEM(ret, i, b);
+	}
+
+end:
+	for (i = 0; i < n; i++) {
+		if (ubs[i]) uwsgi_buffer_destroy(ubs[i]);
+		if (pybodies[i] && bodies[i]) Py_DECREF(pybodies[i]);
+	}
+	free(ubs);
+	free(pybodies);
+	free(bufs);
+	free(lens);
+	free(bodies);
+	free(body_lens);
+	free(results);
+	Py_DECREF(list);
+	return ret;
+}
+
 PyObject *py_uwsgi_spooler_pid(PyObject * self, PyObject * args) {
 	struct uwsgi_spooler *uspool = uwsgi.spoolers;
 	if (!uwsgi.spoolers) return PyInt_FromLong(0);
@@ -2650,6 +3232,16 @@ PyObject *py_uwsgi_accepting(PyObject * self, PyObject * args) {
 	return Py_None;
 }
 
+PyObject *py_uwsgi_worker_ready(PyObject * self, PyObject * args) {
+	int ready = 1;
+	if (!PyArg_ParseTuple(args, "|i", &ready)) {
+		return NULL;
+	}
+	uwsgi.workers[uwsgi.mywid].ready = !!ready;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
 PyObject *py_uwsgi_parse_file(PyObject * self, PyObject * args) {
 
 	char *filename;
@@ -2801,6 +3393,7 @@ static PyMethodDef uwsgi_advanced_methods[] = {
 	{"worker_id", py_uwsgi_worker_id, METH_VARARGS, ""},
 	{"mule_id", py_uwsgi_mule_id, METH_VARARGS, ""},
 	{"mule_msg_recv_size", py_uwsgi_mule_msg_recv_size, METH_VARARGS, ""},
+	{"spool_remote", py_uwsgi_spool_remote, METH_VARARGS, ""},
 	{"log", py_uwsgi_log, METH_VARARGS, ""},
 	{"log_this_request", py_uwsgi_log_this, METH_VARARGS, ""},
 	{"set_logvar", py_uwsgi_set_logvar, METH_VARARGS, ""},
@@ -2812,6 +3405,7 @@ static PyMethodDef uwsgi_advanced_methods[] = {
 	{"unlock", py_uwsgi_unlock, METH_VARARGS, ""},
 	{"cl", py_uwsgi_cl, METH_VARARGS, ""},
 	{"accepting", py_uwsgi_accepting, METH_VARARGS, ""},
+	{"worker_ready", py_uwsgi_worker_ready, METH_VARARGS, ""},
 
 	{"setprocname", py_uwsgi_setprocname, METH_VARARGS, ""},
 
@@ -2826,6 +3420,7 @@ static PyMethodDef uwsgi_advanced_methods[] = {
 	{"add_timer", py_uwsgi_add_timer, METH_VARARGS, ""},
 	{"add_ms_timer", py_uwsgi_add_ms_timer, METH_VARARGS, ""},
 	{"add_rb_timer", py_uwsgi_add_rb_timer, METH_VARARGS, ""},
+	{"add_ms_rb_timer", py_uwsgi_add_ms_rb_timer, METH_VARARGS, ""},
 	{"add_cron", py_uwsgi_add_cron, METH_VARARGS, ""},
 
 #ifdef UWSGI_ROUTING
@@ -2834,6 +3429,7 @@ static PyMethodDef uwsgi_advanced_methods[] = {
 
 	{"register_rpc", py_uwsgi_register_rpc, METH_VARARGS, ""},
 	{"rpc", py_uwsgi_rpc, METH_VARARGS, ""},
+	{"rpc_multi", (PyCFunction)(void *)py_uwsgi_rpc_multi, METH_VARARGS|METH_KEYWORDS, ""},
 	{"rpc_list", py_uwsgi_rpc_list, METH_VARARGS, ""},
 	{"call", py_uwsgi_call, METH_VARARGS, ""},
 	{"sendfile", py_uwsgi_advanced_sendfile, METH_VARARGS, ""},
@@ -2883,6 +3479,7 @@ static PyMethodDef uwsgi_advanced_methods[] = {
 	{"websocket_recv_nb", (PyCFunction)(void *)py_uwsgi_websocket_recv_nb, METH_VARARGS|METH_KEYWORDS, ""},
 	{"websocket_send", (PyCFunction)(void *)py_uwsgi_websocket_send, METH_VARARGS|METH_KEYWORDS, ""},
 	{"websocket_send_binary", (PyCFunction)(void *)py_uwsgi_websocket_send_binary, METH_VARARGS|METH_KEYWORDS, ""},
+	{"websocket_publish", (PyCFunction)(void *)py_uwsgi_websocket_publish, METH_VARARGS|METH_KEYWORDS, ""},
 	{"websocket_handshake", py_uwsgi_websocket_handshake, METH_VARARGS, ""},
 
 	{"chunked_read", py_uwsgi_chunked_read, METH_VARARGS, ""},
@@ -2924,6 +3521,15 @@ static PyMethodDef uwsgi_sa_methods[] = {
 	{"sharedarea_rlock", py_uwsgi_sharedarea_rlock, METH_VARARGS, ""},
 	{"sharedarea_wlock", py_uwsgi_sharedarea_wlock, METH_VARARGS, ""},
 	{"sharedarea_unlock", py_uwsgi_sharedarea_unlock, METH_VARARGS, ""},
+	{"sharedarea_atomic_add", py_uwsgi_sharedarea_atomic_add, METH_VARARGS, ""},
+	{"sharedarea_atomic_add_bulk", py_uwsgi_sharedarea_atomic_add_bulk, METH_VARARGS, ""},
+	{"sharedarea_atomic_cas", py_uwsgi_sharedarea_atomic_cas, METH_VARARGS, ""},
+	{"sharedarea_atomic_xchg", py_uwsgi_sharedarea_atomic_xchg, METH_VARARGS, ""},
+	{"sharedarea_atomic_load", py_uwsgi_sharedarea_atomic_load, METH_VARARGS, ""},
+	{"sharedarea_hashmap_add", py_uwsgi_sharedarea_hashmap_add, METH_VARARGS, ""},
+	{"sharedarea_hashmap_set", py_uwsgi_sharedarea_hashmap_set, METH_VARARGS, ""},
+	{"sharedarea_hashmap_get", py_uwsgi_sharedarea_hashmap_get, METH_VARARGS, ""},
+	{"sharedarea_hashmap_cas", py_uwsgi_sharedarea_hashmap_cas, METH_VARARGS, ""},
 #if defined(PYTHREE) || defined(Py_TPFLAGS_HAVE_NEWBUFFER)
 #ifndef HAS_NOT_PyMemoryView_FromBuffer
 	{"sharedarea_memoryview", py_uwsgi_sharedarea_memoryview, METH_VARARGS, ""},
@@ -3006,6 +3612,68 @@ PyObject *py_uwsgi_cache_set(PyObject * self, PyObject * args) {
 
 }
 
+PyObject *py_uwsgi_cache_set_many(PyObject * self, PyObject * args) {
+
+	PyObject *items;
+	char *remote = NULL;
+	uint64_t expires = 0;
+
+	if (!PyArg_ParseTuple(args, "O!|ls:cache_set_many", &PyDict_Type, &items, &expires, &remote)) {
+		return NULL;
+	}
+
+	// the copy keeps the keys and the values alive (and unchanged) while the GIL is released
+	items = PyDict_Copy(items);
+	if (!items) return NULL;
+
+	Py_ssize_t pos = 0, i = 0, n = PyDict_Size(items);
+	char **keys = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint16_t *keylens = uwsgi_malloc(sizeof(uint16_t) * (n + 1));
+	char **values = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint64_t *vallens = uwsgi_malloc(sizeof(uint64_t) * (n + 1));
+
+	PyObject *key_obj, *value_obj;
+	while (PyDict_Next(items, &pos, &key_obj, &value_obj)) {
+		Py_ssize_t keylen = 0, vallen = 0;
+		if (!PyArg_Parse(key_obj, "s#", &keys[i], &keylen) || !PyArg_Parse(value_obj, "s#", &values[i], &vallen)) {
+			goto error;
+		}
+		if (keylen > 0xffff) {
+			PyErr_Format(PyExc_ValueError, "cache_set_many() key too long");
+			goto error;
+		}
+		keylens[i] = keylen;
+		vallens[i] = vallen;
+		i++;
+	}
+
+	UWSGI_RELEASE_GIL
+	uint64_t failed = uwsgi_cache_magic_mset(keys, keylens, values, vallens, i, expires, 0, remote);
+	UWSGI_GET_GIL
+
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+	Py_DECREF(items);
+
+	if (failed) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	Py_INCREF(Py_True);
+	return Py_True;
+
+error:
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+	Py_DECREF(items);
+	return NULL;
+}
+
 PyObject *py_uwsgi_cache_update(PyObject * self, PyObject * args) {
 
 	char *key;
@@ -3161,7 +3829,7 @@ PyObject *py_uwsgi_queue_push(PyObject * self, PyObject * args) {
 
 	Py_ssize_t msglen = 0;
 	char *message ;
-	PyObject *res;
+	int ret;
 
 	if (!PyArg_ParseTuple(args, "s#:queue_push", &message, &msglen)) {
                 return NULL;
@@ -3169,20 +3837,12 @@ PyObject *py_uwsgi_queue_push(PyObject * self, PyObject * args) {
 	
 	if (uwsgi.queue_size) {
 		UWSGI_RELEASE_GIL
-                uwsgi_wlock(uwsgi.queue_lock);
-                if (uwsgi_queue_push(message, msglen)) {
-                	uwsgi_rwunlock(uwsgi.queue_lock);
-			UWSGI_GET_GIL
+		ret = uwsgi_queue_push_message(message, msglen);
+		UWSGI_GET_GIL
+		if (ret) {
 			Py_INCREF(Py_True);
-                        res = Py_True;
-                }
-                else {
-                	uwsgi_rwunlock(uwsgi.queue_lock);
-			UWSGI_GET_GIL
-                        Py_INCREF(Py_None);
-                        res = Py_None;
-                }
-                return res;
+			return Py_True;
+		}
         }
 
         Py_INCREF(Py_None);
@@ -3238,30 +3898,25 @@ PyObject *py_uwsgi_queue_pull_slot(PyObject * self, PyObject * args) {
 
 PyObject *py_uwsgi_queue_pull(PyObject * self, PyObject * args) {
 
-	char *message;
-	uint64_t size;
+	uint64_t size = 0;
 	PyObject *res;
 	char *storage;
+	int timeout = 0;
+
+	if (!PyArg_ParseTuple(args, "|i:queue_pull", &timeout)) {
+		return NULL;
+	}
 
 	if (uwsgi.queue_size) {
 		UWSGI_RELEASE_GIL
-		uwsgi_wlock(uwsgi.queue_lock);
-
-		message = uwsgi_queue_pull(&size);
-
-                if (!message || size == 0) {
-                	uwsgi_rwunlock(uwsgi.queue_lock);
-			UWSGI_GET_GIL
-                        Py_INCREF(Py_None);
-                        return Py_None;
-                }
-
-                storage = uwsgi_malloc(size);
-		memcpy(storage, message, size);
-
-                uwsgi_rwunlock(uwsgi.queue_lock);
+		storage = uwsgi_queue_pull_message(&size, timeout);
 		UWSGI_GET_GIL
 
+		if (!storage) {
+			Py_INCREF(Py_None);
+			return Py_None;
+		}
+
 		res = PyString_FromStringAndSize(storage, size);
 		free(storage);
                 return res;
@@ -3274,30 +3929,25 @@ PyObject *py_uwsgi_queue_pull(PyObject * self, PyObject * args) {
 
 PyObject *py_uwsgi_queue_pop(PyObject * self, PyObject * args) {
 
-        char *message;
-        uint64_t size;
+        uint64_t size = 0;
         PyObject *res;
 	char *storage;
+	int timeout = 0;
 
-        if (uwsgi.queue_size) {
+	if (!PyArg_ParseTuple(args, "|i:queue_pop", &timeout)) {
+		return NULL;
+	}
 
+        if (uwsgi.queue_size) {
 		UWSGI_RELEASE_GIL
-                uwsgi_wlock(uwsgi.queue_lock);
+		storage = uwsgi_queue_pop_message(&size, timeout);
+		UWSGI_GET_GIL
 
-                message = uwsgi_queue_pop(&size);
-		if (!message || size == 0) {
-                	uwsgi_rwunlock(uwsgi.queue_lock);
-			UWSGI_GET_GIL
+		if (!storage) {
                         Py_INCREF(Py_None);
 			return Py_None;
 		}
 
-		storage = uwsgi_malloc(size);
-                memcpy(storage, message, size);
-
-                uwsgi_rwunlock(uwsgi.queue_lock);
-		UWSGI_GET_GIL
-
 		res = PyString_FromStringAndSize(storage, size);
 		free(storage);
                 return res;
@@ -3474,6 +4124,66 @@ PyObject *py_uwsgi_cache_get(PyObject * self, PyObject * args) {
 
 }
 
+PyObject *py_uwsgi_cache_get_many(PyObject * self, PyObject * args) {
+
+	PyObject *keys_obj;
+	char *cache = NULL;
+
+	if (!PyArg_ParseTuple(args, "O|s:cache_get_many", &keys_obj, &cache)) {
+		return NULL;
+	}
+
+	// a tuple keeps the keys alive (a list could be changed by another thread while the GIL is released)
+	PyObject *keys_seq = PySequence_Tuple(keys_obj);
+	if (!keys_seq) return NULL;
+
+	Py_ssize_t i, n = PyTuple_GET_SIZE(keys_seq);
+	char **keys = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint16_t *keylens = uwsgi_malloc(sizeof(uint16_t) * (n + 1));
+	char **values = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint64_t *vallens = uwsgi_malloc(sizeof(uint64_t) * (n + 1));
+
+	for (i = 0; i < n; i++) {
+		Py_ssize_t keylen = 0;
+		if (!PyArg_Parse(PyTuple_GET_ITEM(keys_seq, i), "s#", &keys[i], &keylen)) {
+			goto error;
+		}
+		if (keylen > 0xffff) {
+			PyErr_Format(PyExc_ValueError, "cache_get_many() key too long");
+			goto error;
+		}
+		keylens[i] = keylen;
+	}
+
+	UWSGI_RELEASE_GIL
+	uwsgi_cache_magic_mget(keys, keylens, values, vallens, n, cache);
+	UWSGI_GET_GIL
+
+	PyObject *ret = PyDict_New();
+	for (i = 0; i < n; i++) {
+		if (!values[i]) continue;
+		PyObject *value = PyString_FromStringAndSize(values[i], vallens[i]);
+		PyDict_SetItem(ret, PyTuple_GET_ITEM(keys_seq, i), value);
+		Py_DECREF(value);
+		free(values[i]);
+	}
+
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+	Py_DECREF(keys_seq);
+	return ret;
+
+error:
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+	Py_DECREF(keys_seq);
+	return NULL;
+}
+
 PyObject *py_uwsgi_cache_num(PyObject * self, PyObject * args) {
 
         char *key;
@@ -3484,20 +4194,143 @@ PyObject *py_uwsgi_cache_num(PyObject * self, PyObject * args) {
                 return NULL;
         }
 
-        uint64_t vallen = 0;
+	int64_t num = 0;
         UWSGI_RELEASE_GIL
-        char *value = uwsgi_cache_magic_get(key, keylen, &vallen, NULL, cache);
+        int ret = uwsgi_cache_magic_num(key, keylen, &num, cache);
         UWSGI_GET_GIL
-        if (value && vallen == 8) {
-		int64_t *num = (int64_t *) value;
-                PyObject *ret = PyLong_FromLong(*num);
-                free(value);
-                return ret;
+        if (ret) num = 0;
+
+        return PyLong_FromLongLong(num);
+
+}
+
+// store a number usable by cache_num() and the math operations (no serialization needed)
+PyObject *py_uwsgi_cache_set_num(PyObject * self, PyObject * args) {
+
+        char *key;
+        Py_ssize_t keylen = 0;
+        long long num = 0;
+        uint64_t expires = 0;
+        char *cache = NULL;
+
+        if (!PyArg_ParseTuple(args, "s#L|ls:cache_set_num", &key, &keylen, &num, &expires, &cache)) {
+                return NULL;
+        }
+
+	int64_t value = num;
+        UWSGI_RELEASE_GIL
+        if (uwsgi_cache_magic_set(key, keylen, (char *) &value, 8, expires, UWSGI_CACHE_FLAG_UPDATE, cache)) {
+                UWSGI_GET_GIL
+                Py_INCREF(Py_None);
+                return Py_None;
         }
+        UWSGI_GET_GIL
+
+        Py_INCREF(Py_True);
+        return Py_True;
+
+}
+
+#ifdef PYTHREE
+/*
+	cache_view() returns a read-only memoryview of a cache value.
+
+	For local bitmap caches the memoryview maps the shared memory of the value (no copies): the value
+	is pinned (its blocks are not reused even if the item is updated or removed) until the memoryview
+	is released, so release it (memoryview.release() or a with block) as soon as possible,
+	the pins of a cache are limited. For the other caches (or when all of the pins are in use)
+	the memoryview maps a private copy of the value.
+*/
+typedef struct {
+	PyObject_HEAD
+	struct uwsgi_cache *uc;
+	uint64_t pin;
+	char *value;
+	uint64_t len;
+	char *copy;
+} uwsgi_CacheValue;
+
+static void uwsgi_CacheValue_free(uwsgi_CacheValue *self) {
+	if (self->copy) {
+		free(self->copy);
+	}
+	else if (self->uc) {
+		uwsgi_cache_unpin(self->uc, self->pin);
+	}
+	PyObject_Del(self);
+}
+
+static int uwsgi_CacheValue_getbuffer(uwsgi_CacheValue *self, Py_buffer *view, int flags) {
+	return PyBuffer_FillInfo(view, (PyObject *) self, self->value, self->len, 1, flags);
+}
+
+static PyBufferProcs uwsgi_CacheValue_as_buffer = {
+	(getbufferproc) uwsgi_CacheValue_getbuffer,
+	NULL,
+};
+
+PyTypeObject uwsgi_CacheValueType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "uwsgi.CacheValue",
+	.tp_basicsize = sizeof(uwsgi_CacheValue),
+	.tp_dealloc = (destructor) uwsgi_CacheValue_free,
+	.tp_as_buffer = &uwsgi_CacheValue_as_buffer,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "uwsgi cache value",
+};
+
+PyObject *py_uwsgi_cache_view(PyObject * self, PyObject * args) {
+
+	char *key;
+	Py_ssize_t keylen = 0;
+	char *cache = NULL;
+
+	if (!PyArg_ParseTuple(args, "s#|s:cache_view", &key, &keylen, &cache)) {
+		return NULL;
+	}
+
+	char *value = NULL;
+	uint64_t vallen = 0;
+	uint64_t pin = 0;
+	char *copy = NULL;
+	int ret = -1;
+
+	UWSGI_RELEASE_GIL
+	struct uwsgi_cache *uc = uwsgi_cache_pinnable(cache, key, keylen);
+	if (uc) {
+		ret = uwsgi_cache_pin(uc, key, keylen, &value, &vallen, NULL, &pin);
+	}
+	// not pinnable or no more pins available
+	if (!uc || ret == -2) {
+		uc = NULL;
+		copy = uwsgi_cache_magic_get(key, keylen, &vallen, NULL, cache);
+		value = copy;
+	}
+	UWSGI_GET_GIL
 
-        return PyLong_FromLong(0);
+	if (!value) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	uwsgi_CacheValue *cv = PyObject_New(uwsgi_CacheValue, &uwsgi_CacheValueType);
+	if (!cv) {
+		if (copy) free(copy);
+		else uwsgi_cache_unpin(uc, pin);
+		return NULL;
+	}
+	cv->uc = uc;
+	cv->pin = pin;
+	cv->value = value;
+	cv->len = vallen;
+	cv->copy = copy;
 
+	// the memoryview keeps the only reference to the value
+	PyObject *mv = PyMemoryView_FromObject((PyObject *) cv);
+	Py_DECREF(cv);
+	return mv;
 }
+#endif
 
 PyObject *py_uwsgi_cache_keys(PyObject * self, PyObject * args) {
 	char *cache = NULL;
@@ -3515,7 +4348,7 @@ PyObject *py_uwsgi_cache_keys(PyObject * self, PyObject * args) {
 
 	PyObject *l = PyList_New(0);
 
-	uwsgi_rlock(uc->lock);
+	uwsgi_cache_rlock(uc);
         for(;;) {
                 uci = uwsgi_cache_keys(uc, &pos, &uci);
                 if (!uci) break;
@@ -3523,7 +4356,7 @@ PyObject *py_uwsgi_cache_keys(PyObject * self, PyObject * args) {
 		PyList_Append(l, ci);
 		Py_DECREF(ci);
         }
-	uwsgi_rwunlock(uc->lock);
+	uwsgi_cache_rwunlock(uc);
 	return l;
 }
 
@@ -3531,6 +4364,8 @@ PyObject *py_uwsgi_cache_keys(PyObject * self, PyObject * args) {
 static PyMethodDef uwsgi_cache_methods[] = {
 	{"cache_get", py_uwsgi_cache_get, METH_VARARGS, ""},
 	{"cache_set", py_uwsgi_cache_set, METH_VARARGS, ""},
+	{"cache_get_many", py_uwsgi_cache_get_many, METH_VARARGS, ""},
+	{"cache_set_many", py_uwsgi_cache_set_many, METH_VARARGS, ""},
 	{"cache_update", py_uwsgi_cache_update, METH_VARARGS, ""},
 	{"cache_del", py_uwsgi_cache_del, METH_VARARGS, ""},
 	{"cache_exists", py_uwsgi_cache_exists, METH_VARARGS, ""},
@@ -3540,6 +4375,10 @@ static PyMethodDef uwsgi_cache_methods[] = {
 	{"cache_mul", py_uwsgi_cache_mul, METH_VARARGS, ""},
 	{"cache_div", py_uwsgi_cache_div, METH_VARARGS, ""},
 	{"cache_num", py_uwsgi_cache_num, METH_VARARGS, ""},
+	{"cache_set_num", py_uwsgi_cache_set_num, METH_VARARGS, ""},
+#ifdef PYTHREE
+	{"cache_view", py_uwsgi_cache_view, METH_VARARGS, ""},
+#endif
 	{"cache_keys", py_uwsgi_cache_keys, METH_VARARGS, ""},
 	{NULL, NULL},
 };
@@ -3685,6 +4524,22 @@ PyObject *py_uwsgi_metric_set_min(PyObject * self, PyObject * args) {
 
 }
 
+PyObject *py_uwsgi_metric_observe(PyObject * self, PyObject * args) {
+        char *key;
+        int64_t value = 0;
+        if (!PyArg_ParseTuple(args, "sl:metric_observe", &key, &value)) return NULL;
+
+        UWSGI_RELEASE_GIL
+        if (uwsgi_metric_observe(key, NULL, value)) {
+                UWSGI_GET_GIL
+                Py_INCREF(Py_None);
+                return Py_None;
+        }
+        UWSGI_GET_GIL
+        Py_INCREF(Py_True);
+        return Py_True;
+
+}
 
 static PyMethodDef uwsgi_metrics_methods[] = {
 	{"metric_inc", py_uwsgi_metric_inc, METH_VARARGS, ""},
@@ -3695,6 +4550,7 @@ static PyMethodDef uwsgi_metrics_methods[] = {
 	{"metric_set", py_uwsgi_metric_set, METH_VARARGS, ""},
 	{"metric_set_max", py_uwsgi_metric_set_max, METH_VARARGS, ""},
 	{"metric_set_min", py_uwsgi_metric_set_min, METH_VARARGS, ""},
+	{"metric_observe", py_uwsgi_metric_observe, METH_VARARGS, ""},
 	{NULL, NULL},
 };
 
@@ -3760,6 +4616,13 @@ void init_uwsgi_module_cache(PyObject * current_uwsgi_module) {
 		PyDict_SetItemString(uwsgi_module_dict, uwsgi_function->ml_name, func);
 		Py_DECREF(func);
 	}
+
+#ifdef PYTHREE
+	if (PyType_Ready(&uwsgi_CacheValueType) < 0) {
+		uwsgi_log("uwsgi.CacheValue not ready\n");
+		exit(1);
+	}
+#endif
 }
 
 void init_uwsgi_module_queue(PyObject * current_uwsgi_module) {
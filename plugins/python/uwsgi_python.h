@@ -48,6 +48,19 @@
 #define UWSGI_SHOULD_CALL_PYEVAL_INITTHREADS
 #endif
 
+#if (PY_VERSION_HEX >= 0x030b0000)
+#define UWSGI_PY311
+#endif
+
+#if (PY_VERSION_HEX >= 0x030c0000)
+#define UWSGI_PY312
+#endif
+
+// per-interpreter GIL (PEP 684)
+#ifdef UWSGI_PY312
+#define UWSGI_PYTHON_CORE_INTERPRETERS
+#endif
+
 #if (PY_VERSION_HEX < 0x03090000)
 #ifndef Py_SET_SIZE
 #define Py_SET_SIZE(o, size) ((o)->ob_size = (size))
@@ -109,9 +122,39 @@ PyAPI_FUNC(PyObject *) PyMarshal_ReadObjectFromString(char *, Py_ssize_t);
 
 #define LOADER_MAX              9
 
+// the chunks of a WSGI iterable waiting for a single writev() (--wsgi-write-batch)
+#define UWSGI_PYTHON_WRITE_BATCH_IOVEC 64
+struct uwsgi_python_write_batch {
+	PyObject *chunks[UWSGI_PYTHON_WRITE_BATCH_IOVEC];
+	struct iovec iov[UWSGI_PYTHON_WRITE_BATCH_IOVEC];
+	size_t cnt;
+	size_t len;
+};
+
+// how an app has been loaded, core interpreters (--py-core-interpreters) load it again
+struct uwsgi_python_app_loader {
+	int loader;
+	char *arg;
+	int app_type;
+};
+
+// the sub interpreter (with its own GIL) of a core (--py-core-interpreters) and its copy of the apps
+struct uwsgi_python_core_interpreter {
+	PyThreadState *ts;
+	// a thread state of the main interpreter, for calling the hooks registered there
+	PyThreadState *main_ts;
+	PyObject *spitout;
+	PyObject *writeout;
+	int apps_cnt;
+	struct uwsgi_app *apps;
+};
+
 typedef struct uwsgi_Input {
         PyObject_HEAD
         struct wsgi_request *wsgi_req;
+        // the mmap()ed post_file exported by the buffer protocol (owned by the object, so it survives the views)
+        char *body_map;
+        size_t body_map_len;
 } uwsgi_Input;
 
 
@@ -177,11 +220,24 @@ struct uwsgi_python {
 
 	char *callable;
 
+#ifdef UWSGI_PY311
+	// python 3.11 does not expose the frame objects of the thread state anymore
+	int *current_recursion_remaining;
+	_PyCFrame **current_frame;
+
+	int current_main_recursion_remaining;
+	_PyCFrame *current_main_frame;
+#ifdef UWSGI_PY312
+	int *current_c_recursion_remaining;
+	int current_main_c_recursion_remaining;
+#endif
+#else
 	int *current_recursion_depth;
 	struct _frame **current_frame;
 
 	int current_main_recursion_depth;
 	struct _frame *current_main_frame;
+#endif
 
 	void (*swap_ts)(struct wsgi_request *, struct uwsgi_app *);
 	void (*reset_ts)(struct wsgi_request *, struct uwsgi_app *);
@@ -193,6 +249,8 @@ struct uwsgi_python {
 	void (*gil_release) (void);
 	int auto_reload;
 	char *tracebacker;
+	int sampler;
+	char *sampler_socket;
 	struct uwsgi_string_list *auto_reload_ignore;
 
 	PyObject *workers_tuple;
@@ -219,6 +277,8 @@ struct uwsgi_python {
 	char *programname;
 	int wsgi_strict;
 	int wsgi_accept_buffer;
+	uint64_t wsgi_write_batch;
+	struct uwsgi_python_write_batch *write_batch;
 
 	char *raw;
 	PyObject *raw_callable;
@@ -226,6 +286,7 @@ struct uwsgi_python {
 	struct uwsgi_string_list *sharedarea;
 
 	int call_osafterfork;
+	int gc_freeze;
 	int pre_initialized;
 
 	// when 1 we have the app-loading lock held
@@ -240,6 +301,10 @@ struct uwsgi_python {
 	int master_check_signals;
 	
 	char *executable;
+
+	int core_interpreters;
+	struct uwsgi_python_core_interpreter *core_interpreter;
+	struct uwsgi_python_app_loader *app_loaders;
 };
 
 
@@ -247,6 +312,13 @@ struct uwsgi_python {
 void init_uwsgi_vars(void);
 void init_uwsgi_embedded_module(void);
 
+void uwsgi_python_core_interpreter_init(int);
+struct uwsgi_python_core_interpreter *uwsgi_python_core_interpreter(struct wsgi_request *);
+struct uwsgi_app *uwsgi_python_get_app(struct wsgi_request *);
+PyThreadState *uwsgi_python_core_main_enter(void);
+void uwsgi_python_core_main_exit(PyThreadState *);
+int uwsgi_python_in_core_interpreter(void);
+
 
 void uwsgi_wsgi_config(char *);
 void uwsgi_paste_config(char *);
@@ -305,6 +377,7 @@ void init_uwsgi_module_advanced(PyObject *);
 void init_uwsgi_module_spooler(PyObject *);
 void init_uwsgi_module_sharedarea(PyObject *);
 void init_uwsgi_module_cache(PyObject *);
+void init_uwsgi_module_pending(PyObject *);
 void init_uwsgi_module_queue(PyObject *);
 void init_uwsgi_module_snmp(PyObject *);
 
@@ -323,10 +396,13 @@ int uwsgi_python_profiler_call(PyObject *, PyFrameObject *, int, PyObject *);
 int uwsgi_python_tracer(PyObject *, PyFrameObject *, int, PyObject *);
 
 void uwsgi_python_reset_random_seed(void);
+long uwsgi_python_gc_call(char *);
+void uwsgi_python_gc_freeze(void);
 
 char *uwsgi_pythonize(char *);
 void *uwsgi_python_autoreloader_thread(void *);
 void *uwsgi_python_tracebacker_thread(void *);
+void *uwsgi_python_sampler_thread(void *);
 
 int uwsgi_python_do_send_headers(struct wsgi_request *);
 void *uwsgi_python_tracebacker_thread(void *);
@@ -339,6 +415,7 @@ struct uwsgi_buffer *uwsgi_python_backtrace(struct wsgi_request *);
 void uwsgi_python_exception_log(struct wsgi_request *);
 
 int uwsgi_python_send_body(struct wsgi_request *, PyObject *);
+int uwsgi_python_write_batch_flush(struct wsgi_request *);
 
 int uwsgi_request_python_raw(struct wsgi_request *);
 
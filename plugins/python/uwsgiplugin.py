@@ -27,6 +27,7 @@ GCC_LIST = [
     'profiler',
     'symimporter',
     'tracebacker',
+    'pending',
     'raw'
 ]
 
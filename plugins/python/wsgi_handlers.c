@@ -47,6 +47,9 @@ PyObject *uwsgi_Input_next(PyObject* self) {
 }
 
 static void uwsgi_Input_free(uwsgi_Input *self) {
+	if (self->body_map) {
+		munmap(self->body_map, self->body_map_len);
+	}
     	PyObject_Del(self);
 }
 
@@ -95,6 +98,62 @@ static PyObject *uwsgi_Input_read(uwsgi_Input *self, PyObject *args) {
 		
 }
 
+// read directly in a caller supplied (writable) buffer, without allocating a new object for every read
+static PyObject *uwsgi_Input_readinto(uwsgi_Input *self, PyObject *args) {
+
+	Py_buffer pbuf;
+
+	if (!PyArg_ParseTuple(args, "w*:readinto", &pbuf)) {
+		return NULL;
+	}
+
+	struct wsgi_request *wsgi_req = self->wsgi_req;
+	char *dst = pbuf.buf;
+	size_t len = pbuf.len;
+	size_t pos = 0;
+	ssize_t rlen = 0;
+	char *buf = NULL;
+
+	if (len == 0) goto done;
+
+	UWSGI_RELEASE_GIL
+	if (wsgi_req->body_is_chunked && up.wsgi_manage_chunked_input) {
+		while (pos < len) {
+			size_t slice_len = 0;
+			buf = uwsgi_chunked_read_slice(wsgi_req, &slice_len, len - pos, uwsgi.socket_timeout, 0);
+			if (!buf || slice_len == 0) break;
+			memcpy(dst + pos, buf, slice_len);
+			pos += slice_len;
+		}
+		UWSGI_GET_GIL
+		if (!buf && !pos) {
+			PyBuffer_Release(&pbuf);
+			return PyErr_Format(PyExc_IOError, "error during chunked readinto(%llu) on wsgi.input", (unsigned long long) len);
+		}
+		goto done;
+	}
+	buf = uwsgi_request_body_read(wsgi_req, len, &rlen);
+	UWSGI_GET_GIL
+
+	if (buf == uwsgi.empty) goto done;
+
+	if (!buf) {
+		PyBuffer_Release(&pbuf);
+		// error ?
+		if (rlen < 0) {
+			return PyErr_Format(PyExc_IOError, "error during readinto(%llu) on wsgi.input", (unsigned long long) len);
+		}
+		// timeout ?
+		return PyErr_Format(PyExc_IOError, "timeout during readinto(%llu) on wsgi.input", (unsigned long long) len);
+	}
+
+	memcpy(dst, buf, rlen);
+	pos = rlen;
+done:
+	PyBuffer_Release(&pbuf);
+	return PyLong_FromSize_t(pos);
+}
+
 static PyObject *uwsgi_Input_readline(uwsgi_Input *self, PyObject *args) {
 
 	long hint = 0;
@@ -193,9 +252,69 @@ static PyObject *uwsgi_Input_tell(uwsgi_Input *self, PyObject *args) {
         return PyLong_FromLong(self->wsgi_req->post_pos);
 }
 
+#ifdef PYTHREE
+/*
+	buffer protocol: the whole (buffered) body is exported read-only without copies,
+	memoryview(wsgi.input) or wsgi.input.getbuffer() can be passed to parsers accepting buffers.
+
+	The body is the post buffering memory of the core or the mmap()ed post_file, the memory of the
+	core is reused by the next request so the data of a view is valid only during the request.
+	The current position of the stream is not changed.
+*/
+static int uwsgi_Input_getbuffer_proc(uwsgi_Input *self, Py_buffer *view, int flags) {
+	struct wsgi_request *wsgi_req = self->wsgi_req;
+	char *body = uwsgi.empty;
+	size_t body_len = 0;
+
+	if (wsgi_req->body_is_chunked || (wsgi_req->post_cl && !uwsgi.post_buffering)) {
+		PyErr_SetString(PyExc_BufferError, "wsgi.input buffer requires a buffered body (--post-buffering)");
+		return -1;
+	}
+
+	if (wsgi_req->post_file) {
+		if (!self->body_map) {
+			int ret;
+			UWSGI_RELEASE_GIL
+			ret = uwsgi_request_body_buffer(wsgi_req);
+			UWSGI_GET_GIL
+			if (ret) {
+				PyErr_SetString(PyExc_IOError, "error buffering the body of wsgi.input");
+				return -1;
+			}
+			char *map = mmap(NULL, wsgi_req->post_cl, PROT_READ, MAP_SHARED, fileno(wsgi_req->post_file), 0);
+			if (map == MAP_FAILED) {
+				PyErr_SetFromErrno(PyExc_IOError);
+				return -1;
+			}
+			self->body_map = map;
+			self->body_map_len = wsgi_req->post_cl;
+		}
+		body = self->body_map;
+		body_len = self->body_map_len;
+	}
+	else if (wsgi_req->post_cl) {
+		body = wsgi_req->post_buffering_buf;
+		body_len = wsgi_req->post_cl;
+	}
+
+	return PyBuffer_FillInfo(view, (PyObject *) self, body, body_len, 1, flags);
+}
+
+static PyBufferProcs uwsgi_Input_as_buffer = {
+	(getbufferproc) uwsgi_Input_getbuffer_proc,
+	NULL,
+};
+
+static PyObject *uwsgi_Input_getbuffer(uwsgi_Input *self, PyObject *args) {
+
+	return PyMemoryView_FromObject((PyObject *) self);
+}
+#endif
+
 
 static PyMethodDef uwsgi_Input_methods[] = {
 	{ "read",      (PyCFunction)uwsgi_Input_read,      METH_VARARGS, 0 },
+	{ "readinto",  (PyCFunction)uwsgi_Input_readinto,  METH_VARARGS, 0 },
 	{ "readline",  (PyCFunction)uwsgi_Input_readline,  METH_VARARGS, 0 },
 	{ "readlines", (PyCFunction)uwsgi_Input_readlines, METH_VARARGS, 0 },
 // add close to allow mod_wsgi compatibility
@@ -203,6 +322,9 @@ static PyMethodDef uwsgi_Input_methods[] = {
 	{ "seek",     (PyCFunction)uwsgi_Input_seek,     METH_VARARGS, 0 },
 	{ "tell",     (PyCFunction)uwsgi_Input_tell,     METH_VARARGS, 0 },
 	{ "fileno",     (PyCFunction)uwsgi_Input_fileno,     METH_VARARGS, 0 },
+#ifdef PYTHREE
+	{ "getbuffer",  (PyCFunction)uwsgi_Input_getbuffer,  METH_NOARGS, 0 },
+#endif
 	{ NULL, NULL}
 };
 
@@ -226,7 +348,11 @@ PyTypeObject uwsgi_InputType = {
         0,                      /*tp_str */
         0,                      /*tp_getattr */
         0,                      /*tp_setattr */
+#ifdef PYTHREE
+        &uwsgi_Input_as_buffer,	/*tp_as_buffer */
+#else
         0,                      /*tp_as_buffer */
+#endif
 #if defined(Py_TPFLAGS_HAVE_ITER)
         Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER,
 #else
@@ -253,6 +379,8 @@ PyObject *py_uwsgi_write(PyObject * self, PyObject * args) {
 
 	data = PyTuple_GetItem(args, 0);
 	if (PyString_Check(data)) {
+		// chunks yielded before have to be sent first
+		if (uwsgi_python_write_batch_flush(wsgi_req)) return NULL;
 		content = PyString_AsString(data);
 		content_len = PyString_Size(data);
 		UWSGI_RELEASE_GIL
@@ -310,7 +438,7 @@ int uwsgi_request_wsgi(struct wsgi_request *wsgi_req) {
 	struct uwsgi_app *wi;
 
 	if (wsgi_req->async_force_again) {
-		wi = &uwsgi_apps[wsgi_req->app_id];
+		wi = uwsgi_python_get_app(wsgi_req);
 		wsgi_req->async_force_again = 0;
 		UWSGI_GET_GIL
 		// get rid of timeout
@@ -389,7 +517,12 @@ int uwsgi_request_wsgi(struct wsgi_request *wsgi_req) {
 		goto clear2;
 	}
 
-	wi = &uwsgi_apps[wsgi_req->app_id];
+	wi = uwsgi_python_get_app(wsgi_req);
+	if (!wi) {
+		uwsgi_500(wsgi_req);
+		uwsgi_log("--- python application %d is not available in the interpreter of core %d ---\n", wsgi_req->app_id, wsgi_req->async_id);
+		goto clear2;
+	}
 
 	up.swap_ts(wsgi_req, wi);
 
@@ -408,6 +541,10 @@ int uwsgi_request_wsgi(struct wsgi_request *wsgi_req) {
 
 	// no fear of race conditions for this counter as it is already protected by the GIL
 	wi->requests++;
+	// ...but the core interpreters do not share it
+	if (wi != &uwsgi_apps[wsgi_req->app_id]) {
+		__sync_add_and_fetch(&uwsgi_apps[wsgi_req->app_id].requests, 1);
+	}
 
 	// create WSGI environ
 	wsgi_req->async_environ = up.wsgi_env_create(wsgi_req, wi);
@@ -461,6 +598,8 @@ void uwsgi_after_request_wsgi(struct wsgi_request *wsgi_req) {
                 		set_harakiri(wsgi_req, 0);
 		}
 		UWSGI_GET_GIL
+		// the hook belongs to the main interpreter
+		PyThreadState *core_ts = uwsgi_python_core_main_enter();
 		PyObject *arh = python_call(up.after_req_hook, up.after_req_hook_args, 0, NULL);
         	if (!arh) {
 			uwsgi_manage_exception(wsgi_req, 0);
@@ -469,6 +608,7 @@ void uwsgi_after_request_wsgi(struct wsgi_request *wsgi_req) {
 			Py_DECREF(arh);
 		}
 		PyErr_Clear();
+		uwsgi_python_core_main_exit(core_ts);
 		UWSGI_RELEASE_GIL
 	}
 
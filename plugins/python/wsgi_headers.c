@@ -194,7 +194,12 @@ PyObject *py_uwsgi_spit(PyObject * self, PyObject * args) {
 	}
 
 end:
-	Py_INCREF(up.wsgi_writeout);
-	return up.wsgi_writeout;
+	;
+	// every core interpreter has its own write()
+	PyObject *writeout = up.wsgi_writeout;
+	struct uwsgi_python_core_interpreter *upci = uwsgi_python_core_interpreter(wsgi_req);
+	if (upci) writeout = upci->writeout;
+	Py_INCREF(writeout);
+	return writeout;
 }
 
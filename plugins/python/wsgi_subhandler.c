@@ -127,6 +127,157 @@ static void uwsgi_python_consume_file_wrapper_read(struct wsgi_request *wsgi_req
         Py_DECREF(read_method);
 }
 
+/*
+	environ keys and values
+
+	the keys are interned once (in the main interpreter only, objects cannot be shared with the
+	other ones): the CGI vars sent by the webservers are looked up in a small hash table (by
+	length and first/last chars) and their values are reused when equal to the previous ones,
+	as most of them (method, protocol, host, accept headers...) rarely change between requests.
+
+	PEP 3333 requires a builtin dict, so rarely used vars cannot be lazily materialized.
+*/
+
+#ifdef PYTHREE
+#define uwsgi_python_env_intern(x) PyUnicode_InternFromString(x)
+#define uwsgi_python_env_decode(x, y) PyUnicode_DecodeLatin1(x, y, NULL)
+#else
+#define uwsgi_python_env_intern(x) PyString_InternFromString(x)
+#define uwsgi_python_env_decode(x, y) PyString_FromStringAndSize(x, y)
+#endif
+
+#define UWSGI_PYTHON_ENV_BUCKETS 64
+#define UWSGI_PYTHON_ENV_VALUE_MAX 128
+
+struct uwsgi_python_env_var {
+	char *name;
+	uint16_t len;
+	PyObject *key;
+	PyObject *value;
+	uint16_t value_len;
+	char value_buf[UWSGI_PYTHON_ENV_VALUE_MAX];
+	struct uwsgi_python_env_var *next;
+};
+
+static char *uwsgi_python_env_cgi_vars[] = {
+	"REQUEST_METHOD", "REQUEST_URI", "PATH_INFO", "QUERY_STRING", "SERVER_PROTOCOL",
+	"SCRIPT_NAME", "SERVER_NAME", "SERVER_PORT", "SERVER_ADDR", "REMOTE_ADDR", "REMOTE_PORT",
+	"REMOTE_USER", "DOCUMENT_ROOT", "REQUEST_SCHEME", "HTTPS", "CONTENT_TYPE", "CONTENT_LENGTH",
+	"UWSGI_SCHEME", "UWSGI_ROUTER",
+	"HTTP_HOST", "HTTP_USER_AGENT", "HTTP_ACCEPT", "HTTP_ACCEPT_LANGUAGE", "HTTP_ACCEPT_ENCODING",
+	"HTTP_CONNECTION", "HTTP_COOKIE", "HTTP_REFERER", "HTTP_CACHE_CONTROL", "HTTP_PRAGMA",
+	"HTTP_UPGRADE_INSECURE_REQUESTS", "HTTP_X_FORWARDED_FOR", "HTTP_X_FORWARDED_PROTO",
+	"HTTP_X_FORWARDED_HOST", "HTTP_X_REAL_IP", "HTTP_X_REQUEST_ID", "HTTP_AUTHORIZATION",
+	"HTTP_IF_MODIFIED_SINCE", "HTTP_IF_NONE_MATCH", "HTTP_ORIGIN", "HTTP_DNT",
+	"HTTP_SEC_FETCH_SITE", "HTTP_SEC_FETCH_MODE", "HTTP_SEC_FETCH_DEST",
+	NULL
+};
+
+enum {
+	UWSGI_PYTHON_ENV_WSGI_INPUT,
+	UWSGI_PYTHON_ENV_WSGI_INPUT_TERMINATED,
+	UWSGI_PYTHON_ENV_WSGI_FILE_WRAPPER,
+	UWSGI_PYTHON_ENV_FDEVENT_READABLE,
+	UWSGI_PYTHON_ENV_FDEVENT_WRITABLE,
+	UWSGI_PYTHON_ENV_FDEVENT_TIMEOUT,
+	UWSGI_PYTHON_ENV_WSGI_VERSION,
+	UWSGI_PYTHON_ENV_WSGI_ERRORS,
+	UWSGI_PYTHON_ENV_WSGI_RUN_ONCE,
+	UWSGI_PYTHON_ENV_WSGI_MULTITHREAD,
+	UWSGI_PYTHON_ENV_WSGI_MULTIPROCESS,
+	UWSGI_PYTHON_ENV_WSGI_URL_SCHEME,
+	UWSGI_PYTHON_ENV_UWSGI_VERSION,
+	UWSGI_PYTHON_ENV_UWSGI_CORE,
+	UWSGI_PYTHON_ENV_UWSGI_NODE,
+	UWSGI_PYTHON_ENV_KEYS
+};
+
+static char *uwsgi_python_env_keys[] = {
+	"wsgi.input",
+	"wsgi.input_terminated",
+	"wsgi.file_wrapper",
+	"x-wsgiorg.fdevent.readable",
+	"x-wsgiorg.fdevent.writable",
+	"x-wsgiorg.fdevent.timeout",
+	"wsgi.version",
+	"wsgi.errors",
+	"wsgi.run_once",
+	"wsgi.multithread",
+	"wsgi.multiprocess",
+	"wsgi.url_scheme",
+	"uwsgi.version",
+	"uwsgi.core",
+	"uwsgi.node",
+};
+
+static struct {
+	int ready;
+	struct uwsgi_python_env_var *buckets[UWSGI_PYTHON_ENV_BUCKETS];
+	PyObject *keys[UWSGI_PYTHON_ENV_KEYS];
+	PyObject *http;
+	PyObject *https;
+} uwsgi_python_env;
+
+static int uwsgi_python_env_hash(char *name, uint16_t len) {
+	return ((len * 31) + ((uint8_t) name[0] * 7) + (uint8_t) name[len - 1]) % UWSGI_PYTHON_ENV_BUCKETS;
+}
+
+static void uwsgi_python_env_init() {
+	char **name = uwsgi_python_env_cgi_vars;
+	while (*name) {
+		struct uwsgi_python_env_var *var = uwsgi_calloc(sizeof(struct uwsgi_python_env_var));
+		var->name = *name;
+		var->len = strlen(*name);
+		var->key = uwsgi_python_env_intern(*name);
+		int bucket = uwsgi_python_env_hash(var->name, var->len);
+		var->next = uwsgi_python_env.buckets[bucket];
+		uwsgi_python_env.buckets[bucket] = var;
+		name++;
+	}
+	int i;
+	for (i = 0; i < UWSGI_PYTHON_ENV_KEYS; i++) {
+		uwsgi_python_env.keys[i] = uwsgi_python_env_intern(uwsgi_python_env_keys[i]);
+	}
+	uwsgi_python_env.http = uwsgi_python_env_intern("http");
+	uwsgi_python_env.https = uwsgi_python_env_intern("https");
+	uwsgi_python_env.ready = 1;
+}
+
+static struct uwsgi_python_env_var *uwsgi_python_env_var(char *name, uint16_t len) {
+	if (!len) return NULL;
+	struct uwsgi_python_env_var *var = uwsgi_python_env.buckets[uwsgi_python_env_hash(name, len)];
+	while (var) {
+		if (var->len == len && !memcmp(var->name, name, len)) return var;
+		var = var->next;
+	}
+	return NULL;
+}
+
+static PyObject *uwsgi_python_env_value(struct uwsgi_python_env_var *var, char *buf, uint16_t len) {
+	if (var && var->value && var->value_len == len && !memcmp(var->value_buf, buf, len)) {
+		Py_INCREF(var->value);
+		return var->value;
+	}
+	PyObject *value = uwsgi_python_env_decode(buf, len);
+	if (var && value && len <= UWSGI_PYTHON_ENV_VALUE_MAX) {
+		Py_XDECREF(var->value);
+		Py_INCREF(value);
+		var->value = value;
+		var->value_len = len;
+		memcpy(var->value_buf, buf, len);
+	}
+	return value;
+}
+
+static void uwsgi_python_env_set(struct wsgi_request *wsgi_req, int interned, int key, PyObject *value) {
+	if (interned) {
+		PyDict_SetItem(wsgi_req->async_environ, uwsgi_python_env.keys[key], value);
+	}
+	else {
+		PyDict_SetItemString(wsgi_req->async_environ, uwsgi_python_env_keys[key], value);
+	}
+}
+
 void *uwsgi_request_subhandler_wsgi(struct wsgi_request *wsgi_req, struct uwsgi_app *wi) {
 
 
@@ -135,17 +286,24 @@ void *uwsgi_request_subhandler_wsgi(struct wsgi_request *wsgi_req, struct uwsgi_
 	PyObject *pydictkey, *pydictvalue;
 	char *path_info;
 
+	int interned = (wi->interpreter == up.main_thread);
+	if (interned && !uwsgi_python_env.ready) {
+		uwsgi_python_env_init();
+	}
+
         for (i = 0; i < wsgi_req->var_cnt; i += 2) {
 #ifdef UWSGI_DEBUG
                 uwsgi_debug("%.*s: %.*s\n", wsgi_req->hvec[i].iov_len, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i+1].iov_len, wsgi_req->hvec[i+1].iov_base);
 #endif
-#ifdef PYTHREE
-                pydictkey = PyUnicode_DecodeLatin1(wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len, NULL);
-                pydictvalue = PyUnicode_DecodeLatin1(wsgi_req->hvec[i + 1].iov_base, wsgi_req->hvec[i + 1].iov_len, NULL);
-#else
-                pydictkey = PyString_FromStringAndSize(wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len);
-                pydictvalue = PyString_FromStringAndSize(wsgi_req->hvec[i + 1].iov_base, wsgi_req->hvec[i + 1].iov_len);
-#endif
+		struct uwsgi_python_env_var *var = interned ? uwsgi_python_env_var(wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len) : NULL;
+		if (var) {
+			pydictkey = var->key;
+			Py_INCREF(pydictkey);
+		}
+		else {
+			pydictkey = uwsgi_python_env_decode(wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len);
+		}
+		pydictvalue = uwsgi_python_env_value(var, wsgi_req->hvec[i + 1].iov_base, wsgi_req->hvec[i + 1].iov_len);
 
 #ifdef UWSGI_DEBUG
 		uwsgi_log("%p %d %p %d\n", pydictkey, wsgi_req->hvec[i].iov_len, pydictvalue, wsgi_req->hvec[i + 1].iov_len);
@@ -175,65 +333,72 @@ void *uwsgi_request_subhandler_wsgi(struct wsgi_request *wsgi_req, struct uwsgi_
         // create wsgi.input custom object
         wsgi_req->async_input = (PyObject *) PyObject_New(uwsgi_Input, &uwsgi_InputType);
         ((uwsgi_Input*)wsgi_req->async_input)->wsgi_req = wsgi_req;
+        ((uwsgi_Input*)wsgi_req->async_input)->body_map = NULL;
 
 
-        PyDict_SetItemString(wsgi_req->async_environ, "wsgi.input", wsgi_req->async_input);
+        uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_INPUT, wsgi_req->async_input);
 
 	if (up.wsgi_manage_chunked_input) {
 		if (wsgi_req->body_is_chunked) {
-			PyDict_SetItemString(wsgi_req->async_environ, "wsgi.input_terminated", Py_True);
+			uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_INPUT_TERMINATED, Py_True);
 		}
 		else {
-			PyDict_SetItemString(wsgi_req->async_environ, "wsgi.input_terminated", Py_False);
+			uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_INPUT_TERMINATED, Py_False);
 		}
 	}
 
 	if (!up.wsgi_disable_file_wrapper)
-		PyDict_SetItemString(wsgi_req->async_environ, "wsgi.file_wrapper", wi->sendfile);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_FILE_WRAPPER, wi->sendfile);
 
 	if (uwsgi.async > 0) {
-		PyDict_SetItemString(wsgi_req->async_environ, "x-wsgiorg.fdevent.readable", wi->eventfd_read);
-		PyDict_SetItemString(wsgi_req->async_environ, "x-wsgiorg.fdevent.writable", wi->eventfd_write);
-		PyDict_SetItemString(wsgi_req->async_environ, "x-wsgiorg.fdevent.timeout", Py_None);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_FDEVENT_READABLE, wi->eventfd_read);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_FDEVENT_WRITABLE, wi->eventfd_write);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_FDEVENT_TIMEOUT, Py_None);
 	}
 
-	PyDict_SetItemString(wsgi_req->async_environ, "wsgi.version", wi->gateway_version);
+	uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_VERSION, wi->gateway_version);
 
-	PyDict_SetItemString(wsgi_req->async_environ, "wsgi.errors", wi->error);
+	uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_ERRORS, wi->error);
 
-	PyDict_SetItemString(wsgi_req->async_environ, "wsgi.run_once", Py_False);
+	uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_RUN_ONCE, Py_False);
 
 
 
 	if (uwsgi.threads > 1) {
-		PyDict_SetItemString(wsgi_req->async_environ, "wsgi.multithread", Py_True);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_MULTITHREAD, Py_True);
 	}
 	else {
-		PyDict_SetItemString(wsgi_req->async_environ, "wsgi.multithread", Py_False);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_MULTITHREAD, Py_False);
 	}
 	if (uwsgi.numproc == 1) {
-		PyDict_SetItemString(wsgi_req->async_environ, "wsgi.multiprocess", Py_False);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_MULTIPROCESS, Py_False);
 	}
 	else {
-		PyDict_SetItemString(wsgi_req->async_environ, "wsgi.multiprocess", Py_True);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_MULTIPROCESS, Py_True);
 	}
 
 
+	int https = 0;
 	if (wsgi_req->scheme_len > 0) {
-		zero = UWSGI_PYFROMSTRINGSIZE(wsgi_req->scheme, wsgi_req->scheme_len);
+		https = -1;
 	}
 	else if (wsgi_req->https_len > 0) {
 		if (!strncasecmp(wsgi_req->https, "on", 2) || wsgi_req->https[0] == '1') {
-			zero = UWSGI_PYFROMSTRING("https");
-		}
-		else {
-			zero = UWSGI_PYFROMSTRING("http");
+			https = 1;
 		}
 	}
+
+	if (https < 0) {
+		zero = UWSGI_PYFROMSTRINGSIZE(wsgi_req->scheme, wsgi_req->scheme_len);
+	}
+	else if (interned) {
+		zero = https ? uwsgi_python_env.https : uwsgi_python_env.http;
+		Py_INCREF(zero);
+	}
 	else {
-		zero = UWSGI_PYFROMSTRING("http");
+		zero = UWSGI_PYFROMSTRING(https ? "https" : "http");
 	}
-	PyDict_SetItemString(wsgi_req->async_environ, "wsgi.url_scheme", zero);
+	uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_WSGI_URL_SCHEME, zero);
 	Py_DECREF(zero);
 
 	wsgi_req->async_app = wi->callable;
@@ -243,15 +408,15 @@ void *uwsgi_request_subhandler_wsgi(struct wsgi_request *wsgi_req, struct uwsgi_
 		PyDict_SetItemString(up.embedded_dict, "env", wsgi_req->async_environ);
 	}
 
-	PyDict_SetItemString(wsgi_req->async_environ, "uwsgi.version", wi->uwsgi_version);
+	uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_UWSGI_VERSION, wi->uwsgi_version);
 
 	if (uwsgi.cores > 1) {
 		zero = PyInt_FromLong(wsgi_req->async_id);
-		PyDict_SetItemString(wsgi_req->async_environ, "uwsgi.core", zero);
+		uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_UWSGI_CORE, zero);
 		Py_DECREF(zero);
 	}
 
-	PyDict_SetItemString(wsgi_req->async_environ, "uwsgi.node", wi->uwsgi_node);
+	uwsgi_python_env_set(wsgi_req, interned, UWSGI_PYTHON_ENV_UWSGI_NODE, wi->uwsgi_node);
 
 	// call
 	if (PyTuple_GetItem(wsgi_req->async_args, 0) != wsgi_req->async_environ) {
@@ -264,6 +429,72 @@ void *uwsgi_request_subhandler_wsgi(struct wsgi_request *wsgi_req, struct uwsgi_
 	return python_call(wsgi_req->async_app, wsgi_req->async_args, uwsgi.catch_exceptions, wsgi_req);
 }
 
+/*
+
+	--wsgi-write-batch <bytes>
+
+	templates engines yield hundreds of small chunks, with this option they are accumulated
+	(holding a reference to them, so no copy is involved) and sent with a single writev()
+	when they reach the specified size, at the end of the response, or before anything else
+	is written (file wrappers, buffers, the write() callable...).
+
+	Yielding an empty chunk flushes the batch, so streaming apps keep working.
+
+*/
+
+int uwsgi_python_write_batch_flush(struct wsgi_request *wsgi_req) {
+	if (!up.write_batch) return 0;
+	struct uwsgi_python_write_batch *wb = &up.write_batch[wsgi_req->async_id];
+	if (!wb->cnt) return 0;
+
+	UWSGI_RELEASE_GIL
+	uwsgi_response_writev_body_do(wsgi_req, wb->iov, wb->cnt);
+	UWSGI_GET_GIL
+
+	size_t i;
+	for(i=0;i<wb->cnt;i++) {
+		Py_DECREF(wb->chunks[i]);
+	}
+	wb->cnt = 0;
+	wb->len = 0;
+
+	uwsgi_py_check_write_errors {
+		uwsgi_py_write_exception(wsgi_req);
+		return -1;
+	}
+	return 0;
+}
+
+// 1 if the chunk has been batched (or has flushed the batch), 0 if the caller has to manage it, -1 on error
+static int uwsgi_python_write_batch_add(struct wsgi_request *wsgi_req, PyObject *chunk) {
+	if (!PyString_Check(chunk)) return 0;
+
+	// allocated under the GIL, so it is safe in multithread mode too
+	if (!up.write_batch) {
+		up.write_batch = uwsgi_calloc(sizeof(struct uwsgi_python_write_batch) * uwsgi.cores);
+	}
+	struct uwsgi_python_write_batch *wb = &up.write_batch[wsgi_req->async_id];
+
+	size_t len = PyString_Size(chunk);
+	// explicit flush
+	if (len == 0) {
+		if (!wb->cnt) return 0;
+		return uwsgi_python_write_batch_flush(wsgi_req) ? -1 : 1;
+	}
+
+	Py_INCREF(chunk);
+	wb->chunks[wb->cnt] = chunk;
+	wb->iov[wb->cnt].iov_base = PyString_AsString(chunk);
+	wb->iov[wb->cnt].iov_len = len;
+	wb->cnt++;
+	wb->len += len;
+
+	if (wb->cnt >= UWSGI_PYTHON_WRITE_BATCH_IOVEC || wb->len >= up.wsgi_write_batch) {
+		if (uwsgi_python_write_batch_flush(wsgi_req)) return -1;
+	}
+	return 1;
+}
+
 int uwsgi_response_subhandler_wsgi(struct wsgi_request *wsgi_req) {
 
 	PyObject *pychunk;
@@ -307,14 +538,30 @@ int uwsgi_response_subhandler_wsgi(struct wsgi_request *wsgi_req) {
 
 	if (!pychunk) {
 exception:
+		// what has been yielded before the exception is sent as without batching
+		if (up.write_batch) {
+			PyObject *type, *value, *traceback;
+			PyErr_Fetch(&type, &value, &traceback);
+			uwsgi_python_write_batch_flush(wsgi_req);
+			PyErr_Restore(type, value, traceback);
+		}
 		if (PyErr_Occurred()) { 
 			uwsgi_manage_exception(wsgi_req, uwsgi.catch_exceptions);
 		}	
 		goto clear;
 	}
-
-
-
+	if (up.wsgi_write_batch > 0) {
+		int batched = uwsgi_python_write_batch_add(wsgi_req, pychunk);
+		if (batched) {
+			Py_DECREF(pychunk);
+			if (batched < 0) goto clear;
+			return UWSGI_AGAIN;
+		}
+		if (uwsgi_python_write_batch_flush(wsgi_req)) {
+			Py_DECREF(pychunk);
+			goto clear;
+		}
+	}
 
 	int ret = uwsgi_python_send_body(wsgi_req, pychunk);
 	if (ret != 0) {
@@ -360,6 +607,8 @@ exception:
 	return UWSGI_AGAIN;
 
 clear:
+	uwsgi_python_write_batch_flush(wsgi_req);
+
 	// Release the reference that we took in py_uwsgi_sendfile.
 	if (wsgi_req->async_sendfile != NULL) {
 		Py_DECREF((PyObject *) wsgi_req->async_sendfile);
@@ -572,6 +572,125 @@ error:
 
 }
 
+static VALUE rack_uwsgi_cache_get_many(int argc, VALUE *argv, VALUE *class) {
+
+	if (argc == 0) goto error;
+
+	Check_Type(argv[0], T_ARRAY);
+
+	char *cache = NULL;
+
+	if (argc > 1) {
+		Check_Type(argv[1], T_STRING);
+		cache = RSTRING_PTR(argv[1]);
+	}
+
+	long i, n = RARRAY_LEN(argv[0]);
+	char **keys = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint16_t *keylens = uwsgi_malloc(sizeof(uint16_t) * (n + 1));
+	char **values = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint64_t *vallens = uwsgi_malloc(sizeof(uint64_t) * (n + 1));
+
+	for (i = 0; i < n; i++) {
+		VALUE key = rb_ary_entry(argv[0], i);
+		if (TYPE(key) != T_STRING) {
+			free(keys);
+			free(keylens);
+			free(values);
+			free(vallens);
+			rb_raise(rb_eArgError, "cache keys must be strings");
+			return Qnil;
+		}
+		keys[i] = RSTRING_PTR(key);
+		keylens[i] = RSTRING_LEN(key);
+	}
+
+	uwsgi_cache_magic_mget(keys, keylens, values, vallens, n, cache);
+
+	VALUE res = rb_hash_new();
+	for (i = 0; i < n; i++) {
+		if (!values[i]) continue;
+		rb_hash_aset(res, rb_ary_entry(argv[0], i), rb_str_new(values[i], vallens[i]));
+		free(values[i]);
+	}
+
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+	return res;
+
+error:
+	rb_raise(rb_eArgError, "you need to specify an array of cache keys");
+	return Qnil;
+
+}
+
+static int rack_uwsgi_cache_set_many_item(VALUE key, VALUE value, VALUE arg) {
+	struct uwsgi_buffer *ub = (struct uwsgi_buffer *) arg;
+	Check_Type(key, T_STRING);
+	Check_Type(value, T_STRING);
+	// store the VALUEs (they are kept alive by the hash)
+	if (uwsgi_buffer_append(ub, (char *) &key, sizeof(VALUE))) return ST_STOP;
+	if (uwsgi_buffer_append(ub, (char *) &value, sizeof(VALUE))) return ST_STOP;
+	return ST_CONTINUE;
+}
+
+static VALUE rack_uwsgi_cache_set_many(int argc, VALUE *argv, VALUE *class) {
+
+	if (argc == 0) goto error;
+
+	Check_Type(argv[0], T_HASH);
+
+	uint64_t expires = 0;
+	char *cache = NULL;
+
+	if (argc > 1) {
+		Check_Type(argv[1], T_FIXNUM);
+		expires = NUM2INT(argv[1]);
+		if (argc > 2) {
+			Check_Type(argv[2], T_STRING);
+			cache = RSTRING_PTR(argv[2]);
+		}
+	}
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	rb_hash_foreach(argv[0], rack_uwsgi_cache_set_many_item, (VALUE) ub);
+
+	uint64_t i, n = ub->pos / (sizeof(VALUE) * 2);
+	VALUE *pairs = (VALUE *) ub->buf;
+	char **keys = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint16_t *keylens = uwsgi_malloc(sizeof(uint16_t) * (n + 1));
+	char **values = uwsgi_malloc(sizeof(char *) * (n + 1));
+	uint64_t *vallens = uwsgi_malloc(sizeof(uint64_t) * (n + 1));
+
+	for (i = 0; i < n; i++) {
+		keys[i] = RSTRING_PTR(pairs[i * 2]);
+		keylens[i] = RSTRING_LEN(pairs[i * 2]);
+		values[i] = RSTRING_PTR(pairs[(i * 2) + 1]);
+		vallens[i] = RSTRING_LEN(pairs[(i * 2) + 1]);
+	}
+
+	uint64_t failed = uwsgi_cache_magic_mset(keys, keylens, values, vallens, n, expires, 0, cache);
+
+	free(keys);
+	free(keylens);
+	free(values);
+	free(vallens);
+	uwsgi_buffer_destroy(ub);
+
+	if (failed) {
+		return Qnil;
+	}
+
+	return Qtrue;
+
+error:
+	rb_raise(rb_eArgError, "you need to specify a hash of cache keys and values");
+	return Qnil;
+
+}
+
 static VALUE rack_uwsgi_cache_get_exc(int argc, VALUE *argv, VALUE *class) {
 	VALUE ret = rack_uwsgi_cache_get(argc, argv, class);
 	if (ret == Qnil) {
@@ -1145,6 +1264,8 @@ void uwsgi_rack_init_api() {
         uwsgi_rack_api("cache_del", rack_uwsgi_cache_del, -1);
         uwsgi_rack_api("cache_del!", rack_uwsgi_cache_del_exc, -1);
         uwsgi_rack_api("cache_set", rack_uwsgi_cache_set, -1);
+        uwsgi_rack_api("cache_get_many", rack_uwsgi_cache_get_many, -1);
+        uwsgi_rack_api("cache_set_many", rack_uwsgi_cache_set_many, -1);
         uwsgi_rack_api("cache_set!", rack_uwsgi_cache_set_exc, -1);
         uwsgi_rack_api("cache_update", rack_uwsgi_cache_update, -1);
         uwsgi_rack_api("cache_update!", rack_uwsgi_cache_update_exc, -1);
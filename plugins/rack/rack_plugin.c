@@ -5,6 +5,8 @@ extern struct uwsgi_server uwsgi;
 struct uwsgi_rack ur;
 struct uwsgi_plugin rack_plugin;
 
+#define RACK_BODY_IOVEC 64
+
 static void uwsgi_opt_rbshell(char *opt, char *value, void *foobar) {
 
         uwsgi.honour_stdin = 1;
@@ -27,6 +29,9 @@ struct uwsgi_option uwsgi_rack_options[] = {
         {"rack", required_argument, 0, "load a rack app", uwsgi_opt_set_str, &ur.rack, UWSGI_OPT_POST_BUFFERING},
         {"ruby-gc-freq", required_argument, 0, "set ruby GC frequency", uwsgi_opt_set_int, &ur.gc_freq, 0},
         {"rb-gc-freq", required_argument, 0, "set ruby GC frequency", uwsgi_opt_set_int, &ur.gc_freq, 0},
+        {"ruby-gc-compact", no_argument, 0, "run a full compacting ruby GC after the apps are loaded (before forking workers)", uwsgi_opt_true, &ur.gc_compact, 0},
+        {"rb-gc-compact", no_argument, 0, "run a full compacting ruby GC after the apps are loaded (before forking workers)", uwsgi_opt_true, &ur.gc_compact, 0},
+        {"rack-reuse-env", no_argument, 0, "reuse the env hash of each core between requests (the app must not keep references to it)", uwsgi_opt_true, &ur.reuse_env, 0},
 
 #ifdef RUBY19
 	{"rb-lib", required_argument, 0, "add a directory to the ruby libdir search path", uwsgi_opt_add_string_list, &ur.libdir, 0},
@@ -454,6 +459,27 @@ void uwsgi_ruby_gemset(char *gemset) {
 	
 }
 
+static const char *rack_env_keys[RACK_ENV_KEYS] = {
+	[RACK_ENV_SCRIPT_NAME] = "SCRIPT_NAME",
+	[RACK_ENV_QUERY_STRING] = "QUERY_STRING",
+	[RACK_ENV_SERVER_NAME] = "SERVER_NAME",
+	[RACK_ENV_SERVER_PORT] = "SERVER_PORT",
+	[RACK_ENV_RACK_VERSION] = "rack.version",
+	[RACK_ENV_RACK_URL_SCHEME] = "rack.url_scheme",
+	[RACK_ENV_RACK_MULTITHREAD] = "rack.multithread",
+	[RACK_ENV_RACK_MULTIPROCESS] = "rack.multiprocess",
+	[RACK_ENV_RACK_RUN_ONCE] = "rack.run_once",
+	[RACK_ENV_RACK_INPUT] = "rack.input",
+	[RACK_ENV_RACK_ERRORS] = "rack.errors",
+	[RACK_ENV_UWSGI_CORE] = "uwsgi.core",
+	[RACK_ENV_UWSGI_VERSION] = "uwsgi.version",
+	[RACK_ENV_UWSGI_NODE] = "uwsgi.node",
+	[RACK_ENV_HTTP_CONTENT_LENGTH] = "HTTP_CONTENT_LENGTH",
+	[RACK_ENV_HTTP_CONTENT_TYPE] = "HTTP_CONTENT_TYPE",
+};
+
+#define rack_env_store(k, v) rb_hash_aset(env, ur.env_keys[RACK_ENV_##k], v)
+
 static void rack_hack_dollar_zero(VALUE name, ID id) {
 	ur.dollar_zero = rb_obj_as_string(name);
 	rb_obj_taint(ur.dollar_zero);
@@ -465,6 +491,8 @@ void Init_stack(VALUE*);
 
 int uwsgi_rack_init(){
 
+	int i;
+
 #ifdef RUBY19
         int argc = 2;
         char *sargv[] = { (char *) "uwsgi", (char *) "-e0" };
@@ -525,6 +553,18 @@ int uwsgi_rack_init(){
 	rb_gc_register_address(&ur.signals_protector);
 	rb_gc_register_address(&ur.rpc_protector);
 
+	for(i=0;i<RACK_ENV_KEYS;i++) {
+		ur.env_keys[i] = rack_env_key_cstr(rack_env_keys[i]);
+		rb_gc_register_address(&ur.env_keys[i]);
+	}
+
+	// rack.errors is the same stream for every request
+	ur.rack_errors = rb_funcall( rb_const_get(rb_cObject, rb_intern("IO")), rb_intern("new"), 2, INT2NUM(2), rb_str_new("w",1) );
+	rb_gc_register_address(&ur.rack_errors);
+
+	ur.envs = rb_ary_new();
+	rb_gc_register_address(&ur.envs);
+
 	uwsgi_rack_init_api();	
 
 	return 0;
@@ -713,6 +753,36 @@ static VALUE send_body(VALUE obj) {
 	return Qnil;
 }
 
+/*
+	Array bodies cannot stream, so they are sent in batches with a single writev()
+	instead of paying a block call and a syscall for each chunk.
+*/
+static void rack_write_array_body(struct wsgi_request *wsgi_req, VALUE body) {
+
+	struct iovec iov[RACK_BODY_IOVEC];
+	size_t iov_cnt = 0;
+	long i, body_len = RARRAY_LEN(body);
+
+	for(i=0;i<body_len;i++) {
+		VALUE chunk = RARRAY_PTR(body)[i];
+		if (TYPE(chunk) != T_STRING) {
+			uwsgi_log("UNMANAGED BODY TYPE %d\n", TYPE(chunk));
+			continue;
+		}
+		if (RSTRING_LEN(chunk) == 0) continue;
+		iov[iov_cnt].iov_base = RSTRING_PTR(chunk);
+		iov[iov_cnt].iov_len = RSTRING_LEN(chunk);
+		iov_cnt++;
+		if (iov_cnt < RACK_BODY_IOVEC) continue;
+		if (uwsgi_response_writev_body_do(wsgi_req, iov, iov_cnt)) return;
+		iov_cnt = 0;
+	}
+
+	if (iov_cnt > 0) {
+		uwsgi_response_writev_body_do(wsgi_req, iov, iov_cnt);
+	}
+}
+
 VALUE body_to_path(VALUE body) {
         return rb_funcall( body, rb_intern("to_path"), 0);
 }
@@ -826,18 +896,30 @@ int uwsgi_rack_request(struct wsgi_request *wsgi_req) {
 	wsgi_req->app_id = ur.app_id;
 	uwsgi_apps[wsgi_req->app_id].requests++;
 
-        env = rb_hash_new();
+	if (ur.reuse_env) {
+		env = rb_ary_entry(ur.envs, wsgi_req->async_id);
+		if (NIL_P(env)) {
+			env = rb_hash_new();
+			rb_ary_store(ur.envs, wsgi_req->async_id, env);
+		}
+		else {
+			rb_hash_clear(env);
+		}
+	}
+	else {
+        	env = rb_hash_new();
+	}
 	// the following vars have to always been defined (we skip REQUEST_METHOD and PATH_INFO as they should always be available)
-	rb_hash_aset(env, rb_str_new2("SCRIPT_NAME"), rb_str_new2(""));
-	rb_hash_aset(env, rb_str_new2("QUERY_STRING"), rb_str_new2(""));
-	rb_hash_aset(env, rb_str_new2("SERVER_NAME"), rb_str_new2(uwsgi.hostname));
+	rack_env_store(SCRIPT_NAME, rb_str_new2(""));
+	rack_env_store(QUERY_STRING, rb_str_new2(""));
+	rack_env_store(SERVER_NAME, rb_str_new2(uwsgi.hostname));
 	// SERVER_PORT
         char *server_port = strchr(wsgi_req->socket->name, ':');
         if (server_port) {
-		rb_hash_aset(env, rb_str_new2("SERVER_PORT"), rb_str_new(server_port+1, strlen(server_port+1)));
+		rack_env_store(SERVER_PORT, rb_str_new(server_port+1, strlen(server_port+1)));
         }
         else {
-		rb_hash_aset(env, rb_str_new2("SERVER_PORT"), rb_str_new2("80"));
+		rack_env_store(SERVER_PORT, rb_str_new2("80"));
         }
 
         // fill ruby hash
@@ -852,7 +934,7 @@ int uwsgi_rack_request(struct wsgi_request *wsgi_req) {
 					!uwsgi_strncmp((char *)"SERVER_NAME", 11, wsgi_req->hvec[i].iov_base, (int) wsgi_req->hvec[i].iov_len) ||
 					!uwsgi_strncmp((char *)"SERVER_PORT", 11, wsgi_req->hvec[i].iov_base, (int) wsgi_req->hvec[i].iov_len)
 							) {
-			rb_hash_aset(env, rb_str_new(wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len),
+			rb_hash_aset(env, rack_env_key(wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i].iov_len),
 					rb_str_new(wsgi_req->hvec[i+1].iov_base, wsgi_req->hvec[i+1].iov_len));
 
 			//uwsgi_log("%.*s = %.*s\n", wsgi_req->hvec[i].iov_len, wsgi_req->hvec[i].iov_base, wsgi_req->hvec[i+1].iov_len, wsgi_req->hvec[i+1].iov_base);
@@ -864,53 +946,53 @@ int uwsgi_rack_request(struct wsgi_request *wsgi_req) {
 	VALUE rbv = rb_ary_new();
 	rb_ary_store(rbv, 0, INT2NUM(1));
 	rb_ary_store(rbv, 1, INT2NUM(1));
-	rb_hash_aset(env, rb_str_new2("rack.version"), rbv);
+	rack_env_store(RACK_VERSION, rbv);
 
 	if (wsgi_req->scheme_len > 0) {
-		rb_hash_aset(env, rb_str_new2("rack.url_scheme"), rb_str_new(wsgi_req->scheme, wsgi_req->scheme_len));
+		rack_env_store(RACK_URL_SCHEME, rb_str_new(wsgi_req->scheme, wsgi_req->scheme_len));
         }
         else if (wsgi_req->https_len > 0) {
                 if (!strncasecmp(wsgi_req->https, "on", 2) || wsgi_req->https[0] == '1') {
-			rb_hash_aset(env, rb_str_new2("rack.url_scheme"), rb_str_new2("https"));
+			rack_env_store(RACK_URL_SCHEME, rb_str_new2("https"));
                 }
                 else {
-			rb_hash_aset(env, rb_str_new2("rack.url_scheme"), rb_str_new2("http"));
+			rack_env_store(RACK_URL_SCHEME, rb_str_new2("http"));
                 }
         }
         else {
-		rb_hash_aset(env, rb_str_new2("rack.url_scheme"), rb_str_new2("http"));
+		rack_env_store(RACK_URL_SCHEME, rb_str_new2("http"));
         }
 
 
 	if (uwsgi.threads > 1) {
-		rb_hash_aset(env, rb_str_new2("rack.multithread"), Qtrue);
+		rack_env_store(RACK_MULTITHREAD, Qtrue);
 	}
 	else {
-		rb_hash_aset(env, rb_str_new2("rack.multithread"), Qfalse);
+		rack_env_store(RACK_MULTITHREAD, Qfalse);
 	}
 
 	if (uwsgi.numproc > 1) {
-		rb_hash_aset(env, rb_str_new2("rack.multiprocess"), Qtrue);
+		rack_env_store(RACK_MULTIPROCESS, Qtrue);
 	}
 	else {
-		rb_hash_aset(env, rb_str_new2("rack.multiprocess"), Qfalse);
+		rack_env_store(RACK_MULTIPROCESS, Qfalse);
 	}
 
-	rb_hash_aset(env, rb_str_new2("rack.run_once"), Qfalse);
+	rack_env_store(RACK_RUN_ONCE, Qfalse);
 
 	VALUE dws_wr = Data_Wrap_Struct(ur.rb_uwsgi_io_class, 0, 0, wsgi_req);
 
-	rb_hash_aset(env, rb_str_new2("rack.input"), rb_funcall(ur.rb_uwsgi_io_class, rb_intern("new"), 1, dws_wr ));
+	rack_env_store(RACK_INPUT, rb_funcall(ur.rb_uwsgi_io_class, rb_intern("new"), 1, dws_wr ));
 
-	rb_hash_aset(env, rb_str_new2("rack.errors"), rb_funcall( rb_const_get(rb_cObject, rb_intern("IO")), rb_intern("new"), 2, INT2NUM(2), rb_str_new("w",1) ));
+	rack_env_store(RACK_ERRORS, ur.rack_errors);
 
-	rb_hash_aset(env, rb_str_new2("uwsgi.core"), INT2NUM(wsgi_req->async_id));
-	rb_hash_aset(env, rb_str_new2("uwsgi.version"), rb_str_new2(UWSGI_VERSION));
-	rb_hash_aset(env, rb_str_new2("uwsgi.node"), rb_str_new2(uwsgi.hostname));
+	rack_env_store(UWSGI_CORE, INT2NUM(wsgi_req->async_id));
+	rack_env_store(UWSGI_VERSION, rb_str_new2(UWSGI_VERSION));
+	rack_env_store(UWSGI_NODE, rb_str_new2(uwsgi.hostname));
 
 	// remove HTTP_CONTENT_LENGTH and HTTP_CONTENT_TYPE
-	rb_hash_delete(env, rb_str_new2("HTTP_CONTENT_LENGTH"));
-	rb_hash_delete(env, rb_str_new2("HTTP_CONTENT_TYPE"));
+	rb_hash_delete(env, ur.env_keys[RACK_ENV_HTTP_CONTENT_LENGTH]);
+	rb_hash_delete(env, ur.env_keys[RACK_ENV_HTTP_CONTENT_TYPE]);
 
 	if (ur.unprotected) {
 		ret = call_dispatch(env);
@@ -962,6 +1044,9 @@ int uwsgi_rack_request(struct wsgi_request *wsgi_req) {
 				uwsgi_response_sendfile_do(wsgi_req, fd, 0, 0);
 			}
 		}
+		else if (TYPE(body) == T_ARRAY) {
+			rack_write_array_body(wsgi_req, body);
+		}
 		else if (rb_respond_to( body, rb_intern("each") )) {
 			if (ur.unprotected) {
 				iterate_body(body);
@@ -990,6 +1075,11 @@ int uwsgi_rack_request(struct wsgi_request *wsgi_req) {
 
 clear:
 
+	// drop the references held by the env as soon as possible
+	if (ur.reuse_env) {
+		rb_hash_clear(env);
+	}
+
 	if (ur.gc_freq <= 1 || ur.cycles%ur.gc_freq == 0) {
 #ifdef UWSGI_DEBUG
 			uwsgi_log("calling ruby GC\n");
@@ -1282,7 +1372,29 @@ void uwsgi_ruby_init_thread(int core_id) {
 	uwsgi_log("DANGER: native threads do not work under ruby !!!\n");
 }
 
+static VALUE uwsgi_rb_gc_compact(VALUE arg) {
+	VALUE gc = rb_const_get(rb_cObject, rb_intern("GC"));
+	// ruby >= 3.3 groups the fork-friendly GC tuning in Process.warmup
+	if (rb_respond_to(rb_mProcess, rb_intern("warmup"))) {
+		return rb_funcall(rb_mProcess, rb_intern("warmup"), 0);
+	}
+	rb_funcall(gc, rb_intern("start"), 0);
+	if (rb_respond_to(gc, rb_intern("compact"))) {
+		return rb_funcall(gc, rb_intern("compact"), 0);
+	}
+	return Qnil;
+}
+
 void uwsgi_rack_postinit_apps(void) {
+	// compact the heap in the master, so the workers share as many pages as possible
+	if (ur.gc_compact && ur.call && !uwsgi.lazy && !uwsgi.lazy_apps) {
+		int error = 0;
+		uwsgi_log("compacting ruby heap before forking workers...\n");
+		rb_protect(uwsgi_rb_gc_compact, 0, &error);
+		if (error) {
+			uwsgi_ruby_exception_log(NULL);
+		}
+	}
 }
 
 /*
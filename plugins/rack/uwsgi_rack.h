@@ -5,6 +5,21 @@
 #ifndef RUBY19
 #include <st.h>
 #define rb_errinfo() ruby_errinfo
+#else
+#include <ruby/version.h>
+#endif
+
+// ruby >= 3.0 exposes the fstring table, so env keys can be interned without allocating
+#if defined(RUBY_API_VERSION_MAJOR) && RUBY_API_VERSION_MAJOR >= 3
+#define rack_env_key(x, len) rb_interned_str(x, len)
+#define rack_env_key_cstr(x) rb_interned_str_cstr(x)
+#else
+#define rack_env_key(x, len) rb_str_new(x, len)
+#define rack_env_key_cstr(x) rb_obj_freeze(rb_str_new2(x))
+#endif
+
+#if !defined(RUBY_API_VERSION_MAJOR) || RUBY_API_VERSION_MAJOR < 2
+#define rb_hash_clear(x) rb_funcall(x, rb_intern("clear"), 0)
 #endif
 
 #ifndef RARRAY_LEN
@@ -23,6 +38,26 @@
 #define RSTRING_LEN(x) RSTRING(x)->len
 #endif
 
+enum {
+	RACK_ENV_SCRIPT_NAME,
+	RACK_ENV_QUERY_STRING,
+	RACK_ENV_SERVER_NAME,
+	RACK_ENV_SERVER_PORT,
+	RACK_ENV_RACK_VERSION,
+	RACK_ENV_RACK_URL_SCHEME,
+	RACK_ENV_RACK_MULTITHREAD,
+	RACK_ENV_RACK_MULTIPROCESS,
+	RACK_ENV_RACK_RUN_ONCE,
+	RACK_ENV_RACK_INPUT,
+	RACK_ENV_RACK_ERRORS,
+	RACK_ENV_UWSGI_CORE,
+	RACK_ENV_UWSGI_VERSION,
+	RACK_ENV_UWSGI_NODE,
+	RACK_ENV_HTTP_CONTENT_LENGTH,
+	RACK_ENV_HTTP_CONTENT_TYPE,
+	RACK_ENV_KEYS,
+};
+
 struct uwsgi_rack {
 
         char *rails;
@@ -55,6 +90,16 @@ struct uwsgi_rack {
 	char *gemset;
 
 	struct uwsgi_string_list *libdir;
+
+	// frozen keys, shared by all of the env hashes
+	VALUE env_keys[RACK_ENV_KEYS];
+	VALUE rack_errors;
+
+	int reuse_env;
+	// per-core env hashes (when reuse_env is enabled)
+	VALUE envs;
+
+	int gc_compact;
 };
 
 void uwsgi_rack_init_api(void);
@@ -10,6 +10,7 @@
 static struct uwsgi_rawrouter {
 	struct uwsgi_corerouter cr;
 	int xclient;
+	int splice;
 } urr;
 
 extern struct uwsgi_server uwsgi;
@@ -22,6 +23,12 @@ struct rawrouter_session {
 	size_t xclient_pos;
 	// placeholder for \r\n
 	size_t xclient_rn;
+
+	// splice() mode: client->backend and backend->client pipes and the bytes waiting in them
+	int c2b[2];
+	int b2c[2];
+	size_t c2b_pending;
+	size_t b2c_pending;
 };
 
 static struct uwsgi_option rawrouter_options[] = {
@@ -30,6 +37,7 @@ static struct uwsgi_option rawrouter_options[] = {
 	{"rawrouter-workers", required_argument, 0, "prefork the specified number of rawrouter processes", uwsgi_opt_set_int, &urr.cr.processes, 0},
 	{"rawrouter-zerg", required_argument, 0, "attach the rawrouter to a zerg server", uwsgi_opt_corerouter_zerg, &urr, 0},
 	{"rawrouter-use-cache", optional_argument, 0, "use uWSGI cache as hostname->server mapper for the rawrouter", uwsgi_opt_set_str, &urr.cr.use_cache, 0},
+	{"rawrouter-cache-memo", required_argument, 0, "memoize (per router process) the specified number of recent results of the cache mapper", uwsgi_opt_set_64bit, &urr.cr.cache_memo, 0},
 
 	{"rawrouter-use-pattern", required_argument, 0, "use a pattern for rawrouter hostname->server mapping", uwsgi_opt_corerouter_use_pattern, &urr, 0},
 	{"rawrouter-use-base", required_argument, 0, "use a base dir for rawrouter hostname->server mapping", uwsgi_opt_corerouter_use_base, &urr, 0},
@@ -56,6 +64,8 @@ static struct uwsgi_option rawrouter_options[] = {
 
 	{"rawrouter-xclient", no_argument, 0, "use the xclient protocol to pass the client address", uwsgi_opt_true, &urr.xclient, 0},
 
+	{"rawrouter-splice", no_argument, 0, "forward data between sockets with splice() without copying it to userspace (Linux only, not used with xclient)", uwsgi_opt_true, &urr.splice, 0},
+
 	{"rawrouter-buffer-size", required_argument, 0, "set internal buffer size (default: page size)", uwsgi_opt_set_64bit, &urr.cr.buffer_size, 0},
 
 	{0, 0, 0, 0, 0, 0, 0},
@@ -160,6 +170,84 @@ static ssize_t rr_xclient_read(struct corerouter_peer *peer) {
 	return len;
 }
 
+#ifdef __linux__
+/*
+	splice() mode
+
+	data is moved from a socket to the session pipe and from the pipe to the other socket
+	without passing in userspace. As with buffers, the reading side is stopped until the pipe
+	has been fully written to the other peer.
+*/
+
+// the default pipe capacity
+#define RR_SPLICE_SIZE 65536
+
+#define rr_splice_in(peer, p, f) splice(peer->fd, NULL, p[1], NULL, RR_SPLICE_SIZE, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);\
+	if (len < 0) {\
+		cr_try_again;\
+		uwsgi_cr_error(peer, f);\
+		return -1;\
+	}\
+	if (peer != peer->session->main_peer && peer->un) peer->un->tx+=len;
+
+#define rr_splice_out(peer, p, pending, f) splice(p[0], NULL, peer->fd, NULL, pending, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);\
+	if (len < 0) {\
+		cr_try_again;\
+		uwsgi_cr_error(peer, f);\
+		return -1;\
+	}\
+	if (peer != peer->session->main_peer && peer->un) peer->un->rx+=len;\
+	pending -= len;
+
+// write to backend
+static ssize_t rr_instance_splice_write(struct corerouter_peer *peer) {
+	struct rawrouter_session *rr = (struct rawrouter_session *) peer->session;
+	ssize_t len = rr_splice_out(peer, rr->c2b, rr->c2b_pending, "rr_instance_splice_write()");
+	if (!len) return 0;
+
+	if (!rr->c2b_pending) {
+		cr_reset_hooks(peer);
+	}
+
+	return len;
+}
+
+// write to client
+static ssize_t rr_splice_write(struct corerouter_peer *main_peer) {
+	struct rawrouter_session *rr = (struct rawrouter_session *) main_peer->session;
+	ssize_t len = rr_splice_out(main_peer, rr->b2c, rr->b2c_pending, "rr_splice_write()");
+	if (!len) return 0;
+
+	if (!rr->b2c_pending) {
+		cr_reset_hooks(main_peer);
+	}
+
+	return len;
+}
+
+// read from backend
+static ssize_t rr_instance_splice_read(struct corerouter_peer *peer) {
+	struct rawrouter_session *rr = (struct rawrouter_session *) peer->session;
+	ssize_t len = rr_splice_in(peer, rr->b2c, "rr_instance_splice_read()");
+	if (!len) return 0;
+
+	rr->b2c_pending = len;
+	cr_write_to_main(peer, rr_splice_write);
+	return len;
+}
+
+// read from client
+static ssize_t rr_splice_read(struct corerouter_peer *main_peer) {
+	struct rawrouter_session *rr = (struct rawrouter_session *) main_peer->session;
+	ssize_t len = rr_splice_in(main_peer, rr->c2b, "rr_splice_read()");
+	if (!len) return 0;
+
+	rr->c2b_pending = len;
+	cr_write_to_backend(main_peer->session->peers, rr_instance_splice_write);
+	return len;
+}
+#endif
+
 // the instance is connected now we cannot retry connections
 static ssize_t rr_instance_connected(struct corerouter_peer *peer) {
 
@@ -173,6 +261,12 @@ static ssize_t rr_instance_connected(struct corerouter_peer *peer) {
 		cr_reset_hooks_and_read(peer, rr_xclient_read);
 		return 1;
 	}
+#ifdef __linux__
+	if (rr->c2b[0] > -1) {
+		cr_reset_hooks_and_read(peer, rr_instance_splice_read);
+		return 1;
+	}
+#endif
 	cr_reset_hooks_and_read(peer, rr_instance_read);
 	return 1;
 }
@@ -216,6 +310,12 @@ static void rr_session_close(struct corerouter_session *cs) {
 	if (rr->xclient) {
 		uwsgi_buffer_destroy(rr->xclient);
 	}
+	if (rr->c2b[0] > -1) {
+		close(rr->c2b[0]);
+		close(rr->c2b[1]);
+		close(rr->b2c[0]);
+		close(rr->b2c[1]);
+	}
 }
 
 // allocate a new session
@@ -228,9 +328,11 @@ static int rawrouter_alloc_session(struct uwsgi_corerouter *ucr, struct uwsgi_ga
 	// set retry hook
 	cs->retry = rr_retry;
 
+	struct rawrouter_session *rr = (struct rawrouter_session *) cs;
+	rr->c2b[0] = -1;
+
 	if (sa && sa->sa_family == AF_INET) {
 		if (urr.xclient) {
-			struct rawrouter_session *rr = (struct rawrouter_session *) cs;
 			rr->xclient = uwsgi_buffer_new(13+sizeof(cs->client_address)+2);
 			if (uwsgi_buffer_append(rr->xclient, "XCLIENT ADDR=", 13)) return -1;
 			if (uwsgi_buffer_append(rr->xclient, cs->client_address, strlen(cs->client_address))) return -1;
@@ -238,11 +340,34 @@ static int rawrouter_alloc_session(struct uwsgi_corerouter *ucr, struct uwsgi_ga
 		}
         }
 
+#ifdef __linux__
+	if (urr.splice && !rr->xclient) {
+		if (pipe2(rr->c2b, O_NONBLOCK|O_CLOEXEC)) {
+			uwsgi_error("rawrouter_alloc_session()/pipe2()");
+			rr->c2b[0] = -1;
+			return -1;
+		}
+		if (pipe2(rr->b2c, O_NONBLOCK|O_CLOEXEC)) {
+			uwsgi_error("rawrouter_alloc_session()/pipe2()");
+			close(rr->c2b[0]);
+			close(rr->c2b[1]);
+			rr->c2b[0] = -1;
+			return -1;
+		}
+		cs->main_peer->last_hook_read = rr_splice_read;
+	}
+#endif
+
 	// add a new peer
 	struct corerouter_peer *peer = uwsgi_cr_peer_add(cs);
 
 	// set default peer hook
 	peer->last_hook_read = rr_instance_read;
+#ifdef __linux__
+	if (rr->c2b[0] > -1) {
+		peer->last_hook_read = rr_instance_splice_read;
+	}
+#endif
 
 	// use the address as hostname
         memcpy(peer->key, cs->ugs->name, cs->ugs->name_len);
@@ -264,6 +389,13 @@ static int rawrouter_alloc_session(struct uwsgi_corerouter *ucr, struct uwsgi_ga
 
 static int rawrouter_init() {
 
+#ifndef __linux__
+	if (urr.splice) {
+		uwsgi_log("--rawrouter-splice is supported only on Linux\n");
+		exit(1);
+	}
+#endif
+
 	urr.cr.session_size = sizeof(struct rawrouter_session);
 	urr.cr.alloc_session = rawrouter_alloc_session;
 	uwsgi_corerouter_init((struct uwsgi_corerouter *) &urr);
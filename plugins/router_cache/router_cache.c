@@ -12,6 +12,21 @@ extern struct uwsgi_server uwsgi;
 
 	route = /^foobar1(.*)/ cache:key=foo$1poo,content_type=text/html,name=foobar
 
+	stale-while-revalidate and request coalescing:
+
+	route = ^/news cache:key=${REQUEST_URI},stale=1,coalesce=10
+	route = ^/news cachestore:key=${REQUEST_URI},expires=30,stale=300
+
+	cachestore with stale=N keeps the item N seconds after its expiration and marks
+	it as fresh with a "<key>@fresh" item (expiring after 'expires' seconds).
+	A lookup with stale=1 serving an item without the fresh marker lets a single
+	request (the one getting the "<key>@inflight" marker) reach the app,
+	while the others get the stale item.
+
+	With coalesce=N (seconds, the lifetime of the in-flight marker) on a miss only the
+	request getting the in-flight marker reaches the app, the others wait (up to N seconds)
+	for the item to be stored. cachestore always removes the in-flight marker.
+
 */
 
 struct uwsgi_router_cache_conf {
@@ -58,6 +73,11 @@ struct uwsgi_router_cache_conf {
 	int status;
 	char *no_offload;
 
+	char *stale_str;
+	uint64_t stale;
+	char *coalesce_str;
+	uint64_t coalesce;
+
 	char *no_cl;
 };
 
@@ -73,8 +93,44 @@ struct uwsgi_transformation_cache_conf {
 
         struct uwsgi_buffer *cache_it_to;
         uint64_t cache_it_expires;
+
+	// stale-while-revalidate markers
+	struct uwsgi_buffer *fresh;
+	uint64_t fresh_expires;
+	struct uwsgi_buffer *inflight;
 };
 
+// "<key>@fresh" and "<key>@inflight"
+static struct uwsgi_buffer *cache_marker(struct uwsgi_buffer *key, char *suffix) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(key->pos + strlen(suffix) + 1);
+	if (uwsgi_buffer_append(ub, key->buf, key->pos)) goto error;
+	if (uwsgi_buffer_append(ub, suffix, strlen(suffix))) goto error;
+	if (uwsgi_buffer_append(ub, "\0", 1)) goto error;
+	ub->pos--;
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+// returns 1 if the caller is the only one in charge of regenerating the item
+static int cache_inflight_acquire(struct uwsgi_router_cache_conf *urcc, struct uwsgi_buffer *key) {
+	struct uwsgi_buffer *ub = cache_marker(key, "@inflight");
+	if (!ub) return 0;
+	// without the UPDATE flag the set fails if the marker already exists
+	int ret = uwsgi_cache_magic_set(ub->buf, ub->pos, "1", 1, urcc->coalesce ? urcc->coalesce : 10, 0, urcc->name);
+	uwsgi_buffer_destroy(ub);
+	return ret == 0;
+}
+
+static int cache_marker_exists(struct uwsgi_router_cache_conf *urcc, struct uwsgi_buffer *key, char *suffix) {
+	struct uwsgi_buffer *ub = cache_marker(key, suffix);
+	if (!ub) return 0;
+	int ret = uwsgi_cache_magic_exists(ub->buf, ub->pos, urcc->name);
+	uwsgi_buffer_destroy(ub);
+	return ret;
+}
+
 static int transform_cache(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
 	struct uwsgi_transformation_cache_conf *utcc = (struct uwsgi_transformation_cache_conf *) ut->data;
 	struct uwsgi_buffer *ub = ut->chunk;
@@ -97,9 +153,20 @@ static int transform_cache(struct wsgi_request *wsgi_req, struct uwsgi_transform
 				}
 			}
 #endif
+			if (utcc->fresh) {
+				uwsgi_cache_magic_set(utcc->fresh->buf, utcc->fresh->pos, "1", 1, utcc->fresh_expires,
+					UWSGI_CACHE_FLAG_UPDATE, utcc->cache_it_to ? utcc->cache_it_to->buf : NULL);
+			}
 		}
 	}
 
+	// let the next request regenerate the item (even on failures)
+	if (utcc->inflight) {
+		uwsgi_cache_magic_del(utcc->inflight->buf, utcc->inflight->pos, utcc->cache_it_to ? utcc->cache_it_to->buf : NULL);
+		uwsgi_buffer_destroy(utcc->inflight);
+	}
+	if (utcc->fresh) uwsgi_buffer_destroy(utcc->fresh);
+
 	// free resources
 	if (utcc->cache_it) uwsgi_buffer_destroy(utcc->cache_it);
 #ifdef UWSGI_ZLIB
@@ -145,6 +212,18 @@ static int uwsgi_routing_func_cache_store(struct wsgi_request *wsgi_req, struct
 #endif
 	utcc->cache_it_expires = urcc->expires;
 
+	if (urcc->stale && urcc->expires) {
+		utcc->fresh = cache_marker(utcc->cache_it, "@fresh");
+		if (!utcc->fresh) goto error;
+		utcc->fresh_expires = urcc->expires;
+		utcc->cache_it_expires += urcc->stale;
+	}
+
+	if (urcc->stale || urcc->coalesce) {
+		utcc->inflight = cache_marker(utcc->cache_it, "@inflight");
+		if (!utcc->inflight) goto error;
+	}
+
 	uwsgi_add_transformation(wsgi_req, transform_cache, utcc);
 
 	return UWSGI_ROUTE_NEXT;
@@ -155,6 +234,8 @@ error:
 	if (utcc->cache_it_gzip) uwsgi_buffer_destroy(utcc->cache_it_gzip);
 #endif
 	if (utcc->cache_it_to) uwsgi_buffer_destroy(utcc->cache_it_to);
+	if (utcc->fresh) uwsgi_buffer_destroy(utcc->fresh);
+	if (utcc->inflight) uwsgi_buffer_destroy(utcc->inflight);
 	free(utcc);
 	return UWSGI_ROUTE_NEXT;
 }
@@ -172,7 +253,47 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 
 	uint64_t valsize = 0;
 	uint64_t expires = 0;
-	char *value = uwsgi_cache_magic_get(ub->buf, ub->pos, &valsize, &expires, urcc->name);
+	char *value = NULL;
+	// offloaded values are pinned and sent from the cache memory (when possible)
+	struct uwsgi_cache *pinned = NULL;
+	uint64_t pin = 0;
+	int ret = -2;
+	if (wsgi_req->socket->can_offload && !ur->custom && !urcc->no_offload) {
+		struct uwsgi_cache *uc = uwsgi_cache_pinnable(urcc->name, ub->buf, ub->pos);
+		if (uc) {
+			ret = uwsgi_cache_pin(uc, ub->buf, ub->pos, &value, &valsize, &expires, &pin);
+			if (!ret) pinned = uc;
+		}
+	}
+	if (ret == -2) {
+		value = uwsgi_cache_magic_get(ub->buf, ub->pos, &valsize, &expires, urcc->name);
+	}
+
+	// a stale item is served only if someone else is already regenerating it
+	if (value && urcc->stale && !cache_marker_exists(urcc, ub, "@fresh") && cache_inflight_acquire(urcc, ub)) {
+		if (pinned) {
+			uwsgi_cache_unpin(pinned, pin);
+		}
+		else {
+			free(value);
+		}
+		uwsgi_buffer_destroy(ub);
+		return UWSGI_ROUTE_NEXT;
+	}
+
+	// on a miss wait for the request regenerating the item
+	if (!value && urcc->coalesce && !cache_inflight_acquire(urcc, ub)) {
+		uint64_t waited = 0;
+		while (waited < urcc->coalesce * 1000) {
+			if (uwsgi.wait_milliseconds_hook(50)) break;
+			waited += 50;
+			value = uwsgi_cache_magic_get(ub->buf, ub->pos, &valsize, &expires, urcc->name);
+			if (value) break;
+			// the regenerating request failed
+			if (!cache_marker_exists(urcc, ub, "@inflight")) break;
+		}
+	}
+
 	if (urcc->mime && value) {
 		mime_type = uwsgi_get_mime_type(ub->buf, ub->pos, &mime_type_len);	
 	}
@@ -194,7 +315,13 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 		if (!urcc->no_cl) {
 			if (uwsgi_response_add_content_length(wsgi_req, valsize)) goto error;
 		}
-		if (wsgi_req->socket->can_offload && !ur->custom && !urcc->no_offload) {
+		if (pinned) {
+			if (!uwsgi_offload_request_cache_do(wsgi_req, pinned, pin, value, valsize)) {
+				wsgi_req->via = UWSGI_VIA_OFFLOAD;
+				return UWSGI_ROUTE_BREAK;
+			}
+		}
+		else if (wsgi_req->socket->can_offload && !ur->custom && !urcc->no_offload) {
                 	if (!uwsgi_offload_request_memory_do(wsgi_req, value, valsize)) {
                         	wsgi_req->via = UWSGI_VIA_OFFLOAD;
                         	return UWSGI_ROUTE_BREAK;
@@ -202,7 +329,12 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 		}
 
 		uwsgi_response_write_body_do(wsgi_req, value, valsize);
-		free(value);
+		if (pinned) {
+			uwsgi_cache_unpin(pinned, pin);
+		}
+		else {
+			free(value);
+		}
 		if (ur->custom)
 			return UWSGI_ROUTE_NEXT;
 		return UWSGI_ROUTE_BREAK;
@@ -210,7 +342,12 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 	
 	return UWSGI_ROUTE_NEXT;
 error:
-	free(value);
+	if (pinned) {
+		uwsgi_cache_unpin(pinned, pin);
+	}
+	else {
+		free(value);
+	}
 	return UWSGI_ROUTE_BREAK;
 }
 
@@ -324,6 +461,8 @@ static int uwsgi_router_cache_store(struct uwsgi_route *ur, char *args) {
                         "value", &urcc->value,
 			"status", &urcc->status_str,
 			"code", &urcc->status_str,
+                        "stale", &urcc->stale_str,
+                        "coalesce", &urcc->coalesce_str,
                         "expires", &urcc->expires_str, NULL)) {
                         uwsgi_log("invalid cachestore route syntax: %s\n", args);
 			goto error;
@@ -360,6 +499,14 @@ static int uwsgi_router_cache_store(struct uwsgi_route *ur, char *args) {
                         urcc->status = atoi(urcc->status_str);
                 }
 
+		if (urcc->stale_str) {
+			urcc->stale = strtoul(urcc->stale_str, NULL, 10);
+		}
+
+		if (urcc->coalesce_str) {
+			urcc->coalesce = strtoul(urcc->coalesce_str, NULL, 10);
+		}
+
 	ur->data2 = urcc;
         return 0;
 error:
@@ -385,11 +532,21 @@ static int uwsgi_router_cache(struct uwsgi_route *ur, char *args) {
                         "no_content_length", &urcc->no_cl,
                         "no_cl", &urcc->no_cl,
                         "nocl", &urcc->no_cl,
+                        "stale", &urcc->stale_str,
+                        "coalesce", &urcc->coalesce_str,
                         NULL)) {
 			uwsgi_log("invalid route syntax: %s\n", args);
 			exit(1);
                 }
 
+		if (urcc->stale_str) {
+			urcc->stale = strtoul(urcc->stale_str, NULL, 10);
+		}
+
+		if (urcc->coalesce_str) {
+			urcc->coalesce = strtoul(urcc->coalesce_str, NULL, 10);
+		}
+
 		if (urcc->key) {
 			urcc->key_len = strlen(urcc->key);
 		}
@@ -16,8 +16,30 @@ struct fcgi_record {
 	char *data;
 } FCGI_Record;
 
-static int fcgi_send(struct wsgi_request *wsgi_req, char *addr, struct uwsgi_buffer *ub, int timeout) {
-	int fd = uwsgi_connect(addr, 0, 1);
+/*
+	requests are sent with FCGI_KEEP_CONN and the connections go back to the per-process pool
+	(--connection-pool-size) once the FCGI_END_REQUEST record is consumed.
+
+	Only one request runs on a connection at a time (request id 1): php-fpm (like most of the
+	FastCGI servers) does not multiplex (FCGI_MPXS_CONNS=0), concurrent requests of the same process
+	(threads or async cores) get different pooled connections.
+*/
+
+static int fcgi_send(struct wsgi_request *wsgi_req, char *addr, struct uwsgi_buffer *ub, int timeout, int *pooled) {
+	int fd = uwsgi_connection_pool_get(addr);
+	*pooled = fd > -1;
+	if (*pooled) {
+		if (uwsgi_write_true_nb(fd, ub->buf, ub->pos, timeout)) {
+			// closed by the server, try with a new connection
+			close(fd);
+			*pooled = 0;
+		}
+		else {
+			return fd;
+		}
+	}
+
+	fd = uwsgi_connect(addr, 0, 1);
 	if (fd < 0)
 		return -1;
 
@@ -39,6 +61,14 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 	struct uwsgi_buffer *ub = NULL, *headers = NULL;
 	int ret = UWSGI_ROUTE_BREAK;
 	int inbody = 0;
+	int pooled = 0;
+	// a pooled connection could be closed by the server before answering, retry once
+	int retry = 1;
+	// set when the FCGI_END_REQUEST record is found, the connection can be reused
+	int completed = 0;
+	// bytes of the FCGI_END_REQUEST record not read yet
+	size_t pending = 0;
+	size_t received = 0;
 
 	// mark a route request
         wsgi_req->via = UWSGI_VIA_ROUTE;
@@ -50,7 +80,7 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 	if (!ub_addr) return UWSGI_ROUTE_BREAK;
 
 	// convert the wsgi_request to an fcgi request
-	ub = uwsgi_to_fastcgi(wsgi_req, ur->custom ? FCGI_AUTHORIZER : FCGI_RESPONDER);
+	ub = uwsgi_to_fastcgi(wsgi_req, ur->custom ? FCGI_AUTHORIZER : FCGI_RESPONDER, FCGI_KEEP_CONN);
 
 	if (!ub) {
 		uwsgi_log("unable to generate fcgi request for %s\n", ub_addr->buf);
@@ -59,21 +89,23 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 	}
 
 	int fd = 0;
+	char buf[8192];
+	char *ptr;
+	ssize_t left, n, p;
+	int oversized, done;
 
-	fd = fcgi_send(wsgi_req, ub_addr->buf, ub, uwsgi.socket_timeout);
-	uwsgi_buffer_destroy(ub);
-	ub = NULL;
+send:
+	fd = fcgi_send(wsgi_req, ub_addr->buf, ub, uwsgi.socket_timeout, &pooled);
 
 	if (fd == -1) {
 		uwsgi_log("error routing request to fcgi server %s\n", ub_addr->buf);
 		goto end;
 	}
 
-	headers = uwsgi_buffer_new(uwsgi.page_size);
-	char buf[8192];
-	char *ptr = buf;//, *rptr = NULL;
-	ssize_t left = 0, n = 0, p = 0;
-	int oversized = 0, done = 0;
+	if (!headers) headers = uwsgi_buffer_new(uwsgi.page_size);
+	ptr = buf;
+	left = 0; n = 0; p = 0;
+	oversized = 0; done = 0;
 
 
 	for (;;) {
@@ -91,10 +123,21 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 		if ((!done || !left) && (sizeof(buf) - (ptr - buf) - left) > 0) {
 			rlen = read(fd, ptr + left, sizeof(buf) - (ptr - buf) - left);
 
-			if (rlen < 0)
+			if (rlen < 0) {
+				if (!received && pooled && retry) goto resend;
 				break;
+			}
 			if (rlen == 0)
 				done = 1;
+			received += rlen;
+		}
+
+		if (done && !received && pooled && retry) {
+resend:
+			retry = 0;
+			close(fd);
+			fd = 0;
+			goto send;
 		}
 
 		if (done && !left) {
@@ -152,7 +195,15 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 			left -= 8;
 			switch (type) {
 			case FCGI_END_REQUEST:
-				break;
+				completed = 1;
+				// nothing must follow the end of the request
+				if ((n + p) < left) {
+					completed = 0;
+				}
+				else {
+					pending = (n + p) - left;
+				}
+				goto end;
 
 			case FCGI_STDERR:
 				uwsgi_log("[fastcgi] %s: stderr: %*s\n", ub_addr->buf, (int) (n > left ? left : n), ptr);
@@ -165,8 +216,9 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 				break;
 
 			case FCGI_STDOUT:
+				// the end of the stream, FCGI_END_REQUEST follows
 				if (n == 0)
-					goto end;
+					break;
 
 				if (!inbody) {
 					ssize_t now = n < left ? n : left;
@@ -228,7 +280,11 @@ static int uwsgi_routing_func_fcgi(struct wsgi_request *wsgi_req, struct uwsgi_r
 	}
 
 end:
-	if (fd) close(fd);
+	if (completed && fd > 0) {
+		uwsgi_connection_pool_release(ub_addr->buf, fd, pending, uwsgi.socket_timeout);
+	}
+	else if (fd > 0) close(fd);
+	if (ub) uwsgi_buffer_destroy(ub);
 	if (ub_addr) uwsgi_buffer_destroy(ub_addr);
 	if (headers) uwsgi_buffer_destroy(headers);
 	return ret;
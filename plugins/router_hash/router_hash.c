@@ -23,6 +23,8 @@ struct uwsgi_router_hash_conf {
 	size_t var_len;
 
 	char *algo;
+	// resolved in the master (keyed algos like siphash generate their key at the first lookup)
+	struct uwsgi_hash_algo *uha;
 	char *items;
 	size_t items_len;
 };
@@ -31,7 +33,7 @@ static int uwsgi_routing_func_hash(struct wsgi_request *wsgi_req, struct uwsgi_r
 
         struct uwsgi_router_hash_conf *urhc = (struct uwsgi_router_hash_conf *) ur->data2;
 
-	struct uwsgi_hash_algo *uha = uwsgi_hash_algo_get(urhc->algo);
+	struct uwsgi_hash_algo *uha = urhc->uha ? urhc->uha : uwsgi_hash_algo_get(urhc->algo);
 	if (!uha) {
 		uwsgi_log("[uwsgi-hash-router] unable to find hash algo \"%s\"\n", urhc->algo);
 		return UWSGI_ROUTE_BREAK;
@@ -127,6 +129,9 @@ static int uwsgi_router_hash(struct uwsgi_route *ur, char *args) {
 
 
 		if (!urhc->algo) urhc->algo = "djb33x";
+		// (re)registering is a no-op if another subsystem already did it
+		uwsgi_hash_algo_register_all();
+		urhc->uha = uwsgi_hash_algo_get(urhc->algo);
 
                 ur->data2 = urhc;
         return 0;
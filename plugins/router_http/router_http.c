@@ -79,6 +79,16 @@ static int uwsgi_routing_func_http(struct wsgi_request *wsgi_req, struct uwsgi_r
                         uwsgi_response_write_headers_do(wsgi_req);	
 		}
 
+		// plain requests (with the whole body available) are parsed by the http engine,
+		// allowing it to reuse the upstream connections
+		if (!(ur->custom & 0x06) && (wsgi_req->post_cl == 0 || uwsgi.post_buffering > 0) &&
+			!uwsgi_offload_request_http_do(wsgi_req, ub_addr->buf, ub)) {
+			wsgi_req->via = UWSGI_VIA_OFFLOAD;
+			wsgi_req->status = 202;
+			uwsgi_buffer_destroy(ub_addr);
+			return UWSGI_ROUTE_BREAK;
+		}
+
         	if (!uwsgi_offload_request_net_do(wsgi_req, ub_addr->buf, ub)) {
                 	wsgi_req->via = UWSGI_VIA_OFFLOAD;
 			wsgi_req->status = 202;
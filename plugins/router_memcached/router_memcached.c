@@ -13,6 +13,9 @@ extern struct uwsgi_server uwsgi;
 	route = /^foobar1(.*)/ memcached:addr=127.0.0.1:11211,key=foo$1poo
 	route = /^foobar1(.*)/ memcachedstore:addr=127.0.0.1:11211,key=foo$1poo
 
+	connections are kept in the per-process pool (--connection-pool-size), stores
+	use noreply so they are pipelined on the same connections of the lookups.
+
 */
 
 struct uwsgi_router_memcached_conf {
@@ -63,29 +66,37 @@ static size_t memcached_firstline_parse(char *buf, size_t len) {
 static void memcached_store(char *addr, struct uwsgi_buffer *key, struct uwsgi_buffer *value, char *expires) {
 	
 	int timeout = uwsgi.socket_timeout;
+	struct uwsgi_buffer *ub = NULL;
 
-        int fd = uwsgi_connect(addr, 0, 1);
-        if (fd < 0) return;
+	// noreply commands leave the connection clean, so it can go back to the pool
+	int fd = uwsgi_connection_pool_get(addr);
+	if (fd < 0) {
+        	fd = uwsgi_connect(addr, 0, 1);
+        	if (fd < 0) return;
 
-	// wait for connection
-        int ret = uwsgi.wait_write_hook(fd, timeout);
-        if (ret <= 0) goto end;
+		// wait for connection
+        	int ret = uwsgi.wait_write_hook(fd, timeout);
+        	if (ret <= 0) goto end;
+	}
 
 	// build the request
-	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	ub = uwsgi_buffer_new(uwsgi.page_size);
 	if (uwsgi_buffer_append(ub, "set ", 4)) goto end2;
 	if (uwsgi_buffer_append(ub, key->buf, key->pos)) goto end2;
 	if (uwsgi_buffer_append(ub, " 0 " , 3)) goto end2;
 	if (uwsgi_buffer_append(ub, expires, strlen(expires))) goto end2;
 	if (uwsgi_buffer_append(ub, " " , 1)) goto end2;
 	if (uwsgi_buffer_num64(ub, value->pos)) goto end2;
-	if (uwsgi_buffer_append(ub, "\r\n" , 2)) goto end2;
+	if (uwsgi_buffer_append(ub, " noreply\r\n" , 10)) goto end2;
 	
         if (uwsgi_write_true_nb(fd, ub->buf, ub->pos, timeout)) goto end2;
         if (uwsgi_write_true_nb(fd, value->buf, value->pos, timeout)) goto end2;
         if (uwsgi_write_true_nb(fd, "\r\n", 2, timeout)) goto end2;
 
-	// we are not interested in command result... (ugly but it works)
+	uwsgi_buffer_destroy(ub);
+	uwsgi_connection_pool_put(addr, fd);
+	return;
+
 end2:
 	uwsgi_buffer_destroy(ub);
 end:
@@ -144,6 +155,13 @@ static int uwsgi_routing_func_memcached(struct wsgi_request *wsgi_req, struct uw
 	char buf[MEMCACHED_BUFSIZE];
 	size_t i;
 	char last_char = 0;
+	int ret;
+	// a pooled connection could have been closed by the server, retry once with a new one
+	int retry = 1;
+	int pooled = 0;
+	size_t found = 0;
+	size_t pos = 0;
+	int fd = -1;
 
 	struct uwsgi_router_memcached_conf *urmc = (struct uwsgi_router_memcached_conf *) ur->data2;
 
@@ -159,39 +177,31 @@ static int uwsgi_routing_func_memcached(struct wsgi_request *wsgi_req, struct uw
 		return UWSGI_ROUTE_BREAK;
 	}
 
-	int fd = uwsgi_connect(ub_addr->buf, 0, 1);
-	if (fd < 0) {
-		uwsgi_buffer_destroy(ub_key);
-		uwsgi_buffer_destroy(ub_addr);
-		goto end;
-	}
+	// build the request
+	char *cmd = uwsgi_concat3n("get ", 4, ub_key->buf, ub_key->pos, "\r\n", 2);
+	size_t cmd_len = 6+ub_key->pos;
+	uwsgi_buffer_destroy(ub_key);
 
-        // wait for connection;
-        int ret = uwsgi.wait_write_hook(fd, uwsgi.socket_timeout);
-        if (ret <= 0) {
-		uwsgi_buffer_destroy(ub_key) ;
-		uwsgi_buffer_destroy(ub_addr);
-		close(fd);
-		goto end;
-        }
+connect:
+	fd = uwsgi_connection_pool_get(ub_addr->buf);
+	pooled = fd > -1;
+	if (!pooled) {
+		fd = uwsgi_connect(ub_addr->buf, 0, 1);
+		if (fd < 0) goto end;
 
-	// build the request and send it
-	char *cmd = uwsgi_concat3n("get ", 4, ub_key->buf, ub_key->pos, "\r\n", 2);
-	if (uwsgi_write_true_nb(fd, cmd, 6+ub_key->pos, uwsgi.socket_timeout)) {
-		uwsgi_buffer_destroy(ub_key);
-		uwsgi_buffer_destroy(ub_addr);
-		free(cmd);
-		close(fd);
-		goto end;
+        	// wait for connection;
+        	ret = uwsgi.wait_write_hook(fd, uwsgi.socket_timeout);
+        	if (ret <= 0) goto end;
 	}
-	uwsgi_buffer_destroy(ub_key);
-	uwsgi_buffer_destroy(ub_addr);
-	free(cmd);
+
+	// send the request
+	if (uwsgi_write_true_nb(fd, cmd, cmd_len, uwsgi.socket_timeout)) goto reconnect;
 
 	// ok, start reading the response...
 	// first we need to get a full line;
-	size_t found = 0;
-	size_t pos = 0;
+	last_char = 0;
+	found = 0;
+	pos = 0;
 	for(;;) {
 		ssize_t len = read(fd, buf + pos, MEMCACHED_BUFSIZE - pos);
 		if (len > 0) {
@@ -201,8 +211,7 @@ static int uwsgi_routing_func_memcached(struct wsgi_request *wsgi_req, struct uw
 		if (len < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS) goto wait;
 		}
-		close(fd);
-		goto end;
+		goto reconnect;
 wait:
 		ret = uwsgi.wait_read_hook(fd, uwsgi.socket_timeout);
 		// when we have a chunk try to read the first line
@@ -213,8 +222,7 @@ wait:
 				goto read;
 			}
 		}
-		close(fd);
-		goto end;
+		goto reconnect;
 read:
 		for(i=0;i<pos;i++) {
 			if (last_char == '\r' && buf[i] == '\n') {
@@ -224,13 +232,15 @@ read:
 			last_char = buf[i];
 		}
 		if (found) break;
+		// no line in a full buffer
+		if (pos >= MEMCACHED_BUFSIZE) goto end;
 	}
 
 	// ok parse the first line
 	size_t response_size = memcached_firstline_parse(buf, found);
-
 	if (response_size == 0) {
-		close(fd);
+		// a complete "END" (or an error line) leaves the connection clean
+		if (pos == found+2 && (found < 5 || memcmp(buf, "VALUE", 5))) goto end_pool;
 		goto end;
 	}
 
@@ -243,8 +253,13 @@ read:
 
 	// the first chunk could already contains part of the body
 	size_t remains = pos-(found+2);
+	// the trailing \r\nEND\r\n
+	size_t pending = 7;
 	if (remains >= response_size) {
 		uwsgi_response_write_body_do(wsgi_req, buf+found+2, response_size);
+		remains -= response_size;
+		if (remains > pending) goto error;
+		pending -= remains;
 		goto done;	
 	}
 
@@ -258,6 +273,8 @@ read:
 	if (wsgi_req->socket->can_offload && !ur->custom && !urmc->no_offload) {
         	if (!uwsgi_offload_request_pipe_do(wsgi_req, fd, response_size)) {
                 	wsgi_req->via = UWSGI_VIA_OFFLOAD;
+			uwsgi_buffer_destroy(ub_addr);
+			free(cmd);
                         return UWSGI_ROUTE_BREAK;
                 }
         }
@@ -282,16 +299,34 @@ write:
 	}
 
 done:
-	close(fd);
+	uwsgi_connection_pool_release(ub_addr->buf, fd, pending, uwsgi.socket_timeout);
+	uwsgi_buffer_destroy(ub_addr);
+	free(cmd);
 	if (ur->custom)
                 return UWSGI_ROUTE_NEXT;
 	return UWSGI_ROUTE_BREAK;
 
 error:
 	close(fd);
+	uwsgi_buffer_destroy(ub_addr);
+	free(cmd);
 	return UWSGI_ROUTE_BREAK;
-	
+
+reconnect:
+	if (pooled && retry && pos == 0) {
+		retry = 0;
+		close(fd);
+		goto connect;
+	}
+	goto end;
+
+end_pool:
+	uwsgi_connection_pool_put(ub_addr->buf, fd);
+	fd = -1;
 end:
+	if (fd > -1) close(fd);
+	uwsgi_buffer_destroy(ub_addr);
+	free(cmd);
 	return UWSGI_ROUTE_NEXT;
 }
 
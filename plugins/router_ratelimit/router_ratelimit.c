@@ -0,0 +1,174 @@
+#include <uwsgi.h>
+
+#ifdef UWSGI_ROUTING
+
+extern struct uwsgi_server uwsgi;
+
+/*
+
+	token buckets stored in a sharedarea hashmap (--sharedarea pages=N,hashmap=<max key size>)
+
+	syntax:
+
+	route = ^/api/ ratelimit:key=${REMOTE_ADDR},rate=10,period=1,burst=20
+	route = ^/login ratelimit:key=login${REMOTE_ADDR},rate=5,period=60,sharedarea=1,legion=mycluster
+
+	rate requests are allowed every period seconds (default 1) with bursts of up to burst requests
+	(default rate), the key (default ${REMOTE_ADDR}) supports route vars. Limited requests get a
+	429 with a Retry-After header.
+
+	Every bucket is a single int64 (the theoretical arrival time of the next request, GCRA)
+	updated with a CAS, so workers never lock each other.
+
+	With legion=<name> the budget is split between the nodes of the legion (rate and burst
+	are divided by the number of alive nodes), so the limit is enforced cluster-wide without
+	exchanging counters (as long as the traffic is balanced between the nodes).
+
+	If the hashmap is full (keys are never removed) requests are allowed.
+
+*/
+
+struct uwsgi_router_ratelimit_conf {
+	char *key;
+	size_t key_len;
+
+	char *rate_str;
+	char *period_str;
+	char *burst_str;
+	char *sharedarea_str;
+	char *legion;
+
+	// microseconds between two requests
+	uint64_t interval;
+	uint64_t burst;
+	int sharedarea;
+};
+
+static int uwsgi_routing_func_ratelimit(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
+	struct uwsgi_router_ratelimit_conf *urrc = (struct uwsgi_router_ratelimit_conf *) ur->data2;
+
+	char **subject = (char **) (((char *)(wsgi_req))+ur->subject);
+	uint16_t *subject_len = (uint16_t *)  (((char *)(wsgi_req))+ur->subject_len);
+
+	struct uwsgi_buffer *ub = uwsgi_routing_translate(wsgi_req, ur, *subject, *subject_len, urrc->key, urrc->key_len);
+	if (!ub) return UWSGI_ROUTE_BREAK;
+
+	uint64_t interval = urrc->interval;
+	uint64_t burst = urrc->burst;
+	if (urrc->legion) {
+		uint64_t nodes = uwsgi_legion_nodes(urrc->legion);
+		if (nodes > 1) {
+			interval *= nodes;
+			burst /= nodes;
+			if (!burst) burst = 1;
+		}
+	}
+	int64_t tolerance = interval * burst;
+
+	int64_t retry_after = 0;
+	int i;
+	// give up (allowing the request) after too much collisions
+	for(i=0;i<10;i++) {
+		int64_t now = uwsgi_micros();
+		int64_t tat = 0;
+		int ret = uwsgi_sharedarea_hashmap_get(urrc->sharedarea, ub->buf, ub->pos, &tat);
+		if (ret < 0) break;
+		int64_t new_tat = (tat > now ? tat : now) + interval;
+		if (new_tat - now > tolerance) {
+			retry_after = new_tat - tolerance - now;
+			break;
+		}
+		ret = uwsgi_sharedarea_hashmap_cas(urrc->sharedarea, ub->buf, ub->pos, &tat, new_tat, 0);
+		// allowed (or hashmap full)
+		if (ret != 1) break;
+	}
+
+	uwsgi_buffer_destroy(ub);
+
+	if (!retry_after) return UWSGI_ROUTE_NEXT;
+
+	// round up to seconds
+	char *retry = uwsgi_64bit2str((retry_after + 999999) / 1000000);
+	if (uwsgi_response_prepare_headers(wsgi_req, "429 Too Many Requests", 21)) goto end;
+	if (uwsgi_response_add_content_type(wsgi_req, "text/plain", 10)) goto end;
+	if (uwsgi_response_add_header(wsgi_req, "Retry-After", 11, retry, strlen(retry))) goto end;
+	uwsgi_response_write_body_do(wsgi_req, "Too Many Requests", 17);
+end:
+	free(retry);
+	return UWSGI_ROUTE_BREAK;
+}
+
+static int uwsgi_router_ratelimit(struct uwsgi_route *ur, char *args) {
+	ur->func = uwsgi_routing_func_ratelimit;
+	ur->data = args;
+	ur->data_len = strlen(args);
+	struct uwsgi_router_ratelimit_conf *urrc = uwsgi_calloc(sizeof(struct uwsgi_router_ratelimit_conf));
+	if (uwsgi_kvlist_parse(ur->data, ur->data_len, ',', '=',
+		"key", &urrc->key,
+		"rate", &urrc->rate_str,
+		"period", &urrc->period_str,
+		"burst", &urrc->burst_str,
+		"sharedarea", &urrc->sharedarea_str,
+		"legion", &urrc->legion, NULL)) {
+		uwsgi_log("invalid ratelimit route syntax: %s\n", args);
+		exit(1);
+	}
+
+	if (!urrc->key) {
+		urrc->key = "${REMOTE_ADDR}";
+	}
+	urrc->key_len = strlen(urrc->key);
+
+	uint64_t rate = urrc->rate_str ? strtoul(urrc->rate_str, NULL, 10) : 0;
+	if (!rate) {
+		uwsgi_log("invalid ratelimit route syntax: you need to specify a rate\n");
+		exit(1);
+	}
+	uint64_t period = urrc->period_str ? strtoul(urrc->period_str, NULL, 10) : 1;
+	if (!period) period = 1;
+	urrc->interval = (period * 1000000) / rate;
+	if (!urrc->interval) urrc->interval = 1;
+
+	urrc->burst = urrc->burst_str ? strtoul(urrc->burst_str, NULL, 10) : rate;
+	if (!urrc->burst) urrc->burst = 1;
+
+	if (urrc->sharedarea_str) {
+		urrc->sharedarea = atoi(urrc->sharedarea_str);
+	}
+
+	ur->data2 = urrc;
+	return 0;
+}
+
+// sharedareas do not exist yet while parsing the routes
+static int router_ratelimit_check() {
+	struct uwsgi_route *routes = uwsgi.routes;
+	while (routes) {
+		if (routes->func == uwsgi_routing_func_ratelimit) {
+			struct uwsgi_router_ratelimit_conf *urrc = (struct uwsgi_router_ratelimit_conf *) routes->data2;
+			int64_t foo;
+			if (uwsgi_sharedarea_hashmap_get(urrc->sharedarea, "", 0, &foo) < 0) {
+				uwsgi_log("[ratelimit] sharedarea %d is not a hashmap, use --sharedarea pages=N,hashmap=<max key size>\n", urrc->sharedarea);
+				exit(1);
+			}
+		}
+		routes = routes->next;
+	}
+	return 0;
+}
+
+static void router_ratelimit_register() {
+	uwsgi_register_router("ratelimit", uwsgi_router_ratelimit);
+}
+
+struct uwsgi_plugin router_ratelimit_plugin = {
+	.name = "router_ratelimit",
+	.on_load = router_ratelimit_register,
+	.init = router_ratelimit_check,
+};
+
+#else
+struct uwsgi_plugin router_ratelimit_plugin = {
+	.name = "router_ratelimit",
+};
+#endif
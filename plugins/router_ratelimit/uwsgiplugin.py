@@ -0,0 +1,6 @@
+NAME = 'router_ratelimit'
+
+CFLAGS = []
+LDFLAGS = []
+LIBS = []
+GCC_LIST = ['router_ratelimit']
@@ -17,7 +17,7 @@ static int uwsgi_routing_func_uwsgi_simple(struct wsgi_request *wsgi_req, struct
 		char *ptr = uwsgi_req_append(wsgi_req, "UWSGI_APPID", 11, ur->data2, ur->data2_len);
 		if (ptr) {
 			// fill iovec
-			if (wsgi_req->var_cnt + 2 < uwsgi.vec_size - (4 + 1)) {
+			if (!uwsgi_req_hvec_room(wsgi_req, 2)) {
 				wsgi_req->hvec[wsgi_req->var_cnt].iov_base = ptr - (2 + 11);
                         	wsgi_req->hvec[wsgi_req->var_cnt].iov_len = 11;	
                 		wsgi_req->var_cnt++;
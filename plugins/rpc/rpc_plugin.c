@@ -19,6 +19,7 @@ extern struct uwsgi_server uwsgi;
 	3 -> set xmlrpc wrapper (requires libxml2)
 	4 -> set jsonrpc wrapper (requires libjansson)
 	5 -> used in uwsgi response to signal the response is a uwsgi dictionary followed by the body (the dictionary must contains a CONTENT_LENGTH key)
+	6 -> rpc stream: multiple (pipelined) calls on a persistent connection (see core/rpc.c)
 
 */
 
@@ -128,6 +129,70 @@ static int uwsgi_rpc_xmlrpc(struct wsgi_request *wsgi_req, xmlDoc *doc, char **a
 }
 #endif
 
+// serve the calls of a rpc stream until the client closes the connection
+static int uwsgi_rpc_stream(struct wsgi_request *wsgi_req) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	struct uwsgi_buffer *out = uwsgi_buffer_new(uwsgi.page_size);
+	char *argv[UMAX8];
+	uint16_t argvs[UMAX8];
+
+	if (wsgi_req->proto_parser_remains > 0) {
+		if (uwsgi_buffer_append(ub, wsgi_req->proto_parser_remains_buf, wsgi_req->proto_parser_remains)) goto end;
+		wsgi_req->proto_parser_remains = 0;
+	}
+
+	for (;;) {
+		size_t pos = 0, needed = 0;
+		out->pos = 0;
+		while (ub->pos - pos >= 8) {
+			uint8_t *frame = (uint8_t *) ub->buf + pos;
+			if (frame[0] != 173) {
+				uwsgi_log("invalid frame in RPC stream\n");
+				goto end;
+			}
+			size_t size = frame[1] | (frame[2] << 8);
+			if (ub->pos - pos < 8 + size) {
+				needed = 8 + size;
+				break;
+			}
+			uint8_t argc = 0xff;
+			if (uwsgi_parse_array((char *) frame + 8, size, argv, argvs, &argc) || argc == 0) {
+				uwsgi_log("invalid RPC request in RPC stream\n");
+				goto end;
+			}
+			char *response_buf = NULL;
+			uint64_t content_len = uwsgi_rpc(argv[0], argc - 1, argv + 1, argvs + 1, &response_buf);
+			if (content_len > 0xffffffff) content_len = 0;
+			if (uwsgi_buffer_u8(out, 173) || uwsgi_buffer_u16le(out, 0) || uwsgi_buffer_u8(out, response_buf ? 1 : 0)
+				|| uwsgi_buffer_append(out, (char *) frame + 4, 4) || uwsgi_buffer_u32le(out, response_buf ? content_len : 0)
+				|| (response_buf && uwsgi_buffer_append(out, response_buf, content_len))) {
+				if (response_buf) free(response_buf);
+				goto end;
+			}
+			if (response_buf) free(response_buf);
+			pos += 8 + size;
+		}
+
+		if (out->pos > 0 && uwsgi_write_true_nb(wsgi_req->fd, out->buf, out->pos, uwsgi.socket_timeout)) {
+			goto end;
+		}
+
+		memmove(ub->buf, ub->buf + pos, ub->pos - pos);
+		ub->pos -= pos;
+
+		if (needed > ub->pos && uwsgi_buffer_ensure(ub, needed - ub->pos)) goto end;
+		if (uwsgi_buffer_ensure(ub, 4096)) goto end;
+		ssize_t rlen = uwsgi_read_true_nb(wsgi_req->fd, ub->buf + ub->pos, ub->len - ub->pos, uwsgi.socket_timeout);
+		if (rlen <= 0) break;
+		ub->pos += rlen;
+	}
+
+end:
+	uwsgi_buffer_destroy(ub);
+	uwsgi_buffer_destroy(out);
+	return UWSGI_OK;
+}
+
 static int uwsgi_rpc_request(struct wsgi_request *wsgi_req) {
 
 	// this is the list of args
@@ -141,6 +206,10 @@ static int uwsgi_rpc_request(struct wsgi_request *wsgi_req) {
 	// response size
 	size_t content_len = 0;
 
+	if (wsgi_req->uh->modifier2 == UWSGI_RPC_STREAM) {
+		return uwsgi_rpc_stream(wsgi_req);
+	}
+
 	/* Standard RPC request */
         if (!wsgi_req->len) {
                 uwsgi_log("Empty RPC request. skip.\n");
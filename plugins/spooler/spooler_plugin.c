@@ -8,6 +8,90 @@ this plugin, allows remote spooling of jobs
 
 extern struct uwsgi_server uwsgi;
 
+/*
+	a spooler stream (see core/spooler.c): frames are parsed as they arrive, and the acks
+	of all the frames available in the read buffer are sent back with a single write.
+	The stream ends when the client closes the connection (or after --socket-timeout of inactivity)
+*/
+static int uwsgi_request_spooler_stream(struct wsgi_request *wsgi_req) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(64 * 1024);
+	struct uwsgi_buffer *acks = uwsgi_buffer_new(uwsgi.page_size);
+	uint64_t tasks = 0, failed = 0;
+
+	// frames sent with the stream request
+	if (wsgi_req->proto_parser_remains > 0) {
+		if (uwsgi_buffer_append(ub, wsgi_req->proto_parser_remains_buf, wsgi_req->proto_parser_remains)) goto end;
+		wsgi_req->proto_parser_remains = 0;
+	}
+
+	for (;;) {
+		// parse the complete frames
+		size_t pos = 0, needed = 0;
+		acks->pos = 0;
+		while (ub->pos - pos >= 4) {
+			uint8_t *frame = (uint8_t *) ub->buf + pos;
+			if (frame[0] != UWSGI_MODIFIER_SPOOL_REQUEST) {
+				uwsgi_log("[uwsgi-spooler] invalid frame in spooler stream\n");
+				goto end;
+			}
+			size_t vars_len = frame[1] | (frame[2] << 8);
+			size_t frame_len = 4 + vars_len;
+			size_t body_len = 0;
+			if (frame[3] & UWSGI_SPOOLER_STREAM_BODY) {
+				if (ub->pos - pos < frame_len + 4) {
+					needed = frame_len + 4;
+					break;
+				}
+				uint8_t *bl = frame + frame_len;
+				body_len = bl[0] | (bl[1] << 8) | (bl[2] << 16) | ((uint32_t) bl[3] << 24);
+				if (uwsgi.limit_post && body_len > (size_t) uwsgi.limit_post) {
+					uwsgi_log("[uwsgi-spooler] task body in spooler stream too big (%llu bytes)\n", (unsigned long long) body_len);
+					goto end;
+				}
+				frame_len += 4;
+			}
+			if (ub->pos - pos < frame_len + body_len) {
+				needed = frame_len + body_len;
+				break;
+			}
+
+			char *filename = uwsgi_spool_request(NULL, (char *) frame + 4, vars_len, body_len ? (char *) frame + frame_len : NULL, body_len);
+			struct uwsgi_header uh;
+			uh.modifier1 = 255;
+			uh._pktsize = 0;
+			uh.modifier2 = filename ? 1 : 0;
+			if (filename) free(filename);
+			else failed++;
+			tasks++;
+			if (uwsgi_buffer_append(acks, (char *) &uh, 4)) goto end;
+			pos += frame_len + body_len;
+		}
+
+		if (acks->pos > 0 && uwsgi_write_true_nb(wsgi_req->fd, acks->buf, acks->pos, uwsgi.socket_timeout)) {
+			uwsgi_log("[uwsgi-spooler] unable to send acks to the spooler stream client\n");
+			goto end;
+		}
+
+		// move the partial frame at the start of the buffer
+		memmove(ub->buf, ub->buf + pos, ub->pos - pos);
+		ub->pos -= pos;
+
+		// make room for the whole partial task
+		if (needed > ub->pos && uwsgi_buffer_ensure(ub, needed - ub->pos)) goto end;
+		if (uwsgi_buffer_ensure(ub, 4096)) goto end;
+		ssize_t rlen = uwsgi_read_true_nb(wsgi_req->fd, ub->buf + ub->pos, ub->len - ub->pos, uwsgi.socket_timeout);
+		if (rlen <= 0) break;
+		ub->pos += rlen;
+	}
+
+end:
+	if (!uwsgi.spooler_quiet)
+		uwsgi_log("[uwsgi-spooler] spooler stream closed after %llu tasks (%llu failed)\n", (unsigned long long) tasks, (unsigned long long) failed);
+	uwsgi_buffer_destroy(ub);
+	uwsgi_buffer_destroy(acks);
+	return UWSGI_OK;
+}
+
 int uwsgi_request_spooler(struct wsgi_request *wsgi_req) {
 
 	struct uwsgi_header uh;
@@ -23,6 +107,10 @@ int uwsgi_request_spooler(struct wsgi_request *wsgi_req) {
                 return -1;
         }
 
+	if (wsgi_req->uh->modifier2 == UWSGI_SPOOLER_STREAM) {
+		return uwsgi_request_spooler_stream(wsgi_req);
+	}
+
         char *filename = uwsgi_spool_request(NULL, wsgi_req->buffer, wsgi_req->uh->_pktsize, NULL, 0);
         uh.modifier1 = 255;
         uh._pktsize = 0;
@@ -8,6 +8,9 @@ extern struct uwsgi_server uwsgi;
 
 	uWSGI server side includes implementation
 
+	templates are parsed once and cached (with the included files) by every process
+	until they change on disk (see --ssi-cache-items)
+
 */
 
 
@@ -27,6 +30,51 @@ struct uwsgi_ssi_cmd {
 
 struct uwsgi_ssi_cmd *uwsgi_ssi_commands = NULL;
 
+// a parsed template is a list of literal chunks and (already split) commands
+struct uwsgi_ssi_segment {
+	// NULL for literal text
+	struct uwsgi_ssi_cmd *usc;
+	struct uwsgi_ssi_arg argv[UWSGI_SSI_MAX_ARGS];
+	int argc;
+	// literal text (in the text buffer)
+	size_t off;
+	size_t len;
+};
+
+struct uwsgi_ssi_template {
+	struct uwsgi_buffer *text;
+	struct uwsgi_ssi_segment *segments;
+	int segments_cnt;
+};
+
+struct uwsgi_ssi_file {
+	char *filename;
+	time_t mtime;
+	off_t size;
+	ino_t ino;
+	// the args of the template point here
+	struct uwsgi_buffer *content;
+	struct uwsgi_ssi_template *tpl;
+	int refcnt;
+	int detached;
+	struct uwsgi_ssi_file *next;
+};
+
+static struct uwsgi_ssi {
+	int cache_items;
+	struct uwsgi_ssi_file *files;
+	int files_cnt;
+	pthread_mutex_t lock;
+} ussi = {
+	.cache_items = 64,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct uwsgi_option uwsgi_ssi_options[] = {
+	{"ssi-cache-items", required_argument, 0, "set the max number of parsed templates and included files cached by each process (default 64, 0 disables caching)", uwsgi_opt_set_int, &ussi.cache_items, 0},
+	UWSGI_END_OF_OPTIONS
+};
+
 static struct uwsgi_ssi_cmd* uwsgi_ssi_get_cmd(char *name, size_t name_len) {
 	struct uwsgi_ssi_cmd *usc = uwsgi_ssi_commands;
 	while(usc) {
@@ -124,11 +172,8 @@ static int uwsgi_ssi_parse_args(struct wsgi_request *wsgi_req, char *buf, size_t
 	return 0;
 }
 
-static struct uwsgi_buffer *uwsgi_ssi_parse_command(struct wsgi_request *wsgi_req, char *buf, size_t len) {
-
-	// storage for arguments
-	struct uwsgi_ssi_arg argv[UWSGI_SSI_MAX_ARGS];
-	int argc = 0;
+// split a command in its name and args
+static struct uwsgi_ssi_cmd *uwsgi_ssi_compile_command(char *buf, size_t len, struct uwsgi_ssi_arg *argv, int *argc) {
 
 	// first remove white spaces from the begin and the end
 	char *cmd = buf;
@@ -170,7 +215,7 @@ static struct uwsgi_buffer *uwsgi_ssi_parse_command(struct wsgi_request *wsgi_re
 	struct uwsgi_ssi_cmd *usc = uwsgi_ssi_get_cmd(ssi_cmd, ssi_cmd_len);
 	if (!usc) return NULL ;
 
-	if (!found) goto run;
+	if (!found) return usc;
 
 	// now split the args
 	char *cmd_args = cmd + ssi_cmd_len + 1;
@@ -186,20 +231,49 @@ static struct uwsgi_buffer *uwsgi_ssi_parse_command(struct wsgi_request *wsgi_re
 		}
 	}
 
-	if (uwsgi_ssi_parse_args(wsgi_req, cmd_args, cmd_args_len, argv, &argc)) {
+	if (uwsgi_ssi_parse_args(NULL, cmd_args, cmd_args_len, argv, argc)) {
 		return NULL;
 	}
 
-run:
-	return usc->func(wsgi_req, argv, argc);
+	return usc;
+}
+
+static int uwsgi_ssi_add_segment(struct uwsgi_ssi_template *tpl, struct uwsgi_ssi_cmd *usc, size_t off, size_t len) {
+	struct uwsgi_ssi_segment *segments = realloc(tpl->segments, sizeof(struct uwsgi_ssi_segment) * (tpl->segments_cnt + 1));
+	if (!segments) {
+		uwsgi_error("uwsgi_ssi_add_segment()/realloc()");
+		return -1;
+	}
+	tpl->segments = segments;
+	struct uwsgi_ssi_segment *seg = &tpl->segments[tpl->segments_cnt];
+	memset(seg, 0, sizeof(struct uwsgi_ssi_segment));
+	seg->usc = usc;
+	seg->off = off;
+	seg->len = len;
+	tpl->segments_cnt++;
+	return 0;
+}
+
+static void uwsgi_ssi_template_destroy(struct uwsgi_ssi_template *tpl) {
+	if (tpl->text) uwsgi_buffer_destroy(tpl->text);
+	free(tpl->segments);
+	free(tpl);
 }
 
-static struct uwsgi_buffer *uwsgi_ssi_parse(struct wsgi_request *wsgi_req, char *buf, size_t len) {
+/*
+	parse a template in a list of literal text and commands (with their args pointing to buf),
+	the template can be rendered multiple times with uwsgi_ssi_render()
+*/
+static struct uwsgi_ssi_template *uwsgi_ssi_compile(char *buf, size_t len) {
 	size_t i;
 	uint8_t status = 0;
 	char *cmd = NULL;
 	size_t cmd_len = 0;
+	struct uwsgi_ssi_template *tpl = uwsgi_calloc(sizeof(struct uwsgi_ssi_template));
+	// the literal text of the whole template
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(len);
+	tpl->text = ub;
+	size_t literal = 0;
 	// parsing status 0[null] 1[<] 2[!] 3[-] 4[-] 5[#/-] 6[-] 7[>]
         // on status 6-7-8 the reset action come back to 5 instead of 0 
 	for(i=0;i<len;i++) {
@@ -275,13 +349,19 @@ static struct uwsgi_buffer *uwsgi_ssi_parse(struct wsgi_request *wsgi_req, char
 				status = 5;
 				if (buf[i] == '>') {
 					status = 0;
-					struct uwsgi_buffer *ub_cmd = uwsgi_ssi_parse_command(wsgi_req, cmd, cmd_len);
-					if (ub_cmd) {
-						if (uwsgi_buffer_append(ub, ub_cmd->buf, ub_cmd->pos)) {
-							uwsgi_buffer_destroy(ub_cmd);
-							goto error;
+					struct uwsgi_ssi_arg argv[UWSGI_SSI_MAX_ARGS];
+					int argc = 0;
+					struct uwsgi_ssi_cmd *usc = cmd ? uwsgi_ssi_compile_command(cmd, cmd_len, argv, &argc) : NULL;
+					// unknown commands are skipped
+					if (usc) {
+						if (ub->pos > literal) {
+							if (uwsgi_ssi_add_segment(tpl, NULL, literal, ub->pos - literal)) goto error;
+							literal = ub->pos;
 						}
-						uwsgi_buffer_destroy(ub_cmd);
+						if (uwsgi_ssi_add_segment(tpl, usc, 0, 0)) goto error;
+						struct uwsgi_ssi_segment *seg = &tpl->segments[tpl->segments_cnt-1];
+						memcpy(seg->argv, argv, sizeof(struct uwsgi_ssi_arg) * argc);
+						seg->argc = argc;
 					}
 					cmd = NULL;
 					cmd_len = 0;	
@@ -295,6 +375,35 @@ static struct uwsgi_buffer *uwsgi_ssi_parse(struct wsgi_request *wsgi_req, char
 		}
 	}
 
+	if (ub->pos > literal) {
+		if (uwsgi_ssi_add_segment(tpl, NULL, literal, ub->pos - literal)) goto error;
+	}
+
+	return tpl;
+
+error:
+	uwsgi_ssi_template_destroy(tpl);
+	return NULL;
+}
+
+static struct uwsgi_buffer *uwsgi_ssi_render(struct wsgi_request *wsgi_req, struct uwsgi_ssi_template *tpl) {
+	int i;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(tpl->text->pos + 1);
+	for(i=0;i<tpl->segments_cnt;i++) {
+		struct uwsgi_ssi_segment *seg = &tpl->segments[i];
+		if (!seg->usc) {
+			if (uwsgi_buffer_append(ub, tpl->text->buf + seg->off, seg->len)) goto error;
+			continue;
+		}
+		struct uwsgi_buffer *ub_cmd = seg->usc->func(wsgi_req, seg->argv, seg->argc);
+		if (ub_cmd) {
+			if (uwsgi_buffer_append(ub, ub_cmd->buf, ub_cmd->pos)) {
+				uwsgi_buffer_destroy(ub_cmd);
+				goto error;
+			}
+			uwsgi_buffer_destroy(ub_cmd);
+		}
+	}
 	return ub;
 
 error:
@@ -302,6 +411,104 @@ error:
 	return NULL;
 }
 
+/*
+	per-process cache of files (included fragments and parsed templates), validated
+	with stat() (mtime, size and inode) on every access.
+	Entries replaced while in use are freed by the last user.
+*/
+static void uwsgi_ssi_file_free(struct uwsgi_ssi_file *usf) {
+	if (usf->tpl) uwsgi_ssi_template_destroy(usf->tpl);
+	if (usf->content) uwsgi_buffer_destroy(usf->content);
+	free(usf->filename);
+	free(usf);
+}
+
+// unlink (and free if not in use) an entry, must be called with the lock held
+static void uwsgi_ssi_file_detach(struct uwsgi_ssi_file *usf) {
+	struct uwsgi_ssi_file *prev = NULL, *cur = ussi.files;
+	while(cur) {
+		if (cur == usf) {
+			if (prev) prev->next = cur->next;
+			else ussi.files = cur->next;
+			ussi.files_cnt--;
+			break;
+		}
+		prev = cur;
+		cur = cur->next;
+	}
+	usf->detached = 1;
+	if (!usf->refcnt) uwsgi_ssi_file_free(usf);
+}
+
+static struct uwsgi_ssi_file *uwsgi_ssi_file_get(char *filename, int compile) {
+	struct stat st;
+	if (stat(filename, &st)) return NULL;
+
+	pthread_mutex_lock(&ussi.lock);
+	struct uwsgi_ssi_file *usf = ussi.files;
+	while(usf) {
+		if (!strcmp(usf->filename, filename)) {
+			if (usf->mtime == st.st_mtime && usf->size == st.st_size && usf->ino == st.st_ino) {
+				goto found;
+			}
+			uwsgi_ssi_file_detach(usf);
+			break;
+		}
+		usf = usf->next;
+	}
+
+	struct uwsgi_buffer *content = uwsgi_buffer_from_file(filename);
+	if (!content) {
+		pthread_mutex_unlock(&ussi.lock);
+		return NULL;
+	}
+	usf = uwsgi_calloc(sizeof(struct uwsgi_ssi_file));
+	usf->filename = uwsgi_str(filename);
+	usf->mtime = st.st_mtime;
+	usf->size = st.st_size;
+	usf->ino = st.st_ino;
+	usf->content = content;
+	if (ussi.files_cnt < ussi.cache_items) {
+		usf->next = ussi.files;
+		ussi.files = usf;
+		ussi.files_cnt++;
+	}
+	else {
+		// not cached, freed on release
+		usf->detached = 1;
+	}
+
+found:
+	if (compile && !usf->tpl) {
+		usf->tpl = uwsgi_ssi_compile(usf->content->buf, usf->content->pos);
+		if (!usf->tpl) {
+			if (!usf->detached) uwsgi_ssi_file_detach(usf);
+			else uwsgi_ssi_file_free(usf);
+			pthread_mutex_unlock(&ussi.lock);
+			return NULL;
+		}
+	}
+	usf->refcnt++;
+	pthread_mutex_unlock(&ussi.lock);
+	return usf;
+}
+
+static void uwsgi_ssi_file_release(struct uwsgi_ssi_file *usf) {
+	pthread_mutex_lock(&ussi.lock);
+	usf->refcnt--;
+	if (usf->detached && !usf->refcnt) uwsgi_ssi_file_free(usf);
+	pthread_mutex_unlock(&ussi.lock);
+}
+
+// render a ssi file
+static struct uwsgi_buffer *uwsgi_ssi_file(struct wsgi_request *wsgi_req, char *filename) {
+	struct uwsgi_ssi_file *usf = uwsgi_ssi_file_get(filename, 1);
+	if (!usf) return NULL;
+	struct uwsgi_buffer *ub = uwsgi_ssi_render(wsgi_req, usf->tpl);
+	uwsgi_ssi_file_release(usf);
+	return ub;
+}
+
 static int uwsgi_ssi_request(struct wsgi_request *wsgi_req) {
 	struct uwsgi_buffer *ub = NULL;
 
@@ -326,15 +533,8 @@ static int uwsgi_ssi_request(struct wsgi_request *wsgi_req) {
 		return UWSGI_OK;
 	}
 
-	struct uwsgi_buffer *ub_ssi = uwsgi_buffer_from_file(real_filename);
+	ub = uwsgi_ssi_file(wsgi_req, real_filename);
 	free(real_filename);
-	if (!ub_ssi) {
-		uwsgi_500(wsgi_req);
-		return UWSGI_OK;
-	}
-
-	ub = uwsgi_ssi_parse(wsgi_req, ub_ssi->buf, ub_ssi->pos);
-	uwsgi_buffer_destroy(ub_ssi);
 	if (!ub) {
                	uwsgi_500(wsgi_req);
 		return UWSGI_OK;
@@ -422,9 +622,16 @@ static struct uwsgi_buffer *ssi_cmd_include(struct wsgi_request *wsgi_req, struc
 
 	char *filename = uwsgi_concat2n(var, var_len, "", 0);
 
-	struct uwsgi_buffer *ub = uwsgi_buffer_from_file(filename);
-
+	struct uwsgi_ssi_file *usf = uwsgi_ssi_file_get(filename, 0);
 	free(filename);
+	if (!usf) return NULL;
+
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(usf->content->pos + 1);
+	if (uwsgi_buffer_append(ub, usf->content->buf, usf->content->pos)) {
+		uwsgi_buffer_destroy(ub);
+		ub = NULL;
+	}
+	uwsgi_ssi_file_release(usf);
 
 	return ub;
 }
@@ -471,12 +678,8 @@ static int uwsgi_routing_func_ssi(struct wsgi_request *wsgi_req, struct uwsgi_ro
         struct uwsgi_buffer *ub_filename = uwsgi_routing_translate(wsgi_req, ur, *subject, *subject_len, ur->data, ur->data_len);
         if (!ub_filename) goto end;
 
-	struct uwsgi_buffer *ub_ssi = uwsgi_buffer_from_file(ub_filename->buf);
+	ub = uwsgi_ssi_file(wsgi_req, ub_filename->buf);
 	uwsgi_buffer_destroy(ub_filename);
-	if (!ub_ssi) goto end;
-
-	ub = uwsgi_ssi_parse(wsgi_req, ub_ssi->buf, ub_ssi->pos);
-	uwsgi_buffer_destroy(ub_ssi);
 	if (!ub) goto end;
 
         if (uwsgi_response_prepare_headers(wsgi_req, "200 OK", 6)) goto end;
@@ -519,6 +722,7 @@ static void uwsgi_ssi_log(struct wsgi_request *wsgi_req) {
 struct uwsgi_plugin ssi_plugin = {
 	.name = "ssi",
 	.modifier1 = 19,
+	.options = uwsgi_ssi_options,
 	.init = uwsgi_ssi_init,
 	.request = uwsgi_ssi_request,
 	.after_request = uwsgi_ssi_log,
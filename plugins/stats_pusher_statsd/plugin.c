@@ -12,6 +12,8 @@ example:
 
 it exports values exposed by the metric subsystem
 
+metrics are batched (newline separated) in datagrams of at most --stats-pusher-mtu bytes
+
 */
 
 extern struct uwsgi_server uwsgi;
@@ -34,6 +36,7 @@ struct statsd_node {
 	socklen_t addr_len;
 	char *prefix;
 	uint16_t prefix_len;
+	struct uwsgi_stats_pusher_batch *batch;
 };
 
 static int statsd_send_metric(struct uwsgi_buffer *ub, struct uwsgi_stats_pusher_instance *uspi, char *metric, size_t metric_len, int64_t value, char type[2]) {
@@ -47,13 +50,7 @@ static int statsd_send_metric(struct uwsgi_buffer *ub, struct uwsgi_stats_pusher
         if (uwsgi_buffer_num64(ub, value)) return -1;
 	if (uwsgi_buffer_append(ub, type, 2)) return -1;
 
-        if (sendto(sn->fd, ub->buf, ub->pos, 0, (struct sockaddr *) &sn->addr.sa, sn->addr_len) < 0) {
-			if (errno != EAGAIN)	// drop if we were to block
-				uwsgi_error("statsd_send_metric()/sendto()");
-        }
-
-        return 0;
-
+	return uwsgi_stats_pusher_batch_add(sn->batch, ub->buf, ub->pos);
 }
 
 
@@ -82,34 +79,41 @@ static void stats_pusher_statsd(struct uwsgi_stats_pusher_instance *uspi, time_t
         uwsgi_socket_nb(sn->fd);
 
 		if (comma) *comma = ',';
+		sn->batch = uwsgi_stats_pusher_batch_new(sn->fd, &sn->addr.sa, sn->addr_len, uwsgi.stats_pusher_mtu, 0);
 		uspi->data = sn;
 		uspi->configured = 1;
 	}
 
-	// we use the same buffer for all of the packets
+	struct statsd_node *sn = (struct statsd_node *) uspi->data;
+	// we use the same buffer for all of the records
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
 	struct uwsgi_metric *um = uwsgi.metrics;
+	int pos = 0;
 	while(um) {
 		if (u_stats_pusher_statsd.no_workers && !uwsgi_starts_with(um->name, um->name_len, "worker.", 7)) {
 		    goto next;
 		}
 		uwsgi_rlock(uwsgi.metrics_lock);
+		int64_t value = *um->value;
+		uwsgi_rwunlock(uwsgi.metrics_lock);
+		if (!uwsgi_stats_pusher_changed(uspi, pos, value)) goto next;
 		// ignore return value
 		if (u_stats_pusher_statsd.all_gauges || um->type == UWSGI_METRIC_GAUGE) {
-			statsd_send_metric(ub, uspi, um->name, um->name_len, *um->value, "|g");
+			statsd_send_metric(ub, uspi, um->name, um->name_len, value, "|g");
 		}
 		else {
-			statsd_send_metric(ub, uspi, um->name, um->name_len, *um->value, "|c");
+			statsd_send_metric(ub, uspi, um->name, um->name_len, value, "|c");
 		}
-		uwsgi_rwunlock(uwsgi.metrics_lock);
 		if (um->reset_after_push){
 			uwsgi_wlock(uwsgi.metrics_lock);
 			*um->value = um->initial_value;
 			uwsgi_rwunlock(uwsgi.metrics_lock);
 		}
 		next:
+		pos++;
 		um = um->next;
 	}
+	uwsgi_stats_pusher_batch_flush(sn->batch);
 	uwsgi_buffer_destroy(ub);
 }
 
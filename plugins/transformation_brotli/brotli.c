@@ -0,0 +1,157 @@
+#include <uwsgi.h>
+
+extern struct uwsgi_server uwsgi;
+
+#if defined(UWSGI_ROUTING)
+
+#include <brotli/encode.h>
+
+/*
+
+	brotli transformations add content-encoding to your headers and changes the final size !!!
+
+	remember to fix the content_length (or use chunked encoding) !!!
+
+	the route argument is the compression quality (0-11, default 5)
+
+*/
+
+#define UWSGI_BROTLI_DEFAULT_QUALITY 5
+
+struct uwsgi_transformation_brotli {
+	BrotliEncoderState *state;
+	uint8_t header;
+	// for metrics
+	size_t len;
+	size_t out;
+	uint64_t usecs;
+};
+
+static struct uwsgi_transformation_metrics brotli_metrics;
+
+// compress the whole chunk, appending the compressed data to out
+static int brotli_compress(BrotliEncoderState *state, struct uwsgi_buffer *ub, struct uwsgi_buffer *out, BrotliEncoderOperation op) {
+	const uint8_t *next_in = (const uint8_t *) ub->buf;
+	size_t avail_in = ub->pos;
+
+	for(;;) {
+		if (uwsgi_buffer_ensure(out, uwsgi.page_size)) goto error;
+		uint8_t *next_out = (uint8_t *) out->buf + out->pos;
+		size_t avail_out = out->len - out->pos;
+		if (!BrotliEncoderCompressStream(state, op, &avail_in, &next_in, &avail_out, &next_out, NULL)) goto error;
+		out->pos = (char *) next_out - out->buf;
+		if (op == BROTLI_OPERATION_FINISH) {
+			if (BrotliEncoderIsFinished(state)) break;
+		}
+		else if (avail_in == 0 && !BrotliEncoderHasMoreOutput(state)) {
+			break;
+		}
+	}
+	return 0;
+
+error:
+	return -1;
+}
+
+// close the stream, replacing the content of the (final) chunk with the compressed data
+static int brotli_compress_end(BrotliEncoderState *state, struct uwsgi_buffer *ub) {
+	struct uwsgi_buffer *out = uwsgi_buffer_new(uwsgi.page_size);
+	if (brotli_compress(state, ub, out, BROTLI_OPERATION_FINISH)) {
+		uwsgi_buffer_destroy(out);
+		return -1;
+	}
+	uwsgi_buffer_map(ub, out->buf, out->pos);
+	out->buf = NULL;
+	uwsgi_buffer_destroy(out);
+	return 0;
+}
+
+static int transform_brotli(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_brotli *utb = (struct uwsgi_transformation_brotli *) ut->data;
+	struct uwsgi_buffer *ub = ut->chunk;
+
+	if (ut->is_final) {
+		int ret = 0;
+		if (utb->header) {
+			uint64_t start = uwsgi_micros();
+			ret = brotli_compress_end(utb->state, ub);
+			if (!ret) {
+				uwsgi_transformation_metrics_add(&brotli_metrics, utb->len, utb->out + ub->pos, utb->usecs + (uwsgi_micros() - start));
+			}
+		}
+		BrotliEncoderDestroyInstance(utb->state);
+		free(utb);
+		return ret;
+	}
+
+	if (ub->pos == 0) {
+		// Don't try to compress empty responses.
+		return 0;
+	}
+
+	// flush every chunk, so the client gets the data as soon as possible
+	uint64_t start = uwsgi_micros();
+	utb->len += ub->pos;
+	// the compressed data goes to the spare buffer of the request
+	struct uwsgi_buffer *out = uwsgi_transformation_spare(wsgi_req, ut);
+	if (brotli_compress(utb->state, ub, out, BROTLI_OPERATION_FLUSH)) return -1;
+	ut->chunk = out;
+	utb->usecs += uwsgi_micros() - start;
+	utb->out += out->pos;
+	if (!utb->header) {
+		// do not check for errors !!!
+		uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "br", 2);
+		utb->header = 1;
+	}
+
+	return 0;
+}
+
+static int uwsgi_routing_func_brotli(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
+	struct uwsgi_transformation_brotli *utb = uwsgi_calloc(sizeof(struct uwsgi_transformation_brotli));
+	utb->state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+	if (!utb->state) {
+		free(utb);
+		return UWSGI_ROUTE_BREAK;
+	}
+	BrotliEncoderSetParameter(utb->state, BROTLI_PARAM_QUALITY, ur->custom);
+	struct uwsgi_transformation *ut = uwsgi_add_transformation(wsgi_req, transform_brotli, utb);
+	ut->can_stream = 1;
+	// this is the transformation clearing the memory
+	ut = uwsgi_add_transformation(wsgi_req, transform_brotli, utb);
+	ut->is_final = 1;
+	return UWSGI_ROUTE_NEXT;
+}
+
+static int uwsgi_router_brotli(struct uwsgi_route *ur, char *args) {
+	ur->func = uwsgi_routing_func_brotli;
+	ur->custom = UWSGI_BROTLI_DEFAULT_QUALITY;
+	if (args && *args) {
+		ur->custom = atoi(args);
+		if (ur->custom > BROTLI_MAX_QUALITY) {
+			uwsgi_log("invalid brotli route quality: %s\n", args);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void router_brotli_register(void) {
+	uwsgi_register_router("brotli", uwsgi_router_brotli);
+}
+
+static int transformation_brotli_init(void) {
+	uwsgi_transformation_metrics_register(&brotli_metrics, "transformation_brotli", "4.102");
+	return 0;
+}
+
+struct uwsgi_plugin transformation_brotli_plugin = {
+	.name = "transformation_brotli",
+	.on_load = router_brotli_register,
+	.init = transformation_brotli_init,
+};
+#else
+struct uwsgi_plugin transformation_brotli_plugin = {
+	.name = "transformation_brotli",
+};
+#endif
@@ -0,0 +1,6 @@
+NAME = 'transformation_brotli'
+
+CFLAGS = []
+LDFLAGS = []
+LIBS = ['-lbrotlienc']
+GCC_LIST = ['brotli']
@@ -8,6 +8,8 @@
 
 	remember to fix the content_length (or use chunked encoding) !!!
 
+	the route argument is the compression level (1-9, default: zlib default)
+
 */
 
 struct uwsgi_transformation_gzip {
@@ -15,18 +17,27 @@ struct uwsgi_transformation_gzip {
 	uint32_t crc32;
 	size_t len;
 	uint8_t header;
+	// compressed bytes and microseconds spent compressing (for metrics)
+	size_t out;
+	uint64_t usecs;
 };
 
 extern char gzheader[];
 
+static struct uwsgi_transformation_metrics gzip_metrics;
+
 static int transform_gzip(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
 	struct uwsgi_transformation_gzip *utgz = (struct uwsgi_transformation_gzip *) ut->data;
 	struct uwsgi_buffer *ub = ut->chunk;
 
 	if (ut->is_final) {
-		if (utgz->len > 0 && uwsgi_gzip_fix(&utgz->z, utgz->crc32, ub, utgz->len)) {
-			free(utgz);
-			return -1;
+		if (utgz->len > 0) {
+			uint64_t start = uwsgi_micros();
+			if (uwsgi_gzip_fix(&utgz->z, utgz->crc32, ub, utgz->len)) {
+				free(utgz);
+				return -1;
+			}
+			uwsgi_transformation_metrics_add(&gzip_metrics, utgz->len, utgz->out + ub->pos, utgz->usecs + (uwsgi_micros() - start));
 		}
 		free(utgz);
 		return 0;
@@ -37,19 +48,23 @@ static int transform_gzip(struct wsgi_request *wsgi_req, struct uwsgi_transforma
 		return 0;
 	}
 
-	size_t dlen = 0;
-	char *gzipped = uwsgi_gzip_chunk(&utgz->z, &utgz->crc32, ub->buf, ub->pos, &dlen);
-	if (!gzipped) return -1;
-	utgz->len += ub->pos;
-	uwsgi_buffer_map(ub, gzipped, dlen);
+	// the compressed data goes to the spare buffer of the request
+	struct uwsgi_buffer *out = uwsgi_transformation_spare(wsgi_req, ut);
 	if (!utgz->header) {
 		// do not check for errors !!!
 		uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "gzip", 4);
 		utgz->header = 1;
-		if (uwsgi_buffer_insert(ub, 0, gzheader, 10)) {
+		if (uwsgi_buffer_append(out, gzheader, 10)) {
 			return -1;
 		}
 	}
+	uint64_t start = uwsgi_micros();
+	uwsgi_crc32(&utgz->crc32, ub->buf, ub->pos);
+	if (uwsgi_deflate_buffer(&utgz->z, ub->buf, ub->pos, out)) return -1;
+	utgz->usecs += uwsgi_micros() - start;
+	utgz->len += ub->pos;
+	utgz->out += out->pos;
+	ut->chunk = out;
 
 	return 0;
 }
@@ -60,6 +75,9 @@ static int uwsgi_routing_func_gzip(struct wsgi_request *wsgi_req, struct uwsgi_r
 		free(utgz);
 		return UWSGI_ROUTE_BREAK;
 	}
+	if (ur->custom) {
+		deflateParams(&utgz->z, (int) ur->custom, Z_DEFAULT_STRATEGY);
+	}
 	struct uwsgi_transformation *ut = uwsgi_add_transformation(wsgi_req, transform_gzip, utgz);
 	ut->can_stream = 1;
 	// this is the transformation clearing the memory
@@ -70,6 +88,14 @@ static int uwsgi_routing_func_gzip(struct wsgi_request *wsgi_req, struct uwsgi_r
 
 static int uwsgi_router_gzip(struct uwsgi_route *ur, char *args) {
 	ur->func = uwsgi_routing_func_gzip;
+	if (args && *args) {
+		int level = atoi(args);
+		if (level < 1 || level > 9) {
+			uwsgi_log("invalid gzip route level: %s\n", args);
+			return -1;
+		}
+		ur->custom = level;
+	}
 	return 0;
 }
 
@@ -77,9 +103,15 @@ static void router_gzip_register(void) {
 	uwsgi_register_router("gzip", uwsgi_router_gzip);
 }
 
+static int transformation_gzip_init(void) {
+	uwsgi_transformation_metrics_register(&gzip_metrics, "transformation_gzip", "4.101");
+	return 0;
+}
+
 struct uwsgi_plugin transformation_gzip_plugin = {
 	.name = "transformation_gzip",
 	.on_load = router_gzip_register,
+	.init = transformation_gzip_init,
 };
 #else
 struct uwsgi_plugin transformation_gzip_plugin = {
@@ -15,50 +15,93 @@ struct uwsgi_router_tofile_conf {
 	size_t mode_len;
 };
 
-// this is allocated for each transformation
+/*
+	this is allocated (in the request arena) for each transformation
+
+	the body is streamed to a temporary file in the same directory, renamed to the
+	destination at the end of a successful response (readers never see partial files)
+
+	the file descriptor and the names live in the transformations, so they are released
+	even when the chain is not completed
+*/
 struct uwsgi_transformation_tofile_conf {
-	struct uwsgi_buffer *filename;
+	// ub is the destination name, fd the temporary file
+	struct uwsgi_transformation *stream;
+	// ub is the temporary name
+	struct uwsgi_transformation *final;
+	int failed;
 };
 
+static int transform_tofile_final(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_tofile_conf *uttc = (struct uwsgi_transformation_tofile_conf *) ut->data;
+	struct uwsgi_transformation *stream = uttc->stream;
+
+	if (stream->fd < 0) return 0;
+	close(stream->fd);
+	stream->fd = -1;
+
+	char *tmp_filename = uttc->final->ub->buf;
+	// store only successful responses
+	if (!uttc->failed && wsgi_req->write_errors == 0 && wsgi_req->status == 200) {
+		if (rename(tmp_filename, stream->ub->buf)) {
+			uwsgi_req_error("transform_tofile()/rename()");
+			unlink(tmp_filename);
+		}
+	}
+	else {
+		unlink(tmp_filename);
+	}
+	return 0;
+}
+
+// create the temporary file (in the directory of the destination)
+static int tofile_open(struct uwsgi_transformation *ut, struct uwsgi_transformation_tofile_conf *uttc) {
+	struct uwsgi_buffer *tmp_filename = uwsgi_buffer_new(ut->ub->pos + 8);
+	if (uwsgi_buffer_append(tmp_filename, ut->ub->buf, ut->ub->pos) || uwsgi_buffer_append(tmp_filename, ".XXXXXX\0", 8)) {
+		uwsgi_buffer_destroy(tmp_filename);
+		return -1;
+	}
+	uttc->final->ub = tmp_filename;
+	ut->fd = mkstemp(tmp_filename->buf);
+	if (ut->fd < 0) {
+		uwsgi_error_open(tmp_filename->buf);
+		return -1;
+	}
+	if (fchmod(ut->fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) {
+		uwsgi_error("tofile_open()/fchmod()");
+	}
+	return 0;
+}
+
 static int transform_tofile(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
 	
 	struct uwsgi_transformation_tofile_conf *uttc = (struct uwsgi_transformation_tofile_conf *) ut->data;
 	struct uwsgi_buffer *ub = ut->chunk;
 
+	// the chunk is passed unchanged to the next transformation
+	if (uttc->failed || ub->pos == 0) return 0;
+
 	// store only successful response
-	if (wsgi_req->write_errors == 0 && wsgi_req->status == 200 && ub->pos > 0) {
-		if (uttc->filename) {
-			int fd = open(uttc->filename->buf, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-			if (fd < 0) {
-				uwsgi_error_open(uttc->filename->buf);
-				goto end;
-			}
-			// lock the file
-			if (uwsgi_fcntl_lock(fd)) {
-				close(fd);
-				goto end;
-			}
-			// write to it
-			size_t remains = ub->pos;
-			while(remains) {
-				ssize_t rlen = write(fd, ub->buf + (ub->pos - remains), remains);
-				if (rlen <= 0) {
-					uwsgi_req_error("transform_tofile()/write()");
-					unlink(uttc->filename->buf);
-					break;
-				}
-				remains -= rlen;
-			}
-                        // unlock/close
-			close(fd);
-		}
+	if (wsgi_req->write_errors || wsgi_req->status != 200) {
+		uttc->failed = 1;
+		return 0;
+	}
+
+	if (ut->fd < 0 && tofile_open(ut, uttc)) {
+		uttc->failed = 1;
+		return 0;
 	}
 
-end:
-	// free resources
-	if (uttc->filename) uwsgi_buffer_destroy(uttc->filename);
-	free(uttc);
-	// reset the buffer
+	size_t remains = ub->pos;
+	while(remains) {
+		ssize_t rlen = write(ut->fd, ub->buf + (ub->pos - remains), remains);
+		if (rlen <= 0) {
+			uwsgi_req_error("transform_tofile()/write()");
+			uttc->failed = 1;
+			break;
+		}
+		remains -= rlen;
+	}
         return 0;
 }
 
@@ -67,21 +110,25 @@ end:
 static int uwsgi_routing_func_tofile(struct wsgi_request *wsgi_req, struct uwsgi_route *ur){
 	struct uwsgi_router_tofile_conf *urtc = (struct uwsgi_router_tofile_conf *) ur->data2;
 
-	struct uwsgi_transformation_tofile_conf *uttc = uwsgi_calloc(sizeof(struct uwsgi_transformation_tofile_conf));
-
 	// build key and name
         char **subject = (char **) (((char *)(wsgi_req))+ur->subject);
         uint16_t *subject_len = (uint16_t *)  (((char *)(wsgi_req))+ur->subject_len);
 
-        uttc->filename = uwsgi_routing_translate(wsgi_req, ur, *subject, *subject_len, urtc->filename, urtc->filename_len);
-        if (!uttc->filename) goto error;
-	
-	uwsgi_add_transformation(wsgi_req, transform_tofile, uttc);
-	return UWSGI_ROUTE_NEXT;
-
-error:
-	if (uttc->filename) uwsgi_buffer_destroy(uttc->filename);
-	free(uttc);
+        struct uwsgi_buffer *filename = uwsgi_routing_translate(wsgi_req, ur, *subject, *subject_len, urtc->filename, urtc->filename_len);
+        if (!filename) return UWSGI_ROUTE_NEXT;
+	if (uwsgi_buffer_append(filename, "\0", 1)) {
+		uwsgi_buffer_destroy(filename);
+		return UWSGI_ROUTE_NEXT;
+	}
+	filename->pos--;
+
+	struct uwsgi_transformation_tofile_conf *uttc = uwsgi_req_calloc(wsgi_req, sizeof(struct uwsgi_transformation_tofile_conf));
+	uttc->stream = uwsgi_add_transformation(wsgi_req, transform_tofile, uttc);
+	uttc->stream->can_stream = 1;
+	uttc->stream->ub = filename;
+	// rename (or remove) the temporary file
+	uttc->final = uwsgi_add_transformation(wsgi_req, transform_tofile_final, uttc);
+	uttc->final->is_final = 1;
 	return UWSGI_ROUTE_NEXT;
 }
 
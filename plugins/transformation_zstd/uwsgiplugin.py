@@ -0,0 +1,6 @@
+NAME = 'transformation_zstd'
+
+CFLAGS = []
+LDFLAGS = []
+LIBS = ['-lzstd']
+GCC_LIST = ['zstd']
@@ -0,0 +1,201 @@
+#include <uwsgi.h>
+
+extern struct uwsgi_server uwsgi;
+
+#if defined(UWSGI_ROUTING)
+
+#include <zstd.h>
+
+/*
+
+	zstd transformations add content-encoding to your headers and changes the final size !!!
+
+	remember to fix the content_length (or use chunked encoding) !!!
+
+	the route argument is the compression level (default 3)
+
+	--zstd-dictionary loads a dictionary (as built by "zstd --train") shared by all of the
+	zstd routes, it is digested once at startup for every configured level. Clients must
+	know the dictionary to decode the responses, so use it only with your own clients.
+
+*/
+
+#define UWSGI_ZSTD_DEFAULT_LEVEL 3
+#define UWSGI_ZSTD_MAX_LEVELS 32
+
+static struct uwsgi_transformation_zstd_conf {
+	char *dictionary;
+	// levels used by the routes
+	uint32_t levels;
+	ZSTD_CDict *cdicts[UWSGI_ZSTD_MAX_LEVELS];
+	struct uwsgi_transformation_metrics metrics;
+} uzstd;
+
+static struct uwsgi_option transformation_zstd_options[] = {
+	{"zstd-dictionary", required_argument, 0, "use the specified dictionary for zstd transformations", uwsgi_opt_set_str, &uzstd.dictionary, 0},
+	UWSGI_END_OF_OPTIONS
+};
+
+struct uwsgi_transformation_zstd {
+	ZSTD_CCtx *ctx;
+	uint8_t header;
+	// for metrics
+	size_t len;
+	size_t out;
+	uint64_t usecs;
+};
+
+// compress the whole chunk, appending the compressed data to out
+static int zstd_compress(ZSTD_CCtx *ctx, struct uwsgi_buffer *ub, struct uwsgi_buffer *out, ZSTD_EndDirective mode) {
+	ZSTD_inBuffer input = { ub->buf, ub->pos, 0 };
+
+	for(;;) {
+		if (uwsgi_buffer_ensure(out, uwsgi.page_size)) goto error;
+		ZSTD_outBuffer output = { out->buf, out->len, out->pos };
+		size_t remaining = ZSTD_compressStream2(ctx, &output, &input, mode);
+		if (ZSTD_isError(remaining)) goto error;
+		out->pos = output.pos;
+		// the whole input is consumed and flushed (or the frame is closed)
+		if (remaining == 0) break;
+	}
+	return 0;
+
+error:
+	return -1;
+}
+
+// close the stream, replacing the content of the (final) chunk with the compressed data
+static int zstd_compress_end(ZSTD_CCtx *ctx, struct uwsgi_buffer *ub) {
+	struct uwsgi_buffer *out = uwsgi_buffer_new(uwsgi.page_size);
+	if (zstd_compress(ctx, ub, out, ZSTD_e_end)) {
+		uwsgi_buffer_destroy(out);
+		return -1;
+	}
+	uwsgi_buffer_map(ub, out->buf, out->pos);
+	out->buf = NULL;
+	uwsgi_buffer_destroy(out);
+	return 0;
+}
+
+static int transform_zstd(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_zstd *utz = (struct uwsgi_transformation_zstd *) ut->data;
+	struct uwsgi_buffer *ub = ut->chunk;
+
+	if (ut->is_final) {
+		int ret = 0;
+		if (utz->header) {
+			uint64_t start = uwsgi_micros();
+			ret = zstd_compress_end(utz->ctx, ub);
+			if (!ret) {
+				uwsgi_transformation_metrics_add(&uzstd.metrics, utz->len, utz->out + ub->pos, utz->usecs + (uwsgi_micros() - start));
+			}
+		}
+		ZSTD_freeCCtx(utz->ctx);
+		free(utz);
+		return ret;
+	}
+
+	if (ub->pos == 0) {
+		// Don't try to compress empty responses.
+		return 0;
+	}
+
+	// flush every chunk, so the client gets the data as soon as possible
+	uint64_t start = uwsgi_micros();
+	utz->len += ub->pos;
+	// the compressed data goes to the spare buffer of the request
+	struct uwsgi_buffer *out = uwsgi_transformation_spare(wsgi_req, ut);
+	if (zstd_compress(utz->ctx, ub, out, ZSTD_e_flush)) return -1;
+	ut->chunk = out;
+	utz->usecs += uwsgi_micros() - start;
+	utz->out += out->pos;
+	if (!utz->header) {
+		// do not check for errors !!!
+		uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "zstd", 4);
+		utz->header = 1;
+	}
+
+	return 0;
+}
+
+static int uwsgi_routing_func_zstd(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
+	struct uwsgi_transformation_zstd *utz = uwsgi_calloc(sizeof(struct uwsgi_transformation_zstd));
+	utz->ctx = ZSTD_createCCtx();
+	if (!utz->ctx) {
+		free(utz);
+		return UWSGI_ROUTE_BREAK;
+	}
+	size_t ret;
+	// the digested dictionary already carries the level
+	if (uzstd.cdicts[ur->custom]) {
+		ret = ZSTD_CCtx_refCDict(utz->ctx, uzstd.cdicts[ur->custom]);
+	}
+	else {
+		ret = ZSTD_CCtx_setParameter(utz->ctx, ZSTD_c_compressionLevel, (int) ur->custom);
+	}
+	if (ZSTD_isError(ret)) {
+		ZSTD_freeCCtx(utz->ctx);
+		free(utz);
+		return UWSGI_ROUTE_BREAK;
+	}
+	struct uwsgi_transformation *ut = uwsgi_add_transformation(wsgi_req, transform_zstd, utz);
+	ut->can_stream = 1;
+	// this is the transformation clearing the memory
+	ut = uwsgi_add_transformation(wsgi_req, transform_zstd, utz);
+	ut->is_final = 1;
+	return UWSGI_ROUTE_NEXT;
+}
+
+static int uwsgi_router_zstd(struct uwsgi_route *ur, char *args) {
+	ur->func = uwsgi_routing_func_zstd;
+	ur->custom = UWSGI_ZSTD_DEFAULT_LEVEL;
+	if (args && *args) {
+		int level = atoi(args);
+		if (level < 1 || level > ZSTD_maxCLevel()) {
+			uwsgi_log("invalid zstd route level: %s\n", args);
+			return -1;
+		}
+		ur->custom = level;
+	}
+	if (ur->custom < UWSGI_ZSTD_MAX_LEVELS) {
+		uzstd.levels |= 1 << ur->custom;
+	}
+	return 0;
+}
+
+static void router_zstd_register(void) {
+	uwsgi_register_router("zstd", uwsgi_router_zstd);
+}
+
+static int transformation_zstd_init(void) {
+	uwsgi_transformation_metrics_register(&uzstd.metrics, "transformation_zstd", "4.103");
+
+	if (!uzstd.dictionary) return 0;
+
+	size_t size = 0;
+	char *dict = uwsgi_open_and_read(uzstd.dictionary, &size, 0, NULL);
+	int i;
+	for(i=1;i<UWSGI_ZSTD_MAX_LEVELS;i++) {
+		if (!(uzstd.levels & (1 << i))) continue;
+		uzstd.cdicts[i] = ZSTD_createCDict(dict, size, i);
+		if (!uzstd.cdicts[i]) {
+			uwsgi_log("[zstd] unable to load dictionary %s for level %d\n", uzstd.dictionary, i);
+			exit(1);
+		}
+	}
+	free(dict);
+	uwsgi_log("[zstd] loaded dictionary %s (%llu bytes)\n", uzstd.dictionary, (unsigned long long) size);
+	return 0;
+}
+
+struct uwsgi_plugin transformation_zstd_plugin = {
+	.name = "transformation_zstd",
+	.options = transformation_zstd_options,
+	.on_load = router_zstd_register,
+	.init = transformation_zstd_init,
+};
+#else
+struct uwsgi_plugin transformation_zstd_plugin = {
+	.name = "transformation_zstd",
+};
+#endif
@@ -51,6 +51,10 @@ struct uwsgi_tuntap_peer *uwsgi_tuntap_peer_create(struct uwsgi_tuntap_router *u
 	return uttp;
 }
 
+static uint32_t uwsgi_tuntap_addr_slot(uint32_t addr) {
+	return ((addr * 0x9e3779b1) >> 24) & (UWSGI_TUNTAP_PEERS - 1);
+}
+
 // destroy a peer
 void uwsgi_tuntap_peer_destroy(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp) {
 	struct uwsgi_tuntap_peer *prev = uttp->prev;
@@ -72,6 +76,17 @@ void uwsgi_tuntap_peer_destroy(struct uwsgi_tuntap_router *uttr, struct uwsgi_tu
 		uttr->peers_tail = prev;
 	}
 
+	if (uttp->addr && uttr->peers_by_addr) {
+		struct uwsgi_tuntap_peer **cur = &uttr->peers_by_addr[uwsgi_tuntap_addr_slot(uttp->addr)];
+		while(*cur) {
+			if (*cur == uttp) {
+				*cur = uttp->addr_next;
+				break;
+			}
+			cur = &(*cur)->addr_next;
+		}
+	}
+
 	free(uttp->buf);
 	free(uttp->write_buf);
 	if (uttp->rules) free(uttp->rules);
@@ -82,11 +97,12 @@ void uwsgi_tuntap_peer_destroy(struct uwsgi_tuntap_router *uttr, struct uwsgi_tu
 
 // get a peer by addr
 struct uwsgi_tuntap_peer *uwsgi_tuntap_peer_get_by_addr(struct uwsgi_tuntap_router *uttr, uint32_t addr) {
-	struct uwsgi_tuntap_peer *uttp = uttr->peers_head;
+	if (!uttr->peers_by_addr) return NULL;
+	struct uwsgi_tuntap_peer *uttp = uttr->peers_by_addr[uwsgi_tuntap_addr_slot(addr)];
 	while (uttp) {
 		if (uttp->addr == addr)
 			return uttp;
-		uttp = uttp->next;
+		uttp = uttp->addr_next;
 	}
 
 	return NULL;
@@ -196,80 +212,101 @@ int uwsgi_tuntap_register_addr(struct uwsgi_tuntap_router *uttr, struct uwsgi_tu
         	uwsgi_tuntap_error(uttp, "uwsgi_tuntap_register_addr()/inet_ntop()");
                 return -1;
         }
-        if (uttp != tmp_uttp) {
+        if (tmp_uttp && uttp != tmp_uttp) {
         	uwsgi_log("[tuntap-router] detected ip collision for %s\n", ip);
                 uwsgi_tuntap_peer_destroy(uttr, tmp_uttp);
         }
+	if (uttp != tmp_uttp) {
+		uint32_t slot = uwsgi_tuntap_addr_slot(uttp->addr);
+		uttp->addr_next = uttr->peers_by_addr[slot];
+		uttr->peers_by_addr[slot] = uttp;
+	}
         uwsgi_log("[tuntap-router] registered new peer %s (fd: %d)\n", ip, uttp->fd);
         memcpy(uttp->ip, ip, INET_ADDRSTRLEN + 1);
 	return 0;
 }
 
-// receive a packet from the client
-int uwsgi_tuntap_peer_dequeue(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp, int is_router) {
-	// get body
-	if (uttp->header_pos >= 4) {
-		ssize_t rlen = read(uttp->fd, uttp->buf + uttp->buf_pos, uttp->buf_pktsize - uttp->buf_pos);
-		if (rlen == 0)
-			return -1;
-		if (rlen < 0) {
-			if (uwsgi_is_again())
-				return 0;
-			uwsgi_tuntap_error(uttp, "uwsgi_tuntap_peer_dequeue()/read()");
-			return -1;
-		}
-		uttp->buf_pos += rlen;
-		uttp->rx += rlen;
-		// a whole pkt has been received
-		if (uttp->buf_pos >= uttp->buf_pktsize) {
-
-			uttp->header_pos = 0;
-			uttp->buf_pos = 0;
-
-			if (!is_router) goto enqueue;
-
-			// a rule block
-			if (uttp->header[3] == 1) {
-				if (uttp->rules) free(uttp->rules);
-				uttp->rules = uwsgi_malloc(uttp->buf_pktsize);
-				memcpy(uttp->rules, uttp->buf, uttp->buf_pktsize);
-				uttp->rules_cnt = uttp->buf_pktsize / sizeof(struct uwsgi_tuntap_peer_rule);
-				return 0;
-			}
+// manage a packet received from the client
+static int uwsgi_tuntap_peer_packet(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp, uint8_t modifier2, char *pkt, uint16_t pktsize, int is_router) {
+	if (!is_router) goto enqueue;
 
-			if (uwsgi_tuntap_firewall_check(utt.fw_out, uttp->buf, uttp->buf_pktsize)) return 0;
+	// a rule block
+	if (modifier2 == 1) {
+		if (uttp->rules) free(uttp->rules);
+		uttp->rules = uwsgi_malloc(pktsize);
+		memcpy(uttp->rules, pkt, pktsize);
+		uttp->rules_cnt = pktsize / sizeof(struct uwsgi_tuntap_peer_rule);
+		return 0;
+	}
 
-			// if there is no associated address store the source
-			if (!uttp->addr) {
-				// close on invalid first packet
-				if (uttp->buf_pktsize < 20) return -1;
-				uint32_t *src_ip = (uint32_t *) (&uttp->buf[12]);
-				uttp->addr = *src_ip;
-				// drop invalid ip addresses
-				if (!uttp->addr)
-					return -1;
+	if (uwsgi_tuntap_firewall_check(&utt.fw_out, pkt, pktsize)) return 0;
 
-				if (uwsgi_tuntap_register_addr(uttr, uttp)) {
-					return -1;
-				}
+	// if there is no associated address store the source
+	if (!uttp->addr) {
+		// close on invalid first packet
+		if (pktsize < 20) return -1;
+		uint32_t *src_ip = (uint32_t *) (&pkt[12]);
+		uttp->addr = *src_ip;
+		// drop invalid ip addresses
+		if (!uttp->addr)
+			return -1;
 
-			}
+		if (uwsgi_tuntap_register_addr(uttr, uttp)) {
+			return -1;
+		}
 
-			if (uwsgi_tuntap_peer_rules_check(uttr, uttp, uttp->buf, uttp->buf_pktsize, 1)) return 0;
+	}
 
-			// check four routing rule
-			if (uttr->gateway_fd > -1) {
-				if (uwsgi_tuntap_route_check(uttr->gateway_fd, uttp->buf, uttp->buf_pktsize)) return 0;
-			}
+	if (uwsgi_tuntap_peer_rules_check(uttr, uttp, pkt, pktsize, 1)) return 0;
+
+	// check four routing rule
+	if (uttr->gateway_fd > -1) {
+		if (uwsgi_tuntap_route_check(uttr, pkt, pktsize)) return 0;
+	}
 enqueue:
+	memcpy(uttr->write_buf, pkt, pktsize);
+	uttr->write_pktsize = pktsize;
+	uwsgi_tuntap_enqueue(uttr);
+	return 0;
+}
 
-			memcpy(uttr->write_buf, uttp->buf, uttp->buf_pktsize);
-			uttr->write_pktsize = uttp->buf_pktsize;
-			uwsgi_tuntap_enqueue(uttr);
+// manage all of the complete packets in the peer buffer (stopping if the device blocks)
+int uwsgi_tuntap_peer_parse(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp, int is_router) {
+	uint16_t off = 0;
+	int ret = 0;
+	while (uttp->buf_pos - off >= 4) {
+		if (uttr->wait_for_write) {
+			uttr->peers_pending = 1;
+			break;
+		}
+		uint8_t *hdr = (uint8_t *) uttp->buf + off;
+		uint16_t pktsize = hdr[1] | (hdr[2] << 8);
+		if (pktsize > utt.buffer_size) {
+			uwsgi_log_verbose("[tuntap] peer fd: %d ip: %s sent a packet bigger than the buffer (%u bytes)\n", uttp->fd, uttp->ip, pktsize);
+			ret = -1;
+			break;
+		}
+		if (uttp->buf_pos - off - 4 < pktsize) break;
+		off += 4 + pktsize;
+		if (uwsgi_tuntap_peer_packet(uttr, uttp, hdr[3], (char *) hdr + 4, pktsize, is_router)) {
+			ret = -1;
+			break;
 		}
-		return 0;
 	}
-	ssize_t rlen = read(uttp->fd, uttp->header + uttp->header_pos, 4 - uttp->header_pos);
+
+	// routed packets point to the buffer
+	if (uttr->gateway_queued) uwsgi_tuntap_gateway_flush(uttr);
+
+	if (!ret && off > 0) {
+		memmove(uttp->buf, uttp->buf + off, uttp->buf_pos - off);
+		uttp->buf_pos -= off;
+	}
+	return ret;
+}
+
+// receive packets from the client
+int uwsgi_tuntap_peer_dequeue(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp, int is_router) {
+	ssize_t rlen = read(uttp->fd, uttp->buf + uttp->buf_pos, (utt.buffer_size + 4) - uttp->buf_pos);
 	if (rlen == 0)
 		return -1;
 	if (rlen < 0) {
@@ -278,13 +315,27 @@ enqueue:
 		uwsgi_tuntap_error(uttp, "uwsgi_tuntap_peer_dequeue()/read()");
 		return -1;
 	}
-	uttp->header_pos += rlen;
-	if (uttp->header_pos >= 4) {
-		uint16_t *pktsize = (uint16_t *) &uttp->header[1];
-		uttp->buf_pktsize = *pktsize;
-		uttp->rx += 4;
+	uttp->buf_pos += rlen;
+	uttp->rx += rlen;
+	return uwsgi_tuntap_peer_parse(uttr, uttp, is_router);
+}
+
+// the device is writable again, manage the packets left in the peers buffers
+void uwsgi_tuntap_peers_resume(struct uwsgi_tuntap_router *uttr, int is_router) {
+	if (!uttr->peers_pending || uttr->wait_for_write) return;
+	uttr->peers_pending = 0;
+	struct uwsgi_tuntap_peer *uttp = uttr->peers_head;
+	while (uttp && !uttr->wait_for_write) {
+		struct uwsgi_tuntap_peer *next = uttp->next;
+		if (uttp->buf_pos >= 4 && uwsgi_tuntap_peer_parse(uttr, uttp, is_router)) {
+			if (!is_router) {
+				uwsgi_log_verbose("tuntap server disconnected...\n");
+				exit(1);
+			}
+			uwsgi_tuntap_peer_destroy(uttr, uttp);
+		}
+		uttp = next;
 	}
-	return 0;
 }
 
 // enqueue a packet to the client
@@ -328,8 +379,9 @@ int uwsgi_tuntap_peer_enqueue(struct uwsgi_tuntap_router *uttr, struct uwsgi_tun
 		return 0;
 	}
 
-	memmove(uttp->write_buf, uttp->write_buf + rlen, uttp->write_buf_pktsize - rlen);
-	uttp->write_buf_pktsize -= rlen;
+	memmove(uttp->write_buf, uttp->write_buf + uttp->written, uttp->write_buf_pktsize - uttp->written);
+	uttp->write_buf_pktsize -= uttp->written;
+	uttp->written = 0;
 
 retry:
 	if (!uttp->wait_for_write) {
@@ -23,6 +23,13 @@ struct uwsgi_tuntap_peer_rule {
 	uint16_t target_port;
 } __attribute__ ((__packed__));
 
+// packets managed for each wakeup of the router
+#define UWSGI_TUNTAP_BATCH 64
+// slots of the firewall/routing flow tables (power of 2)
+#define UWSGI_TUNTAP_FLOWS 4096
+// buckets of the peers address table (power of 2)
+#define UWSGI_TUNTAP_PEERS 256
+
 struct uwsgi_tuntap_peer {
         int fd;
         uint32_t addr;
@@ -30,16 +37,17 @@ struct uwsgi_tuntap_peer {
         int wait_for_write;
         int blocked_read;
         size_t written;
-        char header[4];
-        uint8_t header_pos;
+	// the stream from the peer (uwsgi header + packet), more packets are parsed from a single read
         char *buf;
-        uint16_t buf_pktsize;
         uint16_t buf_pos;
         char *write_buf;
         uint16_t write_buf_pktsize;
         uint16_t write_buf_pos;
+	// packets from the device waiting to be flushed at the end of the batch
+	uint8_t pending;
         struct uwsgi_tuntap_peer *prev;
         struct uwsgi_tuntap_peer *next;
+	struct uwsgi_tuntap_peer *addr_next;
 	// counters
 	uint64_t tx;
 	uint64_t rx;
@@ -64,6 +72,22 @@ struct uwsgi_tuntap_firewall_rule {
         struct uwsgi_tuntap_firewall_rule *next;
 };
 
+/*
+	the firewall chains and the routing table are static, so the first matching rule
+	for a src/dst couple is computed only once and stored in a direct-mapped table
+*/
+struct uwsgi_tuntap_flow {
+	uint32_t src;
+	uint32_t dst;
+	struct uwsgi_tuntap_firewall_rule *rule;
+	uint8_t valid;
+};
+
+struct uwsgi_tuntap_chain {
+	struct uwsgi_tuntap_firewall_rule *rules;
+	struct uwsgi_tuntap_flow *flows;
+};
+
 struct uwsgi_tuntap_router {
 	int fd;
         int server_fd;
@@ -72,6 +96,9 @@ struct uwsgi_tuntap_router {
         char *write_buf;
         struct uwsgi_tuntap_peer *peers_head;
         struct uwsgi_tuntap_peer *peers_tail;
+	struct uwsgi_tuntap_peer **peers_by_addr;
+	// a peer has complete packets buffered while the device was blocked
+	int peers_pending;
         uint16_t write_pktsize;
         uint16_t write_pos;
         int wait_for_write;
@@ -80,6 +107,12 @@ struct uwsgi_tuntap_router {
 	char *gateway;
 	int gateway_fd;
 	char *gateway_buf;
+	// batched gateway I/O (recvmmsg/sendmmsg)
+	struct mmsghdr *gateway_rmsgs;
+	struct iovec *gateway_riov;
+	struct mmsghdr *gateway_smsgs;
+	struct iovec *gateway_siov;
+	int gateway_queued;
 	char *subscription_server;
 	int subscription_server_fd;
 };
@@ -88,9 +121,9 @@ struct uwsgi_tuntap {
         struct uwsgi_string_list *routers;
         struct uwsgi_string_list *devices;
         uint16_t buffer_size;
-        struct uwsgi_tuntap_firewall_rule *fw_in;
-        struct uwsgi_tuntap_firewall_rule *fw_out;
-        struct uwsgi_tuntap_firewall_rule *routes;
+        struct uwsgi_tuntap_chain fw_in;
+        struct uwsgi_tuntap_chain fw_out;
+        struct uwsgi_tuntap_chain routes;
         struct uwsgi_string_list *device_rules;
 	char *stats_server;
 	char *use_credentials;
@@ -101,8 +134,11 @@ int uwsgi_tuntap_peer_dequeue(struct uwsgi_tuntap_router *, struct uwsgi_tuntap_
 int uwsgi_tuntap_peer_enqueue(struct uwsgi_tuntap_router *, struct uwsgi_tuntap_peer *);
 void uwsgi_tuntap_enqueue(struct uwsgi_tuntap_router *);
 
-int uwsgi_tuntap_firewall_check(struct uwsgi_tuntap_firewall_rule *, char *, uint16_t);
-int uwsgi_tuntap_route_check(int , char *, uint16_t);
+int uwsgi_tuntap_firewall_check(struct uwsgi_tuntap_chain *, char *, uint16_t);
+int uwsgi_tuntap_route_check(struct uwsgi_tuntap_router *, char *, uint16_t);
+void uwsgi_tuntap_gateway_flush(struct uwsgi_tuntap_router *);
+int uwsgi_tuntap_peer_parse(struct uwsgi_tuntap_router *, struct uwsgi_tuntap_peer *, int);
+void uwsgi_tuntap_peers_resume(struct uwsgi_tuntap_router *, int);
 
 struct uwsgi_tuntap_peer *uwsgi_tuntap_peer_create(struct uwsgi_tuntap_router *, int, int);
 struct uwsgi_tuntap_peer *uwsgi_tuntap_peer_get_by_addr(struct uwsgi_tuntap_router *,uint32_t);
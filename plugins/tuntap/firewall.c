@@ -79,7 +79,42 @@ int uwsgi_tuntap_peer_rules_check(struct uwsgi_tuntap_router *uttr, struct uwsgi
 	return 0;
 }
 
-int uwsgi_tuntap_firewall_check(struct uwsgi_tuntap_firewall_rule *direction, char *pkt, uint16_t len) {
+// the first rule of the chain matching src and dst (NULL if none)
+static struct uwsgi_tuntap_firewall_rule *uwsgi_tuntap_chain_lookup(struct uwsgi_tuntap_chain *chain, uint32_t src, uint32_t dst) {
+	if (!chain->rules) return NULL;
+	if (!chain->flows) {
+		chain->flows = uwsgi_calloc(sizeof(struct uwsgi_tuntap_flow) * UWSGI_TUNTAP_FLOWS);
+	}
+
+	uint32_t hash = (src * 0x9e3779b1) ^ (dst * 0x85ebca6b);
+	struct uwsgi_tuntap_flow *flow = &chain->flows[(hash ^ (hash >> 16)) & (UWSGI_TUNTAP_FLOWS - 1)];
+	if (flow->valid && flow->src == src && flow->dst == dst) return flow->rule;
+
+	struct uwsgi_tuntap_firewall_rule *utfr = chain->rules;
+	while(utfr) {
+		if (utfr->src) {
+			uint32_t src_masked = src & utfr->src_mask;
+			if (src_masked != utfr->src) goto next;
+		}
+
+		if (utfr->dst) {
+			uint32_t dst_masked = dst & utfr->dst_mask;
+			if (dst_masked != utfr->dst) goto next;
+		}
+
+		break;
+next:
+		utfr = utfr->next;
+	}
+
+	flow->src = src;
+	flow->dst = dst;
+	flow->rule = utfr;
+	flow->valid = 1;
+	return utfr;
+}
+
+int uwsgi_tuntap_firewall_check(struct uwsgi_tuntap_chain *chain, char *pkt, uint16_t len) {
         // sanity check
         if (len < 20) return -1;
         uint32_t *src_ip = (uint32_t *) &pkt[12];
@@ -88,27 +123,28 @@ int uwsgi_tuntap_firewall_check(struct uwsgi_tuntap_firewall_rule *direction, ch
         uint32_t src = ntohl(*src_ip);
         uint32_t dst = ntohl(*dst_ip);
 
-        struct uwsgi_tuntap_firewall_rule *utfr = direction;
-        while(utfr) {
-                if (utfr->src) {
-                        uint32_t src_masked = src & utfr->src_mask;
-                        if (src_masked != utfr->src) goto next;
-                }
-
-                if (utfr->dst) {
-                        uint32_t dst_masked = dst & utfr->dst_mask;
-                        if (dst_masked != utfr->dst) goto next;
-                }
-
-                return utfr->action;
-next:
-                utfr = utfr->next;
-        }
+	struct uwsgi_tuntap_firewall_rule *utfr = uwsgi_tuntap_chain_lookup(chain, src, dst);
+	if (utfr) return utfr->action;
 
         return 0;
 }
 
-int uwsgi_tuntap_route_check(int fd, char *pkt, uint16_t len) {
+// send the routed packets queued during the batch with a single syscall
+void uwsgi_tuntap_gateway_flush(struct uwsgi_tuntap_router *uttr) {
+	int sent = 0;
+	while(sent < uttr->gateway_queued) {
+		int ret = sendmmsg(uttr->gateway_fd, uttr->gateway_smsgs + sent, uttr->gateway_queued - sent, 0);
+		if (ret <= 0) {
+			uwsgi_error("uwsgi_tuntap_gateway_flush()/sendmmsg()");
+			break;
+		}
+		sent += ret;
+	}
+	uttr->gateway_queued = 0;
+}
+
+// the packet must stay valid until the next flush
+int uwsgi_tuntap_route_check(struct uwsgi_tuntap_router *uttr, char *pkt, uint16_t len) {
         // sanity check
         if (len < 20) return -1;
         uint32_t *src_ip = (uint32_t *) &pkt[12];
@@ -117,27 +153,21 @@ int uwsgi_tuntap_route_check(int fd, char *pkt, uint16_t len) {
         uint32_t src = ntohl(*src_ip);
         uint32_t dst = ntohl(*dst_ip);
 
-        struct uwsgi_tuntap_firewall_rule *utrr = utt.routes;
-        while(utrr) {
-                if (utrr->src) {
-                        uint32_t src_masked = src & utrr->src_mask;
-                        if (src_masked != utrr->src) goto next;
-                }
+	struct uwsgi_tuntap_firewall_rule *utrr = uwsgi_tuntap_chain_lookup(&utt.routes, src, dst);
+	if (!utrr) return 0;
 
-                if (utrr->dst) {
-                        uint32_t dst_masked = dst & utrr->dst_mask;
-                        if (dst_masked != utrr->dst) goto next;
-                }
-
-		if (sendto(fd, pkt, len, 0, (struct sockaddr *) &utrr->dest_addr, utrr->addrlen) < 0) {
-			uwsgi_error("uwsgi_tuntap_route_check()/sendto()");
-		}
-                return 1;
-next:
-                utrr = utrr->next;
-        }
-
-        return 0;
+	if (uttr->gateway_queued >= UWSGI_TUNTAP_BATCH) {
+		uwsgi_tuntap_gateway_flush(uttr);
+	}
+	int i = uttr->gateway_queued++;
+	uttr->gateway_siov[i].iov_base = pkt;
+	uttr->gateway_siov[i].iov_len = len;
+	struct msghdr *msg = &uttr->gateway_smsgs[i].msg_hdr;
+	msg->msg_name = &utrr->dest_addr;
+	msg->msg_namelen = utrr->addrlen;
+	msg->msg_iov = &uttr->gateway_siov[i];
+	msg->msg_iovlen = 1;
+        return 1;
 }
 
 
@@ -46,6 +46,12 @@ struct uwsgi_tuntap utt;
 	--tuntap-router-firewall-in = allow 0.0.0.0 192.168.0.0/24
 	--tuntap-router-firewall-in = deny
 
+	The router manages up to 64 packets for each wakeup: the device is drained with a read() per packet
+	(the tun interface does not allow more), packets for the same peer are written with a single write()
+	at the end of the batch, the peers streams are parsed for multiple packets from a single read()
+	and the gateway socket uses recvmmsg()/sendmmsg(). The first matching rule of the firewall chains and
+	of the routing table is computed once for every src/dst couple (the chains are static).
+
 	Author: Roberto De Ioris
 
 	TODO:
@@ -60,14 +66,70 @@ static struct uwsgi_option uwsgi_tuntap_options[] = {
 	{"tuntap-router", required_argument, 0, "run the tuntap router (syntax: <device> <socket> [stats] [gateway])", uwsgi_opt_add_string_list, &utt.routers, 0},
 	{"tuntap-device", required_argument, 0, "add a tuntap device to the instance (syntax: <device>[ <socket>])", uwsgi_opt_add_string_list, &utt.devices, 0},
 	{"tuntap-use-credentials", optional_argument, 0, "enable check of SCM_CREDENTIALS for tuntap client/server", uwsgi_opt_set_str, &utt.use_credentials, 0},
-	{"tuntap-router-firewall-in", required_argument, 0, "add a firewall rule to the tuntap router (syntax: <action> <src/mask> <dst/mask>)", uwsgi_tuntap_opt_firewall, &utt.fw_in, 0},
-	{"tuntap-router-firewall-out", required_argument, 0, "add a firewall rule to the tuntap router (syntax: <action> <src/mask> <dst/mask>)", uwsgi_tuntap_opt_firewall, &utt.fw_out, 0},
-	{"tuntap-router-route", required_argument, 0, "add a routing rule to the tuntap router (syntax: <src/mask> <dst/mask> <gateway>)", uwsgi_tuntap_opt_route, &utt.routes, 0},
+	{"tuntap-router-firewall-in", required_argument, 0, "add a firewall rule to the tuntap router (syntax: <action> <src/mask> <dst/mask>)", uwsgi_tuntap_opt_firewall, &utt.fw_in.rules, 0},
+	{"tuntap-router-firewall-out", required_argument, 0, "add a firewall rule to the tuntap router (syntax: <action> <src/mask> <dst/mask>)", uwsgi_tuntap_opt_firewall, &utt.fw_out.rules, 0},
+	{"tuntap-router-route", required_argument, 0, "add a routing rule to the tuntap router (syntax: <src/mask> <dst/mask> <gateway>)", uwsgi_tuntap_opt_route, &utt.routes.rules, 0},
 	{"tuntap-router-stats", required_argument, 0, "run the tuntap router stats server", uwsgi_opt_set_str, &utt.stats_server, 0},
 	{"tuntap-device-rule", required_argument, 0, "add a tuntap device rule (syntax: <direction> <src/mask> <dst/mask> <action> [target])", uwsgi_opt_add_string_list, &utt.device_rules, 0},
 	{NULL, 0, 0, NULL, NULL, NULL, 0},
 };
 
+/*
+	packets from the device (or the gateway) are appended to the peers write buffers for the whole batch,
+	every peer is written once at the end of it
+*/
+static int uwsgi_tuntap_peer_flush(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp, int is_router) {
+	uttp->pending = 0;
+	if (uwsgi_tuntap_peer_enqueue(uttr, uttp)) {
+		if (!is_router) {
+			uwsgi_log_verbose("tuntap server disconnected...\n");
+			exit(1);
+		}
+		uwsgi_tuntap_peer_destroy(uttr, uttp);
+		return -1;
+	}
+	return 0;
+}
+
+static void uwsgi_tuntap_peers_flush(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer **pending, int npending, int is_router) {
+	int i;
+	for (i = 0; i < npending; i++) {
+		uwsgi_tuntap_peer_flush(uttr, pending[i], is_router);
+	}
+}
+
+static void uwsgi_tuntap_peer_push(struct uwsgi_tuntap_router *uttr, struct uwsgi_tuntap_peer *uttp, char *pkt, uint16_t pktsize, struct uwsgi_tuntap_peer **pending, int *npending, int is_router) {
+	// check for full write buffer (and try to make room writing what is already there)
+	if (uttp->write_buf_pktsize + 4 + pktsize > utt.buffer_size && uttp->pending && !uttp->wait_for_write) {
+		int i;
+		for (i = 0; i < *npending; i++) {
+			if (pending[i] == uttp) {
+				pending[i] = pending[--(*npending)];
+				break;
+			}
+		}
+		// the peer is gone
+		if (uwsgi_tuntap_peer_flush(uttr, uttp, is_router)) return;
+	}
+
+	if (uttp->write_buf_pktsize + 4 + pktsize > utt.buffer_size) {
+		uttp->dropped++;
+		return;
+	}
+
+	char *ptr = uttp->write_buf + uttp->write_buf_pktsize;
+	memcpy(ptr + 4, pkt, pktsize);
+	ptr[0] = 0;
+	ptr[1] = (uint8_t) (pktsize & 0xff);
+	ptr[2] = (uint8_t) ((pktsize >> 8) & 0xff);
+	ptr[3] = 0;
+	uttp->write_buf_pktsize += pktsize + 4;
+	if (!uttp->pending) {
+		uttp->pending = 1;
+		pending[(*npending)++] = uttp;
+	}
+}
+
 static void *uwsgi_tuntap_loop(void *arg) {
 
 	// block signals on this thread
@@ -112,30 +174,18 @@ static void *uwsgi_tuntap_loop(void *arg) {
 				uwsgi_tuntap_enqueue(uttr);
 				continue;
 			}
-			ssize_t rlen = read(uttr->fd, uttr->buf, utt.buffer_size);
-			if (rlen <= 0) {
-				uwsgi_error("uwsgi_tuntap_loop()/read()");
-				exit(1);
-			}
-
-			// check for full write buffer
-                        if (uttp->write_buf_pktsize + 4 + rlen > utt.buffer_size) {
-                        	uttp->dropped++;
-                                continue;
-                        }
-
-			uint16_t pktsize = rlen;
-			char *ptr = uttp->write_buf + uttp->write_buf_pktsize;
-			memcpy(ptr + 4, uttr->buf, rlen);
-			ptr[0] = 0;
-			ptr[1] = (uint8_t) (pktsize & 0xff);
-			ptr[2] = (uint8_t) ((pktsize >> 8) & 0xff);
-			ptr[3] = 0;
-			uttp->write_buf_pktsize+= pktsize+4;
-			if (uwsgi_tuntap_peer_enqueue(uttr, uttp)) {
-				uwsgi_log_verbose("tuntap server disconnected...\n");
-				exit(1);
+			struct uwsgi_tuntap_peer *pending[1];
+			int npending = 0, j;
+			for (j = 0; j < UWSGI_TUNTAP_BATCH; j++) {
+				ssize_t rlen = read(uttr->fd, uttr->buf, utt.buffer_size);
+				if (rlen < 0 && uwsgi_is_again()) break;
+				if (rlen <= 0) {
+					uwsgi_error("uwsgi_tuntap_loop()/read()");
+					exit(1);
+				}
+				uwsgi_tuntap_peer_push(uttr, uttp, uttr->buf, rlen, pending, &npending, 0);
 			}
+			uwsgi_tuntap_peers_flush(uttr, pending, npending, 0);
 			continue;
 		}
 
@@ -161,6 +211,8 @@ static void *uwsgi_tuntap_loop(void *arg) {
 				}
 			}
 		}
+
+		uwsgi_tuntap_peers_resume(uttr, 0);
 	}
 
 		return NULL;
@@ -208,6 +260,10 @@ void uwsgi_tuntap_router_loop(int id, void *arg) {
 
 	uttr->stats_server_fd = -1;
 	uttr->gateway_fd = -1;
+	uttr->peers_by_addr = uwsgi_calloc(sizeof(struct uwsgi_tuntap_peer *) * UWSGI_TUNTAP_PEERS);
+
+	// packets are read in batches
+	uwsgi_socket_nb(uttr->fd);
 
 	void *events = event_queue_alloc(64);
 	if (event_queue_add_fd_read(uttr->queue, uttr->server_fd))
@@ -240,7 +296,17 @@ void uwsgi_tuntap_router_loop(int id, void *arg) {
 		if (uttr->gateway_fd < 0) exit(1);
                 if (event_queue_add_fd_read(uttr->queue, uttr->gateway_fd)) exit(1);
 		uwsgi_log("*** tuntap gateway address enabled on %s\n", uttr->gateway);
-		uttr->gateway_buf = uwsgi_malloc(utt.buffer_size);
+		uttr->gateway_buf = uwsgi_malloc(utt.buffer_size * UWSGI_TUNTAP_BATCH);
+		uttr->gateway_rmsgs = uwsgi_calloc(sizeof(struct mmsghdr) * UWSGI_TUNTAP_BATCH);
+		uttr->gateway_riov = uwsgi_calloc(sizeof(struct iovec) * UWSGI_TUNTAP_BATCH);
+		uttr->gateway_smsgs = uwsgi_calloc(sizeof(struct mmsghdr) * UWSGI_TUNTAP_BATCH);
+		uttr->gateway_siov = uwsgi_calloc(sizeof(struct iovec) * UWSGI_TUNTAP_BATCH);
+		for (i = 0; i < UWSGI_TUNTAP_BATCH; i++) {
+			uttr->gateway_riov[i].iov_base = uttr->gateway_buf + (utt.buffer_size * i);
+			uttr->gateway_riov[i].iov_len = utt.buffer_size;
+			uttr->gateway_rmsgs[i].msg_hdr.msg_iov = &uttr->gateway_riov[i];
+			uttr->gateway_rmsgs[i].msg_hdr.msg_iovlen = 1;
+		}
 		uwsgi_socket_nb(uttr->gateway_fd);
 	}
 
@@ -254,40 +320,29 @@ void uwsgi_tuntap_router_loop(int id, void *arg) {
 					uwsgi_tuntap_enqueue(uttr);
 					continue;
 				}
-				ssize_t rlen = read(uttr->fd, uttr->buf, utt.buffer_size);
-				if (rlen <= 0) {
-					uwsgi_error("uwsgi_tuntap_router_loop()/read()");
-					exit(1);
-				}
-				if (rlen < 20) continue;
-
-				if (uwsgi_tuntap_firewall_check(utt.fw_in, uttr->buf, rlen)) continue;
+				struct uwsgi_tuntap_peer *pending[UWSGI_TUNTAP_BATCH];
+				int npending = 0, j;
+				for (j = 0; j < UWSGI_TUNTAP_BATCH; j++) {
+					ssize_t rlen = read(uttr->fd, uttr->buf, utt.buffer_size);
+					if (rlen < 0 && uwsgi_is_again()) break;
+					if (rlen <= 0) {
+						uwsgi_error("uwsgi_tuntap_router_loop()/read()");
+						exit(1);
+					}
+					if (rlen < 20) continue;
 
+					if (uwsgi_tuntap_firewall_check(&utt.fw_in, uttr->buf, rlen)) continue;
 
-				uint32_t *dst_ip = (uint32_t *) & uttr->buf[16];
-				struct uwsgi_tuntap_peer *uttp = uwsgi_tuntap_peer_get_by_addr(uttr, *dst_ip);
-				if (!uttp)
-					continue;
+					uint32_t *dst_ip = (uint32_t *) & uttr->buf[16];
+					struct uwsgi_tuntap_peer *uttp = uwsgi_tuntap_peer_get_by_addr(uttr, *dst_ip);
+					if (!uttp)
+						continue;
 
-				if (uwsgi_tuntap_peer_rules_check(uttr, uttp, uttr->buf, rlen, 0)) continue;
+					if (uwsgi_tuntap_peer_rules_check(uttr, uttp, uttr->buf, rlen, 0)) continue;
 
-				// check for full write buffer
-				if (uttp->write_buf_pktsize + 4 + rlen > utt.buffer_size) {
-					uttp->dropped++;
-					continue;
-				}
-
-				uint16_t pktsize = rlen;
-                        	char *ptr = uttp->write_buf + uttp->write_buf_pktsize;
-                        	memcpy(ptr + 4, uttr->buf, rlen);
-                        	ptr[0] = 0;
-                        	ptr[1] = (uint8_t) (pktsize & 0xff);
-                        	ptr[2] = (uint8_t) ((pktsize >> 8) & 0xff);
-                        	ptr[3] = 0;
-                        	uttp->write_buf_pktsize+= pktsize+4;
-				if (uwsgi_tuntap_peer_enqueue(uttr, uttp)) {
-					uwsgi_tuntap_peer_destroy(uttr, uttp);
+					uwsgi_tuntap_peer_push(uttr, uttp, uttr->buf, rlen, pending, &npending, 1);
 				}
+				uwsgi_tuntap_peers_flush(uttr, pending, npending, 1);
 				continue;
 			}
 
@@ -316,36 +371,28 @@ void uwsgi_tuntap_router_loop(int id, void *arg) {
 			}
 
 			if (uttr->gateway_fd > -1 && interesting_fd == uttr->gateway_fd) {
-				ssize_t rlen = read(uttr->gateway_fd, uttr->gateway_buf, utt.buffer_size);	
-				if (rlen <= 0) {
-                                        uwsgi_error("uwsgi_tuntap_router_loop()/read()");
+				int n = recvmmsg(uttr->gateway_fd, uttr->gateway_rmsgs, UWSGI_TUNTAP_BATCH, MSG_DONTWAIT, NULL);
+				if (n < 0) {
+					if (!uwsgi_is_again()) {
+						uwsgi_error("uwsgi_tuntap_router_loop()/recvmmsg()");
+					}
 					continue;
-                                }
-				if (rlen < 20) continue;
-				if (uwsgi_tuntap_firewall_check(utt.fw_in, uttr->gateway_buf, rlen)) continue;
-				uint32_t *dst_ip = (uint32_t *) & uttr->gateway_buf[16];
-                                struct uwsgi_tuntap_peer *uttp = uwsgi_tuntap_peer_get_by_addr(uttr, *dst_ip);
-                                if (!uttp)
-                                        continue;
-
-                                // check for full write buffer
-                                if (uttp->write_buf_pktsize + 4 + rlen > utt.buffer_size) {
-                                        uttp->dropped++;
-                                        continue;
-                                }
-
-                                uint16_t pktsize = rlen;
-                                char *ptr = uttp->write_buf + uttp->write_buf_pktsize;
-                                memcpy(ptr + 4, uttr->gateway_buf, rlen);
-                                ptr[0] = 0;
-                                ptr[1] = (uint8_t) (pktsize & 0xff);
-                                ptr[2] = (uint8_t) ((pktsize >> 8) & 0xff);
-                                ptr[3] = 0;
-                                uttp->write_buf_pktsize+= pktsize+4;
-                                if (uwsgi_tuntap_peer_enqueue(uttr, uttp)) {
-                                        uwsgi_tuntap_peer_destroy(uttr, uttp);
-                                }
-                                continue;
+				}
+				struct uwsgi_tuntap_peer *pending[UWSGI_TUNTAP_BATCH];
+				int npending = 0, j;
+				for (j = 0; j < n; j++) {
+					char *pkt = uttr->gateway_riov[j].iov_base;
+					uint16_t rlen = uttr->gateway_rmsgs[j].msg_len;
+					if (rlen < 20) continue;
+					if (uwsgi_tuntap_firewall_check(&utt.fw_in, pkt, rlen)) continue;
+					uint32_t *dst_ip = (uint32_t *) & pkt[16];
+					struct uwsgi_tuntap_peer *uttp = uwsgi_tuntap_peer_get_by_addr(uttr, *dst_ip);
+					if (!uttp)
+						continue;
+					uwsgi_tuntap_peer_push(uttr, uttp, pkt, rlen, pending, &npending, 1);
+				}
+				uwsgi_tuntap_peers_flush(uttr, pending, npending, 1);
+				continue;
 			}
 
 			struct uwsgi_tuntap_peer *uttp = uttr->peers_head;
@@ -406,6 +453,8 @@ void uwsgi_tuntap_router_loop(int id, void *arg) {
 				uttp = uttp->next;
 			}
 		}
+
+		uwsgi_tuntap_peers_resume(uttr, 1);
 	}
 }
 
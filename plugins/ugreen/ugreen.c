@@ -20,9 +20,16 @@ struct uwsgi_ugreen {
         ucontext_t      main;
         ucontext_t    *contexts;
         size_t          u_stack_size;
+	// stacks are taken from the pool when a request starts and given back when it ends
+	struct uwsgi_stack_pool *pool;
+	struct uwsgi_stack **stacks;
+	int stack_pool;
+	int stack_trim;
+	int finished;
 } ug;
 
 #define UGREEN_DEFAULT_STACKSIZE 256*1024
+#define UGREEN_DEFAULT_STACK_POOL 64
 
 
 extern struct uwsgi_server uwsgi;
@@ -30,9 +37,17 @@ extern struct uwsgi_server uwsgi;
 static struct uwsgi_option ugreen_options[] = {
 	{"ugreen", no_argument, 0, "enable ugreen coroutine subsystem", uwsgi_opt_true, &ug.ugreen, 0},
 	{"ugreen-stacksize", required_argument, 0, "set ugreen stack size in pages", uwsgi_opt_set_int, &ug.stackpages, 0},
+	{"ugreen-stack-pool", required_argument, 0, "set the max number of idle ugreen stacks kept for reuse (default 64)", uwsgi_opt_set_int, &ug.stack_pool, 0},
+	{"ugreen-stack-trim", no_argument, 0, "release the memory of the ugreen stacks when they are recycled", uwsgi_opt_true, &ug.stack_trim, 0},
 	{ 0, 0, 0, 0, 0, 0, 0 }
 };
 
+static void u_green_request() {
+	async_schedule_to_req_green();
+	// back to the main stack (uc_link), the stack can be recycled
+	ug.finished = 1;
+}
+
 static void u_green_schedule_to_req() {
 
 	int id = uwsgi.wsgi_req->async_id;
@@ -40,8 +55,15 @@ static void u_green_schedule_to_req() {
 
 	// first round ?
 	if (!uwsgi.wsgi_req->suspended) {
+		ug.stacks[id] = uwsgi_stack_get(ug.pool);
+		if (!ug.stacks[id]) {
+			uwsgi_log("[uGreen] unable to allocate a stack for core %d\n", id);
+			exit(1);
+		}
+		ug.contexts[id].uc_stack.ss_sp = ug.stacks[id]->sp;
+		ug.contexts[id].uc_stack.ss_size = ug.stacks[id]->size;
 		ug.contexts[id].uc_link = &ug.main;
-        	makecontext(&ug.contexts[id], async_schedule_to_req_green, 0);
+        	makecontext(&ug.contexts[id], u_green_request, 0);
 		uwsgi.wsgi_req->suspended = 1;
 	}
 
@@ -53,6 +75,12 @@ static void u_green_schedule_to_req() {
 	// save the main stack and switch to the core
 	swapcontext(&ug.main, &ug.contexts[id] );		
 
+	if (ug.finished) {
+		ug.finished = 0;
+		uwsgi_stack_put(ug.pool, ug.stacks[id]);
+		ug.stacks[id] = NULL;
+	}
+
 	// call it in the main core
 	if (uwsgi.p[modifier1]->resume) {
 		uwsgi.p[modifier1]->resume(NULL);
@@ -92,33 +120,20 @@ static int u_green_init() {
 		ug.u_stack_size = ug.stackpages * uwsgi.page_size;
 	}
 
-	uwsgi_log("initializing %d uGreen threads with stack size of %lu (%lu KB)\n", uwsgi.async, (unsigned long) ug.u_stack_size,  (unsigned long) ug.u_stack_size/1024);
+	if (!ug.stack_pool) {
+		ug.stack_pool = UGREEN_DEFAULT_STACK_POOL;
+	}
+
+	uwsgi_log("initializing %d uGreen threads with stack size of %lu (%lu KB), stacks are mapped on demand (%d kept for reuse)\n", uwsgi.async, (unsigned long) ug.u_stack_size,  (unsigned long) ug.u_stack_size/1024, ug.stack_pool);
 
 
 	ug.contexts = uwsgi_malloc( sizeof(ucontext_t) * uwsgi.async);
+	ug.stacks = uwsgi_calloc( sizeof(struct uwsgi_stack *) * uwsgi.async);
+	ug.pool = uwsgi_stack_pool_new(ug.u_stack_size, ug.stack_pool, ug.stack_trim);
 
 
 	for(i=0;i<uwsgi.async;i++) {
 		getcontext(&ug.contexts[i]);
-		void *page_base_ptr = mmap(NULL, ug.u_stack_size + (uwsgi.page_size*2) , PROT_READ | PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE, -1, 0);
-		if (page_base_ptr == MAP_FAILED) {
-			uwsgi_error("mmap()");
-			exit(1);
-		}
-		ug.contexts[i].uc_stack.ss_sp = page_base_ptr + uwsgi.page_size;
-
-		// set guard pages for stack
-		if (mprotect(ug.contexts[i].uc_stack.ss_sp - uwsgi.page_size, uwsgi.page_size, PROT_NONE)) {
-			uwsgi_error("mprotect()");
-			exit(1);
-		}
-		if (mprotect(ug.contexts[i].uc_stack.ss_sp + ug.u_stack_size, uwsgi.page_size, PROT_NONE)) {
-			uwsgi_error("mprotect()");
-			exit(1);
-		}
-
-		ug.contexts[i].uc_stack.ss_size = ug.u_stack_size;
-
 	}
 
 
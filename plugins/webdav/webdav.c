@@ -6,6 +6,12 @@
 #include <sys/xattr.h>
 #endif
 
+#ifdef UWSGI_EVENT_FILEMONITOR_USE_INOTIFY
+#ifndef OBSOLETE_LINUX_KERNEL
+#include <sys/inotify.h>
+#endif
+#endif
+
 /*
 
 	rfc4918 implementation (WebDAV)
@@ -42,6 +48,9 @@
 
 	- Resource properties are stored as filesystem xattr (warning, not all operating system support them) -
 
+	PROPFIND multistatus responses are streamed to the client one <response> at a time, and the
+	collections metadata can be cached in every worker with --webdav-dir-cache <n> (see below)
+
 */
 
 extern struct uwsgi_server uwsgi;
@@ -77,6 +86,8 @@ struct uwsgi_webdav {
 
 	struct uwsgi_string_list *skip_prop;
 
+	int dir_cache;
+
 } udav;
 
 struct uwsgi_option uwsgi_webdav_options[] = {
@@ -108,6 +119,8 @@ struct uwsgi_option uwsgi_webdav_options[] = {
 
 	{ "webdav-skip-prop", required_argument, 0, "do not add the specified prop if available in resource xattr", uwsgi_opt_add_string_list, &udav.skip_prop, UWSGI_OPT_MIME},
 
+	{ "webdav-dir-cache", required_argument, 0, "cache the metadata of the specified number of directories in every worker (invalidated via inotify)", uwsgi_opt_set_int, &udav.dir_cache, UWSGI_OPT_MIME},
+
 	{ 0, 0, 0, 0, 0, 0, 0 },
 };
 
@@ -228,9 +241,16 @@ static char *uwsgi_webdav_new_date(uint64_t t) {
 	return uwsgi_concat2n(d, len, "", 0);
 }
 
-static int uwsgi_webdav_add_props(struct wsgi_request *wsgi_req, xmlNode *req_prop, xmlNode * multistatus, xmlNsPtr dav_ns, char *uri, char *filename, int with_values) {
+/*
+	stat_cache/xattrs_cache are the metadata cached by the directory cache (if available),
+	xattrs_cache_len is -1 when the xattrs list has to be read from the filesystem
+*/
+static int uwsgi_webdav_add_props(struct wsgi_request *wsgi_req, xmlNode *req_prop, xmlNode * multistatus, xmlNsPtr dav_ns, char *uri, char *filename, int with_values, struct stat *stat_cache, char *xattrs_cache, ssize_t xattrs_cache_len) {
 	struct stat st;
-	if (stat(filename, &st)) {
+	if (stat_cache) {
+		st = *stat_cache;
+	}
+	else if (stat(filename, &st)) {
 		uwsgi_error("uwsgi_webdav_add_props()/stat()");
 		return -1;
 	}
@@ -402,15 +422,25 @@ static int uwsgi_webdav_add_props(struct wsgi_request *wsgi_req, xmlNode *req_pr
 
 #if defined(__linux__) || defined(__APPLE__)
 	// get xattr for user.uwsgi.webdav.
+	ssize_t rlen = 0;
+	char *xattrs = NULL;
+	if (xattrs_cache_len >= 0) {
+		if (xattrs_cache_len == 0) return 0;
+		rlen = xattrs_cache_len;
+		// the names are tokenized in place
+		xattrs = uwsgi_malloc(rlen);
+		memcpy(xattrs, xattrs_cache, rlen);
+		goto parse;
+	}
 #if defined(__linux__)
-	ssize_t rlen = listxattr(filename, NULL, 0);
+	rlen = listxattr(filename, NULL, 0);
 #elif defined(__APPLE__)
-	ssize_t rlen = listxattr(filename, NULL, 0, 0);
+	rlen = listxattr(filename, NULL, 0, 0);
 #endif
 	// do not return -1 as the previous xml is valid !!!
 	if (rlen <= 0) return 0;
 	// use calloc to avoid races
-	char *xattrs = uwsgi_calloc(rlen);
+	xattrs = uwsgi_calloc(rlen);
 #if defined(__linux__)
 	if (listxattr(filename, xattrs, rlen) <= 0) {
 #elif defined(__APPLE__)
@@ -419,6 +449,8 @@ static int uwsgi_webdav_add_props(struct wsgi_request *wsgi_req, xmlNode *req_pr
 		free(xattrs);
 		return 0;
 	}
+parse:
+	;
 	// parse the name list
 	ssize_t i;
 	char *key = NULL;
@@ -513,7 +545,278 @@ static size_t uwsgi_webdav_expand_fake_path(struct wsgi_request *wsgi_req, char
 	return filename_len;
 }
 
-static xmlDoc *uwsgi_webdav_manage_prop(struct wsgi_request *wsgi_req, xmlNode *req_prop, char *filename, size_t filename_len, int with_values) {
+/*
+	directory metadata cache (--webdav-dir-cache <n>)
+
+	every worker keeps the entries (name, stat and xattrs list) of its last <n> listed collections,
+	so Depth: 1 PROPFIND on big (and mostly idle) directories do not need a stat()/listxattr() storm.
+	Each cached directory is watched by a per-worker inotify instance (added before scanning the directory, so no
+	change can be lost), pending events are consumed at every lookup and invalidate the related item.
+	Items are refcounted as they could be in use by other threads (or async cores) while being invalidated.
+
+	Platforms without inotify always scan the directory.
+*/
+
+struct uwsgi_webdav_dirent {
+	char *name;
+	struct stat st;
+	char *xattrs;
+	ssize_t xattrs_len;
+};
+
+struct uwsgi_webdav_dir {
+	char *path;
+	uint32_t hash;
+	int wd;
+	int refcnt;
+	uint64_t last_use;
+	struct uwsgi_webdav_dirent *entries;
+	size_t entries_cnt;
+};
+
+static int uwsgi_webdav_dir_scan(struct uwsgi_webdav_dir *dir, char *filename, size_t filename_len) {
+	DIR *collection = opendir(filename);
+	if (!collection) return -1;
+	size_t allocated = 64;
+	dir->entries = uwsgi_malloc(sizeof(struct uwsgi_webdav_dirent) * allocated);
+	dir->entries_cnt = 0;
+	struct dirent de;
+	for (;;) {
+		struct dirent *de_r = NULL;
+		if (readdir_r(collection, &de, &de_r)) {
+			uwsgi_error("uwsgi_webdav_dir_scan()/readdir_r()");
+			break;
+		}
+		if (de_r == NULL) {
+			break;
+		}
+		// skip ..
+		if (!strcmp(de.d_name, "..")) continue;
+		char *direntry = uwsgi_concat3n(filename, filename_len, "/", 1, de.d_name, strlen(de.d_name));
+		struct uwsgi_webdav_dirent *ude = &dir->entries[dir->entries_cnt];
+		if (stat(direntry, &ude->st)) {
+			// vanished (or dangling symlink)
+			free(direntry);
+			continue;
+		}
+		ude->xattrs = NULL;
+		ude->xattrs_len = 0;
+#if defined(__linux__) || defined(__APPLE__)
+#if defined(__linux__)
+		ssize_t rlen = listxattr(direntry, NULL, 0);
+#elif defined(__APPLE__)
+		ssize_t rlen = listxattr(direntry, NULL, 0, 0);
+#endif
+		if (rlen > 0) {
+			ude->xattrs = uwsgi_calloc(rlen);
+#if defined(__linux__)
+			ude->xattrs_len = listxattr(direntry, ude->xattrs, rlen);
+#elif defined(__APPLE__)
+			ude->xattrs_len = listxattr(direntry, ude->xattrs, rlen, 0);
+#endif
+			if (ude->xattrs_len < 0) ude->xattrs_len = 0;
+		}
+#endif
+		free(direntry);
+		ude->name = uwsgi_str(de.d_name);
+		dir->entries_cnt++;
+		if (dir->entries_cnt >= allocated) {
+			allocated *= 2;
+			dir->entries = realloc(dir->entries, sizeof(struct uwsgi_webdav_dirent) * allocated);
+			if (!dir->entries) {
+				uwsgi_error("uwsgi_webdav_dir_scan()/realloc()");
+				exit(1);
+			}
+		}
+	}
+	closedir(collection);
+	return 0;
+}
+
+static void uwsgi_webdav_dir_free(struct uwsgi_webdav_dir *dir) {
+	size_t i;
+	for(i=0;i<dir->entries_cnt;i++) {
+		free(dir->entries[i].name);
+		free(dir->entries[i].xattrs);
+	}
+	free(dir->entries);
+	free(dir->path);
+	free(dir);
+}
+
+// a scan not tracked by the cache
+static struct uwsgi_webdav_dir *uwsgi_webdav_dir_new(char *filename, size_t filename_len) {
+	struct uwsgi_webdav_dir *dir = uwsgi_calloc(sizeof(struct uwsgi_webdav_dir));
+	dir->path = uwsgi_concat2n(filename, filename_len, "", 0);
+	dir->refcnt = 1;
+	if (uwsgi_webdav_dir_scan(dir, filename, filename_len)) {
+		uwsgi_webdav_dir_free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+#if defined(UWSGI_EVENT_FILEMONITOR_USE_INOTIFY) && !defined(OBSOLETE_LINUX_KERNEL)
+static struct {
+	pthread_mutex_t lock;
+	int fd;
+	pid_t pid;
+	uint64_t clock;
+	struct uwsgi_webdav_dir **items;
+} udav_dir_cache = { PTHREAD_MUTEX_INITIALIZER, -1, 0, 0, NULL };
+
+// must be called with the lock held
+static void uwsgi_webdav_dir_cache_drop(int slot) {
+	struct uwsgi_webdav_dir *dir = udav_dir_cache.items[slot];
+	udav_dir_cache.items[slot] = NULL;
+	// the watch could already be gone (IN_IGNORED), the error is harmless
+	inotify_rm_watch(udav_dir_cache.fd, dir->wd);
+	if (--dir->refcnt == 0) uwsgi_webdav_dir_free(dir);
+}
+
+// consume pending inotify events, must be called with the lock held
+static void uwsgi_webdav_dir_cache_events() {
+	char buf[8192] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	for(;;) {
+		ssize_t rlen = read(udav_dir_cache.fd, buf, sizeof(buf));
+		if (rlen <= 0) break;
+		char *ptr = buf;
+		while(ptr < buf + rlen) {
+			struct inotify_event *ie = (struct inotify_event *) ptr;
+			int i;
+			for(i=0;i<udav.dir_cache;i++) {
+				struct uwsgi_webdav_dir *dir = udav_dir_cache.items[i];
+				if (!dir) continue;
+				if (dir->wd == ie->wd || (ie->mask & IN_Q_OVERFLOW)) {
+					uwsgi_webdav_dir_cache_drop(i);
+				}
+			}
+			ptr += sizeof(struct inotify_event) + ie->len;
+		}
+	}
+}
+
+static struct uwsgi_webdav_dir *uwsgi_webdav_dir_get(char *filename, size_t filename_len) {
+	struct uwsgi_webdav_dir *dir = NULL;
+	uint32_t hash = djb33x_hash(filename, filename_len);
+	int i, free_slot = -1, lru_slot = 0;
+	if (udav.dir_cache <= 0) return uwsgi_webdav_dir_new(filename, filename_len);
+	pthread_mutex_lock(&udav_dir_cache.lock);
+	// the cache cannot be inherited from the master
+	if (udav_dir_cache.pid != getpid()) {
+		udav_dir_cache.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (udav_dir_cache.fd < 0) {
+			uwsgi_error("uwsgi_webdav_dir_get()/inotify_init1()");
+			pthread_mutex_unlock(&udav_dir_cache.lock);
+			return NULL;
+		}
+		udav_dir_cache.items = uwsgi_calloc(sizeof(struct uwsgi_webdav_dir *) * udav.dir_cache);
+		udav_dir_cache.pid = getpid();
+	}
+	uwsgi_webdav_dir_cache_events();
+	udav_dir_cache.clock++;
+	for(i=0;i<udav.dir_cache;i++) {
+		struct uwsgi_webdav_dir *item = udav_dir_cache.items[i];
+		if (!item) {
+			if (free_slot < 0) free_slot = i;
+			continue;
+		}
+		if (item->hash == hash && !strcmp(item->path, filename)) {
+			item->last_use = udav_dir_cache.clock;
+			item->refcnt++;
+			pthread_mutex_unlock(&udav_dir_cache.lock);
+			return item;
+		}
+		if (udav_dir_cache.items[lru_slot] && item->last_use < udav_dir_cache.items[lru_slot]->last_use) lru_slot = i;
+	}
+
+	dir = uwsgi_calloc(sizeof(struct uwsgi_webdav_dir));
+	dir->path = uwsgi_concat2n(filename, filename_len, "", 0);
+	dir->hash = hash;
+	dir->refcnt = 1;
+	dir->wd = inotify_add_watch(udav_dir_cache.fd, filename, IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE);
+	if (dir->wd < 0) {
+		uwsgi_error("uwsgi_webdav_dir_get()/inotify_add_watch()");
+		pthread_mutex_unlock(&udav_dir_cache.lock);
+		uwsgi_webdav_dir_free(dir);
+		return uwsgi_webdav_dir_new(filename, filename_len);
+	}
+	// the scan is done with the lock held, so a concurrent lookup of the same directory waits for it
+	if (uwsgi_webdav_dir_scan(dir, filename, filename_len)) {
+		inotify_rm_watch(udav_dir_cache.fd, dir->wd);
+		pthread_mutex_unlock(&udav_dir_cache.lock);
+		uwsgi_webdav_dir_free(dir);
+		return NULL;
+	}
+	if (free_slot < 0) {
+		free_slot = lru_slot;
+		uwsgi_webdav_dir_cache_drop(free_slot);
+	}
+	dir->last_use = udav_dir_cache.clock;
+	// one reference for the cache, one for the caller
+	dir->refcnt = 2;
+	udav_dir_cache.items[free_slot] = dir;
+	pthread_mutex_unlock(&udav_dir_cache.lock);
+	return dir;
+}
+
+static void uwsgi_webdav_dir_put(struct uwsgi_webdav_dir *dir) {
+	pthread_mutex_lock(&udav_dir_cache.lock);
+	int refcnt = --dir->refcnt;
+	pthread_mutex_unlock(&udav_dir_cache.lock);
+	if (refcnt == 0) uwsgi_webdav_dir_free(dir);
+}
+#else
+static struct uwsgi_webdav_dir *uwsgi_webdav_dir_get(char *filename, size_t filename_len) {
+	return uwsgi_webdav_dir_new(filename, filename_len);
+}
+
+static void uwsgi_webdav_dir_put(struct uwsgi_webdav_dir *dir) {
+	if (--dir->refcnt == 0) uwsgi_webdav_dir_free(dir);
+}
+#endif
+
+/*
+	the multistatus response is streamed: every <response> node is serialized (and freed) as soon as it is built.
+	Responses smaller than UWSGI_WEBDAV_STREAM_CHUNK are sent in one shot with a Content-Length,
+	bigger ones are flushed chunk by chunk without it.
+*/
+#define UWSGI_WEBDAV_STREAM_CHUNK 32768
+
+struct uwsgi_webdav_stream {
+	xmlDoc *rdoc;
+	xmlNode *multistatus;
+	xmlNsPtr dav_ns;
+	xmlBufferPtr xbuf;
+	struct uwsgi_buffer *ub;
+	int streaming;
+};
+
+static int uwsgi_webdav_stream_flush(struct wsgi_request *wsgi_req, struct uwsgi_webdav_stream *uws) {
+	uws->streaming = 1;
+	if (uwsgi_response_write_body_do(wsgi_req, uws->ub->buf, uws->ub->pos)) return -1;
+	uws->ub->pos = 0;
+	return 0;
+}
+
+static int uwsgi_webdav_stream_last(struct wsgi_request *wsgi_req, struct uwsgi_webdav_stream *uws) {
+	xmlNode *response = uws->multistatus->last;
+	if (!response) return 0;
+	xmlBufferEmpty(uws->xbuf);
+	int ret = xmlNodeDump(uws->xbuf, uws->rdoc, response, 1, 1);
+	xmlUnlinkNode(response);
+	xmlFreeNode(response);
+	if (ret < 0) return -1;
+	if (uwsgi_buffer_append(uws->ub, "  ", 2)) return -1;
+	if (uwsgi_buffer_append(uws->ub, (char *) xmlBufferContent(uws->xbuf), xmlBufferLength(uws->xbuf))) return -1;
+	if (uwsgi_buffer_append(uws->ub, "\n", 1)) return -1;
+	if (uws->ub->pos >= UWSGI_WEBDAV_STREAM_CHUNK) {
+		return uwsgi_webdav_stream_flush(wsgi_req, uws);
+	}
+	return 0;
+}
+
+static void uwsgi_webdav_manage_prop(struct wsgi_request *wsgi_req, xmlNode *req_prop, char *filename, size_t filename_len, int with_values) {
 	// default 1 depth
 	int depth = 1;
         uint16_t http_depth_len = 0;
@@ -522,56 +825,65 @@ static xmlDoc *uwsgi_webdav_manage_prop(struct wsgi_request *wsgi_req, xmlNode *
                 depth = uwsgi_str_num(http_depth, http_depth_len);
         }
 
-	xmlDoc *rdoc = xmlNewDoc(BAD_CAST "1.0");
-        xmlNode *multistatus = xmlNewNode(NULL, BAD_CAST "multistatus");
-        xmlDocSetRootElement(rdoc, multistatus);
-        xmlNsPtr dav_ns = xmlNewNs(multistatus, BAD_CAST "DAV:", BAD_CAST "D");
-        xmlSetNs(multistatus, dav_ns);
-
-	if (depth == 0) {
+	struct uwsgi_webdav_stream uws;
+	memset(&uws, 0, sizeof(struct uwsgi_webdav_stream));
+	uws.rdoc = xmlNewDoc(BAD_CAST "1.0");
+        uws.multistatus = xmlNewNode(NULL, BAD_CAST "multistatus");
+        xmlDocSetRootElement(uws.rdoc, uws.multistatus);
+        uws.dav_ns = xmlNewNs(uws.multistatus, BAD_CAST "DAV:", BAD_CAST "D");
+        xmlSetNs(uws.multistatus, uws.dav_ns);
+	uws.xbuf = xmlBufferCreate();
+	uws.ub = uwsgi_buffer_new(UWSGI_WEBDAV_STREAM_CHUNK + uwsgi.page_size);
+	if (uwsgi_buffer_append(uws.ub, "<?xml version=\"1.0\"?>\n<D:multistatus xmlns:D=\"DAV:\">\n", 53)) goto end;
+
+	// not a collection (or not readable) ? fallback to the resource itself
+	struct uwsgi_webdav_dir *dir = depth != 0 ? uwsgi_webdav_dir_get(filename, filename_len) : NULL;
+
+	if (!dir) {
                 char *uri = uwsgi_concat2n(wsgi_req->path_info, wsgi_req->path_info_len, "", 0);
-                uwsgi_webdav_add_props(wsgi_req, req_prop, multistatus, dav_ns, uri, filename, with_values);
+                uwsgi_webdav_add_props(wsgi_req, req_prop, uws.multistatus, uws.dav_ns, uri, filename, with_values, NULL, NULL, -1);
                 free(uri);
+		if (uwsgi_webdav_stream_last(wsgi_req, &uws)) goto end;
         }
         else {
-                DIR *collection = opendir(filename);
-                struct dirent de;
-                for (;;) {
-                        struct dirent *de_r = NULL;
-                        if (readdir_r(collection, &de, &de_r)) {
-                                uwsgi_error("uwsgi_wevdav_manage_propfind()/readdir_r()");
-                                break;
-                        }
-                        if (de_r == NULL) {
-                                break;
-                        }
+		size_t i, entries_cnt = dir->entries_cnt;
+		for(i=0;i<entries_cnt;i++) {
+			struct uwsgi_webdav_dirent *ude = &dir->entries[i];
                         char *uri = NULL;
                         char *direntry = NULL;
-                        if (!strcmp(de.d_name, "..")) {
-                                // skip ..
-                                continue;
-                        }
-                        else if (!strcmp(de.d_name, ".")) {
+                        if (!strcmp(ude->name, ".")) {
                                 uri = uwsgi_concat2n(wsgi_req->path_info, wsgi_req->path_info_len, "", 0);
                                 direntry = uwsgi_concat2n(filename, filename_len, "", 0);
                         }
                         else if (wsgi_req->path_info[wsgi_req->path_info_len - 1] == '/') {
-                                uri = uwsgi_concat2n(wsgi_req->path_info, wsgi_req->path_info_len, de.d_name, strlen(de.d_name));
-                                direntry = uwsgi_concat3n(filename, filename_len, "/", 1, de.d_name, strlen(de.d_name));
+                                uri = uwsgi_concat2n(wsgi_req->path_info, wsgi_req->path_info_len, ude->name, strlen(ude->name));
+                                direntry = uwsgi_concat3n(filename, filename_len, "/", 1, ude->name, strlen(ude->name));
                         }
                         else {
-                                uri = uwsgi_concat3n(wsgi_req->path_info, wsgi_req->path_info_len, "/", 1, de.d_name, strlen(de.d_name));
-                                direntry = uwsgi_concat3n(filename, filename_len, "/", 1, de.d_name, strlen(de.d_name));
+                                uri = uwsgi_concat3n(wsgi_req->path_info, wsgi_req->path_info_len, "/", 1, ude->name, strlen(ude->name));
+                                direntry = uwsgi_concat3n(filename, filename_len, "/", 1, ude->name, strlen(ude->name));
                         }
-                        uwsgi_webdav_add_props(wsgi_req, req_prop, multistatus, dav_ns, uri, direntry, with_values);
+                        uwsgi_webdav_add_props(wsgi_req, req_prop, uws.multistatus, uws.dav_ns, uri, direntry, with_values, &ude->st, ude->xattrs, ude->xattrs_len);
                         free(uri);
                         free(direntry);
+			if (uwsgi_webdav_stream_last(wsgi_req, &uws)) break;
                 }
-                closedir(collection);
+		uwsgi_webdav_dir_put(dir);
+		if (i < entries_cnt) goto end;
         }
 
-	return rdoc;
-	
+	if (uwsgi_buffer_append(uws.ub, "</D:multistatus>\n", 17)) goto end;
+	if (!uws.streaming) {
+		uwsgi_response_add_content_length(wsgi_req, uws.ub->pos);
+	}
+#ifdef UWSGI_DEBUG
+	uwsgi_log("\n%.*s\n", uws.ub->pos, uws.ub->buf);
+#endif
+	uwsgi_webdav_stream_flush(wsgi_req, &uws);
+end:
+	uwsgi_buffer_destroy(uws.ub);
+	xmlBufferFree(uws.xbuf);
+	xmlFreeDoc(uws.rdoc);
 }
 
 static int uwsgi_wevdav_manage_propfind(struct wsgi_request *wsgi_req, xmlDoc * doc) {
@@ -581,7 +893,6 @@ static int uwsgi_wevdav_manage_propfind(struct wsgi_request *wsgi_req, xmlDoc *
 		uwsgi_404(wsgi_req);
 		return UWSGI_OK;
 	}
-	xmlDoc *rdoc = NULL;
 	xmlNode *element = NULL;
 
 	if (doc) {
@@ -603,15 +914,15 @@ static int uwsgi_wevdav_manage_propfind(struct wsgi_request *wsgi_req, xmlDoc *
 		if (node->type == XML_ELEMENT_NODE) {
 			if (node->ns && !strcmp((char *) node->ns->href, "DAV:")) {
                 		if (!strcmp((char *) node->name, "prop")) {
-					rdoc = uwsgi_webdav_manage_prop(wsgi_req, node, filename, filename_len, 1);
+					uwsgi_webdav_manage_prop(wsgi_req, node, filename, filename_len, 1);
 					break;
 				}
 				if (!strcmp((char *) node->name, "allprop")) {
-					rdoc = uwsgi_webdav_manage_prop(wsgi_req, NULL, filename, filename_len, 1);
+					uwsgi_webdav_manage_prop(wsgi_req, NULL, filename, filename_len, 1);
 					break;
 				}
 				if (!strcmp((char *) node->name, "propname")) {
-					rdoc = uwsgi_webdav_manage_prop(wsgi_req, node, filename, filename_len, 0);
+					uwsgi_webdav_manage_prop(wsgi_req, node, filename, filename_len, 0);
 					break;
 				}
 			}
@@ -619,21 +930,9 @@ static int uwsgi_wevdav_manage_propfind(struct wsgi_request *wsgi_req, xmlDoc *
 	}
 	}
 	else {
-		rdoc = uwsgi_webdav_manage_prop(wsgi_req, NULL, filename, filename_len, 1);
+		uwsgi_webdav_manage_prop(wsgi_req, NULL, filename, filename_len, 1);
 	}
 
-	if (!rdoc) return UWSGI_OK;
-
-	xmlChar *xmlbuf;
-	int xlen = 0;
-	xmlDocDumpFormatMemory(rdoc, &xmlbuf, &xlen, 1);
-	uwsgi_response_add_content_length(wsgi_req, xlen);
-	uwsgi_response_write_body_do(wsgi_req, (char *) xmlbuf, xlen);
-#ifdef UWSGI_DEBUG
-	uwsgi_log("\n%.*s\n", xlen, xmlbuf);
-#endif
-	xmlFreeDoc(rdoc);
-	xmlFree(xmlbuf);
 	return UWSGI_OK;
 }
 
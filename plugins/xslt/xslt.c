@@ -3,6 +3,8 @@
 #include <libxslt/xsltutils.h>
 #include <libxslt/transform.h>
 
+extern struct uwsgi_server uwsgi;
+
 /*
 
 	XSLT request plugin
@@ -19,6 +21,13 @@
 
 	toxslt:stylesheet=<path2>,params=<params>
 
+	Compiled stylesheets are cached in every worker (--xslt-cache-items, default 32, --xslt-no-cache to disable),
+	an item is recompiled when the mtime (or size, or inode) of its file changes. Imported/included stylesheets
+	are not checked.
+
+	With --xslt-threads <n> the transformations are run by a pool of threads in every worker, the request core
+	waits for the result with the wait_read_hook, so in async modes (ugreen, gevent...) the other cores can go on.
+
 */
 
 struct uwsgi_xslt_config {
@@ -28,6 +37,9 @@ struct uwsgi_xslt_config {
 	struct uwsgi_string_list *stylesheet;
 	char *content_type;
 	uint16_t content_type_len;
+	int cache_items;
+	int no_cache;
+	int threads;
 } uxslt;
 
 struct uwsgi_router_xslt_conf {
@@ -53,13 +65,126 @@ struct uwsgi_option uwsgi_xslt_options[] = {
 	{"xslt-var", required_argument, 0, "get the xslt stylesheet path from the specified request var", uwsgi_opt_add_string_list, &uxslt.var, 0},
 	{"xslt-stylesheet", required_argument, 0, "if no xslt stylesheet file can be found, use the specified one", uwsgi_opt_add_string_list, &uxslt.stylesheet, 0},
 	{"xslt-content-type", required_argument, 0, "set the content-type for the xslt result (default: text/html)", uwsgi_opt_set_str, &uxslt.content_type, 0},
+	{"xslt-cache-items", required_argument, 0, "set the number of compiled stylesheets cached by every worker (default 32)", uwsgi_opt_set_int, &uxslt.cache_items, 0},
+	{"xslt-no-cache", no_argument, 0, "do not cache compiled stylesheets", uwsgi_opt_true, &uxslt.no_cache, 0},
+	{"xslt-threads", required_argument, 0, "run xslt transformations in the specified number of threads per worker", uwsgi_opt_set_int, &uxslt.threads, 0},
 	{NULL, 0, 0, NULL, NULL, NULL, 0},
 };
 
+struct uwsgi_xslt_stylesheet {
+	char *path;
+	uint32_t hash;
+	time_t mtime;
+	off_t size;
+	ino_t ino;
+	int refcnt;
+	uint64_t last_use;
+	xsltStylesheetPtr ss;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	uint64_t clock;
+	struct uwsgi_xslt_stylesheet **items;
+} uxslt_cache = { PTHREAD_MUTEX_INITIALIZER, 0, NULL };
+
+// must be called with the lock held (or for items not in the cache)
+static void uwsgi_xslt_stylesheet_put_locked(struct uwsgi_xslt_stylesheet *uxs) {
+	if (--uxs->refcnt > 0) return;
+	xsltFreeStylesheet(uxs->ss);
+	free(uxs->path);
+	free(uxs);
+}
+
+static void uwsgi_xslt_stylesheet_put(struct uwsgi_xslt_stylesheet *uxs) {
+	pthread_mutex_lock(&uxslt_cache.lock);
+	uwsgi_xslt_stylesheet_put_locked(uxs);
+	pthread_mutex_unlock(&uxslt_cache.lock);
+}
+
+static struct uwsgi_xslt_stylesheet *uwsgi_xslt_stylesheet_compile(char *xsltfile, struct stat *st) {
+	xsltStylesheetPtr ss = xsltParseStylesheetFile((const xmlChar *) xsltfile);
+	if (!ss) return NULL;
+	struct uwsgi_xslt_stylesheet *uxs = uwsgi_calloc(sizeof(struct uwsgi_xslt_stylesheet));
+	uxs->path = uwsgi_str(xsltfile);
+	uxs->hash = djb33x_hash(xsltfile, strlen(xsltfile));
+	uxs->mtime = st->st_mtime;
+	uxs->size = st->st_size;
+	uxs->ino = st->st_ino;
+	uxs->refcnt = 1;
+	uxs->ss = ss;
+	return uxs;
+}
+
+/*
+	get a compiled stylesheet (with a reference, release it with uwsgi_xslt_stylesheet_put())
+
+	the compilation is done without the lock held, if two cores compile the same stylesheet
+	at the same time the last one wins the cache slot
+*/
+static struct uwsgi_xslt_stylesheet *uwsgi_xslt_stylesheet_get(char *xsltfile) {
+	struct stat st;
+	if (stat(xsltfile, &st)) {
+		uwsgi_error_open(xsltfile);
+		return NULL;
+	}
+
+	if (uxslt.no_cache) return uwsgi_xslt_stylesheet_compile(xsltfile, &st);
+
+	if (!uxslt.cache_items) uxslt.cache_items = 32;
+	uint32_t hash = djb33x_hash(xsltfile, strlen(xsltfile));
+	int i, slot = -1;
+
+	pthread_mutex_lock(&uxslt_cache.lock);
+	if (!uxslt_cache.items) {
+		uxslt_cache.items = uwsgi_calloc(sizeof(struct uwsgi_xslt_stylesheet *) * uxslt.cache_items);
+	}
+	uxslt_cache.clock++;
+	for(i=0;i<uxslt.cache_items;i++) {
+		struct uwsgi_xslt_stylesheet *uxs = uxslt_cache.items[i];
+		if (!uxs) continue;
+		if (uxs->hash != hash || strcmp(uxs->path, xsltfile)) continue;
+		if (uxs->mtime == st.st_mtime && uxs->size == st.st_size && uxs->ino == st.st_ino) {
+			uxs->last_use = uxslt_cache.clock;
+			uxs->refcnt++;
+			pthread_mutex_unlock(&uxslt_cache.lock);
+			return uxs;
+		}
+		// stale, cores still using it will release it
+		uxslt_cache.items[i] = NULL;
+		uwsgi_xslt_stylesheet_put_locked(uxs);
+		break;
+	}
+	pthread_mutex_unlock(&uxslt_cache.lock);
+
+	struct uwsgi_xslt_stylesheet *uxs = uwsgi_xslt_stylesheet_compile(xsltfile, &st);
+	if (!uxs) return NULL;
+
+	pthread_mutex_lock(&uxslt_cache.lock);
+	for(i=0;i<uxslt.cache_items;i++) {
+		struct uwsgi_xslt_stylesheet *item = uxslt_cache.items[i];
+		if (!item || (item->hash == hash && !strcmp(item->path, xsltfile))) {
+			slot = i;
+			break;
+		}
+		if (slot < 0 || item->last_use < uxslt_cache.items[slot]->last_use) slot = i;
+	}
+	if (uxslt_cache.items[slot]) {
+		uwsgi_xslt_stylesheet_put_locked(uxslt_cache.items[slot]);
+	}
+	uxs->last_use = uxslt_cache.clock;
+	// one reference for the cache, one for the caller
+	uxs->refcnt = 2;
+	uxslt_cache.items[slot] = uxs;
+	pthread_mutex_unlock(&uxslt_cache.lock);
+	return uxs;
+}
+
 static char *uwsgi_xslt_apply(xmlDoc *doc, char *xsltfile, char *params, int *rlen) {
 
 	char **vparams = NULL;
 	char *tmp_params = NULL;
+	char *output = NULL;
 	uint16_t count = 0;
 	if (params) {
 		// first count the number of items
@@ -88,38 +213,134 @@ static char *uwsgi_xslt_apply(xmlDoc *doc, char *xsltfile, char *params, int *rl
 	xmlSubstituteEntitiesDefault(1);
 	xmlLoadExtDtdDefaultValue = 1;
 
-        xsltStylesheetPtr ss = xsltParseStylesheetFile((const xmlChar *) xsltfile);
-        if (!ss) {
-		if (vparams) {
-			int i; for(i=1;i<(count*2);i+=2) free(vparams[i]);
-			free(vparams);
-		}
-		free(tmp_params);
-                return NULL;
-        }
+	struct uwsgi_xslt_stylesheet *uxs = uwsgi_xslt_stylesheet_get(xsltfile);
+	if (!uxs) goto end;
 
-        xmlDocPtr res = xsltApplyStylesheet(ss, doc, (const char **) vparams);
-	if (!res) {
-		xsltFreeStylesheet(ss);
-		if (vparams) {
-			int i; for(i=1;i<(count*2);i+=2) free(vparams[i]);
-			free(vparams);
-		}
-		free(tmp_params);
-		return NULL;
-	}
+        xmlDocPtr res = xsltApplyStylesheet(uxs->ss, doc, (const char **) vparams);
+	if (!res) goto end;
 
-        xmlChar *output;
-        int ret = xsltSaveResultToString(&output, rlen, res, ss);
-	xsltFreeStylesheet(ss);
+        xmlChar *xoutput;
+        int ret = xsltSaveResultToString(&xoutput, rlen, res, uxs->ss);
 	xmlFreeDoc(res);
+	if (ret >= 0) output = (char *) xoutput;
+end:
+	if (uxs) uwsgi_xslt_stylesheet_put(uxs);
 	if (vparams) {
 		int i; for(i=1;i<(count*2);i+=2) free(vparams[i]);
 		free(vparams);
 	}
 	free(tmp_params);
-	if (ret < 0) return NULL;
-	return (char *) output;
+	return output;
+}
+
+/*
+	transformation threads
+
+	jobs are passed (as pointers) to the threads via their uwsgi_thread socketpair,
+	every core has its own pipe for being notified of the completion
+*/
+
+struct uwsgi_xslt_job {
+	xmlDoc *doc;
+	char *xsltfile;
+	char *params;
+	int rlen;
+	char *output;
+	int notify_fd;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pid_t pid;
+	struct uwsgi_thread **threads;
+	int *notify_pipes;
+	uint64_t next;
+} uxslt_pool = { PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, 0 };
+
+static void uwsgi_xslt_thread_loop(struct uwsgi_thread *ut) {
+	for (;;) {
+		int interesting_fd = -1;
+		int ret = event_queue_wait(ut->queue, -1, &interesting_fd);
+		if (ret <= 0) continue;
+		struct uwsgi_xslt_job *uxj = NULL;
+		ssize_t len = read(ut->pipe[1], &uxj, sizeof(struct uwsgi_xslt_job *));
+		if (len != sizeof(struct uwsgi_xslt_job *) || !uxj) continue;
+		uxj->output = uwsgi_xslt_apply(uxj->doc, uxj->xsltfile, uxj->params, &uxj->rlen);
+		char byte = 1;
+		if (write(uxj->notify_fd, &byte, 1) != 1) {
+			uwsgi_error("uwsgi_xslt_thread_loop()/write()");
+		}
+	}
+}
+
+// returns the notification pipe of the core (spawning the pool if needed), NULL on error
+static int *uwsgi_xslt_pool_get(struct wsgi_request *wsgi_req) {
+	int *ret = NULL;
+	pthread_mutex_lock(&uxslt_pool.lock);
+	// the pool cannot be inherited via fork()
+	if (uxslt_pool.pid != getpid()) {
+		int i;
+		uxslt_pool.threads = uwsgi_calloc(sizeof(struct uwsgi_thread *) * uxslt.threads);
+		for(i=0;i<uxslt.threads;i++) {
+			uxslt_pool.threads[i] = uwsgi_thread_new(uwsgi_xslt_thread_loop);
+			if (!uxslt_pool.threads[i]) {
+				uwsgi_log("unable to spawn xslt thread\n");
+				goto end;
+			}
+		}
+		uxslt_pool.notify_pipes = uwsgi_malloc(sizeof(int) * 2 * uwsgi.cores);
+		for(i=0;i<uwsgi.cores;i++) {
+			uxslt_pool.notify_pipes[i*2] = -1;
+		}
+		uxslt_pool.pid = getpid();
+	}
+	int *notify_pipe = &uxslt_pool.notify_pipes[wsgi_req->async_id * 2];
+	if (notify_pipe[0] < 0) {
+		if (pipe(notify_pipe)) {
+			uwsgi_error("uwsgi_xslt_pool_get()/pipe()");
+			notify_pipe[0] = -1;
+			goto end;
+		}
+		uwsgi_socket_nb(notify_pipe[0]);
+	}
+	ret = notify_pipe;
+end:
+	pthread_mutex_unlock(&uxslt_pool.lock);
+	return ret;
+}
+
+static char *uwsgi_xslt_run(struct wsgi_request *wsgi_req, xmlDoc *doc, char *xsltfile, char *params, int *rlen) {
+	if (uxslt.threads <= 0) return uwsgi_xslt_apply(doc, xsltfile, params, rlen);
+
+	int *notify_pipe = uwsgi_xslt_pool_get(wsgi_req);
+	if (!notify_pipe) return uwsgi_xslt_apply(doc, xsltfile, params, rlen);
+
+	struct uwsgi_xslt_job uxj;
+	memset(&uxj, 0, sizeof(struct uwsgi_xslt_job));
+	uxj.doc = doc;
+	uxj.xsltfile = xsltfile;
+	uxj.params = params;
+	uxj.notify_fd = notify_pipe[1];
+
+	struct uwsgi_xslt_job *ptr = &uxj;
+	struct uwsgi_thread *ut = uxslt_pool.threads[__sync_fetch_and_add(&uxslt_pool.next, 1) % uxslt.threads];
+	if (write(ut->pipe[0], &ptr, sizeof(struct uwsgi_xslt_job *)) != sizeof(struct uwsgi_xslt_job *)) {
+		// the thread queue is full
+		return uwsgi_xslt_apply(doc, xsltfile, params, rlen);
+	}
+
+	// the job references our stack, so we need to wait for it even after a timeout
+	for(;;) {
+		int ret = uwsgi.wait_read_hook(notify_pipe[0], uwsgi.socket_timeout);
+		if (ret < 0) {
+			ret = uwsgi_simple_wait_read_hook(notify_pipe[0], uwsgi.socket_timeout);
+		}
+		if (ret <= 0) continue;
+		char byte;
+		if (read(notify_pipe[0], &byte, 1) == 1) break;
+	}
+	*rlen = uxj.rlen;
+	return uxj.output;
 }
 
 static int uwsgi_request_xslt(struct wsgi_request *wsgi_req) {
@@ -281,7 +502,7 @@ apply:
 	if (wsgi_req->query_string_len > 0) {
 		params = uwsgi_concat2n(wsgi_req->query_string, wsgi_req->query_string_len, "", 0);
 	}
-	output = uwsgi_xslt_apply(doc, stylesheet, params, &output_rlen);
+	output = uwsgi_xslt_run(wsgi_req, doc, stylesheet, params, &output_rlen);
 	xmlFreeDoc(doc);
 	if (params) free(params);
 	if (!output) {
@@ -325,7 +546,7 @@ static int transform_toxslt(struct wsgi_request *wsgi_req, struct uwsgi_transfor
 	if (!doc) goto end;
 
 	int rlen;
-        char *output = uwsgi_xslt_apply( doc, utxc->stylesheet->buf, utxc->params ? utxc->params->buf : NULL, &rlen);
+        char *output = uwsgi_xslt_run(wsgi_req, doc, utxc->stylesheet->buf, utxc->params ? utxc->params->buf : NULL, &rlen);
 	if (!output) goto end;
 
 	// do not check for errors !!!
@@ -407,7 +628,7 @@ static int uwsgi_routing_func_xslt(struct wsgi_request *wsgi_req, struct uwsgi_r
 	int rlen;
 	xmlDoc *doc = xmlParseFile(ub_doc->buf) ;
 	if (!doc) goto end;
-        char *output = uwsgi_xslt_apply(doc, ub_stylesheet->buf, ub_params ? ub_params->buf : NULL, &rlen);
+        char *output = uwsgi_xslt_run(wsgi_req, doc, ub_stylesheet->buf, ub_params ? ub_params->buf : NULL, &rlen);
 	xmlFreeDoc(doc);
 	if (!output) goto end;
 
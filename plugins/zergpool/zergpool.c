@@ -9,12 +9,14 @@
 extern struct uwsgi_server uwsgi;
 
 struct uwsgi_string_list *zergpool_socket_names;
+int zergpool_reuseport;
 
 #define ZERGPOOL_EVENTS 64
 
 struct uwsgi_option zergpool_options[] = {
 	{ "zergpool", required_argument, 0, "start a zergpool on specified address for specified address", uwsgi_opt_add_string_list, &zergpool_socket_names, 0},
 	{ "zerg-pool", required_argument, 0, "start a zergpool on specified address for specified address", uwsgi_opt_add_string_list, &zergpool_socket_names, 0},
+	{ "zergpool-reuseport", no_argument, 0, "give every zerg its own REUSE_PORT TCP sockets (on Linux connections are steered to the less busy ones)", uwsgi_opt_true, &zergpool_reuseport, 0},
 	{0, 0, 0, 0, 0, 0, 0},
 };
 
@@ -23,6 +25,8 @@ struct zergpool_socket {
 	int *sockets;
 	int num_sockets;
 
+	struct uwsgi_zerg_balancer *balancer;
+
 	struct zergpool_socket *next;
 };
 
@@ -39,11 +43,29 @@ void zergpool_loop(int id, void *foobar) {
 	struct zergpool_socket *zps = zergpool_sockets;
 	while(zps) {
 		event_queue_add_fd_read(zergpool_queue, zps->fd);
+		if (zergpool_reuseport) {
+			// after a respawn the zergs of the previous process are unknown
+			zps->balancer = uwsgi_zerg_balancer_new(zps->num_sockets, zps->sockets, 0, !ushared->gateways[id].respawns);
+		}
 		zps = zps->next;
 	}
 
+	time_t last_update = 0;
+
 	for(;;) {
-		int nevents = event_queue_wait_multi(zergpool_queue, -1, events, ZERGPOOL_EVENTS);
+		int nevents = event_queue_wait_multi(zergpool_queue, zergpool_reuseport ? 1 : -1, events, ZERGPOOL_EVENTS);
+
+		if (zergpool_reuseport) {
+			time_t now = uwsgi_now();
+			if (now != last_update) {
+				zps = zergpool_sockets;
+				while(zps) {
+					uwsgi_zerg_balancer_update(zps->balancer);
+					zps = zps->next;
+				}
+				last_update = now;
+			}
+		}
 
 		for(i=0;i<nevents;i++) {
 
@@ -52,7 +74,12 @@ void zergpool_loop(int id, void *foobar) {
 			zps = zergpool_sockets;
 			while(zps) {
 				if (zps->fd == interesting_fd) {
-					uwsgi_manage_zerg(zps->fd, zps->num_sockets, zps->sockets);
+					if (zps->balancer) {
+						uwsgi_manage_zerg_balanced(zps->balancer, zps->fd);
+					}
+					else {
+						uwsgi_manage_zerg(zps->fd, zps->num_sockets, zps->sockets);
+					}
 				}
 				zps = zps->next;
 			}
@@ -111,7 +138,10 @@ struct zergpool_socket *add_zergpool_socket(char *name, char *sockets) {
 		}
 		else {
 			char *gsn = generate_socket_name(p);
+			int current_reuse_port = uwsgi.reuse_port;
+			if (zergpool_reuseport) uwsgi.reuse_port = 1;
 			z_sock->sockets[pos] = bind_to_tcp(gsn, uwsgi.listen_queue, strchr(gsn, ':'));
+			uwsgi.reuse_port = current_reuse_port;
 			sockname = uwsgi_getsockname(z_sock->sockets[pos]);
 			uwsgi_log("zergpool %s bound to TCP socket %s (fd: %d)\n", name, sockname, z_sock->sockets[pos]);
 		}
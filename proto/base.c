@@ -127,6 +127,10 @@ int uwsgi_proto_ssl_accept(struct wsgi_request *wsgi_req, int server_fd) {
 }
 
 void uwsgi_proto_ssl_close(struct wsgi_request *wsgi_req) {
+	// mark clean connections as shut down, otherwise SSL_free() removes the session from the cache
+	if (!wsgi_req->write_errors && !wsgi_req->read_errors) {
+		SSL_set_shutdown(wsgi_req->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+	}
 	uwsgi_proto_base_close(wsgi_req);
 	// clear the errors (otherwise they could be propagated)
         ERR_clear_error();
@@ -134,60 +138,82 @@ void uwsgi_proto_ssl_close(struct wsgi_request *wsgi_req) {
 }
 #endif
 
-struct uwsgi_buffer *uwsgi_proto_base_add_header(struct wsgi_request *wsgi_req, char *k, uint16_t kl, char *v, uint16_t vl) {
-	struct uwsgi_buffer *ub = NULL;
+// make room for "need" bytes (doubling the buffer, like realloc-based growth usually does)
+static int uwsgi_proto_base_reserve(struct uwsgi_buffer *ub, size_t need) {
+	if (ub->len - ub->pos >= need) return 0;
+	size_t new_len = UMAX(ub->pos + need, ub->len * 2);
+	if (ub->limit > 0 && new_len > ub->limit) new_len = ub->pos + need;
+	return uwsgi_buffer_fix(ub, new_len);
+}
+
+// append a header line directly to the response headers buffer (kl == 0 means the value is a whole line)
+int uwsgi_proto_base_append_header(struct uwsgi_buffer *ub, char *k, uint16_t kl, char *v, uint16_t vl) {
+	if (uwsgi_proto_base_reserve(ub, (kl > 0 ? kl + 2 : 0) + vl + 2)) return -1;
+	char *ptr = ub->buf + ub->pos;
 	if (kl > 0) {
-		ub = uwsgi_buffer_new(kl + 2 + vl + 2);
-		if (uwsgi_buffer_append(ub, k, kl)) goto end;
-		if (uwsgi_buffer_append(ub, ": ", 2)) goto end;
-		if (uwsgi_buffer_append(ub, v, vl)) goto end;
-		if (uwsgi_buffer_append(ub, "\r\n", 2)) goto end;
+		memcpy(ptr, k, kl); ptr += kl;
+		*ptr++ = ':'; *ptr++ = ' ';
 	}
-	else {
-		ub = uwsgi_buffer_new(vl + 2);
-		if (uwsgi_buffer_append(ub, v, vl)) goto end;
-                if (uwsgi_buffer_append(ub, "\r\n", 2)) goto end;
-	}
-	return ub;
-end:
-	uwsgi_buffer_destroy(ub);
-	return NULL;
+	memcpy(ptr, v, vl); ptr += vl;
+	*ptr++ = '\r'; *ptr++ = '\n';
+	ub->pos = ptr - ub->buf;
+	return 0;
 }
 
-struct uwsgi_buffer *uwsgi_proto_base_prepare_headers(struct wsgi_request *wsgi_req, char *s, uint16_t sl) {
-        struct uwsgi_buffer *ub = NULL;
-	if (uwsgi.cgi_mode == 0) {
+// append the status line, msg (if not NULL) is the reason phrase to add after the status code
+int uwsgi_proto_base_append_status(struct wsgi_request *wsgi_req, struct uwsgi_buffer *ub, int cgi, char *s, uint16_t sl, const char *msg, uint16_t msg_len) {
+	// "Status: " in cgi mode, "<protocol> " otherwise
+	char *prefix = "Status:";
+	size_t prefix_len = 7;
+	if (!cgi && uwsgi.cgi_mode == 0) {
 		if (wsgi_req->protocol_len) {
-			ub = uwsgi_buffer_new(wsgi_req->protocol_len + 1 + sl + 2);
-			if (uwsgi_buffer_append(ub, wsgi_req->protocol, wsgi_req->protocol_len)) goto end;
-			if (uwsgi_buffer_append(ub, " ", 1)) goto end;
+			prefix = wsgi_req->protocol;
+			prefix_len = wsgi_req->protocol_len;
 		}
 		else {
-			ub = uwsgi_buffer_new(9 + sl + 2);
-			if (uwsgi_buffer_append(ub, "HTTP/1.0 ", 9)) goto end;
+			prefix = "HTTP/1.0";
+			prefix_len = 8;
 		}
 	}
-	else {
-		ub = uwsgi_buffer_new(8 + sl + 2);
-		if (uwsgi_buffer_append(ub, "Status: ", 8)) goto end;
+	if (uwsgi_proto_base_reserve(ub, prefix_len + 1 + sl + (msg ? 1 + msg_len : 0) + 2)) return -1;
+	char *ptr = ub->buf + ub->pos;
+	memcpy(ptr, prefix, prefix_len); ptr += prefix_len;
+	*ptr++ = ' ';
+	memcpy(ptr, s, sl); ptr += sl;
+	if (msg) {
+		*ptr++ = ' ';
+		memcpy(ptr, msg, msg_len); ptr += msg_len;
+	}
+	*ptr++ = '\r'; *ptr++ = '\n';
+	ub->pos = ptr - ub->buf;
+	return 0;
+}
+
+struct uwsgi_buffer *uwsgi_proto_base_add_header(struct wsgi_request *wsgi_req, char *k, uint16_t kl, char *v, uint16_t vl) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new((kl > 0 ? kl + 2 : 0) + vl + 2);
+	if (uwsgi_proto_base_append_header(ub, k, kl, v, vl)) {
+		uwsgi_buffer_destroy(ub);
+		return NULL;
+	}
+	return ub;
+}
+
+struct uwsgi_buffer *uwsgi_proto_base_prepare_headers(struct wsgi_request *wsgi_req, char *s, uint16_t sl) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(UMAX(wsgi_req->protocol_len, 9) + 1 + sl + 2);
+	if (uwsgi_proto_base_append_status(wsgi_req, ub, 0, s, sl, NULL, 0)) {
+		uwsgi_buffer_destroy(ub);
+		return NULL;
 	}
-        if (uwsgi_buffer_append(ub, s, sl)) goto end;
-	if (uwsgi_buffer_append(ub, "\r\n", 2)) goto end;
-        return ub;
-end:
-        uwsgi_buffer_destroy(ub);
-        return NULL;
+	return ub;
 }
 
 struct uwsgi_buffer *uwsgi_proto_base_cgi_prepare_headers(struct wsgi_request *wsgi_req, char *s, uint16_t sl) {
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(8 + sl + 2);
-	if (uwsgi_buffer_append(ub, "Status: ", 8)) goto end;
-        if (uwsgi_buffer_append(ub, s, sl)) goto end;
-	if (uwsgi_buffer_append(ub, "\r\n", 2)) goto end;
-	return ub;	
-end:
-	uwsgi_buffer_destroy(ub);
-	return NULL;
+	if (uwsgi_proto_base_append_status(wsgi_req, ub, 1, s, sl, NULL, 0)) {
+		uwsgi_buffer_destroy(ub);
+		return NULL;
+	}
+	return ub;
 }
 
 
@@ -318,6 +344,31 @@ int uwsgi_proto_base_sendfile(struct wsgi_request * wsgi_req, int fd, size_t pos
 int uwsgi_proto_ssl_sendfile(struct wsgi_request *wsgi_req, int fd, size_t pos, size_t len) {
 	char buf[32768];
 
+#ifdef UWSGI_SSL_KTLS
+	// kTLS is active, the kernel encrypts the pages directly
+	if (BIO_get_ktls_send(SSL_get_wbio(wsgi_req->ssl))) {
+		ossl_ssize_t wlen = SSL_sendfile(wsgi_req->ssl, fd, pos+wsgi_req->write_pos, len-wsgi_req->write_pos, 0);
+		if (wlen > 0) {
+			wsgi_req->write_pos += wlen;
+			if (wsgi_req->write_pos == len) {
+				return UWSGI_OK;
+			}
+			return UWSGI_AGAIN;
+		}
+		int err = SSL_get_error(wsgi_req->ssl, wlen);
+		if (err == SSL_ERROR_WANT_WRITE) {
+			return UWSGI_AGAIN;
+		}
+		if (err == SSL_ERROR_SYSCALL && errno != 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS) {
+				return UWSGI_AGAIN;
+			}
+			uwsgi_error("uwsgi_proto_ssl_sendfile()/SSL_sendfile()");
+		}
+		return -1;
+	}
+#endif
+
 	if (lseek(fd, pos+wsgi_req->write_pos, SEEK_SET) < 0) {
 		uwsgi_error("lseek()");
 		return -1;
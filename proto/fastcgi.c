@@ -138,12 +138,12 @@ static int fastcgi_buf_begin_request(struct uwsgi_buffer *ub, int reqid, int rol
 }
 
 /* convert a uwsgi request into a fastcgi request */
-struct uwsgi_buffer *uwsgi_to_fastcgi(struct wsgi_request *wsgi_req, int role) {
+struct uwsgi_buffer *uwsgi_to_fastcgi(struct wsgi_request *wsgi_req, int role, int flags) {
 	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
 	int i;
 	size_t rlen = 0;
 
-	fastcgi_buf_begin_request(ub, 1, role, 0);
+	fastcgi_buf_begin_request(ub, 1, role, flags);
 
 #define FCGI_LEN_LEN(x) ((x) < 128 ? 1 : 4)
         for(i = 0; i < wsgi_req->var_cnt; i += 2)
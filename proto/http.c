@@ -2,8 +2,41 @@
 
 #include "uwsgi.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 extern struct uwsgi_server uwsgi;
 
+/*
+	delimiters scanners: instead of checking every byte in the parsers loops,
+	jump straight to the next interesting one (memchr is vectorized by the libc,
+	the two chars version uses SSE2 when available). They return "end" if nothing is found
+*/
+static char *http_find(char *ptr, char *end, char c) {
+	char *found = memchr(ptr, c, end - ptr);
+	if (!found) return end;
+	return found;
+}
+
+static char *http_find2(char *ptr, char *end, char a, char b) {
+#if defined(__SSE2__)
+	__m128i va = _mm_set1_epi8(a);
+	__m128i vb = _mm_set1_epi8(b);
+	while (end - ptr >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) ptr);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+		if (mask) return ptr + __builtin_ctz(mask);
+		ptr += 16;
+	}
+#endif
+	while (ptr < end) {
+		if (*ptr == a || *ptr == b) return ptr;
+		ptr++;
+	}
+	return end;
+}
+
 int http_status_code(char *buf, int len) {
 	char *p = buf;
 
@@ -225,6 +258,8 @@ static int http_parse(struct wsgi_request *wsgi_req, char *watermark) {
 
 	// REQUEST_METHOD 
 	while (ptr < watermark) {
+		ptr = http_find(ptr, watermark, ' ');
+		if (ptr >= watermark) break;
 		if (*ptr == ' ') {
 			wsgi_req->len += proto_base_add_uwsgi_var(wsgi_req, "REQUEST_METHOD", 14, base, ptr - base);
 			ptr++;
@@ -236,6 +271,9 @@ static int http_parse(struct wsgi_request *wsgi_req, char *watermark) {
 	// REQUEST_URI / PATH_INFO / QUERY_STRING
 	base = ptr;
 	while (ptr < watermark) {
+		// only the first '?' is meaningful
+		ptr = query_string ? http_find(ptr, watermark, ' ') : http_find2(ptr, watermark, '?', ' ');
+		if (ptr >= watermark) break;
 		if (*ptr == '?' && !query_string) {
 			if (watermark + (ptr - base) < (char *)(wsgi_req->proto_parser_buf + uwsgi.buffer_size)) {
 				if (ptr - base > 0xffff) return -1;
@@ -281,6 +319,8 @@ static int http_parse(struct wsgi_request *wsgi_req, char *watermark) {
 	// SERVER_PROTOCOL
 	base = ptr;
 	while (ptr < watermark) {
+		ptr = http_find(ptr, watermark, '\r');
+		if (ptr >= watermark) break;
 		if (*ptr == '\r') {
 			if (ptr + 1 >= watermark)
 				return -1 ;
@@ -392,6 +432,8 @@ static int http_parse(struct wsgi_request *wsgi_req, char *watermark) {
 	struct uwsgi_string_list *headers = NULL, *usl = NULL;
 
 	while (ptr < watermark) {
+		ptr = http_find(ptr, watermark, '\r');
+		if (ptr >= watermark) break;
 		if (*ptr == '\r') {
 			if (ptr + 1 >= watermark)
 				return -1;
@@ -476,12 +518,23 @@ clear:
 
 static int uwsgi_proto_http_parser(struct wsgi_request *wsgi_req) {
 
-	ssize_t j;
+	ssize_t j, len;
 	char *ptr;
 
 	// first round ? (wsgi_req->proto_parser_buf is freed at the end of the request)
 	if (!wsgi_req->proto_parser_buf) {
-		wsgi_req->proto_parser_buf = uwsgi_malloc(uwsgi.buffer_size);
+		struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+		// keepalive sockets hand back the buffer of the previous request, pipelined data included
+		if (uwsgi_sock->proto_parser_bufs && uwsgi_sock->proto_parser_bufs[wsgi_req->async_id]) {
+			wsgi_req->proto_parser_buf = uwsgi_sock->proto_parser_bufs[wsgi_req->async_id];
+			uwsgi_sock->proto_parser_bufs[wsgi_req->async_id] = NULL;
+			len = uwsgi_sock->proto_parser_carry[wsgi_req->async_id];
+			uwsgi_sock->proto_parser_carry[wsgi_req->async_id] = 0;
+			if (len > 0) goto parse;
+		}
+		else {
+			wsgi_req->proto_parser_buf = uwsgi_malloc(uwsgi.buffer_size);
+		}
 	}
 
 	if (uwsgi.buffer_size - wsgi_req->proto_parser_pos == 0) {
@@ -489,7 +542,7 @@ static int uwsgi_proto_http_parser(struct wsgi_request *wsgi_req) {
 		return -1;
 	}
 
-	ssize_t len = read(wsgi_req->fd, wsgi_req->proto_parser_buf + wsgi_req->proto_parser_pos, uwsgi.buffer_size - wsgi_req->proto_parser_pos);
+	len = read(wsgi_req->fd, wsgi_req->proto_parser_buf + wsgi_req->proto_parser_pos, uwsgi.buffer_size - wsgi_req->proto_parser_pos);
 	if (len > 0) {
 		goto parse;
 	}
@@ -511,6 +564,13 @@ parse:
 	wsgi_req->proto_parser_pos += len;
 
 	for (j = 0; j < len; j++) {
+		// outside of a \r\n sequence only a \r can change the status
+		if (wsgi_req->proto_parser_status == 0 && *ptr != '\r') {
+			char *cr = http_find(ptr, ptr + (len - j), '\r');
+			j += cr - ptr;
+			ptr = cr;
+			if (j >= len) break;
+		}
 		if (*ptr == '\r' && (wsgi_req->proto_parser_status == 0 || wsgi_req->proto_parser_status == 2)) {
 			wsgi_req->proto_parser_status++;
 		}
@@ -747,6 +807,11 @@ int uwsgi_is_full_http(struct uwsgi_buffer *ub) {
 	size_t i;
 	int status = 0;
 	for(i=0;i<ub->pos;i++) {
+		if (status == 0) {
+			char *cr = memchr(ub->buf + i, '\r', ub->pos - i);
+			if (!cr) return 0;
+			i = cr - ub->buf;
+		}
 		switch(status) {
 			// \r
 			case 0:
@@ -786,6 +851,10 @@ int uwsgi_is_full_http(struct uwsgi_buffer *ub) {
 }
 
 void uwsgi_proto_http_setup(struct uwsgi_socket *uwsgi_sock) {
+	if (uwsgi.http_socket_keepalive) {
+		uwsgi_proto_http11_setup(uwsgi_sock);
+		return;
+	}
 	uwsgi_sock->proto = uwsgi_proto_http_parser;
                         uwsgi_sock->proto_accept = uwsgi_proto_base_accept;
                         uwsgi_sock->proto_prepare_headers = uwsgi_proto_base_prepare_headers;
@@ -803,42 +872,71 @@ void uwsgi_proto_http_setup(struct uwsgi_socket *uwsgi_sock) {
 }
 
 /*
-close the connection on errors, incomplete parsing, HTTP/1.0,  pipelined or offloaded requests
-NOTE: Connection: close is not honoured
+close the connection on errors, incomplete parsing, HTTP/1.0, "Connection: close", undelimited responses,
+unread (or chunked) request bodies, offloaded requests and draining workers (--worker-drain).
+
+Bytes left in the parser buffer after the request belong to the next (pipelined) one: they are moved
+to the start of the buffer, that is handed back to the socket for being reused by the next request
 */
 void uwsgi_proto_http11_close(struct wsgi_request *wsgi_req) {
-        // check for errors or incomplete packets
-        if (wsgi_req->write_errors || wsgi_req->proto_parser_status != 3 || wsgi_req->proto_parser_remains > 0
-		|| wsgi_req->post_pos < wsgi_req->post_cl || wsgi_req->via == UWSGI_VIA_OFFLOAD
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+	int id = wsgi_req->async_id;
+	int delimited = wsgi_req->response_has_length || wsgi_req->status == 204 || wsgi_req->status == 304
+		|| !uwsgi_strncmp("HEAD", 4, wsgi_req->method, wsgi_req->method_len);
+
+	// check for errors or incomplete packets
+	// a draining worker does not keep connections
+	int draining = uwsgi.worker_drain && !uwsgi.workers[uwsgi.mywid].manage_next_request;
+
+	if (wsgi_req->write_errors || wsgi_req->proto_parser_status != 3 || !delimited || wsgi_req->http_connection_close || draining
+		|| wsgi_req->post_pos < wsgi_req->post_cl || wsgi_req->body_is_chunked || wsgi_req->via == UWSGI_VIA_OFFLOAD
 		|| !uwsgi_strncmp("HTTP/1.0", 8, wsgi_req->protocol, wsgi_req->protocol_len)) {
-                close(wsgi_req->fd);
-                wsgi_req->socket->retry[wsgi_req->async_id] = 0;
-                wsgi_req->socket->fd_threads[wsgi_req->async_id] = -1;
-        }
-        else {
-                wsgi_req->socket->retry[wsgi_req->async_id] = 1;
-                wsgi_req->socket->fd_threads[wsgi_req->async_id] = wsgi_req->fd;
-        }
+		close(wsgi_req->fd);
+		uwsgi_sock->retry[id] = 0;
+		uwsgi_sock->fd_threads[id] = -1;
+		uwsgi_sock->proto_parser_carry[id] = 0;
+	}
+	else {
+		uwsgi_sock->retry[id] = 1;
+		uwsgi_sock->fd_threads[id] = wsgi_req->fd;
+		if (wsgi_req->proto_parser_buf && wsgi_req->proto_parser_remains > 0) {
+			memmove(wsgi_req->proto_parser_buf, wsgi_req->proto_parser_remains_buf, wsgi_req->proto_parser_remains);
+			uwsgi_sock->proto_parser_carry[id] = wsgi_req->proto_parser_remains;
+		}
+	}
+
+	if (wsgi_req->proto_parser_buf) {
+		if (uwsgi_sock->proto_parser_bufs[id]) {
+			free(uwsgi_sock->proto_parser_bufs[id]);
+		}
+		uwsgi_sock->proto_parser_bufs[id] = wsgi_req->proto_parser_buf;
+		wsgi_req->proto_parser_buf = NULL;
+	}
 }
 
 int uwsgi_proto_http11_accept(struct wsgi_request *wsgi_req, int fd) {
-	if (wsgi_req->socket->retry[wsgi_req->async_id]) {
-		wsgi_req->fd = wsgi_req->socket->fd_threads[wsgi_req->async_id];
+	struct uwsgi_socket *uwsgi_sock = wsgi_req->socket;
+	if (uwsgi_sock->retry[wsgi_req->async_id]) {
+		wsgi_req->fd = uwsgi_sock->fd_threads[wsgi_req->async_id];
 		wsgi_req->c_len = sizeof(struct sockaddr_un);
-		int ret = getsockname(wsgi_req->fd, (struct sockaddr *) &wsgi_req->client_addr, (socklen_t *) &wsgi_req->c_len);
+		int ret = getpeername(wsgi_req->fd, (struct sockaddr *) &wsgi_req->client_addr, (socklen_t *) &wsgi_req->c_len);
 		if (ret < 0)
 			goto error;
+		// a pipelined request is already in the buffer
+		if (uwsgi_sock->proto_parser_carry[wsgi_req->async_id] > 0)
+			return wsgi_req->fd;
 		ret = uwsgi_wait_read_req(wsgi_req);
 		if (ret <= 0)
 			goto error;
-		return wsgi_req->socket->fd_threads[wsgi_req->async_id];
+		return wsgi_req->fd;
 	}
 	return uwsgi_proto_base_accept(wsgi_req, fd);
 
 error:
 	close(wsgi_req->fd);
-	wsgi_req->socket->retry[wsgi_req->async_id] = 0;
-	wsgi_req->socket->fd_threads[wsgi_req->async_id] = -1;
+	uwsgi_sock->retry[wsgi_req->async_id] = 0;
+	uwsgi_sock->fd_threads[wsgi_req->async_id] = -1;
+	uwsgi_sock->proto_parser_carry[wsgi_req->async_id] = 0;
 	return -1;
 }
 
@@ -859,6 +957,9 @@ void uwsgi_proto_http11_setup(struct uwsgi_socket *uwsgi_sock) {
 	uwsgi_sock->fd_threads = uwsgi_malloc(sizeof(int) * uwsgi.cores);
         memset(uwsgi_sock->fd_threads, -1, sizeof(int) * uwsgi.cores);
         uwsgi_sock->retry = uwsgi_calloc(sizeof(int) * uwsgi.cores);
+	uwsgi_sock->proto_parser_bufs = uwsgi_calloc(sizeof(char *) * uwsgi.cores);
+	uwsgi_sock->proto_parser_carry = uwsgi_calloc(sizeof(size_t) * uwsgi.cores);
+	uwsgi_sock->keepalive = 1;
         uwsgi.is_et = 1;
 }
 
@@ -915,6 +1016,12 @@ parse:
         wsgi_req->proto_parser_pos += len;
 
         for (j = 0; j < len; j++) {
+		if (wsgi_req->proto_parser_status == 0 && *ptr != '\r') {
+			char *cr = http_find(ptr, ptr + (len - j), '\r');
+			j += cr - ptr;
+			ptr = cr;
+			if (j >= len) break;
+		}
                 if (*ptr == '\r' && (wsgi_req->proto_parser_status == 0 || wsgi_req->proto_parser_status == 2)) {
                         wsgi_req->proto_parser_status++;
                 }
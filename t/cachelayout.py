@@ -0,0 +1,46 @@
+import uwsgi
+import random
+import time
+
+ITEMS = 9000
+ROUNDS = 20
+
+
+def check(cache, items):
+    for key, value in items.items():
+        if uwsgi.cache_get(key, cache) != value:
+            raise Exception('invalid value for %s in cache %s' % (key, cache))
+
+
+def bench(cache, keys):
+    start = time.time()
+    for i in range(ROUNDS):
+        for key in keys:
+            uwsgi.cache_get(key, cache)
+    return (time.time() - start) * 1000000000 / (ROUNDS * len(keys))
+
+
+for cache in ('chain', 'open'):
+    items = {}
+    for i in range(ITEMS):
+        key = 'http://example.com/path/to/resource/%d' % random.randint(0, 1 << 30)
+        items[key] = ('%d' % i).encode()
+        uwsgi.cache_update(key, items[key], 0, cache)
+    check(cache, items)
+
+    # remove half of the items (exercise unlinking/backward shifting) and put them back
+    removed = random.sample(sorted(items.keys()), ITEMS // 2)
+    for key in removed:
+        uwsgi.cache_del(key, cache)
+        if uwsgi.cache_exists(key, cache):
+            raise Exception('%s still in cache %s' % (key, cache))
+    for key in removed:
+        uwsgi.cache_set(key, items[key], 0, cache)
+    check(cache, items)
+
+    if len(uwsgi.cache_keys(cache)) != len(items):
+        raise Exception('invalid number of keys in cache %s' % cache)
+
+    keys = list(items.keys())
+    misses = ['http://example.com/missing/%d' % i for i in range(ITEMS)]
+    print('%s layout: hit %.1f ns/lookup miss %.1f ns/lookup' % (cache, bench(cache, keys), bench(cache, misses)))
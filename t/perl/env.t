@@ -43,6 +43,7 @@ my @tests = (
     [ 'Defaults', {} ],
     [ 'Master', { 'psgix.harakiri' => $t }, '--master' ],
     [ 'Async', { 'psgi.nonblocking' => $t }, '--async' => 1 ],
+    [ 'Reused env', {}, '--psgi-reuse-env' ],
     [
         'Workers',
         { 'psgix.harakiri' => $t, 'psgi.multiprocess' => $t },
@@ -69,6 +70,8 @@ for (@tests) {
 
     sleep 1;    # Let uWSGI start.
 
+    # the second request could get the hash of the first one
+    $http->get('http://localhost:5000');
     my %got = split /\n/, $http->get('http://localhost:5000')->{content};
 
     cmp_deeply \%got, { %exp, %$exp }, $name;
@@ -4,7 +4,11 @@ use warnings;
 use Time::HiRes qw(sleep);
 use autodie qw(:all);
 
-my $psgi = $ARGV[0] || 't/perl/test_hello.psgi';
+my $psgi = shift(@ARGV) || 't/perl/test_hello.psgi';
+# additional uWSGI options, e.g. to compare the env reuse:
+#   perl t/perl/test_benchmark.pl t/perl/test_array_body.psgi
+#   perl t/perl/test_benchmark.pl t/perl/test_array_body.psgi --psgi-reuse-env
+my $opts = join ' ', @ARGV;
 
 for my $use_thunder_lock (0,1) {
     for my $cpu_multiplier (1,2,4,8,16,32,64) {
@@ -14,7 +18,7 @@ for my $use_thunder_lock (0,1) {
 
         #say STDERR "Now testing $desc";
         system q[for p in $(ps auxf|grep uwsgi.*--disable-logging|grep -v grep|awk '{print $2}'); do kill $p; done];
-        system qq[./uwsgi --http 127.0.0.1:8080 --processes $procs --psgi $psgi --disable-logging $tl_cl >/dev/null 2>&1 &];
+        system qq[./uwsgi --http 127.0.0.1:8080 --processes $procs --psgi $psgi --disable-logging $tl_cl $opts >/dev/null 2>&1 &];
         sleep 0.5;
         chomp(my $ab = qx[http_proxy= ab -n 10000 -c 32 http://localhost:8080/ 2>&1]);
         my ($seconds) = $ab =~ m[Time taken for tests:\s+([0-9.]+) seconds];
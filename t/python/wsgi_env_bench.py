@@ -0,0 +1,69 @@
+# WSGI environ microbenchmark
+#
+# run the app:
+#   ./uwsgi --socket 127.0.0.1:3031 --wsgi-file t/python/wsgi_env_bench.py --disable-logging
+# and the client:
+#   python3 t/python/wsgi_env_bench.py 127.0.0.1:3031 [requests]
+#
+# every request sends the vars of a typical browser request (through nginx), the app
+# does nothing but reading a few of them, so most of the time spent in the worker is the
+# creation of the environ (compare the builds using the same --cpu-affinity)
+import sys
+import struct
+import socket
+import time
+
+VARS = [
+    ('QUERY_STRING', 'page=1&sort=asc'),
+    ('REQUEST_METHOD', 'GET'),
+    ('CONTENT_TYPE', ''),
+    ('CONTENT_LENGTH', ''),
+    ('REQUEST_URI', '/articles/42?page=1&sort=asc'),
+    ('PATH_INFO', '/articles/42'),
+    ('DOCUMENT_ROOT', '/usr/share/nginx/html'),
+    ('SERVER_PROTOCOL', 'HTTP/1.1'),
+    ('REQUEST_SCHEME', 'http'),
+    ('REMOTE_ADDR', '10.0.0.1'),
+    ('REMOTE_PORT', '51234'),
+    ('SERVER_PORT', '80'),
+    ('SERVER_NAME', 'example.com'),
+    ('HTTP_HOST', 'example.com'),
+    ('HTTP_USER_AGENT', 'Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0'),
+    ('HTTP_ACCEPT', 'text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8'),
+    ('HTTP_ACCEPT_LANGUAGE', 'en-US,en;q=0.5'),
+    ('HTTP_ACCEPT_ENCODING', 'gzip, deflate, br'),
+    ('HTTP_CONNECTION', 'keep-alive'),
+    ('HTTP_COOKIE', 'sessionid=0123456789abcdef; csrftoken=fedcba9876543210'),
+    ('HTTP_UPGRADE_INSECURE_REQUESTS', '1'),
+    ('HTTP_X_APP_CUSTOM', 'custom'),
+]
+
+
+def application(env, start_response):
+    body = ('%s %s %s' % (env['REQUEST_METHOD'], env['PATH_INFO'], env['HTTP_HOST'])).encode()
+    start_response('200 OK', [('Content-Type', 'text/plain')])
+    return [body]
+
+
+def packet():
+    body = b''
+    for key, value in VARS:
+        key = key.encode()
+        value = value.encode()
+        body += struct.pack('<H', len(key)) + key + struct.pack('<H', len(value)) + value
+    return struct.pack('<BHB', 0, len(body), 0) + body
+
+
+if __name__ == '__main__':
+    host, port = sys.argv[1].split(':')
+    requests = int(sys.argv[2]) if len(sys.argv) > 2 else 10000
+    pkt = packet()
+    start = time.time()
+    for i in range(requests):
+        s = socket.create_connection((host, int(port)))
+        s.sendall(pkt)
+        while s.recv(4096):
+            pass
+        s.close()
+    elapsed = time.time() - start
+    print('%d requests in %.3f seconds (%.1f usecs per request)' % (requests, elapsed, elapsed * 1000000 / requests))
@@ -0,0 +1,23 @@
+# application used by tests/bench/bench.py (one app for all of the scenarios)
+import uwsgi
+
+HELLO = b'Hello World'
+
+
+def application(env, start_response):
+    path = env['PATH_INFO']
+    if path == '/cache':
+        key = env.get('QUERY_STRING') or 'bench'
+        value = uwsgi.cache_get(key)
+        if value is None:
+            value = HELLO
+            uwsgi.cache_set(key, value)
+        start_response('200 OK', [('Content-Type', 'text/plain')])
+        return [value]
+    if path == '/websocket':
+        uwsgi.websocket_handshake(env['HTTP_SEC_WEBSOCKET_KEY'], env.get('HTTP_ORIGIN', ''))
+        while True:
+            msg = uwsgi.websocket_recv()
+            uwsgi.websocket_send(msg)
+    start_response('200 OK', [('Content-Type', 'text/plain'), ('Content-Length', str(len(HELLO)))])
+    return [HELLO]
@@ -0,0 +1,321 @@
+# end-to-end benchmark suite (run by "make bench")
+#
+#   python3 tests/bench/bench.py [--binary ./uwsgi] [--duration 5] [--concurrency 8] [--output bench.json]
+#
+# every scenario spawns the needed uWSGI instances, hammers them with the bundled
+# load generator (one process per concurrent client, no external tools required)
+# and kills them. The results are printed and written as json, so different builds
+# can be compared (use the same --cpu-affinity/--extra for both of them).
+#
+# extra options are passed to every instance, e.g. when the python plugin is not embedded:
+#   python3 tests/bench/bench.py --extra "--plugin ./python_plugin.so"
+import argparse
+import base64
+import json
+import multiprocessing
+import os
+import platform
+import shlex
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+APP = os.path.join(HERE, 'app.py')
+
+
+# protocol helpers
+
+def uwsgi_packet(path):
+    body = b''
+    for key, value in (('REQUEST_METHOD', 'GET'), ('PATH_INFO', path), ('REQUEST_URI', path),
+                       ('QUERY_STRING', ''), ('SERVER_NAME', 'localhost'), ('SERVER_PORT', '80'),
+                       ('SERVER_PROTOCOL', 'HTTP/1.1'), ('HTTP_HOST', 'localhost')):
+        key = key.encode()
+        value = value.encode()
+        body += struct.pack('<H', len(key)) + key + struct.pack('<H', len(value)) + value
+    return struct.pack('<BHB', 0, len(body), 0) + body
+
+
+def read_all(s):
+    chunks = []
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        chunks.append(chunk)
+    return b''.join(chunks)
+
+
+def one_shot(addr, payload, min_size=0):
+    s = socket.create_connection(addr)
+    try:
+        s.sendall(payload)
+        response = read_all(s)
+    finally:
+        s.close()
+    if len(response) < min_size:
+        return False
+    return response.startswith(b'HTTP/1.1 200') or response.startswith(b'HTTP/1.0 200')
+
+
+def http_request(path):
+    return ('GET %s HTTP/1.0\r\nHost: localhost\r\n\r\n' % path).encode()
+
+
+def recv_exactly(s, n):
+    buf = b''
+    while len(buf) < n:
+        chunk = s.recv(n - len(buf))
+        if not chunk:
+            raise IOError('connection closed')
+        buf += chunk
+    return buf
+
+
+class WebSocketClient(object):
+
+    def __init__(self, addr):
+        self.s = socket.create_connection(addr)
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.s.sendall(('GET /websocket HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n'
+                        'Connection: Upgrade\r\nSec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n' % key).encode())
+        headers = b''
+        while b'\r\n\r\n' not in headers:
+            chunk = self.s.recv(4096)
+            if not chunk:
+                raise IOError('handshake failed')
+            headers += chunk
+        if not headers.startswith(b'HTTP/1.1 101'):
+            raise IOError('handshake failed')
+
+    def send(self, payload):
+        mask = os.urandom(4)
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        self.s.sendall(struct.pack('!BB', 0x81, 0x80 | len(payload)) + mask + masked)
+
+    def recv(self):
+        while True:
+            opcode, size = struct.unpack('!BB', recv_exactly(self.s, 2))
+            size &= 0x7f
+            if size == 126:
+                size = struct.unpack('!H', recv_exactly(self.s, 2))[0]
+            elif size == 127:
+                size = struct.unpack('!Q', recv_exactly(self.s, 8))[0]
+            payload = recv_exactly(self.s, size)
+            # skip pings/pongs
+            if opcode & 0x0f in (1, 2):
+                return payload
+
+    def close(self):
+        self.s.close()
+
+
+# scenarios: name, list of instances (each one a list of options), client factory
+
+def scenarios(ports, static_dir, has_routing):
+    app = ['--wsgi-file', APP]
+    p = ports
+    yield ('hello-uwsgi', [app + ['--socket', '127.0.0.1:%d' % p[0]]],
+           lambda: (lambda: one_shot(('127.0.0.1', p[0]), uwsgi_packet('/'))))
+    yield ('hello-http-socket', [app + ['--http-socket', '127.0.0.1:%d' % p[1]]],
+           lambda: (lambda: one_shot(('127.0.0.1', p[1]), http_request('/'))))
+    yield ('static', [app + ['--http-socket', '127.0.0.1:%d' % p[2], '--static-map', '/static=%s' % static_dir]],
+           lambda: (lambda: one_shot(('127.0.0.1', p[2]), http_request('/static/4k.bin'), 4096)))
+    yield ('cache', [app + ['--http-socket', '127.0.0.1:%d' % p[3], '--cache2', 'name=bench,items=1000']],
+           lambda: (lambda: one_shot(('127.0.0.1', p[3]), http_request('/cache?key1'))))
+    yield ('http-router', [app + ['--http', '127.0.0.1:%d' % p[4], '--http-to', '127.0.0.1:%d' % p[5], '--socket', '127.0.0.1:%d' % p[5]]],
+           lambda: (lambda: one_shot(('127.0.0.1', p[4]), http_request('/'))))
+    if has_routing:
+        yield ('router-http', [app + ['--http-socket', '127.0.0.1:%d' % p[7]],
+                               ['--http-socket', '127.0.0.1:%d' % p[6], '--route-run', 'http:127.0.0.1:%d' % p[7]]],
+               lambda: (lambda: one_shot(('127.0.0.1', p[6]), http_request('/'))))
+    else:
+        yield ('router-http', None, None)
+    yield ('websockets', [app + ['--http-socket', '127.0.0.1:%d' % p[8]]], lambda: websocket_client(('127.0.0.1', p[8])))
+
+
+def websocket_client(addr):
+    ws = WebSocketClient(addr)
+
+    def message():
+        ws.send(b'hello')
+        return ws.recv() == b'hello'
+    return message
+
+
+# load generator
+
+def client_loop(factory, deadline, queue):
+    latencies = []
+    errors = 0
+    try:
+        request = factory()
+    except Exception:
+        queue.put((0, 1, []))
+        return
+    while time.time() < deadline:
+        start = time.time()
+        try:
+            ok = request()
+        except Exception:
+            ok = False
+        if ok:
+            latencies.append(time.time() - start)
+        else:
+            errors += 1
+            # persistent connections are lost on errors
+            try:
+                request = factory()
+            except Exception:
+                break
+    queue.put((len(latencies), errors, latencies))
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    k = min(len(values) - 1, int(len(values) * p / 100.0))
+    return round(values[k] * 1000, 3)
+
+
+def run_load(factory, concurrency, duration):
+    queue = multiprocessing.Queue()
+    start = time.time()
+    deadline = start + duration
+    clients = [multiprocessing.Process(target=client_loop, args=(factory, deadline, queue)) for _ in range(concurrency)]
+    for c in clients:
+        c.start()
+    requests = errors = 0
+    latencies = []
+    for _ in clients:
+        r, e, l = queue.get()
+        requests += r
+        errors += e
+        latencies += l
+    for c in clients:
+        c.join()
+    elapsed = time.time() - start
+    latencies.sort()
+    return {
+        'requests': requests,
+        'errors': errors,
+        'duration': round(elapsed, 3),
+        'rps': round(requests / elapsed, 2),
+        'p50_ms': percentile(latencies, 50),
+        'p90_ms': percentile(latencies, 90),
+        'p99_ms': percentile(latencies, 99),
+        'max_ms': percentile(latencies, 100),
+    }
+
+
+# instances management
+
+def wait_for_port(port, proc, timeout=10):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if proc.poll() is not None:
+            return False
+        try:
+            socket.create_connection(('127.0.0.1', port), 0.5).close()
+            return True
+        except socket.error:
+            time.sleep(0.1)
+    return False
+
+
+def first_port(options):
+    for i, opt in enumerate(options):
+        if opt in ('--socket', '--http-socket', '--http'):
+            return int(options[i + 1].rsplit(':', 1)[1])
+
+
+def spawn(args, options, logdir, name, index):
+    log = open(os.path.join(logdir, '%s.%d.log' % (name, index)), 'w')
+    cmd = [args.binary] + shlex.split(args.extra) + ['--master', '--processes', str(args.processes),
+                                                      '--disable-logging', '--die-on-term'] + options
+    proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+    if not wait_for_port(first_port(options), proc):
+        proc.kill()
+        proc.wait()
+        raise RuntimeError('unable to spawn %s (log in %s)' % (' '.join(cmd), log.name))
+    return proc
+
+
+def main():
+    parser = argparse.ArgumentParser(description='uWSGI end-to-end benchmarks')
+    parser.add_argument('--binary', default='./uwsgi')
+    parser.add_argument('--extra', default='', help='options added to every instance')
+    parser.add_argument('--duration', type=float, default=5)
+    parser.add_argument('--concurrency', type=int, default=8)
+    parser.add_argument('--processes', type=int, default=8, help='workers of every instance (websockets need one per client)')
+    parser.add_argument('--base-port', type=int, default=9300)
+    parser.add_argument('--scenario', action='append', help='run only the specified scenario (can be repeated)')
+    parser.add_argument('--output', default='bench.json')
+    args = parser.parse_args()
+
+    help_output = subprocess.run([args.binary] + shlex.split(args.extra) + ['--help'], stdout=subprocess.PIPE,
+                                 stderr=subprocess.STDOUT).stdout
+    version = subprocess.run([args.binary, '--version'], stdout=subprocess.PIPE).stdout.decode().strip()
+    has_routing = b'--route-run' in help_output
+
+    logdir = tempfile.mkdtemp(prefix='uwsgi-bench-')
+    static_dir = os.path.join(logdir, 'static')
+    os.mkdir(static_dir)
+    with open(os.path.join(static_dir, '4k.bin'), 'wb') as f:
+        f.write(os.urandom(4096))
+
+    ports = [args.base_port + i for i in range(9)]
+    results = []
+    failed = 0
+    for name, instances, factory in scenarios(ports, static_dir, has_routing):
+        if args.scenario and name not in args.scenario:
+            continue
+        if instances is None:
+            results.append({'name': name, 'skipped': 'no internal routing support'})
+            print('%-20s skipped' % name)
+            continue
+        procs = []
+        try:
+            # backends first
+            for i, options in reversed(list(enumerate(instances))):
+                procs.append(spawn(args, options, logdir, name, i))
+            result = run_load(factory, args.concurrency, args.duration)
+        except RuntimeError as e:
+            result = {'error': str(e)}
+            failed += 1
+        finally:
+            for proc in procs:
+                proc.terminate()
+            for proc in procs:
+                proc.wait()
+        result['name'] = name
+        results.append(result)
+        if 'error' in result:
+            print('%-20s ERROR %s' % (name, result['error']))
+        else:
+            print('%-20s %10.2f req/s  p50 %s ms  p99 %s ms  errors %d' % (name, result['rps'], result['p50_ms'], result['p99_ms'], result['errors']))
+
+    report = {
+        'version': version,
+        'timestamp': int(time.time()),
+        'machine': platform.machine(),
+        'system': platform.system(),
+        'cpus': multiprocessing.cpu_count(),
+        'concurrency': args.concurrency,
+        'processes': args.processes,
+        'duration': args.duration,
+        'extra': args.extra,
+        'scenarios': results,
+    }
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2)
+    print('results written to %s (logs in %s)' % (args.output, logdir))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,54 @@
+# coroutine switch cost of greenlet and gevent, to be compared with the
+# "ucontext switch round trip" of check/bench_core (the engine used by ugreen):
+#
+#   python3 tests/bench/switch.py [--switches 1000000]
+#
+# every round trip is a switch to the coroutine and back, as in uwsgi.suspend()
+import argparse
+import time
+
+
+def bench_greenlet(switches):
+    import greenlet
+
+    main = greenlet.getcurrent()
+
+    def coro():
+        while True:
+            main.switch()
+
+    g = greenlet.greenlet(coro)
+    start = time.perf_counter()
+    for _ in range(switches):
+        g.switch()
+    return time.perf_counter() - start
+
+
+def bench_gevent(switches):
+    import gevent
+
+    def coro():
+        for _ in range(switches):
+            gevent.sleep(0)
+
+    # two greenlets yielding to each other, every sleep(0) goes through the hub
+    start = time.perf_counter()
+    gevent.joinall([gevent.spawn(coro), gevent.spawn(coro)])
+    return (time.perf_counter() - start) / 2
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--switches', type=int, default=1000000)
+    args = parser.parse_args()
+    for name, func in (('greenlet', bench_greenlet), ('gevent', bench_gevent)):
+        try:
+            elapsed = func(args.switches)
+        except ImportError:
+            print('%-48s not installed' % name)
+            continue
+        print('%-48s %12d ops %10.2f ns/op' % (name + ' switch round trip', args.switches, elapsed * 1e9 / args.switches))
+
+
+if __name__ == '__main__':
+    main()
@@ -363,13 +363,37 @@ extern int pivot_root(const char *new_root, const char *put_old);
 #define UWSGI_CACHE_FLAG_DIV	1 << 8
 #define UWSGI_CACHE_FLAG_FIXEXPIRE	1 << 9
 
+#define UWSGI_CACHE_SEQLOCK_RETRIES	16
+
+// eviction policies (used when purge_lru is enabled)
+#define UWSGI_CACHE_POLICY_LRU	0
+#define UWSGI_CACHE_POLICY_SLRU	1
+#define UWSGI_CACHE_POLICY_CLOCK	2
+
+// per-item policy state (stored in the high bits of the item flags)
+#define UWSGI_CACHE_ITEM_PROTECTED	(1ULL << 62)
+#define UWSGI_CACHE_ITEM_REFERENCED	(1ULL << 63)
+
+#define UWSGI_CACHE_WHEEL_SLOTS	4096
+// values (of bitmap caches) that can be pinned at the same time
+#define UWSGI_CACHE_PINS	64
+// log2 microseconds buckets, the last one is unbounded
+#define UWSGI_CACHE_HIST_BUCKETS	16
+
+// batched replication
+#define UWSGI_CACHE_REPL_PKTSIZE	8192
+#define UWSGI_CACHE_REPL_MAXPKT	65000
+#define UWSGI_CACHE_REPL_HISTORY	256
+
 #ifdef UWSGI_SSL
 #include <openssl/conf.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
 #define UWSGI_SSL_SESSION_CACHE
+
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define UWSGI_SSL_KTLS
 #endif
 #endif
 
@@ -418,6 +442,10 @@ struct uwsgi_lock_item {
 	int rw;
 	pid_t pid;
 	int can_deadlock;
+	// --lock-stats counters
+	uint64_t acquisitions;
+	uint64_t contended;
+	uint64_t wait_us;
 	struct uwsgi_lock_item *next;
 };
 
@@ -509,8 +537,36 @@ struct uwsgi_rb_timer {
 struct uwsgi_rbtree *uwsgi_init_rb_timer(void);
 struct uwsgi_rb_timer *uwsgi_min_rb_timer(struct uwsgi_rbtree *, struct uwsgi_rb_timer *);
 struct uwsgi_rb_timer *uwsgi_add_rb_timer(struct uwsgi_rbtree *, uint64_t, void *);
+struct uwsgi_rb_timer *uwsgi_insert_rb_timer(struct uwsgi_rbtree *, struct uwsgi_rb_timer *, uint64_t, void *);
 void uwsgi_del_rb_timer(struct uwsgi_rbtree *, struct uwsgi_rb_timer *);
 
+// hierarchical timing wheel (intrusive timers, O(1) add/del), the tick unit is chosen by the user
+#define UWSGI_TIMER_WHEEL_BITS 6
+#define UWSGI_TIMER_WHEEL_SLOTS (1 << UWSGI_TIMER_WHEEL_BITS)
+#define UWSGI_TIMER_WHEEL_LEVELS 4
+
+struct uwsgi_wheel_timer {
+	uint64_t value;
+	void *data;
+	struct uwsgi_wheel_timer *prev;
+	struct uwsgi_wheel_timer *next;
+	// 0 = not armed, otherwise 1 + the index of the slot
+	uint16_t slot;
+};
+
+struct uwsgi_timer_wheel {
+	uint64_t now;
+	uint64_t count;
+	uint64_t occupied[UWSGI_TIMER_WHEEL_LEVELS];
+	struct uwsgi_wheel_timer *slots[UWSGI_TIMER_WHEEL_LEVELS * UWSGI_TIMER_WHEEL_SLOTS];
+};
+
+struct uwsgi_timer_wheel *uwsgi_timer_wheel_new(uint64_t);
+void uwsgi_timer_wheel_add(struct uwsgi_timer_wheel *, struct uwsgi_wheel_timer *, uint64_t, void *);
+void uwsgi_timer_wheel_del(struct uwsgi_timer_wheel *, struct uwsgi_wheel_timer *);
+struct uwsgi_wheel_timer *uwsgi_timer_wheel_pop(struct uwsgi_timer_wheel *, uint64_t);
+int64_t uwsgi_timer_wheel_next(struct uwsgi_timer_wheel *, uint64_t);
+
 
 union uwsgi_sockaddr {
 	struct sockaddr sa;
@@ -534,6 +590,28 @@ union uwsgi_sockaddr_ptr {
 // server core features
 // -- Gateways can prefork or spawn threads --
 
+// an instance attached to a balanced zerg server
+struct uwsgi_zerg_node {
+	// 0 for the server itself (or an unknown pid), -1 for a dead zerg (its sockets go to the next one)
+	pid_t pid;
+	// one for each socket of the server (its REUSE_PORT twin or the shared one)
+	int *fds;
+	struct uwsgi_zerg_node *next;
+};
+
+// a zerg server giving each zerg its own REUSE_PORT socket
+struct uwsgi_zerg_balancer {
+	int num_sockets;
+	int *sockets;
+	// the sockets with a REUSE_PORT group (the others are shared)
+	int *balanced;
+	// connections are steered (with a BPF program) by the accept queue of each member
+	int steering;
+	// in REUSE_PORT group order
+	struct uwsgi_zerg_node *nodes;
+	int nodes_cnt;
+};
+
 struct uwsgi_gateway {
 
 	char *name;
@@ -643,9 +721,29 @@ struct uwsgi_logger {
 	char *buf;
 	// used by chosen logger
 	char *arg;
+	// the logger writes to a byte stream, so it can get multiple lines in a single message
+	int stream;
+	// max size of a message for stream loggers (0 for no limit)
+	size_t batch_max;
+	// messages queued for the async thread (--log-async-buffer)
+	struct uwsgi_log_async *async;
 	struct uwsgi_logger *next;
 };
 
+// bounded buffer ([u32 len][msg] records) between the log dispatcher and the thread of an async logger
+struct uwsgi_log_async {
+	pthread_mutex_t lock;
+	pthread_cond_t data;
+	pthread_cond_t room;
+	char *buf;
+	size_t size;
+	uint64_t head;
+	uint64_t tail;
+	// exposed as metrics
+	int64_t queued;
+	int64_t dropped;
+};
+
 #ifdef UWSGI_SSL
 struct uwsgi_legion_node {
 	char *name;
@@ -658,6 +756,14 @@ struct uwsgi_legion_node {
 	uint64_t lord_valor;
 	char lord_uuid[36];
 	time_t last_seen;
+	// --legion-scroll-delta
+	uint32_t scroll_version;
+	time_t scroll_requested;
+	// heartbeats arrival (usecs) for the failure detector
+	uint64_t last_heartbeat;
+	uint64_t last_periodic_heartbeat;
+	double interval_mean;
+	double interval_var;
 	struct uwsgi_legion_node *prev;
 	struct uwsgi_legion_node *next;
 };
@@ -674,6 +780,8 @@ struct uwsgi_legion {
 	int socket;
 
 	int quorum;
+	// quorum reached in the last round
+	int has_quorum;
 	int changed;
 	// if set the next packet will be a death-announce
 	int dead;
@@ -707,6 +815,19 @@ struct uwsgi_legion {
 	char *scrolls;
 	uint64_t scrolls_len;
 	uint64_t scrolls_max_size;
+	// the scrolls list is rebuilt once per round
+	int scrolls_dirty;
+
+	// --legion-scroll-delta (in received packets too)
+	uint32_t scroll_version;
+	int scroll_versioned;
+	int scroll_request;
+	uint32_t scroll_announced_version;
+	// out of band announce (not a periodic heartbeat)
+	int oob;
+
+	// nodes (us included) in the last round
+	int alive_nodes;
 
 	// found nodes dynamic lists
 	struct uwsgi_legion_node *nodes_head;
@@ -723,6 +844,11 @@ struct uwsgi_legion {
 	struct uwsgi_string_list *node_left_hooks;
 
 	time_t suspended_til;
+
+	// the lord distributes the ssl session ticket keys via its scroll
+	int ssl_tickets;
+	time_t ssl_tickets_rotated;
+
 	struct uwsgi_legion *next;
 };
 
@@ -753,6 +879,8 @@ struct uwsgi_hash_algo {
 struct uwsgi_hash_algo *uwsgi_hash_algo_get(char *);
 void uwsgi_hash_algo_register(char *, uint32_t(*)(char *, uint64_t));
 void uwsgi_hash_algo_register_all(void);
+uint64_t uwsgi_xxh3_64(char *, uint64_t);
+uint64_t uwsgi_siphash(char *, uint64_t, uint64_t, uint64_t);
 
 struct uwsgi_sharedarea {
 	int id;
@@ -766,6 +894,8 @@ struct uwsgi_sharedarea {
 	uint8_t honour_used;
 	uint64_t used;
 	void *obj;
+	// the page size backing the area (huge pages)
+	size_t mem_page_size;
 };
 
 // maintain alignment here !!!
@@ -796,6 +926,59 @@ struct uwsgi_cache_item {
 	char key[];
 } __attribute__ ((__packed__));
 
+// datagrams received by uwsgi_udp_batch_recv()
+// coroutine stacks (see core/stacks.c)
+struct uwsgi_stack {
+	char *base;
+	size_t map_size;
+	// usable area (between the guard pages)
+	char *sp;
+	size_t size;
+	struct uwsgi_stack *next;
+};
+
+struct uwsgi_stack_pool {
+	size_t stack_size;
+	int max_free;
+	int trim;
+	struct uwsgi_stack *free_list;
+	int free_count;
+	int in_use;
+	int mapped;
+	uint64_t recycled;
+};
+
+// subsystems the allocations are accounted to (--memory-stats)
+#define UWSGI_MEM_CORE		0
+#define UWSGI_MEM_BUFFERS	1
+#define UWSGI_MEM_ROUTING	2
+#define UWSGI_MEM_PLUGINS	3
+#define UWSGI_MEM_SUBSYSTEMS	4
+
+struct uwsgi_udp_batch {
+	int n;
+	size_t bufsize;
+	char *bufs;
+	struct sockaddr_in *addrs;
+	ssize_t *lens;
+#ifdef __linux__
+	struct iovec *iov;
+	struct mmsghdr *msgs;
+#endif
+};
+#define uwsgi_udp_batch_buf(ub, i) ((ub)->bufs + ((i) * (ub)->bufsize))
+
+// process-local mapping of an immutable cache file (see core/cache_immutable.c)
+struct uwsgi_cache_immutable;
+
+// blocks of a value in use by a reader (they are freed only when the last one releases them)
+struct uwsgi_cache_pin {
+	uint64_t first_block;
+	uint64_t size;
+	uint64_t refs;
+	uint64_t released;
+};
+
 struct uwsgi_cache {
 	char *name;
 	uint16_t name_len;
@@ -821,6 +1004,8 @@ struct uwsgi_cache {
 	uint64_t max_item_size;
 	uint64_t n_items;
 	struct uwsgi_cache_item *items;
+	// the page size backing the items (huge pages)
+	size_t items_page_size;
 
 	uint8_t use_last_modified;
 	time_t last_modified_at;
@@ -842,6 +1027,7 @@ struct uwsgi_cache {
 	int udp_node_socket;
 	struct uwsgi_string_list *sync_nodes;
 	struct uwsgi_string_list *udp_servers;
+	int udp_threads;
 
 	struct uwsgi_lock_item *lock;
 
@@ -858,6 +1044,89 @@ struct uwsgi_cache {
 	int lazy_expire;
 	uint64_t sweep_on_full;
 	int clear_on_full;
+
+	// lock-striped mode: the parent cache only dispatches to its shards
+	uint64_t shards_count;
+	struct uwsgi_cache **shards;
+	struct uwsgi_cache *shard_of;
+
+	// pinned values (bitmap mode only)
+	struct uwsgi_cache_pin *pins;
+
+	// lockless (seqlock) reads
+	int seqlock;
+	uint64_t seq;
+
+	// bumped on every update (local memoizations of the values check it)
+	uint64_t generation;
+
+	// open addressing layout (tags are 1 byte per slot)
+	int open_addressing;
+	uint8_t *tags;
+
+	// eviction policy (slru uses lru_* as the probation segment)
+	int policy;
+	uint64_t lru_protected_head;
+	uint64_t lru_protected_tail;
+	uint64_t lru_protected_items;
+	uint64_t lru_protected_max;
+
+	// tinylfu admission (4 rows count-min sketch, counters saturate at 15)
+	int tinylfu;
+	// shared by all of the workers and updated with atomic operations (readers hold only the read lock)
+	uint8_t *sketch;
+	uint64_t sketch_mask;
+	uint64_t *sketch_ops;
+	uint64_t rejected;
+
+	// timer wheel for expirations (items are linked using lru_prev/lru_next)
+	int use_expire_wheel;
+	uint64_t *expire_wheel;
+	uint64_t wheel_pos;
+
+	// batched replication: updates are queued (under the cache lock) in the active
+	// buffer, the master thread swaps them and sends sequenced batches to the nodes
+	uint64_t replication_window;
+	uint64_t replication_buffer_size;
+	char *replication_buffers[2];
+	uint64_t replication_pos[2];
+	int replication_active;
+	uint64_t replication_dropped;
+	uint64_t replication_lost;
+
+#ifdef UWSGI_SSL
+	// legion=<name>: the Lord sequences the updates, the other nodes forward their writes to it
+	struct uwsgi_legion *legion;
+#endif
+	uint64_t legion_forwarded;
+	uint64_t legion_refused;
+
+	// background (chunked) sync from the sync nodes
+	int sync_stream;
+	uint64_t sync_stream_chunk;
+
+	// checksummed (double buffered) snapshots
+	char *snapshot;
+	int snapshot_fd;
+	uint64_t snapshot_freq;
+	uint64_t snapshot_generation;
+	uint64_t *snapshot_hashes[2];
+	// private copy of the cache state (hashed and written without holding the cache lock)
+	char *snapshot_copy;
+	int snapshot_valid[2];
+	time_t snapshot_last;
+
+	// metrics
+	int histograms;
+	uint64_t evictions;
+	uint64_t get_latency[UWSGI_CACHE_HIST_BUCKETS];
+	uint64_t set_latency[UWSGI_CACHE_HIST_BUCKETS];
+	uint64_t lock_wait[UWSGI_CACHE_HIST_BUCKETS];
+
+	// immutable=<file>: read-only perfect hash file, every process remaps it when the generation changes
+	char *immutable;
+	uint64_t immutable_generation;
+	struct uwsgi_cache_immutable *immutable_map;
 };
 
 struct uwsgi_option {
@@ -904,6 +1173,10 @@ struct uwsgi_opt {
 #endif
 
 #define UWSGI_SPOOLER_EXTERNAL		1
+#define UWSGI_SPOOLER_STREAM		2
+#define UWSGI_SPOOLER_STREAM_BODY	1
+
+#define UWSGI_RPC_STREAM		6
 
 #define UWSGI_MODIFIER_ADMIN_REQUEST	10
 #define UWSGI_MODIFIER_SPOOL_REQUEST	17
@@ -942,6 +1215,16 @@ struct uwsgi_loop {
 
 struct wsgi_request;
 
+// body sizes seen by a socket (shared by all the workers), to adapt its post buffering threshold
+#define UWSGI_POST_BUFFERING_BUCKETS 32
+struct uwsgi_post_buffering_policy {
+	uint64_t threshold;
+	uint64_t samples;
+	uint64_t hist[UWSGI_POST_BUFFERING_BUCKETS];
+	uint64_t in_memory;
+	uint64_t in_disk;
+};
+
 struct uwsgi_socket {
 	int fd;
 	char *name;
@@ -954,11 +1237,19 @@ struct uwsgi_socket {
 	uint64_t queue;
 	uint64_t max_queue;
 	int no_defer;
+	// max msecs a connection can wait in the listen queue (admission control)
+	int admission_max_wait;
+	// request bodies smaller than this are buffered in memory (see --post-buffering-socket)
+	size_t post_buffering;
+	struct uwsgi_post_buffering_policy *post_buffering_policy;
 
 	int auto_port;
 	// true if connection must be initialized for each core
 	int per_core;
 
+	// SO_REUSEPORT listen sockets (one per worker, indexed by worker id)
+	int *reuse_port_fds;
+
 	// this is the protocol internal name
 	char *proto_name;
 
@@ -994,6 +1285,11 @@ struct uwsgi_socket {
 
 	// this is a special map for having socket->thread mapping
 	int *fd_threads;
+	// connections can be reused for more requests (HTTP 1.1 keepalive)
+	int keepalive;
+	// per-core parser buffers kept between keepalive requests (and the pipelined bytes they hold)
+	char **proto_parser_bufs;
+	size_t *proto_parser_carry;
 
 	// generally used by zeromq handlers
 	char uuid[37];
@@ -1030,6 +1326,7 @@ struct uwsgi_protocol {
 
 struct uwsgi_server;
 struct uwsgi_instance;
+struct uwsgi_spooler_task;
 
 struct uwsgi_plugin {
 
@@ -1095,6 +1392,11 @@ struct uwsgi_plugin {
 	int (*worker)(void);
 
 	void (*early_post_jail) (void);
+
+	int (*spooler_batch) (struct uwsgi_spooler_task *, int);
+
+	// --harakiri-soft, called (in the worker) from a signal handler with the core to abort
+	void (*soft_harakiri) (int);
 };
 
 #ifdef UWSGI_PCRE
@@ -1105,6 +1407,12 @@ int uwsgi_regexp_ovector(pcre *, pcre_extra *);
 char *uwsgi_regexp_apply_ovec(char *, int, char *, int, int *, int);
 
 int uwsgi_regexp_match_pattern(char *pattern, char *str);
+
+#ifdef UWSGI_HYPERSCAN
+struct uwsgi_regexp_set;
+struct uwsgi_regexp_set *uwsgi_regexp_set_build(char **, uint32_t, uint64_t *);
+int uwsgi_regexp_set_scan(struct uwsgi_regexp_set *, int, char *, size_t, uint64_t *);
+#endif
 #endif
 
 
@@ -1157,6 +1465,20 @@ struct uwsgi_app {
 	uint64_t avg_response_time;
 };
 
+// a task of a batch (--spooler-batch), the plugin sets ret (-2 done, -1 retry)
+struct uwsgi_spooler_task {
+	char *filename;
+	char *buf;
+	uint16_t len;
+	char *body;
+	size_t body_len;
+	int ret;
+
+	char *dir;
+	char *name;
+	int fd;
+};
+
 struct uwsgi_spooler {
 
 	char dir[PATH_MAX];
@@ -1172,6 +1494,8 @@ struct uwsgi_spooler {
 	int running;
 
 	int signal_pipe[2];
+	// written by the enqueuers
+	int wakeup_fd;
 
 	struct uwsgi_spooler *next;
 
@@ -1201,6 +1525,8 @@ struct uwsgi_route {
 	int *ovn;
 	int **ovector;
 	struct uwsgi_buffer **condition_ub;
+	// compiled arguments (UWSGI_ROUTE_TEMPLATES for each core)
+	struct uwsgi_route_template **templates;
 
 	char *subject_str;
 	size_t subject_str_len;
@@ -1238,10 +1564,42 @@ struct uwsgi_route {
 	// this is used by virtual route to free resources
 	void (*free)(struct uwsgi_route *);
 
+	// literal routes dispatched via a lookup table (see uwsgi_fixup_routes)
+	struct uwsgi_route_group *group;
+	uint32_t group_pos;
+
+	// regexp routes scanned at once (multi-pattern backend)
+	struct uwsgi_route_set *set;
+	uint32_t set_pos;
+
 	struct uwsgi_route *next;
 
 };
 
+// a literal ("^foo" or "^foo$") of a routes group
+struct uwsgi_route_literal {
+	char *key;
+	size_t key_len;
+	int prefix;
+	// positions (in the group) of the routes using the literal, ascending
+	uint32_t *members;
+	uint32_t members_cnt;
+	struct uwsgi_route_literal *next;
+};
+
+// consecutive literal routes on the same subject
+struct uwsgi_route_group {
+	size_t subject;
+	size_t subject_len;
+	struct uwsgi_route **routes;
+	uint32_t routes_cnt;
+	struct uwsgi_route_literal **table;
+	uint32_t table_size;
+	// distinct lengths of the prefixes
+	size_t *prefix_lens;
+	uint32_t prefix_lens_cnt;
+};
+
 struct uwsgi_route_condition {
 	char *name;
 	int (*func)(struct wsgi_request *, struct uwsgi_route *);
@@ -1253,9 +1611,24 @@ struct uwsgi_route_var {
 	uint16_t name_len;
 	char *(*func)(struct wsgi_request *, char *, uint16_t, uint16_t *);
 	int need_free;
+	// the value only depends on the request vars (and the argument)
+	int memoize;
 	struct uwsgi_route_var *next;
 };
 
+// per-request memo of route vars values
+struct uwsgi_route_memo {
+	struct uwsgi_route_var *urv;
+	char *arg;
+	uint16_t arg_len;
+	char *value;
+	uint16_t value_len;
+	int need_free;
+	// number of request vars when the value has been computed
+	uint16_t var_cnt;
+	struct uwsgi_route_memo *next;
+};
+
 struct uwsgi_router {
 	char *name;
 	int (*func) (struct uwsgi_route *, char *);
@@ -1265,6 +1638,7 @@ struct uwsgi_router {
 #endif
 
 struct uwsgi_alarm;
+#define UWSGI_ALARM_DEDUPE 8
 struct uwsgi_alarm_instance {
 	char *name;
 	char *arg;
@@ -1279,6 +1653,11 @@ struct uwsgi_alarm_instance {
 	char *last_msg;
 	size_t last_msg_size;
 
+	// dedupe window of the messages queued to the alarm thread (managed by the master)
+	uint64_t queued_hash[UWSGI_ALARM_DEDUPE];
+	time_t queued_at[UWSGI_ALARM_DEDUPE];
+	uint8_t queued_pos;
+
 	struct uwsgi_alarm *alarm;
 	struct uwsgi_alarm_instance *next;
 };
@@ -1330,6 +1709,23 @@ struct uwsgi_async_fd {
 	struct uwsgi_async_fd *next;
 };
 
+// request-scoped memory, released at the end of the request
+struct uwsgi_arena_block {
+	struct uwsgi_arena_block *next;
+	size_t size;
+	size_t pos;
+	char data[];
+};
+
+// hash index of the request vars (see uwsgi_get_var)
+struct uwsgi_vars_index {
+	// hvec items already indexed
+	uint16_t indexed;
+	uint32_t size;
+	// hvec position of the key + 1 (0 is an empty slot)
+	uint16_t slots[];
+};
+
 struct uwsgi_logvar {
 	char key[256];
 	uint8_t keylen;
@@ -1363,6 +1759,13 @@ struct uwsgi_transformation {
 	struct uwsgi_transformation *next;
 };
 
+// compression metrics of a transformation plugin (see uwsgi_transformation_metrics_register())
+struct uwsgi_transformation_metrics {
+	struct uwsgi_metric *bytes_in;
+	struct uwsgi_metric *bytes_out;
+	struct uwsgi_metric *time;
+};
+
 enum uwsgi_range {
 	UWSGI_RANGE_NOT_PARSED,
 	UWSGI_RANGE_PARSED,
@@ -1374,10 +1777,43 @@ enum uwsgi_range {
 #undef sun
 
 struct wsgi_request {
+	/*
+		the fields touched by every request are grouped here (2-3 cache lines),
+		keep the rarely used ones below
+	*/
 	int fd;
+	int async_id;
+	int app_id;
+	int status;
+	uint16_t var_cnt;
+	uint16_t header_cnt;
+	// check if headers are already sent
+	int headers_sent;
+	int switches;
+
 	struct uwsgi_header *uh;
+	char *buffer;
+	// uWSGI 2.1
+	uint64_t len;
+	//iovec
+	struct iovec *hvec;
+	// current socket mapped to request
+	struct uwsgi_socket *socket;
+	struct uwsgi_buffer *headers;
+
+	size_t response_size;
+	size_t headers_size;
+	size_t write_pos;
+
+	uint64_t start_of_request;
+	uint64_t end_of_request;
+
+	size_t post_cl;
+	size_t post_pos;
+
+	// survives the request reset (one for each core)
+	struct uwsgi_arena_block *arena;
 
-	int app_id;
 	int dynamic;
 	int parsed;
 
@@ -1389,12 +1825,16 @@ struct wsgi_request {
 	struct sockaddr_un c_addr;
 	int c_len;
 
-	//iovec
-	struct iovec *hvec;
-
-	uint64_t start_of_request;
 	uint64_t start_of_request_in_sec;
-	uint64_t end_of_request;
+
+	// latency breakdown (microseconds, 0 if the phase did not happen)
+	uint64_t accepted_at;
+	uint64_t headers_at;
+	uint64_t body_at;
+	uint64_t app_at;
+	uint64_t first_byte_at;
+	// time spent in the listen queue (--queue-time-var)
+	uint64_t queue_time;
 
 	char *uri;
 	uint16_t uri_len;
@@ -1473,6 +1913,9 @@ struct wsgi_request {
 	char *if_modified_since;
 	uint16_t if_modified_since_len;
 
+	char *if_none_match;
+	uint16_t if_none_match_len;
+
 	int fd_closed;
 
 	int sendfile_fd;
@@ -1481,8 +1924,6 @@ struct wsgi_request {
 	off_t sendfile_fd_pos;
 	void *sendfile_obj;
 
-	uint16_t var_cnt;
-	uint16_t header_cnt;
 
 	int do_not_log;
 
@@ -1490,17 +1931,8 @@ struct wsgi_request {
 
 	int do_not_account;
 
-	int status;
-	struct uwsgi_buffer *headers;
-
-	size_t response_size;
-	size_t headers_size;
-
-	int async_id;
 	int async_status;
 
-	int switches;
-	size_t write_pos;
 
 	int async_timed_out;
 	int async_ready_fd;
@@ -1524,13 +1956,19 @@ struct wsgi_request {
 	uint64_t write_errors;
 	uint64_t read_errors;
 
+	// 1 if SO_ZEROCOPY is enabled on the socket, -1 if unsupported
+	int zerocopy;
+	// MSG_ZEROCOPY sends not yet completed by the kernel
+	uint64_t zerocopy_pending;
+
 	int *ovector;
-	size_t post_cl;
-	size_t post_pos;
 	size_t post_readline_size;
 	size_t post_readline_pos;
 	size_t post_readline_watermark;
 	FILE *post_file;
+	// bytes stored in post_file during disk buffering
+	size_t post_buffered;
+	uint8_t post_streaming;
 	char *post_readline_buf;
 	// this is used when no post buffering is in place
 	char *post_read_buf;
@@ -1543,11 +1981,7 @@ struct wsgi_request {
 	size_t __range_from;
 	size_t __range_to;
 
-	// current socket mapped to request
-	struct uwsgi_socket *socket;
 
-	// check if headers are already sent
-	int headers_sent;
 	int headers_hvec;
 
 	uint64_t proto_parser_pos;
@@ -1558,8 +1992,6 @@ struct wsgi_request {
 	void *proto_parser_remains_buf;
 	size_t proto_parser_remains;
 
-	char *buffer;
-
 	int log_this;
 
 	int sigwait;
@@ -1587,14 +2019,16 @@ struct wsgi_request {
 	uint16_t http_origin_len;
 	char *http_sec_websocket_protocol;
 	uint16_t http_sec_websocket_protocol_len;
+	char *http_sec_websocket_extensions;
+	uint16_t http_sec_websocket_extensions_len;
 	
 
 	struct uwsgi_buffer *chunked_input_buf;
 	uint8_t chunked_input_parser_status;
 	ssize_t chunked_input_chunk_len;
-	size_t chunked_input_need;
 	uint8_t chunked_input_complete;
-        size_t chunked_input_decapitate;
+	// read cursor in chunked_input_buf
+	size_t chunked_input_off;
 
 	uint64_t stream_id;
 
@@ -1615,12 +2049,17 @@ struct wsgi_request {
 	uint32_t error_route_goto;
 	uint32_t response_route_goto;
 	uint32_t final_route_goto;
+	struct uwsgi_route_memo *route_memo;
+	struct uwsgi_vars_index *vars_index;
+
 
 	int ignore_body;
 
 	struct uwsgi_transformation *transformations;
 	char *transformed_chunk;
 	size_t transformed_chunk_len;
+	// reused by the streaming transformations (ping-pong)
+	struct uwsgi_buffer *transformation_bufs[2];
 
 	int is_raw;
 
@@ -1634,10 +2073,15 @@ struct wsgi_request {
 	int proto_parser_eof;
 
 	int body_is_chunked;
-	struct uwsgi_buffer *body_chunked_buf;
+	// the client asked for "Connection: close"
+	int http_connection_close;
+	// the response has a Content-Length or Transfer-Encoding header
+	int response_has_length;
+	// the app already sent a Connection header
+	int response_has_connection;
+	// the connection has been passed by another worker
+	int handed_over;
 
-	// uWSGI 2.1
-	uint64_t len;
 
 	// 64bit range, deprecates size_t __range_from, __range_to
 	enum uwsgi_range range_parsed;
@@ -1654,7 +2098,21 @@ struct wsgi_request {
 	char * if_range;
 	uint16_t if_range_len;
 
+	// the whole Range header (multiple ranges are parsed by the static files server)
+	char *range;
+	uint16_t range_len;
+	// more writes follow the sendfile() calls, so they cannot be offloaded
+	int no_sendfile_offload;
+
 	uint8_t websocket_is_fin;
+	// permessage-deflate (RFC 7692), UWSGI_WEBSOCKET_DEFLATE_* flags
+	uint8_t websocket_deflate;
+	uint8_t websocket_deflate_window_bits;
+	// the message being received is compressed
+	uint8_t websocket_compressed;
+	// z_stream pointers
+	void *websocket_deflater;
+	void *websocket_inflater;
 };
 
 
@@ -1676,12 +2134,13 @@ struct uwsgi_timer {
 };
 
 struct uwsgi_signal_rb_timer {
+	// msecs
 	int value;
 	int registered;
 	int iterations;
 	int iterations_done;
 	uint8_t sig;
-	struct uwsgi_rb_timer *uwsgi_rb_timer;
+	struct uwsgi_wheel_timer timer;
 };
 
 struct uwsgi_cheaper_algo {
@@ -1712,7 +2171,7 @@ struct uwsgi_stats_pusher;
 struct uwsgi_stats_pusher_instance;
 
 #define UWSGI_PROTO_MIN_CHECK 4
-#define UWSGI_PROTO_MAX_CHECK 28
+#define UWSGI_PROTO_MAX_CHECK 30
 
 struct uwsgi_offload_engine;
 
@@ -1727,6 +2186,8 @@ struct uwsgi_instance_status {
 	int is_cheap;
 	int is_cleaning;
 	int dying_for_need_app;
+	// workers suspended by the Emperor (on demand hibernation)
+	int hibernated;
 };
 
 struct uwsgi_configurator {
@@ -1755,6 +2216,8 @@ struct uwsgi_logging_options {
 	uint32_t slow;
 	uint64_t big;
 	int log_x_forwarded_for;
+	uint64_t sample;
+	uint64_t rate_limit;
 };
 
 struct uwsgi_harakiri_options {
@@ -1801,6 +2264,7 @@ struct uwsgi_server {
 	struct uwsgi_logging_options logging_options;
 	struct uwsgi_harakiri_options harakiri_options;
 	int socket_timeout;
+	uint64_t zerocopy_threshold;
 	int reaper;
 	int cgi_mode;
 	uint64_t max_requests;
@@ -1838,6 +2302,11 @@ struct uwsgi_server {
 	struct uwsgi_logchunk *registered_logchunks;
 	void (*logit) (struct wsgi_request *);
 	struct iovec **logvectors;
+	// per-core scratch area where numeric and formatted chunks are rendered
+	char **logbuffers;
+	size_t logformat_buffer_size;
+	int logformat_msgpack;
+	struct uwsgi_buffer **logformat_ub;
 
 	// autoload plugins
 	int autoload;
@@ -1877,6 +2346,9 @@ struct uwsgi_server {
 	uint64_t master_cycles;
 
 	int reuse_port;
+	int reuse_port_per_worker;
+	int reuse_port_cpu_steering;
+	int reuse_port_numa_steering;
 	int tcp_fast_open;
 	int tcp_fast_open_client;
 
@@ -1897,6 +2369,35 @@ struct uwsgi_server {
 	int lazy;
 	// enable lazy-apps mode
 	int lazy_apps;
+	struct uwsgi_string_list *warmup_requests;
+
+	int admission_enabled;
+	int admission_max_wait;
+	int admission_codel;
+	int admission_codel_interval;
+	int admission_503;
+	struct uwsgi_string_list *admission_socket_max_wait;
+
+	struct uwsgi_string_list *priority_class_list;
+	struct uwsgi_string_list *priority_route_list;
+	struct uwsgi_priority_class *priority_classes;
+	struct uwsgi_priority_class *priority_my_class;
+	char **handover_peek_bufs;
+
+	char *affinity_header;
+	char *affinity_cookie;
+	char *affinity_hash_name;
+	struct uwsgi_hash_algo *affinity_hash;
+	char *affinity_var;
+	size_t affinity_var_len;
+	// handover socketpairs of the workers (2 for each worker id)
+	int *affinity_fds;
+
+	int zygote;
+	pid_t zygote_pid;
+	int zygote_fd;
+	int zygote_ready;
+	int zygote_worker;
 	// enable cheaper mode
 	int cheaper;
 	char *requested_cheaper_algo;
@@ -1906,6 +2407,7 @@ struct uwsgi_server {
 	uint64_t cheaper_overload;
 	// minimal number of running workers in cheaper mode
 	int cheaper_count;
+	int cheaper_standby;
 	int cheaper_initial;
 	// enable idle mode
 	int idle;
@@ -1940,6 +2442,10 @@ struct uwsgi_server {
 	int emperor_magic_exec;
 	int emperor_heartbeat;
 	int emperor_curse_tolerance;
+	int emperor_spawn_parallel;
+	int emperor_spawn_cpu_budget;
+	int emperor_spawn_timeout;
+	struct uwsgi_string_list *emperor_spawn_priority;
 	struct uwsgi_string_list *emperor_extra_extension;
 	// search for a file with the specified extension at the same level of the vassal file
 	char *emperor_on_demand_extension;
@@ -1947,6 +2453,14 @@ struct uwsgi_server {
 	char *emperor_on_demand_directory;
 	// run a shell script passing the vassal as the only argument, the stdout is used as the socket
 	char *emperor_on_demand_exec;
+	// hibernate idle on demand vassals instead of stopping them
+	int emperor_on_demand_hibernate;
+	// per-vassal cgroup v2 placement and pressure based throttling
+	char *emperor_cgroup;
+	struct uwsgi_string_list *emperor_cgroup_opt;
+	struct uwsgi_string_list *emperor_cgroup_protect;
+	int emperor_cgroup_pressure;
+	int emperor_cgroup_throttle_weight;
 
 	int disable_nuclear_blast;
 
@@ -1962,6 +2476,9 @@ struct uwsgi_server {
 	uint64_t emperor_broodlord_num;
 	char *emperor_stats;
 	int emperor_stats_fd;
+	char *emperor_stats_aggregate;
+	int emperor_stats_aggregate_fd;
+	int emperor_stats_aggregate_freq;
 	struct uwsgi_string_list *vassals_templates;
 	struct uwsgi_string_list *vassals_includes;
 	struct uwsgi_string_list *vassals_templates_before;
@@ -1980,9 +2497,13 @@ struct uwsgi_server {
 
 	// set cpu affinity
 	int cpu_affinity;
+	int numa_affinity;
+	int numa_interleave;
+	char *shared_hugepages;
 
 	int reload_mercy;
 	int worker_reload_mercy;
+	int worker_drain;
 	// map reloads to death
 	int exit_on_reload;
 
@@ -2005,6 +2526,13 @@ struct uwsgi_server {
 	int dump_options;
 	// show ini representation of the current config
 	int show_config;
+	// resolved options serialized by --compile-config/--compiled-config
+	char *compile_config;
+	int compiled_config_start;
+	int compiled_config_end;
+	char *emperor_config_stash;
+	size_t emperor_config_stash_len;
+	int emperor_compiled_config;
 	// enable strict mode (only registered options can be used)
 	int strict;
 
@@ -2030,6 +2558,8 @@ struct uwsgi_server {
 	struct uwsgi_string_list *zerg_node;
 	int zerg_fallback;
 	int zerg_server_fd;
+	int zerg_server_reuseport;
+	struct uwsgi_zerg_balancer *zerg_balancer;
 
 	// security
 	char *chroot;
@@ -2139,6 +2669,12 @@ struct uwsgi_server {
 	size_t log_master_bufsize;
 	int log_master_stream;
 	int log_master_req_stream;
+	uint64_t req_log_ring;
+	char *req_log_batch;
+	int req_log_batchable;
+	uint64_t log_async_buffer;
+	int log_async_block;
+	size_t req_log_batch_size;
 
 	int log_reopen;
 	int log_truncate;
@@ -2273,9 +2809,15 @@ struct uwsgi_server {
 	struct uwsgi_string_list *alarm_fd_list;
 	struct uwsgi_string_list *alarm_segfault;
 	struct uwsgi_string_list *alarm_backlog;
+	char *queue_time_var;
 	struct uwsgi_alarm *alarms;
 	struct uwsgi_alarm_instance *alarm_instances;
 	struct uwsgi_alarm_log *alarm_logs;
+#ifdef UWSGI_PCRE
+	// all of the (non negated) log-alarm regexps in a single one, to skip the lines not raising alarms in one pass
+	pcre *alarm_logs_any;
+	pcre_extra *alarm_logs_any_extra;
+#endif
 	struct uwsgi_thread *alarm_thread;
 
 	int threaded_logger;
@@ -2307,9 +2849,15 @@ struct uwsgi_server {
 	struct uwsgi_string_list *static_safe;
 
 	struct uwsgi_hash_algo *hash_algos;
+	char *hash_siphash_key;
 	int use_static_cache_paths;
 	char *static_cache_paths_name;
 	struct uwsgi_cache *static_cache_paths;
+	int static_fd_cache;
+	int static_fd_cache_ttl;
+	int static_etag;
+	struct uwsgi_string_list *static_pin;
+	uint64_t static_pin_max_size;
 	int cache_expire_freq;
 	int cache_report_freed_items;
 	int cache_no_expire;
@@ -2319,6 +2867,8 @@ struct uwsgi_server {
 	int cache_store_sync;
 	struct uwsgi_string_list *cache2;
 	int cache_setup;
+	int cache_immutable;
+	int cache_immutable_swap;
 	int locking_setup;
 	int cache_use_last_modified;
 
@@ -2346,9 +2896,16 @@ struct uwsgi_server {
 	struct uwsgi_offload_engine *offload_engine_transfer;
 	struct uwsgi_offload_engine *offload_engine_memory;
 	struct uwsgi_offload_engine *offload_engine_pipe;
+	struct uwsgi_offload_engine *offload_engine_http;
+	struct uwsgi_offload_engine *offload_engine_cache;
+	int offload_http_keepalive;
+	int connection_pool_size;
 	int offload_threads;
 	int offload_threads_events;
+	int offload_io_uring;
 	struct uwsgi_thread **offload_thread;
+	uint64_t sendfile_readahead;
+	uint64_t offload_sendfile_rate;
 
 	int check_static_docroot;
 	int disable_sendfile;
@@ -2368,6 +2925,10 @@ struct uwsgi_server {
 	struct wsgi_request **async_proto_fd_table;
 	struct uwsgi_async_request *async_runqueue;
 	struct uwsgi_async_request *async_runqueue_last;
+	// one runqueue slot per core (wsgi_req is NULL when the core is not queued)
+	struct uwsgi_async_request *async_runqueue_slots;
+	// one timeout node per core
+	struct uwsgi_rb_timer *async_timeout_slots;
 
 	struct uwsgi_rbtree *rb_async_timeouts;
 
@@ -2385,6 +2946,17 @@ struct uwsgi_server {
 
 	// funny reload systems
 	int force_get_memusage;
+	// collect uss/pss/shared memory after each request (for the stats server)
+	int force_get_memusage_extra;
+
+	// allocator statistics (see core/memory_stats.c), the counters are process local
+	int memory_stats;
+	uint64_t memory_alloc_count;
+	uint64_t memory_alloc_bytes[UWSGI_MEM_SUBSYSTEMS];
+	uint64_t memory_last_bytes;
+	uint64_t memory_apps_heap;
+	uint64_t memory_plugins;
+	uint64_t memory_caches;
 	rlim_t reload_on_as;
 	rlim_t reload_on_rss;
 	rlim_t evil_reload_on_as;
@@ -2395,6 +2967,9 @@ struct uwsgi_server {
 
 	struct uwsgi_string_list *touch_reload;
 	struct uwsgi_string_list *touch_chain_reload;
+	int chain_reload_concurrency;
+	int chain_reload_wait_ready;
+	int chain_reload_ready_timeout;
 	struct uwsgi_string_list *touch_workers_reload;
 	struct uwsgi_string_list *touch_gracefully_stop;
 	struct uwsgi_string_list *touch_logrotate;
@@ -2436,6 +3011,11 @@ struct uwsgi_server {
 	char *spooler_chdir;
 	int spooler_max_tasks;
 	int spooler_ordered;
+	int spooler_index;
+	int spooler_inotify;
+	int spooler_batch;
+	int spooler_threads;
+	int spooler_stream_window;
 	int spooler_quiet;
 	int spooler_frequency;
 
@@ -2451,11 +3031,16 @@ struct uwsgi_server {
 	// removed in 2.1, here for ABI compatibility
 	uint16_t __buffer_size;
 	int signal_bufsize;
+	int signal_coalesce;
 
 	// post buffering
 	size_t post_buffering;
 	int post_buffering_harakiri;
 	size_t post_buffering_bufsize;
+	size_t post_buffering_memfd;
+	int post_buffering_stream;
+	struct uwsgi_string_list *post_buffering_socket;
+	int post_buffering_adaptive;
 	size_t body_read_warning;
 
 	int master_process;
@@ -2467,6 +3052,7 @@ struct uwsgi_server {
 
 	int no_defer_accept;
 	int so_keepalive;
+	int http_socket_keepalive;
 	int so_send_timeout;
 	uint64_t so_sndbuf;
 	uint64_t so_rcvbuf;
@@ -2484,6 +3070,7 @@ struct uwsgi_server {
 
 	int harakiri_verbose;
 	int harakiri_no_arh;
+	int harakiri_soft;
 
 	int magic_table_first_round;
 	char *magic_table[256];
@@ -2498,6 +3085,8 @@ struct uwsgi_server {
 
 	int max_vars;
 	int vec_size;
+	// allocate the per-core vars vectors on demand
+	int compact_cores;
 
 	// shared area
 	struct uwsgi_string_list *sharedareas_list;
@@ -2513,6 +3102,9 @@ struct uwsgi_server {
 	int use_thunder_lock_watchdog;
 	struct uwsgi_lock_item *the_thunder_lock;
 
+	int accept_batch;
+	struct uwsgi_accept_batch *accept_batches;
+
 	/* the list of workers */
 	struct uwsgi_worker *workers;
 	int max_apps;
@@ -2523,6 +3115,8 @@ struct uwsgi_server {
 	struct uwsgi_string_list *farms_list;
 	struct uwsgi_farm *farms;
 	int mule_msg_size;
+	uint64_t mule_msg_ring;
+	struct uwsgi_mule_ring *mule_ring;
 
 	pid_t mypid;
 	int mywid;
@@ -2536,6 +3130,14 @@ struct uwsgi_server {
 
 	struct timeval start_tv;
 
+	// --startup-trace
+	int startup_trace;
+	uint64_t startup_trace_start;
+	uint64_t startup_trace_last;
+	struct uwsgi_string_list *startup_trace_loads;
+	// threads used to initialize big shared memory areas at startup
+	int startup_threads;
+
 	int abstract_socket;
 #ifdef __linux__
 	int freebind;
@@ -2615,6 +3217,9 @@ struct uwsgi_server {
 
 	struct uwsgi_cron *crons;
 	time_t cron_harakiri;
+	int cron_spread;
+	int cron_jitter;
+	struct uwsgi_timer_wheel *cron_wheel;
 
 	time_t respawn_delta;
 
@@ -2663,6 +3268,8 @@ struct uwsgi_server {
 	struct uwsgi_lock_item *registered_locks;
 	struct uwsgi_lock_ops lock_ops;
 	char *lock_engine;
+	int lock_spin;
+	int lock_stats;
 	char *ftok;
 	char *lock_id;
 	size_t lock_size;
@@ -2687,10 +3294,15 @@ struct uwsgi_server {
 	int stats_fd;
 	int stats_http;
 	int stats_minified;
+	int stats_snapshot;
+	char *stats_openmetrics;
+	int stats_openmetrics_fd;
 	struct uwsgi_string_list *requested_stats_pushers;
 	struct uwsgi_stats_pusher *stats_pushers;
 	struct uwsgi_stats_pusher_instance *stats_pusher_instances;
 	int stats_pusher_default_freq;
+	int stats_pusher_mtu;
+	int stats_push_changed_only;
 
 	uint64_t queue_size;
 	uint64_t queue_blocksize;
@@ -2698,7 +3310,9 @@ struct uwsgi_server {
 	struct uwsgi_queue_header *queue_header;
 	char *queue_store;
 	size_t queue_filesize;
+	size_t queue_page_size;
 	int queue_store_sync;
+	int queue_lockfree;
 
 
 	int locks;
@@ -2717,6 +3331,7 @@ struct uwsgi_server {
 
 	// rpc
 	uint64_t rpc_max;
+	int rpc_pool;
 	struct uwsgi_rpc *rpc_table;	
 
 	// subscription client
@@ -2729,6 +3344,8 @@ struct uwsgi_server {
 
 	struct uwsgi_subscribe_node *(*subscription_algo) (struct uwsgi_subscribe_slot *, struct uwsgi_subscribe_node *, struct uwsgi_subscription_client *);
 	int subscription_dotsplit;
+	char *subscription_hash_name;
+	struct uwsgi_hash_algo *subscription_hash;
 
 	int never_swap;
 
@@ -2738,6 +3355,8 @@ struct uwsgi_server {
 	char *ssl_sessions_use_cache;
 	int ssl_sessions_timeout;
 	struct uwsgi_cache *ssl_sessions_cache;
+	char *ssl_tickets_legion;
+	int ssl_tickets_rotate;
 	char *ssl_tmp_dir;
 #ifdef UWSGI_PCRE
 	struct uwsgi_regexp_list *sni_regexp;
@@ -2757,6 +3376,10 @@ struct uwsgi_server {
 	uint16_t legion_scroll_max_size;
 	uint64_t legion_scroll_list_max_size;
 	int legion_death_on_lord_error;
+	int legion_scroll_delta;
+	int legion_freq_ms;
+	int legion_tolerance_ms;
+	char *legion_phi;
 #endif
 
 #ifdef __linux__
@@ -2776,6 +3399,10 @@ struct uwsgi_server {
 	int websockets_ping_freq;
 	int websockets_pong_tolerance;
 	uint64_t websockets_max_size;
+	int websockets_deflate;
+	int websockets_deflate_no_context_takeover;
+	int websockets_deflate_window_bits;
+	char *websockets_hub;
 
 	int chunked_input_timeout;
 	uint64_t chunked_input_limit;
@@ -2788,6 +3415,12 @@ struct uwsgi_server {
 	uint64_t metrics_cnt;
 	struct uwsgi_string_list *additional_metrics;
 	struct uwsgi_string_list *metrics_threshold;
+	struct uwsgi_metric *metric_response_time;
+	struct uwsgi_metric *metric_headers_time;
+	struct uwsgi_metric *metric_body_time;
+	struct uwsgi_metric *metric_app_time;
+	struct uwsgi_metric *metric_first_byte_time;
+	struct uwsgi_metric *metric_queue_time;
 
 	int (*wait_write_hook) (int, int);
 	int (*wait_read_hook) (int, int);
@@ -2831,6 +3464,7 @@ struct uwsgi_server {
 
 	// uWSGI 2.0.9
 	char *subscribe_with_modifier1;
+	int subscriptions_batch;
 	struct uwsgi_string_list *pull_headers;
 
 	// uWSGI 2.0.10
@@ -2860,6 +3494,11 @@ struct uwsgi_server {
 
 #ifdef UWSGI_SSL
 	int tlsv1;
+	int ssl_ktls;
+	int ssl_ocsp_stapling;
+	char *ssl_ocsp_responder;
+	int ssl_ocsp_refresh;
+	int ssl_ocsp_timeout;
 #endif
 
 	// uWSGI 2.0.19
@@ -2872,6 +3511,8 @@ struct uwsgi_server {
 	char *fork_socket;
 	char *emperor_use_fork_server;
 	struct uwsgi_string_list *vassal_fork_base;
+	struct uwsgi_string_list *emperor_fork_servers;
+	struct uwsgi_string_list *fork_server_preload;
 	struct uwsgi_string_list *emperor_collect_attributes;
 	char *emperor_fork_server_attr;
 	char *emperor_wrapper_attr;
@@ -2889,6 +3530,7 @@ struct uwsgi_server {
 	int async_warn_if_queue_full;
 	char *zeus;
 	uint64_t buffer_size;
+	uint64_t request_arena_size;
 	int emperor_tyrant_initgroups;
 	char *safe_pidfile;
 	char *safe_pidfile2;
@@ -2916,6 +3558,10 @@ struct uwsgi_server {
 
 	int subscription_tolerance_inactive;
 
+	int subscription_outlier_failures;
+	int subscription_outlier_latency;
+	int subscription_ejection_time;
+
 #ifdef __linux__
 	rlim_t reload_on_uss;
 	rlim_t reload_on_pss;
@@ -2944,6 +3590,18 @@ struct uwsgi_rpc {
 	struct uwsgi_plugin *plugin;
 };
 
+// a remote (or local) call for uwsgi_rpc_calls()
+struct uwsgi_rpc_call {
+	char *node;
+	char *func;
+	uint8_t argc;
+	char **argv;
+	uint16_t *argvs;
+	// set by uwsgi_rpc_calls() (must be freed)
+	char *response;
+	uint64_t len;
+};
+
 struct uwsgi_signal_entry {
 	int wid;
 	uint8_t modifier1;
@@ -2994,6 +3652,11 @@ struct uwsgi_cron {
 	uint8_t unique;
 	pid_t pid;
 
+	// the start of the next matching minute (the firing could be delayed by spread/jitter)
+	time_t next_fire;
+	struct uwsgi_wheel_timer timer;
+	int registered;
+
 	struct uwsgi_cron *next;
 
 #ifdef UWSGI_SSL
@@ -3001,6 +3664,13 @@ struct uwsgi_cron {
 #endif
 };
 
+// signals coalesced for a signal pipe (--signal-coalesce)
+struct uwsgi_signal_pending {
+	uint64_t bits[4];
+	// a wakeup byte is in the pipe
+	uint64_t armed;
+};
+
 struct uwsgi_shared {
 
 	//vga 80 x25 specific !
@@ -3013,6 +3683,12 @@ struct uwsgi_shared {
 	struct uwsgi_snmp_custom_value snmp_value[100];
 
 	int worker_signal_pipe[2];
+	struct uwsgi_signal_pending worker_signals_pending;
+	// earliest harakiri of the workers cores known by the master (see master_checks.c)
+	time_t workers_next_deadline;
+	int deadline_pipe[2];
+	struct uwsgi_signal_pending spooler_signals_pending;
+	struct uwsgi_signal_pending mule_signals_pending;
 	int spooler_frequency;
 	int spooler_signal_pipe[2];
 	int mule_signal_pipe[2];
@@ -3035,6 +3711,7 @@ struct uwsgi_shared {
 	int worker_log_pipe[2];
 	// used for request logging
 	int worker_req_log_pipe[2];
+	int req_log_ring_pipe[2];
 
 	uint64_t load;
 	uint64_t max_load;
@@ -3056,11 +3733,25 @@ struct uwsgi_shared {
 	uint64_t idle_workers;
 	uint64_t overloaded;
 
+	// drain time (in msecs) of the gracefully stopped workers
+	uint64_t drained_workers;
+	uint64_t drain_time_last;
+	uint64_t drain_time_max;
+
 	int ready;
 };
 
 struct uwsgi_core {
 
+	// hot fields first (see wsgi_req_setup())
+	int in_request;
+	// allocated hvec items (with --compact-cores it grows on demand up to uwsgi.vec_size)
+	int hvec_size;
+	char *buffer;
+	struct iovec *hvec;
+	char *post_buf;
+	// bytes of the request arena retained by the core (updated at the end of every request)
+	uint64_t arena_size;
 
 	uint64_t requests;
 	uint64_t failed_requests;
@@ -3079,19 +3770,58 @@ struct uwsgi_core {
 	// one ts-perapp
 	void **ts;
 
-	int in_request;
-
-	char *buffer;
-	struct iovec *hvec;
-	char *post_buf;
-
 	struct wsgi_request req;
 
 	// uWSGI 2.1
 	time_t harakiri;
 	time_t user_harakiri;
+	// --harakiri-soft: when the current request was asked to abort (set by the master)
+	time_t soft_harakiri;
+
+	struct uwsgi_log_ring *req_log_ring;
+
+	// request log sampling and rate limiting
+	uint64_t log_sampled;
+	uint64_t log_tokens;
+	uint64_t log_tokens_ts;
+	uint64_t log_dropped;
+};
+
+// single producer (the core) single consumer (the logger) ring of request log records ([u32 len][line])
+struct uwsgi_log_ring {
+	uint64_t head;
+	char pad0[56];
+	uint64_t tail;
+	char pad1[56];
+	uint64_t size;
+	char buf[];
+};
+
+// per-core (process local) cache of the events harvested by wsgi_req_accept()
+struct uwsgi_accept_batch {
+	void *events;
+	int count;
+	int pos;
+	// the last listener that successfully accepted, try it again before waiting
+	int drain;
+	int drain_fd;
+	int streak;
+};
+
+// a worker pool reserved for a class of requests (--priority-class)
+struct uwsgi_priority_class {
+	char *name;
+	// indexed by worker id
+	char *workers;
+	// datagram socketpair used for passing connections to the pool (0 receives, 1 sends)
+	int fd[2];
+	struct uwsgi_priority_class *next;
 };
 
+// log-linear buckets (4 for each power of 2, in microseconds) of the per-worker response time histogram
+// values under 4 get their own bucket, then bucket 4*(msb-1) + the 2 bits after the msb (the last one is unbounded)
+#define UWSGI_WORKER_RT_BUCKETS 128
+
 struct uwsgi_worker {
 	int id;
 	pid_t pid;
@@ -3111,10 +3841,32 @@ struct uwsgi_worker {
 	time_t user_harakiri_unused;
 	uint64_t harakiri_count;
 	int pending_harakiri;
+	uint64_t soft_harakiri_count;
+	// requests refused by the admission controller
+	uint64_t admission_refused;
+	// connections passed to a priority class pool
+	uint64_t priority_handovers;
+	// connections passed to the worker owning their affinity key
+	uint64_t affinity_handovers;
 
 	uint64_t vsz_size;
 	uint64_t rss_size;
 
+	// allocator statistics (--memory-stats), updated by the worker itself
+	uint64_t memory_stats_at;
+	uint64_t heap_used;
+	uint64_t heap_free;
+	uint64_t heap_mapped;
+	uint64_t heap_fragmentation;
+	uint64_t alloc_count;
+	uint64_t alloc_bytes;
+	uint64_t alloc_rate;
+	uint64_t alloc_buffers;
+	uint64_t alloc_routing;
+	uint64_t alloc_plugins;
+	uint64_t mem_buffers;
+	uint64_t mem_plugins;
+
 	uint64_t running_time;
 
 	int manage_next_request;
@@ -3135,33 +3887,60 @@ struct uwsgi_worker {
 
 	time_t cursed_at;
 	time_t no_mercy_at;
+	// when the (graceful) stop of the worker started, in microseconds
+	uint64_t drain_started_at;
 
 	// signals managed by this worker
 	uint64_t signals;
 
 	int signal_pipe[2];
+	struct uwsgi_signal_pending signals_pending;
 
 	uint64_t avg_response_time;
+	// histogram of the response times
+	uint64_t rt_histogram[UWSGI_WORKER_RT_BUCKETS];
 
 	struct uwsgi_core *cores;
 
 	int accepting;
 
+	// set by the app (or on accepting without --chain-reload-wait-ready), gates chain reloads
+	int ready;
+	// 1 = cursed by the chain reload, 2 = respawned and waiting to be ready
+	int chain_reload;
+
+	// standby (pre-forked) worker parked waiting for activation, pid is 0 until then
+	int standby;
+	pid_t standby_pid;
+
 	char name[0xff];
 
 	int shutdown_sockets;
 
 	uint64_t uss_size;
 	uint64_t pss_size;
+	uint64_t shared_size;
 };
 
 
+struct uwsgi_mule_ring {
+	struct uwsgi_lock_item *lock;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t size;
+	// eventfd (or pipe) signaled when the ring becomes non-empty
+	int wakeup[2];
+	char data[];
+};
+
 struct uwsgi_mule {
 	int id;
 	pid_t pid;
 
 	int signal_pipe[2];
+	struct uwsgi_signal_pending signals_pending;
 	int queue_pipe[2];
+	struct uwsgi_mule_ring *ring;
 
 	time_t last_spawn;
 	uint64_t respawn_count;
@@ -3184,6 +3963,8 @@ struct uwsgi_mule {
 
 struct uwsgi_mule_farm {
 	struct uwsgi_mule *mule;
+	// the queue of the mule in the farm (--mule-msg-ring)
+	struct uwsgi_mule_ring *ring;
 	struct uwsgi_mule_farm *next;
 };
 
@@ -3192,6 +3973,7 @@ struct uwsgi_farm {
 	char name[0xff];
 
 	int signal_pipe[2];
+	struct uwsgi_signal_pending signals_pending;
 	int queue_pipe[2];
 
 	struct uwsgi_mule_farm *mules;
@@ -3213,10 +3995,16 @@ void end_me(int);
 int bind_to_unix(char *, int, int, int);
 int bind_to_tcp(char *, int, char *);
 int bind_to_udp(char *, int, int);
+int bind_to_udp_reuse_port(char *);
+struct uwsgi_udp_batch *uwsgi_udp_batch_new(int, size_t);
+int uwsgi_udp_batch_recv(struct uwsgi_udp_batch *, int);
 int bind_to_unix_dgram(char *);
 int timed_connect(struct pollfd *, const struct sockaddr *, int, int, int);
 int uwsgi_connect(char *, int, int);
 int uwsgi_connect_udp(char *);
+int uwsgi_connection_pool_get(char *);
+void uwsgi_connection_pool_put(char *, int);
+void uwsgi_connection_pool_release(char *, int, size_t, int);
 int uwsgi_connectn(char *, uint16_t, int, int);
 
 void daemonize(char *);
@@ -3224,8 +4012,27 @@ void logto(char *);
 
 void log_request(struct wsgi_request *);
 void get_memusage(uint64_t *, uint64_t *);
+
+struct uwsgi_stack_pool *uwsgi_stack_pool_new(size_t, int, int);
+struct uwsgi_stack *uwsgi_stack_get(struct uwsgi_stack_pool *);
+void uwsgi_stack_put(struct uwsgi_stack_pool *, struct uwsgi_stack *);
+
+void uwsgi_memory_account(size_t);
+void uwsgi_memory_account_to(int, size_t);
+int uwsgi_memory_enter(int);
+void uwsgi_memory_leave(int);
+char *uwsgi_memory_allocator(void);
+int uwsgi_memory_heap(uint64_t *, uint64_t *, uint64_t *);
+void uwsgi_memory_stats_apps_begin(void);
+void uwsgi_memory_stats_apps_end(void);
+void uwsgi_memory_stats_worker_init(void);
+void uwsgi_memory_stats_update(uint64_t);
+uint64_t uwsgi_memory_caches(void);
+uint64_t uwsgi_memory_core(struct uwsgi_core *);
+int uwsgi_req_hvec_capacity(struct wsgi_request *);
+int uwsgi_req_hvec_room(struct wsgi_request *, int);
 #ifdef __linux__
-void get_memusage_extra(uint64_t *, uint64_t *);
+void get_memusage_extra(uint64_t *, uint64_t *, uint64_t *);
 #endif
 void harakiri(void);
 
@@ -3247,6 +4054,9 @@ void uwsgi_master_manage_snmp(int);
 
 char *uwsgi_spool_request(struct wsgi_request *, char *, size_t, char *, size_t);
 void spooler(struct uwsgi_spooler *);
+void uwsgi_spooler_wakeup_init(struct uwsgi_spooler *);
+void uwsgi_spooler_threads_check(struct uwsgi_spooler *);
+int uwsgi_spool_remote(char *, int, char **, size_t *, char **, size_t *, char *);
 pid_t spooler_start(struct uwsgi_spooler *);
 
 int uwsgi_spooler_read_header(char *, int, struct uwsgi_header *);
@@ -3386,6 +4196,9 @@ char *uwsgi_cache_get2(struct uwsgi_cache *, char *, uint16_t, uint64_t *);
 char *uwsgi_cache_get3(struct uwsgi_cache *, char *, uint16_t, uint64_t *, uint64_t *);
 char *uwsgi_cache_get4(struct uwsgi_cache *, char *, uint16_t, uint64_t *, uint64_t *);
 uint32_t uwsgi_cache_exists2(struct uwsgi_cache *, char *, uint16_t);
+struct uwsgi_cache *uwsgi_cache_pinnable(char *, char *, uint16_t);
+int uwsgi_cache_pin(struct uwsgi_cache *, char *, uint16_t, char **, uint64_t *, uint64_t *, uint64_t *);
+void uwsgi_cache_unpin(struct uwsgi_cache *, uint64_t);
 struct uwsgi_cache *uwsgi_cache_create(char *);
 struct uwsgi_cache *uwsgi_cache_by_name(char *);
 struct uwsgi_cache *uwsgi_cache_by_namelen(char *, uint16_t);
@@ -3393,13 +4206,30 @@ void uwsgi_cache_create_all(void);
 void uwsgi_cache_sync_from_nodes(struct uwsgi_cache *);
 void uwsgi_cache_setup_nodes(struct uwsgi_cache *);
 int64_t uwsgi_cache_num2(struct uwsgi_cache *, char *, uint16_t);
+struct uwsgi_cache *uwsgi_cache_shard(struct uwsgi_cache *, char *, uint16_t);
+int uwsgi_cache_clear(struct uwsgi_cache *);
 
 void uwsgi_cache_sync_all(void);
 void uwsgi_cache_start_sweepers(void);
 void uwsgi_cache_start_sync_servers(void);
+void uwsgi_cache_start_replicators(void);
+void uwsgi_cache_start_snapshotters(void);
+uint64_t uwsgi_cache_fragmentation(struct uwsgi_cache *);
+
+void uwsgi_cache_immutable_init(struct uwsgi_cache *);
+char *uwsgi_cache_immutable_get(struct uwsgi_cache *, char *, uint16_t, uint64_t *);
+char *uwsgi_cache_immutable_lookup(char *, char *, uint16_t, uint64_t *);
+int uwsgi_cache_immutable_build(char *, char *);
+void uwsgi_cache_immutable_swap(int);
+void uwsgi_cache_immutable_swap_signal(int);
+void uwsgi_opt_cache_immutable_build(char *, char *, void *);
+struct uwsgi_buffer *uwsgi_cache_dump_range(struct uwsgi_cache *, uint64_t, uint64_t, uint64_t *, uint64_t *);
 
 
 void *uwsgi_malloc(size_t);
+void *uwsgi_req_alloc(struct wsgi_request *, size_t);
+void *uwsgi_req_calloc(struct wsgi_request *, size_t);
+void uwsgi_req_arena_reset(struct wsgi_request *);
 void *uwsgi_calloc(size_t);
 
 
@@ -3410,6 +4240,7 @@ int event_queue_add_fd_write(int, int);
 int event_queue_del_fd(int, int, int);
 int event_queue_wait(int, int, int *);
 int event_queue_wait_multi(int, int, void *, int);
+int event_queue_wait_multi_ms(int, int, void *, int);
 int event_queue_interesting_fd(void *, int);
 int event_queue_interesting_fd_has_error(void *, int);
 int event_queue_fd_write_to_read(int, int);
@@ -3434,6 +4265,7 @@ int uwsgi_add_file_monitor(uint8_t, char *);
 int uwsgi_add_timer(uint8_t, int);
 int uwsgi_add_timer_hr(uint8_t, int, long);
 int uwsgi_signal_add_rb_timer(uint8_t, int, int);
+int uwsgi_signal_add_rb_timer_ms(uint8_t, int, int);
 int uwsgi_signal_handler(struct wsgi_request *, uint8_t);
 
 void uwsgi_route_signal(uint8_t);
@@ -3443,6 +4275,8 @@ int uwsgi_start(void *);
 int uwsgi_register_rpc(char *, struct uwsgi_plugin *, uint8_t, void *);
 uint64_t uwsgi_rpc(char *, uint8_t, char **, uint16_t *, char **);
 char *uwsgi_do_rpc(char *, char *, uint8_t, char **, uint16_t *, uint64_t *);
+int uwsgi_rpc_calls(struct uwsgi_rpc_call *, int);
+int uwsgi_rpc_multi(char **, int, char *, uint8_t, char **, uint16_t *, int, char **, uint64_t *);
 void uwsgi_rpc_init(void);
 
 char *uwsgi_cheap_string(char *, int);
@@ -3484,6 +4318,9 @@ char *uwsgi_queue_pull(uint64_t *);
 int uwsgi_queue_push(char *, uint64_t);
 char *uwsgi_queue_pop(uint64_t *);
 int uwsgi_queue_set(uint64_t, char *, uint64_t);
+int uwsgi_queue_push_message(char *, uint64_t);
+char *uwsgi_queue_pull_message(uint64_t *, int);
+char *uwsgi_queue_pop_message(uint64_t *, int);
 
 
 struct uwsgi_subscribe_req {
@@ -3591,6 +4428,8 @@ char *uwsgi_amqp_consume(int, uint64_t *, char **);
 int uwsgi_file_serve(struct wsgi_request *, char *, uint16_t, char *, uint16_t, int);
 int uwsgi_starts_with(char *, int, char *, int);
 int uwsgi_static_want_gzip(struct wsgi_request *, char *, size_t *, struct stat *);
+void uwsgi_static_pin_init(void);
+int uwsgi_static_etag(struct stat *, char *, char *);
 
 #ifdef __sun__
 time_t timegm(struct tm *);
@@ -3691,6 +4530,37 @@ void uwsgi_sig_pause(void);
 void uwsgi_ignition(void);
 
 int uwsgi_respawn_worker(int);
+void uwsgi_standby_park(void);
+int uwsgi_standby_spawn(int);
+int uwsgi_standby_check_death(pid_t);
+void uwsgi_standby_destroy(void);
+void uwsgi_worker_child_setup(int);
+
+void uwsgi_warmup(void);
+void uwsgi_admission_setup(void);
+int uwsgi_admission_check(struct wsgi_request *);
+void uwsgi_priority_setup(void);
+void uwsgi_priority_worker_setup(void);
+int uwsgi_priority_dispatch(struct wsgi_request *);
+struct uwsgi_priority_class *uwsgi_priority_class_by_name(char *, size_t);
+int uwsgi_handover_accept(struct wsgi_request *, int);
+struct uwsgi_socket *uwsgi_handover_socket(char *, int);
+int uwsgi_handover_send(struct wsgi_request *, int);
+void uwsgi_handover_release(struct wsgi_request *);
+char *uwsgi_handover_peek(struct wsgi_request *, size_t *);
+char *uwsgi_handover_head_var(struct uwsgi_socket *, char *, size_t, char *, size_t, size_t *);
+void uwsgi_affinity_setup(void);
+void uwsgi_affinity_worker_setup(void);
+int uwsgi_affinity_worker(char *, size_t);
+int uwsgi_affinity_dispatch(struct wsgi_request *);
+
+void uwsgi_zygote_init(void);
+int uwsgi_zygote_spawn(void);
+int uwsgi_zygote_is_ready(void);
+pid_t uwsgi_zygote_fork(int);
+int uwsgi_zygote_check_death(pid_t);
+void uwsgi_zygote_destroy(void);
+void uwsgi_zygote_reload(void);
 
 socklen_t socket_to_in_addr(char *, char *, int, struct sockaddr_in *);
 socklen_t socket_to_un_addr(char *, struct sockaddr_un *);
@@ -3715,10 +4585,12 @@ int uwsgi_run_command_and_wait(char *, char *);
 int uwsgi_run_command_putenv_and_wait(char *, char *, char **, unsigned int);
 int uwsgi_call_symbol(char *);
 
-void uwsgi_manage_signal_cron(time_t);
+void uwsgi_cron_setup(void);
+int64_t uwsgi_cron_timeout(void);
+void uwsgi_cron_expire(void);
+time_t uwsgi_cron_next(struct uwsgi_cron *, time_t);
 pid_t uwsgi_run_command(char *, int *, int);
 
-void uwsgi_manage_command_cron(time_t);
 
 int *uwsgi_attach_fd(int, int *, char *, size_t);
 
@@ -3775,6 +4647,7 @@ struct uwsgi_subscription_client {
 	int fd;
 	union uwsgi_sockaddr *sockaddr;
 	char *cookie;
+	uint16_t cookie_len;
 };
 
 struct uwsgi_subscribe_node {
@@ -3803,6 +4676,15 @@ struct uwsgi_subscribe_node {
 	uint64_t weight;
 	uint64_t wrr;
 
+	// moving average (in microseconds) of the backend response time, measured by the routers
+	uint64_t latency;
+
+	// passive health checks (outlier detection)
+	uint64_t consecutive_failures;
+	uint64_t ejected_until;
+	uint64_t ejections;
+	int ejected;
+
 	time_t unix_check;
 
 	// used by unix credentials
@@ -3825,6 +4707,23 @@ struct uwsgi_subscribe_node {
 	uint16_t vassal_len;
 };
 
+// circuit breaker of a subscription key (managed by the routers)
+struct uwsgi_subscribe_breaker {
+	int state;
+	// end of the open state (usecs)
+	uint64_t open_until;
+	// start of the current error rate window
+	time_t window;
+	uint64_t requests;
+	uint64_t failures;
+	// requests currently running on the nodes of the key
+	uint64_t inflight;
+	// a half-open probe request is running
+	int probing;
+	uint64_t trips;
+	uint64_t rejected;
+};
+
 struct uwsgi_subscribe_slot {
 
 	char key[0xff];
@@ -3836,9 +4735,6 @@ struct uwsgi_subscribe_slot {
 
 	struct uwsgi_subscribe_node *nodes;
 
-	struct uwsgi_subscribe_slot *prev;
-	struct uwsgi_subscribe_slot *next;
-
 #ifdef UWSGI_SSL
 	EVP_PKEY *sign_public_key;
 	EVP_MD_CTX *sign_ctx;
@@ -3848,18 +4744,43 @@ struct uwsgi_subscribe_slot {
 	// uWSGI 2.1 (algo is required)
         struct uwsgi_subscribe_node *(*algo) (struct uwsgi_subscribe_slot *, struct uwsgi_subscribe_node *, struct uwsgi_subscription_client *);
 
+	// consistent hashing ring (lazily built by the chash algo, dropped whenever the nodes change)
+	struct uwsgi_subscribe_point *ring;
+	uint64_t ring_size;
+
+	struct uwsgi_subscribe_breaker breaker;
+};
+
+struct uwsgi_subscribe_point {
+	uint32_t hash;
+	struct uwsgi_subscribe_node *node;
+};
+
+// buckets store the key hash, so probing compares keys only on hash matches
+struct uwsgi_subscribe_bucket {
+	uint32_t hash;
+	struct uwsgi_subscribe_slot *slot;
+};
+
+// open addressing (linear probing) table of subscription slots, resized on load
+struct uwsgi_subscriptions {
+	uint64_t size;
+	uint64_t count;
+	struct uwsgi_subscribe_bucket *buckets;
 };
 
 int mule_send_msg(int, char *, size_t);
 
 uint32_t djb33x_hash(char *, uint64_t);
 void create_signal_pipe(int *);
+int uwsgi_signal_pending_get(int, uint8_t, uint8_t *);
 void create_msg_pipe(int *, int);
-struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscribe_slot **, char *, uint16_t);
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscribe_slot **, char *, uint16_t, char *, uint16_t);
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscribe_slot **, char *, uint16_t, struct uwsgi_subscription_client *);
-int uwsgi_remove_subscribe_node(struct uwsgi_subscribe_slot **, struct uwsgi_subscribe_node *);
-struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slot **, struct uwsgi_subscribe_req *);
+struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscriptions *, char *, uint16_t);
+struct uwsgi_subscribe_slot *uwsgi_subscriptions_next(struct uwsgi_subscriptions *, uint64_t *);
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscriptions *, char *, uint16_t, char *, uint16_t);
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscriptions *, char *, uint16_t, struct uwsgi_subscription_client *);
+int uwsgi_remove_subscribe_node(struct uwsgi_subscriptions *, struct uwsgi_subscribe_node *);
+struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscriptions *, struct uwsgi_subscribe_req *);
 
 ssize_t uwsgi_mule_get_msg(int, int, char *, size_t, int);
 
@@ -3869,6 +4790,10 @@ int uwsgi_signal_send(int, uint8_t);
 int uwsgi_remote_signal_send(char *, uint8_t);
 
 void uwsgi_configure();
+struct uwsgi_buffer *uwsgi_compiled_config_build(int, int, int);
+int uwsgi_compiled_config_apply(char *, size_t);
+void uwsgi_compiled_config_dump(void);
+void uwsgi_compiled_config_send_to_emperor(void);
 
 int uwsgi_read_response(int, struct uwsgi_header *, int, char **);
 char *uwsgi_simple_file_read(char *);
@@ -3894,7 +4819,7 @@ int uwsgi_build_cap(char *, cap_value_t **);
 void uwsgi_apply_cap(cap_value_t *, int);
 #endif
 
-void uwsgi_register_logger(char *, ssize_t(*func) (struct uwsgi_logger *, char *, size_t));
+struct uwsgi_logger *uwsgi_register_logger(char *, ssize_t(*func) (struct uwsgi_logger *, char *, size_t));
 void uwsgi_append_logger(struct uwsgi_logger *);
 void uwsgi_append_req_logger(struct uwsgi_logger *);
 struct uwsgi_logger *uwsgi_get_logger(char *);
@@ -3908,9 +4833,25 @@ struct uwsgi_gateway_socket *uwsgi_new_gateway_socket_from_fd(int, char *);
 
 void escape_shell_arg(char *, size_t, char *);
 void escape_json(char *, size_t, char *);
+size_t uwsgi_json_plain_len(char *, size_t);
+size_t uwsgi_json_escape(char *, char *, size_t);
 
 void *uwsgi_malloc_shared(size_t);
+void *uwsgi_mmap_shared(size_t, size_t *);
 void *uwsgi_calloc_shared(size_t);
+void uwsgi_parallel_for(uint64_t, uint64_t, void (*)(uint64_t, uint64_t, void *), void *);
+void uwsgi_parallel_memset(void *, size_t);
+
+void uwsgi_startup_trace_init(void);
+void uwsgi_startup_trace_phase(char *);
+void uwsgi_startup_trace_hook(const char *, char *, uint64_t);
+#define uwsgi_plugin_hook_call(up, hook) do {\
+		if ((up)->hook) {\
+			uint64_t _uht = uwsgi.startup_trace ? uwsgi_micros() : 0;\
+			(up)->hook();\
+			if (_uht) uwsgi_startup_trace_hook((up)->name, #hook, _uht);\
+		}\
+	} while(0)
 
 struct uwsgi_spooler *uwsgi_new_spooler(char *);
 
@@ -3969,11 +4910,14 @@ void uwsgi_opt_add_unique_legion_cron(char *, char *, void *);
 void uwsgi_opt_sni(char *, char *, void *);
 struct uwsgi_string_list *uwsgi_ssl_add_sni_item(char *, char *, char *, char *, char *);
 void uwsgi_ssl_del_sni_item(char *, uint16_t);
+void uwsgi_ssl_ocsp_setup(SSL_CTX *, char *);
+void uwsgi_ssl_ocsp_free(SSL_CTX *);
 char *uwsgi_write_pem_to_file(char *, char *, size_t, char *);
 #endif
 void uwsgi_opt_flock(char *, char *, void *);
 void uwsgi_opt_flock_wait(char *, char *, void *);
 void uwsgi_opt_load_ini(char *, char *, void *);
+void uwsgi_opt_load_compiled(char *, char *, void *);
 #ifdef UWSGI_XML
 void uwsgi_opt_load_xml(char *, char *, void *);
 #endif
@@ -4069,6 +5013,7 @@ int uwsgi_apply_routes_do(struct uwsgi_route *, struct wsgi_request *, char *, u
 void uwsgi_register_embedded_routers(void);
 void uwsgi_routing_dump();
 struct uwsgi_buffer *uwsgi_routing_translate(struct wsgi_request *, struct uwsgi_route *, char *, uint16_t, char *, size_t);
+void uwsgi_routing_free_memo(struct wsgi_request *);
 int uwsgi_route_api_func(struct wsgi_request *, char *, char *);
 struct uwsgi_route_condition *uwsgi_register_route_condition(char *, int (*) (struct wsgi_request *, struct uwsgi_route *));
 void uwsgi_fixup_routes(struct uwsgi_route *);
@@ -4084,6 +5029,9 @@ void uwsgi_check_logrotate(void);
 char *uwsgi_check_touches(struct uwsgi_string_list *);
 
 void uwsgi_manage_zerg(int, int, int *);
+struct uwsgi_zerg_balancer *uwsgi_zerg_balancer_new(int, int *, int, int);
+void uwsgi_manage_zerg_balanced(struct uwsgi_zerg_balancer *, int);
+void uwsgi_zerg_balancer_update(struct uwsgi_zerg_balancer *);
 
 time_t uwsgi_now(void);
 
@@ -4095,6 +5043,7 @@ int uwsgi_cheaper_algo_manual(int);
 
 int uwsgi_master_log(void);
 int uwsgi_master_req_log(void);
+int uwsgi_master_req_log_rings(void);
 void uwsgi_flush_logs(void);
 
 void uwsgi_register_cheaper_algo(char *, int (*)(int));
@@ -4108,6 +5057,8 @@ void uwsgi_emulate_cow_for_apps(int);
 char *uwsgi_read_fd(int, size_t *, int);
 
 void uwsgi_setup_post_buffering(void);
+size_t uwsgi_post_buffering_threshold(struct wsgi_request *);
+void uwsgi_post_buffering_account(struct wsgi_request *, int);
 
 struct uwsgi_lock_item *uwsgi_lock_ipcsem_init(char *);
 
@@ -4167,14 +5118,37 @@ struct uwsgi_stats_pusher_instance {
 	int retry_delay;
 	time_t next_retry;
 
+	// values of the last push (--stats-push-changed-only)
+	int64_t *last_values;
+	uint8_t *last_pushed;
+
 	struct uwsgi_stats_pusher_instance *next;
 };
 
+struct uwsgi_stats_pusher_batch {
+	int fd;
+	// destination of datagrams, NULL for connected sockets
+	struct sockaddr *addr;
+	socklen_t addr_len;
+	size_t size;
+	int timeout;
+	uint64_t packets;
+	struct uwsgi_buffer *ub;
+};
+
+struct uwsgi_stats_pusher_batch *uwsgi_stats_pusher_batch_new(int, struct sockaddr *, socklen_t, size_t, int);
+int uwsgi_stats_pusher_batch_add(struct uwsgi_stats_pusher_batch *, char *, size_t);
+int uwsgi_stats_pusher_batch_flush(struct uwsgi_stats_pusher_batch *);
+void uwsgi_stats_pusher_batch_destroy(struct uwsgi_stats_pusher_batch *);
+int uwsgi_stats_pusher_changed(struct uwsgi_stats_pusher_instance *, int, int64_t);
+
 struct uwsgi_thread;
 void uwsgi_stats_pusher_loop(struct uwsgi_thread *);
 
 void uwsgi_stats_pusher_setup(void);
 void uwsgi_send_stats(int, struct uwsgi_stats *(*func) (void));
+void uwsgi_send_stats_snapshot(int, struct uwsgi_stats *(*func) (void));
+void uwsgi_stats_snapshot_refresh(struct uwsgi_stats *(*func) (void));
 struct uwsgi_stats *uwsgi_master_generate_stats(void);
 struct uwsgi_stats_pusher * uwsgi_register_stats_pusher(char *, void (*)(struct uwsgi_stats_pusher_instance *, time_t, char *, size_t));
 
@@ -4197,6 +5171,7 @@ int uwsgi_stats_keylong_comma(struct uwsgi_stats *, char *, unsigned long long);
 int uwsgi_stats_keyslong(struct uwsgi_stats *, char *, long long);
 int uwsgi_stats_keyslong_comma(struct uwsgi_stats *, char *, long long);
 int uwsgi_stats_str(struct uwsgi_stats *, char *);
+int uwsgi_stats_strn_json(struct uwsgi_stats *, char *, size_t);
 
 char *uwsgi_substitute(char *, char *, char *);
 
@@ -4215,6 +5190,8 @@ char *uwsgi_get_cflags();
 struct uwsgi_string_list *uwsgi_string_list_has_item(struct uwsgi_string_list *, char *, size_t);
 
 void trigger_harakiri(int);
+void trigger_soft_harakiri(int, int);
+void soft_harakiri(int);
 
 void uwsgi_setup_systemd();
 void uwsgi_setup_upstart();
@@ -4225,6 +5202,7 @@ void uwsgi_setup_emperor();
 #ifdef UWSGI_SSL
 void uwsgi_ssl_init(void);
 SSL_CTX *uwsgi_ssl_new_server_context(char *, char *, char *, char *, char *);
+void uwsgi_ssl_tickets_rotate(struct uwsgi_legion *, int);
 char *uwsgi_rsa_sign(char *, char *, size_t, unsigned int *);
 char *uwsgi_sanitize_cert_filename(char *, char *, uint16_t);
 void uwsgi_opt_scd(char *, char *, void *);
@@ -4237,7 +5215,8 @@ char *uwsgi_md5(char *, size_t, char *);
 
 void uwsgi_opt_ssa(char *, char *, void *);
 
-int uwsgi_no_subscriptions(struct uwsgi_subscribe_slot **);
+int uwsgi_no_subscriptions(struct uwsgi_subscriptions *);
+void uwsgi_subscribe_node_report(struct uwsgi_subscribe_node *, int);
 void uwsgi_deadlock_check(pid_t);
 
 
@@ -4251,13 +5230,22 @@ struct uwsgi_logchunk {
 	int type;
 	int free;
 	ssize_t(*func) (struct wsgi_request *, char **);
+	// numeric chunks
+	int64_t (*num) (struct wsgi_request *);
+	// chunks rendered in the per-core buffer
+	ssize_t (*render) (struct wsgi_request *, char *, size_t);
+	size_t render_len;
+	size_t buf_pos;
 	struct uwsgi_logchunk *next;
 };
 
 void uwsgi_build_log_format(char *);
+void uwsgi_logit_lf_msgpack(struct wsgi_request *);
 
 void uwsgi_add_logchunk(int, int, char *, size_t);
 struct uwsgi_logchunk *uwsgi_register_logchunk(char *, ssize_t (*)(struct wsgi_request *, char **), int);
+struct uwsgi_logchunk *uwsgi_register_logchunk_num(char *, int64_t (*)(struct wsgi_request *));
+struct uwsgi_logchunk *uwsgi_register_logchunk_render(char *, ssize_t (*)(struct wsgi_request *, char *, size_t), size_t);
 
 void uwsgi_logit_simple(struct wsgi_request *);
 void uwsgi_logit_lf(struct wsgi_request *);
@@ -4281,6 +5269,23 @@ int uwsgi_emperor_is_valid(char *);
 // an instance (called vassal) is a uWSGI stack running
 // it is identified by the name of its config file
 // a vassal is 'loyal' as soon as it manages a request
+// metrics sent by a vassal to the Emperor (--emperor-stats-aggregate)
+struct uwsgi_emperor_vassal_metrics {
+	uint64_t workers;
+	uint64_t busy_workers;
+	uint64_t requests;
+	uint64_t exceptions;
+	uint64_t harakiri_count;
+	uint64_t respawn_count;
+	uint64_t tx;
+	uint64_t rss_size;
+	uint64_t vsz_size;
+	uint64_t avg_rt;
+	uint64_t load;
+	uint64_t listen_queue;
+	uint64_t listen_queue_errors;
+};
+
 struct uwsgi_instance {
 	struct uwsgi_instance *ui_prev;
 	struct uwsgi_instance *ui_next;
@@ -4332,6 +5337,35 @@ struct uwsgi_instance {
 
 	// when 1 the instance must be manually activated
 	int suspended;
+
+	// on demand hibernation (--emperor-on-demand-hibernate)
+	int hibernated;
+	int hibernate_on_accepting;
+
+	// compiled config sent back by the vassal (--emperor-compiled-config)
+	char *compiled_config;
+	uint32_t compiled_config_len;
+	uint32_t compiled_config_hash;
+	uint32_t pushed_config_hash;
+
+	// waiting for a spawn slot (--emperor-spawn-parallel)
+	int spawn_queued;
+	int spawn_tier;
+	time_t spawn_started;
+
+	// chains of the emperor indexes (name, pipe and on demand socket)
+	struct uwsgi_instance *hash_next[3];
+
+	// cgroup v2 accounting (--emperor-cgroup)
+	char *cgroup;
+	int cgroup_protected;
+	int cgroup_throttled;
+	uint64_t cgroup_cpu_usec;
+	uint64_t cgroup_cpu_delta;
+
+	// last metrics received (--emperor-stats-aggregate)
+	struct uwsgi_emperor_vassal_metrics metrics;
+	time_t metrics_updated;
 };
 
 struct uwsgi_instance *emperor_get_by_fd(int);
@@ -4349,6 +5383,17 @@ void uwsgi_imperial_monitor_glob_init(struct uwsgi_emperor_scanner *);
 void uwsgi_imperial_monitor_directory_init(struct uwsgi_emperor_scanner *);
 void uwsgi_imperial_monitor_directory(struct uwsgi_emperor_scanner *);
 void uwsgi_imperial_monitor_glob(struct uwsgi_emperor_scanner *);
+#ifdef __linux__
+void uwsgi_imperial_monitor_inotify_init(struct uwsgi_emperor_scanner *);
+void uwsgi_imperial_monitor_inotify(struct uwsgi_emperor_scanner *);
+#endif
+
+void uwsgi_emperor_cgroup_init(void);
+void uwsgi_emperor_cgroup_new(struct uwsgi_instance *);
+void uwsgi_emperor_cgroup_attach(struct uwsgi_instance *, pid_t);
+void uwsgi_emperor_cgroup_del(struct uwsgi_instance *);
+int uwsgi_emperor_cgroup_stats(struct uwsgi_stats *, struct uwsgi_instance *);
+void uwsgi_emperor_cgroup_policy(void);
 
 void uwsgi_register_clock(struct uwsgi_clock *);
 void uwsgi_set_clock(char *name);
@@ -4369,6 +5414,10 @@ void uwsgi_setup_workers(void);
 void uwsgi_map_sockets(void);
 
 void uwsgi_set_cpu_affinity(void);
+void uwsgi_numa_init(void);
+void uwsgi_numa_set_worker_affinity(void);
+void uwsgi_numa_interleave(void *, size_t);
+void uwsgi_numa_steer_reuse_port(int);
 
 void uwsgi_emperor_start(void);
 
@@ -4412,7 +5461,7 @@ ssize_t uwsgi_buffer_write_simple(struct wsgi_request *, struct uwsgi_buffer *);
 
 struct uwsgi_buffer *uwsgi_to_http(struct wsgi_request *, char *, uint16_t, char *, uint16_t);
 struct uwsgi_buffer *uwsgi_to_http_dumb(struct wsgi_request *, char *, uint16_t, char *, uint16_t);
-struct uwsgi_buffer *uwsgi_to_fastcgi(struct wsgi_request *, int);
+struct uwsgi_buffer *uwsgi_to_fastcgi(struct wsgi_request *, int, int);
 int http_status_code(char *buf, int len);
 
 ssize_t uwsgi_pipe(int, int, int);
@@ -4456,7 +5505,20 @@ struct uwsgi_thread {
 	struct uwsgi_offload_request *offload_requests_head;
 	struct uwsgi_offload_request *offload_requests_tail;
 	void (*func) (struct uwsgi_thread *);
+	// io_uring ring of offload threads (when enabled)
+	struct uwsgi_io_uring *io_uring;
 };
+struct uwsgi_io_uring;
+#ifdef UWSGI_IO_URING
+struct uwsgi_io_uring *uwsgi_io_uring_new(uint32_t);
+int uwsgi_io_uring_eventfd(struct uwsgi_io_uring *);
+int uwsgi_io_uring_submit(struct uwsgi_io_uring *);
+int uwsgi_io_uring_send(struct uwsgi_io_uring *, int, char *, size_t, void *);
+int uwsgi_io_uring_splice(struct uwsgi_io_uring *, int, int64_t, int, int64_t, size_t, void *);
+int uwsgi_io_uring_poll(struct uwsgi_io_uring *, int, int, void *);
+int uwsgi_io_uring_complete(struct uwsgi_io_uring *, void **, int32_t *);
+#endif
+
 struct uwsgi_thread *uwsgi_thread_new(void (*)(struct uwsgi_thread *));
 struct uwsgi_thread *uwsgi_thread_new_with_data(void (*)(struct uwsgi_thread *), void *data);
 
@@ -4517,6 +5579,15 @@ struct uwsgi_offload_request {
 
 	void *data;
 	void (*free)(struct uwsgi_offload_request *);
+
+	// pipe used by io_uring splice()
+	int splice_pipe[2];
+
+	// sendfile readahead and pacing
+	off_t prefetched;
+	uint64_t started_at;
+	uint64_t paused_until;
+	int parked;
 };
 
 struct uwsgi_offload_engine {
@@ -4524,6 +5595,8 @@ struct uwsgi_offload_engine {
 	int (*prepare_func)(struct wsgi_request *, struct uwsgi_offload_request *);
 	int (*event_func) (struct uwsgi_thread *, struct uwsgi_offload_request *, int);
 	struct uwsgi_offload_engine *next;	
+	// optional, called with the result of each io_uring request (-1 closes the task)
+	int (*io_uring_func) (struct uwsgi_thread *, struct uwsgi_offload_request *, int32_t);
 };
 
 struct uwsgi_offload_engine *uwsgi_offload_engine_by_name(char *);
@@ -4538,13 +5611,15 @@ int uwsgi_offload_request_sendfile_do(struct wsgi_request *, int, size_t, size_t
 int uwsgi_offload_request_net_do(struct wsgi_request *, char *, struct uwsgi_buffer *);
 int uwsgi_offload_request_memory_do(struct wsgi_request *, char *, size_t);
 int uwsgi_offload_request_pipe_do(struct wsgi_request *, int, size_t);
+int uwsgi_offload_request_http_do(struct wsgi_request *, char *, struct uwsgi_buffer *);
+int uwsgi_offload_request_cache_do(struct wsgi_request *, struct uwsgi_cache *, uint64_t, char *, uint64_t);
 
 int uwsgi_simple_sendfile(struct wsgi_request *, int, size_t, size_t);
 int uwsgi_simple_write(struct wsgi_request *, char *, size_t);
 
 
 void uwsgi_subscription_set_algo(char *);
-struct uwsgi_subscribe_slot **uwsgi_subscription_init_ht(void);
+struct uwsgi_subscriptions *uwsgi_subscription_init_ht(void);
 
 int uwsgi_check_pidfile(char *);
 void uwsgi_daemons_spawn_all();
@@ -4602,6 +5677,7 @@ void uwsgi_uuid(char *);
 int uwsgi_uuid_cmp(char *, char *);
 
 int uwsgi_legion_i_am_the_lord(char *);
+int uwsgi_legion_nodes(char *);
 char *uwsgi_legion_lord_scroll(char *, uint16_t *);
 void uwsgi_additional_header_add(struct wsgi_request *, char *, uint16_t);
 void uwsgi_remove_header(struct wsgi_request *, char *, uint16_t);
@@ -4621,6 +5697,7 @@ struct uwsgi_buffer *uwsgi_websocket_recv(struct wsgi_request *);
 struct uwsgi_buffer *uwsgi_websocket_recv_nb(struct wsgi_request *);
 
 char *uwsgi_chunked_read(struct wsgi_request *, size_t *, int, int);
+char *uwsgi_chunked_read_slice(struct wsgi_request *, size_t *, size_t, int, int);
 struct uwsgi_buffer *uwsgi_chunked_read_smart(struct wsgi_request *, size_t, int);
 
 uint16_t uwsgi_be16(char *);
@@ -4628,6 +5705,11 @@ uint32_t uwsgi_be32(char *);
 uint64_t uwsgi_be64(char *);
 
 int uwsgi_websocket_handshake(struct wsgi_request *, char *, uint16_t, char *, uint16_t, char *, uint16_t);
+int uwsgi_websocket_handshake_prepare(struct wsgi_request *, char *, uint16_t, char *, uint16_t, char *, uint16_t);
+struct uwsgi_buffer *uwsgi_websocket_message(struct wsgi_request *, char *, size_t, uint8_t);
+void uwsgi_websocket_deflate_free(struct wsgi_request *);
+int uwsgi_websocket_publish(char *, uint16_t, char *, size_t, int);
+void uwsgi_websocket_mask(char *, size_t, char *);
 
 int uwsgi_response_prepare_headers(struct wsgi_request *, char *, uint16_t);
 int uwsgi_response_prepare_headers_int(struct wsgi_request *, int);
@@ -4637,6 +5719,8 @@ int uwsgi_response_sendfile_do(struct wsgi_request *, int, size_t, size_t);
 int uwsgi_response_sendfile_do_can_close(struct wsgi_request *, int, size_t, size_t, int);
 
 struct uwsgi_buffer *uwsgi_proto_base_add_header(struct wsgi_request *, char *, uint16_t, char *, uint16_t);
+int uwsgi_proto_base_append_header(struct uwsgi_buffer *, char *, uint16_t, char *, uint16_t);
+int uwsgi_proto_base_append_status(struct wsgi_request *, struct uwsgi_buffer *, int, char *, uint16_t, const char *, uint16_t);
 
 int uwsgi_simple_wait_write_hook(int, int);
 int uwsgi_simple_wait_read_hook(int, int);
@@ -4646,11 +5730,13 @@ int uwsgi_response_write_headers_do(struct wsgi_request *);
 char *uwsgi_request_body_read(struct wsgi_request *, ssize_t , ssize_t *);
 char *uwsgi_request_body_readline(struct wsgi_request *, ssize_t, ssize_t *);
 void uwsgi_request_body_seek(struct wsgi_request *, off_t);
+int uwsgi_request_body_buffer(struct wsgi_request *);
 
 struct uwsgi_buffer *uwsgi_proto_base_prepare_headers(struct wsgi_request *, char *, uint16_t);
 struct uwsgi_buffer *uwsgi_proto_base_cgi_prepare_headers(struct wsgi_request *, char *, uint16_t);
 int uwsgi_response_write_body_do(struct wsgi_request *, char *, size_t);
 int uwsgi_response_writev_body_do(struct wsgi_request *, struct iovec *, size_t);
+int uwsgi_response_headers_finalize(struct wsgi_request *);
 
 int uwsgi_proto_base_sendfile(struct wsgi_request *, int, size_t, size_t);
 #ifdef UWSGI_SSL
@@ -4682,10 +5768,15 @@ void uwsgi_master_manage_emperor(void);
 void uwsgi_master_manage_udp(int);
 
 void uwsgi_threaded_logger_spawn(void);
+void uwsgi_log_async_setup(void);
+void uwsgi_log_async_spawn(void);
 void uwsgi_threaded_logger_worker_spawn(void);
 
 void uwsgi_master_check_idle(void);
 int uwsgi_master_check_workers_deadline(void);
+int uwsgi_master_check_workers_harakiri(time_t);
+void uwsgi_master_deadline_notify(time_t);
+int64_t uwsgi_master_deadline_timeout(void);
 int uwsgi_master_check_gateways_deadline(void);
 int uwsgi_master_check_mules_deadline(void);
 int uwsgi_master_check_spoolers_deadline(void);
@@ -4766,10 +5857,18 @@ struct uwsgi_cache_magic_context {
 
 char *uwsgi_cache_magic_get(char *, uint16_t, uint64_t *, uint64_t *, char *);
 int uwsgi_cache_magic_set(char *, uint16_t, char *, uint64_t, uint64_t, uint64_t, char *);
+uint64_t uwsgi_cache_magic_mget(char **, uint16_t *, char **, uint64_t *, uint64_t, char *);
+uint64_t uwsgi_cache_magic_mset(char **, uint16_t *, char **, uint64_t *, uint64_t, uint64_t, uint64_t, char *);
 int uwsgi_cache_magic_del(char *, uint16_t, char *);
 int uwsgi_cache_magic_exists(char *, uint16_t, char *);
+int uwsgi_cache_magic_num(char *, uint16_t, int64_t *, char *);
 int uwsgi_cache_magic_clear(char *);
 void uwsgi_cache_magic_context_hook(char *, uint16_t, char *, uint16_t, void *);
+struct uwsgi_buffer *uwsgi_cache_prepare_magic_get(char *, uint16_t, char *, uint16_t);
+struct uwsgi_buffer *uwsgi_cache_prepare_magic_exists(char *, uint16_t, char *, uint16_t);
+struct uwsgi_buffer *uwsgi_cache_prepare_magic_del(char *, uint16_t, char *, uint16_t);
+struct uwsgi_buffer *uwsgi_cache_prepare_magic_set(char *, uint16_t, char *, uint16_t, uint64_t, uint64_t);
+struct uwsgi_buffer *uwsgi_cache_prepare_magic_update(char *, uint16_t, char *, uint16_t, uint64_t, uint64_t);
 
 char *uwsgi_legion_scrolls(char *, uint64_t *);
 int uwsgi_emperor_vassal_start(struct uwsgi_instance *);
@@ -4778,7 +5877,10 @@ int uwsgi_emperor_vassal_start(struct uwsgi_instance *);
 #include <zlib.h>
 int uwsgi_deflate_init(z_stream *, char *, size_t);
 int uwsgi_inflate_init(z_stream *, char *, size_t);
+int uwsgi_deflate_init_raw(z_stream *, int);
+int uwsgi_inflate_init_raw(z_stream *);
 char *uwsgi_deflate(z_stream *, char *, size_t, size_t *);
+int uwsgi_deflate_buffer(z_stream *, char *, size_t, struct uwsgi_buffer *);
 void uwsgi_crc32(uint32_t *, char *, size_t);
 struct uwsgi_buffer *uwsgi_gzip(char *, size_t);
 struct uwsgi_buffer *uwsgi_zlib_decompress(char *, size_t);
@@ -4807,6 +5909,9 @@ int uwsgi_apply_transformations(struct wsgi_request *wsgi_req, char *, size_t);
 int uwsgi_apply_final_transformations(struct wsgi_request *);
 void uwsgi_free_transformations(struct wsgi_request *);
 struct uwsgi_transformation *uwsgi_add_transformation(struct wsgi_request *wsgi_req, int (*func)(struct wsgi_request *, struct uwsgi_transformation *), void *);
+void uwsgi_transformation_metrics_register(struct uwsgi_transformation_metrics *, char *, char *);
+void uwsgi_transformation_metrics_add(struct uwsgi_transformation_metrics *, uint64_t, uint64_t, uint64_t);
+struct uwsgi_buffer *uwsgi_transformation_spare(struct wsgi_request *, struct uwsgi_transformation *);
 
 void uwsgi_file_write_do(struct uwsgi_string_list *);
 
@@ -4912,8 +6017,14 @@ enum {
 	UWSGI_METRIC_GAUGE,
 	UWSGI_METRIC_ABSOLUTE,
 	UWSGI_METRIC_ALIAS,
+	UWSGI_METRIC_HISTOGRAM,
 };
 
+// log2 buckets of histogram metrics (the last one is unbounded)
+#define UWSGI_METRIC_HIST_BUCKETS 32
+// int64_t slots in a cacheline
+#define UWSGI_METRIC_SHARD_SLOT 8
+
 struct uwsgi_metric_child;
 
 struct uwsgi_metric_collector {
@@ -4986,6 +6097,18 @@ struct uwsgi_metric {
 
 	// allow to reset metrics after each push
 	uint8_t reset_after_push;
+
+	// histograms: a row (buckets + sum) for each worker (shared memory)
+	uint64_t *histogram;
+
+	// increments not yet folded in the value, a cacheline for each worker (shared memory)
+	int64_t *shards;
+
+	// hash chains of the metrics indexes
+	struct uwsgi_metric *name_next;
+	struct uwsgi_metric *oid_next;
+	struct uwsgi_metric *asn_next;
+	uint8_t indexed;
 };
 
 struct uwsgi_metric_child {
@@ -4995,6 +6118,7 @@ struct uwsgi_metric_child {
 
 void uwsgi_setup_metrics(void);
 void uwsgi_metrics_start_collector(void);
+void uwsgi_send_openmetrics(int);
 
 int uwsgi_metric_set(char *, char *, int64_t);
 int uwsgi_metric_inc(char *, char *, int64_t);
@@ -5005,6 +6129,10 @@ int64_t uwsgi_metric_get(char *, char *);
 int64_t uwsgi_metric_getn(char *, size_t, char *, size_t);
 int uwsgi_metric_set_max(char *, char *, int64_t);
 int uwsgi_metric_set_min(char *, char *, int64_t);
+int uwsgi_metric_observe(char *, char *, int64_t);
+void uwsgi_metric_histogram_add(struct uwsgi_metric *, int64_t);
+void uwsgi_req_latency(struct wsgi_request *, uint64_t *, uint64_t *, uint64_t *, uint64_t *);
+void uwsgi_req_queue_time(struct wsgi_request *);
 
 struct uwsgi_metric_collector *uwsgi_register_metric_collector(char *, int64_t (*)(struct uwsgi_metric *));
 struct uwsgi_metric *uwsgi_register_metric(char *, char *, uint8_t, char *, void *, uint32_t, void *);
@@ -5017,6 +6145,8 @@ struct uwsgi_metric_child *uwsgi_metric_add_child(struct uwsgi_metric *, struct
 struct uwsgi_metric *uwsgi_metric_find_by_oid(char *);
 struct uwsgi_metric *uwsgi_metric_find_by_oidn(char *, size_t);
 struct uwsgi_metric *uwsgi_metric_find_by_asn(char *, size_t);
+struct uwsgi_metric *uwsgi_metric_find_next_by_asn(char *, size_t);
+int uwsgi_metric_asn_cmp(char *, size_t, char *, size_t);
 
 int uwsgi_base128(struct uwsgi_buffer *, uint64_t, int);
 
@@ -5032,6 +6162,11 @@ void uwsgi_sharedareas_init();
 
 struct uwsgi_sharedarea *uwsgi_sharedarea_init(int);
 struct uwsgi_sharedarea *uwsgi_sharedarea_init_ptr(char *, uint64_t);
+int uwsgi_sharedarea_hashmap_init(struct uwsgi_sharedarea *, uint32_t);
+int uwsgi_sharedarea_hashmap_add(int, char *, uint16_t, int64_t, uint64_t, int64_t *);
+int uwsgi_sharedarea_hashmap_set(int, char *, uint16_t, int64_t, uint64_t);
+int uwsgi_sharedarea_hashmap_cas(int, char *, uint16_t, int64_t *, int64_t, uint64_t);
+int uwsgi_sharedarea_hashmap_get(int, char *, uint16_t, int64_t *);
 struct uwsgi_sharedarea *uwsgi_sharedarea_init_fd(int, uint64_t, off_t);
 
 int64_t uwsgi_sharedarea_read(int, uint64_t, char *, uint64_t);
@@ -5053,6 +6188,26 @@ int uwsgi_sharedarea_dec16(int, uint64_t, int16_t);
 int uwsgi_sharedarea_dec32(int, uint64_t, int32_t);
 int uwsgi_sharedarea_dec64(int, uint64_t, int64_t);
 int uwsgi_sharedarea_wait(int, int, int);
+int uwsgi_sharedarea_atomic_add8(int, uint64_t, int8_t, int8_t *);
+int uwsgi_sharedarea_atomic_cas8(int, uint64_t, int8_t *, int8_t);
+int uwsgi_sharedarea_atomic_xchg8(int, uint64_t, int8_t, int8_t *);
+int uwsgi_sharedarea_atomic_load8(int, uint64_t, int8_t *);
+int uwsgi_sharedarea_atomic_add8_bulk(int, uint64_t, int8_t *, uint64_t);
+int uwsgi_sharedarea_atomic_add16(int, uint64_t, int16_t, int16_t *);
+int uwsgi_sharedarea_atomic_cas16(int, uint64_t, int16_t *, int16_t);
+int uwsgi_sharedarea_atomic_xchg16(int, uint64_t, int16_t, int16_t *);
+int uwsgi_sharedarea_atomic_load16(int, uint64_t, int16_t *);
+int uwsgi_sharedarea_atomic_add16_bulk(int, uint64_t, int16_t *, uint64_t);
+int uwsgi_sharedarea_atomic_add32(int, uint64_t, int32_t, int32_t *);
+int uwsgi_sharedarea_atomic_cas32(int, uint64_t, int32_t *, int32_t);
+int uwsgi_sharedarea_atomic_xchg32(int, uint64_t, int32_t, int32_t *);
+int uwsgi_sharedarea_atomic_load32(int, uint64_t, int32_t *);
+int uwsgi_sharedarea_atomic_add32_bulk(int, uint64_t, int32_t *, uint64_t);
+int uwsgi_sharedarea_atomic_add64(int, uint64_t, int64_t, int64_t *);
+int uwsgi_sharedarea_atomic_cas64(int, uint64_t, int64_t *, int64_t);
+int uwsgi_sharedarea_atomic_xchg64(int, uint64_t, int64_t, int64_t *);
+int uwsgi_sharedarea_atomic_load64(int, uint64_t, int64_t *);
+int uwsgi_sharedarea_atomic_add64_bulk(int, uint64_t, int64_t *, uint64_t);
 int uwsgi_sharedarea_unlock(int);
 int uwsgi_sharedarea_rlock(int);
 int uwsgi_sharedarea_wlock(int);
@@ -5089,6 +6244,15 @@ void uwsgi_fork_server(char *);
 void uwsgi_emperor_ini_attrs(char *, char *, struct uwsgi_dyn_dict **);
 
 int uwsgi_buffer_httpdate(struct uwsgi_buffer *, time_t);
+int uwsgi_buffer_msgpack_map(struct uwsgi_buffer *, uint32_t);
+int uwsgi_buffer_msgpack_array(struct uwsgi_buffer *, uint32_t);
+int uwsgi_buffer_msgpack_str(struct uwsgi_buffer *, char *, uint32_t);
+int uwsgi_buffer_msgpack_bin(struct uwsgi_buffer *, char *, uint32_t);
+int uwsgi_buffer_msgpack_int(struct uwsgi_buffer *, int64_t);
+int uwsgi_buffer_msgpack_float(struct uwsgi_buffer *, double);
+int uwsgi_buffer_msgpack_nil(struct uwsgi_buffer *);
+int uwsgi_buffer_msgpack_true(struct uwsgi_buffer *);
+int uwsgi_buffer_msgpack_false(struct uwsgi_buffer *);
 int uwsgi_buffer_append_xml(struct uwsgi_buffer *, char *, size_t);
 
 struct uwsgi_buffer *uwsgi_webdav_multistatus_new();
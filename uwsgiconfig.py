@@ -85,6 +85,7 @@ report = {
     'timer': False,
     'filemonitor': False,
     'pcre': False,
+    'hyperscan': False,
     'routing': False,
     'capabilities': False,
     'yaml': False,
@@ -658,12 +659,12 @@ class uConf(object):
             'core/snmp', 'core/exceptions', 'core/config', 'core/setup_utils',
             'core/clock', 'core/init', 'core/buffer', 'core/reader',
             'core/writer', 'core/alarm', 'core/cron', 'core/hooks',
-            'core/plugins', 'core/lock', 'core/cache', 'core/daemons',
+            'core/plugins', 'core/lock', 'core/cache', 'core/cache_immutable', 'core/memory_stats', 'core/stacks', 'core/daemons', 'core/io_uring',
             'core/errors', 'core/hash', 'core/master_events', 'core/chunked',
             'core/queue', 'core/event', 'core/signal', 'core/strings',
             'core/progress', 'core/timebomb', 'core/ini', 'core/fsmon',
             'core/mount', 'core/metrics', 'core/plugins_builder',
-            'core/sharedarea', 'core/fork_server', 'core/webdav', 'core/zeus',
+            'core/sharedarea', 'core/fork_server', 'core/zygote', 'core/warmup', 'core/admission', 'core/priority', 'core/affinity', 'core/numa', 'core/emperor_cgroup', 'core/timer_wheel', 'core/webdav', 'core/zeus',
             'core/rpc', 'core/gateway', 'core/loop', 'core/cookie',
             'core/querystring', 'core/rb_timers', 'core/transformations',
             'core/uwsgi',
@@ -1066,10 +1067,24 @@ class uConf(object):
 
         report['filemonitor'] = filemonitor_mode
 
+        # io_uring support (used by offload threads)
+        io_uring_mode = self.get('io_uring', 'auto')
+        if io_uring_mode == 'auto':
+            io_uring_mode = 'false'
+            if uwsgi_os == 'Linux' and self.has_include('linux/io_uring.h'):
+                io_uring_mode = 'true'
+
+        if io_uring_mode == 'true':
+            self.cflags.append('-DUWSGI_IO_URING')
+
+        report['io_uring'] = io_uring_mode
+
         if self.get('malloc_implementation') != 'libc':
             if self.get('malloc_implementation') == 'tcmalloc':
+                self.cflags.append('-DUWSGI_TCMALLOC')
                 self.libs.append('-ltcmalloc')
             if self.get('malloc_implementation') == 'jemalloc':
+                self.cflags.append('-DUWSGI_JEMALLOC')
                 self.libs.append('-ljemalloc')
 
         report['malloc'] = self.get('malloc_implementation')
@@ -1124,6 +1139,20 @@ class uConf(object):
         if has_pcre:
             report['pcre'] = True
 
+            # optional multi-pattern backend for routes
+            if self.get('hyperscan'):
+                hsconf = spcall('pkg-config --libs libhs')
+                if hsconf:
+                    self.libs.append(hsconf)
+                    hsconf = spcall('pkg-config --cflags libhs')
+                    if hsconf:
+                        self.cflags.append(hsconf)
+                    self.cflags.append("-DUWSGI_HYPERSCAN")
+                    report['hyperscan'] = True
+                elif self.get('hyperscan') != 'auto':
+                    print("*** libhs headers unavailable. uWSGI build is interrupted. You have to install hyperscan development package or disable hyperscan")
+                    sys.exit(1)
+
         if self.get('routing'):
             if self.get('routing') == 'auto':
                 if has_pcre:
@@ -1312,6 +1341,7 @@ class uConf(object):
                     self.libs.append('-lssl')
                     self.libs.append('-lcrypto')
                     self.gcc_list.append('core/ssl')
+                    self.gcc_list.append('core/ssl_ocsp')
                     self.gcc_list.append('core/legion')
                     report['ssl'] = True
             else:
@@ -1319,6 +1349,7 @@ class uConf(object):
                 self.libs.append('-lssl')
                 self.libs.append('-lcrypto')
                 self.gcc_list.append('core/ssl')
+                self.gcc_list.append('core/ssl_ocsp')
                 self.gcc_list.append('core/legion')
                 report['ssl'] = True
 